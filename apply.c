@@ -13,6 +13,8 @@
 #include "config.h"
 #include "object-store-ll.h"
 #include "blob.h"
+#include "bulk-checkin.h"
+#include "cache-tree.h"
 #include "delta.h"
 #include "diff.h"
 #include "dir.h"
@@ -4841,7 +4843,11 @@ static int apply_patch(struct apply_state *state,
 	}
 
 	if (state->apply) {
-		int write_res = write_out_results(state, list);
+		int write_res;
+
+		begin_odb_transaction();
+		write_res = write_out_results(state, list);
+		end_odb_transaction();
 		if (write_res < 0) {
 			res = -128;
 			goto end;
@@ -5035,6 +5041,15 @@ int apply_all_patches(struct apply_state *state,
 	}
 
 	if (state->update_index) {
+		/*
+		 * A caller that is about to write a tree from the index
+		 * can have it done now, so that the index is written once
+		 * with a valid cache-tree rather than written here and
+		 * again by write_index_as_tree(). Failure, e.g. due to
+		 * conflicts left by --3way, is for that caller to report.
+		 */
+		if (state->update_cache_tree)
+			cache_tree_update(state->repo->index, WRITE_TREE_SILENT);
 		res = write_locked_index(state->repo->index, &state->lock_file, COMMIT_LOCK);
 		if (res) {
 			error(_("Unable to write new index file"));
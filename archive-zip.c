@@ -8,6 +8,7 @@
 #include "git-zlib.h"
 #include "hex.h"
 #include "streaming.h"
+#include "thread-utils.h"
 #include "utf8.h"
 #include "object-store-ll.h"
 #include "userdiff.h"
@@ -26,6 +27,8 @@ static uint64_t zip_dir_entries;
 
 static unsigned int max_creator_version;
 
+static int zip_threads;
+
 #define ZIP_STREAM	(1 <<  3)
 #define ZIP_UTF8	(1 << 11)
 
@@ -287,11 +290,33 @@ static int entry_is_binary(struct index_state *istate, const char *path,
 
 #define STREAM_BUFFER_SIZE (1024 * 16)
 
-static int write_zip_entry(struct archiver_args *args,
-			   const struct object_id *oid,
-			   const char *path, size_t pathlen,
-			   unsigned int mode,
-			   void *buffer, unsigned long size)
+/*
+ * An entry whose contents are deflated by a worker thread, while the
+ * entries before it are still being written.
+ */
+struct zip_job {
+	struct object_id oid;
+	char *path;
+	size_t pathlen;
+	unsigned int mode;
+	void *buffer;
+	unsigned long size;
+	int is_binary;
+	unsigned deflate : 1;
+
+	/* Set by the worker. */
+	unsigned long crc;
+	void *deflated;
+	unsigned long compressed_size;
+	int done;
+};
+
+static int write_zip_entry_1(struct archiver_args *args,
+			     const struct object_id *oid,
+			     const char *path, size_t pathlen,
+			     unsigned int mode,
+			     void *buffer, unsigned long size,
+			     struct zip_job *job)
 {
 	struct zip_local_header header;
 	uintmax_t offset = zip_offset;
@@ -351,6 +376,10 @@ static int write_zip_entry(struct archiver_args *args,
 					     oid_to_hex(oid));
 			flags |= ZIP_STREAM;
 			out = NULL;
+		} else if (job) {
+			crc = job->crc;
+			is_binary = job->is_binary;
+			out = buffer;
 		} else {
 			crc = crc32(crc, buffer, size);
 			is_binary = entry_is_binary(args->repo->index,
@@ -368,9 +397,15 @@ static int write_zip_entry(struct archiver_args *args,
 		max_creator_version = creator_version;
 
 	if (buffer && method == ZIP_METHOD_DEFLATE) {
-		out = deflated = zlib_deflate_raw(buffer, size,
-						  args->compression_level,
-						  &compressed_size);
+		if (job) {
+			out = deflated = job->deflated;
+			compressed_size = job->compressed_size;
+			job->deflated = NULL;
+		} else {
+			out = deflated = zlib_deflate_raw(buffer, size,
+							  args->compression_level,
+							  &compressed_size);
+		}
 		if (!out || compressed_size >= size) {
 			out = buffer;
 			method = ZIP_METHOD_STORE;
@@ -551,6 +586,205 @@ static int write_zip_entry(struct archiver_args *args,
 	return 0;
 }
 
+/* Do not hold more than this many bytes of blobs waiting to be written. */
+#define ZIP_MAX_PENDING (64 * 1024 * 1024)
+
+/*
+ * The jobs are kept in a ring in the order of the archive. Workers
+ * take them from "next" on, and the main thread writes them out from
+ * "first" on once they are done. Both count up from 0 and are taken
+ * modulo "alloc".
+ */
+static struct zip_pool {
+	pthread_t *threads;
+	int nr_threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct zip_job *jobs;
+	size_t alloc, first, nr, next;
+	unsigned long pending_bytes;
+	int compression_level;
+	int stop;
+} pool;
+
+static void *zip_worker(void *data UNUSED)
+{
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		struct zip_job *job;
+
+		while (!pool.stop && pool.next == pool.first + pool.nr)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+		if (pool.next == pool.first + pool.nr)
+			break;
+		job = &pool.jobs[pool.next++ % pool.alloc];
+		if (job->done)
+			continue;
+		pthread_mutex_unlock(&pool.mutex);
+
+		job->crc = crc32(crc32(0, NULL, 0), job->buffer, job->size);
+		job->deflated = zlib_deflate_raw(job->buffer, job->size,
+						 pool.compression_level,
+						 &job->compressed_size);
+
+		pthread_mutex_lock(&pool.mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&pool.cond);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return NULL;
+}
+
+static void start_zip_workers(struct archiver_args *args, int nr_threads)
+{
+	int i;
+
+	pool.nr_threads = nr_threads;
+	pool.alloc = 16 * nr_threads;
+	CALLOC_ARRAY(pool.jobs, pool.alloc);
+	pool.compression_level = args->compression_level;
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	CALLOC_ARRAY(pool.threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&pool.threads[i], NULL,
+					 zip_worker, NULL);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+static void clear_zip_job(struct zip_job *job)
+{
+	free(job->path);
+	free(job->buffer);
+	free(job->deflated);
+	memset(job, 0, sizeof(*job));
+}
+
+/*
+ * Write out the oldest job, waiting for it to be done unless "wait"
+ * is 0. Return 1 if there was none to write.
+ */
+static int write_zip_job(struct archiver_args *args, int wait, int *err)
+{
+	struct zip_job *job;
+
+	pthread_mutex_lock(&pool.mutex);
+	job = &pool.jobs[pool.first % pool.alloc];
+	if (!pool.nr || (!wait && !job->done)) {
+		pthread_mutex_unlock(&pool.mutex);
+		return 1;
+	}
+	while (!job->done)
+		pthread_cond_wait(&pool.cond, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (!*err)
+		*err = write_zip_entry_1(args, &job->oid, job->path,
+					 job->pathlen, job->mode,
+					 job->buffer, job->size,
+					 job->deflate ? job : NULL);
+
+	pthread_mutex_lock(&pool.mutex);
+	if (job->buffer)
+		pool.pending_bytes -= job->size;
+	clear_zip_job(job);
+	pool.first++;
+	pool.nr--;
+	/* The workers need not look at jobs that were done from the start. */
+	if (pool.next < pool.first)
+		pool.next = pool.first;
+	pthread_mutex_unlock(&pool.mutex);
+	return 0;
+}
+
+static int write_zip_jobs(struct archiver_args *args)
+{
+	int err = 0;
+
+	if (pool.nr_threads)
+		while (!write_zip_job(args, 1, &err))
+			; /* nothing */
+	return err;
+}
+
+static void stop_zip_workers(void)
+{
+	int i;
+
+	if (!pool.nr_threads)
+		return;
+	pthread_mutex_lock(&pool.mutex);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+	for (i = 0; i < pool.nr_threads; i++)
+		pthread_join(pool.threads[i], NULL);
+	for (; pool.nr; pool.nr--)
+		clear_zip_job(&pool.jobs[pool.first++ % pool.alloc]);
+	pthread_mutex_destroy(&pool.mutex);
+	pthread_cond_destroy(&pool.cond);
+	free(pool.threads);
+	free(pool.jobs);
+	memset(&pool, 0, sizeof(pool));
+}
+
+static int write_zip_entry(struct archiver_args *args,
+			   const struct object_id *oid,
+			   const char *path, size_t pathlen,
+			   unsigned int mode,
+			   void *buffer, unsigned long size)
+{
+	struct zip_job *job;
+	int err = 0;
+
+	if (!pool.nr_threads)
+		return write_zip_entry_1(args, oid, path, pathlen, mode,
+					 buffer, size, NULL);
+
+	while (!write_zip_job(args, 0, &err))
+		; /* write what is done already */
+	while (pool.nr == pool.alloc ||
+	       (pool.nr && buffer &&
+		pool.pending_bytes + size > ZIP_MAX_PENDING))
+		write_zip_job(args, 1, &err);
+	if (err)
+		return err;
+
+	/* The workers do not look at the job until it is counted in. */
+	job = &pool.jobs[(pool.first + pool.nr) % pool.alloc];
+	oidcpy(&job->oid, oid);
+	job->path = xmemdupz(path, pathlen);
+	job->pathlen = pathlen;
+	job->mode = mode;
+	job->size = size;
+	if (buffer)
+		job->buffer = xmemdupz(buffer, size);
+
+	/*
+	 * Only regular files that are deflated in one go are handed to
+	 * the workers. Others, like blobs streamed from the object
+	 * database, are simply written in their turn.
+	 */
+	if (buffer && S_ISREG(mode) && size && pathlen <= 0xffff) {
+		job->deflate = 1;
+		job->is_binary = entry_is_binary(args->repo->index,
+						 path + args->baselen,
+						 buffer, size);
+	} else {
+		job->done = 1;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.nr++;
+	if (job->buffer)
+		pool.pending_bytes += job->size;
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+	return 0;
+}
+
 static void write_zip64_trailer(void)
 {
 	struct zip64_dir_trailer trailer64;
@@ -617,9 +851,16 @@ static void dos_time(timestamp_t *timestamp, int *dos_date, int *dos_time)
 }
 
 static int archive_zip_config(const char *var, const char *value,
-			      const struct config_context *ctx UNUSED,
+			      const struct config_context *ctx,
 			      void *data UNUSED)
 {
+	if (!strcmp(var, "zip.threads")) {
+		zip_threads = git_config_int(var, value, ctx->kvi);
+		if (zip_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    zip_threads, var);
+		return 0;
+	}
 	return userdiff_config(var, value);
 }
 
@@ -634,7 +875,15 @@ static int write_zip_archive(const struct archiver *ar UNUSED,
 
 	strbuf_init(&zip_dir, 0);
 
+	if (!zip_threads)
+		zip_threads = online_cpus();
+	if (HAVE_THREADS && zip_threads > 1 && args->compression_level)
+		start_zip_workers(args, zip_threads);
+
 	err = write_archive_entries(args, write_zip_entry);
+	if (!err)
+		err = write_zip_jobs(args);
+	stop_zip_workers();
 	if (!err)
 		write_zip_trailer(args->commit_oid);
 
@@ -9,6 +9,7 @@
 #include "pretty.h"
 #include "setup.h"
 #include "refs.h"
+#include "object-file.h"
 #include "object-store-ll.h"
 #include "commit.h"
 #include "tree.h"
@@ -19,6 +20,10 @@
 #include "unpack-trees.h"
 #include "dir.h"
 #include "quote.h"
+#include "copy.h"
+#include "date.h"
+#include "tempfile.h"
+#include "trace2.h"
 
 static char const * const archive_usage[] = {
 	N_("git archive [<options>] <tree-ish> [<path>...]"),
@@ -174,6 +179,8 @@ static int write_archive_entry(const struct object_id *oid, const char *base,
 		if (check_attr_export_ignore(check))
 			return 0;
 		args->convert = check_attr_export_subst(check);
+		if (args->convert)
+			args->substituted = 1;
 	}
 
 	if (args->prefix) {
@@ -723,6 +730,221 @@ static int parse_archive_args(int argc, const char **argv,
 	return argc;
 }
 
+static char *archive_cache_dir(void)
+{
+	const char *dir;
+
+	if (!git_config_get_value("archive.cachedir", &dir) && dir)
+		return interpolate_path(dir, 0);
+	return git_pathdup("archive-cache");
+}
+
+static int add_cache_key_config(const char *var, const char *value,
+				const struct config_context *ctx UNUSED,
+				void *data)
+{
+	struct strbuf *key = data;
+
+	if (!strcmp(var, "core.autocrlf") || !strcmp(var, "core.eol") ||
+	    !strcmp(var, "core.bigfilethreshold") ||
+	    !strcmp(var, "core.attributesfile") ||
+	    starts_with(var, "filter.") || starts_with(var, "diff.") ||
+	    starts_with(var, "tar."))
+		strbuf_addf(key, "config %s=%s\n", var, value ? value : "");
+	return 0;
+}
+
+static void add_cache_key_file(struct strbuf *key, const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id oid;
+
+	if (!path || strbuf_read_file(&buf, path, 0) < 0)
+		return;
+	hash_object_file(the_hash_algo, buf.buf, buf.len, OBJ_BLOB, &oid);
+	strbuf_addf(key, "file %s %s\n", path, oid_to_hex(&oid));
+	strbuf_release(&buf);
+}
+
+/*
+ * Describe everything that the archive depends on besides the tree: the
+ * options, the configuration that changes the contents of files and the
+ * attributes that do not come from the tree itself. Return -1 if the
+ * archive cannot be cached.
+ */
+static int archive_cache_key(const struct archiver *ar,
+			     struct archiver_args *args,
+			     struct strbuf *out)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct object_id oid;
+	int i;
+
+	if (args->worktree_attributes || args->extra_files.nr ||
+	    (!args->commit && !args->mtime_option))
+		return -1;
+
+	strbuf_addf(&key, "tree %s\n", oid_to_hex(&args->tree->object.oid));
+	if (args->commit_oid)
+		strbuf_addf(&key, "commit %s\n", oid_to_hex(args->commit_oid));
+	strbuf_addf(&key, "time %"PRItime"\n", args->time);
+	strbuf_addf(&key, "format %s\n", ar->name);
+	strbuf_addf(&key, "level %d\n", args->compression_level);
+	strbuf_addf(&key, "base %s\n", args->base);
+	strbuf_addf(&key, "prefix %s\n", args->prefix ? args->prefix : "");
+	strbuf_addf(&key, "refname %s\n", args->refname ? args->refname : "");
+	for (i = 0; i < args->pathspec.nr; i++)
+		strbuf_addf(&key, "pathspec %s\n",
+			    args->pathspec.items[i].original);
+	git_config(add_cache_key_config, &key);
+	add_cache_key_file(&key, git_path("info/attributes"));
+	add_cache_key_file(&key, git_attr_global_file());
+	if (git_attr_system_is_enabled())
+		add_cache_key_file(&key, git_attr_system_file());
+
+	hash_object_file(the_hash_algo, key.buf, key.len, OBJ_BLOB, &oid);
+	strbuf_addf(out, "%s.%s", oid_to_hex(&oid), ar->name);
+	strbuf_release(&key);
+	return 0;
+}
+
+/*
+ * Serve the archive from the cache, or write it to the cache first. Archives
+ * with files run through export-subst are not kept, because what is
+ * substituted can depend on refs, like "%d".
+ */
+static int write_cached_archive(const struct archiver *ar,
+				struct archiver_args *args,
+				const char *key)
+{
+	char *dir = archive_cache_dir();
+	char *path = xstrfmt("%s/%s", dir, key);
+	char *template;
+	struct tempfile *tmp;
+	int fd, saved_stdout, rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		trace2_data_string("archive", args->repo, "cache", "hit");
+		/* The time of the last use decides what is evicted. */
+		utime(path, NULL);
+		rc = copy_fd(fd, 1);
+		close(fd);
+		free(path);
+		free(dir);
+		return rc ? error(_("unable to copy '%s'"), key) : 0;
+	}
+	trace2_data_string("archive", args->repo, "cache", "miss");
+
+	template = xstrfmt("%s/tmp_archive_XXXXXX", dir);
+	if (safe_create_leading_directories_const(template) ||
+	    !(tmp = mks_tempfile(template))) {
+		warning_errno(_("unable to write to the archive cache '%s'"), dir);
+		rc = ar->write_archive(ar, args);
+		goto out;
+	}
+
+	saved_stdout = xdup(1);
+	if (dup2(get_tempfile_fd(tmp), 1) < 0)
+		die_errno(_("could not redirect output"));
+	rc = ar->write_archive(ar, args);
+	if (dup2(saved_stdout, 1) < 0)
+		die_errno(_("could not redirect output"));
+	close(saved_stdout);
+
+	if (!rc) {
+		fd = xopen(get_tempfile_path(tmp), O_RDONLY);
+		if (copy_fd(fd, 1))
+			rc = error(_("unable to copy '%s'"), key);
+		close(fd);
+	}
+	if (rc || args->substituted)
+		delete_tempfile(&tmp);
+	else if (rename_tempfile(&tmp, path))
+		warning_errno(_("unable to write to the archive cache '%s'"), dir);
+
+out:
+	free(template);
+	free(path);
+	free(dir);
+	return rc;
+}
+
+struct cached_archive {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static int compare_cached_archives(const void *a_, const void *b_)
+{
+	const struct cached_archive *a = a_, *b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+int expire_archive_cache(struct repository *r UNUSED)
+{
+	char *dir = archive_cache_dir();
+	const char *expiry = "1.week.ago";
+	timestamp_t expire;
+	unsigned long max_size = 0;
+	struct cached_archive *files = NULL;
+	size_t nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	struct dirent *de;
+	DIR *d;
+
+	git_config_get_expiry("archive.cacheexpiry", &expiry);
+	if (parse_expiry_date(expiry, &expire)) {
+		free(dir);
+		return error(_("invalid archive.cacheExpiry: '%s'"), expiry);
+	}
+	git_config_get_ulong("archive.cachemaxsize", &max_size);
+
+	d = opendir(dir);
+	if (!d) {
+		free(dir);
+		return 0;
+	}
+
+	/* Remove what was not used lately, and keep the size of the rest. */
+	while ((de = readdir_skip_dot_and_dotdot(d))) {
+		char *path = xstrfmt("%s/%s", dir, de->d_name);
+		struct stat st;
+
+		if (lstat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+		} else if (st.st_mtime <= expire) {
+			unlink_or_warn(path);
+			free(path);
+		} else {
+			ALLOC_GROW(files, nr + 1, alloc);
+			files[nr].path = path;
+			files[nr].size = st.st_size;
+			files[nr].mtime = st.st_mtime;
+			total += st.st_size;
+			nr++;
+		}
+	}
+	closedir(d);
+
+	/* Then remove the least recently used ones until the rest fit. */
+	QSORT(files, nr, compare_cached_archives);
+	for (i = 0; i < nr; i++) {
+		if (max_size && total > max_size) {
+			unlink_or_warn(files[i].path);
+			total -= files[i].size;
+		}
+		free(files[i].path);
+	}
+	free(files);
+	free(dir);
+	return 0;
+}
+
 int write_archive(int argc, const char **argv, const char *prefix,
 		  struct repository *repo,
 		  const char *name_hint, int remote)
@@ -731,6 +953,8 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	struct pretty_print_describe_status describe_status = {0};
 	struct pretty_print_context ctx = {0};
 	struct archiver_args args;
+	struct strbuf cache_key = STRBUF_INIT;
+	int use_cache = 0;
 	int rc;
 
 	git_config_get_bool("uploadarchive.allowunreachable", &remote_allow_unreachable);
@@ -743,6 +967,7 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	args.pretty_ctx = &ctx;
 	args.repo = repo;
 	args.prefix = prefix;
+	args.substituted = 0;
 	string_list_init_dup(&args.extra_files);
 	argc = parse_archive_args(argc, argv, &ar, &args, name_hint, remote);
 	if (!startup_info->have_repository) {
@@ -757,7 +982,12 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	parse_treeish_arg(argv, &args, remote);
 	parse_pathspec_arg(argv + 1, &args);
 
-	rc = ar->write_archive(ar, &args);
+	git_config_get_bool("archive.cache", &use_cache);
+	if (use_cache && !archive_cache_key(ar, &args, &cache_key))
+		rc = write_cached_archive(ar, &args, cache_key.buf);
+	else
+		rc = ar->write_archive(ar, &args);
+	strbuf_release(&cache_key);
 
 	string_list_clear_func(&args.extra_files, extra_file_info_clear);
 	free(args.refname);
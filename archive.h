@@ -23,6 +23,8 @@ struct archiver_args {
 	unsigned int verbose : 1;
 	unsigned int worktree_attributes : 1;
 	unsigned int convert : 1;
+	/* Whether any file was run through export-subst. */
+	unsigned int substituted : 1;
 	int compression_level;
 	struct string_list extra_files;
 	struct pretty_print_context *pretty_ctx;
@@ -36,6 +38,13 @@ int write_archive(int argc, const char **argv, const char *prefix,
 
 const char *archive_format_from_filename(const char *filename);
 
+/*
+ * Remove the archives that were not used for archive.cacheExpiry from
+ * the cache of archive.cache, and then the least recently used ones
+ * until the rest fit into archive.cacheMaxSize.
+ */
+int expire_archive_cache(struct repository *r);
+
 /* archive backend stuff */
 
 #define ARCHIVER_WANT_COMPRESSION_LEVELS 1
@@ -457,8 +457,164 @@ struct attr_stack {
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
+	struct attr_matcher *matcher;
 };
 
+/*
+ * Indices into attr_stack->attrs of the patterns that may match a
+ * path, in increasing order.
+ */
+struct attr_match_list {
+	unsigned *idx;
+	unsigned nr, alloc;
+};
+
+/* Patterns that match a basename, or an extension, by its name. */
+struct attr_name_entry {
+	struct hashmap_entry ent;
+	const char *name;
+	size_t len;
+	struct attr_match_list matches;
+};
+
+/*
+ * The patterns of one attr_stack, compiled by compile_attr_stack() the
+ * first time a path is checked against it.  Patterns that are a plain
+ * basename, like "Makefile", or "*" followed by an extension, like
+ * "*.c", are looked up by the basename or the extension of the path
+ * instead of being tried one by one; only the rest are matched.
+ *
+ * Of the rest, the ones that match the full path, like "doc/git-*.txt",
+ * cannot match anything in most directories because of the literal
+ * prefix they start with.  The ones that can match a path in the
+ * directory the last path was in are kept in "dir_matches", so that
+ * all the paths in a directory are checked against those only.
+ */
+struct attr_matcher {
+	struct hashmap names;
+	struct hashmap exts;
+	struct attr_match_list others;
+
+	struct strbuf dir;
+	int dir_valid;
+	struct attr_match_list dir_matches;
+};
+
+static void attr_match_list_add(struct attr_match_list *list, unsigned nr)
+{
+	ALLOC_GROW(list->idx, list->nr + 1, list->alloc);
+	list->idx[list->nr++] = nr;
+}
+
+static int attr_name_entry_cmp(const void *cmp_data UNUSED,
+			       const struct hashmap_entry *eptr,
+			       const struct hashmap_entry *entry_or_key,
+			       const void *keydata UNUSED)
+{
+	const struct attr_name_entry *a, *b;
+
+	a = container_of(eptr, const struct attr_name_entry, ent);
+	b = container_of(entry_or_key, const struct attr_name_entry, ent);
+	return a->len != b->len || fspathncmp(a->name, b->name, a->len);
+}
+
+static unsigned int attr_name_hash(const char *name, size_t len)
+{
+	return ignore_case ? memihash(name, len) : memhash(name, len);
+}
+
+static struct attr_match_list *attr_name_lookup(struct hashmap *map,
+						const char *name, size_t len)
+{
+	struct attr_name_entry key, *e;
+
+	hashmap_entry_init(&key.ent, attr_name_hash(name, len));
+	key.name = name;
+	key.len = len;
+	e = hashmap_get_entry(map, &key, ent, NULL);
+	return e ? &e->matches : NULL;
+}
+
+static void attr_name_add(struct hashmap *map, const char *name, size_t len,
+			  unsigned nr)
+{
+	struct attr_match_list *list = attr_name_lookup(map, name, len);
+
+	if (!list) {
+		struct attr_name_entry *e;
+
+		CALLOC_ARRAY(e, 1);
+		hashmap_entry_init(&e->ent, attr_name_hash(name, len));
+		e->name = name;
+		e->len = len;
+		hashmap_add(map, &e->ent);
+		list = &e->matches;
+	}
+	attr_match_list_add(list, nr);
+}
+
+static void attr_name_map_clear(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct attr_name_entry *e;
+
+	hashmap_for_each_entry(map, &iter, e, ent)
+		free(e->matches.idx);
+	hashmap_clear_and_free(map, struct attr_name_entry, ent);
+}
+
+static void compile_attr_stack(struct attr_stack *e)
+{
+	struct attr_matcher *m;
+	unsigned i;
+
+	CALLOC_ARRAY(m, 1);
+	hashmap_init(&m->names, attr_name_entry_cmp, NULL, 0);
+	hashmap_init(&m->exts, attr_name_entry_cmp, NULL, 0);
+	strbuf_init(&m->dir, 0);
+
+	for (i = 0; i < e->num_matches; i++) {
+		const struct match_attr *a = e->attrs[i];
+		const struct pattern *pat = &a->u.pat;
+
+		if (a->is_macro)
+			continue;
+		if ((pat->flags & PATTERN_FLAG_NODIR) &&
+		    !(pat->flags & PATTERN_FLAG_MUSTBEDIR)) {
+			if (pat->nowildcardlen == pat->patternlen) {
+				attr_name_add(&m->names, pat->pattern,
+					      pat->patternlen, i);
+				continue;
+			}
+			/*
+			 * "*.ext" matches exactly the basenames whose
+			 * extension, from their last ".", is ".ext".
+			 */
+			if ((pat->flags & PATTERN_FLAG_ENDSWITH) &&
+			    pat->pattern[1] == '.' &&
+			    !memchr(pat->pattern + 2, '.', pat->patternlen - 2)) {
+				attr_name_add(&m->exts, pat->pattern + 1,
+					      pat->patternlen - 1, i);
+				continue;
+			}
+		}
+		attr_match_list_add(&m->others, i);
+	}
+	e->matcher = m;
+}
+
+static void attr_matcher_free(struct attr_matcher *m)
+{
+	if (!m)
+		return;
+	attr_name_map_clear(&m->names);
+	attr_name_map_clear(&m->exts);
+	free(m->others.idx);
+	strbuf_release(&m->dir);
+	free(m->dir_matches.idx);
+	free(m);
+}
+
 static void attr_stack_free(struct attr_stack *e)
 {
 	unsigned i;
@@ -480,6 +636,7 @@ static void attr_stack_free(struct attr_stack *e)
 		free(a);
 	}
 	free(e->attrs);
+	attr_matcher_free(e->matcher);
 	free(e);
 }
 
@@ -1108,18 +1265,105 @@ static int fill_one(struct all_attrs_item *all_attrs,
 	return rem;
 }
 
+/*
+ * Return the patterns of "stack" that match the full path and may match
+ * a path in the directory path[0..dirlen), or the basename of a path
+ * in any directory.
+ */
+static const struct attr_match_list *dir_matches(struct attr_stack *stack,
+						 const char *path, int dirlen)
+{
+	struct attr_matcher *m = stack->matcher;
+	const char *dir = path;
+	int len = dirlen;
+	unsigned i;
+
+	if (m->dir_valid && m->dir.len == dirlen &&
+	    !memcmp(m->dir.buf, path, dirlen))
+		return &m->dir_matches;
+
+	strbuf_reset(&m->dir);
+	strbuf_add(&m->dir, path, dirlen);
+	m->dir_matches.nr = 0;
+	m->dir_valid = 1;
+
+	/* The directory relative to the one of the .gitattributes file */
+	if (stack->origin && stack->originlen) {
+		int skip = stack->originlen + 1;
+
+		dir += skip < dirlen ? skip : dirlen;
+		len = skip < dirlen ? dirlen - skip : 0;
+	}
+
+	for (i = 0; i < m->others.nr; i++) {
+		const struct pattern *pat = &stack->attrs[m->others.idx[i]]->u.pat;
+		const char *prefix = pat->pattern;
+		int prefixlen = pat->nowildcardlen;
+
+		if (!(pat->flags & PATTERN_FLAG_NODIR) && len) {
+			if (*prefix == '/') {
+				prefix++;
+				prefixlen--;
+			}
+			/* match_pathname() compares the prefix first. */
+			if (fspathncmp(prefix, dir,
+				       prefixlen < len ? prefixlen : len) ||
+			    (prefixlen > len && prefix[len] != '/'))
+				continue;
+		}
+		attr_match_list_add(&m->dir_matches, m->others.idx[i]);
+	}
+	return &m->dir_matches;
+}
+
 static int fill(const char *path, int pathlen, int basename_offset,
-		const struct attr_stack *stack,
+		struct attr_stack *stack,
 		struct all_attrs_item *all_attrs, int rem)
 {
+	int isdir = (pathlen && path[pathlen - 1] == '/');
+	const char *name = path + basename_offset;
+	int namelen = pathlen - basename_offset - isdir;
+	int extlen;
+
+	for (extlen = 1; extlen <= namelen; extlen++)
+		if (name[namelen - extlen] == '.')
+			break;
+	if (extlen > namelen)
+		extlen = 0;
+
 	for (; rem > 0 && stack; stack = stack->prev) {
-		unsigned i;
 		const char *base = stack->origin ? stack->origin : "";
-
-		for (i = stack->num_matches; 0 < rem && 0 < i; i--) {
-			const struct match_attr *a = stack->attrs[i - 1];
-			if (a->is_macro)
-				continue;
+		const struct attr_match_list *lists[3];
+		unsigned pos[3];
+		int i;
+
+		if (!stack->matcher)
+			compile_attr_stack(stack);
+		lists[0] = attr_name_lookup(&stack->matcher->names,
+					    name, namelen);
+		lists[1] = extlen ? attr_name_lookup(&stack->matcher->exts,
+						     name + namelen - extlen,
+						     extlen) : NULL;
+		lists[2] = dir_matches(stack, path,
+				       basename_offset ? basename_offset - 1 : 0);
+		for (i = 0; i < ARRAY_SIZE(lists); i++)
+			pos[i] = lists[i] ? lists[i]->nr : 0;
+
+		/* Later patterns override earlier ones. */
+		while (rem > 0) {
+			const struct match_attr *a;
+			int best = -1;
+
+			for (i = 0; i < ARRAY_SIZE(lists); i++)
+				if (pos[i] &&
+				    (best < 0 ||
+				     lists[i]->idx[pos[i] - 1] >
+				     lists[best]->idx[pos[best] - 1]))
+					best = i;
+			if (best < 0)
+				break;
+
+			a = stack->attrs[lists[best]->idx[--pos[best]]];
 			if (path_matches(path, pathlen, basename_offset,
 					 &a->u.pat, base, stack->originlen))
 				rem = fill_one(all_attrs, a, rem);
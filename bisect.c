@@ -17,6 +17,8 @@
 #include "strvec.h"
 #include "commit-slab.h"
 #include "commit-reach.h"
+#include "commit-graph.h"
+#include "prio-queue.h"
 #include "object-name.h"
 #include "object-store-ll.h"
 #include "path.h"
@@ -32,6 +34,8 @@ static const char *term_good;
 
 /* Remember to update object flag allocation in object.h */
 #define COUNTED		(1u<<16)
+#define FROM_BASE	(1u<<17)
+#define FROM_OTHER	(1u<<18)
 
 /*
  * This is a truly stupid algorithm, but it's only
@@ -91,6 +95,125 @@ static inline void weight_set(struct commit_list *elem, int weight)
 	**commit_weight_at(&commit_weight, elem->item) = weight;
 }
 
+/*
+ * Return the weight of "commit" by following the strand of pearls it
+ * is on down to a commit whose weight is known, or -1 if that is a
+ * merge which is yet to be counted (or a commit not on the list).
+ */
+static int strand_weight(struct commit *commit)
+{
+	int nr = 0;
+
+	for (;;) {
+		struct commit_list *p;
+		int **w;
+
+		if (commit->object.flags & UNINTERESTING)
+			return nr;
+		w = commit_weight_peek(&commit_weight, commit);
+		if (!w || !*w || **w < -1)
+			return -1;
+		if (**w >= 0)
+			return nr + **w;
+		if (!(commit->object.flags & TREESAME))
+			nr++;
+		for (p = commit->parents; p; p = p->next)
+			if (!(p->item->object.flags & UNINTERESTING))
+				break;
+		commit = p->item;
+	}
+}
+
+static void paint(struct prio_queue *queue, struct commit *commit,
+		  unsigned flags, int *other_only)
+{
+	unsigned old = commit->object.flags & (FROM_BASE | FROM_OTHER);
+
+	if (commit->object.flags & UNINTERESTING || (old | flags) == old)
+		return;
+	if (!old)
+		prio_queue_put(queue, commit);
+	if ((old | flags) == FROM_OTHER)
+		(*other_only)++;
+	else if (old == FROM_OTHER)
+		(*other_only)--;
+	commit->object.flags |= flags;
+}
+
+/*
+ * Count the tree-changing commits that the parents of "merge" other
+ * than "base" reach, but "base" does not.
+ *
+ * The walk goes in generation number order, so that by the time a commit
+ * is taken off the queue, all of its descendants that "base" reaches have
+ * painted it. It stops as soon as only commits that "base" reaches are
+ * left in the queue, i.e. at the point where the other parents forked off,
+ * instead of going all the way down like count_distance() does.
+ */
+static int count_not_in_base(struct commit *merge, struct commit *base)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct commit_list *p;
+	int other_only = 0, nr = 0;
+
+	paint(&queue, base, FROM_BASE, &other_only);
+	for (p = merge->parents; p; p = p->next)
+		paint(&queue, p->item, FROM_OTHER, &other_only);
+
+	while (other_only) {
+		struct commit *commit = prio_queue_get(&queue);
+		unsigned flags = commit->object.flags & (FROM_BASE | FROM_OTHER);
+
+		if (flags == FROM_OTHER) {
+			other_only--;
+			if (!(commit->object.flags & TREESAME))
+				nr++;
+		}
+		for (p = commit->parents; p; p = p->next)
+			paint(&queue, p->item, flags, &other_only);
+	}
+
+	clear_prio_queue(&queue);
+	for (p = merge->parents; p; p = p->next)
+		clear_commit_marks(p->item, FROM_BASE | FROM_OTHER);
+	return nr;
+}
+
+/*
+ * Count the distance of a merge from the weight of its first interesting
+ * parent, plus the commits that only its other parents reach. Returns -1
+ * if the weight of that parent cannot be had cheaply.
+ */
+static int count_merge_distance(struct commit *merge)
+{
+	struct commit_list *p;
+	int nr;
+
+	for (p = merge->parents; p; p = p->next)
+		if (!(p->item->object.flags & UNINTERESTING))
+			break;
+	nr = strand_weight(p->item);
+	if (nr < 0)
+		return -1;
+	if (!(merge->object.flags & TREESAME))
+		nr++;
+	return nr + count_not_in_base(merge, p->item);
+}
+
+/*
+ * count_merge_distance() needs a generation number for every commit
+ * it may walk over, i.e. all of them need to be in the commit-graph.
+ */
+static int can_count_by_generation(struct commit_list *list)
+{
+	if (!generation_numbers_enabled(the_repository))
+		return 0;
+	for (; list; list = list->next)
+		if (commit_graph_generation(list->item) == GENERATION_NUMBER_INFINITY)
+			return 0;
+	return 1;
+}
+
 static int count_interesting_parents(struct commit *commit, unsigned bisect_flags)
 {
 	struct commit_list *p;
@@ -277,7 +400,7 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 					     int nr, int *weights,
 					     unsigned bisect_flags)
 {
-	int n, counted;
+	int n, counted, by_generation;
 	struct commit_list *p;
 
 	counted = 0;
@@ -324,16 +447,30 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 	 *
 	 * So we will first count distance of merges the usual
 	 * way, and then fill the blanks using cheaper algorithm.
+	 *
+	 * With generation numbers, a merge whose first parent's
+	 * weight follows from the merges counted before it only
+	 * needs to count what its other parents add to that. The
+	 * list has older commits first, so that is the usual case.
 	 */
+	by_generation = !(bisect_flags & FIND_BISECTION_FIRST_PARENT_ONLY) &&
+			can_count_by_generation(list);
 	for (p = list; p; p = p->next) {
+		int distance = -1;
+
 		if (p->item->object.flags & UNINTERESTING)
 			continue;
 		if (weight(p) != -2)
 			continue;
 		if (bisect_flags & FIND_BISECTION_FIRST_PARENT_ONLY)
 			BUG("shouldn't be calling count-distance in fp mode");
-		weight_set(p, count_distance(p));
-		clear_distance(list);
+		if (by_generation)
+			distance = count_merge_distance(p->item);
+		if (distance < 0) {
+			distance = count_distance(p);
+			clear_distance(list);
+		}
+		weight_set(p, distance);
 
 		/* Does it happen to be at half-way? */
 		if (!(bisect_flags & FIND_BISECTION_ALL) &&
@@ -471,7 +608,6 @@ static int read_bisect_refs(void)
 }
 
 static GIT_PATH_FUNC(git_path_bisect_names, "BISECT_NAMES")
-static GIT_PATH_FUNC(git_path_bisect_expected_rev, "BISECT_EXPECTED_REV")
 static GIT_PATH_FUNC(git_path_bisect_ancestors_ok, "BISECT_ANCESTORS_OK")
 static GIT_PATH_FUNC(git_path_bisect_run, "BISECT_RUN")
 static GIT_PATH_FUNC(git_path_bisect_start, "BISECT_START")
@@ -707,26 +843,10 @@ static enum bisect_error error_if_skipped_commits(struct commit_list *tried,
 
 static int is_expected_rev(const struct object_id *oid)
 {
-	const char *filename = git_path_bisect_expected_rev();
-	struct stat st;
-	struct strbuf str = STRBUF_INIT;
-	FILE *fp;
-	int res = 0;
-
-	if (stat(filename, &st) || !S_ISREG(st.st_mode))
-		return 0;
-
-	fp = fopen_or_warn(filename, "r");
-	if (!fp)
+	struct object_id expected_oid;
+	if (read_ref("BISECT_EXPECTED_REV", &expected_oid))
 		return 0;
-
-	if (strbuf_getline_lf(&str, fp) != EOF)
-		res = !strcmp(str.buf, oid_to_hex(oid));
-
-	strbuf_release(&str);
-	fclose(fp);
-
-	return res;
+	return oideq(oid, &expected_oid);
 }
 
 enum bisect_error bisect_checkout(const struct object_id *bisect_rev,
@@ -1185,10 +1305,10 @@ int bisect_clean_state(void)
 	struct string_list refs_for_removal = STRING_LIST_INIT_NODUP;
 	for_each_ref_in("refs/bisect", mark_for_removal, (void *) &refs_for_removal);
 	string_list_append(&refs_for_removal, xstrdup("BISECT_HEAD"));
+	string_list_append(&refs_for_removal, xstrdup("BISECT_EXPECTED_REV"));
 	result = delete_refs("bisect: remove", &refs_for_removal, REF_NO_DEREF);
 	refs_for_removal.strdup_strings = 1;
 	string_list_clear(&refs_for_removal, 0);
-	unlink_or_warn(git_path_bisect_expected_rev());
 	unlink_or_warn(git_path_bisect_ancestors_ok());
 	unlink_or_warn(git_path_bisect_log());
 	unlink_or_warn(git_path_bisect_names());
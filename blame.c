@@ -8,11 +8,15 @@
 #include "diffcore.h"
 #include "gettext.h"
 #include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
 #include "path.h"
 #include "read-cache.h"
 #include "setup.h"
 #include "tag.h"
 #include "trace2.h"
+#include "userdiff.h"
+#include "write-or-die.h"
 #include "blame.h"
 #include "alloc.h"
 #include "commit-slab.h"
@@ -350,8 +354,6 @@ static int find_line_starts(int **line_starts, const char *buf,
 	return num;
 }
 
-struct fingerprint_entry;
-
 /* A fingerprint is intended to loosely represent a string, such that two
  * fingerprints can be quickly compared to give an indication of the similarity
  * of the strings that they represent.
@@ -367,52 +369,52 @@ struct fingerprint_entry;
  * their multisets, including repeated elements. See fingerprint_similarity for
  * examples.
  *
- * For ease of implementation, the fingerprint is implemented as a map
- * of byte pairs to the count of that byte pair in the string, instead of
- * allowing repeated elements in a set.
+ * The multiset is stored as an array of the distinct byte pairs, sorted, with
+ * the number of times each occurs, so that two fingerprints are compared with
+ * a single merge of their arrays. "total" is the size of the multiset, which
+ * bounds its similarity with any other fingerprint.
  */
 struct fingerprint {
-	struct hashmap map;
-	/* As we know the maximum number of entries in advance, it's
-	 * convenient to store the entries in a single array instead of having
-	 * the hashmap manage the memory.
-	 */
 	struct fingerprint_entry *entries;
+	int nr;
+	int total;
 };
 
-/* A byte pair in a fingerprint. Stores the number of times the byte pair
- * occurs in the string that the fingerprint represents.
+/* A byte pair in a fingerprint and the number of times it occurs in the
+ * string that the fingerprint represents.
  */
 struct fingerprint_entry {
-	/* The hashmap entry - the hash represents the byte pair in its
-	 * entirety so we don't need to store the byte pair separately.
-	 */
-	struct hashmap_entry entry;
-	/* The number of times the byte pair occurs in the string that the
-	 * fingerprint represents.
-	 */
+	/* the first byte in the low bits, the second in the high bits */
+	unsigned short pair;
 	int count;
 };
 
+static int compare_byte_pairs(const void *a_, const void *b_)
+{
+	const unsigned short *a = a_, *b = b_;
+
+	return *a - *b;
+}
+
 /* See `struct fingerprint` for an explanation of what a fingerprint is.
- * \param result the fingerprint of the string is stored here. This must be
- * 		 freed later using free_fingerprint.
+ * \param result the fingerprint of the string is stored here, in entries
+ *		 that must have room for one more than the length of the
+ *		 string.
+ * \param pairs scratch space with room for one more than the length of the
+ *		string.
  * \param line_begin the start of the string
  * \param line_end the end of the string
  */
 static void get_fingerprint(struct fingerprint *result,
+			    unsigned short *pairs,
 			    const char *line_begin,
 			    const char *line_end)
 {
 	unsigned int hash, c0 = 0, c1;
 	const char *p;
-	int max_map_entry_count = 1 + line_end - line_begin;
-	struct fingerprint_entry *entry = xcalloc(max_map_entry_count,
-		sizeof(struct fingerprint_entry));
-	struct fingerprint_entry *found_entry;
+	int i, nr_pairs = 0;
+	struct fingerprint_entry *entry = result->entries;
 
-	hashmap_init(&result->map, NULL, NULL, max_map_entry_count);
-	result->entries = entry;
 	for (p = line_begin; p <= line_end; ++p, c0 = c1) {
 		/* Always terminate the string with whitespace.
 		 * Normalise whitespace to 0, and normalise letters to
@@ -427,24 +429,21 @@ static void get_fingerprint(struct fingerprint *result,
 		/* Ignore whitespace pairs */
 		if (hash == 0)
 			continue;
-		hashmap_entry_init(&entry->entry, hash);
+		pairs[nr_pairs++] = hash;
+	}
 
-		found_entry = hashmap_get_entry(&result->map, entry,
-						/* member name */ entry, NULL);
-		if (found_entry) {
-			found_entry->count += 1;
-		} else {
-			entry->count = 1;
-			hashmap_add(&result->map, &entry->entry);
-			++entry;
+	QSORT(pairs, nr_pairs, compare_byte_pairs);
+	for (i = 0; i < nr_pairs; i++) {
+		if (i && pairs[i] == pairs[i - 1]) {
+			entry[-1].count++;
+			continue;
 		}
+		entry->pair = pairs[i];
+		entry->count = 1;
+		entry++;
 	}
-}
-
-static void free_fingerprint(struct fingerprint *f)
-{
-	hashmap_clear(&f->map);
-	free(f->entries);
+	result->nr = entry - result->entries;
+	result->total = nr_pairs;
 }
 
 /* Calculates the similarity between two fingerprints as the size of the
@@ -456,16 +455,22 @@ static void free_fingerprint(struct fingerprint *f)
  */
 static int fingerprint_similarity(struct fingerprint *a, struct fingerprint *b)
 {
+	const struct fingerprint_entry *entry_a = a->entries;
+	const struct fingerprint_entry *entry_b = b->entries;
+	const struct fingerprint_entry *end_a = entry_a + a->nr;
+	const struct fingerprint_entry *end_b = entry_b + b->nr;
 	int intersection = 0;
-	struct hashmap_iter iter;
-	const struct fingerprint_entry *entry_a, *entry_b;
 
-	hashmap_for_each_entry(&b->map, &iter, entry_b,
-				entry /* member name */) {
-		entry_a = hashmap_get_entry(&a->map, entry_b, entry, NULL);
-		if (entry_a) {
+	while (entry_a < end_a && entry_b < end_b) {
+		if (entry_a->pair < entry_b->pair) {
+			entry_a++;
+		} else if (entry_a->pair > entry_b->pair) {
+			entry_b++;
+		} else {
 			intersection += entry_a->count < entry_b->count ?
 					entry_a->count : entry_b->count;
+			entry_a++;
+			entry_b++;
 		}
 	}
 	return intersection;
@@ -475,50 +480,73 @@ static int fingerprint_similarity(struct fingerprint *a, struct fingerprint *b)
  */
 static void fingerprint_subtract(struct fingerprint *a, struct fingerprint *b)
 {
-	struct hashmap_iter iter;
-	struct fingerprint_entry *entry_a;
-	const struct fingerprint_entry *entry_b;
+	const struct fingerprint_entry *entry_a = a->entries;
+	const struct fingerprint_entry *entry_b = b->entries;
+	const struct fingerprint_entry *end_a = entry_a + a->nr;
+	const struct fingerprint_entry *end_b = entry_b + b->nr;
+	struct fingerprint_entry *dst = a->entries;
 
-	hashmap_iter_init(&b->map, &iter);
+	for (; entry_a < end_a; entry_a++) {
+		struct fingerprint_entry e = *entry_a;
 
-	hashmap_for_each_entry(&b->map, &iter, entry_b,
-				entry /* member name */) {
-		entry_a = hashmap_get_entry(&a->map, entry_b, entry, NULL);
-		if (entry_a) {
-			if (entry_a->count <= entry_b->count)
-				hashmap_remove(&a->map, &entry_b->entry, NULL);
-			else
-				entry_a->count -= entry_b->count;
+		while (entry_b < end_b && entry_b->pair < e.pair)
+			entry_b++;
+		if (entry_b < end_b && entry_b->pair == e.pair) {
+			if (e.count <= entry_b->count) {
+				a->total -= e.count;
+				continue;
+			}
+			e.count -= entry_b->count;
+			a->total -= entry_b->count;
 		}
+		*dst++ = e;
 	}
+	a->nr = dst - a->entries;
 }
 
 /* Calculate fingerprints for a series of lines.
  * Puts the fingerprints in the fingerprints array, which must have been
- * preallocated to allow storing line_count elements.
+ * preallocated to allow storing line_count elements. The entries of all of
+ * them are allocated in one block, which free_line_fingerprints() frees.
  */
 static void get_line_fingerprints(struct fingerprint *fingerprints,
 				  const char *content, const int *line_starts,
 				  long first_line, long line_count)
 {
-	int i;
+	int i, max_len = 0;
+	size_t nr_entries = 0;
 	const char *linestart, *lineend;
+	struct fingerprint_entry *entries;
+	unsigned short *pairs;
 
+	if (!line_count)
+		return;
 	line_starts += first_line;
+	for (i = 0; i < line_count; ++i) {
+		int len = line_starts[i + 1] - line_starts[i];
+
+		if (max_len < len)
+			max_len = len;
+		nr_entries = st_add3(nr_entries, len, 1);
+	}
+	ALLOC_ARRAY(entries, nr_entries);
+	ALLOC_ARRAY(pairs, st_add(max_len, 1));
+
 	for (i = 0; i < line_count; ++i) {
 		linestart = content + line_starts[i];
 		lineend = content + line_starts[i + 1];
-		get_fingerprint(fingerprints + i, linestart, lineend);
+		fingerprints[i].entries = entries;
+		get_fingerprint(fingerprints + i, pairs, linestart, lineend);
+		entries += lineend - linestart + 1;
 	}
+	free(pairs);
 }
 
 static void free_line_fingerprints(struct fingerprint *fingerprints,
 				   int nr_fingerprints)
 {
-	int i;
-
-	for (i = 0; i < nr_fingerprints; i++)
-		free_fingerprint(&fingerprints[i]);
+	if (nr_fingerprints)
+		free(fingerprints[0].entries);
 }
 
 /* This contains the data necessary to linearly map a line number in one half
@@ -667,10 +695,20 @@ static void find_best_line_matches(
 					    closest_local_line_a,
 					    max_search_distance_a);
 		if (*similarity == -1) {
+			int bound = fingerprints_a[i].total;
+
 			/* This value will never exceed 10 but assert just in
 			 * case
 			 */
 			assert(abs(i - closest_local_line_a) < 1000);
+			/* Skip lines in A too different in size to beat the
+			 * second best match.
+			 */
+			if (bound > fingerprints_b[local_line_b].total)
+				bound = fingerprints_b[local_line_b].total;
+			if (bound * (1000 - abs(i - closest_local_line_a)) <=
+			    second_best_similarity)
+				continue;
 			/* scale the similarity by (1000 - distance from
 			 * closest line) to act as a tie break between lines
 			 * that otherwise are equally similar.
@@ -1419,6 +1457,31 @@ static struct blame_origin *find_rename(struct repository *r,
 	struct diff_options diff_opts;
 	int i;
 
+	/*
+	 * The commit-graph may have recorded the renames of the commit
+	 * against its first parent already.
+	 */
+	if (!is_null_oid(&origin->commit->object.oid) &&
+	    origin->commit->parents &&
+	    origin->commit->parents->item == parent) {
+		const char *from;
+
+		switch (commit_graph_rename_source(r, origin->commit,
+						   origin->path, &from)) {
+		case 0:
+			return NULL;
+		case 1:
+			porigin = get_origin(parent, from);
+			if (!fill_blob_sha1_and_mode(r, porigin)) {
+				add_bloom_key(bd, from);
+				return porigin;
+			}
+			blame_origin_decref(porigin);
+			porigin = NULL;
+			break;
+		}
+	}
+
 	repo_diff_setup(r, &diff_opts);
 	diff_opts.flags.recursive = 1;
 	diff_opts.detect_rename = DIFF_DETECT_RENAME;
@@ -1664,7 +1727,13 @@ static int scan_parent_range(struct fingerprint *p_fps,
 	int best_sim_val = FINGERPRINT_FILE_THRESHOLD;
 	int best_sim_idx = -1;
 
+	/* No line can be similar enough to a line this short. */
+	if (t_fps[t_idx].total < best_sim_val)
+		return -1;
+
 	for (p_idx = from; p_idx < from + nr_lines; p_idx++) {
+		if (p_fps[p_idx].total < best_sim_val)
+			continue;
 		sim = fingerprint_similarity(&t_fps[t_idx], &p_fps[p_idx]);
 		if (sim < best_sim_val)
 			continue;
@@ -2572,6 +2641,322 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * The blame cache remembers, for a path in a commit, the origin each of
+ * its lines was blamed on, so that blaming a descendant can stop digging
+ * as soon as it reaches that commit.  Where the lines of an origin end
+ * up does not depend on where the blame started, as long as no option
+ * makes it depend on other origins (-M, -C, --ignore-rev) or on the
+ * range of history (--reverse, --first-parent, bottom commits); the
+ * caller only sets "use_cache" when none of them is in effect.
+ *
+ * Each file in $GIT_DIR/blame-cache/ starts with the commit and blob
+ * that were blamed and the options that change the result:
+ *
+ *   "<commit> <blob> <xdl_opts> <no_whole_file_rename>\n" "<path>\0"
+ *
+ * followed by one record per group of lines, in line order:
+ *
+ *   "<lno> <s_lno> <num_lines> <commit> <previous commit>\n"
+ *   "<path>\0" "<previous path>\0"
+ *
+ * where the previous commit is the null oid when there is none.
+ */
+#define BLAME_CACHE_SIGNATURE "blame-cache 1\n"
+
+struct blame_cache_span {
+	int lno, s_lno, num_lines;
+	struct blame_origin *suspect;
+};
+
+static char *blame_cache_path(struct repository *r,
+			      const struct object_id *commit, const char *path)
+{
+	git_hash_ctx ctx;
+	struct object_id key;
+	const char *hex;
+
+	r->hash_algo->init_fn(&ctx);
+	r->hash_algo->update_fn(&ctx, commit->hash, r->hash_algo->rawsz);
+	r->hash_algo->update_fn(&ctx, path, strlen(path));
+	r->hash_algo->final_oid_fn(&key, &ctx);
+	hex = oid_to_hex(&key);
+	return repo_git_path(r, "blame-cache/%.2s/%s", hex, hex + 2);
+}
+
+/* Lines shown through a textconv filter depend on more than the blob. */
+static int blame_cache_allowed(struct blame_scoreboard *sb, const char *path)
+{
+	struct userdiff_driver *driver;
+
+	if (!sb->revs->diffopt.flags.allow_textconv)
+		return 1;
+	driver = userdiff_find_by_path(sb->repo->index, path);
+	return !driver || !driver->textconv;
+}
+
+static int parse_blame_cache_int(const char **p, char term, int *v)
+{
+	char *end;
+	long l;
+
+	errno = 0;
+	l = strtol(*p, &end, 10);
+	if (errno || end == *p || *end != term || l < 0 || l > INT_MAX)
+		return -1;
+	*v = l;
+	*p = end + 1;
+	return 0;
+}
+
+static int parse_blame_cache_oid(struct repository *r, const char **p,
+				 char term, struct object_id *oid)
+{
+	if (parse_oid_hex_algop(*p, oid, p, r->hash_algo) || **p != term)
+		return -1;
+	(*p)++;
+	return 0;
+}
+
+static const char *parse_blame_cache_path(const char **p, const char *end)
+{
+	const char *path = *p;
+	size_t len = strnlen(path, end - path);
+
+	if (len == end - path)
+		return NULL;
+	*p += len + 1;
+	return path;
+}
+
+static struct blame_origin *blame_cache_origin(struct repository *r,
+					       const struct object_id *oid,
+					       const char *path)
+{
+	struct commit *commit = lookup_commit(r, oid);
+	struct blame_origin *o;
+
+	if (!commit)
+		return NULL;
+	o = get_origin(commit, path);
+	/* the origin may be reused later on, so it has to be complete */
+	if (fill_blob_sha1_and_mode(r, o)) {
+		blame_origin_decref(o);
+		return NULL;
+	}
+	return o;
+}
+
+static void free_blame_cache_spans(struct blame_cache_span *spans, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		blame_origin_decref(spans[i].suspect);
+	free(spans);
+}
+
+/*
+ * Read the blame of "origin" from the cache, with an origin for each
+ * group of its lines, or return -1 if it is not there.
+ */
+static int read_blame_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *origin,
+			    struct blame_cache_span **spans_p, int *nr_p)
+{
+	struct repository *r = sb->repo;
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_cache_span *spans = NULL;
+	struct commit *commit;
+	int nr = 0, alloc = 0, xdl_opts, no_whole_file_rename;
+	struct object_id oid;
+	const char *p, *end, *path;
+	char *file;
+
+	file = blame_cache_path(r, &origin->commit->object.oid, origin->path);
+	if (strbuf_read_file(&buf, file, 0) < 0)
+		goto fail;
+	p = buf.buf;
+	end = buf.buf + buf.len;
+
+	if (!skip_prefix(p, BLAME_CACHE_SIGNATURE, &p) ||
+	    parse_blame_cache_oid(r, &p, ' ', &oid) ||
+	    !oideq(&oid, &origin->commit->object.oid) ||
+	    parse_blame_cache_oid(r, &p, ' ', &oid) ||
+	    !oideq(&oid, &origin->blob_oid) ||
+	    parse_blame_cache_int(&p, ' ', &xdl_opts) ||
+	    xdl_opts != sb->xdl_opts ||
+	    parse_blame_cache_int(&p, '\n', &no_whole_file_rename) ||
+	    no_whole_file_rename != !!sb->no_whole_file_rename ||
+	    !(path = parse_blame_cache_path(&p, end)) ||
+	    strcmp(path, origin->path))
+		goto fail;
+
+	while (p < end) {
+		struct blame_cache_span *span;
+		struct object_id prev_oid;
+		const char *prev_path;
+
+		ALLOC_GROW(spans, nr + 1, alloc);
+		span = &spans[nr];
+		if (parse_blame_cache_int(&p, ' ', &span->lno) ||
+		    span->lno != (nr ? spans[nr - 1].lno + spans[nr - 1].num_lines : 0) ||
+		    parse_blame_cache_int(&p, ' ', &span->s_lno) ||
+		    parse_blame_cache_int(&p, ' ', &span->num_lines) ||
+		    !span->num_lines ||
+		    parse_blame_cache_oid(r, &p, ' ', &oid) ||
+		    parse_blame_cache_oid(r, &p, '\n', &prev_oid) ||
+		    !(path = parse_blame_cache_path(&p, end)) ||
+		    !(prev_path = parse_blame_cache_path(&p, end)) ||
+		    !(span->suspect = blame_cache_origin(r, &oid, path)))
+			goto fail;
+		nr++;
+
+		/* as assign_blame() would have marked it */
+		commit = span->suspect->commit;
+		if (repo_parse_commit(r, commit))
+			goto fail;
+		if (!commit->parents && !sb->show_root)
+			commit->object.flags |= UNINTERESTING;
+
+		if (!span->suspect->previous && !is_null_oid(&prev_oid) &&
+		    !(span->suspect->previous = blame_cache_origin(r, &prev_oid, prev_path)))
+			goto fail;
+	}
+
+	strbuf_release(&buf);
+	free(file);
+	*spans_p = spans;
+	*nr_p = nr;
+	return 0;
+
+fail:
+	free_blame_cache_spans(spans, nr);
+	strbuf_release(&buf);
+	free(file);
+	return -1;
+}
+
+/*
+ * Blame all the lines of "origin" on the origins the cache records for
+ * them, if it has them.
+ */
+static int blame_from_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *origin)
+{
+	struct blame_cache_span *spans;
+	struct blame_entry *e, *next;
+	int nr, lines;
+
+	if (!blame_cache_allowed(sb, origin->path) ||
+	    read_blame_cache(sb, origin, &spans, &nr))
+		return -1;
+
+	lines = nr ? spans[nr - 1].lno + spans[nr - 1].num_lines : 0;
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > lines) {
+			free_blame_cache_spans(spans, nr);
+			return -1;
+		}
+
+	for (e = origin->suspects; e; e = next) {
+		int lno = e->s_lno, end = e->s_lno + e->num_lines;
+		int i = 0;
+
+		while (spans[i].lno + spans[i].num_lines <= lno)
+			i++;
+		for (; lno < end; i++) {
+			struct blame_cache_span *span = &spans[i];
+			struct blame_entry *ent;
+			int n = span->lno + span->num_lines;
+
+			if (end < n)
+				n = end;
+			n -= lno;
+
+			CALLOC_ARRAY(ent, 1);
+			ent->lno = e->lno + (lno - e->s_lno);
+			ent->num_lines = n;
+			ent->s_lno = span->s_lno + (lno - span->lno);
+			ent->suspect = blame_origin_incref(span->suspect);
+			span->suspect->guilty = 1;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(ent, sb->found_guilty_entry_data);
+			ent->next = sb->ent;
+			sb->ent = ent;
+			lno += n;
+		}
+
+		next = e->next;
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+
+	free_blame_cache_spans(spans, nr);
+	sb->num_cache_hits++;
+	return 0;
+}
+
+void blame_cache_write(struct blame_scoreboard *sb)
+{
+	struct repository *r = sb->repo;
+	const struct object_id *commit_oid = &sb->final->object.oid;
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_entry *e;
+	struct object_id blob_oid;
+	unsigned short mode;
+	char *file = NULL;
+	int lno = 0;
+
+	if (!sb->use_cache || is_null_oid(commit_oid) ||
+	    !blame_cache_allowed(sb, sb->path) ||
+	    get_tree_entry(r, commit_oid, sb->path, &blob_oid, &mode))
+		return;
+
+	blame_sort_final(sb);
+	blame_coalesce(sb);
+
+	strbuf_addstr(&buf, BLAME_CACHE_SIGNATURE);
+	strbuf_addf(&buf, "%s ", oid_to_hex(commit_oid));
+	strbuf_addf(&buf, "%s %d %d\n", oid_to_hex(&blob_oid),
+		    sb->xdl_opts, !!sb->no_whole_file_rename);
+	strbuf_add(&buf, sb->path, strlen(sb->path) + 1);
+	for (e = sb->ent; e; e = e->next) {
+		struct blame_origin *prev = e->suspect->previous;
+
+		/* only the blame of a whole file can be reused */
+		if (e->lno != lno)
+			goto out;
+		lno += e->num_lines;
+
+		strbuf_addf(&buf, "%d %d %d %s ", e->lno, e->s_lno,
+			    e->num_lines, oid_to_hex(&e->suspect->commit->object.oid));
+		strbuf_addf(&buf, "%s\n",
+			    oid_to_hex(prev ? &prev->commit->object.oid : null_oid()));
+		strbuf_add(&buf, e->suspect->path, strlen(e->suspect->path) + 1);
+		strbuf_add(&buf, prev ? prev->path : "", prev ? strlen(prev->path) + 1 : 1);
+	}
+	if (lno != sb->num_lines)
+		goto out;
+
+	file = blame_cache_path(r, commit_oid, sb->path);
+	/* someone else may be writing the same blame; let them */
+	if (safe_create_leading_directories_const(file) ||
+	    hold_lock_file_for_update(&lk, file, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lk)) {
+		warning_errno(_("unable to write blame cache '%s'"), file);
+		rollback_lock_file(&lk);
+	}
+
+out:
+	strbuf_release(&buf);
+	free(file);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2604,9 +2989,10 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		repo_parse_commit(the_repository, commit);
 		if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
-		     !(revs->max_age != -1 && commit->date < revs->max_age)))
-			pass_blame(sb, suspect, opt);
-		else {
+		     !(revs->max_age != -1 && commit->date < revs->max_age))) {
+			if (!sb->use_cache || blame_from_cache(sb, suspect))
+				pass_blame(sb, suspect, opt);
+		} else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
 				mark_parents_uninteresting(sb->revs, commit);
@@ -2756,32 +3142,73 @@ void init_scoreboard(struct blame_scoreboard *sb)
 	sb->copy_score = BLAME_DEFAULT_COPY_SCORE;
 }
 
-void setup_scoreboard(struct blame_scoreboard *sb,
-		      struct blame_origin **orig)
+static void find_scoreboard_final(struct blame_scoreboard *sb,
+				  const char **final_commit_name)
 {
-	const char *final_commit_name = NULL;
-	struct blame_origin *o;
-	struct commit *final_commit = NULL;
-	enum object_type type;
-
-	init_blame_suspects(&blame_suspects);
-
-	if (sb->reverse && sb->contents_from)
-		die(_("--contents and --reverse do not blend well."));
-
 	if (!sb->repo)
 		BUG("repo is NULL");
 
 	if (!sb->reverse) {
-		sb->final = find_single_final(sb->revs, &final_commit_name);
+		sb->final = find_single_final(sb->revs, final_commit_name);
 		sb->commits.compare = compare_commits_by_commit_date;
 	} else {
-		sb->final = find_single_initial(sb->revs, &final_commit_name);
+		sb->final = find_single_initial(sb->revs, final_commit_name);
 		sb->commits.compare = compare_commits_by_reverse_commit_date;
 	}
 
 	if (sb->reverse && sb->revs->first_parent_only)
 		sb->revs->children.name = NULL;
+}
+
+static void prepare_scoreboard_walk(struct blame_scoreboard *sb)
+{
+	struct commit *final_commit = NULL;
+
+	if (sb->reverse && sb->revs->first_parent_only) {
+		final_commit = find_single_final(sb->revs, NULL);
+		if (!final_commit)
+			die(_("--reverse and --first-parent together require specified latest commit"));
+	}
+
+	/*
+	 * If we have bottom, this will mark the ancestors of the
+	 * bottom commits we would reach while traversing as
+	 * uninteresting.
+	 */
+	if (prepare_revision_walk(sb->revs))
+		die(_("revision walk setup failed"));
+
+	if (sb->reverse && sb->revs->first_parent_only) {
+		struct commit *c = final_commit;
+
+		sb->revs->children.name = "children";
+		while (c->parents &&
+		       !oideq(&c->object.oid, &sb->final->object.oid)) {
+			struct commit_list *l = xcalloc(1, sizeof(*l));
+
+			l->item = c;
+			if (add_decoration(&sb->revs->children,
+					   &c->parents->item->object, l))
+				BUG("not unique item in first-parent chain");
+			c = c->parents->item;
+		}
+
+		if (!oideq(&c->object.oid, &sb->final->object.oid))
+			die(_("--reverse --first-parent together require range along first-parent chain"));
+	}
+}
+
+void setup_scoreboard(struct blame_scoreboard *sb,
+		      struct blame_origin **orig)
+{
+	const char *final_commit_name = NULL;
+
+	init_blame_suspects(&blame_suspects);
+
+	if (sb->reverse && sb->contents_from)
+		die(_("--contents and --reverse do not blend well."));
+
+	find_scoreboard_final(sb, &final_commit_name);
 
 	if (sb->contents_from || !sb->final) {
 		struct object_id head_oid, *parent_oid;
@@ -2816,38 +3243,34 @@ void setup_scoreboard(struct blame_scoreboard *sb,
 		add_pending_object(sb->revs, &(sb->final->object), ":");
 	}
 
-	if (sb->reverse && sb->revs->first_parent_only) {
-		final_commit = find_single_final(sb->revs, NULL);
-		if (!final_commit)
-			die(_("--reverse and --first-parent together require specified latest commit"));
-	}
+	prepare_scoreboard_walk(sb);
 
-	/*
-	 * If we have bottom, this will mark the ancestors of the
-	 * bottom commits we would reach while traversing as
-	 * uninteresting.
-	 */
-	if (prepare_revision_walk(sb->revs))
-		die(_("revision walk setup failed"));
+	if (setup_scoreboard_path(sb, orig))
+		die(_("no such path %s in %s"), sb->path, final_commit_name);
 
-	if (sb->reverse && sb->revs->first_parent_only) {
-		struct commit *c = final_commit;
+	free((char *)final_commit_name);
+}
 
-		sb->revs->children.name = "children";
-		while (c->parents &&
-		       !oideq(&c->object.oid, &sb->final->object.oid)) {
-			struct commit_list *l = xcalloc(1, sizeof(*l));
+int prepare_scoreboard(struct blame_scoreboard *sb)
+{
+	const char *final_commit_name = NULL;
 
-			l->item = c;
-			if (add_decoration(&sb->revs->children,
-					   &c->parents->item->object, l))
-				BUG("not unique item in first-parent chain");
-			c = c->parents->item;
-		}
+	init_blame_suspects(&blame_suspects);
 
-		if (!oideq(&c->object.oid, &sb->final->object.oid))
-			die(_("--reverse --first-parent together require range along first-parent chain"));
-	}
+	find_scoreboard_final(sb, &final_commit_name);
+	free((char *)final_commit_name);
+	if (sb->contents_from || !sb->final)
+		return -1;
+
+	prepare_scoreboard_walk(sb);
+	return 0;
+}
+
+int setup_scoreboard_path(struct blame_scoreboard *sb,
+			  struct blame_origin **orig)
+{
+	struct blame_origin *o;
+	enum object_type type;
 
 	if (is_null_oid(&sb->final->object.oid)) {
 		o = get_blame_suspects(sb->final);
@@ -2856,8 +3279,10 @@ void setup_scoreboard(struct blame_scoreboard *sb,
 	}
 	else {
 		o = get_origin(sb->final, sb->path);
-		if (fill_blob_sha1_and_mode(sb->repo, o))
-			die(_("no such path %s in %s"), sb->path, final_commit_name);
+		if (fill_blob_sha1_and_mode(sb->repo, o)) {
+			blame_origin_decref(o);
+			return -1;
+		}
 
 		if (sb->revs->diffopt.flags.allow_textconv &&
 		    textconv_object(sb->repo, sb->path, o->mode, &o->blob_oid, 1, (char **) &sb->final_buf,
@@ -2879,8 +3304,9 @@ void setup_scoreboard(struct blame_scoreboard *sb,
 
 	if (orig)
 		*orig = o;
-
-	free((char *)final_commit_name);
+	else
+		blame_origin_decref(o);
+	return 0;
 }
 
 
@@ -2926,6 +3352,10 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb)
 
 void cleanup_scoreboard(struct blame_scoreboard *sb)
 {
+	FREE_AND_NULL(sb->lineno);
+	if (sb->use_cache)
+		trace2_data_intmax("blame", sb->repo, "cache/hits",
+				   sb->num_cache_hits);
 	if (sb->bloom_data) {
 		int i;
 		for (i = 0; i < sb->bloom_data->nr; i++) {
@@ -135,6 +135,7 @@ struct blame_scoreboard {
 	int num_read_blob;
 	int num_get_patch;
 	int num_commits;
+	int num_cache_hits;
 
 	/*
 	 * blame for a blame_entry with score lower than these thresholds
@@ -152,6 +153,8 @@ struct blame_scoreboard {
 	int xdl_opts;
 	int no_whole_file_rename;
 	int debug;
+	/* reuse and record the blame of whole files in $GIT_DIR/blame-cache */
+	int use_cache;
 
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
@@ -182,7 +185,30 @@ const char *blame_nth_line(struct blame_scoreboard *sb, long lno);
 void init_scoreboard(struct blame_scoreboard *sb);
 void setup_scoreboard(struct blame_scoreboard *sb,
 		      struct blame_origin **orig);
+
+/*
+ * Prepare "sb" to blame one path after another in the history given by
+ * "sb->revs", with setup_scoreboard_path() and cleanup_scoreboard() for
+ * each.  Unlike setup_scoreboard(), this cannot blame the contents of
+ * the working tree or of "sb->contents_from", and returns -1 when it
+ * would have to.
+ */
+int prepare_scoreboard(struct blame_scoreboard *sb);
+
+/*
+ * Set "sb" up to blame "sb->path" in "sb->final"; returns -1 if there
+ * is no such path.
+ */
+int setup_scoreboard_path(struct blame_scoreboard *sb,
+			  struct blame_origin **orig);
+
 void setup_blame_bloom_data(struct blame_scoreboard *sb);
+
+/*
+ * Record the blame of the whole of "sb->path" in "sb->final", once
+ * assign_blame() is done with it, for "use_cache" to find later.
+ */
+void blame_cache_write(struct blame_scoreboard *sb);
 void cleanup_scoreboard(struct blame_scoreboard *sb);
 
 struct blame_entry *blame_entry_prepend(struct blame_entry *head,
@@ -7,6 +7,17 @@
 #include "commit-graph.h"
 #include "commit.h"
 #include "commit-slab.h"
+#include "gettext.h"
+#include "hex.h"
+#include "object-store-ll.h"
+#include "promisor-remote.h"
+#include "thread-utils.h"
+#include "tree.h"
+#include "tree-walk.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
@@ -51,7 +62,8 @@ static int check_bloom_offset(struct commit_graph *g, uint32_t pos,
 
 static int load_bloom_filter_from_graph(struct commit_graph *g,
 					struct bloom_filter *filter,
-					uint32_t graph_pos)
+					uint32_t graph_pos,
+					const struct bloom_filter_settings *settings)
 {
 	uint32_t lex_pos, start_index, end_index;
 
@@ -62,6 +74,16 @@ static int load_bloom_filter_from_graph(struct commit_graph *g,
 	if (!g->chunk_bloom_indexes)
 		return 0;
 
+	/*
+	 * Nor does it if they were written with other settings, e.g. by
+	 * an older layer of a split commit-graph.
+	 */
+	if (!g->bloom_filter_settings ||
+	    (settings &&
+	     (g->bloom_filter_settings->hash_version != settings->hash_version ||
+	      g->bloom_filter_settings->num_hashes != settings->num_hashes)))
+		return 0;
+
 	lex_pos = graph_pos - g->num_commits_in_base;
 
 	end_index = get_be32(g->chunk_bloom_indexes + 4 * lex_pos);
@@ -168,9 +190,15 @@ void fill_bloom_key(const char *data,
 	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
 	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
 
-	key->hashes = (uint32_t *)xcalloc(settings->num_hashes, sizeof(uint32_t));
+	int nr = settings->num_hashes;
+
+	if (settings->hash_version == BLOOM_HASH_VERSION_BLOCKED)
+		nr++;
+	key->hashes = (uint32_t *)xcalloc(nr, sizeof(uint32_t));
 	for (i = 0; i < settings->num_hashes; i++)
 		key->hashes[i] = hash0 + i * hash1;
+	if (settings->hash_version == BLOOM_HASH_VERSION_BLOCKED)
+		key->hashes[settings->num_hashes] = hash1;
 }
 
 void clear_bloom_key(struct bloom_key *key)
@@ -178,6 +206,83 @@ void clear_bloom_key(struct bloom_key *key)
 	FREE_AND_NULL(key->hashes);
 }
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	size_t i, nr = 1;
+
+	for (i = 0; i < len; i++)
+		if (path[i] == '/')
+			nr++;
+
+	vec = xcalloc(1, st_add(sizeof(*vec),
+				st_mult(nr, sizeof(struct bloom_key))));
+	vec->count = nr;
+
+	/*
+	 * The path itself goes first, as it is the key that is most
+	 * likely to be missing from a filter.
+	 */
+	fill_bloom_key(path, len, &vec->key[0], settings);
+	nr = 1;
+	for (i = len - 1; i > 0; i--)
+		if (path[i] == '/')
+			fill_bloom_key(path, i, &vec->key[nr++], settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	size_t i;
+
+	if (!vec)
+		return;
+	for (i = 0; i < vec->count; i++)
+		clear_bloom_key(&vec->key[i]);
+	free(vec);
+}
+
+/*
+ * Find the block of a blocked filter that all the bits of "key" are
+ * in. Filters that are shorter than BLOOM_BLOCK_SIZE are a single
+ * block, longer ones are a multiple of BLOOM_BLOCK_SIZE.
+ */
+static unsigned char *key_block(const struct bloom_key *key,
+				const struct bloom_filter *filter,
+				const struct bloom_filter_settings *settings,
+				size_t *block_len)
+{
+	uint64_t nr_blocks;
+
+	*block_len = filter->len < BLOOM_BLOCK_SIZE ? filter->len : BLOOM_BLOCK_SIZE;
+	nr_blocks = filter->len / *block_len;
+
+	/*
+	 * Use the high bits of the block hash; it is the step of the
+	 * other hashes, whose low bits pick the bits within the block.
+	 */
+	return filter->data + *block_len *
+		((key->hashes[settings->num_hashes] * nr_blocks) >> 32);
+}
+
+static void add_key_to_block(const struct bloom_key *key,
+			     struct bloom_filter *filter,
+			     const struct bloom_filter_settings *settings)
+{
+	int i;
+	size_t block_len;
+	unsigned char *block = key_block(key, filter, settings, &block_len);
+	uint64_t mod = block_len * BITS_PER_WORD;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+
+		block[hash_mod / BITS_PER_WORD] |= get_bitmask(hash_mod);
+	}
+}
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings)
@@ -185,6 +290,11 @@ void add_key_to_filter(const struct bloom_key *key,
 	int i;
 	uint64_t mod = filter->len * BITS_PER_WORD;
 
+	if (settings->hash_version == BLOOM_HASH_VERSION_BLOCKED) {
+		add_key_to_block(key, filter, settings);
+		return;
+	}
+
 	for (i = 0; i < settings->num_hashes; i++) {
 		uint64_t hash_mod = key->hashes[i] % mod;
 		uint64_t block_pos = hash_mod / BITS_PER_WORD;
@@ -218,6 +328,74 @@ static void init_truncated_large_filter(struct bloom_filter *filter)
 	filter->len = 1;
 }
 
+/*
+ * Add the changed "path" to "pathmap". Note that "path" is modified.
+ */
+static void add_changed_path(struct hashmap *pathmap, char *path)
+{
+	struct pathmap_hash_entry *e;
+
+	/*
+	 * Add each leading directory of the changed file, i.e. for
+	 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
+	 * the Bloom filter could be used to speed up commands like
+	 * 'git log dir/subdir', too.
+	 *
+	 * Note that directories are added without the trailing '/'.
+	 */
+	do {
+		char *last_slash = strrchr(path, '/');
+
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->entry, strhash(path));
+
+		if (!hashmap_get(pathmap, &e->entry, NULL))
+			hashmap_add(pathmap, &e->entry);
+		else
+			free(e);
+
+		if (!last_slash)
+			last_slash = path;
+		*last_slash = '\0';
+
+	} while (*path);
+}
+
+static void fill_filter_from_paths(struct bloom_filter *filter,
+				   struct hashmap *pathmap,
+				   const struct bloom_filter_settings *settings,
+				   enum bloom_filter_computed *computed)
+{
+	struct pathmap_hash_entry *e;
+	struct hashmap_iter iter;
+
+	if (hashmap_get_size(pathmap) > settings->max_changed_paths) {
+		init_truncated_large_filter(filter);
+		if (computed)
+			*computed |= BLOOM_TRUNC_LARGE;
+		return;
+	}
+
+	filter->len = (hashmap_get_size(pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	if (!filter->len) {
+		if (computed)
+			*computed |= BLOOM_TRUNC_EMPTY;
+		filter->len = 1;
+	}
+	if (settings->hash_version == BLOOM_HASH_VERSION_BLOCKED &&
+	    filter->len > BLOOM_BLOCK_SIZE)
+		filter->len = st_mult(DIV_ROUND_UP(filter->len, BLOOM_BLOCK_SIZE),
+				      BLOOM_BLOCK_SIZE);
+	CALLOC_ARRAY(filter->data, filter->len);
+
+	hashmap_for_each_entry(pathmap, &iter, e, entry) {
+		struct bloom_key key;
+		fill_bloom_key(e->path, strlen(e->path), &key, settings);
+		add_key_to_filter(&key, filter, settings);
+		clear_bloom_key(&key);
+	}
+}
+
 struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 struct commit *c,
 						 int compute_if_not_present,
@@ -240,7 +418,9 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		uint32_t graph_pos;
 		if (repo_find_commit_pos_in_graph(r, c, &graph_pos))
 			load_bloom_filter_from_graph(r->objects->commit_graph,
-						     filter, graph_pos);
+						     filter, graph_pos,
+						     settings ? settings :
+						     get_bloom_filter_settings(r));
 	}
 
 	if (filter->data && filter->len)
@@ -265,63 +445,14 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 
 	if (diff_queued_diff.nr <= settings->max_changed_paths) {
 		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
-		struct pathmap_hash_entry *e;
-		struct hashmap_iter iter;
 
 		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-
+			add_changed_path(&pathmap,
+					 diff_queued_diff.queue[i]->two->path);
 			diff_free_filepair(diff_queued_diff.queue[i]);
 		}
 
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
-			init_truncated_large_filter(filter);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
-			goto cleanup;
-		}
-
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
-		if (!filter->len) {
-			if (computed)
-				*computed |= BLOOM_TRUNC_EMPTY;
-			filter->len = 1;
-		}
-		CALLOC_ARRAY(filter->data, filter->len);
-
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
-			struct bloom_key key;
-			fill_bloom_key(e->path, strlen(e->path), &key, settings);
-			add_key_to_filter(&key, filter, settings);
-			clear_bloom_key(&key);
-		}
-
-	cleanup:
+		fill_filter_from_paths(filter, &pathmap, settings, computed);
 		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
 		for (i = 0; i < diff_queued_diff.nr; i++)
@@ -341,6 +472,56 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	return filter;
 }
 
+/*
+ * Check all the bits of a block at once: build the mask of the bits
+ * "key" needs, and compare it against the block 16 (with SSE2) or 8
+ * bytes at a time.
+ */
+static int block_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	unsigned char mask[BLOOM_BLOCK_SIZE] = { 0 };
+	const unsigned char *block;
+	size_t block_len, i = 0;
+	uint64_t mod, missing = 0;
+	int j;
+
+	block = key_block(key, filter, settings, &block_len);
+	mod = block_len * BITS_PER_WORD;
+	for (j = 0; j < settings->num_hashes; j++) {
+		uint64_t hash_mod = key->hashes[j] % mod;
+
+		mask[hash_mod / BITS_PER_WORD] |= get_bitmask(hash_mod);
+	}
+
+#ifdef __SSE2__
+	if (block_len >= 16) {
+		__m128i acc = _mm_setzero_si128();
+
+		for (; i + 16 <= block_len; i += 16) {
+			__m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+			__m128i d = _mm_loadu_si128((const __m128i *)(block + i));
+
+			acc = _mm_or_si128(acc, _mm_andnot_si128(d, m));
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+			return 0;
+	}
+#endif
+	for (; i + 8 <= block_len; i += 8) {
+		uint64_t m, d;
+
+		memcpy(&m, mask + i, sizeof(m));
+		memcpy(&d, block + i, sizeof(d));
+		missing |= m & ~d;
+	}
+	for (; i < block_len; i++)
+		missing |= mask[i] & ~block[i];
+
+	return !missing;
+}
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings)
@@ -351,6 +532,9 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 	if (!mod)
 		return -1;
 
+	if (settings->hash_version == BLOOM_HASH_VERSION_BLOCKED)
+		return block_contains(filter, key, settings);
+
 	for (i = 0; i < settings->num_hashes; i++) {
 		uint64_t hash_mod = key->hashes[i] % mod;
 		uint64_t block_pos = hash_mod / BITS_PER_WORD;
@@ -360,3 +544,260 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 
 	return 1;
 }
+
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings)
+{
+	int ret = 1;
+	size_t i;
+
+	for (i = 0; ret && i < vec->count; i++)
+		ret = bloom_filter_contains(filter, &vec->key[i], settings);
+
+	return ret;
+}
+
+/*
+ * The changed paths of a commit, computed without the diff machinery,
+ * which is not thread-safe. This finds the same paths as the
+ * recursive tree diff against the first parent in
+ * get_or_compute_bloom_filter(): every path at which a non-tree entry
+ * was added, removed or changed.
+ */
+struct changed_paths {
+	struct hashmap pathmap;
+	struct strbuf path, scratch;
+	size_t nr, max;
+};
+
+static void *read_tree_for_paths(struct repository *r,
+				 const struct object_id *oid,
+				 struct tree_desc *desc)
+{
+	enum object_type type;
+	unsigned long size = 0;
+	void *buf = NULL;
+
+	if (oid) {
+		buf = repo_read_object_file(r, oid, &type, &size);
+		if (!buf || type != OBJ_TREE)
+			die("unable to read tree %s", oid_to_hex(oid));
+	}
+	init_tree_desc(desc, buf, size);
+	return buf;
+}
+
+static int add_changed_entry(struct repository *r,
+			     struct changed_paths *paths,
+			     const struct name_entry *old,
+			     const struct name_entry *new);
+
+/* Returns -1 as soon as more than "paths->max" paths changed. */
+static int diff_trees_for_paths(struct repository *r,
+				struct changed_paths *paths,
+				const struct object_id *old_oid,
+				const struct object_id *new_oid)
+{
+	struct tree_desc t1, t2;
+	void *buf1, *buf2;
+	int ret = 0;
+
+	buf1 = read_tree_for_paths(r, old_oid, &t1);
+	buf2 = read_tree_for_paths(r, new_oid, &t2);
+
+	while (!ret && (t1.size || t2.size)) {
+		struct name_entry *e1 = &t1.entry, *e2 = &t2.entry;
+		int cmp;
+
+		if (!t1.size)
+			cmp = 1;
+		else if (!t2.size)
+			cmp = -1;
+		else
+			cmp = base_name_compare(e1->path, tree_entry_len(e1), e1->mode,
+						e2->path, tree_entry_len(e2), e2->mode);
+
+		if (!cmp) {
+			if (!oideq(&e1->oid, &e2->oid) || e1->mode != e2->mode)
+				ret = add_changed_entry(r, paths, e1, e2);
+			update_tree_entry(&t1);
+			update_tree_entry(&t2);
+		} else if (cmp < 0) {
+			ret = add_changed_entry(r, paths, e1, NULL);
+			update_tree_entry(&t1);
+		} else {
+			ret = add_changed_entry(r, paths, NULL, e2);
+			update_tree_entry(&t2);
+		}
+	}
+
+	free(buf1);
+	free(buf2);
+	return ret;
+}
+
+static int add_changed_entry(struct repository *r,
+			     struct changed_paths *paths,
+			     const struct name_entry *old,
+			     const struct name_entry *new)
+{
+	const struct name_entry *e = new ? new : old;
+	size_t len = paths->path.len;
+	int ret = 0;
+
+	strbuf_add(&paths->path, e->path, tree_entry_len(e));
+	if (S_ISDIR(e->mode)) {
+		strbuf_addch(&paths->path, '/');
+		ret = diff_trees_for_paths(r, paths, old ? &old->oid : NULL,
+					   new ? &new->oid : NULL);
+	} else if (++paths->nr > paths->max) {
+		ret = -1;
+	} else {
+		/* add_changed_path() chops up the path it is given */
+		strbuf_reset(&paths->scratch);
+		strbuf_addbuf(&paths->scratch, &paths->path);
+		add_changed_path(&paths->pathmap, paths->scratch.buf);
+	}
+	strbuf_setlen(&paths->path, len);
+	return ret;
+}
+
+static void compute_filter_from_trees(struct repository *r,
+				      struct bloom_filter *filter,
+				      const struct object_id *parent_tree,
+				      const struct object_id *tree,
+				      const struct bloom_filter_settings *settings,
+				      enum bloom_filter_computed *computed)
+{
+	struct changed_paths paths = {
+		.pathmap = HASHMAP_INIT(pathmap_cmp, NULL),
+		.path = STRBUF_INIT,
+		.scratch = STRBUF_INIT,
+		.max = settings->max_changed_paths,
+	};
+
+	*computed = BLOOM_COMPUTED;
+	if (diff_trees_for_paths(r, &paths, parent_tree, tree) < 0) {
+		init_truncated_large_filter(filter);
+		*computed |= BLOOM_TRUNC_LARGE;
+	} else {
+		fill_filter_from_paths(filter, &paths.pathmap, settings,
+				       computed);
+	}
+
+	hashmap_clear_and_free(&paths.pathmap, struct pathmap_hash_entry, entry);
+	strbuf_release(&paths.path);
+	strbuf_release(&paths.scratch);
+}
+
+struct bloom_todo {
+	struct bloom_filter *filter;
+	const struct object_id *parent_tree, *tree;
+	enum bloom_filter_computed *computed;
+};
+
+struct bloom_threads {
+	struct repository *r;
+	const struct bloom_filter_settings *settings;
+	struct bloom_todo *todo;
+	size_t nr, next;
+	pthread_mutex_t mutex;
+};
+
+static void *compute_bloom_filters_thread(void *arg)
+{
+	struct bloom_threads *st = arg;
+
+	for (;;) {
+		struct bloom_todo *todo;
+
+		pthread_mutex_lock(&st->mutex);
+		todo = st->next < st->nr ? &st->todo[st->next++] : NULL;
+		pthread_mutex_unlock(&st->mutex);
+		if (!todo)
+			break;
+
+		compute_filter_from_trees(st->r, todo->filter,
+					  todo->parent_tree, todo->tree,
+					  st->settings, todo->computed);
+	}
+	return NULL;
+}
+
+int compute_bloom_filters_in_threads(struct repository *r,
+				     struct commit **commits, size_t nr,
+				     size_t max_new_filters,
+				     const struct bloom_filter_settings *settings,
+				     enum bloom_filter_computed *computed,
+				     int nr_threads)
+{
+	struct bloom_threads st = {
+		.r = r,
+		.settings = settings,
+	};
+	pthread_t *threads;
+	size_t i, alloc = 0;
+	int ret;
+
+	if (!HAVE_THREADS || nr_threads <= 1 || !bloom_filters.slab_size ||
+	    repo_has_promisor_remote(r))
+		return -1;
+
+	/*
+	 * Load the filters that are already there, and find the trees of
+	 * those that are not, up front: neither the commit-graph, nor the
+	 * commits, nor the slab of filters may be touched from threads.
+	 */
+	for (i = 0; i < nr; i++) {
+		struct commit *c = commits[i];
+		struct bloom_filter *filter;
+		struct bloom_todo *todo;
+
+		computed[i] = BLOOM_NOT_COMPUTED;
+		filter = bloom_filter_slab_at(&bloom_filters, c);
+		if (!filter->data) {
+			uint32_t graph_pos;
+			if (repo_find_commit_pos_in_graph(r, c, &graph_pos))
+				load_bloom_filter_from_graph(r->objects->commit_graph,
+							     filter, graph_pos,
+							     settings);
+		}
+		if ((filter->data && filter->len) || st.nr >= max_new_filters)
+			continue;
+
+		repo_parse_commit(r, c);
+		ALLOC_GROW(st.todo, st.nr + 1, alloc);
+		todo = &st.todo[st.nr++];
+		todo->filter = filter;
+		todo->tree = get_commit_tree_oid(c);
+		todo->parent_tree = NULL;
+		if (c->parents) {
+			repo_parse_commit(r, c->parents->item);
+			todo->parent_tree = get_commit_tree_oid(c->parents->item);
+		}
+		todo->computed = &computed[i];
+	}
+
+	if (nr_threads > st.nr)
+		nr_threads = st.nr;
+
+	pthread_mutex_init(&st.mutex, NULL);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL,
+				     compute_bloom_filters_thread, &st);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&st.mutex);
+	free(threads);
+	free(st.todo);
+	return 0;
+}
@@ -7,9 +7,12 @@ struct repository;
 struct bloom_filter_settings {
 	/*
 	 * The version of the hashing technique being used.
-	 * We currently only support version = 1 which is
-	 * the seeded murmur3 hashing technique implemented
-	 * in bloom.c.
+	 * Version 1 is the seeded murmur3 hashing technique
+	 * implemented in bloom.c, which sets bits anywhere in
+	 * the filter. Version 2 uses the same hashes, but sets
+	 * all the bits of a path in one block of
+	 * BLOOM_BLOCK_SIZE bytes, so that looking it up touches
+	 * a single cache line.
 	 */
 	uint32_t hash_version;
 
@@ -38,6 +41,10 @@ struct bloom_filter_settings {
 	uint32_t max_changed_paths;
 };
 
+#define BLOOM_HASH_VERSION_MURMUR3 1
+#define BLOOM_HASH_VERSION_BLOCKED 2
+#define BLOOM_BLOCK_SIZE 64
+
 #define DEFAULT_BLOOM_MAX_CHANGES 512
 #define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10, DEFAULT_BLOOM_MAX_CHANGES }
 #define BITS_PER_WORD 8
@@ -63,11 +70,25 @@ struct bloom_filter {
  * for all Bloom filters and keys interacting with
  * the loaded version of the commit graph file and
  * the Bloom data chunks.
+ *
+ * Keys for blocked filters carry one more hash, which
+ * picks the block the other ones are looked up in.
  */
 struct bloom_key {
 	uint32_t *hashes;
 };
 
+/*
+ * A bloom_keyvec holds the keys of a path and of all its
+ * leading directories, e.g. "a/b/c", "a/b" and "a". A
+ * filter may only contain a change to that path if it
+ * contains all of them.
+ */
+struct bloom_keyvec {
+	size_t count;
+	struct bloom_key key[FLEX_ARRAY];
+};
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -83,6 +104,14 @@ void fill_bloom_key(const char *data,
 		    const struct bloom_filter_settings *settings);
 void clear_bloom_key(struct bloom_key *key);
 
+/*
+ * Fill a new bloom_keyvec with the keys of the "len" bytes
+ * of "path", which must not end in a slash.
+ */
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings);
@@ -105,8 +134,36 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 #define get_bloom_filter(r, c) get_or_compute_bloom_filter( \
 	(r), (c), 0, NULL, NULL)
 
+/*
+ * Compute the missing Bloom filters of up to "max_new_filters" of the
+ * "nr" commits (in the given order, like calling
+ * get_or_compute_bloom_filter() on each of them would), spread over
+ * "nr_threads" threads; their results are stored in "computed", one
+ * for each commit. The filters that are already there are loaded, too,
+ * so that get_bloom_filter() returns the filters of all the commits
+ * afterwards.
+ *
+ * Returns -1, without doing anything, if the filters cannot be
+ * computed in threads, e.g. because objects may have to be fetched
+ * from a promisor remote.
+ */
+int compute_bloom_filters_in_threads(struct repository *r,
+				     struct commit **commits, size_t nr,
+				     size_t max_new_filters,
+				     const struct bloom_filter_settings *settings,
+				     enum bloom_filter_computed *computed,
+				     int nr_threads);
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Like bloom_filter_contains(), but check all the keys of "vec";
+ * returns 0 if any of them is definitely not in the filter.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings);
+
 #endif
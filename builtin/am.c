@@ -1509,8 +1509,11 @@ static int run_apply(const struct am_state *state, const char *index_file)
 	if (index_file) {
 		apply_state.index_file = index_file;
 		apply_state.cached = 1;
-	} else
+	} else {
 		apply_state.check_index = 1;
+		/* do_commit() writes a tree right after */
+		apply_state.update_cache_tree = 1;
+	}
 
 	/*
 	 * If we are allowed to fall back on 3-way merge, don't give false
@@ -2423,6 +2426,8 @@ int cmd_am(int argc, const char **argv, const char *prefix)
 	/* Ensure a valid committer ident can be constructed */
 	git_committer_info(IDENT_STRICT);
 
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
 	if (repo_read_index_preload(the_repository, NULL, 0) < 0)
 		die(_("failed to read the index"));
 
@@ -2,6 +2,7 @@
 #include "gettext.h"
 #include "parse-options.h"
 #include "repository.h"
+#include "setup.h"
 #include "apply.h"
 
 static const char * const apply_usage[] = {
@@ -26,6 +27,11 @@ int cmd_apply(int argc, const char **argv, const char *prefix)
 	if (check_apply_state(&state, force_apply))
 		exit(128);
 
+	if (startup_info->have_repository) {
+		prepare_repo_settings(the_repository);
+		the_repository->settings.command_requires_full_index = 0;
+	}
+
 	ret = apply_all_patches(&state, argc, argv, options);
 
 	clear_apply_state(&state);
@@ -71,6 +71,7 @@ static int coloring_mode;
 static struct string_list ignore_revs_file_list = STRING_LIST_INIT_NODUP;
 static int mark_unblamable_lines;
 static int mark_ignored_lines;
+static int use_blame_cache;
 
 static struct date_mode blame_date_mode = { DATE_ISO8601 };
 static size_t blame_date_width;
@@ -736,6 +737,10 @@ static int git_blame_config(const char *var, const char *value,
 		mark_ignored_lines = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "color.blame.repeatedlines")) {
 		if (color_parse_mem(value, strlen(value), repeated_meta_color))
 			warning(_("invalid value for '%s': '%s'"),
@@ -861,6 +866,117 @@ static void build_ignorelist(struct blame_scoreboard *sb,
 	}
 }
 
+static void output_blame(struct blame_scoreboard *sb, int output_option)
+{
+	blame_sort_final(sb);
+
+	blame_coalesce(sb);
+
+	if (!(output_option & (OUTPUT_COLOR_LINE | OUTPUT_SHOW_AGE_WITH_COLOR)))
+		output_option |= coloring_mode;
+
+	if (!(output_option & OUTPUT_PORCELAIN)) {
+		find_alignment(sb, &output_option);
+		if (!*repeated_meta_color &&
+		    (output_option & OUTPUT_COLOR_LINE))
+			xsnprintf(repeated_meta_color,
+				  sizeof(repeated_meta_color),
+				  "%s", GIT_COLOR_CYAN);
+	}
+	if (output_option & OUTPUT_ANNOTATE_COMPAT)
+		output_option &= ~(OUTPUT_COLOR_LINE | OUTPUT_SHOW_AGE_WITH_COLOR);
+
+	output(sb, output_option);
+}
+
+/*
+ * Blame each path read from the standard input in turn, reusing the
+ * revision walk, the commits parsed and the diffs cached while blaming
+ * the paths before it.  Each blame is followed by an empty line.
+ */
+static void blame_batch(struct blame_scoreboard *sb, const char *prefix,
+			int opt, int output_option)
+{
+	struct strbuf line = STRBUF_INIT;
+	int saved_abbrev = abbrev;
+
+	if (prepare_scoreboard(sb))
+		die(_("--batch needs a commit to blame from"));
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		struct blame_origin *o;
+		struct blame_entry *ent;
+		const char *path;
+
+		if (!line.len)
+			continue;
+		path = add_prefix(prefix, line.buf);
+		sb->path = path;
+		if (setup_scoreboard_path(sb, &o)) {
+			error(_("no such path %s"), path);
+			free((char *)path);
+			goto next;
+		}
+
+		/*
+		 * Changed-path Bloom filters are disabled when looking
+		 * for copies.
+		 */
+		if (!(opt & PICKAXE_BLAME_COPY))
+			setup_blame_bloom_data(sb);
+
+		if (sb->num_lines)
+			o->suspects = blame_entry_prepend(NULL, 0, sb->num_lines, o);
+		prio_queue_put(&sb->commits, o->commit);
+		blame_origin_decref(o);
+
+		sb->ent = NULL;
+		assign_blame(sb, opt);
+		blame_cache_write(sb);
+		if (!incremental)
+			output_blame(sb, output_option);
+
+		for (ent = sb->ent; ent; ) {
+			struct blame_entry *e = ent->next;
+			ent->suspect->commit->object.flags &=
+				~(METAINFO_SHOWN | MORE_THAN_ONE_PATH);
+			blame_origin_decref(ent->suspect);
+			free(ent);
+			ent = e;
+		}
+		free((void *)sb->final_buf);
+		sb->final_buf = NULL;
+		cleanup_scoreboard(sb);
+		free((char *)path);
+		abbrev = saved_abbrev;
+		longest_file = longest_author = 0;
+	next:
+		putchar('\n');
+		maybe_flush_or_die(stdout, "blame output");
+	}
+	strbuf_release(&line);
+}
+
+/*
+ * The blame cache records where the lines of a file in a commit come
+ * from; only use it when that does not depend on anything else.
+ */
+static int can_use_blame_cache(struct blame_scoreboard *sb, int opt,
+			       const char *revs_file)
+{
+	struct rev_info *revs = sb->revs;
+	int i;
+
+	if (!use_blame_cache || opt || sb->reverse || revs_file ||
+	    revs->first_parent_only || revs->max_age != -1 ||
+	    oidset_size(&sb->ignore_list))
+		return 0;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 0;
+	return 1;
+}
+
 int cmd_blame(int argc, const char **argv, const char *prefix)
 {
 	struct rev_info revs;
@@ -875,6 +991,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	struct string_list ignore_rev_list = STRING_LIST_INIT_NODUP;
 	int output_option = 0, opt = 0;
 	int show_stats = 0;
+	int batch = 0;
 	const char *revs_file = NULL;
 	const char *contents_from = NULL;
 	const struct option options[] = {
@@ -901,6 +1018,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 		OPT_BIT(0, "minimal", &xdl_opts, N_("spend extra cycles to find better match"), XDF_NEED_MINIMAL),
 		OPT_STRING('S', NULL, &revs_file, N_("file"), N_("use revisions from <file> instead of calling git-rev-list")),
 		OPT_STRING(0, "contents", &contents_from, N_("file"), N_("use <file>'s contents as the final image")),
+		OPT_BOOL(0, "batch", &batch, N_("blame the paths read from the standard input")),
 		OPT_CALLBACK_F('C', NULL, &opt, N_("score"), N_("find line copies within and across files"), PARSE_OPT_OPTARG, blame_copy_callback),
 		OPT_CALLBACK_F('M', NULL, &opt, N_("score"), N_("find line movements within and across files"), PARSE_OPT_OPTARG, blame_move_callback),
 		OPT_STRING_LIST('L', NULL, &range_list, N_("range"),
@@ -916,6 +1034,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	long anchor;
 	const int hexsz = the_hash_algo->hexsz;
 	long num_lines = 0;
+	int whole_file;
 	const char *str_usage = cmd_is_annotate ? annotate_usage : blame_usage;
 	const char **opt_usage = cmd_is_annotate ? annotate_opt_usage : blame_opt_usage;
 
@@ -1055,7 +1174,19 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	 * Note that we must strip out <path> from the arguments: we do not
 	 * want the path pruning but we may want "bottom" processing.
 	 */
-	if (dashdash_pos) {
+	if (batch) {
+		/* "blame --batch [revisions]", with the paths on stdin */
+		if (range_list.nr)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch", "-L");
+		if (contents_from)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch", "--contents");
+		if (dashdash_pos)
+			usage_with_options(opt_usage, options);
+		path = NULL;
+		show_progress = 0;
+	} else if (dashdash_pos) {
 		switch (argc - dashdash_pos - 1) {
 		case 2: /* (1b) */
 			if (argc != 4)
@@ -1088,7 +1219,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	revs.disable_stdin = 1;
 	setup_revisions(argc, argv, &revs, NULL);
-	if (!revs.pending.nr && is_bare_repository()) {
+	if (!revs.pending.nr && (batch || is_bare_repository())) {
 		struct commit *head_commit;
 		struct object_id head_oid;
 
@@ -1110,6 +1241,30 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	build_ignorelist(&sb, &ignore_revs_file_list, &ignore_rev_list);
 	string_list_clear(&ignore_revs_file_list, 0);
 	string_list_clear(&ignore_rev_list, 0);
+
+	if (blame_move_score)
+		sb.move_score = blame_move_score;
+	if (blame_copy_score)
+		sb.copy_score = blame_copy_score;
+
+	sb.debug = DEBUG_BLAME;
+	sb.on_sanity_fail = &sanity_check_on_fail;
+
+	sb.show_root = show_root;
+	sb.xdl_opts = xdl_opts;
+	sb.no_whole_file_rename = no_whole_file_rename;
+
+	read_mailmap(&mailmap);
+
+	sb.found_guilty_entry = &found_guilty_entry;
+	sb.found_guilty_entry_data = &pi;
+	sb.use_cache = can_use_blame_cache(&sb, opt, revs_file);
+
+	if (batch) {
+		blame_batch(&sb, prefix, opt, output_option);
+		goto show_stats;
+	}
+
 	setup_scoreboard(&sb, &o);
 
 	/*
@@ -1121,7 +1276,8 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	lno = sb.num_lines;
 
-	if (lno && !range_list.nr)
+	whole_file = !range_list.nr;
+	if (lno && whole_file)
 		string_list_append(&range_list, "1");
 
 	anchor = 1;
@@ -1165,22 +1321,6 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	sb.ent = NULL;
 
-	if (blame_move_score)
-		sb.move_score = blame_move_score;
-	if (blame_copy_score)
-		sb.copy_score = blame_copy_score;
-
-	sb.debug = DEBUG_BLAME;
-	sb.on_sanity_fail = &sanity_check_on_fail;
-
-	sb.show_root = show_root;
-	sb.xdl_opts = xdl_opts;
-	sb.no_whole_file_rename = no_whole_file_rename;
-
-	read_mailmap(&mailmap);
-
-	sb.found_guilty_entry = &found_guilty_entry;
-	sb.found_guilty_entry_data = &pi;
 	if (show_progress)
 		pi.progress = start_delayed_progress(_("Blaming lines"), num_lines);
 
@@ -1188,30 +1328,15 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	stop_progress(&pi.progress);
 
+	if (whole_file)
+		blame_cache_write(&sb);
+
 	if (!incremental)
 		setup_pager();
 	else
 		goto cleanup;
 
-	blame_sort_final(&sb);
-
-	blame_coalesce(&sb);
-
-	if (!(output_option & (OUTPUT_COLOR_LINE | OUTPUT_SHOW_AGE_WITH_COLOR)))
-		output_option |= coloring_mode;
-
-	if (!(output_option & OUTPUT_PORCELAIN)) {
-		find_alignment(&sb, &output_option);
-		if (!*repeated_meta_color &&
-		    (output_option & OUTPUT_COLOR_LINE))
-			xsnprintf(repeated_meta_color,
-				  sizeof(repeated_meta_color),
-				  "%s", GIT_COLOR_CYAN);
-	}
-	if (output_option & OUTPUT_ANNOTATE_COMPAT)
-		output_option &= ~(OUTPUT_COLOR_LINE | OUTPUT_SHOW_AGE_WITH_COLOR);
-
-	output(&sb, output_option);
+	output_blame(&sb, output_option);
 	free((void *)sb.final_buf);
 	for (ent = sb.ent; ent; ) {
 		struct blame_entry *e = ent->next;
@@ -1219,6 +1344,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 		ent = e;
 	}
 
+show_stats:
 	if (show_stats) {
 		printf("num read blob: %d\n", sb.num_read_blob);
 		printf("num get patch: %d\n", sb.num_get_patch);
@@ -18,6 +18,8 @@
 #include "tree-walk.h"
 #include "oid-array.h"
 #include "packfile.h"
+#include "pack-revindex.h"
+#include "midx.h"
 #include "object-file.h"
 #include "object-name.h"
 #include "object-store-ll.h"
@@ -25,6 +27,7 @@
 #include "promisor-remote.h"
 #include "mailmap.h"
 #include "write-or-die.h"
+#include "thread-utils.h"
 
 enum batch_mode {
 	BATCH_MODE_CONTENTS,
@@ -43,6 +46,7 @@ struct batch_options {
 	char input_delim;
 	char output_delim;
 	const char *format;
+	int nr_threads;
 };
 
 static const char *force_path;
@@ -310,9 +314,12 @@ static int is_atom(const char *atom, const char *s, int slen)
 static void expand_atom(struct strbuf *sb, const char *atom, int len,
 			struct expand_data *data)
 {
+	/* not oid_to_hex(), as --batch-threads formats in parallel */
+	char hex[GIT_MAX_HEXSZ + 1];
+
 	if (is_atom("objectname", atom, len)) {
 		if (!data->mark_query)
-			strbuf_addstr(sb, oid_to_hex(&data->oid));
+			strbuf_addstr(sb, oid_to_hex_r(hex, &data->oid));
 	} else if (is_atom("objecttype", atom, len)) {
 		if (data->mark_query)
 			data->info.typep = &data->type;
@@ -338,7 +345,7 @@ static void expand_atom(struct strbuf *sb, const char *atom, int len,
 			data->info.delta_base_oid = &data->delta_base_oid;
 		else
 			strbuf_addstr(sb,
-				      oid_to_hex(&data->delta_base_oid));
+				      oid_to_hex_r(hex, &data->delta_base_oid));
 	} else
 		die("unknown format element: %.*s", len, atom);
 }
@@ -369,6 +376,36 @@ static void batch_write(struct batch_options *opt, const void *data, int len)
 		write_or_die(1, data, len);
 }
 
+/*
+ * Stream a blob into our stdio buffer, rather than flushing it and writing
+ * to the file descriptor directly as stream_blob() does. Large non-delta
+ * blobs in a pack are inflated straight into the chunk we hand to
+ * fwrite(), so they are never held in memory as a whole.
+ */
+static void stream_blob_buffered(const struct object_id *oid)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long size;
+	static char buf[1024 * 64];
+
+	st = open_istream(the_repository, oid, &type, &size, NULL);
+	if (!st || type != OBJ_BLOB)
+		die("unable to stream %s to stdout", oid_to_hex(oid));
+
+	for (;;) {
+		ssize_t readlen = read_istream(st, buf, sizeof(buf));
+
+		if (readlen < 0)
+			die("unable to stream %s to stdout", oid_to_hex(oid));
+		if (!readlen)
+			break;
+		if (fwrite(buf, 1, readlen, stdout) != readlen)
+			die_errno("unable to write to stdout");
+	}
+	close_istream(st);
+}
+
 static void print_object_or_die(struct batch_options *opt, struct expand_data *data)
 {
 	const struct object_id *oid = &data->oid;
@@ -376,8 +413,6 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 	assert(data->info.typep);
 
 	if (data->type == OBJ_BLOB) {
-		if (opt->buffer_output)
-			fflush(stdout);
 		if (opt->transform_mode) {
 			char *contents;
 			unsigned long size;
@@ -406,6 +441,8 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 				BUG("invalid transform_mode: %c", opt->transform_mode);
 			batch_write(opt, contents, size);
 			free(contents);
+		} else if (opt->buffer_output) {
+			stream_blob_buffered(oid);
 		} else {
 			stream_blob(oid);
 		}
@@ -439,7 +476,9 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 static void print_default_format(struct strbuf *scratch, struct expand_data *data,
 				 struct batch_options *opt)
 {
-	strbuf_addf(scratch, "%s %s %"PRIuMAX"%c", oid_to_hex(&data->oid),
+	char hex[GIT_MAX_HEXSZ + 1];
+
+	strbuf_addf(scratch, "%s %s %"PRIuMAX"%c", oid_to_hex_r(hex, &data->oid),
 		    type_name(data->type),
 		    (uintmax_t)data->size, opt->output_delim);
 }
@@ -506,10 +545,15 @@ static void batch_object_write(const char *obj_name,
 	}
 }
 
-static void batch_one_object(const char *obj_name,
-			     struct strbuf *scratch,
-			     struct batch_options *opt,
-			     struct expand_data *data)
+/*
+ * Resolve "obj_name" into data->oid. Returns 0 if there is an object to
+ * report on, or -1 after adding the response for a name that does not
+ * resolve (or resolves to an out-of-tree symlink) to "out".
+ */
+static int batch_resolve_object(const char *obj_name,
+				struct strbuf *out,
+				struct batch_options *opt,
+				struct expand_data *data)
 {
 	struct object_context ctx;
 	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
@@ -520,39 +564,52 @@ static void batch_one_object(const char *obj_name,
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
-			printf("%s missing%c", obj_name, opt->output_delim);
+			strbuf_addf(out, "%s missing%c", obj_name, opt->output_delim);
 			break;
 		case SHORT_NAME_AMBIGUOUS:
-			printf("%s ambiguous%c", obj_name, opt->output_delim);
+			strbuf_addf(out, "%s ambiguous%c", obj_name, opt->output_delim);
 			break;
 		case DANGLING_SYMLINK:
-			printf("dangling %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
+			strbuf_addf(out, "dangling %"PRIuMAX"%c%s%c",
+				    (uintmax_t)strlen(obj_name),
+				    opt->output_delim, obj_name, opt->output_delim);
 			break;
 		case SYMLINK_LOOP:
-			printf("loop %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
+			strbuf_addf(out, "loop %"PRIuMAX"%c%s%c",
+				    (uintmax_t)strlen(obj_name),
+				    opt->output_delim, obj_name, opt->output_delim);
 			break;
 		case NOT_DIR:
-			printf("notdir %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
+			strbuf_addf(out, "notdir %"PRIuMAX"%c%s%c",
+				    (uintmax_t)strlen(obj_name),
+				    opt->output_delim, obj_name, opt->output_delim);
 			break;
 		default:
 			BUG("unknown get_sha1_with_context result %d\n",
 			       result);
 			break;
 		}
-		fflush(stdout);
-		return;
+		return -1;
 	}
 
 	if (ctx.mode == 0) {
-		printf("symlink %"PRIuMAX"%c%s%c",
-		       (uintmax_t)ctx.symlink_path.len,
-		       opt->output_delim, ctx.symlink_path.buf, opt->output_delim);
+		strbuf_addf(out, "symlink %"PRIuMAX"%c%s%c",
+			    (uintmax_t)ctx.symlink_path.len,
+			    opt->output_delim, ctx.symlink_path.buf, opt->output_delim);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void batch_one_object(const char *obj_name,
+			     struct strbuf *scratch,
+			     struct batch_options *opt,
+			     struct expand_data *data)
+{
+	strbuf_reset(scratch);
+	if (batch_resolve_object(obj_name, scratch, opt, data) < 0) {
+		fwrite(scratch->buf, 1, scratch->len, stdout);
 		fflush(stdout);
 		return;
 	}
@@ -625,6 +682,42 @@ static int batch_unordered_packed(const struct object_id *oid,
 				      data);
 }
 
+/*
+ * Visit the objects of each multi-pack-index in its pseudo-pack order,
+ * i.e. in the order in which they are laid out on disk, rather than one
+ * pack after another, which would revisit objects the midx resolved to
+ * a different pack. Returns -1 without visiting anything if some midx
+ * has no reverse index.
+ */
+static int batch_unordered_midx(struct object_cb_data *cb)
+{
+	struct multi_pack_index *m;
+	struct object_id oid;
+
+	for (m = get_multi_pack_index(the_repository); m; m = m->next)
+		if (load_midx_revindex(m))
+			return -1;
+
+	for (m = get_multi_pack_index(the_repository); m; m = m->next) {
+		uint32_t i;
+
+		for (i = 0; i < m->num_objects; i++) {
+			uint32_t midx_pos = pack_pos_to_midx(m, i);
+			uint32_t pack_int_id = nth_midxed_pack_int_id(m, midx_pos);
+
+			if (prepare_midx_pack(the_repository, m, pack_int_id))
+				continue;
+
+			nth_midxed_object_oid(&oid, m, midx_pos);
+			batch_unordered_object(&oid, m->packs[pack_int_id],
+					       nth_midxed_offset(m, midx_pos),
+					       cb);
+		}
+	}
+
+	return 0;
+}
+
 typedef void (*parse_cmd_fn_t)(struct batch_options *, const char *,
 			       struct strbuf *, struct expand_data *);
 
@@ -757,6 +850,243 @@ static void batch_objects_command(struct batch_options *opt,
 
 #define DEFAULT_FORMAT "%(objectname) %(objecttype) %(objectsize)"
 
+/*
+ * With --batch-threads, the main thread reads and resolves the names on
+ * stdin and queues them in a ring of jobs. Worker threads look up and read
+ * the objects, formatting each job's complete response into its own
+ * buffer. Whichever thread completes the oldest outstanding job writes out
+ * all consecutive finished responses, so that the output is in the same
+ * order as the input, and appears as soon as it is ready.
+ */
+struct batch_job {
+	struct expand_data data;
+	char *obj_name;
+	char *rest;
+	struct strbuf out;
+	unsigned done : 1;
+};
+
+static struct batch_job *jobs;
+static size_t jobs_nr;
+/* jobs [job_start, job_next) are taken, [job_next, job_end) are queued */
+static size_t job_start, job_next, job_end;
+static int all_jobs_added;
+
+static pthread_mutex_t job_mutex;
+/* signalled when a job is queued, or when no more jobs will be queued */
+static pthread_cond_t cond_add;
+/* signalled when a job slot becomes free */
+static pthread_cond_t cond_write;
+
+static void init_job_data(struct expand_data *dst,
+			  const struct expand_data *tmpl)
+{
+	*dst = *tmpl;
+	if (tmpl->info.typep)
+		dst->info.typep = &dst->type;
+	if (tmpl->info.sizep)
+		dst->info.sizep = &dst->size;
+	if (tmpl->info.disk_sizep)
+		dst->info.disk_sizep = &dst->disk_size;
+	if (tmpl->info.delta_base_oid)
+		dst->info.delta_base_oid = &dst->delta_base_oid;
+}
+
+/*
+ * The threaded counterpart of batch_object_write(), collecting the
+ * response in job->out rather than writing it out.
+ */
+static void batch_job_run(struct batch_options *opt, struct batch_job *job)
+{
+	struct expand_data *data = &job->data;
+	struct strbuf *out = &job->out;
+
+	if (!data->skip_object_info &&
+	    oid_object_info_extended(the_repository, &data->oid, &data->info,
+				     OBJECT_INFO_LOOKUP_REPLACE) < 0) {
+		strbuf_addf(out, "%s missing%c", job->obj_name,
+			    opt->output_delim);
+		return;
+	}
+
+	if (!opt->format) {
+		print_default_format(out, data, opt);
+	} else {
+		expand_format(out, opt->format, data);
+		strbuf_addch(out, opt->output_delim);
+	}
+
+	if (opt->batch_mode == BATCH_MODE_CONTENTS) {
+		enum object_type type;
+		unsigned long size;
+		void *contents;
+
+		contents = repo_read_object_file(the_repository, &data->oid,
+						 &type, &size);
+		if (!contents)
+			die("object %s disappeared", oid_to_hex(&data->oid));
+		if (type != data->type)
+			die("object %s changed type!?", oid_to_hex(&data->oid));
+		if (data->info.sizep && size != data->size)
+			die("object %s changed size!?", oid_to_hex(&data->oid));
+
+		strbuf_add(out, contents, size);
+		strbuf_addch(out, opt->output_delim);
+		free(contents);
+	}
+}
+
+/* Write out finished jobs in order; call with job_mutex held. */
+static void write_done_jobs(struct batch_options *opt)
+{
+	while (job_start != job_end && jobs[job_start].done) {
+		struct batch_job *job = &jobs[job_start];
+
+		batch_write(opt, job->out.buf, job->out.len);
+		strbuf_reset(&job->out);
+		FREE_AND_NULL(job->obj_name);
+		FREE_AND_NULL(job->rest);
+		job->done = 0;
+
+		if (job_next == job_start)
+			job_next = (job_next + 1) % jobs_nr;
+		job_start = (job_start + 1) % jobs_nr;
+		pthread_cond_signal(&cond_write);
+	}
+}
+
+static struct batch_job *get_job(void)
+{
+	struct batch_job *job = NULL;
+
+	pthread_mutex_lock(&job_mutex);
+	for (;;) {
+		/* responses filled in by the main thread need no work */
+		while (job_next != job_end && jobs[job_next].done)
+			job_next = (job_next + 1) % jobs_nr;
+		if (job_next != job_end) {
+			job = &jobs[job_next];
+			job_next = (job_next + 1) % jobs_nr;
+			break;
+		}
+		if (all_jobs_added)
+			break;
+		pthread_cond_wait(&cond_add, &job_mutex);
+	}
+	pthread_mutex_unlock(&job_mutex);
+
+	return job;
+}
+
+static void *batch_worker(void *data)
+{
+	struct batch_options *opt = data;
+	struct batch_job *job;
+
+	while ((job = get_job())) {
+		batch_job_run(opt, job);
+
+		pthread_mutex_lock(&job_mutex);
+		job->done = 1;
+		write_done_jobs(opt);
+		pthread_mutex_unlock(&job_mutex);
+	}
+
+	return NULL;
+}
+
+static void add_job(struct batch_options *opt, const struct expand_data *tmpl,
+		    const char *obj_name, const char *rest)
+{
+	struct batch_job *job;
+
+	pthread_mutex_lock(&job_mutex);
+	while ((job_end + 1) % jobs_nr == job_start)
+		pthread_cond_wait(&cond_write, &job_mutex);
+	pthread_mutex_unlock(&job_mutex);
+
+	/* the slot at job_end is not visible to other threads yet */
+	job = &jobs[job_end];
+	init_job_data(&job->data, tmpl);
+	job->obj_name = xstrdup(obj_name);
+	job->rest = xstrdup_or_null(rest);
+	job->data.rest = job->rest;
+
+	/*
+	 * Resolving names may read objects; hold the lock so that we do not
+	 * race with the workers doing the same.
+	 */
+	obj_read_lock();
+	if (batch_resolve_object(obj_name, &job->out, opt, &job->data) < 0)
+		job->done = 1;
+	obj_read_unlock();
+
+	pthread_mutex_lock(&job_mutex);
+	job_end = (job_end + 1) % jobs_nr;
+	if (job->done)
+		write_done_jobs(opt);
+	else
+		pthread_cond_signal(&cond_add);
+	pthread_mutex_unlock(&job_mutex);
+}
+
+static void batch_objects_threaded(struct batch_options *opt,
+				   struct strbuf *input,
+				   struct expand_data *data)
+{
+	pthread_t *threads;
+	size_t i;
+
+	/* enough to keep every thread busy while earlier output is written */
+	jobs_nr = st_mult(opt->nr_threads, 8);
+	CALLOC_ARRAY(jobs, jobs_nr);
+	for (i = 0; i < jobs_nr; i++)
+		strbuf_init(&jobs[i].out, 0);
+
+	pthread_mutex_init(&job_mutex, NULL);
+	pthread_cond_init(&cond_add, NULL);
+	pthread_cond_init(&cond_write, NULL);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, opt->nr_threads);
+	for (i = 0; i < opt->nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, batch_worker, opt);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	while (strbuf_getdelim_strip_crlf(input, stdin, opt->input_delim) != EOF) {
+		char *rest = NULL;
+
+		if (data->split_on_whitespace) {
+			rest = strpbrk(input->buf, " \t");
+			if (rest) {
+				while (*rest && strchr(" \t", *rest))
+					*rest++ = '\0';
+			}
+		}
+		add_job(opt, data, input->buf, rest);
+	}
+
+	pthread_mutex_lock(&job_mutex);
+	all_jobs_added = 1;
+	pthread_cond_broadcast(&cond_add);
+	pthread_mutex_unlock(&job_mutex);
+
+	for (i = 0; i < opt->nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&cond_write);
+	pthread_cond_destroy(&cond_add);
+	pthread_mutex_destroy(&job_mutex);
+
+	for (i = 0; i < jobs_nr; i++)
+		strbuf_release(&jobs[i].out);
+	FREE_AND_NULL(jobs);
+	free(threads);
+}
+
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf input = STRBUF_INIT;
@@ -807,12 +1137,16 @@ static int batch_objects(struct batch_options *opt)
 
 		if (opt->unordered) {
 			struct oidset seen = OIDSET_INIT;
+			enum for_each_object_flags pack_flags =
+				FOR_EACH_OBJECT_PACK_ORDER;
 
 			cb.seen = &seen;
 
 			for_each_loose_object(batch_unordered_loose, &cb, 0);
+			if (!batch_unordered_midx(&cb))
+				pack_flags |= FOR_EACH_OBJECT_SKIP_MIDX_PACKS;
 			for_each_packed_object(batch_unordered_packed, &cb,
-					       FOR_EACH_OBJECT_PACK_ORDER);
+					       pack_flags);
 
 			oidset_clear(&seen);
 		} else {
@@ -845,6 +1179,11 @@ static int batch_objects(struct batch_options *opt)
 		goto cleanup;
 	}
 
+	if (opt->nr_threads > 1) {
+		batch_objects_threaded(opt, &input, &data);
+		goto cleanup;
+	}
+
 	while (strbuf_getdelim_strip_crlf(&input, stdin, opt->input_delim) != EOF) {
 		if (data.split_on_whitespace) {
 			/*
@@ -926,7 +1265,7 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		   "             [<rev>:<path|tree-ish> | --path=<path|tree-ish> <rev>]"),
 		N_("git cat-file (--batch | --batch-check | --batch-command) [--batch-all-objects]\n"
 		   "             [--buffer] [--follow-symlinks] [--unordered]\n"
-		   "             [--textconv | --filters] [-Z]"),
+		   "             [--textconv | --filters] [--batch-threads=<n>] [-Z]"),
 		NULL
 	};
 	const struct option options[] = {
@@ -969,6 +1308,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			 N_("follow in-tree symlinks")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
 			 N_("do not order objects before emitting them")),
+		OPT_INTEGER(0, "batch-threads", &batch.nr_threads,
+			    N_("read objects using <n> threads")),
 		/* Textconv options, stand-ole*/
 		OPT_GROUP(N_("Emit object (blob or tree) with conversion or filter (stand-alone, or with batch)")),
 		OPT_CMDMODE(0, "textconv", &opt,
@@ -983,6 +1324,7 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	git_config(git_cat_file_config, NULL);
 
 	batch.buffer_output = -1;
+	batch.nr_threads = 1;
 
 	argc = parse_options(argc, argv, prefix, options, usage, 0);
 	opt_cw = (opt == 'c' || opt == 'w');
@@ -1020,6 +1362,33 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	else if (nul_terminated)
 		usage_msg_optf(_("'%s' requires a batch mode"), usage, options,
 			       "-Z");
+	else if (batch.nr_threads != 1)
+		usage_msg_optf(_("'%s' requires a batch mode"), usage, options,
+			       "--batch-threads");
+
+	if (batch.nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"),
+		    batch.nr_threads);
+	if (!HAVE_THREADS && batch.nr_threads != 1) {
+		warning(_("no threads support, ignoring %s"), "--batch-threads");
+		batch.nr_threads = 1;
+	}
+	if (!batch.nr_threads)
+		batch.nr_threads = online_cpus();
+	if (batch.nr_threads > 1) {
+		if (batch.batch_mode == BATCH_MODE_QUEUE_AND_DISPATCH)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch-threads", "--batch-command");
+		if (batch.all_objects)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch-threads", "--batch-all-objects");
+		if (opt_cw)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch-threads", "--textconv/--filters");
+		if (use_mailmap)
+			die(_("options '%s' and '%s' cannot be used together"),
+			    "--batch-threads", "--use-mailmap");
+	}
 
 	batch.input_delim = batch.output_delim = '\n';
 	if (input_nul_terminated)
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "entry.h"
 #include "gettext.h"
+#include "hex.h"
 #include "parallel-checkout.h"
 #include "parse-options.h"
 #include "pkt-line.h"
@@ -21,7 +22,8 @@ static void packet_to_pc_item(const char *buffer, int len,
 	fixed_portion = (struct pc_item_fixed_portion *)buffer;
 
 	if (len - sizeof(struct pc_item_fixed_portion) !=
-		fixed_portion->name_len + fixed_portion->working_tree_encoding_len)
+		fixed_portion->name_len + fixed_portion->working_tree_encoding_len +
+		fixed_portion->driver_len)
 		BUG("checkout worker received corrupted item");
 
 	variant = buffer + sizeof(struct pc_item_fixed_portion);
@@ -41,6 +43,16 @@ static void packet_to_pc_item(const char *buffer, int len,
 	}
 
 	memset(pc_item, 0, sizeof(*pc_item));
+	if (fixed_portion->driver_len) {
+		char *driver = xmemdupz(variant, fixed_portion->driver_len);
+		variant += fixed_portion->driver_len;
+		conv_attrs_set_driver(&pc_item->ca, driver);
+		if (!pc_item->ca.drv)
+			BUG("checkout worker received unknown filter driver '%s'",
+			    driver);
+		free(driver);
+	}
+
 	pc_item->ce = make_empty_transient_cache_entry(fixed_portion->name_len, NULL);
 	pc_item->ce->ce_namelen = fixed_portion->name_len;
 	pc_item->ce->ce_mode = fixed_portion->ce_mode;
@@ -78,10 +90,75 @@ static void release_pc_item_data(struct parallel_checkout_item *pc_item)
 	discard_cache_entry(pc_item->ce);
 }
 
+/*
+ * Write the items that their filters delayed as the filters make them
+ * available, like finish_delayed_checkout() does in the main process.
+ */
+static void write_delayed_items(struct checkout *state,
+				struct delayed_checkout *dco)
+{
+	struct string_list_item *filter, *path;
+
+	dco->state = CE_RETRY;
+	while (dco->filters.nr > 0) {
+		for_each_string_list_item(filter, &dco->filters) {
+			struct string_list available_paths = STRING_LIST_INIT_DUP;
+
+			if (!async_query_available_blobs(filter->string,
+							 &available_paths) ||
+			    !available_paths.nr) {
+				/* The filter failed, or is done. */
+				filter->string = "";
+				string_list_clear(&available_paths, 0);
+				continue;
+			}
+
+			for_each_string_list_item(path, &available_paths) {
+				struct string_list_item *item;
+				struct parallel_checkout_item *pc_item;
+
+				item = string_list_lookup(&dco->paths, path->string);
+				if (!item || !item->util) {
+					error("external filter '%s' signaled that '%s' "
+					      "is now available although it has not been "
+					      "delayed earlier",
+					      filter->string, path->string);
+					filter->string = "";
+					continue;
+				}
+				pc_item = item->util;
+				item->util = NULL;
+				write_pc_item_or_delay(pc_item, state, dco);
+				report_result(pc_item);
+			}
+			string_list_clear(&available_paths, 0);
+		}
+		string_list_remove_empty_items(&dco->filters, 0);
+	}
+
+	for_each_string_list_item(path, &dco->paths) {
+		struct parallel_checkout_item *pc_item = path->util;
+
+		if (!pc_item)
+			continue;
+		error("'%s' was not filtered properly", path->string);
+		pc_item->status = PC_ITEM_FAILED;
+		report_result(pc_item);
+	}
+	string_list_clear(&dco->filters, 0);
+	string_list_clear(&dco->paths, 0);
+}
+
 static void worker_loop(struct checkout *state)
 {
 	struct parallel_checkout_item *items = NULL;
-	size_t i, nr = 0, alloc = 0;
+	struct delayed_checkout dco = {
+		.state = CE_CAN_DELAY,
+		.filters = STRING_LIST_INIT_NODUP,
+		.paths = STRING_LIST_INIT_NODUP,
+	};
+	struct parallel_checkout_item **delayed = NULL;
+	size_t i, nr = 0, alloc = 0, delayed_nr = 0, delayed_alloc = 0;
 
 	while (1) {
 		int len = packet_read(0, packet_buffer, sizeof(packet_buffer),
@@ -98,11 +175,26 @@ static void worker_loop(struct checkout *state)
 
 	for (i = 0; i < nr; i++) {
 		struct parallel_checkout_item *pc_item = &items[i];
-		write_pc_item(pc_item, state);
+
+		/* Only the long-running process filters can delay items. */
+		write_pc_item_or_delay(pc_item, state, &dco);
+		if (pc_item->status == PC_ITEM_DELAYED) {
+			string_list_lookup(&dco.paths, pc_item->ce->name)->util = pc_item;
+			ALLOC_GROW(delayed, delayed_nr + 1, delayed_alloc);
+			delayed[delayed_nr++] = pc_item;
+			continue;
+		}
 		report_result(pc_item);
 		release_pc_item_data(pc_item);
 	}
 
+	if (dco.paths.nr) {
+		write_delayed_items(state, &dco);
+		for (i = 0; i < delayed_nr; i++)
+			release_pc_item_data(delayed[i]);
+		free(delayed);
+	}
+
 	packet_flush(1);
 
 	free(items);
@@ -116,9 +208,14 @@ static const char * const checkout_worker_usage[] = {
 int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 {
 	struct checkout state = CHECKOUT_INIT;
+	const char *treeish = NULL;
 	struct option checkout_worker_options[] = {
 		OPT_STRING(0, "prefix", &state.base_dir, N_("string"),
 			N_("when creating files, prepend <string>")),
+		OPT_STRING(0, "refname", &state.meta.refname, N_("refname"),
+			N_("ref to tell filter processes about")),
+		OPT_STRING(0, "treeish", &treeish, N_("object-id"),
+			N_("tree-ish to tell filter processes about")),
 		OPT_END()
 	};
 
@@ -134,6 +231,8 @@ int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
 
 	if (state.base_dir)
 		state.base_dir_len = strlen(state.base_dir);
+	if (treeish && get_oid_hex(treeish, &state.meta.treeish))
+		die(_("invalid tree-ish '%s'"), treeish);
 
 	/*
 	 * Setting this on a worker won't actually update the index. We just
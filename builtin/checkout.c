@@ -8,6 +8,7 @@
 #include "commit.h"
 #include "config.h"
 #include "diff.h"
+#include "diffcore.h"
 #include "dir.h"
 #include "environment.h"
 #include "gettext.h"
@@ -768,6 +769,52 @@ static void init_topts(struct unpack_trees_options *topts, int merge,
 	topts->preserve_ignored = !overwrite_ignore;
 }
 
+/*
+ * A two-way merge keeps the entries at paths that are the same in both
+ * trees as they are, whatever is in the worktree, so only the entries
+ * at the paths that differ need to be refreshed for it.  Refresh just
+ * those and return 0, unless so many paths differ that refreshing the
+ * whole index with the threads of preload_index() is faster.
+ */
+static int refresh_changed_paths(struct commit *old_commit,
+				 struct commit *new_commit)
+{
+	struct diff_options diff_opts;
+	int i, ret = -1;
+
+	repo_diff_setup(the_repository, &diff_opts);
+	diff_opts.flags.recursive = 1;
+	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diff_opts);
+	diff_tree_oid(get_commit_tree_oid(old_commit),
+		      get_commit_tree_oid(new_commit), "", &diff_opts);
+
+	if (diff_queued_diff.nr > the_index.cache_nr / 16)
+		goto out;
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+		const char *path = p->one->path;
+		int pos = index_name_pos_sparse(&the_index, path, strlen(path));
+		struct cache_entry *ce, *refreshed;
+
+		if (pos < 0)
+			continue;
+		ce = the_index.cache[pos];
+		if (ce_stage(ce) || S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+		refreshed = refresh_cache_entry(&the_index, ce, CE_MATCH_REFRESH);
+		if (refreshed && refreshed != ce)
+			add_index_entry(&the_index, refreshed,
+					ADD_CACHE_OK_TO_ADD | ADD_CACHE_OK_TO_REPLACE);
+	}
+	ret = 0;
+
+out:
+	diff_flush(&diff_opts);
+	return ret;
+}
+
 static int merge_working_tree(const struct checkout_opts *opts,
 			      struct branch_info *old_branch_info,
 			      struct branch_info *new_branch_info,
@@ -778,7 +825,7 @@ static int merge_working_tree(const struct checkout_opts *opts,
 	struct tree *new_tree;
 
 	repo_hold_locked_index(the_repository, &lock_file, LOCK_DIE_ON_ERROR);
-	if (repo_read_index_preload(the_repository, NULL, 0) < 0)
+	if (repo_read_index(the_repository) < 0)
 		return error(_("index file corrupt"));
 
 	resolve_undo_clear_index(&the_index);
@@ -790,6 +837,7 @@ static int merge_working_tree(const struct checkout_opts *opts,
 		new_tree = repo_get_commit_tree(the_repository,
 						new_branch_info->commit);
 	if (opts->discard_changes) {
+		preload_index(&the_index, NULL, 0);
 		ret = reset_tree(new_tree, opts, 1, writeout_error, new_branch_info);
 		if (ret)
 			return ret;
@@ -799,7 +847,15 @@ static int merge_working_tree(const struct checkout_opts *opts,
 		struct unpack_trees_options topts;
 		const struct object_id *old_commit_oid;
 
-		refresh_index(&the_index, REFRESH_QUIET, NULL, NULL, NULL);
+		/*
+		 * Unless the local changes are shown afterwards, which
+		 * needs the whole index to be refreshed anyway.
+		 */
+		if (!opts->quiet || !old_branch_info->commit ||
+		    !new_branch_info->commit ||
+		    refresh_changed_paths(old_branch_info->commit,
+					  new_branch_info->commit))
+			refresh_index(&the_index, REFRESH_QUIET, NULL, NULL, NULL);
 
 		if (unmerged_index(&the_index)) {
 			error(_("you need to resolve your current index first"));
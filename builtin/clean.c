@@ -24,9 +24,11 @@
 #include "pathspec.h"
 #include "help.h"
 #include "prompt.h"
+#include "thread-utils.h"
 
 static int force = -1; /* unset */
 static int interactive;
+static int clean_threads = 1;
 static struct string_list del_list = STRING_LIST_INIT_DUP;
 static unsigned int colopts;
 
@@ -132,6 +134,14 @@ static int git_clean_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (!strcmp(var, "clean.threads")) {
+		clean_threads = git_config_int(var, value, ctx->kvi);
+		if (clean_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    clean_threads, var);
+		return 0;
+	}
+
 	if (git_color_config(var, value, cb) < 0)
 		return -1;
 
@@ -158,8 +168,84 @@ static int exclude_cb(const struct option *opt, const char *arg, int unset)
 	return 0;
 }
 
+/*
+ * What removing one item reports.  Items removed in threads keep it
+ * here, for the main thread to show in the order of the items; with
+ * no log, it is shown right away.
+ */
+struct clean_log {
+	struct clean_log_entry {
+		char *msg;
+		int is_warning;
+		int err;
+	} *entries;
+	size_t nr, alloc;
+};
+
+static void clean_printf(struct clean_log *log, const char *fmt, const char *arg)
+{
+	if (!log) {
+		printf(fmt, arg);
+		return;
+	}
+	ALLOC_GROW(log->entries, log->nr + 1, log->alloc);
+	log->entries[log->nr].msg = xstrfmt(fmt, arg);
+	log->entries[log->nr].is_warning = 0;
+	log->nr++;
+}
+
+static void clean_warning_errno(struct clean_log *log, const char *fmt,
+				const char *arg)
+{
+	int err = errno;
+
+	if (!log) {
+		warning_errno(fmt, arg);
+		return;
+	}
+	ALLOC_GROW(log->entries, log->nr + 1, log->alloc);
+	log->entries[log->nr].msg = xstrfmt(fmt, arg);
+	log->entries[log->nr].is_warning = 1;
+	log->entries[log->nr].err = err;
+	log->nr++;
+}
+
+static void clean_log_flush(struct clean_log *log)
+{
+	size_t i;
+
+	for (i = 0; i < log->nr; i++) {
+		struct clean_log_entry *e = &log->entries[i];
+
+		if (e->is_warning) {
+			errno = e->err;
+			warning_errno("%s", e->msg);
+		} else {
+			fputs(e->msg, stdout);
+		}
+		free(e->msg);
+	}
+	FREE_AND_NULL(log->entries);
+	log->nr = log->alloc = 0;
+}
+
+/* Held around is_nonbare_repository_dir() while removing in threads. */
+static pthread_mutex_t *nested_git_mutex;
+
+static int is_nested_git(struct strbuf *path)
+{
+	int ret;
+
+	if (nested_git_mutex)
+		pthread_mutex_lock(nested_git_mutex);
+	ret = is_nonbare_repository_dir(path);
+	if (nested_git_mutex)
+		pthread_mutex_unlock(nested_git_mutex);
+	return ret;
+}
+
 static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
-		int dry_run, int quiet, int *dir_gone)
+		int dry_run, int quiet, int *dir_gone, struct clean_log *log)
 {
 	DIR *dir;
 	struct strbuf quoted = STRBUF_INIT;
@@ -172,11 +258,11 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	*dir_gone = 1;
 
 	if ((force_flag & REMOVE_DIR_KEEP_NESTED_GIT) &&
-	    is_nonbare_repository_dir(path)) {
+	    is_nested_git(path)) {
 		if (!quiet) {
 			quote_path(path->buf, prefix, &quoted, 0);
-			printf(dry_run ?  _(msg_would_skip_git_dir) : _(msg_skip_git_dir),
-					quoted.buf);
+			clean_printf(log, dry_run ?  _(msg_would_skip_git_dir) : _(msg_skip_git_dir),
+				     quoted.buf);
 		}
 
 		*dir_gone = 0;
@@ -191,7 +277,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 			int saved_errno = errno;
 			quote_path(path->buf, prefix, &quoted, 0);
 			errno = saved_errno;
-			warning_errno(_(msg_warn_remove_failed), quoted.buf);
+			clean_warning_errno(log, _(msg_warn_remove_failed), quoted.buf);
 			*dir_gone = 0;
 		}
 		ret = res;
@@ -207,9 +293,9 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 		strbuf_setlen(path, len);
 		strbuf_addstr(path, e->d_name);
 		if (lstat(path->buf, &st))
-			warning_errno(_(msg_warn_lstat_failed), path->buf);
+			clean_warning_errno(log, _(msg_warn_lstat_failed), path->buf);
 		else if (S_ISDIR(st.st_mode)) {
-			if (remove_dirs(path, prefix, force_flag, dry_run, quiet, &gone))
+			if (remove_dirs(path, prefix, force_flag, dry_run, quiet, &gone, log))
 				ret = 1;
 			if (gone) {
 				quote_path(path->buf, prefix, &quoted, 0);
@@ -226,7 +312,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 				int saved_errno = errno;
 				quote_path(path->buf, prefix, &quoted, 0);
 				errno = saved_errno;
-				warning_errno(_(msg_warn_remove_failed), quoted.buf);
+				clean_warning_errno(log, _(msg_warn_remove_failed), quoted.buf);
 				*dir_gone = 0;
 				ret = 1;
 			}
@@ -259,7 +345,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 					 startup_info->original_cwd, 1);
 
 		if (!strbuf_cmp(&realpath, &real_ocwd)) {
-			printf("%s", dry_run ? _(msg_would_skip_cwd) : _(msg_skip_cwd));
+			clean_printf(log, "%s", dry_run ? _(msg_would_skip_cwd) : _(msg_skip_cwd));
 			*dir_gone = 0;
 		} else {
 			res = dry_run ? 0 : rmdir(path->buf);
@@ -269,7 +355,7 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 				int saved_errno = errno;
 				quote_path(path->buf, prefix, &quoted, 0);
 				errno = saved_errno;
-				warning_errno(_(msg_warn_remove_failed), quoted.buf);
+				clean_warning_errno(log, _(msg_warn_remove_failed), quoted.buf);
 				*dir_gone = 0;
 				ret = 1;
 			}
@@ -279,7 +365,8 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	if (!*dir_gone && !quiet) {
 		int i;
 		for (i = 0; i < dels.nr; i++)
-			printf(dry_run ?  _(msg_would_remove) : _(msg_remove), dels.items[i].string);
+			clean_printf(log, dry_run ?  _(msg_would_remove) : _(msg_remove),
+				     dels.items[i].string);
 	}
 out:
 	strbuf_release(&realpath);
@@ -289,6 +376,161 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	return ret;
 }
 
+static int clean_one(const char *name, const char *prefix, int rm_flags,
+		     int dry_run, int quiet, struct clean_log *log)
+{
+	struct strbuf abs_path = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct stat st;
+	const char *qname;
+	int res, gone = 1, errors = 0;
+
+	if (prefix)
+		strbuf_addstr(&abs_path, prefix);
+
+	strbuf_addstr(&abs_path, name);
+
+	/*
+	 * we might have removed this as part of earlier
+	 * recursive directory removal, so lstat() here could
+	 * fail with ENOENT.
+	 */
+	if (lstat(abs_path.buf, &st))
+		goto out;
+
+	if (S_ISDIR(st.st_mode)) {
+		if (remove_dirs(&abs_path, prefix, rm_flags, dry_run, quiet, &gone, log))
+			errors++;
+		if (gone && !quiet) {
+			qname = quote_path(name, NULL, &buf, 0);
+			clean_printf(log, dry_run ? _(msg_would_remove) : _(msg_remove), qname);
+		}
+	} else {
+		res = dry_run ? 0 : unlink(abs_path.buf);
+		if (res) {
+			int saved_errno = errno;
+			qname = quote_path(name, NULL, &buf, 0);
+			errno = saved_errno;
+			clean_warning_errno(log, _(msg_warn_remove_failed), qname);
+			errors++;
+		} else if (!quiet) {
+			qname = quote_path(name, NULL, &buf, 0);
+			clean_printf(log, dry_run ? _(msg_would_remove) : _(msg_remove), qname);
+		}
+	}
+
+out:
+	strbuf_release(&abs_path);
+	strbuf_release(&buf);
+	return errors;
+}
+
+/*
+ * With "clean.threads", the items of del_list are removed in threads,
+ * each item (a file, or a whole directory) by one thread, while the
+ * main thread reports them in order as they are done.
+ */
+struct clean_item {
+	struct clean_log log;
+	int errors;
+	int done;
+};
+
+struct clean_threads_data {
+	struct clean_item *items;
+	size_t next;
+	const char *prefix;
+	int rm_flags, dry_run, quiet;
+	pthread_mutex_t mutex;
+	pthread_cond_t done;
+};
+
+static void *clean_thread(void *arg)
+{
+	struct clean_threads_data *ctd = arg;
+
+	pthread_mutex_lock(&ctd->mutex);
+	while (ctd->next < del_list.nr) {
+		size_t i = ctd->next++;
+		struct clean_item *ci = &ctd->items[i];
+		int errors;
+
+		pthread_mutex_unlock(&ctd->mutex);
+		errors = clean_one(del_list.items[i].string, ctd->prefix,
+				   ctd->rm_flags, ctd->dry_run, ctd->quiet,
+				   &ci->log);
+		pthread_mutex_lock(&ctd->mutex);
+		ci->errors = errors;
+		ci->done = 1;
+		pthread_cond_broadcast(&ctd->done);
+	}
+	pthread_mutex_unlock(&ctd->mutex);
+	return NULL;
+}
+
+/*
+ * Remove the items of del_list in threads, and add the number of
+ * items that could not be removed to "errors".  Returns 0 without
+ * doing anything if they should be removed by the caller instead.
+ */
+static int clean_in_threads(const char *prefix, int rm_flags, int dry_run,
+			    int quiet, int *errors)
+{
+	struct clean_threads_data ctd = { 0 };
+	pthread_mutex_t repo_mutex;
+	pthread_t *threads;
+	int nr_threads = clean_threads, i, ret;
+	size_t j;
+
+	if (!HAVE_THREADS)
+		return 0;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads > del_list.nr)
+		nr_threads = del_list.nr;
+	if (nr_threads <= 1)
+		return 0;
+
+	CALLOC_ARRAY(ctd.items, del_list.nr);
+	ctd.prefix = prefix;
+	ctd.rm_flags = rm_flags;
+	ctd.dry_run = dry_run;
+	ctd.quiet = quiet;
+	pthread_mutex_init(&ctd.mutex, NULL);
+	pthread_cond_init(&ctd.done, NULL);
+	pthread_mutex_init(&repo_mutex, NULL);
+	nested_git_mutex = &repo_mutex;
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL, clean_thread, &ctd);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	for (j = 0; j < del_list.nr; j++) {
+		struct clean_item *ci = &ctd.items[j];
+
+		pthread_mutex_lock(&ctd.mutex);
+		while (!ci->done)
+			pthread_cond_wait(&ctd.done, &ctd.mutex);
+		pthread_mutex_unlock(&ctd.mutex);
+
+		clean_log_flush(&ci->log);
+		*errors += ci->errors;
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	nested_git_mutex = NULL;
+	pthread_mutex_destroy(&repo_mutex);
+	pthread_cond_destroy(&ctd.done);
+	pthread_mutex_destroy(&ctd.mutex);
+	free(ctd.items);
+	return 1;
+}
+
 static void pretty_print_dels(void)
 {
 	struct string_list list = STRING_LIST_INIT_DUP;
@@ -918,18 +1160,17 @@ static void correct_untracked_entries(struct dir_struct *dir)
 
 int cmd_clean(int argc, const char **argv, const char *prefix)
 {
-	int i, res;
+	int i;
 	int dry_run = 0, remove_directories = 0, quiet = 0, ignored = 0;
-	int ignored_only = 0, config_set = 0, errors = 0, gone = 1;
+	int ignored_only = 0, config_set = 0, errors = 0, nested_items = 0;
 	int rm_flags = REMOVE_DIR_KEEP_NESTED_GIT;
-	struct strbuf abs_path = STRBUF_INIT;
 	struct dir_struct dir = DIR_INIT;
 	struct pathspec pathspec;
 	struct strbuf buf = STRBUF_INIT;
 	struct string_list exclude_list = STRING_LIST_INIT_NODUP;
 	struct pattern_list *pl;
 	struct string_list_item *item;
-	const char *qname;
+	const struct dir_entry *last_dir = NULL;
 	struct option options[] = {
 		OPT__QUIET(&quiet, N_("do not print names of files removed")),
 		OPT__DRY_RUN(&dry_run, N_("dry run")),
@@ -1048,6 +1289,12 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 		if (S_ISDIR(st.st_mode) && !remove_directories)
 			continue;
 
+		/* The entries are sorted, so the ones inside a directory follow it. */
+		if (last_dir && check_dir_entry_contains(last_dir, ent))
+			nested_items = 1;
+		else if (S_ISDIR(st.st_mode))
+			last_dir = ent;
+
 		rel = relative_path(ent->name, prefix, &buf);
 		string_list_append(&del_list, rel);
 	}
@@ -1057,46 +1304,12 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 	if (interactive && del_list.nr > 0)
 		interactive_main_loop();
 
-	for_each_string_list_item(item, &del_list) {
-		struct stat st;
-
-		strbuf_reset(&abs_path);
-		if (prefix)
-			strbuf_addstr(&abs_path, prefix);
-
-		strbuf_addstr(&abs_path, item->string);
+	if (nested_items || !clean_in_threads(prefix, rm_flags, dry_run,
+					      quiet, &errors))
+		for_each_string_list_item(item, &del_list)
+			errors += clean_one(item->string, prefix, rm_flags,
+					    dry_run, quiet, NULL);
 
-		/*
-		 * we might have removed this as part of earlier
-		 * recursive directory removal, so lstat() here could
-		 * fail with ENOENT.
-		 */
-		if (lstat(abs_path.buf, &st))
-			continue;
-
-		if (S_ISDIR(st.st_mode)) {
-			if (remove_dirs(&abs_path, prefix, rm_flags, dry_run, quiet, &gone))
-				errors++;
-			if (gone && !quiet) {
-				qname = quote_path(item->string, NULL, &buf, 0);
-				printf(dry_run ? _(msg_would_remove) : _(msg_remove), qname);
-			}
-		} else {
-			res = dry_run ? 0 : unlink(abs_path.buf);
-			if (res) {
-				int saved_errno = errno;
-				qname = quote_path(item->string, NULL, &buf, 0);
-				errno = saved_errno;
-				warning_errno(_(msg_warn_remove_failed), qname);
-				errors++;
-			} else if (!quiet) {
-				qname = quote_path(item->string, NULL, &buf, 0);
-				printf(dry_run ? _(msg_would_remove) : _(msg_remove), qname);
-			}
-		}
-	}
-
-	strbuf_release(&abs_path);
 	strbuf_release(&buf);
 	string_list_clear(&del_list, 0);
 	string_list_clear(&exclude_list, 0);
@@ -21,7 +21,8 @@
 #define BUILTIN_COMMIT_GRAPH_WRITE_USAGE \
 	N_("git commit-graph write [--object-dir <dir>] [--append]\n" \
 	   "                       [--split[=<strategy>]] [--reachable | --stdin-packs | --stdin-commits]\n" \
-	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress]\n" \
+	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--[no-]tree-cache]\n" \
+	   "                       [--[no-]progress]\n" \
 	   "                       <split options>")
 
 static const char * builtin_commit_graph_verify_usage[] = {
@@ -50,6 +51,7 @@ static struct opts_commit_graph {
 	int shallow;
 	int progress;
 	int enable_changed_paths;
+	int tree_cache;
 } opts;
 
 static struct option common_opts[] = {
@@ -237,6 +239,8 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 			N_("include all commits already in the commit-graph file")),
 		OPT_BOOL(0, "changed-paths", &opts.enable_changed_paths,
 			N_("enable computation for changed paths")),
+		OPT_BOOL(0, "tree-cache", &opts.tree_cache,
+			N_("write the contents of reachable trees to a tree cache")),
 		OPT_CALLBACK_F(0, "split", &write_opts.split_flags, NULL,
 			N_("allow writing an incremental commit-graph file"),
 			PARSE_OPT_OPTARG | PARSE_OPT_NONEG,
@@ -245,6 +249,8 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 			N_("maximum number of commits in a non-base split commit-graph")),
 		OPT_INTEGER(0, "size-multiple", &write_opts.size_multiple,
 			N_("maximum ratio between two levels of a split commit-graph")),
+		OPT_INTEGER(0, "merge-limit", &write_opts.merge_limit,
+			N_("maximum number of commits in split commit-graph layers to merge")),
 		OPT_EXPIRY_DATE(0, "expire-time", &write_opts.expire_time,
 			N_("only expire files older than a given date-time")),
 		OPT_CALLBACK_F(0, "max-new-filters", &write_opts.max_new_filters,
@@ -258,6 +264,7 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 
 	opts.progress = isatty(2);
 	opts.enable_changed_paths = -1;
+	opts.tree_cache = -1;
 	write_opts.size_multiple = 2;
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
@@ -288,6 +295,10 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 	if (opts.enable_changed_paths == 1 ||
 	    git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
 		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	if (opts.tree_cache == 1)
+		flags |= COMMIT_GRAPH_WRITE_TREE_CACHE;
+	else if (!opts.tree_cache)
+		flags |= COMMIT_GRAPH_NO_WRITE_TREE_CACHE;
 
 	odb = find_odb(the_repository, opts.obj_dir);
 
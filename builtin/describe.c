@@ -21,14 +21,11 @@
 #include "run-command.h"
 #include "object-store-ll.h"
 #include "list-objects.h"
-#include "commit-slab.h"
 #include "wildmatch.h"
 
 #define MAX_TAGS	(FLAG_BITS - 1)
 #define DEFAULT_CANDIDATES 10
 
-define_commit_slab(commit_names, struct commit_name *);
-
 static const char * const describe_usage[] = {
 	N_("git describe [--all] [--tags] [--contains] [--abbrev=<n>] [<commit-ish>...]"),
 	N_("git describe [--all] [--tags] [--contains] [--abbrev=<n>] --dirty[=<mark>]"),
@@ -44,12 +41,10 @@ static int first_parent;
 static int abbrev = -1; /* unspecified */
 static int max_candidates = DEFAULT_CANDIDATES;
 static struct hashmap names;
-static int have_util;
 static struct string_list patterns = STRING_LIST_INIT_NODUP;
 static struct string_list exclude_patterns = STRING_LIST_INIT_NODUP;
 static int always;
 static const char *suffix, *dirty, *broken;
-static struct commit_names commit_names;
 
 /* diff-index command arguments to check if working tree is dirty. */
 static const char *diff_index_args[] = {
@@ -339,33 +334,15 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 	if (debug)
 		fprintf(stderr, _("No exact match on refs or tags, searching to describe\n"));
 
-	if (!have_util) {
-		struct hashmap_iter iter;
-		struct commit *c;
-		struct commit_name *n;
-
-		init_commit_names(&commit_names);
-		hashmap_for_each_entry(&names, &iter, n,
-					entry /* member name */) {
-			c = lookup_commit_reference_gently(the_repository,
-							   &n->peeled, 1);
-			if (c)
-				*commit_names_at(&commit_names, c) = n;
-		}
-		have_util = 1;
-	}
-
 	list = NULL;
 	cmit->object.flags = SEEN;
 	commit_list_insert(cmit, &list);
 	while (list) {
 		struct commit *c = pop_commit(&list);
 		struct commit_list *parents = c->parents;
-		struct commit_name **slot;
 
 		seen_commits++;
-		slot = commit_names_peek(&commit_names, c);
-		n = slot ? *slot : NULL;
+		n = find_commit_name(&c->object.oid);
 		if (n) {
 			if (!tags && !all && n->prio < 2) {
 				unannotated_cnt++;
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "diff.h"
 #include "diff-merges.h"
+#include "pathspec.h"
 #include "commit.h"
 #include "preload-index.h"
 #include "repository.h"
@@ -27,6 +28,10 @@ int cmd_diff_index(int argc, const char **argv, const char *prefix)
 		usage(diff_cache_usage);
 
 	git_config(git_diff_basic_config, NULL); /* no "diff" UI options */
+
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
+
 	repo_init_revisions(the_repository, &rev, prefix);
 	rev.abbrev = 0;
 	prefix = precompose_argv_prefix(argc, argv, prefix);
@@ -72,6 +77,9 @@ int cmd_diff_index(int argc, const char **argv, const char *prefix)
 		perror("repo_read_index");
 		return -1;
 	}
+	if (pathspec_needs_expanded_index(the_repository->index,
+					  &rev.diffopt.pathspec))
+		ensure_full_index(the_repository->index);
 	run_diff_index(&rev, option);
 	result = diff_result_code(&rev.diffopt);
 	release_revisions(&rev);
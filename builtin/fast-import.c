@@ -26,6 +26,7 @@
 #include "commit-reach.h"
 #include "khash.h"
 #include "date.h"
+#include "thread-utils.h"
 
 #define PACK_ID_BITS 16
 #define MAX_PACK_ID ((1<<PACK_ID_BITS)-1)
@@ -91,6 +92,22 @@ struct last_object {
 	unsigned no_swap : 1;
 };
 
+/*
+ * A blob that later blobs may be stored as deltas against. It is shared
+ * by the delta window and by the jobs that use it as a base.
+ */
+struct blob_base {
+	struct strbuf data;
+	struct object_entry *e;
+	/*
+	 * The depth of the blob in its delta chain or, until it is written
+	 * out, the shallowest it may end up at.
+	 */
+	unsigned int depth;
+	unsigned int refcount;
+	unsigned written : 1;
+};
+
 struct atom_str {
 	struct atom_str *next_atom;
 	unsigned short str_len;
@@ -213,10 +230,45 @@ static int import_marks_file_ignore_missing;
 static int import_marks_file_done;
 static int relative_marks_paths;
 
-/* Our last blob */
-static struct last_object last_blob = {
-	.data = STRBUF_INIT,
- };
+enum marks_format {
+	MARKS_FORMAT_UNSET,
+	MARKS_FORMAT_TEXT,
+	MARKS_FORMAT_BINARY,
+};
+static enum marks_format marks_format;
+
+/*
+ * A binary marks file that was imported. Its marks are only looked up
+ * when they are used, and are then cached in "marks".
+ */
+static struct marks_file {
+	unsigned char *data;
+	size_t size;
+	const unsigned char *table;
+	uint64_t nr;
+	/* The records appended after the table, which override it. */
+	struct mark_set *log;
+} marks_file;
+
+/*
+ * The binary marks file that we exported to, or imported from and
+ * export to again. As long as "appendable" is set, a dump appends the
+ * marks set since the last one to it instead of writing it anew.
+ */
+static struct {
+	off_t size;
+	uint64_t nr;
+	uint64_t log_nr;
+	uintmax_t *new_marks;
+	size_t new_marks_nr, new_marks_alloc;
+	unsigned appendable : 1;
+} marks_export;
+
+/* Blobs that later ones may be stored as deltas against, newest first */
+static struct blob_base **delta_window;
+static unsigned int delta_window_nr;
+static unsigned long delta_window_size = 1;
+static int blob_threads = 1;
 
 /* Tree management */
 static unsigned int tree_entry_alloc = 1000;
@@ -410,6 +462,9 @@ static void write_crash_report(const char *err)
 }
 
 static void end_packfile(void);
+static struct object_entry *find_file_mark(uintmax_t idnum);
+static void write_pending_blobs(void);
+static void prune_delta_window(int all);
 static void unkeep_all_packs(void);
 static void dump_marks(void);
 
@@ -566,21 +621,43 @@ static void insert_mark(struct mark_set **top, uintmax_t idnum, struct object_en
 	s->data.marked[idnum] = oe;
 }
 
-static void *find_mark(struct mark_set *s, uintmax_t idnum)
+/* Set a mark from the stream, as opposed to loading it from a file. */
+static void mark_object(uintmax_t idnum, struct object_entry *oe)
 {
-	uintmax_t orig_idnum = idnum;
-	struct object_entry *oe = NULL;
-	if ((idnum >> s->shift) < 1024) {
-		while (s && s->shift) {
-			uintmax_t i = idnum >> s->shift;
-			idnum -= i << s->shift;
-			s = s->data.sets[i];
-		}
-		if (s)
-			oe = s->data.marked[idnum];
+	insert_mark(&marks, idnum, oe);
+	if (!marks_export.appendable)
+		return;
+	/* Rather write the file anew than append more than it holds. */
+	if (marks_export.log_nr + marks_export.new_marks_nr >= marks_export.nr) {
+		marks_export.appendable = 0;
+		FREE_AND_NULL(marks_export.new_marks);
+		marks_export.new_marks_nr = marks_export.new_marks_alloc = 0;
+		return;
 	}
+	ALLOC_GROW(marks_export.new_marks, marks_export.new_marks_nr + 1,
+		   marks_export.new_marks_alloc);
+	marks_export.new_marks[marks_export.new_marks_nr++] = idnum;
+}
+
+static void *lookup_mark(struct mark_set *s, uintmax_t idnum)
+{
+	if ((idnum >> s->shift) >= 1024)
+		return NULL;
+	while (s && s->shift) {
+		uintmax_t i = idnum >> s->shift;
+		idnum -= i << s->shift;
+		s = s->data.sets[i];
+	}
+	return s ? s->data.marked[idnum] : NULL;
+}
+
+static void *find_mark(struct mark_set *s, uintmax_t idnum)
+{
+	void *oe = lookup_mark(s, idnum);
+	if (!oe && s == marks)
+		oe = find_file_mark(idnum);
 	if (!oe)
-		die("mark :%" PRIuMAX " not declared", orig_idnum);
+		die("mark :%" PRIuMAX " not declared", idnum);
 	return oe;
 }
 
@@ -861,6 +938,7 @@ static void end_packfile(void)
 	if (running || !pack_data)
 		return;
 
+	write_pending_blobs();
 	running = 1;
 	clear_delta_base_cache();
 	if (object_count) {
@@ -925,9 +1003,7 @@ static void end_packfile(void)
 	running = 0;
 
 	/* We can't carry a delta across packfiles. */
-	strbuf_release(&last_blob.data);
-	last_blob.offset = 0;
-	last_blob.depth = 0;
+	prune_delta_window(0);
 }
 
 static void cycle_packfile(void)
@@ -936,20 +1012,30 @@ static void cycle_packfile(void)
 	start_packfile();
 }
 
-static int store_object(
+/* Whether an object of "len" bytes would take the pack over its limit. */
+static int pack_is_full(uintmax_t len)
+{
+	return (max_packsize
+		&& (pack_size + PACK_SIZE_THRESHOLD + len) > max_packsize)
+		|| (pack_size + PACK_SIZE_THRESHOLD + len) < pack_size;
+}
+
+/*
+ * Name the object and look it up, returning 1 if it is stored already,
+ * either by us or in the repository.
+ */
+static int find_stored_object(
 	enum object_type type,
 	struct strbuf *dat,
-	struct last_object *last,
 	struct object_id *oidout,
-	uintmax_t mark)
+	uintmax_t mark,
+	struct object_entry **ep)
 {
-	void *out, *delta;
 	struct object_entry *e;
 	unsigned char hdr[96];
 	struct object_id oid;
-	unsigned long hdrlen, deltalen;
+	unsigned long hdrlen;
 	git_hash_ctx c;
-	git_zstream s;
 
 	hdrlen = format_object_header((char *)hdr, sizeof(hdr), type,
 				      dat->len);
@@ -960,9 +1046,9 @@ static int store_object(
 	if (oidout)
 		oidcpy(oidout, &oid);
 
-	e = insert_object(&oid);
+	*ep = e = insert_object(&oid);
 	if (mark)
-		insert_mark(&marks, mark, e);
+		mark_object(mark, e);
 	if (e->idx.offset) {
 		duplicate_count_by_type[type]++;
 		return 1;
@@ -974,6 +1060,24 @@ static int store_object(
 		duplicate_count_by_type[type]++;
 		return 1;
 	}
+	return 0;
+}
+
+static int store_object(
+	enum object_type type,
+	struct strbuf *dat,
+	struct last_object *last,
+	struct object_id *oidout,
+	uintmax_t mark)
+{
+	void *out, *delta;
+	struct object_entry *e;
+	unsigned char hdr[96];
+	unsigned long hdrlen, deltalen;
+	git_zstream s;
+
+	if (find_stored_object(type, dat, oidout, mark, &e))
+		return 1;
 
 	if (last && last->data.len && last->data.buf && last->depth < max_depth
 		&& dat->len > the_hash_algo->rawsz) {
@@ -1000,10 +1104,10 @@ static int store_object(
 	git_deflate_end(&s);
 
 	/* Determine if we should auto-checkpoint. */
-	if ((max_packsize
-		&& (pack_size + PACK_SIZE_THRESHOLD + s.total_out) > max_packsize)
-		|| (pack_size + PACK_SIZE_THRESHOLD + s.total_out) < pack_size) {
-
+	if (pack_is_full(s.total_out))
+		/* The blobs that came before go into this pack first. */
+		write_pending_blobs();
+	if (pack_is_full(s.total_out)) {
 		/* This new object needs to *not* have the current pack_id. */
 		e->pack_id = pack_id + 1;
 		cycle_packfile();
@@ -1075,6 +1179,428 @@ static int store_object(
 	return 0;
 }
 
+/*
+ * Blobs are named as they are read, as marks and the search for
+ * duplicates need their names right away, but the search for a delta
+ * against the blobs before them and the deflating are left to a pool
+ * of threads. The blobs are written out in the order they came in, so
+ * that a delta always follows its base in the pack.
+ */
+struct blob_job {
+	struct blob_base *blob;
+	struct blob_base **bases;
+	unsigned int nr_bases;
+
+	/* Set by the thread that works on the job. */
+	struct blob_base *base;
+	void *delta;
+	unsigned long delta_len;
+	void *out;
+	unsigned long out_len;
+	int done;
+};
+
+/* Do not hold more than this many bytes of blobs waiting to be written. */
+#define BLOB_MAX_PENDING (64 * 1024 * 1024)
+
+/*
+ * The jobs are kept in a ring in the order of the stream. Workers take
+ * them from "next" on, and the main thread writes them out from "first"
+ * on once they are done. Both count up from 0 and are taken modulo
+ * "alloc".
+ */
+static struct blob_pool {
+	pthread_t *threads;
+	int nr_threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct blob_job *jobs;
+	size_t alloc, first, nr, next;
+	size_t pending_bytes;
+	int stop;
+} blob_pool;
+
+static struct blob_base *get_blob_base(struct blob_base *b)
+{
+	b->refcount++;
+	return b;
+}
+
+static void put_blob_base(struct blob_base *b)
+{
+	if (--b->refcount)
+		return;
+	strbuf_release(&b->data);
+	free(b);
+}
+
+static void add_to_delta_window(struct blob_base *b)
+{
+	if (!delta_window_size)
+		return;
+	if (!delta_window)
+		ALLOC_ARRAY(delta_window, delta_window_size);
+	if (delta_window_nr == delta_window_size)
+		put_blob_base(delta_window[--delta_window_nr]);
+	MOVE_ARRAY(delta_window + 1, delta_window, delta_window_nr);
+	delta_window[0] = get_blob_base(b);
+	delta_window_nr++;
+}
+
+static int in_delta_window(struct object_entry *e)
+{
+	unsigned int i;
+
+	for (i = 0; i < delta_window_nr; i++)
+		if (delta_window[i]->e == e)
+			return 1;
+	return 0;
+}
+
+/*
+ * Drop the blobs that are written out already from the delta window,
+ * or all of them.
+ */
+static void prune_delta_window(int all)
+{
+	unsigned int i, nr = 0;
+
+	for (i = 0; i < delta_window_nr; i++) {
+		if (all || delta_window[i]->written)
+			put_blob_base(delta_window[i]);
+		else
+			delta_window[nr++] = delta_window[i];
+	}
+	delta_window_nr = nr;
+}
+
+static void *deflate_blob_data(const void *buf, unsigned long len,
+			       unsigned long *out_len)
+{
+	git_zstream s;
+	void *out;
+
+	git_deflate_init(&s, pack_compression_level);
+	s.next_in = (void *)buf;
+	s.avail_in = len;
+	s.avail_out = git_deflate_bound(&s, s.avail_in);
+	s.next_out = out = xmalloc(s.avail_out);
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	*out_len = s.total_out;
+	return out;
+}
+
+static void work_on_blob_job(struct blob_job *job)
+{
+	struct strbuf *dat = &job->blob->data;
+	unsigned long max_len = dat->len - the_hash_algo->rawsz;
+	unsigned int i;
+
+	/* The newest base goes first and wins ties. */
+	for (i = 0; i < job->nr_bases; i++) {
+		struct blob_base *base = job->bases[i];
+		unsigned long len;
+		void *delta = diff_delta(base->data.buf, base->data.len,
+					 dat->buf, dat->len, &len, max_len);
+		if (!delta)
+			continue;
+		free(job->delta);
+		job->base = base;
+		job->delta = delta;
+		job->delta_len = len;
+		max_len = len - 1;
+	}
+
+	if (job->delta)
+		job->out = deflate_blob_data(job->delta, job->delta_len,
+					     &job->out_len);
+	else
+		job->out = deflate_blob_data(dat->buf, dat->len,
+					     &job->out_len);
+}
+
+static void drop_blob_delta(struct blob_job *job)
+{
+	FREE_AND_NULL(job->delta);
+	job->base = NULL;
+	free(job->out);
+	job->out = deflate_blob_data(job->blob->data.buf, job->blob->data.len,
+				     &job->out_len);
+}
+
+static void append_blob(struct blob_job *job)
+{
+	struct blob_base *blob = job->blob;
+	struct object_entry *e = blob->e;
+	unsigned char hdr[96];
+	unsigned long hdrlen;
+
+	if (job->nr_bases)
+		delta_count_attempts_by_type[OBJ_BLOB]++;
+
+	/*
+	 * The base may have gone into a pack before this one, or ended up
+	 * deeper than it looked when the blob came in.
+	 */
+	if (job->delta && (job->base->e->pack_id != pack_id ||
+			   job->base->depth >= max_depth))
+		drop_blob_delta(job);
+
+	/* Determine if we should auto-checkpoint. */
+	if (pack_is_full(job->out_len)) {
+		cycle_packfile();
+
+		/* We cannot carry a delta into the new pack. */
+		if (job->delta)
+			drop_blob_delta(job);
+	}
+
+	e->type = OBJ_BLOB;
+	e->pack_id = pack_id;
+	e->idx.offset = pack_size;
+	object_count++;
+	object_count_by_type[OBJ_BLOB]++;
+
+	crc32_begin(pack_file);
+
+	if (job->delta) {
+		off_t ofs = e->idx.offset - job->base->e->idx.offset;
+		unsigned pos = sizeof(hdr) - 1;
+
+		delta_count_by_type[OBJ_BLOB]++;
+		e->depth = job->base->depth + 1;
+
+		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+						      OBJ_OFS_DELTA,
+						      job->delta_len);
+		hashwrite(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+
+		hdr[pos] = ofs & 127;
+		while (ofs >>= 7)
+			hdr[--pos] = 128 | (--ofs & 127);
+		hashwrite(pack_file, hdr + pos, sizeof(hdr) - pos);
+		pack_size += sizeof(hdr) - pos;
+	} else {
+		e->depth = 0;
+		hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+						      OBJ_BLOB,
+						      blob->data.len);
+		hashwrite(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+	}
+
+	hashwrite(pack_file, job->out, job->out_len);
+	pack_size += job->out_len;
+
+	e->idx.crc32 = crc32_end(pack_file);
+
+	blob->depth = e->depth;
+	blob->written = 1;
+}
+
+static void clear_blob_job(struct blob_job *job)
+{
+	unsigned int i;
+
+	for (i = 0; i < job->nr_bases; i++)
+		put_blob_base(job->bases[i]);
+	free(job->bases);
+	free(job->delta);
+	free(job->out);
+	put_blob_base(job->blob);
+	memset(job, 0, sizeof(*job));
+}
+
+static void *blob_worker(void *data UNUSED)
+{
+	pthread_mutex_lock(&blob_pool.mutex);
+	for (;;) {
+		struct blob_job *job;
+
+		while (!blob_pool.stop &&
+		       blob_pool.next == blob_pool.first + blob_pool.nr)
+			pthread_cond_wait(&blob_pool.cond, &blob_pool.mutex);
+		if (blob_pool.next == blob_pool.first + blob_pool.nr)
+			break;
+		job = &blob_pool.jobs[blob_pool.next++ % blob_pool.alloc];
+		pthread_mutex_unlock(&blob_pool.mutex);
+
+		work_on_blob_job(job);
+
+		pthread_mutex_lock(&blob_pool.mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&blob_pool.cond);
+	}
+	pthread_mutex_unlock(&blob_pool.mutex);
+	return NULL;
+}
+
+static void start_blob_workers(void)
+{
+	int i;
+
+	if (!blob_threads)
+		blob_threads = online_cpus();
+	if (!HAVE_THREADS && blob_threads != 1) {
+		warning(_("no threads support, ignoring %s"), "--threads");
+		blob_threads = 1;
+	}
+	if (blob_threads <= 1) {
+		blob_threads = 1;
+		return;
+	}
+
+	blob_pool.nr_threads = blob_threads;
+	blob_pool.alloc = 16 * blob_threads;
+	CALLOC_ARRAY(blob_pool.jobs, blob_pool.alloc);
+	pthread_mutex_init(&blob_pool.mutex, NULL);
+	pthread_cond_init(&blob_pool.cond, NULL);
+	CALLOC_ARRAY(blob_pool.threads, blob_threads);
+	for (i = 0; i < blob_threads; i++) {
+		int err = pthread_create(&blob_pool.threads[i], NULL,
+					 blob_worker, NULL);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+/*
+ * Write out the oldest blob, waiting for it to be done unless "wait"
+ * is 0. Return 1 if there was none to write.
+ */
+static int write_blob_job(int wait)
+{
+	static int writing;
+	struct blob_job *job;
+
+	/* Cycling the pack for a blob must not write the ones after it. */
+	if (writing || !blob_pool.nr_threads)
+		return 1;
+
+	pthread_mutex_lock(&blob_pool.mutex);
+	job = &blob_pool.jobs[blob_pool.first % blob_pool.alloc];
+	if (!blob_pool.nr || (!wait && !job->done)) {
+		pthread_mutex_unlock(&blob_pool.mutex);
+		return 1;
+	}
+	while (!job->done)
+		pthread_cond_wait(&blob_pool.cond, &blob_pool.mutex);
+	pthread_mutex_unlock(&blob_pool.mutex);
+
+	writing = 1;
+	append_blob(job);
+	writing = 0;
+
+	pthread_mutex_lock(&blob_pool.mutex);
+	blob_pool.pending_bytes -= job->blob->data.len;
+	clear_blob_job(job);
+	blob_pool.first++;
+	blob_pool.nr--;
+	pthread_mutex_unlock(&blob_pool.mutex);
+	return 0;
+}
+
+static void write_pending_blobs(void)
+{
+	while (!write_blob_job(1))
+		; /* nothing */
+}
+
+static void stop_blob_workers(void)
+{
+	int i;
+
+	if (!blob_pool.nr_threads)
+		return;
+	write_pending_blobs();
+	pthread_mutex_lock(&blob_pool.mutex);
+	blob_pool.stop = 1;
+	pthread_cond_broadcast(&blob_pool.cond);
+	pthread_mutex_unlock(&blob_pool.mutex);
+	for (i = 0; i < blob_pool.nr_threads; i++)
+		pthread_join(blob_pool.threads[i], NULL);
+	pthread_mutex_destroy(&blob_pool.mutex);
+	pthread_cond_destroy(&blob_pool.cond);
+	free(blob_pool.threads);
+	free(blob_pool.jobs);
+	memset(&blob_pool, 0, sizeof(blob_pool));
+}
+
+static void store_blob(
+	struct strbuf *dat,
+	struct object_id *oidout,
+	uintmax_t mark)
+{
+	struct object_entry *e;
+	struct blob_base *blob;
+	struct blob_job *job, serial_job = { 0 };
+	unsigned int i;
+
+	if (find_stored_object(OBJ_BLOB, dat, oidout, mark, &e))
+		return;
+
+	/*
+	 * Until it is written out, the blob looks like one that is stored
+	 * elsewhere, which keeps it out of the index of the current pack.
+	 * Reading it back needs write_pending_blobs() first.
+	 */
+	e->type = OBJ_BLOB;
+	e->pack_id = MAX_PACK_ID;
+	e->idx.offset = 1; /* just not zero! */
+
+	if (blob_threads != 1 && !blob_pool.nr_threads)
+		start_blob_workers();
+	if (blob_pool.nr_threads) {
+		/* Write what is done already, and make room. */
+		while (!write_blob_job(0))
+			; /* nothing */
+		while (blob_pool.nr == blob_pool.alloc ||
+		       (blob_pool.nr &&
+			blob_pool.pending_bytes + dat->len > BLOB_MAX_PENDING))
+			write_blob_job(1);
+		job = &blob_pool.jobs[(blob_pool.first + blob_pool.nr) %
+				      blob_pool.alloc];
+	} else
+		job = &serial_job;
+
+	CALLOC_ARRAY(blob, 1);
+	strbuf_init(&blob->data, 0);
+	strbuf_swap(&blob->data, dat);
+	blob->e = e;
+	blob->refcount = 1;
+	job->blob = blob;
+
+	if (blob->data.len > the_hash_algo->rawsz) {
+		ALLOC_ARRAY(job->bases, delta_window_nr);
+		for (i = 0; i < delta_window_nr; i++) {
+			struct blob_base *base = delta_window[i];
+			if (!base->data.len || base->depth >= max_depth)
+				continue;
+			if (!job->nr_bases || blob->depth > base->depth + 1)
+				blob->depth = base->depth + 1;
+			job->bases[job->nr_bases++] = get_blob_base(base);
+		}
+	}
+	add_to_delta_window(blob);
+
+	if (!blob_pool.nr_threads) {
+		work_on_blob_job(job);
+		append_blob(job);
+		clear_blob_job(job);
+		return;
+	}
+
+	/* The workers do not look at the job until it is counted in. */
+	pthread_mutex_lock(&blob_pool.mutex);
+	blob_pool.nr++;
+	blob_pool.pending_bytes += blob->data.len;
+	pthread_cond_broadcast(&blob_pool.cond);
+	pthread_mutex_unlock(&blob_pool.mutex);
+}
+
 static void truncate_pack(struct hashfile_checkpoint *checkpoint)
 {
 	if (hashfile_truncate(pack_file, checkpoint))
@@ -1097,9 +1623,9 @@ static void stream_blob(uintmax_t len, struct object_id *oidout, uintmax_t mark)
 	int status = Z_OK;
 
 	/* Determine if we should auto-checkpoint. */
-	if ((max_packsize
-		&& (pack_size + PACK_SIZE_THRESHOLD + len) > max_packsize)
-		|| (pack_size + PACK_SIZE_THRESHOLD + len) < pack_size)
+	if (pack_is_full(len))
+		write_pending_blobs();
+	if (pack_is_full(len))
 		cycle_packfile();
 
 	the_hash_algo->init_fn(&checkpoint.ctx);
@@ -1161,7 +1687,7 @@ static void stream_blob(uintmax_t len, struct object_id *oidout, uintmax_t mark)
 	e = insert_object(&oid);
 
 	if (mark)
-		insert_mark(&marks, mark, e);
+		mark_object(mark, e);
 
 	if (e->idx.offset) {
 		duplicate_count_by_type[OBJ_BLOB]++;
@@ -1699,6 +2225,204 @@ static void dump_tags(void)
 	strbuf_release(&err);
 }
 
+/*
+ * A binary marks file starts with a header of a signature, a version,
+ * the hash algorithm and the number of records in the table after it.
+ * Each record is a mark in network byte order followed by the raw
+ * object ID, and the table is sorted by mark. It ends with a checksum
+ * of what comes before. Records appended after the checksum override
+ * the table in the order they come.
+ */
+#define MARKS_SIGNATURE 0x464d524b /* "FMRK" */
+#define MARKS_VERSION 1
+#define MARKS_HEADER_SIZE 20
+
+static size_t marks_record_size(void)
+{
+	return sizeof(uint64_t) + the_hash_algo->rawsz;
+}
+
+struct mark_record {
+	uintmax_t mark;
+	const unsigned char *hash;
+};
+
+struct mark_records {
+	struct mark_record *items;
+	size_t nr, alloc;
+};
+
+typedef void (*each_mark_record_fn_t)(uintmax_t mark, const unsigned char *hash,
+				      void *data);
+
+struct exported_mark_cb {
+	each_mark_record_fn_t fn;
+	void *data;
+	struct mark_records *records;
+	/* Whether the marks point to object IDs rather than entries. */
+	int logged;
+	uint64_t nr;
+};
+
+static void export_mark_fn(uintmax_t mark, void *object, void *cbp)
+{
+	struct exported_mark_cb *cb = cbp;
+	const unsigned char *hash = cb->logged ?
+		((struct object_id *)object)->hash :
+		((struct object_entry *)object)->idx.oid.hash;
+
+	if (cb->records) {
+		ALLOC_GROW(cb->records->items, cb->records->nr + 1,
+			   cb->records->alloc);
+		cb->records->items[cb->records->nr].mark = mark;
+		cb->records->items[cb->records->nr++].hash = hash;
+	} else if (cb->fn) {
+		cb->fn(mark, hash, cb->data);
+	}
+	cb->nr++;
+}
+
+static void collect_marks(struct mark_set *s, int logged,
+			  struct mark_records *records)
+{
+	struct exported_mark_cb cb = { .records = records, .logged = logged };
+
+	for_each_mark(s, 0, export_mark_fn, &cb);
+}
+
+/*
+ * Call "fn" for each mark that is to be exported, in order, and return
+ * their number. The marks set in memory override the ones logged in an
+ * imported binary marks file, which override the ones in its table.
+ */
+static uint64_t for_each_exported_mark(each_mark_record_fn_t fn, void *data)
+{
+	struct mark_records mem = { 0 }, log = { 0 };
+	size_t rec = marks_record_size();
+	size_t i = 0, j = 0;
+	uint64_t k = 0, nr = 0;
+
+	if (!marks_file.data) {
+		struct exported_mark_cb cb = { .fn = fn, .data = data };
+		for_each_mark(marks, 0, export_mark_fn, &cb);
+		return cb.nr;
+	}
+
+	collect_marks(marks, 0, &mem);
+	if (marks_file.log)
+		collect_marks(marks_file.log, 1, &log);
+
+	for (;;) {
+		const unsigned char *table = marks_file.table + k * rec;
+		uintmax_t mark = 0;
+		const unsigned char *hash = NULL;
+
+		if (k < marks_file.nr) {
+			mark = get_be64(table);
+			hash = table + sizeof(uint64_t);
+		}
+		if (j < log.nr && (!hash || log.items[j].mark <= mark)) {
+			mark = log.items[j].mark;
+			hash = log.items[j].hash;
+		}
+		if (i < mem.nr && (!hash || mem.items[i].mark <= mark)) {
+			mark = mem.items[i].mark;
+			hash = mem.items[i].hash;
+		}
+		if (!hash)
+			break;
+
+		if (k < marks_file.nr && get_be64(table) == mark)
+			k++;
+		if (j < log.nr && log.items[j].mark == mark)
+			j++;
+		if (i < mem.nr && mem.items[i].mark == mark)
+			i++;
+		if (fn)
+			fn(mark, hash, data);
+		nr++;
+	}
+
+	free(mem.items);
+	free(log.items);
+	return nr;
+}
+
+static void write_text_mark(uintmax_t mark, const unsigned char *hash,
+			    void *data)
+{
+	fprintf(data, ":%" PRIuMAX " %s\n", mark, hash_to_hex(hash));
+}
+
+static void write_binary_mark(uintmax_t mark, const unsigned char *hash,
+			      void *data)
+{
+	unsigned char buf[sizeof(uint64_t)];
+
+	put_be64(buf, mark);
+	hashwrite(data, buf, sizeof(buf));
+	hashwrite(data, hash, the_hash_algo->rawsz);
+}
+
+static void write_binary_marks(struct lock_file *lock)
+{
+	unsigned char hdr[MARKS_HEADER_SIZE];
+	struct hashfile *f;
+	uint64_t nr = for_each_exported_mark(NULL, NULL);
+
+	f = hashfd(get_lock_file_fd(lock), get_lock_file_path(lock));
+	put_be32(hdr, MARKS_SIGNATURE);
+	put_be32(hdr + 4, MARKS_VERSION);
+	put_be32(hdr + 8, the_hash_algo->format_id);
+	put_be64(hdr + 12, nr);
+	hashwrite(f, hdr, sizeof(hdr));
+	for_each_exported_mark(write_binary_mark, f);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+
+	marks_export.size = sizeof(hdr) + nr * marks_record_size() +
+			    the_hash_algo->rawsz;
+	marks_export.nr = nr;
+	marks_export.log_nr = 0;
+}
+
+/* Append the marks set since the last dump to the exported file. */
+static void append_marks(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	unsigned char be[sizeof(uint64_t)];
+	size_t i;
+	int fd;
+
+	for (i = 0; i < marks_export.new_marks_nr; i++) {
+		uintmax_t mark = marks_export.new_marks[i];
+		struct object_entry *e = lookup_mark(marks, mark);
+
+		put_be64(be, mark);
+		strbuf_add(&buf, be, sizeof(be));
+		strbuf_add(&buf, e->idx.oid.hash, the_hash_algo->rawsz);
+	}
+
+	/* Drop what a dump that died half-way may have left behind. */
+	fd = open(export_marks_file, O_WRONLY);
+	if (fd < 0 ||
+	    ftruncate(fd, marks_export.size) ||
+	    lseek(fd, 0, SEEK_END) < 0 ||
+	    write_in_full(fd, buf.buf, buf.len) < 0 ||
+	    close(fd)) {
+		failure |= error_errno("Unable to write marks file %s",
+				       export_marks_file);
+		if (fd >= 0)
+			close(fd);
+		/* Write the file anew next time. */
+		marks_export.appendable = 0;
+	} else {
+		marks_export.size += buf.len;
+		marks_export.log_nr += marks_export.new_marks_nr;
+	}
+	marks_export.new_marks_nr = 0;
+	strbuf_release(&buf);
+}
+
 static void dump_marks(void)
 {
 	struct lock_file mark_lock = LOCK_INIT;
@@ -1707,6 +2431,11 @@ static void dump_marks(void)
 	if (!export_marks_file || (import_marks_file && !import_marks_file_done))
 		return;
 
+	if (marks_format == MARKS_FORMAT_BINARY && marks_export.appendable) {
+		append_marks();
+		return;
+	}
+
 	if (safe_create_leading_directories_const(export_marks_file)) {
 		failure |= error_errno("unable to create leading directories of %s",
 				       export_marks_file);
@@ -1719,21 +2448,30 @@ static void dump_marks(void)
 		return;
 	}
 
-	f = fdopen_lock_file(&mark_lock, "w");
-	if (!f) {
-		int saved_errno = errno;
-		rollback_lock_file(&mark_lock);
-		failure |= error("Unable to write marks file %s: %s",
-			export_marks_file, strerror(saved_errno));
-		return;
+	if (marks_format == MARKS_FORMAT_BINARY) {
+		write_binary_marks(&mark_lock);
+	} else {
+		f = fdopen_lock_file(&mark_lock, "w");
+		if (!f) {
+			int saved_errno = errno;
+			rollback_lock_file(&mark_lock);
+			failure |= error("Unable to write marks file %s: %s",
+				export_marks_file, strerror(saved_errno));
+			return;
+		}
+		for_each_exported_mark(write_text_mark, f);
 	}
 
-	for_each_mark(marks, 0, dump_marks_fn, f);
 	if (commit_lock_file(&mark_lock)) {
 		failure |= error_errno("Unable to write file %s",
 				       export_marks_file);
 		return;
 	}
+
+	if (marks_format == MARKS_FORMAT_BINARY) {
+		marks_export.appendable = 1;
+		marks_export.new_marks_nr = 0;
+	}
 }
 
 static void insert_object_entry(struct mark_set **s, struct object_id *oid, uintmax_t mark)
@@ -1782,8 +2520,106 @@ static void read_mark_file(struct mark_set **s, FILE *f, mark_set_inserter_t ins
 	}
 }
 
+static void read_binary_marks(int fd, int lazy)
+{
+	size_t rec = marks_record_size(), rawsz = the_hash_algo->rawsz;
+	const unsigned char *table, *log;
+	unsigned char *data;
+	uint64_t nr, log_nr, i;
+	struct object_id oid;
+	struct stat st;
+	size_t size;
+
+	if (fstat(fd, &st))
+		die_errno("cannot stat '%s'", import_marks_file);
+	size = xsize_t(st.st_size);
+	if (size < MARKS_HEADER_SIZE + rawsz)
+		die("marks file '%s' is too small", import_marks_file);
+	data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (get_be32(data + 4) != MARKS_VERSION)
+		die("marks file '%s' has unknown version %"PRIu32,
+		    import_marks_file, get_be32(data + 4));
+	if (get_be32(data + 8) != the_hash_algo->format_id)
+		die("marks file '%s' uses a different hash algorithm",
+		    import_marks_file);
+	nr = get_be64(data + 12);
+	if (nr > (size - MARKS_HEADER_SIZE - rawsz) / rec)
+		die("marks file '%s' is truncated", import_marks_file);
+	table = data + MARKS_HEADER_SIZE;
+	log = table + nr * rec + rawsz;
+	/* A record cut short by a dump that died half-way is ignored. */
+	log_nr = (data + size - log) / rec;
+
+	if (!lazy) {
+		for (i = 0; i < nr + log_nr; i++) {
+			const unsigned char *r = i < nr ?
+				table + i * rec : log + (i - nr) * rec;
+			oidread(&oid, r + sizeof(uint64_t));
+			insert_object_entry(&marks, &oid, get_be64(r));
+		}
+		munmap(data, size);
+		return;
+	}
+
+	marks_file.data = data;
+	marks_file.size = size;
+	marks_file.table = table;
+	marks_file.nr = nr;
+	if (log_nr)
+		CALLOC_ARRAY(marks_file.log, 1);
+	for (i = 0; i < log_nr; i++) {
+		oidread(&oid, log + i * rec + sizeof(uint64_t));
+		insert_oid_entry(&marks_file.log, &oid,
+				 get_be64(log + i * rec));
+	}
+
+	if (marks_format == MARKS_FORMAT_BINARY && export_marks_file &&
+	    !strcmp(export_marks_file, import_marks_file)) {
+		marks_export.size = log + log_nr * rec - data;
+		marks_export.nr = nr;
+		marks_export.log_nr = log_nr;
+		marks_export.appendable = 1;
+	}
+}
+
+static struct object_entry *find_file_mark(uintmax_t idnum)
+{
+	size_t rec = marks_record_size();
+	uint64_t lo = 0, hi = marks_file.nr;
+	const unsigned char *hash = NULL;
+	struct object_id oid;
+
+	if (!marks_file.data)
+		return NULL;
+	if (marks_file.log) {
+		struct object_id *logged = lookup_mark(marks_file.log, idnum);
+		if (logged)
+			hash = logged->hash;
+	}
+	while (!hash && lo < hi) {
+		uint64_t mi = lo + (hi - lo) / 2;
+		const unsigned char *r = marks_file.table + mi * rec;
+		uint64_t mark = get_be64(r);
+
+		if (mark == idnum)
+			hash = r + sizeof(uint64_t);
+		else if (mark < idnum)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	if (!hash)
+		return NULL;
+
+	oidread(&oid, hash);
+	insert_object_entry(&marks, &oid, idnum);
+	return lookup_mark(marks, idnum);
+}
+
 static void read_marks(void)
 {
+	static int imported;
+	unsigned char sig[4];
 	FILE *f = fopen(import_marks_file, "r");
 	if (f)
 		;
@@ -1791,7 +2627,23 @@ static void read_marks(void)
 		goto done; /* Marks file does not exist */
 	else
 		die_errno("cannot read '%s'", import_marks_file);
-	read_mark_file(&marks, f, insert_object_entry);
+
+	/*
+	 * Only the first marks file is looked up lazily, so that the ones
+	 * after it override it.
+	 */
+	if (fread(sig, 1, sizeof(sig), f) == sizeof(sig) &&
+	    get_be32(sig) == MARKS_SIGNATURE) {
+		if (marks_format == MARKS_FORMAT_UNSET)
+			marks_format = MARKS_FORMAT_BINARY;
+		read_binary_marks(fileno(f), !imported);
+	} else {
+		rewind(f);
+		read_mark_file(&marks, f, insert_object_entry);
+	}
+	if (imported)
+		marks_export.appendable = 0;
+	imported = 1;
 	fclose(f);
 done:
 	import_marks_file_done = 1;
@@ -2001,7 +2853,6 @@ static char *parse_ident(const char *buf)
 }
 
 static void parse_and_store_blob(
-	struct last_object *last,
 	struct object_id *oidout,
 	uintmax_t mark)
 {
@@ -2009,13 +2860,9 @@ static void parse_and_store_blob(
 	uintmax_t len;
 
 	if (parse_data(&buf, big_file_threshold, &len))
-		store_object(OBJ_BLOB, &buf, last, oidout, mark);
+		store_blob(&buf, oidout, mark);
 	else {
-		if (last) {
-			strbuf_release(&last->data);
-			last->offset = 0;
-			last->depth = 0;
-		}
+		prune_delta_window(1);
 		stream_blob(len, oidout, mark);
 		skip_optional_lf();
 	}
@@ -2026,7 +2873,7 @@ static void parse_new_blob(void)
 	read_next_command();
 	parse_mark();
 	parse_original_identifier();
-	parse_and_store_blob(&last_blob, NULL, next_mark);
+	parse_and_store_blob(NULL, next_mark);
 }
 
 static void unload_one_branch(void)
@@ -2347,7 +3194,7 @@ static void file_change_m(const char *p, struct branch *b)
 			if (skip_prefix(command_buf.buf, "cat-blob ", &v))
 				parse_cat_blob(v);
 			else {
-				parse_and_store_blob(&last_blob, &oid, 0);
+				parse_and_store_blob(&oid, 0);
 				break;
 			}
 		}
@@ -2512,7 +3359,7 @@ static void note_change_n(const char *p, struct branch *b, unsigned char *old_fa
 			p = uq.buf;
 		}
 		read_next_command();
-		parse_and_store_blob(&last_blob, &oid, 0);
+		parse_and_store_blob(&oid, 0);
 	} else if (oe) {
 		if (oe->type != OBJ_BLOB)
 			die("Not a blob (actually a %s): %s",
@@ -2943,6 +3790,8 @@ static void cat_blob(struct object_entry *oe, struct object_id *oid)
 	enum object_type type = 0;
 	char *buf;
 
+	if (oe && oe->type == OBJ_BLOB)
+		write_pending_blobs();
 	if (!oe || oe->pack_id == MAX_PACK_ID) {
 		buf = repo_read_object_file(the_repository, oid, &type, &size);
 	} else {
@@ -2973,10 +3822,17 @@ static void cat_blob(struct object_entry *oe, struct object_id *oid)
 	strbuf_release(&line);
 	cat_blob_write(buf, size);
 	cat_blob_write("\n", 1);
-	if (oe && oe->pack_id == pack_id) {
-		last_blob.offset = oe->idx.offset;
-		strbuf_attach(&last_blob.data, buf, size, size);
-		last_blob.depth = oe->depth;
+	if (oe && oe->pack_id == pack_id && !in_delta_window(oe)) {
+		struct blob_base *blob;
+
+		CALLOC_ARRAY(blob, 1);
+		strbuf_attach(&blob->data, buf, size, size);
+		blob->e = oe;
+		blob->depth = oe->depth;
+		blob->refcount = 1;
+		blob->written = 1;
+		add_to_delta_window(blob);
+		put_blob_base(blob);
 	} else
 		free(buf);
 }
@@ -3248,7 +4104,7 @@ static void parse_alias(void)
 		die(_("Expected 'to' command, got %s"), command_buf.buf);
 	e = find_object(&b.oid);
 	assert(e);
-	insert_mark(&marks, next_mark, e);
+	mark_object(next_mark, e);
 }
 
 static char* make_fast_import_path(const char *path)
@@ -3305,6 +4161,24 @@ static void option_depth(const char *depth)
 		die("--depth cannot exceed %u", MAX_DEPTH);
 }
 
+static void option_threads(const char *threads)
+{
+	unsigned long n = ulong_arg("--threads", threads);
+	if (n > (unsigned long) INT_MAX)
+		die("--threads cannot exceed %d", INT_MAX);
+	blob_threads = (int) n;
+}
+
+static void option_marks_format(const char *fmt)
+{
+	if (!strcmp(fmt, "text"))
+		marks_format = MARKS_FORMAT_TEXT;
+	else if (!strcmp(fmt, "binary"))
+		marks_format = MARKS_FORMAT_BINARY;
+	else
+		die("unknown --marks-format argument %s", fmt);
+}
+
 static void option_active_branches(const char *branches)
 {
 	max_active_branches = ulong_arg("--active-branches", branches);
@@ -3376,8 +4250,14 @@ static int parse_one_option(const char *option)
 		big_file_threshold = v;
 	} else if (skip_prefix(option, "depth=", &option)) {
 		option_depth(option);
+	} else if (skip_prefix(option, "window=", &option)) {
+		delta_window_size = ulong_arg("--window", option);
+	} else if (skip_prefix(option, "threads=", &option)) {
+		option_threads(option);
 	} else if (skip_prefix(option, "active-branches=", &option)) {
 		option_active_branches(option);
+	} else if (skip_prefix(option, "marks-format=", &option)) {
+		option_marks_format(option);
 	} else if (skip_prefix(option, "export-pack-edges=", &option)) {
 		option_export_pack_edges(option);
 	} else if (!strcmp(option, "quiet")) {
@@ -3483,6 +4363,11 @@ static void git_pack_config(void)
 	if (!git_config_get_ulong("pack.packsizelimit", &packsizelimit_value))
 		max_packsize = packsizelimit_value;
 
+	git_config_get_ulong("fastimport.window", &delta_window_size);
+	if (!git_config_get_int("fastimport.threads", &blob_threads) &&
+	    blob_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    blob_threads, "fastimport.threads");
 	if (!git_config_get_int("fastimport.unpacklimit", &limit))
 		unpack_limit = limit;
 	else if (!git_config_get_int("transfer.unpacklimit", &limit))
@@ -3619,6 +4504,7 @@ int cmd_fast_import(int argc, const char **argv, const char *prefix)
 		die("stream ends early");
 
 	end_packfile();
+	stop_blob_workers();
 
 	dump_branches();
 	dump_tags();
@@ -1124,7 +1124,7 @@ N_("it took %.2f seconds to check forced updates; you can use\n"
    "to avoid this check\n");
 
 static int store_updated_refs(struct display_state *display_state,
-			      const char *remote_name,
+			      struct transport *transport,
 			      int connectivity_checked,
 			      struct ref_transaction *transaction, struct ref *ref_map,
 			      struct fetch_head *fetch_head,
@@ -1144,6 +1144,7 @@ static int store_updated_refs(struct display_state *display_state,
 		struct check_connected_options opt = CHECK_CONNECTED_INIT;
 
 		opt.exclude_hidden_refs_section = "fetch";
+		opt.transport = transport;
 		rm = ref_map;
 		if (check_connected(iterate_ref_map, &rm, &opt)) {
 			rc = error(_("%s did not send all necessary objects\n"),
@@ -1265,7 +1266,7 @@ static int store_updated_refs(struct display_state *display_state,
 	if (rc & STORE_REF_ERROR_DF_CONFLICT)
 		error(_("some local refs could not be updated; try running\n"
 		      " 'git remote prune %s' to remove any old, conflicting "
-		      "branches"), remote_name);
+		      "branches"), transport->remote->name);
 
 	if (advice_enabled(ADVICE_FETCH_SHOW_FORCED_UPDATES)) {
 		if (!config->show_forced_updates) {
@@ -1351,7 +1352,7 @@ static int fetch_and_consume_refs(struct display_state *display_state,
 	}
 
 	trace2_region_enter("fetch", "consume_refs", the_repository);
-	ret = store_updated_refs(display_state, transport->remote->name,
+	ret = store_updated_refs(display_state, transport,
 				 connectivity_checked, transaction, ref_map,
 				 fetch_head, config);
 	trace2_region_leave("fetch", "consume_refs", the_repository);
@@ -1511,6 +1512,15 @@ static struct transport *prepare_transport(struct remote *remote, int deepen)
 		set_option(transport, TRANS_OPT_LIST_OBJECTS_FILTER, spec);
 		set_option(transport, TRANS_OPT_FROM_PROMISOR, "1");
 	}
+	/*
+	 * In a partial clone, the pack is checked against the links out of
+	 * it that index-pack records, since walking it from the new tips
+	 * would have to enumerate all promisor objects.
+	 */
+	if (transport->smart_options &&
+	    !depth && !deepen_since && !deepen_not.nr &&
+	    repo_has_promisor_remote(the_repository))
+		transport->smart_options->check_self_contained_and_connected = 1;
 	if (negotiation_tip.nr) {
 		if (transport->smart_options)
 			add_negotiation_tips(transport->smart_options);
@@ -2464,13 +2474,19 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	    (fetch_write_commit_graph < 0 &&
 	     the_repository->settings.fetch_write_commit_graph)) {
 		int commit_graph_flags = COMMIT_GRAPH_WRITE_SPLIT;
+		struct commit_graph_opts commit_graph_opts = {
+			.max_new_filters = -1,
+		};
 
 		if (progress)
 			commit_graph_flags |= COMMIT_GRAPH_WRITE_PROGRESS;
 
+		repo_config_get_int(the_repository, "fetch.commitgraphmergelimit",
+				    &commit_graph_opts.merge_limit);
+
 		write_commit_graph_reachable(the_repository->objects->odb,
 					     commit_graph_flags,
-					     NULL);
+					     &commit_graph_opts);
 	}
 
 	if (enable_auto_gc) {
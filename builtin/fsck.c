@@ -27,6 +27,7 @@
 #include "resolve-undo.h"
 #include "run-command.h"
 #include "sparse-index.h"
+#include "thread-utils.h"
 #include "worktree.h"
 #include "pack-revindex.h"
 #include "pack-bitmap.h"
@@ -53,6 +54,7 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int nr_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -180,9 +182,46 @@ static void mark_object_reachable(struct object *obj)
 	mark_object(obj, OBJ_ANY, NULL, NULL);
 }
 
+static int use_bitmap_index;
+static struct bitmap_index *bitmap_git;
+
+static int check_bitmapped(const struct object_id *oid, void *data UNUSED)
+{
+	struct object *obj = lookup_object(the_repository, oid);
+	return !obj || !(obj->flags & HAS_OBJ);
+}
+
+static int mark_bitmapped(const struct object_id *oid, void *data UNUSED)
+{
+	lookup_object(the_repository, oid)->flags |= REACHABLE;
+	return 0;
+}
+
+/*
+ * Everything in the bitmap of a commit is reachable from it, and need not
+ * be walked if we found all of it while checking the objects. Return -1
+ * if the commit has to be walked after all.
+ */
+static int mark_bitmapped_reachable(struct object *obj)
+{
+	struct commit *commit = (struct commit *)obj;
+
+	if (!bitmap_git || obj->type != OBJ_COMMIT ||
+	    for_each_commit_bitmap_object(bitmap_git, commit,
+					  check_bitmapped, NULL))
+		return -1;
+	return for_each_commit_bitmap_object(bitmap_git, commit,
+					     mark_bitmapped, NULL);
+}
+
 static int traverse_one_object(struct object *obj)
 {
-	int result = fsck_walk(obj, obj, &fsck_walk_options);
+	int result;
+
+	if (!mark_bitmapped_reachable(obj))
+		return 0;
+
+	result = fsck_walk(obj, obj, &fsck_walk_options);
 
 	if (obj->type == OBJ_TREE) {
 		struct tree *tree = (struct tree *)obj;
@@ -196,6 +235,8 @@ static int traverse_reachable(void)
 	struct progress *progress = NULL;
 	unsigned int nr = 0;
 	int result = 0;
+	if (use_bitmap_index && !name_objects)
+		bitmap_git = prepare_bitmap_git(the_repository);
 	if (show_progress)
 		progress = start_delayed_progress(_("Checking connectivity"), 0);
 	while (pending.nr) {
@@ -203,6 +244,8 @@ static int traverse_reachable(void)
 		display_progress(progress, ++nr);
 	}
 	stop_progress(&progress);
+	free_bitmap_index(bitmap_git);
+	bitmap_git = NULL;
 	return !!result;
 }
 
@@ -701,8 +744,8 @@ static void fsck_object_dir(const char *path)
 	if (show_progress)
 		progress = start_progress(_("Checking object directories"), 256);
 
-	for_each_loose_file_in_objdir(path, fsck_loose, fsck_cruft, fsck_subdir,
-				      &cb_data);
+	for_each_loose_file_in_objdir_parallel(path, nr_threads, fsck_loose,
+					       fsck_cruft, fsck_subdir, &cb_data);
 	display_progress(progress, 256);
 	stop_progress(&progress);
 	strbuf_release(&cb_data.obj_type);
@@ -900,7 +943,8 @@ static char const * const fsck_usage[] = {
 	N_("git fsck [--tags] [--root] [--unreachable] [--cache] [--no-reflogs]\n"
 	   "         [--[no-]full] [--strict] [--verbose] [--lost-found]\n"
 	   "         [--[no-]dangling] [--[no-]progress] [--connectivity-only]\n"
-	   "         [--[no-]name-objects] [<object>...]"),
+	   "         [--[no-]name-objects] [--threads=<n>] [--use-bitmap-index]\n"
+	   "         [<object>...]"),
 	NULL
 };
 
@@ -919,6 +963,10 @@ static struct option fsck_opts[] = {
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
+	OPT_INTEGER(0, "threads", &nr_threads,
+		    N_("use up to <n> threads to check objects")),
+	OPT_BOOL(0, "use-bitmap-index", &use_bitmap_index,
+		 N_("take reachability from bitmaps where possible")),
 	OPT_END(),
 };
 
@@ -955,6 +1003,9 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	if (name_objects)
 		fsck_enable_object_names(&fsck_walk_options);
 
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+
 	git_config(git_fsck_config, &fsck_obj_options);
 	prepare_repo_settings(the_repository);
 
@@ -986,7 +1037,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -1060,8 +1111,10 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	}
 
 	errors_found |= check_pack_rev_indexes(the_repository, show_progress);
-	if (verify_bitmap_files(the_repository))
+	if (verify_bitmap_files(the_repository)) {
 		errors_found |= ERROR_BITMAP;
+		use_bitmap_index = 0;
+	}
 
 	check_connectivity();
 
@@ -12,6 +12,7 @@
 
 #include "builtin.h"
 #include "abspath.h"
+#include "archive.h"
 #include "date.h"
 #include "environment.h"
 #include "hex.h"
@@ -25,6 +26,7 @@
 #include "strvec.h"
 #include "commit.h"
 #include "commit-graph.h"
+#include "grep-index.h"
 #include "packfile.h"
 #include "object-file.h"
 #include "object-store-ll.h"
@@ -34,12 +36,14 @@
 #include "blob.h"
 #include "tree.h"
 #include "promisor-remote.h"
+#include "read-cache-ll.h"
 #include "refs.h"
 #include "remote.h"
 #include "exec-cmd.h"
 #include "gettext.h"
 #include "hook.h"
 #include "setup.h"
+#include "trace.h"
 #include "trace2.h"
 
 #define FAILED_RUN "failed to run %s"
@@ -326,7 +330,7 @@ static uint64_t estimate_repack_memory(struct packed_git *pack)
 	 */
 	heap += sizeof(struct tree) * nr_objects / 2;
 	/* and then obj_hash[], underestimated in fact */
-	heap += sizeof(struct object *) * nr_objects;
+	heap += sizeof(struct obj_hash_slot) * nr_objects;
 	/* revindex is used also */
 	heap += (sizeof(off_t) + sizeof(uint32_t)) * nr_objects;
 	/*
@@ -813,6 +817,8 @@ struct maintenance_run_opts {
 	int auto_flag;
 	int quiet;
 	enum schedule_priority schedule;
+	/* Seconds after which no more tasks are started, or 0. */
+	int time_budget;
 };
 
 /* Remember to update object flag allocation in object.h */
@@ -894,6 +900,8 @@ static int should_write_commit_graph(void)
 		return 0;
 	if (data.limit < 0)
 		return 1;
+	if (commit_graph_merge_pending(the_repository))
+		return 1;
 
 	result = for_each_ref(dfs_on_ref, &data);
 
@@ -905,11 +913,16 @@ static int should_write_commit_graph(void)
 static int run_write_commit_graph(struct maintenance_run_opts *opts)
 {
 	struct child_process child = CHILD_PROCESS_INIT;
+	int merge_limit = 0;
 
 	child.git_cmd = child.close_object_store = 1;
 	strvec_pushl(&child.args, "commit-graph", "write",
 		     "--split", "--reachable", NULL);
 
+	git_config_get_int("maintenance.commit-graph.mergelimit", &merge_limit);
+	if (merge_limit > 0)
+		strvec_pushf(&child.args, "--merge-limit=%d", merge_limit);
+
 	if (opts->quiet)
 		strvec_push(&child.args, "--no-progress");
 
@@ -1038,9 +1051,12 @@ static int write_loose_object_to_stdin(const struct object_id *oid,
 {
 	struct write_loose_object_data *d = (struct write_loose_object_data *)data;
 
+	if (d->count >= d->batch_size)
+		return 1;
 	fprintf(d->in, "%s\n", oid_to_hex(oid));
+	d->count++;
 
-	return ++(d->count) > d->batch_size;
+	return 0;
 }
 
 static int pack_loose(struct maintenance_run_opts *opts)
@@ -1076,6 +1092,10 @@ static int pack_loose(struct maintenance_run_opts *opts)
 	data.in = xfdopen(pack_proc.in, "w");
 	data.count = 0;
 	data.batch_size = 50000;
+	git_config_get_int("maintenance.loose-objects.batchsize",
+			   &data.batch_size);
+	if (data.batch_size <= 0)
+		data.batch_size = INT_MAX;
 
 	for_each_loose_file_in_objdir(r->objects->odb->path,
 				      write_loose_object_to_stdin,
@@ -1201,6 +1221,8 @@ static off_t get_auto_pack_size(void)
 static int multi_pack_index_repack(struct maintenance_run_opts *opts)
 {
 	struct child_process child = CHILD_PROCESS_INIT;
+	off_t batch_size = get_auto_pack_size();
+	unsigned long max_batch_size;
 
 	child.git_cmd = child.close_object_store = 1;
 	strvec_pushl(&child.args, "multi-pack-index", "repack", NULL);
@@ -1208,8 +1230,14 @@ static int multi_pack_index_repack(struct maintenance_run_opts *opts)
 	if (opts->quiet)
 		strvec_push(&child.args, "--no-progress");
 
+	/* Repack fewer packs in each run, so that each run writes less. */
+	if (!git_config_get_ulong("maintenance.incremental-repack.batchsize",
+				  &max_batch_size) &&
+	    max_batch_size && batch_size > max_batch_size)
+		batch_size = max_batch_size;
+
 	strvec_pushf(&child.args, "--batch-size=%"PRIuMAX,
-				  (uintmax_t)get_auto_pack_size());
+				  (uintmax_t)batch_size);
 
 	if (run_command(&child))
 		return error(_("'git multi-pack-index repack' failed"));
@@ -1234,6 +1262,73 @@ static int maintenance_task_incremental_repack(struct maintenance_run_opts *opts
 	return 0;
 }
 
+static int split_index_auto_limit = 100;
+
+static int count_not_shared_entries(struct index_state *istate)
+{
+	int i, count = 0;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!istate->cache[i]->index)
+			count++;
+	return count;
+}
+
+static int split_index_auto_condition(void)
+{
+	git_config_get_int("maintenance.split-index.auto",
+			   &split_index_auto_limit);
+
+	if (!split_index_auto_limit)
+		return 0;
+	if (repo_read_index(the_repository) < 0 ||
+	    !the_repository->index->split_index)
+		return 0;
+	if (split_index_auto_limit < 0)
+		return 1;
+
+	return count_not_shared_entries(the_repository->index) >=
+		split_index_auto_limit;
+}
+
+static int maintenance_task_split_index(MAYBE_UNUSED struct maintenance_run_opts *opts)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct index_state *istate = the_repository->index;
+
+	/* Whoever holds the lock may write a new shared index itself. */
+	if (repo_hold_locked_index(the_repository, &lock, 0) < 0)
+		return 0;
+
+	discard_index(istate);
+	if (repo_read_index(the_repository) < 0) {
+		rollback_lock_file(&lock);
+		return error(_("unable to read the index"));
+	}
+	if (!istate->split_index || !count_not_shared_entries(istate)) {
+		rollback_lock_file(&lock);
+		return 0;
+	}
+
+	istate->cache_changed |= SPLIT_INDEX_ORDERED;
+	if (write_locked_index(istate, &lock, COMMIT_LOCK))
+		return error(_("unable to write a new shared index"));
+	return 0;
+}
+
+static int maintenance_task_grep_index(struct maintenance_run_opts *opts)
+{
+	if (write_grep_index(the_repository,
+			     opts->quiet ? 0 : GREP_INDEX_WRITE_PROGRESS))
+		return error(_("failed to write grep index"));
+	return 0;
+}
+
+static int maintenance_task_archive_cache(MAYBE_UNUSED struct maintenance_run_opts *opts)
+{
+	return expire_archive_cache(the_repository);
+}
+
 typedef int maintenance_task_fn(struct maintenance_run_opts *opts);
 
 /*
@@ -1248,6 +1343,8 @@ struct maintenance_task {
 	maintenance_task_fn *fn;
 	maintenance_auto_fn *auto_condition;
 	unsigned enabled:1;
+	/* Whether the time budget ran out before the task could run. */
+	unsigned deferred:1;
 
 	enum schedule_priority schedule;
 
@@ -1262,6 +1359,9 @@ enum maintenance_task_label {
 	TASK_GC,
 	TASK_COMMIT_GRAPH,
 	TASK_PACK_REFS,
+	TASK_SPLIT_INDEX,
+	TASK_GREP_INDEX,
+	TASK_ARCHIVE_CACHE,
 
 	/* Leave as final value */
 	TASK__COUNT
@@ -1298,6 +1398,21 @@ static struct maintenance_task tasks[] = {
 		maintenance_task_pack_refs,
 		NULL,
 	},
+	[TASK_SPLIT_INDEX] = {
+		"split-index",
+		maintenance_task_split_index,
+		split_index_auto_condition,
+	},
+	[TASK_GREP_INDEX] = {
+		"grep-index",
+		maintenance_task_grep_index,
+		NULL,
+	},
+	[TASK_ARCHIVE_CACHE] = {
+		"archive-cache",
+		maintenance_task_archive_cache,
+		NULL,
+	},
 };
 
 static int compare_tasks_by_selection(const void *a_, const void *b_)
@@ -1308,13 +1423,57 @@ static int compare_tasks_by_selection(const void *a_, const void *b_)
 	return b->selected_order - a->selected_order;
 }
 
+/*
+ * The tasks that the last run deferred are listed in this file, one per
+ * line, so that the next run can start with them.
+ */
+static void read_deferred_tasks(const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list names = STRING_LIST_INIT_NODUP;
+	int i;
+
+	if (strbuf_read_file(&buf, path, 0) < 0)
+		return;
+	string_list_split_in_place(&names, buf.buf, "\n", -1);
+	for (i = 0; i < TASK__COUNT; i++)
+		tasks[i].deferred = unsorted_string_list_has_string(&names,
+								    tasks[i].name);
+	string_list_clear(&names, 0);
+	strbuf_release(&buf);
+}
+
+static void write_deferred_tasks(const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < TASK__COUNT; i++)
+		if (tasks[i].deferred)
+			strbuf_addf(&buf, "%s\n", tasks[i].name);
+	if (buf.len)
+		write_file_buf(path, buf.buf, buf.len);
+	else
+		unlink_or_warn(path);
+	strbuf_release(&buf);
+}
+
+static int time_budget_exhausted(struct maintenance_run_opts *opts,
+				 uint64_t start)
+{
+	return opts->time_budget > 0 &&
+	       getnanotime() - start >= opts->time_budget * (uint64_t)1000000000;
+}
+
 static int maintenance_run_tasks(struct maintenance_run_opts *opts)
 {
-	int i, found_selected = 0;
+	int i, pass, found_selected = 0;
 	int result = 0;
 	struct lock_file lk;
 	struct repository *r = the_repository;
 	char *lock_path = xstrfmt("%s/maintenance", r->objects->odb->path);
+	char *deferred_path;
+	uint64_t start = getnanotime();
 
 	if (hold_lock_file_for_update(&lk, lock_path, LOCK_NO_DEREF) < 0) {
 		/*
@@ -1338,29 +1497,61 @@ static int maintenance_run_tasks(struct maintenance_run_opts *opts)
 	if (found_selected)
 		QSORT(tasks, TASK__COUNT, compare_tasks_by_selection);
 
-	for (i = 0; i < TASK__COUNT; i++) {
-		if (found_selected && tasks[i].selected_order < 0)
-			continue;
+	deferred_path = xstrfmt("%s/maintenance-deferred", r->objects->odb->path);
+	read_deferred_tasks(deferred_path);
 
-		if (!found_selected && !tasks[i].enabled)
-			continue;
+	/*
+	 * The tasks that were deferred go first, and are not held back by
+	 * --auto or --schedule again.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < TASK__COUNT; i++) {
+			struct maintenance_task *task = &tasks[i];
 
-		if (opts->auto_flag &&
-		    (!tasks[i].auto_condition ||
-		     !tasks[i].auto_condition()))
-			continue;
+			if (task->deferred != !pass)
+				continue;
 
-		if (opts->schedule && tasks[i].schedule < opts->schedule)
-			continue;
+			if (found_selected && task->selected_order < 0)
+				continue;
+
+			if (!found_selected && !task->enabled) {
+				task->deferred = 0;
+				continue;
+			}
+
+			if (!task->deferred) {
+				if (opts->auto_flag &&
+				    (!task->auto_condition ||
+				     !task->auto_condition()))
+					continue;
+
+				if (opts->schedule &&
+				    task->schedule < opts->schedule)
+					continue;
+			}
 
-		trace2_region_enter("maintenance", tasks[i].name, r);
-		if (tasks[i].fn(opts)) {
-			error(_("task '%s' failed"), tasks[i].name);
-			result = 1;
+			if (time_budget_exhausted(opts, start)) {
+				if (!opts->quiet)
+					warning(_("time budget exhausted, deferring task '%s'"),
+						task->name);
+				trace2_data_string("maintenance", r, "deferred",
+						   task->name);
+				task->deferred = 1;
+				continue;
+			}
+			task->deferred = 0;
+
+			trace2_region_enter("maintenance", task->name, r);
+			if (task->fn(opts)) {
+				error(_("task '%s' failed"), task->name);
+				result = 1;
+			}
+			trace2_region_leave("maintenance", task->name, r);
 		}
-		trace2_region_leave("maintenance", tasks[i].name, r);
 	}
 
+	write_deferred_tasks(deferred_path);
+	free(deferred_path);
 	rollback_lock_file(&lk);
 	return result;
 }
@@ -1466,11 +1657,14 @@ static int maintenance_run(int argc, const char **argv, const char *prefix)
 		OPT_CALLBACK_F(0, "task", NULL, N_("task"),
 			N_("run a specific task"),
 			PARSE_OPT_NONEG, task_option_parse),
+		OPT_INTEGER(0, "time-budget", &opts.time_budget,
+			    N_("do not start tasks after <n> seconds")),
 		OPT_END()
 	};
 	memset(&opts, 0, sizeof(opts));
 
 	opts.quiet = !isatty(2);
+	git_config_get_int("maintenance.timebudget", &opts.time_budget);
 
 	for (i = 0; i < TASK__COUNT; i++)
 		tasks[i].selected_order = -1;
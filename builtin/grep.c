@@ -19,6 +19,7 @@
 #include "run-command.h"
 #include "userdiff.h"
 #include "grep.h"
+#include "grep-index.h"
 #include "quote.h"
 #include "dir.h"
 #include "pathspec.h"
@@ -43,6 +44,9 @@ static char const * const grep_usage[] = {
 
 static int recurse_submodules;
 
+static int use_grep_index = 1;
+static struct grep_index *grep_index;
+
 static int num_threads;
 
 static pthread_t *threads;
@@ -53,6 +57,11 @@ static pthread_t *threads;
  */
 struct work_item {
 	struct grep_source source;
+	/*
+	 * Or, if set, a tree or commit that the thread greps as a whole,
+	 * named after "source.name"; see grep_object().
+	 */
+	struct object *tree;
 	char done;
 	struct strbuf out;
 };
@@ -104,11 +113,16 @@ static pthread_cond_t cond_result;
 
 static int skip_first_line;
 
-static void add_work(struct grep_opt *opt, struct grep_source *gs)
-{
-	if (opt->binary != GREP_BINARY_TEXT)
-		grep_source_load_driver(gs, opt->repo->index);
+/*
+ * When grepping at least as many trees as there are threads, each thread
+ * walks whole trees and reads their blobs itself, instead of the main
+ * thread walking them all and handing out the blobs one by one.
+ */
+static int grep_trees_in_threads;
+static const struct pathspec *tree_pathspec;
 
+static void queue_work(struct grep_source *gs, struct object *tree)
+{
 	grep_lock();
 
 	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
@@ -116,6 +130,7 @@ static void add_work(struct grep_opt *opt, struct grep_source *gs)
 	}
 
 	todo[todo_end].source = *gs;
+	todo[todo_end].tree = tree;
 	todo[todo_end].done = 0;
 	strbuf_reset(&todo[todo_end].out);
 	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
@@ -124,6 +139,22 @@ static void add_work(struct grep_opt *opt, struct grep_source *gs)
 	grep_unlock();
 }
 
+static void add_work(struct grep_opt *opt, struct grep_source *gs)
+{
+	if (opt->binary != GREP_BINARY_TEXT)
+		grep_source_load_driver(gs, opt->repo->index);
+	queue_work(gs, NULL);
+}
+
+static void add_tree_work(struct object *tree, const char *name)
+{
+	struct grep_source gs;
+
+	memset(&gs, 0, sizeof(gs));
+	gs.name = xstrdup_or_null(name);
+	queue_work(&gs, tree);
+}
+
 static struct work_item *get_work(void)
 {
 	struct work_item *ret;
@@ -194,6 +225,9 @@ static void free_repos(void)
 	repos_to_free_alloc = 0;
 }
 
+static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
+		       struct object *obj, const char *name, const char *path);
+
 static void *run(void *arg)
 {
 	int hit = 0;
@@ -205,7 +239,11 @@ static void *run(void *arg)
 			break;
 
 		opt->output_priv = w;
-		hit |= grep_source(opt, &w->source);
+		if (w->tree)
+			hit |= grep_object(opt, tree_pathspec, w->tree,
+					   w->source.name, NULL);
+		else
+			hit |= grep_source(opt, &w->source);
 		grep_source_clear_data(&w->source);
 		work_done(w);
 	}
@@ -221,6 +259,12 @@ static void strbuf_out(struct grep_opt *opt, const void *buf, size_t size)
 	strbuf_add(&w->out, buf, size);
 }
 
+/* Is "opt" the copy of a worker thread, grepping a whole tree? */
+static int in_worker(struct grep_opt *opt)
+{
+	return opt->output == strbuf_out;
+}
+
 static void start_threads(struct grep_opt *opt)
 {
 	int i;
@@ -320,6 +364,9 @@ static int grep_cmd_config(const char *var, const char *value,
 	if (!strcmp(var, "submodule.recurse"))
 		recurse_submodules = git_config_bool(var, value);
 
+	if (!strcmp(var, "grep.trigramindex"))
+		use_grep_index = git_config_bool(var, value);
+
 	return st;
 }
 
@@ -362,11 +409,14 @@ static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 	struct strbuf pathbuf = STRBUF_INIT;
 	struct grep_source gs;
 
+	if (grep_index && !grep_index_may_match(grep_index, oid))
+		return 0;
+
 	grep_source_name(opt, filename, tree_name_len, &pathbuf);
 	grep_source_init_oid(&gs, pathbuf.buf, path, oid, opt->repo);
 	strbuf_release(&pathbuf);
 
-	if (num_threads > 1) {
+	if (num_threads > 1 && !in_worker(opt)) {
 		/*
 		 * add_work() copies gs and thus assumes ownership of
 		 * its fields, so do not call grep_source_clear()
@@ -696,6 +746,11 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 {
 	if (obj->type == OBJ_BLOB)
 		return grep_oid(opt, &obj->oid, name, 0, path);
+	if ((obj->type == OBJ_COMMIT || obj->type == OBJ_TREE) &&
+	    grep_trees_in_threads && !in_worker(opt)) {
+		add_tree_work(obj, name);
+		return 0;
+	}
 	if (obj->type == OBJ_COMMIT || obj->type == OBJ_TREE) {
 		struct tree_desc tree;
 		void *data;
@@ -732,6 +787,15 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 	int hit = 0;
 	const unsigned int nr = list->nr;
 
+	/*
+	 * Submodules are read into the in-memory alternates as they are
+	 * found, and "attr" pathspec magic looks at attributes while walking
+	 * the trees, both of which only the main thread may do.
+	 */
+	grep_trees_in_threads = num_threads > 1 && nr >= num_threads &&
+		!recurse_submodules && !(pathspec->magic & PATHSPEC_ATTR);
+	tree_pathspec = pathspec;
+
 	for (i = 0; i < nr; i++) {
 		struct object *real_obj;
 
@@ -1185,6 +1249,9 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	else if (num_threads == 0)
 		num_threads = HAVE_THREADS ? online_cpus() : 1;
 
+	if (use_grep_index && use_index && !untracked && (cached || list.nr))
+		grep_index = load_grep_index(the_repository, &opt);
+
 	if (num_threads > 1) {
 		if (!HAVE_THREADS)
 			BUG("Somebody got num_threads calculation wrong!");
@@ -1270,5 +1337,6 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	free_grep_patterns(&opt);
 	object_array_clear(&list);
 	free_repos();
+	free_grep_index(grep_index);
 	return !hit;
 }
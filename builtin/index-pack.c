@@ -98,6 +98,14 @@ static size_t base_cache_limit;
 struct thread_local {
 	pthread_t thread;
 	int pack_fd;
+	/*
+	 * Each thread checks the objects it resolves with its own copy of
+	 * fsck_options, so that fsck_object() can run without holding the
+	 * read_mutex. The sets of .gitmodules and .gitattributes blobs it
+	 * collects are merged back into the global options when the
+	 * threads are done.
+	 */
+	struct fsck_options fsck_options;
 };
 
 /* Remember to update object flag allocation in object.h */
@@ -135,6 +143,11 @@ static const char *progress_title;
 static int show_resolving_progress;
 static int show_stat;
 static int check_self_contained_and_connected;
+static int record_boundary;
+
+/* The objects outside of the pack that it links to, for --record-boundary */
+static struct object **boundary;
+static int nr_boundary, boundary_alloc;
 
 static struct progress *progress;
 
@@ -171,6 +184,23 @@ static pthread_mutex_t deepest_delta_mutex;
 
 static pthread_key_t key;
 
+/*
+ * Objects that the first pass has inflated, waiting for a thread to
+ * hash and check them; see queue_first_pass_object().
+ *
+ * Guarded by work_mutex.
+ */
+struct first_pass_job {
+	struct object_entry *obj;
+	void *data;
+};
+static struct first_pass_job *first_pass_jobs;
+static int first_pass_alloc, first_pass_start, first_pass_nr;
+static size_t first_pass_bytes;
+static int first_pass_done;
+static pthread_cond_t first_pass_work;
+static pthread_cond_t first_pass_room;
+
 static inline void lock_mutex(pthread_mutex_t *mutex)
 {
 	if (threads_active)
@@ -183,6 +213,55 @@ static inline void unlock_mutex(pthread_mutex_t *mutex)
 		pthread_mutex_unlock(mutex);
 }
 
+/*
+ * The error callbacks describe objects using static buffers, and print
+ * to stdout; serialize them with the other threads.
+ */
+static int fsck_error_locked(struct fsck_options *o,
+			     const struct object_id *oid,
+			     enum object_type object_type,
+			     enum fsck_msg_type msg_type,
+			     enum fsck_msg_id msg_id,
+			     const char *message)
+{
+	int ret;
+
+	read_lock();
+	ret = fsck_options.error_func(o, oid, object_type, msg_type, msg_id,
+				      message);
+	read_unlock();
+	return ret;
+}
+
+static void init_thread_fsck_options(struct fsck_options *o)
+{
+	*o = fsck_options;
+	oidset_init(&o->gitmodules_found, 0);
+	oidset_init(&o->gitmodules_done, 0);
+	oidset_init(&o->gitattributes_found, 0);
+	oidset_init(&o->gitattributes_done, 0);
+	o->error_func = fsck_error_locked;
+}
+
+static void merge_oidset(struct oidset *dst, struct oidset *src)
+{
+	struct oidset_iter iter;
+	const struct object_id *oid;
+
+	oidset_iter_init(src, &iter);
+	while ((oid = oidset_iter_next(&iter)))
+		oidset_insert(dst, oid);
+	oidset_clear(src);
+}
+
+static void merge_thread_fsck_options(struct fsck_options *o)
+{
+	merge_oidset(&fsck_options.gitmodules_found, &o->gitmodules_found);
+	merge_oidset(&fsck_options.gitmodules_done, &o->gitmodules_done);
+	merge_oidset(&fsck_options.gitattributes_found, &o->gitattributes_found);
+	merge_oidset(&fsck_options.gitattributes_done, &o->gitattributes_done);
+}
+
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
  */
@@ -195,9 +274,12 @@ static void init_thread(void)
 	if (show_stat)
 		pthread_mutex_init(&deepest_delta_mutex, NULL);
 	pthread_key_create(&key, NULL);
+	if (do_fsck_object)
+		fsck_prepare_threads();
 	CALLOC_ARRAY(thread_data, nr_threads);
 	for (i = 0; i < nr_threads; i++) {
 		thread_data[i].pack_fd = xopen(curr_pack, O_RDONLY);
+		init_thread_fsck_options(&thread_data[i].fsck_options);
 	}
 
 	threads_active = 1;
@@ -214,8 +296,10 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&work_mutex);
 	if (show_stat)
 		pthread_mutex_destroy(&deepest_delta_mutex);
-	for (i = 0; i < nr_threads; i++)
+	for (i = 0; i < nr_threads; i++) {
 		close(thread_data[i].pack_fd);
+		merge_thread_fsck_options(&thread_data[i].fsck_options);
+	}
 	pthread_key_delete(key);
 	free(thread_data);
 }
@@ -247,14 +331,23 @@ static unsigned check_object(struct object *obj)
 	if (!(obj->flags & FLAG_CHECKED)) {
 		unsigned long size;
 		int type = oid_object_info(the_repository, &obj->oid, &size);
-		if (type <= 0)
+		/*
+		 * With --record-boundary, whoever reads the boundary decides
+		 * whether a missing object is acceptable, e.g. because it
+		 * is promised.
+		 */
+		if (type <= 0 && !record_boundary)
 			die(_("did not receive expected object %s"),
 			      oid_to_hex(&obj->oid));
-		if (type != obj->type)
+		if (type > 0 && type != obj->type)
 			die(_("object %s: expected type %s, found %s"),
 			    oid_to_hex(&obj->oid),
 			    type_name(obj->type), type_name(type));
 		obj->flags |= FLAG_CHECKED;
+		if (record_boundary) {
+			ALLOC_GROW(boundary, nr_boundary + 1, boundary_alloc);
+			boundary[nr_boundary++] = obj;
+		}
 		return 1;
 	}
 
@@ -408,6 +501,13 @@ static void set_thread_data(struct thread_local *data)
 		pthread_setspecific(key, data);
 }
 
+static struct fsck_options *get_fsck_options(void)
+{
+	if (threads_active)
+		return &get_thread_data()->fsck_options;
+	return &fsck_options;
+}
+
 static void free_base_data(struct base_data *c)
 {
 	if (c->data) {
@@ -462,17 +562,23 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = format_object_header(hdr, sizeof(hdr), type, size);
-		the_hash_algo->init_fn(&c);
-		the_hash_algo->update_fn(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	/*
+	 * Objects we keep in memory are hashed by the threads of the first
+	 * pass, if there are any.
+	 */
+	if (is_delta_type(type) || (threads_active && buf != fixed_buf))
+		oid = NULL;
+	if (oid) {
+		hdrlen = format_object_header(hdr, sizeof(hdr), type, size);
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -846,6 +952,8 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 	}
 
 	if (strict || do_fsck_object) {
+		struct fsck_options *options = get_fsck_options();
+
 		read_lock();
 		if (type == OBJ_BLOB) {
 			struct blob *blob = lookup_blob(the_repository, oid);
@@ -854,7 +962,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 			else
 				die(_("invalid blob object %s"), oid_to_hex(oid));
 			if (do_fsck_object &&
-			    fsck_object(&blob->object, (void *)data, size, &fsck_options))
+			    fsck_object(&blob->object, (void *)data, size, options))
 				die(_("fsck error in packed object"));
 		} else {
 			struct object *obj;
@@ -872,10 +980,19 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 						  &eaten);
 			if (!obj)
 				die(_("invalid %s"), type_name(type));
+
+			/*
+			 * fsck_object() only looks at the buffer and at our
+			 * own fsck_options, so let other threads go on while
+			 * we check this object.
+			 */
+			read_unlock();
 			if (do_fsck_object &&
-			    fsck_object(obj, buf, size, &fsck_options))
+			    fsck_object(obj, buf, size, options))
 				die(_("fsck error in packed object"));
-			if (strict && fsck_walk(obj, NULL, &fsck_options))
+			read_lock();
+
+			if (strict && fsck_walk(obj, NULL, options))
 				die(_("Not all child objects of %s are reachable"), oid_to_hex(&obj->oid));
 
 			if (obj->type == OBJ_TREE) {
@@ -897,7 +1014,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 }
 
 /*
- * Ensure that this node has been reconstructed and return its contents.
+ * Ensure that this node has been reconstructed.
  *
  * In the typical and best case, this node would already be reconstructed
  * (through the invocation to resolve_delta() in threaded_second_pass()) and it
@@ -906,44 +1023,77 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
  * ancestor with reconstructed data that has not been pruned (or if there is
  * none, the ultimate base object), and reconstruct each node in the delta
  * chain in order to generate the reconstructed data for this node.
+ *
+ * This must be called with the work mutex held. The mutex is released while
+ * reconstructing, so that a thread that has to rebuild a long delta chain does
+ * not keep all the others from resolving deltas meanwhile. The nodes on the
+ * chain are retained in the meantime, so that prune_base_data() leaves them
+ * alone; if another thread rebuilt some of them concurrently, its copy wins.
  */
-static void *get_base_data(struct base_data *c)
+static void get_base_data(struct base_data *c)
 {
-	if (!c->data) {
-		struct object_entry *obj = c->obj;
-		struct base_data **delta = NULL;
-		int delta_nr = 0, delta_alloc = 0;
+	struct base_data **chain = NULL, *top;
+	void **data;
+	unsigned long *size, top_size;
+	int chain_nr = 0, chain_alloc = 0, i;
+	void *top_data;
 
-		while (is_delta_type(c->obj->type) && !c->data) {
-			ALLOC_GROW(delta, delta_nr + 1, delta_alloc);
-			delta[delta_nr++] = c;
-			c = c->base;
-		}
-		if (!delta_nr) {
-			c->data = get_data_from_pack(obj);
-			c->size = obj->size;
-			base_cache_used += c->size;
-			prune_base_data(c);
-		}
-		for (; delta_nr > 0; delta_nr--) {
-			void *base, *raw;
-			c = delta[delta_nr - 1];
-			obj = c->obj;
-			base = get_base_data(c->base);
-			raw = get_data_from_pack(obj);
-			c->data = patch_delta(
-				base, c->base->size,
-				raw, obj->size,
-				&c->size);
-			free(raw);
-			if (!c->data)
-				bad_object(obj->idx.offset, _("failed to apply delta"));
-			base_cache_used += c->size;
-			prune_base_data(c);
+	if (c->data)
+		return;
+
+	for (top = c; !top->data && is_delta_type(top->obj->type);
+	     top = top->base) {
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = top;
+	}
+	for (i = 0; i < chain_nr; i++)
+		chain[i]->retain_data++;
+	top->retain_data++;
+	top_data = top->data;
+	top_size = top_data ? top->size : top->obj->size;
+	work_unlock();
+
+	if (!top_data)
+		top_data = get_data_from_pack(top->obj);
+	CALLOC_ARRAY(data, chain_nr);
+	CALLOC_ARRAY(size, chain_nr);
+	for (i = chain_nr - 1; i >= 0; i--) {
+		struct object_entry *obj = chain[i]->obj;
+		void *base = i == chain_nr - 1 ? top_data : data[i + 1];
+		unsigned long base_size = i == chain_nr - 1 ?
+			top_size : size[i + 1];
+		void *raw = get_data_from_pack(obj);
+
+		data[i] = patch_delta(base, base_size, raw, obj->size, &size[i]);
+		free(raw);
+		if (!data[i])
+			bad_object(obj->idx.offset, _("failed to apply delta"));
+	}
+
+	work_lock();
+	if (!top->data) {
+		top->data = top_data;
+		top->size = top_size;
+		base_cache_used += top->size;
+	} else if (top->data != top_data) {
+		free(top_data);
+	}
+	top->retain_data--;
+	for (i = 0; i < chain_nr; i++) {
+		if (!chain[i]->data) {
+			chain[i]->data = data[i];
+			chain[i]->size = size[i];
+			base_cache_used += size[i];
+		} else {
+			free(data[i]);
 		}
-		free(delta);
+		chain[i]->retain_data--;
 	}
-	return c->data;
+	prune_base_data(c);
+
+	free(chain);
+	free(data);
+	free(size);
 }
 
 static struct base_data *make_base(struct object_entry *obj,
@@ -1080,14 +1230,9 @@ static void *threaded_second_pass(void *data)
 
 			/*
 			 * Ensure that the parent has data, since we will need
-			 * it later.
-			 *
-			 * NEEDSWORK: If parent data needs to be reloaded, this
-			 * prolongs the time that the current thread spends in
-			 * the mutex. A mitigating factor is that parent data
-			 * needs to be reloaded only if the delta base cache
-			 * limit is exceeded, so in the typical case, this does
-			 * not happen.
+			 * it later. If it has to be reloaded (which happens
+			 * only if the delta base cache limit is exceeded), the
+			 * mutex is released while doing so.
 			 */
 			get_base_data(parent);
 			parent->retain_data++;
@@ -1160,6 +1305,103 @@ static void *threaded_second_pass(void *data)
  * - calculate SHA1 of all non-delta objects;
  * - remember base (SHA1 or offset) for all deltas.
  */
+static void hash_first_pass_object(struct object_entry *obj, void *data)
+{
+	git_hash_ctx c;
+	char hdr[32];
+	int hdrlen;
+
+	hdrlen = format_object_header(hdr, sizeof(hdr), obj->type, obj->size);
+	the_hash_algo->init_fn(&c);
+	the_hash_algo->update_fn(&c, hdr, hdrlen);
+	the_hash_algo->update_fn(&c, data, obj->size);
+	the_hash_algo->final_oid_fn(&obj->idx.oid, &c);
+
+	sha1_object(data, NULL, obj->size, obj->type, &obj->idx.oid);
+}
+
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		struct first_pass_job job;
+
+		work_lock();
+		while (!first_pass_nr && !first_pass_done)
+			pthread_cond_wait(&first_pass_work, &work_mutex);
+		if (!first_pass_nr) {
+			work_unlock();
+			break;
+		}
+		job = first_pass_jobs[first_pass_start];
+		first_pass_start = (first_pass_start + 1) % first_pass_alloc;
+		first_pass_nr--;
+		work_unlock();
+
+		hash_first_pass_object(job.obj, job.data);
+		free(job.data);
+
+		work_lock();
+		first_pass_bytes -= job.obj->size;
+		pthread_cond_signal(&first_pass_room);
+		work_unlock();
+	}
+	return NULL;
+}
+
+/*
+ * Hand an object that the first pass inflated into "data" to the
+ * threads, which compute its name and check it while we go on
+ * inflating the objects after it. At most delta_base_cache_limit bytes
+ * are kept waiting for them.
+ */
+static void queue_first_pass_object(struct object_entry *obj, void *data)
+{
+	work_lock();
+	while (first_pass_nr == first_pass_alloc ||
+	       (first_pass_nr && first_pass_bytes + obj->size > delta_base_cache_limit))
+		pthread_cond_wait(&first_pass_room, &work_mutex);
+	first_pass_jobs[(first_pass_start + first_pass_nr) % first_pass_alloc].obj = obj;
+	first_pass_jobs[(first_pass_start + first_pass_nr) % first_pass_alloc].data = data;
+	first_pass_nr++;
+	first_pass_bytes += obj->size;
+	pthread_cond_signal(&first_pass_work);
+	work_unlock();
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	init_thread();
+	pthread_cond_init(&first_pass_work, NULL);
+	pthread_cond_init(&first_pass_room, NULL);
+	first_pass_alloc = nr_threads * 64;
+	CALLOC_ARRAY(first_pass_jobs, first_pass_alloc);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	work_lock();
+	first_pass_done = 1;
+	pthread_cond_broadcast(&first_pass_work);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	cleanup_thread();
+	pthread_cond_destroy(&first_pass_work);
+	pthread_cond_destroy(&first_pass_room);
+	FREE_AND_NULL(first_pass_jobs);
+}
+
 static void parse_pack_objects(unsigned char *hash)
 {
 	int i, nr_delays = 0;
@@ -1173,6 +1415,8 @@ static void parse_pack_objects(unsigned char *hash)
 				progress_title ? progress_title :
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS"))
+		start_first_pass_threads();
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
@@ -1192,6 +1436,9 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
+		} else if (threads_active) {
+			queue_first_pass_object(obj, data);
+			data = NULL;
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
@@ -1199,6 +1446,8 @@ static void parse_pack_objects(unsigned char *hash)
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+	if (threads_active)
+		finish_first_pass_threads();
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1498,6 +1747,25 @@ static void write_special_file(const char *suffix, const char *msg,
 	strbuf_release(&name_buf);
 }
 
+/*
+ * Write the objects in "boundary" into a ".boundary" file next to the
+ * ".keep" file, one "<oid> <type>" line each, for the caller to check
+ * before it drops the ".keep" file.
+ */
+static void write_boundary_file(const char *pack_name,
+				const unsigned char *hash)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < nr_boundary; i++)
+		strbuf_addf(&buf, "%s %s\n", oid_to_hex(&boundary[i]->oid),
+			    type_name(boundary[i]->type));
+	strbuf_strip_suffix(&buf, "\n");
+	write_special_file("boundary", buf.buf, pack_name, hash, NULL);
+	strbuf_release(&buf);
+}
+
 static void rename_tmp_packfile(const char **final_name,
 				const char *curr_name,
 				struct strbuf *name, unsigned char *hash,
@@ -1538,6 +1806,8 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	if (keep_msg)
 		write_special_file("keep", keep_msg, final_pack_name, hash,
 				   &report);
+	if (keep_msg && record_boundary)
+		write_boundary_file(final_pack_name, hash);
 	if (promisor_msg)
 		write_special_file("promisor", promisor_msg, final_pack_name,
 				   hash, NULL);
@@ -1785,6 +2055,9 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			} else if (!strcmp(arg, "--check-self-contained-and-connected")) {
 				strict = 1;
 				check_self_contained_and_connected = 1;
+			} else if (!strcmp(arg, "--record-boundary")) {
+				strict = 1;
+				record_boundary = 1;
 			} else if (!strcmp(arg, "--fsck-objects")) {
 				do_fsck_object = 1;
 			} else if (!strcmp(arg, "--verify")) {
@@ -1957,6 +2230,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		die(_("fsck error in pack objects"));
 
 	free(opts.anomaly);
+	free(boundary);
 	free(objects);
 	strbuf_release(&index_name_buf);
 	strbuf_release(&rev_index_name_buf);
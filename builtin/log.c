@@ -21,6 +21,7 @@
 #include "diff-merges.h"
 #include "revision.h"
 #include "log-tree.h"
+#include "log-read-ahead.h"
 #include "builtin.h"
 #include "oid-array.h"
 #include "tag.h"
@@ -42,6 +43,7 @@
 #include "repository.h"
 #include "commit-reach.h"
 #include "range-diff.h"
+#include "thread-utils.h"
 #include "tmp-objdir.h"
 #include "tree.h"
 #include "write-or-die.h"
@@ -61,6 +63,7 @@ static int default_encode_email_headers = 1;
 static int decoration_style;
 static int decoration_given;
 static int use_mailmap_config = 1;
+static int log_threads = 1;
 static unsigned int force_in_body_from;
 static int stdout_mboxrd;
 static const char *fmt_patch_subject_prefix = "PATCH";
@@ -490,6 +493,76 @@ static void finish_early_output(struct rev_info *rev)
 	show_early_header(rev, "done", n);
 }
 
+static void log_walk_show_commit(struct rev_info *rev, struct commit *commit,
+				 int *saved_nrl, int *saved_dcctc)
+{
+	if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
+		/*
+		 * We decremented max_count in get_revision,
+		 * but we didn't actually show the commit.
+		 */
+		rev->max_count++;
+	if (!rev->reflog_info) {
+		/*
+		 * We may show a given commit multiple times when
+		 * walking the reflogs.
+		 */
+		free_commit_buffer(the_repository->parsed_objects,
+				   commit);
+		free_commit_list(commit->parents);
+		commit->parents = NULL;
+	}
+	if (*saved_nrl < rev->diffopt.needed_rename_limit)
+		*saved_nrl = rev->diffopt.needed_rename_limit;
+	if (rev->diffopt.degraded_cc_to_c)
+		*saved_dcctc = 1;
+}
+
+/*
+ * Like the loop in cmd_log_walk_no_free(), but with the next commits of
+ * the walk queued for reading ahead the blobs their diffs need, while
+ * the diffs of the commits before them are shown.
+ */
+static void log_walk_read_ahead(struct rev_info *rev, int nr_threads,
+				int *saved_nrl, int *saved_dcctc)
+{
+	struct log_read_ahead *ra;
+	struct commit **queue;
+	size_t window, head = 0, tail = 0;
+	int walk_done = 0;
+
+	ra = log_read_ahead_start(rev->repo, nr_threads, &window);
+	ALLOC_ARRAY(queue, window);
+
+	for (;;) {
+		struct commit *commit;
+
+		/*
+		 * With a limited number of commits, get_revision() stops
+		 * once it has handed that many out. But it has to go on if
+		 * some of them turn out not to be shown after all.
+		 */
+		while (!walk_done && rev->max_count && tail - head < window) {
+			commit = get_revision(rev);
+			if (!commit) {
+				walk_done = 1;
+				break;
+			}
+			queue[tail++ % window] = commit;
+			log_read_ahead_add(ra, commit);
+		}
+		if (head == tail)
+			break;
+
+		commit = queue[head++ % window];
+		log_walk_show_commit(rev, commit, saved_nrl, saved_dcctc);
+		log_read_ahead_done(ra);
+	}
+
+	free(queue);
+	log_read_ahead_stop(ra);
+}
+
 static int cmd_log_walk_no_free(struct rev_info *rev)
 {
 	struct commit *commit;
@@ -517,28 +590,11 @@ static int cmd_log_walk_no_free(struct rev_info *rev)
 	 * and HAS_CHANGES being accumulated in rev->diffopt, so be careful to
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
-	while ((commit = get_revision(rev)) != NULL) {
-		if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
-			/*
-			 * We decremented max_count in get_revision,
-			 * but we didn't actually show the commit.
-			 */
-			rev->max_count++;
-		if (!rev->reflog_info) {
-			/*
-			 * We may show a given commit multiple times when
-			 * walking the reflogs.
-			 */
-			free_commit_buffer(the_repository->parsed_objects,
-					   commit);
-			free_commit_list(commit->parents);
-			commit->parents = NULL;
-		}
-		if (saved_nrl < rev->diffopt.needed_rename_limit)
-			saved_nrl = rev->diffopt.needed_rename_limit;
-		if (rev->diffopt.degraded_cc_to_c)
-			saved_dcctc = 1;
-	}
+	if (log_threads > 1 && log_read_ahead_possible(rev))
+		log_walk_read_ahead(rev, log_threads, &saved_nrl, &saved_dcctc);
+	else
+		while ((commit = get_revision(rev)) != NULL)
+			log_walk_show_commit(rev, commit, &saved_nrl, &saved_dcctc);
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
 
@@ -614,6 +670,15 @@ static int git_log_config(const char *var, const char *value,
 		default_show_signature = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "log.threads")) {
+		log_threads = git_config_int(var, value, ctx->kvi);
+		if (log_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    log_threads, var);
+		if (!log_threads)
+			log_threads = online_cpus();
+		return 0;
+	}
 
 	return git_diff_ui_config(var, value, ctx, cb);
 }
@@ -2468,6 +2533,8 @@ int cmd_cherry(int argc, const char **argv, const char *prefix)
 	struct patch_ids ids;
 	struct commit *commit;
 	struct commit_list *list = NULL;
+	struct commit **commits = NULL;
+	size_t commits_nr = 0, commits_alloc = 0;
 	struct branch *current_branch;
 	const char *upstream;
 	const char *head = "HEAD";
@@ -2528,7 +2595,11 @@ int cmd_cherry(int argc, const char **argv, const char *prefix)
 		die(_("revision walk setup failed"));
 	while ((commit = get_revision(&revs)) != NULL) {
 		commit_list_insert(commit, &list);
+		ALLOC_GROW(commits, commits_nr + 1, commits_alloc);
+		commits[commits_nr++] = commit;
 	}
+	prepare_patch_id_lookups(&ids, commits, commits_nr);
+	free(commits);
 
 	while (list) {
 		char sign = '+';
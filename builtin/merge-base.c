@@ -34,7 +34,7 @@ static int show_merge_base(struct commit **rev, int rev_nr, int show_all)
 static const char * const merge_base_usage[] = {
 	N_("git merge-base [-a | --all] <commit> <commit>..."),
 	N_("git merge-base [-a | --all] --octopus <commit>..."),
-	N_("git merge-base --is-ancestor <commit> <commit>"),
+	N_("git merge-base [--first-parent] --is-ancestor <commit> <commit>"),
 	N_("git merge-base --independent <commit>..."),
 	N_("git merge-base --fork-point <ref> [<commit>]"),
 	NULL
@@ -100,15 +100,20 @@ static int handle_octopus(int count, const char **args, int show_all)
 	return 0;
 }
 
-static int handle_is_ancestor(int argc, const char **argv)
+static int handle_is_ancestor(int argc, const char **argv, int first_parent)
 {
 	struct commit *one, *two;
+	int res;
 
 	if (argc != 2)
 		die("--is-ancestor takes exactly two commits");
 	one = get_commit_reference(argv[0]);
 	two = get_commit_reference(argv[1]);
-	if (repo_in_merge_bases(the_repository, one, two))
+	if (first_parent)
+		res = repo_in_first_parent_history(the_repository, one, two);
+	else
+		res = repo_in_merge_bases(the_repository, one, two);
+	if (res)
 		return 0;
 	else
 		return 1;
@@ -140,11 +145,14 @@ int cmd_merge_base(int argc, const char **argv, const char *prefix)
 	struct commit **rev;
 	int rev_nr = 0;
 	int show_all = 0;
+	int first_parent = 0;
 	int cmdmode = 0;
 	int ret;
 
 	struct option options[] = {
 		OPT_BOOL('a', "all", &show_all, N_("output all common ancestors")),
+		OPT_BOOL(0, "first-parent", &first_parent,
+			 N_("with --is-ancestor, follow only the first parent of merges")),
 		OPT_CMDMODE(0, "octopus", &cmdmode,
 			    N_("find ancestors for a single n-way merge"), 'o'),
 		OPT_CMDMODE(0, "independent", &cmdmode,
@@ -165,9 +173,13 @@ int cmd_merge_base(int argc, const char **argv, const char *prefix)
 		if (show_all)
 			die(_("options '%s' and '%s' cannot be used together"),
 			    "--is-ancestor", "--all");
-		return handle_is_ancestor(argc, argv);
+		return handle_is_ancestor(argc, argv, first_parent);
 	}
 
+	if (first_parent)
+		die(_("the option '%s' requires '%s'"),
+		    "--first-parent", "--is-ancestor");
+
 	if (cmdmode == 'r' && show_all)
 		die(_("options '%s' and '%s' cannot be used together"),
 		    "--independent", "--all");
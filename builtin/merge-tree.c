@@ -1,5 +1,6 @@
 #define USE_THE_INDEX_VARIABLE
 #include "builtin.h"
+#include "bulk-checkin.h"
 #include "tree-walk.h"
 #include "xdiff-interface.h"
 #include "help.h"
@@ -19,6 +20,7 @@
 #include "tree.h"
 #include "config.h"
 #include "strvec.h"
+#include "write-or-die.h"
 
 static int line_termination = '\n';
 
@@ -418,14 +420,18 @@ struct merge_tree_options {
 	struct merge_options merge_options;
 };
 
+/*
+ * "result" may hold what a previous merge left, for this one to reuse;
+ * the caller calls merge_finalize() on it once it is done merging.
+ */
 static int real_merge(struct merge_tree_options *o,
+		      struct merge_result *result,
 		      const char *merge_base,
 		      const char *branch1, const char *branch2,
 		      const char *prefix)
 {
 	struct commit *parent1, *parent2;
 	struct commit_list *merge_bases = NULL;
-	struct merge_result result = { 0 };
 	int show_messages = o->show_messages;
 	struct merge_options opt;
 
@@ -445,6 +451,11 @@ static int real_merge(struct merge_tree_options *o,
 	opt.branch1 = branch1;
 	opt.branch2 = branch2;
 
+	/*
+	 * Write the new trees and blobs of the merge to one packfile,
+	 * which is in place before we show the result.
+	 */
+	begin_odb_transaction();
 	if (merge_base) {
 		struct commit *base_commit;
 		struct tree *base_tree, *parent1_tree, *parent2_tree;
@@ -457,7 +468,7 @@ static int real_merge(struct merge_tree_options *o,
 		base_tree = repo_get_commit_tree(the_repository, base_commit);
 		parent1_tree = repo_get_commit_tree(the_repository, parent1);
 		parent2_tree = repo_get_commit_tree(the_repository, parent2);
-		merge_incore_nonrecursive(&opt, base_tree, parent1_tree, parent2_tree, &result);
+		merge_incore_nonrecursive(&opt, base_tree, parent1_tree, parent2_tree, result);
 	} else {
 		/*
 		 * Get the merge bases, in reverse order; see comment above
@@ -468,24 +479,25 @@ static int real_merge(struct merge_tree_options *o,
 		if (!merge_bases && !o->allow_unrelated_histories)
 			die(_("refusing to merge unrelated histories"));
 		merge_bases = reverse_commit_list(merge_bases);
-		merge_incore_recursive(&opt, merge_bases, parent1, parent2, &result);
+		merge_incore_recursive(&opt, merge_bases, parent1, parent2, result);
 	}
+	end_odb_transaction();
 
-	if (result.clean < 0)
+	if (result->clean < 0)
 		die(_("failure to merge"));
 
 	if (show_messages == -1)
-		show_messages = !result.clean;
+		show_messages = !result->clean;
 
 	if (o->use_stdin)
-		printf("%d%c", result.clean, line_termination);
-	printf("%s%c", oid_to_hex(&result.tree->object.oid), line_termination);
-	if (!result.clean) {
+		printf("%d%c", result->clean, line_termination);
+	printf("%s%c", oid_to_hex(&result->tree->object.oid), line_termination);
+	if (!result->clean) {
 		struct string_list conflicted_files = STRING_LIST_INIT_NODUP;
 		const char *last = NULL;
 		int i;
 
-		merge_get_conflicted_files(&result, &conflicted_files);
+		merge_get_conflicted_files(result, &conflicted_files);
 		for (i = 0; i < conflicted_files.nr; i++) {
 			const char *name = conflicted_files.items[i].string;
 			struct stage_info *c = conflicted_files.items[i].util;
@@ -503,13 +515,12 @@ static int real_merge(struct merge_tree_options *o,
 	if (show_messages) {
 		putchar(line_termination);
 		merge_display_update_messages(&opt, line_termination == '\0',
-					      &result);
+					      result);
 	}
 	if (o->use_stdin)
 		putchar(line_termination);
-	merge_finalize(&opt, &result);
 	clear_merge_options(&opt);
-	return !result.clean; /* result.clean < 0 handled above */
+	return !result->clean; /* result->clean < 0 handled above */
 }
 
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
@@ -573,6 +584,13 @@ int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 	/* Handle --stdin */
 	if (o.use_stdin) {
 		struct strbuf buf = STRBUF_INIT;
+		/*
+		 * Keep the state of each merge for the next one: besides
+		 * the allocations, a merge of the commits a previous one
+		 * merged onto its result (as when rebasing a series, one
+		 * merge per commit) then reuses the renames found by it.
+		 */
+		struct merge_result merge_result = { 0 };
 
 		if (o.mode == MODE_TRIVIAL)
 			die(_("--trivial-merge is incompatible with all other options"));
@@ -599,17 +617,21 @@ int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 			if (input_merge_base && split[2] && split[3] && !split[4]) {
 				strbuf_rtrim(split[2]);
 				strbuf_rtrim(split[3]);
-				result = real_merge(&o, input_merge_base, split[2]->buf, split[3]->buf, prefix);
+				result = real_merge(&o, &merge_result, input_merge_base,
+						    split[2]->buf, split[3]->buf, prefix);
 			} else if (!input_merge_base && !split[2]) {
-				result = real_merge(&o, NULL, split[0]->buf, split[1]->buf, prefix);
+				result = real_merge(&o, &merge_result, NULL,
+						    split[0]->buf, split[1]->buf, prefix);
 			} else {
 				die(_("malformed input line: '%s'."), buf.buf);
 			}
 
 			if (result < 0)
 				die(_("merging cannot continue; got unclean result of %d"), result);
+			maybe_flush_or_die(stdout, "merge result to stdout");
 			strbuf_list_free(split);
 		}
+		merge_finalize(&o.merge_options, &merge_result);
 		strbuf_release(&buf);
 		return 0;
 	}
@@ -649,8 +671,13 @@ int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 	git_config(git_default_config, NULL);
 
 	/* Do the relevant type of merge */
-	if (o.mode == MODE_REAL)
-		return real_merge(&o, merge_base, argv[0], argv[1], prefix);
-	else
+	if (o.mode == MODE_REAL) {
+		struct merge_result result = { 0 };
+		int ret;
+
+		ret = real_merge(&o, &result, merge_base, argv[0], argv[1], prefix);
+		merge_finalize(&o.merge_options, &result);
+		return ret;
+	} else
 		return trivial_merge(argv[0], argv[1], argv[2]);
 }
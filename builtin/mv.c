@@ -21,6 +21,7 @@
 #include "read-cache-ll.h"
 #include "repository.h"
 #include "setup.h"
+#include "sparse-index.h"
 #include "submodule.h"
 #include "entry.h"
 
@@ -116,10 +117,10 @@ static int index_range_of_same_dir(const char *src, int length,
 	int first, last, len_w_slash = length + 1;
 
 	first = index_name_pos(&the_index, src_w_slash, len_w_slash);
-	if (first >= 0)
+	if (first >= 0 && !S_ISSPARSEDIR(the_index.cache[first]->ce_mode))
 		die(_("%.*s is in index"), len_w_slash, src_w_slash);
 
-	first = -1 - first;
+	first = first >= 0 ? first : -1 - first;
 	for (last = first; last < the_index.cache_nr; last++) {
 		const char *path = the_index.cache[last]->name;
 		if (strncmp(path, src_w_slash, len_w_slash))
@@ -127,6 +128,23 @@ static int index_range_of_same_dir(const char *src, int length,
 	}
 	if (src_w_slash != src)
 		free((char *)src_w_slash);
+
+	/*
+	 * Every file in the directory is moved, so the sparse directory
+	 * entries in it have to be expanded into the files they stand for.
+	 */
+	if (the_index.sparse_index) {
+		int i;
+
+		for (i = first; i < last; i++) {
+			if (S_ISSPARSEDIR(the_index.cache[i]->ce_mode)) {
+				ensure_full_index(&the_index);
+				return index_range_of_same_dir(src, length,
+							       first_p, last_p);
+			}
+		}
+	}
+
 	*first_p = first;
 	*last_p = last;
 	return last - first;
@@ -148,7 +166,11 @@ static int empty_dir_has_sparse_contents(const char *name)
 	int pos = index_name_pos(&the_index, with_slash, length);
 	const struct cache_entry *ce;
 
-	if (pos < 0) {
+	if (pos >= 0) {
+		/* the directory is a sparse directory entry of its own */
+		if (S_ISSPARSEDIR(the_index.cache[pos]->ce_mode))
+			ret = 1;
+	} else {
 		pos = -pos - 1;
 		if (pos >= the_index.cache_nr)
 			goto free_return;
@@ -198,6 +220,8 @@ int cmd_mv(int argc, const char **argv, const char *prefix)
 	if (--argc < 1)
 		usage_with_options(builtin_mv_usage, builtin_mv_options);
 
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
 	repo_hold_locked_index(the_repository, &lock_file, LOCK_DIE_ON_ERROR);
 	if (repo_read_index(the_repository) < 0)
 		die(_("index file corrupt"));
@@ -388,7 +412,7 @@ int cmd_mv(int argc, const char **argv, const char *prefix)
 
 		if (ignore_sparse &&
 		    (dst_mode & (SKIP_WORKTREE_DIR | SPARSE)) &&
-		    index_entry_exists(&the_index, dst, strlen(dst))) {
+		    index_name_pos(&the_index, dst, strlen(dst)) >= 0) {
 			bad = _("destination exists in the index");
 			if (force) {
 				if (verbose)
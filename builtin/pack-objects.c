@@ -41,7 +41,9 @@
 #include "shallow.h"
 #include "promisor-remote.h"
 #include "pack-mtimes.h"
+#include "pack-deltas.h"
 #include "parse-options.h"
+#include "path-walk.h"
 
 /*
  * Objects we are going to pack are collected in the `to_pack` structure.
@@ -218,16 +220,25 @@ static int delta_search_threads;
 static int pack_to_stdout;
 static int sparse;
 static int thin;
+static int path_walk;
+static int name_hash_version = 1;
+static int write_delta_record;
 static int num_preferred_base;
 static struct progress *progress_state;
 
-static struct packed_git *reuse_packfile;
+static struct bitmapped_pack *reuse_packfiles;
+static size_t reuse_packfiles_nr;
 static uint32_t reuse_packfile_objects;
 static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
-static int allow_pack_reuse = 1;
+static enum {
+	NO_PACK_REUSE = 0,
+	SINGLE_PACK_REUSE,
+	MULTI_PACK_REUSE,
+} allow_pack_reuse = SINGLE_PACK_REUSE;
+static int use_sendfile = 1;
 static enum {
 	WRITE_BITMAP_FALSE = 0,
 	WRITE_BITMAP_QUIET,
@@ -239,14 +250,32 @@ static int exclude_promisor_objects;
 
 static int use_delta_islands;
 
+/*
+ * With --path-walk, the objects found at each path are added to the
+ * packing list together; each such range of the list is searched for
+ * deltas on its own first.
+ */
+struct packing_region {
+	uint32_t start;
+	uint32_t nr;
+};
+static struct packing_region *regions;
+static size_t regions_nr, regions_alloc;
+
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
 static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
+static unsigned long window_memory_total = 0;
 
 static struct string_list uri_protocols = STRING_LIST_INIT_NODUP;
 
+static inline uint32_t pack_name_hash_fn(const char *name)
+{
+	return pack_name_hash_version(name, name_hash_version);
+}
+
 enum missing_action {
 	MA_ERROR = 0,      /* fail if any missing objects are encountered */
 	MA_ALLOW_ANY,      /* silently allow ALL missing objects */
@@ -430,6 +459,62 @@ static void copy_pack_data(struct hashfile *f,
 	}
 }
 
+#ifdef HAVE_SENDFILE
+/*
+ * Like copy_pack_data(), but let the kernel copy the data from the pack
+ * file to our output with sendfile(), and only read it through the pack
+ * windows to feed the checksum. Returns the number of bytes that were
+ * not sent, which the caller has to copy itself.
+ */
+static off_t sendfile_pack_data(struct hashfile *f,
+				struct packed_git *p,
+				struct pack_window **w_curs,
+				off_t offset,
+				off_t len)
+{
+	int fd;
+
+	/*
+	 * The pack's own fd may have been closed once the pack was
+	 * mapped in full, so use one of our own.
+	 */
+	fd = git_open(p->pack_name);
+	if (fd < 0)
+		return len;
+
+	hashflush(f);
+	while (len) {
+		unsigned char *in;
+		unsigned long avail;
+		off_t pos = offset;
+		ssize_t ret;
+
+		in = use_pack(p, w_curs, offset, &avail);
+		if (avail > len)
+			avail = (unsigned long)len;
+		ret = sendfile(f->fd, fd, &pos, avail);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			/*
+			 * The output does not support sendfile() (or
+			 * something worse happened, which copying the
+			 * rest will report properly).
+			 */
+			use_sendfile = 0;
+			break;
+		}
+		if (!ret)
+			die(_("premature end of pack file '%s'"), p->pack_name);
+		hashwrite_external(f, in, ret);
+		offset += ret;
+		len -= ret;
+	}
+	close(fd);
+	return len;
+}
+#endif
+
 static inline int oe_size_greater_than(struct packing_data *pack,
 				       const struct object_entry *lhs,
 				       unsigned long rhs)
@@ -441,9 +526,51 @@ static inline int oe_size_greater_than(struct packing_data *pack,
 	return oe_get_size_slow(pack, lhs) > rhs;
 }
 
+/*
+ * When writing a single pack with several threads, the objects that
+ * cannot be copied from an existing pack are read and deflated by
+ * worker threads ahead of the writer, in write order. Each position of
+ * the write order that is at most deflate_window ahead of the writer
+ * has a slot in deflate_jobs (at the position modulo the window).
+ *
+ * Guarded by deflate_mutex, except that the "buf" and "datalen" of a
+ * job belong to the thread that set its state to DEFLATE_RUNNING until
+ * it sets DEFLATE_DONE.
+ */
+struct deflate_job {
+	struct object_entry *entry;
+	enum {
+		DEFLATE_UNUSED = 0,
+		DEFLATE_RUNNING,
+		DEFLATE_DONE
+	} state;
+	/* whether "buf" holds the delta, rather than the whole object */
+	unsigned delta:1;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	unsigned long datalen;
+};
+
+static struct deflate_job *deflate_jobs;
+static uint32_t deflate_window;
+static struct object_entry **deflate_order;
+static uint32_t deflate_nr;
+/* the position of the writer, and the next one to hand to a thread */
+static uint32_t deflate_pos, deflate_next;
+static unsigned long deflate_bytes;
+/* objects the writer wrote out of order, before any thread got to them */
+static struct oidset deflate_taken = OIDSET_INIT;
+static int deflate_stop;
+static int deflate_active;
+static pthread_t *deflate_threads;
+static pthread_mutex_t deflate_mutex;
+static pthread_cond_t deflate_cond;
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct hashfile *f, struct object_entry *entry,
-					   unsigned long limit, int usable_delta)
+					   unsigned long limit, int usable_delta,
+					   struct deflate_job *job)
 {
 	unsigned long size, datalen;
 	unsigned char header[MAX_PACK_OBJECT_HEADER],
@@ -453,9 +580,21 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	void *buf;
 	struct git_istream *st = NULL;
 	const unsigned hashsz = the_hash_algo->rawsz;
+	int deflated = 0;
+
+	if (job && job->buf && job->delta == !!usable_delta) {
+		/* read and deflated ahead of time by another thread */
+		buf = job->buf;
+		datalen = job->datalen;
+		job->buf = NULL;
+		deflated = 1;
+	}
 
 	if (!usable_delta) {
-		if (oe_type(entry) == OBJ_BLOB &&
+		if (deflated) {
+			size = job->size;
+			type = job->type;
+		} else if (oe_type(entry) == OBJ_BLOB &&
 		    oe_size_greater_than(&to_pack, entry, big_file_threshold) &&
 		    (st = open_istream(the_repository, &entry->idx.oid, &type,
 				       &size, NULL)) != NULL)
@@ -472,12 +611,17 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 		 * make sure no cached delta data remains from a
 		 * previous attempt before a pack split occurred.
 		 */
-		FREE_AND_NULL(entry->delta_data);
+		free(oe_delta_data(&to_pack, entry));
+		oe_set_delta_data(&to_pack, entry, NULL);
 		entry->z_delta_size = 0;
-	} else if (entry->delta_data) {
+	} else if (deflated) {
 		size = DELTA_SIZE(entry);
-		buf = entry->delta_data;
-		entry->delta_data = NULL;
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+			OBJ_OFS_DELTA : OBJ_REF_DELTA;
+	} else if (oe_delta_data(&to_pack, entry)) {
+		size = DELTA_SIZE(entry);
+		buf = oe_delta_data(&to_pack, entry);
+		oe_set_delta_data(&to_pack, entry, NULL);
 		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else {
@@ -487,7 +631,9 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (deflated)
+		; /* nothing */
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -590,7 +736,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	offset += entry->in_pack_header_size;
@@ -601,7 +747,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("corrupt packed object for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
@@ -640,14 +786,226 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	return hdrlen + datalen;
 }
 
+static int want_reuse_object(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!IN_PACK(entry))
+		return 0;	/* can't reuse what we don't have */
+	else if (oe_type(entry) == OBJ_REF_DELTA ||
+		 oe_type(entry) == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (oe_type(entry) != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (DELTA(entry))
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+static void deflate_ahead(struct deflate_job *job)
+{
+	struct object_entry *entry = job->entry;
+	void *buf;
+
+	/*
+	 * Without a pack size limit, write_object() uses a delta exactly
+	 * when there is one.
+	 */
+	if (entry->preferred_base || want_reuse_object(entry, !!DELTA(entry)))
+		return;
+
+	if (DELTA(entry)) {
+		if (entry->z_delta_size)
+			return; /* already deflated during the delta search */
+		if (oe_delta_data(&to_pack, entry)) {
+			buf = oe_delta_data(&to_pack, entry);
+			oe_set_delta_data(&to_pack, entry, NULL);
+		} else {
+			packing_data_lock(&to_pack);
+			buf = get_delta(entry);
+			packing_data_unlock(&to_pack);
+		}
+		job->delta = 1;
+		job->datalen = do_compress(&buf, DELTA_SIZE(entry));
+		job->buf = buf;
+		return;
+	}
+
+	if (oe_type(entry) == OBJ_BLOB &&
+	    oe_size_greater_than(&to_pack, entry, big_file_threshold))
+		return; /* streamed by write_no_reuse_object() */
+
+	packing_data_lock(&to_pack);
+	buf = repo_read_object_file(the_repository, &entry->idx.oid,
+				    &job->type, &job->size);
+	packing_data_unlock(&to_pack);
+	if (!buf)
+		die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
+	job->delta = 0;
+	job->datalen = do_compress(&buf, job->size);
+	job->buf = buf;
+}
+
+static void *threaded_deflate_ahead(void *arg UNUSED)
+{
+	pthread_mutex_lock(&deflate_mutex);
+	for (;;) {
+		struct deflate_job *job;
+
+		while (!deflate_stop && deflate_next < deflate_nr &&
+		       (deflate_next >= deflate_pos + deflate_window ||
+			(max_delta_cache_size &&
+			 deflate_bytes > max_delta_cache_size)))
+			pthread_cond_wait(&deflate_cond, &deflate_mutex);
+		if (deflate_stop || deflate_next >= deflate_nr)
+			break;
+
+		job = &deflate_jobs[deflate_next % deflate_window];
+		job->entry = deflate_order[deflate_next++];
+		if (oidset_contains(&deflate_taken, &job->entry->idx.oid)) {
+			job->state = DEFLATE_DONE;
+			continue;
+		}
+		job->state = DEFLATE_RUNNING;
+		pthread_mutex_unlock(&deflate_mutex);
+
+		deflate_ahead(job);
+
+		pthread_mutex_lock(&deflate_mutex);
+		job->state = DEFLATE_DONE;
+		deflate_bytes += job->datalen;
+		pthread_cond_broadcast(&deflate_cond);
+	}
+	pthread_mutex_unlock(&deflate_mutex);
+	return NULL;
+}
+
+static void start_deflate_threads(struct object_entry **write_order)
+{
+	int i;
+
+	if (delta_search_threads <= 1 || pack_size_limit)
+		return;
+
+	deflate_order = write_order;
+	deflate_nr = to_pack.nr_objects;
+	deflate_window = delta_search_threads * 64;
+	deflate_pos = deflate_next = 0;
+	deflate_bytes = 0;
+	deflate_stop = 0;
+	CALLOC_ARRAY(deflate_jobs, deflate_window);
+	pthread_mutex_init(&deflate_mutex, NULL);
+	pthread_cond_init(&deflate_cond, NULL);
+
+	CALLOC_ARRAY(deflate_threads, delta_search_threads);
+	for (i = 0; i < delta_search_threads; i++) {
+		int ret = pthread_create(&deflate_threads[i], NULL,
+					 threaded_deflate_ahead, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	deflate_active = 1;
+}
+
+static void stop_deflate_threads(void)
+{
+	uint32_t pos;
+	int i;
+
+	if (!deflate_active)
+		return;
+
+	pthread_mutex_lock(&deflate_mutex);
+	deflate_stop = 1;
+	pthread_cond_broadcast(&deflate_cond);
+	pthread_mutex_unlock(&deflate_mutex);
+	for (i = 0; i < delta_search_threads; i++)
+		pthread_join(deflate_threads[i], NULL);
+	deflate_active = 0;
+
+	for (pos = 0; pos < deflate_window; pos++)
+		free(deflate_jobs[pos].buf);
+	FREE_AND_NULL(deflate_jobs);
+	FREE_AND_NULL(deflate_threads);
+	oidset_clear(&deflate_taken);
+	pthread_cond_destroy(&deflate_cond);
+	pthread_mutex_destroy(&deflate_mutex);
+}
+
+/*
+ * Return the job of "entry", which the writer is about to write,
+ * waiting for a thread to finish it. If no thread picked it up yet,
+ * make sure none will.
+ */
+static struct deflate_job *wait_for_deflate_job(struct object_entry *entry)
+{
+	struct deflate_job *job = NULL;
+	uint32_t pos;
+
+	if (!deflate_active)
+		return NULL;
+
+	pthread_mutex_lock(&deflate_mutex);
+	if (deflate_pos < deflate_nr && deflate_order[deflate_pos] == entry) {
+		if (deflate_next > deflate_pos)
+			job = &deflate_jobs[deflate_pos % deflate_window];
+		else
+			deflate_next = deflate_pos + 1;
+	} else {
+		/*
+		 * A delta base that comes later in the write order; this
+		 * is rare enough that we can afford to search for it.
+		 */
+		for (pos = deflate_pos + 1; pos < deflate_next; pos++) {
+			if (deflate_jobs[pos % deflate_window].entry == entry) {
+				job = &deflate_jobs[pos % deflate_window];
+				break;
+			}
+		}
+		if (!job)
+			oidset_insert(&deflate_taken, &entry->idx.oid);
+	}
+	while (job && job->state != DEFLATE_DONE)
+		pthread_cond_wait(&deflate_cond, &deflate_mutex);
+	pthread_mutex_unlock(&deflate_mutex);
+	return job;
+}
+
+/* The writer is done with the object at its position; move on. */
+static void advance_deflate_pos(void)
+{
+	struct deflate_job *job;
+
+	if (!deflate_active)
+		return;
+
+	pthread_mutex_lock(&deflate_mutex);
+	job = &deflate_jobs[deflate_pos % deflate_window];
+	while (job->state == DEFLATE_RUNNING)
+		pthread_cond_wait(&deflate_cond, &deflate_mutex);
+	deflate_bytes -= job->datalen;
+	free(job->buf);
+	memset(job, 0, sizeof(*job));
+	deflate_pos++;
+	pthread_cond_broadcast(&deflate_cond);
+	pthread_mutex_unlock(&deflate_mutex);
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static off_t write_object(struct hashfile *f,
 			  struct object_entry *entry,
-			  off_t write_offset)
+			  off_t write_offset,
+			  struct deflate_job *job)
 {
 	unsigned long limit;
 	off_t len;
 	int usable_delta, to_reuse;
+	int locked = 0;
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
@@ -675,28 +1033,26 @@ static off_t write_object(struct hashfile *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!IN_PACK(entry))
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (oe_type(entry) == OBJ_REF_DELTA ||
-		 oe_type(entry) == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (oe_type(entry) != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (DELTA(entry))
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = want_reuse_object(entry, usable_delta);
+
+	/*
+	 * Unless a thread read the object for us already, we read from
+	 * the object store while the threads may do so, too.
+	 */
+	if (deflate_active &&
+	    (to_reuse || !job || !job->buf || job->delta != !!usable_delta) &&
+	    !(usable_delta && entry->z_delta_size)) {
+		packing_data_lock(&to_pack);
+		locked = 1;
+	}
 
 	if (!to_reuse)
-		len = write_no_reuse_object(f, entry, limit, usable_delta);
+		len = write_no_reuse_object(f, entry, limit, usable_delta, job);
 	else
 		len = write_reuse_object(f, entry, limit, usable_delta);
+
+	if (locked)
+		packing_data_unlock(&to_pack);
 	if (!len)
 		return 0;
 
@@ -721,6 +1077,7 @@ static enum write_one_status write_one(struct hashfile *f,
 {
 	off_t size;
 	int recursing;
+	struct deflate_job *job;
 
 	/*
 	 * we set offset to 1 (which is an impossible value) to mark
@@ -737,6 +1094,12 @@ static enum write_one_status write_one(struct hashfile *f,
 		return WRITE_ONE_SKIP;
 	}
 
+	/*
+	 * Wait for the threads before looking at the delta, which is
+	 * what they base their work on.
+	 */
+	job = wait_for_deflate_job(e);
+
 	/* if we are deltified, write out base object first. */
 	if (DELTA(e)) {
 		e->idx.offset = 1; /* now recurse */
@@ -754,7 +1117,7 @@ static enum write_one_status write_one(struct hashfile *f,
 	}
 
 	e->idx.offset = *offset;
-	size = write_object(f, e, *offset);
+	size = write_object(f, e, *offset, job);
 	if (!size) {
 		e->idx.offset = recursing;
 		return WRITE_ONE_BREAK;
@@ -1013,7 +1376,8 @@ static off_t find_reused_offset(off_t where)
 	return reused_chunks[lo-1].difference;
 }
 
-static void write_reused_pack_one(size_t pos, struct hashfile *out,
+static void write_reused_pack_one(struct packed_git *reuse_packfile,
+				  size_t pos, struct hashfile *out,
 				  struct pack_window **w_curs)
 {
 	off_t offset, next, cur;
@@ -1091,62 +1455,110 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 	copy_pack_data(out, reuse_packfile, w_curs, offset, next - offset);
 }
 
-static size_t write_reused_pack_verbatim(struct hashfile *out,
-					 struct pack_window **w_curs)
+/*
+ * Copy the leading objects of "pack" that are all reused in one go, if
+ * they all have their bits in pack order; return how many there were.
+ * Their deltas are all against a base within the same run, so we can
+ * write them out wherever we are in the output without any fixups.
+ */
+static uint32_t write_reused_pack_verbatim(struct bitmapped_pack *pack,
+					   struct hashfile *out,
+					   struct pack_window **w_curs)
 {
-	size_t pos = 0;
+	struct bitmap *reuse = reuse_packfile_bitmap;
+	uint32_t nr = 0;
 
-	while (pos < reuse_packfile_bitmap->word_alloc &&
-			reuse_packfile_bitmap->words[pos] == (eword_t)~0)
-		pos++;
+	if (pack->bitmap_nr != pack->p->num_objects)
+		return 0;
 
-	if (pos) {
+	while (nr < pack->bitmap_nr) {
+		size_t pos = pack->bitmap_pos + nr;
+
+		if (!(pos % BITS_IN_EWORD) &&
+		    nr + BITS_IN_EWORD <= pack->bitmap_nr &&
+		    pos / BITS_IN_EWORD < reuse->word_alloc &&
+		    reuse->words[pos / BITS_IN_EWORD] == (eword_t)~0)
+			nr += BITS_IN_EWORD;
+		else if (bitmap_get(reuse, pos))
+			nr++;
+		else
+			break;
+	}
+
+	if (nr) {
 		off_t to_write;
 
-		written = (pos * BITS_IN_EWORD);
-		to_write = pack_pos_to_offset(reuse_packfile, written)
+		to_write = pack_pos_to_offset(pack->p, nr)
 			- sizeof(struct pack_header);
 
 		/* We're recording one chunk, not one object. */
-		record_reused_object(sizeof(struct pack_header), 0);
+		record_reused_object(sizeof(struct pack_header),
+				     (off_t)sizeof(struct pack_header) -
+				     hashfile_total(out));
 		hashflush(out);
-		copy_pack_data(out, reuse_packfile, w_curs,
+#ifdef HAVE_SENDFILE
+		if (use_sendfile) {
+			off_t left = sendfile_pack_data(out, pack->p, w_curs,
+						sizeof(struct pack_header),
+						to_write);
+			copy_pack_data(out, pack->p, w_curs,
+				sizeof(struct pack_header) + to_write - left,
+				left);
+		} else
+#endif
+		copy_pack_data(out, pack->p, w_curs,
 			sizeof(struct pack_header), to_write);
 
+		written += nr;
 		display_progress(progress_state, written);
 	}
-	return pos;
+	return nr;
 }
 
-static void write_reused_pack(struct hashfile *f)
+static void write_reused_pack(struct bitmapped_pack *pack,
+			      struct hashfile *f)
 {
-	size_t i = 0;
-	uint32_t offset;
+	struct bitmap *reuse = reuse_packfile_bitmap;
+	size_t pos, end = pack->bitmap_pos + pack->bitmap_nr;
 	struct pack_window *w_curs = NULL;
 
-	if (allow_ofs_delta)
-		i = write_reused_pack_verbatim(f, &w_curs);
+	/*
+	 * The offsets of the chunks we record are those in this pack;
+	 * any delta we reuse has its base earlier in this pack.
+	 */
+	reused_chunks_nr = 0;
 
-	for (; i < reuse_packfile_bitmap->word_alloc; ++i) {
-		eword_t word = reuse_packfile_bitmap->words[i];
-		size_t pos = (i * BITS_IN_EWORD);
+	/* Reused objects are copied out in pack order. */
+	pack_set_access_pattern(pack->p, PACK_ACCESS_SEQUENTIAL);
 
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			if ((word >> offset) == 0)
-				break;
+	pos = pack->bitmap_pos;
+	if (allow_ofs_delta)
+		pos += write_reused_pack_verbatim(pack, f, &w_curs);
 
-			offset += ewah_bit_ctz64(word >> offset);
-			/*
-			 * Can use bit positions directly, even for MIDX
-			 * bitmaps. See comment in try_partial_reuse()
-			 * for why.
-			 */
-			write_reused_pack_one(pos + offset, f, &w_curs);
-			display_progress(progress_state, ++written);
+	while (pos < end) {
+		size_t word_pos = pos / BITS_IN_EWORD;
+		eword_t word;
+
+		if (word_pos >= reuse->word_alloc)
+			break;
+		word = reuse->words[word_pos] >> (pos % BITS_IN_EWORD);
+		if (!word) {
+			pos = (word_pos + 1) * BITS_IN_EWORD;
+			continue;
 		}
+		pos += ewah_bit_ctz64(word);
+		if (pos >= end)
+			break;
+
+		write_reused_pack_one(pack->p,
+				      bitmapped_pack_pos(bitmap_git, pack, pos),
+				      f, &w_curs);
+		display_progress(progress_state, ++written);
+		pos++;
 	}
 
 	unuse_pack(&w_curs);
+	pack_set_access_pattern(pack->p, PACK_ACCESS_NORMAL);
 }
 
 static void write_excluded_by_configs(void)
@@ -1168,6 +1580,36 @@ static void write_excluded_by_configs(void)
 	}
 }
 
+/*
+ * The start of a pack to stdout, which write_pack_file() continues; see
+ * start_pack_with_reused().
+ */
+static struct hashfile *started_pack;
+
+/*
+ * When sending objects verbatim from existing packs to stdout, their
+ * number is known once the objects have been enumerated, and so is the
+ * pack header, and both come first in the pack. Send them right away,
+ * instead of only after the other objects have been checked and
+ * searched for deltas, so that the other side starts receiving data
+ * (and the connection stops being idle) as early as possible. The pack
+ * is the same either way.
+ */
+static void start_pack_with_reused(void)
+{
+	uint32_t j;
+
+	if (!pack_to_stdout || !reuse_packfiles_nr)
+		return;
+
+	trace2_region_enter("pack-objects", "write-reused", the_repository);
+	started_pack = hashfd(1, "<stdout>");
+	write_pack_header(started_pack, nr_result);
+	for (j = 0; j < reuse_packfiles_nr; j++)
+		write_reused_pack(&reuse_packfiles[j], started_pack);
+	trace2_region_leave("pack-objects", "write-reused", the_repository);
+}
+
 static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
@@ -1190,26 +1632,37 @@ static void write_pack_file(void)
 		unsigned char hash[GIT_MAX_RAWSZ];
 		char *pack_tmp_name = NULL;
 
-		if (pack_to_stdout)
-			f = hashfd_throughput(1, "<stdout>", progress_state);
-		else
-			f = create_tmp_packfile(&pack_tmp_name);
-
-		offset = write_pack_header(f, nr_remaining);
-
-		if (reuse_packfile) {
-			assert(pack_to_stdout);
-			write_reused_pack(f);
+		if (started_pack) {
+			f = started_pack;
+			started_pack = NULL;
+			f->tp = progress_state;
 			offset = hashfile_total(f);
+		} else {
+			if (pack_to_stdout)
+				f = hashfd_throughput(1, "<stdout>", progress_state);
+			else
+				f = create_tmp_packfile(&pack_tmp_name);
+
+			offset = write_pack_header(f, nr_remaining);
+
+			if (reuse_packfiles_nr) {
+				assert(pack_to_stdout);
+				for (j = 0; j < reuse_packfiles_nr; j++)
+					write_reused_pack(&reuse_packfiles[j], f);
+				offset = hashfile_total(f);
+			}
 		}
 
 		nr_written = 0;
+		start_deflate_threads(write_order);
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
+			advance_deflate_pos();
 			display_progress(progress_state, written);
 		}
+		stop_deflate_threads();
 
 		if (pack_to_stdout) {
 			/*
@@ -1276,6 +1729,8 @@ static void write_pack_file(void)
 
 			if (cruft)
 				pack_idx_opts.flags |= WRITE_MTIMES;
+			if (write_delta_record)
+				pack_idx_opts.flags |= WRITE_DELTAS;
 
 			stage_tmp_packfiles(&tmpname, pack_tmp_name,
 					    written_list, nr_written,
@@ -1289,6 +1744,8 @@ static void write_pack_file(void)
 				stop_progress(&progress_state);
 
 				bitmap_writer_show_progress(progress);
+				bitmap_writer_set_name_hash_version(name_hash_version);
+				bitmap_writer_set_threads(delta_search_threads);
 				bitmap_writer_select_commits(indexed_commits, indexed_commits_nr, -1);
 				if (bitmap_writer_build(&to_pack) < 0)
 					die(_("failed to write bitmap index"));
@@ -1591,7 +2048,7 @@ static int add_object_entry(const struct object_id *oid, enum object_type type,
 		return 0;
 	}
 
-	create_object_entry(oid, type, pack_name_hash(name),
+	create_object_entry(oid, type, pack_name_hash_fn(name),
 			    exclude, name && no_try_delta(name),
 			    found_pack, found_offset);
 	return 1;
@@ -1804,7 +2261,7 @@ static void add_preferred_base_object(const char *name)
 {
 	struct pbase_tree *it;
 	size_t cmplen;
-	unsigned hash = pack_name_hash(name);
+	unsigned hash = pack_name_hash_fn(name);
 
 	if (!num_preferred_base || check_pbase_path(hash))
 		return;
@@ -1943,6 +2400,61 @@ static void prefetch_to_pack(uint32_t object_index_start) {
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * An object that is stored whole in a pack whose .deltas file says that
+ * it was searched for a delta when the pack was written is not searched
+ * again: the only new candidates are objects that are not in that pack,
+ * and those are still searched and may use it as their base.
+ */
+static void check_delta_record(struct object_entry *entry,
+			       struct packed_git *p)
+{
+	uint32_t pos;
+
+	if (!reuse_delta || entry->preferred_base || use_delta_islands)
+		return;
+	if (load_pack_deltas(p) < 0)
+		return;
+	if (!bsearch_pack(&entry->idx.oid, p, &pos))
+		return;
+	if (nth_packed_delta_settled(p, pos))
+		entry->delta_settled = 1;
+}
+
+/*
+ * Set while get_object_details() runs check_object() in several threads.
+ * The pack windows and the object store are then only accessed with the
+ * packing_data lock held; the bytes of a window we hold may be parsed
+ * without it, as a window in use is never unmapped.
+ */
+static int details_threaded;
+
+static inline void details_lock(void)
+{
+	if (details_threaded)
+		packing_data_lock(&to_pack);
+}
+
+static inline void details_unlock(void)
+{
+	if (details_threaded)
+		packing_data_unlock(&to_pack);
+}
+
+static inline void details_unuse_pack(struct pack_window **w_curs)
+{
+	details_lock();
+	unuse_pack(w_curs);
+	details_unlock();
+}
+
+/*
+ * Fill in the type and size of "entry", and decide whether we reuse its
+ * delta. The entry is not added to the list of delta children of its
+ * base yet; get_object_details() does that for all entries at once, so
+ * that the lists do not depend on the order in which the entries are
+ * checked.
+ */
 static void check_object(struct object_entry *entry, uint32_t object_index)
 {
 	unsigned long canonical_size;
@@ -1962,7 +2474,9 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 		enum object_type type;
 		unsigned long in_pack_size;
 
+		details_lock();
 		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
+		details_unlock();
 
 		/*
 		 * We want in_pack_type even if we do not reuse delta
@@ -1991,21 +2505,26 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			entry->in_pack_header_size = used;
 			if (oe_type(entry) < OBJ_COMMIT || oe_type(entry) > OBJ_BLOB)
 				goto give_up;
-			unuse_pack(&w_curs);
+			details_unuse_pack(&w_curs);
+			check_delta_record(entry, p);
 			return;
 		case OBJ_REF_DELTA:
 			if (reuse_delta && !entry->preferred_base) {
-				oidread(&base_ref,
-					use_pack(p, &w_curs,
-						 entry->in_pack_offset + used,
-						 NULL));
+				details_lock();
+				buf = use_pack(p, &w_curs,
+					       entry->in_pack_offset + used,
+					       NULL);
+				details_unlock();
+				oidread(&base_ref, buf);
 				have_base = 1;
 			}
 			entry->in_pack_header_size = used + the_hash_algo->rawsz;
 			break;
 		case OBJ_OFS_DELTA:
+			details_lock();
 			buf = use_pack(p, &w_curs,
 				       entry->in_pack_offset + used, NULL);
+			details_unlock();
 			used_0 = 0;
 			c = buf[used_0++];
 			ofs = c & 127;
@@ -2045,13 +2564,13 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 
 			if (base_entry) {
 				SET_DELTA(entry, base_entry);
-				entry->delta_sibling_idx = base_entry->delta_child_idx;
-				SET_DELTA_CHILD(base_entry, entry);
 			} else {
+				details_lock();
 				SET_DELTA_EXT(entry, &base_ref);
+				details_unlock();
 			}
 
-			unuse_pack(&w_curs);
+			details_unuse_pack(&w_curs);
 			return;
 		}
 
@@ -2064,11 +2583,13 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			 * object size from the delta header.
 			 */
 			delta_pos = entry->in_pack_offset + entry->in_pack_header_size;
+			details_lock();
 			canonical_size = get_size_from_delta(p, &w_curs, delta_pos);
+			details_unlock();
 			if (canonical_size == 0)
 				goto give_up;
 			SET_SIZE(entry, canonical_size);
-			unuse_pack(&w_curs);
+			details_unuse_pack(&w_curs);
 			return;
 		}
 
@@ -2078,11 +2599,13 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 		 * at this point...
 		 */
 		give_up:
-		unuse_pack(&w_curs);
+		details_unuse_pack(&w_curs);
 	}
 
+	details_lock();
 	if (oid_object_info_extended(the_repository, &entry->idx.oid, &oi,
 				     OBJECT_INFO_SKIP_FETCH_OBJECT | OBJECT_INFO_LOOKUP_REPLACE) < 0) {
+		/* get_object_details() does not use threads with a promisor */
 		if (repo_has_promisor_remote(the_repository)) {
 			prefetch_to_pack(object_index);
 			if (oid_object_info_extended(the_repository, &entry->idx.oid, &oi,
@@ -2092,6 +2615,7 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 			type = -1;
 		}
 	}
+	details_unlock();
 	oe_set_type(entry, type);
 	if (entry->type_valid) {
 		SET_SIZE(entry, canonical_size);
@@ -2296,6 +2820,104 @@ static void break_delta_chains(struct object_entry *entry)
 	}
 }
 
+static void check_one_object(struct object_entry *entry, uint32_t i)
+{
+	check_object(entry, i);
+	if (entry->type_valid &&
+	    oe_size_greater_than(&to_pack, entry, big_file_threshold))
+		entry->no_try_delta = 1;
+}
+
+struct details_params {
+	pthread_t thread;
+	struct object_entry **list;
+	uint32_t start, end;
+};
+
+static uint32_t details_done;
+
+static void *threaded_check_objects(void *arg)
+{
+	struct details_params *me = arg;
+	uint32_t i, batch = 0;
+
+	for (i = me->start; i < me->end; i++) {
+		check_one_object(me->list[i], i);
+		if (++batch == 1024 || i + 1 == me->end) {
+			packing_data_lock(&to_pack);
+			details_done += batch;
+			display_progress(progress_state, details_done);
+			packing_data_unlock(&to_pack);
+			batch = 0;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Load what check_object() would otherwise load on the first access to
+ * each pack, which the threads must not race on.
+ */
+static void prepare_threaded_details(struct object_entry **list, uint32_t nr)
+{
+	struct packed_git *last = NULL;
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		struct packed_git *p = IN_PACK(list[i]);
+
+		if (!p || p == last)
+			continue;
+		last = p;
+		if (reuse_delta) {
+			load_pack_revindex(the_repository, p);
+			if (!use_delta_islands)
+				load_pack_deltas(p);
+		}
+	}
+}
+
+/*
+ * Split the list, which is sorted by pack and offset, into one range for
+ * each thread, so that each thread reads its own part of the packs.
+ */
+static void ll_check_objects(struct object_entry **list, uint32_t nr)
+{
+	struct details_params *p;
+	uint32_t i, nr_threads = delta_search_threads;
+
+	/* Not worth it for small lists. */
+	if (nr_threads > nr / 1024)
+		nr_threads = nr / 1024;
+	if (nr_threads <= 1 || repo_has_promisor_remote(the_repository)) {
+		for (i = 0; i < nr; i++) {
+			check_one_object(list[i], i);
+			display_progress(progress_state, i + 1);
+		}
+		return;
+	}
+
+	prepare_threaded_details(list, nr);
+	details_threaded = 1;
+	details_done = 0;
+	CALLOC_ARRAY(p, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int ret;
+
+		p[i].list = list;
+		p[i].start = (uint64_t)nr * i / nr_threads;
+		p[i].end = (uint64_t)nr * (i + 1) / nr_threads;
+		ret = pthread_create(&p[i].thread, NULL,
+				     threaded_check_objects, &p[i]);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(p[i].thread, NULL);
+	details_threaded = 0;
+	free(p);
+}
+
 static void get_object_details(void)
 {
 	uint32_t i;
@@ -2310,15 +2932,23 @@ static void get_object_details(void)
 		sorted_by_offset[i] = to_pack.objects + i;
 	QSORT(sorted_by_offset, to_pack.nr_objects, pack_offset_sort);
 
+	ll_check_objects(sorted_by_offset, to_pack.nr_objects);
+	stop_progress(&progress_state);
+
+	/*
+	 * Link the reused deltas to their bases in pack order, whether
+	 * or not they were checked in threads.
+	 */
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = sorted_by_offset[i];
-		check_object(entry, i);
-		if (entry->type_valid &&
-		    oe_size_greater_than(&to_pack, entry, big_file_threshold))
-			entry->no_try_delta = 1;
-		display_progress(progress_state, i + 1);
+		struct object_entry *base;
+
+		if (!entry->delta_idx || entry->ext_base)
+			continue;
+		base = DELTA(entry);
+		entry->delta_sibling_idx = base->delta_child_idx;
+		SET_DELTA_CHILD(base, entry);
 	}
-	stop_progress(&progress_state);
 
 	/*
 	 * This must happen in a second pass, since we rely on the delta
@@ -2395,7 +3025,7 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-/* Protect delta_cache_size */
+/* Protect delta_cache_size and window_memory_used */
 static pthread_mutex_t cache_mutex;
 #define cache_lock()		pthread_mutex_lock(&cache_mutex)
 #define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
@@ -2605,16 +3235,17 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	 * accounting lock.  Compiler will optimize the strangeness
 	 * away when NO_PTHREADS is defined.
 	 */
-	free(trg_entry->delta_data);
+	free(oe_delta_data(&to_pack, trg_entry));
 	cache_lock();
-	if (trg_entry->delta_data) {
+	if (oe_delta_data(&to_pack, trg_entry)) {
 		delta_cache_size -= DELTA_SIZE(trg_entry);
-		trg_entry->delta_data = NULL;
+		oe_set_delta_data(&to_pack, trg_entry, NULL);
 	}
 	if (delta_cacheable(src_size, trg_size, delta_size)) {
 		delta_cache_size += delta_size;
 		cache_unlock();
-		trg_entry->delta_data = xrealloc(delta_buf, delta_size);
+		oe_set_delta_data(&to_pack, trg_entry,
+				  xrealloc(delta_buf, delta_size));
 	} else {
 		cache_unlock();
 		free(delta_buf);
@@ -2654,12 +3285,37 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
+/* The memory used by the windows of all threads together. */
+static unsigned long window_memory_used;
+
+/*
+ * Account for the current memory usage of our window in the total of
+ * all threads, of which we last told it "*published" bytes, and
+ * return whether the total is over window_memory_total.
+ */
+static int window_memory_over_total(unsigned long mem_usage,
+				    unsigned long *published)
+{
+	int over;
+
+	if (!window_memory_total)
+		return 0;
+
+	cache_lock();
+	window_memory_used -= *published;
+	window_memory_used += mem_usage;
+	*published = mem_usage;
+	over = window_memory_used > window_memory_total;
+	cache_unlock();
+	return over;
+}
+
 static void find_deltas(struct object_entry **list, unsigned *list_size,
 			int window, int depth, unsigned *processed)
 {
 	uint32_t i, idx = 0, count = 0;
 	struct unpacked *array;
-	unsigned long mem_usage = 0;
+	unsigned long mem_usage = 0, published = 0;
 
 	CALLOC_ARRAY(array, window);
 
@@ -2675,7 +3331,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 		entry = *list++;
 		(*list_size)--;
-		if (!entry->preferred_base) {
+		if (!entry->preferred_base && !entry->delta_settled) {
 			(*processed)++;
 			display_progress(progress_state, *processed);
 		}
@@ -2684,8 +3340,14 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		mem_usage -= free_unpacked(n);
 		n->entry = entry;
 
-		while (window_memory_limit &&
-		       mem_usage > window_memory_limit &&
+		/*
+		 * Each thread makes room in its own window, starting with
+		 * the object it has not used for the longest time, when
+		 * either it or all threads together use too much.
+		 */
+		while (((window_memory_limit &&
+			 mem_usage > window_memory_limit) ||
+			window_memory_over_total(mem_usage, &published)) &&
 		       count > 1) {
 			const uint32_t tail = (idx + window - count) % window;
 			mem_usage -= free_unpacked(array + tail);
@@ -2693,9 +3355,9 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 
 		/* We do not compute delta to *create* objects we are not
-		 * going to pack.
+		 * going to pack, nor for those that were searched before.
 		 */
-		if (entry->preferred_base)
+		if (entry->preferred_base || entry->delta_settled)
 			goto next;
 
 		/*
@@ -2741,10 +3403,12 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * instead, as we can afford spending more time compressing
 		 * between writes at that moment.
 		 */
-		if (entry->delta_data && !pack_to_stdout) {
+		if (oe_delta_data(&to_pack, entry) && !pack_to_stdout) {
+			void *delta_data = oe_delta_data(&to_pack, entry);
 			unsigned long size;
 
-			size = do_compress(&entry->delta_data, DELTA_SIZE(entry));
+			size = do_compress(&delta_data, DELTA_SIZE(entry));
+			oe_set_delta_data(&to_pack, entry, delta_data);
 			if (size < (1U << OE_Z_DELTA_BITS)) {
 				entry->z_delta_size = size;
 				cache_lock();
@@ -2752,7 +3416,8 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 				delta_cache_size += entry->z_delta_size;
 				cache_unlock();
 			} else {
-				FREE_AND_NULL(entry->delta_data);
+				free(delta_data);
+				oe_set_delta_data(&to_pack, entry, NULL);
 				entry->z_delta_size = 0;
 			}
 		}
@@ -2794,6 +3459,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		free(array[i].data);
 	}
 	free(array);
+	window_memory_over_total(0, &published);
 }
 
 /*
@@ -3011,6 +3677,173 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	free(p);
 }
 
+/*
+ * Whether "entry" takes part in the delta search, as a delta target or
+ * (if it is a preferred base) only as a base for the others.
+ */
+static int want_delta_search(struct object_entry *entry)
+{
+	if (DELTA(entry))
+		/* This happens if we decided to reuse existing
+		 * delta from a pack.  "reuse_delta &&" is implied.
+		 * With --path-walk, it also happens for the deltas
+		 * already found within the same path.
+		 */
+		return 0;
+
+	if (!entry->type_valid ||
+	    oe_size_less_than(&to_pack, entry, 50))
+		return 0;
+
+	if (entry->no_try_delta)
+		return 0;
+
+	if (!entry->preferred_base) {
+		if (oe_type(entry) < 0)
+			die(_("unable to get type of object %s"),
+			    oid_to_hex(&entry->idx.oid));
+	} else {
+		if (oe_type(entry) < 0) {
+			/*
+			 * This object is not found, but we
+			 * don't have to include it anyway.
+			 */
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * The delta search within the --path-walk regions: the threads take one
+ * region after the other, each of which is searched on its own.
+ */
+struct region_search {
+	struct object_entry **list;
+	/* region i spans list[offsets[i]] up to list[offsets[i + 1]] */
+	uint32_t *offsets;
+	size_t nr;
+	size_t next;
+	int window;
+	int depth;
+	unsigned *processed;
+};
+
+static void *find_deltas_in_regions(void *arg)
+{
+	struct region_search *rs = arg;
+
+	for (;;) {
+		unsigned list_size;
+		size_t i;
+
+		progress_lock();
+		i = rs->next;
+		if (i < rs->nr)
+			rs->next++;
+		progress_unlock();
+		if (i >= rs->nr)
+			break;
+
+		list_size = rs->offsets[i + 1] - rs->offsets[i];
+		find_deltas(rs->list + rs->offsets[i], &list_size,
+			    rs->window, rs->depth, rs->processed);
+	}
+	return NULL;
+}
+
+static void find_deltas_by_region(int window, int depth)
+{
+	struct region_search rs = {
+		.window = window,
+		.depth = depth,
+	};
+	uint32_t nr_deltas = 0, n = 0;
+	unsigned nr_done = 0;
+	size_t i;
+
+	if (!regions_nr)
+		return;
+
+	ALLOC_ARRAY(rs.list, to_pack.nr_objects);
+	ALLOC_ARRAY(rs.offsets, regions_nr + 1);
+	rs.processed = &nr_done;
+
+	for (i = 0; i < regions_nr; i++) {
+		uint32_t start = n, region_deltas = 0, j;
+
+		for (j = 0; j < regions[i].nr; j++) {
+			struct object_entry *entry;
+
+			entry = to_pack.objects + regions[i].start + j;
+			if (!want_delta_search(entry))
+				continue;
+			if (!entry->preferred_base && !entry->delta_settled)
+				region_deltas++;
+			rs.list[n++] = entry;
+		}
+
+		if (!region_deltas || n - start < 2) {
+			n = start;
+			continue;
+		}
+		QSORT(rs.list + start, n - start, type_size_sort);
+		rs.offsets[rs.nr++] = start;
+		nr_deltas += region_deltas;
+	}
+	rs.offsets[rs.nr] = n;
+
+	if (rs.nr) {
+		if (progress)
+			progress_state = start_progress(_("Compressing objects by path"),
+							nr_deltas);
+		init_threaded_search();
+		if (delta_search_threads <= 1 || rs.nr == 1) {
+			find_deltas_in_regions(&rs);
+		} else {
+			int nr_threads = delta_search_threads;
+			pthread_t *threads;
+			int ret;
+
+			if (nr_threads > rs.nr)
+				nr_threads = rs.nr;
+			CALLOC_ARRAY(threads, nr_threads);
+			for (i = 0; i < nr_threads; i++) {
+				ret = pthread_create(&threads[i], NULL,
+						     find_deltas_in_regions, &rs);
+				if (ret)
+					die(_("unable to create thread: %s"),
+					    strerror(ret));
+			}
+			for (i = 0; i < nr_threads; i++)
+				pthread_join(threads[i], NULL);
+			free(threads);
+		}
+		cleanup_threaded_search();
+		stop_progress(&progress_state);
+		if (nr_done != nr_deltas)
+			die(_("inconsistency with delta count"));
+	}
+
+	/*
+	 * Link up the deltas we found, so that the search across all
+	 * paths can tell how deep the delta chains below each of the
+	 * remaining objects already are.
+	 */
+	for (i = 0; i < n; i++) {
+		struct object_entry *entry = rs.list[i];
+
+		if (!DELTA(entry))
+			continue;
+		entry->delta_sibling_idx = DELTA(entry)->delta_child_idx;
+		SET_DELTA_CHILD(DELTA(entry), entry);
+	}
+
+	free(rs.list);
+	free(rs.offsets);
+}
+
 static int obj_is_packed(const struct object_id *oid)
 {
 	return packlist_find(&to_pack, oid) ||
@@ -3064,7 +3897,8 @@ static void prepare_pack(int window, int depth)
 	unsigned n;
 
 	if (use_delta_islands)
-		resolve_tree_islands(the_repository, progress, &to_pack);
+		resolve_tree_islands(the_repository, progress,
+				     delta_search_threads, &to_pack);
 
 	get_object_details();
 
@@ -3081,39 +3915,22 @@ static void prepare_pack(int window, int depth)
 	if (!to_pack.nr_objects || !window || !depth)
 		return;
 
+	/* The delta search may run in threads; see oe_set_delta_data(). */
+	oe_prepare_delta_data(&to_pack);
+
+	find_deltas_by_region(window + 1, depth);
+
 	ALLOC_ARRAY(delta_list, to_pack.nr_objects);
 	nr_deltas = n = 0;
 
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = to_pack.objects + i;
 
-		if (DELTA(entry))
-			/* This happens if we decided to reuse existing
-			 * delta from a pack.  "reuse_delta &&" is implied.
-			 */
+		if (!want_delta_search(entry))
 			continue;
 
-		if (!entry->type_valid ||
-		    oe_size_less_than(&to_pack, entry, 50))
-			continue;
-
-		if (entry->no_try_delta)
-			continue;
-
-		if (!entry->preferred_base) {
+		if (!entry->preferred_base && !entry->delta_settled)
 			nr_deltas++;
-			if (oe_type(entry) < 0)
-				die(_("unable to get type of object %s"),
-				    oid_to_hex(&entry->idx.oid));
-		} else {
-			if (oe_type(entry) < 0) {
-				/*
-				 * This object is not found, but we
-				 * don't have to include it anyway.
-				 */
-				continue;
-			}
-		}
 
 		delta_list[n++] = entry;
 	}
@@ -3130,6 +3947,14 @@ static void prepare_pack(int window, int depth)
 		if (nr_done != nr_deltas)
 			die(_("inconsistency with delta count"));
 	}
+
+	/*
+	 * Whatever did not find a delta now is recorded in the .deltas
+	 * file as not worth searching again.
+	 */
+	for (i = 0; i < n; i++)
+		if (!delta_list[i]->preferred_base)
+			delta_list[i]->delta_settled = 1;
 	free(delta_list);
 }
 
@@ -3144,6 +3969,10 @@ static int git_pack_config(const char *k, const char *v,
 		window_memory_limit = git_config_ulong(k, v, ctx->kvi);
 		return 0;
 	}
+	if (!strcmp(k, "pack.windowmemorytotal")) {
+		window_memory_total = git_config_ulong(k, v, ctx->kvi);
+		return 0;
+	}
 	if (!strcmp(k, "pack.depth")) {
 		depth = git_config_int(k, v, ctx->kvi);
 		return 0;
@@ -3170,12 +3999,32 @@ static int git_pack_config(const char *k, const char *v,
 			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
 	}
 
+	if (!strcmp(k, "pack.writedeltarecord")) {
+		write_delta_record = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
 	}
 	if (!strcmp(k, "pack.allowpackreuse")) {
-		allow_pack_reuse = git_config_bool(k, v);
+		int res = git_parse_maybe_bool_text(v);
+		if (res < 0) {
+			if (!strcasecmp(v, "single"))
+				allow_pack_reuse = SINGLE_PACK_REUSE;
+			else if (!strcasecmp(v, "multi"))
+				allow_pack_reuse = MULTI_PACK_REUSE;
+			else
+				die(_("invalid pack.allowPackReuse value: '%s'"), v);
+		} else if (res) {
+			allow_pack_reuse = SINGLE_PACK_REUSE;
+		} else {
+			allow_pack_reuse = NO_PACK_REUSE;
+		}
+		return 0;
+	}
+	if (!strcmp(k, "pack.usesendfile")) {
+		use_sendfile = git_config_bool(k, v);
 		return 0;
 	}
 	if (!strcmp(k, "pack.threads")) {
@@ -3296,7 +4145,7 @@ static void show_object_pack_hint(struct object *object, const char *name,
 	 * here using a now in order to perhaps improve the delta selection
 	 * process.
 	 */
-	oe->hash = pack_name_hash(name);
+	oe->hash = pack_name_hash_fn(name);
 	oe->no_try_delta = name && no_try_delta(name);
 
 	stdin_packs_hints_nr++;
@@ -3446,7 +4295,7 @@ static void add_cruft_object_entry(const struct object_id *oid, enum object_type
 	entry = packlist_find(&to_pack, oid);
 	if (entry) {
 		if (name) {
-			entry->hash = pack_name_hash(name);
+			entry->hash = pack_name_hash_fn(name);
 			entry->no_try_delta = no_try_delta(name);
 		}
 	} else {
@@ -3469,7 +4318,7 @@ static void add_cruft_object_entry(const struct object_id *oid, enum object_type
 			return;
 		}
 
-		entry = create_object_entry(oid, type, pack_name_hash(name),
+		entry = create_object_entry(oid, type, pack_name_hash_fn(name),
 					    0, name && no_try_delta(name),
 					    pack, offset);
 	}
@@ -3710,6 +4559,68 @@ static void show_object(struct object *obj, const char *name,
 	}
 }
 
+static int add_objects_by_path(const char *path,
+			       struct oid_array *oids,
+			       enum object_type type,
+			       void *data UNUSED)
+{
+	struct strbuf name = STRBUF_INIT;
+	uint32_t start = to_pack.nr_objects;
+	size_t i;
+
+	if (type == OBJ_COMMIT) {
+		for (i = 0; i < oids->nr; i++)
+			show_commit(lookup_commit(the_repository,
+						  &oids->oid[i]), NULL);
+		return 0;
+	}
+
+	/* tree paths end with a slash, which the name hash does not expect */
+	strbuf_addstr(&name, path);
+	if (type == OBJ_TREE)
+		strbuf_strip_suffix(&name, "/");
+
+	for (i = 0; i < oids->nr; i++) {
+		struct object *o = lookup_object(the_repository, &oids->oid[i]);
+
+		/*
+		 * The other side has what is UNINTERESTING; it is only
+		 * of use as a base for a thin pack.
+		 */
+		if (o->flags & UNINTERESTING) {
+			if (thin)
+				add_object_entry(&o->oid, type, name.buf, 1);
+			continue;
+		}
+		add_object_entry(&o->oid, type, name.buf, 0);
+	}
+
+	if ((type == OBJ_TREE || type == OBJ_BLOB) &&
+	    to_pack.nr_objects - start > 1) {
+		ALLOC_GROW(regions, regions_nr + 1, regions_alloc);
+		regions[regions_nr].start = start;
+		regions[regions_nr].nr = to_pack.nr_objects - start;
+		regions_nr++;
+	}
+
+	strbuf_release(&name);
+	return 0;
+}
+
+static void get_object_list_path_walk(struct rev_info *revs)
+{
+	struct path_walk_info info = PATH_WALK_INFO_INIT;
+
+	info.revs = revs;
+	info.path_fn = add_objects_by_path;
+	info.prune_all_uninteresting = sparse;
+
+	trace2_region_enter("pack-objects", "path-walk", the_repository);
+	if (walk_objects_by_path(&info))
+		die(_("failed to pack objects via path-walk"));
+	trace2_region_leave("pack-objects", "path-walk", the_repository);
+}
+
 static void show_object__ma_allow_any(struct object *obj, const char *name, void *data)
 {
 	assert(arg_missing_action == MA_ALLOW_ANY);
@@ -3946,9 +4857,11 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	if (pack_options_allow_reuse() &&
 	    !reuse_partial_packfile_from_bitmap(
 			bitmap_git,
-			&reuse_packfile,
+			&reuse_packfiles,
+			&reuse_packfiles_nr,
 			&reuse_packfile_objects,
-			&reuse_packfile_bitmap)) {
+			&reuse_packfile_bitmap,
+			allow_pack_reuse == MULTI_PACK_REUSE)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		nr_seen += reuse_packfile_objects;
@@ -4059,15 +4972,19 @@ static void get_object_list(struct rev_info *revs, int ac, const char **av)
 	if (write_bitmap_index)
 		mark_bitmap_preferred_tips();
 
-	if (prepare_revision_walk(revs))
-		die(_("revision walk setup failed"));
-	mark_edges_uninteresting(revs, show_edge, sparse);
+	if (path_walk) {
+		get_object_list_path_walk(revs);
+	} else {
+		if (prepare_revision_walk(revs))
+			die(_("revision walk setup failed"));
+		mark_edges_uninteresting(revs, show_edge, sparse);
 
-	if (!fn_show_object)
-		fn_show_object = show_object;
-	traverse_commit_list(revs,
-			     show_commit, fn_show_object,
-			     NULL);
+		if (!fn_show_object)
+			fn_show_object = show_object;
+		traverse_commit_list(revs,
+				     show_commit, fn_show_object,
+				     NULL);
+	}
 
 	if (unpack_unreachable_expiration) {
 		revs->ignore_missing_links = 1;
@@ -4215,6 +5132,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			    N_("limit pack window by objects")),
 		OPT_MAGNITUDE(0, "window-memory", &window_memory_limit,
 			      N_("limit pack window by memory in addition to object limit")),
+		OPT_MAGNITUDE(0, "window-memory-total", &window_memory_total,
+			      N_("limit the pack windows of all threads together by memory")),
 		OPT_INTEGER(0, "depth", &depth,
 			    N_("maximum length of delta chain allowed in the resulting pack")),
 		OPT_BOOL(0, "reuse-delta", &reuse_delta,
@@ -4260,6 +5179,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		  PARSE_OPT_OPTARG, option_parse_cruft_expiration),
 		OPT_BOOL(0, "sparse", &sparse,
 			 N_("use the sparse reachability algorithm")),
+		OPT_BOOL(0, "path-walk", &path_walk,
+			 N_("group objects by path for delta compression")),
+		OPT_INTEGER(0, "name-hash-version", &name_hash_version,
+			    N_("use the given version of the path name hash")),
 		OPT_BOOL(0, "thin", &thin,
 			 N_("create thin packs")),
 		OPT_BOOL(0, "shallow", &shallow,
@@ -4339,6 +5262,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (window < 0)
 		window = 0;
 
+	if (name_hash_version < 1 || name_hash_version > 2)
+		die(_("invalid --name-hash-version option: %d"),
+		    name_hash_version);
+
 	strvec_push(&rp, "pack-objects");
 	if (thin) {
 		use_internal_rev_list = 1;
@@ -4415,6 +5342,23 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			die(_("cannot use --stdin-packs with --cruft"));
 	}
 
+	if (path_walk) {
+		const char *option = NULL;
+
+		if (filter_options.choice)
+			option = "--filter";
+		else if (use_delta_islands)
+			option = "--delta-islands";
+		else if (arg_missing_action != MA_ERROR)
+			option = "--missing";
+		else if (exclude_promisor_objects)
+			option = "--exclude-promisor-objects";
+		if (option) {
+			warning(_("cannot use %s with %s"), option, "--path-walk");
+			path_walk = 0;
+		}
+	}
+
 	/*
 	 * "soft" reasons not to use bitmaps - for on-disk repack by default we want
 	 *
@@ -4434,6 +5378,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!use_internal_rev_list || (!pack_to_stdout && write_bitmap_index) || is_repository_shallow(the_repository))
 		use_bitmap_index = 0;
 
+	/* the bitmaps would give us the objects without their paths */
+	if (path_walk)
+		use_bitmap_index = 0;
+
 	if (pack_to_stdout || !rev_list_all)
 		write_bitmap_index = 0;
 
@@ -4500,6 +5448,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (non_empty && !nr_result)
 		goto cleanup;
+
+	/* This must come before any pack data. */
+	write_excluded_by_configs();
+	start_pack_with_reused();
+
 	if (nr_result) {
 		trace2_region_enter("pack-objects", "prepare-pack",
 				    the_repository);
@@ -4509,7 +5462,6 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	}
 
 	trace2_region_enter("pack-objects", "write-pack-file", the_repository);
-	write_excluded_by_configs();
 	write_pack_file();
 	trace2_region_leave("pack-objects", "write-pack-file", the_repository);
 
@@ -40,6 +40,7 @@
 #include "worktree.h"
 #include "shallow.h"
 #include "parse-options.h"
+#include "thread-utils.h"
 
 static const char * const receive_pack_usage[] = {
 	N_("git receive-pack <git-dir>"),
@@ -108,6 +109,7 @@ static enum {
 	KEEPALIVE_ALWAYS
 } use_keepalive;
 static int keepalive_in_sec = 5;
+static int update_hook_jobs = 1;
 
 static struct tmp_objdir *tmp_objdir;
 
@@ -245,6 +247,15 @@ static int receive_pack_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (strcmp(var, "receive.updatehookjobs") == 0) {
+		update_hook_jobs = git_config_int(var, value, ctx->kvi);
+		if (update_hook_jobs < 0)
+			die(_("negative receive.updateHookJobs is not allowed"));
+		if (!update_hook_jobs)
+			update_hook_jobs = online_cpus();
+		return 0;
+	}
+
 	if (strcmp(var, "receive.keepalive") == 0) {
 		keepalive_in_sec = git_config_int(var, value, ctx->kvi);
 		return 0;
@@ -360,6 +371,7 @@ struct command {
 	struct ref_push_report *report;
 	unsigned int skip_update:1,
 		     did_not_exist:1,
+		     update_worktree:1,
 		     run_proc_receive:2;
 	int index;
 	struct object_id old_oid;
@@ -1458,15 +1470,22 @@ static const char *update_worktree(unsigned char *sha1, const struct worktree *w
 	return retval;
 }
 
-static const char *update(struct command *cmd, struct shallow_info *si)
+static int should_process_cmd(struct command *cmd)
+{
+	return !cmd->error_string && !cmd->skip_update;
+}
+
+/*
+ * The checks that an update has to pass before the update hook gets to
+ * see it.
+ */
+static const char *check_update(struct command *cmd)
 {
 	const char *name = cmd->ref_name;
-	struct strbuf namespaced_name_buf = STRBUF_INIT;
-	static char *namespaced_name;
-	const char *ret;
+	struct strbuf namespaced_name = STRBUF_INIT;
+	const char *ret = NULL;
 	struct object_id *old_oid = &cmd->old_oid;
 	struct object_id *new_oid = &cmd->new_oid;
-	int do_update_worktree = 0;
 	struct worktree **worktrees = get_worktrees();
 	const struct worktree *worktree =
 		find_shared_symref(worktrees, "HEAD", name);
@@ -1480,9 +1499,7 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 		goto out;
 	}
 
-	strbuf_addf(&namespaced_name_buf, "%s%s", get_git_namespace(), name);
-	free(namespaced_name);
-	namespaced_name = strbuf_detach(&namespaced_name_buf, NULL);
+	strbuf_addf(&namespaced_name, "%s%s", get_git_namespace(), name);
 
 	if (worktree && !worktree->is_bare) {
 		switch (deny_current_branch) {
@@ -1500,7 +1517,7 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 			goto out;
 		case DENY_UPDATE_INSTEAD:
 			/* pass -- let other checks intervene first */
-			do_update_worktree = 1;
+			cmd->update_worktree = 1;
 			break;
 		}
 	}
@@ -1519,7 +1536,8 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 			goto out;
 		}
 
-		if (worktree || (head_name && !strcmp(namespaced_name, head_name))) {
+		if (worktree ||
+		    (head_name && !strcmp(namespaced_name.buf, head_name))) {
 			switch (deny_delete_current) {
 			case DENY_IGNORE:
 				break;
@@ -1566,14 +1584,32 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 			goto out;
 		}
 	}
-	if (run_update_hook(cmd)) {
-		rp_error("hook declined to update %s", name);
-		ret = "hook declined";
-		goto out;
-	}
 
-	if (do_update_worktree) {
-		ret = update_worktree(new_oid->hash, worktree);
+out:
+	strbuf_release(&namespaced_name);
+	free_worktrees(worktrees);
+	return ret;
+}
+
+/* Queue an update that passed its checks and hook in the transaction. */
+static const char *apply_update(struct command *cmd, struct shallow_info *si)
+{
+	const char *name = cmd->ref_name;
+	struct strbuf namespaced_name_buf = STRBUF_INIT;
+	static char *namespaced_name;
+	const char *ret;
+	struct object_id *old_oid = &cmd->old_oid;
+	struct object_id *new_oid = &cmd->new_oid;
+	struct worktree **worktrees = get_worktrees();
+
+	strbuf_addf(&namespaced_name_buf, "%s%s", get_git_namespace(), name);
+	free(namespaced_name);
+	namespaced_name = strbuf_detach(&namespaced_name_buf, NULL);
+
+	if (cmd->update_worktree) {
+		ret = update_worktree(new_oid->hash,
+				      find_shared_symref(worktrees, "HEAD",
+							 name));
 		if (ret)
 			goto out;
 	}
@@ -1626,6 +1662,125 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 	return ret;
 }
 
+static const char *update(struct command *cmd, struct shallow_info *si)
+{
+	const char *ret = check_update(cmd);
+
+	if (ret)
+		return ret;
+	if (run_update_hook(cmd)) {
+		rp_error("hook declined to update %s", cmd->ref_name);
+		return "hook declined";
+	}
+	return apply_update(cmd, si);
+}
+
+struct update_hooks_cb {
+	const char *hook_path;
+	struct command *next;
+	int err_fd;
+};
+
+static int update_hook_next_task(struct child_process *cp,
+				 struct strbuf *out UNUSED,
+				 void *pp_cb, void **pp_task_cb)
+{
+	struct update_hooks_cb *cb = pp_cb;
+	struct command *cmd = cb->next;
+
+	while (cmd && (!should_process_cmd(cmd) || cmd->run_proc_receive))
+		cmd = cmd->next;
+	if (!cmd)
+		return 0;
+	cb->next = cmd->next;
+
+	strvec_push(&cp->args, cb->hook_path);
+	strvec_push(&cp->args, cmd->ref_name);
+	strvec_push(&cp->args, oid_to_hex(&cmd->old_oid));
+	strvec_push(&cp->args, oid_to_hex(&cmd->new_oid));
+	cp->no_stdin = 1;
+	cp->stdout_to_stderr = 1;
+	cp->err = cb->err_fd ? dup(cb->err_fd) : 0;
+	cp->trace2_hook_name = "update";
+
+	*pp_task_cb = cmd;
+	return 1;
+}
+
+static int update_hook_finished(int result, struct strbuf *out UNUSED,
+				void *pp_cb UNUSED, void *pp_task_cb)
+{
+	struct command *cmd = pp_task_cb;
+
+	if (result)
+		cmd->error_string = "hook declined";
+	return 0;
+}
+
+/*
+ * With receive.updateHookJobs, check all updates up front and then run
+ * their update hooks in parallel, instead of running each hook right
+ * before its ref is updated. Return 1 if this was done, so that the
+ * updates only need apply_update(), and set "failed" if any of them was
+ * refused. For an atomic push, the hooks do not run once a check failed.
+ */
+static int check_updates_and_run_hooks(struct command *commands, int atomic,
+				       int *failed)
+{
+	struct update_hooks_cb cb = { .next = commands };
+	struct run_process_parallel_opts opts = {
+		.tr2_category = "receive-pack",
+		.tr2_label = "update-hooks",
+		.processes = update_hook_jobs,
+		.ungroup = 1,
+		.get_next_task = update_hook_next_task,
+		.task_finished = update_hook_finished,
+		.data = &cb,
+	};
+	struct async muxer;
+	struct command *cmd;
+
+	*failed = 0;
+	if (update_hook_jobs == 1)
+		return 0;
+	cb.hook_path = find_hook("update");
+	if (!cb.hook_path)
+		return 0;
+
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (!should_process_cmd(cmd) || cmd->run_proc_receive)
+			continue;
+		cmd->error_string = check_update(cmd);
+		if (cmd->error_string)
+			*failed = 1;
+	}
+	if (*failed && atomic)
+		return 1;
+
+	if (use_sideband) {
+		memset(&muxer, 0, sizeof(muxer));
+		muxer.proc = copy_to_sideband;
+		muxer.in = -1;
+		if (!start_async(&muxer))
+			cb.err_fd = muxer.in;
+	}
+	run_processes_parallel(&opts);
+	if (cb.err_fd) {
+		close(cb.err_fd);
+		finish_async(&muxer);
+	}
+
+	/* Only report now, so that this does not race with the muxer. */
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (cmd->error_string &&
+		    !strcmp(cmd->error_string, "hook declined")) {
+			rp_error("hook declined to update %s", cmd->ref_name);
+			*failed = 1;
+		}
+	}
+	return 1;
+}
+
 static void run_update_post_hook(struct command *commands)
 {
 	struct command *cmd;
@@ -1817,11 +1972,6 @@ static void reject_updates_to_hidden(struct command *commands)
 	strbuf_release(&refname_full);
 }
 
-static int should_process_cmd(struct command *cmd)
-{
-	return !cmd->error_string && !cmd->skip_update;
-}
-
 static void BUG_if_skipped_connectivity_check(struct command *commands,
 					       struct shallow_info *si)
 {
@@ -1840,6 +1990,8 @@ static void execute_commands_non_atomic(struct command *commands,
 {
 	struct command *cmd;
 	struct strbuf err = STRBUF_INIT;
+	int failed;
+	int checked = check_updates_and_run_hooks(commands, 0, &failed);
 
 	for (cmd = commands; cmd; cmd = cmd->next) {
 		if (!should_process_cmd(cmd) || cmd->run_proc_receive)
@@ -1853,7 +2005,8 @@ static void execute_commands_non_atomic(struct command *commands,
 			continue;
 		}
 
-		cmd->error_string = update(cmd, si);
+		cmd->error_string = checked ? apply_update(cmd, si) :
+					      update(cmd, si);
 
 		if (!cmd->error_string
 		    && ref_transaction_commit(transaction, &err)) {
@@ -1872,6 +2025,11 @@ static void execute_commands_atomic(struct command *commands,
 	struct command *cmd;
 	struct strbuf err = STRBUF_INIT;
 	const char *reported_error = "atomic push failure";
+	int failed;
+	int checked = check_updates_and_run_hooks(commands, 1, &failed);
+
+	if (failed)
+		goto failure;
 
 	transaction = ref_transaction_begin(&err);
 	if (!transaction) {
@@ -1885,7 +2043,8 @@ static void execute_commands_atomic(struct command *commands,
 		if (!should_process_cmd(cmd) || cmd->run_proc_receive)
 			continue;
 
-		cmd->error_string = update(cmd, si);
+		cmd->error_string = checked ? apply_update(cmd, si) :
+					      update(cmd, si);
 
 		if (cmd->error_string)
 			goto failure;
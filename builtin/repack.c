@@ -35,6 +35,8 @@ static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps = -1;
 static int use_delta_islands;
+static int path_walk;
+static int geometric_jobs = 1;
 static int run_update_server_info = 1;
 static char *packdir, *packtmp_name, *packtmp;
 
@@ -58,6 +60,7 @@ struct pack_objects_args {
 	int no_reuse_object;
 	int quiet;
 	int local;
+	int name_hash_version;
 	struct list_objects_filter_options filter_options;
 };
 
@@ -82,6 +85,10 @@ static int repack_config(const char *var, const char *value,
 		use_delta_islands = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "repack.jobs")) {
+		geometric_jobs = git_config_int(var, value, ctx->kvi);
+		return 0;
+	}
 	if (strcmp(var, "repack.updateserverinfo") == 0) {
 		run_update_server_info = git_config_bool(var, value);
 		return 0;
@@ -291,6 +298,9 @@ static void prepare_pack_objects(struct child_process *cmd,
 		strvec_pushf(&cmd->args, "--no-reuse-object");
 	if (args->local)
 		strvec_push(&cmd->args,  "--local");
+	if (args->name_hash_version)
+		strvec_pushf(&cmd->args, "--name-hash-version=%d",
+			     args->name_hash_version);
 	if (args->quiet)
 		strvec_push(&cmd->args,  "--quiet");
 	if (delta_base_offset)
@@ -327,6 +337,7 @@ static struct {
 	{".pack"},
 	{".rev", 1},
 	{".mtimes", 1},
+	{".deltas", 1},
 	{".bitmap", 1},
 	{".promisor", 1},
 	{".idx"},
@@ -435,6 +446,14 @@ struct pack_geometry {
 	uint32_t pack_nr, pack_alloc;
 	uint32_t split;
 
+	/*
+	 * The packs below "split" are rolled up into "tier_nr" new packs,
+	 * the ith of which gets the packs from tier[i] up to tier[i + 1]
+	 * (or "split", for the last one).
+	 */
+	uint32_t *tier;
+	uint32_t tier_nr;
+
 	int split_factor;
 };
 
@@ -591,6 +610,90 @@ static void split_pack_geometry(struct pack_geometry *geometry)
 	geometry->split = split;
 }
 
+/*
+ * Divide the packs that are to be rolled up into at most "jobs" tiers,
+ * each of which is written by its own pack-objects, so that they can
+ * run in parallel. Going from the heaviest pack down, a tier is closed
+ * as soon as it weighs at least "split_factor" times as much as all of
+ * the packs below it, so that the new packs form a geometric
+ * progression of their own (and with the packs above "split", which
+ * weigh at least that much more than all of the rolled-up packs).
+ */
+static void split_geometry_tiers(struct pack_geometry *geometry, int jobs)
+{
+	uint64_t below = 0;
+	uint32_t i, end = geometry->split;
+
+	if (jobs > geometry->split)
+		jobs = geometry->split;
+	if (jobs < 1)
+		jobs = 1;
+	ALLOC_ARRAY(geometry->tier, jobs);
+	geometry->tier_nr = 0;
+
+	for (i = 0; i < geometry->split; i++)
+		below += geometry_pack_weight(geometry->pack[i]);
+
+	while (end && geometry->tier_nr < jobs - 1) {
+		uint64_t weight = 0;
+		uint32_t start = end;
+
+		while (start) {
+			uint32_t w = geometry_pack_weight(geometry->pack[--start]);
+			weight += w;
+			below -= w;
+			if (!unsigned_mult_overflows(geometry->split_factor, below) &&
+			    weight >= geometry->split_factor * below)
+				break;
+		}
+
+		geometry->tier[geometry->tier_nr++] = start;
+		end = start;
+	}
+	if (end || !geometry->tier_nr)
+		geometry->tier[geometry->tier_nr++] = 0;
+
+	/* We found the tiers from the heaviest one down. */
+	for (i = 0; i < geometry->tier_nr / 2; i++)
+		SWAP(geometry->tier[i],
+		     geometry->tier[geometry->tier_nr - i - 1]);
+}
+
+static int start_geometry_tier(struct child_process *cmd,
+			       struct pack_geometry *geometry,
+			       uint32_t tier)
+{
+	uint32_t i, start, end;
+	FILE *in;
+
+	start = geometry->tier[tier];
+	if (tier + 1 < geometry->tier_nr)
+		end = geometry->tier[tier + 1];
+	else
+		end = geometry->split;
+
+	cmd->in = -1;
+	if (start_command(cmd))
+		return -1;
+
+	in = xfdopen(cmd->in, "w");
+	/*
+	 * The resulting pack should contain all objects in packs that
+	 * are going to be rolled up into this tier, but exclude objects
+	 * in packs which are being left alone.
+	 *
+	 * Note that objects in packs of other tiers are not excluded;
+	 * they may end up in more than one of the new packs.
+	 */
+	for (i = start; i < end; i++)
+		fprintf(in, "%s\n", pack_basename(geometry->pack[i]));
+	for (i = geometry->split; i < geometry->pack_nr; i++)
+		fprintf(in, "^%s\n", pack_basename(geometry->pack[i]));
+	fclose(in);
+
+	return 0;
+}
+
 static struct packed_git *get_preferred_pack(struct pack_geometry *geometry)
 {
 	uint32_t i;
@@ -658,6 +761,7 @@ static void free_pack_geometry(struct pack_geometry *geometry)
 		return;
 
 	free(geometry->pack);
+	free(geometry->tier);
 }
 
 struct midx_snapshot_ref_data {
@@ -1119,6 +1223,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	struct string_list names = STRING_LIST_INIT_DUP;
 	struct existing_packs existing = EXISTING_PACKS_INIT;
 	struct pack_geometry geometry = { 0 };
+	struct child_process *tier_cmds = NULL;
 	struct tempfile *refs_snapshot = NULL;
 	int i, ext, ret;
 	int show_progress;
@@ -1163,6 +1268,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("write bitmap index")),
 		OPT_BOOL('i', "delta-islands", &use_delta_islands,
 				N_("pass --delta-islands to git-pack-objects")),
+		OPT_BOOL(0, "path-walk", &path_walk,
+				N_("pass --path-walk to git-pack-objects")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
@@ -1177,6 +1284,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("limits the maximum number of threads")),
 		OPT_MAGNITUDE(0, "max-pack-size", &po_args.max_pack_size,
 				N_("maximum size of each packfile")),
+		OPT_INTEGER(0, "name-hash-version", &po_args.name_hash_version,
+				N_("specify the name hash version to use for grouping similar objects by path")),
 		OPT_PARSE_LIST_OBJECTS_FILTER(&po_args.filter_options),
 		OPT_BOOL(0, "pack-kept-objects", &pack_kept_objects,
 				N_("repack objects in packs marked with .keep")),
@@ -1184,6 +1293,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("do not repack this pack")),
 		OPT_INTEGER('g', "geometric", &geometry.split_factor,
 			    N_("find a geometric progression with factor <N>")),
+		OPT_INTEGER(0, "jobs", &geometric_jobs,
+			    N_("with --geometric, write up to <n> packs in parallel")),
 		OPT_BOOL('m', "write-midx", &write_midx,
 			   N_("write a multi-pack index of the resulting packs")),
 		OPT_STRING(0, "expire-to", &expire_to, N_("dir"),
@@ -1264,8 +1375,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (geometry.split_factor) {
 		if (pack_everything)
 			die(_("options '%s' and '%s' cannot be used together"), "--geometric", "-A/-a");
+		if (geometric_jobs < 0)
+			die(_("invalid number of jobs: %d"), geometric_jobs);
+		if (!geometric_jobs)
+			geometric_jobs = online_cpus();
 		init_pack_geometry(&geometry, &existing, &po_args);
 		split_pack_geometry(&geometry);
+		split_geometry_tiers(&geometry, geometric_jobs);
 	}
 
 	prepare_pack_objects(&cmd, &po_args, packtmp);
@@ -1304,6 +1420,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	}
 	if (use_delta_islands)
 		strvec_push(&cmd.args, "--delta-islands");
+	if (path_walk)
+		strvec_push(&cmd.args, "--path-walk");
 
 	if (pack_everything & ALL_INTO_ONE) {
 		repack_promisor_objects(&po_args, &names);
@@ -1329,7 +1447,6 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		}
 	} else if (geometry.split_factor) {
 		strvec_push(&cmd.args, "--stdin-packs");
-		strvec_push(&cmd.args, "--unpacked");
 	} else {
 		strvec_push(&cmd.args, "--unpacked");
 		strvec_push(&cmd.args, "--incremental");
@@ -1341,30 +1458,43 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	else if (filter_to)
 		die(_("option '%s' can only be used along with '%s'"), "--filter-to", "--filter");
 
-	if (geometry.split_factor)
-		cmd.in = -1;
-	else
-		cmd.no_stdin = 1;
-
-	ret = start_command(&cmd);
-	if (ret)
-		goto cleanup;
-
 	if (geometry.split_factor) {
-		FILE *in = xfdopen(cmd.in, "w");
+		uint32_t t;
+
 		/*
-		 * The resulting pack should contain all objects in packs that
-		 * are going to be rolled up, but exclude objects in packs which
-		 * are being left alone.
+		 * All but the lightest tier are written by copies of "cmd",
+		 * which run while we wait for the lightest one, which also
+		 * picks up the loose objects.
 		 */
-		for (i = 0; i < geometry.split; i++)
-			fprintf(in, "%s\n", pack_basename(geometry.pack[i]));
-		for (i = geometry.split; i < geometry.pack_nr; i++)
-			fprintf(in, "^%s\n", pack_basename(geometry.pack[i]));
-		fclose(in);
-	}
+		CALLOC_ARRAY(tier_cmds, geometry.tier_nr - 1);
+		for (t = 1; t < geometry.tier_nr; t++) {
+			struct child_process *tier_cmd = &tier_cmds[t - 1];
+
+			child_process_init(tier_cmd);
+			strvec_pushv(&tier_cmd->args, cmd.args.v);
+			tier_cmd->git_cmd = 1;
+			tier_cmd->out = -1;
+			if (start_geometry_tier(tier_cmd, &geometry, t))
+				die(_("could not start pack-objects"));
+		}
 
-	ret = finish_pack_objects_cmd(&cmd, &names, 1);
+		strvec_push(&cmd.args, "--unpacked");
+		ret = start_geometry_tier(&cmd, &geometry, 0);
+		if (!ret)
+			ret = finish_pack_objects_cmd(&cmd, &names, 1);
+
+		for (t = 1; t < geometry.tier_nr; t++) {
+			int r = finish_pack_objects_cmd(&tier_cmds[t - 1],
+							&names, 1);
+			if (!ret)
+				ret = r;
+		}
+	} else {
+		cmd.no_stdin = 1;
+		ret = start_command(&cmd);
+		if (!ret)
+			ret = finish_pack_objects_cmd(&cmd, &names, 1);
+	}
 	if (ret)
 		goto cleanup;
 
@@ -1387,6 +1517,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 		cruft_po_args.local = po_args.local;
 		cruft_po_args.quiet = po_args.quiet;
+		cruft_po_args.name_hash_version = po_args.name_hash_version;
 
 		ret = write_cruft_pack(&cruft_po_args, packtmp, pack_prefix,
 				       cruft_expiration, &names,
@@ -1532,6 +1663,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	string_list_clear(&names, 1);
 	existing_packs_release(&existing);
 	free_pack_geometry(&geometry);
+	free(tier_cmds);
 	list_objects_filter_release(&po_args.filter_options);
 
 	return ret;
@@ -6,6 +6,7 @@
 #include "git-compat-util.h"
 
 #include "builtin.h"
+#include "bulk-checkin.h"
 #include "environment.h"
 #include "hex.h"
 #include "lockfile.h"
@@ -379,6 +380,11 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 	merge_opt.show_rename_progress = 0;
 	last_commit = onto;
 	replayed_commits = kh_init_oid_map();
+	/*
+	 * Write the new trees and blobs of all the merges to one packfile,
+	 * which is flushed before we show a commit that needs them.
+	 */
+	begin_odb_transaction();
 	while ((commit = get_revision(&revs))) {
 		const struct name_decoration *decoration;
 		khint_t pos;
@@ -407,6 +413,7 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 		decoration = get_name_decoration(&commit->object);
 		if (!decoration)
 			continue;
+		flush_odb_transaction();
 		while (decoration) {
 			if (decoration->type == DECORATION_REF_LOCAL &&
 			    (contained || strset_contains(update_refs,
@@ -420,6 +427,8 @@ int cmd_replay(int argc, const char **argv, const char *prefix)
 		}
 	}
 
+	end_odb_transaction();
+
 	/* In --advance mode, advance the target ref */
 	if (result.clean == 1 && advance_name) {
 		printf("update %s %s %s\n",
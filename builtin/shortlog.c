@@ -4,9 +4,11 @@
 #include "diff.h"
 #include "environment.h"
 #include "gettext.h"
+#include "object-store-ll.h"
 #include "string-list.h"
 #include "repository.h"
 #include "revision.h"
+#include "thread-utils.h"
 #include "utf8.h"
 #include "mailmap.h"
 #include "setup.h"
@@ -92,14 +94,14 @@ static void insert_one_record(struct shortlog *log,
 	}
 }
 
-static int parse_ident(struct shortlog *log,
-		       struct strbuf *out, const char *in)
+static int format_ident(struct shortlog *log, struct strbuf *out,
+			const char *in, size_t len, int email)
 {
 	const char *mailbuf, *namebuf;
 	size_t namelen, maillen;
 	struct ident_split ident;
 
-	if (split_ident_line(&ident, in, strlen(in)))
+	if (split_ident_line(&ident, in, len))
 		return -1;
 
 	namebuf = ident.name_begin;
@@ -109,12 +111,18 @@ static int parse_ident(struct shortlog *log,
 
 	map_user(&log->mailmap, &mailbuf, &maillen, &namebuf, &namelen);
 	strbuf_add(out, namebuf, namelen);
-	if (log->email)
+	if (email)
 		strbuf_addf(out, " <%.*s>", (int)maillen, mailbuf);
 
 	return 0;
 }
 
+static int parse_ident(struct shortlog *log,
+		       struct strbuf *out, const char *in)
+{
+	return format_ident(log, out, in, strlen(in), log->email);
+}
+
 static void read_from_stdin(struct shortlog *log)
 {
 	struct strbuf ident = STRBUF_INIT;
@@ -214,9 +222,38 @@ static int shortlog_needs_dedup(const struct shortlog *log)
 	return HAS_MULTI_BITS(log->groups) || log->format.nr > 1 || log->trailers.nr;
 }
 
+/*
+ * The author and committer groups, which is what shortlog is used for
+ * most, need just one header line of the commit. Pick it out of the
+ * commit buffer instead of going through the pretty-printer, which
+ * re-encodes and parses the whole commit for each format. Returns -1 if
+ * "format" is not one of those groups.
+ */
+static int format_ident_group(struct shortlog *log, struct strbuf *out,
+			      const char *commit_buffer, const char *format)
+{
+	const char *header, *line;
+	size_t len;
+	int email;
+
+	if (!strcmp(format, "%aN <%aE>") || !strcmp(format, "%aN"))
+		header = "author";
+	else if (!strcmp(format, "%cN <%cE>") || !strcmp(format, "%cN"))
+		header = "committer";
+	else
+		return -1;
+	email = !!strchr(format, '<');
+
+	line = find_commit_header(commit_buffer, header, &len);
+	if (!line)
+		return -1;
+	return format_ident(log, out, line, len, email);
+}
+
 static void insert_records_from_format(struct shortlog *log,
 				       struct strset *dups,
 				       struct commit *commit,
+				       const char *commit_buffer,
 				       struct pretty_print_context *ctx,
 				       const char *oneline)
 {
@@ -226,8 +263,12 @@ static void insert_records_from_format(struct shortlog *log,
 	for_each_string_list_item(item, &log->format) {
 		strbuf_reset(&buf);
 
-		repo_format_commit_message(the_repository, commit,
-					   item->string, &buf, ctx);
+		if (!commit_buffer ||
+		    format_ident_group(log, &buf, commit_buffer, item->string)) {
+			strbuf_reset(&buf);
+			repo_format_commit_message(the_repository, commit,
+						   item->string, &buf, ctx);
+		}
 
 		if (!shortlog_needs_dedup(log) || strset_add(dups, buf.buf))
 			insert_one_record(log, buf.buf, oneline);
@@ -241,7 +282,8 @@ void shortlog_add_commit(struct shortlog *log, struct commit *commit)
 	struct strbuf oneline = STRBUF_INIT;
 	struct strset dups = STRSET_INIT;
 	struct pretty_print_context ctx = {0};
-	const char *oneline_str;
+	const char *oneline_str, *commit_buffer;
+	size_t len;
 
 	ctx.fmt = CMIT_FMT_USERFORMAT;
 	ctx.abbrev = log->abbrev;
@@ -249,30 +291,142 @@ void shortlog_add_commit(struct shortlog *log, struct commit *commit)
 	ctx.date_mode = log->date_mode;
 	ctx.output_encoding = get_log_output_encoding();
 
+	/*
+	 * Unless the commit needs re-encoding, what we need of it can be
+	 * picked out of its buffer directly (see format_ident_group()).
+	 */
+	commit_buffer = repo_get_commit_buffer(the_repository, commit, NULL);
+	if (find_commit_header(commit_buffer, "encoding", &len)) {
+		repo_unuse_commit_buffer(the_repository, commit, commit_buffer);
+		commit_buffer = NULL;
+	}
+
 	if (!log->summary) {
 		if (log->user_format)
 			pretty_print_commit(&ctx, commit, &oneline);
-		else
+		else if (commit_buffer) {
+			/* the same as "%s" */
+			const char *msg = strstr(commit_buffer, "\n\n");
+
+			if (msg)
+				format_subject(&oneline, skip_blank_lines(msg + 1), " ");
+		} else
 			repo_format_commit_message(the_repository, commit,
 						   "%s", &oneline, &ctx);
 	}
 	oneline_str = oneline.len ? oneline.buf : "<none>";
 
 	insert_records_from_trailers(log, &dups, commit, &ctx, oneline_str);
-	insert_records_from_format(log, &dups, commit, &ctx, oneline_str);
+	insert_records_from_format(log, &dups, commit, commit_buffer, &ctx,
+				   oneline_str);
 
+	if (commit_buffer)
+		repo_unuse_commit_buffer(the_repository, commit, commit_buffer);
 	strset_clear(&dups);
 	strbuf_release(&oneline);
 }
 
+/*
+ * Reading (mostly inflating) the commits is what shortlog spends its
+ * time on, so with more than one CPU the commits are taken from the walk
+ * in batches, whose buffers are read by threads while the records are
+ * still added in walk order by the main thread.
+ */
+#define READ_BATCH_SIZE 1024
+
+struct read_batch_data {
+	pthread_t thread;
+	struct commit **commits;
+	void **buffers;
+	unsigned long *sizes;
+	int start, step, nr;
+};
+
+static void *read_batch_thread(void *data)
+{
+	struct read_batch_data *d = data;
+	int i;
+
+	for (i = d->start; i < d->nr; i += d->step) {
+		enum object_type type;
+
+		if (get_cached_commit_buffer(the_repository, d->commits[i], NULL))
+			continue;
+		d->buffers[i] = repo_read_object_file(the_repository,
+						      &d->commits[i]->object.oid,
+						      &type, &d->sizes[i]);
+		if (d->buffers[i] && type != OBJ_COMMIT)
+			FREE_AND_NULL(d->buffers[i]);
+	}
+	return NULL;
+}
+
+static void read_batch(struct commit **commits, void **buffers,
+		       unsigned long *sizes, int nr, int nr_threads)
+{
+	struct read_batch_data *data;
+	int i;
+
+	CALLOC_ARRAY(data, nr_threads);
+	enable_obj_read_lock();
+	for (i = 0; i < nr_threads; i++) {
+		int err;
+
+		data[i].commits = commits;
+		data[i].buffers = buffers;
+		data[i].sizes = sizes;
+		data[i].start = i;
+		data[i].step = nr_threads;
+		data[i].nr = nr;
+		err = pthread_create(&data[i].thread, NULL,
+				     read_batch_thread, &data[i]);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].thread, NULL))
+			die(_("unable to join thread"));
+	disable_obj_read_lock();
+	free(data);
+}
+
 static void get_from_rev(struct rev_info *rev, struct shortlog *log)
 {
+	struct commit *commits[READ_BATCH_SIZE];
+	void *buffers[READ_BATCH_SIZE];
+	unsigned long sizes[READ_BATCH_SIZE];
 	struct commit *commit;
+	int nr_threads = HAVE_THREADS ? online_cpus() : 1;
+	int i, nr;
 
 	if (prepare_revision_walk(rev))
 		die(_("revision walk setup failed"));
-	while ((commit = get_revision(rev)) != NULL)
-		shortlog_add_commit(log, commit);
+
+	if (nr_threads < 2) {
+		while ((commit = get_revision(rev)) != NULL)
+			shortlog_add_commit(log, commit);
+		return;
+	}
+
+	do {
+		for (nr = 0; nr < READ_BATCH_SIZE; nr++) {
+			commits[nr] = get_revision(rev);
+			if (!commits[nr])
+				break;
+		}
+		memset(buffers, 0, sizeof(*buffers) * nr);
+		read_batch(commits, buffers, sizes, nr, nr_threads);
+
+		for (i = 0; i < nr; i++) {
+			if (buffers[i])
+				set_commit_buffer(the_repository, commits[i],
+						  buffers[i], sizes[i]);
+			shortlog_add_commit(log, commits[i]);
+			if (buffers[i])
+				free_commit_buffer(the_repository->parsed_objects,
+						   commits[i]);
+		}
+	} while (nr == READ_BATCH_SIZE);
 }
 
 static int parse_uint(char const **arg, int comma, int defval)
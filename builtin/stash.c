@@ -24,6 +24,7 @@
 #include "revision.h"
 #include "setup.h"
 #include "sparse-index.h"
+#include "symlinks.h"
 #include "log-tree.h"
 #include "diffcore.h"
 #include "exec-cmd.h"
@@ -1151,32 +1152,87 @@ static int check_changes(const struct pathspec *ps, int include_untracked,
 	return ret;
 }
 
+/*
+ * Bring the entries of "istate" for the NUL-separated "paths" in line
+ * with the working tree, the way "update-index -z --add --remove --stdin"
+ * (with "--ignore-skip-worktree-entries" if "ignore_skip_worktree" is
+ * set) would, but without writing the index out and reading it back in a
+ * separate process.
+ */
+static int update_index_from_worktree(struct index_state *istate,
+				      const struct strbuf *paths,
+				      int ignore_skip_worktree)
+{
+	const char *path = paths->buf, *end = paths->buf + paths->len;
+
+	for (; path < end; path += strlen(path) + 1) {
+		int len = strlen(path), stat_errno = 0, pos;
+		const struct cache_entry *ce;
+		struct object_id oid;
+		struct stat st;
+
+		if (lstat(path, &st)) {
+			st.st_mode = 0;
+			stat_errno = errno;
+		}
+		/* e.g. "sub/" for an untracked nested repository */
+		if (!verify_path(path, st.st_mode))
+			continue;
+		if (has_symlink_leading_path(path, len))
+			return error(_("'%s' is beyond a symbolic link"), path);
+
+		pos = index_name_pos(istate, path, len);
+		ce = pos < 0 ? NULL : istate->cache[pos];
+		if (ce && ce_skip_worktree(ce)) {
+			if (!ignore_skip_worktree &&
+			    remove_file_from_index(istate, path))
+				return error(_("%s: cannot remove from the index"),
+					     path);
+			continue;
+		}
+
+		if (stat_errno) {
+			if (!is_missing_file_error(stat_errno))
+				return error(_("could not lstat '%s': %s"), path,
+					     strerror(stat_errno));
+			if (remove_file_from_index(istate, path))
+				return error(_("%s: cannot remove from the index"),
+					     path);
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode) && ce) {
+			/* a file that became a directory is gone */
+			if (!S_ISGITLINK(ce->ce_mode)) {
+				if (remove_file_from_index(istate, path))
+					return error(_("%s: cannot remove from the index"),
+						     path);
+				continue;
+			}
+			/* leave submodules without a HEAD alone */
+			if (resolve_gitlink_ref(path, "HEAD", &oid) < 0)
+				continue;
+		}
+		if (add_to_index(istate, path, &st, 0))
+			return -1;
+	}
+	return 0;
+}
+
 static int save_untracked_files(struct stash_info *info, struct strbuf *msg,
 				struct strbuf files)
 {
 	int ret = 0;
 	struct strbuf untracked_msg = STRBUF_INIT;
-	struct child_process cp_upd_index = CHILD_PROCESS_INIT;
 	struct index_state istate = INDEX_STATE_INIT(the_repository);
 
-	cp_upd_index.git_cmd = 1;
-	strvec_pushl(&cp_upd_index.args, "update-index", "-z", "--add",
-		     "--remove", "--stdin", NULL);
-	strvec_pushf(&cp_upd_index.env, "GIT_INDEX_FILE=%s",
-			 stash_index_path.buf);
-
 	strbuf_addf(&untracked_msg, "untracked files on %s\n", msg->buf);
-	if (pipe_command(&cp_upd_index, files.buf, files.len, NULL, 0,
-			 NULL, 0)) {
-		ret = -1;
-		goto done;
-	}
-
-	if (write_index_as_tree(&info->u_tree, &istate, stash_index_path.buf, 0,
-				NULL)) {
+	if (update_index_from_worktree(&istate, &files, 0) ||
+	    cache_tree_update(&istate, 0)) {
 		ret = -1;
 		goto done;
 	}
+	oidcpy(&info->u_tree, &istate.cache_tree->oid);
 
 	if (commit_tree(untracked_msg.buf, untracked_msg.len,
 			&info->u_tree, NULL, &info->u_commit, NULL, NULL)) {
@@ -1187,7 +1243,6 @@ static int save_untracked_files(struct stash_info *info, struct strbuf *msg,
 done:
 	release_index(&istate);
 	strbuf_release(&untracked_msg);
-	remove_path(stash_index_path.buf);
 	return ret;
 }
 
@@ -1289,9 +1344,7 @@ static int stash_working_tree(struct stash_info *info, const struct pathspec *ps
 {
 	int ret = 0;
 	struct rev_info rev;
-	struct child_process cp_upd_index = CHILD_PROCESS_INIT;
 	struct strbuf diff_output = STRBUF_INIT;
-	struct index_state istate = INDEX_STATE_INIT(the_repository);
 
 	repo_init_revisions(the_repository, &rev, NULL);
 	copy_pathspec(&rev.prune_data, ps);
@@ -1316,27 +1369,20 @@ static int stash_working_tree(struct stash_info *info, const struct pathspec *ps
 			   "");
 	run_diff_index(&rev, 0);
 
-	cp_upd_index.git_cmd = 1;
-	strvec_pushl(&cp_upd_index.args, "update-index",
-		     "--ignore-skip-worktree-entries",
-		     "-z", "--add", "--remove", "--stdin", NULL);
-	strvec_pushf(&cp_upd_index.env, "GIT_INDEX_FILE=%s",
-		     stash_index_path.buf);
-
-	if (pipe_command(&cp_upd_index, diff_output.buf, diff_output.len,
-			 NULL, 0, NULL, 0)) {
-		ret = -1;
-		goto done;
-	}
-
-	if (write_index_as_tree(&info->w_tree, &istate, stash_index_path.buf, 0,
-				NULL)) {
+	/*
+	 * The in-core index is the one of i_tree that reset_tree() left
+	 * behind, with the stat data of the refreshed index, so the paths
+	 * that did not change on disk are not hashed again.
+	 */
+	if (update_index_from_worktree(&the_index, &diff_output, 1) ||
+	    cache_tree_update(&the_index, 0)) {
 		ret = -1;
 		goto done;
 	}
+	oidcpy(&info->w_tree, &the_index.cache_tree->oid);
 
 done:
-	release_index(&istate);
+	discard_index(&the_index);
 	release_revisions(&rev);
 	strbuf_release(&diff_output);
 	remove_path(stash_index_path.buf);
@@ -1363,7 +1409,8 @@ static int do_create_stash(const struct pathspec *ps, struct strbuf *stash_msg_b
 	prepare_fallback_ident("git stash", "git@stash");
 
 	repo_read_index_preload(the_repository, NULL, 0);
-	if (repo_refresh_and_write_index(the_repository, REFRESH_QUIET, 0, 0,
+	if (repo_refresh_and_write_index(the_repository, REFRESH_QUIET,
+					 SKIP_IF_UNCHANGED, 0,
 					 NULL, NULL, NULL) < 0) {
 		ret = -1;
 		goto done;
@@ -1539,8 +1586,8 @@ static int do_push_stash(const struct pathspec *ps, const char *stash_msg, int q
 		int i;
 		char *ps_matched = xcalloc(ps->nr, 1);
 
-		/* TODO: audit for interaction with sparse-index. */
-		ensure_full_index(&the_index);
+		if (pathspec_needs_expanded_index(&the_index, ps))
+			ensure_full_index(&the_index);
 		for (i = 0; i < the_index.cache_nr; i++)
 			ce_path_match(&the_index, the_index.cache[i], ps,
 				      ps_matched);
@@ -1554,7 +1601,8 @@ static int do_push_stash(const struct pathspec *ps, const char *stash_msg, int q
 		free(ps_matched);
 	}
 
-	if (repo_refresh_and_write_index(the_repository, REFRESH_QUIET, 0, 0,
+	if (repo_refresh_and_write_index(the_repository, REFRESH_QUIET,
+					 SKIP_IF_UNCHANGED, 0,
 					 NULL, NULL, NULL)) {
 		ret = -1;
 		goto done;
@@ -1,11 +1,18 @@
 #include "builtin.h"
+#include "commit-graph.h"
+#include "config.h"
 #include "exec-cmd.h"
 #include "gettext.h"
+#include "packfile.h"
 #include "pkt-line.h"
 #include "parse-options.h"
 #include "path.h"
 #include "protocol.h"
 #include "replace-object.h"
+#include "repository.h"
+#include "shallow.h"
+#include "strvec.h"
+#include "unix-socket.h"
 #include "upload-pack.h"
 #include "serve.h"
 
@@ -15,6 +22,183 @@ static const char * const upload_pack_usage[] = {
 	NULL
 };
 
+struct pool_options {
+	const char *socket;
+	int workers;
+	int max_requests;
+	int idle_timeout;
+};
+
+#ifndef NO_UNIX_SOCKETS
+/* The connection to "git daemon" that a pool worker serves. */
+static int pool_conn = -1;
+
+/*
+ * Read what every request needs, so that the workers forked from the
+ * pool start with it at hand.
+ */
+static void warm_repository(void)
+{
+	struct packed_git *p;
+	int v;
+
+	git_config_get_bool("uploadpack.allowfilter", &v);
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		open_pack_index(p);
+	generation_numbers_enabled(the_repository);
+	is_repository_shallow(the_repository);
+}
+
+/*
+ * Wait for "git daemon" to hand over a client and set up the process
+ * to serve it, with the client on stdin and stdout, the daemon's error
+ * pipe on stderr and its environment for the request.
+ */
+static void pool_worker(int listen_fd, int busy_fd)
+{
+	struct packet_reader reader;
+	int fds[2], nr = ARRAY_SIZE(fds);
+	char c;
+	int conn;
+
+	while ((conn = accept(listen_fd, NULL, NULL)) < 0)
+		if (errno != EINTR && errno != ECONNABORTED)
+			die_errno(_("unable to accept a pool connection"));
+
+	/* Like "git daemon", ignore SIGTERM now that we have a client. */
+	signal(SIGTERM, SIG_IGN);
+	if (write_in_full(busy_fd, "", 1) < 0)
+		die_errno(_("unable to notify the pool"));
+	close(busy_fd);
+	close(listen_fd);
+
+	if (unix_stream_recv_fds(conn, &c, 1, fds, &nr) != 1 || nr != 2)
+		die(_("expected a client from git-daemon"));
+
+	packet_reader_init(&reader, conn, NULL, 0, 0);
+	while (packet_reader_read(&reader) == PACKET_READ_NORMAL) {
+		char *eq = strchr(reader.line, '=');
+
+		if (!eq)
+			die(_("invalid environment from git-daemon: '%s'"),
+			    reader.line);
+		*eq = '\0';
+		setenv(reader.line, eq + 1, 1);
+	}
+	if (reader.status != PACKET_READ_FLUSH)
+		die(_("expected flush after the environment from git-daemon"));
+
+	dup2(fds[0], 0);
+	dup2(fds[0], 1);
+	dup2(fds[1], 2);
+	close(fds[0]);
+	close(fds[1]);
+	pool_conn = conn;
+}
+
+/*
+ * Serve the repository through the socket "opts->socket" as a pool of
+ * pre-forked workers that "git daemon" hands its clients to. Each of
+ * them serves a single client, so that it starts from the state of the
+ * warm pool rather than from what an earlier request left behind. The
+ * pool forks at most "opts->max_requests" of them and goes away once
+ * they are used up, or when no client came for "opts->idle_timeout"
+ * seconds, so that a new one is started with fresh configuration.
+ *
+ * This only returns in a worker, once it has a client to serve.
+ */
+static void serve_pool(const struct pool_options *opts)
+{
+	struct unix_stream_listen_opts listen_opts = UNIX_STREAM_LISTEN_OPTS_INIT;
+	pid_t *pids = NULL;
+	int nr_pids = 0, alloc_pids = 0;
+	int listen_fd, busy[2], idle = 0, started = 0;
+	struct stat st, cur;
+	int i;
+
+	if (opts->workers < 1 || opts->max_requests < 1)
+		die(_("the pool needs at least one worker and request"));
+
+	/* Leave the socket alone if another pool serves it already. */
+	listen_fd = unix_stream_connect(opts->socket, 0);
+	if (listen_fd >= 0)
+		exit(0);
+
+	signal(SIGTERM, SIG_DFL);
+	warm_repository();
+
+	listen_fd = unix_stream_listen(opts->socket, &listen_opts);
+	if (listen_fd < 0 || lstat(opts->socket, &st) < 0)
+		die_errno(_("unable to listen on '%s'"), opts->socket);
+	if (pipe(busy) < 0)
+		die_errno(_("unable to create pipe"));
+
+	for (;;) {
+		struct pollfd pfd;
+		char buf[64];
+		ssize_t n;
+		pid_t pid;
+
+		while (idle < opts->workers && started < opts->max_requests) {
+			pid = fork();
+			if (pid < 0)
+				die_errno(_("unable to fork"));
+			if (!pid) {
+				close(busy[0]);
+				free(pids);
+				pool_worker(listen_fd, busy[1]);
+				return;
+			}
+			idle++;
+			started++;
+
+			/* Forget about the workers that are done. */
+			for (i = 0; i < nr_pids; i++)
+				if (waitpid(pids[i], NULL, WNOHANG) == pids[i])
+					pids[i--] = pids[--nr_pids];
+			ALLOC_GROW(pids, nr_pids + 1, alloc_pids);
+			pids[nr_pids++] = pid;
+		}
+		if (!idle)
+			break;
+
+		pfd.fd = busy[0];
+		pfd.events = POLLIN;
+		n = poll(&pfd, 1, opts->idle_timeout * 1000);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		n = xread(busy[0], buf, sizeof(buf));
+		if (n <= 0)
+			break;
+		idle -= n;
+	}
+
+	/* A newer pool may have taken the socket over in the meantime. */
+	if (!lstat(opts->socket, &cur) &&
+	    cur.st_dev == st.st_dev && cur.st_ino == st.st_ino)
+		unlink(opts->socket);
+	close(listen_fd);
+
+	/* The workers that are busy ignore this. */
+	for (i = 0; i < nr_pids; i++)
+		kill(pids[i], SIGTERM);
+	free(pids);
+	exit(0);
+}
+
+/* Tell "git daemon" that the worker served its client. */
+static void pool_worker_done(void)
+{
+	if (pool_conn < 0)
+		return;
+	write_in_full(pool_conn, "", 1);
+	close(pool_conn);
+	pool_conn = -1;
+}
+#endif
+
 int cmd_upload_pack(int argc, const char **argv, const char *prefix)
 {
 	const char *dir;
@@ -22,6 +206,11 @@ int cmd_upload_pack(int argc, const char **argv, const char *prefix)
 	int advertise_refs = 0;
 	int stateless_rpc = 0;
 	int timeout = 0;
+	struct pool_options pool = {
+		.workers = 2,
+		.max_requests = 100,
+		.idle_timeout = 60,
+	};
 	struct option options[] = {
 		OPT_BOOL(0, "stateless-rpc", &stateless_rpc,
 			 N_("quit after a single request/response exchange")),
@@ -32,6 +221,18 @@ int cmd_upload_pack(int argc, const char **argv, const char *prefix)
 			 N_("do not try <directory>/.git/ if <directory> is no Git directory")),
 		OPT_INTEGER(0, "timeout", &timeout,
 			    N_("interrupt transfer after <n> seconds of inactivity")),
+		OPT_STRING_F(0, "pool", &pool.socket, N_("socket"),
+			     N_("serve clients of git-daemon from a pool of workers"),
+			     PARSE_OPT_HIDDEN),
+		OPT_INTEGER_F(0, "pool-workers", &pool.workers,
+			      N_("keep <n> idle workers in the pool"),
+			      PARSE_OPT_HIDDEN),
+		OPT_INTEGER_F(0, "pool-requests", &pool.max_requests,
+			      N_("serve at most <n> requests from the pool"),
+			      PARSE_OPT_HIDDEN),
+		OPT_INTEGER_F(0, "pool-idle-timeout", &pool.idle_timeout,
+			      N_("shut the pool down after <n> idle seconds"),
+			      PARSE_OPT_HIDDEN),
 		OPT_END()
 	};
 
@@ -50,6 +251,16 @@ int cmd_upload_pack(int argc, const char **argv, const char *prefix)
 	if (!enter_repo(dir, strict))
 		die("'%s' does not appear to be a git repository", dir);
 
+	if (pool.socket) {
+#ifndef NO_UNIX_SOCKETS
+		if (stateless_rpc || advertise_refs)
+			die(_("--pool cannot be used with --stateless-rpc or --advertise-refs"));
+		serve_pool(&pool);
+#else
+		die(_("--pool is not supported on this platform"));
+#endif
+	}
+
 	switch (determine_protocol_version_server()) {
 	case protocol_v2:
 		if (advertise_refs)
@@ -73,5 +284,8 @@ int cmd_upload_pack(int argc, const char **argv, const char *prefix)
 		BUG("unknown protocol version");
 	}
 
+#ifndef NO_UNIX_SOCKETS
+	pool_worker_done();
+#endif
 	return 0;
 }
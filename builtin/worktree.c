@@ -424,7 +424,7 @@ static int add_worktree(const char *path, const char *refname,
 	struct commit *commit = NULL;
 	int is_branch = 0;
 	struct strbuf sb_name = STRBUF_INIT;
-	struct worktree **worktrees;
+	struct worktree **worktrees, *wt;
 
 	worktrees = get_worktrees();
 	check_candidate_path(path, opts->force, worktrees, "add");
@@ -509,6 +509,24 @@ static int add_worktree(const char *path, const char *refname,
 	strbuf_addf(&sb, "%s/commondir", sb_repo.buf);
 	write_file(sb.buf, "../..");
 
+	/*
+	 * Set up the per-worktree part of the reference database, which
+	 * the backends other than "files" keep in a store of its own.
+	 */
+	wt = get_linked_worktree(name);
+	if (!wt) {
+		ret = error(_("could not find created worktree '%s'"), name);
+		goto done;
+	}
+	strbuf_reset(&sb);
+	ret = refs_init_db(get_worktree_ref_store(wt),
+			   REFS_INIT_DB_IS_WORKTREE, &sb);
+	free_worktree(wt);
+	if (ret) {
+		error("%s", sb.buf);
+		goto done;
+	}
+
 	/*
 	 * If the current worktree has sparse-checkout enabled, then copy
 	 * the sparse-checkout patterns from the current worktree.
@@ -16,11 +16,148 @@
 #include "packfile.h"
 #include "object-file.h"
 #include "object-store-ll.h"
+#include "oidmap.h"
+#include "trace2.h"
+#include "write-or-die.h"
+#ifdef HAVE_IO_URING
+#include "compat/linux/io-uring.h"
+#endif
 
 static int odb_transaction_nesting;
 
 static struct tmp_objdir *bulk_fsync_objdir;
 
+#ifdef HAVE_IO_URING
+/*
+ * With io_uring the writeout and close of each loose object file are
+ * queued and completed by the kernel in the background, while we go on
+ * producing the next object. The ring is drained before the single
+ * hardware flush in flush_batch_fsync().
+ */
+#define BULK_FSYNC_RING_ENTRIES 64
+
+static struct git_uring *bulk_fsync_ring;
+static int bulk_fsync_ring_unavailable;
+
+/*
+ * The user_data of each queued operation is the file descriptor it
+ * works on, shifted left by one, with the low bit set for the close.
+ */
+static void complete_bulk_fsync(uint64_t user_data, int res,
+				void *cb_data UNUSED)
+{
+	int fd = user_data >> 1;
+
+	/* Failures of the writeout are dealt with when closing. */
+	if (!(user_data & 1))
+		return;
+
+	if (res == -ECANCELED) {
+		/*
+		 * The linked writeout failed, so the kernel did not close
+		 * the file either. Fall back to a full fsync, like
+		 * fsync_loose_object_bulk_checkin() does.
+		 */
+		fsync_or_die(fd, "loose object file");
+		res = close(fd) ? -errno : 0;
+	}
+	if (res < 0) {
+		errno = -res;
+		die_errno(_("error when closing loose object file"));
+	}
+}
+
+static void drain_bulk_fsync_ring(void)
+{
+	int ret;
+
+	if (!bulk_fsync_ring)
+		return;
+
+	while (git_uring_inflight(bulk_fsync_ring)) {
+		ret = git_uring_submit(bulk_fsync_ring, 1);
+		if (ret < 0) {
+			errno = -ret;
+			die_errno(_("unable to wait for loose object writeout"));
+		}
+		git_uring_reap(bulk_fsync_ring, complete_bulk_fsync, NULL);
+	}
+
+	git_uring_release(bulk_fsync_ring);
+	bulk_fsync_ring = NULL;
+}
+
+static int queue_bulk_fsync(int fd)
+{
+	struct io_uring_sqe *writeout, *close_sqe;
+	int ret;
+
+	if (!bulk_fsync_ring) {
+		if (bulk_fsync_ring_unavailable)
+			return -1;
+		bulk_fsync_ring = git_uring_init(BULK_FSYNC_RING_ENTRIES);
+		if (!bulk_fsync_ring) {
+			bulk_fsync_ring_unavailable = 1;
+			return -1;
+		}
+	}
+
+	/* Make room for the two entries, waiting for older ones to finish. */
+	while (!(writeout = git_uring_get_sqe(bulk_fsync_ring)) ||
+	       !(close_sqe = git_uring_get_sqe(bulk_fsync_ring))) {
+		/*
+		 * git_uring_get_sqe() cannot hand out the second entry
+		 * without the first, so if "writeout" was obtained it is
+		 * turned into a no-op and submitted along with the rest.
+		 */
+		if (writeout) {
+			writeout->opcode = IORING_OP_NOP;
+			writeout->user_data = 0;
+		}
+		ret = git_uring_submit(bulk_fsync_ring, 1);
+		if (ret < 0) {
+			errno = -ret;
+			die_errno(_("unable to wait for loose object writeout"));
+		}
+		git_uring_reap(bulk_fsync_ring, complete_bulk_fsync, NULL);
+	}
+
+	/* See git_fsync(fd, FSYNC_WRITEOUT_ONLY). */
+	writeout->opcode = IORING_OP_SYNC_FILE_RANGE;
+	writeout->fd = fd;
+	writeout->off = 0;
+	writeout->len = 0;
+	writeout->sync_range_flags = SYNC_FILE_RANGE_WAIT_BEFORE |
+				     SYNC_FILE_RANGE_WRITE |
+				     SYNC_FILE_RANGE_WAIT_AFTER;
+	writeout->flags = IOSQE_IO_LINK;
+	writeout->user_data = (uint64_t)fd << 1;
+
+	close_sqe->opcode = IORING_OP_CLOSE;
+	close_sqe->fd = fd;
+	close_sqe->user_data = ((uint64_t)fd << 1) | 1;
+
+	ret = git_uring_submit(bulk_fsync_ring, 0);
+	if (ret < 0) {
+		errno = -ret;
+		die_errno(_("unable to queue loose object writeout"));
+	}
+	git_uring_reap(bulk_fsync_ring, complete_bulk_fsync, NULL);
+
+	trace2_counter_add(TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY, 1);
+	return 0;
+}
+#else
+static void drain_bulk_fsync_ring(void)
+{
+}
+
+static int queue_bulk_fsync(int fd UNUSED)
+{
+	return -1;
+}
+#endif
+
 static struct bulk_checkin_packfile {
 	char *pack_tmp_name;
 	struct hashfile *f;
@@ -32,6 +169,30 @@ static struct bulk_checkin_packfile {
 	uint32_t nr_written;
 } bulk_checkin_packfile;
 
+/*
+ * The objects written to the packfile from memory. They are read from
+ * here until the packfile is flushed and can be read instead.
+ */
+struct bulk_checkin_object {
+	struct oidmap_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+};
+
+static struct oidmap bulk_checkin_objects = OIDMAP_INIT;
+
+static void clear_bulk_checkin_objects(void)
+{
+	struct oidmap_iter iter;
+	struct bulk_checkin_object *e;
+
+	oidmap_iter_init(&bulk_checkin_objects, &iter);
+	while ((e = oidmap_iter_next(&iter)))
+		free(e->buf);
+	oidmap_free(&bulk_checkin_objects, 1);
+}
+
 static void finish_tmp_packfile(struct strbuf *basename,
 				const char *pack_tmp_name,
 				struct pack_idx_entry **written_list,
@@ -87,6 +248,7 @@ static void flush_bulk_checkin_packfile(struct bulk_checkin_packfile *state)
 	strbuf_release(&packname);
 	/* Make objects we just wrote available to ourselves */
 	reprepare_packed_git(the_repository);
+	clear_bulk_checkin_objects();
 }
 
 /*
@@ -100,6 +262,8 @@ static void flush_batch_fsync(void)
 	if (!bulk_fsync_objdir)
 		return;
 
+	drain_bulk_fsync_ring();
+
 	/*
 	 * Issue a full hardware flush against a temporary file to ensure
 	 * that all objects are durable before any renames occur. The code in
@@ -140,33 +304,83 @@ static int already_written(struct bulk_checkin_packfile *state, struct object_id
 	return 0;
 }
 
+/* Lazily create backing packfile for the state */
+static void prepare_to_stream(struct bulk_checkin_packfile *state,
+			      unsigned flags)
+{
+	if (!(flags & HASH_WRITE_OBJECT) || state->f)
+		return;
+
+	state->f = create_tmp_packfile(&state->pack_tmp_name);
+	reset_pack_idx_option(&state->pack_idx_opts);
+
+	/* Pretend we are going to write only one object */
+	state->offset = write_pack_header(state->f, 1);
+	if (!state->offset)
+		die_errno("unable to write pack header");
+}
+
+/*
+ * The object we are streaming out, which starts at "checkpoint", does
+ * not fit in the current pack anymore. Move what we already wrote of it
+ * to a new pack and finish the current pack without it, so that the
+ * caller can continue where it left off instead of reading its input
+ * again. "checkpoint" and "idx" are updated to point into the new pack.
+ */
+static void move_object_to_new_pack(struct bulk_checkin_packfile *state,
+				    struct hashfile_checkpoint *checkpoint,
+				    struct pack_idx_entry *idx)
+{
+	struct bulk_checkin_packfile old = *state;
+	struct hashfile_checkpoint old_checkpoint = *checkpoint;
+	unsigned char buf[16384];
+	off_t pos;
+
+	hashflush(old.f);
+
+	memset(state, 0, sizeof(*state));
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+	hashfile_checkpoint(state->f, checkpoint);
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+
+	for (pos = old_checkpoint.offset; pos < old.offset; ) {
+		size_t len = sizeof(buf);
+
+		if (old.offset - pos < len)
+			len = old.offset - pos;
+		if (pread_in_full(old.f->fd, buf, len, pos) != len)
+			die_errno("unable to read back from '%s'",
+				  old.pack_tmp_name);
+		hashwrite(state->f, buf, len);
+		state->offset += len;
+		pos += len;
+	}
+
+	if (hashfile_truncate(old.f, &old_checkpoint))
+		die_errno("unable to truncate '%s'", old.pack_tmp_name);
+	old.offset = old_checkpoint.offset;
+	flush_bulk_checkin_packfile(&old);
+}
+
 /*
  * Read the contents from fd for size bytes, streaming it to the
- * packfile in state while updating the hash in ctx. Signal a failure
- * by returning a negative value when the resulting pack would exceed
- * the pack size limit and this is not the first object in the pack,
- * so that the caller can discard what we wrote from the current pack
- * by truncating it and opening a new one. The caller will then call
- * us again after rewinding the input fd.
- *
- * The already_hashed_to pointer is kept untouched by the caller to
- * make sure we do not hash the same byte when we are called
- * again. This way, the caller does not have to checkpoint its hash
- * status before calling us just in case we ask it to call us again
- * with a new pack.
+ * packfile in state while updating the hash in ctx. The input is read
+ * exactly once: when the object would make the pack exceed the pack
+ * size limit and this is not the first object in the pack, what was
+ * written of it so far is moved to a new pack, and we keep going there.
  */
-static int stream_blob_to_pack(struct bulk_checkin_packfile *state,
-			       git_hash_ctx *ctx, off_t *already_hashed_to,
-			       int fd, size_t size, const char *path,
-			       unsigned flags)
+static void stream_blob_to_pack(struct bulk_checkin_packfile *state,
+				git_hash_ctx *ctx,
+				struct hashfile_checkpoint *checkpoint,
+				struct pack_idx_entry *idx,
+				int fd, size_t size, const char *path)
 {
 	git_zstream s;
 	unsigned char ibuf[16384];
 	unsigned char obuf[16384];
 	unsigned hdrlen;
 	int status = Z_OK;
-	int write_object = (flags & HASH_WRITE_OBJECT);
-	off_t offset = 0;
 
 	git_deflate_init(&s, pack_compression_level);
 
@@ -183,15 +397,7 @@ static int stream_blob_to_pack(struct bulk_checkin_packfile *state,
 			if (read_result != rsize)
 				die("failed to read %d bytes from '%s'",
 				    (int)rsize, path);
-			offset += rsize;
-			if (*already_hashed_to < offset) {
-				size_t hsize = offset - *already_hashed_to;
-				if (rsize < hsize)
-					hsize = rsize;
-				if (hsize)
-					the_hash_algo->update_fn(ctx, ibuf, hsize);
-				*already_hashed_to = offset;
-			}
+			the_hash_algo->update_fn(ctx, ibuf, rsize);
 			s.next_in = ibuf;
 			s.avail_in = rsize;
 			size -= rsize;
@@ -200,16 +406,15 @@ static int stream_blob_to_pack(struct bulk_checkin_packfile *state,
 		status = git_deflate(&s, size ? 0 : Z_FINISH);
 
 		if (!s.avail_out || status == Z_STREAM_END) {
-			if (write_object) {
+			if (idx) {
 				size_t written = s.next_out - obuf;
 
 				/* would we bust the size limit? */
 				if (state->nr_written &&
 				    pack_size_limit_cfg &&
-				    pack_size_limit_cfg < state->offset + written) {
-					git_deflate_abort(&s);
-					return -1;
-				}
+				    pack_size_limit_cfg < state->offset + written)
+					move_object_to_new_pack(state, checkpoint,
+								idx);
 
 				hashwrite(state->f, obuf, written);
 				state->offset += written;
@@ -228,23 +433,6 @@ static int stream_blob_to_pack(struct bulk_checkin_packfile *state,
 		}
 	}
 	git_deflate_end(&s);
-	return 0;
-}
-
-/* Lazily create backing packfile for the state */
-static void prepare_to_stream(struct bulk_checkin_packfile *state,
-			      unsigned flags)
-{
-	if (!(flags & HASH_WRITE_OBJECT) || state->f)
-		return;
-
-	state->f = create_tmp_packfile(&state->pack_tmp_name);
-	reset_pack_idx_option(&state->pack_idx_opts);
-
-	/* Pretend we are going to write only one object */
-	state->offset = write_pack_header(state->f, 1);
-	if (!state->offset)
-		die_errno("unable to write pack header");
 }
 
 static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
@@ -252,17 +440,12 @@ static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
 				int fd, size_t size,
 				const char *path, unsigned flags)
 {
-	off_t seekback, already_hashed_to;
 	git_hash_ctx ctx;
 	unsigned char obuf[16384];
 	unsigned header_len;
 	struct hashfile_checkpoint checkpoint = {0};
 	struct pack_idx_entry *idx = NULL;
 
-	seekback = lseek(fd, 0, SEEK_CUR);
-	if (seekback == (off_t) -1)
-		return error("cannot find the current offset");
-
 	header_len = format_object_header((char *)obuf, sizeof(obuf),
 					  OBJ_BLOB, size);
 	the_hash_algo->init_fn(&ctx);
@@ -270,34 +453,17 @@ static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
 	the_hash_algo->init_fn(&checkpoint.ctx);
 
 	/* Note: idx is non-NULL when we are writing */
-	if ((flags & HASH_WRITE_OBJECT) != 0)
+	if ((flags & HASH_WRITE_OBJECT) != 0) {
 		CALLOC_ARRAY(idx, 1);
 
-	already_hashed_to = 0;
-
-	while (1) {
 		prepare_to_stream(state, flags);
-		if (idx) {
-			hashfile_checkpoint(state->f, &checkpoint);
-			idx->offset = state->offset;
-			crc32_begin(state->f);
-		}
-		if (!stream_blob_to_pack(state, &ctx, &already_hashed_to,
-					 fd, size, path, flags))
-			break;
-		/*
-		 * Writing this object to the current pack will make
-		 * it too big; we need to truncate it, start a new
-		 * pack, and write into it.
-		 */
-		if (!idx)
-			BUG("should not happen");
-		hashfile_truncate(state->f, &checkpoint);
-		state->offset = checkpoint.offset;
-		flush_bulk_checkin_packfile(state);
-		if (lseek(fd, seekback, SEEK_SET) == (off_t) -1)
-			return error("cannot seek back");
+		hashfile_checkpoint(state->f, &checkpoint);
+		idx->offset = state->offset;
+		crc32_begin(state->f);
 	}
+
+	stream_blob_to_pack(state, &ctx, &checkpoint, idx, fd, size, path);
+
 	the_hash_algo->final_oid_fn(result_oid, &ctx);
 	if (!idx)
 		return 0;
@@ -317,6 +483,103 @@ static int deflate_blob_to_pack(struct bulk_checkin_packfile *state,
 	return 0;
 }
 
+static void write_buffer_to_pack(struct bulk_checkin_packfile *state,
+				 const struct object_id *oid,
+				 const void *buf, unsigned long len,
+				 enum object_type type)
+{
+	unsigned char hdr[MAX_PACK_OBJECT_HEADER];
+	unsigned hdrlen;
+	struct pack_idx_entry *idx;
+	git_zstream s;
+	unsigned long maxsize;
+	void *out;
+
+	git_deflate_init(&s, pack_compression_level);
+	maxsize = git_deflate_bound(&s, len);
+	out = xmalloc(maxsize);
+	s.next_in = (void *)buf;
+	s.avail_in = len;
+	s.next_out = out;
+	s.avail_out = maxsize;
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, len);
+
+	/* would we bust the size limit? */
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + hdrlen + s.total_out)
+		flush_bulk_checkin_packfile(state);
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+
+	CALLOC_ARRAY(idx, 1);
+	oidcpy(&idx->oid, oid);
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+	hashwrite(state->f, hdr, hdrlen);
+	hashwrite(state->f, out, s.total_out);
+	idx->crc32 = crc32_end(state->f);
+	state->offset += hdrlen + s.total_out;
+	free(out);
+
+	ALLOC_GROW(state->written,
+		   state->nr_written + 1,
+		   state->alloc_written);
+	state->written[state->nr_written++] = idx;
+}
+
+int write_object_bulk_checkin(const struct object_id *oid,
+			      const void *buf, unsigned long len,
+			      enum object_type type)
+{
+	struct bulk_checkin_object *e;
+
+	if (!odb_transaction_nesting)
+		return -1;
+	if (oidmap_get(&bulk_checkin_objects, oid))
+		return 0;
+
+	write_buffer_to_pack(&bulk_checkin_packfile, oid, buf, len, type);
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->entry.oid, oid);
+	e->type = type;
+	e->size = len;
+	e->buf = xmemdupz(buf, len);
+	oidmap_put(&bulk_checkin_objects, e);
+	return 0;
+}
+
+int bulk_checkin_object_info(struct repository *r,
+			     const struct object_id *oid,
+			     struct object_info *oi)
+{
+	struct bulk_checkin_object *e;
+
+	if (r != the_repository)
+		return -1;
+	e = oidmap_get(&bulk_checkin_objects, oid);
+	if (!e)
+		return -1;
+
+	if (oi->typep)
+		*(oi->typep) = e->type;
+	if (oi->sizep)
+		*(oi->sizep) = e->size;
+	if (oi->disk_sizep)
+		*(oi->disk_sizep) = 0;
+	if (oi->delta_base_oid)
+		oidclr(oi->delta_base_oid);
+	if (oi->type_name)
+		strbuf_addstr(oi->type_name, type_name(e->type));
+	if (oi->contentp)
+		*oi->contentp = xmemdupz(e->buf, e->size);
+	oi->whence = OI_CACHED;
+	return 0;
+}
+
 void prepare_loose_object_bulk_checkin(void)
 {
 	/*
@@ -333,6 +596,13 @@ void prepare_loose_object_bulk_checkin(void)
 		tmp_objdir_replace_primary_odb(bulk_fsync_objdir, 0);
 }
 
+int fsync_and_close_loose_object_bulk_checkin(int fd)
+{
+	if (!bulk_fsync_objdir)
+		return -1;
+	return queue_bulk_fsync(fd);
+}
+
 void fsync_loose_object_bulk_checkin(int fd, const char *filename)
 {
 	/*
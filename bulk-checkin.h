@@ -6,13 +6,45 @@
 
 #include "object.h"
 
+struct object_info;
+struct repository;
+
 void prepare_loose_object_bulk_checkin(void);
 void fsync_loose_object_bulk_checkin(int fd, const char *filename);
 
+/*
+ * Like fsync_loose_object_bulk_checkin() followed by close(), but allow
+ * both to complete asynchronously, before the objects of the current
+ * transaction are made visible. Returns 0 if "fd" was taken over (it
+ * must not be used by the caller anymore), or -1 if the caller has to
+ * take care of it.
+ */
+int fsync_and_close_loose_object_bulk_checkin(int fd);
+
 int index_blob_bulk_checkin(struct object_id *oid,
 			    int fd, size_t size,
 			    const char *path, unsigned flags);
 
+/*
+ * Write the object in "buf", whose name "oid" the caller computed, to
+ * the packfile of the current ODB transaction. Until the transaction is
+ * flushed, the object is read from a copy kept in memory; see
+ * bulk_checkin_object_info(). Returns -1 if no transaction is active,
+ * in which case the caller has to write the object itself.
+ */
+int write_object_bulk_checkin(const struct object_id *oid,
+			      const void *buf, unsigned long len,
+			      enum object_type type);
+
+/*
+ * Fill "oi" for an object written by write_object_bulk_checkin() whose
+ * transaction has not been flushed yet. Returns -1 if "oid" is not such
+ * an object.
+ */
+int bulk_checkin_object_info(struct repository *r,
+			     const struct object_id *oid,
+			     struct object_info *oi);
+
 /*
  * Tell the object database to optimize for adding
  * multiple objects. end_odb_transaction must be called
@@ -11,6 +11,7 @@
 #include "pkt-line.h"
 #include "config.h"
 #include "remote.h"
+#include "trace2.h"
 
 static struct {
 	enum bundle_list_heuristic heuristic;
@@ -285,47 +286,80 @@ static char *find_temp_filename(void)
 	return strbuf_detach(&name, NULL);
 }
 
-static int download_https_uri_to_file(const char *file, const char *uri)
+/*
+ * A download of a bundle by a "git remote-https" child, which may run
+ * in the background while we work on other bundles.
+ */
+struct bundle_download {
+	struct remote_bundle_info *bundle;
+	char *file;
+	struct child_process cp;
+	FILE *out;
+	int result;
+	/* The helper cannot write the file to its output. */
+	unsigned no_stream : 1;
+};
+
+/*
+ * Have a "git remote-https" child download 'uri' to 'file', and return
+ * as soon as it has the request. finish_https_download() waits for it.
+ * Without a 'file', the child writes the download to 'dl->cp.out'.
+ */
+static void start_https_download(struct bundle_download *dl,
+				 const char *file, const char *uri)
 {
-	int result = 0;
-	struct child_process cp = CHILD_PROCESS_INIT;
-	FILE *child_in = NULL, *child_out = NULL;
+	FILE *child_in = NULL;
 	struct strbuf line = STRBUF_INIT;
-	int found_get = 0;
+	int found_get = 0, found_get_stream = 0;
 
-	strvec_pushl(&cp.args, "git-remote-https", uri, NULL);
-	cp.err = -1;
-	cp.in = -1;
-	cp.out = -1;
+	strvec_pushl(&dl->cp.args, "git-remote-https", uri, NULL);
+	dl->cp.err = -1;
+	dl->cp.in = -1;
+	dl->cp.out = -1;
 
-	if (start_command(&cp))
-		return 1;
+	if (start_command(&dl->cp)) {
+		dl->result = 1;
+		dl->cp.pid = 0;
+		return;
+	}
 
-	child_in = fdopen(cp.in, "w");
+	child_in = fdopen(dl->cp.in, "w");
 	if (!child_in) {
-		result = 1;
+		dl->result = 1;
 		goto cleanup;
 	}
 
-	child_out = fdopen(cp.out, "r");
-	if (!child_out) {
-		result = 1;
+	dl->out = fdopen(dl->cp.out, "r");
+	if (!dl->out) {
+		dl->result = 1;
 		goto cleanup;
 	}
 
 	fprintf(child_in, "capabilities\n");
 	fflush(child_in);
 
-	while (!strbuf_getline(&line, child_out)) {
+	while (!strbuf_getline(&line, dl->out)) {
 		if (!line.len)
 			break;
 		if (!strcmp(line.buf, "get"))
 			found_get = 1;
+		else if (!strcmp(line.buf, "get-stream"))
+			found_get_stream = 1;
 	}
 	strbuf_release(&line);
 
+	if (!file) {
+		if (!found_get_stream) {
+			dl->result = 1;
+			dl->no_stream = 1;
+			goto cleanup;
+		}
+		fprintf(child_in, "get-stream %s\n", uri);
+		goto cleanup;
+	}
+
 	if (!found_get) {
-		result = error(_("insufficient capabilities"));
+		dl->result = error(_("insufficient capabilities"));
 		goto cleanup;
 	}
 
@@ -334,19 +368,84 @@ static int download_https_uri_to_file(const char *file, const char *uri)
 cleanup:
 	if (child_in)
 		fclose(child_in);
-	if (finish_command(&cp))
-		return 1;
-	if (child_out)
-		fclose(child_out);
-	return result;
+	else
+		close(dl->cp.in);
+}
+
+static int finish_https_download(struct bundle_download *dl)
+{
+	if (!dl->cp.pid)
+		return dl->result;
+	if (finish_command(&dl->cp))
+		dl->result = 1;
+	if (dl->out)
+		fclose(dl->out);
+	else
+		close(dl->cp.out);
+	return dl->result;
+}
+
+/*
+ * The size of what an interrupted download left in "<file>.temp", from
+ * where remote-https resumes it with a range request.
+ */
+static off_t partial_download_size(const char *file)
+{
+	struct stat st;
+	char *temp = xstrfmt("%s.temp", file);
+	off_t size = stat(temp, &st) ? 0 : st.st_size;
+
+	free(temp);
+	return size;
+}
+
+static void unlink_partial_download(const char *file)
+{
+	char *temp = xstrfmt("%s.temp", file);
+
+	unlink(temp);
+	free(temp);
+}
+
+#define BUNDLE_DOWNLOAD_ATTEMPTS 5
+
+static int download_https_uri_to_file(const char *file, const char *uri)
+{
+	off_t partial = partial_download_size(file);
+	int attempts = 0;
+
+	for (;;) {
+		struct bundle_download dl = { .cp = CHILD_PROCESS_INIT };
+		off_t size;
+
+		start_https_download(&dl, file, uri);
+		if (!finish_https_download(&dl))
+			return 0;
+
+		/*
+		 * Try again for as long as the attempts get anywhere, each
+		 * one resuming where the one before it was interrupted. The
+		 * partial download is gone if the server ignored our range,
+		 * and we start over.
+		 */
+		size = partial_download_size(file);
+		if (++attempts >= BUNDLE_DOWNLOAD_ATTEMPTS || size == partial)
+			return 1;
+		partial = size;
+	}
+}
+
+static int is_https_uri(const char *uri)
+{
+	return starts_with(uri, "https:") ||
+	       starts_with(uri, "http:");
 }
 
 static int copy_uri_to_file(const char *filename, const char *uri)
 {
 	const char *out;
 
-	if (starts_with(uri, "https:") ||
-	    starts_with(uri, "http:"))
+	if (is_https_uri(uri))
 		return download_https_uri_to_file(filename, uri);
 
 	if (skip_prefix(uri, "file://", &out))
@@ -356,25 +455,134 @@ static int copy_uri_to_file(const char *filename, const char *uri)
 	return copy_file(filename, uri, 0);
 }
 
-static int unbundle_from_file(struct repository *r, const char *file)
+/*
+ * The bundles that download in the background. At most 'max' of them,
+ * from fetch.bundleParallel, download at once.
+ */
+struct bundle_downloads {
+	struct bundle_download **items;
+	size_t nr, alloc;
+	int max;
+};
+
+static void init_bundle_downloads(struct repository *r,
+				  struct bundle_downloads *downloads)
+{
+	memset(downloads, 0, sizeof(*downloads));
+	if (repo_config_get_int(r, "fetch.bundleparallel", &downloads->max) ||
+	    downloads->max < 1)
+		downloads->max = 1;
+}
+
+static struct bundle_download *take_download(struct bundle_downloads *downloads,
+					     struct remote_bundle_info *bundle)
+{
+	size_t i;
+
+	if (!downloads)
+		return NULL;
+	for (i = 0; i < downloads->nr; i++) {
+		struct bundle_download *dl = downloads->items[i];
+
+		if (dl->bundle != bundle)
+			continue;
+		MOVE_ARRAY(downloads->items + i, downloads->items + i + 1,
+			   downloads->nr - i - 1);
+		downloads->nr--;
+		return dl;
+	}
+	return NULL;
+}
+
+/*
+ * Start downloading the first of 'bundles' that are not downloaded
+ * yet in the background, as long as there is room for them. Only
+ * https bundles download in the background; the others are copied
+ * when we get to them. Downloading one at a time, we rather stream
+ * the bundles into index-pack, see stream_bundle().
+ */
+static void start_downloads(struct bundle_downloads *downloads,
+			    struct remote_bundle_info **bundles, size_t nr)
+{
+	size_t i, j;
+
+	if (downloads->max < 2)
+		return;
+
+	for (i = 0; i < nr && downloads->nr < downloads->max; i++) {
+		struct bundle_download *dl;
+
+		if (bundles[i]->file || !is_https_uri(bundles[i]->uri))
+			continue;
+		for (j = 0; j < downloads->nr; j++)
+			if (downloads->items[j]->bundle == bundles[i])
+				break;
+		if (j < downloads->nr)
+			continue;
+
+		CALLOC_ARRAY(dl, 1);
+		child_process_init(&dl->cp);
+		dl->bundle = bundles[i];
+		if (!(dl->file = find_temp_filename())) {
+			free(dl);
+			return;
+		}
+		start_https_download(dl, dl->file, dl->bundle->uri);
+
+		ALLOC_GROW(downloads->items, downloads->nr + 1,
+			   downloads->alloc);
+		downloads->items[downloads->nr++] = dl;
+	}
+}
+
+/*
+ * Wait for a download that ran in the background, and resume it if it
+ * was interrupted.
+ */
+static int finish_download(struct bundle_download *dl)
+{
+	int result = finish_https_download(dl);
+
+	if (result && partial_download_size(dl->file))
+		result = download_https_uri_to_file(dl->file, dl->bundle->uri);
+	return result;
+}
+
+/* Wait for the downloads that turned out not to be needed. */
+static void release_bundle_downloads(struct bundle_downloads *downloads)
+{
+	size_t i;
+
+	for (i = 0; i < downloads->nr; i++) {
+		struct bundle_download *dl = downloads->items[i];
+
+		finish_https_download(dl);
+		unlink(dl->file);
+		unlink_partial_download(dl->file);
+		free(dl->file);
+		free(dl);
+	}
+	FREE_AND_NULL(downloads->items);
+	downloads->nr = downloads->alloc = 0;
+}
+
+/*
+ * Unbundle the pack that follows the header of a bundle in 'bundle_fd',
+ * which may be a file or the output of a download.
+ */
+static int unbundle_from_fd(struct repository *r,
+			    struct bundle_header *header, int bundle_fd)
 {
-	int result = 0;
-	int bundle_fd;
-	struct bundle_header header = BUNDLE_HEADER_INIT;
 	struct string_list_item *refname;
 	struct strbuf bundle_ref = STRBUF_INIT;
 	size_t bundle_prefix_len;
 
-	if ((bundle_fd = read_bundle_header(file, &header)) < 0)
-		return 1;
-
 	/*
 	 * Skip the reachability walk here, since we will be adding
 	 * a reachable ref pointing to the new tips, which will reach
 	 * the prerequisite commits.
 	 */
-	if ((result = unbundle(r, &header, bundle_fd, NULL,
-			       VERIFY_BUNDLE_QUIET)))
+	if (unbundle(r, header, bundle_fd, NULL, VERIFY_BUNDLE_QUIET))
 		return 1;
 
 	/*
@@ -384,7 +592,7 @@ static int unbundle_from_file(struct repository *r, const char *file)
 	strbuf_addstr(&bundle_ref, "refs/bundles/");
 	bundle_prefix_len = bundle_ref.len;
 
-	for_each_string_list_item(refname, &header.references) {
+	for_each_string_list_item(refname, &header->references) {
 		struct object_id *oid = refname->util;
 		struct object_id old_oid;
 		const char *branch_name;
@@ -403,16 +611,131 @@ static int unbundle_from_file(struct repository *r, const char *file)
 			   UPDATE_REFS_MSG_ON_ERR);
 	}
 
+	strbuf_release(&bundle_ref);
+	return 0;
+}
+
+static int unbundle_from_file(struct repository *r, const char *file)
+{
+	int result;
+	int bundle_fd;
+	struct bundle_header header = BUNDLE_HEADER_INIT;
+
+	if ((bundle_fd = read_bundle_header(file, &header)) < 0)
+		result = 1;
+	else
+		result = unbundle_from_fd(r, &header, bundle_fd);
+
 	bundle_header_release(&header);
 	return result;
 }
 
+/*
+ * Download an https bundle, and unbundle it from the download as it
+ * arrives if we have its prerequisites. This saves writing all of it
+ * to 'bundle->file' and reading it back. Otherwise, e.g. for a bundle
+ * list or a bundle that has to wait for others, write it there just
+ * like copy_uri_to_file() does. Only the header of a bundle is written
+ * either way, for read_bundle_header() to parse.
+ *
+ * Return -1 if the helper cannot stream, with nothing downloaded, and
+ * set 'bundle->unbundled' if the bundle was unbundled.
+ */
+static int stream_bundle(struct repository *r,
+			 struct remote_bundle_info *bundle)
+{
+	struct bundle_download dl = { .cp = CHILD_PROCESS_INIT };
+	struct bundle_header header = BUNDLE_HEADER_INIT;
+	struct strbuf line = STRBUF_INIT;
+	int in, fd, header_fd, result = 0, got_data = 0;
+
+	start_https_download(&dl, NULL, bundle->uri);
+	if (dl.result) {
+		finish_https_download(&dl);
+		return dl.no_stream ? -1 : 1;
+	}
+	in = dl.cp.out;
+
+	fd = open(bundle->file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		error_errno(_("could not create '%s'"), bundle->file);
+		result = 1;
+		goto cleanup;
+	}
+
+	/*
+	 * The header of a bundle starts with its signature and ends with
+	 * an empty line, after which the pack follows.
+	 */
+	for (;;) {
+		int eof = strbuf_getwholeline_fd(&line, in, '\n');
+		int first = !got_data;
+
+		if (line.len) {
+			got_data = 1;
+			if (write_in_full(fd, line.buf, line.len) < 0) {
+				result = 1;
+				break;
+			}
+		}
+		if (eof || !strcmp(line.buf, "\n") ||
+		    (first && !is_bundle(bundle->file, 1)))
+			break;
+	}
+	if (result || strcmp(line.buf, "\n"))
+		goto spool;
+
+	if ((header_fd = read_bundle_header(bundle->file, &header)) < 0)
+		goto spool;
+	close(header_fd);
+	if (verify_bundle(r, &header, VERIFY_BUNDLE_QUIET))
+		goto spool;
+
+	close(fd);
+	fd = -1;
+	if (!unbundle_from_fd(r, &header, dup(in))) {
+		unlink(bundle->file);
+		bundle->unbundled = 1;
+		trace2_data_string("bundle-uri", r, "unbundled-from-download",
+				   bundle->uri);
+	} else
+		result = 1;
+	goto cleanup;
+
+spool:
+	if (!result && copy_fd(in, fd) < 0)
+		result = 1;
+
+cleanup:
+	if (fd >= 0 && close(fd)) {
+		error_errno(_("could not write '%s'"), bundle->file);
+		result = 1;
+	}
+	if (finish_https_download(&dl) && !bundle->unbundled)
+		result = 1;
+
+	/*
+	 * What got lost on the way into index-pack or the file can no
+	 * longer be resumed, but we may download the bundle again. The
+	 * helper would not replace what we wrote.
+	 */
+	if (result && got_data) {
+		unlink(bundle->file);
+		result = download_https_uri_to_file(bundle->file, bundle->uri);
+	}
+
+	bundle_header_release(&header);
+	strbuf_release(&line);
+	return result;
+}
+
 struct bundle_list_context {
 	struct repository *r;
 	struct bundle_list *list;
 	enum bundle_list_mode mode;
 	int count;
 	int depth;
+	struct bundle_downloads *downloads;
 };
 
 /*
@@ -425,7 +748,8 @@ struct bundle_list_context {
 static int fetch_bundle_uri_internal(struct repository *r,
 				     struct remote_bundle_info *bundle,
 				     int depth,
-				     struct bundle_list *list);
+				     struct bundle_list *list,
+				     struct bundle_downloads *downloads);
 
 static int download_bundle_to_file(struct remote_bundle_info *bundle, void *data)
 {
@@ -435,7 +759,8 @@ static int download_bundle_to_file(struct remote_bundle_info *bundle, void *data
 	if (ctx->mode == BUNDLE_MODE_ANY && ctx->count)
 		return 0;
 
-	res = fetch_bundle_uri_internal(ctx->r, bundle, ctx->depth + 1, ctx->list);
+	res = fetch_bundle_uri_internal(ctx->r, bundle, ctx->depth + 1,
+					ctx->list, ctx->downloads);
 
 	/*
 	 * Only increment count if the download succeeded. If our mode is
@@ -489,10 +814,12 @@ static int fetch_bundles_by_token(struct repository *r,
 	int move_direction = 0;
 	const char *creationTokenStr;
 	uint64_t maxCreationToken = 0, newMaxCreationToken = 0;
+	struct bundle_downloads downloads;
 	struct bundle_list_context ctx = {
 		.r = r,
 		.list = list,
 		.mode = list->mode,
+		.downloads = &downloads,
 	};
 	struct bundles_for_sorting bundles = {
 		.alloc = hashmap_get_size(&list->bundles),
@@ -539,10 +866,15 @@ static int fetch_bundles_by_token(struct repository *r,
 	 * If there are existing objects, then this process may terminate
 	 * early when all required commits from "new" bundles exist in the
 	 * repo's object store.
+	 *
+	 * Once we look deeper into the list, the bundles below the current
+	 * one download in the background while we unbundle it.
 	 */
+	init_bundle_downloads(r, &downloads);
 	cur = 0;
 	while (cur >= 0 && cur < bundles.nr) {
 		struct remote_bundle_info *bundle = bundles.items[cur];
+		int unbundled = 0;
 
 		/*
 		 * If we need to dig into bundles below the previous
@@ -560,7 +892,11 @@ static int fetch_bundles_by_token(struct repository *r,
 			 * Note that bundle->file is non-NULL if a download
 			 * was attempted, even if it failed to download.
 			 */
-			if (fetch_bundle_uri_internal(ctx.r, bundle, ctx.depth + 1, ctx.list)) {
+			if (move_direction > 0)
+				start_downloads(&downloads, bundles.items + cur,
+						bundles.nr - cur);
+			if (fetch_bundle_uri_internal(ctx.r, bundle, ctx.depth + 1,
+						      ctx.list, &downloads)) {
 				/* Mark as unbundled so we do not retry. */
 				bundle->unbundled = 1;
 
@@ -569,8 +905,11 @@ static int fetch_bundles_by_token(struct repository *r,
 				goto move;
 			}
 
+			/* It may have been unbundled as it downloaded. */
+			unbundled = bundle->unbundled;
+
 			/* We expect bundles when using creationTokens. */
-			if (!is_bundle(bundle->file, 1)) {
+			if (!unbundled && !is_bundle(bundle->file, 1)) {
 				warning(_("file downloaded from '%s' is not a bundle"),
 					bundle->uri);
 				break;
@@ -582,20 +921,23 @@ static int fetch_bundles_by_token(struct repository *r,
 			 * This was downloaded, but not successfully
 			 * unbundled. Try unbundling again.
 			 */
-			if (unbundle_from_file(ctx.r, bundle->file)) {
+			if (unbundle_from_file(ctx.r, bundle->file))
 				/* Try looking deeper in the list. */
 				move_direction = 1;
-			} else {
-				/*
-				 * Succeeded in unbundle. Retry bundles
-				 * that previously failed to unbundle.
-				 */
-				move_direction = -1;
-				bundle->unbundled = 1;
+			else
+				unbundled = 1;
+		}
 
-				if (bundle->creationToken > newMaxCreationToken)
-					newMaxCreationToken = bundle->creationToken;
-			}
+		if (unbundled) {
+			/*
+			 * Succeeded in unbundle. Retry bundles
+			 * that previously failed to unbundle.
+			 */
+			move_direction = -1;
+			bundle->unbundled = 1;
+
+			if (bundle->creationToken > newMaxCreationToken)
+				newMaxCreationToken = bundle->creationToken;
 		}
 
 		/*
@@ -626,6 +968,7 @@ static int fetch_bundles_by_token(struct repository *r,
 		strbuf_release(&value);
 	}
 
+	release_bundle_downloads(&downloads);
 	free(bundles.items);
 	return cur >= 0;
 }
@@ -635,14 +978,37 @@ static int download_bundle_list(struct repository *r,
 				struct bundle_list *global_list,
 				int depth)
 {
+	struct bundle_downloads downloads;
 	struct bundle_list_context ctx = {
 		.r = r,
 		.list = global_list,
 		.depth = depth + 1,
 		.mode = local_list->mode,
+		.downloads = &downloads,
+	};
+	struct bundles_for_sorting bundles = {
+		.alloc = hashmap_get_size(&local_list->bundles),
 	};
+	size_t i;
+
+	ALLOC_ARRAY(bundles.items, bundles.alloc);
+	for_all_bundles_in_list(local_list, append_bundle, &bundles);
 
-	return for_all_bundles_in_list(local_list, download_bundle_to_file, &ctx);
+	/*
+	 * All of the bundles of an "all" list are needed, so they may as
+	 * well download at the same time.
+	 */
+	init_bundle_downloads(r, &downloads);
+	for (i = 0; i < bundles.nr; i++) {
+		if (ctx.mode == BUNDLE_MODE_ALL)
+			start_downloads(&downloads, bundles.items + i,
+					bundles.nr - i);
+		download_bundle_to_file(bundles.items[i], &ctx);
+	}
+
+	release_bundle_downloads(&downloads);
+	free(bundles.items);
+	return 0;
 }
 
 static int fetch_bundle_list_in_config_format(struct repository *r,
@@ -699,10 +1065,12 @@ static int max_bundle_uri_depth = 4;
 static int fetch_bundle_uri_internal(struct repository *r,
 				     struct remote_bundle_info *bundle,
 				     int depth,
-				     struct bundle_list *list)
+				     struct bundle_list *list,
+				     struct bundle_downloads *downloads)
 {
 	int result = 0;
 	struct remote_bundle_info *bcopy;
+	struct bundle_download *dl;
 
 	if (depth >= max_bundle_uri_depth) {
 		warning(_("exceeded bundle URI recursion limit (%d)"),
@@ -710,18 +1078,28 @@ static int fetch_bundle_uri_internal(struct repository *r,
 		return -1;
 	}
 
-	if (!bundle->file &&
-	    !(bundle->file = find_temp_filename())) {
+	if ((dl = take_download(downloads, bundle))) {
+		bundle->file = dl->file;
+		result = finish_download(dl);
+		free(dl);
+	} else if (!bundle->file &&
+		   !(bundle->file = find_temp_filename())) {
 		result = -1;
 		goto cleanup;
+	} else {
+		result = -1;
+		if (is_https_uri(bundle->uri))
+			result = stream_bundle(r, bundle);
+		if (result < 0)
+			result = copy_uri_to_file(bundle->file, bundle->uri);
 	}
 
-	if ((result = copy_uri_to_file(bundle->file, bundle->uri))) {
+	if (result) {
 		warning(_("failed to download bundle from URI '%s'"), bundle->uri);
 		goto cleanup;
 	}
 
-	if ((result = !is_bundle(bundle->file, 1))) {
+	if (!bundle->unbundled && (result = !is_bundle(bundle->file, 1))) {
 		result = fetch_bundle_list_in_config_format(
 				r, list, bundle, depth);
 		if (result)
@@ -734,12 +1112,15 @@ static int fetch_bundle_uri_internal(struct repository *r,
 	CALLOC_ARRAY(bcopy, 1);
 	bcopy->id = xstrdup(bundle->id);
 	bcopy->file = xstrdup(bundle->file);
+	bcopy->unbundled = bundle->unbundled;
 	hashmap_entry_init(&bcopy->ent, strhash(bcopy->id));
 	hashmap_add(&list->bundles, &bcopy->ent);
 
 cleanup:
-	if (result && bundle->file)
+	if (result && bundle->file) {
 		unlink(bundle->file);
+		unlink_partial_download(bundle->file);
+	}
 	return result;
 }
 
@@ -810,7 +1191,7 @@ int fetch_bundle_uri(struct repository *r, const char *uri,
 	/* If a bundle is added to this global list, then it is required. */
 	list.mode = BUNDLE_MODE_ALL;
 
-	if ((result = fetch_bundle_uri_internal(r, &bundle, 0, &list)))
+	if ((result = fetch_bundle_uri_internal(r, &bundle, 0, &list, NULL)))
 		goto cleanup;
 
 	result = unbundle_all_bundles(r, &list);
@@ -878,10 +1259,10 @@ static int config_to_packet_line(const char *key, const char *value,
 				 const struct config_context *ctx UNUSED,
 				 void *data)
 {
-	struct packet_reader *writer = data;
+	struct packet_writer *writer = data;
 
 	if (starts_with(key, "bundle."))
-		packet_write_fmt(writer->fd, "%s=%s", key, value);
+		packet_writer_write(writer, "%s=%s", key, value);
 
 	return 0;
 }
@@ -891,6 +1272,7 @@ int bundle_uri_command(struct repository *r,
 {
 	struct packet_writer writer;
 	packet_writer_init(&writer, 1);
+	writer.buffered = 1;
 
 	while (packet_reader_read(request) == PACKET_READ_NORMAL)
 		die(_("bundle-uri: unexpected argument: '%s'"), request->line);
@@ -904,6 +1286,7 @@ int bundle_uri_command(struct repository *r,
 	repo_config(r, config_to_packet_line, &writer);
 
 	packet_writer_flush(&writer);
+	packet_writer_release(&writer);
 
 	return 0;
 }
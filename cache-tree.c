@@ -244,6 +244,21 @@ int cache_tree_fully_valid(struct cache_tree *it)
 	return 1;
 }
 
+/*
+ * After "git add" of many files most of the objects the index names are
+ * loose.  Look them up in the loose object cache, which reads each
+ * fan-out directory once, instead of stat()ing every one of them, and
+ * only look harder for the objects it does not know about, like the
+ * trees written since it was filled.
+ */
+static int index_has_object(const struct object_id *oid)
+{
+	return repo_has_object_file_with_flags(the_repository, oid,
+					       OBJECT_INFO_QUICK |
+					       OBJECT_INFO_SKIP_FETCH_OBJECT) ||
+		repo_has_object_file(the_repository, oid);
+}
+
 static int must_check_existence(const struct cache_entry *ce)
 {
 	return !(repo_has_promisor_remote(the_repository) && ce_skip_worktree(ce));
@@ -286,7 +301,7 @@ static int update_one(struct cache_tree *it,
 		}
 	}
 
-	if (0 <= it->entry_count && repo_has_object_file(the_repository, &it->oid))
+	if (0 <= it->entry_count && index_has_object(&it->oid))
 		return it->entry_count;
 
 	/*
@@ -392,7 +407,7 @@ static int update_one(struct cache_tree *it,
 		ce_missing_ok = mode == S_IFGITLINK || missing_ok ||
 			!must_check_existence(ce);
 		if (is_null_oid(oid) ||
-		    (!ce_missing_ok && !repo_has_object_file(the_repository, oid))) {
+		    (!ce_missing_ok && !index_has_object(oid))) {
 			strbuf_release(&buffer);
 			if (expected_missing)
 				return -1;
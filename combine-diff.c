@@ -17,6 +17,7 @@
 #include "userdiff.h"
 #include "oid-array.h"
 #include "revision.h"
+#include "thread-utils.h"
 
 static int compare_paths(const struct combine_diff_path *one,
 			  const struct diff_filespec *two)
@@ -425,6 +426,59 @@ static int consume_line(void *state_, char *line, unsigned long len)
 	return 0;
 }
 
+/*
+ * Assign line numbers for parent "n", once the lines it lost and the ones
+ * added since have been recorded in "sline".
+ *
+ * sline[lno].p_lno[n] records the first line number
+ * (counting from 1) for parent N if the final hunk display
+ * started by showing sline[lno] (possibly showing the lost
+ * lines attached to it first).
+ */
+static void assign_parent_lno(struct sline *sline, unsigned long cnt,
+			      int n, long flags)
+{
+	unsigned long nmask = (1UL << n);
+	unsigned int p_lno, lno;
+
+	for (lno = 0,  p_lno = 1; lno <= cnt; lno++) {
+		struct lline *ll;
+		sline[lno].p_lno[n] = p_lno;
+
+		/* Coalesce new lines */
+		if (sline[lno].plost.lost_head) {
+			struct sline *sl = &sline[lno];
+			sl->lost = coalesce_lines(sl->lost, &sl->lenlost,
+						  sl->plost.lost_head,
+						  sl->plost.len, n, flags);
+			sl->plost.lost_head = sl->plost.lost_tail = NULL;
+			sl->plost.len = 0;
+		}
+
+		/* How many lines would this sline advance the p_lno? */
+		ll = sline[lno].lost;
+		while (ll) {
+			if (ll->parent_map & nmask)
+				p_lno++; /* '-' means parent had it */
+			ll = ll->next;
+		}
+		if (lno < cnt && !(sline[lno].flag & nmask))
+			p_lno++; /* no '+' means parent had it */
+	}
+	sline[lno].p_lno[n] = p_lno; /* trailer */
+}
+
+static void init_combine_diff_state(struct combine_diff_state *state,
+				    struct sline *sline, int n, int num_parent)
+{
+	memset(state, 0, sizeof(*state));
+	state->nmask = (1UL << n);
+	state->sline = sline;
+	state->lno = 1;
+	state->num_parent = num_parent;
+	state->n = n;
+}
+
 static void combine_diff(struct repository *r,
 			 const struct object_id *parent, unsigned int mode,
 			 mmfile_t *result_file,
@@ -433,8 +487,6 @@ static void combine_diff(struct repository *r,
 			 struct userdiff_driver *textconv,
 			 const char *path, long flags)
 {
-	unsigned int p_lno, lno;
-	unsigned long nmask = (1UL << n);
 	xpparam_t xpp;
 	xdemitconf_t xecfg;
 	mmfile_t parent_file;
@@ -449,12 +501,7 @@ static void combine_diff(struct repository *r,
 	memset(&xpp, 0, sizeof(xpp));
 	xpp.flags = flags;
 	memset(&xecfg, 0, sizeof(xecfg));
-	memset(&state, 0, sizeof(state));
-	state.nmask = nmask;
-	state.sline = sline;
-	state.lno = 1;
-	state.num_parent = num_parent;
-	state.n = n;
+	init_combine_diff_state(&state, sline, n, num_parent);
 
 	if (xdi_diff_outf(&parent_file, result_file, consume_hunk,
 			  consume_line, &state, &xpp, &xecfg))
@@ -462,38 +509,7 @@ static void combine_diff(struct repository *r,
 		    oid_to_hex(parent));
 	free(parent_file.ptr);
 
-	/* Assign line numbers for this parent.
-	 *
-	 * sline[lno].p_lno[n] records the first line number
-	 * (counting from 1) for parent N if the final hunk display
-	 * started by showing sline[lno] (possibly showing the lost
-	 * lines attached to it first).
-	 */
-	for (lno = 0,  p_lno = 1; lno <= cnt; lno++) {
-		struct lline *ll;
-		sline[lno].p_lno[n] = p_lno;
-
-		/* Coalesce new lines */
-		if (sline[lno].plost.lost_head) {
-			struct sline *sl = &sline[lno];
-			sl->lost = coalesce_lines(sl->lost, &sl->lenlost,
-						  sl->plost.lost_head,
-						  sl->plost.len, n, flags);
-			sl->plost.lost_head = sl->plost.lost_tail = NULL;
-			sl->plost.len = 0;
-		}
-
-		/* How many lines would this sline advance the p_lno? */
-		ll = sline[lno].lost;
-		while (ll) {
-			if (ll->parent_map & nmask)
-				p_lno++; /* '-' means parent had it */
-			ll = ll->next;
-		}
-		if (lno < cnt && !(sline[lno].flag & nmask))
-			p_lno++; /* no '+' means parent had it */
-	}
-	sline[lno].p_lno[n] = p_lno; /* trailer */
+	assign_parent_lno(sline, cnt, n, flags);
 }
 
 static unsigned long context = 3;
@@ -1017,6 +1033,242 @@ static void show_combined_header(struct combine_diff_path *elem,
 				 line_prefix, c_meta, c_reset);
 }
 
+/* Files smaller than this are diffed against the parents in one thread. */
+#define COMBINE_DIFF_THREADS_MIN_SIZE (64 * 1024)
+
+/*
+ * An instruction of the diff against one parent: a hunk header, a line
+ * lost from the parent, or a run of lines added to the result.
+ */
+struct combine_diff_op {
+	char type; /* '@', '-' or '+' */
+	long ob, on, nb, nn;
+	/* the lost line, with its '-', in the "lost" buffer of the parent */
+	size_t lost, len;
+	unsigned long added;
+};
+
+/*
+ * The diff against one parent, computed in a thread and recorded to be
+ * fed to consume_hunk() and consume_line() in the order of the parents,
+ * as the lines lost from the parents are coalesced in that order.
+ */
+struct parent_diff {
+	mmfile_t file;
+	struct combine_diff_op *ops;
+	size_t ops_nr, ops_alloc;
+	struct strbuf lost;
+};
+
+struct combine_diff_threads {
+	struct combine_diff_path *elem;
+	struct parent_diff *parents;
+	int num_parent;
+	mmfile_t *result_file;
+	long flags;
+	int next;
+	pthread_mutex_t mutex;
+};
+
+static void record_hunk(void *data,
+			long ob, long on, long nb, long nn,
+			const char *func UNUSED, long funclen UNUSED)
+{
+	struct parent_diff *parent = data;
+	struct combine_diff_op *op;
+
+	ALLOC_GROW(parent->ops, parent->ops_nr + 1, parent->ops_alloc);
+	op = &parent->ops[parent->ops_nr++];
+	memset(op, 0, sizeof(*op));
+	op->type = '@';
+	op->ob = ob;
+	op->on = on;
+	op->nb = nb;
+	op->nn = nn;
+}
+
+static int record_line(void *data, char *line, unsigned long len)
+{
+	struct parent_diff *parent = data;
+	struct combine_diff_op *op;
+
+	if (line[0] == '+' && parent->ops_nr &&
+	    parent->ops[parent->ops_nr - 1].type == '+') {
+		parent->ops[parent->ops_nr - 1].added++;
+		return 0;
+	}
+	if (line[0] != '+' && line[0] != '-')
+		return 0; /* consume_line() ignores them, too */
+
+	ALLOC_GROW(parent->ops, parent->ops_nr + 1, parent->ops_alloc);
+	op = &parent->ops[parent->ops_nr++];
+	memset(op, 0, sizeof(*op));
+	op->type = line[0];
+	if (op->type == '+') {
+		op->added = 1;
+	} else {
+		op->lost = parent->lost.len;
+		op->len = len;
+		strbuf_add(&parent->lost, line, len);
+	}
+	return 0;
+}
+
+static void replay_combine_diff(struct parent_diff *parent,
+				struct sline *sline, int n, int num_parent)
+{
+	struct combine_diff_state state;
+	char added[] = "+";
+	size_t i;
+
+	init_combine_diff_state(&state, sline, n, num_parent);
+	for (i = 0; i < parent->ops_nr; i++) {
+		struct combine_diff_op *op = &parent->ops[i];
+		unsigned long k;
+
+		switch (op->type) {
+		case '@':
+			consume_hunk(&state, op->ob, op->on, op->nb, op->nn,
+				     NULL, 0);
+			break;
+		case '-':
+			consume_line(&state, parent->lost.buf + op->lost, op->len);
+			break;
+		case '+':
+			for (k = 0; k < op->added; k++)
+				consume_line(&state, added, 1);
+			break;
+		}
+	}
+}
+
+static void *combine_diff_thread(void *arg)
+{
+	struct combine_diff_threads *st = arg;
+
+	for (;;) {
+		struct parent_diff *parent;
+		xpparam_t xpp;
+		xdemitconf_t xecfg;
+		int i = -1;
+
+		pthread_mutex_lock(&st->mutex);
+		while (st->next < st->num_parent &&
+		       !st->parents[st->next].file.ptr)
+			st->next++;
+		if (st->next < st->num_parent)
+			i = st->next++;
+		pthread_mutex_unlock(&st->mutex);
+		if (i < 0)
+			break;
+
+		parent = &st->parents[i];
+		memset(&xpp, 0, sizeof(xpp));
+		xpp.flags = st->flags;
+		memset(&xecfg, 0, sizeof(xecfg));
+		if (xdi_diff_outf(&parent->file, st->result_file, record_hunk,
+				  record_line, parent, &xpp, &xecfg))
+			die("unable to generate combined diff for %s",
+			    oid_to_hex(&st->elem->parent[i].oid));
+	}
+	return NULL;
+}
+
+/* Return the first parent of "elem" with the same blob as parent "i". */
+static int first_same_parent(struct combine_diff_path *elem, int i)
+{
+	int j;
+
+	for (j = 0; j < i; j++)
+		if (oideq(&elem->parent[i].oid, &elem->parent[j].oid))
+			break;
+	return j;
+}
+
+static int combine_diff_threads_nr(struct diff_options *opt,
+				   struct combine_diff_path *elem,
+				   int num_parent, unsigned long result_size,
+				   int result_deleted)
+{
+	int nr_threads = opt->combined_threads;
+	int i, nr = 0;
+
+	if (!HAVE_THREADS || result_deleted ||
+	    result_size < COMBINE_DIFF_THREADS_MIN_SIZE)
+		return 1;
+	for (i = 0; i < num_parent; i++)
+		if (first_same_parent(elem, i) == i)
+			nr++;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads < nr ? nr_threads : nr;
+}
+
+/*
+ * Do what combine_diff() does for every parent, but run the diffs in
+ * "nr_threads" threads. The blobs are read beforehand, as textconv and
+ * the object store are not to be used in the threads.
+ */
+static void combine_diff_in_threads(struct repository *r,
+				    struct combine_diff_path *elem,
+				    mmfile_t *result_file,
+				    struct sline *sline, unsigned long cnt,
+				    int num_parent,
+				    struct userdiff_driver *textconv,
+				    long flags, int nr_threads)
+{
+	struct combine_diff_threads st = {
+		.elem = elem,
+		.num_parent = num_parent,
+		.result_file = result_file,
+		.flags = flags,
+	};
+	pthread_t *threads;
+	int i, j, ret;
+
+	CALLOC_ARRAY(st.parents, num_parent);
+	for (i = 0; i < num_parent; i++) {
+		struct parent_diff *parent = &st.parents[i];
+		unsigned long sz;
+
+		strbuf_init(&parent->lost, 0);
+		if (first_same_parent(elem, i) < i)
+			continue;
+		parent->file.ptr = grab_blob(r, &elem->parent[i].oid,
+					     elem->parent[i].mode, &sz,
+					     textconv, elem->path);
+		parent->file.size = sz;
+	}
+
+	pthread_mutex_init(&st.mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL, combine_diff_thread, &st);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&st.mutex);
+
+	for (i = 0; i < num_parent; i++) {
+		struct parent_diff *parent = &st.parents[i];
+
+		j = first_same_parent(elem, i);
+		if (j < i) {
+			reuse_combine_diff(sline, cnt, i, j);
+		} else {
+			replay_combine_diff(parent, sline, i, num_parent);
+			assign_parent_lno(sline, cnt, i, flags);
+		}
+		free(parent->file.ptr);
+		free(parent->ops);
+		strbuf_release(&parent->lost);
+	}
+	free(st.parents);
+}
+
 static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 			    int working_tree_file,
 			    struct rev_info *rev)
@@ -1027,7 +1279,7 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	char *result, *cp;
 	struct sline *sline; /* survived lines */
 	int mode_differs = 0;
-	int i, show_hunks;
+	int i, show_hunks, nr_threads;
 	mmfile_t result_file;
 	struct userdiff_driver *userdiff;
 	struct userdiff_driver *textconv = NULL;
@@ -1188,23 +1440,25 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	for (lno = 0; lno <= cnt; lno++)
 		sline[lno+1].p_lno = sline[lno].p_lno + num_parent;
 
-	for (i = 0; i < num_parent; i++) {
-		int j;
-		for (j = 0; j < i; j++) {
-			if (oideq(&elem->parent[i].oid,
-				  &elem->parent[j].oid)) {
+	nr_threads = combine_diff_threads_nr(opt, elem, num_parent,
+					     result_size, result_deleted);
+	if (nr_threads > 1)
+		combine_diff_in_threads(opt->repo, elem, &result_file, sline,
+					cnt, num_parent, textconv,
+					opt->xdl_opts, nr_threads);
+	else
+		for (i = 0; i < num_parent; i++) {
+			int j = first_same_parent(elem, i);
+			if (j < i)
 				reuse_combine_diff(sline, cnt, i, j);
-				break;
-			}
+			else
+				combine_diff(opt->repo,
+					     &elem->parent[i].oid,
+					     elem->parent[i].mode,
+					     &result_file, sline,
+					     cnt, i, num_parent, result_deleted,
+					     textconv, elem->path, opt->xdl_opts);
 		}
-		if (i <= j)
-			combine_diff(opt->repo,
-				     &elem->parent[i].oid,
-				     elem->parent[i].mode,
-				     &result_file, sline,
-				     cnt, i, num_parent, result_deleted,
-				     textconv, elem->path, opt->xdl_opts);
-	}
 
 	show_hunks = make_hunks(sline, cnt, num_parent, rev->dense_combined_merges);
 
@@ -26,6 +26,9 @@
 #include "trace2.h"
 #include "tree.h"
 #include "chunk-format.h"
+#include "tree-cache.h"
+#include "diff.h"
+#include "diffcore.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -47,6 +50,10 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
 #define GRAPH_CHUNKID_GENERATION_DATA 0x47444132 /* "GDA2" */
 #define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f32 /* "GDO2" */
+#define GRAPH_CHUNKID_FIRST_PARENT_GENERATION 0x46504731 /* "FPG1" */
+#define GRAPH_CHUNKID_REACHABILITY 0x52454143 /* "REAC" */
+#define GRAPH_CHUNKID_RENAMEINDEXES 0x524e4958 /* "RNIX" */
+#define GRAPH_CHUNKID_RENAMEDATA 0x524e4441 /* "RNDA" */
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
@@ -75,6 +82,22 @@ void git_test_write_commit_graph_or_die(void)
 
 define_commit_slab(topo_level_slab, uint32_t);
 
+/*
+ * The reachability labels of a commit come from a depth-first search
+ * over parents: "post" is its 1-based post-order number, "low" the
+ * smallest post-order number in the subtree of the search below it, and
+ * "dag_low" the smallest post-order number of any of its ancestors.
+ */
+struct reachability_label {
+	uint32_t post;
+	uint32_t low;
+	uint32_t dag_low;
+};
+
+#define REACHABILITY_LABEL_WIDTH (3 * sizeof(uint32_t))
+
+define_commit_slab(reachability_label_slab, struct reachability_label);
+
 /* Keep track of the order in which commits are added to our list. */
 define_commit_slab(commit_pos, int);
 static struct commit_pos commit_pos = COMMIT_SLAB_INIT(1, commit_pos);
@@ -109,6 +132,15 @@ static int get_configured_generation_version(struct repository *r)
 	return version;
 }
 
+static int get_configured_changed_paths_version(struct repository *r)
+{
+	int version = BLOOM_HASH_VERSION_MURMUR3;
+	repo_config_get_int(r, "commitgraph.changedpathsversion", &version);
+	if (version != BLOOM_HASH_VERSION_BLOCKED)
+		version = BLOOM_HASH_VERSION_MURMUR3;
+	return version;
+}
+
 uint32_t commit_graph_position(const struct commit *c)
 {
 	struct commit_graph_data *data =
@@ -128,6 +160,127 @@ timestamp_t commit_graph_generation(const struct commit *c)
 	return GENERATION_NUMBER_INFINITY;
 }
 
+uint32_t commit_graph_first_parent_generation(const struct commit *c)
+{
+	struct commit_graph_data *data =
+		commit_graph_data_slab_peek(&commit_graph_data_slab, c);
+
+	return data ? data->first_parent_generation : 0;
+}
+
+static void reachability_label_at(const struct commit_graph *g,
+				  uint32_t lex_index,
+				  struct reachability_label *label)
+{
+	const unsigned char *data = g->chunk_reachability +
+		st_mult(REACHABILITY_LABEL_WIDTH, lex_index);
+
+	label->post = get_be32(data);
+	label->low = get_be32(data + 4);
+	label->dag_low = get_be32(data + 8);
+}
+
+static int read_reachability_label(struct repository *r,
+				   const struct commit *c,
+				   struct reachability_label *label)
+{
+	struct commit_graph *g = r->objects->commit_graph;
+	uint32_t pos = commit_graph_position(c);
+
+	if (!g || pos == COMMIT_NOT_FROM_GRAPH)
+		return 0;
+
+	/* Only the base layer is closed under reachability. */
+	while (g->base_graph)
+		g = g->base_graph;
+	if (!g->chunk_reachability || pos >= g->num_commits)
+		return 0;
+
+	reachability_label_at(g, pos, label);
+	return 1;
+}
+
+int commit_graph_can_reach(struct repository *r,
+			   const struct commit *from,
+			   const struct commit *to)
+{
+	struct reachability_label f, t;
+
+	if (!read_reachability_label(r, from, &f) ||
+	    !read_reachability_label(r, to, &t))
+		return -1;
+
+	/* "to" is in the subtree of the search below "from". */
+	if (f.low <= t.post && t.post <= f.post)
+		return 1;
+
+	/* All ancestors of "from" are numbered in this range. */
+	if (t.post < f.dag_low || t.post > f.post)
+		return 0;
+
+	return -1;
+}
+
+/*
+ * Find the renames recorded for the commit at "graph_pos": a sequence of
+ * NUL-terminated destination and source paths between "*start" and
+ * "*end". Returns -1 if the layer of the commit has none recorded.
+ */
+static int renames_from_graph(struct commit_graph *g, uint32_t graph_pos,
+			      const char **start, const char **end)
+{
+	uint32_t lex_pos, start_index, end_index;
+
+	while (g && graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || !g->chunk_rename_indexes ||
+	    graph_pos >= g->num_commits + g->num_commits_in_base)
+		return -1;
+
+	lex_pos = graph_pos - g->num_commits_in_base;
+	end_index = get_be32(g->chunk_rename_indexes + 4 * lex_pos);
+	start_index = lex_pos ?
+		get_be32(g->chunk_rename_indexes + 4 * (lex_pos - 1)) : 0;
+
+	if (end_index < start_index ||
+	    end_index > g->chunk_rename_data_size ||
+	    (end_index > start_index &&
+	     g->chunk_rename_data[end_index - 1] != '\0')) {
+		warning(_("ignoring out-of-range renames in commit-graph file '%s'"),
+			g->filename);
+		return -1;
+	}
+
+	*start = (const char *)g->chunk_rename_data + start_index;
+	*end = (const char *)g->chunk_rename_data + end_index;
+	return 0;
+}
+
+int commit_graph_rename_source(struct repository *r, struct commit *c,
+			       const char *path, const char **from)
+{
+	const char *p, *end;
+	uint32_t graph_pos;
+
+	if (!repo_find_commit_pos_in_graph(r, c, &graph_pos) ||
+	    renames_from_graph(r->objects->commit_graph, graph_pos, &p, &end))
+		return -1;
+
+	while (p < end) {
+		const char *dst = p;
+		const char *src = dst + strlen(dst) + 1;
+
+		if (src >= end)
+			return -1;
+		p = src + strlen(src) + 1;
+		if (!strcmp(dst, path)) {
+			*from = src;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static timestamp_t commit_graph_generation_from_graph(const struct commit *c)
 {
 	struct commit_graph_data *data =
@@ -329,6 +482,47 @@ static int graph_read_generation_data(const unsigned char *chunk_start,
 	return 0;
 }
 
+static int graph_read_first_parent_generation(const unsigned char *chunk_start,
+					      size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / sizeof(uint32_t) != g->num_commits)
+		return error(_("commit-graph first-parent generations chunk is wrong size"));
+	g->chunk_first_parent_generation = chunk_start;
+	return 0;
+}
+
+static int graph_read_reachability(const unsigned char *chunk_start,
+				   size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / REACHABILITY_LABEL_WIDTH != g->num_commits)
+		return error(_("commit-graph reachability chunk is wrong size"));
+	g->chunk_reachability = chunk_start;
+	return 0;
+}
+
+static int graph_read_rename_index(const unsigned char *chunk_start,
+				   size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	if (chunk_size / 4 != g->num_commits) {
+		warning(_("commit-graph rename index chunk is too small"));
+		return -1;
+	}
+	g->chunk_rename_indexes = chunk_start;
+	return 0;
+}
+
+static int graph_read_rename_data(const unsigned char *chunk_start,
+				  size_t chunk_size, void *data)
+{
+	struct commit_graph *g = data;
+	g->chunk_rename_data = chunk_start;
+	g->chunk_rename_data_size = chunk_size;
+	return 0;
+}
+
 static int graph_read_bloom_index(const unsigned char *chunk_start,
 				  size_t chunk_size, void *data)
 {
@@ -359,7 +553,8 @@ static int graph_read_bloom_data(const unsigned char *chunk_start,
 	g->chunk_bloom_data_size = chunk_size;
 	hash_version = get_be32(chunk_start);
 
-	if (hash_version != 1)
+	if (hash_version != BLOOM_HASH_VERSION_MURMUR3 &&
+	    hash_version != BLOOM_HASH_VERSION_BLOCKED)
 		return 0;
 
 	g->bloom_filter_settings = xmalloc(sizeof(struct bloom_filter_settings));
@@ -460,6 +655,24 @@ struct commit_graph *parse_commit_graph(struct repo_settings *s,
 			graph->read_generation_data = 1;
 	}
 
+	read_chunk(cf, GRAPH_CHUNKID_FIRST_PARENT_GENERATION,
+		   graph_read_first_parent_generation, graph);
+	if (graph->chunk_first_parent_generation)
+		graph->read_first_parent_generation = 1;
+
+	read_chunk(cf, GRAPH_CHUNKID_REACHABILITY,
+		   graph_read_reachability, graph);
+
+	read_chunk(cf, GRAPH_CHUNKID_RENAMEINDEXES,
+		   graph_read_rename_index, graph);
+	read_chunk(cf, GRAPH_CHUNKID_RENAMEDATA,
+		   graph_read_rename_data, graph);
+	if (!graph->chunk_rename_indexes || !graph->chunk_rename_data) {
+		graph->chunk_rename_indexes = NULL;
+		graph->chunk_rename_data = NULL;
+		graph->chunk_rename_data_size = 0;
+	}
+
 	if (s->commit_graph_read_changed_paths) {
 		read_chunk(cf, GRAPH_CHUNKID_BLOOMINDEXES,
 			   graph_read_bloom_index, graph);
@@ -544,6 +757,25 @@ static int validate_mixed_generation_chain(struct commit_graph *g)
 	return 0;
 }
 
+/*
+ * First-parent generations are only used if all graphs in the chain
+ * store them, as those of a layer build on those of its base layers.
+ */
+static int validate_first_parent_generation_chain(struct commit_graph *g)
+{
+	struct commit_graph *p;
+
+	for (p = g; p; p = p->base_graph)
+		if (!p->read_first_parent_generation)
+			break;
+	if (!p)
+		return 1;
+
+	for (; g; g = g->base_graph)
+		g->read_first_parent_generation = 0;
+	return 0;
+}
+
 static int add_graph_to_chain(struct commit_graph *g,
 			      struct commit_graph *chain,
 			      struct object_id *oids,
@@ -667,6 +899,7 @@ struct commit_graph *load_commit_graph_chain_fd_st(struct repository *r,
 	}
 
 	validate_mixed_generation_chain(graph_chain);
+	validate_first_parent_generation_chain(graph_chain);
 
 	free(oids);
 	fclose(fp);
@@ -897,6 +1130,11 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 	} else
 		graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
 
+	if (g->read_first_parent_generation)
+		graph_data->first_parent_generation =
+			get_be32(g->chunk_first_parent_generation +
+				 st_mult(sizeof(uint32_t), lex_index));
+
 	if (g->topo_levels)
 		*topo_level_slab_at(g->topo_levels, item) = get_be32(commit_data + g->hash_len + 8) >> 2;
 }
@@ -1134,9 +1372,15 @@ struct write_commit_graph_context {
 		 changed_paths:1,
 		 order_by_pack:1,
 		 write_generation_data:1,
+		 write_first_parent_generation:1,
+		 write_reachability:1,
+		 write_renames:1,
 		 trust_generation_numbers:1;
 
 	struct topo_level_slab *topo_levels;
+	struct reachability_label_slab reachability_labels;
+	uint32_t *rename_indexes;
+	struct strbuf rename_data;
 	const struct commit_graph_opts *opts;
 	size_t total_bloom_filter_data_size;
 	const struct bloom_filter_settings *bloom_settings;
@@ -1321,6 +1565,40 @@ static int write_graph_chunk_generation_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_first_parent_generation(struct hashfile *f,
+						     void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, commit_graph_data_at(c)->first_parent_generation);
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_reachability(struct hashfile *f,
+					  void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct reachability_label *label =
+			reachability_label_slab_at(&ctx->reachability_labels,
+						   ctx->commits.list[i]);
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, label->post);
+		hashwrite_be32(f, label->low);
+		hashwrite_be32(f, label->dag_low);
+	}
+
+	return 0;
+}
+
 static int write_graph_chunk_generation_data_overflow(struct hashfile *f,
 						      void *data)
 {
@@ -1395,6 +1673,38 @@ static int write_graph_chunk_extra_edges(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_rename_indexes(struct hashfile *f,
+					    void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, ctx->rename_indexes[i]);
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_rename_data(struct hashfile *f,
+					 void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	uint32_t start = 0;
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		uint32_t end = ctx->rename_indexes[i];
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite(f, ctx->rename_data.buf + start, end - start);
+		start = end;
+	}
+
+	return 0;
+}
+
 static int write_graph_chunk_bloom_indexes(struct hashfile *f,
 					   void *data)
 {
@@ -1404,7 +1714,8 @@ static int write_graph_chunk_bloom_indexes(struct hashfile *f,
 	uint32_t cur_pos = 0;
 
 	while (list < last) {
-		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list);
+		struct bloom_filter *filter = get_or_compute_bloom_filter(
+			ctx->r, *list, 0, ctx->bloom_settings, NULL);
 		size_t len = filter ? filter->len : 0;
 		cur_pos += len;
 		display_progress(ctx->progress, ++ctx->progress_cnt);
@@ -1445,7 +1756,8 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	hashwrite_be32(f, ctx->bloom_settings->bits_per_entry);
 
 	while (list < last) {
-		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list);
+		struct bloom_filter *filter = get_or_compute_bloom_filter(
+			ctx->r, *list, 0, ctx->bloom_settings, NULL);
 		size_t len = filter ? filter->len : 0;
 
 		display_progress(ctx->progress, ++ctx->progress_cnt);
@@ -1713,6 +2025,221 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 	stop_progress(&ctx->progress);
 }
 
+/*
+ * Walk down the first-parent history of each commit until a commit
+ * whose first-parent generation is known, either computed here or read
+ * from a layer of the commit-graph, and number the commits on the way
+ * back up.
+ */
+static void compute_first_parent_generations(struct write_commit_graph_context *ctx)
+{
+	struct commit **stack = NULL;
+	size_t nr = 0, alloc = 0;
+	int i;
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+					_("Computing commit graph first-parent generations"),
+					ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		uint32_t gen = 0;
+
+		display_progress(ctx->progress, i + 1);
+
+		while (c) {
+			repo_parse_commit(ctx->r, c);
+			gen = commit_graph_data_at(c)->first_parent_generation;
+			if (gen)
+				break;
+			ALLOC_GROW(stack, nr + 1, alloc);
+			stack[nr++] = c;
+			c = c->parents ? c->parents->item : NULL;
+		}
+
+		while (nr) {
+			if (gen < UINT32_MAX)
+				gen++;
+			commit_graph_data_at(stack[--nr])->first_parent_generation = gen;
+		}
+	}
+
+	free(stack);
+	stop_progress(&ctx->progress);
+}
+
+static int topo_level_desc_cmp(const void *va, const void *vb, void *data)
+{
+	struct topo_level_slab *topo_levels = data;
+	uint32_t a = *topo_level_slab_at(topo_levels, *(struct commit **)va);
+	uint32_t b = *topo_level_slab_at(topo_levels, *(struct commit **)vb);
+
+	return a < b ? 1 : a > b ? -1 : 0;
+}
+
+/*
+ * Label the commits with the post-order numbers of a depth-first search
+ * over their parents (see struct reachability_label). Every commit
+ * finishes after all of its ancestors, so those are numbered below it,
+ * from its "dag_low" up; the ones that the search reached through it
+ * form the unbroken range from its "low" up. The search starts from
+ * the commits with the highest topological levels, so that most
+ * commits end up below a few large subtrees.
+ */
+static void compute_reachability_labels(struct write_commit_graph_context *ctx)
+{
+	struct commit **sorted;
+	struct reachability_stack_entry {
+		struct commit *commit;
+		struct commit_list *parent;
+	} *stack = NULL;
+	size_t nr = 0, alloc = 0;
+	uint32_t counter = 0;
+	int i;
+
+	init_reachability_label_slab(&ctx->reachability_labels);
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+					_("Computing commit graph reachability labels"),
+					ctx->commits.nr);
+
+	DUP_ARRAY(sorted, ctx->commits.list, ctx->commits.nr);
+	QSORT_S(sorted, ctx->commits.nr, topo_level_desc_cmp, ctx->topo_levels);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct reachability_label *label =
+			reachability_label_slab_at(&ctx->reachability_labels,
+						   sorted[i]);
+		if (label->low)
+			continue;
+
+		label->low = label->dag_low = counter + 1;
+		ALLOC_GROW(stack, nr + 1, alloc);
+		stack[nr].commit = sorted[i];
+		stack[nr].parent = sorted[i]->parents;
+		nr++;
+
+		while (nr) {
+			struct reachability_stack_entry *top = &stack[nr - 1];
+			struct reachability_label *top_label =
+				reachability_label_slab_at(&ctx->reachability_labels,
+							   top->commit);
+			struct commit *parent;
+			struct reachability_label *parent_label;
+
+			if (!top->parent) {
+				top_label->post = ++counter;
+				display_progress(ctx->progress, counter);
+				nr--;
+				if (nr) {
+					struct reachability_label *child_label =
+						reachability_label_slab_at(&ctx->reachability_labels,
+									   stack[nr - 1].commit);
+					if (top_label->dag_low < child_label->dag_low)
+						child_label->dag_low = top_label->dag_low;
+				}
+				continue;
+			}
+
+			parent = top->parent->item;
+			top->parent = top->parent->next;
+			repo_parse_commit(ctx->r, parent);
+			parent_label = reachability_label_slab_at(&ctx->reachability_labels,
+								  parent);
+
+			if (!parent_label->low) {
+				parent_label->low = parent_label->dag_low = counter + 1;
+				ALLOC_GROW(stack, nr + 1, alloc);
+				stack[nr].commit = parent;
+				stack[nr].parent = parent->parents;
+				nr++;
+			} else if (parent_label->dag_low < top_label->dag_low) {
+				top_label->dag_low = parent_label->dag_low;
+			}
+		}
+	}
+
+	free(sorted);
+	free(stack);
+	stop_progress(&ctx->progress);
+}
+
+static void add_commit_renames(struct repository *r, struct commit *c,
+			       struct strbuf *out)
+{
+	struct diff_options diffopt;
+	struct commit *parent;
+	int i;
+
+	if (!c->parents)
+		return;
+	parent = c->parents->item;
+	if (repo_parse_commit(r, parent))
+		die(_("unable to parse commit %s"),
+		    oid_to_hex(&parent->object.oid));
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.detect_rename = DIFF_DETECT_RENAME;
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diffopt);
+
+	diff_tree_oid(get_commit_tree_oid(parent), get_commit_tree_oid(c),
+		      "", &diffopt);
+	diffcore_std(&diffopt);
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+
+		if (p->status != DIFF_STATUS_RENAMED &&
+		    p->status != DIFF_STATUS_COPIED)
+			continue;
+		strbuf_add(out, p->two->path, strlen(p->two->path) + 1);
+		strbuf_add(out, p->one->path, strlen(p->one->path) + 1);
+	}
+	diff_flush(&diffopt);
+}
+
+/*
+ * Record which paths each commit renamed or copied from its first
+ * parent, as "git blame" would find them. Commits that come from a
+ * layer that has them recorded already keep those.
+ */
+static void compute_renames(struct write_commit_graph_context *ctx)
+{
+	struct commit_graph *g = ctx->r->objects->commit_graph;
+	int i;
+
+	ALLOC_ARRAY(ctx->rename_indexes, ctx->commits.nr);
+	strbuf_init(&ctx->rename_data, 0);
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+					_("Detecting renames in commits"),
+					ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		uint32_t pos = commit_graph_position(c);
+		const char *start, *end;
+
+		if (pos != COMMIT_NOT_FROM_GRAPH &&
+		    !renames_from_graph(g, pos, &start, &end))
+			strbuf_add(&ctx->rename_data, start, end - start);
+		else
+			add_commit_renames(ctx->r, c, &ctx->rename_data);
+
+		if (ctx->rename_data.len > UINT32_MAX)
+			die(_("too many renames for the commit-graph"));
+		ctx->rename_indexes[i] = ctx->rename_data.len;
+		display_progress(ctx->progress, i + 1);
+	}
+
+	stop_progress(&ctx->progress);
+}
+
 static void set_generation_in_graph_data(struct commit *c, timestamp_t t,
 					 void *data UNUSED)
 {
@@ -1759,7 +2286,8 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
-	int max_new_filters;
+	enum bloom_filter_computed *computed_in_threads;
+	int max_new_filters, nr_threads;
 
 	init_bloom_filters();
 
@@ -1778,15 +2306,34 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	if (repo_config_get_int(ctx->r, "commitgraph.threads", &nr_threads) ||
+	    !nr_threads)
+		nr_threads = online_cpus();
+	CALLOC_ARRAY(computed_in_threads, ctx->commits.nr);
+	if (compute_bloom_filters_in_threads(ctx->r, sorted_commits,
+					     ctx->commits.nr, max_new_filters,
+					     ctx->bloom_settings,
+					     computed_in_threads,
+					     nr_threads) < 0)
+		FREE_AND_NULL(computed_in_threads);
+
 	for (i = 0; i < ctx->commits.nr; i++) {
 		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
+		struct bloom_filter *filter;
+
+		if (computed_in_threads) {
+			filter = get_or_compute_bloom_filter(
+				ctx->r, c, 0, ctx->bloom_settings, NULL);
+			computed = computed_in_threads[i];
+		} else {
+			filter = get_or_compute_bloom_filter(
+				ctx->r,
+				c,
+				ctx->count_bloom_filter_computed < max_new_filters,
+				ctx->bloom_settings,
+				&computed);
+		}
 		if (computed & BLOOM_COMPUTED) {
 			ctx->count_bloom_filter_computed++;
 			if (computed & BLOOM_TRUNC_EMPTY)
@@ -1803,6 +2350,7 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
+	free(computed_in_threads);
 	free(sorted_commits);
 	stop_progress(&progress);
 }
@@ -2069,6 +2617,22 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 		add_chunk(cf, GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW,
 			  st_mult(sizeof(timestamp_t), ctx->num_generation_data_overflows),
 			  write_graph_chunk_generation_data_overflow);
+	if (ctx->write_first_parent_generation)
+		add_chunk(cf, GRAPH_CHUNKID_FIRST_PARENT_GENERATION,
+			  st_mult(sizeof(uint32_t), ctx->commits.nr),
+			  write_graph_chunk_first_parent_generation);
+	if (ctx->write_reachability)
+		add_chunk(cf, GRAPH_CHUNKID_REACHABILITY,
+			  st_mult(REACHABILITY_LABEL_WIDTH, ctx->commits.nr),
+			  write_graph_chunk_reachability);
+	if (ctx->write_renames) {
+		add_chunk(cf, GRAPH_CHUNKID_RENAMEINDEXES,
+			  st_mult(sizeof(uint32_t), ctx->commits.nr),
+			  write_graph_chunk_rename_indexes);
+		add_chunk(cf, GRAPH_CHUNKID_RENAMEDATA,
+			  ctx->rename_data.len,
+			  write_graph_chunk_rename_data);
+	}
 	if (ctx->num_extra_edges)
 		add_chunk(cf, GRAPH_CHUNKID_EXTRAEDGES,
 			  st_mult(4, ctx->num_extra_edges),
@@ -2182,18 +2746,71 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	return 0;
 }
 
+/*
+ * Return the number of layers at the top of the chain "g" that have to
+ * be merged so that no layer (of "odb") has a base with at most
+ * "size_mult" times as many commits as itself. Such layers are left
+ * behind by writes with a merge limit, which skip the merges that would
+ * rewrite too many commits.
+ */
+static uint32_t count_pending_merges(struct commit_graph *g,
+				     struct object_directory *odb,
+				     int size_mult)
+{
+	uint32_t depth, pending = 0;
+
+	for (depth = 0; g && g->base_graph; depth++, g = g->base_graph) {
+		if (g->odb != odb || g->base_graph->odb != odb)
+			break;
+		if (g->base_graph->num_commits <= st_mult(size_mult, g->num_commits))
+			pending = depth + 2;
+	}
+	return pending;
+}
+
+int commit_graph_merge_pending(struct repository *r)
+{
+	if (!prepare_commit_graph(r))
+		return 0;
+	return !!count_pending_merges(r->objects->commit_graph,
+				      r->objects->odb, 2);
+}
+
+/*
+ * Return the number of layers a split write has to merge to catch up,
+ * unless its options say not to merge them now.
+ */
+static uint32_t pending_split_merges(struct write_commit_graph_context *ctx)
+{
+	int size_mult = 2;
+
+	if (!ctx->split)
+		return 0;
+	if (ctx->opts) {
+		if (ctx->opts->merge_limit ||
+		    ctx->opts->split_flags != COMMIT_GRAPH_SPLIT_UNSPECIFIED)
+			return 0;
+		if (ctx->opts->size_multiple)
+			size_mult = ctx->opts->size_multiple;
+	}
+	return count_pending_merges(ctx->r->objects->commit_graph, ctx->odb,
+				    size_mult);
+}
+
 static void split_graph_merge_strategy(struct write_commit_graph_context *ctx)
 {
 	struct commit_graph *g;
 	uint32_t num_commits;
 	enum commit_graph_split_flags flags = COMMIT_GRAPH_SPLIT_UNSPECIFIED;
-	uint32_t i;
+	uint32_t i, min_merges = 0;
 
 	int max_commits = 0;
 	int size_mult = 2;
+	int merge_limit = 0;
 
 	if (ctx->opts) {
 		max_commits = ctx->opts->max_commits;
+		merge_limit = ctx->opts->merge_limit;
 
 		if (ctx->opts->size_multiple)
 			size_mult = ctx->opts->size_multiple;
@@ -2208,12 +2825,25 @@ static void split_graph_merge_strategy(struct write_commit_graph_context *ctx)
 	else
 		ctx->num_commit_graphs_after = ctx->num_commit_graphs_before + 1;
 
+	/*
+	 * Without new commits, we only get here to catch up with the
+	 * merges that earlier writes skipped.
+	 */
+	if (!num_commits)
+		min_merges = pending_split_merges(ctx);
+
 	if (flags != COMMIT_GRAPH_SPLIT_MERGE_PROHIBITED &&
 	    flags != COMMIT_GRAPH_SPLIT_REPLACE) {
-		while (g && (g->num_commits <= st_mult(size_mult, num_commits) ||
-			    (max_commits && num_commits > max_commits))) {
+		while (g && (min_merges ||
+			     g->num_commits <= st_mult(size_mult, num_commits) ||
+			     (max_commits && num_commits > max_commits))) {
 			if (g->odb != ctx->odb)
 				break;
+			if (merge_limit &&
+			    num_commits + (uintmax_t)g->num_commits > merge_limit)
+				break;
+			if (min_merges)
+				min_merges--;
 
 			if (unsigned_add_overflows(num_commits, g->num_commits))
 				die(_("cannot merge graphs with %"PRIuMAX", "
@@ -2263,8 +2893,11 @@ static void split_graph_merge_strategy(struct write_commit_graph_context *ctx)
 		 * If the topmost remaining layer has generation data chunk, the
 		 * resultant layer also has generation data chunk.
 		 */
-		if (i == ctx->num_commit_graphs_after - 2)
+		if (i == ctx->num_commit_graphs_after - 2) {
 			ctx->write_generation_data = !!g->chunk_generation_data;
+			ctx->write_first_parent_generation &=
+				g->read_first_parent_generation;
+		}
 
 		i--;
 		g = g->base_graph;
@@ -2468,6 +3101,9 @@ int write_commit_graph(struct object_directory *odb,
 	int replace = 0;
 	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
 	struct topo_level_slab topo_levels;
+	int write_fp_gen = 0;
+	int write_reachability = 0;
+	int write_renames = 0;
 
 	prepare_repo_settings(r);
 	if (!r->settings.core_commit_graph) {
@@ -2486,8 +3122,15 @@ int write_commit_graph(struct object_directory *odb,
 	ctx->opts = opts;
 	ctx->total_bloom_filter_data_size = 0;
 	ctx->write_generation_data = (get_configured_generation_version(r) == 2);
+	repo_config_get_bool(r, "commitgraph.firstparentgeneration", &write_fp_gen);
+	ctx->write_first_parent_generation = write_fp_gen;
+	repo_config_get_bool(r, "commitgraph.reachabilityindex", &write_reachability);
+	ctx->write_reachability = write_reachability;
+	repo_config_get_bool(r, "commitgraph.renames", &write_renames);
+	ctx->write_renames = write_renames;
 	ctx->num_generation_data_overflows = 0;
 
+	bloom_settings.hash_version = get_configured_changed_paths_version(r);
 	bloom_settings.bits_per_entry = git_env_ulong("GIT_TEST_BLOOM_SETTINGS_BITS_PER_ENTRY",
 						      bloom_settings.bits_per_entry);
 	bloom_settings.num_hashes = git_env_ulong("GIT_TEST_BLOOM_SETTINGS_NUM_HASHES",
@@ -2516,10 +3159,16 @@ int write_commit_graph(struct object_directory *odb,
 
 		g = ctx->r->objects->commit_graph;
 
-		/* We have changed-paths already. Keep them in the next graph */
+		/*
+		 * We have changed-paths already. Keep them in the next graph,
+		 * unless they are of another version than the configured one,
+		 * in which case the filters are computed anew.
+		 */
 		if (g && g->chunk_bloom_data) {
 			ctx->changed_paths = 1;
-			ctx->bloom_settings = g->bloom_filter_settings;
+			if (g->bloom_filter_settings &&
+			    g->bloom_filter_settings->hash_version == bloom_settings.hash_version)
+				ctx->bloom_settings = g->bloom_filter_settings;
 		}
 	}
 
@@ -2583,7 +3232,7 @@ int write_commit_graph(struct object_directory *odb,
 		goto cleanup;
 	}
 
-	if (!ctx->commits.nr && !replace)
+	if (!ctx->commits.nr && !replace && !pending_split_merges(ctx))
 		goto cleanup;
 
 	if (ctx->split) {
@@ -2599,6 +3248,18 @@ int write_commit_graph(struct object_directory *odb,
 	compute_topological_levels(ctx);
 	if (ctx->write_generation_data)
 		compute_generation_numbers(ctx);
+	if (ctx->write_first_parent_generation)
+		compute_first_parent_generations(ctx);
+	/*
+	 * The labels only describe a layer that contains all the ancestors
+	 * of its commits, i.e. one without a base.
+	 */
+	if (ctx->new_base_graph)
+		ctx->write_reachability = 0;
+	if (ctx->write_reachability)
+		compute_reachability_labels(ctx);
+	if (ctx->write_renames)
+		compute_renames(ctx);
 
 	if (ctx->changed_paths)
 		compute_bloom_filters(ctx);
@@ -2608,6 +3269,19 @@ int write_commit_graph(struct object_directory *odb,
 	if (ctx->split)
 		mark_commit_graphs(ctx);
 
+	/*
+	 * Like the changed-path Bloom filters, keep an existing tree cache
+	 * up to date unless told otherwise.
+	 */
+	if (flags & COMMIT_GRAPH_NO_WRITE_TREE_CACHE)
+		remove_tree_cache(odb);
+	else if (!res && ((flags & COMMIT_GRAPH_WRITE_TREE_CACHE) ||
+			  tree_cache_exists(odb)))
+		res = write_tree_cache(r, odb, ctx->commits.list,
+				       ctx->commits.nr,
+				       ctx->split || ctx->append,
+				       ctx->report_progress);
+
 	expire_commit_graphs(ctx);
 
 cleanup:
@@ -2616,6 +3290,12 @@ int write_commit_graph(struct object_directory *odb,
 	free(ctx->commits.list);
 	oid_array_clear(&ctx->oids);
 	clear_topo_level_slab(&topo_levels);
+	if (ctx->write_reachability)
+		clear_reachability_label_slab(&ctx->reachability_labels);
+	if (ctx->write_renames) {
+		free(ctx->rename_indexes);
+		strbuf_release(&ctx->rename_data);
+	}
 
 	if (ctx->commit_graph_filenames_after) {
 		for (i = 0; i < ctx->num_commit_graphs_after; i++) {
@@ -2656,20 +3336,185 @@ static int commit_graph_checksum_valid(struct commit_graph *g)
 	return hashfile_checksum_valid(g->data, g->data_len);
 }
 
+struct verify_checksum {
+	struct commit_graph *g;
+	int valid;
+	int in_thread;
+	pthread_t thread;
+};
+
+static void *verify_checksum_thread(void *arg)
+{
+	struct verify_checksum *vc = arg;
+	vc->valid = commit_graph_checksum_valid(vc->g);
+	return NULL;
+}
+
+/*
+ * Hashing the whole file takes a while for a large commit-graph, so do it
+ * in a thread of its own while the first commits are read, if we may use
+ * threads.
+ */
+static void start_verify_checksum(struct verify_checksum *vc,
+				  struct commit_graph *g, int nr_threads)
+{
+	vc->g = g;
+	vc->in_thread = HAVE_THREADS && nr_threads > 1 &&
+		!pthread_create(&vc->thread, NULL, verify_checksum_thread, vc);
+	if (!vc->in_thread)
+		vc->valid = commit_graph_checksum_valid(g);
+}
+
+static void finish_verify_checksum(struct verify_checksum *vc)
+{
+	if (vc->in_thread)
+		pthread_join(vc->thread, NULL);
+	if (!vc->valid) {
+		graph_report(_("the commit-graph file has incorrect checksum and is likely corrupt"));
+		verify_commit_graph_error = VERIFY_COMMIT_GRAPH_ERROR_HASH;
+	}
+}
+
+/*
+ * Reading the commits from the object database, which is what takes the
+ * most time when verifying, is done in threads, a batch of commits at a
+ * time. Parsing them and comparing them with the commit-graph touches
+ * the object hash and the commit slabs, so that is left to the main
+ * thread, in the order of the commit-graph, so that mismatches are
+ * reported in the same order however many threads there are.
+ */
+#define VERIFY_BATCH_PER_THREAD 1024
+
+struct verify_read {
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+	int ret;
+};
+
+struct verify_reads {
+	struct repository *r;
+	struct commit_graph *g;
+	struct verify_read *reads;
+	uint32_t start, nr, next;
+	pthread_mutex_t mutex;
+};
+
+static void *verify_read_commits_thread(void *arg)
+{
+	struct verify_reads *vr = arg;
+
+	for (;;) {
+		struct object_info oi = OBJECT_INFO_INIT;
+		struct object_id oid;
+		struct verify_read *read;
+		uint32_t i;
+
+		if (HAVE_THREADS)
+			pthread_mutex_lock(&vr->mutex);
+		i = vr->next < vr->nr ? vr->next++ : vr->nr;
+		if (HAVE_THREADS)
+			pthread_mutex_unlock(&vr->mutex);
+		if (i >= vr->nr)
+			break;
+
+		read = &vr->reads[i];
+		oidread(&oid, vr->g->chunk_oid_lookup +
+			st_mult(vr->g->hash_len, vr->start + i));
+		oi.typep = &read->type;
+		oi.sizep = &read->size;
+		oi.contentp = &read->buffer;
+		read->ret = oid_object_info_extended(vr->r, &oid, &oi,
+						     OBJECT_INFO_LOOKUP_REPLACE |
+						     OBJECT_INFO_SKIP_FETCH_OBJECT |
+						     OBJECT_INFO_DIE_IF_CORRUPT);
+	}
+	return NULL;
+}
+
+static void verify_read_commits(struct verify_reads *vr, uint32_t start,
+				uint32_t nr, int nr_threads)
+{
+	pthread_t *threads;
+	int i, ret;
+
+	vr->start = start;
+	vr->nr = nr;
+	vr->next = 0;
+	memset(vr->reads, 0, st_mult(nr, sizeof(*vr->reads)));
+
+	if (!HAVE_THREADS || nr_threads <= 1) {
+		verify_read_commits_thread(vr);
+		return;
+	}
+
+	pthread_mutex_init(&vr->mutex, NULL);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL,
+				     verify_read_commits_thread, vr);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&vr->mutex);
+	free(threads);
+}
+
+/*
+ * Parse "odb_commit" from what verify_read_commits() read for it, like
+ * repo_parse_commit_internal() would.
+ */
+static int verify_parse_commit(struct repository *r, struct commit *odb_commit,
+			       struct verify_read *read)
+{
+	int ret;
+
+	if (read->ret < 0)
+		return error("Could not read %s",
+			     oid_to_hex(&odb_commit->object.oid));
+	if (read->type != OBJ_COMMIT) {
+		FREE_AND_NULL(read->buffer);
+		return error("Object %s not a commit",
+			     oid_to_hex(&odb_commit->object.oid));
+	}
+
+	ret = parse_commit_buffer(r, odb_commit, read->buffer, read->size, 0);
+	FREE_AND_NULL(read->buffer);
+	return ret;
+}
+
 static int verify_one_commit_graph(struct repository *r,
 				   struct commit_graph *g,
 				   struct progress *progress,
-				   uint64_t *seen)
+				   uint64_t *seen,
+				   int nr_threads)
 {
 	uint32_t i, cur_fanout_pos = 0;
 	struct object_id prev_oid, cur_oid;
 	struct commit *seen_gen_zero = NULL;
 	struct commit *seen_gen_non_zero = NULL;
+	struct verify_checksum checksum;
+	struct verify_reads reads = { .r = r, .g = g };
+	uint32_t batch_start = 0, batch_size;
 
-	if (!commit_graph_checksum_valid(g)) {
-		graph_report(_("the commit-graph file has incorrect checksum and is likely corrupt"));
-		verify_commit_graph_error = VERIFY_COMMIT_GRAPH_ERROR_HASH;
-	}
+	/*
+	 * Read the first batch of commits while the checksum is being
+	 * computed, but report a bad checksum before anything else, as
+	 * the checks below may die on a corrupt file.
+	 */
+	start_verify_checksum(&checksum, g, nr_threads);
+	batch_size = st_mult(VERIFY_BATCH_PER_THREAD, nr_threads > 1 ? nr_threads : 1);
+	if (batch_size > g->num_commits)
+		batch_size = g->num_commits;
+	CALLOC_ARRAY(reads.reads, batch_size);
+	verify_read_commits(&reads, 0, batch_size, nr_threads);
+	finish_verify_checksum(&checksum);
 
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit;
@@ -2709,7 +3554,7 @@ static int verify_one_commit_graph(struct repository *r,
 	}
 
 	if (verify_commit_graph_error & ~VERIFY_COMMIT_GRAPH_ERROR_HASH)
-		return verify_commit_graph_error;
+		goto done;
 
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
@@ -2717,12 +3562,21 @@ static int verify_one_commit_graph(struct repository *r,
 		timestamp_t max_generation = 0;
 		timestamp_t generation;
 
+		if (i == batch_start + reads.nr) {
+			batch_start = i;
+			verify_read_commits(&reads, batch_start,
+					    g->num_commits - i < batch_size ?
+					    g->num_commits - i : batch_size,
+					    nr_threads);
+		}
+
 		display_progress(progress, ++(*seen));
 		oidread(&cur_oid, g->chunk_oid_lookup + st_mult(g->hash_len, i));
 
 		graph_commit = lookup_commit(r, &cur_oid);
 		odb_commit = (struct commit *)create_object(r, &cur_oid, alloc_commit_node(r));
-		if (repo_parse_commit_internal(r, odb_commit, 0, 0)) {
+		if (verify_parse_commit(r, odb_commit,
+					&reads.reads[i - batch_start])) {
 			graph_report(_("failed to parse commit %s from object database for commit-graph"),
 				     oid_to_hex(&cur_oid));
 			continue;
@@ -2766,6 +3620,61 @@ static int verify_one_commit_graph(struct repository *r,
 			graph_report(_("commit-graph parent list for commit %s terminates early"),
 				     oid_to_hex(&cur_oid));
 
+		if (g->read_first_parent_generation) {
+			uint32_t fp_gen = 1;
+
+			if (graph_commit->parents)
+				fp_gen += commit_graph_first_parent_generation(
+						graph_commit->parents->item);
+			if (commit_graph_first_parent_generation(graph_commit) != fp_gen)
+				graph_report(_("commit-graph first-parent generation for commit %s is %"PRIu32" != %"PRIu32),
+					     oid_to_hex(&cur_oid),
+					     commit_graph_first_parent_generation(graph_commit),
+					     fp_gen);
+		}
+
+		if (g->chunk_reachability && !g->base_graph) {
+			struct reachability_label label;
+			struct commit_list *p;
+
+			reachability_label_at(g, i, &label);
+			if (!label.post || label.low > label.post ||
+			    label.dag_low > label.low)
+				graph_report(_("commit-graph reachability label for commit %s is invalid"),
+					     oid_to_hex(&cur_oid));
+
+			for (p = graph_commit->parents; p; p = p->next) {
+				struct reachability_label parent_label;
+				uint32_t pos = commit_graph_position(p->item);
+
+				if (pos >= g->num_commits)
+					continue;
+				reachability_label_at(g, pos, &parent_label);
+				if (parent_label.post >= label.post ||
+				    parent_label.dag_low < label.dag_low)
+					graph_report(_("commit-graph reachability label for commit %s does not cover its parent %s"),
+						     oid_to_hex(&cur_oid),
+						     oid_to_hex(&p->item->object.oid));
+			}
+		}
+
+		if (g->chunk_rename_indexes) {
+			const char *p, *end;
+			int nr = 0;
+
+			if (renames_from_graph(g, i + g->num_commits_in_base,
+					       &p, &end))
+				graph_report(_("commit-graph renames for commit %s are out of range"),
+					     oid_to_hex(&cur_oid));
+			else {
+				for (; p < end; p += strlen(p) + 1)
+					nr++;
+				if (nr % 2)
+					graph_report(_("commit-graph renames for commit %s are not in pairs"),
+						     oid_to_hex(&cur_oid));
+			}
+		}
+
 		if (commit_graph_generation_from_graph(graph_commit))
 			seen_gen_non_zero = graph_commit;
 		else
@@ -2803,6 +3712,10 @@ static int verify_one_commit_graph(struct repository *r,
 			     oid_to_hex(&seen_gen_zero->object.oid),
 			     oid_to_hex(&seen_gen_non_zero->object.oid));
 
+done:
+	for (i = 0; i < reads.nr; i++)
+		free(reads.reads[i].buffer);
+	free(reads.reads);
 	return verify_commit_graph_error;
 }
 
@@ -2811,12 +3724,17 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	struct progress *progress = NULL;
 	int local_error = 0;
 	uint64_t seen = 0;
+	int nr_threads;
 
 	if (!g) {
 		graph_report("no commit-graph file loaded");
 		return 1;
 	}
 
+	if (repo_config_get_int(r, "commitgraph.threads", &nr_threads) ||
+	    !nr_threads)
+		nr_threads = online_cpus();
+
 	if (flags & COMMIT_GRAPH_WRITE_PROGRESS) {
 		uint64_t total = g->num_commits;
 		if (!(flags & COMMIT_GRAPH_VERIFY_SHALLOW))
@@ -2827,7 +3745,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	}
 
 	for (; g; g = g->base_graph) {
-		local_error |= verify_one_commit_graph(r, g, progress, &seen);
+		local_error |= verify_one_commit_graph(r, g, progress, &seen,
+						       nr_threads);
 		if (flags & COMMIT_GRAPH_VERIFY_SHALLOW)
 			break;
 	}
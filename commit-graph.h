@@ -93,6 +93,7 @@ struct commit_graph {
 
 	uint32_t num_commits_in_base;
 	unsigned int read_generation_data;
+	unsigned int read_first_parent_generation;
 	struct commit_graph *base_graph;
 
 	const uint32_t *chunk_oid_fanout;
@@ -101,6 +102,11 @@ struct commit_graph {
 	const unsigned char *chunk_generation_data;
 	const unsigned char *chunk_generation_data_overflow;
 	size_t chunk_generation_data_overflow_size;
+	const unsigned char *chunk_first_parent_generation;
+	const unsigned char *chunk_reachability;
+	const unsigned char *chunk_rename_indexes;
+	const unsigned char *chunk_rename_data;
+	size_t chunk_rename_data_size;
 	const unsigned char *chunk_extra_edges;
 	size_t chunk_extra_edges_size;
 	const unsigned char *chunk_base_graphs;
@@ -149,6 +155,8 @@ enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_TREE_CACHE = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_TREE_CACHE = (1 << 6),
 };
 
 enum commit_graph_split_flags {
@@ -163,6 +171,7 @@ struct commit_graph_opts {
 	timestamp_t expire_time;
 	enum commit_graph_split_flags split_flags;
 	int max_new_filters;
+	int merge_limit;
 };
 
 /*
@@ -180,6 +189,13 @@ int write_commit_graph(struct object_directory *odb,
 		       enum commit_graph_write_flags flags,
 		       const struct commit_graph_opts *opts);
 
+/*
+ * Return 1 if the commit-graph chain of the repository has layers that a
+ * split write with the default options would merge, because an earlier
+ * write with a merge limit skipped merging them, and 0 otherwise.
+ */
+int commit_graph_merge_pending(struct repository *r);
+
 #define COMMIT_GRAPH_VERIFY_SHALLOW	(1 << 0)
 
 int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags);
@@ -195,6 +211,7 @@ void disable_commit_graph(struct repository *r);
 
 struct commit_graph_data {
 	uint32_t graph_pos;
+	uint32_t first_parent_generation;
 	timestamp_t generation;
 };
 
@@ -204,6 +221,35 @@ struct commit_graph_data {
 timestamp_t commit_graph_generation(const struct commit *);
 uint32_t commit_graph_position(const struct commit *);
 
+/*
+ * The first-parent generation of a commit is the number of commits in
+ * its first-parent history, itself included: 1 for a root commit, and
+ * one more than that of its first parent otherwise. Returns 0 if it is
+ * not known, because the commit is not in a commit-graph, or not in
+ * one that stores them.
+ */
+uint32_t commit_graph_first_parent_generation(const struct commit *);
+
+/*
+ * Use the reachability labels of the commit-graph to tell whether
+ * "from" can reach "to": returns 1 if it can, 0 if it cannot, and -1 if
+ * the labels do not tell (or are not there), in which case the caller
+ * has to walk. Both commits must be parsed.
+ */
+int commit_graph_can_reach(struct repository *r,
+			   const struct commit *from,
+			   const struct commit *to);
+
+/*
+ * Look up the renames that the commit-graph recorded for "c" against
+ * its first parent: returns 1 and points "from" at the path that "path"
+ * was renamed or copied from, 0 if "path" was not, and -1 if the
+ * commit-graph does not know, in which case the caller has to detect
+ * renames itself.
+ */
+int commit_graph_rename_source(struct repository *r, struct commit *c,
+			       const char *path, const char **from);
+
 /*
  * After this method, all commits reachable from those in the given
  * list will have non-zero, non-infinite generation numbers.
@@ -0,0 +1,156 @@
+#ifndef COMMIT_QUEUE_H
+#define COMMIT_QUEUE_H
+
+/*
+ * define_commit_queue(name, keyfn) creates boilerplate code to define a
+ * priority queue of commits (struct name) that hands out the commit with
+ * the largest key first, where the key of a commit is given by
+ *
+ *   timestamp_t keyfn(const struct commit *, void *cb_data);
+ *
+ * (typically its generation number), using the commit date when the keys
+ * are equal, and the order in which the commits were added when the dates
+ * are equal, too. With commit_graph_generation() as the key, this is
+ * the order of a "struct prio_queue" using
+ * compare_commits_by_gen_then_commit_date().
+ *
+ * Unlike "struct prio_queue", the key and the date of a commit are read
+ * once, when it is added, and stored next to it, and the comparisons are
+ * inlined, so that the walks that push and pop many commits do not make
+ * an indirect call and look at two commits for every comparison. The
+ * heap has four children per node, kept next to each other, which makes
+ * it shallower and lets a sift down look at neighbouring entries.
+ *
+ * As the keys are not looked at again, a commit must be parsed before it
+ * is added, and its key must not change while it is in the queue.
+ *
+ * After including this header file, using:
+ *
+ * define_commit_queue(gen_queue, gen_key);
+ *
+ * with a function gen_key() of the type above will let you use a "struct
+ * gen_queue", initialized to all zeroes except possibly for its "cb_data",
+ * which is passed to gen_key(), and call the following functions:
+ *
+ * - void gen_queue_put(struct gen_queue *, struct commit *);
+ *
+ *   Adds the commit to the queue.
+ *
+ * - struct commit *gen_queue_get(struct gen_queue *);
+ *
+ *   Removes the first commit from the queue and returns it, or returns
+ *   NULL if the queue is empty.
+ *
+ * - struct commit *gen_queue_peek(struct gen_queue *);
+ *
+ *   Returns the commit gen_queue_get() would return, without removing
+ *   it from the queue.
+ *
+ * - void clear_gen_queue(struct gen_queue *);
+ *
+ *   Empties the queue and frees its memory.
+ *
+ * The commits in the queue are "array[i].commit" for "i" below "nr", in
+ * no particular order.
+ */
+
+#define COMMIT_QUEUE_ARITY 4
+
+#define define_commit_queue(name, keyfn)				\
+									\
+struct name##_entry {							\
+	timestamp_t key;						\
+	timestamp_t date;						\
+	unsigned ctr;							\
+	struct commit *commit;						\
+};									\
+									\
+struct name {								\
+	void *cb_data;							\
+	unsigned insertion_ctr;						\
+	size_t nr, alloc;						\
+	struct name##_entry *array;					\
+};									\
+									\
+static inline int name##_before(const struct name##_entry *a,		\
+				const struct name##_entry *b)		\
+{									\
+	if (a->key != b->key)						\
+		return a->key > b->key;					\
+	if (a->date != b->date)						\
+		return a->date > b->date;				\
+	return a->ctr < b->ctr;						\
+}									\
+									\
+MAYBE_UNUSED								\
+static inline void name##_put(struct name *queue, struct commit *commit) \
+{									\
+	struct name##_entry entry;					\
+	size_t ix, parent;						\
+									\
+	entry.key = keyfn(commit, queue->cb_data);			\
+	entry.date = commit->date;					\
+	entry.ctr = queue->insertion_ctr++;				\
+	entry.commit = commit;						\
+									\
+	ALLOC_GROW(queue->array, queue->nr + 1, queue->alloc);		\
+	/* Bubble up the new one */					\
+	for (ix = queue->nr++; ix; ix = parent) {			\
+		parent = (ix - 1) / COMMIT_QUEUE_ARITY;			\
+		if (!name##_before(&entry, &queue->array[parent]))	\
+			break;						\
+		queue->array[ix] = queue->array[parent];		\
+	}								\
+	queue->array[ix] = entry;					\
+}									\
+									\
+MAYBE_UNUSED								\
+static inline struct commit *name##_get(struct name *queue)		\
+{									\
+	struct commit *result;						\
+	const struct name##_entry *last;				\
+	size_t ix, child, end, i;					\
+									\
+	if (!queue->nr)							\
+		return NULL;						\
+	result = queue->array[0].commit;				\
+	if (!--queue->nr)						\
+		return result;						\
+									\
+	/* Push the last one down from the root */			\
+	last = &queue->array[queue->nr];				\
+	for (ix = 0; (child = ix * COMMIT_QUEUE_ARITY + 1) < queue->nr; \
+	     ix = child) {						\
+		end = child + COMMIT_QUEUE_ARITY;			\
+		if (end > queue->nr)					\
+			end = queue->nr;				\
+		for (i = child + 1; i < end; i++)			\
+			if (name##_before(&queue->array[i],		\
+					  &queue->array[child]))	\
+				child = i;				\
+		if (!name##_before(&queue->array[child], last))		\
+			break;						\
+		queue->array[ix] = queue->array[child];			\
+	}								\
+	queue->array[ix] = *last;					\
+	return result;							\
+}									\
+									\
+MAYBE_UNUSED								\
+static inline struct commit *name##_peek(struct name *queue)		\
+{									\
+	return queue->nr ? queue->array[0].commit : NULL;		\
+}									\
+									\
+MAYBE_UNUSED								\
+static inline void clear_##name(struct name *queue)			\
+{									\
+	FREE_AND_NULL(queue->array);					\
+	queue->nr = 0;							\
+	queue->alloc = 0;						\
+	queue->insertion_ctr = 0;					\
+}									\
+									\
+struct name
+
+#endif /* COMMIT_QUEUE_H */
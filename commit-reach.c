@@ -1,6 +1,7 @@
 #include "git-compat-util.h"
 #include "commit.h"
 #include "commit-graph.h"
+#include "commit-queue.h"
 #include "decorate.h"
 #include "hex.h"
 #include "prio-queue.h"
@@ -38,45 +39,55 @@ static int compare_commits_by_gen(const void *_a, const void *_b)
 	return 0;
 }
 
-static int queue_has_nonstale(struct prio_queue *queue)
+static inline timestamp_t paint_key(const struct commit *c, void *by_date)
 {
-	int i;
+	return *(int *)by_date ? 0 : commit_graph_generation(c);
+}
+
+define_commit_queue(paint_queue, paint_key);
+
+static int queue_has_nonstale(struct paint_queue *queue)
+{
+	size_t i;
 	for (i = 0; i < queue->nr; i++) {
-		struct commit *commit = queue->array[i].data;
+		struct commit *commit = queue->array[i].commit;
 		if (!(commit->object.flags & STALE))
 			return 1;
 	}
 	return 0;
 }
 
-/* all input commits in one and twos[] must have been parsed! */
-static struct commit_list *paint_down_to_common(struct repository *r,
-						struct commit *one, int n,
-						struct commit **twos,
-						timestamp_t min_generation)
+/* all input commits in ones[] and twos[] must have been parsed! */
+static struct commit_list *paint_down_to_common_many(struct repository *r,
+						     int nr_ones,
+						     struct commit **ones,
+						     int n,
+						     struct commit **twos,
+						     timestamp_t min_generation)
 {
-	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	int by_date = !min_generation && !corrected_commit_dates_enabled(r);
+	struct paint_queue queue = { .cb_data = &by_date };
 	struct commit_list *result = NULL;
 	int i;
 	timestamp_t last_gen = GENERATION_NUMBER_INFINITY;
 
-	if (!min_generation && !corrected_commit_dates_enabled(r))
-		queue.compare = compare_commits_by_commit_date;
-
-	one->object.flags |= PARENT1;
+	for (i = 0; i < nr_ones; i++)
+		ones[i]->object.flags |= PARENT1;
 	if (!n) {
-		commit_list_append(one, &result);
+		for (i = 0; i < nr_ones; i++)
+			commit_list_append(ones[i], &result);
 		return result;
 	}
-	prio_queue_put(&queue, one);
+	for (i = 0; i < nr_ones; i++)
+		paint_queue_put(&queue, ones[i]);
 
 	for (i = 0; i < n; i++) {
 		twos[i]->object.flags |= PARENT2;
-		prio_queue_put(&queue, twos[i]);
+		paint_queue_put(&queue, twos[i]);
 	}
 
 	while (queue_has_nonstale(&queue)) {
-		struct commit *commit = prio_queue_get(&queue);
+		struct commit *commit = paint_queue_get(&queue);
 		struct commit_list *parents;
 		int flags;
 		timestamp_t generation = commit_graph_generation(commit);
@@ -108,14 +119,22 @@ static struct commit_list *paint_down_to_common(struct repository *r,
 			if (repo_parse_commit(r, p))
 				return NULL;
 			p->object.flags |= flags;
-			prio_queue_put(&queue, p);
+			paint_queue_put(&queue, p);
 		}
 	}
 
-	clear_prio_queue(&queue);
+	clear_paint_queue(&queue);
 	return result;
 }
 
+static struct commit_list *paint_down_to_common(struct repository *r,
+						struct commit *one, int n,
+						struct commit **twos,
+						timestamp_t min_generation)
+{
+	return paint_down_to_common_many(r, 1, &one, n, twos, min_generation);
+}
+
 static struct commit_list *merge_bases_many(struct repository *r,
 					    struct commit *one, int n,
 					    struct commit **twos)
@@ -150,6 +169,36 @@ static struct commit_list *merge_bases_many(struct repository *r,
 	return result;
 }
 
+struct commit_list *repo_get_merge_bases_of_sets(struct repository *r,
+						 int nr_ones,
+						 struct commit **ones,
+						 int nr_twos,
+						 struct commit **twos)
+{
+	struct commit_list *list, *result = NULL;
+	int i;
+
+	if (!nr_ones || !nr_twos)
+		return NULL;
+	for (i = 0; i < nr_ones; i++)
+		if (repo_parse_commit(r, ones[i]))
+			return NULL;
+	for (i = 0; i < nr_twos; i++)
+		if (repo_parse_commit(r, twos[i]))
+			return NULL;
+
+	list = paint_down_to_common_many(r, nr_ones, ones, nr_twos, twos, 0);
+	while (list) {
+		struct commit *commit = pop_commit(&list);
+		if (!(commit->object.flags & STALE))
+			commit_list_insert_by_date(commit, &result);
+	}
+
+	clear_commit_marks_many(nr_ones, ones, all_flags);
+	clear_commit_marks_many(nr_twos, twos, all_flags);
+	return result;
+}
+
 struct commit_list *get_octopus_merge_bases(struct commit_list *in)
 {
 	struct commit_list *i, *j, *k, *ret = NULL;
@@ -478,32 +527,52 @@ int repo_in_merge_bases_many(struct repository *r, struct commit *commit,
 			     int nr_reference, struct commit **reference)
 {
 	struct commit_list *bases;
-	int ret = 0, i;
+	struct commit **unknown;
+	int ret = 0, i, nr_unknown = 0;
 	timestamp_t generation, max_generation = GENERATION_NUMBER_ZERO;
 
 	if (repo_parse_commit(r, commit))
 		return ret;
-	for (i = 0; i < nr_reference; i++) {
+	for (i = 0; i < nr_reference; i++)
 		if (repo_parse_commit(r, reference[i]))
 			return ret;
 
-		generation = commit_graph_generation(reference[i]);
+	/*
+	 * Ask the reachability labels of the commit-graph first, and only
+	 * walk from the references they cannot tell about.
+	 */
+	ALLOC_ARRAY(unknown, nr_reference);
+	for (i = 0; i < nr_reference; i++) {
+		int reach = commit_graph_can_reach(r, reference[i], commit);
+
+		if (reach > 0) {
+			free(unknown);
+			return 1;
+		}
+		if (reach < 0)
+			unknown[nr_unknown++] = reference[i];
+	}
+
+	for (i = 0; i < nr_unknown; i++) {
+		generation = commit_graph_generation(unknown[i]);
 		if (generation > max_generation)
 			max_generation = generation;
 	}
 
 	generation = commit_graph_generation(commit);
-	if (generation > max_generation)
-		return ret;
+	if (!nr_unknown || generation > max_generation)
+		goto cleanup;
 
 	bases = paint_down_to_common(r, commit,
-				     nr_reference, reference,
+				     nr_unknown, unknown,
 				     generation);
 	if (commit->object.flags & PARENT2)
 		ret = 1;
 	clear_commit_marks(commit, all_flags);
-	clear_commit_marks_many(nr_reference, reference, all_flags);
+	clear_commit_marks_many(nr_unknown, unknown, all_flags);
 	free_commit_list(bases);
+cleanup:
+	free(unknown);
 	return ret;
 }
 
@@ -525,6 +594,44 @@ int repo_in_merge_bases(struct repository *r,
 	return res;
 }
 
+int repo_in_first_parent_history(struct repository *r,
+				 struct commit *commit,
+				 struct commit *reference)
+{
+	uint32_t fp_gen;
+	timestamp_t generation;
+
+	if (repo_parse_commit(r, commit))
+		return 0;
+	fp_gen = commit_graph_first_parent_generation(commit);
+	generation = commit_graph_generation(commit);
+
+	while (reference) {
+		uint32_t ref_fp_gen;
+
+		if (reference == commit)
+			return 1;
+		if (repo_parse_commit(r, reference))
+			return 0;
+
+		/*
+		 * The first-parent history of "reference" holds exactly
+		 * one commit of each lower first-parent generation, so
+		 * once we are down to that of "commit" without having
+		 * found it, it is not there.
+		 */
+		ref_fp_gen = commit_graph_first_parent_generation(reference);
+		if (fp_gen && ref_fp_gen && ref_fp_gen <= fp_gen)
+			return 0;
+		if (commit_graph_generation(reference) < generation)
+			return 0;
+
+		reference = reference->parents ? reference->parents->item : NULL;
+	}
+
+	return 0;
+}
+
 struct commit_list *reduce_heads(struct commit_list *heads)
 {
 	struct commit_list *p;
@@ -821,6 +928,46 @@ int can_all_from_reach_with_flag(struct object_array *from,
 	return result;
 }
 
+/*
+ * Answer can_all_from_reach() with the reachability labels of the
+ * commit-graph alone, if they allow: returns 1 or 0 if they do, and -1
+ * if some commit in "from" has to be walked from.
+ */
+static int can_all_from_reach_by_labels(struct commit_list *from,
+					struct commit_list *to)
+{
+	int ret = 1;
+
+	for (; from; from = from->next) {
+		struct commit_list *t;
+		int found = 0;
+
+		if (repo_parse_commit(the_repository, from->item))
+			return -1;
+		for (t = to; t; t = t->next) {
+			int reach;
+
+			if (repo_parse_commit(the_repository, t->item))
+				return -1;
+			reach = commit_graph_can_reach(the_repository,
+						       from->item, t->item);
+			if (reach > 0) {
+				found = 1;
+				break;
+			}
+			if (reach < 0)
+				found = -1;
+		}
+
+		if (!found)
+			return 0;
+		if (found < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
 int can_all_from_reach(struct commit_list *from, struct commit_list *to,
 		       int cutoff_by_min_date)
 {
@@ -830,6 +977,10 @@ int can_all_from_reach(struct commit_list *from, struct commit_list *to,
 	int result;
 	timestamp_t min_generation = GENERATION_NUMBER_INFINITY;
 
+	result = can_all_from_reach_by_labels(from, to);
+	if (result >= 0)
+		return result;
+
 	while (from_iter) {
 		add_object_array(&from_iter->item->object, NULL, &from_objs);
 
@@ -955,11 +1106,11 @@ struct commit_list *get_reachable_subset(struct commit **from, int nr_from,
 define_commit_slab(bit_arrays, struct bitmap *);
 static struct bit_arrays bit_arrays;
 
-static void insert_no_dup(struct prio_queue *queue, struct commit *c)
+static void insert_no_dup(struct paint_queue *queue, struct commit *c)
 {
 	if (c->object.flags & PARENT2)
 		return;
-	prio_queue_put(queue, c);
+	paint_queue_put(queue, c);
 	c->object.flags |= PARENT2;
 }
 
@@ -984,7 +1135,8 @@ void ahead_behind(struct repository *r,
 		  struct commit **commits, size_t commits_nr,
 		  struct ahead_behind_count *counts, size_t counts_nr)
 {
-	struct prio_queue queue = { .compare = compare_commits_by_gen_then_commit_date };
+	int by_date = 0;
+	struct paint_queue queue = { .cb_data = &by_date };
 	size_t width = DIV_ROUND_UP(commits_nr, BITS_IN_EWORD);
 
 	if (!commits_nr || !counts_nr)
@@ -1008,7 +1160,7 @@ void ahead_behind(struct repository *r,
 	}
 
 	while (queue_has_nonstale(&queue)) {
-		struct commit *c = prio_queue_get(&queue);
+		struct commit *c = paint_queue_get(&queue);
 		struct commit_list *p;
 		struct bitmap *bitmap_c = get_bit_array(c, width);
 
@@ -1051,7 +1203,7 @@ void ahead_behind(struct repository *r,
 	/* STALE is used here, PARENT2 is used by insert_no_dup(). */
 	repo_clear_commit_marks(r, PARENT2 | STALE);
 	clear_bit_arrays(&bit_arrays);
-	clear_prio_queue(&queue);
+	clear_paint_queue(&queue);
 }
 
 struct commit_and_index {
@@ -1072,6 +1224,47 @@ static int compare_commit_and_index_by_generation(const void *va, const void *vb
 	return 0;
 }
 
+/*
+ * Mark the tips that the reachability labels of the commit-graph show
+ * to be reachable from "bases". Returns 1 if the labels told about all
+ * of them, so that there is no need to walk.
+ */
+static int tips_reachable_by_labels(struct repository *r,
+				    struct commit_list *bases,
+				    struct commit **tips, size_t tips_nr,
+				    int mark)
+{
+	int all_known = 1;
+
+	for (size_t i = 0; i < tips_nr; i++) {
+		struct commit_list *b;
+		int found = 0;
+
+		if (repo_parse_commit(r, tips[i]))
+			return 0;
+		for (b = bases; b; b = b->next) {
+			int reach;
+
+			if (repo_parse_commit(r, b->item))
+				return 0;
+			reach = commit_graph_can_reach(r, b->item, tips[i]);
+			if (reach > 0) {
+				found = 1;
+				break;
+			}
+			if (reach < 0)
+				found = -1;
+		}
+
+		if (found > 0)
+			tips[i]->object.flags |= mark;
+		else if (found < 0)
+			all_known = 0;
+	}
+
+	return all_known;
+}
+
 void tips_reachable_from_bases(struct repository *r,
 			       struct commit_list *bases,
 			       struct commit **tips, size_t tips_nr,
@@ -1085,6 +1278,9 @@ void tips_reachable_from_bases(struct repository *r,
 	if (!bases || !tips || !tips_nr)
 		return;
 
+	if (tips_reachable_by_labels(r, bases, tips, tips_nr, mark))
+		return;
+
 	/*
 	 * Do a depth-first search starting at 'bases' to search for the
 	 * tips. Stop at the lowest (un-found) generation number. When
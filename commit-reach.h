@@ -20,6 +20,19 @@ struct commit_list *repo_get_merge_bases_many_dirty(struct repository *r,
 						    struct commit *one, int n,
 						    struct commit **twos);
 
+/*
+ * Return the commits that are reachable from both one of the "ones" and
+ * one of the "twos", but not from another such commit; that is, where
+ * the histories of the two sets of commits meet. Unlike the functions
+ * above, this does not remove the merge bases that turn out to be
+ * reachable from others after the walk, which can be expensive.
+ */
+struct commit_list *repo_get_merge_bases_of_sets(struct repository *r,
+						 int nr_ones,
+						 struct commit **ones,
+						 int nr_twos,
+						 struct commit **twos);
+
 struct commit_list *get_octopus_merge_bases(struct commit_list *in);
 
 int repo_is_descendant_of(struct repository *r,
@@ -32,6 +45,16 @@ int repo_in_merge_bases_many(struct repository *r,
 			     struct commit *commit,
 			     int nr_reference, struct commit **reference);
 
+/*
+ * Is "commit" in the first-parent history of "reference", i.e. can it
+ * be reached from "reference" following only first parents? The
+ * first-parent generations of the commit-graph, when it has them, end
+ * the walk as soon as it is past "commit".
+ */
+int repo_in_first_parent_history(struct repository *r,
+				 struct commit *commit,
+				 struct commit *reference);
+
 /*
  * Takes a list of commits and returns a new list where those
  * have been removed that can be reached from other commits in
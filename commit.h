@@ -26,6 +26,13 @@ struct commit_list {
 struct commit {
 	struct object object;
 	timestamp_t date;
+
+	/*
+	 * Each node is allocated on its own and owned by the commit;
+	 * unparse_commit(), parent rewriting and simplification in the
+	 * revision walk and several commands free or replace them one by
+	 * one, which is why they do not come from the slabs of alloc.c.
+	 */
 	struct commit_list *parents;
 
 	/*
@@ -0,0 +1,514 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "fsmonitor-ll.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "string-list.h"
+#include "trace.h"
+#include <sys/inotify.h>
+
+/*
+ * An inotify watch only reports the changes to the entries of a
+ * single directory, so we add a watch to every directory of the
+ * worktree, and to the directories that appear in it later, and
+ * remember which directory each watch descriptor stands for.
+ *
+ * Inside ".git" (or the external <gitdir>), only the cookie
+ * directory is watched; the daemon ignores everything else in there.
+ */
+#define WATCH_MASK (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MODIFY | \
+		    IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DELETE_SELF | IN_MOVE_SELF | \
+		    IN_DONT_FOLLOW | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	char *dir; /* absolute path of the watched directory */
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+
+	struct hashmap watches;
+	int wd_worktree;
+	int wd_gitdir;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+static int watch_entry_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata UNUSED)
+{
+	const struct watch_entry *a, *b;
+
+	a = container_of(eptr, const struct watch_entry, ent);
+	b = container_of(entry_or_key, const struct watch_entry, ent);
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void forget_watch(struct fsm_listen_data *data, struct watch_entry *w)
+{
+	hashmap_remove(&data->watches, &w->ent, NULL);
+	free(w->dir);
+	free(w);
+}
+
+/*
+ * Watch the directory "path" alone and return the watch descriptor,
+ * or -1 if the directory is gone (or is not a directory any more), or
+ * -2 on errors that should stop the daemon.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *path)
+{
+	struct watch_entry *w;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, path, WATCH_MASK);
+	if (wd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR || errno == EACCES)
+			return -1;
+		if (errno == ENOSPC)
+			error(_("inotify watch limit reached; consider "
+				"raising fs.inotify.max_user_watches"));
+		else
+			error_errno(_("could not watch '%s'"), path);
+		return -2;
+	}
+
+	/* A directory we watch already, possibly under another name. */
+	w = find_watch(data, wd);
+	if (w) {
+		free(w->dir);
+		w->dir = xstrdup(path);
+		return wd;
+	}
+
+	CALLOC_ARRAY(w, 1);
+	hashmap_entry_init(&w->ent, memhash(&wd, sizeof(wd)));
+	w->wd = wd;
+	w->dir = xstrdup(path);
+	hashmap_add(&data->watches, &w->ent);
+	return wd;
+}
+
+/*
+ * Watch the directory "path" and all the directories below it,
+ * except for ".git".  Returns -1 on errors that should stop the
+ * daemon.
+ */
+static int add_watches(struct fsmonitor_daemon_state *state,
+		       struct strbuf *path)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct dirent *de;
+	size_t len = path->len;
+	int ret = 0;
+	DIR *dir;
+
+	switch (add_watch(data, path->buf)) {
+	case -1:
+		return 0;
+	case -2:
+		return -1;
+	}
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return 0;
+	while (!ret && (de = readdir_skip_dot_and_dotdot(dir))) {
+		int dtype = get_dtype(de, path, 0);
+
+		strbuf_setlen(path, len);
+		strbuf_addch(path, '/');
+		strbuf_addstr(path, de->d_name);
+
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+
+			if (lstat(path->buf, &st) || !S_ISDIR(st.st_mode))
+				continue;
+		} else if (dtype != DT_DIR) {
+			continue;
+		}
+		if (!strcmp(path->buf, state->path_gitdir_watch.buf))
+			continue;
+
+		ret = add_watches(state, path);
+	}
+	strbuf_setlen(path, len);
+	closedir(dir);
+	return ret;
+}
+
+/*
+ * Stop watching "dir" and the directories below it, when it has
+ * been moved away.  If it is moved within the worktree, its new
+ * name is watched anew when we see where it went.
+ */
+static void remove_watches(struct fsm_listen_data *data, const char *dir)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	struct watch_entry **gone = NULL;
+	size_t nr = 0, alloc = 0, i;
+	size_t len = strlen(dir);
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (strncmp(w->dir, dir, len) ||
+		    (w->dir[len] && w->dir[len] != '/'))
+			continue;
+		ALLOC_GROW(gone, nr + 1, alloc);
+		gone[nr++] = w;
+	}
+	for (i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd_inotify, gone[i]->wd);
+		forget_watch(data, gone[i]);
+	}
+	free(gone);
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+/*
+ * Handle the events in "buf", queueing the changed paths into
+ * "batch" and the cookies into "cookie_list".  Returns the way to
+ * shut down if we have to, or SHUTDOWN_EVENT to keep going.
+ */
+static enum shutdown_style handle_events(struct fsmonitor_daemon_state *state,
+					 const char *buf, size_t len,
+					 struct fsmonitor_batch **batch,
+					 struct string_list *cookie_list)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf path = STRBUF_INIT;
+	enum shutdown_style ret = SHUTDOWN_EVENT;
+	const char *p;
+
+	for (p = buf; !ret && p < buf + len; ) {
+		const struct inotify_event *ev = (const struct inotify_event *)p;
+		struct watch_entry *w;
+		const char *rel, *slash;
+
+		p += sizeof(*ev) + ev->len;
+
+		/*
+		 * The kernel dropped events.  Flush what we have and
+		 * make sure that we watch any directory we may have
+		 * missed.
+		 */
+		if (ev->mask & IN_Q_OVERFLOW) {
+			trace_printf_key(&trace_fsmonitor, "inotify: overflow");
+			fsmonitor_force_resync(state);
+			fsmonitor_batch__free_list(*batch);
+			string_list_clear(cookie_list, 0);
+			*batch = NULL;
+
+			strbuf_reset(&path);
+			strbuf_addbuf(&path, &state->path_worktree_watch);
+			if (add_watches(state, &path))
+				ret = FORCE_ERROR_STOP;
+			continue;
+		}
+
+		w = find_watch(data, ev->wd);
+		if (!w)
+			continue;
+
+		if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+			/*
+			 * The parent directory reports the removal of
+			 * everything but the roots of our watches.
+			 */
+			if (ev->wd == data->wd_worktree ||
+			    ev->wd == data->wd_gitdir) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: root removed");
+				ret = FORCE_SHUTDOWN;
+			}
+			if (ev->mask & IN_IGNORED)
+				forget_watch(data, w);
+			continue;
+		}
+
+		strbuf_reset(&path);
+		strbuf_addstr(&path, w->dir);
+		if (ev->len) {
+			strbuf_addch(&path, '/');
+			strbuf_addstr(&path, ev->name);
+		}
+
+		switch (fsmonitor_classify_path_absolute(state, path.buf)) {
+
+		case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+		case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+			/* special case cookie files within .git or gitdir */
+
+			/* Use just the filename of the cookie file. */
+			slash = find_last_dir_sep(path.buf);
+			string_list_append(cookie_list,
+					   slash ? slash + 1 : path.buf);
+			break;
+
+		case IS_INSIDE_DOT_GIT:
+		case IS_INSIDE_GITDIR:
+			/* ignore all other paths inside of .git or gitdir */
+			break;
+
+		case IS_DOT_GIT:
+		case IS_GITDIR:
+			/*
+			 * If .git directory is deleted or renamed away,
+			 * we have to quit.
+			 */
+			if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed");
+				ret = FORCE_SHUTDOWN;
+			}
+			break;
+
+		case IS_WORKDIR_PATH:
+			/* try to queue normal pathnames */
+
+			if (trace_pass_fl(&trace_fsmonitor))
+				log_mask_set(path.buf, ev->mask);
+
+			if (!*batch)
+				*batch = fsmonitor_batch__new();
+
+			rel = path.buf + state->path_worktree_watch.len + 1;
+			if (!(ev->mask & IN_ISDIR)) {
+				fsmonitor_batch__add_path(*batch, rel);
+				break;
+			}
+
+			/*
+			 * Report a directory with a trailing slash, so
+			 * that the client invalidates everything below
+			 * it; that covers whatever appeared in a new
+			 * directory before we started to watch it.
+			 */
+			if (ev->mask & IN_MOVED_FROM)
+				remove_watches(data, path.buf);
+			if (ev->mask & (IN_CREATE | IN_MOVED_TO) &&
+			    add_watches(state, &path))
+				ret = FORCE_ERROR_STOP;
+
+			strbuf_addch(&path, '/');
+			rel = path.buf + state->path_worktree_watch.len + 1;
+			fsmonitor_batch__add_path(*batch, rel);
+			break;
+
+		case IS_OUTSIDE_CONE:
+		default:
+			trace_printf_key(&trace_fsmonitor,
+					 "ignoring '%s'", path.buf);
+			break;
+		}
+	}
+
+	strbuf_release(&path);
+	return ret;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct strbuf path = STRBUF_INIT;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	data->wd_worktree = data->wd_gitdir = -1;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+
+	data->fd_inotify = inotify_init1(IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("could not initialize inotify"));
+		goto failed;
+	}
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create pipe"));
+		goto failed;
+	}
+
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	if (add_watches(state, &path))
+		goto failed;
+	/* Watching it again merely tells us its watch descriptor. */
+	data->wd_worktree = add_watch(data, path.buf);
+	if (data->wd_worktree < 0)
+		goto failed;
+
+	if (state->nr_paths_watching > 1) {
+		data->wd_gitdir = add_watch(data, state->path_gitdir_watch.buf);
+		if (data->wd_gitdir < 0)
+			goto failed;
+	}
+
+	/* The cookie prefix ends in a slash. */
+	strbuf_reset(&path);
+	strbuf_addbuf(&path, &state->path_cookie_prefix);
+	strbuf_strip_suffix(&path, "/");
+	if (add_watch(data, path.buf) < 0)
+		goto failed;
+
+	strbuf_release(&path);
+	return 0;
+
+failed:
+	error(_("Unable to watch '%s' with inotify."),
+	      state->path_worktree_watch.buf);
+	strbuf_release(&path);
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent)
+		free(w->dir);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = state->listen_data;
+
+	if (write_in_full(data->fd_stop[1], "", 1) < 0)
+		warning_errno(_("could not stop the inotify listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	union {
+		struct inotify_event ev;
+		char buf[64 * 1024];
+	} u;
+
+	data = state->listen_data;
+	data->shutdown_style = SHUTDOWN_EVENT;
+
+	while (data->shutdown_style == SHUTDOWN_EVENT) {
+		struct fsmonitor_batch *batch = NULL;
+		struct string_list cookie_list = STRING_LIST_INIT_DUP;
+		struct pollfd pfd[2];
+		ssize_t len;
+
+		pfd[0].fd = data->fd_inotify;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = data->fd_stop[0];
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("poll() failed"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		len = xread(data->fd_inotify, u.buf, sizeof(u.buf));
+		if (len < 0) {
+			error_errno(_("could not read inotify events"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		data->shutdown_style = handle_events(state, u.buf, len,
+						     &batch, &cookie_list);
+		if (data->shutdown_style == SHUTDOWN_EVENT)
+			fsmonitor_publish(state, batch, &cookie_list);
+		else
+			fsmonitor_batch__free_list(batch);
+		string_list_clear(&cookie_list, 0);
+	}
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
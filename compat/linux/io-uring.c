@@ -0,0 +1,200 @@
+#include "git-compat-util.h"
+#include "compat/linux/io-uring.h"
+
+#include <sys/syscall.h>
+
+struct git_uring {
+	int fd;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	/* entries handed out by git_uring_get_sqe(), not yet submitted */
+	unsigned sq_pending;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	unsigned entries;
+	unsigned inflight;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+struct git_uring *git_uring_init(unsigned entries)
+{
+	struct io_uring_params p;
+	struct git_uring *ring;
+	int saved_errno;
+
+	memset(&p, 0, sizeof(p));
+	CALLOC_ARRAY(ring, 1);
+	ring->fd = sys_io_uring_setup(entries, &p);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+	ring->entries = p.sq_entries;
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto fail_sq;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, ring->fd,
+				     IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+			goto fail_cq;
+	}
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail_sqes;
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = *(unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+
+	ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+
+	return ring;
+
+fail_sqes:
+	saved_errno = errno;
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	errno = saved_errno;
+fail_cq:
+	saved_errno = errno;
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	errno = saved_errno;
+fail_sq:
+	saved_errno = errno;
+	close(ring->fd);
+	free(ring);
+	errno = saved_errno;
+	return NULL;
+}
+
+void git_uring_release(struct git_uring *ring)
+{
+	if (!ring)
+		return;
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	free(ring);
+}
+
+struct io_uring_sqe *git_uring_get_sqe(struct git_uring *ring)
+{
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *ring->sq_tail + ring->sq_pending;
+	struct io_uring_sqe *sqe;
+
+	/*
+	 * Never have more operations in flight than the submission queue
+	 * can hold; the completion queue is at least that large, so it
+	 * cannot overflow.
+	 */
+	if (tail - head >= ring->entries ||
+	    ring->inflight + ring->sq_pending >= ring->entries)
+		return NULL;
+
+	sqe = &ring->sqes[tail & ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+	ring->sq_pending++;
+	return sqe;
+}
+
+int git_uring_submit(struct git_uring *ring, unsigned wait_nr)
+{
+	unsigned to_submit = ring->sq_pending;
+	unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	if (wait_nr > ring->inflight + to_submit)
+		wait_nr = ring->inflight + to_submit;
+	if (!to_submit && !wait_nr)
+		return 0;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + to_submit,
+			 __ATOMIC_RELEASE);
+	ring->sq_pending = 0;
+	ring->inflight += to_submit;
+
+	do {
+		ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : 0;
+}
+
+unsigned git_uring_inflight(struct git_uring *ring)
+{
+	return ring->inflight + ring->sq_pending;
+}
+
+unsigned git_uring_reap(struct git_uring *ring, git_uring_complete_fn fn,
+			void *cb_data)
+{
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned nr = 0;
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+
+		fn(cqe->user_data, cqe->res, cb_data);
+		head++;
+		nr++;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	ring->inflight -= nr;
+	return nr;
+}
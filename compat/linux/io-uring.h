@@ -0,0 +1,52 @@
+#ifndef COMPAT_LINUX_IO_URING_H
+#define COMPAT_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+
+/*
+ * A minimal wrapper around the raw io_uring(7) system calls, so that we
+ * do not need to depend on liburing. Only the subset needed to queue
+ * up a bunch of independent operations and reap their completions is
+ * provided.
+ */
+struct git_uring;
+
+/*
+ * Set up a ring with room for (at least) "entries" submissions. Returns
+ * NULL and sets errno if the kernel does not support io_uring or does
+ * not let us use it.
+ */
+struct git_uring *git_uring_init(unsigned entries);
+
+/* Tear down the ring. Operations still in flight are not waited for. */
+void git_uring_release(struct git_uring *ring);
+
+/*
+ * Return a cleared submission queue entry to be filled in by the caller,
+ * or NULL if the queue is full. The entry is passed to the kernel by the
+ * next call to git_uring_submit().
+ */
+struct io_uring_sqe *git_uring_get_sqe(struct git_uring *ring);
+
+/*
+ * Hand all entries obtained from git_uring_get_sqe() to the kernel, and
+ * wait until at least "wait_nr" operations have completed. Returns 0 on
+ * success, or a negative errno value.
+ */
+int git_uring_submit(struct git_uring *ring, unsigned wait_nr);
+
+/* The number of operations that were submitted but not reaped yet. */
+unsigned git_uring_inflight(struct git_uring *ring);
+
+typedef void (*git_uring_complete_fn)(uint64_t user_data, int res,
+				      void *cb_data);
+
+/*
+ * Call "fn" for each completed operation with the user_data of its
+ * submission queue entry and its result (a negative errno value on
+ * failure). Returns the number of completions consumed.
+ */
+unsigned git_uring_reap(struct git_uring *ring, git_uring_complete_fn fn,
+			void *cb_data);
+
+#endif /* COMPAT_LINUX_IO_URING_H */
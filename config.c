@@ -35,6 +35,8 @@
 #include "replace-object.h"
 #include "refs.h"
 #include "setup.h"
+#include "statinfo.h"
+#include "strmap.h"
 #include "strvec.h"
 #include "trace2.h"
 #include "wildmatch.h"
@@ -1028,6 +1030,58 @@ static void kvi_from_source(struct config_source *cs,
 	out->path = cs->path;
 }
 
+static int report_bad_config_line(struct config_source *cs,
+				  const struct config_options *opts)
+{
+	int error_return = 0;
+	char *error_msg = NULL;
+
+	switch (cs->origin_type) {
+	case CONFIG_ORIGIN_BLOB:
+		error_msg = xstrfmt(_("bad config line %d in blob %s"),
+				      cs->linenr, cs->name);
+		break;
+	case CONFIG_ORIGIN_FILE:
+		error_msg = xstrfmt(_("bad config line %d in file %s"),
+				      cs->linenr, cs->name);
+		break;
+	case CONFIG_ORIGIN_STDIN:
+		error_msg = xstrfmt(_("bad config line %d in standard input"),
+				      cs->linenr);
+		break;
+	case CONFIG_ORIGIN_SUBMODULE_BLOB:
+		error_msg = xstrfmt(_("bad config line %d in submodule-blob %s"),
+				       cs->linenr, cs->name);
+		break;
+	case CONFIG_ORIGIN_CMDLINE:
+		error_msg = xstrfmt(_("bad config line %d in command line %s"),
+				       cs->linenr, cs->name);
+		break;
+	default:
+		error_msg = xstrfmt(_("bad config line %d in %s"),
+				      cs->linenr, cs->name);
+	}
+
+	switch (opts && opts->error_action ?
+		opts->error_action :
+		cs->default_error_action) {
+	case CONFIG_ERROR_DIE:
+		die("%s", error_msg);
+		break;
+	case CONFIG_ERROR_ERROR:
+		error_return = error("%s", error_msg);
+		break;
+	case CONFIG_ERROR_SILENT:
+		error_return = -1;
+		break;
+	case CONFIG_ERROR_UNSET:
+		BUG("config error action unset");
+	}
+
+	free(error_msg);
+	return error_return;
+}
+
 static int git_parse_source(struct config_source *cs, config_fn_t fn,
 			    struct key_value_info *kvi, void *data,
 			    const struct config_options *opts)
@@ -1035,8 +1089,6 @@ static int git_parse_source(struct config_source *cs, config_fn_t fn,
 	int comment = 0;
 	size_t baselen = 0;
 	struct strbuf *var = &cs->var;
-	int error_return = 0;
-	char *error_msg = NULL;
 
 	/* U+FEFF Byte Order Mark in UTF8 */
 	const char *bomptr = utf8_bom;
@@ -1121,50 +1173,7 @@ static int git_parse_source(struct config_source *cs, config_fn_t fn,
 	if (do_event(cs, CONFIG_EVENT_ERROR, &event_data) < 0)
 		return -1;
 
-	switch (cs->origin_type) {
-	case CONFIG_ORIGIN_BLOB:
-		error_msg = xstrfmt(_("bad config line %d in blob %s"),
-				      cs->linenr, cs->name);
-		break;
-	case CONFIG_ORIGIN_FILE:
-		error_msg = xstrfmt(_("bad config line %d in file %s"),
-				      cs->linenr, cs->name);
-		break;
-	case CONFIG_ORIGIN_STDIN:
-		error_msg = xstrfmt(_("bad config line %d in standard input"),
-				      cs->linenr);
-		break;
-	case CONFIG_ORIGIN_SUBMODULE_BLOB:
-		error_msg = xstrfmt(_("bad config line %d in submodule-blob %s"),
-				       cs->linenr, cs->name);
-		break;
-	case CONFIG_ORIGIN_CMDLINE:
-		error_msg = xstrfmt(_("bad config line %d in command line %s"),
-				       cs->linenr, cs->name);
-		break;
-	default:
-		error_msg = xstrfmt(_("bad config line %d in %s"),
-				      cs->linenr, cs->name);
-	}
-
-	switch (opts && opts->error_action ?
-		opts->error_action :
-		cs->default_error_action) {
-	case CONFIG_ERROR_DIE:
-		die("%s", error_msg);
-		break;
-	case CONFIG_ERROR_ERROR:
-		error_return = error("%s", error_msg);
-		break;
-	case CONFIG_ERROR_SILENT:
-		error_return = -1;
-		break;
-	case CONFIG_ERROR_UNSET:
-		BUG("config error action unset");
-	}
-
-	free(error_msg);
-	return error_return;
+	return report_bad_config_line(cs, opts);
 }
 
 NORETURN
@@ -1889,21 +1898,158 @@ static int git_config_from_stdin(config_fn_t fn, void *data,
 				   data, scope, NULL);
 }
 
+/*
+ * The same config files are read several times while a command starts
+ * up: the repository config to check its format, all of them for the
+ * pager and aliases, and all of them again into the config set of the
+ * repository. Remember the entries of every file that was parsed without
+ * errors, so that reading it again while it has not changed only calls
+ * the callback on them, without parsing the file.
+ */
+struct parsed_config_entry {
+	char *key;
+	char *value;
+	int linenr;
+};
+
+struct parsed_config_file {
+	struct stat_validity validity;
+	struct parsed_config_entry *entries;
+	size_t nr, alloc;
+};
+
+static struct strmap parsed_config_files = STRMAP_INIT;
+/* do not replace a parsed file while its entries are being replayed */
+static int replaying_config_file;
+
+static void free_parsed_config_file(struct parsed_config_file *file)
+{
+	size_t i;
+
+	if (!file)
+		return;
+	for (i = 0; i < file->nr; i++) {
+		free(file->entries[i].key);
+		free(file->entries[i].value);
+	}
+	free(file->entries);
+	stat_validity_clear(&file->validity);
+	free(file);
+}
+
+/*
+ * A file that was modified within the last second could be replaced
+ * again within the same second by one of the same size, which might
+ * even reuse its inode, and stat_validity_check() would not notice when
+ * timestamps only have a resolution of seconds.
+ */
+static int config_file_is_settled(int fd)
+{
+	struct stat st;
+
+	return !fstat(fd, &st) && S_ISREG(st.st_mode) &&
+	       st.st_mtime + 1 < time(NULL);
+}
+
+struct config_recorder {
+	config_fn_t fn;
+	void *data;
+	struct parsed_config_file *file;
+};
+
+static int record_config_entry(const char *key, const char *value,
+			       const struct config_context *ctx, void *data)
+{
+	struct config_recorder *rec = data;
+	struct parsed_config_file *file = rec->file;
+	struct parsed_config_entry *e;
+
+	ALLOC_GROW(file->entries, file->nr + 1, file->alloc);
+	e = &file->entries[file->nr++];
+	e->key = xstrdup(key);
+	e->value = xstrdup_or_null(value);
+	e->linenr = ctx->kvi->linenr;
+	return rec->fn(key, value, ctx, rec->data);
+}
+
+static int replay_config_file(const struct parsed_config_file *file,
+			      config_fn_t fn, const char *filename, void *data,
+			      enum config_scope scope,
+			      const struct config_options *opts)
+{
+	struct config_source top = CONFIG_SOURCE_INIT;
+	struct key_value_info kvi = KVI_INIT;
+	struct config_context ctx = {
+		.kvi = &kvi,
+	};
+	int ret = 0;
+	size_t i;
+
+	top.origin_type = CONFIG_ORIGIN_FILE;
+	top.name = filename;
+	top.path = filename;
+	top.default_error_action = CONFIG_ERROR_DIE;
+	kvi_from_source(&top, scope, &kvi);
+
+	replaying_config_file++;
+	for (i = 0; i < file->nr; i++) {
+		const struct parsed_config_entry *e = &file->entries[i];
+
+		kvi.linenr = e->linenr;
+		if (fn(e->key, e->value, &ctx, data) < 0) {
+			top.linenr = e->linenr;
+			ret = report_bad_config_line(&top, opts);
+			break;
+		}
+	}
+	replaying_config_file--;
+	return ret;
+}
+
 int git_config_from_file_with_options(config_fn_t fn, const char *filename,
 				      void *data, enum config_scope scope,
 				      const struct config_options *opts)
 {
-	int ret = -1;
+	/* the parser events refer to offsets in the file */
+	int use_parsed = !opts || !opts->event_fn;
+	struct parsed_config_file *file;
+	int ret;
 	FILE *f;
 
 	if (!filename)
 		BUG("filename cannot be NULL");
+
+	if (use_parsed) {
+		file = strmap_get(&parsed_config_files, filename);
+		if (file && stat_validity_check(&file->validity, filename))
+			return replay_config_file(file, fn, filename, data,
+						  scope, opts);
+	}
+
 	f = fopen_or_warn(filename, "r");
-	if (f) {
+	if (!f)
+		return -1;
+
+	if (use_parsed && !replaying_config_file &&
+	    config_file_is_settled(fileno(f))) {
+		struct config_recorder rec = { .fn = fn, .data = data };
+
+		CALLOC_ARRAY(rec.file, 1);
+		stat_validity_update(&rec.file->validity, fileno(f));
+		ret = do_config_from_file(record_config_entry,
+					  CONFIG_ORIGIN_FILE, filename,
+					  filename, f, &rec, scope, opts);
+		if (ret)
+			free_parsed_config_file(rec.file);
+		else
+			free_parsed_config_file(strmap_put(&parsed_config_files,
+							   filename, rec.file));
+	} else {
 		ret = do_config_from_file(fn, CONFIG_ORIGIN_FILE, filename,
 					  filename, f, data, scope, opts);
-		fclose(f);
 	}
+
+	fclose(f);
 	return ret;
 }
 
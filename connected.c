@@ -1,4 +1,5 @@
 #include "git-compat-util.h"
+#include "config.h"
 #include "gettext.h"
 #include "hex.h"
 #include "object-store-ll.h"
@@ -6,8 +7,443 @@
 #include "sigchain.h"
 #include "connected.h"
 #include "transport.h"
+#include "oid-array.h"
+#include "pack-bitmap.h"
 #include "packfile.h"
+#include "progress.h"
 #include "promisor-remote.h"
+#include "shallow.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "tree-walk.h"
+
+static void prepare_rev_list(struct child_process *rev_list,
+			     struct check_connected_options *opt)
+{
+	if (opt->shallow_file) {
+		strvec_push(&rev_list->args, "--shallow-file");
+		strvec_push(&rev_list->args, opt->shallow_file);
+	}
+	strvec_push(&rev_list->args,"rev-list");
+	strvec_push(&rev_list->args, "--objects");
+	strvec_push(&rev_list->args, "--stdin");
+	if (repo_has_promisor_remote(the_repository))
+		strvec_push(&rev_list->args, "--exclude-promisor-objects");
+	if (!opt->is_deepening_fetch) {
+		strvec_push(&rev_list->args, "--not");
+		if (opt->exclude_hidden_refs_section)
+			strvec_pushf(&rev_list->args, "--exclude-hidden=%s",
+				     opt->exclude_hidden_refs_section);
+		strvec_push(&rev_list->args, "--all");
+	}
+	strvec_push(&rev_list->args, "--quiet");
+	strvec_push(&rev_list->args, "--alternate-refs");
+
+	rev_list->git_cmd = 1;
+	if (opt->env)
+		strvec_pushv(&rev_list->env, opt->env);
+	rev_list->in = -1;
+	rev_list->no_stdout = 1;
+}
+
+static int finish_rev_list(struct child_process *rev_list, FILE *rev_list_in)
+{
+	int err = 0;
+
+	if (ferror(rev_list_in) || fflush(rev_list_in)) {
+		if (errno != EPIPE && errno != EINVAL)
+			error_errno(_("failed write to rev-list"));
+		err = -1;
+	}
+
+	if (fclose(rev_list_in))
+		err = error_errno(_("failed to close rev-list's stdin"));
+
+	sigchain_pop(SIGPIPE);
+	return finish_command(rev_list) || err;
+}
+
+/*
+ * The objects of a newly received pack are connected if everything that
+ * they point to is either in the pack, too, or already connected. Rather
+ * than having rev-list walk all of the pack, what they point to outside
+ * of the pack is taken from the ".boundary" file of index-pack, if there
+ * is one, or else collected by threads that read the objects of the pack.
+ * Blobs outside of the pack merely need to exist, objects in promisor
+ * packs or covered by bitmaps are known to be connected, and only what is
+ * left of the others is given to rev-list.
+ */
+#define PACK_WALK_BATCH 256
+
+struct pack_walk {
+	struct repository *r;
+	struct packed_git *pack;
+	uint32_t next, done;
+	struct progress *progress;
+	struct oid_array outside;
+	int err;
+	pthread_mutex_t mutex;
+};
+
+struct pack_walk_thread {
+	struct pack_walk *walk;
+	struct oid_array outside;
+	int err;
+};
+
+static void add_link(struct pack_walk_thread *t, const struct object_id *oid,
+		     enum object_type type)
+{
+	if (find_pack_entry_one(oid->hash, t->walk->pack))
+		return;
+	if (type != OBJ_BLOB)
+		oid_array_append(&t->outside, oid);
+	else if (!has_object(t->walk->r, oid, 0))
+		t->err = 1;
+}
+
+static int add_commit_links(struct pack_walk_thread *t, const char *buf)
+{
+	struct object_id oid;
+
+	if (!skip_prefix(buf, "tree ", &buf) ||
+	    parse_oid_hex(buf, &oid, &buf) || *buf++ != '\n')
+		return -1;
+	add_link(t, &oid, OBJ_TREE);
+	while (skip_prefix(buf, "parent ", &buf)) {
+		if (parse_oid_hex(buf, &oid, &buf) || *buf++ != '\n')
+			return -1;
+		add_link(t, &oid, OBJ_COMMIT);
+	}
+	return 0;
+}
+
+static int add_tree_links(struct pack_walk_thread *t, const void *buf,
+			  unsigned long size)
+{
+	struct tree_desc desc;
+
+	if (init_tree_desc_gently(&desc, buf, size, 0))
+		return -1;
+	while (desc.size) {
+		if (!S_ISGITLINK(desc.entry.mode))
+			add_link(t, &desc.entry.oid,
+				 S_ISDIR(desc.entry.mode) ? OBJ_TREE : OBJ_BLOB);
+		if (update_tree_entry_gently(&desc))
+			return -1;
+	}
+	return 0;
+}
+
+static int add_tag_links(struct pack_walk_thread *t, const char *buf)
+{
+	struct object_id oid;
+	int type;
+
+	if (!skip_prefix(buf, "object ", &buf) ||
+	    parse_oid_hex(buf, &oid, &buf) || *buf++ != '\n' ||
+	    !skip_prefix(buf, "type ", &buf))
+		return -1;
+	type = type_from_string_gently(buf, strchrnul(buf, '\n') - buf, 1);
+	if (type < 0)
+		return -1;
+	add_link(t, &oid, type);
+	return 0;
+}
+
+static int add_object_links(struct pack_walk_thread *t, uint32_t pos)
+{
+	struct repository *r = t->walk->r;
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	void *buf = NULL;
+	struct object_info oi = OBJECT_INFO_INIT;
+	int ret = -1;
+
+	if (nth_packed_object_id(&oid, t->walk->pack, pos))
+		return -1;
+	oi.typep = &type;
+	if (oid_object_info_extended(r, &oid, &oi, OBJECT_INFO_SKIP_FETCH_OBJECT) < 0)
+		return -1;
+	if (type == OBJ_BLOB)
+		return 0;
+
+	oi.sizep = &size;
+	oi.contentp = &buf;
+	if (oid_object_info_extended(r, &oid, &oi, OBJECT_INFO_SKIP_FETCH_OBJECT) < 0)
+		return -1;
+	switch (type) {
+	case OBJ_COMMIT:
+		ret = add_commit_links(t, buf);
+		break;
+	case OBJ_TREE:
+		ret = add_tree_links(t, buf, size);
+		break;
+	case OBJ_TAG:
+		ret = add_tag_links(t, buf);
+		break;
+	default:
+		break;
+	}
+	free(buf);
+	return ret;
+}
+
+static void *walk_pack_thread(void *arg)
+{
+	struct pack_walk_thread *t = arg;
+	struct pack_walk *walk = t->walk;
+
+	while (!t->err) {
+		uint32_t pos, end;
+
+		pthread_mutex_lock(&walk->mutex);
+		pos = walk->next;
+		end = pos + PACK_WALK_BATCH;
+		if (end > walk->pack->num_objects)
+			end = walk->pack->num_objects;
+		walk->next = end;
+		walk->done += end - pos;
+		display_progress(walk->progress, walk->done);
+		pthread_mutex_unlock(&walk->mutex);
+		if (pos == end)
+			break;
+
+		for (; pos < end && !t->err; pos++)
+			if (add_object_links(t, pos))
+				t->err = 1;
+	}
+	return NULL;
+}
+
+static int in_promisor_pack(struct repository *r, const struct object_id *oid)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(r); p; p = p->next)
+		if (p->pack_promisor && find_pack_entry_one(oid->hash, p))
+			return 1;
+	return 0;
+}
+
+/*
+ * Read the ".boundary" file that index-pack --record-boundary wrote for
+ * "pack", and add the commits, trees and tags in it that still need to
+ * be walked to "outside". Return -1 if there is no such file, and 1 if an
+ * object in it is neither present nor promised.
+ */
+static int read_pack_boundary(struct repository *r, struct packed_git *pack,
+			      struct oid_array *outside)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *path;
+	const char *line;
+	size_t len, nr = 0;
+	int promisor = repo_has_promisor_remote(r);
+	int ret = 0;
+
+	if (!strip_suffix(pack->pack_name, ".pack", &len))
+		return -1;
+	path = xstrfmt("%.*s.boundary", (int)len, pack->pack_name);
+	if (strbuf_read_file(&buf, path, 0) < 0) {
+		free(path);
+		strbuf_release(&buf);
+		return -1;
+	}
+
+	for (line = buf.buf; *line && !ret; nr++) {
+		struct object_id oid;
+		const char *end;
+		int type;
+
+		if (parse_oid_hex(line, &oid, &line) || *line++ != ' ') {
+			warning(_("ignoring invalid pack boundary '%s'"), path);
+			ret = -1;
+			break;
+		}
+		end = strchrnul(line, '\n');
+		type = type_from_string_gently(line, end - line, 1);
+		line = *end ? end + 1 : end;
+
+		if (find_pack_entry_one(oid.hash, pack))
+			continue;
+		if (promisor && in_promisor_pack(r, &oid))
+			continue;
+		if (!has_object(r, &oid, 0)) {
+			/*
+			 * What a promisor pack points to, but does not have,
+			 * is promised.
+			 */
+			if (!pack->pack_promisor)
+				ret = 1;
+			continue;
+		}
+		if (type != OBJ_BLOB)
+			oid_array_append(outside, &oid);
+	}
+	if (!ret)
+		trace2_data_intmax("connectivity", r, "boundary", nr);
+	strbuf_release(&buf);
+	free(path);
+	return ret;
+}
+
+/*
+ * Read the objects of the pack in threads, adding what they point to
+ * outside of the pack to walk->outside. Return non-zero if an object
+ * cannot be read or points to a missing blob.
+ */
+static int walk_pack(struct pack_walk *walk, int progress)
+{
+	struct repository *r = walk->r;
+	struct packed_git *pack = walk->pack;
+	struct pack_walk_thread *threads;
+	pthread_t *pthreads;
+	int nr_threads, i, err = 0;
+
+	if (repo_config_get_int(r, "transfer.connectivitythreads", &nr_threads) ||
+	    !nr_threads)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS || nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > DIV_ROUND_UP(pack->num_objects, PACK_WALK_BATCH))
+		nr_threads = DIV_ROUND_UP(pack->num_objects, PACK_WALK_BATCH);
+
+	trace2_region_enter("connectivity", "walk-pack", r);
+	if (progress)
+		walk->progress = start_delayed_progress(_("Checking connectivity"),
+							pack->num_objects);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		threads[i].walk = walk;
+	pthread_mutex_init(&walk->mutex, NULL);
+	if (nr_threads > 1) {
+		enable_obj_read_lock();
+		CALLOC_ARRAY(pthreads, nr_threads);
+		for (i = 0; i < nr_threads; i++) {
+			int ret = pthread_create(&pthreads[i], NULL,
+						 walk_pack_thread, &threads[i]);
+			if (ret)
+				die(_("unable to create thread: %s"),
+				    strerror(ret));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(pthreads[i], NULL);
+		disable_obj_read_lock();
+		free(pthreads);
+	} else if (nr_threads) {
+		walk_pack_thread(&threads[0]);
+	}
+	pthread_mutex_destroy(&walk->mutex);
+	stop_progress(&walk->progress);
+
+	for (i = 0; i < nr_threads; i++) {
+		size_t j;
+		err |= threads[i].err;
+		for (j = 0; j < threads[i].outside.nr; j++)
+			oid_array_append(&walk->outside,
+					 &threads[i].outside.oid[j]);
+		oid_array_clear(&threads[i].outside);
+	}
+	free(threads);
+	trace2_region_leave("connectivity", "walk-pack", r);
+	return err;
+}
+
+static int check_pack_connected(struct packed_git *pack,
+				struct oid_array *tips,
+				struct check_connected_options *opt)
+{
+	struct repository *r = the_repository;
+	struct pack_walk walk = {
+		.r = r,
+		.pack = pack,
+		.outside = OID_ARRAY_INIT,
+	};
+	struct bitmap_index *bitmap_git;
+	struct child_process rev_list = CHILD_PROCESS_INIT;
+	FILE *rev_list_in;
+	int err;
+	size_t i, nr_outside = 0, nr_bitmapped = 0;
+
+	if (open_pack_index(pack))
+		return -1;
+
+	err = read_pack_boundary(r, pack, &walk.outside);
+	if (err < 0) {
+		/* Walking a promisor pack would run into promised objects. */
+		oid_array_clear(&walk.outside);
+		if (repo_has_promisor_remote(r))
+			goto out;
+		err = walk_pack(&walk, opt->progress);
+	}
+	if (err)
+		goto out;
+
+	for (i = 0; i < tips->nr; i++)
+		if (!find_pack_entry_one(tips->oid[i].hash, pack) &&
+		    !(repo_has_promisor_remote(r) &&
+		      in_promisor_pack(r, &tips->oid[i])))
+			oid_array_append(&walk.outside, &tips->oid[i]);
+
+	bitmap_git = prepare_bitmap_git(r);
+	oid_array_sort(&walk.outside);
+	for (i = 0; i < walk.outside.nr; i++) {
+		const struct object_id *oid = &walk.outside.oid[i];
+
+		if (i && oideq(oid, &walk.outside.oid[i - 1]))
+			continue;
+		if (bitmap_git && bitmap_covers_oid(bitmap_git, oid))
+			nr_bitmapped++;
+		else
+			walk.outside.oid[nr_outside++] = *oid;
+	}
+	walk.outside.nr = nr_outside;
+	free_bitmap_index(bitmap_git);
+
+	trace2_data_intmax("connectivity", r, "pack-objects", pack->num_objects);
+	trace2_data_intmax("connectivity", r, "bitmapped", nr_bitmapped);
+	trace2_data_intmax("connectivity", r, "outside", nr_outside);
+	if (!nr_outside)
+		goto out;
+
+	/*
+	 * Whatever rev-list complains about is reported when all of the
+	 * objects are checked again, so let it stay quiet.
+	 */
+	prepare_rev_list(&rev_list, opt);
+	rev_list.no_stderr = 1;
+	if (start_command(&rev_list)) {
+		err = -1;
+		goto out;
+	}
+	sigchain_push(SIGPIPE, SIG_IGN);
+	rev_list_in = xfdopen(rev_list.in, "w");
+	for (i = 0; i < walk.outside.nr; i++)
+		if (fprintf(rev_list_in, "%s\n",
+			    oid_to_hex(&walk.outside.oid[i])) < 0)
+			break;
+	err = finish_rev_list(&rev_list, rev_list_in);
+
+out:
+	oid_array_clear(&walk.outside);
+	return err ? -1 : 0;
+}
+
+struct oid_array_iter {
+	struct oid_array *oids;
+	size_t i;
+};
+
+static const struct object_id *iterate_oid_array(void *cb_data)
+{
+	struct oid_array_iter *iter = cb_data;
+
+	if (iter->i >= iter->oids->nr)
+		return NULL;
+	return &iter->oids->oid[iter->i++];
+}
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -29,7 +465,10 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	const struct object_id *oid;
 	int err = 0;
 	struct packed_git *new_pack = NULL;
+	int self_contained = 0;
 	struct transport *transport;
+	struct oid_array tips = OID_ARRAY_INIT;
+	struct oid_array_iter tips_iter = { .oids = &tips };
 	size_t base_len;
 
 	if (!opt)
@@ -43,9 +482,7 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		return err;
 	}
 
-	if (transport && transport->smart_options &&
-	    transport->smart_options->self_contained_and_connected &&
-	    transport->pack_lockfiles.nr == 1 &&
+	if (transport && transport->pack_lockfiles.nr == 1 &&
 	    strip_suffix(transport->pack_lockfiles.items[0].string,
 			 ".keep", &base_len)) {
 		struct strbuf idx_file = STRBUF_INIT;
@@ -54,6 +491,8 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		strbuf_addstr(&idx_file, ".idx");
 		new_pack = add_packed_git(idx_file.buf, idx_file.len, 1);
 		strbuf_release(&idx_file);
+		self_contained = transport->smart_options &&
+			transport->smart_options->self_contained_and_connected;
 	}
 
 	if (repo_has_promisor_remote(the_repository)) {
@@ -92,33 +531,38 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	}
 
 no_promisor_pack_found:
-	if (opt->shallow_file) {
-		strvec_push(&rev_list.args, "--shallow-file");
-		strvec_push(&rev_list.args, opt->shallow_file);
-	}
-	strvec_push(&rev_list.args,"rev-list");
-	strvec_push(&rev_list.args, "--objects");
-	strvec_push(&rev_list.args, "--stdin");
-	if (repo_has_promisor_remote(the_repository))
-		strvec_push(&rev_list.args, "--exclude-promisor-objects");
-	if (!opt->is_deepening_fetch) {
-		strvec_push(&rev_list.args, "--not");
-		if (opt->exclude_hidden_refs_section)
-			strvec_pushf(&rev_list.args, "--exclude-hidden=%s",
-				     opt->exclude_hidden_refs_section);
-		strvec_push(&rev_list.args, "--all");
+	/*
+	 * Check the objects of a new pack that is not known to be self
+	 * contained and connected from the inside. This does not know about
+	 * shallow commits, though.
+	 */
+	if (new_pack && !self_contained && !opt->shallow_file &&
+	    !opt->is_deepening_fetch &&
+	    !is_repository_shallow(the_repository)) {
+		do {
+			oid_array_append(&tips, oid);
+		} while ((oid = fn(cb_data)) != NULL);
+
+		if (!check_pack_connected(new_pack, &tips, opt)) {
+			close_pack_index(new_pack);
+			free(new_pack);
+			oid_array_clear(&tips);
+			if (opt->err_fd)
+				close(opt->err_fd);
+			return 0;
+		}
+
+		/* Let rev-list check all of the objects, and report. */
+		fn = iterate_oid_array;
+		cb_data = &tips_iter;
+		oid = fn(cb_data);
 	}
-	strvec_push(&rev_list.args, "--quiet");
-	strvec_push(&rev_list.args, "--alternate-refs");
+
+	prepare_rev_list(&rev_list, opt);
 	if (opt->progress)
 		strvec_pushf(&rev_list.args, "--progress=%s",
 			     _("Checking connectivity"));
 
-	rev_list.git_cmd = 1;
-	if (opt->env)
-		strvec_pushv(&rev_list.env, opt->env);
-	rev_list.in = -1;
-	rev_list.no_stdout = 1;
 	if (opt->err_fd)
 		rev_list.err = opt->err_fd;
 	else
@@ -126,6 +570,7 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 
 	if (start_command(&rev_list)) {
 		free(new_pack);
+		oid_array_clear(&tips);
 		return error(_("Could not run 'git rev-list'"));
 	}
 
@@ -142,23 +587,14 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		 * are sure the ref is good and not sending it to
 		 * rev-list for verification.
 		 */
-		if (new_pack && find_pack_entry_one(oid->hash, new_pack))
+		if (self_contained && find_pack_entry_one(oid->hash, new_pack))
 			continue;
 
 		if (fprintf(rev_list_in, "%s\n", oid_to_hex(oid)) < 0)
 			break;
 	} while ((oid = fn(cb_data)) != NULL);
 
-	if (ferror(rev_list_in) || fflush(rev_list_in)) {
-		if (errno != EPIPE && errno != EINVAL)
-			error_errno(_("failed write to rev-list"));
-		err = -1;
-	}
-
-	if (fclose(rev_list_in))
-		err = error_errno(_("failed to close rev-list's stdin"));
-
-	sigchain_pop(SIGPIPE);
 	free(new_pack);
-	return finish_command(&rev_list) || err;
+	oid_array_clear(&tips);
+	return finish_rev_list(&rev_list, rev_list_in);
 }
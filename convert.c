@@ -17,6 +17,10 @@
 #include "utf8.h"
 #include "merge-ll.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*
  * convert.c - convert a file when checking it out and checking it in.
  *
@@ -39,6 +43,25 @@ struct text_stat {
 	unsigned printable, nonprintable;
 };
 
+#ifdef __SSE2__
+/*
+ * Return how many of the 16 bytes at "buf" there are before the first
+ * one that is not plainly printable, i.e. a control character or DEL;
+ * gather_stats() counts all the others as printable.
+ */
+static unsigned plain_prefix_16(const char *buf)
+{
+	const __m128i ctrl_max = _mm_set1_epi8(31);
+	const __m128i del = _mm_set1_epi8(127);
+	__m128i v = _mm_loadu_si128((const __m128i *)buf);
+	__m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl_max), v);
+	unsigned mask = _mm_movemask_epi8(_mm_or_si128(ctrl,
+						       _mm_cmpeq_epi8(v, del)));
+
+	return mask ? __builtin_ctz(mask) : 16;
+}
+#endif
+
 static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
 {
 	unsigned long i;
@@ -46,7 +69,21 @@ static void gather_stats(const char *buf, unsigned long size, struct text_stat *
 	memset(stats, 0, sizeof(*stats));
 
 	for (i = 0; i < size; i++) {
-		unsigned char c = buf[i];
+		unsigned char c;
+
+#ifdef __SSE2__
+		while (i + 16 <= size) {
+			unsigned n = plain_prefix_16(buf + i);
+
+			stats->printable += n;
+			i += n;
+			if (n < 16)
+				break;
+		}
+		if (i == size)
+			break;
+#endif
+		c = buf[i];
 		if (c == '\r') {
 			if (i+1 < size && buf[i+1] == '\n') {
 				stats->crlf++;
@@ -558,6 +595,7 @@ static int crlf_to_git(struct index_state *istate,
 	/* only grow if not in place */
 	if (strbuf_avail(buf) + buf->len < len)
 		strbuf_grow(buf, len - buf->len);
+	/* Copy the runs between CRs; "src" may be "buf" itself. */
 	dst = buf->buf;
 	if (crlf_action == CRLF_AUTO || crlf_action == CRLF_AUTO_INPUT || crlf_action == CRLF_AUTO_CRLF) {
 		/*
@@ -565,18 +603,31 @@ static int crlf_to_git(struct index_state *istate,
 		 * lone CR, and we can strip a CR without looking at what
 		 * follow it.
 		 */
-		do {
-			unsigned char c = *src++;
-			if (c != '\r')
-				*dst++ = c;
-		} while (--len);
+		const char *cr;
+
+		while ((cr = memchr(src, '\r', len))) {
+			memmove(dst, src, cr - src);
+			dst += cr - src;
+			len -= cr + 1 - src;
+			src = cr + 1;
+		}
 	} else {
-		do {
-			unsigned char c = *src++;
-			if (! (c == '\r' && (1 < len && *src == '\n')))
-				*dst++ = c;
-		} while (--len);
+		const char *cr;
+
+		while ((cr = memchr(src, '\r', len))) {
+			size_t keep = cr - src;
+
+			/* keep the CR unless it comes right before a LF */
+			if (!(cr + 1 < src + len && cr[1] == '\n'))
+				keep++;
+			memmove(dst, src, keep);
+			dst += keep;
+			len -= cr + 1 - src;
+			src = cr + 1;
+		}
 	}
+	memmove(dst, src, len);
+	dst += len;
 	strbuf_setlen(buf, dst - buf->buf);
 	return 1;
 }
@@ -983,6 +1034,7 @@ static struct convert_driver {
 	const char *clean;
 	const char *process;
 	int required;
+	int parallel;
 } *user_convert, **user_convert_tail;
 
 static int apply_filter(const char *path, const char *src, size_t len,
@@ -1060,6 +1112,11 @@ static int read_convert_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (!strcmp("parallel", key)) {
+		drv->parallel = git_config_bool(var, value);
+		return 0;
+	}
+
 	return 0;
 }
 
@@ -1302,6 +1359,35 @@ static int git_path_check_ident(struct attr_check_item *check)
 
 static struct attr_check *check;
 
+static void prepare_convert_drivers(void)
+{
+	if (user_convert_tail)
+		return;
+	user_convert_tail = &user_convert;
+	git_config(read_convert_config, NULL);
+}
+
+const char *conv_attrs_driver_name(const struct conv_attrs *ca)
+{
+	return ca->drv ? ca->drv->name : NULL;
+}
+
+void conv_attrs_set_driver(struct conv_attrs *ca, const char *name)
+{
+	struct convert_driver *drv;
+
+	prepare_convert_drivers();
+	for (drv = user_convert; drv; drv = drv->next)
+		if (!strcmp(name, drv->name))
+			break;
+	ca->drv = drv;
+}
+
+int conv_attrs_filter_is_parallel(const struct conv_attrs *ca)
+{
+	return ca->drv && ca->drv->parallel;
+}
+
 void convert_attrs(struct index_state *istate,
 		   struct conv_attrs *ca, const char *path)
 {
@@ -1311,8 +1397,7 @@ void convert_attrs(struct index_state *istate,
 		check = attr_check_initl("crlf", "ident", "filter",
 					 "eol", "text", "working-tree-encoding",
 					 NULL);
-		user_convert_tail = &user_convert;
-		git_config(read_convert_config, NULL);
+		prepare_convert_drivers();
 	}
 
 	git_check_attr(istate, path, check);
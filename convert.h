@@ -91,6 +91,19 @@ struct conv_attrs {
 void convert_attrs(struct index_state *istate,
 		   struct conv_attrs *ca, const char *path);
 
+/*
+ * The name of the filter driver of "ca", if any, and a way to find the
+ * driver configured under that name again, e.g. in another process.
+ */
+const char *conv_attrs_driver_name(const struct conv_attrs *ca);
+void conv_attrs_set_driver(struct conv_attrs *ca, const char *name);
+
+/*
+ * Return 1 if the filter driver of "ca" is configured as safe to run
+ * in several processes at once ("filter.<driver>.parallel").
+ */
+int conv_attrs_filter_is_parallel(const struct conv_attrs *ca);
+
 extern enum eol core_eol;
 extern char *check_roundtrip_encoding;
 const char *get_cached_convert_stats_ascii(struct index_state *istate,
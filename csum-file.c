@@ -135,6 +135,31 @@ void hashwrite(struct hashfile *f, const void *buf, unsigned int count)
 	}
 }
 
+void hashwrite_external(struct hashfile *f, const void *buf, size_t count)
+{
+	if (f->offset)
+		BUG("hashwrite_external() with unflushed data in '%s'", f->name);
+	if (0 <= f->check_fd)
+		BUG("hashwrite_external() on a checking hashfile '%s'", f->name);
+
+	if (f->do_crc) {
+		const unsigned char *p = buf;
+		size_t left = count;
+
+		while (left) {
+			unsigned int nr = left > UINT_MAX ? UINT_MAX : left;
+			f->crc32 = crc32(f->crc32, p, nr);
+			p += nr;
+			left -= nr;
+		}
+	}
+	if (!f->skip_hash)
+		the_hash_algo->update_fn(&f->ctx, buf, count);
+
+	f->total += count;
+	display_throughput(f->tp, f->total);
+}
+
 struct hashfile *hashfd_check(const char *name)
 {
 	int sink, check;
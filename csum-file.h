@@ -49,6 +49,15 @@ struct hashfile *hashfd_throughput(int fd, const char *name, struct progress *tp
 int finalize_hashfile(struct hashfile *, unsigned char *, enum fsync_component, unsigned int);
 void hashwrite(struct hashfile *, const void *, unsigned int);
 void hashflush(struct hashfile *f);
+
+/*
+ * Account for "count" bytes that the caller already wrote to "f->fd" by
+ * other means (e.g. with sendfile()): they are fed to the checksum (and
+ * crc32, if enabled) as if they had been passed to hashwrite(), but are
+ * not written again. The caller must hashflush() before writing to the
+ * fd itself, and "buf" must hold a copy of the data that was written.
+ */
+void hashwrite_external(struct hashfile *f, const void *buf, size_t count);
 void crc32_begin(struct hashfile *);
 uint32_t crc32_end(struct hashfile *);
 
@@ -2,6 +2,8 @@
 #include "abspath.h"
 #include "config.h"
 #include "environment.h"
+#include "hash.h"
+#include "hex.h"
 #include "path.h"
 #include "pkt-line.h"
 #include "protocol.h"
@@ -9,6 +11,7 @@
 #include "setup.h"
 #include "strbuf.h"
 #include "string-list.h"
+#include "unix-socket.h"
 
 #ifdef NO_INITGROUPS
 #define initgroups(x, y) (0) /* nothing */
@@ -33,6 +36,9 @@ static const char daemon_usage[] =
 "           [--reuseaddr] [--pid-file=<file>]\n"
 "           [--(enable|disable|allow-override|forbid-override)=<service>]\n"
 "           [--access-hook=<path>]\n"
+"           [--upload-pack-pool=<dir> [--upload-pack-pool-workers=<n>]\n"
+"            [--upload-pack-pool-requests=<n>]\n"
+"            [--upload-pack-pool-idle-timeout=<n>]]\n"
 "           [--inetd | [--listen=<host_or_ipaddr>] [--port=<n>]\n"
 "                      [--detach] [--user=<user> [--group=<group>]]\n"
 "           [--log-destination=(stderr|syslog|none)]\n"
@@ -60,6 +66,15 @@ static const char *user_path;
 static unsigned int timeout;
 static unsigned int init_timeout;
 
+/*
+ * If set, upload-pack is served from pools of pre-forked workers, one
+ * per repository, that listen on sockets in this directory.
+ */
+static const char *upload_pack_pool;
+static int upload_pack_pool_workers = 2;
+static int upload_pack_pool_requests = 100;
+static int upload_pack_pool_idle_timeout = 60;
+
 struct hostinfo {
 	struct strbuf hostname;
 	struct strbuf canon_hostname;
@@ -460,9 +475,116 @@ static int run_service_command(struct child_process *cld)
 	return finish_command(cld);
 }
 
+#ifndef NO_UNIX_SOCKETS
+static void start_upload_pack_pool(const char *socket)
+{
+	struct child_process cld = CHILD_PROCESS_INIT;
+
+	strvec_pushl(&cld.args, "upload-pack", "--strict", NULL);
+	strvec_pushf(&cld.args, "--timeout=%u", timeout);
+	strvec_pushf(&cld.args, "--pool=%s", socket);
+	strvec_pushf(&cld.args, "--pool-workers=%d", upload_pack_pool_workers);
+	strvec_pushf(&cld.args, "--pool-requests=%d",
+		     upload_pack_pool_requests);
+	strvec_pushf(&cld.args, "--pool-idle-timeout=%d",
+		     upload_pack_pool_idle_timeout);
+	strvec_push(&cld.args, ".");
+	cld.git_cmd = 1;
+	cld.no_stdin = 1;
+	cld.no_stdout = 1;
+	cld.no_stderr = 1;
+
+	/* The pool outlives us; we do not wait for it. */
+	if (start_command(&cld))
+		logerror("unable to start upload-pack pool");
+	child_process_clear(&cld);
+}
+
+/*
+ * Hand the client over to the pool of upload-pack workers for the
+ * repository we are in, and relay what the worker logs. Return -1
+ * without touching the client if there is no pool to take it, after
+ * starting one for the connections to come. Otherwise return 0 and
+ * the outcome of the request in "ret".
+ */
+static int upload_pack_pooled(const struct strvec *env, int *ret)
+{
+	const struct git_hash_algo *algo = &hash_algos[GIT_HASH_SHA1];
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct strbuf buf = STRBUF_INIT;
+	git_hash_ctx ctx;
+	int fd, err[2], fds[2];
+	const char *var;
+	char c;
+	int i;
+
+	/* path_ok() left us in the repository. */
+	if (strbuf_getcwd(&buf) < 0)
+		return -1;
+	algo->init_fn(&ctx);
+	algo->update_fn(&ctx, buf.buf, buf.len);
+	algo->final_fn(hash, &ctx);
+	strbuf_reset(&buf);
+	strbuf_addf(&buf, "%s/%s", upload_pack_pool,
+		    hash_to_hex_algop(hash, algo));
+
+	fd = unix_stream_connect(buf.buf, 0);
+	if (fd < 0) {
+		start_upload_pack_pool(buf.buf);
+		strbuf_release(&buf);
+		return -1;
+	}
+	strbuf_release(&buf);
+
+	if (pipe(err) < 0) {
+		close(fd);
+		return -1;
+	}
+	fds[0] = 0;
+	fds[1] = err[1];
+	if (unix_stream_send_fds(fd, "", 1, fds, ARRAY_SIZE(fds)) < 0) {
+		close(err[0]);
+		close(err[1]);
+		close(fd);
+		return -1;
+	}
+	close(err[1]);
+
+	for (i = 0; i < env->nr; i++)
+		packet_buf_write(&buf, "%s", env->v[i]);
+	if ((var = getenv("REMOTE_ADDR")))
+		packet_buf_write(&buf, "REMOTE_ADDR=%s", var);
+	if ((var = getenv("REMOTE_PORT")))
+		packet_buf_write(&buf, "REMOTE_PORT=%s", var);
+	packet_buf_flush(&buf);
+	if (write_in_full(fd, buf.buf, buf.len) < 0)
+		logerror("unable to pass the request to the upload-pack pool");
+	strbuf_release(&buf);
+
+	close(0);
+	close(1);
+
+	copy_to_log(err[0]);
+
+	/* The worker tells us when it is done; it says nothing if it died. */
+	*ret = xread(fd, &c, 1) == 1 ? 0 : 128;
+	close(fd);
+	return 0;
+}
+#endif
+
 static int upload_pack(const struct strvec *env)
 {
 	struct child_process cld = CHILD_PROCESS_INIT;
+
+#ifndef NO_UNIX_SOCKETS
+	if (upload_pack_pool) {
+		int ret;
+		if (!upload_pack_pooled(env, &ret))
+			return ret;
+	}
+#endif
+
 	strvec_pushl(&cld.args, "upload-pack", "--strict", NULL);
 	strvec_pushf(&cld.args, "--timeout=%u", timeout);
 
@@ -1319,6 +1441,25 @@ int cmd_main(int argc, const char **argv)
 				max_connections = 0;	        /* unlimited */
 			continue;
 		}
+		if (skip_prefix(arg, "--upload-pack-pool=", &v)) {
+#ifdef NO_UNIX_SOCKETS
+			die("--upload-pack-pool not supported on this platform");
+#endif
+			upload_pack_pool = xstrdup(absolute_path(v));
+			continue;
+		}
+		if (skip_prefix(arg, "--upload-pack-pool-workers=", &v)) {
+			upload_pack_pool_workers = atoi(v);
+			continue;
+		}
+		if (skip_prefix(arg, "--upload-pack-pool-requests=", &v)) {
+			upload_pack_pool_requests = atoi(v);
+			continue;
+		}
+		if (skip_prefix(arg, "--upload-pack-pool-idle-timeout=", &v)) {
+			upload_pack_pool_idle_timeout = atoi(v);
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
@@ -1433,6 +1574,16 @@ int cmd_main(int argc, const char **argv)
 		die("base-path '%s' does not exist or is not a directory",
 		    base_path);
 
+	if (upload_pack_pool) {
+		if (!is_directory(upload_pack_pool))
+			die("upload-pack-pool '%s' does not exist or is not a directory",
+			    upload_pack_pool);
+		if (upload_pack_pool_workers < 1 || upload_pack_pool_requests < 1)
+			die("--upload-pack-pool-workers and --upload-pack-pool-requests must be positive");
+		if (upload_pack_pool_idle_timeout < 1)
+			die("--upload-pack-pool-idle-timeout must be positive");
+	}
+
 	if (log_destination != LOG_DESTINATION_STDERR) {
 		if (!freopen("/dev/null", "w", stderr))
 			die_errno("failed to redirect stderr to /dev/null");
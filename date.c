@@ -283,6 +283,47 @@ static void show_date_normal(struct strbuf *buf, timestamp_t time, struct tm *tm
 		strbuf_addf(buf, " %+05d", tz);
 }
 
+/*
+ * The numeric date formats are shown for every commit by "log
+ * --date=iso" and "--format=%aI" and friends, where formatting them
+ * with printf() takes a good part of the time; add their fields by
+ * hand instead.
+ */
+static void add_2digits(struct strbuf *sb, int n)
+{
+	if (n < 0 || n > 99) {
+		strbuf_addf(sb, "%02d", n);
+		return;
+	}
+	strbuf_addch(sb, '0' + n / 10);
+	strbuf_addch(sb, '0' + n % 10);
+}
+
+static void add_ymd(struct strbuf *sb, const struct tm *tm)
+{
+	int year = tm->tm_year + 1900;
+
+	if (year < 0 || year > 9999)
+		strbuf_addf(sb, "%04d", year);
+	else {
+		add_2digits(sb, year / 100);
+		add_2digits(sb, year % 100);
+	}
+	strbuf_addch(sb, '-');
+	add_2digits(sb, tm->tm_mon + 1);
+	strbuf_addch(sb, '-');
+	add_2digits(sb, tm->tm_mday);
+}
+
+static void add_hms(struct strbuf *sb, const struct tm *tm)
+{
+	add_2digits(sb, tm->tm_hour);
+	strbuf_addch(sb, ':');
+	add_2digits(sb, tm->tm_min);
+	strbuf_addch(sb, ':');
+	add_2digits(sb, tm->tm_sec);
+}
+
 const char *show_date(timestamp_t time, int tz, const struct date_mode *mode)
 {
 	struct tm *tm;
@@ -332,24 +373,25 @@ const char *show_date(timestamp_t time, int tz, const struct date_mode *mode)
 
 	strbuf_reset(&timebuf);
 	if (mode->type == DATE_SHORT)
-		strbuf_addf(&timebuf, "%04d-%02d-%02d", tm->tm_year + 1900,
-				tm->tm_mon + 1, tm->tm_mday);
-	else if (mode->type == DATE_ISO8601)
-		strbuf_addf(&timebuf, "%04d-%02d-%02d %02d:%02d:%02d %+05d",
-				tm->tm_year + 1900,
-				tm->tm_mon + 1,
-				tm->tm_mday,
-				tm->tm_hour, tm->tm_min, tm->tm_sec,
-				tz);
-	else if (mode->type == DATE_ISO8601_STRICT) {
+		add_ymd(&timebuf, tm);
+	else if (mode->type == DATE_ISO8601) {
+		add_ymd(&timebuf, tm);
+		strbuf_addch(&timebuf, ' ');
+		add_hms(&timebuf, tm);
+		strbuf_addch(&timebuf, ' ');
+		strbuf_addch(&timebuf, tz >= 0 ? '+' : '-');
+		add_2digits(&timebuf, abs(tz) / 100);
+		add_2digits(&timebuf, abs(tz) % 100);
+	} else if (mode->type == DATE_ISO8601_STRICT) {
 		char sign = (tz >= 0) ? '+' : '-';
 		tz = abs(tz);
-		strbuf_addf(&timebuf, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d",
-				tm->tm_year + 1900,
-				tm->tm_mon + 1,
-				tm->tm_mday,
-				tm->tm_hour, tm->tm_min, tm->tm_sec,
-				sign, tz / 100, tz % 100);
+		add_ymd(&timebuf, tm);
+		strbuf_addch(&timebuf, 'T');
+		add_hms(&timebuf, tm);
+		strbuf_addch(&timebuf, sign);
+		add_2digits(&timebuf, tz / 100);
+		strbuf_addch(&timebuf, ':');
+		add_2digits(&timebuf, tz % 100);
 	} else if (mode->type == DATE_RFC2822)
 		strbuf_addf(&timebuf, "%.3s, %d %.3s %d %02d:%02d:%02d %+05d",
 			weekday_names[tm->tm_wday], tm->tm_mday,
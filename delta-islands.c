@@ -21,6 +21,7 @@
 #include "delta-islands.h"
 #include "oid-array.h"
 #include "config.h"
+#include "promisor-remote.h"
 
 KHASH_INIT(str, const char *, void *, 1, kh_str_hash_func, kh_str_hash_equal)
 
@@ -239,8 +240,134 @@ static int tree_depth_compare(const void *a, const void *b)
 	return todo_a->depth - todo_b->depth;
 }
 
+static void resolve_one_tree_island(struct repository *r,
+				    struct object_entry *ent)
+{
+	struct island_bitmap *root_marks;
+	struct tree *tree;
+	struct tree_desc desc;
+	struct name_entry entry;
+	khiter_t pos;
+
+	obj_read_lock();
+	pos = kh_get_oid_map(island_marks, ent->idx.oid);
+	tree = pos < kh_end(island_marks) ? lookup_tree(r, &ent->idx.oid) : NULL;
+	obj_read_unlock();
+	if (pos >= kh_end(island_marks))
+		return;
+
+	if (!tree || parse_tree(tree) < 0)
+		die(_("bad tree object %s"), oid_to_hex(&ent->idx.oid));
+
+	obj_read_lock();
+	/*
+	 * Another thread may have given us more marks (or a copy of our
+	 * marks) since we looked them up.
+	 */
+	root_marks = kh_value(island_marks, kh_get_oid_map(island_marks, ent->idx.oid));
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		struct object *obj;
+
+		if (S_ISGITLINK(entry.mode))
+			continue;
+
+		obj = lookup_object(r, &entry.oid);
+		if (!obj)
+			continue;
+
+		set_island_marks(obj, root_marks);
+	}
+	obj_read_unlock();
+
+	free_tree_buffer(tree);
+}
+
+struct tree_islands_thread {
+	pthread_t thread;
+	struct repository *r;
+	struct tree_islands_todo *todo;
+	int start, end;
+	struct progress *progress;
+	int *done;
+};
+
+static void *resolve_tree_islands_thread(void *arg)
+{
+	struct tree_islands_thread *me = arg;
+	int i;
+
+	for (i = me->start; i < me->end; i++) {
+		resolve_one_tree_island(me->r, me->todo[i].entry);
+
+		obj_read_lock();
+		display_progress(me->progress, ++*me->done);
+		obj_read_unlock();
+	}
+	return NULL;
+}
+
+/*
+ * The trees at the same depth do not depend on each other, so resolve
+ * each depth with "nr_threads" threads, which read and parse their
+ * trees in parallel. The island marks themselves are only updated
+ * under the object read lock.
+ */
+static void resolve_tree_islands_threaded(struct repository *r,
+					  struct tree_islands_todo *todo,
+					  int nr, int nr_threads,
+					  struct progress *progress)
+{
+	struct tree_islands_thread *p;
+	int start, end, done = 0;
+
+	CALLOC_ARRAY(p, nr_threads);
+	enable_obj_read_lock();
+
+	for (start = 0; start < nr; start = end) {
+		int i, threads = nr_threads;
+
+		for (end = start + 1; end < nr; end++)
+			if (todo[end].depth != todo[start].depth)
+				break;
+
+		/* Not worth it for small levels. */
+		if (threads > (end - start) / 256)
+			threads = (end - start) / 256;
+		if (threads <= 1) {
+			for (i = start; i < end; i++) {
+				resolve_one_tree_island(r, todo[i].entry);
+				display_progress(progress, ++done);
+			}
+			continue;
+		}
+
+		for (i = 0; i < threads; i++) {
+			int ret;
+
+			p[i].r = r;
+			p[i].todo = todo;
+			p[i].start = start + (uint64_t)(end - start) * i / threads;
+			p[i].end = start + (uint64_t)(end - start) * (i + 1) / threads;
+			p[i].progress = progress;
+			p[i].done = &done;
+			ret = pthread_create(&p[i].thread, NULL,
+					     resolve_tree_islands_thread, &p[i]);
+			if (ret)
+				die(_("unable to create thread: %s"), strerror(ret));
+		}
+		for (i = 0; i < threads; i++)
+			pthread_join(p[i].thread, NULL);
+	}
+
+	disable_obj_read_lock();
+	free(p);
+}
+
 void resolve_tree_islands(struct repository *r,
 			  int progress,
+			  int nr_threads,
 			  struct packing_data *to_pack)
 {
 	struct progress *progress_state = NULL;
@@ -271,41 +398,15 @@ void resolve_tree_islands(struct repository *r,
 	if (progress)
 		progress_state = start_progress(_("Propagating island marks"), nr);
 
-	for (i = 0; i < nr; i++) {
-		struct object_entry *ent = todo[i].entry;
-		struct island_bitmap *root_marks;
-		struct tree *tree;
-		struct tree_desc desc;
-		struct name_entry entry;
-		khiter_t pos;
-
-		pos = kh_get_oid_map(island_marks, ent->idx.oid);
-		if (pos >= kh_end(island_marks))
-			continue;
-
-		root_marks = kh_value(island_marks, pos);
-
-		tree = lookup_tree(r, &ent->idx.oid);
-		if (!tree || parse_tree(tree) < 0)
-			die(_("bad tree object %s"), oid_to_hex(&ent->idx.oid));
-
-		init_tree_desc(&desc, tree->buffer, tree->size);
-		while (tree_entry(&desc, &entry)) {
-			struct object *obj;
-
-			if (S_ISGITLINK(entry.mode))
-				continue;
-
-			obj = lookup_object(r, &entry.oid);
-			if (!obj)
-				continue;
-
-			set_island_marks(obj, root_marks);
+	/* Objects that are missing must not be fetched from threads. */
+	if (HAVE_THREADS && nr_threads > 1 && !repo_has_promisor_remote(r)) {
+		resolve_tree_islands_threaded(r, todo, nr, nr_threads,
+					      progress_state);
+	} else {
+		for (i = 0; i < nr; i++) {
+			resolve_one_tree_island(r, todo[i].entry);
+			display_progress(progress_state, i+1);
 		}
-
-		free_tree_buffer(tree);
-
-		display_progress(progress_state, i+1);
 	}
 
 	stop_progress(&progress_state);
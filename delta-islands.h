@@ -10,6 +10,7 @@ int island_delta_cmp(const struct object_id *a, const struct object_id *b);
 int in_same_island(const struct object_id *, const struct object_id *);
 void resolve_tree_islands(struct repository *r,
 			  int progress,
+			  int nr_threads,
 			  struct packing_data *to_pack);
 void load_delta_islands(struct repository *r, int progress);
 void propagate_island_marks(struct commit *commit);
@@ -79,6 +79,50 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 		  const void *delta_buf, unsigned long delta_size,
 		  unsigned long *dst_size);
 
+/*
+ * delta_chain: a chain of deltas, composed into a single list of
+ * instructions against the buffer the first delta applies to
+ *
+ * Applying a chain of deltas one by one copies every intermediate buffer
+ * in full. Instead, delta_chain_append() maps the copy instructions of
+ * each delta onto the instructions composed so far, and
+ * delta_chain_apply() then builds the final buffer in one pass.
+ *
+ * The insert instructions point into the delta buffers, which must not
+ * be freed or altered before delta_chain_release() is called.
+ */
+struct delta_chain_op;
+struct delta_chain {
+	struct delta_chain_op *ops;
+	size_t nr, alloc;
+	unsigned long src_size, size;
+};
+
+/*
+ * Start an empty chain for a source buffer of "src_size" bytes; applying
+ * it gives back the source.
+ */
+void delta_chain_init(struct delta_chain *chain, unsigned long src_size);
+
+/*
+ * Add the delta "delta_buf" to the chain, to be applied to what the
+ * chain results in so far. Returns 0 on success, and -1 without a message
+ * if the delta is corrupt or does not apply to it, in which case the
+ * chain must not be used any more except for releasing it.
+ */
+int delta_chain_append(struct delta_chain *chain,
+		       const void *delta_buf, unsigned long delta_size);
+
+/*
+ * Recreate the result of the chain from the source buffer, like
+ * patch_delta() does for a single delta.
+ */
+void *delta_chain_apply(const struct delta_chain *chain,
+			const void *src_buf, unsigned long src_size,
+			unsigned long *dst_size);
+
+void delta_chain_release(struct delta_chain *chain);
+
 /* the smallest possible delta size is 4 bytes */
 #define DELTA_SIZE_MIN	4
 
@@ -308,6 +308,31 @@ unsigned long sizeof_delta_index(struct delta_index *index)
 		return 0;
 }
 
+/*
+ * Return how many of the first "max" bytes of "a" and "b" are the same.
+ * Matches tend to be long, so compare them a word at a time and only
+ * look at single bytes to find where the first differing word differs.
+ */
+static inline unsigned int common_prefix_len(const unsigned char *a,
+					     const unsigned char *b,
+					     unsigned int max)
+{
+	unsigned int n = 0;
+
+	while (max - n >= sizeof(uint64_t)) {
+		uint64_t x, y;
+
+		memcpy(&x, a + n, sizeof(x));
+		memcpy(&y, b + n, sizeof(y));
+		if (x != y)
+			break;
+		n += sizeof(uint64_t);
+	}
+	while (n < max && a[n] == b[n])
+		n++;
+	return n;
+}
+
 /*
  * The maximum size for any opcode sequence, including the initial header
  * plus Rabin window plus biggest copy.
@@ -386,11 +411,10 @@ create_delta(const struct delta_index *index,
 					ref_size = top - src;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < ref - entry->ptr) {
+				ref_size = common_prefix_len(ref, src, ref_size);
+				if (msize < ref_size) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
+					msize = ref_size;
 					moff = entry->ptr - ref_data;
 					if (msize >= 4096) /* good enough */
 						break;
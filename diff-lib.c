@@ -4,6 +4,7 @@
 #include "git-compat-util.h"
 #include "quote.h"
 #include "commit.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "gettext.h"
@@ -12,12 +13,14 @@
 #include "object-name.h"
 #include "read-cache.h"
 #include "revision.h"
+#include "string-list.h"
 #include "cache-tree.h"
 #include "unpack-trees.h"
 #include "refs.h"
 #include "repository.h"
 #include "submodule.h"
 #include "symlinks.h"
+#include "thread-utils.h"
 #include "trace.h"
 #include "dir.h"
 #include "fsmonitor.h"
@@ -67,6 +70,17 @@ static int check_removed(const struct cache_entry *ce, struct stat *st)
 	return 0;
 }
 
+/*
+ * A submodule whose status run_diff_files() has put off, to look at the
+ * status of several submodules in parallel.
+ */
+struct deferred_submodule {
+	struct submodule_status_util status;
+	struct cache_entry *ce;
+	unsigned int newmode;
+	int changed;
+};
+
 /*
  * Has a file changed or has a submodule new commits or a dirty work tree?
  *
@@ -74,11 +88,16 @@ static int check_removed(const struct cache_entry *ce, struct stat *st)
  * option is set, the caller does not only want to know if a submodule is
  * modified at all but wants to know all the conditions that are met (new
  * commits, untracked content and/or modified content).
+ *
+ * If "defer" is not NULL, a submodule whose work tree needs to be looked
+ * at is appended to it instead, with a "struct deferred_submodule" as
+ * its util, for the caller to fill in the result later.
  */
 static int match_stat_with_submodule(struct diff_options *diffopt,
 				     const struct cache_entry *ce,
 				     struct stat *st, unsigned ce_option,
-				     unsigned *dirty_submodule)
+				     unsigned *dirty_submodule,
+				     struct string_list *defer)
 {
 	int changed = ie_match_stat(diffopt->repo->index, ce, st, ce_option);
 	if (S_ISGITLINK(ce->ce_mode)) {
@@ -88,14 +107,88 @@ static int match_stat_with_submodule(struct diff_options *diffopt,
 		if (diffopt->flags.ignore_submodules)
 			changed = 0;
 		else if (!diffopt->flags.ignore_dirty_submodules &&
-			 (!changed || diffopt->flags.dirty_submodules))
-			*dirty_submodule = is_submodule_modified(ce->name,
-								 diffopt->flags.ignore_untracked_in_submodules);
+			 (!changed || diffopt->flags.dirty_submodules)) {
+			int ignore_untracked =
+				diffopt->flags.ignore_untracked_in_submodules;
+
+			if (defer) {
+				struct deferred_submodule *sub;
+
+				CALLOC_ARRAY(sub, 1);
+				sub->status.ignore_untracked = ignore_untracked;
+				string_list_append(defer, ce->name)->util = &sub->status;
+			} else {
+				*dirty_submodule = is_submodule_modified(ce->name,
+									 ignore_untracked);
+			}
+		}
 		diffopt->flags = orig_flags;
 	}
 	return changed;
 }
 
+static void diff_files_change(struct rev_info *revs, struct cache_entry *ce,
+			      int changed, unsigned int newmode,
+			      unsigned dirty_submodule)
+{
+	struct index_state *istate = revs->diffopt.repo->index;
+	unsigned int oldmode;
+	const struct object_id *old_oid, *new_oid;
+
+	if (!changed && !dirty_submodule) {
+		ce_mark_uptodate(ce);
+		mark_fsmonitor_valid(istate, ce);
+		if (!revs->diffopt.flags.find_copies_harder)
+			return;
+	}
+	oldmode = ce->ce_mode;
+	old_oid = &ce->oid;
+	new_oid = changed ? null_oid() : &ce->oid;
+	diff_change(&revs->diffopt, oldmode, newmode,
+		    old_oid, new_oid,
+		    !is_null_oid(old_oid),
+		    !is_null_oid(new_oid),
+		    ce->name, 0, dirty_submodule);
+}
+
+static int submodule_diff_jobs(struct repository *r)
+{
+	int jobs;
+
+	if (repo_config_get_int(r, "submodule.diffjobs", &jobs))
+		return 1;
+	if (jobs < 0)
+		die(_("negative values not allowed for submodule.diffJobs"));
+	return jobs ? jobs : online_cpus();
+}
+
+/*
+ * Look at the work trees of the submodules that run_diff_files() has
+ * deferred, all at once, and queue their changes. These come after
+ * those of the other paths, so sort the queue back into index order.
+ */
+static void diff_deferred_submodules(struct rev_info *revs,
+				     struct string_list *submodules,
+				     int jobs)
+{
+	size_t i;
+
+	if (get_submodules_status(submodules, jobs))
+		die(_("submodule status failed"));
+
+	for (i = 0; i < submodules->nr; i++) {
+		struct deferred_submodule *sub =
+			container_of(submodules->items[i].util,
+				     struct deferred_submodule, status);
+
+		diff_files_change(revs, sub->ce, sub->changed, sub->newmode,
+				  sub->status.dirty_submodule);
+		free(sub);
+	}
+	string_list_clear(submodules, 0);
+	diffcore_fix_diff_index();
+}
+
 void run_diff_files(struct rev_info *revs, unsigned int option)
 {
 	int entries, i;
@@ -104,6 +197,9 @@ void run_diff_files(struct rev_info *revs, unsigned int option)
 			      ? CE_MATCH_RACY_IS_DIRTY : 0);
 	uint64_t start = getnanotime();
 	struct index_state *istate = revs->diffopt.repo->index;
+	struct string_list submodules = STRING_LIST_INIT_NODUP;
+	int submodule_jobs = submodule_diff_jobs(revs->diffopt.repo);
+	struct string_list *defer = submodule_jobs > 1 ? &submodules : NULL;
 
 	diff_set_mnemonic_prefix(&revs->diffopt, "i/", "w/");
 
@@ -113,11 +209,10 @@ void run_diff_files(struct rev_info *revs, unsigned int option)
 		diff_unmerged_stage = 2;
 	entries = istate->cache_nr;
 	for (i = 0; i < entries; i++) {
-		unsigned int oldmode, newmode;
+		unsigned int newmode;
 		struct cache_entry *ce = istate->cache[i];
 		int changed;
 		unsigned dirty_submodule = 0;
-		const struct object_id *old_oid, *new_oid;
 
 		if (diff_can_quit_early(&revs->diffopt))
 			break;
@@ -228,6 +323,7 @@ void run_diff_files(struct rev_info *revs, unsigned int option)
 			newmode = ce->ce_mode;
 		} else {
 			struct stat st;
+			size_t nr_deferred = submodules.nr;
 
 			changed = check_removed(ce, &st);
 			if (changed) {
@@ -249,26 +345,25 @@ void run_diff_files(struct rev_info *revs, unsigned int option)
 			}
 
 			changed = match_stat_with_submodule(&revs->diffopt, ce, &st,
-							    ce_option, &dirty_submodule);
+							    ce_option, &dirty_submodule,
+							    defer);
 			newmode = ce_mode_from_stat(ce, st.st_mode);
-		}
-
-		if (!changed && !dirty_submodule) {
-			ce_mark_uptodate(ce);
-			mark_fsmonitor_valid(istate, ce);
-			if (!revs->diffopt.flags.find_copies_harder)
+			if (submodules.nr > nr_deferred) {
+				struct deferred_submodule *sub =
+					container_of(submodules.items[nr_deferred].util,
+						     struct deferred_submodule, status);
+
+				sub->ce = ce;
+				sub->changed = changed;
+				sub->newmode = newmode;
 				continue;
+			}
 		}
-		oldmode = ce->ce_mode;
-		old_oid = &ce->oid;
-		new_oid = changed ? null_oid() : &ce->oid;
-		diff_change(&revs->diffopt, oldmode, newmode,
-			    old_oid, new_oid,
-			    !is_null_oid(old_oid),
-			    !is_null_oid(new_oid),
-			    ce->name, 0, dirty_submodule);
 
+		diff_files_change(revs, ce, changed, newmode, dirty_submodule);
 	}
+	if (submodules.nr)
+		diff_deferred_submodules(revs, &submodules, submodule_jobs);
 	diffcore_std(&revs->diffopt);
 	diff_flush(&revs->diffopt);
 	trace_performance_since(start, "diff-files");
@@ -315,7 +410,7 @@ static int get_stat_data(const struct index_state *istate,
 			return -1;
 		}
 		changed = match_stat_with_submodule(diffopt, ce, &st,
-						    0, dirty_submodule);
+						    0, dirty_submodule, NULL);
 		if (changed) {
 			mode = ce_mode_from_stat(ce, st.st_mode);
 			oid = null_oid();
@@ -42,6 +42,7 @@
 #include "setup.h"
 #include "strmap.h"
 #include "ws.h"
+#include "trace2.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -52,6 +53,10 @@
 static int diff_detect_rename_default;
 static int diff_indent_heuristic = 1;
 static int diff_rename_limit_default = 1000;
+static int diff_rename_threads_default;
+static int diff_approximate_renames_default;
+static int diff_rename_cache_default;
+static int diff_combined_threads_default;
 static int diff_suppress_blank_empty;
 static int diff_use_color_default = -1;
 static int diff_color_moved_default;
@@ -70,6 +75,7 @@ static int diff_stat_graph_width;
 static int diff_dirstat_permille_default = 30;
 static struct diff_options default_diff_options;
 static long diff_algorithm;
+static long diff_max_cost;
 static unsigned ws_error_highlight_default = WSEH_NEW;
 
 static char diff_colors[][COLOR_MAXLEN] = {
@@ -443,6 +449,12 @@ int git_diff_ui_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (!strcmp(var, "diff.maxcost")) {
+		unsigned long v = git_config_ulong(var, value, ctx->kvi);
+		diff_max_cost = v > LONG_MAX ? LONG_MAX : v;
+		return 0;
+	}
+
 	if (git_color_config(var, value, cb) < 0)
 		return -1;
 
@@ -458,6 +470,28 @@ int git_diff_basic_config(const char *var, const char *value,
 		diff_rename_limit_default = git_config_int(var, value, ctx->kvi);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renamethreads")) {
+		diff_rename_threads_default = git_config_int(var, value, ctx->kvi);
+		if (diff_rename_threads_default < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    diff_rename_threads_default, var);
+		return 0;
+	}
+	if (!strcmp(var, "diff.combinedthreads")) {
+		diff_combined_threads_default = git_config_int(var, value, ctx->kvi);
+		if (diff_combined_threads_default < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    diff_combined_threads_default, var);
+		return 0;
+	}
+	if (!strcmp(var, "diff.approximaterenames")) {
+		diff_approximate_renames_default = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "diff.renamecache")) {
+		diff_rename_cache_default = git_config_bool(var, value);
+		return 0;
+	}
 
 	if (userdiff_config(var, value) < 0)
 		return -1;
@@ -966,8 +1000,46 @@ static void prepare_entry(struct diff_options *o, struct emitted_diff_symbol *l,
 
 struct moved_entry_list {
 	struct moved_entry *add, *del;
+	/*
+	 * The entries of "add" and "del" that are followed by another line,
+	 * sorted by the id of that line, so that the blocks a line may start
+	 * can be narrowed down to those that continue with the next line.
+	 */
+	struct moved_entry **add_by_next, **del_by_next;
+	unsigned add_by_next_nr, del_by_next_nr;
 };
 
+static int moved_entry_next_id_cmp(const void *a_, const void *b_)
+{
+	const struct moved_entry *a = *(const struct moved_entry * const *)a_;
+	const struct moved_entry *b = *(const struct moved_entry * const *)b_;
+	unsigned a_id = a->next_line->es->id, b_id = b->next_line->es->id;
+
+	return a_id < b_id ? -1 : a_id > b_id;
+}
+
+static struct moved_entry **sort_by_next_line(struct mem_pool *pool,
+					      struct moved_entry *match,
+					      unsigned *nr)
+{
+	struct moved_entry **sorted, *e;
+
+	*nr = 0;
+	for (e = match; e; e = e->next_match)
+		if (e->next_line)
+			(*nr)++;
+	if (!*nr)
+		return NULL;
+
+	sorted = mem_pool_alloc(pool, st_mult(*nr, sizeof(*sorted)));
+	*nr = 0;
+	for (e = match; e; e = e->next_match)
+		if (e->next_line)
+			sorted[(*nr)++] = e;
+	QSORT(sorted, *nr, moved_entry_next_id_cmp);
+	return sorted;
+}
+
 static struct moved_entry_list *add_lines_to_move_detection(struct diff_options *o,
 							    struct mem_pool *entry_mem_pool)
 {
@@ -1027,6 +1099,21 @@ static struct moved_entry_list *add_lines_to_move_detection(struct diff_options
 	hashmap_clear(&interned_map);
 	mem_pool_discard(&interned_pool, 0);
 
+	if (o->color_moved != COLOR_MOVED_PLAIN) {
+		unsigned i;
+
+		for (i = 0; i < id; i++) {
+			struct moved_entry_list *list = &entry_list[i];
+
+			list->add_by_next = sort_by_next_line(entry_mem_pool,
+							      list->add,
+							      &list->add_by_next_nr);
+			list->del_by_next = sort_by_next_line(entry_mem_pool,
+							      list->del,
+							      &list->del_by_next_nr);
+		}
+	}
+
 	return entry_list;
 }
 
@@ -1058,33 +1145,59 @@ static void pmb_advance_or_null(struct diff_options *o,
 	*pmb_nr = j;
 }
 
+static void add_potential_moved_block(struct diff_options *o,
+				      struct moved_entry *match,
+				      struct emitted_diff_symbol *l,
+				      struct moved_block **pmb_p,
+				      int *pmb_alloc_p, int *pmb_nr_p)
+{
+	ALLOC_GROW(*pmb_p, *pmb_nr_p + 1, *pmb_alloc_p);
+	if (o->color_moved_ws_handling &
+	    COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE)
+		(*pmb_p)[*pmb_nr_p].wsd = compute_ws_delta(l, match->es);
+	else
+		(*pmb_p)[*pmb_nr_p].wsd = 0;
+	(*pmb_p)[(*pmb_nr_p)++].match = match;
+}
+
 static void fill_potential_moved_blocks(struct diff_options *o,
 					struct moved_entry *match,
+					struct moved_entry **by_next,
+					unsigned by_next_nr,
 					struct emitted_diff_symbol *l,
+					const struct emitted_diff_symbol *next,
 					struct moved_block **pmb_p,
 					int *pmb_alloc_p, int *pmb_nr_p)
 
 {
-	struct moved_block *pmb = *pmb_p;
-	int pmb_alloc = *pmb_alloc_p, pmb_nr = *pmb_nr_p;
+	unsigned lo = 0, hi = by_next_nr;
 
 	/*
-	 * The current line is the start of a new block.
-	 * Setup the set of potential blocks.
+	 * The current line is the start of a new block. The blocks that
+	 * may follow it are those that continue with the next line, if it
+	 * is on the same side, so only these need to be tracked; when there
+	 * are none, any one match makes the current line a block of its own.
+	 * Tracking all the places where a common line, like a closing brace,
+	 * appears would take time proportional to their number for each
+	 * such line.
 	 */
-	for (; match; match = match->next_match) {
-		ALLOC_GROW(pmb, pmb_nr + 1, pmb_alloc);
-		if (o->color_moved_ws_handling &
-		    COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE)
-			pmb[pmb_nr].wsd = compute_ws_delta(l, match->es);
-		else
-			pmb[pmb_nr].wsd = 0;
-		pmb[pmb_nr++].match = match;
-	}
+	if (next && next->s == l->s) {
+		while (lo < hi) {
+			unsigned mi = lo + (hi - lo) / 2;
 
-	*pmb_p = pmb;
-	*pmb_alloc_p = pmb_alloc;
-	*pmb_nr_p = pmb_nr;
+			if (by_next[mi]->next_line->es->id < next->id)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		for (; lo < by_next_nr &&
+		       by_next[lo]->next_line->es->id == next->id; lo++)
+			add_potential_moved_block(o, by_next[lo], l, pmb_p,
+						  pmb_alloc_p, pmb_nr_p);
+	}
+	if (!*pmb_nr_p)
+		add_potential_moved_block(o, match, l, pmb_p,
+					  pmb_alloc_p, pmb_nr_p);
 }
 
 /*
@@ -1136,15 +1249,20 @@ static void mark_color_as_moved(struct diff_options *o,
 
 
 	for (n = 0; n < o->emitted_symbols->nr; n++) {
-		struct moved_entry *match = NULL;
+		struct moved_entry *match = NULL, **by_next = NULL;
+		unsigned by_next_nr = 0;
 		struct emitted_diff_symbol *l = &o->emitted_symbols->buf[n];
 
 		switch (l->s) {
 		case DIFF_SYMBOL_PLUS:
 			match = entry_list[l->id].del;
+			by_next = entry_list[l->id].del_by_next;
+			by_next_nr = entry_list[l->id].del_by_next_nr;
 			break;
 		case DIFF_SYMBOL_MINUS:
 			match = entry_list[l->id].add;
+			by_next = entry_list[l->id].add_by_next;
+			by_next_nr = entry_list[l->id].add_by_next_nr;
 			break;
 		default:
 			flipped_block = 0;
@@ -1186,7 +1304,10 @@ static void mark_color_as_moved(struct diff_options *o,
 				 */
 				n -= block_length;
 			else
-				fill_potential_moved_blocks(o, match, l,
+				fill_potential_moved_blocks(o, match, by_next,
+							    by_next_nr, l,
+							    n + 1 < o->emitted_symbols->nr ?
+							    &o->emitted_symbols->buf[n + 1] : NULL,
 							    &pmb, &pmb_alloc,
 							    &pmb_nr);
 
@@ -2182,8 +2303,8 @@ static void diff_words_flush(struct emit_callback *ecbdata)
 	}
 }
 
-static void diff_filespec_load_driver(struct diff_filespec *one,
-				      struct index_state *istate)
+void diff_filespec_load_driver(struct diff_filespec *one,
+			       struct index_state *istate)
 {
 	/* Use already-loaded driver */
 	if (one->driver)
@@ -3493,6 +3614,19 @@ static int set_diff_algorithm(struct diff_options *opts,
 	return 0;
 }
 
+/*
+ * With "diff.maxCost", the diff of a file pair may have given up on being
+ * minimal to stay within it; say so in the trace.
+ */
+static void report_max_cost_exceeded(struct diff_options *o,
+				     struct diff_filespec *one,
+				     int exceeded)
+{
+	if (exceeded)
+		trace2_data_string("diff", o->repo, "max-cost-exceeded",
+				   one->path);
+}
+
 static void builtin_diff(const char *name_a,
 			 const char *name_b,
 			 struct diff_filespec *one,
@@ -3667,6 +3801,7 @@ static void builtin_diff(const char *name_a,
 		xpparam_t xpp;
 		xdemitconf_t xecfg;
 		struct emit_callback ecbdata;
+		int max_cost_exceeded = 0;
 		const struct userdiff_funcname *pe;
 
 		if (must_show_header) {
@@ -3700,6 +3835,8 @@ static void builtin_diff(const char *name_a,
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
 		xpp.anchors_nr = o->anchors_nr;
+		xpp.max_cost = diff_max_cost;
+		xpp.max_cost_exceeded = &max_cost_exceeded;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
 		xecfg.flags = XDL_EMIT_FUNCNAMES;
@@ -3721,6 +3858,7 @@ static void builtin_diff(const char *name_a,
 		if (xdi_diff_outf(&mf1, &mf2, NULL, fn_out_consume,
 				  &ecbdata, &xpp, &xecfg))
 			die("unable to generate diff for %s", one->path);
+		report_max_cost_exceeded(o, one, max_cost_exceeded);
 		if (o->word_diff)
 			free_diff_words_data(&ecbdata);
 		if (textconv_one)
@@ -3819,6 +3957,7 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		/* Crazy xdl interfaces.. */
 		xpparam_t xpp;
 		xdemitconf_t xecfg;
+		int max_cost_exceeded = 0;
 
 		if (fill_mmfile(o->repo, &mf1, one) < 0 ||
 		    fill_mmfile(o->repo, &mf2, two) < 0)
@@ -3831,12 +3970,15 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
 		xpp.anchors_nr = o->anchors_nr;
+		xpp.max_cost = diff_max_cost;
+		xpp.max_cost_exceeded = &max_cost_exceeded;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
 		xecfg.flags = XDL_EMIT_NO_HUNK_HDR;
 		if (xdi_diff_outf(&mf1, &mf2, NULL,
 				  diffstat_consume, diffstat, &xpp, &xecfg))
 			die("unable to generate diffstat for %s", one->path);
+		report_max_cost_exceeded(o, one, max_cost_exceeded);
 
 		if (DIFF_FILE_VALID(one) && DIFF_FILE_VALID(two)) {
 			struct diffstat_file *file =
@@ -4694,6 +4836,10 @@ void repo_diff_setup(struct repository *r, struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->rename_threads = diff_rename_threads_default;
+	options->approximate_renames = diff_approximate_renames_default;
+	options->rename_cache = diff_rename_cache_default;
+	options->combined_threads = diff_combined_threads_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = diff_context_default;
 	options->interhunkcontext = diff_interhunk_context_default;
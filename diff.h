@@ -310,9 +310,20 @@ struct diff_options {
 	 */
 	int rename_score;
 	int rename_limit;
+	/* Threads scoring inexact rename candidates; 0 means one per CPU. */
+	int rename_threads;
+	/*
+	 * Beyond rename_limit, compare only the pairs that look alike
+	 * instead of skipping inexact rename detection.
+	 */
+	int approximate_renames;
+	/* Keep the scores of inexact renames in $GIT_DIR/rename-cache. */
+	int rename_cache;
 
 	int needed_rename_limit;
 	int degraded_cc_to_c;
+	/* Threads diffing a merge against its parents; 0 means one per CPU. */
+	int combined_threads;
 	int show_rename_progress;
 	int dirstat_permille;
 	int setup;
@@ -163,6 +163,43 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	return hash;
 }
 
+void diffcore_count_spans(struct repository *r, struct diff_filespec *one)
+{
+	if (!one->cnt_data)
+		one->cnt_data = hash_chars(r, one);
+}
+
+static uint32_t minhash_mix(uint32_t hashval, int i)
+{
+	uint32_t x = hashval ^ ((uint32_t)i * 0x9e3779b9u + 1);
+
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35u;
+	x ^= x >> 16;
+	return x;
+}
+
+int diffcore_span_minhash(const void *cnt_data, uint32_t *sig, int nr)
+{
+	const struct spanhash_top *hash = cnt_data;
+	const struct spanhash *s;
+	const struct spanhash *end = hash->data + ((size_t)1 << hash->alloc_log2);
+	int i;
+
+	for (i = 0; i < nr; i++)
+		sig[i] = UINT32_MAX;
+	/* The spans are sorted, with the unused slots at the end. */
+	for (s = hash->data; s < end && s->cnt; s++)
+		for (i = 0; i < nr; i++) {
+			uint32_t x = minhash_mix(s->hashval, i);
+			if (x < sig[i])
+				sig[i] = x;
+		}
+	return s != hash->data;
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
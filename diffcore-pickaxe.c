@@ -114,12 +114,62 @@ static unsigned int contains(mmfile_t *mf, regex_t *regexp, kwset_t kws,
 	return cnt;
 }
 
+#define COMMON_BLOCK_SIZE 4096
+
+static int is_line_start(const mmfile_t *mf, long pos)
+{
+	return !pos || mf->ptr[pos - 1] == '\n';
+}
+
+/*
+ * Drop the lines that "one" and "two" both start and end with. A fixed
+ * string without a newline only ever matches within a line, and its
+ * matches are counted afresh on each line, so these lines hold as many
+ * matches on either side.
+ */
+static void skip_common_lines(mmfile_t *one, mmfile_t *two)
+{
+	long common = one->size < two->size ? one->size : two->size;
+	long prefix = 0, suffix = 0;
+
+	while (prefix + COMMON_BLOCK_SIZE <= common &&
+	       !memcmp(one->ptr + prefix, two->ptr + prefix, COMMON_BLOCK_SIZE))
+		prefix += COMMON_BLOCK_SIZE;
+	while (prefix < common && one->ptr[prefix] == two->ptr[prefix])
+		prefix++;
+	while (!is_line_start(one, prefix))
+		prefix--;
+
+	common -= prefix;
+	while (suffix + COMMON_BLOCK_SIZE <= common &&
+	       !memcmp(one->ptr + one->size - suffix - COMMON_BLOCK_SIZE,
+		       two->ptr + two->size - suffix - COMMON_BLOCK_SIZE,
+		       COMMON_BLOCK_SIZE))
+		suffix += COMMON_BLOCK_SIZE;
+	while (suffix < common &&
+	       one->ptr[one->size - suffix - 1] == two->ptr[two->size - suffix - 1])
+		suffix++;
+	while (suffix && !(is_line_start(one, one->size - suffix) &&
+			   is_line_start(two, two->size - suffix)))
+		suffix--;
+
+	one->ptr += prefix;
+	one->size -= prefix + suffix;
+	two->ptr += prefix;
+	two->size -= prefix + suffix;
+}
+
 static int has_changes(mmfile_t *one, mmfile_t *two,
-		       struct diff_options *o UNUSED,
+		       struct diff_options *o,
 		       regex_t *regexp, kwset_t kws)
 {
-	unsigned int c1 = one ? contains(one, regexp, kws, 0) : 0;
-	unsigned int c2 = two ? contains(two, regexp, kws, c1 + 1) : 0;
+	mmfile_t mf1 = *one, mf2 = *two;
+	unsigned int c1, c2;
+
+	if (kws && !strchr(o->pickaxe, '\n'))
+		skip_common_lines(&mf1, &mf2);
+	c1 = contains(&mf1, regexp, kws, 0);
+	c2 = contains(&mf2, regexp, kws, c1 + 1);
 	return c1 != c2;
 }
 
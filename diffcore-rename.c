@@ -7,12 +7,15 @@
 #include "diffcore.h"
 #include "object-store-ll.h"
 #include "hashmap.h"
+#include "hex.h"
 #include "mem-pool.h"
 #include "oid-array.h"
 #include "progress.h"
 #include "promisor-remote.h"
+#include "rename-cache.h"
 #include "string-list.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
 
 /* Table of rename/copy destinations */
@@ -95,6 +98,13 @@ struct inexact_prefetch_options {
 	struct repository *repo;
 	int skip_unmodified;
 };
+static void add_for_prefetch(struct oid_array *to_fetch,
+			     const struct diff_filespec *filespec)
+{
+	if (filespec && filespec->oid_valid && !S_ISGITLINK(filespec->mode))
+		oid_array_append(to_fetch, &filespec->oid);
+}
+
 static void inexact_prefetch(void *prefetch_options)
 {
 	struct inexact_prefetch_options *options = prefetch_options;
@@ -108,8 +118,7 @@ static void inexact_prefetch(void *prefetch_options)
 			 * blobs, so skip prefetching.
 			 */
 			continue; /* already found exact match */
-		diff_add_if_missing(options->repo, &to_fetch,
-				    rename_dst[i].p->two);
+		add_for_prefetch(&to_fetch, rename_dst[i].p->two);
 	}
 	for (i = 0; i < rename_src_nr; i++) {
 		if (options->skip_unmodified &&
@@ -119,13 +128,62 @@ static void inexact_prefetch(void *prefetch_options)
 			 * blobs, so skip prefetching.
 			 */
 			continue;
-		diff_add_if_missing(options->repo, &to_fetch,
-				    rename_src[i].p->one);
+		add_for_prefetch(&to_fetch, rename_src[i].p->one);
 	}
-	promisor_remote_get_direct(options->repo, to_fetch.oid, to_fetch.nr);
+	/*
+	 * Besides fetching what is missing, read ahead what we already
+	 * have; the similarity matrix will look at all of these blobs.
+	 */
+	odb_prefetch(options->repo, &to_fetch,
+		     ODB_PREFETCH_MISSING | ODB_PREFETCH_PACKED);
 	oid_array_clear(&to_fetch);
 }
 
+static int too_different_in_size(unsigned long src_size,
+				 unsigned long dst_size,
+				 int minimum_score)
+{
+	unsigned long max_size, delta_size, base_size;
+
+	max_size = ((src_size > dst_size) ? src_size : dst_size);
+	base_size = ((src_size < dst_size) ? src_size : dst_size);
+	delta_size = max_size - base_size;
+
+	/* We would not consider edits that change the file size so
+	 * drastically.  delta_size must be smaller than
+	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+	 *
+	 * Note that base_size == 0 case is handled here already
+	 * and the final score computation in score_span_counts()
+	 * would not have a divide-by-zero issue.
+	 */
+	return max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE;
+}
+
+/*
+ * Compute the score of a pair whose contents were read, or whose span
+ * counts were already computed.
+ */
+static int score_span_counts(struct repository *r,
+			     struct diff_filespec *src,
+			     struct diff_filespec *dst)
+{
+	unsigned long max_size, src_copied, literal_added;
+
+	if (diffcore_count_changes(r, src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   &src_copied, &literal_added))
+		return 0;
+
+	/* How similar are they?
+	 * what percentage of material in dst are from source?
+	 */
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
@@ -145,8 +203,6 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	int score;
 
 	/* We deal only with regular files.  Symlink renames are handled
 	 * only when they are exact matches --- in other words, no edits
@@ -173,19 +229,7 @@ static int estimate_similarity(struct repository *r,
 	    diff_populate_filespec(r, dst, dpf_opt))
 		return 0;
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (too_different_in_size(src->size, dst->size, minimum_score))
 		return 0;
 
 	dpf_opt->check_size_only = 0;
@@ -195,19 +239,7 @@ static int estimate_similarity(struct repository *r,
 	if (!dst->cnt_data && diff_populate_filespec(r, dst, dpf_opt))
 		return 0;
 
-	if (diffcore_count_changes(r, src, dst,
-				   &src->cnt_data, &dst->cnt_data,
-				   &src_copied, &literal_added))
-		return 0;
-
-	/* How similar are they?
-	 * what percentage of material in dst are from source?
-	 */
-	if (!dst->size)
-		score = 0; /* should not happen */
-	else
-		score = (int)(src_copied * MAX_SCORE / max_size);
-	return score;
+	return score_span_counts(r, src, dst);
 }
 
 static void record_rename_pair(int dst_index, int src_index, int score)
@@ -1075,6 +1107,633 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * Like estimate_similarity(), but only from the span counts computed
+ * beforehand by score_candidates(), so that it may be called from
+ * several threads at once.
+ */
+static int estimate_similarity_from_spans(struct repository *r,
+					  struct diff_filespec *src,
+					  struct diff_filespec *dst,
+					  int minimum_score)
+{
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode) ||
+	    !src->cnt_data || !dst->cnt_data)
+		return 0;
+	if (too_different_in_size(src->size, dst->size, minimum_score))
+		return 0;
+	return score_span_counts(r, src, dst);
+}
+
+/*
+ * With approximate renames, only the pairs whose MinHash signatures
+ * agree on all MINHASH_ROWS values of at least one of MINHASH_BANDS
+ * bands are scored. Files whose sets of spans have a Jaccard similarity
+ * of J are compared with a chance of 1 - (1 - J^2)^16: a rename that
+ * keeps half of the lines has J of about 1/3 and is found 85% of the
+ * time, and one that keeps two thirds 99% of the time.
+ */
+#define MINHASH_BANDS 16
+#define MINHASH_ROWS 2
+/* At most this many sources of a bucket are compared to a destination. */
+#define MINHASH_MAX_BUCKET 256
+
+struct minhash_entry {
+	uint32_t band, key;
+	int src;
+};
+
+static int minhash_entry_cmp(const void *a_, const void *b_)
+{
+	const struct minhash_entry *a = a_, *b = b_;
+
+	if (a->band != b->band)
+		return a->band < b->band ? -1 : 1;
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return a->src < b->src ? -1 : a->src > b->src;
+}
+
+static uint32_t minhash_band_key(const uint32_t *sig, int band)
+{
+	uint32_t key = 0;
+	int i;
+
+	for (i = 0; i < MINHASH_ROWS; i++)
+		key = (key ^ sig[band * MINHASH_ROWS + i]) * 0x9e3779b1u;
+	return key;
+}
+
+/*
+ * State shared by the threads filling the score matrix "mx", which has
+ * a row of the NUM_CANDIDATE_PER_DST best sources for each destination.
+ */
+struct rename_score_threads {
+	struct repository *r;
+	struct diff_score *mx;
+	int minimum_score;
+
+	/*
+	 * With approximate renames, the LSH buckets of the sources, sorted
+	 * by band and key; "src" is an index into "srcs".
+	 */
+	int approximate;
+	struct minhash_entry *buckets;
+	int buckets_nr;
+
+	/* candidate sources and destinations, as indices into rename_src/dst */
+	int *srcs, srcs_nr;
+	int *dsts, dsts_nr;
+
+	/* filespecs whose span counts are to be computed */
+	struct diff_filespec **spans;
+	int spans_nr, spans_alloc;
+
+	/* next filespec or row to work on, rows done so far */
+	int next, rows_done;
+	struct progress *progress;
+	pthread_mutex_t mutex;
+};
+
+static int take_next(struct rename_score_threads *st, int nr)
+{
+	int next = -1;
+
+	pthread_mutex_lock(&st->mutex);
+	if (st->next < nr)
+		next = st->next++;
+	pthread_mutex_unlock(&st->mutex);
+	return next;
+}
+
+static void *count_spans_thread(void *arg)
+{
+	struct rename_score_threads *st = arg;
+	int k;
+
+	while ((k = take_next(st, st->spans_nr)) >= 0) {
+		struct diff_filespec *one = st->spans[k];
+		enum object_type type;
+
+		if (!one->data) {
+			one->data = repo_read_object_file(st->r, &one->oid,
+							  &type, &one->size);
+			if (!one->data)
+				die(_("unable to read %s"), oid_to_hex(&one->oid));
+			one->should_free = 1;
+		}
+		diffcore_count_spans(st->r, one);
+		diff_free_filespec_blob(one);
+	}
+	return NULL;
+}
+
+static int compare_int(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static void score_candidate(struct rename_score_threads *st,
+			    struct diff_score *m, int dst, int src)
+{
+	struct diff_filespec *one = rename_src[src].p->one;
+	struct diff_filespec *two = rename_dst[dst].p->two;
+	struct diff_score this_src;
+
+	this_src.score = estimate_similarity_from_spans(st->r, one, two,
+							st->minimum_score);
+	this_src.name_score = basename_same(one, two);
+	this_src.dst = dst;
+	this_src.src = src;
+	record_if_better(m, &this_src);
+}
+
+/*
+ * Collect in "cand" the indices into "srcs" of the sources that share an
+ * LSH bucket with "two", in ascending order, and return their number.
+ */
+static int collect_minhash_candidates(struct rename_score_threads *st,
+				      struct diff_filespec *two,
+				      int **cand, int *cand_alloc)
+{
+	uint32_t sig[MINHASH_BANDS * MINHASH_ROWS];
+	int band, i, nr = 0, uniq = 0;
+
+	if (!two->cnt_data ||
+	    !diffcore_span_minhash(two->cnt_data, sig, ARRAY_SIZE(sig)))
+		return 0;
+
+	for (band = 0; band < MINHASH_BANDS; band++) {
+		struct minhash_entry key = {
+			.band = band,
+			.key = minhash_band_key(sig, band),
+			.src = -1,
+		};
+		int lo = 0, hi = st->buckets_nr, end;
+
+		while (lo < hi) {
+			int mi = lo + (hi - lo) / 2;
+
+			if (minhash_entry_cmp(&st->buckets[mi], &key) < 0)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		for (end = lo;
+		     end < st->buckets_nr && end - lo < MINHASH_MAX_BUCKET &&
+		     st->buckets[end].band == key.band &&
+		     st->buckets[end].key == key.key;
+		     end++) {
+			ALLOC_GROW(*cand, nr + 1, *cand_alloc);
+			(*cand)[nr++] = st->buckets[end].src;
+		}
+	}
+
+	QSORT(*cand, nr, compare_int);
+	for (i = 0; i < nr; i++)
+		if (!uniq || (*cand)[uniq - 1] != (*cand)[i])
+			(*cand)[uniq++] = (*cand)[i];
+	return uniq;
+}
+
+static void *score_rows_thread(void *arg)
+{
+	struct rename_score_threads *st = arg;
+	int *cand = NULL, cand_alloc = 0;
+	int k, j;
+
+	while ((k = take_next(st, st->dsts_nr)) >= 0) {
+		int i = st->dsts[k];
+		struct diff_score *m = &st->mx[k * NUM_CANDIDATE_PER_DST];
+
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		if (st->approximate) {
+			int nr = collect_minhash_candidates(st,
+							    rename_dst[i].p->two,
+							    &cand, &cand_alloc);
+			for (j = 0; j < nr; j++)
+				score_candidate(st, m, i, st->srcs[cand[j]]);
+		} else {
+			for (j = 0; j < st->srcs_nr; j++)
+				score_candidate(st, m, i, st->srcs[j]);
+		}
+
+		pthread_mutex_lock(&st->mutex);
+		st->rows_done++;
+		display_progress(st->progress,
+				 (uint64_t)st->rows_done * (uint64_t)rename_src_nr);
+		pthread_mutex_unlock(&st->mutex);
+	}
+	free(cand);
+	return NULL;
+}
+
+static void run_rename_score_threads(struct rename_score_threads *st,
+				     int nr_threads, void *(*fn)(void *))
+{
+	pthread_t *threads;
+	int i, ret;
+
+	st->next = 0;
+	if (nr_threads == 1) {
+		fn(st);
+		return;
+	}
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL, fn, st);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static int rename_score_threads_nr(struct diff_options *options,
+				   int num_destinations,
+				   struct diff_populate_filespec_options *dpf_opt)
+{
+	int nr_threads = options->rename_threads;
+
+	/* Objects missing from a partial clone are fetched one batch at a time. */
+	if (!HAVE_THREADS || dpf_opt->missing_object_cb)
+		return 1;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads < num_destinations ? nr_threads : num_destinations;
+}
+
+static int compare_ulong(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static int compare_filespec_ptr(const void *a_, const void *b_)
+{
+	uintptr_t a = (uintptr_t)*(struct diff_filespec * const *)a_;
+	uintptr_t b = (uintptr_t)*(struct diff_filespec * const *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Return 1 if a file of "size" is close enough in size to one of
+ * "sizes", sorted, for their contents to be compared. The sizes close
+ * enough form a range around "size", so it is enough to look at its
+ * nearest neighbours.
+ */
+static int has_partner_of_size(unsigned long size, const unsigned long *sizes,
+			       int nr, int minimum_score)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+
+		if (sizes[mi] < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return (lo < nr &&
+		!too_different_in_size(size, sizes[lo], minimum_score)) ||
+	       (lo > 0 &&
+		!too_different_in_size(size, sizes[lo - 1], minimum_score));
+}
+
+/*
+ * Add the regular files of "list" that need their span counts, i.e.
+ * the ones with a partner among "partners" of a compatible size, to
+ * the span counts to compute.
+ */
+static void collect_spans(struct rename_score_threads *st,
+			  struct diff_filespec **list, int nr,
+			  const unsigned long *partners, int partners_nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct diff_filespec *one = list[i];
+
+		if (one->cnt_data ||
+		    !has_partner_of_size(one->size, partners, partners_nr,
+					 st->minimum_score))
+			continue;
+		ALLOC_GROW(st->spans, st->spans_nr + 1, st->spans_alloc);
+		st->spans[st->spans_nr++] = one;
+	}
+}
+
+/*
+ * Collect the regular files among the candidates "idx" of "pairs" (the
+ * "one" or "two" side of each as "two_side" says), with their sizes.
+ */
+static int collect_regular_files(struct repository *r, int *idx, int nr,
+				 struct diff_filespec **files,
+				 unsigned long *sizes, int two_side,
+				 const struct diff_populate_filespec_options *dpf)
+{
+	struct diff_populate_filespec_options dpf_opt = *dpf;
+	int i, files_nr = 0;
+
+	dpf_opt.check_size_only = 1;
+
+	for (i = 0; i < nr; i++) {
+		struct diff_filespec *one = two_side ?
+			rename_dst[idx[i]].p->two : rename_src[idx[i]].p->one;
+
+		if (!S_ISREG(one->mode) || diff_populate_filespec(r, one, &dpf_opt))
+			continue;
+		files[files_nr] = one;
+		sizes[files_nr++] = one->size;
+	}
+	QSORT(sizes, files_nr, compare_ulong);
+	return files_nr;
+}
+
+/* Put the sources with span counts in their LSH buckets. */
+static void fill_minhash_buckets(struct rename_score_threads *st)
+{
+	uint32_t sig[MINHASH_BANDS * MINHASH_ROWS];
+	int i, band;
+
+	ALLOC_ARRAY(st->buckets, st_mult(st->srcs_nr, MINHASH_BANDS));
+	for (i = 0; i < st->srcs_nr; i++) {
+		struct diff_filespec *one = rename_src[st->srcs[i]].p->one;
+
+		if (!S_ISREG(one->mode) || !one->cnt_data ||
+		    !diffcore_span_minhash(one->cnt_data, sig, ARRAY_SIZE(sig)))
+			continue;
+		for (band = 0; band < MINHASH_BANDS; band++) {
+			struct minhash_entry *e = &st->buckets[st->buckets_nr++];
+
+			e->band = band;
+			e->key = minhash_band_key(sig, band);
+			e->src = i;
+		}
+	}
+	QSORT(st->buckets, st->buckets_nr, minhash_entry_cmp);
+}
+
+/*
+ * Fill the rows of the score matrix "mx" with "nr_threads" threads, in
+ * the same order as the loop in diffcore_rename_extended() does, and
+ * return their number. With "approximate", score only the pairs that
+ * share an LSH bucket.
+ *
+ * The main thread first finds which regular files have a partner of a
+ * compatible size at all and loads their userdiff drivers, and computes
+ * the span counts of the files in the working tree. The threads then
+ * read the blobs of the other files and compute their span counts, once
+ * for each file, and finally score the candidates of one destination
+ * after another from these counts. Each row is independent of the
+ * others, so it needs no merging afterwards.
+ */
+static int score_candidates(struct diff_options *options,
+			    struct diff_score *mx, int nr_threads,
+			    int minimum_score, int skip_unmodified,
+			    int allow_used_sources, int approximate,
+			    const struct diff_populate_filespec_options *dpf_opt,
+			    struct progress *progress)
+{
+	struct repository *r = options->repo;
+	struct rename_score_threads st = {
+		.r = r,
+		.mx = mx,
+		.minimum_score = minimum_score,
+		.approximate = approximate,
+		.progress = progress,
+	};
+	struct diff_filespec **src_files, **dst_files;
+	unsigned long *src_sizes, *dst_sizes;
+	int src_files_nr, dst_files_nr;
+	int i, nr;
+
+	ALLOC_ARRAY(st.srcs, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		assert(!rename_src[i].p->one->rename_used || allow_used_sources);
+		if (skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		st.srcs[st.srcs_nr++] = i;
+	}
+	ALLOC_ARRAY(st.dsts, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].is_rename)
+			st.dsts[st.dsts_nr++] = i;
+
+	ALLOC_ARRAY(src_files, st.srcs_nr);
+	ALLOC_ARRAY(src_sizes, st.srcs_nr);
+	src_files_nr = collect_regular_files(r, st.srcs, st.srcs_nr,
+					     src_files, src_sizes, 0, dpf_opt);
+	ALLOC_ARRAY(dst_files, st.dsts_nr);
+	ALLOC_ARRAY(dst_sizes, st.dsts_nr);
+	dst_files_nr = collect_regular_files(r, st.dsts, st.dsts_nr,
+					     dst_files, dst_sizes, 1, dpf_opt);
+
+	collect_spans(&st, src_files, src_files_nr, dst_sizes, dst_files_nr);
+	collect_spans(&st, dst_files, dst_files_nr, src_sizes, src_files_nr);
+
+	/* With copies, a file may be among both the sources and destinations. */
+	QSORT(st.spans, st.spans_nr, compare_filespec_ptr);
+	for (i = nr = 0; i < st.spans_nr; i++) {
+		struct diff_filespec *one = st.spans[i];
+
+		if (i && st.spans[i - 1] == one)
+			continue;
+		if (!one->oid_valid || nr_threads == 1) {
+			if (!diff_populate_filespec(r, one, dpf_opt))
+				diffcore_count_spans(r, one);
+			diff_free_filespec_blob(one);
+			continue;
+		}
+		diff_filespec_load_driver(one, r->index);
+		st.spans[nr++] = one;
+	}
+	st.spans_nr = nr;
+
+	pthread_mutex_init(&st.mutex, NULL);
+	enable_obj_read_lock();
+	run_rename_score_threads(&st, nr_threads, count_spans_thread);
+	disable_obj_read_lock();
+	if (approximate)
+		fill_minhash_buckets(&st);
+	run_rename_score_threads(&st, nr_threads, score_rows_thread);
+	pthread_mutex_destroy(&st.mutex);
+
+	free(src_files);
+	free(src_sizes);
+	free(dst_files);
+	free(dst_sizes);
+	free(st.spans);
+	free(st.buckets);
+	free(st.srcs);
+	free(st.dsts);
+	return st.rows_done;
+}
+
+/* Fewer pairs than this are quicker to compare again than to cache. */
+#define RENAME_CACHE_MIN_PAIRS 1024
+
+/*
+ * The candidates of the score matrix, i.e. its columns and rows, and
+ * the key of their scores in the rename cache.
+ */
+struct rename_cache_state {
+	struct object_id key;
+	int *srcs, srcs_nr;
+	int *dsts, dsts_nr;
+	/* index among "srcs" of each entry of rename_src */
+	int *src_index;
+};
+
+static void hash_rename_candidate(git_hash_ctx *ctx, struct repository *r,
+				  struct strbuf *buf, struct diff_filespec *one)
+{
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%06o %s %s", one->mode, oid_to_hex(&one->oid),
+		    one->path);
+	r->hash_algo->update_fn(ctx, buf->buf, buf->len + 1);
+}
+
+/*
+ * Collect the candidates and hash them, and the options their scores
+ * depend on, into the key of the rename cache. Return -1 if a file is
+ * in the working tree, in which case the scores cannot be cached.
+ */
+static int prepare_rename_cache(struct repository *r,
+				int minimum_score, int skip_unmodified,
+				int approximate, struct rename_cache_state *rc)
+{
+	struct strbuf buf = STRBUF_INIT;
+	git_hash_ctx ctx;
+	int i, ret = 0;
+
+	ALLOC_ARRAY(rc->srcs, rename_src_nr);
+	ALLOC_ARRAY(rc->src_index, rename_src_nr);
+	ALLOC_ARRAY(rc->dsts, rename_dst_nr);
+	rc->srcs_nr = rc->dsts_nr = 0;
+
+	r->hash_algo->init_fn(&ctx);
+	strbuf_addf(&buf, "rename-cache score %d approximate %d",
+		    minimum_score, approximate);
+	r->hash_algo->update_fn(&ctx, buf.buf, buf.len + 1);
+
+	for (i = 0; i < rename_src_nr && !ret; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		rc->src_index[i] = -1;
+		if (skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (!one->oid_valid)
+			ret = -1;
+		hash_rename_candidate(&ctx, r, &buf, one);
+		rc->src_index[i] = rc->srcs_nr;
+		rc->srcs[rc->srcs_nr++] = i;
+	}
+	/* An empty entry separates the sources from the destinations. */
+	r->hash_algo->update_fn(&ctx, "", 1);
+	for (i = 0; i < rename_dst_nr && !ret; i++) {
+		struct diff_filespec *two = rename_dst[i].p->two;
+
+		if (rename_dst[i].is_rename)
+			continue;
+		if (!two->oid_valid)
+			ret = -1;
+		hash_rename_candidate(&ctx, r, &buf, two);
+		rc->dsts[rc->dsts_nr++] = i;
+	}
+	r->hash_algo->final_oid_fn(&rc->key, &ctx);
+
+	strbuf_release(&buf);
+	return ret;
+}
+
+static void release_rename_cache(struct rename_cache_state *rc)
+{
+	free(rc->srcs);
+	free(rc->dsts);
+	free(rc->src_index);
+}
+
+/*
+ * Fill the rows of the score matrix "mx" from the rename cache, and
+ * return their number, or -1 if the scores are not cached.
+ */
+static int read_cached_scores(struct repository *r,
+			      struct rename_cache_state *rc,
+			      struct diff_score *mx)
+{
+	struct rename_cache_score *scores;
+	size_t nr, i;
+	uint32_t row = 0;
+	int slot = 0;
+
+	if (read_rename_cache(r, &rc->key, &scores, &nr))
+		return -1;
+
+	for (i = 0; i < st_mult(rc->dsts_nr, NUM_CANDIDATE_PER_DST); i++)
+		mx[i].dst = -1;
+	for (i = 0; i < nr; i++) {
+		struct diff_score *m;
+
+		if (scores[i].dst != row) {
+			row = scores[i].dst;
+			slot = 0;
+		}
+		if (row >= rc->dsts_nr ||
+		    (i && scores[i].dst < scores[i - 1].dst) ||
+		    scores[i].src >= rc->srcs_nr ||
+		    slot >= NUM_CANDIDATE_PER_DST) {
+			free(scores);
+			return -1;
+		}
+		m = &mx[row * NUM_CANDIDATE_PER_DST + slot++];
+		m->src = rc->srcs[scores[i].src];
+		m->dst = rc->dsts[row];
+		m->score = scores[i].score;
+		m->name_score = scores[i].name_score;
+	}
+	free(scores);
+	return rc->dsts_nr;
+}
+
+/*
+ * Cache the entries of the rows of the score matrix "mx" that
+ * find_renames() may use, in order.
+ */
+static void write_cached_scores(struct repository *r,
+				struct rename_cache_state *rc,
+				struct diff_score *mx, int dst_cnt,
+				int minimum_score)
+{
+	struct rename_cache_score *scores;
+	size_t nr = 0, i;
+
+	ALLOC_ARRAY(scores, st_mult(dst_cnt, NUM_CANDIDATE_PER_DST));
+	for (i = 0; i < st_mult(dst_cnt, NUM_CANDIDATE_PER_DST); i++) {
+		struct rename_cache_score *s;
+
+		if (mx[i].dst < 0 || mx[i].score < minimum_score)
+			continue;
+		s = &scores[nr++];
+		s->dst = i / NUM_CANDIDATE_PER_DST;
+		s->src = rc->src_index[mx[i].src];
+		s->score = mx[i].score;
+		s->name_score = mx[i].name_score;
+	}
+	write_rename_cache(r, &rc->key, scores, nr);
+	free(scores);
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -1388,7 +2047,9 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
 	int i, j, rename_count, skip_unmodified = 0;
-	int num_destinations, dst_cnt;
+	int num_destinations, dst_cnt, nr_threads, approximate = 0;
+	int use_cache, cached = 0;
+	struct rename_cache_state cache = { 0 };
 	int num_sources, want_copies;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
@@ -1553,7 +2214,12 @@ void diffcore_rename_extended(struct diff_options *options,
 	switch (too_many_rename_candidates(num_destinations, num_sources,
 					   options)) {
 	case 1:
-		goto cleanup;
+		if (!options->approximate_renames)
+			goto cleanup;
+		/* Look for likely pairs instead of giving up. */
+		options->needed_rename_limit = 0;
+		approximate = 1;
+		break;
 	case 2:
 		options->degraded_cc_to_c = 1;
 		skip_unmodified = 1;
@@ -1577,48 +2243,69 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	nr_threads = rename_score_threads_nr(options, num_destinations,
+					     &dpf_options);
+	use_cache = options->rename_cache &&
+		st_mult(num_destinations, num_sources) >= RENAME_CACHE_MIN_PAIRS &&
+		!prepare_rename_cache(options->repo, minimum_score,
+				      skip_unmodified, approximate, &cache);
+	if (use_cache &&
+	    (dst_cnt = read_cached_scores(options->repo, &cache, mx)) >= 0) {
+		cached = 1;
+	} else if (nr_threads > 1 || approximate) {
+		dst_cnt = score_candidates(options, mx, nr_threads,
+					   minimum_score, skip_unmodified,
+					   want_copies || break_idx,
+					   approximate, &dpf_options, progress);
+	} else {
+		for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+			struct diff_filespec *two = rename_dst[i].p->two;
+			struct diff_score *m;
+
+			if (rename_dst[i].is_rename)
+				continue; /* exact or basename match already handled */
+
+			m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+			for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+				m[j].dst = -1;
+
+			for (j = 0; j < rename_src_nr; j++) {
+				struct diff_filespec *one = rename_src[j].p->one;
+				struct diff_score this_src;
+
+				assert(!one->rename_used || want_copies || break_idx);
+
+				if (skip_unmodified &&
+				    diff_unmodified_pair(rename_src[j].p))
+					continue;
+
+				this_src.score = estimate_similarity(options->repo,
+								     one, two,
+								     minimum_score,
+								     &dpf_options);
+				this_src.name_score = basename_same(one, two);
+				this_src.dst = i;
+				this_src.src = j;
+				record_if_better(m, &this_src);
+				/*
+				 * Once we run estimate_similarity,
+				 * We do not need the text anymore.
+				 */
+				diff_free_filespec_blob(one);
+				diff_free_filespec_blob(two);
+			}
+			dst_cnt++;
+			display_progress(progress,
+					 (uint64_t)dst_cnt * (uint64_t)num_sources);
 		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
 	}
 	stop_progress(&progress);
 
+	if (use_cache && !cached)
+		write_cached_scores(options->repo, &cache, mx, dst_cnt,
+				    minimum_score);
+	release_rename_cache(&cache);
+
 	/* cost matrix sorted by most to least similar pair */
 	STABLE_QSORT(mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
 
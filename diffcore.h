@@ -7,6 +7,7 @@
 #include "hash-ll.h"
 
 struct diff_options;
+struct index_state;
 struct mem_pool;
 struct oid_array;
 struct repository;
@@ -91,6 +92,7 @@ int diff_populate_filespec(struct repository *, struct diff_filespec *,
 void diff_free_filespec_data(struct diff_filespec *);
 void diff_free_filespec_blob(struct diff_filespec *);
 int diff_filespec_is_binary(struct repository *, struct diff_filespec *);
+void diff_filespec_load_driver(struct diff_filespec *, struct index_state *);
 
 /**
  * This records a pair of `struct diff_filespec`; the filespec for a file in
@@ -227,6 +229,23 @@ int diffcore_count_changes(struct repository *r,
 			   unsigned long *src_copied,
 			   unsigned long *literal_added);
 
+/*
+ * Compute the span counts diffcore_count_changes() compares in
+ * "one->cnt_data", unless they were computed already. The contents of
+ * "one" must have been read, and its userdiff driver loaded; then this
+ * may be called from several threads for different filespecs.
+ */
+void diffcore_count_spans(struct repository *r, struct diff_filespec *one);
+
+/*
+ * Compute a MinHash signature of "nr" values from the span counts
+ * "cnt_data" computed by diffcore_count_spans(): the chance that two
+ * signatures agree at a given position is the Jaccard similarity of the
+ * sets of spans of the two files. Return 0 if there are no spans, i.e.
+ * the file is empty.
+ */
+int diffcore_span_minhash(const void *cnt_data, uint32_t *sig, int nr);
+
 /*
  * If filespec contains an OID and if that object is missing from the given
  * repository, add that OID to to_fetch.
@@ -29,6 +29,7 @@
 #include "sparse-index.h"
 #include "submodule-config.h"
 #include "symlinks.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 
@@ -50,9 +51,11 @@ enum path_treatment {
  */
 struct cached_dir {
 	DIR *fdir;
+	struct prefetched_dir *prefetched;
 	struct untracked_cache_dir *untracked;
 	int nr_files;
 	int nr_dirs;
+	size_t nr_prefetched;
 
 	const char *d_name;
 	int d_type;
@@ -937,6 +940,8 @@ static int read_skip_worktree_file_from_index(struct index_state *istate,
  * Frees memory within pl which was allocated for exclude patterns and
  * the file buffer.  Does not free pl itself.
  */
+static void free_pattern_list_index(struct pattern_list_index *index);
+
 void clear_pattern_list(struct pattern_list *pl)
 {
 	int i;
@@ -947,6 +952,7 @@ void clear_pattern_list(struct pattern_list *pl)
 	free(pl->filebuf);
 	hashmap_clear_and_free(&pl->recursive_hashmap, struct pattern_entry, ent);
 	hashmap_clear_and_free(&pl->parent_hashmap, struct pattern_entry, ent);
+	free_pattern_list_index(pl->index);
 
 	memset(pl, 0, sizeof(*pl));
 }
@@ -1318,6 +1324,270 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+/*
+ * Lists shorter than this are scanned, as indexing them costs more than
+ * it saves.
+ */
+#define PATTERN_LIST_INDEX_MIN 16
+
+/* Positions in pattern_list->patterns, in increasing order. */
+struct pattern_pos_list {
+	int *pos;
+	int nr, alloc;
+};
+
+struct pattern_name_entry {
+	struct hashmap_entry ent;
+	const char *name;
+	int len;
+	struct pattern_pos_list patterns;
+};
+
+/*
+ * A pattern_list split by the kind of its patterns.  Patterns that are
+ * a plain basename, like "Makefile", and "*" followed by an extension,
+ * like "*.o", are looked up by the basename or the extension of the
+ * path.  The others are kept in "others"; those of them that can match
+ * a path in the directory of the last path checked, given the base and
+ * the literal prefix they start with, are kept in "dir_patterns".
+ */
+struct pattern_list_index {
+	int nr;
+	struct hashmap names;
+	struct hashmap exts;
+	struct pattern_pos_list others;
+
+	struct strbuf dir;
+	int dir_valid;
+	struct pattern_pos_list dir_patterns;
+
+	/* The patterns to try on the path being checked, last first. */
+	struct pattern_pos_list candidates;
+};
+
+static void pattern_pos_list_add(struct pattern_pos_list *list, int pos)
+{
+	ALLOC_GROW(list->pos, list->nr + 1, list->alloc);
+	list->pos[list->nr++] = pos;
+}
+
+static int pattern_name_entry_cmp(const void *cmp_data UNUSED,
+				  const struct hashmap_entry *eptr,
+				  const struct hashmap_entry *entry_or_key,
+				  const void *keydata UNUSED)
+{
+	const struct pattern_name_entry *a, *b;
+
+	a = container_of(eptr, const struct pattern_name_entry, ent);
+	b = container_of(entry_or_key, const struct pattern_name_entry, ent);
+	return a->len != b->len || fspathncmp(a->name, b->name, a->len);
+}
+
+static unsigned int pattern_name_hash(const char *name, int len)
+{
+	return ignore_case ? memihash(name, len) : memhash(name, len);
+}
+
+static struct pattern_pos_list *pattern_name_lookup(struct hashmap *map,
+						    const char *name, int len)
+{
+	struct pattern_name_entry key, *e;
+
+	hashmap_entry_init(&key.ent, pattern_name_hash(name, len));
+	key.name = name;
+	key.len = len;
+	e = hashmap_get_entry(map, &key, ent, NULL);
+	return e ? &e->patterns : NULL;
+}
+
+static void pattern_name_add(struct hashmap *map, const char *name, int len,
+			     int pos)
+{
+	struct pattern_pos_list *list = pattern_name_lookup(map, name, len);
+
+	if (!list) {
+		struct pattern_name_entry *e;
+
+		CALLOC_ARRAY(e, 1);
+		hashmap_entry_init(&e->ent, pattern_name_hash(name, len));
+		e->name = name;
+		e->len = len;
+		hashmap_add(map, &e->ent);
+		list = &e->patterns;
+	}
+	pattern_pos_list_add(list, pos);
+}
+
+static void pattern_name_map_clear(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_name_entry *e;
+
+	hashmap_for_each_entry(map, &iter, e, ent)
+		free(e->patterns.pos);
+	hashmap_clear_and_free(map, struct pattern_name_entry, ent);
+}
+
+static void free_pattern_list_index(struct pattern_list_index *index)
+{
+	if (!index)
+		return;
+	pattern_name_map_clear(&index->names);
+	pattern_name_map_clear(&index->exts);
+	free(index->others.pos);
+	strbuf_release(&index->dir);
+	free(index->dir_patterns.pos);
+	free(index->candidates.pos);
+	free(index);
+}
+
+static struct pattern_list_index *index_pattern_list(struct pattern_list *pl)
+{
+	struct pattern_list_index *index = pl->index;
+	int i;
+
+	if (index && index->nr == pl->nr)
+		return index;
+	free_pattern_list_index(index);
+
+	CALLOC_ARRAY(index, 1);
+	index->nr = pl->nr;
+	hashmap_init(&index->names, pattern_name_entry_cmp, NULL, 0);
+	hashmap_init(&index->exts, pattern_name_entry_cmp, NULL, 0);
+	strbuf_init(&index->dir, 0);
+
+	for (i = 0; i < pl->nr; i++) {
+		const struct path_pattern *pattern = pl->patterns[i];
+
+		if ((pattern->flags & PATTERN_FLAG_NODIR) &&
+		    !(pattern->flags & PATTERN_FLAG_MUSTBEDIR)) {
+			if (pattern->nowildcardlen == pattern->patternlen) {
+				pattern_name_add(&index->names, pattern->pattern,
+						 pattern->patternlen, i);
+				continue;
+			}
+			/*
+			 * "*.ext" matches exactly the basenames whose
+			 * extension, from their last ".", is ".ext".
+			 */
+			if ((pattern->flags & PATTERN_FLAG_ENDSWITH) &&
+			    pattern->pattern[1] == '.' &&
+			    !memchr(pattern->pattern + 2, '.',
+				    pattern->patternlen - 2)) {
+				pattern_name_add(&index->exts, pattern->pattern + 1,
+						 pattern->patternlen - 1, i);
+				continue;
+			}
+		}
+		pattern_pos_list_add(&index->others, i);
+	}
+
+	pl->index = index;
+	return index;
+}
+
+/*
+ * Can "pattern", which is matched against the full path, match a path
+ * that starts with dir[0..dirlen)?  match_pathname() requires the path
+ * to start with the base of the pattern, and then with its literal
+ * prefix.
+ */
+static int pattern_may_match_in_dir(const struct path_pattern *pattern,
+				    const char *dir, int dirlen)
+{
+	const char *prefix = pattern->pattern;
+	int prefixlen = pattern->nowildcardlen;
+	int len;
+
+	if (*prefix == '/') {
+		prefix++;
+		prefixlen--;
+	}
+
+	len = pattern->baselen < dirlen ? pattern->baselen : dirlen;
+	if (len && fspathncmp(pattern->base, dir, len))
+		return 0;
+	if (dirlen <= pattern->baselen)
+		return 1;
+
+	dir += pattern->baselen;
+	dirlen -= pattern->baselen;
+	return !fspathncmp(prefix, dir, prefixlen < dirlen ? prefixlen : dirlen);
+}
+
+static const struct pattern_pos_list *dir_patterns(struct pattern_list *pl,
+						   struct pattern_list_index *index,
+						   const char *dir, int dirlen)
+{
+	int i;
+
+	if (index->dir_valid && index->dir.len == dirlen &&
+	    !memcmp(index->dir.buf, dir, dirlen))
+		return &index->dir_patterns;
+
+	strbuf_reset(&index->dir);
+	strbuf_add(&index->dir, dir, dirlen);
+	index->dir_patterns.nr = 0;
+	index->dir_valid = 1;
+
+	for (i = 0; i < index->others.nr; i++) {
+		int pos = index->others.pos[i];
+		const struct path_pattern *pattern = pl->patterns[pos];
+
+		if (!(pattern->flags & PATTERN_FLAG_NODIR) &&
+		    !pattern_may_match_in_dir(pattern, dir, dirlen))
+			continue;
+		pattern_pos_list_add(&index->dir_patterns, pos);
+	}
+	return &index->dir_patterns;
+}
+
+/*
+ * Return the positions of the patterns in "pl" that may match
+ * "pathname", in decreasing order.
+ */
+static const struct pattern_pos_list *pattern_list_candidates(struct pattern_list *pl,
+							      const char *pathname,
+							      int pathlen,
+							      const char *basename)
+{
+	struct pattern_list_index *index = index_pattern_list(pl);
+	struct pattern_pos_list *out = &index->candidates;
+	const struct pattern_pos_list *lists[3];
+	int namelen = pathlen - (basename - pathname);
+	int extlen, pos[3], i;
+
+	for (extlen = 1; extlen <= namelen; extlen++)
+		if (basename[namelen - extlen] == '.')
+			break;
+	if (extlen > namelen)
+		extlen = 0;
+
+	lists[0] = pattern_name_lookup(&index->names, basename, namelen);
+	lists[1] = extlen ? pattern_name_lookup(&index->exts,
+						basename + namelen - extlen,
+						extlen) : NULL;
+	lists[2] = dir_patterns(pl, index, pathname, basename - pathname);
+	for (i = 0; i < ARRAY_SIZE(lists); i++)
+		pos[i] = lists[i] ? lists[i]->nr : 0;
+
+	out->nr = 0;
+	for (;;) {
+		int best = -1;
+
+		for (i = 0; i < ARRAY_SIZE(lists); i++)
+			if (pos[i] &&
+			    (best < 0 ||
+			     lists[i]->pos[pos[i] - 1] >
+			     lists[best]->pos[pos[best] - 1]))
+				best = i;
+		if (best < 0)
+			break;
+		pattern_pos_list_add(out, lists[best]->pos[--pos[best]]);
+	}
+	return out;
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1332,13 +1602,21 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct index_state *istate)
 {
 	struct path_pattern *res = NULL; /* undecided */
-	int i;
+	const struct pattern_pos_list *candidates = NULL;
+	int i, n = pl->nr;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
-	for (i = pl->nr - 1; 0 <= i; i--) {
-		struct path_pattern *pattern = pl->patterns[i];
+	if (pl->nr >= PATTERN_LIST_INDEX_MIN) {
+		candidates = pattern_list_candidates(pl, pathname, pathlen,
+						     basename);
+		n = candidates->nr;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct path_pattern *pattern =
+			pl->patterns[candidates ? candidates->pos[i] : n - 1 - i];
 		const char *exclude = pattern->pattern;
 		int prefix = pattern->nowildcardlen;
 
@@ -2424,6 +2702,220 @@ static void add_untracked(struct untracked_cache_dir *dir, const char *name)
 	dir->untracked[dir->untracked_nr++] = xstrdup(name);
 }
 
+/*
+ * Checking whether the directories in the untracked cache are still
+ * valid takes an lstat() of each, and those that are not have to be
+ * read again, one at a time.  With "core.untrackedCacheThreads", the
+ * directories of the cache are stat'ed, and the invalid ones read, in
+ * threads before the traversal, which then merges what they found
+ * into the untracked cache as usual.  The rest of the traversal (the
+ * exclude patterns and the index lookups) stays on the main thread.
+ */
+#define PREFETCH_DIRS_PER_THREAD 50
+
+struct prefetched_dirent {
+	char *name;
+	int d_type;
+};
+
+struct prefetched_dir {
+	struct hashmap_entry ent;
+	struct untracked_cache_dir *ucd;
+	char *path;
+	int stat_errno;
+	struct stat st;
+	/* The entries of the directory, if it has to be read again */
+	unsigned listed : 1;
+	struct prefetched_dirent *entries;
+	size_t nr, alloc;
+};
+
+struct untracked_prefetch {
+	struct index_state *istate;
+	struct hashmap dirs;
+	struct prefetched_dir **list;
+	size_t nr, alloc;
+	size_t next;
+	pthread_mutex_t mutex;
+};
+
+static int prefetched_dir_cmp(const void *cmp_data UNUSED,
+			      const struct hashmap_entry *eptr,
+			      const struct hashmap_entry *entry_or_key,
+			      const void *keydata UNUSED)
+{
+	const struct prefetched_dir *a, *b;
+
+	a = container_of(eptr, const struct prefetched_dir, ent);
+	b = container_of(entry_or_key, const struct prefetched_dir, ent);
+	return a->ucd != b->ucd;
+}
+
+static struct prefetched_dir *find_prefetched_dir(struct dir_struct *dir,
+						  struct untracked_cache_dir *ucd)
+{
+	struct untracked_prefetch *up = dir->internal.untracked_prefetch;
+	struct prefetched_dir key;
+
+	if (!up || !ucd)
+		return NULL;
+	hashmap_entry_init(&key.ent, memhash(&ucd, sizeof(ucd)));
+	key.ucd = ucd;
+	return hashmap_get_entry(&up->dirs, &key, ent, NULL);
+}
+
+static void collect_prefetch_dirs(struct untracked_prefetch *up,
+				  struct untracked_cache *uc,
+				  struct untracked_cache_dir *ucd,
+				  struct strbuf *path)
+{
+	size_t len = path->len;
+	int i;
+
+	/* With fsmonitor, the traversal trusts valid directories. */
+	if (!(uc->use_fsmonitor && ucd->valid)) {
+		struct prefetched_dir *pd;
+
+		CALLOC_ARRAY(pd, 1);
+		hashmap_entry_init(&pd->ent, memhash(&ucd, sizeof(ucd)));
+		pd->ucd = ucd;
+		pd->path = xstrdup(path->len ? path->buf : ".");
+		hashmap_add(&up->dirs, &pd->ent);
+		ALLOC_GROW(up->list, up->nr + 1, up->alloc);
+		up->list[up->nr++] = pd;
+	}
+
+	for (i = 0; i < ucd->dirs_nr; i++) {
+		strbuf_addstr(path, ucd->dirs[i]->name);
+		strbuf_addch(path, '/');
+		collect_prefetch_dirs(up, uc, ucd->dirs[i], path);
+		strbuf_setlen(path, len);
+	}
+}
+
+static void prefetch_one_dir(struct untracked_prefetch *up,
+			     struct prefetched_dir *pd)
+{
+	struct dirent *de;
+	DIR *fdir;
+
+	if (lstat(pd->path, &pd->st)) {
+		pd->stat_errno = errno;
+		return;
+	}
+	if (pd->ucd->valid &&
+	    !match_stat_data_racy(up->istate, &pd->ucd->stat_data, &pd->st))
+		return;
+
+	fdir = opendir(pd->path);
+	if (!fdir)
+		return;
+	while ((de = readdir_skip_dot_and_dotdot(fdir))) {
+		ALLOC_GROW(pd->entries, pd->nr + 1, pd->alloc);
+		pd->entries[pd->nr].name = xstrdup(de->d_name);
+		pd->entries[pd->nr].d_type = DTYPE(de);
+		pd->nr++;
+	}
+	closedir(fdir);
+	pd->listed = 1;
+}
+
+static void *prefetch_untracked_thread(void *arg)
+{
+	struct untracked_prefetch *up = arg;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&up->mutex);
+		i = up->next++;
+		pthread_mutex_unlock(&up->mutex);
+		if (i >= up->nr)
+			break;
+		prefetch_one_dir(up, up->list[i]);
+	}
+	return NULL;
+}
+
+static void prefetch_untracked_cache(struct dir_struct *dir,
+				     struct index_state *istate,
+				     struct untracked_cache_dir *untracked,
+				     const char *base, int baselen)
+{
+	struct untracked_prefetch *up;
+	struct strbuf path = STRBUF_INIT;
+	pthread_t *threads;
+	int nr_threads = 1, i, ret;
+
+	if (!HAVE_THREADS ||
+	    repo_config_get_int(istate->repo, "core.untrackedcachethreads",
+				&nr_threads))
+		return;
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    nr_threads, "core.untrackedCacheThreads");
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads <= 1)
+		return;
+
+	CALLOC_ARRAY(up, 1);
+	up->istate = istate;
+	hashmap_init(&up->dirs, prefetched_dir_cmp, NULL, 0);
+	strbuf_add(&path, base, baselen);
+	collect_prefetch_dirs(up, dir->untracked, untracked, &path);
+	strbuf_release(&path);
+
+	if (nr_threads > up->nr / PREFETCH_DIRS_PER_THREAD)
+		nr_threads = up->nr / PREFETCH_DIRS_PER_THREAD;
+	if (nr_threads <= 1) {
+		hashmap_clear_and_free(&up->dirs, struct prefetched_dir, ent);
+		free(up->list);
+		free(up);
+		return;
+	}
+
+	trace2_region_enter("dir", "untracked-prefetch", istate->repo);
+	pthread_mutex_init(&up->mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL,
+				     prefetch_untracked_thread, up);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&up->mutex);
+	trace2_data_intmax("dir", istate->repo, "untracked-prefetch/dirs", up->nr);
+	trace2_data_intmax("dir", istate->repo, "untracked-prefetch/threads",
+			   nr_threads);
+	trace2_region_leave("dir", "untracked-prefetch", istate->repo);
+
+	dir->internal.untracked_prefetch = up;
+}
+
+static void free_untracked_prefetch(struct dir_struct *dir)
+{
+	struct untracked_prefetch *up = dir->internal.untracked_prefetch;
+	size_t i, j;
+
+	if (!up)
+		return;
+	for (i = 0; i < up->nr; i++) {
+		struct prefetched_dir *pd = up->list[i];
+
+		for (j = 0; j < pd->nr; j++)
+			free(pd->entries[j].name);
+		free(pd->entries);
+		free(pd->path);
+	}
+	hashmap_clear_and_free(&up->dirs, struct prefetched_dir, ent);
+	free(up->list);
+	FREE_AND_NULL(dir->internal.untracked_prefetch);
+}
+
 static int valid_cached_dir(struct dir_struct *dir,
 			    struct untracked_cache_dir *untracked,
 			    struct index_state *istate,
@@ -2440,10 +2932,14 @@ static int valid_cached_dir(struct dir_struct *dir,
 	 */
 	refresh_fsmonitor(istate);
 	if (!(dir->untracked->use_fsmonitor && untracked->valid)) {
-		if (lstat(path->len ? path->buf : ".", &st)) {
+		struct prefetched_dir *pd = find_prefetched_dir(dir, untracked);
+
+		if (pd ? pd->stat_errno : lstat(path->len ? path->buf : ".", &st)) {
 			memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
 			return 0;
 		}
+		if (pd)
+			st = pd->st;
 		if (!untracked->valid ||
 			match_stat_data_racy(istate, &untracked->stat_data, &st)) {
 			fill_stat_data(&untracked->stat_data, &st);
@@ -2479,21 +2975,27 @@ static int open_cached_dir(struct cached_dir *cdir,
 			   struct strbuf *path,
 			   int check_only)
 {
+	struct prefetched_dir *pd;
 	const char *c_path;
 
 	memset(cdir, 0, sizeof(*cdir));
 	cdir->untracked = untracked;
 	if (valid_cached_dir(dir, untracked, istate, path, check_only))
 		return 0;
-	c_path = path->len ? path->buf : ".";
-	cdir->fdir = opendir(c_path);
-	if (!cdir->fdir)
-		warning_errno(_("could not open directory '%s'"), c_path);
+	pd = find_prefetched_dir(dir, untracked);
+	if (pd && pd->listed) {
+		cdir->prefetched = pd;
+	} else {
+		c_path = path->len ? path->buf : ".";
+		cdir->fdir = opendir(c_path);
+		if (!cdir->fdir)
+			warning_errno(_("could not open directory '%s'"), c_path);
+	}
 	if (dir->untracked) {
 		invalidate_directory(dir->untracked, untracked);
 		dir->untracked->dir_opened++;
 	}
-	if (!cdir->fdir)
+	if (!cdir->fdir && !cdir->prefetched)
 		return -1;
 	return 0;
 }
@@ -2502,6 +3004,19 @@ static int read_cached_dir(struct cached_dir *cdir)
 {
 	struct dirent *de;
 
+	if (cdir->prefetched) {
+		struct prefetched_dir *pd = cdir->prefetched;
+
+		if (cdir->nr_prefetched >= pd->nr) {
+			cdir->d_name = NULL;
+			cdir->d_type = DT_UNKNOWN;
+			return -1;
+		}
+		cdir->d_name = pd->entries[cdir->nr_prefetched].name;
+		cdir->d_type = pd->entries[cdir->nr_prefetched].d_type;
+		cdir->nr_prefetched++;
+		return 0;
+	}
 	if (cdir->fdir) {
 		de = readdir_skip_dot_and_dotdot(cdir->fdir);
 		if (!de) {
@@ -2571,7 +3086,7 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 		if (dir->flags & DIR_SHOW_IGNORED)
 			break;
 		dir_add_name(dir, istate, path->buf, path->len);
-		if (cdir->fdir)
+		if (cdir->fdir || cdir->prefetched)
 			add_untracked(untracked, path->buf + baselen);
 		break;
 
@@ -2677,7 +3192,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 			/* abort early if maximum state has been reached */
 			if (dir_state == path_untracked) {
-				if (cdir.fdir)
+				if (cdir.fdir || cdir.prefetched)
 					add_untracked(untracked, path.buf + baselen);
 				break;
 			}
@@ -3057,8 +3572,11 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
+	if (untracked)
+		prefetch_untracked_cache(dir, istate, untracked, path, len);
 	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+	free_untracked_prefetch(dir);
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
@@ -121,6 +121,12 @@ struct pattern_list {
 	 * Used to check single-level parents of blobs.
 	 */
 	struct hashmap parent_hashmap;
+
+	/*
+	 * The patterns by kind, built on demand when the list is long
+	 * enough, so that not every pattern has to be tried on every path.
+	 */
+	struct pattern_list_index *index;
 };
 
 /*
@@ -356,6 +362,9 @@ struct dir_struct {
 		/* Stats about the traversal */
 		unsigned visited_paths;
 		unsigned visited_directories;
+
+		/* Untracked cache directories read ahead in threads */
+		struct untracked_prefetch *untracked_prefetch;
 	} internal;
 };
 
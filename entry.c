@@ -82,9 +82,75 @@ static void remove_subtree(struct strbuf *path)
 		die_errno("cannot rmdir '%s'", path->buf);
 }
 
+#ifdef HAVE_OPENAT
+/*
+ * Entries are checked out in index order, so most files go into the
+ * same directory as the one before them. Keep that directory open and
+ * create the files relative to it, so that the kernel does not have to
+ * walk all the leading directories of every file again.
+ *
+ * create_directories() has made sure that the leading directories are
+ * real directories before the path is first opened. If one of them is
+ * removed afterwards, creating a file relative to the stale descriptor
+ * fails with ENOENT, and we look the path up again.
+ */
+static struct strbuf cached_dir_path = STRBUF_INIT;
+static int cached_dir_fd = -1;
+
+static void clear_cached_dir(void)
+{
+	if (cached_dir_fd >= 0)
+		close(cached_dir_fd);
+	cached_dir_fd = -1;
+	strbuf_reset(&cached_dir_path);
+}
+
+/*
+ * Make sure the leading directory of "path" is the cached one, and
+ * return the rest of "path", or NULL if it has no leading directory or
+ * it cannot be opened.
+ */
+static const char *open_cached_dir(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	size_t dirlen;
+
+	if (!slash)
+		return NULL;
+	dirlen = slash - path;
+	if (cached_dir_fd >= 0 && cached_dir_path.len == dirlen &&
+	    !memcmp(cached_dir_path.buf, path, dirlen))
+		return slash + 1;
+
+	clear_cached_dir();
+	strbuf_add(&cached_dir_path, path, dirlen);
+	cached_dir_fd = open(cached_dir_path.buf,
+			     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cached_dir_fd < 0) {
+		clear_cached_dir();
+		return NULL;
+	}
+	return slash + 1;
+}
+#endif
+
 static int create_file(const char *path, unsigned int mode)
 {
+#ifdef HAVE_OPENAT
+	const char *basename;
+#endif
+
 	mode = (mode & 0100) ? 0777 : 0666;
+#ifdef HAVE_OPENAT
+	basename = open_cached_dir(path);
+	if (basename) {
+		int fd = openat(cached_dir_fd, basename,
+				O_WRONLY | O_CREAT | O_EXCL, mode);
+		if (fd >= 0 || errno != ENOENT)
+			return fd;
+		clear_cached_dir();
+	}
+#endif
 	return open(path, O_WRONLY | O_CREAT | O_EXCL, mode);
 }
 
@@ -18,6 +18,7 @@
  */
 #include "git-compat-util.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
@@ -100,21 +101,47 @@ struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
 	return ewah;
 }
 
+/*
+ * OR the first "max" words of "ewah" into "self", starting at word 0.
+ * Instead of inflating every word, walk the run-length words of the
+ * compressed form: a run of zeroes needs no work at all, a run of ones
+ * is filled in at once, and only the literal words are actually ORed
+ * in. Returns the number of words "ewah" covers, up to "max".
+ */
+static size_t bitmap_or_ewah_words(struct bitmap *self,
+				   const struct ewah_bitmap *ewah,
+				   size_t max)
+{
+	size_t i = 0, pointer = 0;
+
+	while (pointer < ewah->buffer_size && i < max) {
+		const eword_t *rlw = &ewah->buffer[pointer++];
+		size_t run = rlw_get_running_len(rlw);
+		size_t nr = rlw_get_literal_words(rlw);
+
+		if (nr > ewah->buffer_size - pointer)
+			nr = ewah->buffer_size - pointer;
+		if (run > max - i)
+			run = max - i;
+		if (nr > max - i - run)
+			nr = max - i - run;
+		bitmap_grow(self, i + run + nr);
+
+		if (rlw_get_run_bit(rlw))
+			memset(self->words + i, 0xff, run * sizeof(eword_t));
+		i += run;
+
+		while (nr--)
+			self->words[i++] |= ewah->buffer[pointer++];
+	}
+	return i;
+}
+
 struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
 {
-	struct bitmap *bitmap = bitmap_new();
-	struct ewah_iterator it;
-	eword_t blowup;
-	size_t i = 0;
-
-	ewah_iterator_init(&it, ewah);
+	struct bitmap *bitmap = bitmap_word_alloc(ewah->bit_size / BITS_IN_EWORD + 1);
 
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
-	}
-
-	bitmap->word_alloc = i;
+	bitmap->word_alloc = bitmap_or_ewah_words(bitmap, ewah, SIZE_MAX);
 	return bitmap;
 }
 
@@ -140,23 +167,14 @@ void bitmap_or(struct bitmap *self, const struct bitmap *other)
 
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
-	size_t original_size = self->word_alloc;
-	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
-
-	if (self->word_alloc < other_final) {
-		self->word_alloc = other_final;
-		REALLOC_ARRAY(self->words, self->word_alloc);
-		memset(self->words + original_size, 0x0,
-			(self->word_alloc - original_size) * sizeof(eword_t));
-	}
-
-	ewah_iterator_init(&it, other);
+	bitmap_grow(self, (other->bit_size / BITS_IN_EWORD) + 1);
+	bitmap_or_ewah_words(self, other, SIZE_MAX);
+}
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+void bitmap_or_ewah_prefix(struct bitmap *self, struct ewah_bitmap *other,
+			   size_t nr_words)
+{
+	bitmap_or_ewah_words(self, other, nr_words);
 }
 
 size_t bitmap_popcount(struct bitmap *self)
@@ -356,6 +356,41 @@ int ewah_iterator_next(eword_t *next, struct ewah_iterator *it)
 	return 1;
 }
 
+size_t ewah_iterator_next_words(const eword_t **literals, eword_t *fill,
+				size_t max, struct ewah_iterator *it)
+{
+	size_t nr;
+
+	if (it->pointer >= it->buffer_size || !max)
+		return 0;
+
+	if (it->compressed < it->rl) {
+		nr = it->rl - it->compressed;
+		if (nr > max)
+			nr = max;
+		it->compressed += nr;
+		*literals = NULL;
+		*fill = it->b ? (eword_t)(~0) : 0;
+	} else {
+		nr = it->lw - it->literals;
+		if (nr > max)
+			nr = max;
+
+		assert(it->pointer + nr < it->buffer_size);
+
+		*literals = it->buffer + it->pointer + 1;
+		it->literals += nr;
+		it->pointer += nr;
+	}
+
+	if (it->compressed == it->rl && it->literals == it->lw) {
+		if (++it->pointer < it->buffer_size)
+			read_new_rlw(it);
+	}
+
+	return nr;
+}
+
 void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
 {
 	it->buffer = parent->buffer;
@@ -148,6 +148,18 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
  */
 int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
 
+/**
+ * Yield up to "max" of the next words at once, as they are stored in the
+ * compressed bitmap: either a run of words that are all "*fill" (0 or
+ * ~0), in which case "*literals" is set to NULL, or a block of literal
+ * words, which "*literals" then points to. Mixing calls with
+ * ewah_iterator_next() on the same iterator is fine.
+ *
+ * Return: the number of words yielded, or 0 if there are no words left
+ */
+size_t ewah_iterator_next_words(const eword_t **literals, eword_t *fill,
+				size_t max, struct ewah_iterator *it);
+
 void ewah_xor(
 	struct ewah_bitmap *ewah_i,
 	struct ewah_bitmap *ewah_j,
@@ -186,6 +198,9 @@ struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah);
 
 void bitmap_and_not(struct bitmap *self, struct bitmap *other);
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
+/* Like bitmap_or_ewah(), but only for the first "nr_words" words of "other". */
+void bitmap_or_ewah_prefix(struct bitmap *self, struct ewah_bitmap *other,
+			   size_t nr_words);
 void bitmap_or(struct bitmap *self, const struct bitmap *other);
 
 size_t bitmap_popcount(struct bitmap *self);
@@ -877,24 +877,22 @@ static void create_promisor_file(const char *keep_name,
 	strbuf_release(&promisor_name);
 }
 
-static void parse_gitmodules_oids(int fd, struct oidset *gitmodules_oids)
+static void parse_gitmodules_oids(const char *p, const char *end,
+				  struct oidset *gitmodules_oids)
 {
 	int len = the_hash_algo->hexsz + 1; /* hash + NL */
 
-	do {
-		char hex_hash[GIT_MAX_HEXSZ + 1];
-		int read_len = read_in_full(fd, hex_hash, len);
+	while (p < end) {
 		struct object_id oid;
-		const char *end;
+		const char *hex_end;
 
-		if (!read_len)
-			return;
-		if (read_len != len)
-			die("invalid length read %d", read_len);
-		if (parse_oid_hex(hex_hash, &oid, &end) || *end != '\n')
+		if (end - p < len)
+			die("invalid length read %d", (int)(end - p));
+		if (parse_oid_hex(p, &oid, &hex_end) || *hex_end != '\n')
 			die("invalid hash");
 		oidset_insert(gitmodules_oids, &oid);
-	} while (1);
+		p = hex_end + 1;
+	}
 }
 
 static void add_index_pack_keep_option(struct strvec *args)
@@ -908,13 +906,187 @@ static void add_index_pack_keep_option(struct strvec *args)
 }
 
 /*
- * If packfile URIs were provided, pass a non-NULL pointer to index_pack_args.
- * The strings to pass as the --index-pack-arg arguments to http-fetch will be
- * stored there. (It must be freed by the caller.)
+ * The packs that the server told us to download from packfile URIs. Each
+ * of them is downloaded and indexed by an http-fetch child, which runs
+ * while the rest of the response is still coming in.
+ */
+struct packfile_uri_downloads {
+	/* "<hash> <uri>" for each pack, as sent by the server. */
+	struct string_list uris;
+	/* The --index-pack-arg arguments to pass to http-fetch. */
+	struct strvec index_pack_args;
+	/* The child and what it wrote so far, for each pack. */
+	struct child_process *cmds;
+	struct strbuf *outputs;
+	/* How many children were started, and how many may run at once. */
+	int nr_started;
+	int max;
+};
+
+#define PACKFILE_URI_DOWNLOADS_INIT { \
+	.uris = STRING_LIST_INIT_DUP, \
+	.index_pack_args = STRVEC_INIT, \
+}
+
+static void start_packfile_uri_download(struct packfile_uri_downloads *d)
+{
+	struct child_process *cmd = &d->cmds[d->nr_started];
+	const char *hash_and_uri = d->uris.items[d->nr_started].string;
+	int i;
+
+	child_process_init(cmd);
+	strvec_push(&cmd->args, "http-fetch");
+	strvec_pushf(&cmd->args, "--packfile=%.*s",
+		     (int) the_hash_algo->hexsz, hash_and_uri);
+	for (i = 0; i < d->index_pack_args.nr; i++)
+		strvec_pushf(&cmd->args, "--index-pack-arg=%s",
+			     d->index_pack_args.v[i]);
+	strvec_push(&cmd->args, hash_and_uri + the_hash_algo->hexsz + 1);
+	cmd->git_cmd = 1;
+	cmd->no_stdin = 1;
+	cmd->out = -1;
+	cmd->clean_on_exit = 1;
+	if (start_command(cmd))
+		die("fetch-pack: unable to spawn http-fetch");
+	strbuf_init(&d->outputs[d->nr_started], 0);
+	d->nr_started++;
+}
+
+/*
+ * Start as many downloads as may run at once. This needs the arguments
+ * for index-pack, but no data of the response, so that the downloads
+ * run alongside the main pack.
+ */
+static void start_packfile_uri_downloads(struct packfile_uri_downloads *d)
+{
+	int max = 5;
+
+	if (!d->uris.nr)
+		return;
+	git_config_get_int("http.maxrequests", &max);
+	d->max = max < 1 ? 1 : max;
+	CALLOC_ARRAY(d->cmds, d->uris.nr);
+	CALLOC_ARRAY(d->outputs, d->uris.nr);
+	while (d->nr_started < d->uris.nr && d->nr_started < d->max)
+		start_packfile_uri_download(d);
+}
+
+/*
+ * The http-fetch child of the i-th pack closed its output; check that it
+ * indexed the pack we asked for and record the pack.
+ */
+static void finish_packfile_uri_download(struct packfile_uri_downloads *d,
+					 int i,
+					 struct string_list *pack_lockfiles,
+					 struct oidset *gitmodules_oids)
+{
+	struct child_process *cmd = &d->cmds[i];
+	struct strbuf *out = &d->outputs[i];
+	const char *hash = d->uris.items[i].string;
+	const char *uri = hash + the_hash_algo->hexsz + 1;
+	const char *packname;
+
+	close(cmd->out);
+	cmd->out = -1;
+	if (finish_command(cmd))
+		die("fetch-pack: unable to finish http-fetch");
+
+	if (!skip_prefix(out->buf, "keep\t", &packname))
+		die("fetch-pack: expected keep then TAB at start of http-fetch output");
+	if (out->buf + out->len - packname < the_hash_algo->hexsz + 1 ||
+	    packname[the_hash_algo->hexsz] != '\n')
+		die("fetch-pack: expected hash then LF at end of http-fetch output");
+
+	parse_gitmodules_oids(packname + the_hash_algo->hexsz + 1,
+			      out->buf + out->len, gitmodules_oids);
+
+	if (memcmp(hash, packname, the_hash_algo->hexsz))
+		die("fetch-pack: pack downloaded from %s does not match expected hash %.*s",
+		    uri, (int) the_hash_algo->hexsz, hash);
+
+	string_list_append_nodup(pack_lockfiles,
+				 xstrfmt("%s/pack/pack-%.*s.keep",
+					 get_object_directory(),
+					 (int) the_hash_algo->hexsz, packname));
+	strbuf_release(out);
+}
+
+/*
+ * Wait for the downloads in whatever order they finish, starting the
+ * remaining ones as slots free up, so that a large pack does not hold
+ * up the ones after it.
+ */
+static void finish_packfile_uri_downloads(struct packfile_uri_downloads *d,
+					  struct string_list *pack_lockfiles,
+					  struct oidset *gitmodules_oids)
+{
+	struct pollfd *pfd;
+	int *running;
+	int nr_finished = 0;
+
+	if (!d->nr_started)
+		return;
+
+	ALLOC_ARRAY(pfd, d->max);
+	ALLOC_ARRAY(running, d->max);
+	while (nr_finished < d->uris.nr) {
+		int i, nr = 0;
+
+		for (i = 0; i < d->nr_started; i++) {
+			if (d->cmds[i].out < 0)
+				continue;
+			pfd[nr].fd = d->cmds[i].out;
+			pfd[nr].events = POLLIN;
+			running[nr++] = i;
+		}
+
+		if (poll(pfd, nr, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("fetch-pack: poll failed");
+		}
+
+		for (i = 0; i < nr; i++) {
+			ssize_t len;
+
+			if (!pfd[i].revents)
+				continue;
+			len = strbuf_read_once(&d->outputs[running[i]],
+					       pfd[i].fd, 0);
+			if (len < 0)
+				die_errno("fetch-pack: unable to read http-fetch output");
+			if (len)
+				continue;
+
+			finish_packfile_uri_download(d, running[i],
+						     pack_lockfiles,
+						     gitmodules_oids);
+			nr_finished++;
+			if (d->nr_started < d->uris.nr)
+				start_packfile_uri_download(d);
+		}
+	}
+	free(pfd);
+	free(running);
+}
+
+static void clear_packfile_uri_downloads(struct packfile_uri_downloads *d)
+{
+	string_list_clear(&d->uris, 0);
+	strvec_clear(&d->index_pack_args);
+	FREE_AND_NULL(d->cmds);
+	FREE_AND_NULL(d->outputs);
+	d->nr_started = 0;
+}
+
+/*
+ * If packfile URIs were provided, pass them in uri_downloads. The downloads
+ * are started once the arguments for index-pack are known; the caller has
+ * to finish them.
  */
 static int get_pack(struct fetch_pack_args *args,
 		    int xd[2], struct string_list *pack_lockfiles,
-		    struct strvec *index_pack_args,
+		    struct packfile_uri_downloads *uri_downloads,
 		    struct ref **sought, int nr_sought,
 		    struct oidset *gitmodules_oids)
 {
@@ -943,7 +1115,7 @@ static int get_pack(struct fetch_pack_args *args,
 	else
 		demux.out = xd[0];
 
-	if (!args->keep_pack && unpack_limit && !index_pack_args) {
+	if (!args->keep_pack && unpack_limit && !uri_downloads) {
 
 		if (read_pack_header(demux.out, &header))
 			die(_("protocol error: bad pack header"));
@@ -966,7 +1138,7 @@ static int get_pack(struct fetch_pack_args *args,
 	    : 0)
 		fsck_objects = 1;
 
-	if (do_keep || args->from_promisor || index_pack_args || fsck_objects) {
+	if (do_keep || args->from_promisor || uri_downloads || fsck_objects) {
 		if (pack_lockfiles || fsck_objects)
 			cmd.out = -1;
 		cmd_name = "index-pack";
@@ -976,11 +1148,16 @@ static int get_pack(struct fetch_pack_args *args,
 			strvec_push(&cmd.args, "-v");
 		if (args->use_thin_pack)
 			strvec_push(&cmd.args, "--fix-thin");
-		if ((do_keep || index_pack_args) && (args->lock_pack || unpack_limit))
+		if ((do_keep || uri_downloads) && (args->lock_pack || unpack_limit))
 			add_index_pack_keep_option(&cmd.args);
-		if (!index_pack_args && args->check_self_contained_and_connected)
+		if (!uri_downloads && args->check_self_contained_and_connected) {
 			strvec_push(&cmd.args, "--check-self-contained-and-connected");
-		else
+			/*
+			 * Have the links out of the pack written down, so that
+			 * check_connected() only needs to look at these.
+			 */
+			strvec_push(&cmd.args, "--record-boundary");
+		} else
 			/*
 			 * We cannot perform any connectivity checks because
 			 * not all packs have been downloaded; let the caller
@@ -1012,7 +1189,7 @@ static int get_pack(struct fetch_pack_args *args,
 			     ntohl(header.hdr_version),
 				 ntohl(header.hdr_entries));
 	if (fsck_objects) {
-		if (args->from_promisor || index_pack_args)
+		if (args->from_promisor || uri_downloads)
 			/*
 			 * We cannot use --strict in index-pack because it
 			 * checks both broken objects and links, but we only
@@ -1024,11 +1201,13 @@ static int get_pack(struct fetch_pack_args *args,
 				     fsck_msg_types.buf);
 	}
 
-	if (index_pack_args) {
+	if (uri_downloads) {
 		int i;
 
 		for (i = 0; i < cmd.args.nr; i++)
-			strvec_push(index_pack_args, cmd.args.v[i]);
+			strvec_push(&uri_downloads->index_pack_args,
+				    cmd.args.v[i]);
+		start_packfile_uri_downloads(uri_downloads);
 	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
@@ -1038,6 +1217,7 @@ static int get_pack(struct fetch_pack_args *args,
 	if (start_command(&cmd))
 		die(_("fetch-pack: unable to fork off %s"), cmd_name);
 	if (do_keep && (pack_lockfiles || fsck_objects)) {
+		struct strbuf out = STRBUF_INIT;
 		int is_well_formed;
 		char *pack_lockfile = index_pack_lockfile(cmd.out, &is_well_formed);
 
@@ -1045,7 +1225,11 @@ static int get_pack(struct fetch_pack_args *args,
 			die(_("fetch-pack: invalid index-pack output"));
 		if (pack_lockfile)
 			string_list_append_nodup(pack_lockfiles, pack_lockfile);
-		parse_gitmodules_oids(cmd.out, gitmodules_oids);
+		if (strbuf_read(&out, cmd.out, 0) < 0)
+			die_errno(_("fetch-pack: unable to read index-pack output"));
+		parse_gitmodules_oids(out.buf, out.buf + out.len,
+				      gitmodules_oids);
+		strbuf_release(&out);
 		close(cmd.out);
 	}
 
@@ -1662,9 +1846,8 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	int seen_ack = 0;
 	struct object_id common_oid;
 	int received_ready = 0;
-	struct string_list packfile_uris = STRING_LIST_INIT_DUP;
-	int i;
-	struct strvec index_pack_args = STRVEC_INIT;
+	struct packfile_uri_downloads uri_downloads =
+		PACKFILE_URI_DOWNLOADS_INIT;
 
 	negotiator = &negotiator_alloc;
 	if (args->refetch)
@@ -1769,7 +1952,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			if (git_env_bool("GIT_TRACE_REDACT", 1))
 				reader.options |= PACKET_READ_REDACT_URI_PATH;
 			if (process_section_header(&reader, "packfile-uris", 1))
-				receive_packfile_uris(&reader, &packfile_uris);
+				receive_packfile_uris(&reader, &uri_downloads.uris);
 			/* We don't expect more URIs. Reset to avoid expensive URI check. */
 			reader.options &= ~PACKET_READ_REDACT_URI_PATH;
 
@@ -1784,7 +1967,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			fd[1] = -1;
 
 			if (get_pack(args, fd, pack_lockfiles,
-				     packfile_uris.nr ? &index_pack_args : NULL,
+				     uri_downloads.uris.nr ? &uri_downloads : NULL,
 				     sought, nr_sought, &fsck_options.gitmodules_found))
 				die(_("git fetch-pack: fetch failed."));
 			do_check_stateless_delimiter(args->stateless_rpc, &reader);
@@ -1796,58 +1979,9 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 		}
 	}
 
-	for (i = 0; i < packfile_uris.nr; i++) {
-		int j;
-		struct child_process cmd = CHILD_PROCESS_INIT;
-		char packname[GIT_MAX_HEXSZ + 1];
-		const char *uri = packfile_uris.items[i].string +
-			the_hash_algo->hexsz + 1;
-
-		strvec_push(&cmd.args, "http-fetch");
-		strvec_pushf(&cmd.args, "--packfile=%.*s",
-			     (int) the_hash_algo->hexsz,
-			     packfile_uris.items[i].string);
-		for (j = 0; j < index_pack_args.nr; j++)
-			strvec_pushf(&cmd.args, "--index-pack-arg=%s",
-				     index_pack_args.v[j]);
-		strvec_push(&cmd.args, uri);
-		cmd.git_cmd = 1;
-		cmd.no_stdin = 1;
-		cmd.out = -1;
-		if (start_command(&cmd))
-			die("fetch-pack: unable to spawn http-fetch");
-
-		if (read_in_full(cmd.out, packname, 5) < 0 ||
-		    memcmp(packname, "keep\t", 5))
-			die("fetch-pack: expected keep then TAB at start of http-fetch output");
-
-		if (read_in_full(cmd.out, packname,
-				 the_hash_algo->hexsz + 1) < 0 ||
-		    packname[the_hash_algo->hexsz] != '\n')
-			die("fetch-pack: expected hash then LF at end of http-fetch output");
-
-		packname[the_hash_algo->hexsz] = '\0';
-
-		parse_gitmodules_oids(cmd.out, &fsck_options.gitmodules_found);
-
-		close(cmd.out);
-
-		if (finish_command(&cmd))
-			die("fetch-pack: unable to finish http-fetch");
-
-		if (memcmp(packfile_uris.items[i].string, packname,
-			   the_hash_algo->hexsz))
-			die("fetch-pack: pack downloaded from %s does not match expected hash %.*s",
-			    uri, (int) the_hash_algo->hexsz,
-			    packfile_uris.items[i].string);
-
-		string_list_append_nodup(pack_lockfiles,
-					 xstrfmt("%s/pack/pack-%s.keep",
-						 get_object_directory(),
-						 packname));
-	}
-	string_list_clear(&packfile_uris, 0);
-	strvec_clear(&index_pack_args);
+	finish_packfile_uri_downloads(&uri_downloads, pack_lockfiles,
+				      &fsck_options.gitmodules_found);
+	clear_packfile_uri_downloads(&uri_downloads);
 
 	if (fsck_finish(&fsck_options))
 		die("fsck failed");
@@ -77,6 +77,11 @@ static void prepare_msg_ids(void)
 	}
 }
 
+void fsck_prepare_threads(void)
+{
+	prepare_msg_ids();
+}
+
 static int parse_msg_id(const char *text)
 {
 	int i;
@@ -205,7 +210,7 @@ void fsck_set_msg_types(struct fsck_options *options, const char *values)
 		if (!strcmp(buf, "skiplist")) {
 			if (equal == len)
 				die("skiplist requires a path");
-			oidset_parse_file(&options->skiplist, buf + equal + 1);
+			oidset_sorted_parse_file(&options->skiplist, buf + equal + 1);
 			buf += len + 1;
 			continue;
 		}
@@ -222,7 +227,7 @@ void fsck_set_msg_types(struct fsck_options *options, const char *values)
 static int object_on_skiplist(struct fsck_options *opts,
 			      const struct object_id *oid)
 {
-	return opts && oid && oidset_contains(&opts->skiplist, oid);
+	return opts && oid && oidset_sorted_contains(&opts->skiplist, oid);
 }
 
 __attribute__((format (printf, 5, 6)))
@@ -4,6 +4,9 @@
  */
 #include "git-compat-util.h"
 #include "git-zlib.h"
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 static const char *zerr_to_string(int status)
 {
@@ -147,6 +150,32 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+#ifdef USE_LIBDEFLATE
+unsigned long git_inflate_oneshot(unsigned char *out, unsigned long out_size,
+				  const unsigned char *in, unsigned long in_size)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result res;
+	size_t in_used = 0, out_used = 0;
+
+	/*
+	 * A decompressor is only a few kilobytes without any further
+	 * allocations, so allocating one per call keeps this safe for
+	 * callers that inflate from several threads at once.
+	 */
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		return 0;
+	res = libdeflate_zlib_decompress_ex(d, in, in_size, out, out_size,
+					    &in_used, &out_used);
+	libdeflate_free_decompressor(d);
+
+	if (res != LIBDEFLATE_SUCCESS || out_used != out_size)
+		return 0;
+	return in_used;
+}
+#endif
+
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
 #define deflateBound(c,s)  ((s) + (((s) + 7) >> 3) + (((s) + 63) >> 6) + 11)
 #endif
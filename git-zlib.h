@@ -25,4 +25,18 @@ int git_deflate_end_gently(git_zstream *);
 int git_deflate(git_zstream *, int flush);
 unsigned long git_deflate_bound(git_zstream *, unsigned long);
 
+#ifdef USE_LIBDEFLATE
+/*
+ * Inflate a complete zlib stream of which we know the inflated size
+ * in one go with libdeflate, which is faster than zlib at that. The
+ * input may extend past the end of the stream. Returns the number of
+ * bytes of input consumed, or 0 if "in" does not hold a complete and
+ * valid stream that inflates to exactly "out_size" bytes, in which
+ * case the caller should fall back to git_inflate() (e.g. to report
+ * the error).
+ */
+unsigned long git_inflate_oneshot(unsigned char *out, unsigned long out_size,
+				  const unsigned char *in, unsigned long in_size);
+#endif
+
 #endif /* GIT_ZLIB_H */
@@ -0,0 +1,655 @@
+#include "git-compat-util.h"
+#include "csum-file.h"
+#include "environment.h"
+#include "ewah/ewok.h"
+#include "gettext.h"
+#include "grep.h"
+#include "grep-index.h"
+#include "hash-lookup.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "oid-array.h"
+#include "progress.h"
+#include "repository.h"
+#include "trace2.h"
+#include "varint.h"
+#include "write-or-die.h"
+#include "xdiff-interface.h"
+
+#define GREP_INDEX_SIGNATURE 0x47524958 /* "GRIX" */
+#define GREP_INDEX_VERSION 1
+#define GREP_INDEX_HEADER_SIZE 20
+#define GREP_INDEX_FANOUT_SIZE (256 * 4)
+#define GREP_INDEX_TRIGRAM_SIZE 12
+
+/*
+ * The file consists of
+ *
+ *  - the header: signature, version, hash id, number of blobs and number
+ *    of trigrams, each a 32-bit integer in network byte order,
+ *  - the fanout table of the blobs, as in the pack index,
+ *  - the sorted object IDs of the blobs,
+ *  - the sorted trigrams, each a 32-bit integer followed by the 64-bit
+ *    offset of its postings,
+ *  - the postings: for each trigram the increasing positions of the blobs
+ *    that contain it, each stored as a varint of its distance to the
+ *    position after the previous one,
+ *  - the checksum of all of the above.
+ */
+struct grep_index {
+	const unsigned char *data;
+	size_t data_len;
+	size_t rawsz;
+	uint32_t nr_blobs;
+	uint32_t nr_trigrams;
+	const unsigned char *fanout;
+	const unsigned char *oids;
+	const unsigned char *trigrams;
+	const unsigned char *postings;
+	size_t postings_len;
+
+	/* The blobs that may match, by position. */
+	struct bitmap *candidates;
+};
+
+struct blob_positions {
+	uint32_t *pos;
+	size_t nr, alloc;
+};
+
+static char *grep_index_path(struct repository *r)
+{
+	return xstrfmt("%s/info/grep-index", r->objects->odb->path);
+}
+
+static int open_grep_index(struct repository *r, struct grep_index *gi)
+{
+	char *path = grep_index_path(r);
+	const unsigned char *data = NULL;
+	size_t len = 0, off;
+	struct stat st;
+	int fd, ret = -1;
+
+	fd = git_open(path);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), path);
+		goto out;
+	}
+
+	len = xsize_t(st.st_size);
+	gi->rawsz = r->hash_algo->rawsz;
+	if (len < GREP_INDEX_HEADER_SIZE + GREP_INDEX_FANOUT_SIZE + gi->rawsz) {
+		error(_("grep index %s is too small"), path);
+		goto out;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (get_be32(data) != GREP_INDEX_SIGNATURE) {
+		error(_("grep index %s has unknown signature"), path);
+		goto out;
+	}
+	if (get_be32(data + 4) != GREP_INDEX_VERSION) {
+		error(_("grep index %s has unsupported version %"PRIu32),
+		      path, get_be32(data + 4));
+		goto out;
+	}
+	if (get_be32(data + 8) != hash_algo_by_ptr(r->hash_algo)) {
+		error(_("grep index %s has unsupported hash id %"PRIu32),
+		      path, get_be32(data + 8));
+		goto out;
+	}
+	gi->nr_blobs = get_be32(data + 12);
+	gi->nr_trigrams = get_be32(data + 16);
+
+	off = GREP_INDEX_HEADER_SIZE;
+	gi->fanout = data + off;
+	off = st_add(off, GREP_INDEX_FANOUT_SIZE);
+	gi->oids = data + off;
+	off = st_add(off, st_mult(gi->nr_blobs, gi->rawsz));
+	if (off > len - gi->rawsz)
+		goto corrupt;
+	gi->trigrams = data + off;
+	off = st_add(off, st_mult(gi->nr_trigrams, GREP_INDEX_TRIGRAM_SIZE));
+	if (off > len - gi->rawsz)
+		goto corrupt;
+	gi->postings = data + off;
+	gi->postings_len = len - gi->rawsz - off;
+	if (get_be32(gi->fanout + 255 * 4) != gi->nr_blobs)
+		goto corrupt;
+
+	gi->data = data;
+	gi->data_len = len;
+	ret = 0;
+	goto out;
+
+corrupt:
+	error(_("grep index %s is corrupt"), path);
+out:
+	if (ret && data)
+		munmap((void *)data, len);
+	if (fd >= 0)
+		close(fd);
+	free(path);
+	return ret;
+}
+
+static void close_grep_index(struct grep_index *gi)
+{
+	if (gi->data)
+		munmap((void *)gi->data, gi->data_len);
+	gi->data = NULL;
+}
+
+static uint32_t nth_trigram(struct grep_index *gi, uint32_t n)
+{
+	return get_be32(gi->trigrams + st_mult(n, GREP_INDEX_TRIGRAM_SIZE));
+}
+
+static int find_trigram(struct grep_index *gi, uint32_t t, uint32_t *n)
+{
+	uint32_t lo = 0, hi = gi->nr_trigrams;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t cur = nth_trigram(gi, mi);
+
+		if (cur == t) {
+			*n = mi;
+			return 1;
+		}
+		if (cur < t)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+/*
+ * Append the positions of the blobs that contain the "n"th trigram to
+ * "list", mapped through "map" if it is not NULL, where a mapped
+ * position of -1 means the blob is to be left out.
+ */
+static int read_postings(struct grep_index *gi, uint32_t n,
+			 const int64_t *map, struct blob_positions *list)
+{
+	const unsigned char *entry = gi->trigrams +
+		st_mult(n, GREP_INDEX_TRIGRAM_SIZE);
+	uint64_t start = get_be64(entry + 4);
+	uint64_t end = gi->postings_len;
+	const unsigned char *p;
+	uintmax_t next = 0;
+
+	if (n + 1 < gi->nr_trigrams)
+		end = get_be64(entry + GREP_INDEX_TRIGRAM_SIZE + 4);
+	if (start > end || end > gi->postings_len)
+		return error(_("grep index is corrupt"));
+
+	for (p = gi->postings + start; p < gi->postings + end; ) {
+		uintmax_t pos = next + decode_varint(&p);
+
+		if (pos >= gi->nr_blobs)
+			return error(_("grep index is corrupt"));
+		next = pos + 1;
+		if (map && map[pos] < 0)
+			continue;
+		ALLOC_GROW(list->pos, list->nr + 1, list->alloc);
+		list->pos[list->nr++] = map ? map[pos] : pos;
+	}
+	return 0;
+}
+
+static int fold_byte(unsigned char c)
+{
+	return tolower(c);
+}
+
+static int cmp_uint32(const void *a_, const void *b_)
+{
+	uint32_t a = *(const uint32_t *)a_;
+	uint32_t b = *(const uint32_t *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Collect the trigrams that every match of the fixed string "s" contains.
+ * With "ignore_case", the regex engines may also let "k" and "s" match
+ * the Kelvin sign and the long s, and non-ASCII letters match other
+ * bytes, so leave out the trigrams with those.
+ */
+static void pattern_trigrams(const char *s, size_t len, int ignore_case,
+			     struct blob_positions *out)
+{
+	size_t i, j;
+
+	out->nr = 0;
+	for (i = 0; i + 3 <= len; i++) {
+		uint32_t t = 0;
+
+		for (j = i; j < i + 3; j++) {
+			unsigned char c = fold_byte(s[j]);
+
+			if (ignore_case && (c == 'k' || c == 's' || c >= 0x80))
+				break;
+			t = (t << 8) | c;
+		}
+		if (j < i + 3)
+			continue;
+		ALLOC_GROW(out->pos, out->nr + 1, out->alloc);
+		out->pos[out->nr++] = t;
+	}
+	QSORT(out->pos, out->nr, cmp_uint32);
+}
+
+static void intersect(struct blob_positions *a, const struct blob_positions *b)
+{
+	size_t i = 0, j = 0, nr = 0;
+
+	while (i < a->nr && j < b->nr) {
+		if (a->pos[i] < b->pos[j])
+			i++;
+		else if (a->pos[i] > b->pos[j])
+			j++;
+		else {
+			a->pos[nr++] = a->pos[i];
+			i++;
+			j++;
+		}
+	}
+	a->nr = nr;
+}
+
+/*
+ * Mark the blobs that contain all trigrams of "s" as candidates. Returns
+ * 1 if "s" has no trigram to look up, and -1 on error.
+ */
+static int add_candidates(struct grep_index *gi, const char *s, size_t len,
+			  int ignore_case)
+{
+	struct blob_positions trigrams = { 0 }, found = { 0 }, cur = { 0 };
+	size_t i;
+	int ret = 0, first = 1;
+
+	pattern_trigrams(s, len, ignore_case, &trigrams);
+	if (!trigrams.nr) {
+		ret = 1;
+		goto out;
+	}
+
+	for (i = 0; i < trigrams.nr; i++) {
+		uint32_t n;
+
+		if (i && trigrams.pos[i] == trigrams.pos[i - 1])
+			continue;
+		if (!find_trigram(gi, trigrams.pos[i], &n)) {
+			found.nr = 0;
+			break;
+		}
+		cur.nr = 0;
+		if (read_postings(gi, n, NULL, first ? &found : &cur)) {
+			ret = -1;
+			goto out;
+		}
+		if (!first)
+			intersect(&found, &cur);
+		first = 0;
+		if (!found.nr)
+			break;
+	}
+
+	for (i = 0; i < found.nr; i++)
+		bitmap_set(gi->candidates, found.pos[i]);
+
+out:
+	free(trigrams.pos);
+	free(found.pos);
+	free(cur.pos);
+	return ret;
+}
+
+static int is_fixed_pattern(struct grep_opt *opt, struct grep_pat *p)
+{
+	size_t i;
+
+	if (p->token != GREP_PATTERN)
+		return 0;
+	if (opt->pattern_type_option == GREP_PATTERN_TYPE_FIXED)
+		return 1;
+	for (i = 0; i < p->patternlen; i++)
+		if (is_regex_special(p->pattern[i]))
+			return 0;
+	return 1;
+}
+
+struct grep_index *load_grep_index(struct repository *r, struct grep_opt *opt)
+{
+	struct grep_index *gi;
+	struct grep_pat *p;
+
+	/* Skipping blobs must not change what is shown for them. */
+	if (opt->invert || opt->unmatch_name_only || opt->allow_textconv ||
+	    !opt->pattern_list)
+		return NULL;
+	for (p = opt->pattern_list; p; p = p->next)
+		if (!is_fixed_pattern(opt, p))
+			return NULL;
+
+	CALLOC_ARRAY(gi, 1);
+	if (open_grep_index(r, gi)) {
+		free(gi);
+		return NULL;
+	}
+
+	gi->candidates = bitmap_word_alloc(DIV_ROUND_UP(gi->nr_blobs,
+							BITS_IN_EWORD));
+	for (p = opt->pattern_list; p; p = p->next) {
+		if (add_candidates(gi, p->pattern, p->patternlen,
+				   opt->ignore_case)) {
+			free_grep_index(gi);
+			return NULL;
+		}
+	}
+
+	trace2_data_intmax("grep", r, "index/blobs", gi->nr_blobs);
+	trace2_data_intmax("grep", r, "index/candidates",
+			   bitmap_popcount(gi->candidates));
+	return gi;
+}
+
+int grep_index_may_match(struct grep_index *gi, const struct object_id *oid)
+{
+	uint32_t pos;
+
+	if (!bsearch_hash(oid->hash, (const uint32_t *)gi->fanout, gi->oids,
+			  gi->rawsz, &pos))
+		return 1;
+	return bitmap_get(gi->candidates, pos);
+}
+
+void free_grep_index(struct grep_index *gi)
+{
+	if (!gi)
+		return;
+	close_grep_index(gi);
+	bitmap_free(gi->candidates);
+	free(gi);
+}
+
+struct grep_index_writer {
+	struct repository *r;
+	struct grep_index old;
+	/* The blobs of "old" that are still there. */
+	struct bitmap *old_present;
+	struct oid_array objects;
+
+	/* The new blobs and their trigrams, as "trigram << 32 | blob". */
+	struct oid_array blobs;
+	uint64_t *pairs;
+	size_t pairs_nr, pairs_alloc;
+
+	/* Trigrams seen in the current blob. */
+	unsigned char *seen;
+	struct blob_positions blob_trigrams;
+	struct progress *progress;
+	size_t nr_done;
+};
+
+static int add_object(struct grep_index_writer *w, const struct object_id *oid)
+{
+	uint32_t pos;
+
+	if (w->old.data &&
+	    bsearch_hash(oid->hash, (const uint32_t *)w->old.fanout,
+			 w->old.oids, w->old.rawsz, &pos))
+		bitmap_set(w->old_present, pos);
+	else
+		oid_array_append(&w->objects, oid);
+	return 0;
+}
+
+static int add_loose_object(const struct object_id *oid,
+			    const char *path UNUSED, void *data)
+{
+	return add_object(data, oid);
+}
+
+static int add_packed_object(const struct object_id *oid,
+			     struct packed_git *pack UNUSED,
+			     uint32_t pos UNUSED, void *data)
+{
+	return add_object(data, oid);
+}
+
+static void add_trigrams(struct grep_index_writer *w,
+			 const unsigned char *buf, unsigned long size,
+			 uint64_t blob)
+{
+	unsigned long i;
+	uint32_t t = 0;
+	int len = 0;
+
+	w->blob_trigrams.nr = 0;
+	for (i = 0; i < size; i++) {
+		/* No pattern spans lines. */
+		if (buf[i] == '\n') {
+			len = 0;
+			continue;
+		}
+		t = ((t << 8) | fold_byte(buf[i])) & 0xffffff;
+		if (++len < 3 || (w->seen[t >> 3] & (1 << (t & 7))))
+			continue;
+		w->seen[t >> 3] |= 1 << (t & 7);
+		ALLOC_GROW(w->blob_trigrams.pos, w->blob_trigrams.nr + 1,
+			   w->blob_trigrams.alloc);
+		w->blob_trigrams.pos[w->blob_trigrams.nr++] = t;
+	}
+
+	ALLOC_GROW(w->pairs, st_add(w->pairs_nr, w->blob_trigrams.nr),
+		   w->pairs_alloc);
+	for (i = 0; i < w->blob_trigrams.nr; i++) {
+		t = w->blob_trigrams.pos[i];
+		w->seen[t >> 3] &= ~(1 << (t & 7));
+		w->pairs[w->pairs_nr++] = ((uint64_t)t << 32) | blob;
+	}
+}
+
+static int index_blob(const struct object_id *oid, void *data)
+{
+	struct grep_index_writer *w = data;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	display_progress(w->progress, ++w->nr_done);
+	type = oid_object_info(w->r, oid, &size);
+	if (type != OBJ_BLOB || size > big_file_threshold)
+		return 0;
+	buf = repo_read_object_file(w->r, oid, &type, &size);
+	if (!buf)
+		return error(_("unable to read %s"), oid_to_hex(oid));
+	if (!buffer_is_binary(buf, size)) {
+		add_trigrams(w, buf, size, w->blobs.nr);
+		oid_array_append(&w->blobs, oid);
+	}
+	free(buf);
+	return 0;
+}
+
+static int cmp_uint64(const void *a_, const void *b_)
+{
+	uint64_t a = *(const uint64_t *)a_;
+	uint64_t b = *(const uint64_t *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static void write_postings(struct strbuf *out, const struct blob_positions *list)
+{
+	unsigned char varint[16];
+	uint32_t next = 0;
+	size_t i;
+
+	for (i = 0; i < list->nr; i++) {
+		strbuf_add(out, varint,
+			   encode_varint(list->pos[i] - next, varint));
+		next = list->pos[i] + 1;
+	}
+}
+
+int write_grep_index(struct repository *r, unsigned flags)
+{
+	struct grep_index_writer w = { .r = r };
+	const struct grep_index *old = &w.old;
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	struct strbuf postings = STRBUF_INIT;
+	struct blob_positions list = { 0 };
+	struct oid_array oids = OID_ARRAY_INIT;
+	int64_t *old_map = NULL, *new_map = NULL;
+	uint32_t fanout[256] = { 0 }, nr_trigrams = 0;
+	uint32_t *trigrams = NULL;
+	uint64_t *offsets = NULL;
+	size_t i, j, trigrams_alloc = 0, offsets_alloc = 0;
+	char *path = grep_index_path(r);
+	int ret = 0;
+
+	if (open_grep_index(r, &w.old))
+		memset(&w.old, 0, sizeof(w.old));
+	w.old_present = bitmap_new();
+
+	for_each_loose_object(add_loose_object, &w, FOR_EACH_OBJECT_LOCAL_ONLY);
+	for_each_packed_object(add_packed_object, &w, FOR_EACH_OBJECT_LOCAL_ONLY);
+
+	oid_array_sort(&w.objects);
+	w.seen = xcalloc(1, (1 << 24) / 8);
+	if (flags & GREP_INDEX_WRITE_PROGRESS)
+		w.progress = start_delayed_progress(_("Indexing blobs for grep"),
+						    w.objects.nr);
+	ret = oid_array_for_each_unique(&w.objects, index_blob, &w);
+	stop_progress(&w.progress);
+	if (ret)
+		goto out;
+
+	/* Merge the blobs that are still there with the new ones. */
+	ALLOC_ARRAY(old_map, old->nr_blobs);
+	ALLOC_ARRAY(new_map, w.blobs.nr);
+	for (i = j = 0; i < old->nr_blobs || j < w.blobs.nr; ) {
+		struct object_id oid;
+		int cmp;
+
+		if (i < old->nr_blobs && !bitmap_get(w.old_present, i)) {
+			old_map[i++] = -1;
+			continue;
+		}
+		if (i < old->nr_blobs)
+			oidread(&oid, old->oids + st_mult(i, old->rawsz));
+		if (i == old->nr_blobs)
+			cmp = 1;
+		else if (j == w.blobs.nr)
+			cmp = -1;
+		else
+			cmp = oidcmp(&oid, &w.blobs.oid[j]);
+
+		if (cmp < 0) {
+			old_map[i++] = oids.nr;
+		} else {
+			oidcpy(&oid, &w.blobs.oid[j]);
+			new_map[j++] = oids.nr;
+		}
+		oid_array_append(&oids, &oid);
+		fanout[oid.hash[0]]++;
+	}
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	/* Merge the postings of the trigrams. */
+	QSORT(w.pairs, w.pairs_nr, cmp_uint64);
+	for (i = j = 0; i < old->nr_trigrams || j < w.pairs_nr; ) {
+		uint32_t t;
+
+		if (j == w.pairs_nr ||
+		    (i < old->nr_trigrams &&
+		     nth_trigram(&w.old, i) <= w.pairs[j] >> 32))
+			t = nth_trigram(&w.old, i);
+		else
+			t = w.pairs[j] >> 32;
+
+		list.nr = 0;
+		if (i < old->nr_trigrams && nth_trigram(&w.old, i) == t &&
+		    read_postings(&w.old, i++, old_map, &list)) {
+			ret = -1;
+			goto out;
+		}
+		for (; j < w.pairs_nr && w.pairs[j] >> 32 == t; j++) {
+			ALLOC_GROW(list.pos, list.nr + 1, list.alloc);
+			list.pos[list.nr++] = new_map[(uint32_t)w.pairs[j]];
+		}
+		if (!list.nr)
+			continue;
+		QSORT(list.pos, list.nr, cmp_uint32);
+
+		ALLOC_GROW(trigrams, nr_trigrams + 1, trigrams_alloc);
+		ALLOC_GROW(offsets, nr_trigrams + 1, offsets_alloc);
+		trigrams[nr_trigrams] = t;
+		offsets[nr_trigrams++] = postings.len;
+		write_postings(&postings, &list);
+	}
+
+	if (safe_create_leading_directories(path)) {
+		ret = error_errno(_("unable to create leading directories of %s"),
+				  path);
+		goto out;
+	}
+	hold_lock_file_for_update(&lk, path, LOCK_DIE_ON_ERROR);
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+
+	hashwrite_be32(f, GREP_INDEX_SIGNATURE);
+	hashwrite_be32(f, GREP_INDEX_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(r->hash_algo));
+	hashwrite_be32(f, oids.nr);
+	hashwrite_be32(f, nr_trigrams);
+	for (i = 0; i < 256; i++)
+		hashwrite_be32(f, fanout[i]);
+	for (i = 0; i < oids.nr; i++)
+		hashwrite(f, oids.oid[i].hash, r->hash_algo->rawsz);
+	for (i = 0; i < nr_trigrams; i++) {
+		hashwrite_be32(f, trigrams[i]);
+		hashwrite_be64(f, offsets[i]);
+	}
+	for (i = 0; i < postings.len; ) {
+		unsigned int chunk = (unsigned int)
+			(postings.len - i < (1 << 30) ? postings.len - i : (1 << 30));
+
+		hashwrite(f, postings.buf + i, chunk);
+		i += chunk;
+	}
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+
+	close_grep_index(&w.old);
+	if (commit_lock_file(&lk))
+		ret = error_errno(_("unable to write %s"), path);
+
+out:
+	close_grep_index(&w.old);
+	bitmap_free(w.old_present);
+	oid_array_clear(&w.objects);
+	oid_array_clear(&w.blobs);
+	oid_array_clear(&oids);
+	free(w.pairs);
+	free(w.seen);
+	free(w.blob_trigrams.pos);
+	free(list.pos);
+	free(old_map);
+	free(new_map);
+	free(trigrams);
+	free(offsets);
+	strbuf_release(&postings);
+	free(path);
+	return ret;
+}
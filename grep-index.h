@@ -0,0 +1,43 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+struct grep_opt;
+struct object_id;
+struct repository;
+
+/*
+ * The grep index in "$GIT_DIR/objects/info/grep-index" records which
+ * trigrams, i.e. sequences of three bytes, occur in which blobs, folding
+ * ASCII letters to lower case. A blob that lacks one of the trigrams of a
+ * fixed string cannot contain it, so "git grep" need not read it.
+ *
+ * The index is keyed by object ID and never goes stale; it merely lacks
+ * the blobs added since it was written, which are grepped as usual.
+ */
+struct grep_index;
+
+/*
+ * Load the grep index of "r" and look up the blobs in it that may match
+ * the patterns of "opt". Returns NULL if there is no index, or if the
+ * patterns are not all fixed strings that it can narrow down.
+ */
+struct grep_index *load_grep_index(struct repository *r, struct grep_opt *opt);
+
+/*
+ * Return 0 if the blob "oid" is in the index and cannot match, 1
+ * otherwise. This may be called from several threads at once.
+ */
+int grep_index_may_match(struct grep_index *gi, const struct object_id *oid);
+
+void free_grep_index(struct grep_index *gi);
+
+#define GREP_INDEX_WRITE_PROGRESS (1 << 0)
+
+/*
+ * Add the local blobs that are not in the grep index of "r" yet to it,
+ * and drop the ones that are gone. Binary blobs and blobs larger than
+ * "core.bigFileThreshold" are left out.
+ */
+int write_grep_index(struct repository *r, unsigned flags);
+
+#endif
@@ -488,6 +488,163 @@ static void compile_fixed_regexp(struct grep_pat *p, struct grep_opt *opt)
 }
 #endif /* !USE_LIBPCRE2 */
 
+static void set_literal(struct grep_pat *p, const char *s, size_t len)
+{
+	free(p->literal);
+	p->literal = xmemdupz(s, len);
+	p->literal_len = len;
+}
+
+static int skip_bracket_expression(const char **sp, const char *end)
+{
+	const char *s = *sp;
+
+	if (s < end && *s == '^')
+		s++;
+	if (s < end && *s == ']')
+		s++;
+	while (s < end && *s != ']') {
+		if (*s == '[' && s + 1 < end && strchr(":.=", s[1])) {
+			char delim = s[1];
+
+			for (s += 2; s + 1 < end; s++)
+				if (s[0] == delim && s[1] == ']')
+					break;
+			if (s + 1 >= end)
+				return -1;
+			s++;
+		}
+		s++;
+	}
+	if (s == end)
+		return -1;
+	*sp = s + 1;
+	return 0;
+}
+
+/*
+ * Find the longest run of ordinary characters in the basic or extended
+ * regular expression of "p" that every match contains: one outside of
+ * groups and bracket expressions that no quantifier applies to. Anything
+ * we do not understand ends the current run, or makes us give up if it
+ * might make the runs optional, like a top-level alternation.
+ */
+static void compile_regexp_literal(struct grep_pat *p, int extended)
+{
+	const char *s = p->pattern, *end = p->pattern + p->patternlen;
+	struct strbuf run = STRBUF_INIT, best = STRBUF_INIT;
+	int depth = 0, last_is_literal = 0;
+
+	while (s < end) {
+		int c = (unsigned char)*s++;
+		int escaped = 0;
+
+		if (c == '\\') {
+			if (s == end)
+				goto out;
+			c = (unsigned char)*s++;
+			escaped = 1;
+		}
+
+		/*
+		 * Turn the operators into their ERE spelling; in a BRE,
+		 * "\(", "\{", "\|", "\+" and "\?" are operators and the
+		 * plain characters are not.
+		 */
+		if (c < 0x80 && strchr("(){}|+?", c)) {
+			if (escaped == extended) {
+				escaped = 1;
+			} else {
+				escaped = 0;
+				c |= 0x100;
+			}
+		}
+
+		if (escaped) {
+			if (c >= 0x80 || !strchr(".[]*^$\\/-(){}|+?", c)) {
+				/* \w, \<, back-references and the like */
+				c = 0x100 | '.';
+			}
+		} else if (c == '*' || c == '.' || c == '[' ||
+			   c == '^' || c == '$') {
+			c |= 0x100;
+		}
+
+		switch (c) {
+		case 0x100 | '|':
+			if (!depth)
+				goto give_up;
+			break;
+		case 0x100 | '(':
+			depth++;
+			break;
+		case 0x100 | ')':
+			if (!depth)
+				goto give_up;
+			depth--;
+			break;
+		case 0x100 | '[':
+			if (skip_bracket_expression(&s, end))
+				goto give_up;
+			break;
+		case 0x100 | '{':
+			if (s == end || !isdigit(*s))
+				goto give_up;
+			while (s < end && *s != '}')
+				s++;
+			if (s == end)
+				goto give_up;
+			s++;
+			/* fallthrough */
+		case 0x100 | '*':
+		case 0x100 | '+':
+		case 0x100 | '?':
+			/* The quantified character is not required. */
+			if (last_is_literal && run.len) {
+				size_t len = run.len - 1;
+
+				while (len && (run.buf[len] & 0xc0) == 0x80)
+					len--;
+				strbuf_setlen(&run, len);
+			}
+			break;
+		case 0x100 | '}':
+			goto give_up;
+		default:
+			if (c < 0x100 && !depth) {
+				strbuf_addch(&run, c);
+				last_is_literal = 1;
+				continue;
+			}
+			break;
+		}
+
+		if (run.len > best.len)
+			strbuf_swap(&run, &best);
+		strbuf_reset(&run);
+		last_is_literal = 0;
+	}
+
+out:
+	if (run.len > best.len)
+		strbuf_swap(&run, &best);
+	if (best.len)
+		set_literal(p, best.buf, best.len);
+give_up:
+	strbuf_release(&run);
+	strbuf_release(&best);
+}
+
+static int is_ascii(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (s[i] & 0x80)
+			return 0;
+	return 1;
+}
+
 static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 {
 	int err;
@@ -551,6 +708,15 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 #else /* !USE_LIBPCRE2 */
 		compile_fixed_regexp(p, opt);
 #endif /* !USE_LIBPCRE2 */
+		/*
+		 * Without "-i", look for the string ourselves. In the middle
+		 * of a multi-byte character, the regex would not match it.
+		 */
+		if (!p->ignore_case && p->patternlen &&
+		    (p->fixed || is_fixed(p->pattern, p->patternlen))) {
+			set_literal(p, p->pattern, p->patternlen);
+			p->literal_only = is_ascii(p->pattern, p->patternlen);
+		}
 		return;
 	}
 
@@ -569,6 +735,8 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 		regerror(err, &p->regexp, errbuf, 1024);
 		compile_regexp_failed(p, errbuf);
 	}
+	if (!p->ignore_case)
+		compile_regexp_literal(p, !!(regflags & REG_EXTENDED));
 }
 
 static struct grep_expr *grep_not_expr(struct grep_expr *expr)
@@ -845,6 +1013,7 @@ static void free_grep_pat(struct grep_pat *pattern)
 			else
 				regfree(&p->regexp);
 			free(p->pattern);
+			free(p->literal);
 			break;
 		default:
 			break;
@@ -909,6 +1078,19 @@ static int patmatch(struct grep_pat *p,
 {
 	int hit;
 
+	if (p->literal) {
+		const char *found = memmem(line, eol - line,
+					   p->literal, p->literal_len);
+
+		if (!found)
+			return 0;
+		if (p->literal_only) {
+			match->rm_so = found - line;
+			match->rm_eo = match->rm_so + p->literal_len;
+			return 1;
+		}
+	}
+
 	if (p->pcre2_pattern)
 		hit = !pcre2match(p, line, eol, match, eflags);
 	else
@@ -1458,12 +1640,23 @@ static int look_ahead(struct grep_opt *opt,
 	regoff_t earliest = -1;
 
 	for (p = opt->pattern_list; p; p = p->next) {
+		const char *start = bol;
 		int hit;
 		regmatch_t m;
 
-		hit = patmatch(p, bol, bol + *left_p, &m, 0);
+		/* No match can start before the line with the literal. */
+		if (p->literal) {
+			start = memmem(bol, *left_p, p->literal, p->literal_len);
+			if (!start)
+				continue;
+			while (bol < start && start[-1] != '\n')
+				start--;
+		}
+
+		hit = patmatch(p, start, bol + *left_p, &m, 0);
 		if (!hit || m.rm_so < 0 || m.rm_eo < 0)
 			continue;
+		m.rm_so += start - bol;
 		if (earliest < 0 || m.rm_so < earliest)
 			earliest = m.rm_so;
 	}
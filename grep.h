@@ -82,6 +82,13 @@ struct grep_pat {
 	pcre2_general_context *pcre2_general_context;
 	const uint8_t *pcre2_tables;
 	uint32_t pcre2_jit_on;
+	/*
+	 * A string that every match contains, looked for before running
+	 * the regex. If "literal_only", the pattern matches nothing else.
+	 */
+	char *literal;
+	size_t literal_len;
+	unsigned literal_only:1;
 	unsigned fixed:1;
 	unsigned is_fixed:1;
 	unsigned ignore_case:1;
@@ -2,6 +2,10 @@
 #include "hash.h"
 #include "hex.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static int get_hash_hex_algop(const char *hex, unsigned char *hash,
 			      const struct git_hash_algo *algop)
 {
@@ -72,12 +76,40 @@ int parse_oid_hex(const char *hex, struct object_id *oid, const char **end)
 	return parse_oid_hex_algop(hex, oid, end, the_hash_algo);
 }
 
+#ifdef __SSE2__
+/*
+ * Convert 16 bytes into 32 hex digits at once. SSE2 is part of the
+ * x86-64 baseline, so there is no need to check the CPU at runtime.
+ */
+static void hex_encode_16(char *out, const unsigned char *in)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i letter = _mm_set1_epi8('a' - '0' - 10);
+	__m128i v = _mm_loadu_si128((const __m128i *)in);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+	__m128i lo = _mm_and_si128(v, mask);
+	__m128i a = _mm_unpacklo_epi8(hi, lo);
+	__m128i b = _mm_unpackhi_epi8(hi, lo);
+
+	/* digits above 9 need to skip the gap between '9' and 'a' */
+	a = _mm_add_epi8(_mm_add_epi8(a, zero),
+			 _mm_and_si128(_mm_cmpgt_epi8(a, nine), letter));
+	b = _mm_add_epi8(_mm_add_epi8(b, zero),
+			 _mm_and_si128(_mm_cmpgt_epi8(b, nine), letter));
+
+	_mm_storeu_si128((__m128i *)out, a);
+	_mm_storeu_si128((__m128i *)(out + 16), b);
+}
+#endif
+
 char *hash_to_hex_algop_r(char *buffer, const unsigned char *hash,
 			  const struct git_hash_algo *algop)
 {
 	static const char hex[] = "0123456789abcdef";
 	char *buf = buffer;
-	int i;
+	int i = 0;
 
 	/*
 	 * Our struct object_id has been memset to 0, so default to printing
@@ -86,7 +118,14 @@ char *hash_to_hex_algop_r(char *buffer, const unsigned char *hash,
 	if (algop == &hash_algos[0])
 		algop = the_hash_algo;
 
-	for (i = 0; i < algop->rawsz; i++) {
+#ifdef __SSE2__
+	for (; i + 16 <= algop->rawsz; i += 16) {
+		hex_encode_16(buf, hash);
+		buf += 32;
+		hash += 16;
+	}
+#endif
+	for (; i < algop->rawsz; i++) {
 		unsigned int val = *hash++;
 		*buf++ = hex[val >> 4];
 		*buf++ = hex[val & 0xf];
@@ -196,6 +196,27 @@ static void send_local_file(struct strbuf *hdr, const char *the_type,
 	hdr_date(hdr, last_modified, sb.st_mtime);
 	end_headers(hdr);
 
+#ifdef HAVE_SENDFILE
+	/*
+	 * Let the kernel copy the file, which spares us passing packs and
+	 * their indexes through our buffer. The read loop below sends what
+	 * is left, if stdout does not support this.
+	 */
+	for (;;) {
+		ssize_t n = sendfile(1, fd, NULL, MAX_IO_SIZE);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno == EINVAL || errno == ENOSYS)
+				break;
+			check_pipe(errno);
+			die_errno("Cannot send '%s'", p);
+		}
+		if (!n)
+			break;
+	}
+#endif
+
 	for (;;) {
 		ssize_t n = xread(fd, buf, buf_alloc);
 		if (n < 0)
@@ -451,6 +472,30 @@ static void pipe_fixed_length(const char *prog_name, int out, size_t req_len)
 	unsigned char buf[8192];
 	size_t remaining_len = req_len;
 
+#ifdef HAVE_SPLICE
+	/*
+	 * The child reads from a pipe, so the kernel can move the request
+	 * over to it without copying it through our buffer. Fall back to
+	 * the loop below if our input does not support this.
+	 */
+	while (remaining_len > 0) {
+		ssize_t n = splice(0, NULL, out, NULL,
+				   remaining_len > MAX_IO_SIZE ?
+				   MAX_IO_SIZE : remaining_len,
+				   SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno == EINVAL)
+				break;
+			die_errno("unable to write to '%s'", prog_name);
+		}
+		if (!n)
+			break;
+		remaining_len -= n;
+	}
+#endif
+
 	while (remaining_len > 0) {
 		size_t chunk_length = remaining_len > sizeof(buf) ? sizeof(buf) : remaining_len;
 		ssize_t n = xread(0, buf, chunk_length);
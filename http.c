@@ -2017,6 +2017,7 @@ static void http_opt_request_remainder(CURL *curl, off_t pos)
 /* http_request() targets */
 #define HTTP_REQUEST_STRBUF	0
 #define HTTP_REQUEST_FILE	1
+#define HTTP_REQUEST_STREAM	2
 
 static int http_request(const char *url,
 			void *result, int target,
@@ -2027,6 +2028,7 @@ static int http_request(const char *url,
 	struct curl_slist *headers = http_copy_default_headers();
 	struct strbuf buf = STRBUF_INIT;
 	const char *accept_language;
+	off_t posn = 0;
 	int ret;
 
 	slot = get_active_slot();
@@ -2039,12 +2041,15 @@ static int http_request(const char *url,
 		curl_easy_setopt(slot->curl, CURLOPT_WRITEDATA, result);
 
 		if (target == HTTP_REQUEST_FILE) {
-			off_t posn = ftello(result);
+			posn = ftello(result);
 			curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION,
 					 fwrite);
 			if (posn > 0)
 				http_opt_request_remainder(slot->curl, posn);
-		} else
+		} else if (target == HTTP_REQUEST_STREAM)
+			curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION,
+					 fwrite);
+		else
 			curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION,
 					 fwrite_buffer);
 	}
@@ -2076,10 +2081,34 @@ static int http_request(const char *url,
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, headers);
 	curl_easy_setopt(slot->curl, CURLOPT_ENCODING, "");
-	curl_easy_setopt(slot->curl, CURLOPT_FAILONERROR, 0);
+	/*
+	 * What we write to a stream cannot be taken back, so do not let an
+	 * error page in.
+	 */
+	curl_easy_setopt(slot->curl, CURLOPT_FAILONERROR,
+			 target == HTTP_REQUEST_STREAM);
 
 	ret = run_one_slot(slot, &results);
 
+	/*
+	 * Do not leave an error page in the file for a later attempt to
+	 * resume after. A server that ignored our range sent all of the
+	 * file after the part that we had, so that we must start over.
+	 */
+	if (target == HTTP_REQUEST_FILE && result &&
+	    (results.http_code >= 300 ||
+	     (posn > 0 && results.http_code == 200))) {
+		if (results.http_code == 200) {
+			posn = 0;
+			ret = HTTP_ERROR;
+		}
+		if (fflush(result) || ftruncate(fileno(result), posn) < 0 ||
+		    fseeko(result, posn, SEEK_SET) < 0) {
+			error_errno("unable to truncate a file");
+			ret = HTTP_ERROR;
+		}
+	}
+
 	if (options && options->content_type) {
 		struct strbuf raw = STRBUF_INIT;
 		curlinfo_strbuf(slot->curl, CURLINFO_CONTENT_TYPE, &raw);
@@ -2189,6 +2218,9 @@ static int http_request_reauth(const char *url,
 			return HTTP_START_FAILED;
 		}
 		break;
+	case HTTP_REQUEST_STREAM:
+		/* Nothing was written, as the request failed on error. */
+		break;
 	default:
 		BUG("Unknown http_request target");
 	}
@@ -2236,6 +2268,12 @@ int http_get_file(const char *url, const char *filename,
 	return ret;
 }
 
+int http_get_stream(const char *url, FILE *out,
+		    struct http_get_options *options)
+{
+	return http_request_reauth(url, out, HTTP_REQUEST_STREAM, options);
+}
+
 int http_fetch_ref(const char *base, struct ref *ref)
 {
 	struct http_get_options options = {0};
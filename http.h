@@ -174,6 +174,13 @@ int http_get_strbuf(const char *url, struct strbuf *result, struct http_get_opti
 int http_get_file(const char *url, const char *filename,
 		  struct http_get_options *options);
 
+/*
+ * Downloads a URL and writes it to the given stream as it arrives. Unlike
+ * http_get_file(), an interrupted download cannot be resumed.
+ */
+int http_get_stream(const char *url, FILE *out,
+		    struct http_get_options *options);
+
 int http_fetch_ref(const char *base, struct ref *ref);
 
 /* Helpers for fetching packs */
@@ -19,6 +19,7 @@
 #include "strvec.h"
 #include "bloom.h"
 #include "tree-walk.h"
+#include "oidmap.h"
 
 static void range_set_grow(struct range_set *rs, size_t extra)
 {
@@ -1025,6 +1026,70 @@ static void dump_diff_hacky(struct rev_info *rev, struct line_log_data *range)
  * Unlike most other functions, this destructively operates on
  * 'range'.
  */
+/*
+ * The blob a commit is diffed against is, more often than not, the blob
+ * the next commit we look at on the same line of history has, so keep a
+ * copy of the parent blobs to spare reading them again.
+ */
+struct line_log_blob {
+	struct oidmap_entry entry;
+	char *data;
+	unsigned long size;
+};
+
+static void populate_target_blob(struct rev_info *rev,
+				 struct diff_filespec *spec)
+{
+	struct line_log_blob *blob = NULL;
+
+	if (!spec->data && rev->line_log_blobs)
+		blob = oidmap_remove(rev->line_log_blobs, &spec->oid);
+	if (blob) {
+		spec->data = blob->data;
+		spec->size = blob->size;
+		spec->should_free = 1;
+		free(blob);
+		return;
+	}
+	if (diff_populate_filespec(rev->diffopt.repo, spec, NULL))
+		die("Cannot read blob %s", oid_to_hex(&spec->oid));
+}
+
+static void populate_parent_blob(struct rev_info *rev,
+				 struct diff_filespec *spec)
+{
+	struct line_log_blob *blob;
+
+	if (diff_populate_filespec(rev->diffopt.repo, spec, NULL))
+		die("Cannot read blob %s", oid_to_hex(&spec->oid));
+
+	if (!rev->line_log_blobs) {
+		CALLOC_ARRAY(rev->line_log_blobs, 1);
+		oidmap_init(rev->line_log_blobs, 0);
+	}
+	if (oidmap_get(rev->line_log_blobs, &spec->oid))
+		return;
+	CALLOC_ARRAY(blob, 1);
+	oidcpy(&blob->entry.oid, &spec->oid);
+	blob->data = xmemdupz(spec->data, spec->size);
+	blob->size = spec->size;
+	oidmap_put(rev->line_log_blobs, blob);
+}
+
+static void free_line_log_blobs(struct oidmap *blobs)
+{
+	struct oidmap_iter iter;
+	struct line_log_blob *blob;
+
+	if (!blobs)
+		return;
+	oidmap_iter_init(blobs, &iter);
+	while ((blob = oidmap_iter_next(&iter)))
+		free(blob->data);
+	oidmap_free(blobs, 1);
+	free(blobs);
+}
+
 static int process_diff_filepair(struct rev_info *rev,
 				 struct diff_filepair *pair,
 				 struct line_log_data *range,
@@ -1049,12 +1114,19 @@ static int process_diff_filepair(struct rev_info *rev,
 		return 0;
 
 	assert(pair->two->oid_valid);
-	diff_populate_filespec(rev->diffopt.repo, pair->two, NULL);
+	if (pair->one->oid_valid && oideq(&pair->one->oid, &pair->two->oid)) {
+		/* Only the path or the mode changed, so did no line. */
+		free(rg->path);
+		rg->path = xstrdup(pair->one->path);
+		return 0;
+	}
+
+	populate_target_blob(rev, pair->two);
 	file_target.ptr = pair->two->data;
 	file_target.size = pair->two->size;
 
 	if (pair->one->oid_valid) {
-		diff_populate_filespec(rev->diffopt.repo, pair->one, NULL);
+		populate_parent_blob(rev, pair->one);
 		file_parent.ptr = pair->one->data;
 		file_parent.size = pair->one->size;
 	} else {
@@ -1336,4 +1408,6 @@ static void free_void_line_log_data(void *data)
 void line_log_free(struct rev_info *rev)
 {
 	clear_decoration(&rev->line_log_data, free_void_line_log_data);
+	free_line_log_blobs(rev->line_log_blobs);
+	rev->line_log_blobs = NULL;
 }
@@ -93,6 +93,44 @@ static void process_tree(struct traversal_context *ctx,
 			 struct strbuf *base,
 			 const char *name);
 
+static void process_tree_entry(struct traversal_context *ctx,
+			       struct tree *tree,
+			       struct strbuf *base,
+			       struct name_entry *entry)
+{
+	if (S_ISDIR(entry->mode)) {
+		struct tree *t = lookup_tree(ctx->revs->repo, &entry->oid);
+		if (!t) {
+			die(_("entry '%s' in tree %s has tree mode, "
+			      "but is not a tree"),
+			    entry->path, oid_to_hex(&tree->object.oid));
+		}
+		t->object.flags |= NOT_USER_GIVEN;
+		ctx->depth++;
+		process_tree(ctx, t, base, entry->path);
+		ctx->depth--;
+	}
+	else if (S_ISGITLINK(entry->mode))
+		; /* ignore gitlink */
+	else {
+		struct blob *b = lookup_blob(ctx->revs->repo, &entry->oid);
+		if (!b) {
+			die(_("entry '%s' in tree %s has blob mode, "
+			      "but is not a blob"),
+			    entry->path, oid_to_hex(&tree->object.oid));
+		}
+		b->object.flags |= NOT_USER_GIVEN;
+		process_blob(ctx, b, base, entry->path);
+	}
+}
+
+/*
+ * Without a pathspec, the entries of a tree are decoded this many at a
+ * time, and the slots of the object hash table where they will be looked
+ * up are prefetched before the first of them is processed.
+ */
+#define TREE_ENTRY_BATCH 16
+
 static void process_tree_contents(struct traversal_context *ctx,
 				  struct tree *tree,
 				  struct strbuf *base)
@@ -104,6 +142,24 @@ static void process_tree_contents(struct traversal_context *ctx,
 
 	init_tree_desc(&desc, tree->buffer, tree->size);
 
+	if (match == all_entries_interesting) {
+		struct name_entry batch[TREE_ENTRY_BATCH];
+		int nr, i;
+
+		do {
+			for (nr = 0; nr < TREE_ENTRY_BATCH; nr++) {
+				if (!tree_entry(&desc, &batch[nr]))
+					break;
+				if (!S_ISGITLINK(batch[nr].mode))
+					prefetch_object(ctx->revs->repo,
+							&batch[nr].oid);
+			}
+			for (i = 0; i < nr; i++)
+				process_tree_entry(ctx, tree, base, &batch[i]);
+		} while (nr == TREE_ENTRY_BATCH);
+		return;
+	}
+
 	while (tree_entry(&desc, &entry)) {
 		if (match != all_entries_interesting) {
 			match = tree_entry_interesting(ctx->revs->repo->index,
@@ -114,31 +170,7 @@ static void process_tree_contents(struct traversal_context *ctx,
 			if (match == entry_not_interesting)
 				continue;
 		}
-
-		if (S_ISDIR(entry.mode)) {
-			struct tree *t = lookup_tree(ctx->revs->repo, &entry.oid);
-			if (!t) {
-				die(_("entry '%s' in tree %s has tree mode, "
-				      "but is not a tree"),
-				    entry.path, oid_to_hex(&tree->object.oid));
-			}
-			t->object.flags |= NOT_USER_GIVEN;
-			ctx->depth++;
-			process_tree(ctx, t, base, entry.path);
-			ctx->depth--;
-		}
-		else if (S_ISGITLINK(entry.mode))
-			; /* ignore gitlink */
-		else {
-			struct blob *b = lookup_blob(ctx->revs->repo, &entry.oid);
-			if (!b) {
-				die(_("entry '%s' in tree %s has blob mode, "
-				      "but is not a blob"),
-				    entry.path, oid_to_hex(&tree->object.oid));
-			}
-			b->object.flags |= NOT_USER_GIVEN;
-			process_blob(ctx, b, base, entry.path);
-		}
+		process_tree_entry(ctx, tree, base, &entry);
 	}
 }
 
@@ -0,0 +1,354 @@
+#include "git-compat-util.h"
+#include "commit.h"
+#include "diff.h"
+#include "environment.h"
+#include "gettext.h"
+#include "log-read-ahead.h"
+#include "object-store-ll.h"
+#include "oid-array.h"
+#include "revision.h"
+#include "thread-utils.h"
+#include "tree.h"
+#include "tree-walk.h"
+
+/* Commits queued per thread. */
+#define READ_AHEAD_COMMITS_PER_THREAD 4
+/* Bytes of blobs kept for the queued commits, at most. */
+#define READ_AHEAD_MAX_BYTES (256 * 1024 * 1024)
+
+enum read_ahead_state {
+	READ_AHEAD_QUEUED,
+	READ_AHEAD_RUNNING,
+	READ_AHEAD_FINISHED,
+};
+
+struct read_ahead_job {
+	struct object_id tree, parent_tree;
+	unsigned has_tree : 1,
+		 has_parent_tree : 1,
+		 cancelled : 1;
+	enum read_ahead_state state;
+	struct oid_array objects;
+	unsigned long bytes;
+};
+
+struct log_read_ahead {
+	struct repository *r;
+	struct read_ahead_job *jobs;
+	size_t window;
+	/* jobs before "head" are done, jobs from "next" on are queued */
+	size_t head, next, tail;
+	unsigned long bytes;
+	int stop;
+
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t queued;
+	pthread_cond_t finished;
+};
+
+int log_read_ahead_possible(struct rev_info *revs)
+{
+	return HAVE_THREADS &&
+		revs->diff &&
+		(revs->diffopt.output_format &
+		 (DIFF_FORMAT_PATCH | DIFF_FORMAT_DIFFSTAT |
+		  DIFF_FORMAT_NUMSTAT | DIFF_FORMAT_SHORTSTAT |
+		  DIFF_FORMAT_DIRSTAT)) &&
+		!revs->prune_data.nr &&
+		!revs->diffopt.flags.follow_renames &&
+		!revs->graph &&
+		!revs->reflog_info &&
+		!revs->line_level_traverse &&
+		!revs->track_linear &&
+		!revs->early_output &&
+		!revs->remerge_diff;
+}
+
+static int read_ahead_one(struct log_read_ahead *ra,
+			  struct read_ahead_job *job,
+			  const struct object_id *oid)
+{
+	unsigned long size;
+	int full;
+
+	pthread_mutex_lock(&ra->mutex);
+	full = ra->bytes >= READ_AHEAD_MAX_BYTES;
+	pthread_mutex_unlock(&ra->mutex);
+	if (full)
+		return -1;
+
+	size = read_ahead_object(ra->r, oid, big_file_threshold);
+	if (!size)
+		return 0;
+
+	pthread_mutex_lock(&ra->mutex);
+	oid_array_append(&job->objects, oid);
+	job->bytes += size;
+	ra->bytes += size;
+	pthread_mutex_unlock(&ra->mutex);
+	return 0;
+}
+
+/*
+ * The main thread reads the trees again to compute the diff, so keep
+ * them, too; reading them here then merely copies them.
+ */
+static int read_tree_for_read_ahead(struct log_read_ahead *ra,
+				    struct read_ahead_job *job,
+				    const struct object_id *oid,
+				    struct tree_desc *desc, void **buf)
+{
+	enum object_type type;
+	unsigned long size = 0;
+
+	*buf = NULL;
+	if (oid) {
+		if (read_ahead_one(ra, job, oid))
+			return -1;
+		*buf = repo_read_object_file(ra->r, oid, &type, &size);
+		if (!*buf || type != OBJ_TREE) {
+			FREE_AND_NULL(*buf);
+			return -1;
+		}
+	}
+	init_tree_desc(desc, *buf, size);
+	return 0;
+}
+
+static int read_ahead_blob(struct log_read_ahead *ra,
+			   struct read_ahead_job *job,
+			   const struct name_entry *e)
+{
+	if (!e || !(S_ISREG(e->mode) || S_ISLNK(e->mode)))
+		return 0;
+	return read_ahead_one(ra, job, &e->oid);
+}
+
+/*
+ * Read the trees "old_oid" and "new_oid", either of which may be NULL, and
+ * the blobs and subtrees that differ between them. Returns non-zero
+ * once there is no room left.
+ */
+static int read_ahead_trees(struct log_read_ahead *ra,
+			    struct read_ahead_job *job,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid)
+{
+	struct tree_desc t1, t2;
+	void *buf1 = NULL, *buf2 = NULL;
+	int ret = 0;
+
+	if (read_tree_for_read_ahead(ra, job, old_oid, &t1, &buf1) ||
+	    read_tree_for_read_ahead(ra, job, new_oid, &t2, &buf2))
+		goto out;
+
+	while (!ret && (t1.size || t2.size)) {
+		struct name_entry *e1 = t1.size ? &t1.entry : NULL;
+		struct name_entry *e2 = t2.size ? &t2.entry : NULL;
+		int cmp;
+
+		if (!e1)
+			cmp = 1;
+		else if (!e2)
+			cmp = -1;
+		else
+			cmp = base_name_compare(e1->path, tree_entry_len(e1), e1->mode,
+						e2->path, tree_entry_len(e2), e2->mode);
+
+		if (!cmp) {
+			update_tree_entry(&t1);
+			update_tree_entry(&t2);
+			if (oideq(&e1->oid, &e2->oid))
+				continue;
+		} else if (cmp < 0) {
+			update_tree_entry(&t1);
+			e2 = NULL;
+		} else {
+			update_tree_entry(&t2);
+			e1 = NULL;
+		}
+
+		if ((!e1 || S_ISDIR(e1->mode)) && (!e2 || S_ISDIR(e2->mode)))
+			ret = read_ahead_trees(ra, job,
+					       e1 ? &e1->oid : NULL,
+					       e2 ? &e2->oid : NULL);
+		else
+			ret = read_ahead_blob(ra, job, e1) ||
+			      read_ahead_blob(ra, job, e2);
+	}
+
+out:
+	free(buf1);
+	free(buf2);
+	return ret;
+}
+
+/* Called with the mutex held. */
+static void release_read_ahead_job(struct log_read_ahead *ra,
+				   struct read_ahead_job *job)
+{
+	size_t i;
+
+	for (i = 0; i < job->objects.nr; i++)
+		drop_read_ahead_object(ra->r, &job->objects.oid[i]);
+	oid_array_clear(&job->objects);
+	ra->bytes -= job->bytes;
+	job->bytes = 0;
+}
+
+static void *read_ahead_thread(void *arg)
+{
+	struct log_read_ahead *ra = arg;
+
+	pthread_mutex_lock(&ra->mutex);
+	for (;;) {
+		struct read_ahead_job *job;
+
+		while (!ra->stop && ra->next == ra->tail)
+			pthread_cond_wait(&ra->queued, &ra->mutex);
+		if (ra->next == ra->tail)
+			break;
+
+		job = &ra->jobs[ra->next++ % ra->window];
+		job->state = READ_AHEAD_RUNNING;
+		pthread_mutex_unlock(&ra->mutex);
+
+		if (job->has_tree)
+			read_ahead_trees(ra, job,
+					 job->has_parent_tree ? &job->parent_tree : NULL,
+					 &job->tree);
+
+		pthread_mutex_lock(&ra->mutex);
+		job->state = READ_AHEAD_FINISHED;
+		if (job->cancelled)
+			release_read_ahead_job(ra, job);
+		pthread_cond_broadcast(&ra->finished);
+	}
+	pthread_mutex_unlock(&ra->mutex);
+	return NULL;
+}
+
+struct log_read_ahead *log_read_ahead_start(struct repository *r,
+					    int nr_threads, size_t *window)
+{
+	struct log_read_ahead *ra;
+	int i, ret;
+
+	CALLOC_ARRAY(ra, 1);
+	ra->r = r;
+	ra->nr_threads = nr_threads;
+	ra->window = st_mult(nr_threads, READ_AHEAD_COMMITS_PER_THREAD);
+	CALLOC_ARRAY(ra->jobs, ra->window);
+	for (i = 0; i < ra->window; i++)
+		ra->jobs[i].state = READ_AHEAD_FINISHED;
+	*window = ra->window;
+
+	pthread_mutex_init(&ra->mutex, NULL);
+	pthread_cond_init(&ra->queued, NULL);
+	pthread_cond_init(&ra->finished, NULL);
+	enable_obj_read_lock();
+	enable_read_ahead(ra->r);
+
+	CALLOC_ARRAY(ra->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&ra->threads[i], NULL,
+				     read_ahead_thread, ra);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	return ra;
+}
+
+void log_read_ahead_add(struct log_read_ahead *ra, struct commit *commit)
+{
+	struct read_ahead_job *job;
+	struct commit *parent = NULL;
+	int has_tree = 0;
+
+	if (ra->tail - ra->head >= ra->window)
+		BUG("too many commits queued for reading ahead");
+
+	/* The diffs of merges depend on too many options to guess them. */
+	if (!commit->parents ||
+	    (!commit->parents->next &&
+	     !repo_parse_commit(ra->r, commit->parents->item))) {
+		if (commit->parents)
+			parent = commit->parents->item;
+		has_tree = repo_get_commit_tree(ra->r, commit) &&
+			(!parent || repo_get_commit_tree(ra->r, parent));
+	}
+
+	pthread_mutex_lock(&ra->mutex);
+	job = &ra->jobs[ra->tail % ra->window];
+	while (job->state == READ_AHEAD_RUNNING)
+		pthread_cond_wait(&ra->finished, &ra->mutex);
+
+	job->state = READ_AHEAD_QUEUED;
+	job->cancelled = 0;
+	job->has_tree = has_tree;
+	job->has_parent_tree = has_tree && parent;
+	if (has_tree)
+		oidcpy(&job->tree, get_commit_tree_oid(commit));
+	if (job->has_parent_tree)
+		oidcpy(&job->parent_tree, get_commit_tree_oid(parent));
+
+	ra->tail++;
+	pthread_cond_signal(&ra->queued);
+	pthread_mutex_unlock(&ra->mutex);
+}
+
+void log_read_ahead_done(struct log_read_ahead *ra)
+{
+	struct read_ahead_job *job;
+
+	if (ra->head == ra->tail)
+		BUG("no commit queued for reading ahead");
+
+	pthread_mutex_lock(&ra->mutex);
+	job = &ra->jobs[ra->head % ra->window];
+	switch (job->state) {
+	case READ_AHEAD_QUEUED:
+		/* No thread got to it; make sure none will. */
+		ra->next++;
+		job->state = READ_AHEAD_FINISHED;
+		break;
+	case READ_AHEAD_RUNNING:
+		/* Its thread releases it when it is finished. */
+		job->cancelled = 1;
+		break;
+	case READ_AHEAD_FINISHED:
+		release_read_ahead_job(ra, job);
+		break;
+	}
+	ra->head++;
+	pthread_mutex_unlock(&ra->mutex);
+}
+
+void log_read_ahead_stop(struct log_read_ahead *ra)
+{
+	int i;
+
+	if (!ra)
+		return;
+
+	while (ra->head < ra->tail)
+		log_read_ahead_done(ra);
+
+	pthread_mutex_lock(&ra->mutex);
+	ra->stop = 1;
+	pthread_cond_broadcast(&ra->queued);
+	pthread_mutex_unlock(&ra->mutex);
+	for (i = 0; i < ra->nr_threads; i++)
+		pthread_join(ra->threads[i], NULL);
+
+	disable_read_ahead(ra->r);
+	disable_obj_read_lock();
+	pthread_cond_destroy(&ra->finished);
+	pthread_cond_destroy(&ra->queued);
+	pthread_mutex_destroy(&ra->mutex);
+	free(ra->threads);
+	free(ra->jobs);
+	free(ra);
+}
@@ -0,0 +1,49 @@
+#ifndef LOG_READ_AHEAD_H
+#define LOG_READ_AHEAD_H
+
+struct commit;
+struct repository;
+struct rev_info;
+
+/*
+ * With "log.threads", "git log -p" and its friends read the blobs that
+ * the diffs of the next commits will need in threads, while the main
+ * thread computes and shows the diffs of the commits before them, in
+ * order; see read_ahead_object(). The patch IDs of cherry-pick
+ * detection are computed the same way with "patchId.threads". Only the reading and inflating of the
+ * blobs happens in the threads: the diff machinery is not thread-safe.
+ */
+struct log_read_ahead;
+
+/*
+ * Return 1 if the commits shown by the walk "revs" may be read ahead,
+ * i.e. if it shows diffs that need the contents of the blobs, and
+ * nothing it shows depends on the state of the walk, like "--graph"
+ * does.
+ */
+int log_read_ahead_possible(struct rev_info *revs);
+
+/*
+ * Start "nr_threads" threads to read ahead from "r", and return how many
+ * commits the caller should queue before showing the first one in
+ * "window".
+ */
+struct log_read_ahead *log_read_ahead_start(struct repository *r,
+					    int nr_threads, size_t *window);
+
+/*
+ * Queue the blobs the diff of "commit" with its parent will need, if it
+ * has only one, or none. At most "window" commits may be queued and not
+ * yet done.
+ */
+void log_read_ahead_add(struct log_read_ahead *ra, struct commit *commit);
+
+/*
+ * Release what was read for the oldest queued commit, once it has been
+ * shown.
+ */
+void log_read_ahead_done(struct log_read_ahead *ra);
+
+void log_read_ahead_stop(struct log_read_ahead *ra);
+
+#endif
@@ -0,0 +1,340 @@
+#include "git-compat-util.h"
+#include "loose-index.h"
+#include "chunk-format.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "oid-array.h"
+#include "path.h"
+#include "repository.h"
+#include "strbuf.h"
+#include "trace2.h"
+
+#define LOOSE_INDEX_HEADER_SIZE (12)
+#define LOOSE_INDEX_DIR_SIZE (16)
+
+/*
+ * An mtime that no directory can have. It is used for directories we know
+ * nothing about, and is written out for directories that changed so
+ * recently that a later change might leave their mtime unchanged.
+ */
+#define LOOSE_INDEX_MTIME_UNKNOWN ((uint64_t)-1)
+
+struct loose_index_dir {
+	uint64_t mtime_sec;
+	uint32_t mtime_nsec;
+
+	/*
+	 * The "nr" object names of this directory, either in the mapped
+	 * file, or (if the directory had to be read again) in "oids".
+	 */
+	uint32_t nr;
+	const unsigned char *mapped;
+	struct oid_array oids;
+};
+
+struct loose_index {
+	struct loose_index_dir dir[256];
+	void *map;
+	size_t map_size;
+	int dirty;
+};
+
+static char *loose_index_filename(struct object_directory *odb)
+{
+	return xstrfmt("%s/info/loose-index", odb->path);
+}
+
+static void load_loose_index(struct loose_index *li, const char *path)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	const unsigned char *data, *oids;
+	struct stat st;
+	uint64_t total = 0;
+	size_t size;
+	int fd, i;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return;
+	}
+	size = xsize_t(st.st_size);
+	if (size < LOOSE_INDEX_HEADER_SIZE + 256 * LOOSE_INDEX_DIR_SIZE + rawsz) {
+		close(fd);
+		return;
+	}
+	li->map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	li->map_size = size;
+	close(fd);
+
+	data = li->map;
+	if (get_be32(data) != LOOSE_INDEX_SIGNATURE ||
+	    get_be32(data + 4) != LOOSE_INDEX_VERSION ||
+	    get_be32(data + 8) != oid_version(the_hash_algo))
+		goto invalid;
+
+	data += LOOSE_INDEX_HEADER_SIZE;
+	for (i = 0; i < 256; i++)
+		total += get_be32(data + i * LOOSE_INDEX_DIR_SIZE + 12);
+	if (size != LOOSE_INDEX_HEADER_SIZE + 256 * LOOSE_INDEX_DIR_SIZE +
+		    (total + 1) * rawsz)
+		goto invalid;
+
+	oids = data + 256 * LOOSE_INDEX_DIR_SIZE;
+	for (i = 0; i < 256; i++) {
+		struct loose_index_dir *d = &li->dir[i];
+
+		d->mtime_sec = get_be64(data);
+		d->mtime_nsec = get_be32(data + 8);
+		d->nr = get_be32(data + 12);
+		d->mapped = oids;
+
+		oids += st_mult(d->nr, rawsz);
+		data += LOOSE_INDEX_DIR_SIZE;
+	}
+	return;
+
+invalid:
+	warning(_("ignoring invalid loose object index '%s'"), path);
+	munmap(li->map, li->map_size);
+	li->map = NULL;
+	li->map_size = 0;
+}
+
+static int append_oid(const struct object_id *oid,
+		      const char *path UNUSED,
+		      void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+static int loose_index_oid_cmp(const void *a, const void *b)
+{
+	return oidcmp(a, b);
+}
+
+static void refresh_dir(struct loose_index *li, struct object_directory *odb,
+			unsigned int subdir_nr)
+{
+	struct loose_index_dir *d = &li->dir[subdir_nr];
+	struct strbuf path = STRBUF_INIT;
+	uint64_t mtime_sec = 0;
+	uint32_t mtime_nsec = 0;
+	struct stat st;
+
+	/*
+	 * A missing directory is recorded with an mtime of zero. Note that
+	 * we have to stat before reading the directory, so that a change
+	 * made while we read it makes us read it again next time.
+	 */
+	strbuf_addf(&path, "%s/%02x", odb->path, subdir_nr);
+	if (!stat(path.buf, &st)) {
+		mtime_sec = st.st_mtime;
+		mtime_nsec = ST_MTIME_NSEC(st);
+	} else if (errno != ENOENT) {
+		mtime_sec = LOOSE_INDEX_MTIME_UNKNOWN;
+	}
+
+	if (mtime_sec != LOOSE_INDEX_MTIME_UNKNOWN &&
+	    d->mtime_sec == mtime_sec && d->mtime_nsec == mtime_nsec) {
+		strbuf_release(&path);
+		return;
+	}
+
+	oid_array_clear(&d->oids);
+	strbuf_reset(&path);
+	strbuf_addstr(&path, odb->path);
+	for_each_file_in_obj_subdir(subdir_nr, &path, append_oid, NULL, NULL,
+				    &d->oids);
+	QSORT(d->oids.oid, d->oids.nr, loose_index_oid_cmp);
+	d->oids.sorted = 1;
+
+	d->mtime_sec = mtime_sec;
+	d->mtime_nsec = mtime_nsec;
+	d->nr = d->oids.nr;
+	d->mapped = NULL;
+	li->dirty = 1;
+
+	strbuf_release(&path);
+}
+
+struct loose_index *odb_loose_index(struct object_directory *odb)
+{
+	struct loose_index *li;
+	char *path;
+	int i;
+
+	if (odb->loose_index || odb->loose_index_checked)
+		return odb->loose_index;
+	odb->loose_index_checked = 1;
+
+	/*
+	 * Only index our own object directory; alternates and temporary
+	 * object directories are not ours to write to.
+	 */
+	prepare_repo_settings(the_repository);
+	if (!the_repository->settings.core_loose_object_index ||
+	    odb != the_repository->objects->odb || odb->will_destroy)
+		return NULL;
+
+	trace2_region_enter("loose-index", "load", the_repository);
+
+	CALLOC_ARRAY(li, 1);
+	for (i = 0; i < 256; i++)
+		li->dir[i].mtime_sec = LOOSE_INDEX_MTIME_UNKNOWN;
+
+	path = loose_index_filename(odb);
+	load_loose_index(li, path);
+	free(path);
+
+	for (i = 0; i < 256; i++)
+		refresh_dir(li, odb, i);
+	loose_index_write(li, odb);
+
+	trace2_region_leave("loose-index", "load", the_repository);
+
+	odb->loose_index = li;
+	return li;
+}
+
+int loose_index_for_each_in_subdir(struct loose_index *li,
+				   struct object_directory *odb,
+				   unsigned int subdir_nr,
+				   each_loose_object_fn cb, void *data)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	struct loose_index_dir *d;
+	struct strbuf path = STRBUF_INIT;
+	struct object_id oid;
+	size_t baselen;
+	uint32_t i;
+	int r = 0;
+
+	if (subdir_nr > 0xff)
+		BUG("invalid loose object subdirectory: %x", subdir_nr);
+
+	refresh_dir(li, odb, subdir_nr);
+	d = &li->dir[subdir_nr];
+
+	strbuf_addf(&path, "%s/%02x/", odb->path, subdir_nr);
+	baselen = path.len;
+
+	for (i = 0; i < d->nr; i++) {
+		if (d->mapped)
+			oidread(&oid, d->mapped + st_mult(i, rawsz));
+		else
+			oidcpy(&oid, &d->oids.oid[i]);
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, oid_to_hex(&oid) + 2);
+		r = cb(&oid, path.buf, data);
+		if (r)
+			break;
+	}
+
+	strbuf_release(&path);
+	return r;
+}
+
+int loose_index_for_each(struct loose_index *li,
+			 struct object_directory *odb,
+			 each_loose_object_fn cb, void *data)
+{
+	int r = 0;
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		r = loose_index_for_each_in_subdir(li, odb, i, cb, data);
+		if (r)
+			break;
+	}
+
+	return r;
+}
+
+void loose_index_write(struct loose_index *li, struct object_directory *odb)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	char *path;
+	time_t now;
+	int i;
+
+	if (!li->dirty)
+		return;
+
+	path = loose_index_filename(odb);
+	if (hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto cleanup;
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, LOOSE_INDEX_SIGNATURE);
+	hashwrite_be32(f, LOOSE_INDEX_VERSION);
+	hashwrite_be32(f, oid_version(the_hash_algo));
+
+	now = time(NULL);
+	for (i = 0; i < 256; i++) {
+		struct loose_index_dir *d = &li->dir[i];
+		uint64_t mtime_sec = d->mtime_sec;
+		uint32_t mtime_nsec = d->mtime_nsec;
+
+		/*
+		 * Timestamps of a directory that changed within the last
+		 * second may not change again when it is modified once
+		 * more, much like a racily clean entry in the index.
+		 * Make the next reader look at such directories again.
+		 */
+		if (mtime_sec != LOOSE_INDEX_MTIME_UNKNOWN &&
+		    mtime_sec + 1 >= (uint64_t)now) {
+			mtime_sec = LOOSE_INDEX_MTIME_UNKNOWN;
+			mtime_nsec = 0;
+		}
+
+		hashwrite_be64(f, mtime_sec);
+		hashwrite_be32(f, mtime_nsec);
+		hashwrite_be32(f, d->nr);
+	}
+
+	for (i = 0; i < 256; i++) {
+		struct loose_index_dir *d = &li->dir[i];
+		uint32_t j;
+
+		if (d->mapped)
+			hashwrite(f, d->mapped, st_mult(d->nr, rawsz));
+		else
+			for (j = 0; j < d->nr; j++)
+				hashwrite(f, d->oids.oid[j].hash, rawsz);
+	}
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+
+	if (adjust_shared_perm(get_lock_file_path(&lk)) < 0 ||
+	    commit_lock_file(&lk) < 0) {
+		rollback_lock_file(&lk);
+		goto cleanup;
+	}
+	li->dirty = 0;
+
+cleanup:
+	free(path);
+}
+
+void loose_index_free(struct loose_index *li)
+{
+	int i;
+
+	if (!li)
+		return;
+	for (i = 0; i < 256; i++)
+		oid_array_clear(&li->dir[i].oids);
+	if (li->map)
+		munmap(li->map, li->map_size);
+	free(li);
+}
@@ -0,0 +1,63 @@
+#ifndef LOOSE_INDEX_H
+#define LOOSE_INDEX_H
+
+#include "object-store-ll.h"
+
+#define LOOSE_INDEX_SIGNATURE 0x4c494458 /* "LIDX" */
+#define LOOSE_INDEX_VERSION 1
+
+/*
+ * The loose object index ("$GIT_OBJECT_DIRECTORY/info/loose-index") is a
+ * cache of the names of all loose objects, so that listing them does not
+ * need to readdir(3) all 256 fan-out directories. For each directory it
+ * remembers the mtime the directory had when it was last read; adding or
+ * removing an object changes that mtime, in which case only that one
+ * directory is read again.
+ *
+ * The file consists of:
+ *
+ *   - a 12-byte header: the signature, the version and the hash id
+ *
+ *   - 256 entries, one for each fan-out directory, of 16 bytes each: the
+ *     mtime of the directory in seconds (64-bit) and nanoseconds (32-bit),
+ *     and the number of objects in it (32-bit)
+ *
+ *   - the raw object names, sorted
+ *
+ *   - a trailing checksum of the preceding contents
+ *
+ * All numbers are in network byte order.
+ */
+struct loose_index;
+
+/*
+ * Return the loose object index of "odb", loading it and bringing it up
+ * to date with the fan-out directories on first use, or NULL if the
+ * index is not enabled for "odb" (see core.looseObjectIndex).
+ */
+struct loose_index *odb_loose_index(struct object_directory *odb);
+
+/*
+ * Call "cb" for each loose object in fan-out directory "subdir_nr" of
+ * "odb", in the same way as for_each_file_in_obj_subdir() would. The
+ * directory is checked with stat(2), and read again only if it changed.
+ */
+int loose_index_for_each_in_subdir(struct loose_index *li,
+				   struct object_directory *odb,
+				   unsigned int subdir_nr,
+				   each_loose_object_fn cb, void *data);
+
+/* Call "cb" for each loose object in "odb"; see above. */
+int loose_index_for_each(struct loose_index *li,
+			 struct object_directory *odb,
+			 each_loose_object_fn cb, void *data);
+
+/*
+ * Write out the index if any directory had to be read again. This is
+ * best-effort and fails silently, e.g. for a read-only repository.
+ */
+void loose_index_write(struct loose_index *li, struct object_directory *odb);
+
+void loose_index_free(struct loose_index *li);
+
+#endif
@@ -1,8 +1,13 @@
 #include "git-compat-util.h"
+#include "chunk-format.h"
+#include "csum-file.h"
 #include "environment.h"
 #include "gettext.h"
 #include "hash.h"
 #include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "path.h"
 #include "repository.h"
 #include "refs.h"
 #include "remote.h"
@@ -11,6 +16,7 @@
 #include "pkt-line.h"
 #include "config.h"
 #include "string-list.h"
+#include "write-or-die.h"
 
 static enum {
 	UNBORN_IGNORE = 0,
@@ -74,6 +80,9 @@ struct ls_refs_data {
 	struct strbuf buf;
 	struct strvec hidden_refs;
 	unsigned unborn : 1;
+
+	/* If non-NULL, collect the response here instead of sending it. */
+	struct strbuf *response;
 };
 
 static int send_ref(const char *refname, const struct object_id *oid,
@@ -114,11 +123,159 @@ static int send_ref(const char *refname, const struct object_id *oid,
 	}
 
 	strbuf_addch(&data->buf, '\n');
-	packet_fwrite(stdout, data->buf.buf, data->buf.len);
+	if (data->response)
+		packet_buf_write(data->response, "%s", data->buf.buf);
+	else
+		packet_fwrite(stdout, data->buf.buf, data->buf.len);
 
 	return 0;
 }
 
+/*
+ * With lsrefs.cache, the response to each distinct ls-refs request is
+ * kept in "$GIT_DIR/ls-refs-cache/<key>", where the key is a hash of
+ * everything besides the references that the response depends on: the
+ * arguments of the request, the namespace and the hidden refs. Each
+ * file consists of:
+ *
+ *   - a 16-byte header: the signature, the version, the hash id and
+ *     the length of the generation of the references (see
+ *     refs_read_generation()) that the response was made from
+ *
+ *   - that generation
+ *
+ *   - the response as a sequence of pkt-lines, without the final flush
+ *
+ *   - a trailing checksum of the preceding contents
+ *
+ * All numbers are in network byte order. The response is only used if
+ * the generation still matches. The files may be removed at any time.
+ */
+#define LS_REFS_CACHE_SIGNATURE 0x4c535243 /* "LSRC" */
+#define LS_REFS_CACHE_VERSION 1
+#define LS_REFS_CACHE_HEADER_SIZE 16
+
+static void ls_refs_cache_key(struct repository *r, struct ls_refs_data *data,
+			      struct object_id *key)
+{
+	struct strbuf buf = STRBUF_INIT;
+	git_hash_ctx ctx;
+	int i;
+
+	r->hash_algo->init_fn(&ctx);
+	strbuf_addf(&buf, "ls-refs peel %u symrefs %u unborn %u namespace %s",
+		    data->peel, data->symrefs, data->unborn,
+		    get_git_namespace());
+	r->hash_algo->update_fn(&ctx, buf.buf, buf.len + 1);
+	for (i = 0; i < data->prefixes.nr; i++)
+		r->hash_algo->update_fn(&ctx, data->prefixes.v[i],
+					strlen(data->prefixes.v[i]) + 1);
+	/* An empty entry separates the prefixes from the hidden refs. */
+	r->hash_algo->update_fn(&ctx, "", 1);
+	for (i = 0; i < data->hidden_refs.nr; i++)
+		r->hash_algo->update_fn(&ctx, data->hidden_refs.v[i],
+					strlen(data->hidden_refs.v[i]) + 1);
+	r->hash_algo->final_oid_fn(key, &ctx);
+	strbuf_release(&buf);
+}
+
+static char *ls_refs_cache_filename(struct repository *r,
+				    const struct object_id *key)
+{
+	return repo_git_path(r, "ls-refs-cache/%s", oid_to_hex(key));
+}
+
+/*
+ * Read the response cached under `key` for the references at
+ * `generation` into `response`. Return 0 on success, and -1 if there is
+ * none, or it is for another generation.
+ */
+static int read_ls_refs_cache(struct repository *r, const struct object_id *key,
+			      const struct strbuf *generation,
+			      struct strbuf *response)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const unsigned char *data;
+	char *path = ls_refs_cache_filename(r, key);
+	size_t len;
+	int ret = -1;
+
+	if (strbuf_read_file(&buf, path, 0) < 0)
+		goto cleanup;
+	data = (const unsigned char *)buf.buf;
+
+	if (buf.len < LS_REFS_CACHE_HEADER_SIZE + r->hash_algo->rawsz ||
+	    get_be32(data) != LS_REFS_CACHE_SIGNATURE ||
+	    get_be32(data + 4) != LS_REFS_CACHE_VERSION ||
+	    get_be32(data + 8) != oid_version(r->hash_algo))
+		goto invalid;
+	len = get_be32(data + 12);
+	if (buf.len < st_add3(LS_REFS_CACHE_HEADER_SIZE, len,
+			      r->hash_algo->rawsz) ||
+	    !hashfile_checksum_valid(data, buf.len))
+		goto invalid;
+
+	data += LS_REFS_CACHE_HEADER_SIZE;
+	if (len != generation->len || memcmp(data, generation->buf, len))
+		goto cleanup;
+	data += len;
+	strbuf_add(response, data, buf.len - LS_REFS_CACHE_HEADER_SIZE - len -
+		   r->hash_algo->rawsz);
+	ret = 0;
+	goto cleanup;
+
+invalid:
+	warning(_("ignoring invalid ls-refs cache '%s'"), path);
+cleanup:
+	strbuf_release(&buf);
+	free(path);
+	return ret;
+}
+
+/*
+ * Cache the `response` for the references at `generation` under `key`.
+ * Failing to do so is not an error: the response is merely computed
+ * again the next time.
+ */
+static void write_ls_refs_cache(struct repository *r, const struct object_id *key,
+				const struct strbuf *generation,
+				const struct strbuf *response)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	char *path = ls_refs_cache_filename(r, key);
+
+	if (generation->len > UINT32_MAX ||
+	    safe_create_leading_directories(path) < 0 ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto cleanup;
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, LS_REFS_CACHE_SIGNATURE);
+	hashwrite_be32(f, LS_REFS_CACHE_VERSION);
+	hashwrite_be32(f, oid_version(r->hash_algo));
+	hashwrite_be32(f, generation->len);
+	hashwrite(f, generation->buf, generation->len);
+	hashwrite(f, response->buf, response->len);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+
+	if (adjust_shared_perm(get_lock_file_path(&lk)) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		rollback_lock_file(&lk);
+
+cleanup:
+	free(path);
+}
+
+/* Send the cached or collected `response` and the final flush at once. */
+static void send_response(struct strbuf *response)
+{
+	packet_buf_flush(response);
+	if (fflush(stdout))
+		die_errno(_("write failure on standard output"));
+	write_or_die(1, response->buf, response->len);
+}
+
 static void send_possibly_unborn_head(struct ls_refs_data *data)
 {
 	struct strbuf namespaced = STRBUF_INIT;
@@ -152,6 +309,10 @@ static int ls_refs_config(const char *var, const char *value,
 int ls_refs(struct repository *r, struct packet_reader *request)
 {
 	struct ls_refs_data data;
+	struct strbuf generation = STRBUF_INIT;
+	struct strbuf response = STRBUF_INIT;
+	struct object_id key;
+	int use_cache = 0;
 
 	memset(&data, 0, sizeof(data));
 	strvec_init(&data.prefixes);
@@ -189,6 +350,17 @@ int ls_refs(struct repository *r, struct packet_reader *request)
 	if (data.prefixes.nr >= TOO_MANY_PREFIXES)
 		strvec_clear(&data.prefixes);
 
+	if (!repo_config_get_bool(r, "lsrefs.cache", &use_cache) &&
+	    use_cache &&
+	    !refs_read_generation(get_main_ref_store(r), &generation)) {
+		ls_refs_cache_key(r, &data, &key);
+		if (!read_ls_refs_cache(r, &key, &generation, &response)) {
+			send_response(&response);
+			goto done;
+		}
+		data.response = &response;
+	}
+
 	send_possibly_unborn_head(&data);
 	if (!data.prefixes.nr)
 		strvec_push(&data.prefixes, "");
@@ -196,7 +368,23 @@ int ls_refs(struct repository *r, struct packet_reader *request)
 					  get_git_namespace(), data.prefixes.v,
 					  hidden_refs_to_excludes(&data.hidden_refs),
 					  send_ref, &data);
-	packet_fflush(stdout);
+
+	if (data.response) {
+		struct strbuf after = STRBUF_INIT;
+
+		/* Only cache a response made from a single generation. */
+		if (!refs_read_generation(get_main_ref_store(r), &after) &&
+		    !strbuf_cmp(&generation, &after))
+			write_ls_refs_cache(r, &key, &generation, &response);
+		strbuf_release(&after);
+		send_response(&response);
+	} else {
+		packet_fflush(stdout);
+	}
+
+done:
+	strbuf_release(&generation);
+	strbuf_release(&response);
 	strvec_clear(&data.prefixes);
 	strbuf_release(&data.buf);
 	strvec_clear(&data.hidden_refs);
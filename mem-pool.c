@@ -152,24 +152,23 @@ void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src)
 {
 	struct mp_block *p;
 
-	/* Append the blocks from src to dst */
-	if (dst->mp_block && src->mp_block) {
+	if (src->mp_block) {
 		/*
-		 * src and dst have blocks, append
-		 * blocks from src to dst.
+		 * Splice the blocks from src in right after the first
+		 * block of dst, which keeps serving dst's allocations.
+		 * That costs a walk over the blocks of src, which is
+		 * usually a short-lived pool of a thread, but not over
+		 * those of dst, which may have collected the blocks of
+		 * many such pools already.
 		 */
-		p = dst->mp_block;
-		while (p->next_block)
-			p = p->next_block;
-
-		p->next_block = src->mp_block;
-	} else if (src->mp_block) {
-		/*
-		 * src has blocks, dst is empty.
-		 */
-		dst->mp_block = src->mp_block;
-	} else {
-		/* src is empty, nothing to do. */
+		for (p = src->mp_block; p->next_block; p = p->next_block)
+			; /* nothing */
+		if (dst->mp_block) {
+			p->next_block = dst->mp_block->next_block;
+			dst->mp_block->next_block = src->mp_block;
+		} else {
+			dst->mp_block = src->mp_block;
+		}
 	}
 
 	dst->pool_alloc += src->pool_alloc;
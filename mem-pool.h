@@ -51,6 +51,10 @@ char *mem_pool_strndup(struct mem_pool *pool, const char *str, size_t len);
  * Move the memory associated with the 'src' pool to the 'dst' pool. The 'src'
  * pool will be empty and not contain any memory. It still needs to be free'd
  * with a call to `mem_pool_discard`.
+ *
+ * This only walks the blocks of 'src', so threaded code can cheaply give
+ * each thread a pool of its own, and combine them into a shared one once
+ * the threads have been joined.
  */
 void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src);
 
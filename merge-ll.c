@@ -381,6 +381,36 @@ static void normalize_file(mmfile_t *mm, const char *path, struct index_state *i
 	}
 }
 
+/* Look up the driver for "path" and its conflict marker size. */
+static const struct ll_merge_driver *find_driver_for_path(const char *path,
+							  struct index_state *istate,
+							  const struct ll_merge_options *opts,
+							  int *marker_size)
+{
+	struct attr_check *check = load_merge_attributes();
+	const char *ll_driver_name = NULL;
+	const struct ll_merge_driver *driver;
+
+	*marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	git_check_attr(istate, path, check);
+	ll_driver_name = check->items[0].value;
+	if (check->items[1].value) {
+		*marker_size = atoi(check->items[1].value);
+		if (*marker_size <= 0)
+			*marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	}
+	driver = find_ll_merge_driver(ll_driver_name);
+
+	if (opts->virtual_ancestor) {
+		if (driver->recursive)
+			driver = find_ll_merge_driver(driver->recursive);
+	}
+	if (opts->extra_marker_size) {
+		*marker_size += opts->extra_marker_size;
+	}
+	return driver;
+}
+
 enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	     const char *path,
 	     mmfile_t *ancestor, const char *ancestor_label,
@@ -389,10 +419,8 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts)
 {
-	struct attr_check *check = load_merge_attributes();
 	static const struct ll_merge_options default_opts;
-	const char *ll_driver_name = NULL;
-	int marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	int marker_size;
 	const struct ll_merge_driver *driver;
 
 	if (!opts)
@@ -404,27 +432,43 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 		normalize_file(theirs, path, istate);
 	}
 
-	git_check_attr(istate, path, check);
-	ll_driver_name = check->items[0].value;
-	if (check->items[1].value) {
-		marker_size = atoi(check->items[1].value);
-		if (marker_size <= 0)
-			marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
-	}
-	driver = find_ll_merge_driver(ll_driver_name);
-
-	if (opts->virtual_ancestor) {
-		if (driver->recursive)
-			driver = find_ll_merge_driver(driver->recursive);
-	}
-	if (opts->extra_marker_size) {
-		marker_size += opts->extra_marker_size;
-	}
+	driver = find_driver_for_path(path, istate, opts, &marker_size);
 	return driver->fn(driver, result_buf, path, ancestor, ancestor_label,
 			  ours, our_label, theirs, their_label,
 			  opts, marker_size);
 }
 
+int ll_merge_prepare(struct ll_merge_prep *prep, const char *path,
+		     struct index_state *istate,
+		     const struct ll_merge_options *opts)
+{
+	int i;
+
+	if (opts->renormalize)
+		return 0;
+	prep->driver = find_driver_for_path(path, istate, opts,
+					    &prep->marker_size);
+	/* Only the built-in drivers are safe to run in threads. */
+	for (i = 0; i < ARRAY_SIZE(ll_merge_drv); i++)
+		if (prep->driver == &ll_merge_drv[i])
+			return 1;
+	return 0;
+}
+
+enum ll_merge_result ll_merge_prepared(const struct ll_merge_prep *prep,
+				       mmbuffer_t *result_buf,
+				       const char *path,
+				       mmfile_t *ancestor, const char *ancestor_label,
+				       mmfile_t *ours, const char *our_label,
+				       mmfile_t *theirs, const char *their_label,
+				       const struct ll_merge_options *opts)
+{
+	return prep->driver->fn(prep->driver, result_buf, path,
+				ancestor, ancestor_label,
+				ours, our_label, theirs, their_label,
+				opts, prep->marker_size);
+}
+
 int ll_merge_marker_size(struct index_state *istate, const char *path)
 {
 	static struct attr_check *check;
@@ -103,6 +103,33 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts);
 
+/*
+ * ll_merge() reads attributes and configuration, and may run an external
+ * merge driver, so it must be called from the main thread. To merge in
+ * threads, look up how to merge "path" there with ll_merge_prepare()
+ * first. It returns 1 if a built-in driver merges it and no
+ * renormalization is needed, in which case ll_merge_prepared() gives the
+ * same result as ll_merge() and may be called from any thread. Otherwise
+ * it returns 0, and ll_merge() must be used.
+ */
+struct ll_merge_driver;
+struct ll_merge_prep {
+	const struct ll_merge_driver *driver;
+	int marker_size;
+};
+
+int ll_merge_prepare(struct ll_merge_prep *prep, const char *path,
+		     struct index_state *istate,
+		     const struct ll_merge_options *opts);
+
+enum ll_merge_result ll_merge_prepared(const struct ll_merge_prep *prep,
+				       mmbuffer_t *result_buf,
+				       const char *path,
+				       mmfile_t *ancestor, const char *ancestor_label,
+				       mmfile_t *ours, const char *our_label,
+				       mmfile_t *theirs, const char *their_label,
+				       const struct ll_merge_options *opts);
+
 int ll_merge_marker_size(struct index_state *istate, const char *path);
 void reset_merge_attributes(void);
 
@@ -33,17 +33,20 @@
 #include "merge-ll.h"
 #include "match-trees.h"
 #include "mem-pool.h"
+#include "object-file.h"
 #include "object-name.h"
 #include "object-store-ll.h"
 #include "oid-array.h"
 #include "path.h"
 #include "promisor-remote.h"
 #include "read-cache-ll.h"
+#include "refs.h"
 #include "revision.h"
 #include "sparse-index.h"
 #include "strmap.h"
 #include "submodule-config.h"
 #include "submodule.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 #include "unpack-trees.h"
@@ -401,6 +404,15 @@ struct merge_options_internal {
 
 	/* field that holds submodule conflict information */
 	struct string_list conflicted_submodules;
+
+	/*
+	 * content_merges: content merges done in threads ahead of
+	 * process_entries(), see run_content_merges().
+	 *
+	 * Keys are paths and values are struct content_merge, which
+	 * merge_3way() takes the results of.
+	 */
+	struct strmap content_merges;
 };
 
 struct conflicted_submodule_item {
@@ -1948,62 +1960,126 @@ static void initialize_attr_index(struct merge_options *opt)
 	}
 }
 
-static int merge_3way(struct merge_options *opt,
-		      const char *path,
-		      const struct object_id *o,
-		      const struct object_id *a,
-		      const struct object_id *b,
-		      const char *pathnames[3],
-		      const int extra_marker_size,
-		      mmbuffer_t *result_buf)
+static void init_ll_merge_options(struct merge_options *opt,
+				  const int extra_marker_size,
+				  struct ll_merge_options *ll_opts)
 {
-	mmfile_t orig, src1, src2;
-	struct ll_merge_options ll_opts = {0};
-	char *base, *name1, *name2;
-	enum ll_merge_result merge_status;
-
-	if (!opt->priv->attr_index.initialized)
-		initialize_attr_index(opt);
-
-	ll_opts.renormalize = opt->renormalize;
-	ll_opts.extra_marker_size = extra_marker_size;
-	ll_opts.xdl_opts = opt->xdl_opts;
+	memset(ll_opts, 0, sizeof(*ll_opts));
+	ll_opts->renormalize = opt->renormalize;
+	ll_opts->extra_marker_size = extra_marker_size;
+	ll_opts->xdl_opts = opt->xdl_opts;
 
 	if (opt->priv->call_depth) {
-		ll_opts.virtual_ancestor = 1;
-		ll_opts.variant = 0;
+		ll_opts->virtual_ancestor = 1;
+		ll_opts->variant = 0;
 	} else {
 		switch (opt->recursive_variant) {
 		case MERGE_VARIANT_OURS:
-			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+			ll_opts->variant = XDL_MERGE_FAVOR_OURS;
 			break;
 		case MERGE_VARIANT_THEIRS:
-			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+			ll_opts->variant = XDL_MERGE_FAVOR_THEIRS;
 			break;
 		default:
-			ll_opts.variant = 0;
+			ll_opts->variant = 0;
 			break;
 		}
 	}
+}
 
+static void merge_3way_labels(struct merge_options *opt,
+			      const char *pathnames[3],
+			      char **base, char **name1, char **name2)
+{
 	assert(pathnames[0] && pathnames[1] && pathnames[2] && opt->ancestor);
 	if (pathnames[0] == pathnames[1] && pathnames[1] == pathnames[2]) {
-		base  = mkpathdup("%s", opt->ancestor);
-		name1 = mkpathdup("%s", opt->branch1);
-		name2 = mkpathdup("%s", opt->branch2);
+		*base  = mkpathdup("%s", opt->ancestor);
+		*name1 = mkpathdup("%s", opt->branch1);
+		*name2 = mkpathdup("%s", opt->branch2);
 	} else {
-		base  = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
-		name1 = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
-		name2 = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
+		*base  = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
+		*name1 = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
+		*name2 = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
 	}
+}
+
+struct content_merge {
+	/* what merge_3way() was going to be asked to merge */
+	struct object_id o, a, b;
+	const char **pathnames;
+	int extra_marker_size;
+
+	char *base, *name1, *name2;
+	struct ll_merge_options ll_opts;
+	struct ll_merge_prep prep;
+	const char *path;
+
+	mmbuffer_t result;
+	enum ll_merge_result status;
+};
+
+/*
+ * Take the result of the content merge of "path" done ahead of time, if
+ * it was done for the same inputs.
+ */
+static int take_content_merge(struct merge_options *opt,
+			      const char *path,
+			      const struct object_id *o,
+			      const struct object_id *a,
+			      const struct object_id *b,
+			      const char *pathnames[3],
+			      const int extra_marker_size,
+			      mmbuffer_t *result_buf,
+			      enum ll_merge_result *merge_status)
+{
+	struct content_merge *cm;
 
-	read_mmblob(&orig, o);
-	read_mmblob(&src1, a);
-	read_mmblob(&src2, b);
+	cm = strmap_get(&opt->priv->content_merges, path);
+	if (!cm || !cm->result.ptr ||
+	    !oideq(&cm->o, o) || !oideq(&cm->a, a) || !oideq(&cm->b, b) ||
+	    cm->pathnames != pathnames ||
+	    cm->extra_marker_size != extra_marker_size)
+		return 0;
+
+	*result_buf = cm->result;
+	*merge_status = cm->status;
+	cm->result.ptr = NULL;
+	return 1;
+}
+
+static int merge_3way(struct merge_options *opt,
+		      const char *path,
+		      const struct object_id *o,
+		      const struct object_id *a,
+		      const struct object_id *b,
+		      const char *pathnames[3],
+		      const int extra_marker_size,
+		      mmbuffer_t *result_buf)
+{
+	mmfile_t orig, src1, src2;
+	struct ll_merge_options ll_opts;
+	char *base, *name1, *name2;
+	enum ll_merge_result merge_status;
+
+	merge_3way_labels(opt, pathnames, &base, &name1, &name2);
+
+	if (!take_content_merge(opt, path, o, a, b, pathnames,
+				extra_marker_size, result_buf, &merge_status)) {
+		if (!opt->priv->attr_index.initialized)
+			initialize_attr_index(opt);
+		init_ll_merge_options(opt, extra_marker_size, &ll_opts);
 
-	merge_status = ll_merge(result_buf, path, &orig, base,
-				&src1, name1, &src2, name2,
-				&opt->priv->attr_index, &ll_opts);
+		read_mmblob(&orig, o);
+		read_mmblob(&src1, a);
+		read_mmblob(&src2, b);
+
+		merge_status = ll_merge(result_buf, path, &orig, base,
+					&src1, name1, &src2, name2,
+					&opt->priv->attr_index, &ll_opts);
+		free(orig.ptr);
+		free(src1.ptr);
+		free(src2.ptr);
+	}
 	if (merge_status == LL_MERGE_BINARY_CONFLICT)
 		path_msg(opt, CONFLICT_BINARY, 0,
 			 path, NULL, NULL, NULL,
@@ -2013,9 +2089,6 @@ static int merge_3way(struct merge_options *opt,
 	free(base);
 	free(name1);
 	free(name2);
-	free(orig.ptr);
-	free(src1.ptr);
-	free(src2.ptr);
 	return merge_status;
 }
 
@@ -2109,8 +2182,9 @@ static int handle_content_merge(struct merge_options *opt,
 			ret = error(_("failed to execute internal merge"));
 
 		if (!ret &&
-		    write_object_file(result_buf.ptr, result_buf.size,
-				      OBJ_BLOB, &result->oid))
+		    write_object_file_flags(result_buf.ptr, result_buf.size,
+					    OBJ_BLOB, &result->oid,
+					    HASH_BULK_CHECKIN))
 			ret = error(_("unable to add %s to database"), path);
 
 		free(result_buf.ptr);
@@ -3631,7 +3705,8 @@ static int write_tree(struct object_id *result_oid,
 	}
 
 	/* Write this object file out, and record in result_oid */
-	if (write_object_file(buf.buf, buf.len, OBJ_TREE, result_oid))
+	if (write_object_file_flags(buf.buf, buf.len, OBJ_TREE, result_oid,
+				    HASH_BULK_CHECKIN))
 		ret = -1;
 	strbuf_release(&buf);
 	return ret;
@@ -4200,13 +4275,37 @@ static int process_entry(struct merge_options *opt,
 	return 0;
 }
 
+/* Return 1 if "ci" likely needs a 3-way merge of regular files. */
+static int needs_content_merge(struct conflict_info *ci)
+{
+	/* Ignore clean entries */
+	if (ci->merged.clean)
+		return 0;
+
+	/* Ignore entries that don't need a content merge */
+	if (ci->match_mask || ci->filemask < 6 ||
+	    !S_ISREG(ci->stages[1].mode) ||
+	    !S_ISREG(ci->stages[2].mode) ||
+	    oideq(&ci->stages[1].oid, &ci->stages[2].oid))
+		return 0;
+
+	/* Also don't need content merge if base matches either side */
+	if (ci->filemask == 7 &&
+	    S_ISREG(ci->stages[0].mode) &&
+	    (oideq(&ci->stages[0].oid, &ci->stages[1].oid) ||
+	     oideq(&ci->stages[0].oid, &ci->stages[2].oid)))
+		return 0;
+
+	return 1;
+}
+
 static void prefetch_for_content_merges(struct merge_options *opt,
 					struct string_list *plist)
 {
 	struct string_list_item *e;
 	struct oid_array to_fetch = OID_ARRAY_INIT;
 
-	if (opt->repo != the_repository || !repo_has_promisor_remote(the_repository))
+	if (opt->repo != the_repository)
 		return;
 
 	for (e = &plist->items[plist->nr-1]; e >= plist->items; --e) {
@@ -4214,22 +4313,7 @@ static void prefetch_for_content_merges(struct merge_options *opt,
 		struct conflict_info *ci = e->util;
 		int i;
 
-		/* Ignore clean entries */
-		if (ci->merged.clean)
-			continue;
-
-		/* Ignore entries that don't need a content merge */
-		if (ci->match_mask || ci->filemask < 6 ||
-		    !S_ISREG(ci->stages[1].mode) ||
-		    !S_ISREG(ci->stages[2].mode) ||
-		    oideq(&ci->stages[1].oid, &ci->stages[2].oid))
-			continue;
-
-		/* Also don't need content merge if base matches either side */
-		if (ci->filemask == 7 &&
-		    S_ISREG(ci->stages[0].mode) &&
-		    (oideq(&ci->stages[0].oid, &ci->stages[1].oid) ||
-		     oideq(&ci->stages[0].oid, &ci->stages[2].oid)))
+		if (!needs_content_merge(ci))
 			continue;
 
 		for (i = 0; i < 3; i++) {
@@ -4237,17 +4321,154 @@ static void prefetch_for_content_merges(struct merge_options *opt,
 			struct version_info *vi = &ci->stages[i];
 
 			if ((ci->filemask & side_mask) &&
-			    S_ISREG(vi->mode) &&
-			    oid_object_info_extended(opt->repo, &vi->oid, NULL,
-						     OBJECT_INFO_FOR_PREFETCH))
+			    S_ISREG(vi->mode))
 				oid_array_append(&to_fetch, &vi->oid);
 		}
 	}
 
-	promisor_remote_get_direct(opt->repo, to_fetch.oid, to_fetch.nr);
+	odb_prefetch(opt->repo, &to_fetch,
+		     ODB_PREFETCH_MISSING | ODB_PREFETCH_PACKED);
 	oid_array_clear(&to_fetch);
 }
 
+struct content_merge_threads {
+	struct content_merge **merges;
+	int nr, alloc, next;
+	pthread_mutex_t mutex;
+};
+
+static void *content_merge_thread(void *arg)
+{
+	struct content_merge_threads *st = arg;
+
+	for (;;) {
+		struct content_merge *cm;
+		mmfile_t orig, src1, src2;
+
+		pthread_mutex_lock(&st->mutex);
+		cm = st->next < st->nr ? st->merges[st->next++] : NULL;
+		pthread_mutex_unlock(&st->mutex);
+		if (!cm)
+			break;
+
+		read_mmblob(&orig, &cm->o);
+		read_mmblob(&src1, &cm->a);
+		read_mmblob(&src2, &cm->b);
+		cm->status = ll_merge_prepared(&cm->prep, &cm->result, cm->path,
+					       &orig, cm->base,
+					       &src1, cm->name1,
+					       &src2, cm->name2,
+					       &cm->ll_opts);
+		free(orig.ptr);
+		free(src1.ptr);
+		free(src2.ptr);
+	}
+	return NULL;
+}
+
+/*
+ * The 3-way merges of the contents of different paths do not depend on
+ * each other, so run the ones process_entry() is going to need in
+ * threads, before it goes through the paths in order. merge_3way() then
+ * takes their results, so that everything else, like writing the
+ * results to the object store and the messages about conflicts, happens
+ * in the same order as without threads. Only merges that the built-in
+ * drivers do are run here.
+ */
+static void run_content_merges(struct merge_options *opt,
+			       struct string_list *plist)
+{
+	struct content_merge_threads st = { 0 };
+	struct string_list_item *e;
+	int nr_threads = opt->threads, i, ret;
+	pthread_t *threads;
+
+	if (!HAVE_THREADS || opt->repo != the_repository ||
+	    repo_has_promisor_remote(opt->repo))
+		return;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads < 2)
+		return;
+
+	for (e = &plist->items[plist->nr-1]; e >= plist->items; --e) {
+		struct conflict_info *ci = e->util;
+		struct content_merge *cm;
+		int two_way;
+
+		if (!needs_content_merge(ci))
+			continue;
+
+		CALLOC_ARRAY(cm, 1);
+		two_way = ((S_IFMT & ci->stages[0].mode) !=
+			   (S_IFMT & ci->stages[1].mode));
+		oidcpy(&cm->o, two_way ? null_oid() : &ci->stages[0].oid);
+		oidcpy(&cm->a, &ci->stages[1].oid);
+		oidcpy(&cm->b, &ci->stages[2].oid);
+		cm->pathnames = ci->pathnames;
+		cm->extra_marker_size = opt->priv->call_depth * 2;
+		cm->path = e->string;
+
+		if (!opt->priv->attr_index.initialized)
+			initialize_attr_index(opt);
+		init_ll_merge_options(opt, cm->extra_marker_size, &cm->ll_opts);
+		if (!ll_merge_prepare(&cm->prep, cm->path,
+				      &opt->priv->attr_index, &cm->ll_opts)) {
+			free(cm);
+			continue;
+		}
+		merge_3way_labels(opt, ci->pathnames,
+				  &cm->base, &cm->name1, &cm->name2);
+
+		strmap_put(&opt->priv->content_merges, cm->path, cm);
+		ALLOC_GROW(st.merges, st.nr + 1, st.alloc);
+		st.merges[st.nr++] = cm;
+	}
+	if (nr_threads > st.nr)
+		nr_threads = st.nr;
+	if (nr_threads < 2) {
+		/* merge_3way() does the only one there is itself */
+		free(st.merges);
+		return;
+	}
+
+	trace2_region_enter("merge", "content merges", opt->repo);
+	pthread_mutex_init(&st.mutex, NULL);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL,
+				     content_merge_thread, &st);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&st.mutex);
+	trace2_region_leave("merge", "content merges", opt->repo);
+
+	free(st.merges);
+}
+
+static void free_content_merges(struct strmap *content_merges)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	strmap_for_each_entry(content_merges, &iter, e) {
+		struct content_merge *cm = e->value;
+
+		free(cm->base);
+		free(cm->name1);
+		free(cm->name2);
+		free(cm->result.ptr);
+		free(cm);
+	}
+	strmap_clear(content_merges, 0);
+}
+
 static int process_entries(struct merge_options *opt,
 			   struct object_id *result_oid)
 {
@@ -4296,6 +4517,8 @@ static int process_entries(struct merge_options *opt,
 	 */
 	trace2_region_enter("merge", "processing", opt->repo);
 	prefetch_for_content_merges(opt, &plist);
+	strmap_init(&opt->priv->content_merges);
+	run_content_merges(opt, &plist);
 	for (entry = &plist.items[plist.nr-1]; entry >= plist.items; --entry) {
 		char *path = entry->string;
 		/*
@@ -4336,6 +4559,7 @@ static int process_entries(struct merge_options *opt,
 		       opt->repo->hash_algo->rawsz) < 0)
 		ret = -1;
 cleanup:
+	free_content_merges(&opt->priv->content_merges);
 	string_list_clear(&plist, 0);
 	string_list_clear(&dir_metadata.versions, 0);
 	string_list_clear(&dir_metadata.offsets, 0);
@@ -4662,9 +4886,6 @@ void merge_switch_to_result(struct merge_options *opt,
 {
 	assert(opt->priv == NULL);
 	if (result->clean >= 0 && update_worktree_and_index) {
-		const char *filename;
-		FILE *fp;
-
 		trace2_region_enter("merge", "checkout", opt->repo);
 		if (checkout(opt, head, result->tree)) {
 			/* failure to function */
@@ -4690,10 +4911,17 @@ void merge_switch_to_result(struct merge_options *opt,
 		trace2_region_leave("merge", "record_conflicted", opt->repo);
 
 		trace2_region_enter("merge", "write_auto_merge", opt->repo);
-		filename = git_path_auto_merge(opt->repo);
-		fp = xfopen(filename, "w");
-		fprintf(fp, "%s\n", oid_to_hex(&result->tree->object.oid));
-		fclose(fp);
+		if (refs_update_ref(get_main_ref_store(opt->repo), "", "AUTO_MERGE",
+				    &result->tree->object.oid, NULL, REF_NO_DEREF,
+				    UPDATE_REFS_MSG_ON_ERR)) {
+			/* failure to function */
+			opt->priv = NULL;
+			result->clean = -1;
+			merge_finalize(opt, result);
+			trace2_region_leave("merge", "write_auto_merge",
+					    opt->repo);
+			return;
+		}
 		trace2_region_leave("merge", "write_auto_merge", opt->repo);
 	}
 	if (display_update_msgs)
@@ -5111,7 +5339,18 @@ void merge_incore_recursive(struct merge_options *opt,
 	assert(opt->ancestor == NULL);
 
 	trace2_region_enter("merge", "merge_start", opt->repo);
+	/*
+	 * The renames cached by a previous merge were found relative to
+	 * other trees than the ones this merge will compute; drop them,
+	 * and do not let a next merge reuse the ones found here either.
+	 */
+	if (result->priv) {
+		struct merge_options_internal *opti = result->priv;
+		opti->renames.cached_pairs_valid_side = 0;
+	}
 	merge_start(opt, result);
+	memset(opt->priv->renames.merge_trees, 0,
+	       sizeof(opt->priv->renames.merge_trees));
 	trace2_region_leave("merge", "merge_start", opt->repo);
 
 	merge_ort_internal(opt, merge_bases, side1, side2, result);
@@ -8,6 +8,7 @@
 #include "git-compat-util.h"
 #include "environment.h"
 #include "gettext.h"
+#include "mem-pool.h"
 #include "name-hash.h"
 #include "object.h"
 #include "read-cache-ll.h"
@@ -54,6 +55,22 @@ static struct dir_entry *find_dir_entry(struct index_state *istate,
 	return find_dir_entry__hash(istate, name, namelen, memihash(name, namelen));
 }
 
+/*
+ * Directory entries live as long as the name hash, so they are carved
+ * out of istate->dir_mem_pool (or, while the name hash is built by
+ * several threads, out of a pool of the thread that is combined into it
+ * later) and are all freed at once when the name hash is.
+ */
+static struct dir_entry *alloc_dir_entry(struct mem_pool *pool,
+					 const char *name, size_t namelen)
+{
+	struct dir_entry *dir;
+
+	dir = mem_pool_calloc(pool, 1, st_add3(sizeof(*dir), namelen, 1));
+	memcpy(dir->name, name, namelen);
+	return dir;
+}
+
 static struct dir_entry *hash_dir_entry(struct index_state *istate,
 		struct cache_entry *ce, int namelen)
 {
@@ -77,7 +94,7 @@ static struct dir_entry *hash_dir_entry(struct index_state *istate,
 	dir = find_dir_entry(istate, ce->name, namelen);
 	if (!dir) {
 		/* not found, create it and add to hash table */
-		FLEX_ALLOC_MEM(dir, name, ce->name, namelen);
+		dir = alloc_dir_entry(istate->dir_mem_pool, ce->name, namelen);
 		hashmap_entry_init(&dir->ent, memihash(ce->name, namelen));
 		dir->namelen = namelen;
 		hashmap_add(&istate->dir_hash, &dir->ent);
@@ -100,13 +117,13 @@ static void remove_dir_entry(struct index_state *istate, struct cache_entry *ce)
 {
 	/*
 	 * Release reference to the directory entry. If 0, remove and continue
-	 * with parent directory.
+	 * with parent directory. The memory of the entry stays in the pool
+	 * until the name hash is freed.
 	 */
 	struct dir_entry *dir = hash_dir_entry(istate, ce, ce_namelen(ce));
 	while (dir && !(--dir->nr)) {
 		struct dir_entry *parent = dir->parent;
 		hashmap_remove(&istate->dir_hash, &dir->ent, NULL);
-		free(dir);
 		dir = parent;
 	}
 }
@@ -270,6 +287,7 @@ static inline int compute_dir_lock_nr(
 
 static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
 	struct index_state *istate,
+	struct mem_pool *pool,
 	struct dir_entry *parent,
 	struct strbuf *prefix)
 {
@@ -295,7 +313,7 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
 
 	dir = find_dir_entry__hash(istate, prefix->buf, prefix->len, hash);
 	if (!dir) {
-		FLEX_ALLOC_MEM(dir, name, prefix->buf, prefix->len);
+		dir = alloc_dir_entry(pool, prefix->buf, prefix->len);
 		hashmap_entry_init(&dir->ent, hash);
 		dir->namelen = prefix->len;
 		dir->parent = parent;
@@ -325,6 +343,7 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
  */
 static int handle_range_1(
 	struct index_state *istate,
+	struct mem_pool *pool,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
@@ -333,6 +352,7 @@ static int handle_range_1(
 
 static int handle_range_dir(
 	struct index_state *istate,
+	struct mem_pool *pool,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
@@ -344,7 +364,7 @@ static int handle_range_dir(
 	int input_prefix_len = prefix->len;
 	struct dir_entry *dir_new;
 
-	dir_new = hash_dir_entry_with_parent_and_prefix(istate, parent, prefix);
+	dir_new = hash_dir_entry_with_parent_and_prefix(istate, pool, parent, prefix);
 
 	strbuf_addch(prefix, '/');
 
@@ -378,7 +398,8 @@ static int handle_range_dir(
 	/*
 	 * Recurse and process what we can of this subset [k_start, k).
 	 */
-	rc = handle_range_1(istate, k_start, k, dir_new, prefix, lazy_entries);
+	rc = handle_range_1(istate, pool, k_start, k, dir_new, prefix,
+			    lazy_entries);
 
 	strbuf_setlen(prefix, input_prefix_len);
 
@@ -388,6 +409,7 @@ static int handle_range_dir(
 
 static int handle_range_1(
 	struct index_state *istate,
+	struct mem_pool *pool,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
@@ -413,7 +435,8 @@ static int handle_range_1(
 			struct dir_entry *dir_new;
 
 			strbuf_add(prefix, name, len);
-			processed = handle_range_dir(istate, k, k_end, parent, prefix, lazy_entries, &dir_new);
+			processed = handle_range_dir(istate, pool, k, k_end, parent,
+						     prefix, lazy_entries, &dir_new);
 			if (processed) {
 				k += processed;
 				strbuf_setlen(prefix, input_prefix_len);
@@ -421,7 +444,8 @@ static int handle_range_1(
 			}
 
 			strbuf_addch(prefix, '/');
-			processed = handle_range_1(istate, k, k_end, dir_new, prefix, lazy_entries);
+			processed = handle_range_1(istate, pool, k, k_end, dir_new,
+						   prefix, lazy_entries);
 			k += processed;
 			strbuf_setlen(prefix, input_prefix_len);
 			continue;
@@ -460,6 +484,7 @@ static int handle_range_1(
 struct lazy_dir_thread_data {
 	pthread_t pthread;
 	struct index_state *istate;
+	struct mem_pool pool;
 	struct lazy_entry *lazy_entries;
 	int k_start;
 	int k_end;
@@ -469,7 +494,8 @@ static void *lazy_dir_thread_proc(void *_data)
 {
 	struct lazy_dir_thread_data *d = _data;
 	struct strbuf prefix = STRBUF_INIT;
-	handle_range_1(d->istate, d->k_start, d->k_end, NULL, &prefix, d->lazy_entries);
+	handle_range_1(d->istate, &d->pool, d->k_start, d->k_end, NULL, &prefix,
+		       d->lazy_entries);
 	strbuf_release(&prefix);
 	return NULL;
 }
@@ -537,6 +563,7 @@ static void threaded_lazy_init_name_hash(
 	for (t = 0; t < lazy_nr_dir_threads; t++) {
 		struct lazy_dir_thread_data *td_dir_t = td_dir + t;
 		td_dir_t->istate = istate;
+		mem_pool_init(&td_dir_t->pool, 0);
 		td_dir_t->lazy_entries = lazy_entries;
 		td_dir_t->k_start = k_start;
 		k_start += nr_each;
@@ -551,6 +578,7 @@ static void threaded_lazy_init_name_hash(
 		struct lazy_dir_thread_data *td_dir_t = td_dir + t;
 		if (pthread_join(td_dir_t->pthread, NULL))
 			die("unable to join lazy_dir_thread");
+		mem_pool_combine(istate->dir_mem_pool, &td_dir_t->pool);
 	}
 
 	/*
@@ -582,15 +610,50 @@ static void threaded_lazy_init_name_hash(
 	free(lazy_entries);
 }
 
+static void init_dir_hash(struct index_state *istate, size_t initial_size)
+{
+	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, initial_size);
+	istate->dir_mem_pool = xmalloc(sizeof(*istate->dir_mem_pool));
+	mem_pool_init(istate->dir_mem_pool, 0);
+}
+
+static void free_dir_hash(struct index_state *istate)
+{
+	hashmap_clear(&istate->dir_hash);
+	if (istate->dir_mem_pool) {
+		mem_pool_discard(istate->dir_mem_pool, 0);
+		FREE_AND_NULL(istate->dir_mem_pool);
+	}
+}
+
+/*
+ * Drop what the lookups of a partial name hash have hashed, so that it
+ * can be built in full.
+ */
+static void clear_partial_name_hash(struct index_state *istate)
+{
+	int nr;
+
+	trace2_data_intmax("index", istate->repo, "name-hash/partial-visited",
+			   istate->name_hash_visited);
+	for (nr = 0; nr < istate->cache_nr; nr++)
+		istate->cache[nr]->ce_flags &= ~CE_HASHED;
+	hashmap_clear(&istate->name_hash);
+	free_dir_hash(istate);
+	istate->name_hash_partial = 0;
+}
+
 static void lazy_init_name_hash(struct index_state *istate)
 {
 
-	if (istate->name_hash_initialized)
+	if (istate->name_hash_initialized && !istate->name_hash_partial)
 		return;
 	trace_performance_enter();
 	trace2_region_enter("index", "name-hash-init", istate->repo);
+	if (istate->name_hash_partial)
+		clear_partial_name_hash(istate);
 	hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, istate->cache_nr);
-	hashmap_init(&istate->dir_hash, dir_entry_cmp, NULL, istate->cache_nr);
+	init_dir_hash(istate, istate->cache_nr);
 
 	if (lookup_lazy_params(istate)) {
 		/*
@@ -632,9 +695,118 @@ int test_lazy_init_name_hash(struct index_state *istate, int try_threaded)
 	return lazy_nr_dir_threads;
 }
 
+/*
+ * Return the end of the range of entries in istate->cache[lo..hi) that
+ * start with the first "prefixlen" bytes of the name of istate->cache[lo].
+ */
+static int dir_range_end(struct index_state *istate, int lo, int hi,
+			 int prefixlen)
+{
+	const char *prefix = istate->cache[lo]->name;
+
+	lo++;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		const struct cache_entry *ce = istate->cache[mid];
+
+		if (ce_namelen(ce) >= prefixlen &&
+		    !memcmp(ce->name, prefix, prefixlen))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Hash the entries in istate->cache[lo..hi), whose names all start with
+ * the first "len" bytes of "name" ignoring case, that "name" can match
+ * ignoring case. The children of each directory are walked in index
+ * order, skipping over the subdirectories that do not match. Hashing
+ * one entry of a directory adds the directory to "dir_hash", so that is
+ * all that is done for the directories leading to "name", and for
+ * "name" itself if "want_dir" is set.
+ */
+static void partial_hash_range(struct index_state *istate, int lo, int hi,
+			       const char *name, int len, int namelen,
+			       int want_dir)
+{
+	const char *comp = name + len;
+	const char *slash = memchr(comp, '/', namelen - len);
+	int complen = slash ? slash - comp : namelen - len;
+
+	while (lo < hi) {
+		struct cache_entry *ce = istate->cache[lo];
+		const char *child = ce->name + len;
+		const char *end = strchr(child, '/');
+		int childlen = end ? end - child : ce_namelen(ce) - len;
+		int next = end ? dir_range_end(istate, lo, hi, end + 1 - ce->name)
+			       : lo + 1;
+
+		istate->name_hash_visited++;
+		if (childlen == complen && !strncasecmp(child, comp, complen)) {
+			if (end) {
+				hash_index_entry(istate, ce);
+				if (slash)
+					partial_hash_range(istate, lo, next, name,
+							   slash + 1 - name,
+							   namelen, want_dir);
+			} else if (!slash && !want_dir) {
+				hash_index_entry(istate, ce);
+			}
+		}
+		lo = next;
+	}
+}
+
+/*
+ * A command may look up only a handful of paths, so the name hash starts
+ * out empty and each lookup first hashes the entries it can match, found
+ * by binary search in the sorted index. Once the lookups have visited
+ * half as many entries as the index has, the name hash is built in full,
+ * which then makes every lookup a plain hash lookup.
+ *
+ * The partial name hash is changed by lookups, so unlike the full one it
+ * must not be looked up from several threads at once, and it relies on
+ * the index being sorted when it is looked up.
+ */
+static void lazy_hash_name(struct index_state *istate, const char *name,
+			   int namelen, int icase, int want_dir)
+{
+	if (!istate->name_hash_initialized) {
+		hashmap_init(&istate->name_hash, cache_entry_cmp, NULL, 0);
+		init_dir_hash(istate, 0);
+		istate->name_hash_initialized = 1;
+		istate->name_hash_partial = 1;
+		istate->name_hash_visited = 0;
+	}
+	if (!istate->name_hash_partial)
+		return;
+
+	if (istate->name_hash_visited > istate->cache_nr / 2) {
+		lazy_init_name_hash(istate);
+	} else if (icase || want_dir) {
+		partial_hash_range(istate, 0, istate->cache_nr,
+				   name, 0, namelen, want_dir);
+	} else {
+		int pos = index_name_pos_sparse(istate, name, namelen);
+
+		for (pos = pos < 0 ? -pos - 1 : pos; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (ce_namelen(ce) != namelen ||
+			    memcmp(ce->name, name, namelen))
+				break;
+			hash_index_entry(istate, ce);
+		}
+		istate->name_hash_visited++;
+	}
+}
+
 void add_name_hash(struct index_state *istate, struct cache_entry *ce)
 {
-	if (istate->name_hash_initialized)
+	/* a partial name hash hashes the entries when they are looked up */
+	if (istate->name_hash_initialized && !istate->name_hash_partial)
 		hash_index_entry(istate, ce);
 }
 
@@ -689,8 +861,8 @@ int index_dir_exists(struct index_state *istate, const char *name, int namelen)
 {
 	struct dir_entry *dir;
 
-	lazy_init_name_hash(istate);
 	expand_to_path(istate, name, namelen, 0);
+	lazy_hash_name(istate, name, namelen, 1, 1);
 	dir = find_dir_entry(istate, name, namelen);
 	return dir && dir->nr;
 }
@@ -699,9 +871,11 @@ void adjust_dirname_case(struct index_state *istate, char *name)
 {
 	const char *startPtr = name;
 	const char *ptr = startPtr;
+	const char *last_slash = strrchr(name, '/');
 
-	lazy_init_name_hash(istate);
 	expand_to_path(istate, name, strlen(name), 0);
+	if (last_slash)
+		lazy_hash_name(istate, name, last_slash - name, 1, 1);
 	while (*ptr) {
 		while (*ptr && *ptr != '/')
 			ptr++;
@@ -724,8 +898,8 @@ struct cache_entry *index_file_exists(struct index_state *istate, const char *na
 	struct cache_entry *ce;
 	unsigned int hash = memihash(name, namelen);
 
-	lazy_init_name_hash(istate);
 	expand_to_path(istate, name, namelen, icase);
+	lazy_hash_name(istate, name, namelen, icase, 0);
 
 	ce = hashmap_get_entry_from_hash(&istate->name_hash, hash, NULL,
 					 struct cache_entry, ent);
@@ -741,7 +915,8 @@ void free_name_hash(struct index_state *istate)
 	if (!istate->name_hash_initialized)
 		return;
 	istate->name_hash_initialized = 0;
+	istate->name_hash_partial = 0;
 
 	hashmap_clear(&istate->name_hash);
-	hashmap_clear_and_free(&istate->dir_hash, struct dir_entry, ent);
+	free_dir_hash(istate);
 }
@@ -0,0 +1,263 @@
+#include "git-compat-util.h"
+#include "generation.h"
+#include "../commit.h"
+#include "../commit-slab.h"
+#include "../fetch-negotiator.h"
+#include "../hex.h"
+#include "../prio-queue.h"
+#include "../refs.h"
+#include "../repository.h"
+#include "../tag.h"
+
+/*
+ * Like the skipping negotiator, this one sends fewer and fewer haves
+ * the further it goes back in history, but it only follows first
+ * parents, which it takes from the commit-graph where there is one.
+ * The commits that it skips over thus cost little, even across years
+ * of history.
+ *
+ * Each tip starts a chain that sends the commits 1, 2, 4, 8, ...
+ * first-parent steps apart, and the chain with the highest generation
+ * goes first. When the server acknowledges a have, the stretch between
+ * it and the previous have of its chain is searched again in the same
+ * way, which narrows down the common history like a binary search.
+ */
+
+/* Remember to update object flag allocation in object.h */
+/*
+ * Both us and the server know that both parties have this commit.
+ */
+#define COMMON		(1U << 2)
+/*
+ * A chain went over this commit on its way to the next one to send.
+ */
+#define SEEN		(1U << 3)
+/*
+ * This commit was sent as a "have".
+ */
+#define SENT		(1U << 4)
+
+#define MAX_STEP	(1U << 30)
+
+static int marked;
+
+struct chain {
+	/* The commit to send next. */
+	struct commit *commit;
+	/* The commit sent before it, if any. */
+	struct commit *last_sent;
+	/* The number of first-parent steps to the commit after it. */
+	unsigned int step;
+	/*
+	 * Whether the chain searches a stretch between two haves of
+	 * another chain, which it must go over again.
+	 */
+	unsigned refine : 1;
+	/*
+	 * Whether the commit is one that the server advertised, which is
+	 * sent by itself without going any further.
+	 */
+	unsigned advertised : 1;
+};
+
+/* For each commit sent, the one sent before it by the same chain. */
+define_commit_slab(previous_have, struct commit *);
+
+struct data {
+	struct prio_queue chains;
+	struct previous_have previous;
+};
+
+static int compare(const void *a_, const void *b_, void *data UNUSED)
+{
+	const struct chain *a = a_;
+	const struct chain *b = b_;
+	return compare_commits_by_gen_then_commit_date(a->commit, b->commit,
+						       NULL);
+}
+
+static struct chain *add_chain(struct data *data, struct commit *commit,
+			       struct commit *last_sent, int refine)
+{
+	struct chain *chain;
+
+	CALLOC_ARRAY(chain, 1);
+	chain->commit = commit;
+	chain->last_sent = last_sent;
+	chain->step = 1;
+	chain->refine = refine;
+	prio_queue_put(&data->chains, chain);
+	return chain;
+}
+
+static int clear_marks(const char *refname, const struct object_id *oid,
+		       int flag UNUSED,
+		       void *cb_data UNUSED)
+{
+	struct object *o = deref_tag(the_repository, parse_object(the_repository, oid), refname, 0);
+
+	if (o && o->type == OBJ_COMMIT)
+		clear_commit_marks((struct commit *)o, COMMON | SEEN | SENT);
+	return 0;
+}
+
+/*
+ * Move the chain its step along first parents. Return 0 if it ends,
+ * because it ran into common history or into history that another
+ * chain covers. Roots are never skipped over.
+ */
+static int advance(struct chain *chain)
+{
+	struct commit *c = chain->commit;
+	unsigned int i;
+
+	for (i = 0; i < chain->step; i++) {
+		struct commit *parent;
+
+		if (repo_parse_commit(the_repository, c) || !c->parents)
+			break;
+		parent = c->parents->item;
+		if ((parent->object.flags & COMMON) ||
+		    (!chain->refine && (parent->object.flags & SEEN)))
+			return 0;
+		parent->object.flags |= SEEN;
+		c = parent;
+	}
+	if (c == chain->commit || repo_parse_commit(the_repository, c))
+		return 0;
+
+	chain->commit = c;
+	if (chain->step < MAX_STEP)
+		chain->step *= 2;
+	return 1;
+}
+
+static const struct object_id *get_rev(struct data *data)
+{
+	struct chain *chain;
+
+	while ((chain = prio_queue_get(&data->chains))) {
+		struct commit *commit = chain->commit;
+
+		if (chain->advertised) {
+			free(chain);
+			if (commit->object.flags & SENT)
+				continue;
+			commit->object.flags |= SENT;
+			return &commit->object.oid;
+		}
+
+		/*
+		 * A tip that another chain went over is covered by it, like
+		 * the ones of tags on the history of a branch.
+		 */
+		if ((commit->object.flags & (COMMON | SENT)) ||
+		    (!chain->last_sent && !chain->refine &&
+		     (commit->object.flags & SEEN))) {
+			free(chain);
+			continue;
+		}
+
+		commit->object.flags |= SENT;
+		*previous_have_at(&data->previous, commit) = chain->last_sent;
+		chain->last_sent = commit;
+		if (advance(chain))
+			prio_queue_put(&data->chains, chain);
+		else
+			free(chain);
+		return &commit->object.oid;
+	}
+	return NULL;
+}
+
+/*
+ * Mark the commits that chains went over below this common one as
+ * common, too, which ends the chains on them.
+ */
+static void mark_common(struct commit *c)
+{
+	while (c && !(c->object.flags & COMMON)) {
+		c->object.flags |= COMMON;
+		if (!c->object.parsed || !c->parents ||
+		    !(c->parents->item->object.flags & SEEN))
+			break;
+		c = c->parents->item;
+	}
+}
+
+static void known_common(struct fetch_negotiator *n, struct commit *c)
+{
+	if (c->object.flags & SEEN)
+		return;
+	c->object.flags |= SEEN;
+	mark_common(c);
+	add_chain(n->data, c, NULL, 0)->advertised = 1;
+}
+
+static void add_tip(struct fetch_negotiator *n, struct commit *c)
+{
+	n->known_common = NULL;
+	if (c->object.flags & (SEEN | COMMON | SENT))
+		return;
+	add_chain(n->data, c, NULL, 0);
+}
+
+static const struct object_id *next(struct fetch_negotiator *n)
+{
+	n->known_common = NULL;
+	n->add_tip = NULL;
+	return get_rev(n->data);
+}
+
+static int ack(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+	int known_to_be_common = !!(c->object.flags & COMMON);
+	struct commit *previous;
+
+	if (!(c->object.flags & SENT))
+		die("received ack for commit %s not sent as 'have'\n",
+		    oid_to_hex(&c->object.oid));
+	mark_common(c);
+
+	/*
+	 * The common history starts somewhere between this commit and the
+	 * have sent before it, which we did not hear back about (yet).
+	 */
+	previous = *previous_have_at(&data->previous, c);
+	if (!known_to_be_common && previous &&
+	    !(previous->object.flags & COMMON) &&
+	    previous->parents && previous->parents->item != c &&
+	    !(previous->parents->item->object.flags & (COMMON | SENT)))
+		add_chain(data, previous->parents->item, previous, 1);
+	return known_to_be_common;
+}
+
+static void release(struct fetch_negotiator *n)
+{
+	struct data *data = n->data;
+	struct chain *chain;
+
+	while ((chain = prio_queue_get(&data->chains)))
+		free(chain);
+	clear_prio_queue(&data->chains);
+	clear_previous_have(&data->previous);
+	FREE_AND_NULL(n->data);
+}
+
+void generation_negotiator_init(struct fetch_negotiator *negotiator)
+{
+	struct data *data;
+	negotiator->known_common = known_common;
+	negotiator->add_tip = add_tip;
+	negotiator->next = next;
+	negotiator->ack = ack;
+	negotiator->release = release;
+	negotiator->data = CALLOC_ARRAY(data, 1);
+	data->chains.compare = compare;
+	init_previous_have(&data->previous);
+
+	if (marked)
+		for_each_ref(clear_marks, NULL);
+	marked = 1;
+}
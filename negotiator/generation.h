@@ -0,0 +1,8 @@
+#ifndef NEGOTIATOR_GENERATION_H
+#define NEGOTIATOR_GENERATION_H
+
+struct fetch_negotiator;
+
+void generation_negotiator_init(struct fetch_negotiator *negotiator);
+
+#endif
@@ -0,0 +1,353 @@
+#include "git-compat-util.h"
+#include "csum-file.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "hash-lookup.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "notes-index.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "oid-array.h"
+#include "path.h"
+#include "pathspec.h"
+#include "repository.h"
+#include "trace2.h"
+#include "tree.h"
+
+#define NOTES_INDEX_SIGNATURE 0x4e494458 /* "NIDX" */
+#define NOTES_INDEX_VERSION 1
+#define NOTES_INDEX_HEADER_SIZE 16
+#define NOTES_INDEX_FANOUT_SIZE (4 * 256)
+
+struct notes_index {
+	const unsigned char *data;
+	size_t data_len;
+
+	struct object_id tree;
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *keys;
+	const unsigned char *values;
+
+	/*
+	 * The note ids handed out by notes_index_lookup(), so that they
+	 * stay valid like those of a notes tree do. Allocated (but not
+	 * touched) for all notes up-front.
+	 */
+	struct object_id *oids;
+};
+
+struct note_entry {
+	struct object_id key;
+	struct object_id val;
+};
+
+struct note_entries {
+	struct note_entry *e;
+	size_t nr, alloc;
+};
+
+static void add_entry(struct note_entries *entries,
+		      const struct object_id *key, const struct object_id *val)
+{
+	ALLOC_GROW(entries->e, entries->nr + 1, entries->alloc);
+	oidcpy(&entries->e[entries->nr].key, key);
+	oidcpy(&entries->e[entries->nr].val, val);
+	entries->nr++;
+}
+
+static int note_entry_cmp(const void *a, const void *b)
+{
+	return oidcmp(&((const struct note_entry *)a)->key,
+		      &((const struct note_entry *)b)->key);
+}
+
+static void notes_index_path(struct strbuf *path, const char *ref)
+{
+	struct object_id oid;
+
+	/* name the file after the ref, without nesting directories */
+	hash_object_file(the_hash_algo, ref, strlen(ref), OBJ_BLOB, &oid);
+	strbuf_git_common_path(path, the_repository, "notes-index/%s",
+			       oid_to_hex(&oid));
+}
+
+static struct notes_index *open_index(const char *path)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct notes_index *index;
+	const unsigned char *data;
+	struct stat st;
+	size_t len;
+	uint32_t nr;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) ||
+	    st.st_size < NOTES_INDEX_HEADER_SIZE + hashsz +
+			 NOTES_INDEX_FANOUT_SIZE + hashsz) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr = get_be32(data + 12);
+	if (get_be32(data) != NOTES_INDEX_SIGNATURE ||
+	    get_be32(data + 4) != NOTES_INDEX_VERSION ||
+	    get_be32(data + 8) != hash_algo_by_ptr(the_hash_algo) ||
+	    len != NOTES_INDEX_HEADER_SIZE + hashsz + NOTES_INDEX_FANOUT_SIZE +
+		   st_mult(2 * hashsz, nr) + hashsz) {
+		munmap((void *)data, len);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(index, 1);
+	index->data = data;
+	index->data_len = len;
+	oidread(&index->tree, data + NOTES_INDEX_HEADER_SIZE);
+	index->nr = nr;
+	index->fanout = data + NOTES_INDEX_HEADER_SIZE + hashsz;
+	index->keys = index->fanout + NOTES_INDEX_FANOUT_SIZE;
+	index->values = index->keys + st_mult(hashsz, nr);
+	CALLOC_ARRAY(index->oids, nr);
+	return index;
+}
+
+void notes_index_free(struct notes_index *index)
+{
+	if (!index)
+		return;
+	munmap((void *)index->data, index->data_len);
+	free(index->oids);
+	free(index);
+}
+
+const struct object_id *notes_index_tree(struct notes_index *index)
+{
+	return &index->tree;
+}
+
+const struct object_id *notes_index_lookup(struct notes_index *index,
+					   const struct object_id *oid)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	uint32_t pos;
+
+	if (!bsearch_hash(oid->hash, (const uint32_t *)index->fanout,
+			  index->keys, hashsz, &pos))
+		return NULL;
+	if (is_null_oid(&index->oids[pos]))
+		oidread(&index->oids[pos], index->values + st_mult(hashsz, pos));
+	return &index->oids[pos];
+}
+
+/*
+ * Parse the path of a notes tree entry into the object it annotates,
+ * following the same rules as notes.c: every leading directory must be
+ * a fanout directory named by two hex digits, and the whole path without
+ * the slashes must spell an object id. Anything else is a non-note.
+ */
+static int parse_note_path(const char *base, size_t base_len,
+			   const char *name, struct object_id *oid)
+{
+	char hex[GIT_MAX_HEXSZ + 1];
+	size_t i, len = 0;
+
+	if (base_len % 3)
+		return -1;
+	for (i = 0; i < base_len; i += 3) {
+		if (base[i + 2] != '/')
+			return -1;
+		hex[len++] = base[i];
+		hex[len++] = base[i + 1];
+	}
+	if (len + strlen(name) != the_hash_algo->hexsz)
+		return -1;
+	memcpy(hex + len, name, the_hash_algo->hexsz - len + 1);
+	return get_oid_hex(hex, oid);
+}
+
+static int parse_note_full_path(const char *path, struct object_id *oid)
+{
+	const char *slash = strrchr(path, '/');
+	const char *name = slash ? slash + 1 : path;
+
+	return parse_note_path(path, name - path, name, oid);
+}
+
+static int is_fanout_dir(const char *name)
+{
+	return strlen(name) == 2 && isxdigit(name[0]) && isxdigit(name[1]);
+}
+
+static int collect_note(const struct object_id *oid, struct strbuf *base,
+			const char *name, unsigned mode, void *data)
+{
+	struct note_entries *entries = data;
+	struct object_id key;
+
+	if (!parse_note_path(base->buf, base->len, name, &key)) {
+		add_entry(entries, &key, oid);
+		return 0;
+	}
+	if (S_ISDIR(mode) && is_fanout_dir(name))
+		return READ_TREE_RECURSIVE;
+	return 0;
+}
+
+static int collect_tree(const struct object_id *tree_oid,
+			struct note_entries *entries)
+{
+	struct tree *tree = parse_tree_indirect(tree_oid);
+	struct pathspec pathspec = { 0 };
+
+	if (!tree)
+		return -1;
+	return read_tree(the_repository, tree, &pathspec, collect_note, entries);
+}
+
+/*
+ * Collect the notes of "tree_oid" by applying its differences from the
+ * tree that "index" describes to the notes in "index". Notes that move
+ * between fanout levels show up as a deletion and an addition of
+ * different paths, so all deletions are taken out before the additions
+ * are put in.
+ */
+static int collect_diff(struct notes_index *index,
+			const struct object_id *tree_oid,
+			struct note_entries *entries)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct oid_array removed = OID_ARRAY_INIT;
+	struct note_entries added = { 0 };
+	struct diff_options opt;
+	struct object_id key, val;
+	uint32_t i;
+
+	repo_diff_setup(the_repository, &opt);
+	opt.flags.recursive = 1;
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+	diff_tree_oid(&index->tree, tree_oid, "", &opt);
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+
+		if (DIFF_FILE_VALID(p->one) &&
+		    !parse_note_full_path(p->one->path, &key))
+			oid_array_append(&removed, &key);
+		if (DIFF_FILE_VALID(p->two) &&
+		    !parse_note_full_path(p->two->path, &key))
+			add_entry(&added, &key, &p->two->oid);
+	}
+	diff_flush(&opt);
+
+	for (i = 0; i < index->nr; i++) {
+		oidread(&key, index->keys + st_mult(hashsz, i));
+		if (oid_array_lookup(&removed, &key) >= 0)
+			continue;
+		oidread(&val, index->values + st_mult(hashsz, i));
+		add_entry(entries, &key, &val);
+	}
+	for (i = 0; i < added.nr; i++)
+		add_entry(entries, &added.e[i].key, &added.e[i].val);
+
+	oid_array_clear(&removed);
+	free(added.e);
+	return 0;
+}
+
+static int write_index(const char *path, const struct object_id *tree_oid,
+		       struct note_entries *entries)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct lock_file lk = LOCK_INIT;
+	uint32_t fanout[256] = { 0 };
+	struct hashfile *f;
+	size_t i;
+	int fd;
+
+	QSORT(entries->e, entries->nr, note_entry_cmp);
+	for (i = 1; i < entries->nr; i++)
+		/*
+		 * The same object is annotated at two fanout levels; let
+		 * notes.c combine them.
+		 */
+		if (oideq(&entries->e[i - 1].key, &entries->e[i].key))
+			return -1;
+	if (entries->nr > UINT32_MAX)
+		return -1;
+
+	if (safe_create_leading_directories_const(path))
+		return -1;
+	fd = hold_lock_file_for_update(&lk, path, 0);
+	if (fd < 0)
+		return -1;
+	f = hashfd(fd, get_lock_file_path(&lk));
+
+	hashwrite_be32(f, NOTES_INDEX_SIGNATURE);
+	hashwrite_be32(f, NOTES_INDEX_VERSION);
+	hashwrite_be32(f, hash_algo_by_ptr(the_hash_algo));
+	hashwrite_be32(f, entries->nr);
+	hashwrite(f, tree_oid->hash, hashsz);
+
+	for (i = 0; i < entries->nr; i++)
+		fanout[entries->e[i].key.hash[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+	for (i = 0; i < 256; i++)
+		hashwrite_be32(f, fanout[i]);
+
+	for (i = 0; i < entries->nr; i++)
+		hashwrite(f, entries->e[i].key.hash, hashsz);
+	for (i = 0; i < entries->nr; i++)
+		hashwrite(f, entries->e[i].val.hash, hashsz);
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+	return commit_lock_file(&lk);
+}
+
+struct notes_index *notes_index_load(const char *ref,
+				     const struct object_id *tree)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct note_entries entries = { 0 };
+	struct notes_index *index;
+	int ret;
+
+	notes_index_path(&path, ref);
+	index = open_index(path.buf);
+	if (index && oideq(&index->tree, tree))
+		goto done;
+
+	if (index && repo_has_object_file(the_repository, &index->tree)) {
+		trace2_region_enter("notes-index", "update", the_repository);
+		ret = collect_diff(index, tree, &entries);
+		trace2_region_leave("notes-index", "update", the_repository);
+	} else {
+		trace2_region_enter("notes-index", "build", the_repository);
+		ret = collect_tree(tree, &entries);
+		trace2_region_leave("notes-index", "build", the_repository);
+	}
+	notes_index_free(index);
+	index = NULL;
+
+	if (!ret && !write_index(path.buf, tree, &entries)) {
+		index = open_index(path.buf);
+		if (index && !oideq(&index->tree, tree)) {
+			/* somebody else got in between */
+			notes_index_free(index);
+			index = NULL;
+		}
+	}
+
+done:
+	free(entries.e);
+	strbuf_release(&path);
+	return index;
+}
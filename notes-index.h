@@ -0,0 +1,53 @@
+#ifndef NOTES_INDEX_H
+#define NOTES_INDEX_H
+
+struct object_id;
+
+/*
+ * A notes index is a flat, sorted table that maps annotated objects to
+ * their note blobs, for one notes ref. It is kept in
+ * "$GIT_COMMON_DIR/notes-index/" and records the notes tree that it was
+ * built from, so that looking up notes does not have to read the (often
+ * deeply fanned-out) notes tree at all.
+ *
+ * File format (all integers in network byte order):
+ *
+ *   4-byte signature "NIDX"
+ *   4-byte version (1)
+ *   4-byte hash function id (see `struct git_hash_algo`)
+ *   4-byte number of notes N
+ *   the id of the notes tree the index describes
+ *   256 4-byte fanout entries, the number of annotated objects whose
+ *     first byte is less than or equal to the index of the entry
+ *   N ids of annotated objects, sorted
+ *   N ids of note blobs, in the same order
+ *   checksum of all of the above
+ *
+ * Only notes tree entries that follow the notes naming conventions are
+ * in the index; non-notes are left out.
+ */
+struct notes_index;
+
+/*
+ * Return the index of the notes ref `ref`, brought up to date with the
+ * notes tree `tree` first if needed. The index is updated from the diff
+ * between the tree it was built from and `tree` if that tree is still
+ * around, and built from scratch otherwise.
+ *
+ * Returns NULL if the index cannot be built, read or written (e.g. when
+ * another process holds its lock), in which case the caller should read
+ * the notes tree instead.
+ */
+struct notes_index *notes_index_load(const char *ref,
+				     const struct object_id *tree);
+
+/* Return the note blob of `oid`, or NULL if it has no note. */
+const struct object_id *notes_index_lookup(struct notes_index *index,
+					   const struct object_id *oid);
+
+/* Return the id of the notes tree that the index describes. */
+const struct object_id *notes_index_tree(struct notes_index *index);
+
+void notes_index_free(struct notes_index *index);
+
+#endif
@@ -3,6 +3,7 @@
 #include "environment.h"
 #include "hex.h"
 #include "notes.h"
+#include "notes-index.h"
 #include "object-name.h"
 #include "object-store-ll.h"
 #include "blob.h"
@@ -1007,6 +1008,7 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	struct object_id oid, object_oid;
 	unsigned short mode;
 	struct leaf_node root_tree;
+	int use_index;
 
 	if (!t)
 		t = &default_notes_tree;
@@ -1037,11 +1039,36 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 		die("Failed to read notes tree referenced by %s (%s)",
 		    notes_ref, oid_to_hex(&object_oid));
 
+	if (flags & NOTES_INIT_INDEX && !(flags & NOTES_INIT_WRITABLE) &&
+	    !repo_config_get_bool(the_repository, "notes.index", &use_index) &&
+	    use_index && !read_ref(notes_ref, &object_oid)) {
+		t->index = notes_index_load(notes_ref, &oid);
+		if (t->index)
+			return;
+	}
+
 	oidclr(&root_tree.key_oid);
 	oidcpy(&root_tree.val_oid, &oid);
 	load_subtree(t, &root_tree, t->root, 0);
 }
 
+/*
+ * Read the notes tree that the index of "t" stands in for, for the
+ * operations that cannot be served by the index.
+ */
+static void drop_notes_index(struct notes_tree *t)
+{
+	struct leaf_node root_tree;
+
+	if (!t->index)
+		return;
+	oidclr(&root_tree.key_oid);
+	oidcpy(&root_tree.val_oid, notes_index_tree(t->index));
+	notes_index_free(t->index);
+	t->index = NULL;
+	load_subtree(t, &root_tree, t->root, 0);
+}
+
 struct notes_tree **load_notes_trees(struct string_list *refs, int flags)
 {
 	struct string_list_item *item;
@@ -1119,7 +1146,8 @@ void load_display_notes(struct display_notes_opt *opt)
 						     item->string);
 	}
 
-	display_notes_trees = load_notes_trees(&display_notes_refs, 0);
+	display_notes_trees = load_notes_trees(&display_notes_refs,
+					       NOTES_INIT_INDEX);
 	string_list_clear(&display_notes_refs, 0);
 }
 
@@ -1131,6 +1159,7 @@ int add_note(struct notes_tree *t, const struct object_id *object_oid,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	drop_notes_index(t);
 	t->dirty = 1;
 	if (!combine_notes)
 		combine_notes = t->combine_notes;
@@ -1147,6 +1176,7 @@ int remove_note(struct notes_tree *t, const unsigned char *object_sha1)
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	drop_notes_index(t);
 	oidread(&l.key_oid, object_sha1);
 	oidclr(&l.val_oid);
 	note_tree_remove(t, t->root, 0, &l);
@@ -1164,6 +1194,8 @@ const struct object_id *get_note(struct notes_tree *t,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	if (t->index)
+		return notes_index_lookup(t->index, oid);
 	found = note_tree_find(t, t->root, 0, oid->hash);
 	return found ? &found->val_oid : NULL;
 }
@@ -1174,6 +1206,7 @@ int for_each_note(struct notes_tree *t, int flags, each_note_fn fn,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	drop_notes_index(t);
 	return for_each_note_helper(t, t->root, 0, 0, flags, fn, cb_data);
 }
 
@@ -1187,6 +1220,7 @@ int write_notes_tree(struct notes_tree *t, struct object_id *result)
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	drop_notes_index(t);
 
 	/* Prepare for traversal of current notes tree */
 	root.next = NULL; /* last forward entry in list is grounded */
@@ -1233,6 +1267,7 @@ void free_notes(struct notes_tree *t)
 	if (t->root)
 		note_tree_free(t->root);
 	free(t->root);
+	notes_index_free(t->index);
 	while (t->first_non_note) {
 		t->prev_non_note = t->first_non_note->next;
 		free(t->first_non_note->path);
@@ -1328,8 +1363,14 @@ int copy_note(struct notes_tree *t,
 	      const struct object_id *from_obj, const struct object_id *to_obj,
 	      int force, combine_notes_fn combine_notes)
 {
-	const struct object_id *note = get_note(t, from_obj);
-	const struct object_id *existing_note = get_note(t, to_obj);
+	const struct object_id *note, *existing_note;
+
+	if (!t)
+		t = &default_notes_tree;
+	/* add_note() below would free what get_note() returns */
+	drop_notes_index(t);
+	note = get_note(t, from_obj);
+	existing_note = get_note(t, to_obj);
 
 	if (!force && existing_note)
 		return 1;
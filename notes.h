@@ -48,6 +48,8 @@ int combine_notes_cat_sort_uniq(struct object_id *cur_oid,
  * non-NULL value if you need to refer to several different notes trees
  * simultaneously.
  */
+struct notes_index;
+
 extern struct notes_tree {
 	struct int_node *root;
 	struct non_note *first_non_note, *prev_non_note;
@@ -56,6 +58,8 @@ extern struct notes_tree {
 	combine_notes_fn combine_notes;
 	int initialized;
 	int dirty;
+	/* if set, looked up in instead of the tree (see NOTES_INIT_INDEX) */
+	struct notes_index *index;
 } default_notes_tree;
 
 /*
@@ -87,6 +91,14 @@ const char *default_notes_ref(void);
  */
 #define NOTES_INIT_WRITABLE 2
 
+/*
+ * Look notes up in the notes index of the notes ref (see notes-index.h)
+ * instead of reading the notes tree, if "notes.index" is enabled. The
+ * notes tree is still read if it turns out to be needed, e.g. when notes
+ * are iterated over or modified.
+ */
+#define NOTES_INIT_INDEX 4
+
 /*
  * Initialize the given notes_tree with the notes tree structure at the given
  * ref. If given ref is NULL, the value of the $GIT_NOTES_REF environment
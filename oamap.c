@@ -0,0 +1,210 @@
+/*
+ * Open-addressing hash table with Robin Hood probing.
+ */
+#include "git-compat-util.h"
+#include "oamap.h"
+
+#define OAMAP_INITIAL_SIZE 16
+
+/*
+ * Robin Hood probing keeps the probe sequences short even when the
+ * table is quite full, so let it grow at 80% load only.
+ */
+#define OAMAP_LOAD_FACTOR 80
+
+/* grow by a factor of 4, like struct hashmap */
+#define OAMAP_RESIZE_BITS 2
+
+/*
+ * Linear probing suffers from clusters much more than chaining does, so
+ * mix the bits of hashes whose low bits are poor (e.g. those built from
+ * pointers and offsets) before picking a slot.
+ */
+static inline size_t home_slot(const struct oamap *map, unsigned int hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3b;
+	hash ^= hash >> 16;
+	return hash & (map->size - 1);
+}
+
+static void alloc_table(struct oamap *map, size_t size)
+{
+	map->size = size;
+	CALLOC_ARRAY(map->slots, size);
+}
+
+void oamap_init(struct oamap *map, oamap_cmp_fn cmpfn, const void *cmp_data,
+		size_t initial_size)
+{
+	size_t size = OAMAP_INITIAL_SIZE;
+
+	memset(map, 0, sizeof(*map));
+	map->cmpfn = cmpfn;
+	map->cmp_data = cmp_data;
+
+	if (!initial_size)
+		return;
+	initial_size = st_mult(initial_size, 100) / OAMAP_LOAD_FACTOR;
+	while (size <= initial_size)
+		size = st_mult(size, 2);
+	alloc_table(map, size);
+}
+
+void oamap_clear(struct oamap *map)
+{
+	FREE_AND_NULL(map->slots);
+	map->size = 0;
+	map->nr = 0;
+}
+
+/*
+ * Put "slot" into the table, starting at its "dist". Whenever it is
+ * farther away from its home slot than the entry that sits where it
+ * would go, the two swap places, and the displaced entry continues the
+ * search. The table must have a free slot.
+ */
+static void insert_slot(struct oamap *map, struct oamap_slot slot)
+{
+	size_t mask = map->size - 1;
+	size_t i = (home_slot(map, slot.hash) + slot.dist - 1) & mask;
+
+	for (;;) {
+		struct oamap_slot *cur = &map->slots[i];
+
+		if (!cur->dist) {
+			*cur = slot;
+			return;
+		}
+		if (cur->dist < slot.dist)
+			SWAP(*cur, slot);
+		i = (i + 1) & mask;
+		slot.dist++;
+	}
+}
+
+static void grow_table(struct oamap *map)
+{
+	struct oamap_slot *old_slots = map->slots;
+	size_t i, old_size = map->size;
+
+	alloc_table(map, old_size ? st_mult(old_size, 1 << OAMAP_RESIZE_BITS) :
+				    OAMAP_INITIAL_SIZE);
+	for (i = 0; i < old_size; i++) {
+		struct oamap_slot slot = old_slots[i];
+
+		if (!slot.dist)
+			continue;
+		slot.dist = 1;
+		insert_slot(map, slot);
+	}
+	free(old_slots);
+}
+
+/*
+ * Return the index of the slot that matches, or map->size if there is
+ * none. A slot matches if its entry is "key" itself when "by_entry" is
+ * set, or if the compare function says so otherwise.
+ */
+static size_t find_slot(const struct oamap *map, unsigned int hash,
+			const void *key, int by_entry)
+{
+	size_t mask = map->size - 1;
+	size_t i = home_slot(map, hash);
+	unsigned int dist;
+
+	if (!map->size)
+		return 0;
+
+	/*
+	 * An entry with our hash would have displaced any entry that is
+	 * closer to its home slot than we are to ours, so the search can
+	 * stop at the first such slot, or at an empty one.
+	 */
+	for (dist = 1; map->slots[i].dist >= dist; dist++) {
+		const struct oamap_slot *slot = &map->slots[i];
+
+		if (slot->hash == hash &&
+		    (by_entry ? slot->entry == key :
+		     !map->cmpfn(map->cmp_data, slot->entry, key)))
+			return i;
+		i = (i + 1) & mask;
+	}
+	return map->size;
+}
+
+void *oamap_get(const struct oamap *map, unsigned int hash, const void *key)
+{
+	size_t i = find_slot(map, hash, key, 0);
+
+	return i < map->size ? map->slots[i].entry : NULL;
+}
+
+void oamap_add(struct oamap *map, unsigned int hash, void *entry)
+{
+	struct oamap_slot slot = { .hash = hash, .dist = 1, .entry = entry };
+
+	if ((map->nr + 1) * 100 > map->size * OAMAP_LOAD_FACTOR)
+		grow_table(map);
+	insert_slot(map, slot);
+	map->nr++;
+}
+
+/*
+ * Empty slot "i" by shifting the entries that follow it back by one,
+ * up to the first one that is in its home slot already. This keeps the
+ * table in the state it would be in had the entry never been added, so
+ * that no tombstones are needed.
+ */
+static void *remove_slot(struct oamap *map, size_t i)
+{
+	size_t mask = map->size - 1;
+	void *entry = map->slots[i].entry;
+
+	for (;;) {
+		size_t next = (i + 1) & mask;
+
+		if (map->slots[next].dist <= 1)
+			break;
+		map->slots[i] = map->slots[next];
+		map->slots[i].dist--;
+		i = next;
+	}
+	memset(&map->slots[i], 0, sizeof(map->slots[i]));
+	map->nr--;
+	return entry;
+}
+
+void *oamap_remove(struct oamap *map, unsigned int hash, const void *key)
+{
+	size_t i = find_slot(map, hash, key, 0);
+
+	return i < map->size ? remove_slot(map, i) : NULL;
+}
+
+void *oamap_remove_entry(struct oamap *map, unsigned int hash,
+			 const void *entry)
+{
+	size_t i = find_slot(map, hash, entry, 1);
+
+	return i < map->size ? remove_slot(map, i) : NULL;
+}
+
+void oamap_iter_init(const struct oamap *map, struct oamap_iter *iter)
+{
+	iter->map = map;
+	iter->pos = 0;
+}
+
+void *oamap_iter_next(struct oamap_iter *iter)
+{
+	const struct oamap *map = iter->map;
+
+	while (iter->pos < map->size) {
+		const struct oamap_slot *slot = &map->slots[iter->pos++];
+
+		if (slot->dist)
+			return slot->entry;
+	}
+	return NULL;
+}
@@ -0,0 +1,138 @@
+#ifndef OAMAP_H
+#define OAMAP_H
+
+/*
+ * Generic implementation of an open-addressing hash table, for hot
+ * maps in which the pointer chasing of `struct hashmap` shows up in
+ * profiles.
+ *
+ * Unlike `struct hashmap`, the table does not chain entries through a
+ * `struct hashmap_entry` embedded in them. Instead, every slot of the
+ * table holds the hash of its entry next to a pointer to it, and
+ * collisions are resolved by Robin Hood linear probing. A lookup thus
+ * walks a short run of adjacent slots and only dereferences an entry
+ * whose hash matches the one that is looked for.
+ *
+ * Entries are owned by the caller; the map neither allocates nor frees
+ * them. As with `struct hashmap`, the caller supplies the hash of an
+ * entry, and a comparison function that tells whether an entry matches
+ * a key. Usage example:
+ *
+ * struct long2string {
+ *     long key;
+ *     char value[FLEX_ARRAY];
+ * };
+ *
+ * static int long2string_cmp(const void *cmp_data UNUSED,
+ *                            const void *entry, const void *key)
+ * {
+ *     const struct long2string *e = entry;
+ *     return e->key != *(const long *)key;
+ * }
+ *
+ * struct oamap map;
+ * struct long2string *e;
+ * long key = 42;
+ *
+ * oamap_init(&map, long2string_cmp, NULL, 0);
+ *
+ * FLEX_ALLOC_STR(e, value, "forty-two");
+ * e->key = key;
+ * oamap_add(&map, memihash(&key, sizeof(key)), e);
+ *
+ * e = oamap_get(&map, memihash(&key, sizeof(key)), &key);
+ *
+ * e = oamap_remove(&map, memihash(&key, sizeof(key)), &key);
+ * free(e);
+ *
+ * oamap_clear(&map);
+ */
+
+/*
+ * Compare an entry of the map with a key that is looked up. Returns 0
+ * if they are equal, non-zero otherwise. `cmp_data` is the pointer that
+ * was given to `oamap_init()`.
+ */
+typedef int (*oamap_cmp_fn)(const void *cmp_data, const void *entry,
+			    const void *key);
+
+struct oamap_slot {
+	unsigned int hash;
+	/* 1 + the distance from the home slot of the hash, 0 if unused */
+	unsigned int dist;
+	void *entry;
+};
+
+struct oamap {
+	struct oamap_slot *slots;
+	/* number of slots, always a power of two (or 0) */
+	size_t size;
+	/* number of entries */
+	size_t nr;
+	oamap_cmp_fn cmpfn;
+	const void *cmp_data;
+};
+
+#define OAMAP_INIT(fn, data) { .cmpfn = fn, .cmp_data = data }
+
+/*
+ * Initialize an empty map that compares entries with `cmpfn`. If
+ * `initial_size` is non-zero, room for that many entries is allocated
+ * up-front, so that adding them does not need to grow the table.
+ */
+void oamap_init(struct oamap *map, oamap_cmp_fn cmpfn, const void *cmp_data,
+		size_t initial_size);
+
+/*
+ * Free the table of the map, but not its entries (see
+ * `oamap_for_each_entry()` for a way to free them first). The map is
+ * left empty and can be reused.
+ */
+void oamap_clear(struct oamap *map);
+
+/*
+ * Return the entry that matches `key` and has the hash `hash`, or NULL
+ * if there is none.
+ */
+void *oamap_get(const struct oamap *map, unsigned int hash, const void *key);
+
+/*
+ * Add an entry with the hash `hash`. Like `hashmap_add()`, this does
+ * not check whether a matching entry is in the map already.
+ */
+void oamap_add(struct oamap *map, unsigned int hash, void *entry);
+
+/*
+ * Remove the entry that matches `key` and has the hash `hash` and
+ * return it, or return NULL if there is no such entry.
+ */
+void *oamap_remove(struct oamap *map, unsigned int hash, const void *key);
+
+/*
+ * Remove the entry `entry` itself, which has the hash `hash`. Returns
+ * `entry`, or NULL if it is not in the map.
+ */
+void *oamap_remove_entry(struct oamap *map, unsigned int hash,
+			 const void *entry);
+
+static inline size_t oamap_get_size(const struct oamap *map)
+{
+	return map->nr;
+}
+
+/*
+ * Iterate over the entries of a map, in no particular order. The map
+ * must not be modified while iterating.
+ */
+struct oamap_iter {
+	const struct oamap *map;
+	size_t pos;
+};
+
+void oamap_iter_init(const struct oamap *map, struct oamap_iter *iter);
+void *oamap_iter_next(struct oamap_iter *iter);
+
+#define oamap_for_each_entry(map, iter, var) \
+	for (oamap_iter_init(map, iter); ((var) = oamap_iter_next(iter)); )
+
+#endif
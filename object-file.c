@@ -9,6 +9,7 @@
 #include "git-compat-util.h"
 #include "abspath.h"
 #include "config.h"
+#include "copy.h"
 #include "convert.h"
 #include "environment.h"
 #include "gettext.h"
@@ -21,11 +22,17 @@
 #include "commit.h"
 #include "run-command.h"
 #include "tag.h"
+#include "tempfile.h"
+#include "thread-utils.h"
 #include "tree.h"
 #include "tree-walk.h"
 #include "refs.h"
+#include "oid-array.h"
+#include "oidmap.h"
 #include "pack-revindex.h"
 #include "hash-lookup.h"
+#include "loose-index.h"
+#include "tree-cache.h"
 #include "bulk-checkin.h"
 #include "repository.h"
 #include "replace-object.h"
@@ -43,6 +50,7 @@
 #include "setup.h"
 #include "submodule.h"
 #include "fsck.h"
+#include "trace2.h"
 
 /* The maximum size for an object header. */
 #define MAX_HEADER_LEN 32
@@ -1020,6 +1028,7 @@ int has_loose_object_nonlocal(const struct object_id *oid)
 
 int has_loose_object(const struct object_id *oid)
 {
+	trace2_counter_add(TRACE2_COUNTER_ID_LOOSE_OBJECT_LOOKUP, 1);
 	return check_and_freshen(oid, 0);
 }
 
@@ -1449,6 +1458,8 @@ static int loose_object_info(struct repository *r,
 	enum object_type type_scratch;
 	int allow_unknown = flags & OBJECT_INFO_ALLOW_UNKNOWN_TYPE;
 
+	trace2_counter_add(TRACE2_COUNTER_ID_LOOSE_OBJECT_LOOKUP, 1);
+
 	if (oi->delta_base_oid)
 		oidclr(oi->delta_base_oid);
 
@@ -1499,7 +1510,9 @@ static int loose_object_info(struct repository *r,
 
 		if (!oi->contentp)
 			break;
+		trace2_timer_start(TRACE2_TIMER_ID_INFLATE);
 		*oi->contentp = unpack_loose_rest(&stream, hdr, *oi->sizep, oid);
+		trace2_timer_stop(TRACE2_TIMER_ID_INFLATE);
 		if (*oi->contentp)
 			goto cleanup;
 
@@ -1541,6 +1554,7 @@ void enable_obj_read_lock(void)
 
 	obj_read_use_lock = 1;
 	init_recursive_mutex(&obj_read_mutex);
+	enable_delta_base_cache_lock();
 }
 
 void disable_obj_read_lock(void)
@@ -1550,10 +1564,194 @@ void disable_obj_read_lock(void)
 
 	obj_read_use_lock = 0;
 	pthread_mutex_destroy(&obj_read_mutex);
+	disable_delta_base_cache_lock();
 }
 
 int fetch_if_missing = 1;
 
+void odb_prefetch(struct repository *r, const struct oid_array *oids,
+		  unsigned flags)
+{
+	struct oid_array missing = OID_ARRAY_INIT;
+	struct pack_entry *entries = NULL;
+	size_t entries_nr = 0, entries_alloc = 0;
+	size_t i;
+
+	for (i = 0; i < oids->nr; i++) {
+		const struct object_id *oid = &oids->oid[i];
+		struct pack_entry e;
+
+		if (find_pack_entry(r, oid, &e)) {
+			if (flags & (ODB_PREFETCH_PACKED | ODB_PREFETCH_INFLATE)) {
+				ALLOC_GROW(entries, entries_nr + 1, entries_alloc);
+				entries[entries_nr++] = e;
+			}
+			continue;
+		}
+
+		if ((flags & ODB_PREFETCH_MISSING) &&
+		    oid_object_info_extended(r, oid, NULL,
+					     OBJECT_INFO_FOR_PREFETCH))
+			oid_array_append(&missing, oid);
+	}
+
+	if (missing.nr)
+		promisor_remote_get_direct(r, missing.oid, missing.nr);
+	if (entries_nr)
+		prefetch_pack_entries(r, entries, entries_nr,
+				      flags & ODB_PREFETCH_INFLATE);
+
+	oid_array_clear(&missing);
+	free(entries);
+}
+
+struct read_ahead_entry {
+	struct oidmap_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	unsigned refs;
+};
+
+void enable_read_ahead(struct repository *r)
+{
+	if (r->objects->read_ahead)
+		return;
+	CALLOC_ARRAY(r->objects->read_ahead, 1);
+	oidmap_init(r->objects->read_ahead, 0);
+}
+
+/* Take another reference to "oid" if it was read ahead already. */
+static unsigned long ref_read_ahead_object(struct repository *r,
+					   const struct object_id *oid,
+					   int *found)
+{
+	struct read_ahead_entry *e = NULL;
+	unsigned long size = 0;
+
+	obj_read_lock();
+	if (r->objects->read_ahead)
+		e = oidmap_get(r->objects->read_ahead, oid);
+	if (e) {
+		e->refs++;
+		size = e->size;
+	}
+	obj_read_unlock();
+	*found = !!e;
+	return size;
+}
+
+unsigned long read_ahead_object(struct repository *r,
+				const struct object_id *oid,
+				unsigned long max_size)
+{
+	const struct object_id *real = lookup_replace_object(r, oid);
+	struct object_info oi = OBJECT_INFO_INIT;
+	struct read_ahead_entry *e;
+	unsigned long size;
+	int found;
+
+	size = ref_read_ahead_object(r, real, &found);
+	if (found)
+		return size;
+
+	CALLOC_ARRAY(e, 1);
+	oidcpy(&e->entry.oid, real);
+	e->refs = 1;
+	oi.typep = &e->type;
+	oi.sizep = &e->size;
+	if (oid_object_info_extended(r, real, &oi,
+				     OBJECT_INFO_SKIP_FETCH_OBJECT |
+				     OBJECT_INFO_QUICK) < 0 ||
+	    e->size > max_size) {
+		free(e);
+		return 0;
+	}
+	oi.contentp = &e->buf;
+	if (oid_object_info_extended(r, real, &oi,
+				     OBJECT_INFO_SKIP_FETCH_OBJECT |
+				     OBJECT_INFO_QUICK) < 0) {
+		free(e);
+		return 0;
+	}
+	size = e->size;
+
+	/* Another thread may have read it in the meantime. */
+	obj_read_lock();
+	if (!r->objects->read_ahead) {
+		size = 0;
+	} else {
+		struct read_ahead_entry *other =
+			oidmap_get(r->objects->read_ahead, real);
+		if (other)
+			other->refs++;
+		else {
+			oidmap_put(r->objects->read_ahead, e);
+			e = NULL;
+		}
+	}
+	obj_read_unlock();
+	if (e) {
+		free(e->buf);
+		free(e);
+	}
+	return size;
+}
+
+void drop_read_ahead_object(struct repository *r, const struct object_id *oid)
+{
+	const struct object_id *real = lookup_replace_object(r, oid);
+	struct read_ahead_entry *e = NULL;
+
+	obj_read_lock();
+	if (r->objects->read_ahead)
+		e = oidmap_get(r->objects->read_ahead, real);
+	if (e && !--e->refs) {
+		oidmap_remove(r->objects->read_ahead, real);
+		free(e->buf);
+		free(e);
+	}
+	obj_read_unlock();
+}
+
+void disable_read_ahead(struct repository *r)
+{
+	struct oidmap_iter iter;
+	struct read_ahead_entry *e;
+
+	if (!r->objects->read_ahead)
+		return;
+	oidmap_iter_init(r->objects->read_ahead, &iter);
+	while ((e = oidmap_iter_next(&iter)))
+		free(e->buf);
+	oidmap_free(r->objects->read_ahead, 1);
+	FREE_AND_NULL(r->objects->read_ahead);
+}
+
+/* Answer from the contents read ahead for "oid", if any. */
+static int read_ahead_object_info(struct repository *r,
+				  const struct object_id *oid,
+				  struct object_info *oi)
+{
+	struct read_ahead_entry *e;
+
+	if (!r->objects->read_ahead ||
+	    oi->disk_sizep || oi->delta_base_oid || oi->type_name)
+		return -1;
+	e = oidmap_get(r->objects->read_ahead, oid);
+	if (!e)
+		return -1;
+
+	if (oi->typep)
+		*(oi->typep) = e->type;
+	if (oi->sizep)
+		*(oi->sizep) = e->size;
+	if (oi->contentp)
+		*oi->contentp = xmemdupz(e->buf, e->size);
+	oi->whence = OI_CACHED;
+	return 0;
+}
+
 static int do_oid_object_info_extended(struct repository *r,
 				       const struct object_id *oid,
 				       struct object_info *oi, unsigned flags)
@@ -1593,6 +1791,11 @@ static int do_oid_object_info_extended(struct repository *r,
 		return 0;
 	}
 
+	if (!read_ahead_object_info(r, real, oi))
+		return 0;
+	if (!bulk_checkin_object_info(r, real, oi))
+		return 0;
+
 	while (1) {
 		if (find_pack_entry(r, real, &e))
 			break;
@@ -1879,9 +2082,11 @@ static void close_loose_object(int fd, const char *filename)
 	if (the_repository->objects->odb->will_destroy)
 		goto out;
 
-	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT)) {
+		if (!fsync_and_close_loose_object_bulk_checkin(fd))
+			return;
 		fsync_loose_object_bulk_checkin(fd, filename);
-	else if (fsync_object_files > 0)
+	} else if (fsync_object_files > 0)
 		fsync_or_die(fd, filename);
 	else
 		fsync_component_or_die(FSYNC_COMPONENT_LOOSE_OBJECT, fd,
@@ -2223,6 +2428,9 @@ int write_object_file_flags(const void *buf, unsigned long len,
 				  &hdrlen);
 	if (freshen_packed_object(oid) || freshen_loose_object(oid))
 		return 0;
+	if ((flags & HASH_BULK_CHECKIN) &&
+	    !write_object_bulk_checkin(oid, buf, len, type))
+		return 0;
 	return write_loose_object(oid, hdr, hdrlen, buf, len, 0, flags);
 }
 
@@ -2385,6 +2593,51 @@ static int index_stream_convert_blob(struct index_state *istate,
 	return ret;
 }
 
+static int index_blob_stream(struct object_id *oid, int fd, size_t size,
+			     const char *path,
+			     unsigned flags);
+
+/*
+ * Large blobs coming from a pipe are spooled to a temporary file next
+ * to the object store once they grow beyond core.bigFileThreshold, so
+ * that they can be streamed into a pack by the bulk-checkin machinery
+ * instead of being held in core as a whole.
+ */
+static int index_pipe_spool(struct object_id *oid, int fd,
+			    struct strbuf *sbuf, const char *path,
+			    unsigned flags)
+{
+	struct strbuf tmp_path = STRBUF_INIT;
+	struct tempfile *tmp;
+	off_t size;
+	int ret;
+
+	strbuf_addf(&tmp_path, "%s/tmp_stdin_XXXXXX", get_object_directory());
+	tmp = xmks_tempfile(tmp_path.buf);
+	strbuf_release(&tmp_path);
+
+	if (write_in_full(get_tempfile_fd(tmp), sbuf->buf, sbuf->len) < 0 ||
+	    copy_fd(fd, get_tempfile_fd(tmp)) < 0) {
+		ret = error_errno(_("unable to spool '%s' to '%s'"),
+				  path ? path : "<stdin>",
+				  get_tempfile_path(tmp));
+		goto out;
+	}
+
+	size = lseek(get_tempfile_fd(tmp), 0, SEEK_CUR);
+	if (size < 0 || lseek(get_tempfile_fd(tmp), 0, SEEK_SET) < 0) {
+		ret = error_errno(_("unable to rewind '%s'"),
+				  get_tempfile_path(tmp));
+		goto out;
+	}
+
+	ret = index_blob_stream(oid, get_tempfile_fd(tmp), xsize_t(size),
+				get_tempfile_path(tmp), flags);
+out:
+	delete_tempfile(&tmp);
+	return ret;
+}
+
 static int index_pipe(struct index_state *istate, struct object_id *oid,
 		      int fd, enum object_type type,
 		      const char *path, unsigned flags)
@@ -2392,6 +2645,25 @@ static int index_pipe(struct index_state *istate, struct object_id *oid,
 	struct strbuf sbuf = STRBUF_INIT;
 	int ret;
 
+	if (type == OBJ_BLOB && !(path && would_convert_to_git(istate, path))) {
+		ssize_t len;
+
+		while ((len = strbuf_read_once(&sbuf, fd, 8192)) > 0)
+			if (sbuf.len > big_file_threshold) {
+				ret = index_pipe_spool(oid, fd, &sbuf, path,
+						       flags);
+				strbuf_release(&sbuf);
+				return ret;
+			}
+		if (len < 0)
+			ret = -1;
+		else
+			ret = index_mem(istate, oid, sbuf.buf, sbuf.len,
+					type, path, flags);
+		strbuf_release(&sbuf);
+		return ret;
+	}
+
 	if (strbuf_read(&sbuf, fd, 4096) >= 0)
 		ret = index_mem(istate, oid, sbuf.buf, sbuf.len, type, path, flags);
 	else
@@ -2537,6 +2809,31 @@ void assert_oid_type(const struct object_id *oid, enum object_type expect)
 		    type_name(expect));
 }
 
+/*
+ * Report the entry "name" of a loose object subdirectory to "obj_cb" or
+ * "cruft_cb". The caller sets up "oid->hash[0]" and the first "baselen"
+ * bytes of "path" (the subdirectory followed by a slash).
+ */
+static int handle_obj_subdir_entry(struct object_id *oid,
+				   struct strbuf *path, size_t baselen,
+				   const char *name,
+				   each_loose_object_fn obj_cb,
+				   each_loose_cruft_fn cruft_cb,
+				   void *data)
+{
+	size_t namelen = strlen(name);
+
+	strbuf_setlen(path, baselen);
+	strbuf_add(path, name, namelen);
+	if (namelen == the_hash_algo->hexsz - 2 &&
+	    !hex_to_bytes(oid->hash + 1, name, the_hash_algo->rawsz - 1)) {
+		oid_set_algo(oid, the_hash_algo);
+		return obj_cb ? obj_cb(oid, path->buf, data) : 0;
+	}
+
+	return cruft_cb ? cruft_cb(name, path->buf, data) : 0;
+}
+
 int for_each_file_in_obj_subdir(unsigned int subdir_nr,
 				struct strbuf *path,
 				each_loose_object_fn obj_cb,
@@ -2570,28 +2867,10 @@ int for_each_file_in_obj_subdir(unsigned int subdir_nr,
 	baselen = path->len;
 
 	while ((de = readdir_skip_dot_and_dotdot(dir))) {
-		size_t namelen;
-
-		namelen = strlen(de->d_name);
-		strbuf_setlen(path, baselen);
-		strbuf_add(path, de->d_name, namelen);
-		if (namelen == the_hash_algo->hexsz - 2 &&
-		    !hex_to_bytes(oid.hash + 1, de->d_name,
-				  the_hash_algo->rawsz - 1)) {
-			oid_set_algo(&oid, the_hash_algo);
-			if (obj_cb) {
-				r = obj_cb(&oid, path->buf, data);
-				if (r)
-					break;
-			}
-			continue;
-		}
-
-		if (cruft_cb) {
-			r = cruft_cb(de->d_name, path->buf, data);
-			if (r)
-				break;
-		}
+		r = handle_obj_subdir_entry(&oid, path, baselen, de->d_name,
+					    obj_cb, cruft_cb, data);
+		if (r)
+			break;
 	}
 	closedir(dir);
 
@@ -2640,6 +2919,156 @@ int for_each_loose_file_in_objdir(const char *path,
 	return r;
 }
 
+struct loose_subdir_listing {
+	struct string_list names;
+	int error;
+	unsigned done : 1;
+};
+
+struct parallel_objdir_walk {
+	const char *path;
+	struct loose_subdir_listing subdir[256];
+	unsigned int next;
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void *read_loose_subdirs(void *data)
+{
+	struct parallel_objdir_walk *walk = data;
+	struct strbuf path = STRBUF_INIT;
+
+	for (;;) {
+		struct loose_subdir_listing *l;
+		struct dirent *de;
+		unsigned int nr;
+		DIR *dir;
+
+		pthread_mutex_lock(&walk->mutex);
+		if (walk->stop || walk->next > 0xff) {
+			pthread_mutex_unlock(&walk->mutex);
+			break;
+		}
+		nr = walk->next++;
+		pthread_mutex_unlock(&walk->mutex);
+
+		l = &walk->subdir[nr];
+		strbuf_reset(&path);
+		strbuf_addstr(&path, walk->path);
+		strbuf_complete(&path, '/');
+		strbuf_addf(&path, "%02x", nr);
+
+		dir = opendir(path.buf);
+		if (dir) {
+			while ((de = readdir_skip_dot_and_dotdot(dir)))
+				string_list_append(&l->names, de->d_name);
+			closedir(dir);
+		} else if (errno != ENOENT) {
+			l->error = errno;
+		}
+
+		pthread_mutex_lock(&walk->mutex);
+		l->done = 1;
+		pthread_cond_broadcast(&walk->cond);
+		pthread_mutex_unlock(&walk->mutex);
+	}
+
+	strbuf_release(&path);
+	return NULL;
+}
+
+int for_each_loose_file_in_objdir_parallel(const char *path, int nr_threads,
+					   each_loose_object_fn obj_cb,
+					   each_loose_cruft_fn cruft_cb,
+					   each_loose_subdir_fn subdir_cb,
+					   void *data)
+{
+	struct parallel_objdir_walk *walk;
+	struct strbuf buf = STRBUF_INIT;
+	pthread_t *threads;
+	size_t origlen;
+	unsigned int nr;
+	int i, r = 0;
+
+	if (nr_threads > 256)
+		nr_threads = 256;
+	if (!HAVE_THREADS || nr_threads <= 1)
+		return for_each_loose_file_in_objdir(path, obj_cb, cruft_cb,
+						     subdir_cb, data);
+
+	CALLOC_ARRAY(walk, 1);
+	walk->path = path;
+	for (nr = 0; nr < 256; nr++)
+		string_list_init_dup(&walk->subdir[nr].names);
+	pthread_mutex_init(&walk->mutex, NULL);
+	pthread_cond_init(&walk->cond, NULL);
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL,
+					 read_loose_subdirs, walk);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	strbuf_addstr(&buf, path);
+	strbuf_complete(&buf, '/');
+	origlen = buf.len;
+
+	/*
+	 * The threads only read the directories; the callbacks are all
+	 * invoked from here, in the same order as the serial version.
+	 */
+	for (nr = 0; nr < 256 && !r; nr++) {
+		struct loose_subdir_listing *l = &walk->subdir[nr];
+		struct object_id oid;
+		size_t baselen;
+
+		pthread_mutex_lock(&walk->mutex);
+		while (!l->done)
+			pthread_cond_wait(&walk->cond, &walk->mutex);
+		pthread_mutex_unlock(&walk->mutex);
+
+		strbuf_setlen(&buf, origlen);
+		strbuf_addf(&buf, "%02x", nr);
+		if (l->error) {
+			errno = l->error;
+			r = error_errno(_("unable to open %s"), buf.buf);
+			break;
+		}
+
+		oid.hash[0] = nr;
+		strbuf_addch(&buf, '/');
+		baselen = buf.len;
+		for (i = 0; i < l->names.nr && !r; i++)
+			r = handle_obj_subdir_entry(&oid, &buf, baselen,
+						    l->names.items[i].string,
+						    obj_cb, cruft_cb, data);
+		string_list_clear(&l->names, 0);
+
+		strbuf_setlen(&buf, baselen - 1);
+		if (!r && subdir_cb)
+			r = subdir_cb(nr, buf.buf, data);
+	}
+
+	pthread_mutex_lock(&walk->mutex);
+	walk->stop = 1;
+	pthread_mutex_unlock(&walk->mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (nr = 0; nr < 256; nr++)
+		string_list_clear(&walk->subdir[nr].names, 0);
+	pthread_cond_destroy(&walk->cond);
+	pthread_mutex_destroy(&walk->mutex);
+	free(threads);
+	free(walk);
+	strbuf_release(&buf);
+
+	return r;
+}
+
 int for_each_loose_object(each_loose_object_fn cb, void *data,
 			  enum for_each_object_flags flags)
 {
@@ -2647,8 +3076,16 @@ int for_each_loose_object(each_loose_object_fn cb, void *data,
 
 	prepare_alt_odb(the_repository);
 	for (odb = the_repository->objects->odb; odb; odb = odb->next) {
-		int r = for_each_loose_file_in_objdir(odb->path, cb, NULL,
-						      NULL, data);
+		struct loose_index *li = odb_loose_index(odb);
+		int r;
+
+		if (li) {
+			r = loose_index_for_each(li, odb, cb, data);
+			loose_index_write(li, odb);
+		} else {
+			r = for_each_loose_file_in_objdir(odb->path, cb, NULL,
+							  NULL, data);
+		}
 		if (r)
 			return r;
 
@@ -2676,6 +3113,7 @@ struct oidtree *odb_loose_cache(struct object_directory *odb,
 	size_t word_index = subdir_nr / word_bits;
 	size_t mask = (size_t)1u << (subdir_nr % word_bits);
 	uint32_t *bitmap;
+	struct loose_index *li;
 
 	if (subdir_nr < 0 ||
 	    subdir_nr >= bitsizeof(odb->loose_objects_subdir_seen))
@@ -2688,11 +3126,18 @@ struct oidtree *odb_loose_cache(struct object_directory *odb,
 		ALLOC_ARRAY(odb->loose_objects_cache, 1);
 		oidtree_init(odb->loose_objects_cache);
 	}
-	strbuf_addstr(&buf, odb->path);
-	for_each_file_in_obj_subdir(subdir_nr, &buf,
-				    append_loose_object,
-				    NULL, NULL,
-				    odb->loose_objects_cache);
+	li = odb_loose_index(odb);
+	if (li) {
+		loose_index_for_each_in_subdir(li, odb, subdir_nr,
+					       append_loose_object,
+					       odb->loose_objects_cache);
+	} else {
+		strbuf_addstr(&buf, odb->path);
+		for_each_file_in_obj_subdir(subdir_nr, &buf,
+					    append_loose_object,
+					    NULL, NULL,
+					    odb->loose_objects_cache);
+	}
 	*bitmap |= mask;
 	strbuf_release(&buf);
 	return odb->loose_objects_cache;
@@ -2704,6 +3149,12 @@ void odb_clear_loose_cache(struct object_directory *odb)
 	FREE_AND_NULL(odb->loose_objects_cache);
 	memset(&odb->loose_objects_subdir_seen, 0,
 	       sizeof(odb->loose_objects_subdir_seen));
+	loose_index_free(odb->loose_index);
+	odb->loose_index = NULL;
+	odb->loose_index_checked = 0;
+	tree_cache_free(odb->tree_cache);
+	odb->tree_cache = NULL;
+	odb->tree_cache_checked = 0;
 }
 
 static int check_stream_oid(git_zstream *stream,
@@ -18,6 +18,11 @@ extern int fetch_if_missing;
 #define HASH_FORMAT_CHECK 2
 #define HASH_RENORMALIZE  4
 #define HASH_SILENT 8
+/*
+ * Let write_object_file_flags() write to the packfile of the current ODB
+ * transaction, if there is one, instead of writing a loose object.
+ */
+#define HASH_BULK_CHECKIN 16
 int index_fd(struct index_state *istate, struct object_id *oid, int fd, struct stat *st, enum object_type type, const char *path, unsigned flags);
 int index_path(struct index_state *istate, struct object_id *oid, const char *path, struct stat *st, unsigned flags);
 
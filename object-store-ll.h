@@ -7,10 +7,20 @@
 #include "thread-utils.h"
 #include "oidset.h"
 
+struct oid_array;
 struct oidmap;
 struct oidtree;
 struct strbuf;
 
+/*
+ * The modification and change times of a file or directory, zero if it
+ * is missing; see reprepare_packed_git().
+ */
+struct odb_path_times {
+	uint64_t mtime_sec, ctime_sec;
+	uint32_t mtime_nsec, ctime_nsec;
+};
+
 struct object_directory {
 	struct object_directory *next;
 
@@ -26,6 +36,30 @@ struct object_directory {
 	uint32_t loose_objects_subdir_seen[8]; /* 256 bits */
 	struct oidtree *loose_objects_cache;
 
+	/*
+	 * The on-disk list of loose objects, if core.looseObjectIndex is
+	 * enabled; see loose-index.h. Use odb_loose_index() to access it.
+	 */
+	struct loose_index *loose_index;
+	unsigned loose_index_checked : 1;
+
+	/*
+	 * The uncompressed contents of the trees reachable from the
+	 * commit-graph, if written; see tree-cache.h. Use odb_tree_cache()
+	 * to access it.
+	 */
+	struct tree_cache *tree_cache;
+	unsigned tree_cache_checked : 1;
+
+	/*
+	 * The times of "pack/" and "info/alternates" as of when
+	 * prepare_packed_git() last read them, so that a later
+	 * reprepare_packed_git() can tell whether there is anything new to
+	 * read.
+	 */
+	struct odb_path_times pack_dir_times, alternates_times;
+	unsigned packs_prepared : 1;
+
 	/*
 	 * This is a temporary object store created by the tmp_objdir
 	 * facility. Disable ref updates since the objects in the store
@@ -119,7 +153,9 @@ struct packed_git {
 		 do_not_close:1,
 		 pack_promisor:1,
 		 multi_pack_index:1,
-		 is_cruft:1;
+		 is_cruft:1,
+		 deltas_checked:1,
+		 access_pattern:2;
 	unsigned char hash[GIT_MAX_RAWSZ];
 	struct revindex_entry *revindex;
 	const uint32_t *revindex_data;
@@ -132,6 +168,12 @@ struct packed_git {
 	 */
 	const uint32_t *mtimes_map;
 	size_t mtimes_size;
+	/*
+	 * Likewise for the .deltas file, if any. "deltas_checked" says
+	 * whether we already tried to load it.
+	 */
+	const unsigned char *deltas_map;
+	size_t deltas_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
@@ -182,6 +224,13 @@ struct raw_object_store {
 	struct commit_graph *commit_graph;
 	unsigned commit_graph_attempted : 1; /* if loading has been attempted */
 
+	/*
+	 * Contents of objects read ahead by other threads, which the next
+	 * read of each object takes over; see read_ahead_object(). Only
+	 * accessed with the object read lock held.
+	 */
+	struct oidmap *read_ahead;
+
 	/*
 	 * private data
 	 *
@@ -223,6 +272,9 @@ struct raw_object_store {
 	 * packs.
 	 */
 	unsigned packed_git_initialized : 1;
+
+	/* When packed_git was last populated, see odb_path_times. */
+	time_t packed_git_prepared_at;
 };
 
 struct raw_object_store *raw_object_store_new(void);
@@ -341,6 +393,52 @@ int oid_object_info_extended(struct repository *r,
 			     const struct object_id *,
 			     struct object_info *, unsigned flags);
 
+/* Fetch objects missing locally from the promisor remotes (if any). */
+#define ODB_PREFETCH_MISSING (1 << 0)
+/* Start reading objects that live in local packs, in pack order. */
+#define ODB_PREFETCH_PACKED (1 << 1)
+/*
+ * Like ODB_PREFETCH_PACKED, but also unpack the packed objects, so that
+ * their delta bases are in the delta base cache by the time the caller
+ * reads them.
+ */
+#define ODB_PREFETCH_INFLATE (1 << 2)
+
+/*
+ * Announce that the caller is about to read all of "oids". Depending on
+ * "flags", objects that are missing are fetched in a single batch from
+ * the promisor remotes, and those found in local packs are read ahead in
+ * pack order, so that the subsequent reads do not have to go to the
+ * network or do random I/O one object at a time.
+ *
+ * This is purely an optimization: errors are not reported, and objects
+ * that cannot be found anywhere are silently skipped.
+ */
+void odb_prefetch(struct repository *r, const struct oid_array *oids,
+		  unsigned flags);
+
+/*
+ * Between enable_read_ahead() and disable_read_ahead(), threads may read
+ * the contents of objects the main thread is about to read with
+ * read_ahead_object(). The reads of these objects then get a copy of
+ * these contents instead of inflating the objects again. The object read
+ * lock must be enabled (see enable_obj_read_lock()) while other threads
+ * call read_ahead_object().
+ *
+ * read_ahead_object() takes a reference to the contents of the object,
+ * reading them if nobody holds one yet, and returns their size, or 0 if
+ * it did not take a reference, because the object is missing or is
+ * larger than "max_size". drop_read_ahead_object() releases such a
+ * reference, and the contents are freed when the last one is released.
+ * disable_read_ahead() frees everything.
+ */
+void enable_read_ahead(struct repository *r);
+unsigned long read_ahead_object(struct repository *r,
+				const struct object_id *oid,
+				unsigned long max_size);
+void drop_read_ahead_object(struct repository *r, const struct object_id *oid);
+void disable_read_ahead(struct repository *r);
+
 /*
  * Open the loose object at path, check its hash, and return the contents,
  * use the "oi" argument to assert things about the object, or e.g. populate its
@@ -409,12 +507,12 @@ void assert_oid_type(const struct object_id *oid, enum object_type expect);
  * obj_read_lock() and obj_read_unlock() may also be used to protect other
  * section which cannot execute in parallel with object reading. Since the used
  * lock is a recursive mutex, these sections can even contain calls to object
- * reading functions. However, beware that in these cases zlib inflation won't
- * be performed in parallel, losing performance.
+ * reading functions. However, beware that in these cases zlib inflation and
+ * delta application won't be performed in parallel, losing performance.
  *
  * TODO: oid_object_info_extended()'s call stack has a recursive behavior. If
  * any of its callees end up calling it, this recursive call won't benefit from
- * parallel inflation.
+ * parallel inflation or delta application.
  */
 void enable_obj_read_lock(void);
 void disable_obj_read_lock(void);
@@ -482,6 +580,17 @@ int for_each_loose_file_in_objdir_buf(struct strbuf *path,
 				      each_loose_subdir_fn subdir_cb,
 				      void *data);
 
+/*
+ * Like for_each_loose_file_in_objdir(), but read the subdirectories using
+ * up to "nr_threads" threads. The callbacks are still invoked from the
+ * calling thread and in the same order, so they need not be thread-safe.
+ */
+int for_each_loose_file_in_objdir_parallel(const char *path, int nr_threads,
+					   each_loose_object_fn obj_cb,
+					   each_loose_cruft_fn cruft_cb,
+					   each_loose_subdir_fn subdir_cb,
+					   void *data);
+
 /* Flags for for_each_*_object() below. */
 enum for_each_object_flags {
 	/* Iterate only over local objects, not alternates. */
@@ -500,6 +609,12 @@ enum for_each_object_flags {
 
 	/* Only iterate over packs that do not have .keep files. */
 	FOR_EACH_OBJECT_SKIP_ON_DISK_KEPT_PACKS = (1<<4),
+
+	/*
+	 * Only iterate over packs not covered by a multi-pack-index, e.g.
+	 * because the caller walks the multi-pack-index itself.
+	 */
+	FOR_EACH_OBJECT_SKIP_MIDX_PACKS = (1<<5),
 };
 
 /*
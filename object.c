@@ -13,6 +13,7 @@
 #include "alloc.h"
 #include "packfile.h"
 #include "commit-graph.h"
+#include "trace2.h"
 
 unsigned int get_max_object_index(void)
 {
@@ -21,7 +22,7 @@ unsigned int get_max_object_index(void)
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return the_repository->parsed_objects->obj_hash[idx];
+	return the_repository->parsed_objects->obj_hash[idx].obj;
 }
 
 static const char *object_type_strings[] = {
@@ -68,20 +69,22 @@ static unsigned int hash_obj(const struct object_id *oid, unsigned int n)
 }
 
 /*
- * Insert obj into the hash table hash, which has length size (which
- * must be a power of 2).  On collisions, simply overflow to the next
- * empty bucket.
+ * Insert obj, whose name hashes to "h", into the hash table hash, which
+ * has length size (which must be a power of 2).  On collisions, simply
+ * overflow to the next empty bucket.
  */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static void insert_obj_hash(struct object *obj, unsigned int h,
+			    struct obj_hash_slot *hash, unsigned int size)
 {
-	unsigned int j = hash_obj(&obj->oid, size);
+	unsigned int j = h & (size - 1);
 
-	while (hash[j]) {
+	while (hash[j].obj) {
 		j++;
 		if (j >= size)
 			j = 0;
 	}
-	hash[j] = obj;
+	hash[j].obj = obj;
+	hash[j].hash = h;
 }
 
 /*
@@ -90,32 +93,45 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid)
 {
-	unsigned int i, first;
+	struct obj_hash_slot *hash = r->parsed_objects->obj_hash;
+	unsigned int i, first, h;
 	struct object *obj;
 
-	if (!r->parsed_objects->obj_hash)
+	if (!hash)
 		return NULL;
 
-	first = i = hash_obj(oid, r->parsed_objects->obj_hash_size);
-	while ((obj = r->parsed_objects->obj_hash[i]) != NULL) {
-		if (oideq(oid, &obj->oid))
+	h = oidhash(oid);
+	first = i = h & (r->parsed_objects->obj_hash_size - 1);
+	while ((obj = hash[i].obj) != NULL) {
+		if (hash[i].hash == h && oideq(oid, &obj->oid))
 			break;
 		i++;
 		if (i == r->parsed_objects->obj_hash_size)
 			i = 0;
 	}
+	if (i != first)
+		trace2_counter_add(TRACE2_COUNTER_ID_LOOKUP_OBJECT_PROBES,
+				   (i - first) & (r->parsed_objects->obj_hash_size - 1));
 	if (obj && i != first) {
 		/*
 		 * Move object to where we started to look for it so
 		 * that we do not need to walk the hash table the next
 		 * time we look for it.
 		 */
-		SWAP(r->parsed_objects->obj_hash[i],
-		     r->parsed_objects->obj_hash[first]);
+		SWAP(hash[i], hash[first]);
 	}
 	return obj;
 }
 
+void prefetch_object(struct repository *r, const struct object_id *oid)
+{
+#ifdef __GNUC__
+	if (r->parsed_objects->obj_hash)
+		__builtin_prefetch(&r->parsed_objects->obj_hash[
+			hash_obj(oid, r->parsed_objects->obj_hash_size)]);
+#endif
+}
+
 /*
  * Increase the size of the hash map stored in obj_hash to the next
  * power of 2 (but at least 32).  Copy the existing values to the new
@@ -129,15 +145,15 @@ static void grow_object_hash(struct repository *r)
 	 * above.
 	 */
 	int new_hash_size = r->parsed_objects->obj_hash_size < 32 ? 32 : 2 * r->parsed_objects->obj_hash_size;
-	struct object **new_hash;
+	struct obj_hash_slot *new_hash;
 
 	CALLOC_ARRAY(new_hash, new_hash_size);
 	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
+		struct obj_hash_slot *slot = &r->parsed_objects->obj_hash[i];
 
-		if (!obj)
+		if (!slot->obj)
 			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
+		insert_obj_hash(slot->obj, slot->hash, new_hash, new_hash_size);
 	}
 	free(r->parsed_objects->obj_hash);
 	r->parsed_objects->obj_hash = new_hash;
@@ -152,10 +168,14 @@ void *create_object(struct repository *r, const struct object_id *oid, void *o)
 	obj->flags = 0;
 	oidcpy(&obj->oid, oid);
 
-	if (r->parsed_objects->obj_hash_size - 1 <= r->parsed_objects->nr_objs * 2)
+	/*
+	 * As probing compares the hashes in the slots first, the table
+	 * can be kept fuller than half without loading many objects.
+	 */
+	if (r->parsed_objects->nr_objs + 1 >= r->parsed_objects->obj_hash_size / 4 * 3)
 		grow_object_hash(r);
 
-	insert_obj_hash(obj, r->parsed_objects->obj_hash,
+	insert_obj_hash(obj, oidhash(oid), r->parsed_objects->obj_hash,
 			r->parsed_objects->obj_hash_size);
 	r->parsed_objects->nr_objs++;
 	return obj;
@@ -489,7 +509,7 @@ void clear_object_flags(unsigned flags)
 	int i;
 
 	for (i=0; i < the_repository->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = the_repository->parsed_objects->obj_hash[i];
+		struct object *obj = the_repository->parsed_objects->obj_hash[i].obj;
 		if (obj)
 			obj->flags &= ~flags;
 	}
@@ -500,7 +520,7 @@ void repo_clear_commit_marks(struct repository *r, unsigned int flags)
 	int i;
 
 	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
-		struct object *obj = r->parsed_objects->obj_hash[i];
+		struct object *obj = r->parsed_objects->obj_hash[i].obj;
 		if (obj && obj->type == OBJ_COMMIT)
 			obj->flags &= ~flags;
 	}
@@ -591,7 +611,7 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 	unsigned i;
 
 	for (i = 0; i < o->obj_hash_size; i++) {
-		struct object *obj = o->obj_hash[i];
+		struct object *obj = o->obj_hash[i].obj;
 
 		if (!obj)
 			continue;
@@ -6,8 +6,18 @@
 struct buffer_slab;
 struct repository;
 
+/*
+ * A slot of the object hash table. Next to the object, it keeps the hash
+ * of its name, so that probing past the other objects in a run of
+ * occupied slots need not load them from memory to compare their names.
+ */
+struct obj_hash_slot {
+	struct object *obj;
+	unsigned int hash;
+};
+
 struct parsed_object_pool {
-	struct object **obj_hash;
+	struct obj_hash_slot *obj_hash;
 	int nr_objs, obj_hash_size;
 
 	/* TODO: migrate alloc_states to mem-pool? */
@@ -65,10 +75,11 @@ void object_array_init(struct object_array *array);
  * revision.h:               0---------10         15             23------27
  * fetch-pack.c:             01    67
  * negotiator/default.c:       2--5
+ * negotiator/generation.c:    2-4
  * walker.c:                 0-2
  * upload-pack.c:                4       11-----14  16-----19
  * builtin/blame.c:                        12-13
- * bisect.c:                                        16
+ * bisect.c:                                        16-18
  * bundle.c:                                        16
  * http-push.c:                          11-----14
  * commit-graph.c:                                15
@@ -186,6 +197,13 @@ struct object *get_indexed_object(unsigned int);
  */
 struct object *lookup_object(struct repository *r, const struct object_id *oid);
 
+/*
+ * Hint that lookup_object() is about to be called for "oid", so that the
+ * slot of the hash table it starts at can be loaded from memory while the
+ * caller does something else, e.g. looks up the entries before it.
+ */
+void prefetch_object(struct repository *r, const struct object_id *oid);
+
 void *create_object(struct repository *r, const struct object_id *oid, void *obj);
 
 void *object_as_type(struct object *obj, enum object_type type, int quiet);
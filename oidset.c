@@ -1,5 +1,6 @@
 #include "git-compat-util.h"
 #include "oidset.h"
+#include "hash-lookup.h"
 #include "hex.h"
 #include "strbuf.h"
 
@@ -43,8 +44,10 @@ void oidset_parse_file(struct oidset *set, const char *path)
 	oidset_parse_file_carefully(set, path, NULL, NULL);
 }
 
-void oidset_parse_file_carefully(struct oidset *set, const char *path,
-				 oidset_parse_tweak_fn fn, void *cbdata)
+static void parse_oid_file(const char *path, oidset_parse_tweak_fn fn,
+			   void *cbdata,
+			   void (*add)(void *, const struct object_id *),
+			   void *set)
 {
 	FILE *fp;
 	struct strbuf sb = STRBUF_INIT;
@@ -73,10 +76,94 @@ void oidset_parse_file_carefully(struct oidset *set, const char *path,
 			die("invalid object name: %s", sb.buf);
 		if (fn && fn(&oid, cbdata))
 			continue;
-		oidset_insert(set, &oid);
+		add(set, &oid);
 	}
 	if (ferror(fp))
 		die_errno("Could not read '%s'", path);
 	fclose(fp);
 	strbuf_release(&sb);
 }
+
+static void add_to_oidset(void *set, const struct object_id *oid)
+{
+	oidset_insert(set, oid);
+}
+
+void oidset_parse_file_carefully(struct oidset *set, const char *path,
+				 oidset_parse_tweak_fn fn, void *cbdata)
+{
+	parse_oid_file(path, fn, cbdata, add_to_oidset, set);
+}
+
+void oidset_sorted_append(struct oidset_sorted *set,
+			  const struct object_id *oid)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+
+	ALLOC_GROW(set->hashes, st_mult(set->nr + 1, rawsz), set->alloc);
+	memcpy(set->hashes + set->nr * rawsz, oid->hash, rawsz);
+	set->nr++;
+	set->sealed = 0;
+}
+
+static int hash_cmp(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+void oidset_sorted_seal(struct oidset_sorted *set)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	size_t i, nr = 0;
+	uint32_t count[256] = { 0 }, total = 0;
+
+	if (set->nr > UINT32_MAX)
+		die("too many object names in sorted oidset");
+
+	sane_qsort(set->hashes, set->nr, rawsz, hash_cmp);
+	for (i = 0; i < set->nr; i++) {
+		const unsigned char *hash = set->hashes + i * rawsz;
+
+		if (nr && hasheq(hash, set->hashes + (nr - 1) * rawsz))
+			continue;
+		if (nr != i)
+			memcpy(set->hashes + nr * rawsz, hash, rawsz);
+		count[hash[0]]++;
+		nr++;
+	}
+	set->nr = nr;
+
+	for (i = 0; i < 256; i++) {
+		total += count[i];
+		set->fanout[i] = htonl(total);
+	}
+	set->sealed = 1;
+}
+
+int oidset_sorted_contains(const struct oidset_sorted *set,
+			   const struct object_id *oid)
+{
+	if (!set->nr)
+		return 0;
+	if (!set->sealed)
+		BUG("lookup in a sorted oidset that is not sealed");
+	return bsearch_hash(oid->hash, set->fanout, set->hashes,
+			    the_hash_algo->rawsz, NULL);
+}
+
+void oidset_sorted_clear(struct oidset_sorted *set)
+{
+	free(set->hashes);
+	memset(set, 0, sizeof(*set));
+}
+
+static void add_to_oidset_sorted(void *set, const struct object_id *oid)
+{
+	oidset_sorted_append(set, oid);
+}
+
+void oidset_sorted_parse_file(struct oidset_sorted *set, const char *path)
+{
+	parse_oid_file(path, NULL, NULL, add_to_oidset_sorted, set);
+	oidset_sorted_seal(set);
+}
@@ -113,4 +113,52 @@ static inline struct object_id *oidset_iter_first(struct oidset *set,
 	return oidset_iter_next(iter);
 }
 
+/**
+ * A sorted oidset is a read-only set for big lists that are built once
+ * and then only looked up, like fsck.skipList. It stores nothing but the
+ * raw hashes, at `the_hash_algo->rawsz` bytes each, in one sorted array
+ * with a fanout table like that of a pack index. A lookup reads the
+ * fanout entry for the first byte of the hash and bisects the few slots
+ * that it points to.
+ *
+ * Add oids with `oidset_sorted_append()` (or parse them from a file),
+ * then call `oidset_sorted_seal()` before looking any of them up. Adding
+ * more oids after that requires sealing the set again.
+ */
+struct oidset_sorted {
+	unsigned char *hashes;
+	size_t nr, alloc;
+	uint32_t fanout[256]; /* in network byte order */
+	unsigned sealed : 1;
+};
+
+#define OIDSET_SORTED_INIT { 0 }
+
+void oidset_sorted_append(struct oidset_sorted *set,
+			  const struct object_id *oid);
+
+/**
+ * Sort the set, drop duplicates and build the fanout table.
+ */
+void oidset_sorted_seal(struct oidset_sorted *set);
+
+/**
+ * Returns true iff `set` contains `oid`. The set must be sealed.
+ */
+int oidset_sorted_contains(const struct oidset_sorted *set,
+			   const struct object_id *oid);
+
+static inline size_t oidset_sorted_size(const struct oidset_sorted *set)
+{
+	return set->nr;
+}
+
+void oidset_sorted_clear(struct oidset_sorted *set);
+
+/**
+ * Like `oidset_parse_file()`, but adds to a sorted oidset, which is
+ * sealed afterwards.
+ */
+void oidset_sorted_parse_file(struct oidset_sorted *set, const char *path);
+
 #endif /* OIDSET_H */
@@ -1,4 +1,5 @@
 #include "git-compat-util.h"
+#include "config.h"
 #include "environment.h"
 #include "gettext.h"
 #include "hex.h"
@@ -20,6 +21,9 @@
 #include "trace2.h"
 #include "tree.h"
 #include "tree-walk.h"
+#include "oidset.h"
+#include "refs.h"
+#include "wildmatch.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -45,6 +49,18 @@ struct bitmap_writer {
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
+
+	/* of the hashes in to_pack, or 0 to take the one of the old bitmap */
+	int name_hash_version;
+
+	/* to build the bitmaps with, or 0 to use "pack.threads" */
+	int threads;
+
+	/* subtrees shared by the commits, see fill_tree_bitmap() */
+	struct tree_bitmap_cache tree_cache;
+
+	struct pseudo_merge *pseudo_merges;
+	size_t pseudo_merges_nr, pseudo_merges_alloc;
 };
 
 static struct bitmap_writer writer;
@@ -54,6 +70,16 @@ void bitmap_writer_show_progress(int show)
 	writer.show_progress = show;
 }
 
+void bitmap_writer_set_name_hash_version(int version)
+{
+	writer.name_hash_version = version;
+}
+
+void bitmap_writer_set_threads(int threads)
+{
+	writer.threads = threads;
+}
+
 /**
  * Build the initial type index for the packfile or multi-pack-index
  */
@@ -149,11 +175,20 @@ static uint32_t find_object_pos(const struct object_id *oid, int *found)
 	return oe_in_pack_pos(writer.to_pack, entry);
 }
 
-static void compute_xor_offsets(void)
+/*
+ * Reading a bitmap that is stored as an XOR against another one means
+ * reading (and XORing) its whole chain of bases first. Bitmaps are not
+ * XORed against bases that are already "max_depth" deep, so that no
+ * chain is longer than that; a negative "max_depth" means no limit.
+ */
+static void compute_xor_offsets(int max_depth)
 {
 	static const int MAX_XOR_OFFSET_SEARCH = 10;
 
 	int i, next = 0;
+	int *depth;
+
+	CALLOC_ARRAY(depth, writer.selected_nr);
 
 	while (next < writer.selected_nr) {
 		struct bitmapped_commit *stored = &writer.selected[next];
@@ -167,6 +202,8 @@ static void compute_xor_offsets(void)
 
 			if (curr < 0)
 				break;
+			if (max_depth >= 0 && depth[curr] >= max_depth)
+				continue;
 
 			test_xor = ewah_pool_new();
 			ewah_xor(writer.selected[curr].bitmap, stored->bitmap, test_xor);
@@ -184,9 +221,13 @@ static void compute_xor_offsets(void)
 
 		stored->xor_offset = best_offset;
 		stored->write_as = best_bitmap;
+		if (best_offset)
+			depth[next] = depth[next - best_offset] + 1;
 
 		next++;
 	}
+
+	free(depth);
 }
 
 struct bb_commit {
@@ -196,6 +237,7 @@ struct bb_commit {
 	unsigned selected:1,
 		 maximal:1;
 	unsigned idx; /* within selected array */
+	unsigned pending; /* parents still to be built, with threads */
 };
 
 define_commit_slab(bb_data, struct bb_commit);
@@ -344,55 +386,23 @@ static void bitmap_builder_clear(struct bitmap_builder *bb)
 	bb->commits_nr = bb->commits_alloc = 0;
 }
 
-static int fill_bitmap_tree(struct bitmap *bitmap,
-			    struct tree *tree)
+static int tree_bitmap_pos(const struct object_id *oid, void *data UNUSED)
 {
 	int found;
-	uint32_t pos;
-	struct tree_desc desc;
-	struct name_entry entry;
+	uint32_t pos = find_object_pos(oid, &found);
 
-	/*
-	 * If our bit is already set, then there is nothing to do. Both this
-	 * tree and all of its children will be set.
-	 */
-	pos = find_object_pos(&tree->object.oid, &found);
-	if (!found)
-		return -1;
-	if (bitmap_get(bitmap, pos))
-		return 0;
-	bitmap_set(bitmap, pos);
-
-	if (parse_tree(tree) < 0)
-		die("unable to load tree object %s",
-		    oid_to_hex(&tree->object.oid));
-	init_tree_desc(&desc, tree->buffer, tree->size);
-
-	while (tree_entry(&desc, &entry)) {
-		switch (object_type(entry.mode)) {
-		case OBJ_TREE:
-			if (fill_bitmap_tree(bitmap,
-					     lookup_tree(the_repository, &entry.oid)) < 0)
-				return -1;
-			break;
-		case OBJ_BLOB:
-			pos = find_object_pos(&entry.oid, &found);
-			if (!found)
-				return -1;
-			bitmap_set(bitmap, pos);
-			break;
-		default:
-			/* Gitlink, etc; not reachable */
-			break;
-		}
-	}
-
-	free_tree_buffer(tree);
-	return 0;
+	return found ? (int)pos : -1;
 }
 
 static int reused_bitmaps_nr;
 
+/*
+ * How many of the first positions of the existing bitmap are the same in
+ * the one being written. With a MIDX whose preferred pack did not change,
+ * these are all the objects of that pack, which usually is most of them.
+ */
+static uint32_t mapping_identical;
+
 static int fill_bitmap_commit(struct bb_commit *ent,
 			      struct commit *commit,
 			      struct prio_queue *queue,
@@ -410,19 +420,27 @@ static int fill_bitmap_commit(struct bb_commit *ent,
 	while (queue->nr) {
 		struct commit_list *p;
 		struct commit *c = prio_queue_get(queue);
+		struct tree *tree;
 
 		if (old_bitmap && mapping) {
-			struct ewah_bitmap *old = bitmap_for_commit(old_bitmap, c);
+			struct ewah_bitmap *old;
 			struct bitmap *remapped = bitmap_new();
+
+			obj_read_lock();
+			old = bitmap_for_commit(old_bitmap, c);
+			obj_read_unlock();
 			/*
 			 * If this commit has an old bitmap, then translate that
 			 * bitmap and add its bits to this one. No need to walk
 			 * parents or the tree for this commit.
 			 */
-			if (old && !rebuild_bitmap(mapping, old, remapped)) {
+			if (old && !rebuild_bitmap(mapping, mapping_identical,
+						   old, remapped)) {
 				bitmap_or(ent->bitmap, remapped);
 				bitmap_free(remapped);
+				obj_read_lock();
 				reused_bitmaps_nr++;
+				obj_read_unlock();
 				continue;
 			}
 			bitmap_free(remapped);
@@ -436,8 +454,10 @@ static int fill_bitmap_commit(struct bb_commit *ent,
 		if (!found)
 			return -1;
 		bitmap_set(ent->bitmap, pos);
-		prio_queue_put(tree_queue,
-			       repo_get_commit_tree(the_repository, c));
+		obj_read_lock();
+		tree = repo_get_commit_tree(the_repository, c);
+		obj_read_unlock();
+		prio_queue_put(tree_queue, tree);
 
 		for (p = c->parents; p; p = p->next) {
 			pos = find_object_pos(&p->item->object.oid, &found);
@@ -451,8 +471,10 @@ static int fill_bitmap_commit(struct bb_commit *ent,
 	}
 
 	while (tree_queue->nr) {
-		if (fill_bitmap_tree(ent->bitmap,
-				     prio_queue_get(tree_queue)) < 0)
+		struct tree *tree = prio_queue_get(tree_queue);
+
+		if (fill_tree_bitmap(&writer.tree_cache, ent->bitmap, NULL,
+				     &tree->object.oid, tree_bitmap_pos, NULL) < 0)
 			return -1;
 	}
 	return 0;
@@ -473,15 +495,445 @@ static void store_selected(struct bb_commit *ent, struct commit *commit)
 	kh_value(writer.bitmaps, hash_pos) = stored;
 }
 
+struct bitmap_build_state {
+	struct bitmap_builder *bb;
+	struct bitmap_index *old_bitmap;
+	const uint32_t *mapping;
+	int nr_stored; /* for progress */
+
+	/* The rest is only used when building in threads. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct commit **ready;
+	size_t ready_nr, ready_alloc;
+	size_t done_nr;
+	int failed;
+};
+
+/*
+ * Store the bitmap of "commit" if it was selected, and hand it down to
+ * the commits built on top of it. With threads, those whose parents are
+ * all done become ready to be built.
+ */
+static void finish_bitmap_commit(struct bitmap_build_state *st,
+				 struct commit *commit,
+				 struct bb_commit *ent,
+				 int threaded)
+{
+	struct commit *child;
+	int reused = 0;
+
+	if (ent->selected) {
+		store_selected(ent, commit);
+		st->nr_stored++;
+		display_progress(writer.progress, st->nr_stored);
+	}
+
+	while ((child = pop_commit(&ent->reverse_edges))) {
+		struct bb_commit *child_ent =
+			bb_data_at(&st->bb->data, child);
+
+		if (child_ent->bitmap)
+			bitmap_or(child_ent->bitmap, ent->bitmap);
+		else if (reused)
+			child_ent->bitmap = bitmap_dup(ent->bitmap);
+		else {
+			child_ent->bitmap = ent->bitmap;
+			reused = 1;
+		}
+
+		if (threaded && !--child_ent->pending) {
+			ALLOC_GROW(st->ready, st->ready_nr + 1, st->ready_alloc);
+			st->ready[st->ready_nr++] = child;
+		}
+	}
+	if (!reused)
+		bitmap_free(ent->bitmap);
+	ent->bitmap = NULL;
+}
+
+static void *build_bitmaps_thread(void *data)
+{
+	struct bitmap_build_state *st = data;
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue tree_queue = { NULL };
+
+	pthread_mutex_lock(&st->mutex);
+	for (;;) {
+		struct commit *commit;
+		struct bb_commit *ent;
+		int ret;
+
+		while (!st->ready_nr && !st->failed &&
+		       st->done_nr < st->bb->commits_nr)
+			pthread_cond_wait(&st->cond, &st->mutex);
+		if (st->failed || !st->ready_nr)
+			break;
+
+		commit = st->ready[--st->ready_nr];
+		ent = bb_data_at(&st->bb->data, commit);
+		pthread_mutex_unlock(&st->mutex);
+
+		ret = fill_bitmap_commit(ent, commit, &queue, &tree_queue,
+					 st->old_bitmap, st->mapping);
+
+		pthread_mutex_lock(&st->mutex);
+		if (ret < 0)
+			st->failed = 1;
+		else
+			finish_bitmap_commit(st, commit, ent, 1);
+		st->done_nr++;
+		pthread_cond_broadcast(&st->cond);
+	}
+	pthread_cond_broadcast(&st->cond);
+	pthread_mutex_unlock(&st->mutex);
+
+	clear_prio_queue(&queue);
+	clear_prio_queue(&tree_queue);
+	return NULL;
+}
+
+/*
+ * Build the bitmaps of independent commits (e.g. of different maximal
+ * commits) at the same time. A commit is only started once all the
+ * commits whose bitmaps it builds on are done, and the trees are read
+ * with the object read lock enabled, so that inflating them happens in
+ * parallel, too.
+ */
+static int build_bitmaps_threaded(struct bitmap_build_state *st, int nr_threads)
+{
+	struct bitmap_builder *bb = st->bb;
+	pthread_t *threads;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < bb->commits_nr; i++) {
+		struct bb_commit *ent = bb_data_at(&bb->data, bb->commits[i]);
+		struct commit_list *c;
+
+		for (c = ent->reverse_edges; c; c = c->next)
+			bb_data_at(&bb->data, c->item)->pending++;
+	}
+	for (i = bb->commits_nr; i > 0; i--) {
+		struct commit *commit = bb->commits[i - 1];
+
+		if (bb_data_at(&bb->data, commit)->pending)
+			continue;
+		ALLOC_GROW(st->ready, st->ready_nr + 1, st->ready_alloc);
+		st->ready[st->ready_nr++] = commit;
+	}
+
+	pthread_mutex_init(&st->mutex, NULL);
+	pthread_cond_init(&st->cond, NULL);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL,
+				     build_bitmaps_thread, st);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&st->cond);
+	pthread_mutex_destroy(&st->mutex);
+	free(threads);
+	free(st->ready);
+
+	if (!st->failed && st->done_nr != bb->commits_nr)
+		BUG("only built %"PRIuMAX" of %"PRIuMAX" commit bitmaps",
+		    (uintmax_t)st->done_nr, (uintmax_t)bb->commits_nr);
+	return st->failed ? -1 : 0;
+}
+
+/*
+ * A group of refs configured with "bitmapPseudoMerge.<name>.*", whose
+ * commits are written as (up to "max_merges") pseudo-merges.
+ */
+struct pseudo_merge_group {
+	char *name;
+	const char *pattern;
+	timestamp_t threshold;
+	int max_merges;
+
+	struct commit **commits;
+	size_t commits_nr, commits_alloc;
+};
+
+#define DEFAULT_PSEUDO_MERGE_THRESHOLD "1.week.ago"
+#define DEFAULT_PSEUDO_MERGE_MAX_MERGES 64
+
+struct pseudo_merge_config {
+	struct pseudo_merge_group *groups;
+	size_t nr, alloc;
+};
+
+static int pseudo_merge_config(const char *var, const char *value,
+			       const struct config_context *ctx,
+			       void *data)
+{
+	struct pseudo_merge_config *config = data;
+	struct pseudo_merge_group *group = NULL;
+	const char *name, *key;
+	size_t namelen, i;
+
+	if (parse_config_key(var, "bitmappseudomerge", &name, &namelen,
+			     &key) < 0 || !name)
+		return 0;
+
+	for (i = 0; i < config->nr; i++) {
+		if (!strncmp(config->groups[i].name, name, namelen) &&
+		    !config->groups[i].name[namelen]) {
+			group = &config->groups[i];
+			break;
+		}
+	}
+	if (!group) {
+		ALLOC_GROW(config->groups, config->nr + 1, config->alloc);
+		group = &config->groups[config->nr++];
+		memset(group, 0, sizeof(*group));
+		group->name = xmemdupz(name, namelen);
+		group->threshold = approxidate(DEFAULT_PSEUDO_MERGE_THRESHOLD);
+		group->max_merges = DEFAULT_PSEUDO_MERGE_MAX_MERGES;
+	}
+
+	if (!strcmp(key, "pattern"))
+		return git_config_string(&group->pattern, var, value);
+	if (!strcmp(key, "threshold"))
+		return git_config_expiry_date(&group->threshold, var, value);
+	if (!strcmp(key, "maxmerges")) {
+		group->max_merges = git_config_int(var, value, ctx->kvi);
+		if (group->max_merges < 1)
+			return error(_("%s must be positive"), var);
+		return 0;
+	}
+	return 0;
+}
+
+struct pseudo_merge_refs {
+	struct pseudo_merge_config *config;
+	struct oidset seen;
+};
+
+static int add_pseudo_merge_ref(const char *refname,
+				const struct object_id *oid,
+				int flags UNUSED, void *data)
+{
+	struct pseudo_merge_refs *refs = data;
+	struct pseudo_merge_group *group = NULL;
+	struct commit *commit;
+	size_t i;
+
+	for (i = 0; i < refs->config->nr; i++) {
+		const char *pattern = refs->config->groups[i].pattern;
+
+		if (pattern && (starts_with(refname, pattern) ||
+				!wildmatch(pattern, refname, 0))) {
+			group = &refs->config->groups[i];
+			break;
+		}
+	}
+	if (!group)
+		return 0;
+
+	commit = lookup_commit_reference_gently(the_repository, oid, 1);
+	if (!commit || !packlist_find(writer.to_pack, &commit->object.oid))
+		return 0;
+	if (commit->date > group->threshold)
+		return 0;
+	if (oidset_insert(&refs->seen, &commit->object.oid))
+		return 0;
+
+	ALLOC_GROW(group->commits, group->commits_nr + 1, group->commits_alloc);
+	group->commits[group->commits_nr++] = commit;
+	return 0;
+}
+
+/*
+ * Set the bits of everything reachable from "commits" in "result",
+ * taking the bitmaps of selected commits that were just built instead
+ * of walking them again.
+ */
+static int fill_pseudo_merge(struct bitmap *result,
+			     struct commit **commits, size_t nr)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue tree_queue = { NULL };
+	struct bitmap *queued = bitmap_new();
+	struct commit *c;
+	uint32_t pos;
+	int found, ret = 0;
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		prio_queue_put(&queue, commits[i]);
+
+	while (!ret && (c = prio_queue_get(&queue))) {
+		struct commit_list *p;
+		khiter_t hash_pos;
+
+		pos = find_object_pos(&c->object.oid, &found);
+		if (!found) {
+			ret = -1;
+			break;
+		}
+		if (bitmap_get(result, pos))
+			continue;
+
+		hash_pos = kh_get_oid_map(writer.bitmaps, c->object.oid);
+		if (hash_pos < kh_end(writer.bitmaps)) {
+			struct bitmapped_commit *stored =
+				kh_value(writer.bitmaps, hash_pos);
+			bitmap_or_ewah(result, stored->bitmap);
+			continue;
+		}
+
+		bitmap_set(result, pos);
+		if (repo_parse_commit(the_repository, c)) {
+			ret = -1;
+			break;
+		}
+		prio_queue_put(&tree_queue,
+			       repo_get_commit_tree(the_repository, c));
+
+		for (p = c->parents; p; p = p->next) {
+			pos = find_object_pos(&p->item->object.oid, &found);
+			if (!found) {
+				ret = -1;
+				break;
+			}
+			if (bitmap_get(result, pos) || bitmap_get(queued, pos))
+				continue;
+			bitmap_set(queued, pos);
+			prio_queue_put(&queue, p->item);
+		}
+	}
+
+	while (!ret && tree_queue.nr) {
+		struct tree *tree = prio_queue_get(&tree_queue);
+
+		if (fill_tree_bitmap(&writer.tree_cache, result, NULL,
+				     &tree->object.oid, tree_bitmap_pos, NULL) < 0)
+			ret = -1;
+	}
+
+	clear_prio_queue(&queue);
+	clear_prio_queue(&tree_queue);
+	bitmap_free(queued);
+	return ret;
+}
+
+static int add_pseudo_merge(struct commit **commits, size_t nr)
+{
+	struct pseudo_merge *merge;
+	struct bitmap *tips = bitmap_new();
+	struct bitmap *result = bitmap_new();
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		int found;
+		uint32_t pos = find_object_pos(&commits[i]->object.oid, &found);
+
+		if (!found)
+			BUG("pseudo-merge commit not in pack");
+		bitmap_set(tips, pos);
+	}
+
+	if (fill_pseudo_merge(result, commits, nr) < 0) {
+		bitmap_free(tips);
+		bitmap_free(result);
+		return -1;
+	}
+
+	ALLOC_GROW(writer.pseudo_merges, writer.pseudo_merges_nr + 1,
+		   writer.pseudo_merges_alloc);
+	merge = &writer.pseudo_merges[writer.pseudo_merges_nr++];
+	merge->commits = bitmap_to_ewah(tips);
+	merge->bitmap = bitmap_to_ewah(result);
+
+	bitmap_free(tips);
+	bitmap_free(result);
+	return 0;
+}
+
+static int compare_pseudo_merge_commits(const void *_a, const void *_b)
+{
+	const struct commit *a = *(const struct commit **)_a;
+	const struct commit *b = *(const struct commit **)_b;
+
+	if (a->date < b->date)
+		return -1;
+	if (a->date > b->date)
+		return 1;
+	return oidcmp(&a->object.oid, &b->object.oid);
+}
+
+/*
+ * Split the commits of each group, ordered by date, into pseudo-merges
+ * of equal size, so that refs that stopped changing at about the same
+ * time end up in the same one.
+ */
+static int build_pseudo_merges(struct repository *r)
+{
+	struct pseudo_merge_config config = { 0 };
+	struct pseudo_merge_refs refs = { .config = &config };
+	size_t i, j;
+	int ret = 0;
+
+	repo_config(r, pseudo_merge_config, &config);
+	if (!config.nr)
+		return 0;
+
+	oidset_init(&refs.seen, 0);
+	refs_for_each_ref(get_main_ref_store(r), add_pseudo_merge_ref, &refs);
+	oidset_clear(&refs.seen);
+
+	for (i = 0; i < config.nr; i++) {
+		struct pseudo_merge_group *group = &config.groups[i];
+		size_t size = DIV_ROUND_UP(group->commits_nr, group->max_merges);
+
+		QSORT(group->commits, group->commits_nr,
+		      compare_pseudo_merge_commits);
+		for (j = 0; !ret && j < group->commits_nr; j += size)
+			ret = add_pseudo_merge(group->commits + j,
+					       j + size > group->commits_nr ?
+					       group->commits_nr - j : size);
+
+		free(group->name);
+		free((char *)group->pattern);
+		free(group->commits);
+	}
+	free(config.groups);
+	return ret;
+}
+
+static int bitmap_writer_threads(struct repository *r)
+{
+	int threads = writer.threads;
+
+	if (!threads && repo_config_get_int(r, "pack.threads", &threads))
+		threads = 0;
+	if (!threads)
+		threads = online_cpus();
+	if (!HAVE_THREADS || threads < 1)
+		threads = 1;
+	return threads;
+}
+
 int bitmap_writer_build(struct packing_data *to_pack)
 {
 	struct bitmap_builder bb;
+	struct bitmap_build_state st = { .bb = &bb };
 	size_t i;
-	int nr_stored = 0; /* for progress */
 	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
 	struct prio_queue tree_queue = { NULL };
 	struct bitmap_index *old_bitmap;
 	uint32_t *mapping;
+	int nr_threads;
+	size_t tree_cache_nr = 0;
 	int closed = 1; /* until proven otherwise */
 
 	writer.bitmaps = kh_init_oid_map();
@@ -493,50 +945,52 @@ int bitmap_writer_build(struct packing_data *to_pack)
 			    the_repository);
 
 	old_bitmap = prepare_bitmap_git(to_pack->repo);
-	if (old_bitmap)
-		mapping = create_bitmap_mapping(old_bitmap, to_pack);
-	else
+	if (old_bitmap) {
+		if (!writer.name_hash_version)
+			writer.name_hash_version =
+				bitmap_name_hash_version(old_bitmap);
+		mapping = create_bitmap_mapping(old_bitmap, to_pack,
+						writer.name_hash_version,
+						&mapping_identical);
+	} else {
 		mapping = NULL;
+		mapping_identical = 0;
+	}
+	st.old_bitmap = old_bitmap;
+	st.mapping = mapping;
 
 	bitmap_builder_init(&bb, &writer, old_bitmap);
-	for (i = bb.commits_nr; i > 0; i--) {
-		struct commit *commit = bb.commits[i-1];
-		struct bb_commit *ent = bb_data_at(&bb.data, commit);
-		struct commit *child;
-		int reused = 0;
-
-		if (fill_bitmap_commit(ent, commit, &queue, &tree_queue,
-				       old_bitmap, mapping) < 0) {
-			closed = 0;
-			break;
-		}
+	tree_bitmap_cache_init(&writer.tree_cache, to_pack->repo);
 
-		if (ent->selected) {
-			store_selected(ent, commit);
-			nr_stored++;
-			display_progress(writer.progress, nr_stored);
-		}
-
-		while ((child = pop_commit(&ent->reverse_edges))) {
-			struct bb_commit *child_ent =
-				bb_data_at(&bb.data, child);
+	nr_threads = bitmap_writer_threads(to_pack->repo);
+	if (nr_threads > bb.commits_nr)
+		nr_threads = bb.commits_nr;
 
-			if (child_ent->bitmap)
-				bitmap_or(child_ent->bitmap, ent->bitmap);
-			else if (reused)
-				child_ent->bitmap = bitmap_dup(ent->bitmap);
-			else {
-				child_ent->bitmap = ent->bitmap;
-				reused = 1;
+	if (nr_threads > 1) {
+		if (build_bitmaps_threaded(&st, nr_threads) < 0)
+			closed = 0;
+	} else {
+		for (i = bb.commits_nr; i > 0; i--) {
+			struct commit *commit = bb.commits[i-1];
+			struct bb_commit *ent = bb_data_at(&bb.data, commit);
+
+			if (fill_bitmap_commit(ent, commit, &queue, &tree_queue,
+					       old_bitmap, mapping) < 0) {
+				closed = 0;
+				break;
 			}
+			finish_bitmap_commit(&st, commit, ent, 0);
 		}
-		if (!reused)
-			bitmap_free(ent->bitmap);
-		ent->bitmap = NULL;
 	}
+	if (closed && build_pseudo_merges(to_pack->repo) < 0)
+		closed = 0;
+
 	clear_prio_queue(&queue);
 	clear_prio_queue(&tree_queue);
 	bitmap_builder_clear(&bb);
+	if (writer.tree_cache.bitmaps)
+		tree_cache_nr = kh_size(writer.tree_cache.bitmaps);
+	tree_bitmap_cache_clear(&writer.tree_cache);
 	free_bitmap_index(old_bitmap);
 	free(mapping);
 
@@ -544,11 +998,26 @@ int bitmap_writer_build(struct packing_data *to_pack)
 			    the_repository);
 	trace2_data_intmax("pack-bitmap-write", the_repository,
 			   "building_bitmaps_reused", reused_bitmaps_nr);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "building_bitmaps_identical", mapping_identical);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "building_bitmaps_threads", nr_threads);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "building_bitmaps_cached_trees", tree_cache_nr);
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "building_bitmaps_pseudo_merges",
+			   writer.pseudo_merges_nr);
 
 	stop_progress(&writer.progress);
 
-	if (closed)
-		compute_xor_offsets();
+	if (closed) {
+		int max_xor_depth;
+
+		if (repo_config_get_int(to_pack->repo, "pack.bitmapmaxxordepth",
+					&max_xor_depth))
+			max_xor_depth = -1;
+		compute_xor_offsets(max_xor_depth);
+	}
 	return closed ? 0 : -1;
 }
 
@@ -660,6 +1129,31 @@ static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap)
 		die("Failed to write bitmap index");
 }
 
+/*
+ * Each pseudo-merge is written as the bitmap of its commits followed by
+ * the bitmap of all it reaches, then come their offsets, their number
+ * and the size of the whole extension, so that readers find it from the
+ * end of the data that follows it.
+ */
+static void write_pseudo_merges(struct hashfile *f)
+{
+	off_t start = hashfile_total(f);
+	uint64_t *offsets;
+	size_t i;
+
+	ALLOC_ARRAY(offsets, writer.pseudo_merges_nr);
+	for (i = 0; i < writer.pseudo_merges_nr; i++) {
+		offsets[i] = hashfile_total(f);
+		dump_bitmap(f, writer.pseudo_merges[i].commits);
+		dump_bitmap(f, writer.pseudo_merges[i].bitmap);
+	}
+	for (i = 0; i < writer.pseudo_merges_nr; i++)
+		hashwrite_be64(f, offsets[i]);
+	hashwrite_be32(f, writer.pseudo_merges_nr);
+	hashwrite_be64(f, hashfile_total(f) - start + sizeof(uint64_t));
+	free(offsets);
+}
+
 static const struct object_id *oid_access(size_t pos, const void *table)
 {
 	const struct pack_idx_entry * const *index = table;
@@ -793,6 +1287,18 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 
 	int fd = odb_mkstemp(&tmp_file, "pack/tmp_bitmap_XXXXXX");
 
+	/*
+	 * Hashes of another version than 1 must not end up in the
+	 * BITMAP_OPT_HASH_CACHE section, where they would be mixed with
+	 * version 1 hashes by readers that only know about that one.
+	 */
+	if ((options & BITMAP_OPT_HASH_CACHE) && writer.name_hash_version == 2)
+		options = (options & ~BITMAP_OPT_HASH_CACHE) |
+			  BITMAP_OPT_HASH_CACHE_V2;
+
+	if (writer.pseudo_merges_nr)
+		options |= BITMAP_OPT_PSEUDO_MERGES;
+
 	f = hashfd(fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
@@ -824,6 +1330,12 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 
 	write_selected_commits_v1(f, commit_positions, offsets);
 
+	if (writer.pseudo_merges_nr)
+		write_pseudo_merges(f);
+
+	if (options & BITMAP_OPT_HASH_CACHE_V2)
+		write_hash_cache(f, index, index_nr);
+
 	if (options & BITMAP_OPT_LOOKUP_TABLE)
 		write_lookup_table(f, commit_positions, offsets);
 
@@ -842,4 +1354,10 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	strbuf_release(&tmp_file);
 	free(commit_positions);
 	free(offsets);
+	for (i = 0; i < writer.pseudo_merges_nr; i++) {
+		ewah_free(writer.pseudo_merges[i].commits);
+		ewah_free(writer.pseudo_merges[i].bitmap);
+	}
+	FREE_AND_NULL(writer.pseudo_merges);
+	writer.pseudo_merges_nr = writer.pseudo_merges_alloc = 0;
 }
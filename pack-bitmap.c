@@ -1,5 +1,7 @@
 #include "git-compat-util.h"
 #include "commit.h"
+#include "commit-graph.h"
+#include "commit-reach.h"
 #include "gettext.h"
 #include "hex.h"
 #include "strbuf.h"
@@ -15,10 +17,13 @@
 #include "packfile.h"
 #include "repository.h"
 #include "trace2.h"
+#include "tree.h"
+#include "tree-walk.h"
 #include "object-file.h"
 #include "object-store-ll.h"
 #include "list-objects-filter-options.h"
 #include "midx.h"
+#include "oid-array.h"
 #include "config.h"
 
 /*
@@ -81,8 +86,12 @@ struct bitmap_index {
 	/* Number of bitmapped commits */
 	uint32_t entry_count;
 
-	/* If not NULL, this is a name-hash cache pointing into map. */
+	/*
+	 * If not NULL, this is a name-hash cache pointing into map, with
+	 * hashes of the given version (see pack_name_hash_version()).
+	 */
 	uint32_t *hashes;
+	int name_hash_version;
 
 	/* The checksum of the packfile or MIDX; points into map. */
 	const unsigned char *checksum;
@@ -115,9 +124,34 @@ struct bitmap_index {
 
 	/* Version of the bitmap index */
 	unsigned int version;
+
+	/* Trees filled in by walks, see fill_tree_bitmap() */
+	struct tree_bitmap_cache tree_cache;
+
+	/*
+	 * If not NULL, this points to the offsets of the pseudo-merges
+	 * (within the memory mapped region `map`), which are loaded into
+	 * `pseudo_merges` by load_bitmap().
+	 */
+	const unsigned char *pseudo_merge_offsets;
+	uint32_t pseudo_merges_nr;
+	struct pseudo_merge *pseudo_merges;
+
+	/*
+	 * How bitmap_for_commit() found the bitmaps it was asked for,
+	 * reported to trace2 by free_bitmap_index(): already loaded (hits),
+	 * read on demand via the lookup table (loads), or not at all
+	 * (misses). "xors" counts the bitmaps that had to be XORed with
+	 * their base before they could be used.
+	 */
+	uint32_t commit_bitmap_hits;
+	uint32_t commit_bitmap_loads;
+	uint32_t commit_bitmap_misses;
+	uint32_t commit_bitmap_xors;
 };
 
-static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
+static struct ewah_bitmap *lookup_stored_bitmap(struct bitmap_index *bitmap_git,
+						 struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
 	struct ewah_bitmap *composed;
@@ -126,7 +160,8 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 		return st->root;
 
 	composed = ewah_pool_new();
-	parent = lookup_stored_bitmap(st->xor);
+	parent = lookup_stored_bitmap(bitmap_git, st->xor);
+	bitmap_git->commit_bitmap_xors++;
 	ewah_xor(st->root, parent, composed);
 
 	ewah_pool_free(st->root);
@@ -158,6 +193,19 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 	return b;
 }
 
+static void free_pseudo_merges(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	if (!index->pseudo_merges)
+		return;
+	for (i = 0; i < index->pseudo_merges_nr; i++) {
+		ewah_pool_free(index->pseudo_merges[i].commits);
+		ewah_pool_free(index->pseudo_merges[i].bitmap);
+	}
+	FREE_AND_NULL(index->pseudo_merges);
+}
+
 static uint32_t bitmap_num_objects(struct bitmap_index *index)
 {
 	if (index->midx)
@@ -190,6 +238,9 @@ static int load_bitmap_header(struct bitmap_index *index)
 			BUG("unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		/* objects outside of the bitmap get this version, too */
+		index->name_hash_version = 1;
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			if (cache_size > index_end - index->map - header_size)
 				return error(_("corrupted bitmap index file (too short to fit hash cache)"));
@@ -206,6 +257,37 @@ static int load_bitmap_header(struct bitmap_index *index)
 				index->table_lookup = (void *)(index_end - table_size);
 			index_end -= table_size;
 		}
+
+		/*
+		 * The version 2 hash cache comes before the lookup table,
+		 * where readers that do not know about it skip it.
+		 */
+		if (flags & BITMAP_OPT_HASH_CACHE_V2) {
+			if (cache_size > index_end - index->map - header_size)
+				return error(_("corrupted bitmap index file (too short to fit hash cache)"));
+			index->hashes = (void *)(index_end - cache_size);
+			index->name_hash_version = 2;
+			index_end -= cache_size;
+		}
+
+		if (flags & BITMAP_OPT_PSEUDO_MERGES) {
+			size_t avail = index_end - index->map - header_size;
+			uint64_t ext_size;
+			uint32_t nr;
+
+			if (avail < sizeof(uint32_t) + sizeof(uint64_t))
+				return error(_("corrupted bitmap index file (too short to fit pseudo-merges)"));
+			ext_size = get_be64(index_end - sizeof(uint64_t));
+			nr = get_be32(index_end - sizeof(uint64_t) - sizeof(uint32_t));
+			if (ext_size > avail ||
+			    ext_size < st_add(st_mult(nr, sizeof(uint64_t)),
+					      sizeof(uint32_t) + sizeof(uint64_t)))
+				return error(_("corrupted bitmap index file (too short to fit pseudo-merges)"));
+			index->pseudo_merges_nr = nr;
+			index->pseudo_merge_offsets = index_end - sizeof(uint64_t) -
+				sizeof(uint32_t) - st_mult(nr, sizeof(uint64_t));
+			index_end -= ext_size;
+		}
 	}
 
 	index->entry_count = ntohl(header->entry_count);
@@ -489,6 +571,40 @@ static int load_reverse_index(struct repository *r, struct bitmap_index *bitmap_
 	return load_pack_revindex(r, bitmap_git->pack);
 }
 
+static int load_pseudo_merges(struct bitmap_index *bitmap_git)
+{
+	size_t saved_pos = bitmap_git->map_pos;
+	uint32_t i;
+	int ret = 0;
+
+	if (!bitmap_git->pseudo_merges_nr)
+		return 0;
+
+	CALLOC_ARRAY(bitmap_git->pseudo_merges, bitmap_git->pseudo_merges_nr);
+	for (i = 0; i < bitmap_git->pseudo_merges_nr; i++) {
+		struct pseudo_merge *merge = &bitmap_git->pseudo_merges[i];
+		uint64_t offset = get_be64(bitmap_git->pseudo_merge_offsets +
+					   st_mult(i, sizeof(uint64_t)));
+
+		if (offset >= bitmap_git->map_size) {
+			ret = error(_("corrupt pseudo-merge offset %"PRIuMAX),
+				    (uintmax_t)offset);
+			break;
+		}
+		bitmap_git->map_pos = offset;
+		if (!(merge->commits = read_bitmap_1(bitmap_git)) ||
+		    !(merge->bitmap = read_bitmap_1(bitmap_git))) {
+			ret = -1;
+			break;
+		}
+	}
+	bitmap_git->map_pos = saved_pos;
+
+	if (ret < 0)
+		free_pseudo_merges(bitmap_git);
+	return ret;
+}
+
 static int load_bitmap(struct repository *r, struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
@@ -508,6 +624,9 @@ static int load_bitmap(struct repository *r, struct bitmap_index *bitmap_git)
 	if (!bitmap_git->table_lookup && load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
+	if (load_pseudo_merges(bitmap_git) < 0)
+		goto failed;
+
 	return 0;
 
 failed:
@@ -606,6 +725,7 @@ struct include_data {
 	struct bitmap_index *bitmap_git;
 	struct bitmap *base;
 	struct bitmap *seen;
+	int fill_trees;
 };
 
 struct bitmap_lookup_table_triplet {
@@ -847,17 +967,23 @@ struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
 					   commit->object.oid);
 	if (hash_pos >= kh_end(bitmap_git->bitmaps)) {
 		struct stored_bitmap *bitmap = NULL;
-		if (!bitmap_git->table_lookup)
-			return NULL;
 
-		/* this is a fairly hot codepath - no trace2_region please */
-		/* NEEDSWORK: cache misses aren't recorded */
-		bitmap = lazy_bitmap_for_commit(bitmap_git, commit);
-		if (!bitmap)
+		/*
+		 * this is a fairly hot codepath - no trace2_region please;
+		 * the counters are reported by free_bitmap_index()
+		 */
+		if (bitmap_git->table_lookup)
+			bitmap = lazy_bitmap_for_commit(bitmap_git, commit);
+		if (!bitmap) {
+			bitmap_git->commit_bitmap_misses++;
 			return NULL;
-		return lookup_stored_bitmap(bitmap);
+		}
+		bitmap_git->commit_bitmap_loads++;
+		return lookup_stored_bitmap(bitmap_git, bitmap);
 	}
-	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+	bitmap_git->commit_bitmap_hits++;
+	return lookup_stored_bitmap(bitmap_git,
+				    kh_value(bitmap_git->bitmaps, hash_pos));
 }
 
 static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
@@ -929,7 +1055,8 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 
 		bitmap_pos = eindex->count;
 		eindex->objects[eindex->count] = object;
-		eindex->hashes[eindex->count] = pack_name_hash(name);
+		eindex->hashes[eindex->count] =
+			pack_name_hash_version(name, bitmap_git->name_hash_version);
 		kh_value(eindex->positions, hash_pos) = bitmap_pos;
 		eindex->count++;
 	} else {
@@ -939,6 +1066,218 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
+#define DEFAULT_TREE_BITMAP_CACHE_SIZE (64 * 1024 * 1024)
+
+void tree_bitmap_cache_init(struct tree_bitmap_cache *cache,
+			    struct repository *r)
+{
+	unsigned long limit;
+
+	if (cache->bitmaps)
+		return;
+	if (repo_config_get_ulong(r, "pack.bitmaptreecachesize", &limit))
+		limit = DEFAULT_TREE_BITMAP_CACHE_SIZE;
+	cache->size = 0;
+	cache->limit = limit;
+	if (limit)
+		cache->bitmaps = kh_init_oid_map();
+}
+
+void tree_bitmap_cache_clear(struct tree_bitmap_cache *cache)
+{
+	struct ewah_bitmap *ewah;
+
+	if (!cache->bitmaps)
+		return;
+	kh_foreach_value(cache->bitmaps, ewah, ewah_free(ewah));
+	kh_destroy_oid_map(cache->bitmaps);
+	cache->bitmaps = NULL;
+	cache->size = 0;
+}
+
+/*
+ * Store "bitmap" as the one of the tree "oid", or remember that the tree
+ * could not be filled in if "bitmap" is NULL. Entries are never evicted,
+ * so that the bitmaps returned by tree_bitmap_cache_get() stay valid.
+ */
+static void tree_bitmap_cache_add(struct tree_bitmap_cache *cache,
+				  const struct object_id *oid,
+				  struct bitmap *bitmap)
+{
+	struct ewah_bitmap *ewah = bitmap ? bitmap_to_ewah(bitmap) : NULL;
+	size_t size = sizeof(*oid) + sizeof(ewah);
+	khiter_t pos;
+	int hash_ret;
+
+	if (ewah)
+		size += sizeof(*ewah) + st_mult(ewah->alloc_size, sizeof(eword_t));
+
+	obj_read_lock();
+	if (cache->size + size > cache->limit) {
+		ewah_free(ewah);
+	} else {
+		pos = kh_put_oid_map(cache->bitmaps, *oid, &hash_ret);
+		if (hash_ret > 0) {
+			kh_value(cache->bitmaps, pos) = ewah;
+			cache->size += size;
+		} else {
+			/* another thread was faster */
+			ewah_free(ewah);
+		}
+	}
+	obj_read_unlock();
+}
+
+struct tree_bitmap_fill {
+	struct tree_bitmap_cache *cache;
+	struct bitmap *dest, *seen;
+	tree_bitmap_pos_fn find_pos;
+	void *data;
+};
+
+static int fill_subtree_bitmap(struct tree_bitmap_fill *fill,
+			       struct bitmap *bitmap,
+			       const struct object_id *oid, int pos);
+
+/*
+ * Set the bits of the entries of the tree "oid", and then the bit "pos"
+ * of the tree itself, in "bitmap". Return 1 if a subtree was skipped
+ * because it is in "fill->dest" or "fill->seen" already, and thus
+ * "bitmap" does not have all of the tree, 0 if it does, or -1 on error.
+ */
+static int fill_tree_entries(struct tree_bitmap_fill *fill,
+			     struct bitmap *bitmap,
+			     const struct object_id *oid, int pos)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	int ret = 0;
+
+	buf = repo_read_object_file(the_repository, oid, &type, &size);
+	if (!buf || type != OBJ_TREE) {
+		free(buf);
+		return -1;
+	}
+	init_tree_desc(&desc, buf, size);
+
+	while (ret >= 0 && tree_entry(&desc, &entry)) {
+		int child, r;
+
+		switch (object_type(entry.mode)) {
+		case OBJ_TREE:
+			child = fill->find_pos(&entry.oid, fill->data);
+			if (child < 0)
+				ret = -1;
+			else if (bitmap_get(bitmap, child))
+				; /* walked already */
+			else if (bitmap_get(fill->dest, child) ||
+				 (fill->seen && bitmap_get(fill->seen, child)))
+				ret = 1;
+			else if ((r = fill_subtree_bitmap(fill, bitmap,
+							  &entry.oid, child)))
+				ret = r;
+			break;
+		case OBJ_BLOB:
+			child = fill->find_pos(&entry.oid, fill->data);
+			if (child < 0)
+				ret = -1;
+			else
+				bitmap_set(bitmap, child);
+			break;
+		default:
+			/* Gitlink, etc; not reachable */
+			break;
+		}
+	}
+
+	free(buf);
+	/*
+	 * Only set the bit of the tree once all of it is in, so that a
+	 * tree whose bit is set never has to be walked again.
+	 */
+	if (ret >= 0)
+		bitmap_set(bitmap, pos);
+	return ret;
+}
+
+static int fill_subtree_bitmap(struct tree_bitmap_fill *fill,
+			       struct bitmap *bitmap,
+			       const struct object_id *oid, int pos)
+{
+	struct tree_bitmap_cache *cache = fill->cache;
+	struct ewah_bitmap *ewah = NULL;
+	struct bitmap *sub;
+	khiter_t hash_pos;
+	int found = 0, full;
+	int ret;
+
+	if (!cache || !cache->bitmaps)
+		return fill_tree_entries(fill, bitmap, oid, pos);
+
+	obj_read_lock();
+	hash_pos = kh_get_oid_map(cache->bitmaps, *oid);
+	if (hash_pos < kh_end(cache->bitmaps)) {
+		ewah = kh_value(cache->bitmaps, hash_pos);
+		found = 1;
+	}
+	full = cache->size >= cache->limit;
+	obj_read_unlock();
+
+	if (found) {
+		if (!ewah)
+			return -1;
+		bitmap_or_ewah(bitmap, ewah);
+		return 0;
+	}
+	if (full)
+		return fill_tree_entries(fill, bitmap, oid, pos);
+
+	/*
+	 * Fill in the tree on its own, so that we have its bitmap to
+	 * cache if nothing of it was skipped.
+	 */
+	sub = bitmap_new();
+	ret = fill_tree_entries(fill, sub, oid, pos);
+	if (ret < 0)
+		tree_bitmap_cache_add(cache, oid, NULL);
+	else {
+		if (!ret)
+			tree_bitmap_cache_add(cache, oid, sub);
+		bitmap_or(bitmap, sub);
+	}
+	bitmap_free(sub);
+	return ret;
+}
+
+int fill_tree_bitmap(struct tree_bitmap_cache *cache,
+		     struct bitmap *bitmap, struct bitmap *seen,
+		     const struct object_id *oid,
+		     tree_bitmap_pos_fn find_pos, void *data)
+{
+	struct tree_bitmap_fill fill = {
+		.cache = cache,
+		.dest = bitmap,
+		.seen = seen,
+		.find_pos = find_pos,
+		.data = data,
+	};
+	int pos = find_pos(oid, data);
+
+	if (pos < 0)
+		return -1;
+	if (bitmap_get(bitmap, pos))
+		return 0;
+	return fill_subtree_bitmap(&fill, bitmap, oid, pos) < 0 ? -1 : 0;
+}
+
+static int tree_bitmap_position(const struct object_id *oid, void *data)
+{
+	return bitmap_position(data, oid);
+}
+
 struct bitmap_show_data {
 	struct bitmap_index *bitmap_git;
 	struct bitmap *base;
@@ -1024,6 +1363,17 @@ static int should_include_obj(struct object *obj, void *_data)
 		obj->flags |= SEEN;
 		return 0;
 	}
+	/*
+	 * Fill in the tree without the traversal, if all of it is in the
+	 * bitmap (or in the extended index) already.
+	 */
+	if (obj->type == OBJ_TREE && data->fill_trees &&
+	    !fill_tree_bitmap(&data->bitmap_git->tree_cache, data->base,
+			      data->seen, &obj->oid, tree_bitmap_position,
+			      data->bitmap_git)) {
+		obj->flags |= SEEN;
+		return 0;
+	}
 	return 1;
 }
 
@@ -1044,6 +1394,64 @@ static int add_commit_to_bitmap(struct bitmap_index *bitmap_git,
 	return 1;
 }
 
+static int ewah_is_subset(struct ewah_bitmap *ewah, struct bitmap *bitmap)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i = 0;
+
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&word, &it)) {
+		if (word & ~(i < bitmap->word_alloc ? bitmap->words[i] : 0))
+			return 0;
+		i++;
+	}
+	return 1;
+}
+
+/*
+ * OR together the pseudo-merges all of whose commits are among "roots",
+ * so that the bitmaps of those do not have to be OR-ed in one by one.
+ * Return NULL if there are none.
+ */
+static struct bitmap *apply_pseudo_merges(struct bitmap_index *bitmap_git,
+					  struct object_list *roots)
+{
+	struct bitmap *tips, *base = NULL;
+	uint32_t i, satisfied = 0;
+
+	if (!bitmap_git->pseudo_merges_nr)
+		return NULL;
+
+	tips = bitmap_new();
+	for (; roots; roots = roots->next) {
+		int pos;
+
+		if (roots->item->type != OBJ_COMMIT)
+			continue;
+		pos = bitmap_position(bitmap_git, &roots->item->oid);
+		if (pos >= 0)
+			bitmap_set(tips, pos);
+	}
+
+	for (i = 0; i < bitmap_git->pseudo_merges_nr; i++) {
+		struct pseudo_merge *merge = &bitmap_git->pseudo_merges[i];
+
+		if (!ewah_is_subset(merge->commits, tips))
+			continue;
+		if (!base)
+			base = ewah_to_bitmap(merge->bitmap);
+		else
+			bitmap_or_ewah(base, merge->bitmap);
+		satisfied++;
+	}
+
+	bitmap_free(tips);
+	trace2_data_intmax("bitmap", the_repository, "pseudo_merges_satisfied",
+			   satisfied);
+	return base;
+}
+
 static struct bitmap *fill_in_bitmap(struct bitmap_index *bitmap_git,
 				     struct rev_info *revs,
 				     struct bitmap *base,
@@ -1058,6 +1466,9 @@ static struct bitmap *fill_in_bitmap(struct bitmap_index *bitmap_git,
 	incdata.bitmap_git = bitmap_git;
 	incdata.base = base;
 	incdata.seen = seen;
+	incdata.fill_trees = revs->tree_objects && revs->blob_objects;
+	if (incdata.fill_trees)
+		tree_bitmap_cache_init(&bitmap_git->tree_cache, revs->repo);
 
 	revs->include_check = should_include;
 	revs->include_check_obj = should_include_obj;
@@ -1108,9 +1519,49 @@ static void show_boundary_object(struct object *object UNUSED,
 	BUG("should not be called");
 }
 
+static void add_commit_roots(struct object_list *roots,
+			     struct commit ***commits, int *nr, int *alloc)
+{
+	for (; roots; roots = roots->next) {
+		if (roots->item->type != OBJ_COMMIT)
+			continue;
+		ALLOC_GROW(*commits, *nr + 1, *alloc);
+		(*commits)[(*nr)++] = (struct commit *)roots->item;
+	}
+}
+
+/*
+ * With generation numbers, the boundary is where the histories of the
+ * wants and the haves meet, which we can find by walking both sides
+ * down to their merge bases, instead of all of the haves' history up to
+ * the commits the wants reach.
+ */
+static void find_boundary_by_generation(struct bitmap_boundary_cb *cb,
+					struct rev_info *revs,
+					struct object_list *haves,
+					struct object_list *wants)
+{
+	struct commit **ones = NULL, **twos = NULL;
+	int ones_nr = 0, ones_alloc = 0, twos_nr = 0, twos_alloc = 0;
+	struct commit_list *bases, *p;
+
+	add_commit_roots(wants, &ones, &ones_nr, &ones_alloc);
+	add_commit_roots(haves, &twos, &twos_nr, &twos_alloc);
+
+	bases = repo_get_merge_bases_of_sets(revs->repo, ones_nr, ones,
+					     twos_nr, twos);
+	for (p = bases; p; p = p->next)
+		add_object_array(&p->item->object, "", &cb->boundary);
+
+	free_commit_list(bases);
+	free(ones);
+	free(twos);
+}
+
 static struct bitmap *find_boundary_objects(struct bitmap_index *bitmap_git,
 					    struct rev_info *revs,
-					    struct object_list *roots)
+					    struct object_list *roots,
+					    struct object_list *wants)
 {
 	struct bitmap_boundary_cb cb;
 	struct object_list *root;
@@ -1119,7 +1570,9 @@ static struct bitmap *find_boundary_objects(struct bitmap_index *bitmap_git,
 	int any_missing = 0;
 
 	cb.bitmap_git = bitmap_git;
-	cb.base = bitmap_new();
+	cb.base = apply_pseudo_merges(bitmap_git, roots);
+	if (!cb.base)
+		cb.base = bitmap_new();
 	object_array_init(&cb.boundary);
 
 	revs->ignore_missing_links = 1;
@@ -1144,6 +1597,16 @@ static struct bitmap *find_boundary_objects(struct bitmap_index *bitmap_git,
 	if (!any_missing)
 		goto cleanup;
 
+	if (generation_numbers_enabled(revs->repo)) {
+		trace2_region_enter("pack-bitmap", "boundary-merge-bases",
+				    the_repository);
+		find_boundary_by_generation(&cb, revs, roots, wants);
+		trace2_region_leave("pack-bitmap", "boundary-merge-bases",
+				    the_repository);
+		object_array_clear(&revs->pending);
+		goto fill_in;
+	}
+
 	tmp_blobs = revs->blob_objects;
 	tmp_trees = revs->tree_objects;
 	tmp_tags = revs->blob_objects;
@@ -1175,6 +1638,7 @@ static struct bitmap *find_boundary_objects(struct bitmap_index *bitmap_git,
 	revs->tag_objects = tmp_tags;
 
 	reset_revision_walk();
+fill_in:
 	clear_object_flags(UNINTERESTING);
 
 	/*
@@ -1209,6 +1673,11 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 
 	struct object_list *not_mapped = NULL;
 
+	/*
+	 * Start with the pseudo-merges of groups of roots, if any.
+	 */
+	base = apply_pseudo_merges(bitmap_git, roots);
+
 	/*
 	 * Go through all the roots for the walk. The ones that have bitmaps
 	 * on the bitmap index will be `or`ed together to form an initial
@@ -1221,6 +1690,12 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
+		if (object->type == OBJ_COMMIT && base &&
+		    bitmap_walk_contains(bitmap_git, base, &object->oid)) {
+			object->flags |= SEEN;
+			continue;
+		}
+
 		if (object->type == OBJ_COMMIT &&
 		    add_commit_to_bitmap(bitmap_git, &base, (struct commit *)object)) {
 			object->flags |= SEEN;
@@ -1436,35 +1911,40 @@ static struct bitmap *find_tip_objects(struct bitmap_index *bitmap_git,
 	return result;
 }
 
-static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
-				       struct object_list *tip_objects,
-				       struct bitmap *to_filter,
-				       enum object_type type)
+/*
+ * Remove the objects of type "type" from "to_filter", except for those
+ * that are in "except".
+ */
+static void filter_bitmap_exclude_type_except(struct bitmap_index *bitmap_git,
+					      struct bitmap *to_filter,
+					      struct bitmap *except,
+					      enum object_type type)
 {
 	struct eindex *eindex = &bitmap_git->ext_index;
-	struct bitmap *tips;
 	struct ewah_iterator it;
-	eword_t mask;
-	uint32_t i;
-
-	/*
-	 * The non-bitmap version of this filter never removes
-	 * objects which the other side specifically asked for,
-	 * so we must match that behavior.
-	 */
-	tips = find_tip_objects(bitmap_git, tip_objects, type);
+	const eword_t *literals;
+	eword_t fill;
+	size_t nr, j;
+	uint32_t i = 0;
 
 	/*
 	 * We can use the type-level bitmap for 'type' to work in whole
 	 * words for the objects that are actually in the bitmapped
-	 * packfile.
+	 * packfile, and skip the runs of objects of other types.
 	 */
-	for (i = 0, init_type_iterator(&it, bitmap_git, type);
-	     i < to_filter->word_alloc && ewah_iterator_next(&mask, &it);
-	     i++) {
-		if (i < tips->word_alloc)
-			mask &= ~tips->words[i];
-		to_filter->words[i] &= ~mask;
+	init_type_iterator(&it, bitmap_git, type);
+	while ((nr = ewah_iterator_next_words(&literals, &fill,
+					      to_filter->word_alloc - i, &it))) {
+		if (literals || fill) {
+			for (j = 0; j < nr; j++) {
+				eword_t mask = literals ? literals[j] : fill;
+
+				if (i + j < except->word_alloc)
+					mask &= ~except->words[i + j];
+				to_filter->words[i + j] &= ~mask;
+			}
+		}
+		i += nr;
 	}
 
 	/*
@@ -1476,10 +1956,25 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 		size_t pos = st_add(i, bitmap_num_objects(bitmap_git));
 		if (eindex->objects[i]->type == type &&
 		    bitmap_get(to_filter, pos) &&
-		    !bitmap_get(tips, pos))
+		    !bitmap_get(except, pos))
 			bitmap_unset(to_filter, pos);
 	}
+}
+
+static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       struct bitmap *to_filter,
+				       enum object_type type)
+{
+	struct bitmap *tips;
 
+	/*
+	 * The non-bitmap version of this filter never removes
+	 * objects which the other side specifically asked for,
+	 * so we must match that behavior.
+	 */
+	tips = find_tip_objects(bitmap_git, tip_objects, type);
+	filter_bitmap_exclude_type_except(bitmap_git, to_filter, tips, type);
 	bitmap_free(tips);
 }
 
@@ -1575,18 +2070,186 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	bitmap_free(tips);
 }
 
+static void bitmap_pos_to_oid(struct bitmap_index *bitmap_git, uint32_t pos,
+			      struct object_id *oid)
+{
+	if (pos >= bitmap_num_objects(bitmap_git)) {
+		struct eindex *eindex = &bitmap_git->ext_index;
+		oidcpy(oid, &eindex->objects[pos - bitmap_num_objects(bitmap_git)]->oid);
+	} else if (bitmap_is_midx(bitmap_git)) {
+		nth_midxed_object_oid(oid, bitmap_git->midx,
+				      pack_pos_to_midx(bitmap_git->midx, pos));
+	} else {
+		nth_bitmap_object_oid(bitmap_git, oid,
+				      pack_pos_to_index(bitmap_git->pack, pos));
+	}
+}
+
+int for_each_commit_bitmap_object(struct bitmap_index *bitmap_git,
+				  struct commit *commit,
+				  bitmapped_object_fn fn, void *data)
+{
+	struct ewah_bitmap *bitmap = bitmap_for_commit(bitmap_git, commit);
+	struct ewah_iterator it;
+	eword_t word;
+	uint32_t base = 0;
+
+	if (!bitmap)
+		return -1;
+
+	ewah_iterator_init(&it, bitmap);
+	for (; ewah_iterator_next(&word, &it); base += BITS_IN_EWORD) {
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			struct object_id oid;
+			int ret;
+
+			if (!(word & ((eword_t)1 << offset)))
+				continue;
+			bitmap_pos_to_oid(bitmap_git, base + offset, &oid);
+			ret = fn(&oid, data);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Mark in "keep" the trees and blobs of "to_filter" that are less than
+ * "limit" trees deep below the root tree of a commit of "to_filter" or
+ * below one of the "wants". The trees are read one level at a time, so
+ * that each tree is first found at its lowest depth and read only once;
+ * only the shallowest "limit - 1" levels of trees have to be read.
+ */
+static void mark_shallow_trees(struct bitmap_index *bitmap_git,
+			       struct object_list *wants,
+			       struct bitmap *to_filter,
+			       struct bitmap *keep,
+			       unsigned long limit)
+{
+	struct oid_array trees = OID_ARRAY_INIT;
+	struct oid_array next = OID_ARRAY_INIT;
+	struct ewah_iterator it;
+	eword_t mask;
+	unsigned long depth;
+	uint32_t i;
+
+	for (; wants; wants = wants->next) {
+		int pos = bitmap_position(bitmap_git, &wants->item->oid);
+
+		if (wants->item->type == OBJ_TREE)
+			oid_array_append(&trees, &wants->item->oid);
+		else if (wants->item->type == OBJ_BLOB && pos >= 0)
+			bitmap_set(keep, pos);
+	}
+
+	for (i = 0, init_type_iterator(&it, bitmap_git, OBJ_COMMIT);
+	     i < to_filter->word_alloc && ewah_iterator_next(&mask, &it);
+	     i++) {
+		eword_t word = to_filter->words[i] & mask;
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			struct object_id oid;
+			struct commit *c;
+
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+
+			bitmap_pos_to_oid(bitmap_git, i * BITS_IN_EWORD + offset,
+					  &oid);
+			c = lookup_commit(the_repository, &oid);
+			if (!c || repo_parse_commit(the_repository, c))
+				die(_("unable to parse commit %s"),
+				    oid_to_hex(&oid));
+			oid_array_append(&trees, get_commit_tree_oid(c));
+		}
+	}
+
+	for (i = 0; i < bitmap_git->ext_index.count; i++) {
+		struct object *obj = bitmap_git->ext_index.objects[i];
+		struct commit *c;
+
+		if (obj->type != OBJ_COMMIT ||
+		    !bitmap_get(to_filter, st_add(i, bitmap_num_objects(bitmap_git))))
+			continue;
+		c = (struct commit *)obj;
+		if (repo_parse_commit(the_repository, c))
+			die(_("unable to parse commit %s"),
+			    oid_to_hex(&obj->oid));
+		oid_array_append(&trees, get_commit_tree_oid(c));
+	}
+
+	for (depth = 0; depth < limit && trees.nr; depth++) {
+		for (i = 0; i < trees.nr; i++) {
+			int pos = bitmap_position(bitmap_git, &trees.oid[i]);
+			struct tree *tree;
+			struct tree_desc desc;
+			struct name_entry entry;
+
+			if (pos < 0 || !bitmap_get(to_filter, pos) ||
+			    bitmap_get(keep, pos))
+				continue;
+			bitmap_set(keep, pos);
+
+			if (depth + 1 == limit)
+				continue;
+
+			tree = lookup_tree(the_repository, &trees.oid[i]);
+			if (!tree || parse_tree(tree) < 0)
+				die(_("unable to read tree %s"),
+				    oid_to_hex(&trees.oid[i]));
+
+			init_tree_desc(&desc, tree->buffer, tree->size);
+			while (tree_entry(&desc, &entry)) {
+				if (S_ISDIR(entry.mode)) {
+					oid_array_append(&next, &entry.oid);
+				} else if (!S_ISGITLINK(entry.mode)) {
+					pos = bitmap_position(bitmap_git, &entry.oid);
+					if (pos >= 0)
+						bitmap_set(keep, pos);
+				}
+			}
+			free_tree_buffer(tree);
+		}
+
+		oid_array_clear(&trees);
+		SWAP(trees, next);
+	}
+
+	oid_array_clear(&trees);
+	oid_array_clear(&next);
+}
+
 static void filter_bitmap_tree_depth(struct bitmap_index *bitmap_git,
+				     struct object_list *wants,
 				     struct object_list *tip_objects,
 				     struct bitmap *to_filter,
 				     unsigned long limit)
 {
-	if (limit)
-		BUG("filter_bitmap_tree_depth given non-zero limit");
+	struct bitmap *keep;
 
-	filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
-				   OBJ_TREE);
-	filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
-				   OBJ_BLOB);
+	if (!limit) {
+		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_TREE);
+		filter_bitmap_exclude_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_BLOB);
+		return;
+	}
+
+	/*
+	 * Any object that was asked for is at depth 0 and kept, so unlike
+	 * the other filters we do not need "tip_objects" here; but the
+	 * trees that were asked for are roots we have to walk from.
+	 */
+	keep = bitmap_new();
+	mark_shallow_trees(bitmap_git, wants, to_filter, keep, limit);
+	filter_bitmap_exclude_type_except(bitmap_git, to_filter, keep, OBJ_TREE);
+	filter_bitmap_exclude_type_except(bitmap_git, to_filter, keep, OBJ_BLOB);
+	bitmap_free(keep);
 }
 
 static void filter_bitmap_object_type(struct bitmap_index *bitmap_git,
@@ -1608,6 +2271,7 @@ static void filter_bitmap_object_type(struct bitmap_index *bitmap_git,
 }
 
 static int filter_bitmap(struct bitmap_index *bitmap_git,
+			 struct object_list *wants,
 			 struct object_list *tip_objects,
 			 struct bitmap *to_filter,
 			 struct list_objects_filter_options *filter)
@@ -1630,11 +2294,10 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 		return 0;
 	}
 
-	if (filter->choice == LOFC_TREE_DEPTH &&
-	    filter->tree_exclude_depth == 0) {
+	if (filter->choice == LOFC_TREE_DEPTH) {
 		if (bitmap_git)
-			filter_bitmap_tree_depth(bitmap_git, tip_objects,
-						 to_filter,
+			filter_bitmap_tree_depth(bitmap_git, wants,
+						 tip_objects, to_filter,
 						 filter->tree_exclude_depth);
 		return 0;
 	}
@@ -1650,8 +2313,8 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 	if (filter->choice == LOFC_COMBINE) {
 		int i;
 		for (i = 0; i < filter->sub_nr; i++) {
-			if (filter_bitmap(bitmap_git, tip_objects, to_filter,
-					  &filter->sub[i]) < 0)
+			if (filter_bitmap(bitmap_git, wants, tip_objects,
+					  to_filter, &filter->sub[i]) < 0)
 				return -1;
 		}
 		return 0;
@@ -1663,7 +2326,7 @@ static int filter_bitmap(struct bitmap_index *bitmap_git,
 
 static int can_filter_bitmap(struct list_objects_filter_options *filter)
 {
-	return !filter_bitmap(NULL, NULL, NULL, filter);
+	return !filter_bitmap(NULL, NULL, NULL, NULL, filter);
 }
 
 
@@ -1779,7 +2442,8 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	if (haves) {
 		if (use_boundary_traversal) {
 			trace2_region_enter("pack-bitmap", "haves/boundary", the_repository);
-			haves_bitmap = find_boundary_objects(bitmap_git, revs, haves);
+			haves_bitmap = find_boundary_objects(bitmap_git, revs, haves,
+							      wants);
 			trace2_region_leave("pack-bitmap", "haves/boundary", the_repository);
 		} else {
 			trace2_region_enter("pack-bitmap", "haves/classic", the_repository);
@@ -1807,7 +2471,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
-	filter_bitmap(bitmap_git,
+	filter_bitmap(bitmap_git, wants,
 		      (revs->filter.choice && filter_provided_objects) ? NULL : wants,
 		      wants_bitmap,
 		      &revs->filter);
@@ -1830,11 +2494,70 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 	return NULL;
 }
 
+uint32_t bitmapped_pack_pos(struct bitmap_index *bitmap_git,
+			    const struct bitmapped_pack *pack,
+			    uint32_t pos)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	uint32_t pack_pos;
+
+	if (pos < pack->bitmap_pos || pos >= pack->bitmap_pos + pack->bitmap_nr)
+		BUG("bit %"PRIu32" is not in the range of pack %s",
+		    pos, pack->p->pack_name);
+
+	/*
+	 * A pack none of whose objects the MIDX picked from another pack
+	 * (which the preferred pack, or the pack of a single-pack bitmap
+	 * always are) has a bit for each of its objects, in pack order.
+	 */
+	if (!m || pack->bitmap_nr == pack->p->num_objects)
+		return pos - pack->bitmap_pos;
+
+	if (offset_to_pack_pos(pack->p,
+			       nth_midxed_offset(m, pack_pos_to_midx(m, pos)),
+			       &pack_pos) < 0)
+		BUG("object at bit %"PRIu32" is not in pack %s",
+		    pos, pack->p->pack_name);
+	return pack_pos;
+}
+
 /*
- * -1 means "stop trying further objects"; 0 means we may or may not have
- * reused, but you can keep feeding bits.
+ * Find the bit of the base of a delta at "base_offset" in "pack", if the
+ * bitmap uses that copy of the base; return -1 otherwise.
  */
-static int try_partial_reuse(struct packed_git *pack,
+static int64_t delta_base_bitmap_pos(struct bitmap_index *bitmap_git,
+				     const struct bitmapped_pack *pack,
+				     off_t base_offset)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	struct object_id base_oid;
+	uint32_t base_pack_pos, midx_pos, pos;
+
+	if (offset_to_pack_pos(pack->p, base_offset, &base_pack_pos) < 0)
+		return -1;
+	if (!m || pack->bitmap_nr == pack->p->num_objects)
+		return pack->bitmap_pos + base_pack_pos;
+
+	/*
+	 * The MIDX may have picked a copy of the base in another pack,
+	 * in which case the delta would have to be rewritten to point
+	 * at that copy. Leave it to the normal code path.
+	 */
+	if (nth_packed_object_id(&base_oid, pack->p,
+				 pack_pos_to_index(pack->p, base_pack_pos)) ||
+	    !bsearch_midx(&base_oid, m, &midx_pos) ||
+	    nth_midxed_pack_int_id(m, midx_pos) != pack->pack_int_id ||
+	    midx_to_pack_pos(m, midx_pos, &pos) < 0)
+		return -1;
+	return pos;
+}
+
+/*
+ * -1 means "stop trying further objects from this pack"; 0 means we may
+ * or may not have reused, but you can keep feeding bits.
+ */
+static int try_partial_reuse(struct bitmap_index *bitmap_git,
+			     struct bitmapped_pack *pack,
 			     size_t pos,
 			     struct bitmap *reuse,
 			     struct pack_window **w_curs)
@@ -1844,39 +2567,24 @@ static int try_partial_reuse(struct packed_git *pack,
 	unsigned long size;
 
 	/*
-	 * try_partial_reuse() is called either on (a) objects in the
-	 * bitmapped pack (in the case of a single-pack bitmap) or (b)
-	 * objects in the preferred pack of a multi-pack bitmap.
-	 * Importantly, the latter can pretend as if only a single pack
-	 * exists because:
-	 *
-	 *   - The first pack->num_objects bits of a MIDX bitmap are
-	 *     reserved for the preferred pack, and
-	 *
-	 *   - Ties due to duplicate objects are always resolved in
-	 *     favor of the preferred pack.
-	 *
-	 * Therefore we do not need to ever ask the MIDX for its copy of
-	 * an object by OID, since it will always select it from the
-	 * preferred pack. Likewise, the selected copy of the base
-	 * object for any deltas will reside in the same pack.
-	 *
-	 * This means that we can reuse pos when looking up the bit in
-	 * the reuse bitmap, too, since bits corresponding to the
-	 * preferred pack precede all bits from other packs.
+	 * try_partial_reuse() is called on the objects of each pack we
+	 * reuse from: the bitmapped pack (in the case of a single-pack
+	 * bitmap), or the packs of a multi-pack bitmap. The bits of the
+	 * objects the MIDX picked from a pack are next to each other,
+	 * and in the order of the objects in that pack, so we can write
+	 * them out one pack after the other, and any delta we reuse has
+	 * its base earlier in the same pack.
 	 */
-
-	if (pos >= pack->num_objects)
-		return -1; /* not actually in the pack or MIDX preferred pack */
-
-	offset = delta_obj_offset = pack_pos_to_offset(pack, pos);
-	type = unpack_object_header(pack, w_curs, &offset, &size);
+	offset = delta_obj_offset =
+		pack_pos_to_offset(pack->p,
+				   bitmapped_pack_pos(bitmap_git, pack, pos));
+	type = unpack_object_header(pack->p, w_curs, &offset, &size);
 	if (type < 0)
 		return -1; /* broken packfile, punt */
 
 	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
 		off_t base_offset;
-		uint32_t base_pos;
+		int64_t base_pos;
 
 		/*
 		 * Find the position of the base object so we can look it up
@@ -1886,11 +2594,12 @@ static int try_partial_reuse(struct packed_git *pack,
 		 * and the normal slow path will complain about it in
 		 * more detail.
 		 */
-		base_offset = get_delta_base(pack, w_curs, &offset, type,
+		base_offset = get_delta_base(pack->p, w_curs, &offset, type,
 					     delta_obj_offset);
 		if (!base_offset)
 			return 0;
-		if (offset_to_pack_pos(pack, base_offset, &base_pos) < 0)
+		base_pos = delta_base_bitmap_pos(bitmap_git, pack, base_offset);
+		if (base_pos < 0)
 			return 0;
 
 		/*
@@ -1932,40 +2641,109 @@ uint32_t midx_preferred_pack(struct bitmap_index *bitmap_git)
 	return nth_midxed_pack_int_id(m, pack_pos_to_midx(bitmap_git->midx, 0));
 }
 
+/*
+ * Return the first bit in the MIDX's pseudo-pack order of an object
+ * picked from a pack that sorts at or after "order", where the preferred
+ * pack sorts as -1, and all other packs by their id.
+ */
+static uint32_t midx_order_bitmap_pos(struct multi_pack_index *m,
+				      uint32_t preferred, int64_t order)
+{
+	uint32_t lo = 0, hi = m->num_objects;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t id = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, mi));
+		int64_t mi_order = id == preferred ? -1 : (int64_t)id;
+
+		if (mi_order < order)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+static void collect_bitmapped_packs(struct bitmap_index *bitmap_git,
+				    int multi_pack_reuse,
+				    struct bitmapped_pack **packs_out,
+				    size_t *packs_nr_out)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	struct bitmapped_pack *packs;
+	uint32_t preferred, i;
+	size_t nr = 0;
+
+	if (!m) {
+		CALLOC_ARRAY(packs, 1);
+		packs[0].p = bitmap_git->pack;
+		packs[0].bitmap_nr = bitmap_git->pack->num_objects;
+		*packs_out = packs;
+		*packs_nr_out = 1;
+		return;
+	}
+
+	preferred = midx_preferred_pack(bitmap_git);
+	CALLOC_ARRAY(packs, multi_pack_reuse ? m->num_packs : 1);
+
+	/* The preferred pack comes first, followed by the others by id. */
+	packs[nr].p = m->packs[preferred];
+	packs[nr].pack_int_id = preferred;
+	packs[nr].bitmap_nr = m->packs[preferred]->num_objects;
+	nr++;
+
+	for (i = 0; multi_pack_reuse && i < m->num_packs; i++) {
+		uint32_t start, end;
+
+		if (i == preferred)
+			continue;
+		start = midx_order_bitmap_pos(m, preferred, i);
+		end = midx_order_bitmap_pos(m, preferred, (int64_t)i + 1);
+		if (start == end)
+			continue;
+
+		packs[nr].p = m->packs[i];
+		packs[nr].pack_int_id = i;
+		packs[nr].bitmap_pos = start;
+		packs[nr].bitmap_nr = end - start;
+		nr++;
+	}
+
+	*packs_out = packs;
+	*packs_nr_out = nr;
+}
+
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
-				       struct packed_git **packfile_out,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
 				       uint32_t *entries,
-				       struct bitmap **reuse_out)
+				       struct bitmap **reuse_out,
+				       int multi_pack_reuse)
 {
 	struct repository *r = the_repository;
-	struct packed_git *pack;
+	struct bitmapped_pack *packs = NULL;
 	struct bitmap *result = bitmap_git->result;
 	struct bitmap *reuse;
 	struct pack_window *w_curs = NULL;
-	size_t i = 0;
-	uint32_t offset;
+	size_t i = 0, packs_nr = 0, reused_nr = 0;
+	size_t p;
 	uint32_t objects_nr;
 
 	assert(result);
 
 	load_reverse_index(r, bitmap_git);
 
-	if (bitmap_is_midx(bitmap_git))
-		pack = bitmap_git->midx->packs[midx_preferred_pack(bitmap_git)];
-	else
-		pack = bitmap_git->pack;
-	objects_nr = pack->num_objects;
+	collect_bitmapped_packs(bitmap_git, multi_pack_reuse,
+				&packs, &packs_nr);
+	objects_nr = packs[0].bitmap_nr;
 
 	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
 		i++;
 
 	/*
-	 * Don't mark objects not in the packfile or preferred pack. This bitmap
-	 * marks objects eligible for reuse, but the pack-reuse code only
-	 * understands how to reuse a single pack. Since the preferred pack is
-	 * guaranteed to have all bases for its deltas (in a multi-pack bitmap),
-	 * we use it instead of another pack. In single-pack bitmaps, the choice
-	 * is made for us.
+	 * The first pack always has a bit for each of its objects, at the
+	 * start of the bitmap, so we can take all full words of it in one
+	 * go.
 	 */
 	if (i > objects_nr / BITS_IN_EWORD)
 		i = objects_nr / BITS_IN_EWORD;
@@ -1973,37 +2751,57 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	reuse = bitmap_word_alloc(i);
 	memset(reuse->words, 0xFF, i * sizeof(eword_t));
 
-	for (; i < result->word_alloc; ++i) {
-		eword_t word = result->words[i];
-		size_t pos = (i * BITS_IN_EWORD);
+	for (p = 0; p < packs_nr; p++) {
+		struct bitmapped_pack *pack = &packs[p];
+		size_t pos = pack->bitmap_pos;
+		size_t end = pack->bitmap_pos + pack->bitmap_nr;
+		int reused = 0;
 
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			if ((word >> offset) == 0)
+		if (!p)
+			pos = i * BITS_IN_EWORD;
+
+		while (pos < end) {
+			size_t word_pos = pos / BITS_IN_EWORD;
+			eword_t word;
+
+			if (word_pos >= result->word_alloc)
+				break;
+			word = result->words[word_pos] >> (pos % BITS_IN_EWORD);
+			if (!word) {
+				pos = (word_pos + 1) * BITS_IN_EWORD;
+				continue;
+			}
+			pos += ewah_bit_ctz64(word);
+			if (pos >= end)
 				break;
 
-			offset += ewah_bit_ctz64(word >> offset);
-			if (try_partial_reuse(pack, pos + offset,
+			if (try_partial_reuse(bitmap_git, pack, pos,
 					      reuse, &w_curs) < 0) {
 				/*
-				 * try_partial_reuse indicated we couldn't reuse
-				 * any bits, so there is no point in trying more
-				 * bits in the current word, or any other words
-				 * in result.
-				 *
-				 * Jump out of both loops to avoid future
-				 * unnecessary calls to try_partial_reuse.
+				 * try_partial_reuse indicated we couldn't
+				 * reuse this object, and will not be able to
+				 * reuse any later objects of this pack.
 				 */
-				goto done;
+				break;
 			}
+			if (bitmap_get(reuse, pos))
+				reused = 1;
+			pos++;
 		}
-	}
+		unuse_pack(&w_curs);
 
-done:
-	unuse_pack(&w_curs);
+		/*
+		 * Keep only the packs we actually reuse from, but always the
+		 * first one, whose leading words we may have taken above.
+		 */
+		if (!p || reused)
+			packs[reused_nr++] = *pack;
+	}
 
 	*entries = bitmap_popcount(reuse);
 	if (!*entries) {
 		bitmap_free(reuse);
+		free(packs);
 		return -1;
 	}
 
@@ -2012,7 +2810,8 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	 * need to be handled separately.
 	 */
 	bitmap_and_not(result, reuse);
-	*packfile_out = pack;
+	*packs_out = packs;
+	*packs_nr_out = reused_nr;
 	*reuse_out = reuse;
 	return 0;
 }
@@ -2054,13 +2853,28 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	uint32_t i = 0, count = 0;
 	struct ewah_iterator it;
-	eword_t filter;
+	const eword_t *literals;
+	eword_t fill;
+	size_t nr, j;
 
 	init_type_iterator(&it, bitmap_git, type);
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
-		count += ewah_bit_popcount64(word);
+	/*
+	 * Take the type bitmap a run at a time: runs of other types are
+	 * skipped, and the loops over the others are simple enough for
+	 * the compiler to vectorize.
+	 */
+	while ((nr = ewah_iterator_next_words(&literals, &fill,
+					      objects->word_alloc - i, &it))) {
+		if (literals) {
+			for (j = 0; j < nr; j++)
+				count += ewah_bit_popcount64(objects->words[i + j] &
+							     literals[j]);
+		} else if (fill) {
+			for (j = 0; j < nr; j++)
+				count += ewah_bit_popcount64(objects->words[i + j]);
+		}
+		i += nr;
 	}
 
 	for (i = 0; i < eindex->count; ++i) {
@@ -2295,19 +3109,29 @@ int test_bitmap_hashes(struct repository *r)
 	return 0;
 }
 
-int rebuild_bitmap(const uint32_t *reposition,
+int rebuild_bitmap(const uint32_t *reposition, uint32_t identical,
 		   struct ewah_bitmap *source,
 		   struct bitmap *dest)
 {
 	uint32_t pos = 0;
+	size_t identical_words = identical / BITS_IN_EWORD;
 	struct ewah_iterator it;
 	eword_t word;
 
+	if (identical_words)
+		bitmap_or_ewah_prefix(dest, source, identical_words);
+
 	ewah_iterator_init(&it, source);
 
 	while (ewah_iterator_next(&word, &it)) {
 		uint32_t offset, bit_pos;
 
+		if (identical_words) {
+			identical_words--;
+			pos += BITS_IN_EWORD;
+			continue;
+		}
+
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			if ((word >> offset) == 0)
 				break;
@@ -2327,7 +3151,9 @@ int rebuild_bitmap(const uint32_t *reposition,
 }
 
 uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
-				struct packing_data *mapping)
+				struct packing_data *mapping,
+				int name_hash_version,
+				uint32_t *identical)
 {
 	struct repository *r = the_repository;
 	uint32_t i, num_objects;
@@ -2341,6 +3167,7 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 
 	num_objects = bitmap_num_objects(bitmap_git);
 	CALLOC_ARRAY(reposition, num_objects);
+	*identical = 0;
 
 	for (i = 0; i < num_objects; ++i) {
 		struct object_id oid;
@@ -2356,19 +3183,39 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 
 		if (oe) {
 			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
-			if (bitmap_git->hashes && !oe->hash)
+			if (bitmap_git->hashes && !oe->hash &&
+			    bitmap_git->name_hash_version == name_hash_version)
 				oe->hash = get_be32(bitmap_git->hashes + index_pos);
 		}
+		if (*identical == i && reposition[i] == i + 1)
+			(*identical)++;
 	}
 
 	return reposition;
 }
 
+static void trace_commit_bitmap_stats(struct bitmap_index *b)
+{
+	if (!b->commit_bitmap_hits && !b->commit_bitmap_loads &&
+	    !b->commit_bitmap_misses)
+		return;
+
+	trace2_data_intmax("bitmap", the_repository, "commit_bitmap_hits",
+			   b->commit_bitmap_hits);
+	trace2_data_intmax("bitmap", the_repository, "commit_bitmap_loads",
+			   b->commit_bitmap_loads);
+	trace2_data_intmax("bitmap", the_repository, "commit_bitmap_misses",
+			   b->commit_bitmap_misses);
+	trace2_data_intmax("bitmap", the_repository, "commit_bitmap_xors",
+			   b->commit_bitmap_xors);
+}
+
 void free_bitmap_index(struct bitmap_index *b)
 {
 	if (!b)
 		return;
 
+	trace_commit_bitmap_stats(b);
 	if (b->map)
 		munmap(b->map, b->map_size);
 	ewah_pool_free(b->commits);
@@ -2388,6 +3235,8 @@ void free_bitmap_index(struct bitmap_index *b)
 	kh_destroy_oid_pos(b->ext_index.positions);
 	bitmap_free(b->result);
 	bitmap_free(b->haves);
+	tree_bitmap_cache_clear(&b->tree_cache);
+	free_pseudo_merges(b);
 	if (bitmap_is_midx(b)) {
 		/*
 		 * Multi-pack bitmaps need to have resources associated with
@@ -2411,6 +3260,14 @@ int bitmap_has_oid_in_uninteresting(struct bitmap_index *bitmap_git,
 		bitmap_walk_contains(bitmap_git, bitmap_git->haves, oid);
 }
 
+int bitmap_covers_oid(struct bitmap_index *bitmap_git,
+		      const struct object_id *oid)
+{
+	if (bitmap_is_midx(bitmap_git))
+		return bitmap_position_midx(bitmap_git, oid) >= 0;
+	return bitmap_position_packfile(bitmap_git, oid) >= 0;
+}
+
 static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 				     enum object_type object_type)
 {
@@ -2516,6 +3373,11 @@ int bitmap_is_midx(struct bitmap_index *bitmap_git)
 	return !!bitmap_git->midx;
 }
 
+int bitmap_name_hash_version(struct bitmap_index *bitmap_git)
+{
+	return bitmap_git->hashes ? bitmap_git->name_hash_version : 0;
+}
+
 const struct string_list *bitmap_preferred_tips(struct repository *r)
 {
 	const struct string_list *dest;
@@ -35,7 +35,19 @@ struct bitmap_disk_header {
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 0x1,
 	BITMAP_OPT_HASH_CACHE = 0x4,
+	BITMAP_OPT_HASH_CACHE_V2 = 0x8,
 	BITMAP_OPT_LOOKUP_TABLE = 0x10,
+	BITMAP_OPT_PSEUDO_MERGES = 0x20,
+};
+
+/*
+ * The union of the bitmaps of a group of commits ("commits" has their
+ * bits), which can be used instead of the individual bitmaps when all
+ * of them are wanted.
+ */
+struct pseudo_merge {
+	struct ewah_bitmap *commits;
+	struct ewah_bitmap *bitmap;
 };
 
 enum pack_bitmap_flags {
@@ -69,10 +81,44 @@ int test_bitmap_hashes(struct repository *r);
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 					 int filter_provided_objects);
 uint32_t midx_preferred_pack(struct bitmap_index *bitmap_git);
+
+/*
+ * A pack whose objects can be reused verbatim: the objects that the
+ * bitmap has picked from "p" have the "bitmap_nr" bits starting at
+ * "bitmap_pos", in the order of the objects in "p".
+ */
+struct bitmapped_pack {
+	struct packed_git *p;
+	uint32_t bitmap_pos;
+	uint32_t bitmap_nr;
+	uint32_t pack_int_id; /* for MIDX bitmaps only */
+};
+
+/*
+ * Return the position in "pack" of the object at bit "pos", which must
+ * be one of the bits of "pack".
+ */
+uint32_t bitmapped_pack_pos(struct bitmap_index *bitmap_git,
+			    const struct bitmapped_pack *pack,
+			    uint32_t pos);
+
+/*
+ * Find the objects of the last walk that can be sent verbatim from the
+ * packs they are in, i.e. whose deltas (if any) are against a base that
+ * is sent before them from the same pack. Those objects are removed
+ * from the result of the walk and set in "reuse_out"; the packs to send
+ * them from are returned in "packs_out", in the order of their bits.
+ *
+ * Only the pack of a single-pack bitmap, or the preferred pack of a
+ * multi-pack bitmap, is used unless "multi_pack_reuse" is set, in which
+ * case all packs of a multi-pack bitmap are.
+ */
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
-				       struct packed_git **packfile,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
 				       uint32_t *entries,
-				       struct bitmap **reuse_out);
+				       struct bitmap **reuse_out,
+				       int multi_pack_reuse);
 int rebuild_existing_bitmaps(struct bitmap_index *, struct packing_data *mapping,
 			     kh_oid_map_t *reused_bitmaps, int show_progress);
 void free_bitmap_index(struct bitmap_index *);
@@ -86,16 +132,95 @@ int bitmap_walk_contains(struct bitmap_index *,
  */
 int bitmap_has_oid_in_uninteresting(struct bitmap_index *, const struct object_id *oid);
 
+/*
+ * Return 1 if "oid" is in the pack or multi-pack index that the bitmaps
+ * are for. Bitmaps are only written for those which hold everything that
+ * is reachable from their objects, so all of this is present, too.
+ */
+int bitmap_covers_oid(struct bitmap_index *, const struct object_id *oid);
+
+/*
+ * Call "fn" on each object in the bitmap of "commit" itself, i.e. on
+ * everything that is reachable from it. Return -1 without calling "fn"
+ * if "commit" has no bitmap of its own, and otherwise the first non-zero
+ * value that "fn" returns, or 0.
+ */
+typedef int (*bitmapped_object_fn)(const struct object_id *oid, void *data);
+int for_each_commit_bitmap_object(struct bitmap_index *bitmap_git,
+				  struct commit *commit,
+				  bitmapped_object_fn fn, void *data);
+
 off_t get_disk_usage_from_bitmap(struct bitmap_index *, struct rev_info *);
 
+/*
+ * A cache of the bitmaps of all objects reachable from a tree, for
+ * trees that are reached again and again when filling in bitmaps (the
+ * unchanged subtrees of many commits). Its size is limited to
+ * "pack.bitmapTreeCacheSize" bytes.
+ */
+struct tree_bitmap_cache {
+	kh_oid_map_t *bitmaps;
+	size_t size, limit;
+};
+
+void tree_bitmap_cache_init(struct tree_bitmap_cache *cache,
+			    struct repository *r);
+void tree_bitmap_cache_clear(struct tree_bitmap_cache *cache);
+
+/* Return the bit position of "oid", or -1 if it has none. */
+typedef int (*tree_bitmap_pos_fn)(const struct object_id *oid, void *data);
+
+/*
+ * Set the bits of the tree "oid" and of all objects reachable from it in
+ * "bitmap". Subtrees whose bits are already set in "bitmap" or in "seen"
+ * (if not NULL) are not walked. The bitmaps of the trees that are
+ * walked in full are added to "cache", which may be NULL, and used when
+ * they are reached again.
+ *
+ * Return 0 on success, or -1 if a tree could not be read or an object
+ * has no position. The bit of "oid" is not set then, but those of some
+ * of the objects reachable from it may be.
+ */
+int fill_tree_bitmap(struct tree_bitmap_cache *cache,
+		     struct bitmap *bitmap, struct bitmap *seen,
+		     const struct object_id *oid,
+		     tree_bitmap_pos_fn find_pos, void *data);
+
 void bitmap_writer_show_progress(int show);
+
+/*
+ * Select the name-hash version (see pack_name_hash_version()) of the
+ * hashes in the packing list, which determines the format of the hash
+ * cache written with BITMAP_OPT_HASH_CACHE. If none is selected, the
+ * version of the existing bitmap the hashes are copied from is used.
+ */
+void bitmap_writer_set_name_hash_version(int version);
+/*
+ * The number of threads bitmap_writer_build() uses; 0 (the default) takes
+ * it from "pack.threads", or the number of CPUs.
+ */
+void bitmap_writer_set_threads(int threads);
 void bitmap_writer_set_checksum(const unsigned char *sha1);
 void bitmap_writer_build_type_index(struct packing_data *to_pack,
 				    struct pack_idx_entry **index,
 				    uint32_t index_nr);
+/*
+ * Map the positions of "bitmap_git" to those of the objects in "mapping"
+ * (plus one; zero for objects missing there). "identical" is set to the
+ * number of leading positions that map to themselves.
+ */
 uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
-				struct packing_data *mapping);
-int rebuild_bitmap(const uint32_t *reposition,
+				struct packing_data *mapping,
+				int name_hash_version,
+				uint32_t *identical);
+/*
+ * Translate "source" from the positions of an existing bitmap to those
+ * of the bitmap being written, using "reposition" from
+ * create_bitmap_mapping(). The first "identical" positions are known to
+ * be the same in both, and are copied word by word. Returns -1 if an
+ * object of "source" is not in the new bitmap.
+ */
+int rebuild_bitmap(const uint32_t *reposition, uint32_t identical,
 		   struct ewah_bitmap *source,
 		   struct bitmap *dest);
 struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
@@ -112,6 +237,12 @@ char *pack_bitmap_filename(struct packed_git *p);
 
 int bitmap_is_midx(struct bitmap_index *bitmap_git);
 
+/*
+ * Return the name-hash version of the hash cache of the bitmap, or 0 if
+ * it has none.
+ */
+int bitmap_name_hash_version(struct bitmap_index *bitmap_git);
+
 const struct string_list *bitmap_preferred_tips(struct repository *r);
 int bitmap_is_preferred_refname(struct repository *r, const char *refname);
 
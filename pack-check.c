@@ -8,6 +8,7 @@
 #include "packfile.h"
 #include "object-file.h"
 #include "object-store-ll.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -25,6 +26,11 @@ static int compare_entries(const void *e1, const void *e2)
 	return 0;
 }
 
+/*
+ * Like unpack_entry(), this must be called with obj_read_lock() held when
+ * object reading is multi-threaded; the lock is released while the data
+ * is summed, as the window that we use stays mapped in the meantime.
+ */
 int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 		   off_t offset, off_t len, unsigned int nr)
 {
@@ -36,7 +42,9 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 		void *data = use_pack(p, w_curs, offset, &avail);
 		if (avail > len)
 			avail = len;
+		obj_read_unlock();
 		data_crc = crc32(data_crc, data, avail);
+		obj_read_lock();
 		offset += avail;
 		len -= avail;
 	} while (len);
@@ -47,11 +55,262 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * What checking an object of the pack found out, for verify_entries() to
+ * report in pack order.
+ */
+struct verify_result {
+	void *data;
+	unsigned long size;
+	enum object_type type;
+	unsigned crc_mismatch : 1,
+		 unpack_failed : 1,
+		 corrupt : 1;
+};
+
+#define VERIFY_BATCH 256
+
+/*
+ * The objects are checked by threads in batches of VERIFY_BATCH objects
+ * in pack order, each with its own pack windows, zlib stream and hash
+ * context, while the calling thread reports on them and hands them to
+ * the callback in pack order. At most "window" batches are checked ahead
+ * of the one that is being reported on, whose results are kept in the
+ * slot of the batch modulo "window".
+ */
+struct verify_state {
+	struct repository *r;
+	struct packed_git *p;
+	struct idx_entry *entries;
+	uint32_t nr_objects;
+	uint32_t nr_batches;
+	uint32_t next_batch;
+	uint32_t reported;
+	uint32_t window;
+	struct verify_result *results;
+	/* For each slot, the number of the batch in it plus one, once done. */
+	uint32_t *slot_done;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void check_entry(struct verify_state *v, uint32_t i,
+			struct verify_result *res, struct pack_window **w_curs)
+{
+	struct packed_git *p = v->p;
+	off_t offset = v->entries[i].offset;
+	struct object_id oid;
+	off_t curpos;
+
+	memset(res, 0, sizeof(*res));
+	obj_read_lock();
+	if (nth_packed_object_id(&oid, p, v->entries[i].nr) < 0)
+		BUG("unable to get oid of object %lu from %s",
+		    (unsigned long)v->entries[i].nr, p->pack_name);
+
+	if (p->index_version > 1 &&
+	    check_pack_crc(p, w_curs, offset,
+			   v->entries[i + 1].offset - offset, v->entries[i].nr))
+		res->crc_mismatch = 1;
+
+	curpos = offset;
+	res->type = unpack_object_header(p, w_curs, &curpos, &res->size);
+	unuse_pack(w_curs);
+
+	if (res->type == OBJ_BLOB && big_file_threshold <= res->size) {
+		/*
+		 * Let stream_object_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		if (stream_object_signature(v->r, &oid) < 0)
+			res->corrupt = 1;
+		obj_read_unlock();
+		return;
+	}
+
+	res->data = unpack_entry(v->r, p, offset, &res->type, &res->size);
+	obj_read_unlock();
+	if (!res->data)
+		res->unpack_failed = 1;
+	else if (check_object_signature(v->r, &oid, res->data, res->size,
+					res->type) < 0)
+		res->corrupt = 1;
+}
+
+static int report_entry(struct verify_state *v, uint32_t i,
+			struct verify_result *res, verify_fn fn)
+{
+	struct packed_git *p = v->p;
+	struct object_id oid;
+	int err = 0;
+
+	nth_packed_object_id(&oid, p, v->entries[i].nr);
+	if (res->crc_mismatch)
+		err = error("index CRC mismatch for object %s "
+			    "from %s at offset %"PRIuMAX"",
+			    oid_to_hex(&oid),
+			    p->pack_name, (uintmax_t)v->entries[i].offset);
+
+	if (res->unpack_failed)
+		err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+			    oid_to_hex(&oid), p->pack_name,
+			    (uintmax_t)v->entries[i].offset);
+	else if (res->corrupt)
+		err = error("packed %s from %s is corrupt",
+			    oid_to_hex(&oid), p->pack_name);
+	else if (fn) {
+		int eaten = 0;
+
+		/* The callback may read objects while the threads do. */
+		obj_read_lock();
+		err |= fn(&oid, res->type, res->size, res->data, &eaten);
+		obj_read_unlock();
+		if (eaten)
+			res->data = NULL;
+	}
+	FREE_AND_NULL(res->data);
+	return err;
+}
+
+static void *verify_thread(void *arg)
+{
+	struct verify_state *v = arg;
+	struct pack_window *w_curs = NULL;
+
+	for (;;) {
+		struct verify_result *results;
+		uint32_t batch, i, end;
+
+		pthread_mutex_lock(&v->mutex);
+		while (v->next_batch < v->nr_batches &&
+		       v->next_batch >= v->reported + v->window)
+			pthread_cond_wait(&v->cond, &v->mutex);
+		batch = v->next_batch;
+		if (batch < v->nr_batches)
+			v->next_batch++;
+		pthread_mutex_unlock(&v->mutex);
+		if (batch >= v->nr_batches)
+			break;
+
+		results = v->results + (batch % v->window) * VERIFY_BATCH;
+		i = batch * VERIFY_BATCH;
+		end = i + VERIFY_BATCH;
+		if (end > v->nr_objects)
+			end = v->nr_objects;
+		for (; i < end; i++)
+			check_entry(v, i, &results[i % VERIFY_BATCH], &w_curs);
+
+		pthread_mutex_lock(&v->mutex);
+		v->slot_done[batch % v->window] = batch + 1;
+		pthread_cond_broadcast(&v->cond);
+		pthread_mutex_unlock(&v->mutex);
+	}
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
+/*
+ * Check the objects of the pack at "entries", which are sorted by
+ * offset, using up to "nr_threads" threads. The errors are reported and
+ * "fn" is called in pack order from the calling thread either way.
+ */
+static int verify_entries(struct repository *r, struct packed_git *p,
+			  struct idx_entry *entries, uint32_t nr_objects,
+			  verify_fn fn, struct progress *progress,
+			  uint32_t base_count, int nr_threads)
+{
+	struct verify_state v = {
+		.r = r,
+		.p = p,
+		.entries = entries,
+		.nr_objects = nr_objects,
+		.nr_batches = DIV_ROUND_UP(nr_objects, VERIFY_BATCH),
+	};
+	pthread_t *threads = NULL;
+	uint32_t i;
+	int err = 0;
+
+	if (!HAVE_THREADS || nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > v.nr_batches)
+		nr_threads = v.nr_batches;
+
+	if (nr_threads <= 1) {
+		struct pack_window *w_curs = NULL;
+		struct verify_result res;
+
+		for (i = 0; i < nr_objects; i++) {
+			check_entry(&v, i, &res, &w_curs);
+			err |= report_entry(&v, i, &res, fn);
+			if (((base_count + i) & 1023) == 0)
+				display_progress(progress, base_count + i);
+		}
+		unuse_pack(&w_curs);
+		display_progress(progress, base_count + i);
+		return err;
+	}
+
+	v.window = 2 * nr_threads;
+	CALLOC_ARRAY(v.results, (size_t)v.window * VERIFY_BATCH);
+	CALLOC_ARRAY(v.slot_done, v.window);
+	pthread_mutex_init(&v.mutex, NULL);
+	pthread_cond_init(&v.cond, NULL);
+	enable_obj_read_lock();
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL, verify_thread, &v);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t batch = i / VERIFY_BATCH;
+		uint32_t slot = batch % v.window;
+
+		if (!(i % VERIFY_BATCH)) {
+			pthread_mutex_lock(&v.mutex);
+			while (v.slot_done[slot] != batch + 1)
+				pthread_cond_wait(&v.cond, &v.mutex);
+			pthread_mutex_unlock(&v.mutex);
+		}
+
+		err |= report_entry(&v, i,
+				    &v.results[slot * VERIFY_BATCH + i % VERIFY_BATCH],
+				    fn);
+		if (((base_count + i) & 1023) == 0)
+			display_progress(progress, base_count + i);
+
+		if (i % VERIFY_BATCH == VERIFY_BATCH - 1 || i + 1 == nr_objects) {
+			pthread_mutex_lock(&v.mutex);
+			v.reported = batch + 1;
+			pthread_cond_broadcast(&v.cond);
+			pthread_mutex_unlock(&v.mutex);
+		}
+	}
+	display_progress(progress, base_count + i);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	disable_obj_read_lock();
+	pthread_cond_destroy(&v.cond);
+	pthread_mutex_destroy(&v.mutex);
+	free(threads);
+	free(v.slot_done);
+	free(v.results);
+	return err;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
@@ -66,6 +325,7 @@ static int verify_packfile(struct repository *r,
 	if (!is_pack_valid(p))
 		return error("packfile %s cannot be accessed", p->pack_name);
 
+	pack_set_access_pattern(p, PACK_ACCESS_SEQUENTIAL);
 	r->hash_algo->init_fn(&ctx);
 	do {
 		unsigned long remaining;
@@ -101,70 +361,11 @@ static int verify_packfile(struct repository *r,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		struct object_id oid;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (nth_packed_object_id(&oid, p, entries[i].nr) < 0)
-			BUG("unable to get oid of object %lu from %s",
-			    (unsigned long)entries[i].nr, p->pack_name);
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(&oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
-
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB && big_file_threshold <= size) {
-			/*
-			 * Let stream_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
-			data_valid = 1;
-		}
-
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(&oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (data && check_object_signature(r, &oid, data, size,
-							type) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (!data && stream_object_signature(r, &oid) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(&oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
-
-	}
-	display_progress(progress, base_count + i);
+	if (verify_entries(r, p, entries, nr_objects, fn, progress,
+			   base_count, nr_threads))
+		err = -1;
 	free(entries);
+	pack_set_access_pattern(p, PACK_ACCESS_NORMAL);
 
 	return err;
 }
@@ -184,7 +385,8 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count,
+		int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -193,7 +395,8 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
@@ -0,0 +1,128 @@
+#include "git-compat-util.h"
+#include "gettext.h"
+#include "pack-deltas.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "packfile.h"
+#include "strbuf.h"
+
+static char *pack_deltas_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.deltas", (int)len, p->pack_name);
+}
+
+#define DELTAS_HEADER_SIZE (12)
+
+static int load_pack_deltas_file(char *deltas_file,
+				 uint32_t num_objects,
+				 const unsigned char **data_p, size_t *len_p)
+{
+	int fd, ret = 0;
+	struct stat st;
+	unsigned char *data = NULL;
+	size_t deltas_size, expected_size;
+	uint32_t signature, version, hash_id;
+
+	fd = git_open(deltas_file);
+
+	if (fd < 0) {
+		ret = -1;
+		goto cleanup;
+	}
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), deltas_file);
+		goto cleanup;
+	}
+
+	deltas_size = xsize_t(st.st_size);
+
+	if (deltas_size < DELTAS_HEADER_SIZE) {
+		ret = error(_("deltas file %s is too small"), deltas_file);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, deltas_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	signature = get_be32(data);
+	version = get_be32(data + 4);
+	hash_id = get_be32(data + 8);
+
+	if (signature != DELTAS_SIGNATURE) {
+		ret = error(_("deltas file %s has unknown signature"), deltas_file);
+		goto cleanup;
+	}
+
+	if (version != DELTAS_VERSION) {
+		ret = error(_("deltas file %s has unsupported version %"PRIu32),
+			    deltas_file, version);
+		goto cleanup;
+	}
+
+	if (!(hash_id == 1 || hash_id == 2)) {
+		ret = error(_("deltas file %s has unsupported hash id %"PRIu32),
+			    deltas_file, hash_id);
+		goto cleanup;
+	}
+
+	expected_size = DELTAS_HEADER_SIZE;
+	expected_size = st_add(expected_size, DIV_ROUND_UP(num_objects, 8));
+	expected_size = st_add(expected_size, 2 * (hash_id == 1 ? GIT_SHA1_RAWSZ : GIT_SHA256_RAWSZ));
+
+	if (deltas_size != expected_size) {
+		ret = error(_("deltas file %s is corrupt"), deltas_file);
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret) {
+		if (data)
+			munmap(data, deltas_size);
+	} else {
+		*len_p = deltas_size;
+		*data_p = data;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+int load_pack_deltas(struct packed_git *p)
+{
+	char *deltas_name = NULL;
+	int ret;
+
+	if (p->deltas_map)
+		return 0; /* already loaded */
+	if (p->deltas_checked)
+		return -1; /* no usable .deltas file */
+	p->deltas_checked = 1;
+
+	ret = open_pack_index(p);
+	if (ret < 0)
+		goto cleanup;
+
+	deltas_name = pack_deltas_filename(p);
+	ret = load_pack_deltas_file(deltas_name,
+				    p->num_objects,
+				    &p->deltas_map,
+				    &p->deltas_size);
+cleanup:
+	free(deltas_name);
+	return ret;
+}
+
+int nth_packed_delta_settled(struct packed_git *p, uint32_t pos)
+{
+	if (!p->deltas_map)
+		BUG("pack .deltas file not loaded for %s", p->pack_name);
+	if (p->num_objects <= pos)
+		BUG("pack .deltas out-of-bounds (%"PRIu32" vs %"PRIu32")",
+		    pos, p->num_objects);
+
+	return !!(p->deltas_map[DELTAS_HEADER_SIZE + pos / 8] &
+		  (0x80 >> (pos % 8)));
+}
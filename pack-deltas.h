@@ -0,0 +1,27 @@
+#ifndef PACK_DELTAS_H
+#define PACK_DELTAS_H
+
+#define DELTAS_SIGNATURE 0x444c5441 /* "DLTA" */
+#define DELTAS_VERSION 1
+
+struct packed_git;
+
+/*
+ * Loads the .deltas file corresponding to "p", if any, returning zero
+ * on success. The file is only looked for once until the pack is
+ * closed.
+ */
+int load_pack_deltas(struct packed_git *p);
+
+/*
+ * Returns whether the object at position "pos" (in lexicographic/index
+ * order) in pack "p" is stored whole although pack-objects did search
+ * for a delta for it when the pack was written, i.e. whether searching
+ * it again against the objects of the same pack would be wasted effort.
+ *
+ * It is a BUG() to call this function unless load_pack_deltas()
+ * succeeded for "p".
+ */
+int nth_packed_delta_settled(struct packed_git *p, uint32_t pos);
+
+#endif
@@ -75,9 +75,9 @@ enum dfs_state {
  * compute_write_order(). "delta" and "delta_size" must remain valid
  * at object writing phase in case the delta is not cached.
  *
- * If a delta is cached in memory and is compressed, delta_data points
- * to the data and z_delta_size contains the compressed size. If it's
- * uncompressed [1], z_delta_size must be zero. delta_size is always
+ * If a delta is cached in memory and is compressed, oe_delta_data()
+ * points to the data and z_delta_size contains the compressed size. If
+ * it's uncompressed [1], z_delta_size must be zero. delta_size is always
  * the uncompressed size and must be valid even if the delta is not
  * cached.
  *
@@ -86,7 +86,6 @@ enum dfs_state {
  */
 struct object_entry {
 	struct pack_idx_entry idx;
-	void *delta_data;	/* cached delta (uncompressed) */
 	off_t in_pack_offset;
 	uint32_t hash;			/* name hint hash */
 	unsigned size_:OE_SIZE_BITS;
@@ -116,6 +115,12 @@ struct object_entry {
 	unsigned dfs_state:OE_DFS_STATE_BITS;
 	unsigned depth:OE_DEPTH_BITS;
 	unsigned ext_base:1; /* delta_idx points outside packlist */
+	unsigned delta_settled:1; /*
+				   * the delta search already had a go at
+				   * this object, in this run or (as
+				   * recorded in a .deltas file) when its
+				   * pack was written
+				   */
 };
 
 struct packing_data {
@@ -129,6 +134,13 @@ struct packing_data {
 	unsigned int *in_pack_pos;
 	unsigned long *delta_size;
 
+	/*
+	 * Cached deltas, see oe_delta_data(). Only allocated for the
+	 * delta search, as there is nothing to cache without it, rather
+	 * than making every object_entry pay for the pointer.
+	 */
+	void **delta_data;
+
 	/*
 	 * Only one of these can be non-NULL and they have different
 	 * sizes. if in_pack_by_idx is allocated, oe_in_pack() returns
@@ -206,6 +218,45 @@ static inline uint32_t pack_name_hash(const char *name)
 	return hash;
 }
 
+/*
+ * Version 2 of the name hash, which takes the full path into account:
+ * pack_name_hash() only looks at the last sixteen characters, so files
+ * of the same name in different directories (think "Makefile", or
+ * "index.js") all get the same hash.
+ *
+ * The high 16 bits are the same as those of pack_name_hash(), so that
+ * paths ending in the same way still sort next to each other, and the
+ * low 16 bits are an FNV-1a hash of the full path that tells paths of
+ * the same name apart.
+ */
+static inline uint32_t pack_name_hash_v2(const char *name)
+{
+	uint32_t c, hash = 0, full = 2166136261U;
+
+	if (!name)
+		return 0;
+
+	while ((c = (unsigned char)*name++) != 0) {
+		if (isspace(c))
+			continue;
+		hash = (hash >> 2) + (c << 24);
+		full = (full ^ c) * 16777619U;
+	}
+	return (hash & 0xffff0000) | ((full ^ (full >> 16)) & 0xffff);
+}
+
+static inline uint32_t pack_name_hash_version(const char *name, int version)
+{
+	switch (version) {
+	case 1:
+		return pack_name_hash(name);
+	case 2:
+		return pack_name_hash_v2(name);
+	default:
+		BUG("invalid name-hash version: %d", version);
+	}
+}
+
 static inline enum object_type oe_type(const struct object_entry *e)
 {
 	return e->type_valid ? e->type_ : OBJ_BAD;
@@ -270,6 +321,36 @@ void oe_set_delta_ext(struct packing_data *pack,
 		      struct object_entry *e,
 		      const struct object_id *oid);
 
+static inline void *oe_delta_data(const struct packing_data *pack,
+				  const struct object_entry *e)
+{
+	if (!pack->delta_data)
+		return NULL;
+	return pack->delta_data[e - pack->objects];
+}
+
+/*
+ * The array is allocated on the first use; the threaded delta search
+ * must call oe_prepare_delta_data() before it starts.
+ */
+static inline void oe_prepare_delta_data(struct packing_data *pack)
+{
+	if (!pack->delta_data)
+		CALLOC_ARRAY(pack->delta_data, pack->nr_alloc);
+}
+
+static inline void oe_set_delta_data(struct packing_data *pack,
+				     struct object_entry *e,
+				     void *data)
+{
+	if (!pack->delta_data) {
+		if (!data)
+			return;
+		oe_prepare_delta_data(pack);
+	}
+	pack->delta_data[e - pack->objects] = data;
+}
+
 static inline unsigned int oe_tree_depth(struct packing_data *pack,
 					 struct object_entry *e)
 {
@@ -9,6 +9,9 @@
 #include "parse.h"
 #include "midx.h"
 #include "csum-file.h"
+#include "lockfile.h"
+#include "pack.h"
+#include "path.h"
 
 struct revindex_entry {
 	off_t offset;
@@ -46,10 +49,10 @@ static void sort_revindex(struct revindex_entry *entries, unsigned n, off_t max)
 #define DIGIT_SIZE (16)
 #define BUCKETS (1 << DIGIT_SIZE)
 	/*
-	 * We want to know the bucket that a[i] will go into when we are using
-	 * the digit that is N bits from the (least significant) end.
+	 * We want to know the bucket that an offset will go into when we are
+	 * using the digit that is N bits from the (least significant) end.
 	 */
-#define BUCKET_FOR(a, i, bits) (((a)[(i)].offset >> (bits)) & (BUCKETS-1))
+#define BUCKET_FOR(ofs, bits) (((ofs) >> (bits)) & (BUCKETS-1))
 
 	/*
 	 * We need O(n) temporary storage. Rather than do an extra copy of the
@@ -59,36 +62,60 @@ static void sort_revindex(struct revindex_entry *entries, unsigned n, off_t max)
 	 * to "to".
 	 */
 	struct revindex_entry *tmp, *from, *to;
-	int bits;
+	int bits, rounds, r;
 	unsigned *pos;
+	unsigned i;
+
+	/*
+	 * If (max >> bits) is zero, then we know that the radix digit we are
+	 * on (and any higher) will be zero for all entries, and sorting by
+	 * it would be a no-op, as everybody lands in the same zero-th bucket.
+	 */
+	for (rounds = 0, bits = 0; max >> bits; bits += DIGIT_SIZE)
+		rounds++;
+	if (!rounds || n < 2)
+		return;
+
+	/*
+	 * A stable pass does not change the relative order of the entries,
+	 * so the number of entries landing in each bucket is the same no
+	 * matter which order we visit them in. Count the buckets for all
+	 * digits in a single sweep over the input, rather than re-reading
+	 * the whole array once per round just to build its histogram.
+	 */
+	CALLOC_ARRAY(pos, st_mult(rounds, BUCKETS));
+	for (i = 0; i < n; i++) {
+		off_t ofs = entries[i].offset;
+		for (r = 0; r < rounds; r++)
+			pos[r * BUCKETS + BUCKET_FOR(ofs, r * DIGIT_SIZE)]++;
+	}
 
-	ALLOC_ARRAY(pos, BUCKETS);
 	ALLOC_ARRAY(tmp, n);
 	from = entries;
 	to = tmp;
 
-	/*
-	 * If (max >> bits) is zero, then we know that the radix digit we are
-	 * on (and any higher) will be zero for all entries, and our loop will
-	 * be a no-op, as everybody lands in the same zero-th bucket.
-	 */
-	for (bits = 0; max >> bits; bits += DIGIT_SIZE) {
-		unsigned i;
+	for (r = 0, bits = 0; r < rounds; r++, bits += DIGIT_SIZE) {
+		unsigned *p = pos + r * BUCKETS;
 
-		memset(pos, 0, BUCKETS * sizeof(*pos));
+		/*
+		 * If every entry has the same value for this digit, the pass
+		 * would just copy the array over; skip it. This is common for
+		 * the upper digit of packs slightly larger than a multiple
+		 * of 64k.
+		 */
+		if (p[BUCKET_FOR(from[0].offset, bits)] == n)
+			continue;
 
 		/*
 		 * We want pos[i] to store the index of the last element that
 		 * will go in bucket "i" (actually one past the last element).
-		 * To do this, we first count the items that will go in each
+		 * We have already counted the items that will go in each
 		 * bucket, which gives us a relative offset from the last
 		 * bucket. We can then cumulatively add the index from the
 		 * previous bucket to get the true index.
 		 */
-		for (i = 0; i < n; i++)
-			pos[BUCKET_FOR(from, i, bits)]++;
 		for (i = 1; i < BUCKETS; i++)
-			pos[i] += pos[i-1];
+			p[i] += p[i-1];
 
 		/*
 		 * Now we can drop the elements into their correct buckets (in
@@ -104,7 +131,7 @@ static void sort_revindex(struct revindex_entry *entries, unsigned n, off_t max)
 		 * wrap-around with UINT_MAX.
 		 */
 		for (i = n - 1; i != UINT_MAX; i--)
-			to[--pos[BUCKET_FOR(from, i, bits)]] = from[i];
+			to[--p[BUCKET_FOR(from[i].offset, bits)]] = from[i];
 
 		/*
 		 * Now "to" contains the most sorted list, so we swap "from" and
@@ -291,19 +318,81 @@ int load_pack_revindex_from_disk(struct packed_git *p)
 	return ret;
 }
 
+/*
+ * Having just computed the reverse index of "p" in memory, save it as the
+ * .rev file that the pack was missing, so that the next process can mmap
+ * it instead of sorting all offsets again. This is only an optimization:
+ * if the file cannot be written (e.g., because the object directory is
+ * read-only or another process is writing it right now), quietly go on.
+ */
+static void write_pack_revindex_cache(struct packed_git *p)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	char *revindex_name;
+	uint32_t *pack_order;
+	const unsigned char *pack_hash;
+
+	if (git_env_bool(GIT_TEST_NO_WRITE_REV_INDEX, 0))
+		return;
+
+	revindex_name = pack_revindex_filename(p);
+	if (hold_lock_file_for_update(&lk, revindex_name, 0) < 0)
+		goto cleanup;
+
+	ALLOC_ARRAY(pack_order, p->num_objects);
+	for (size_t i = 0; i < p->num_objects; i++)
+		pack_order[i] = p->revindex[i].nr;
+
+	/* the .idx ends with the pack checksum followed by its own */
+	pack_hash = (const unsigned char *)p->index_data + p->index_size -
+		2 * the_hash_algo->rawsz;
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	write_rev_contents(f, pack_order, p->num_objects, pack_hash);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	free(pack_order);
+
+	if (adjust_shared_perm(get_lock_file_path(&lk)) < 0 ||
+	    commit_lock_file(&lk) < 0) {
+		rollback_lock_file(&lk);
+		goto cleanup;
+	}
+
+	trace2_data_string("revindex", the_repository, "cache-write",
+			   p->pack_name);
+
+cleanup:
+	free(revindex_name);
+}
+
 int load_pack_revindex(struct repository *r, struct packed_git *p)
 {
+	int ret = 1;
+
 	if (p->revindex || p->revindex_data)
 		return 0;
 
 	prepare_repo_settings(r);
 
-	if (r->settings.pack_read_reverse_index &&
-	    !load_pack_revindex_from_disk(p))
-		return 0;
-	else if (!create_pack_revindex_in_memory(p))
-		return 0;
-	return -1;
+	if (r->settings.pack_read_reverse_index) {
+		ret = load_pack_revindex_from_disk(p);
+		if (!ret)
+			return 0;
+	}
+
+	if (create_pack_revindex_in_memory(p))
+		return -1;
+
+	/*
+	 * Only fill in a missing .rev file; a broken one is left alone
+	 * for fsck to report.
+	 */
+	if (ret > 0 && r->settings.pack_read_reverse_index &&
+	    r->settings.pack_cache_reverse_index && p->pack_local)
+		write_pack_revindex_cache(p);
+	return 0;
 }
 
 /*
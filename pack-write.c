@@ -6,6 +6,7 @@
 #include "csum-file.h"
 #include "remote.h"
 #include "chunk-format.h"
+#include "pack-deltas.h"
 #include "pack-mtimes.h"
 #include "oidmap.h"
 #include "pack-objects.h"
@@ -210,6 +211,14 @@ static void write_rev_trailer(struct hashfile *f, const unsigned char *hash)
 	hashwrite(f, hash, the_hash_algo->rawsz);
 }
 
+void write_rev_contents(struct hashfile *f, uint32_t *pack_order,
+			uint32_t nr_objects, const unsigned char *hash)
+{
+	write_rev_header(f);
+	write_rev_index_positions(f, pack_order, nr_objects);
+	write_rev_trailer(f, hash);
+}
+
 const char *write_rev_file(const char *rev_name,
 			   struct pack_idx_entry **objects,
 			   uint32_t nr_objects,
@@ -271,10 +280,7 @@ const char *write_rev_file_order(const char *rev_name,
 	} else
 		return NULL;
 
-	write_rev_header(f);
-
-	write_rev_index_positions(f, pack_order, nr_objects);
-	write_rev_trailer(f, hash);
+	write_rev_contents(f, pack_order, nr_objects, hash);
 
 	if (rev_name && adjust_shared_perm(rev_name) < 0)
 		die(_("failed to make %s readable"), rev_name);
@@ -315,6 +321,63 @@ static void write_mtimes_trailer(struct hashfile *f, const unsigned char *hash)
 	hashwrite(f, hash, the_hash_algo->rawsz);
 }
 
+static void write_deltas_header(struct hashfile *f)
+{
+	hashwrite_be32(f, DELTAS_SIGNATURE);
+	hashwrite_be32(f, DELTAS_VERSION);
+	hashwrite_be32(f, oid_version(the_hash_algo));
+}
+
+/*
+ * Writes one bit for each of "objects", in lexicographic (index) order,
+ * which is set when the object was searched for a delta but is stored
+ * whole. The bits of each byte are used from the most significant one.
+ */
+static void write_deltas_objects(struct hashfile *f,
+				 struct pack_idx_entry **objects,
+				 uint32_t nr_objects)
+{
+	unsigned char byte = 0;
+	uint32_t i;
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *e = (struct object_entry*)objects[i];
+		if (e->delta_settled && !e->delta_idx)
+			byte |= 0x80 >> (i % 8);
+		if (i % 8 == 7) {
+			hashwrite_u8(f, byte);
+			byte = 0;
+		}
+	}
+	if (nr_objects % 8)
+		hashwrite_u8(f, byte);
+}
+
+static char *write_deltas_file(struct pack_idx_entry **objects,
+			       uint32_t nr_objects,
+			       const unsigned char *hash)
+{
+	struct strbuf tmp_file = STRBUF_INIT;
+	char *deltas_name;
+	struct hashfile *f;
+	int fd;
+
+	fd = odb_mkstemp(&tmp_file, "pack/tmp_deltas_XXXXXX");
+	deltas_name = strbuf_detach(&tmp_file, NULL);
+	f = hashfd(fd, deltas_name);
+
+	write_deltas_header(f);
+	write_deltas_objects(f, objects, nr_objects);
+	hashwrite(f, hash, the_hash_algo->rawsz);
+
+	if (adjust_shared_perm(deltas_name) < 0)
+		die(_("failed to make %s readable"), deltas_name);
+
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+
+	return deltas_name;
+}
+
 static char *write_mtimes_file(struct packing_data *to_pack,
 			       struct pack_idx_entry **objects,
 			       uint32_t nr_objects,
@@ -548,6 +611,7 @@ void stage_tmp_packfiles(struct strbuf *name_buffer,
 {
 	const char *rev_tmp_name = NULL;
 	char *mtimes_tmp_name = NULL;
+	char *deltas_tmp_name = NULL;
 
 	if (adjust_shared_perm(pack_tmp_name))
 		die_errno("unable to make temporary pack file readable");
@@ -566,14 +630,21 @@ void stage_tmp_packfiles(struct strbuf *name_buffer,
 						    hash);
 	}
 
+	if (pack_idx_opts->flags & WRITE_DELTAS)
+		deltas_tmp_name = write_deltas_file(written_list, nr_written,
+						    hash);
+
 	rename_tmp_packfile(name_buffer, pack_tmp_name, "pack");
 	if (rev_tmp_name)
 		rename_tmp_packfile(name_buffer, rev_tmp_name, "rev");
 	if (mtimes_tmp_name)
 		rename_tmp_packfile(name_buffer, mtimes_tmp_name, "mtimes");
+	if (deltas_tmp_name)
+		rename_tmp_packfile(name_buffer, deltas_tmp_name, "deltas");
 
 	free((char *)rev_tmp_name);
 	free(mtimes_tmp_name);
+	free(deltas_tmp_name);
 }
 
 void write_promisor_file(const char *promisor_name, struct ref **sought, int nr_sought)
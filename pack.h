@@ -47,6 +47,7 @@ struct pack_idx_option {
 #define WRITE_REV 04
 #define WRITE_REV_VERIFY 010
 #define WRITE_MTIMES 020
+#define WRITE_DELTAS 040
 
 	uint32_t version;
 	uint32_t off32_limit;
@@ -87,7 +88,12 @@ typedef int (*verify_fn)(const struct object_id *, enum object_type, unsigned lo
 const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
 int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 int verify_pack_index(struct packed_git *);
-int verify_pack(struct repository *, struct packed_git *, verify_fn fn, struct progress *, uint32_t);
+/*
+ * Verify the pack and its index, calling "fn" on each object in pack
+ * order. The objects are read and checked by up to "nr_threads" threads,
+ * but "fn" is only ever called from the calling thread.
+ */
+int verify_pack(struct repository *, struct packed_git *, verify_fn fn, struct progress *, uint32_t, int nr_threads);
 off_t write_pack_header(struct hashfile *f, uint32_t);
 void fixup_pack_header_footer(int, unsigned char *, const char *, uint32_t, unsigned char *, off_t);
 char *index_pack_lockfile(int fd, int *is_well_formed);
@@ -99,6 +105,13 @@ void write_promisor_file(const char *promisor_name, struct ref **sought, int nr_
 const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *hash, unsigned flags);
 const char *write_rev_file_order(const char *rev_name, uint32_t *pack_order, uint32_t nr_objects, const unsigned char *hash, unsigned flags);
 
+/*
+ * Write the header, the pack positions in "pack_order" and the trailing
+ * pack checksum "hash" of a .rev file to "f"; the caller takes care of
+ * opening and finalizing the file.
+ */
+void write_rev_contents(struct hashfile *f, uint32_t *pack_order, uint32_t nr_objects, const unsigned char *hash);
+
 /*
  * The "hdr" output buffer should be at least this big, which will handle sizes
  * up to 2^67.
@@ -3,6 +3,7 @@
 #include "gettext.h"
 #include "hex.h"
 #include "list.h"
+#include "oamap.h"
 #include "pack.h"
 #include "repository.h"
 #include "dir.h"
@@ -15,6 +16,7 @@
 #include "object.h"
 #include "tag.h"
 #include "trace.h"
+#include "trace2.h"
 #include "tree-walk.h"
 #include "tree.h"
 #include "object-file.h"
@@ -349,6 +351,16 @@ static void close_pack_mtimes(struct packed_git *p)
 	p->mtimes_map = NULL;
 }
 
+static void close_pack_deltas(struct packed_git *p)
+{
+	p->deltas_checked = 0;
+	if (!p->deltas_map)
+		return;
+
+	munmap((void *)p->deltas_map, p->deltas_size);
+	p->deltas_map = NULL;
+}
+
 void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
@@ -356,6 +368,7 @@ void close_pack(struct packed_git *p)
 	close_pack_index(p);
 	close_pack_revindex(p);
 	close_pack_mtimes(p);
+	close_pack_deltas(p);
 	oidset_clear(&p->bad_objects);
 }
 
@@ -379,7 +392,7 @@ void close_object_store(struct raw_object_store *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes"};
+	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes", ".deltas", ".boundary"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -623,6 +636,42 @@ static int in_window(struct pack_window *win, off_t offset)
 		&& (offset + the_hash_algo->rawsz) <= (win_off + win->len);
 }
 
+static void advise_pack_window(struct packed_git *p, struct pack_window *win)
+{
+#if defined(HAVE_MADVISE) && !defined(NO_MMAP)
+	int advice;
+
+	switch (p->access_pattern) {
+	case PACK_ACCESS_SEQUENTIAL:
+		advice = MADV_SEQUENTIAL;
+		break;
+	case PACK_ACCESS_RANDOM:
+		advice = MADV_RANDOM;
+		break;
+	default:
+		advice = MADV_NORMAL;
+		break;
+	}
+
+	/* These are only hints; failing to apply them is harmless. */
+	madvise(win->base, win->len, advice);
+	if (p->access_pattern == PACK_ACCESS_SEQUENTIAL)
+		madvise(win->base, win->len, MADV_WILLNEED);
+#endif
+}
+
+void pack_set_access_pattern(struct packed_git *p,
+			     enum pack_access_pattern pattern)
+{
+	struct pack_window *win;
+
+	if (p->access_pattern == pattern)
+		return;
+	p->access_pattern = pattern;
+	for (win = p->windows; win; win = win->next)
+		advise_pack_window(p, win);
+}
+
 unsigned char *use_pack(struct packed_git *p,
 		struct pack_window **w_cursor,
 		off_t offset,
@@ -672,10 +721,15 @@ unsigned char *use_pack(struct packed_git *p,
 			if (win->base == MAP_FAILED)
 				die_errno(_("packfile %s cannot be mapped%s"),
 					  p->pack_name, mmap_os_err());
+			if (p->access_pattern != PACK_ACCESS_NORMAL)
+				advise_pack_window(p, win);
 			if (!win->offset && win->len == p->pack_size
 				&& !p->do_not_close)
 				close_pack_fd(p);
 			pack_mmap_calls++;
+			trace2_counter_add(TRACE2_COUNTER_ID_PACK_MMAP, 1);
+			trace2_counter_add(TRACE2_COUNTER_ID_PACK_MMAP_BYTES,
+					   win->len);
 			pack_open_windows++;
 			if (pack_mapped > peak_pack_mapped)
 				peak_pack_mapped = pack_mapped;
@@ -890,7 +944,9 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor") ||
-	    ends_with(file_name, ".mtimes"))
+	    ends_with(file_name, ".mtimes") ||
+	    ends_with(file_name, ".deltas") ||
+	    ends_with(file_name, ".boundary"))
 		string_list_append(data->garbage, full_name);
 	else
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
@@ -990,6 +1046,59 @@ static void prepare_packed_git_mru(struct repository *r)
 		list_add_tail(&p->mru, &r->objects->packed_git_mru);
 }
 
+static void get_path_times(struct object_directory *odb, const char *name,
+			   struct odb_path_times *times)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+
+	strbuf_addf(&path, "%s/%s", odb->path, name);
+	if (stat(path.buf, &st)) {
+		memset(times, 0, sizeof(*times));
+	} else {
+		times->mtime_sec = st.st_mtime;
+		times->mtime_nsec = ST_MTIME_NSEC(st);
+		times->ctime_sec = st.st_ctime;
+		times->ctime_nsec = ST_CTIME_NSEC(st);
+	}
+	strbuf_release(&path);
+}
+
+/*
+ * Whether "name" in "odb" may have changed since it was read at "when".
+ * Adding, removing or renaming a pack changes the times of the pack
+ * directory, and writing the alternates file changes its times. But
+ * a change within a second of reading might not, so such recent times
+ * count as changed.
+ */
+static int path_changed(struct object_directory *odb, const char *name,
+			const struct odb_path_times *old, time_t when)
+{
+	struct odb_path_times cur;
+
+	get_path_times(odb, name, &cur);
+	if (cur.mtime_sec + 1 >= (uint64_t)when ||
+	    cur.ctime_sec + 1 >= (uint64_t)when)
+		return 1;
+	return memcmp(&cur, old, sizeof(cur));
+}
+
+static int packed_git_changed(struct repository *r)
+{
+	struct object_directory *odb;
+	time_t when = r->objects->packed_git_prepared_at;
+
+	if (!r->objects->packed_git_initialized)
+		return 1;
+	for (odb = r->objects->odb; odb; odb = odb->next)
+		if (!odb->packs_prepared ||
+		    path_changed(odb, "pack", &odb->pack_dir_times, when) ||
+		    path_changed(odb, "info/alternates",
+				 &odb->alternates_times, when))
+			return 1;
+	return 0;
+}
+
 static void prepare_packed_git(struct repository *r)
 {
 	struct object_directory *odb;
@@ -997,9 +1106,15 @@ static void prepare_packed_git(struct repository *r)
 	if (r->objects->packed_git_initialized)
 		return;
 
+	r->objects->packed_git_prepared_at = time(NULL);
 	prepare_alt_odb(r);
 	for (odb = r->objects->odb; odb; odb = odb->next) {
 		int local = (odb == r->objects->odb);
+
+		get_path_times(odb, "pack", &odb->pack_dir_times);
+		get_path_times(odb, "info/alternates", &odb->alternates_times);
+		odb->packs_prepared = 1;
+
 		prepare_multi_pack_index_one(r, odb->path, local);
 		prepare_packed_git_one(r, odb->path, local);
 	}
@@ -1015,6 +1130,21 @@ void reprepare_packed_git(struct repository *r)
 
 	obj_read_lock();
 
+	for (odb = r->objects->odb; odb; odb = odb->next)
+		odb_clear_loose_cache(odb);
+
+	r->objects->approximate_object_count_valid = 0;
+
+	/*
+	 * Callers come here whenever an object is not found, which adds
+	 * up with many alternates. Neither the alternates nor the packs
+	 * need to be read again if none of the directories changed.
+	 */
+	if (!packed_git_changed(r)) {
+		obj_read_unlock();
+		return;
+	}
+
 	/*
 	 * Reprepare alt odbs, in case the alternates file was modified
 	 * during the course of this process. This only _adds_ odbs to
@@ -1024,10 +1154,6 @@ void reprepare_packed_git(struct repository *r)
 	r->objects->loaded_alternates = 0;
 	prepare_alt_odb(r);
 
-	for (odb = r->objects->odb; odb; odb = odb->next)
-		odb_clear_loose_cache(odb);
-
-	r->objects->approximate_object_count_valid = 0;
 	r->objects->packed_git_initialized = 0;
 	prepare_packed_git(r);
 	obj_read_unlock();
@@ -1358,10 +1484,27 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
+/*
+ * The delta base cache is split into shards keyed by (pack, offset), each
+ * with its own open-addressing map (see oamap.h), LRU list and share of delta_base_cache_limit. When
+ * object reading is multi-threaded (see enable_obj_read_lock()), every
+ * shard is protected by its own mutex, so that threads unpacking objects
+ * from different parts of a pack do not contend on a single lock. In the
+ * single-threaded case only the first shard is used, and it is given the
+ * whole budget.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
 
-static LIST_HEAD(delta_base_cache_lru);
+struct delta_base_cache_shard {
+	struct oamap map;
+	struct list_head lru;
+	size_t cached;
+	pthread_mutex_t mutex;
+};
+
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static unsigned int delta_base_cache_nr_shards = 1;
+static int delta_base_cache_use_lock;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1369,7 +1512,7 @@ struct delta_base_cache_key {
 };
 
 struct delta_base_cache_entry {
-	struct hashmap_entry ent;
+	unsigned int hash;
 	struct delta_base_cache_key key;
 	struct list_head lru;
 	void *data;
@@ -1386,134 +1529,245 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+static struct delta_base_cache_shard *delta_base_cache_shard(unsigned int hash)
 {
-	struct hashmap_entry entry, *e;
-	struct delta_base_cache_key key;
+	return &delta_base_cache[hash % delta_base_cache_nr_shards];
+}
 
-	if (!delta_base_cache.cmpfn)
-		return NULL;
+static void delta_base_cache_lock(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_use_lock)
+		pthread_mutex_lock(&shard->mutex);
+}
 
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	e = hashmap_get(&delta_base_cache, &entry, &key);
-	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
+static void delta_base_cache_unlock(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_use_lock)
+		pthread_mutex_unlock(&shard->mutex);
 }
 
-static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
-				   const struct delta_base_cache_key *b)
+/*
+ * Look up the entry for "base_offset" in "p". The caller must hold the
+ * lock of the shard that contains the entry.
+ */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   unsigned int hash,
+			   struct packed_git *p, off_t base_offset)
 {
-	return a->p == b->p && a->base_offset == b->base_offset;
+	struct delta_base_cache_key key;
+
+	key.p = p;
+	key.base_offset = base_offset;
+	return oamap_get(&shard->map, hash, &key);
 }
 
-static int delta_base_cache_hash_cmp(const void *cmp_data UNUSED,
-				     const struct hashmap_entry *va,
-				     const struct hashmap_entry *vb,
-				     const void *vkey)
+static int delta_base_cache_cmp(const void *cmp_data UNUSED,
+				const void *ventry, const void *vkey)
 {
-	const struct delta_base_cache_entry *a, *b;
+	const struct delta_base_cache_entry *ent = ventry;
 	const struct delta_base_cache_key *key = vkey;
 
-	a = container_of(va, const struct delta_base_cache_entry, ent);
-	b = container_of(vb, const struct delta_base_cache_entry, ent);
-
-	if (key)
-		return !delta_base_cache_key_eq(&a->key, key);
-	else
-		return !delta_base_cache_key_eq(&a->key, &b->key);
+	return ent->key.p != key->p || ent->key.base_offset != key->base_offset;
 }
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard(hash);
+	int ret;
+
+	delta_base_cache_lock(shard);
+	ret = !!get_delta_base_cache_entry(shard, hash, p, base_offset);
+	delta_base_cache_unlock(shard);
+	return ret;
 }
 
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
- * should copy out any fields it wants before detaching.
+ * should copy out any fields it wants before detaching. The caller must
+ * hold the lock of "shard".
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
+	oamap_remove_entry(&shard->map, ent->hash, ent);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
+	shard->cached -= ent->size;
 	free(ent);
 }
 
+/*
+ * If "base_offset" in "p" is in the cache, remove it and transfer the
+ * ownership of its data to the caller. Returns NULL if there is no such
+ * entry.
+ */
+static void *take_delta_base_cache_entry(struct packed_git *p, off_t base_offset,
+					 unsigned long *size,
+					 enum object_type *type)
+{
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard(hash);
+	struct delta_base_cache_entry *ent;
+	void *data = NULL;
+
+	delta_base_cache_lock(shard);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		data = ent->data;
+		*size = ent->size;
+		*type = ent->type;
+		detach_delta_base_cache_entry(shard, ent);
+	}
+	delta_base_cache_unlock(shard);
+	trace2_counter_add(data ? TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT :
+			   TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS, 1);
+	return data;
+}
+
 static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard(hash);
 	struct delta_base_cache_entry *ent;
+	void *data = NULL;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
-		return unpack_entry(r, p, base_offset, type, base_size);
+	delta_base_cache_lock(shard);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		if (type)
+			*type = ent->type;
+		if (base_size)
+			*base_size = ent->size;
+		data = xmemdupz(ent->data, ent->size);
+	}
+	delta_base_cache_unlock(shard);
 
-	if (type)
-		*type = ent->type;
-	if (base_size)
-		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	/* a miss is counted by unpack_entry() looking it up again */
+	if (data)
+		trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT, 1);
+
+	if (!data)
+		data = unpack_entry(r, p, base_offset, type, base_size);
+	return data;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static inline void release_delta_base_cache(struct delta_base_cache_shard *shard,
+					    struct delta_base_cache_entry *ent)
 {
 	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	detach_delta_base_cache_entry(shard, ent);
 }
 
-void clear_delta_base_cache(void)
+static void clear_delta_base_cache_shard(struct delta_base_cache_shard *shard)
 {
 	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
+
+	if (!shard->map.cmpfn)
+		return;
+
+	list_for_each_safe(lru, tmp, &shard->lru) {
 		struct delta_base_cache_entry *entry =
 			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+		release_delta_base_cache(shard, entry);
+	}
+}
+
+void clear_delta_base_cache(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < delta_base_cache_nr_shards; i++) {
+		delta_base_cache_lock(&delta_base_cache[i]);
+		clear_delta_base_cache_shard(&delta_base_cache[i]);
+		delta_base_cache_unlock(&delta_base_cache[i]);
 	}
 }
 
+void enable_delta_base_cache_lock(void)
+{
+	unsigned int i;
+
+	if (delta_base_cache_use_lock)
+		return;
+
+	/*
+	 * Entries are distributed according to the number of shards, so
+	 * start over with an empty cache when that number changes.
+	 */
+	clear_delta_base_cache();
+	delta_base_cache_nr_shards = DELTA_BASE_CACHE_SHARDS;
+	for (i = 0; i < delta_base_cache_nr_shards; i++)
+		pthread_mutex_init(&delta_base_cache[i].mutex, NULL);
+	delta_base_cache_use_lock = 1;
+}
+
+void disable_delta_base_cache_lock(void)
+{
+	unsigned int i;
+
+	if (!delta_base_cache_use_lock)
+		return;
+
+	delta_base_cache_use_lock = 0;
+	clear_delta_base_cache();
+	for (i = 0; i < delta_base_cache_nr_shards; i++)
+		pthread_mutex_destroy(&delta_base_cache[i].mutex);
+	delta_base_cache_nr_shards = 1;
+}
+
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard(hash);
+	size_t limit = delta_base_cache_limit / delta_base_cache_nr_shards;
 	struct delta_base_cache_entry *ent;
 	struct list_head *lru, *tmp;
 
+	delta_base_cache_lock(shard);
+
+	if (!shard->map.cmpfn) {
+		oamap_init(&shard->map, delta_base_cache_cmp, NULL, 0);
+		INIT_LIST_HEAD(&shard->lru);
+	}
+
 	/*
 	 * Check required to avoid redundant entries when more than one thread
 	 * is unpacking the same object, in unpack_entry() (since its phases I
 	 * and III might run concurrently across multiple threads).
 	 */
-	if (in_delta_base_cache(p, base_offset)) {
+	if (get_delta_base_cache_entry(shard, hash, p, base_offset)) {
+		delta_base_cache_unlock(shard);
 		free(base);
 		return;
 	}
 
-	delta_base_cached += base_size;
+	shard->cached += base_size;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
+	list_for_each_safe(lru, tmp, &shard->lru) {
 		struct delta_base_cache_entry *f =
 			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
+		if (shard->cached <= limit)
 			break;
-		release_delta_base_cache(f);
+		release_delta_base_cache(shard, f);
 	}
 
 	ent = xmalloc(sizeof(*ent));
+	ent->hash = hash;
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	list_add_tail(&ent->lru, &shard->lru);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, &ent->ent);
+	oamap_add(&shard->map, hash, ent);
+
+	delta_base_cache_unlock(shard);
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1605,10 +1859,10 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	return type;
 }
 
-static void *unpack_compressed_entry(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t curpos,
-				    unsigned long size)
+static void *do_unpack_compressed_entry(struct packed_git *p,
+				       struct pack_window **w_curs,
+				       off_t curpos,
+				       unsigned long size)
 {
 	int st;
 	git_zstream stream;
@@ -1617,6 +1871,27 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+#ifdef USE_LIBDEFLATE
+	/*
+	 * An object that lies entirely within one window can be inflated
+	 * in one call; the window may extend past its end, which is fine.
+	 */
+	{
+		unsigned long avail;
+		unsigned long used;
+
+		in = use_pack(p, w_curs, curpos, &avail);
+		obj_read_unlock();
+		used = git_inflate_oneshot(buffer, size, in, avail);
+		obj_read_lock();
+		if (used) {
+			buffer[size] = '\0';
+			return buffer;
+		}
+	}
+#endif
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1650,6 +1925,19 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
+static void *unpack_compressed_entry(struct packed_git *p,
+				    struct pack_window **w_curs,
+				    off_t curpos,
+				    unsigned long size)
+{
+	void *buffer;
+
+	trace2_timer_start(TRACE2_TIMER_ID_INFLATE);
+	buffer = do_unpack_compressed_entry(p, w_curs, curpos, size);
+	trace2_timer_stop(TRACE2_TIMER_ID_INFLATE);
+	return buffer;
+}
+
 static void write_pack_access_log(struct packed_git *p, off_t obj_offset)
 {
 	static struct trace_key pack_access = TRACE_KEY_INIT(PACK_ACCESS);
@@ -1660,12 +1948,68 @@ static void write_pack_access_log(struct packed_git *p, off_t obj_offset)
 int do_check_packed_object_crc;
 
 #define UNPACK_ENTRY_STACK_PREALLOC 64
+#define DELTA_CHAIN_COMPOSE_MIN (64 * 1024)
 struct unpack_entry_stack_ent {
 	off_t obj_offset;
 	off_t curpos;
 	unsigned long size;
 };
 
+/*
+ * Apply all but the last of the "*stack_nr" deltas on "stack" to "base",
+ * the object at "*obj_offset", by composing them into one delta instead
+ * of recreating each object in between, and cache "base". On success,
+ * return the base of the last delta and update "*size", "*obj_offset" and
+ * "*stack_nr" to describe it. Otherwise return "base" and leave it to the
+ * caller to apply the deltas one by one and report what went wrong.
+ */
+static void *compose_delta_chain(struct packed_git *p,
+				 struct pack_window **w_curs,
+				 struct unpack_entry_stack_ent *stack,
+				 int *stack_nr, off_t *obj_offset,
+				 void *base, unsigned long *size,
+				 enum object_type type)
+{
+	struct delta_chain chain;
+	void **deltas;
+	void *data = NULL;
+	unsigned long data_size;
+	int i, nr_deltas = 0;
+
+	ALLOC_ARRAY(deltas, *stack_nr - 1);
+	delta_chain_init(&chain, *size);
+	for (i = *stack_nr - 1; i > 0; i--) {
+		void *delta = unpack_compressed_entry(p, w_curs, stack[i].curpos,
+						      stack[i].size);
+		if (!delta)
+			break;
+		deltas[nr_deltas++] = delta;
+		if (delta_chain_append(&chain, delta, stack[i].size))
+			break;
+	}
+
+	if (!i) {
+		/* See the comment on patch_delta() in unpack_entry(). */
+		obj_read_unlock();
+		data = delta_chain_apply(&chain, base, *size, &data_size);
+		obj_read_lock();
+	}
+
+	delta_chain_release(&chain);
+	for (i = 0; i < nr_deltas; i++)
+		free(deltas[i]);
+	free(deltas);
+
+	if (!data)
+		return base;
+
+	add_delta_base_cache(p, *obj_offset, base, *size, type);
+	*obj_offset = stack[1].obj_offset;
+	*size = data_size;
+	*stack_nr = 1;
+	return data;
+}
+
 void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		   enum object_type *final_type, unsigned long *final_size)
 {
@@ -1679,20 +2023,16 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
 
+	trace2_timer_start(TRACE2_TIMER_ID_UNPACK_ENTRY);
 	write_pack_access_log(p, obj_offset);
 
 	/* PHASE 1: drill down to the innermost base object */
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+
+		data = take_delta_base_cache_entry(p, curpos, &size, &type);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
@@ -1775,6 +2115,21 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 	/* PHASE 3: apply deltas in order */
 
+	/*
+	 * Of the objects in between the base and the object we want, only
+	 * the base of the latter is likely to be wanted again soon, e.g. by
+	 * "log -p" going on to an older version of a file. So there is no
+	 * need to recreate the others in full one after the other.
+	 *
+	 * That does not hold for small objects like trees, which a walk
+	 * reads from all over their delta chains, and which are cheap to
+	 * recreate. Keep them in the delta base cache instead.
+	 */
+	if (data && delta_stack_nr > 2 && size >= DELTA_CHAIN_COMPOSE_MIN)
+		data = compose_delta_chain(p, &w_curs, delta_stack,
+					   &delta_stack_nr, &obj_offset,
+					   data, &size, type);
+
 	/* invariants:
 	 *   'data' holds the base data, or NULL if there was corruption
 	 */
@@ -1834,8 +2189,17 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Both "base" and "delta_data" are private to us at
+			 * this point, so there is no need to hold the
+			 * obj_read_mutex while applying the delta. Letting go
+			 * of it allows other threads to read objects while we
+			 * crunch through long delta chains.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -1852,11 +2216,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		/*
 		 * We delay adding `base` to the cache until the end of the loop
-		 * because unpack_compressed_entry() momentarily releases the
-		 * obj_read_mutex, giving another thread the chance to access
-		 * the cache. Therefore, if `base` was already there, this other
-		 * thread could free() it (e.g. to make space for another entry)
-		 * before we are done using it.
+		 * because unpack_compressed_entry() and patch_delta() above
+		 * momentarily release the obj_read_mutex, giving another thread
+		 * the chance to access the cache. Therefore, if `base` was
+		 * already there, this other thread could free() it (e.g. to
+		 * make space for another entry) before we are done using it.
 		 */
 		if (!external_base)
 			add_delta_base_cache(p, base_obj_offset, base, base_size, type);
@@ -1876,6 +2240,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	if (delta_stack != small_delta_stack)
 		free(delta_stack);
 
+	trace2_timer_stop(TRACE2_TIMER_ID_UNPACK_ENTRY);
 	return data;
 }
 
@@ -2064,6 +2429,82 @@ int find_pack_entry(struct repository *r, const struct object_id *oid, struct pa
 	return 0;
 }
 
+static int pack_entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_entry *a = va, *b = vb;
+
+	if (a->p != b->p)
+		return a->p < b->p ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Ask the kernel to start reading the pages of an object that lives at
+ * "offset" in "p" and spans "len" bytes, without waiting for them.
+ */
+static void pack_willneed(struct packed_git *p, struct pack_window **w_curs,
+			  off_t offset, off_t len)
+{
+	unsigned long avail;
+	unsigned char *start = use_pack(p, w_curs, offset, &avail);
+
+#if defined(HAVE_MADVISE) && !defined(NO_MMAP)
+	{
+		uintptr_t pagesize = getpagesize();
+		uintptr_t addr = (uintptr_t)start & ~(pagesize - 1);
+
+		if (len > avail)
+			len = avail;
+		madvise((void *)addr, (uintptr_t)start + len - addr,
+			MADV_WILLNEED);
+	}
+#else
+	(void)start;
+	(void)len;
+#endif
+}
+
+void prefetch_pack_entries(struct repository *r,
+			   struct pack_entry *entries, size_t nr,
+			   int inflate)
+{
+	struct pack_window *w_curs = NULL;
+	size_t i;
+
+	QSORT(entries, nr, pack_entry_cmp);
+
+	for (i = 0; i < nr; i++) {
+		struct pack_entry *e = &entries[i];
+		uint32_t pos;
+
+		if (i && !pack_entry_cmp(e, &entries[i - 1]))
+			continue;
+
+		if (inflate) {
+			enum object_type type;
+			unsigned long size;
+
+			/*
+			 * Unpacking leaves the delta bases of the object in
+			 * the delta base cache, so that the consumer only
+			 * has to apply the last delta when it asks for it.
+			 */
+			free(unpack_entry(r, e->p, e->offset, &type, &size));
+			continue;
+		}
+
+		if (load_pack_revindex(r, e->p) ||
+		    offset_to_pack_pos(e->p, e->offset, &pos) < 0)
+			continue;
+		pack_willneed(e->p, &w_curs, e->offset,
+			      pack_pos_to_offset(e->p, pos + 1) - e->offset);
+	}
+
+	unuse_pack(&w_curs);
+}
+
 static void maybe_invalidate_kept_pack_cache(struct repository *r,
 					     unsigned flags)
 {
@@ -2209,6 +2650,9 @@ int for_each_packed_object(each_packed_object_fn cb, void *data,
 		if ((flags & FOR_EACH_OBJECT_SKIP_ON_DISK_KEPT_PACKS) &&
 		    p->pack_keep)
 			continue;
+		if ((flags & FOR_EACH_OBJECT_SKIP_MIDX_PACKS) &&
+		    p->multi_pack_index)
+			continue;
 		if (open_pack_index(p)) {
 			pack_errors = 1;
 			continue;
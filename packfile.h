@@ -102,11 +102,36 @@ int close_pack_fd(struct packed_git *p);
 uint32_t get_pack_fanout(struct packed_git *p, uint32_t value);
 
 unsigned char *use_pack(struct packed_git *, struct pack_window **, off_t, unsigned long *);
+
+/*
+ * How a caller is going to read through the windows of a pack. The hint
+ * is passed to the kernel (where supported) for every window of the pack
+ * that is currently mapped and for those mapped later on, so that
+ * sequential scans get aggressive read-ahead and random lookups do not
+ * waste I/O on pages nobody will look at.
+ */
+enum pack_access_pattern {
+	PACK_ACCESS_NORMAL = 0,
+	PACK_ACCESS_SEQUENTIAL,
+	PACK_ACCESS_RANDOM,
+};
+
+void pack_set_access_pattern(struct packed_git *p,
+			     enum pack_access_pattern pattern);
 void close_pack_windows(struct packed_git *);
 void close_pack(struct packed_git *);
 void close_object_store(struct raw_object_store *o);
 void unuse_pack(struct pack_window **);
 void clear_delta_base_cache(void);
+
+/*
+ * Switch the delta base cache to (or back from) its sharded, per-shard
+ * locked layout. Like enable_obj_read_lock(), these must be called while
+ * no other thread is reading objects.
+ */
+void enable_delta_base_cache_lock(void);
+void disable_delta_base_cache_lock(void);
+
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
 /*
@@ -182,6 +207,17 @@ const struct packed_git *has_packed_and_bad(struct repository *, const struct ob
  * return true and store its location to e.
  */
 int find_pack_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e);
+
+/*
+ * Prepare for reading the objects at the given pack entries in a batch.
+ * The entries are sorted by pack and offset (in place), and the kernel is
+ * asked to read their data ahead of time. If "inflate" is set, the
+ * objects are unpacked in that order as well, which populates the delta
+ * base cache with their bases.
+ */
+void prefetch_pack_entries(struct repository *r,
+			   struct pack_entry *entries, size_t nr,
+			   int inflate);
 int find_kept_pack_entry(struct repository *r, const struct object_id *oid, unsigned flags, struct pack_entry *e);
 
 int has_object_pack(const struct object_id *oid);
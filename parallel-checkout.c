@@ -1,9 +1,11 @@
 #include "git-compat-util.h"
 #include "config.h"
 #include "entry.h"
+#include "environment.h"
 #include "gettext.h"
 #include "hash.h"
 #include "hex.h"
+#include "object-store-ll.h"
 #include "parallel-checkout.h"
 #include "pkt-line.h"
 #include "progress.h"
@@ -96,7 +98,8 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 		return 0;
 
 	packed_item_size = sizeof(struct pc_item_fixed_portion) + ce->ce_namelen +
-		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0);
+		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0) +
+		(ca->drv ? strlen(conv_attrs_driver_name(ca)) : 0);
 
 	/*
 	 * The amount of data we send to the workers per checkout item is
@@ -117,28 +120,26 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 		 * It would be safe to allow concurrent instances of
 		 * single-file smudge filters, like rot13, but we should not
 		 * assume that all filters are parallel-process safe. So we
-		 * don't allow this.
+		 * only allow this when the driver is configured as such.
 		 */
-		return 0;
+		return conv_attrs_filter_is_parallel(ca);
 
 	case CA_CLASS_INCORE_PROCESS:
 		/*
 		 * The parallel queue and the delayed queue are not compatible,
 		 * so they must be kept completely separated. And we can't tell
 		 * if a long-running process will delay its response without
-		 * actually asking it to perform the filtering. Therefore, this
-		 * type of filter is not allowed in parallel checkout.
+		 * actually asking it to perform the filtering.
 		 *
 		 * Furthermore, there should only be one instance of the
 		 * long-running process filter as we don't know how it is
-		 * managing its own concurrency. So, spreading the entries that
-		 * requisite such a filter among the parallel workers would
-		 * require a lot more inter-process communication. We would
-		 * probably have to designate a single process to interact with
-		 * the filter and send all the necessary data to it, for each
-		 * entry.
+		 * managing its own concurrency.
+		 *
+		 * Unless the driver is configured to allow several instances.
+		 * Then each worker starts its own, and handles the entries
+		 * its filter delays by itself.
 		 */
-		return 0;
+		return conv_attrs_filter_is_parallel(ca);
 
 	case CA_CLASS_STREAMABLE:
 		return 1;
@@ -263,10 +264,30 @@ static int reset_fd(int fd, const char *path)
 	return 0;
 }
 
+/*
+ * Streaming reads the object store without taking obj_read_lock(), so
+ * threads must hold it while they stream a blob. Only do that for the
+ * blobs that are too large to be read whole.
+ */
+static int should_stream_in_thread(const struct object_id *oid)
+{
+	unsigned long size;
+
+	if (oid_object_info(the_repository, oid, &size) < 0)
+		return 0;
+	return size > big_file_threshold;
+}
+
+/*
+ * Returns 1 if the filter of the item delayed it, in which case nothing
+ * was written.
+ */
 static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
-			       const char *path)
+			       const char *path, const struct checkout *state,
+			       int in_thread, struct delayed_checkout *dco)
 {
 	int ret;
+	struct checkout_metadata meta;
 	struct stream_filter *filter;
 	struct strbuf buf = STRBUF_INIT;
 	char *blob;
@@ -277,8 +298,18 @@ static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
 	assert(is_eligible_for_parallel_checkout(pc_item->ce, &pc_item->ca));
 
 	filter = get_stream_filter_ca(&pc_item->ca, &pc_item->ce->oid);
+	if (filter && in_thread &&
+	    !should_stream_in_thread(&pc_item->ce->oid)) {
+		free_stream_filter(filter);
+		filter = NULL;
+	}
 	if (filter) {
-		if (stream_blob_to_fd(fd, &pc_item->ce->oid, filter, 1)) {
+		if (in_thread)
+			obj_read_lock();
+		ret = stream_blob_to_fd(fd, &pc_item->ce->oid, filter, 1);
+		if (in_thread)
+			obj_read_unlock();
+		if (ret) {
 			/* On error, reset fd to try writing without streaming */
 			if (reset_fd(fd, path))
 				return -1;
@@ -287,19 +318,38 @@ static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
 		}
 	}
 
-	blob = read_blob_entry(pc_item->ce, &size);
-	if (!blob)
-		return error("cannot read object %s '%s'",
-			     oid_to_hex(&pc_item->ce->oid), pc_item->ce->name);
+	/* The blob is not sent again when a delayed entry is retried. */
+	if (dco && dco->state == CE_RETRY) {
+		blob = NULL;
+		size = 0;
+	} else {
+		blob = read_blob_entry(pc_item->ce, &size);
+		if (!blob)
+			return error("cannot read object %s '%s'",
+				     oid_to_hex(&pc_item->ce->oid),
+				     pc_item->ce->name);
+	}
 
 	/*
 	 * checkout metadata is used to give context for external process
-	 * filters. Files requiring such filters are not eligible for parallel
-	 * checkout, so pass NULL. Note: if that changes, the metadata must also
-	 * be passed from the main process to the workers.
+	 * filters. The main process passes its refname and treeish on to
+	 * the workers.
 	 */
-	ret = convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name,
-					 blob, size, &buf, NULL);
+	clone_checkout_metadata(&meta, &state->meta, &pc_item->ce->oid);
+	if (dco) {
+		ret = async_convert_to_working_tree_ca(&pc_item->ca,
+						       pc_item->ce->name,
+						       blob, size, &buf, &meta,
+						       dco);
+		if (ret && dco->state == CE_CAN_DELAY &&
+		    string_list_lookup(&dco->paths, pc_item->ce->name)) {
+			free(blob);
+			return 1;
+		}
+	} else {
+		ret = convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name,
+						 blob, size, &buf, &meta);
+	}
 
 	if (ret) {
 		size_t newsize;
@@ -328,11 +378,16 @@ static int close_and_clear(int *fd)
 	return ret;
 }
 
-void write_pc_item(struct parallel_checkout_item *pc_item,
-		   struct checkout *state)
+/*
+ * Write the item like write_pc_item() does. Threads pass their own
+ * "cache" for the leading directories of the items.
+ */
+static void write_pc_item_1(struct parallel_checkout_item *pc_item,
+			    struct checkout *state, struct cache_def *cache,
+			    struct delayed_checkout *dco)
 {
 	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
-	int fd = -1, fstat_done = 0;
+	int fd = -1, fstat_done = 0, ret;
 	struct strbuf path = STRBUF_INIT;
 	const char *dir_sep;
 
@@ -347,8 +402,12 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	 * a symlink (checked out after we enqueued this entry for parallel
 	 * checkout). Thus, we must check the leading dirs again.
 	 */
-	if (dir_sep && !has_dirs_only_path(path.buf, dir_sep - path.buf,
-					   state->base_dir_len)) {
+	if (dir_sep &&
+	    !(cache ?
+	      threaded_has_dirs_only_path(cache, path.buf, dir_sep - path.buf,
+					  state->base_dir_len) :
+	      has_dirs_only_path(path.buf, dir_sep - path.buf,
+				 state->base_dir_len))) {
 		pc_item->status = PC_ITEM_COLLIDED;
 		trace2_data_string("pcheckout", NULL, "collision/dirname", path.buf);
 		goto out;
@@ -375,9 +434,10 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 		goto out;
 	}
 
-	if (write_pc_item_to_fd(pc_item, fd, path.buf)) {
-		/* Error was already reported. */
-		pc_item->status = PC_ITEM_FAILED;
+	ret = write_pc_item_to_fd(pc_item, fd, path.buf, state, !!cache, dco);
+	if (ret) {
+		/* Unless the item was delayed, the error was already reported. */
+		pc_item->status = ret > 0 ? PC_ITEM_DELAYED : PC_ITEM_FAILED;
 		close_and_clear(&fd);
 		unlink(path.buf);
 		goto out;
@@ -403,22 +463,37 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	strbuf_release(&path);
 }
 
+void write_pc_item(struct parallel_checkout_item *pc_item,
+		   struct checkout *state)
+{
+	write_pc_item_1(pc_item, state, NULL, NULL);
+}
+
+void write_pc_item_or_delay(struct parallel_checkout_item *pc_item,
+			    struct checkout *state,
+			    struct delayed_checkout *dco)
+{
+	write_pc_item_1(pc_item, state, NULL, dco);
+}
+
 static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 {
 	size_t len_data;
 	char *data, *variant;
 	struct pc_item_fixed_portion *fixed_portion;
 	const char *working_tree_encoding = pc_item->ca.working_tree_encoding;
+	const char *driver = conv_attrs_driver_name(&pc_item->ca);
 	size_t name_len = pc_item->ce->ce_namelen;
 	size_t working_tree_encoding_len = working_tree_encoding ?
 					   strlen(working_tree_encoding) : 0;
+	size_t driver_len = driver ? strlen(driver) : 0;
 
 	/*
 	 * Any changes in the calculation of the message size must also be made
 	 * in is_eligible_for_parallel_checkout().
 	 */
 	len_data = sizeof(struct pc_item_fixed_portion) + name_len +
-		   working_tree_encoding_len;
+		   working_tree_encoding_len + driver_len;
 
 	data = xmalloc(len_data);
 
@@ -429,6 +504,7 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 	fixed_portion->ident = pc_item->ca.ident;
 	fixed_portion->name_len = name_len;
 	fixed_portion->working_tree_encoding_len = working_tree_encoding_len;
+	fixed_portion->driver_len = driver_len;
 	/*
 	 * We pad the unused bytes in the hash array because, otherwise,
 	 * Valgrind would complain about passing uninitialized bytes to a
@@ -442,6 +518,10 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 		memcpy(variant, working_tree_encoding, working_tree_encoding_len);
 		variant += working_tree_encoding_len;
 	}
+	if (driver_len) {
+		memcpy(variant, driver, driver_len);
+		variant += driver_len;
+	}
 	memcpy(variant, pc_item->ce->name, name_len);
 
 	packet_write(fd, data, len_data);
@@ -478,6 +558,11 @@ static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
 		strvec_push(&cp->args, "checkout--worker");
 		if (state->base_dir_len)
 			strvec_pushf(&cp->args, "--prefix=%s", state->base_dir);
+		if (state->meta.refname)
+			strvec_pushf(&cp->args, "--refname=%s", state->meta.refname);
+		if (!is_null_oid(&state->meta.treeish))
+			strvec_pushf(&cp->args, "--treeish=%s",
+				     oid_to_hex(&state->meta.treeish));
 		if (start_command(cp))
 			die("failed to spawn checkout worker");
 	}
@@ -638,6 +723,87 @@ static void gather_results_from_workers(struct pc_worker *workers,
 	free(pfds);
 }
 
+struct pc_thread {
+	pthread_t thread;
+	struct checkout *state;
+	size_t start, nr;
+	/* items written, for the progress count */
+	unsigned int written;
+};
+
+static void *write_items_thread(void *arg)
+{
+	struct pc_thread *t = arg;
+	struct cache_def cache = CACHE_DEF_INIT;
+	size_t i;
+
+	trace2_thread_start("pcheckout");
+	for (i = t->start; i < t->start + t->nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		write_pc_item_1(pc_item, t->state, &cache, NULL);
+		if (pc_item->status != PC_ITEM_COLLIDED) {
+			t->written++;
+			progress_add(parallel_checkout.progress, 1);
+		}
+	}
+	cache_def_clear(&cache);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Filter drivers are run by code that is not thread-safe, like the map
+ * of long-running filter processes in sub-process.c.
+ */
+static int can_write_items_in_threads(void)
+{
+	size_t i;
+
+	if (!HAVE_THREADS)
+		return 0;
+	for (i = 0; i < parallel_checkout.nr; i++)
+		if (parallel_checkout.items[i].ca.drv)
+			return 0;
+	return 1;
+}
+
+static void write_items_in_threads(struct checkout *state, int num_threads)
+{
+	struct pc_thread *threads;
+	size_t base_batch_size, batch_beginning = 0;
+	int i, ret, threads_with_one_extra_item;
+
+	CALLOC_ARRAY(threads, num_threads);
+	base_batch_size = parallel_checkout.nr / num_threads;
+	threads_with_one_extra_item = parallel_checkout.nr % num_threads;
+
+	enable_obj_read_lock();
+	for (i = 0; i < num_threads; i++) {
+		struct pc_thread *t = &threads[i];
+
+		t->state = state;
+		t->start = batch_beginning;
+		t->nr = base_batch_size + (i < threads_with_one_extra_item);
+		batch_beginning += t->nr;
+
+		ret = pthread_create(&t->thread, NULL, write_items_thread, t);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (parallel_checkout.progress)
+			*parallel_checkout.progress_cnt += threads[i].written;
+	}
+	disable_obj_read_lock();
+	if (parallel_checkout.progress)
+		display_progress(parallel_checkout.progress,
+				 *parallel_checkout.progress_cnt);
+
+	free(threads);
+}
+
 static void write_items_sequentially(struct checkout *state)
 {
 	size_t i;
@@ -653,7 +819,7 @@ static void write_items_sequentially(struct checkout *state)
 int run_parallel_checkout(struct checkout *state, int num_workers, int threshold,
 			  struct progress *progress, unsigned int *progress_cnt)
 {
-	int ret;
+	int ret, use_threads = 0;
 
 	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
 		BUG("cannot run parallel checkout: uninitialized or already running");
@@ -664,9 +830,12 @@ int run_parallel_checkout(struct checkout *state, int num_workers, int threshold
 
 	if (parallel_checkout.nr < num_workers)
 		num_workers = parallel_checkout.nr;
+	git_config_get_bool("checkout.workerThreads", &use_threads);
 
 	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
 		write_items_sequentially(state);
+	} else if (use_threads && can_write_items_in_threads()) {
+		write_items_in_threads(state, num_workers);
 	} else {
 		struct pc_worker *workers = setup_workers(state, num_workers);
 		gather_results_from_workers(workers, num_workers);
@@ -59,6 +59,11 @@ enum pc_item_status {
 	 */
 	PC_ITEM_COLLIDED,
 	PC_ITEM_FAILED,
+	/*
+	 * The long-running filter process of the entry delayed it. Only used
+	 * in workers, which write the entry once the filter has it ready.
+	 */
+	PC_ITEM_DELAYED,
 };
 
 struct parallel_checkout_item {
@@ -78,9 +83,9 @@ struct parallel_checkout_item {
 
 /*
  * The fixed-size portion of `struct parallel_checkout_item` that is sent to the
- * workers. Following this will be 2 strings: ca.working_tree_encoding and
- * ce.name; These are NOT null terminated, since we have the size in the fixed
- * portion.
+ * workers. Following this will be 3 strings: ca.working_tree_encoding, the
+ * name of the filter driver in ca.drv, and ce.name; These are NOT null
+ * terminated, since we have the size in the fixed portion.
  *
  * Note that not all fields of conv_attrs and cache_entry are passed, only the
  * ones that will be required by the workers to smudge and write the entry.
@@ -92,6 +97,7 @@ struct pc_item_fixed_portion {
 	enum convert_crlf_action crlf_action;
 	int ident;
 	size_t working_tree_encoding_len;
+	size_t driver_len;
 	size_t name_len;
 };
 
@@ -110,4 +116,14 @@ struct pc_item_result {
 void write_pc_item(struct parallel_checkout_item *pc_item,
 		   struct checkout *state);
 
+/*
+ * Like write_pc_item(), but offer the long-running filter process of the
+ * item to delay it, as "dco" allows. If it does, the item is left
+ * PC_ITEM_DELAYED, and should be written again with "dco" in the
+ * CE_RETRY state once the filter lists it as available.
+ */
+void write_pc_item_or_delay(struct parallel_checkout_item *pc_item,
+			    struct checkout *state,
+			    struct delayed_checkout *dco);
+
 #endif /* PARALLEL_CHECKOUT_H */
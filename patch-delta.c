@@ -12,6 +12,39 @@
 #include "git-compat-util.h"
 #include "delta.h"
 
+/*
+ * Parse the offset and size of the copy instruction "cmd", which "*datap"
+ * points right after. Returns -1 if they are cut short.
+ */
+static inline int parse_copy_op(unsigned char cmd,
+				const unsigned char **datap,
+				const unsigned char *top,
+				unsigned long *cp_off, unsigned long *cp_size)
+{
+	const unsigned char *data = *datap;
+
+	*cp_off = 0;
+	*cp_size = 0;
+#define PARSE_CP_PARAM(bit, var, shift) do { \
+		if (cmd & (bit)) { \
+			if (data >= top) \
+				return -1; \
+			*(var) |= ((unsigned) *data++ << (shift)); \
+		} } while (0)
+	PARSE_CP_PARAM(0x01, cp_off, 0);
+	PARSE_CP_PARAM(0x02, cp_off, 8);
+	PARSE_CP_PARAM(0x04, cp_off, 16);
+	PARSE_CP_PARAM(0x08, cp_off, 24);
+	PARSE_CP_PARAM(0x10, cp_size, 0);
+	PARSE_CP_PARAM(0x20, cp_size, 8);
+	PARSE_CP_PARAM(0x40, cp_size, 16);
+#undef PARSE_CP_PARAM
+	if (*cp_size == 0)
+		*cp_size = 0x10000;
+	*datap = data;
+	return 0;
+}
+
 void *patch_delta(const void *src_buf, unsigned long src_size,
 		  const void *delta_buf, unsigned long delta_size,
 		  unsigned long *dst_size)
@@ -39,22 +72,9 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 	while (data < top) {
 		cmd = *data++;
 		if (cmd & 0x80) {
-			unsigned long cp_off = 0, cp_size = 0;
-#define PARSE_CP_PARAM(bit, var, shift) do { \
-			if (cmd & (bit)) { \
-				if (data >= top) \
-					goto bad_length; \
-				var |= ((unsigned) *data++ << (shift)); \
-			} } while (0)
-			PARSE_CP_PARAM(0x01, cp_off, 0);
-			PARSE_CP_PARAM(0x02, cp_off, 8);
-			PARSE_CP_PARAM(0x04, cp_off, 16);
-			PARSE_CP_PARAM(0x08, cp_off, 24);
-			PARSE_CP_PARAM(0x10, cp_size, 0);
-			PARSE_CP_PARAM(0x20, cp_size, 8);
-			PARSE_CP_PARAM(0x40, cp_size, 16);
-#undef PARSE_CP_PARAM
-			if (cp_size == 0) cp_size = 0x10000;
+			unsigned long cp_off, cp_size;
+			if (parse_copy_op(cmd, &data, top, &cp_off, &cp_size))
+				goto bad_length;
 			if (unsigned_add_overflows(cp_off, cp_size) ||
 			    cp_off + cp_size > src_size ||
 			    cp_size > size)
@@ -92,3 +112,165 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 	*dst_size = out - dst_buf;
 	return dst_buf;
 }
+
+struct delta_chain_op {
+	/* where the bytes go in the result of the chain */
+	unsigned long dst_off;
+	unsigned long size;
+	/* the bytes to insert, or NULL to copy them from the source */
+	const unsigned char *data;
+	unsigned long src_off;
+};
+
+void delta_chain_init(struct delta_chain *chain, unsigned long src_size)
+{
+	memset(chain, 0, sizeof(*chain));
+	chain->src_size = src_size;
+	chain->size = src_size;
+	if (src_size) {
+		ALLOC_GROW(chain->ops, 1, chain->alloc);
+		chain->ops[0].dst_off = 0;
+		chain->ops[0].size = src_size;
+		chain->ops[0].data = NULL;
+		chain->ops[0].src_off = 0;
+		chain->nr = 1;
+	}
+}
+
+/*
+ * Add an instruction to "ops", merging it with the last one if both copy
+ * adjacent ranges of the source.
+ */
+static void add_chain_op(struct delta_chain *ops, const unsigned char *data,
+			 unsigned long src_off, unsigned long size)
+{
+	struct delta_chain_op *last = ops->nr ? &ops->ops[ops->nr - 1] : NULL;
+
+	if (last && !data && !last->data &&
+	    last->src_off + last->size == src_off) {
+		last->size += size;
+	} else {
+		ALLOC_GROW(ops->ops, ops->nr + 1, ops->alloc);
+		last = &ops->ops[ops->nr++];
+		last->dst_off = ops->size;
+		last->size = size;
+		last->data = data;
+		last->src_off = src_off;
+	}
+	ops->size += size;
+}
+
+/* Return the instruction of "chain" that "off" of its result comes from. */
+static size_t find_chain_op(const struct delta_chain *chain, unsigned long off)
+{
+	size_t lo = 0, hi = chain->nr;
+
+	while (hi - lo > 1) {
+		size_t mi = lo + (hi - lo) / 2;
+		if (chain->ops[mi].dst_off <= off)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+int delta_chain_append(struct delta_chain *chain,
+		       const void *delta_buf, unsigned long delta_size)
+{
+	const unsigned char *data, *top;
+	struct delta_chain ops = { 0 };
+	unsigned long size;
+	unsigned char cmd;
+
+	if (delta_size < DELTA_SIZE_MIN)
+		return -1;
+
+	data = delta_buf;
+	top = (const unsigned char *) delta_buf + delta_size;
+
+	/* make sure the orig size matches what we expect */
+	if (get_delta_hdr_size(&data, top) != chain->size)
+		return -1;
+
+	/* now the result size */
+	size = get_delta_hdr_size(&data, top);
+
+	while (data < top) {
+		cmd = *data++;
+		if (cmd & 0x80) {
+			unsigned long cp_off, cp_size;
+			size_t i;
+			if (parse_copy_op(cmd, &data, top, &cp_off, &cp_size))
+				goto bad;
+			if (unsigned_add_overflows(cp_off, cp_size) ||
+			    cp_off + cp_size > chain->size ||
+			    cp_size > size)
+				goto bad;
+			size -= cp_size;
+
+			/* copy what the instructions so far make of the range */
+			for (i = find_chain_op(chain, cp_off); cp_size; i++) {
+				const struct delta_chain_op *op = &chain->ops[i];
+				unsigned long skip = cp_off - op->dst_off;
+				unsigned long n = op->size - skip;
+
+				if (n > cp_size)
+					n = cp_size;
+				add_chain_op(&ops, op->data ? op->data + skip : NULL,
+					     op->src_off + skip, n);
+				cp_off += n;
+				cp_size -= n;
+			}
+		} else if (cmd) {
+			if (cmd > size || cmd > top - data)
+				goto bad;
+			add_chain_op(&ops, data, 0, cmd);
+			data += cmd;
+			size -= cmd;
+		} else {
+			goto bad;
+		}
+	}
+
+	/* sanity check */
+	if (data != top || size != 0) {
+		bad:
+		free(ops.ops);
+		return -1;
+	}
+
+	free(chain->ops);
+	chain->ops = ops.ops;
+	chain->nr = ops.nr;
+	chain->alloc = ops.alloc;
+	chain->size = ops.size;
+	return 0;
+}
+
+void *delta_chain_apply(const struct delta_chain *chain,
+			const void *src_buf, unsigned long src_size,
+			unsigned long *dst_size)
+{
+	unsigned char *dst_buf;
+	size_t i;
+
+	if (src_size != chain->src_size)
+		return NULL;
+
+	dst_buf = xmallocz(chain->size);
+	for (i = 0; i < chain->nr; i++) {
+		const struct delta_chain_op *op = &chain->ops[i];
+		memcpy(dst_buf + op->dst_off,
+		       op->data ? op->data : (const unsigned char *)src_buf + op->src_off,
+		       op->size);
+	}
+	*dst_size = chain->size;
+	return dst_buf;
+}
+
+void delta_chain_release(struct delta_chain *chain)
+{
+	FREE_AND_NULL(chain->ops);
+	chain->nr = chain->alloc = 0;
+}
@@ -1,10 +1,35 @@
 #include "git-compat-util.h"
 #include "diff.h"
 #include "commit.h"
+#include "config.h"
+#include "gettext.h"
 #include "hash.h"
 #include "hash-lookup.h"
 #include "hex.h"
+#include "lockfile.h"
+#include "log-read-ahead.h"
+#include "oidset.h"
 #include "patch-ids.h"
+#include "path.h"
+#include "repository.h"
+#include "thread-utils.h"
+#include "write-or-die.h"
+
+#define PATCH_ID_CACHE_SIGNATURE 0x50494443 /* "PIDC" */
+#define PATCH_ID_CACHE_VERSION 1
+
+/*
+ * The patch IDs of a commit, as far as they are known: the null OID
+ * stands for one that was not computed yet. A commit whose parent is
+ * not "parent" anymore (e.g. because of a graft) has them computed
+ * again.
+ */
+struct known_patch_id {
+	struct oidmap_entry entry;
+	struct object_id parent;
+	struct object_id header_only;
+	struct object_id full;
+};
 
 static int patch_id_defined(struct commit *commit)
 {
@@ -27,6 +52,142 @@ int commit_patch_id(struct commit *commit, struct diff_options *options,
 	return diff_flush_patch_id(options, oid, diff_header_only);
 }
 
+static int patch_id_cache_usable(struct patch_ids *ids)
+{
+	/* The cached patch IDs are those of the whole, unordered diff. */
+	return ids->use_cache &&
+		!ids->diffopts.pathspec.nr &&
+		!ids->diffopts.orderfile &&
+		!ids->diffopts.flags.ignore_submodules &&
+		!ids->diffopts.flags.override_submodule_config;
+}
+
+/*
+ * The cache is a header of three 4-byte values: the signature, the
+ * version and the format ID of the hash algorithm, followed by one
+ * record for each commit, of its OID, that of its parent (or the null
+ * OID), and its header-only and full patch IDs (or the null OID).
+ */
+static void load_patch_id_cache(struct patch_ids *ids)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	struct strbuf buf = STRBUF_INIT;
+	const unsigned char *p, *end;
+	char *file;
+
+	if (ids->cache_loaded)
+		return;
+	ids->cache_loaded = 1;
+	if (!patch_id_cache_usable(ids))
+		return;
+
+	file = repo_git_path(ids->diffopts.repo, "patch-id-cache");
+	if (strbuf_read_file(&buf, file, 0) < 0 ||
+	    buf.len < 12 ||
+	    get_be32(buf.buf) != PATCH_ID_CACHE_SIGNATURE ||
+	    get_be32(buf.buf + 4) != PATCH_ID_CACHE_VERSION ||
+	    get_be32(buf.buf + 8) != the_hash_algo->format_id)
+		goto out;
+
+	p = (const unsigned char *)buf.buf + 12;
+	end = (const unsigned char *)buf.buf + buf.len;
+	for (; end - p >= 4 * rawsz; p += 4 * rawsz) {
+		struct known_patch_id *k;
+
+		CALLOC_ARRAY(k, 1);
+		oidread(&k->entry.oid, p);
+		oidread(&k->parent, p + rawsz);
+		oidread(&k->header_only, p + 2 * rawsz);
+		oidread(&k->full, p + 3 * rawsz);
+		free(oidmap_put(&ids->known, k));
+	}
+
+out:
+	strbuf_release(&buf);
+	free(file);
+}
+
+static void write_patch_id_cache(struct patch_ids *ids)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct oidmap_iter iter;
+	struct known_patch_id *k;
+	unsigned char header[12];
+	char *file;
+
+	if (!ids->cache_dirty || !patch_id_cache_usable(ids))
+		return;
+
+	file = repo_git_path(ids->diffopts.repo, "patch-id-cache");
+	/* someone else is writing the cache; let them */
+	if (hold_lock_file_for_update(&lk, file, 0) < 0)
+		goto out;
+
+	put_be32(header, PATCH_ID_CACHE_SIGNATURE);
+	put_be32(header + 4, PATCH_ID_CACHE_VERSION);
+	put_be32(header + 8, the_hash_algo->format_id);
+	strbuf_add(&buf, header, sizeof(header));
+	oidmap_iter_init(&ids->known, &iter);
+	while ((k = oidmap_iter_next(&iter))) {
+		if (is_null_oid(&k->header_only) && is_null_oid(&k->full))
+			continue;
+		strbuf_add(&buf, k->entry.oid.hash, rawsz);
+		strbuf_add(&buf, k->parent.hash, rawsz);
+		strbuf_add(&buf, k->header_only.hash, rawsz);
+		strbuf_add(&buf, k->full.hash, rawsz);
+	}
+
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lk)) {
+		warning_errno(_("unable to write patch ID cache '%s'"), file);
+		rollback_lock_file(&lk);
+	}
+
+out:
+	strbuf_release(&buf);
+	free(file);
+}
+
+/* Like commit_patch_id(), but remember the result in "ids". */
+static int get_patch_id(struct patch_ids *ids, struct commit *commit,
+			struct object_id *oid, int header_only)
+{
+	const struct object_id *parent;
+	struct known_patch_id *k;
+	struct object_id *known;
+
+	if (!patch_id_defined(commit))
+		return -1;
+	parent = commit->parents ?
+		&commit->parents->item->object.oid : null_oid();
+
+	load_patch_id_cache(ids);
+	k = oidmap_get(&ids->known, &commit->object.oid);
+	if (!k) {
+		CALLOC_ARRAY(k, 1);
+		oidcpy(&k->entry.oid, &commit->object.oid);
+		oidcpy(&k->parent, parent);
+		oidmap_put(&ids->known, k);
+	} else if (!oideq(&k->parent, parent)) {
+		oidcpy(&k->parent, parent);
+		oidclr(&k->header_only);
+		oidclr(&k->full);
+	}
+
+	known = header_only ? &k->header_only : &k->full;
+	if (is_null_oid(known)) {
+		if (commit_patch_id(commit, &ids->diffopts, known, header_only)) {
+			oidclr(known);
+			return -1;
+		}
+		ids->cache_dirty = 1;
+	}
+	oidcpy(oid, known);
+	return 0;
+}
+
 /*
  * When we cannot load the full patch-id for both commits for whatever
  * reason, the function returns -1 (i.e. return error(...)). Despite
@@ -43,18 +204,18 @@ static int patch_id_neq(const void *cmpfn_data,
 			const void *keydata UNUSED)
 {
 	/* NEEDSWORK: const correctness? */
-	struct diff_options *opt = (void *)cmpfn_data;
+	struct patch_ids *ids = (void *)cmpfn_data;
 	struct patch_id *a, *b;
 
 	a = container_of(eptr, struct patch_id, ent);
 	b = container_of(entry_or_key, struct patch_id, ent);
 
 	if (is_null_oid(&a->patch_id) &&
-	    commit_patch_id(a->commit, opt, &a->patch_id, 0))
+	    get_patch_id(ids, a->commit, &a->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&a->commit->object.oid));
 	if (is_null_oid(&b->patch_id) &&
-	    commit_patch_id(b->commit, opt, &b->patch_id, 0))
+	    get_patch_id(ids, b->commit, &b->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&b->commit->object.oid));
 	return !oideq(&a->patch_id, &b->patch_id);
@@ -62,18 +223,34 @@ static int patch_id_neq(const void *cmpfn_data,
 
 int init_patch_ids(struct repository *r, struct patch_ids *ids)
 {
+	int use_cache = 0;
+
 	memset(ids, 0, sizeof(*ids));
 	repo_diff_setup(r, &ids->diffopts);
 	ids->diffopts.detect_rename = 0;
 	ids->diffopts.flags.recursive = 1;
 	diff_setup_done(&ids->diffopts);
-	hashmap_init(&ids->patches, patch_id_neq, &ids->diffopts, 256);
+	hashmap_init(&ids->patches, patch_id_neq, ids, 256);
+	oidmap_init(&ids->known, 0);
+
+	repo_config_get_bool(r, "patchid.cache", &use_cache);
+	ids->use_cache = use_cache;
+	ids->nr_threads = 1;
+	if (!repo_config_get_int(r, "patchid.threads", &ids->nr_threads)) {
+		if (ids->nr_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    ids->nr_threads, "patchid.threads");
+		if (!ids->nr_threads)
+			ids->nr_threads = online_cpus();
+	}
 	return 0;
 }
 
 int free_patch_ids(struct patch_ids *ids)
 {
+	write_patch_id_cache(ids);
 	hashmap_clear_and_free(&ids->patches, struct patch_id, ent);
+	oidmap_free(&ids->known, 1);
 	return 0;
 }
 
@@ -84,13 +261,93 @@ static int init_patch_id_entry(struct patch_id *patch,
 	struct object_id header_only_patch_id;
 
 	patch->commit = commit;
-	if (commit_patch_id(commit, &ids->diffopts, &header_only_patch_id, 1))
+	if (get_patch_id(ids, commit, &header_only_patch_id, 1))
 		return -1;
 
 	hashmap_entry_init(&patch->ent, oidhash(&header_only_patch_id));
 	return 0;
 }
 
+/*
+ * Compute the full patch IDs of "commits", while threads read ahead the
+ * blobs the diffs of the next ones need.
+ */
+static void compute_full_patch_ids(struct patch_ids *ids,
+				   struct commit **commits, size_t nr)
+{
+	struct log_read_ahead *ra;
+	struct object_id oid;
+	size_t window, head, tail = 0;
+
+	ra = log_read_ahead_start(ids->diffopts.repo, ids->nr_threads, &window);
+	for (head = 0; head < nr; head++) {
+		while (tail < nr && tail - head < window)
+			log_read_ahead_add(ra, commits[tail++]);
+		get_patch_id(ids, commits[head], &oid, 0);
+		log_read_ahead_done(ra);
+	}
+	log_read_ahead_stop(ra);
+}
+
+static int needs_full_patch_id(struct patch_ids *ids, struct commit *commit,
+			       struct oidset *headers)
+{
+	struct known_patch_id *k;
+	struct object_id oid;
+
+	if (get_patch_id(ids, commit, &oid, 1) ||
+	    !oidset_contains(headers, &oid))
+		return 0;
+	k = oidmap_get(&ids->known, &commit->object.oid);
+	return is_null_oid(&k->full);
+}
+
+void prepare_patch_id_lookups(struct patch_ids *ids,
+			      struct commit **commits, size_t nr)
+{
+	struct oidset set_headers = OIDSET_INIT;
+	struct oidset lookup_headers = OIDSET_INIT;
+	struct hashmap_iter iter;
+	struct patch_id *cur;
+	struct commit **todo = NULL;
+	size_t todo_nr = 0, todo_alloc = 0, i;
+	struct object_id oid;
+
+	if (!HAVE_THREADS || ids->nr_threads <= 1)
+		return;
+
+	/*
+	 * Only commits whose header-only patch IDs are the same on both
+	 * sides need their full ones compared.
+	 */
+	hashmap_for_each_entry(&ids->patches, &iter, cur, ent)
+		if (!get_patch_id(ids, cur->commit, &oid, 1))
+			oidset_insert(&set_headers, &oid);
+	for (i = 0; i < nr; i++) {
+		if (!patch_id_defined(commits[i]) ||
+		    get_patch_id(ids, commits[i], &oid, 1) ||
+		    !oidset_contains(&set_headers, &oid))
+			continue;
+		oidset_insert(&lookup_headers, &oid);
+		if (needs_full_patch_id(ids, commits[i], &set_headers)) {
+			ALLOC_GROW(todo, todo_nr + 1, todo_alloc);
+			todo[todo_nr++] = commits[i];
+		}
+	}
+	hashmap_for_each_entry(&ids->patches, &iter, cur, ent)
+		if (needs_full_patch_id(ids, cur->commit, &lookup_headers)) {
+			ALLOC_GROW(todo, todo_nr + 1, todo_alloc);
+			todo[todo_nr++] = cur->commit;
+		}
+
+	if (todo_nr > 1)
+		compute_full_patch_ids(ids, todo, todo_nr);
+
+	free(todo);
+	oidset_clear(&set_headers);
+	oidset_clear(&lookup_headers);
+}
+
 struct patch_id *patch_id_iter_first(struct commit *commit,
 				     struct patch_ids *ids)
 {
@@ -3,6 +3,7 @@
 
 #include "diff.h"
 #include "hashmap.h"
+#include "oidmap.h"
 
 struct commit;
 struct object_id;
@@ -17,6 +18,16 @@ struct patch_id {
 struct patch_ids {
 	struct hashmap patches;
 	struct diff_options diffopts;
+
+	/*
+	 * The patch IDs computed so far, by commit, and those read from
+	 * the cache when "patchId.cache" is set.
+	 */
+	struct oidmap known;
+	int nr_threads;
+	unsigned use_cache : 1,
+		 cache_loaded : 1,
+		 cache_dirty : 1;
 };
 
 int commit_patch_id(struct commit *commit, struct diff_options *options,
@@ -30,6 +41,15 @@ struct patch_id *add_commit_patch_id(struct commit *, struct patch_ids *);
 /* Returns true if the patch-id of "commit" is present in the set. */
 int has_commit_patch_id(struct commit *commit, struct patch_ids *);
 
+/*
+ * Compute the patch IDs that looking up each of "commits" in the set
+ * will need ahead of time, reading the blobs of their diffs in
+ * "patchId.threads" threads. This is purely an optimization: the
+ * lookups compute whatever this did not.
+ */
+void prepare_patch_id_lookups(struct patch_ids *ids,
+			      struct commit **commits, size_t nr);
+
 /*
  * Iterate over all commits in the set whose patch id matches that of
  * "commit", like:
@@ -0,0 +1,346 @@
+/*
+ * path-walk.c: walk the objects of a revision range one path at a time
+ */
+#include "git-compat-util.h"
+#include "path-walk.h"
+#include "blob.h"
+#include "commit.h"
+#include "gettext.h"
+#include "hex.h"
+#include "object.h"
+#include "oid-array.h"
+#include "revision.h"
+#include "string-list.h"
+#include "strmap.h"
+#include "trace2.h"
+#include "tree.h"
+#include "tree-walk.h"
+
+struct type_and_oid_list {
+	enum object_type type;
+	struct oid_array oids;
+
+	/* Whether any of "oids" was added while not UNINTERESTING. */
+	unsigned maybe_interesting : 1;
+
+	/* Whether the path is on the stack of paths still to be walked. */
+	unsigned pushed : 1;
+};
+
+struct path_walk_context {
+	struct repository *repo;
+	struct path_walk_info *info;
+
+	/*
+	 * Map from a path to its "struct type_and_oid_list". Tree paths
+	 * end with a slash (except for the root trees, which have the
+	 * empty path), so that a tree and a blob at the same path, from
+	 * different commits, do not end up in the same list.
+	 */
+	struct strmap paths_to_lists;
+
+	/* The paths still to be walked; the last one is walked next. */
+	struct string_list path_stack;
+};
+
+static void add_to_list(struct path_walk_context *ctx, const char *path,
+			enum object_type type, struct object *obj, int push)
+{
+	struct type_and_oid_list *list;
+
+	list = strmap_get(&ctx->paths_to_lists, path);
+	if (!list) {
+		CALLOC_ARRAY(list, 1);
+		list->type = type;
+		strmap_put(&ctx->paths_to_lists, path, list);
+	} else if (list->type != type) {
+		BUG("object %s of type %s added to a list of type %s",
+		    oid_to_hex(&obj->oid), type_name(type),
+		    type_name(list->type));
+	}
+
+	oid_array_append(&list->oids, &obj->oid);
+	if (!(obj->flags & UNINTERESTING))
+		list->maybe_interesting = 1;
+
+	if (push && !list->pushed) {
+		string_list_append(&ctx->path_stack, path);
+		list->pushed = 1;
+	}
+}
+
+static int add_tree_entries(struct path_walk_context *ctx,
+			    const char *base_path,
+			    const struct object_id *oid)
+{
+	struct tree *tree = lookup_tree(ctx->repo, oid);
+	struct strbuf path = STRBUF_INIT;
+	struct tree_desc desc;
+	struct name_entry entry;
+	size_t base_len;
+	int ret = 0;
+
+	if (!tree)
+		return -1;
+	if (parse_tree(tree))
+		return error(_("failed to walk children of tree %s: not found"),
+			     oid_to_hex(oid));
+
+	strbuf_addstr(&path, base_path);
+	base_len = path.len;
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		enum object_type type;
+		struct object *o;
+
+		/* Submodule commits are not ours to walk. */
+		if (S_ISGITLINK(entry.mode))
+			continue;
+
+		if (S_ISDIR(entry.mode)) {
+			struct tree *child = lookup_tree(ctx->repo, &entry.oid);
+			type = OBJ_TREE;
+			o = child ? &child->object : NULL;
+		} else {
+			struct blob *child = lookup_blob(ctx->repo, &entry.oid);
+			type = OBJ_BLOB;
+			o = child ? &child->object : NULL;
+		}
+		if (!o) {
+			ret = error(_("failed to find object %s"),
+				    oid_to_hex(&entry.oid));
+			break;
+		}
+
+		/*
+		 * Everything reachable from an UNINTERESTING tree is
+		 * UNINTERESTING, even if we have seen it elsewhere already.
+		 */
+		if (tree->object.flags & UNINTERESTING)
+			o->flags |= UNINTERESTING;
+		if (o->flags & SEEN)
+			continue;
+		o->flags |= SEEN;
+
+		strbuf_setlen(&path, base_len);
+		strbuf_add(&path, entry.path, entry.pathlen);
+		if (type == OBJ_TREE)
+			strbuf_addch(&path, '/');
+		add_to_list(ctx, path.buf, type, o, 1);
+	}
+
+	free_tree_buffer(tree);
+	strbuf_release(&path);
+	return ret;
+}
+
+static int walk_path(struct path_walk_context *ctx, const char *path)
+{
+	struct type_and_oid_list *list;
+	int ret = 0;
+	size_t i;
+
+	list = strmap_get(&ctx->paths_to_lists, path);
+	if (!list)
+		BUG("path '%s' walked without a list", path);
+
+	if (!list->oids.nr ||
+	    (ctx->info->prune_all_uninteresting && !list->maybe_interesting))
+		goto done;
+
+	ret = ctx->info->path_fn(path, &list->oids, list->type,
+				 ctx->info->path_fn_data);
+
+	if (!ret && list->type == OBJ_TREE)
+		for (i = 0; !ret && i < list->oids.nr; i++)
+			ret = add_tree_entries(ctx, path, &list->oids.oid[i]);
+
+done:
+	oid_array_clear(&list->oids);
+	strmap_remove(&ctx->paths_to_lists, path, 1);
+	return ret;
+}
+
+static int walk_path_stack(struct path_walk_context *ctx)
+{
+	int ret = 0;
+
+	while (!ret && ctx->path_stack.nr) {
+		char *path = ctx->path_stack.items[--ctx->path_stack.nr].string;
+
+		ret = walk_path(ctx, path);
+		free(path);
+	}
+	return ret;
+}
+
+/*
+ * Trees and blobs that were pending in the revision walk (e.g. from the
+ * index) and that were not reached from any commit are only walked at
+ * the end. Walk their paths in sorted order, so that a pending tree is
+ * walked before any pending object at a path below it.
+ */
+static int walk_remaining_paths(struct path_walk_context *ctx)
+{
+	struct string_list paths = STRING_LIST_INIT_NODUP;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	int ret = 0;
+
+	while (!ret && strmap_get_size(&ctx->paths_to_lists)) {
+		size_t i;
+
+		strmap_for_each_entry(&ctx->paths_to_lists, &iter, e)
+			string_list_append(&paths, e->key);
+		string_list_sort(&paths);
+
+		for (i = paths.nr; i > 0; i--) {
+			struct type_and_oid_list *list;
+
+			list = strmap_get(&ctx->paths_to_lists,
+					  paths.items[i - 1].string);
+			string_list_append(&ctx->path_stack,
+					   paths.items[i - 1].string);
+			list->pushed = 1;
+		}
+		string_list_clear(&paths, 0);
+
+		ret = walk_path_stack(ctx);
+	}
+	return ret;
+}
+
+static int add_pending_objects(struct path_walk_context *ctx,
+			       struct oid_array *tags,
+			       struct oid_array *pathless_blobs)
+{
+	struct rev_info *revs = ctx->info->revs;
+	struct strbuf path = STRBUF_INIT;
+	int ret = 0;
+	size_t i;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object_array_entry *pending = revs->pending.objects + i;
+		struct object *obj = pending->item;
+
+		if (obj->flags & (UNINTERESTING | SEEN))
+			continue;
+		obj->flags |= SEEN;
+
+		strbuf_reset(&path);
+		if (pending->path)
+			strbuf_addstr(&path, pending->path);
+
+		switch (obj->type) {
+		case OBJ_TAG:
+			oid_array_append(tags, &obj->oid);
+			break;
+		case OBJ_TREE:
+			if (path.len && path.buf[path.len - 1] != '/')
+				strbuf_addch(&path, '/');
+			add_to_list(ctx, path.buf, OBJ_TREE, obj, !path.len);
+			break;
+		case OBJ_BLOB:
+			if (path.len)
+				add_to_list(ctx, path.buf, OBJ_BLOB, obj, 0);
+			else
+				oid_array_append(pathless_blobs, &obj->oid);
+			break;
+		default:
+			ret = error(_("unknown pending object %s (%s)"),
+				    oid_to_hex(&obj->oid), pending->name);
+			goto out;
+		}
+	}
+
+out:
+	object_array_clear(&revs->pending);
+	strbuf_release(&path);
+	return ret;
+}
+
+int walk_objects_by_path(struct path_walk_info *info)
+{
+	struct path_walk_context ctx = {
+		.repo = info->revs->repo,
+		.info = info,
+		.paths_to_lists = STRMAP_INIT,
+		.path_stack = STRING_LIST_INIT_DUP,
+	};
+	struct oid_array commits = OID_ARRAY_INIT;
+	struct oid_array tags = OID_ARRAY_INIT;
+	struct oid_array pathless_blobs = OID_ARRAY_INIT;
+	unsigned int saved_boundary = info->revs->boundary;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct commit *c;
+	int ret;
+
+	trace2_region_enter("path-walk", "commit-walk", ctx.repo);
+
+	/*
+	 * The boundary commits tell us which trees the other side
+	 * already has.
+	 */
+	info->revs->boundary = 1;
+	if (prepare_revision_walk(info->revs)) {
+		ret = error(_("revision walk setup failed"));
+		trace2_region_leave("path-walk", "commit-walk", ctx.repo);
+		goto cleanup;
+	}
+
+	ret = add_pending_objects(&ctx, &tags, &pathless_blobs);
+
+	while (!ret && (c = get_revision(info->revs))) {
+		struct tree *t;
+
+		if (!(c->object.flags & BOUNDARY))
+			oid_array_append(&commits, &c->object.oid);
+
+		t = repo_get_commit_tree(ctx.repo, c);
+		if (!t) {
+			ret = error(_("could not read tree of commit %s"),
+				    oid_to_hex(&c->object.oid));
+			break;
+		}
+		if (c->object.flags & UNINTERESTING)
+			t->object.flags |= UNINTERESTING;
+		if (t->object.flags & SEEN)
+			continue;
+		t->object.flags |= SEEN;
+		add_to_list(&ctx, "", OBJ_TREE, &t->object, 1);
+	}
+
+	trace2_region_leave("path-walk", "commit-walk", ctx.repo);
+
+	if (!ret && commits.nr)
+		ret = info->path_fn("", &commits, OBJ_COMMIT,
+				    info->path_fn_data);
+	if (!ret && tags.nr)
+		ret = info->path_fn("", &tags, OBJ_TAG, info->path_fn_data);
+
+	trace2_region_enter("path-walk", "path-walk", ctx.repo);
+	if (!ret)
+		ret = walk_path_stack(&ctx);
+	if (!ret)
+		ret = walk_remaining_paths(&ctx);
+	trace2_region_leave("path-walk", "path-walk", ctx.repo);
+
+	if (!ret && pathless_blobs.nr)
+		ret = info->path_fn("", &pathless_blobs, OBJ_BLOB,
+				    info->path_fn_data);
+
+cleanup:
+	info->revs->boundary = saved_boundary;
+	strmap_for_each_entry(&ctx.paths_to_lists, &iter, e) {
+		struct type_and_oid_list *list = e->value;
+		oid_array_clear(&list->oids);
+	}
+	strmap_clear(&ctx.paths_to_lists, 1);
+	string_list_clear(&ctx.path_stack, 0);
+	oid_array_clear(&commits);
+	oid_array_clear(&tags);
+	oid_array_clear(&pathless_blobs);
+	return ret;
+}
@@ -0,0 +1,62 @@
+#ifndef PATH_WALK_H
+#define PATH_WALK_H
+
+#include "object.h"
+
+struct rev_info;
+struct oid_array;
+
+/*
+ * Called once for each batch of objects found by walk_objects_by_path().
+ * All objects of a batch have the same type "type". Commits and tags are
+ * reported in a batch of their own with an empty "path", the others in
+ * one batch for each path they were found at, e.g. "Makefile" for all
+ * versions of the top-level Makefile, or "t/" for all versions of the
+ * "t" tree. The root trees have the empty path.
+ *
+ * Objects that are only reachable from the UNINTERESTING side of the
+ * walk are reported as well, with the UNINTERESTING flag set. A non-zero
+ * return value stops the walk and is returned by walk_objects_by_path().
+ */
+typedef int (*path_fn)(const char *path,
+		       struct oid_array *oids,
+		       enum object_type type,
+		       void *data);
+
+struct path_walk_info {
+	/*
+	 * The revisions to walk, set up with setup_revisions() but not yet
+	 * with prepare_revision_walk(). Trees and blobs that are pending in
+	 * "revs" (via --indexed-objects, or given on the command line) are
+	 * walked, too.
+	 */
+	struct rev_info *revs;
+
+	path_fn path_fn;
+	void *path_fn_data;
+
+	/*
+	 * Neither descend into nor report a path at which all objects are
+	 * UNINTERESTING. This is much cheaper when only a small part of a
+	 * large tree changed, at the cost of missing out on some of the
+	 * UNINTERESTING objects, much like "pack.useSparse" does.
+	 */
+	int prune_all_uninteresting;
+};
+
+#define PATH_WALK_INFO_INIT { 0 }
+
+/*
+ * Walk the commits of "info->revs" and then the trees reachable from
+ * them, one path at a time: all versions of a tree at a given path are
+ * read together before the batches of their entries are reported, so
+ * that each path is reported only once with all the objects first seen
+ * at that path. Each object is reported only once, at the first path it
+ * is found at.
+ *
+ * Return 0 on success, or the first non-zero value returned by
+ * "info->path_fn", or -1 if an object could not be read.
+ */
+int walk_objects_by_path(struct path_walk_info *info);
+
+#endif /* PATH_WALK_H */
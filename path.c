@@ -137,6 +137,8 @@ static struct common_dir common_list[] = {
 	{ 0, 0, 1, "config" },
 	{ 1, 0, 1, "gc.pid" },
 	{ 0, 0, 1, "packed-refs" },
+	{ 0, 0, 1, "packed-refs.delta" },
+	{ 0, 0, 1, "packed-refs.idx" },
 	{ 0, 0, 1, "shallow" },
 	{ 0, 0, 0, NULL }
 };
@@ -871,7 +873,7 @@ const char *enter_repo(const char *path, int strict)
 	return NULL;
 }
 
-static int calc_shared_perm(int mode)
+int calc_shared_perm(int mode)
 {
 	int tweak;
 
@@ -1589,6 +1591,5 @@ REPO_GIT_PATH_FUNC(merge_rr, "MERGE_RR")
 REPO_GIT_PATH_FUNC(merge_mode, "MERGE_MODE")
 REPO_GIT_PATH_FUNC(merge_head, "MERGE_HEAD")
 REPO_GIT_PATH_FUNC(merge_autostash, "MERGE_AUTOSTASH")
-REPO_GIT_PATH_FUNC(auto_merge, "AUTO_MERGE")
 REPO_GIT_PATH_FUNC(fetch_head, "FETCH_HEAD")
 REPO_GIT_PATH_FUNC(shallow, "shallow")
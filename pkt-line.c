@@ -650,6 +650,35 @@ void packet_writer_init(struct packet_writer *writer, int dest_fd)
 {
 	writer->dest_fd = dest_fd;
 	writer->use_sideband = 0;
+	writer->buffered = 0;
+	strbuf_init(&writer->buffer, 0);
+}
+
+void packet_writer_release(struct packet_writer *writer)
+{
+	strbuf_release(&writer->buffer);
+}
+
+void packet_writer_send(struct packet_writer *writer)
+{
+	if (!writer->buffer.len)
+		return;
+	if (write_in_full(writer->dest_fd, writer->buffer.buf,
+			  writer->buffer.len) < 0) {
+		check_pipe(errno);
+		die_errno(_("packet write failed"));
+	}
+	strbuf_reset(&writer->buffer);
+}
+
+static void packet_writer_vwrite(struct packet_writer *writer,
+				 const char *prefix, const char *fmt,
+				 va_list args)
+{
+	if (writer->buffered)
+		format_packet(&writer->buffer, prefix, fmt, args);
+	else
+		packet_write_fmt_1(writer->dest_fd, 0, prefix, fmt, args);
 }
 
 void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
@@ -657,8 +686,8 @@ void packet_writer_write(struct packet_writer *writer, const char *fmt, ...)
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\001" : "", fmt, args);
+	packet_writer_vwrite(writer, writer->use_sideband ? "\001" : "",
+			     fmt, args);
 	va_end(args);
 }
 
@@ -667,17 +696,26 @@ void packet_writer_error(struct packet_writer *writer, const char *fmt, ...)
 	va_list args;
 
 	va_start(args, fmt);
-	packet_write_fmt_1(writer->dest_fd, 0,
-			   writer->use_sideband ? "\003" : "ERR ", fmt, args);
+	packet_writer_vwrite(writer, writer->use_sideband ? "\003" : "ERR ",
+			     fmt, args);
 	va_end(args);
+	packet_writer_send(writer);
 }
 
 void packet_writer_delim(struct packet_writer *writer)
 {
-	packet_delim(writer->dest_fd);
+	if (writer->buffered)
+		packet_buf_delim(&writer->buffer);
+	else
+		packet_delim(writer->dest_fd);
 }
 
 void packet_writer_flush(struct packet_writer *writer)
 {
-	packet_flush(writer->dest_fd);
+	if (writer->buffered) {
+		packet_buf_flush(&writer->buffer);
+		packet_writer_send(writer);
+	} else {
+		packet_flush(writer->dest_fd);
+	}
 }
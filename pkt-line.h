@@ -234,9 +234,17 @@ extern char packet_buffer[LARGE_PACKET_MAX];
 struct packet_writer {
 	int dest_fd;
 	unsigned use_sideband : 1;
+	/*
+	 * If set, pkt-lines are gathered in "buffer" and written out
+	 * together at a flush-pkt, an error or packet_writer_send(),
+	 * instead of with a write() each.
+	 */
+	unsigned buffered : 1;
+	struct strbuf buffer;
 };
 
 void packet_writer_init(struct packet_writer *writer, int dest_fd);
+void packet_writer_release(struct packet_writer *writer);
 
 /* These functions die upon failure. */
 __attribute__((format (printf, 2, 3)))
@@ -246,6 +254,12 @@ void packet_writer_error(struct packet_writer *writer, const char *fmt, ...);
 void packet_writer_delim(struct packet_writer *writer);
 void packet_writer_flush(struct packet_writer *writer);
 
+/*
+ * Write out what a buffered writer has gathered. This must be called
+ * before writing to dest_fd by other means.
+ */
+void packet_writer_send(struct packet_writer *writer);
+
 void packet_trace_identity(const char *prog);
 
 #endif
@@ -80,6 +80,10 @@ static void *preload_thread(void *_data)
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
+		/*
+		 * There is no way around this: a file that is modified in
+		 * place leaves the stat data of its directory alone.
+		 */
 		p->t2_nr_lstat++;
 		if (lstat(ce->name, &st))
 			continue;
@@ -773,23 +773,23 @@ static int mailmap_name(const char **email, size_t *email_len,
 	return mail_map->nr && map_user(mail_map, email, email_len, name, name_len);
 }
 
+/* "s" is NULL if the ident line could not be split */
 static size_t format_person_part(struct strbuf *sb, char part,
-				 const char *msg, int len,
+				 const struct ident_split *s,
 				 const struct date_mode *dmode)
 {
 	/* currently all placeholders have same length */
 	const int placeholder_len = 2;
-	struct ident_split s;
 	const char *name, *mail;
 	size_t maillen, namelen;
 
-	if (split_ident_line(&s, msg, len) < 0)
+	if (!s)
 		goto skip;
 
-	name = s.name_begin;
-	namelen = s.name_end - s.name_begin;
-	mail = s.mail_begin;
-	maillen = s.mail_end - s.mail_begin;
+	name = s->name_begin;
+	namelen = s->name_end - s->name_begin;
+	mail = s->mail_begin;
+	maillen = s->mail_end - s->mail_begin;
 
 	if (part == 'N' || part == 'E' || part == 'L') /* mailmap lookup */
 		mailmap_name(&mail, &maillen, &name, &namelen);
@@ -809,35 +809,35 @@ static size_t format_person_part(struct strbuf *sb, char part,
 		return placeholder_len;
 	}
 
-	if (!s.date_begin)
+	if (!s->date_begin)
 		goto skip;
 
 	if (part == 't') {	/* date, UNIX timestamp */
-		strbuf_add(sb, s.date_begin, s.date_end - s.date_begin);
+		strbuf_add(sb, s->date_begin, s->date_end - s->date_begin);
 		return placeholder_len;
 	}
 
 	switch (part) {
 	case 'd':	/* date */
-		strbuf_addstr(sb, show_ident_date(&s, dmode));
+		strbuf_addstr(sb, show_ident_date(s, dmode));
 		return placeholder_len;
 	case 'D':	/* date, RFC2822 style */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(RFC2822)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(RFC2822)));
 		return placeholder_len;
 	case 'r':	/* date, relative */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(RELATIVE)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(RELATIVE)));
 		return placeholder_len;
 	case 'i':	/* date, ISO 8601-like */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(ISO8601)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(ISO8601)));
 		return placeholder_len;
 	case 'I':	/* date, ISO 8601 strict */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(ISO8601_STRICT)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(ISO8601_STRICT)));
 		return placeholder_len;
 	case 'h':	/* date, human */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(HUMAN)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(HUMAN)));
 		return placeholder_len;
 	case 's':
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(SHORT)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(SHORT)));
 		return placeholder_len;
 	}
 
@@ -859,6 +859,16 @@ struct chunk {
 	size_t len;
 };
 
+/*
+ * An author or committer line of the commit being formatted, split
+ * on first use, so that "%an <%ae> %ad" parses the line only once.
+ */
+struct person_chunk {
+	struct chunk chunk;
+	struct ident_split ident;
+	int split; /* 1 once "ident" is valid, -1 if the line is bogus */
+};
+
 enum flush_type {
 	no_flush,
 	flush_right,
@@ -890,8 +900,8 @@ struct format_commit_context {
 	int padding;
 
 	/* These offsets are relative to the start of the commit message. */
-	struct chunk author;
-	struct chunk committer;
+	struct person_chunk author;
+	struct person_chunk committer;
 	size_t message_off;
 	size_t subject_off;
 	size_t body_off;
@@ -914,11 +924,11 @@ static void parse_commit_header(struct format_commit_context *context)
 		if (i == eol) {
 			break;
 		} else if (skip_prefix(msg + i, "author ", &name)) {
-			context->author.off = name - msg;
-			context->author.len = msg + eol - name;
+			context->author.chunk.off = name - msg;
+			context->author.chunk.len = msg + eol - name;
 		} else if (skip_prefix(msg + i, "committer ", &name)) {
-			context->committer.off = name - msg;
-			context->committer.len = msg + eol - name;
+			context->committer.chunk.off = name - msg;
+			context->committer.chunk.len = msg + eol - name;
 		}
 		i = eol;
 	}
@@ -926,6 +936,16 @@ static void parse_commit_header(struct format_commit_context *context)
 	context->commit_header_parsed = 1;
 }
 
+static const struct ident_split *split_person(struct format_commit_context *c,
+					      struct person_chunk *person)
+{
+	if (!person->split)
+		person->split = split_ident_line(&person->ident,
+						 c->message + person->chunk.off,
+						 person->chunk.len) < 0 ? -1 : 1;
+	return person->split > 0 ? &person->ident : NULL;
+}
+
 static int istitlechar(char c)
 {
 	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
@@ -1037,6 +1057,7 @@ static int format_reflog_person(struct strbuf *sb,
 				const struct date_mode *dmode)
 {
 	const char *ident;
+	struct ident_split s;
 
 	if (!log)
 		return 2;
@@ -1045,7 +1066,9 @@ static int format_reflog_person(struct strbuf *sb,
 	if (!ident)
 		return 2;
 
-	return format_person_part(sb, part, ident, strlen(ident), dmode);
+	return format_person_part(sb, part,
+				  split_ident_line(&s, ident, strlen(ident)) < 0 ?
+				  NULL : &s, dmode);
 }
 
 static size_t parse_color(struct strbuf *sb, /* in UTF-8 */
@@ -1711,11 +1734,11 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 	switch (placeholder[0]) {
 	case 'a':	/* author ... */
 		return format_person_part(sb, placeholder[1],
-				   msg + c->author.off, c->author.len,
+				   split_person(c, &c->author),
 				   &c->pretty_ctx->date_mode);
 	case 'c':	/* committer ... */
 		return format_person_part(sb, placeholder[1],
-				   msg + c->committer.off, c->committer.len,
+				   split_person(c, &c->committer),
 				   &c->pretty_ctx->date_mode);
 	case 'e':	/* encoding */
 		if (c->commit_encoding)
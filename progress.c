@@ -14,6 +14,7 @@
 #include "progress.h"
 #include "repository.h"
 #include "strbuf.h"
+#include "thread-utils.h"
 #include "trace.h"
 #include "trace2.h"
 #include "utf8.h"
@@ -21,6 +22,15 @@
 
 #define TP_IDX_MAX      8
 
+/*
+ * Counting with the atomic builtins of GCC and Clang lets progress_add()
+ * get by without a lock; other compilers, and 32-bit platforms that may
+ * need libatomic for 64-bit counters, take a mutex instead.
+ */
+#if defined(__GNUC__) && __SIZEOF_POINTER__ == 8 && !defined(NO_PTHREADS)
+#define PROGRESS_COUNT_ATOMIC
+#endif
+
 struct throughput {
 	off_t curr_total;
 	off_t prev_total;
@@ -45,6 +55,21 @@ struct progress {
 	struct strbuf counters_sb;
 	int title_len;
 	int split;
+
+	/*
+	 * The counts for which the percentage shown is still right, so
+	 * that display() only has to compare, not divide, until the
+	 * percentage changes or the timer fires.
+	 */
+	uint64_t same_lo, same_hi;
+
+	/* see progress_add() */
+	uint64_t count;
+#ifdef PROGRESS_COUNT_ATOMIC
+	char drawing;
+#else
+	pthread_mutex_t count_mutex;
+#endif
 };
 
 static volatile sig_atomic_t progress_update;
@@ -117,11 +142,18 @@ static void display(struct progress *progress, uint64_t n, const char *done)
 		return;
 
 	progress->last_value = n;
+	if (!progress_update && progress->same_lo <= n && n < progress->same_hi)
+		return;
+
 	tp = (progress->throughput) ? progress->throughput->display.buf : "";
 	if (progress->total) {
 		unsigned percent = n * 100 / progress->total;
 		if (percent != progress->last_percent || progress_update) {
 			progress->last_percent = percent;
+			/* the n for which n * 100 / total is percent */
+			progress->same_lo = (percent * progress->total + 99) / 100;
+			progress->same_hi =
+				((percent + 1) * progress->total + 99) / 100;
 
 			strbuf_reset(counters_sb);
 			strbuf_addf(counters_sb,
@@ -247,8 +279,30 @@ void display_throughput(struct progress *progress, uint64_t total)
 
 void display_progress(struct progress *progress, uint64_t n)
 {
-	if (progress)
+	if (progress) {
+		progress->count = n;
 		display(progress, n, NULL);
+	}
+}
+
+void progress_add(struct progress *progress, uint64_t n)
+{
+	if (!progress)
+		return;
+#ifdef PROGRESS_COUNT_ATOMIC
+	n = __atomic_add_fetch(&progress->count, n, __ATOMIC_RELAXED);
+	if (progress_update &&
+	    !__atomic_test_and_set(&progress->drawing, __ATOMIC_ACQUIRE)) {
+		display(progress, n, NULL);
+		__atomic_clear(&progress->drawing, __ATOMIC_RELEASE);
+	}
+#else
+	pthread_mutex_lock(&progress->count_mutex);
+	progress->count += n;
+	if (progress_update)
+		display(progress, progress->count, NULL);
+	pthread_mutex_unlock(&progress->count_mutex);
+#endif
 }
 
 static struct progress *start_progress_delay(const char *title, uint64_t total,
@@ -266,6 +320,14 @@ static struct progress *start_progress_delay(const char *title, uint64_t total,
 	strbuf_init(&progress->counters_sb, 0);
 	progress->title_len = utf8_strwidth(title);
 	progress->split = 0;
+	progress->same_lo = 0;
+	progress->same_hi = total ? 0 : UINT64_MAX;
+	progress->count = 0;
+#ifdef PROGRESS_COUNT_ATOMIC
+	progress->drawing = 0;
+#else
+	pthread_mutex_init(&progress->count_mutex, NULL);
+#endif
 	set_progress_signal();
 	trace2_region_enter("progress", title, the_repository);
 	return progress;
@@ -360,12 +422,18 @@ void stop_progress_msg(struct progress **p_progress, const char *msg)
 		return;
 	*p_progress = NULL;
 
+	/* show where progress_add() got to since the last redraw */
+	if (progress->last_value != -1)
+		progress->last_value = progress->count;
 	finish_if_sparse(progress);
 	if (progress->last_value != -1)
 		force_last_update(progress, msg);
 	log_trace2(progress);
 
 	clear_progress_signal();
+#ifndef PROGRESS_COUNT_ATOMIC
+	pthread_mutex_destroy(&progress->count_mutex);
+#endif
 	strbuf_release(&progress->counters_sb);
 	if (progress->throughput)
 		strbuf_release(&progress->throughput->display);
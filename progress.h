@@ -14,6 +14,16 @@ void progress_test_force_update(void);
 
 void display_throughput(struct progress *progress, uint64_t total);
 void display_progress(struct progress *progress, uint64_t n);
+
+/*
+ * Advance the progress by `n`, from any number of threads at once and
+ * without holding a lock. The count is kept in the progress itself and
+ * is only drawn when the progress timer fires, which keeps this cheap
+ * enough for hot loops. The count starts from the last value given to
+ * display_progress(), which must not be called while other threads may
+ * be calling this.
+ */
+void progress_add(struct progress *progress, uint64_t n);
 struct progress *start_progress(const char *title, uint64_t total);
 struct progress *start_sparse_progress(const char *title, uint64_t total);
 struct progress *start_delayed_progress(const char *title, uint64_t total);
@@ -17,6 +17,7 @@
 #include "userdiff.h"
 #include "apply.h"
 #include "revision.h"
+#include "thread-utils.h"
 
 struct patch_util {
 	/* For the search for an exact match */
@@ -29,6 +30,9 @@ struct patch_util {
 	/* the index of the matching item in the other branch, or -1 */
 	int matching;
 	struct object_id oid;
+	/* sorted hashes of the lines of `diff`, see estimate_diffsize() */
+	unsigned int *line_hashes;
+	int line_hashes_nr;
 };
 
 /*
@@ -315,18 +319,71 @@ static int diffsize(const char *a, const char *b)
 	return COST_MAX;
 }
 
-static void get_correspondences(struct string_list *a, struct string_list *b,
-				int creation_factor)
+static int cmp_uint(const void *a, const void *b)
 {
-	int n = a->nr + b->nr;
-	int *cost, c, *a2b, *b2a;
-	int i, j;
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
 
-	ALLOC_ARRAY(cost, st_mult(n, n));
-	ALLOC_ARRAY(a2b, n);
-	ALLOC_ARRAY(b2a, n);
+	return x < y ? -1 : x > y;
+}
 
-	for (i = 0; i < a->nr; i++) {
+static void hash_lines(struct patch_util *util)
+{
+	const char *p = util->diff;
+	int alloc = 0;
+
+	while (*p) {
+		const char *eol = strchrnul(p, '\n');
+
+		ALLOC_GROW(util->line_hashes, util->line_hashes_nr + 1, alloc);
+		util->line_hashes[util->line_hashes_nr++] = memhash(p, eol - p);
+		p = *eol ? eol + 1 : eol;
+	}
+	QSORT(util->line_hashes, util->line_hashes_nr, cmp_uint);
+}
+
+/*
+ * Every line that is in one diff more often than in the other has to be
+ * added or removed by the diff between them, so counting those lines
+ * gives a lower bound of diffsize() without running a diff. Lines whose
+ * hashes collide are taken to be the same, which only lowers the bound.
+ */
+static int estimate_diffsize(const struct patch_util *a,
+			     const struct patch_util *b)
+{
+	int i = 0, j = 0, count = 0;
+
+	while (i < a->line_hashes_nr && j < b->line_hashes_nr) {
+		if (a->line_hashes[i] < b->line_hashes[j]) {
+			count++;
+			i++;
+		} else if (a->line_hashes[i] > b->line_hashes[j]) {
+			count++;
+			j++;
+		} else {
+			i++;
+			j++;
+		}
+	}
+	return count + (a->line_hashes_nr - i) + (b->line_hashes_nr - j);
+}
+
+static int creation_cost(const struct patch_util *util, int creation_factor)
+{
+	return util->matching < 0 ?
+		util->diffsize * creation_factor / 100 : COST_MAX;
+}
+
+/*
+ * Fill in the costs of pairing patches of `a` with patches of `b`, for
+ * every `step`th patch of `a`, starting with `start`.
+ */
+static void pair_costs(struct string_list *a, struct string_list *b,
+		       int creation_factor, int *cost, int n,
+		       int start, int step)
+{
+	int i, j, c;
+
+	for (i = start; i < a->nr; i += step) {
 		struct patch_util *a_util = a->items[i].util;
 
 		for (j = 0; j < b->nr; j++) {
@@ -334,24 +391,114 @@ static void get_correspondences(struct string_list *a, struct string_list *b,
 
 			if (a_util->matching == j)
 				c = 0;
-			else if (a_util->matching < 0 && b_util->matching < 0)
-				c = diffsize(a_util->diff, b_util->diff);
-			else
+			else if (a_util->matching >= 0 || b_util->matching >= 0)
 				c = COST_MAX;
+			/*
+			 * A pair that costs more than creating one patch
+			 * and deleting the other is never part of the
+			 * cheapest assignment, so there is no need to
+			 * compute its exact cost.
+			 */
+			else if (estimate_diffsize(a_util, b_util) >
+				 creation_cost(a_util, creation_factor) +
+				 creation_cost(b_util, creation_factor))
+				c = COST_MAX;
+			else
+				c = diffsize(a_util->diff, b_util->diff);
 			cost[i + n * j] = c;
 		}
+	}
+}
+
+struct pair_costs_data {
+	pthread_t thread;
+	struct string_list *a, *b;
+	int creation_factor;
+	int *cost, n;
+	int start, step;
+};
+
+static void *pair_costs_thread(void *data)
+{
+	struct pair_costs_data *d = data;
+
+	pair_costs(d->a, d->b, d->creation_factor, d->cost, d->n,
+		   d->start, d->step);
+	return NULL;
+}
+
+/* Below this many pairs, starting threads is not worth it. */
+#define PAIR_COSTS_THREAD_MIN 10000
+
+static void compute_pair_costs(struct string_list *a, struct string_list *b,
+			       int creation_factor, int *cost, int n)
+{
+	struct pair_costs_data *data;
+	int i, nr_threads = 1;
+
+	for (i = 0; i < a->nr; i++)
+		if (((struct patch_util *)a->items[i].util)->matching < 0)
+			hash_lines(a->items[i].util);
+	for (i = 0; i < b->nr; i++)
+		if (((struct patch_util *)b->items[i].util)->matching < 0)
+			hash_lines(b->items[i].util);
+
+	if (HAVE_THREADS && (size_t)a->nr * b->nr >= PAIR_COSTS_THREAD_MIN)
+		nr_threads = online_cpus();
+	if (nr_threads > a->nr)
+		nr_threads = a->nr;
+	if (nr_threads < 2) {
+		pair_costs(a, b, creation_factor, cost, n, 0, 1);
+		return;
+	}
+
+	/*
+	 * Rows are handed out round-robin rather than in blocks, as the
+	 * patches next to each other tend to be alike in cost.
+	 */
+	CALLOC_ARRAY(data, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		struct pair_costs_data *d = &data[i];
+		int err;
+
+		d->a = a;
+		d->b = b;
+		d->creation_factor = creation_factor;
+		d->cost = cost;
+		d->n = n;
+		d->start = i;
+		d->step = nr_threads;
+		err = pthread_create(&d->thread, NULL, pair_costs_thread, d);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].thread, NULL))
+			die(_("unable to join thread"));
+	free(data);
+}
 
-		c = a_util->matching < 0 ?
-			a_util->diffsize * creation_factor / 100 : COST_MAX;
+static void get_correspondences(struct string_list *a, struct string_list *b,
+				int creation_factor)
+{
+	int n = a->nr + b->nr;
+	int *cost, c, *a2b, *b2a;
+	int i, j;
+
+	ALLOC_ARRAY(cost, st_mult(n, n));
+	ALLOC_ARRAY(a2b, n);
+	ALLOC_ARRAY(b2a, n);
+
+	compute_pair_costs(a, b, creation_factor, cost, n);
+
+	for (i = 0; i < a->nr; i++) {
+		c = creation_cost(a->items[i].util, creation_factor);
 		for (j = b->nr; j < n; j++)
 			cost[i + n * j] = c;
 	}
 
 	for (j = 0; j < b->nr; j++) {
-		struct patch_util *util = b->items[j].util;
-
-		c = util->matching < 0 ?
-			util->diffsize * creation_factor / 100 : COST_MAX;
+		c = creation_cost(b->items[j].util, creation_factor);
 		for (i = a->nr; i < n; i++)
 			cost[i + n * j] = c;
 	}
@@ -371,6 +518,10 @@ static void get_correspondences(struct string_list *a, struct string_list *b,
 			b_util->matching = i;
 		}
 
+	for (i = 0; i < a->nr; i++)
+		FREE_AND_NULL(((struct patch_util *)a->items[i].util)->line_hashes);
+	for (j = 0; j < b->nr; j++)
+		FREE_AND_NULL(((struct patch_util *)b->items[j].util)->line_hashes);
 	free(cost);
 	free(a2b);
 	free(b2a);
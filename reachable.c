@@ -250,13 +250,57 @@ static int add_recent_packed(const struct object_id *oid,
 	return 0;
 }
 
+/*
+ * Objects in a pack share the mtime of the pack, unless it is a cruft
+ * pack, which records one for each object. So if the pack is too old,
+ * none of its objects can be recent, unless a hook says so.
+ */
+static int pack_may_have_recent_objects(struct packed_git *p,
+					struct recent_data *data)
+{
+	if (p->is_cruft || p->mtime > data->timestamp)
+		return 1;
+	if (!data->extra_recent_oids_loaded)
+		load_gc_recent_objects(data);
+	return oidset_size(&data->extra_recent_oids) > 0;
+}
+
+/*
+ * Like for_each_packed_object() with FOR_EACH_OBJECT_LOCAL_ONLY and
+ * FOR_EACH_OBJECT_PACK_ORDER, but skip the packs that cannot have any
+ * recent objects without looking at any of their objects.
+ */
+static int add_recent_packs(struct recent_data *data)
+{
+	struct packed_git *p;
+	int r = 0;
+	int pack_errors = 0;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		if (data->ignore_in_core_kept_packs && p->pack_keep_in_core)
+			continue;
+		if (!pack_may_have_recent_objects(p, data))
+			continue;
+		if (open_pack_index(p)) {
+			pack_errors = 1;
+			continue;
+		}
+		r = for_each_object_in_pack(p, add_recent_packed, data,
+					    FOR_EACH_OBJECT_PACK_ORDER);
+		if (r)
+			break;
+	}
+	return r ? r : pack_errors;
+}
+
 int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
 					   timestamp_t timestamp,
 					   report_recent_object_fn *cb,
 					   int ignore_in_core_kept_packs)
 {
 	struct recent_data data;
-	enum for_each_object_flags flags;
 	int r;
 
 	data.revs = revs;
@@ -272,11 +316,7 @@ int add_unseen_recent_objects_to_traversal(struct rev_info *revs,
 	if (r)
 		goto done;
 
-	flags = FOR_EACH_OBJECT_LOCAL_ONLY | FOR_EACH_OBJECT_PACK_ORDER;
-	if (ignore_in_core_kept_packs)
-		flags |= FOR_EACH_OBJECT_SKIP_IN_CORE_KEPT_PACKS;
-
-	r = for_each_packed_object(add_recent_packed, &data, flags);
+	r = add_recent_packs(&data);
 
 done:
 	oidset_clear(&data.extra_recent_oids);
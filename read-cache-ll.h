@@ -172,6 +172,7 @@ struct index_state {
 	struct split_index *split_index;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
+		 name_hash_partial : 1,
 		 initialized : 1,
 		 drop_cache_tree : 1,
 		 updated_workdir : 1,
@@ -180,6 +181,8 @@ struct index_state {
 	enum sparse_index_mode sparse_index;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
+	struct mem_pool *dir_mem_pool;
+	unsigned int name_hash_visited;
 	struct object_id oid;
 	struct untracked_cache *untracked;
 	char *fsmonitor_last_update;
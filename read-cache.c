@@ -2211,7 +2211,18 @@ static void set_new_index_sparsity(struct index_state *istate)
 		istate->sparse_index = 1;
 }
 
-/* remember to discard_cache() before reading a different cache! */
+/*
+ * remember to discard_cache() before reading a different cache!
+ *
+ * Every entry is copied into a "struct cache_entry" here; the rest of
+ * Git modifies istate->cache[] in place and frees it with the index, so
+ * entries cannot point into the mapped file.  Parsing an entry costs
+ * little next to copying it, and a fixed-stride on-disk format would
+ * save only the former.  Large indexes are loaded in threads instead
+ * (see "index.threads"), and read-only commands in huge worktrees are
+ * better served by a sparse index, which keeps whole directories
+ * outside the sparse-checkout cone as a single entry.
+ */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
 	int fd;
@@ -2240,6 +2251,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 		die_errno(_("%s: index file open failed"), path);
 	}
 
+	trace2_timer_start(TRACE2_TIMER_ID_READ_INDEX);
 	if (fstat(fd, &st))
 		die_errno(_("%s: cannot stat the open index"), path);
 
@@ -2325,6 +2337,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 		load_index_extensions(&p);
 	}
 	munmap((void *)mmap, mmap_size);
+	trace2_timer_stop(TRACE2_TIMER_ID_READ_INDEX);
 
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
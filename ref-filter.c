@@ -11,6 +11,7 @@
 #include "object-name.h"
 #include "object-store-ll.h"
 #include "oid-array.h"
+#include "packfile.h"
 #include "repository.h"
 #include "commit.h"
 #include "mailmap.h"
@@ -32,6 +33,8 @@
 #include "worktree.h"
 #include "hashmap.h"
 #include "strvec.h"
+#include "strmap.h"
+#include "thread-utils.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -239,6 +242,19 @@ static struct used_atom {
 } *used_atom;
 static int used_atom_cnt, need_tagged, need_symref;
 
+/*
+ * The format last given to format_ref_array_item(), split into the
+ * literal text before each atom and the position of the atom in
+ * used_atom[], so that the atoms are not looked up again for every
+ * ref. It goes away with used_atom[], in ref_array_clear().
+ */
+static struct format_step {
+	const char *literal, *literal_end; /* literal_end is NULL at the end */
+	int atom; /* -1 for the text after the last atom */
+} *format_steps;
+static size_t format_steps_nr, format_steps_alloc;
+static const char *format_steps_format;
+
 /*
  * Expand string, append it to strbuf *sb, then return error code ret.
  * Allow to save few lines of code.
@@ -1640,7 +1656,7 @@ static void grab_person(const char *who, struct atom_value *val, int deref, void
 {
 	int i;
 	int wholen = strlen(who);
-	const char *wholine = NULL;
+	const char *wholine = NULL, *unmapped_wholine = NULL;
 	const char *headers[] = { "author ", "committer ",
 				  "tagger ", NULL };
 
@@ -1672,7 +1688,9 @@ static void grab_person(const char *who, struct atom_value *val, int deref, void
 			apply_mailmap_to_header(&mailmap_buf, headers, &mailmap);
 			wholine = find_wholine(who, wholen, mailmap_buf.buf);
 		} else {
-			wholine = find_wholine(who, wholen, buf);
+			if (!unmapped_wholine)
+				unmapped_wholine = find_wholine(who, wholen, buf);
+			wholine = unmapped_wholine;
 		}
 
 		if (!wholine)
@@ -1807,15 +1825,18 @@ static void find_subpos(const char *buf,
 			size_t *nonsiglen,
 			const char **sig, size_t *siglen)
 {
-	struct strbuf payload = STRBUF_INIT;
-	struct strbuf signature = STRBUF_INIT;
 	const char *eol;
 	const char *end = buf + strlen(buf);
 	const char *sigstart;
 
-	/* parse signature first; we might not even have a subject line */
-	parse_signature(buf, end - buf, &payload, &signature);
-	strbuf_release(&payload);
+	/*
+	 * Find the signature first; we might not even have a subject line.
+	 * It is the last line that starts one, so if it is not in the
+	 * message (it cannot be in the header), neither is any other.
+	 */
+	sigstart = buf + parse_signed_buffer(buf, end - buf);
+	*siglen = end - sigstart;
+	*sig = xmemdupz(sigstart, *siglen);
 
 	/* skip past header until we hit empty line */
 	while (*buf && *buf != '\n') {
@@ -1827,8 +1848,8 @@ static void find_subpos(const char *buf,
 	/* skip any empty lines */
 	while (*buf == '\n')
 		buf++;
-	*sig = strbuf_detach(&signature, siglen);
-	sigstart = buf + parse_signed_buffer(buf, strlen(buf));
+	if (sigstart < buf)
+		sigstart = end;
 
 	/* subject is first non-empty line */
 	*sub = buf;
@@ -2141,16 +2162,35 @@ static const char *show_ref(struct refname_atom *atom, const char *refname)
 		return xstrdup(refname);
 }
 
+/*
+ * Like stat_tracking_info(), but use the counts that filter_ahead_behind()
+ * computed for all refs at once, if there are any.
+ */
+static int get_tracking_counts(struct used_atom *atom, struct branch *branch,
+			       const struct ahead_behind_count *count,
+			       int *num_ours, int *num_theirs)
+{
+	if (count) {
+		*num_ours = count->ahead;
+		*num_theirs = count->behind;
+		return 0;
+	}
+	return stat_tracking_info(branch, num_ours, num_theirs,
+				  NULL, atom->u.remote_ref.push,
+				  AHEAD_BEHIND_FULL);
+}
+
 static void fill_remote_ref_details(struct used_atom *atom, const char *refname,
-				    struct branch *branch, const char **s)
+				    struct branch *branch,
+				    const struct ahead_behind_count *count,
+				    const char **s)
 {
 	int num_ours, num_theirs;
 	if (atom->u.remote_ref.option == RR_REF)
 		*s = show_ref(&atom->u.remote_ref.refname, refname);
 	else if (atom->u.remote_ref.option == RR_TRACK) {
-		if (stat_tracking_info(branch, &num_ours, &num_theirs,
-				       NULL, atom->u.remote_ref.push,
-				       AHEAD_BEHIND_FULL) < 0) {
+		if (get_tracking_counts(atom, branch, count,
+					&num_ours, &num_theirs) < 0) {
 			*s = xstrdup(msgs.gone);
 		} else if (!num_ours && !num_theirs)
 			*s = xstrdup("");
@@ -2167,9 +2207,8 @@ static void fill_remote_ref_details(struct used_atom *atom, const char *refname,
 			free((void *)to_free);
 		}
 	} else if (atom->u.remote_ref.option == RR_TRACKSHORT) {
-		if (stat_tracking_info(branch, &num_ours, &num_theirs,
-				       NULL, atom->u.remote_ref.push,
-				       AHEAD_BEHIND_FULL) < 0) {
+		if (get_tracking_counts(atom, branch, count,
+					&num_ours, &num_theirs) < 0) {
 			*s = xstrdup("");
 			return;
 		}
@@ -2384,7 +2423,8 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 
 			refname = branch_get_upstream(branch, NULL);
 			if (refname)
-				fill_remote_ref_details(atom, refname, branch, &v->s);
+				fill_remote_ref_details(atom, refname, branch,
+							ref->upstream_count, &v->s);
 			else
 				v->s = xstrdup("");
 			continue;
@@ -2405,7 +2445,8 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 			}
 			/* We will definitely re-init v->s on the next line. */
 			free((char *)v->s);
-			fill_remote_ref_details(atom, refname, branch, &v->s);
+			fill_remote_ref_details(atom, refname, branch,
+						ref->push_count, &v->s);
 			continue;
 		} else if (atom_type == ATOM_COLOR) {
 			v->s = xstrdup(atom->u.color);
@@ -2533,6 +2574,156 @@ static int get_ref_atom_value(struct ref_array_item *ref, int atom,
 	return 0;
 }
 
+/*
+ * The refs of a ref_array are listed in an order that has little to do
+ * with where their objects are in the packs. When the format needs the
+ * contents of the objects, read those of a batch of refs ahead, in pack
+ * order and in threads, before populating the values of the refs in
+ * their own order.
+ */
+#define READ_AHEAD_BATCH 1024
+
+struct read_ahead_item {
+	const struct object_id *oid;
+	struct packed_git *pack;
+	off_t offset;
+	unsigned kept : 1;
+};
+
+struct read_ahead_batch {
+	struct read_ahead_item *items;
+	size_t nr, next;
+	pthread_mutex_t mutex;
+};
+
+static int read_ahead_item_cmp(const void *va, const void *vb)
+{
+	const struct read_ahead_item *a = va, *b = vb;
+
+	if (a->pack != b->pack)
+		return a->pack < b->pack ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return oidcmp(a->oid, b->oid);
+}
+
+static void read_ahead_one(struct read_ahead_item *item)
+{
+	item->kept = !!read_ahead_object(the_repository, item->oid,
+					 big_file_threshold);
+}
+
+static void *read_ahead_thread(void *data)
+{
+	struct read_ahead_batch *batch = data;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&batch->mutex);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->mutex);
+		if (i >= batch->nr)
+			break;
+		read_ahead_one(&batch->items[i]);
+	}
+	return NULL;
+}
+
+static void read_ahead_batch(struct read_ahead_batch *batch, int nr_threads)
+{
+	pthread_t *threads;
+	size_t i;
+	int ret;
+
+	if (nr_threads > batch->nr)
+		nr_threads = batch->nr;
+	if (nr_threads <= 1) {
+		for (i = 0; i < batch->nr; i++)
+			read_ahead_one(&batch->items[i]);
+		return;
+	}
+
+	batch->next = 0;
+	pthread_mutex_init(&batch->mutex, NULL);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL, read_ahead_thread, batch);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&batch->mutex);
+}
+
+static void discard_values(struct ref_array_item *ref)
+{
+	int i;
+
+	for (i = 0; i < used_atom_cnt; i++)
+		free((char *)ref->value[i].s);
+	FREE_AND_NULL(ref->value);
+}
+
+/* Populate the values of "refs", reading their objects ahead if needed. */
+static void populate_values_ahead(struct ref_array_item **refs, size_t nr)
+{
+	struct read_ahead_batch batch = { 0 };
+	struct strbuf err = STRBUF_INIT;
+	int nr_threads = HAVE_THREADS ? online_cpus() : 1;
+	size_t i;
+
+	if ((!oi.info.contentp && !need_tagged) ||
+	    oi.info.disk_sizep || oi.info.delta_base_oid)
+		return;
+
+	ALLOC_ARRAY(batch.items, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_info info = OBJECT_INFO_INIT;
+		struct read_ahead_item *item;
+
+		if (refs[i]->value)
+			continue;
+		item = &batch.items[batch.nr++];
+		item->oid = &refs[i]->objectname;
+		item->pack = NULL;
+		item->offset = 0;
+		if (!oid_object_info_extended(the_repository, item->oid, &info,
+					      OBJECT_INFO_QUICK |
+					      OBJECT_INFO_SKIP_FETCH_OBJECT) &&
+		    info.whence == OI_PACKED) {
+			item->pack = info.u.packed.pack;
+			item->offset = info.u.packed.offset;
+		}
+	}
+	QSORT(batch.items, batch.nr, read_ahead_item_cmp);
+
+	enable_read_ahead(the_repository);
+	read_ahead_batch(&batch, nr_threads);
+
+	for (i = 0; i < nr; i++) {
+		if (refs[i]->value)
+			continue;
+		strbuf_reset(&err);
+		if (populate_value(refs[i], &err))
+			/* leave the error to be reported when it is used */
+			discard_values(refs[i]);
+		else
+			fill_missing_values(refs[i]->value);
+	}
+
+	for (i = 0; i < batch.nr; i++)
+		if (batch.items[i].kept)
+			drop_read_ahead_object(the_repository, batch.items[i].oid);
+	disable_read_ahead(the_repository);
+	strbuf_release(&err);
+	free(batch.items);
+}
+
 /*
  * Return 1 if the refname matches one of the patterns, otherwise 0.
  * A pattern can be a literal prefix (e.g. a refname "refs/heads/master"
@@ -2919,6 +3110,9 @@ void ref_array_clear(struct ref_array *array)
 	}
 	FREE_AND_NULL(used_atom);
 	used_atom_cnt = 0;
+	FREE_AND_NULL(format_steps);
+	format_steps_nr = format_steps_alloc = 0;
+	format_steps_format = NULL;
 
 	if (ref_to_worktree_map.worktrees) {
 		hashmap_clear_and_free(&(ref_to_worktree_map.map),
@@ -2978,44 +3172,162 @@ static void reach_filter(struct ref_array *array,
 	free(to_clear);
 }
 
+/*
+ * Find out whether the format shows how branches compare to their
+ * upstream or push branches, i.e. has "upstream:track" or the like.
+ */
+static void used_tracking_atoms(int *upstream, int *push)
+{
+	*upstream = *push = 0;
+	for (int i = 0; i < used_atom_cnt; i++) {
+		struct used_atom *atom = &used_atom[i];
+
+		if (atom->atom_type != ATOM_UPSTREAM &&
+		    atom->atom_type != ATOM_PUSH)
+			continue;
+		if (atom->u.remote_ref.option != RR_TRACK &&
+		    atom->u.remote_ref.option != RR_TRACKSHORT)
+			continue;
+		if (atom->u.remote_ref.push)
+			*push = 1;
+		else
+			*upstream = 1;
+	}
+}
+
+struct tracking_bases {
+	struct commit **commits;
+	size_t *commits_nr;
+	struct strmap index;
+};
+
+/*
+ * Add the comparison of branch "item", whose commit is "tip", with its
+ * upstream or push branch. The commits of those are shared by all
+ * branches that track the same one; "tip" is added to the commits when
+ * it is first needed, at "*tip_index". Returns NULL if there is nothing
+ * to compare with, in which case fill_remote_ref_details() finds out
+ * why on its own.
+ */
+static struct ahead_behind_count *add_tracking_count(struct repository *r,
+						     struct ref_array *array,
+						     struct ref_array_item *item,
+						     struct commit *tip,
+						     size_t *tip_index,
+						     int for_push,
+						     struct tracking_bases *bases)
+{
+	struct ahead_behind_count *count;
+	const char *branch_name, *base;
+	struct branch *branch;
+	size_t base_index;
+	void *util;
+
+	if (!skip_prefix(item->refname, "refs/heads/", &branch_name))
+		return NULL;
+	branch = branch_get(branch_name);
+	base = for_push ? branch_get_push(branch, NULL) :
+		branch_get_upstream(branch, NULL);
+	if (!base)
+		return NULL;
+
+	util = strmap_get(&bases->index, base);
+	if (util) {
+		base_index = (uintptr_t)util - 1;
+	} else {
+		struct object_id oid;
+		struct commit *c;
+
+		if (read_ref(base, &oid))
+			return NULL;
+		c = lookup_commit_reference(r, &oid);
+		if (!c)
+			return NULL;
+		base_index = (*bases->commits_nr)++;
+		bases->commits[base_index] = c;
+		strmap_put(&bases->index, base, (void *)(uintptr_t)(base_index + 1));
+	}
+
+	if (*tip_index == SIZE_MAX) {
+		*tip_index = (*bases->commits_nr)++;
+		bases->commits[*tip_index] = tip;
+	}
+
+	count = &array->counts[array->counts_nr++];
+	count->tip_index = *tip_index;
+	count->base_index = base_index;
+	return count;
+}
+
 void filter_ahead_behind(struct repository *r,
 			 struct ref_format *format,
 			 struct ref_array *array)
 {
 	struct commit **commits;
-	size_t commits_nr = format->bases.nr + array->nr;
+	size_t commits_nr, per_ref;
+	struct tracking_bases tracking = { .commits_nr = &commits_nr };
+	int upstream, push;
 
-	if (!format->bases.nr || !array->nr)
+	used_tracking_atoms(&upstream, &push);
+	if ((!format->bases.nr && !upstream && !push) || !array->nr)
 		return;
 
-	ALLOC_ARRAY(commits, commits_nr);
+	/*
+	 * All comparisons, those with the ahead-behind bases as well as
+	 * those of branches with their upstream and push branches, share
+	 * a single walk.
+	 */
+	per_ref = format->bases.nr + upstream + push;
+	ALLOC_ARRAY(commits, st_add(format->bases.nr,
+				    st_mult(array->nr, 1 + upstream + push)));
 	for (size_t i = 0; i < format->bases.nr; i++)
 		commits[i] = format->bases.items[i].util;
 
-	ALLOC_ARRAY(array->counts, st_mult(format->bases.nr, array->nr));
+	ALLOC_ARRAY(array->counts, st_mult(per_ref, array->nr));
+	tracking.commits = commits;
+	strmap_init(&tracking.index);
 
 	commits_nr = format->bases.nr;
 	array->counts_nr = 0;
 	for (size_t i = 0; i < array->nr; i++) {
-		const char *name = array->items[i]->refname;
-		commits[commits_nr] = lookup_commit_reference_by_name(name);
+		struct ref_array_item *item = array->items[i];
+		size_t tip_index = SIZE_MAX;
+		struct commit *tip;
 
-		if (!commits[commits_nr])
+		/* Only branches have upstream and push branches. */
+		if (!format->bases.nr &&
+		    !starts_with(item->refname, "refs/heads/"))
 			continue;
 
-		CALLOC_ARRAY(array->items[i]->counts, format->bases.nr);
-		for (size_t j = 0; j < format->bases.nr; j++) {
-			struct ahead_behind_count *count;
-			count = &array->counts[array->counts_nr++];
-			count->tip_index = commits_nr;
-			count->base_index = j;
+		tip = lookup_commit_reference_by_name(item->refname);
+		if (!tip)
+			continue;
 
-			array->items[i]->counts[j] = count;
+		if (format->bases.nr) {
+			tip_index = commits_nr++;
+			commits[tip_index] = tip;
+			CALLOC_ARRAY(item->counts, format->bases.nr);
+			for (size_t j = 0; j < format->bases.nr; j++) {
+				struct ahead_behind_count *count;
+				count = &array->counts[array->counts_nr++];
+				count->tip_index = tip_index;
+				count->base_index = j;
+
+				item->counts[j] = count;
+			}
 		}
-		commits_nr++;
+		if (upstream)
+			item->upstream_count = add_tracking_count(r, array, item,
+								  tip, &tip_index,
+								  0, &tracking);
+		if (push)
+			item->push_count = add_tracking_count(r, array, item,
+							      tip, &tip_index,
+							      1, &tracking);
 	}
 
 	ahead_behind(r, commits, commits_nr, array->counts, array->counts_nr);
+	strmap_clear(&tracking.index, 0);
 	free(commits);
 }
 
@@ -3084,7 +3396,11 @@ int filter_refs(struct ref_array *array, struct ref_filter *filter, unsigned int
 	return ret;
 }
 
+static int sorting_is_iteration_order(struct ref_sorting *sorting,
+				      unsigned int type);
+
 static inline int can_do_iterative_format(struct ref_filter *filter,
+					  unsigned int type,
 					  struct ref_sorting *sorting,
 					  struct ref_format *format)
 {
@@ -3093,20 +3409,26 @@ static inline int can_do_iterative_format(struct ref_filter *filter,
 	 * callback is not compatible with options that require
 	 * post-processing a filtered ref_array. These include:
 	 * - filtering on reachability
-	 * - sorting the filtered results
-	 * - including ahead-behind information in the formatted output
+	 * - sorting the filtered results in any other order than the
+	 *   one the refs are iterated in
+	 * - including ahead-behind information in the formatted output,
+	 *   against the given bases or against upstream or push branches
 	 */
+	int upstream, push;
+
+	used_tracking_atoms(&upstream, &push);
 	return !(filter->reachable_from ||
 		 filter->unreachable_from ||
-		 sorting ||
-		 format->bases.nr);
+		 !sorting_is_iteration_order(sorting, type) ||
+		 format->bases.nr ||
+		 upstream || push);
 }
 
 void filter_and_format_refs(struct ref_filter *filter, unsigned int type,
 			    struct ref_sorting *sorting,
 			    struct ref_format *format)
 {
-	if (can_do_iterative_format(filter, sorting, format)) {
+	if (can_do_iterative_format(filter, type, sorting, format)) {
 		int save_commit_buffer_orig;
 		struct ref_filter_and_format_cbdata ref_cbdata = {
 			.filter = filter,
@@ -3160,6 +3482,29 @@ struct ref_sorting {
 	enum ref_sorting_order sort_flags;
 };
 
+/*
+ * The refs are iterated over sorted by their full names, and so are
+ * the refs matching several patterns, as refs_for_each_fullref_in_prefixes()
+ * visits non-overlapping prefixes in order. Sorting by "refname" alone
+ * thus does not need the whole list; the detached HEAD, though, is
+ * visited last, but sorts first.
+ */
+static int sorting_is_iteration_order(struct ref_sorting *sorting,
+				      unsigned int type)
+{
+	struct used_atom *atom;
+
+	if (!sorting)
+		return 1;
+	if (sorting->next || sorting->sort_flags ||
+	    (type & FILTER_REFS_DETACHED_HEAD))
+		return 0;
+	atom = &used_atom[sorting->atom];
+	return atom->atom_type == ATOM_REFNAME &&
+	       *atom->name != '*' &&
+	       atom->u.refname.option == R_NORMAL;
+}
+
 static int cmp_ref_sorting(struct ref_sorting *s, struct ref_array_item *a, struct ref_array_item *b)
 {
 	struct atom_value *va, *vb;
@@ -3246,6 +3591,18 @@ void ref_sorting_set_sort_flags_all(struct ref_sorting *sorting,
 
 void ref_array_sort(struct ref_sorting *sorting, struct ref_array *array)
 {
+	struct ref_sorting *s;
+	size_t i;
+
+	for (s = sorting; s; s = s->next) {
+		if (used_atom[s->atom].source != SOURCE_OBJ)
+			continue;
+		for (i = 0; i < array->nr; i += READ_AHEAD_BATCH)
+			populate_values_ahead(array->items + i,
+					      array->nr - i < READ_AHEAD_BATCH ?
+					      array->nr - i : READ_AHEAD_BATCH);
+		break;
+	}
 	if (sorting)
 		QSORT_S(array->items, array->nr, compare_refs, sorting);
 }
@@ -3272,35 +3629,64 @@ static void append_literal(const char *cp, const char *ep, struct ref_formatting
 	}
 }
 
+static int compile_ref_format(struct ref_format *format, struct strbuf *err)
+{
+	const char *cp, *sp, *ep;
+
+	format_steps_format = NULL;
+	format_steps_nr = 0;
+	for (cp = format->format; *cp && (sp = find_next(cp)); cp = ep + 1) {
+		int pos;
+
+		ep = strchr(sp, ')');
+		pos = parse_ref_filter_atom(format, sp + 2, ep, err);
+		if (pos < 0)
+			return -1;
+		ALLOC_GROW(format_steps, format_steps_nr + 1, format_steps_alloc);
+		format_steps[format_steps_nr].literal = cp;
+		format_steps[format_steps_nr].literal_end = sp;
+		format_steps[format_steps_nr].atom = pos;
+		format_steps_nr++;
+	}
+	ALLOC_GROW(format_steps, format_steps_nr + 1, format_steps_alloc);
+	format_steps[format_steps_nr].literal = cp;
+	format_steps[format_steps_nr].literal_end = NULL;
+	format_steps[format_steps_nr].atom = -1;
+	format_steps_nr++;
+	format_steps_format = format->format;
+	return 0;
+}
+
 int format_ref_array_item(struct ref_array_item *info,
 			  struct ref_format *format,
 			  struct strbuf *final_buf,
 			  struct strbuf *error_buf)
 {
-	const char *cp, *sp, *ep;
 	struct ref_formatting_state state = REF_FORMATTING_STATE_INIT;
+	size_t i;
 
 	state.quote_style = format->quote_style;
 	push_stack_element(&state.stack);
 
-	for (cp = format->format; *cp && (sp = find_next(cp)); cp = ep + 1) {
+	if (format_steps_format != format->format &&
+	    compile_ref_format(format, error_buf)) {
+		pop_stack_element(&state.stack);
+		return -1;
+	}
+	for (i = 0; i < format_steps_nr; i++) {
+		struct format_step *step = &format_steps[i];
 		struct atom_value *atomv;
-		int pos;
 
-		ep = strchr(sp, ')');
-		if (cp < sp)
-			append_literal(cp, sp, &state);
-		pos = parse_ref_filter_atom(format, sp + 2, ep, error_buf);
-		if (pos < 0 || get_ref_atom_value(info, pos, &atomv, error_buf) ||
+		if (*step->literal && step->literal != step->literal_end)
+			append_literal(step->literal, step->literal_end, &state);
+		if (step->atom < 0)
+			break;
+		if (get_ref_atom_value(info, step->atom, &atomv, error_buf) ||
 		    atomv->handler(atomv, &state, error_buf)) {
 			pop_stack_element(&state.stack);
 			return -1;
 		}
 	}
-	if (*cp) {
-		sp = cp + strlen(cp);
-		append_literal(cp, sp, &state);
-	}
 	if (format->need_color_reset_at_eol) {
 		struct atom_value resetv = ATOM_VALUE_INIT;
 		resetv.s = GIT_COLOR_RESET;
@@ -3327,6 +3713,10 @@ void print_formatted_ref_array(struct ref_array *array, struct ref_format *forma
 	if (!total || array->nr < total)
 		total = array->nr;
 	for (int i = 0; i < total; i++) {
+		if (!(i % READ_AHEAD_BATCH))
+			populate_values_ahead(array->items + i,
+					      total - i < READ_AHEAD_BATCH ?
+					      total - i : READ_AHEAD_BATCH);
 		strbuf_reset(&err);
 		strbuf_reset(&output);
 		if (format_ref_array_item(array->items[i], format, &output, &err))
@@ -46,6 +46,8 @@ struct ref_array_item {
 	struct commit *commit;
 	struct atom_value *value;
 	struct ahead_behind_count **counts;
+	struct ahead_behind_count *upstream_count;
+	struct ahead_behind_count *push_count;
 
 	char refname[FLEX_ARRAY];
 };
@@ -196,6 +198,10 @@ struct ref_array_item *ref_array_push(struct ref_array *array,
  * called after filter_refs() but before outputting the formatted refs.
  *
  * If this is not called, then any ahead-behind atoms will be blank.
+ *
+ * The comparisons of branches with their upstream or push branches for
+ * atoms like "upstream:track" are computed in the same walk; without
+ * calling this, they are computed one branch at a time.
  */
 void filter_ahead_behind(struct repository *r,
 			 struct ref_format *format,
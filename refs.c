@@ -33,17 +33,34 @@
 /*
  * List of all available backends
  */
-static struct ref_storage_be *refs_backends = &refs_be_files;
+static const struct ref_storage_be *refs_backends[] = {
+	[REF_STORAGE_FORMAT_FILES] = &refs_be_files,
+	[REF_STORAGE_FORMAT_REFTABLE] = &refs_be_reftable,
+};
 
-static struct ref_storage_be *find_ref_storage_backend(const char *name)
+static const struct ref_storage_be *find_ref_storage_backend(unsigned int ref_storage_format)
 {
-	struct ref_storage_be *be;
-	for (be = refs_backends; be; be = be->next)
-		if (!strcmp(be->name, name))
-			return be;
+	if (ref_storage_format < ARRAY_SIZE(refs_backends))
+		return refs_backends[ref_storage_format];
 	return NULL;
 }
 
+unsigned int ref_storage_format_by_name(const char *name)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(refs_backends); i++)
+		if (refs_backends[i] && !strcmp(refs_backends[i]->name, name))
+			return i;
+	return REF_STORAGE_FORMAT_UNKNOWN;
+}
+
+const char *ref_storage_format_to_name(unsigned int ref_storage_format)
+{
+	const struct ref_storage_be *be = find_ref_storage_backend(ref_storage_format);
+	if (!be)
+		return "unknown";
+	return be->name;
+}
+
 /*
  * How to handle various characters in refnames:
  * 0: An acceptable character for refs
@@ -990,6 +1007,9 @@ struct read_ref_at_cb {
 	timestamp_t at_time;
 	int cnt;
 	int reccnt;
+	/* The number of youngest entries the backend skipped: */
+	int skipped;
+	int counted_skipped;
 	struct object_id *oid;
 	int found_it;
 
@@ -1016,6 +1036,16 @@ static void set_read_ref_cutoffs(struct read_ref_at_cb *cb,
 		*cb->cutoff_cnt = cb->reccnt;
 }
 
+static void read_ref_at_count_skipped(struct read_ref_at_cb *cb)
+{
+	if (cb->counted_skipped)
+		return;
+	cb->reccnt += cb->skipped;
+	if (cb->cnt > 0)
+		cb->cnt -= cb->skipped;
+	cb->counted_skipped = 1;
+}
+
 static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
 			   const char *email UNUSED,
 			   timestamp_t timestamp, int tz,
@@ -1024,6 +1054,7 @@ static int read_ref_at_ent(struct object_id *ooid, struct object_id *noid,
 	struct read_ref_at_cb *cb = cb_data;
 	int reached_count;
 
+	read_ref_at_count_skipped(cb);
 	cb->tz = tz;
 	cb->date = timestamp;
 
@@ -1110,7 +1141,15 @@ int read_ref_at(struct ref_store *refs, const char *refname,
 		return 0;
 	}
 
-	refs_for_each_reflog_ent_reverse(refs, refname, read_ref_at_ent, &cb);
+	if (refs->be->for_each_reflog_ent_reverse_seek)
+		refs->be->for_each_reflog_ent_reverse_seek(refs, refname,
+							   at_time, cnt,
+							   &cb.skipped,
+							   read_ref_at_ent, &cb);
+	else
+		refs_for_each_reflog_ent_reverse(refs, refname,
+						 read_ref_at_ent, &cb);
+	read_ref_at_count_skipped(&cb);
 
 	if (!cb.reccnt) {
 		if (flags & GET_OID_QUIETLY)
@@ -1818,12 +1857,39 @@ static int refs_read_special_head(struct ref_store *ref_store,
 	return result;
 }
 
+static int is_special_ref(const char *refname)
+{
+	/*
+	 * Special references are written by their users straight into the
+	 * filesystem rather than through the reference backend, so they
+	 * must be read from there, too, whatever the ref storage format:
+	 *
+	 * - FETCH_HEAD and MERGE_HEAD may contain multiple object IDs, and
+	 *   FETCH_HEAD carries additional metadata for each of them.
+	 *
+	 * - MERGE_AUTOSTASH is written next to MERGE_HEAD by "git merge
+	 *   --autostash".
+	 */
+	static const char * const special_refs[] = {
+		"FETCH_HEAD",
+		"MERGE_AUTOSTASH",
+		"MERGE_HEAD",
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(special_refs); i++)
+		if (!strcmp(refname, special_refs[i]))
+			return 1;
+
+	return 0;
+}
+
 int refs_read_raw_ref(struct ref_store *ref_store, const char *refname,
 		      struct object_id *oid, struct strbuf *referent,
 		      unsigned int *type, int *failure_errno)
 {
 	assert(failure_errno);
-	if (!strcmp(refname, "FETCH_HEAD") || !strcmp(refname, "MERGE_HEAD")) {
+	if (is_special_ref(refname)) {
 		return refs_read_special_head(ref_store, refname, oid, referent,
 					      type, failure_errno);
 	}
@@ -1928,11 +1994,9 @@ const char *refs_resolve_ref_unsafe(struct ref_store *refs,
 }
 
 /* backend functions */
-int refs_init_db(struct strbuf *err)
+int refs_init_db(struct ref_store *refs, int flags, struct strbuf *err)
 {
-	struct ref_store *refs = get_main_ref_store(the_repository);
-
-	return refs->be->init_db(refs, err);
+	return refs->be->init_db(refs, flags, err);
 }
 
 const char *resolve_ref_unsafe(const char *refname, int resolve_flags,
@@ -2029,12 +2093,12 @@ static struct ref_store *ref_store_init(struct repository *repo,
 					const char *gitdir,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	const struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	be = find_ref_storage_backend(repo->ref_storage_format);
 	if (!be)
-		BUG("reference backend %s is unknown", be_name);
+		BUG("reference backend is unknown");
 
 	refs = be->init(repo, gitdir, flags);
 	return refs;
@@ -2170,6 +2234,13 @@ int refs_pack_refs(struct ref_store *refs, struct pack_refs_opts *opts)
 	return refs->be->pack_refs(refs, opts);
 }
 
+int refs_read_generation(struct ref_store *refs, struct strbuf *out)
+{
+	if (!refs->be->read_generation)
+		return -1;
+	return refs->be->read_generation(refs, out);
+}
+
 int peel_iterated_oid(const struct object_id *base, struct object_id *peeled)
 {
 	if (current_ref_iter &&
@@ -11,6 +11,14 @@ struct string_list;
 struct string_list_item;
 struct worktree;
 
+/*
+ * Map between the name of a reference storage format, like "files" or
+ * "reftable", and its REF_STORAGE_FORMAT_* constant. Unknown names map
+ * to REF_STORAGE_FORMAT_UNKNOWN.
+ */
+unsigned int ref_storage_format_by_name(const char *name);
+const char *ref_storage_format_to_name(unsigned int ref_storage_format);
+
 /*
  * Resolve a reference, recursively following symbolic refererences.
  *
@@ -123,7 +131,14 @@ int should_autocreate_reflog(const char *refname);
 
 int is_branch(const char *refname);
 
-int refs_init_db(struct strbuf *err);
+#define REFS_INIT_DB_IS_WORKTREE (1 << 0)
+
+/*
+ * Create the on-disk structures of the reference store "refs". Pass
+ * REFS_INIT_DB_IS_WORKTREE when setting up the per-worktree part of a
+ * linked worktree, where the shared references already exist.
+ */
+int refs_init_db(struct ref_store *refs, int flags, struct strbuf *err);
 
 /*
  * Return the peeled value of the oid currently being iterated via
@@ -428,6 +443,16 @@ void warn_dangling_symrefs(FILE *fp, const char *msg_fmt,
  */
 int refs_pack_refs(struct ref_store *refs, struct pack_refs_opts *opts);
 
+/*
+ * Store a string in `out` that changes whenever a reference in `refs` is
+ * updated, so that data derived from the references can be cached under
+ * it. This may need to write to the repository, as the "files" backend
+ * only keeps track of updates once it has been asked for the generation.
+ * Updates by other implementations of Git may go unnoticed. Return 0 on
+ * success, or -1 if the generation cannot be determined.
+ */
+int refs_read_generation(struct ref_store *refs, struct strbuf *out);
+
 /*
  * Setup reflog before using. Fill in err and return -1 on failure.
  */
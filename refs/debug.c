@@ -33,10 +33,10 @@ struct ref_store *maybe_debug_wrap_ref_store(const char *gitdir, struct ref_stor
 	return (struct ref_store *)res;
 }
 
-static int debug_init_db(struct ref_store *refs, struct strbuf *err)
+static int debug_init_db(struct ref_store *refs, int flags, struct strbuf *err)
 {
 	struct debug_ref_store *drefs = (struct debug_ref_store *)refs;
-	int res = drefs->refs->be->init_db(drefs->refs, err);
+	int res = drefs->refs->be->init_db(drefs->refs, flags, err);
 	trace_printf_key(&trace_refs, "init_db: %d\n", res);
 	return res;
 }
@@ -343,6 +343,34 @@ static int debug_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	return res;
 }
 
+static int debug_for_each_reflog_ent_reverse_seek(struct ref_store *ref_store,
+						  const char *refname,
+						  timestamp_t at_time, int cnt,
+						  int *skipped,
+						  each_reflog_ent_fn fn,
+						  void *cb_data)
+{
+	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
+	struct debug_reflog dbg = {
+		.refname = refname,
+		.fn = fn,
+		.cb_data = cb_data,
+	};
+	int res;
+
+	*skipped = 0;
+	if (drefs->refs->be->for_each_reflog_ent_reverse_seek)
+		res = drefs->refs->be->for_each_reflog_ent_reverse_seek(
+			drefs->refs, refname, at_time, cnt, skipped,
+			&debug_print_reflog_ent, &dbg);
+	else
+		res = drefs->refs->be->for_each_reflog_ent_reverse(
+			drefs->refs, refname, &debug_print_reflog_ent, &dbg);
+	trace_printf_key(&trace_refs, "for_each_reflog_reverse_seek: %s: %d (skipped %d)\n",
+			 refname, res, *skipped);
+	return res;
+}
+
 static int debug_reflog_exists(struct ref_store *ref_store, const char *refname)
 {
 	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
@@ -425,8 +453,19 @@ static int debug_reflog_expire(struct ref_store *ref_store, const char *refname,
 	return res;
 }
 
+static int debug_read_generation(struct ref_store *ref_store,
+				 struct strbuf *out)
+{
+	struct debug_ref_store *drefs = (struct debug_ref_store *)ref_store;
+	int res = -1;
+
+	if (drefs->refs->be->read_generation)
+		res = drefs->refs->be->read_generation(drefs->refs, out);
+	trace_printf_key(&trace_refs, "read_generation: %d: %s\n", res, out->buf);
+	return res;
+}
+
 struct ref_storage_be refs_be_debug = {
-	.next = NULL,
 	.name = "debug",
 	.init = NULL,
 	.init_db = debug_init_db,
@@ -454,8 +493,11 @@ struct ref_storage_be refs_be_debug = {
 	.reflog_iterator_begin = debug_reflog_iterator_begin,
 	.for_each_reflog_ent = debug_for_each_reflog_ent,
 	.for_each_reflog_ent_reverse = debug_for_each_reflog_ent_reverse,
+	.for_each_reflog_ent_reverse_seek = debug_for_each_reflog_ent_reverse_seek,
 	.reflog_exists = debug_reflog_exists,
 	.create_reflog = debug_create_reflog,
 	.delete_reflog = debug_delete_reflog,
 	.reflog_expire = debug_reflog_expire,
+
+	.read_generation = debug_read_generation,
 };
@@ -1,6 +1,7 @@
 #include "../git-compat-util.h"
 #include "../config.h"
 #include "../copy.h"
+#include "../csum-file.h"
 #include "../environment.h"
 #include "../gettext.h"
 #include "../hash.h"
@@ -19,10 +20,13 @@
 #include "../dir.h"
 #include "../chdir-notify.h"
 #include "../setup.h"
+#include "../statinfo.h"
 #include "../worktree.h"
 #include "../wrapper.h"
 #include "../write-or-die.h"
 #include "../revision.h"
+#include "../strmap.h"
+#include "../thread-utils.h"
 #include <wildmatch.h>
 
 /*
@@ -62,6 +66,20 @@
  */
 #define REF_DELETED_RMDIR (1 << 9)
 
+/*
+ * Used as a flag in ref_update::flags when the new value is written to
+ * the packed-refs file instead of the loose reference lockfile.
+ */
+#define REF_NEEDS_PACKED_COMMIT (1 << 12)
+
+/*
+ * Transactions with at least this many updates write the new values of
+ * references that only exist in packed-refs, or not at all, straight
+ * into packed-refs. Rewriting that file once is cheaper than writing,
+ * syncing and renaming this many loose references.
+ */
+#define PACKED_UPDATES_MIN 1000
+
 struct ref_lock {
 	char *ref_name;
 	struct lock_file lk;
@@ -75,6 +93,8 @@ struct files_ref_store {
 	char *gitcommondir;
 
 	struct ref_cache *loose;
+	/* Loose ref directories read ahead while priming `loose`. */
+	struct loose_scan *loose_scan;
 
 	struct ref_store *packed_ref_store;
 };
@@ -178,6 +198,141 @@ static void files_reflog_path(struct files_ref_store *refs,
 	}
 }
 
+/*
+ * Once the generation of the references has been read, the file
+ * REF_GENERATION_FILE holds a random token that every update replaces
+ * after changing the references (in both the common directory and the
+ * worktree's own directory, if they differ). While it is being
+ * replaced, or if a process died while replacing it, its lock file
+ * exists, and the generation cannot be read.
+ */
+#define REF_GENERATION_FILE "refs-generation"
+
+/*
+ * Replace the token in the generation file `path`. Return 0 on success
+ * or if the file is locked, i.e. someone else is about to replace it,
+ * and -1 on error.
+ */
+static int write_ref_generation(const char *path)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	unsigned char token[16];
+	size_t i;
+	int ret = 0;
+
+	if (hold_lock_file_for_update(&lk, path, 0) < 0)
+		return errno == EEXIST ? 0 : -1;
+	if (csprng_bytes(token, sizeof(token)) < 0) {
+		rollback_lock_file(&lk);
+		return -1;
+	}
+	for (i = 0; i < sizeof(token); i++)
+		strbuf_addf(&sb, "%02x", token[i]);
+	strbuf_addch(&sb, '\n');
+	if (write_in_full(get_lock_file_fd(&lk), sb.buf, sb.len) < 0 ||
+	    adjust_shared_perm(get_lock_file_path(&lk)) < 0 ||
+	    commit_lock_file(&lk) < 0) {
+		rollback_lock_file(&lk);
+		ret = -1;
+	}
+	strbuf_release(&sb);
+	return ret;
+}
+
+static void files_generation_dirs(struct files_ref_store *refs,
+				  const char **dirs, int *nr)
+{
+	dirs[0] = refs->gitcommondir;
+	dirs[1] = refs->base.gitdir;
+	*nr = strcmp(dirs[0], dirs[1]) ? 2 : 1;
+}
+
+/*
+ * Note that the references may have changed. This must be called after
+ * the changes are visible.
+ */
+static void files_bump_generation(struct files_ref_store *refs)
+{
+	struct strbuf path = STRBUF_INIT;
+	const char *dirs[2];
+	int i, nr;
+
+	files_generation_dirs(refs, dirs, &nr);
+	for (i = 0; i < nr; i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", dirs[i], REF_GENERATION_FILE);
+		if (!file_exists(path.buf))
+			continue;
+		/* Without a new token, the old one must not be used. */
+		if (write_ref_generation(path.buf) < 0)
+			unlink_or_warn(path.buf);
+	}
+	strbuf_release(&path);
+}
+
+static int files_read_generation(struct ref_store *ref_store,
+				 struct strbuf *out)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ, "read_generation");
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf token = STRBUF_INIT;
+	const char *dirs[2];
+	int i, nr, ret = 0;
+
+	strbuf_addstr(out, "files");
+	files_generation_dirs(refs, dirs, &nr);
+	for (i = 0; i < nr && !ret; i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s.lock", dirs[i], REF_GENERATION_FILE);
+		if (file_exists(path.buf)) {
+			ret = -1;
+			break;
+		}
+		strbuf_setlen(&path, path.len - strlen(".lock"));
+
+		strbuf_reset(&token);
+		if (strbuf_read_file(&token, path.buf, 0) < 0 &&
+		    (errno != ENOENT || write_ref_generation(path.buf) < 0 ||
+		     strbuf_read_file(&token, path.buf, 0) < 0)) {
+			ret = -1;
+			break;
+		}
+		strbuf_trim(&token);
+		strbuf_addf(out, " %s", token.buf);
+	}
+	strbuf_release(&path);
+	strbuf_release(&token);
+	return ret;
+}
+
+/*
+ * The path of the index of the reflog of `refname`; see
+ * REFLOG_INDEX_SIGNATURE.
+ */
+static void files_reflog_index_path(struct files_ref_store *refs,
+				    struct strbuf *sb,
+				    const char *refname)
+{
+	const char *slash;
+
+	files_reflog_path(refs, sb, refname);
+	slash = strrchr(sb->buf, '/');
+	strbuf_insertstr(sb, slash - sb->buf + 1, ".");
+	strbuf_addstr(sb, ".idx");
+}
+
+static void unlink_reflog_index(struct files_ref_store *refs,
+				const char *refname)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	files_reflog_index_path(refs, &sb, refname);
+	unlink_or_warn(sb.buf);
+	strbuf_release(&sb);
+}
+
 static void files_ref_path(struct files_ref_store *refs,
 			   struct strbuf *sb,
 			   const char *refname)
@@ -231,6 +386,387 @@ static void add_per_worktree_entries_to_dir(struct ref_dir *dir, const char *dir
 	}
 }
 
+/*
+ * Priming the loose ref cache for a large number of references is
+ * dominated by the latency of listing directories and reading one
+ * small file per reference. A loose_scan does that work ahead of time
+ * on a pool of threads, and loose_fill_ref_dir() then fills the cache
+ * from the results instead of going to disk itself.
+ *
+ * Only plain files that hold an object ID are read ahead. Symbolic
+ * refs, symlinks and anything that fails to parse are left to the
+ * usual code path, which resolves them one by one.
+ */
+struct loose_scan_entry {
+	char *name;
+	unsigned char dtype;
+	/* whether the file is a regular file, not a symlink */
+	unsigned int plain:1;
+	/* whether `oid` holds the contents of the file */
+	unsigned int read:1;
+	struct object_id oid;
+};
+
+struct loose_scan_dir {
+	struct loose_scan_entry *entries;
+	size_t nr, alloc;
+};
+
+/* List a directory, or read the files [begin, end) of a listed one. */
+struct loose_scan_item {
+	char *dirname;
+	struct loose_scan_dir *dir;
+	size_t begin, end;
+};
+
+struct loose_scan {
+	struct files_ref_store *refs;
+	const char *prefix;
+	int nr_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int threads_started;
+	/* number of workers currently processing an item */
+	int busy;
+	/* number of files found so far */
+	size_t files;
+
+	struct loose_scan_item *todo;
+	size_t todo_nr, todo_alloc;
+
+	/* maps directory names like "refs/heads/" to loose_scan_dirs */
+	struct strmap dirs;
+};
+
+/* Number of files found before the scan is spread over threads. */
+#define LOOSE_SCAN_THREAD_MIN_FILES 512
+
+/* Number of files read by one item. */
+#define LOOSE_SCAN_BATCH 64
+
+static int loose_scan_wants_dir(struct loose_scan *scan, const char *dirname)
+{
+	return !scan->prefix || starts_with(dirname, scan->prefix) ||
+		starts_with(scan->prefix, dirname);
+}
+
+static void loose_scan_push(struct loose_scan *scan, const char *dirname,
+			    struct loose_scan_dir *dir, size_t begin, size_t end)
+{
+	struct loose_scan_item *item;
+
+	ALLOC_GROW(scan->todo, scan->todo_nr + 1, scan->todo_alloc);
+	item = &scan->todo[scan->todo_nr++];
+	item->dirname = xstrdup(dirname);
+	item->dir = dir;
+	item->begin = begin;
+	item->end = end;
+}
+
+static void loose_scan_read(struct loose_scan *scan, const char *dirname,
+			    struct loose_scan_dir *dir, size_t begin, size_t end)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf contents = STRBUF_INIT;
+	struct strbuf referent = STRBUF_INIT;
+	size_t pathlen, i;
+
+	files_ref_path(scan->refs, &path, dirname);
+	pathlen = path.len;
+
+	for (i = begin; i < end; i++) {
+		struct loose_scan_entry *e = &dir->entries[i];
+		unsigned int type = 0;
+		int failure_errno;
+
+		if (e->dtype != DT_REG || !e->plain)
+			continue;
+
+		strbuf_setlen(&path, pathlen);
+		strbuf_addstr(&path, e->name);
+		strbuf_reset(&contents);
+		if (strbuf_read_file(&contents, path.buf, 256) < 0)
+			continue;
+		strbuf_rtrim(&contents);
+
+		if (parse_loose_ref_contents(contents.buf, &e->oid, &referent,
+					     &type, &failure_errno) ||
+		    (type & REF_ISSYMREF))
+			continue;
+		e->read = 1;
+	}
+
+	strbuf_release(&path);
+	strbuf_release(&contents);
+	strbuf_release(&referent);
+}
+
+static void loose_scan_list(struct loose_scan *scan, const char *dirname)
+{
+	struct loose_scan_dir *dir;
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf subdir = STRBUF_INIT;
+	struct string_list subdirs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	size_t files = 0, i;
+	DIR *d;
+	struct dirent *de;
+
+	files_ref_path(scan->refs, &path, dirname);
+	d = opendir(path.buf);
+	if (!d) {
+		strbuf_release(&path);
+		return;
+	}
+
+	CALLOC_ARRAY(dir, 1);
+	while ((de = readdir(d)) != NULL) {
+		struct loose_scan_entry *e;
+
+		if (de->d_name[0] == '.')
+			continue;
+		if (ends_with(de->d_name, ".lock"))
+			continue;
+
+		ALLOC_GROW(dir->entries, dir->nr + 1, dir->alloc);
+		e = &dir->entries[dir->nr++];
+		memset(e, 0, sizeof(*e));
+		e->name = xstrdup(de->d_name);
+		e->dtype = get_dtype(de, &path, 1);
+		e->plain = DTYPE(de) == DT_REG;
+
+		if (e->dtype == DT_REG) {
+			files++;
+		} else if (e->dtype == DT_DIR) {
+			strbuf_reset(&subdir);
+			strbuf_addf(&subdir, "%s%s/", dirname, de->d_name);
+			if (loose_scan_wants_dir(scan, subdir.buf))
+				string_list_append(&subdirs, subdir.buf);
+		}
+	}
+	closedir(d);
+
+	/* Small directories are read right away. */
+	if (files <= LOOSE_SCAN_BATCH)
+		loose_scan_read(scan, dirname, dir, 0, dir->nr);
+
+	pthread_mutex_lock(&scan->mutex);
+	strmap_put(&scan->dirs, dirname, dir);
+	scan->files += files;
+	if (files > LOOSE_SCAN_BATCH) {
+		for (i = 0; i < dir->nr; i += LOOSE_SCAN_BATCH)
+			loose_scan_push(scan, dirname, dir, i,
+					i + LOOSE_SCAN_BATCH < dir->nr ?
+					i + LOOSE_SCAN_BATCH : dir->nr);
+	}
+	for_each_string_list_item(item, &subdirs)
+		loose_scan_push(scan, item->string, NULL, 0, 0);
+	pthread_mutex_unlock(&scan->mutex);
+
+	string_list_clear(&subdirs, 0);
+	strbuf_release(&subdir);
+	strbuf_release(&path);
+}
+
+static void *loose_scan_worker(void *cb);
+
+static void loose_scan_start_threads(struct loose_scan *scan)
+{
+	int i, err;
+
+	CALLOC_ARRAY(scan->threads, scan->nr_threads - 1);
+	for (i = 0; i < scan->nr_threads - 1; i++) {
+		err = pthread_create(&scan->threads[i], NULL,
+				     loose_scan_worker, scan);
+		if (err) {
+			warning(_("unable to create thread: %s"), strerror(err));
+			break;
+		}
+	}
+	scan->threads_started = i;
+}
+
+/*
+ * Process items until there are none left. The calling thread starts
+ * the other workers once the scan turns out to be large enough.
+ */
+static void loose_scan_work(struct loose_scan *scan, int is_main)
+{
+	pthread_mutex_lock(&scan->mutex);
+	while (1) {
+		struct loose_scan_item item;
+
+		while (!scan->todo_nr && scan->busy)
+			pthread_cond_wait(&scan->cond, &scan->mutex);
+		if (!scan->todo_nr)
+			break;
+
+		if (is_main && HAVE_THREADS && !scan->threads &&
+		    scan->nr_threads > 1 &&
+		    scan->files >= LOOSE_SCAN_THREAD_MIN_FILES)
+			loose_scan_start_threads(scan);
+
+		item = scan->todo[--scan->todo_nr];
+		scan->busy++;
+		pthread_mutex_unlock(&scan->mutex);
+
+		if (item.dir)
+			loose_scan_read(scan, item.dirname, item.dir,
+					item.begin, item.end);
+		else
+			loose_scan_list(scan, item.dirname);
+		free(item.dirname);
+
+		pthread_mutex_lock(&scan->mutex);
+		scan->busy--;
+		pthread_cond_broadcast(&scan->cond);
+	}
+	pthread_cond_broadcast(&scan->cond);
+	pthread_mutex_unlock(&scan->mutex);
+}
+
+static void *loose_scan_worker(void *cb)
+{
+	loose_scan_work(cb, 0);
+	return NULL;
+}
+
+/*
+ * Queue the directories below `dir` that priming for `prefix` would
+ * have to read from disk.
+ */
+static void loose_scan_queue_incomplete(struct loose_scan *scan,
+					struct ref_entry *entry)
+{
+	struct ref_dir *dir = &entry->u.subdir;
+	int i;
+
+	if (entry->flag & REF_INCOMPLETE) {
+		loose_scan_push(scan, entry->name, NULL, 0, 0);
+		return;
+	}
+
+	for (i = 0; i < dir->nr; i++) {
+		struct ref_entry *child = dir->entries[i];
+		if ((child->flag & REF_DIR) &&
+		    loose_scan_wants_dir(scan, child->name))
+			loose_scan_queue_incomplete(scan, child);
+	}
+}
+
+/*
+ * Read ahead the loose refs that priming `cache` for `prefix` needs.
+ * Returns 0 if there is nothing to read.
+ */
+static int loose_scan_run(struct loose_scan *scan,
+			  struct files_ref_store *refs,
+			  struct ref_cache *cache, const char *prefix)
+{
+	int nr_threads = 0, i;
+
+	memset(scan, 0, sizeof(*scan));
+	scan->refs = refs;
+	scan->prefix = prefix && *prefix ? prefix : NULL;
+
+	if (!HAVE_THREADS)
+		return 0;
+	repo_config_get_int(refs->base.repo, "core.looserefsthreads",
+			    &nr_threads);
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+	if (nr_threads <= 1)
+		return 0;
+	scan->nr_threads = nr_threads;
+
+	loose_scan_queue_incomplete(scan, cache->root);
+	if (!scan->todo_nr)
+		return 0;
+
+	strmap_init(&scan->dirs);
+	pthread_mutex_init(&scan->mutex, NULL);
+	pthread_cond_init(&scan->cond, NULL);
+
+	loose_scan_work(scan, 1);
+
+	for (i = 0; i < scan->threads_started; i++)
+		pthread_join(scan->threads[i], NULL);
+	pthread_cond_destroy(&scan->cond);
+	pthread_mutex_destroy(&scan->mutex);
+	return 1;
+}
+
+static void loose_scan_clear(struct loose_scan *scan)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	strmap_for_each_entry(&scan->dirs, &iter, e) {
+		struct loose_scan_dir *dir = e->value;
+		size_t i;
+
+		for (i = 0; i < dir->nr; i++)
+			free(dir->entries[i].name);
+		free(dir->entries);
+	}
+	strmap_clear(&scan->dirs, 1);
+	free(scan->threads);
+	free(scan->todo);
+}
+
+static void loose_fill_ref_dir_regular_file(struct files_ref_store *refs,
+					    const char *refname,
+					    struct ref_dir *dir,
+					    const struct object_id *read_oid)
+{
+	struct object_id oid;
+	int flag = 0;
+
+	if (read_oid) {
+		oidcpy(&oid, read_oid);
+	} else if (!refs_resolve_ref_unsafe(&refs->base, refname,
+					    RESOLVE_REF_READING, &oid, &flag)) {
+		oidclr(&oid);
+		flag |= REF_ISBROKEN;
+	}
+
+	if (is_null_oid(&oid)) {
+		/*
+		 * It is so astronomically unlikely
+		 * that null_oid is the OID of an
+		 * actual object that we consider its
+		 * appearance in a loose reference
+		 * file to be repo corruption
+		 * (probably due to a software bug).
+		 */
+		flag |= REF_ISBROKEN;
+	}
+
+	if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(refname))
+			die("loose refname is dangerous: %s", refname);
+		oidclr(&oid);
+		flag |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+	add_entry_to_dir(dir, create_ref_entry(refname, &oid, flag));
+}
+
+static void loose_fill_ref_dir_entry(struct files_ref_store *refs,
+				     struct strbuf *refname,
+				     struct ref_dir *dir, unsigned char dtype,
+				     const struct object_id *read_oid)
+{
+	if (dtype == DT_DIR) {
+		strbuf_addch(refname, '/');
+		add_entry_to_dir(dir, create_dir_entry(dir->cache, refname->buf,
+						       refname->len));
+	} else if (dtype == DT_REG) {
+		loose_fill_ref_dir_regular_file(refs, refname->buf, dir,
+						read_oid);
+	}
+}
+
 /*
  * Read the loose references from the namespace dirname into dir
  * (without recursing).  dirname must end with '/'.  dir must be the
@@ -241,12 +777,32 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 {
 	struct files_ref_store *refs =
 		files_downcast(ref_store, REF_STORE_READ, "fill_ref_dir");
+	struct loose_scan_dir *scanned = NULL;
 	DIR *d;
 	struct dirent *de;
 	int dirnamelen = strlen(dirname);
 	struct strbuf refname;
 	struct strbuf path = STRBUF_INIT;
 
+	if (refs->loose_scan)
+		scanned = strmap_get(&refs->loose_scan->dirs, dirname);
+	if (scanned) {
+		size_t i;
+
+		strbuf_init(&refname, dirnamelen + 257);
+		strbuf_add(&refname, dirname, dirnamelen);
+		for (i = 0; i < scanned->nr; i++) {
+			struct loose_scan_entry *e = &scanned->entries[i];
+
+			strbuf_addstr(&refname, e->name);
+			loose_fill_ref_dir_entry(refs, &refname, dir, e->dtype,
+						 e->read ? &e->oid : NULL);
+			strbuf_setlen(&refname, dirnamelen);
+		}
+		strbuf_release(&refname);
+		goto out;
+	}
+
 	files_ref_path(refs, &path, dirname);
 
 	d = opendir(path.buf);
@@ -259,57 +815,20 @@ static void loose_fill_ref_dir(struct ref_store *ref_store,
 	strbuf_add(&refname, dirname, dirnamelen);
 
 	while ((de = readdir(d)) != NULL) {
-		struct object_id oid;
-		int flag;
-		unsigned char dtype;
-
 		if (de->d_name[0] == '.')
 			continue;
 		if (ends_with(de->d_name, ".lock"))
 			continue;
 		strbuf_addstr(&refname, de->d_name);
-
-		dtype = get_dtype(de, &path, 1);
-		if (dtype == DT_DIR) {
-			strbuf_addch(&refname, '/');
-			add_entry_to_dir(dir,
-					 create_dir_entry(dir->cache, refname.buf,
-							  refname.len));
-		} else if (dtype == DT_REG) {
-			if (!refs_resolve_ref_unsafe(&refs->base,
-						     refname.buf,
-						     RESOLVE_REF_READING,
-						     &oid, &flag)) {
-				oidclr(&oid);
-				flag |= REF_ISBROKEN;
-			} else if (is_null_oid(&oid)) {
-				/*
-				 * It is so astronomically unlikely
-				 * that null_oid is the OID of an
-				 * actual object that we consider its
-				 * appearance in a loose reference
-				 * file to be repo corruption
-				 * (probably due to a software bug).
-				 */
-				flag |= REF_ISBROKEN;
-			}
-
-			if (check_refname_format(refname.buf,
-						 REFNAME_ALLOW_ONELEVEL)) {
-				if (!refname_is_safe(refname.buf))
-					die("loose refname is dangerous: %s", refname.buf);
-				oidclr(&oid);
-				flag |= REF_BAD_NAME | REF_ISBROKEN;
-			}
-			add_entry_to_dir(dir,
-					 create_ref_entry(refname.buf, &oid, flag));
-		}
+		loose_fill_ref_dir_entry(refs, &refname, dir,
+					 get_dtype(de, &path, 1), NULL);
 		strbuf_setlen(&refname, dirnamelen);
 	}
 	strbuf_release(&refname);
 	strbuf_release(&path);
 	closedir(d);
 
+out:
 	add_per_worktree_entries_to_dir(dir, dirname);
 }
 
@@ -336,6 +855,28 @@ static struct ref_cache *get_loose_ref_cache(struct files_ref_store *refs)
 	return refs->loose;
 }
 
+/*
+ * Start iterating over the loose refs under `prefix`, with all of them
+ * read into the cache before this function returns.
+ */
+static struct ref_iterator *loose_ref_iterator_begin(struct files_ref_store *refs,
+						     const char *prefix,
+						     struct repository *repo)
+{
+	struct ref_cache *cache = get_loose_ref_cache(refs);
+	struct ref_iterator *iter;
+	struct loose_scan scan;
+
+	if (loose_scan_run(&scan, refs, cache, prefix))
+		refs->loose_scan = &scan;
+	iter = cache_ref_iterator_begin(cache, prefix, repo, 1);
+	if (refs->loose_scan) {
+		refs->loose_scan = NULL;
+		loose_scan_clear(&scan);
+	}
+	return iter;
+}
+
 static int read_ref_internal(struct ref_store *ref_store, const char *refname,
 			     struct object_id *oid, struct strbuf *referent,
 			     unsigned int *type, int *failure_errno, int skip_packed_refs)
@@ -859,8 +1400,7 @@ static struct ref_iterator *files_ref_iterator_begin(
 	 * disk, and re-reads it if not.
 	 */
 
-	loose_iter = cache_ref_iterator_begin(get_loose_ref_cache(refs),
-					      prefix, ref_store->repo, 1);
+	loose_iter = loose_ref_iterator_begin(refs, prefix, ref_store->repo);
 
 	/*
 	 * The packed-refs file might contain broken references, for
@@ -1219,9 +1759,9 @@ static int files_pack_refs(struct ref_store *ref_store,
 		return -1;
 
 	packed_refs_lock(refs->packed_ref_store, LOCK_DIE_ON_ERROR, &err);
+	packed_refs_fold_delta(refs->packed_ref_store);
 
-	iter = cache_ref_iterator_begin(get_loose_ref_cache(refs), NULL,
-					the_repository, 0);
+	iter = loose_ref_iterator_begin(refs, NULL, the_repository);
 	while ((ok = ref_iterator_advance(iter)) == ITER_OK) {
 		/*
 		 * If the loose reference can be packed, add an entry
@@ -1513,6 +2053,7 @@ static int files_copy_or_rename_ref(struct ref_store *ref_store,
 	strbuf_release(&sb_newref);
 	strbuf_release(&sb_oldref);
 	strbuf_release(&tmp_renamed_log);
+	files_bump_generation(refs);
 
 	return ret;
 }
@@ -1727,32 +2268,43 @@ static int files_log_ref_write(struct files_ref_store *refs,
  * Write oid into the open lockfile, then close the lockfile. On
  * errors, rollback the lockfile, fill in *err and return -1.
  */
+/*
+ * Check that `oid` names an existing object that may be stored in
+ * `refname`. On error, write a message to `err` and return -1.
+ */
+static int check_ref_object(const char *refname, const struct object_id *oid,
+			    struct strbuf *err)
+{
+	struct object *o = parse_object(the_repository, oid);
+
+	if (!o) {
+		strbuf_addf(
+			err,
+			"trying to write ref '%s' with nonexistent object %s",
+			refname, oid_to_hex(oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
+		strbuf_addf(
+			err,
+			"trying to write non-commit object %s to branch '%s'",
+			oid_to_hex(oid), refname);
+		return -1;
+	}
+	return 0;
+}
+
 static int write_ref_to_lockfile(struct ref_lock *lock,
 				 const struct object_id *oid,
 				 int skip_oid_verification, struct strbuf *err)
 {
 	static char term = '\n';
-	struct object *o;
 	int fd;
 
-	if (!skip_oid_verification) {
-		o = parse_object(the_repository, oid);
-		if (!o) {
-			strbuf_addf(
-				err,
-				"trying to write ref '%s' with nonexistent object %s",
-				lock->ref_name, oid_to_hex(oid));
-			unlock_ref(lock);
-			return -1;
-		}
-		if (o->type != OBJ_COMMIT && is_branch(lock->ref_name)) {
-			strbuf_addf(
-				err,
-				"trying to write non-commit object %s to branch '%s'",
-				oid_to_hex(oid), lock->ref_name);
-			unlock_ref(lock);
-			return -1;
-		}
+	if (!skip_oid_verification &&
+	    check_ref_object(lock->ref_name, oid, err)) {
+		unlock_ref(lock);
+		return -1;
 	}
 	fd = get_lock_file_fd(&lock->lk);
 	if (write_in_full(fd, oid_to_hex(oid), the_hash_algo->hexsz) < 0 ||
@@ -1906,6 +2458,7 @@ static int files_create_symref(struct ref_store *ref_store,
 
 	ret = create_symref_locked(refs, lock, refname, target, logmsg);
 	unlock_ref(lock);
+	files_bump_generation(refs);
 	return ret;
 }
 
@@ -1933,6 +2486,7 @@ static int files_delete_reflog(struct ref_store *ref_store,
 	int ret;
 
 	files_reflog_path(refs, &sb, refname);
+	unlink_reflog_index(refs, refname);
 	ret = remove_path(sb.buf);
 	strbuf_release(&sb);
 	return ret;
@@ -1978,30 +2532,18 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
-					     const char *refname,
-					     each_reflog_ent_fn fn,
-					     void *cb_data)
+/*
+ * Feed the reflog entries of `logfp` that end at or before `pos` to
+ * `fn`, youngest first.
+ */
+static int for_each_reflog_ent_reverse_before(FILE *logfp, long pos,
+					      const char *refname,
+					      each_reflog_ent_fn fn,
+					      void *cb_data)
 {
-	struct files_ref_store *refs =
-		files_downcast(ref_store, REF_STORE_READ,
-			       "for_each_reflog_ent_reverse");
 	struct strbuf sb = STRBUF_INIT;
-	FILE *logfp;
-	long pos;
 	int ret = 0, at_tail = 1;
 
-	files_reflog_path(refs, &sb, refname);
-	logfp = fopen(sb.buf, "r");
-	strbuf_release(&sb);
-	if (!logfp)
-		return -1;
-
-	/* Jump to the end */
-	if (fseek(logfp, 0, SEEK_END) < 0)
-		ret = error("cannot seek back reflog for %s: %s",
-			    refname, strerror(errno));
-	pos = ftell(logfp);
 	while (!ret && 0 < pos) {
 		int cnt;
 		size_t nread;
@@ -2087,7 +2629,492 @@ static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
 	if (!ret && sb.len)
 		BUG("reverse reflog parser had leftover data");
 
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int files_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+					     const char *refname,
+					     each_reflog_ent_fn fn,
+					     void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse");
+	struct strbuf sb = STRBUF_INIT;
+	FILE *logfp;
+	int ret;
+
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
+	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+
+	/* Jump to the end */
+	if (fseek(logfp, 0, SEEK_END) < 0)
+		ret = error("cannot seek back reflog for %s: %s",
+			    refname, strerror(errno));
+	else
+		ret = for_each_reflog_ent_reverse_before(logfp, ftell(logfp),
+							 refname, fn, cb_data);
+
+	fclose(logfp);
+	return ret;
+}
+
+/*
+ * A reflog may have an index next to it, in a file named like the
+ * reflog but with a leading "." and a trailing ".idx" (for example
+ * "logs/refs/heads/.main.idx" for "logs/refs/heads/main"), which can
+ * never be the reflog of another reference. It is written by `reflog
+ * expire` if "core.reflogIndex" is set, and splits the entries it
+ * covers into chunks of REFLOG_INDEX_CHUNK entries, so that a lookup
+ * of an entry by its position or by its time only has to parse a
+ * chunk or two instead of reading the log back from its end. Entries
+ * appended after the index was written are not covered by it. All
+ * values are in network byte order:
+ *
+ *   - The signature "RLGX" and the version, 4 bytes each.
+ *
+ *   - The number of entries per chunk and the number of chunks N,
+ *     4 bytes each.
+ *
+ *   - The number of entries covered (8 bytes) and the length of the
+ *     part of the reflog that holds them (8 bytes).
+ *
+ *   - The inode number of the reflog as recorded in a `struct
+ *     stat_data` (4 bytes), and the offset (8 bytes) and CRC-32 (4
+ *     bytes) of the last entry covered. The index is used only if
+ *     these match the reflog that is being read.
+ *
+ *   - N chunk records of 16 bytes each: the offset of the first entry
+ *     of the chunk, and the oldest timestamp of the entries in this
+ *     chunk or in any later one.
+ *
+ *   - A trailing checksum of the above.
+ */
+#define REFLOG_INDEX_SIGNATURE 0x524c4758 /* "RLGX" */
+#define REFLOG_INDEX_VERSION 1
+#define REFLOG_INDEX_HEADER_SIZE 48
+#define REFLOG_INDEX_RECORD_SIZE 16
+#define REFLOG_INDEX_CHUNK 64
+
+struct reflog_index {
+	const unsigned char *map;
+	size_t map_size;
+
+	uint32_t chunk_size, nr;
+	uint64_t entries, len;
+};
+
+static void clear_reflog_index(struct reflog_index *index)
+{
+	if (index->map)
+		munmap((void *)index->map, index->map_size);
+	memset(index, 0, sizeof(*index));
+}
+
+static const unsigned char *reflog_index_record(struct reflog_index *index,
+						uint32_t i)
+{
+	return index->map + REFLOG_INDEX_HEADER_SIZE +
+		st_mult(i, REFLOG_INDEX_RECORD_SIZE);
+}
+
+/*
+ * Load the index of the reflog for `refname`, which has been opened
+ * as `fd`. Return 0 on success, or -1 if there is no index or it is
+ * stale or malformed.
+ */
+static int load_reflog_index(struct files_ref_store *refs,
+			     const char *refname, int fd,
+			     struct reflog_index *index)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct stat log_st, st;
+	struct stat_data sd;
+	const unsigned char *map;
+	uint64_t last;
+	size_t size;
+	char *buf;
+	int idx_fd, ok;
+
+	memset(index, 0, sizeof(*index));
+	if (fstat(fd, &log_st) < 0)
+		return -1;
+	fill_stat_data(&sd, &log_st);
+
+	files_reflog_index_path(refs, &sb, refname);
+	idx_fd = open(sb.buf, O_RDONLY);
+	strbuf_release(&sb);
+	if (idx_fd < 0)
+		return -1;
+	if (fstat(idx_fd, &st) < 0 ||
+	    (size = xsize_t(st.st_size)) < REFLOG_INDEX_HEADER_SIZE +
+					   the_hash_algo->rawsz) {
+		close(idx_fd);
+		return -1;
+	}
+	map = xmmap_gently(NULL, size, PROT_READ, MAP_PRIVATE, idx_fd, 0);
+	close(idx_fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	index->map = map;
+	index->map_size = size;
+	index->chunk_size = get_be32(map + 8);
+	index->nr = get_be32(map + 12);
+	index->entries = get_be64(map + 16);
+	index->len = get_be64(map + 24);
+	last = get_be64(map + 36);
+
+	if (get_be32(map) != REFLOG_INDEX_SIGNATURE ||
+	    get_be32(map + 4) != REFLOG_INDEX_VERSION ||
+	    !index->chunk_size || !index->nr ||
+	    size != REFLOG_INDEX_HEADER_SIZE +
+		    st_mult(index->nr, REFLOG_INDEX_RECORD_SIZE) +
+		    the_hash_algo->rawsz ||
+	    index->entries > (uint64_t)index->nr * index->chunk_size ||
+	    index->entries <= (uint64_t)(index->nr - 1) * index->chunk_size ||
+	    get_be32(map + 32) != sd.sd_ino ||
+	    last >= index->len || index->len - last > INT_MAX ||
+	    (uint64_t)log_st.st_size < index->len)
+		goto stale;
+
+	/* Check that the last entry covered is still the same. */
+	buf = xmalloc(index->len - last);
+	ok = pread_in_full(fd, buf, index->len - last, last) ==
+		(ssize_t)(index->len - last) &&
+		crc32(crc32(0, NULL, 0), (unsigned char *)buf,
+		      index->len - last) == get_be32(map + 44);
+	free(buf);
+	if (!ok)
+		goto stale;
+	return 0;
+
+stale:
+	clear_reflog_index(index);
+	return -1;
+}
+
+struct reflog_seek_cb {
+	timestamp_t at_time;
+
+	/* The number of entries after which to stop, or 0 for no limit: */
+	uint64_t limit;
+
+	/* The number of entries seen so far: */
+	uint64_t nr;
+
+	/*
+	 * One plus the position among them of the youngest entry at or
+	 * before `at_time`, or 0 if there is none:
+	 */
+	uint64_t match;
+};
+
+static int reflog_seek_ent(struct object_id *ooid UNUSED,
+			   struct object_id *noid UNUSED,
+			   const char *email UNUSED,
+			   timestamp_t timestamp, int tz UNUSED,
+			   const char *message UNUSED, void *cb_data)
+{
+	struct reflog_seek_cb *cb = cb_data;
+
+	if (timestamp <= cb->at_time)
+		cb->match = cb->nr + 1;
+	return ++cb->nr == cb->limit;
+}
+
+/*
+ * Parse the entries of `logfp` from `offset` on into `cb`. Return the
+ * offset of the end of the last entry parsed, or -1 on error.
+ */
+static long scan_reflog_ents(FILE *logfp, uint64_t offset,
+			     struct reflog_seek_cb *cb)
+{
+	struct strbuf sb = STRBUF_INIT;
+	long end;
+
+	if (fseek(logfp, (long)offset, SEEK_SET) < 0)
+		return -1;
+	while (!strbuf_getwholeline(&sb, logfp, '\n'))
+		if (show_one_reflog_ent(&sb, reflog_seek_ent, cb))
+			break;
+	end = ftell(logfp);
+	strbuf_release(&sb);
+	return end;
+}
+
+/*
+ * Parse the `limit` entries that start at the `i`th chunk of `index`
+ * (which may run into the entries after the chunk) into `cb`, and
+ * return the offset of the end of the last one, or -1 if the index
+ * turns out to be corrupt.
+ */
+static long scan_reflog_index_chunk(struct reflog_index *index, FILE *logfp,
+				    uint32_t i, struct reflog_seek_cb *cb)
+{
+	uint64_t offset = get_be64(reflog_index_record(index, i));
+	long end;
+
+	if (offset >= index->len || !offset != !i)
+		return -1;
+	if (offset) {
+		if (fseek(logfp, (long)offset - 1, SEEK_SET) < 0 ||
+		    getc(logfp) != '\n')
+			return -1;
+	}
+	end = scan_reflog_ents(logfp, offset, cb);
+	if (end < 0 || cb->nr != cb->limit)
+		return -1;
+	return end;
+}
+
+/*
+ * Work out how many of the youngest entries of `logfp`, which is
+ * covered by `index`, the walk for `at_time` or `cnt` entries described
+ * at `for_each_reflog_ent_reverse_seek_fn` can skip. Store that number
+ * in `skipped` and the end of the entries that are left in `end`, or
+ * return -1 if the index turns out to be corrupt.
+ */
+static int reflog_index_seek(struct reflog_index *index, FILE *logfp,
+			     timestamp_t at_time, int cnt,
+			     long *end, int *skipped)
+{
+	struct reflog_seek_cb cb = { .at_time = at_time };
+	uint64_t total, keep = 0;
+	long pos;
+
+	/* The entries after the index have to be looked at anyway. */
+	if (scan_reflog_ents(logfp, index->len, &cb) < 0)
+		return -1;
+	total = index->entries + cb.nr;
+
+	/*
+	 * Keep the youngest entry at or before `at_time`, and the entry
+	 * after it that the walk compares it to.
+	 */
+	if (cb.match) {
+		keep = index->entries + cb.match + 1;
+	} else {
+		uint32_t lo = 0, hi = index->nr;
+
+		/*
+		 * The oldest timestamps recorded for the chunks never
+		 * decrease, so the last chunk whose record is at or
+		 * before `at_time` is the last one holding such an entry.
+		 */
+		while (lo < hi) {
+			uint32_t mi = lo + (hi - lo) / 2;
+
+			if (get_be64(reflog_index_record(index, mi) + 8) <= at_time)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		if (lo) {
+			uint64_t first = (uint64_t)(lo - 1) * index->chunk_size;
+
+			memset(&cb, 0, sizeof(cb));
+			cb.at_time = at_time;
+			cb.limit = index->entries - first;
+			if (cb.limit > index->chunk_size)
+				cb.limit = index->chunk_size;
+			if (scan_reflog_index_chunk(index, logfp, lo - 1, &cb) < 0 ||
+			    !cb.match)
+				return -1;
+			keep = first + cb.match + 1;
+		}
+	}
+
+	/*
+	 * The walk stops at the `cnt`th youngest entry at the latest, and
+	 * compares it to the entry after it, too.
+	 */
+	if (cnt > 0 && (uint64_t)cnt < total + 2 &&
+	    keep < total - (cnt > 2 ? cnt - 2 : 0))
+		keep = total - (cnt > 2 ? cnt - 2 : 0);
+
+	if (keep >= total)
+		return 0;
+	if (total - keep > INT_MAX)
+		keep = total - INT_MAX;
+
+	if (!keep) {
+		pos = 0;
+	} else if (keep > index->entries) {
+		memset(&cb, 0, sizeof(cb));
+		cb.limit = keep - index->entries;
+		pos = scan_reflog_ents(logfp, index->len, &cb);
+		if (pos < 0 || cb.nr != cb.limit)
+			return -1;
+	} else {
+		memset(&cb, 0, sizeof(cb));
+		cb.limit = (keep - 1) % index->chunk_size + 1;
+		pos = scan_reflog_index_chunk(index, logfp,
+					      (keep - 1) / index->chunk_size,
+					      &cb);
+		if (pos < 0)
+			return -1;
+	}
+
+	*end = pos;
+	*skipped = total - keep;
+	return 0;
+}
+
+static int files_for_each_reflog_ent_reverse_seek(struct ref_store *ref_store,
+						  const char *refname,
+						  timestamp_t at_time, int cnt,
+						  int *skipped,
+						  each_reflog_ent_fn fn,
+						  void *cb_data)
+{
+	struct files_ref_store *refs =
+		files_downcast(ref_store, REF_STORE_READ,
+			       "for_each_reflog_ent_reverse_seek");
+	struct strbuf sb = STRBUF_INIT;
+	struct reflog_index index;
+	FILE *logfp;
+	long end;
+	int ret;
+
+	*skipped = 0;
+	files_reflog_path(refs, &sb, refname);
+	logfp = fopen(sb.buf, "r");
+	strbuf_release(&sb);
+	if (!logfp)
+		return -1;
+
+	if (fseek(logfp, 0, SEEK_END) < 0) {
+		ret = error("cannot seek back reflog for %s: %s",
+			    refname, strerror(errno));
+		goto out;
+	}
+	end = ftell(logfp);
+
+	if (!load_reflog_index(refs, refname, fileno(logfp), &index)) {
+		reflog_index_seek(&index, logfp, at_time, cnt, &end, skipped);
+		clear_reflog_index(&index);
+	}
+	ret = for_each_reflog_ent_reverse_before(logfp, end, refname,
+						 fn, cb_data);
+
+out:
 	fclose(logfp);
+	return ret;
+}
+
+/*
+ * The chunks of a reflog index, collected while writing out the
+ * entries of the reflog.
+ */
+struct reflog_index_builder {
+	/* The length of the reflog written so far: */
+	uint64_t len;
+
+	/* The number of entries written so far: */
+	uint64_t entries;
+
+	/* The offset and CRC-32 of the last entry: */
+	uint64_t last;
+	uint32_t crc;
+
+	struct reflog_index_chunk {
+		uint64_t offset;
+		timestamp_t oldest;
+	} *chunks;
+	size_t nr, alloc;
+};
+
+/*
+ * Note that the entry `line` with `timestamp` has been written to the
+ * end of the reflog.
+ */
+static void reflog_index_add(struct reflog_index_builder *index,
+			     timestamp_t timestamp,
+			     const char *line, size_t len)
+{
+	if (!(index->entries % REFLOG_INDEX_CHUNK)) {
+		ALLOC_GROW(index->chunks, index->nr + 1, index->alloc);
+		index->chunks[index->nr].offset = index->len;
+		index->chunks[index->nr].oldest = timestamp;
+		index->nr++;
+	} else if (timestamp < index->chunks[index->nr - 1].oldest) {
+		index->chunks[index->nr - 1].oldest = timestamp;
+	}
+	index->last = index->len;
+	index->crc = crc32(crc32(0, NULL, 0), (const unsigned char *)line, len);
+	index->len += len;
+	index->entries++;
+}
+
+/*
+ * Write the index for the reflog `log_file` of `refname`, whose entries
+ * have been collected in `index`. Logs that fit in a single chunk do
+ * not get an index. Return 0 on success, or a negative value on error.
+ */
+static int write_reflog_index(struct files_ref_store *refs,
+			      const char *refname, const char *log_file,
+			      struct reflog_index_builder *index)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	struct hashfile *f;
+	struct stat st;
+	struct stat_data sd;
+	timestamp_t oldest;
+	size_t i;
+	int ret = 0;
+
+	files_reflog_index_path(refs, &sb, refname);
+	if (index->nr < 2) {
+		unlink_or_warn(sb.buf);
+		goto out;
+	}
+
+	if (stat(log_file, &st) < 0) {
+		ret = error_errno("unable to stat %s", log_file);
+		goto out;
+	}
+	fill_stat_data(&sd, &st);
+
+	if (hold_lock_file_for_update(&lk, sb.buf, 0) < 0) {
+		ret = error_errno("unable to create file %s.lock", sb.buf);
+		goto out;
+	}
+
+	/* Each chunk records the oldest timestamp from there on. */
+	oldest = index->chunks[index->nr - 1].oldest;
+	for (i = index->nr; i--; ) {
+		if (index->chunks[i].oldest > oldest)
+			index->chunks[i].oldest = oldest;
+		oldest = index->chunks[i].oldest;
+	}
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, REFLOG_INDEX_SIGNATURE);
+	hashwrite_be32(f, REFLOG_INDEX_VERSION);
+	hashwrite_be32(f, REFLOG_INDEX_CHUNK);
+	hashwrite_be32(f, index->nr);
+	hashwrite_be64(f, index->entries);
+	hashwrite_be64(f, index->len);
+	hashwrite_be32(f, sd.sd_ino);
+	hashwrite_be64(f, index->last);
+	hashwrite_be32(f, index->crc);
+	for (i = 0; i < index->nr; i++) {
+		hashwrite_be64(f, index->chunks[i].offset);
+		hashwrite_be64(f, index->chunks[i].oldest);
+	}
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_REFERENCE,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+
+	if (commit_lock_file(&lk) < 0)
+		ret = error_errno("unable to write %s", sb.buf);
+
+out:
 	strbuf_release(&sb);
 	return ret;
 }
@@ -2427,6 +3454,23 @@ static int check_old_oid(struct ref_update *update, struct object_id *oid,
 	return -1;
 }
 
+/*
+ * Return true if the new value of `update`, whose reference is locked by
+ * `lock`, can be written to packed-refs. That is the case for plain
+ * references that would be packed by pack-refs and that have no loose
+ * file that would hide the packed value.
+ */
+static int can_update_packed(struct ref_update *update, struct ref_lock *lock)
+{
+	if (update->type & REF_ISSYMREF)
+		return 0;
+	if (!(update->type & REF_ISPACKED) && !is_null_oid(&lock->old_oid))
+		return 0;
+	return starts_with(update->refname, "refs/") &&
+		parse_worktree_ref(update->refname, NULL, NULL, NULL) ==
+		REF_WORKTREE_SHARED;
+}
+
 /*
  * Prepare for carrying out update:
  * - Lock the reference referred to by update.
@@ -2439,12 +3483,16 @@ static int check_old_oid(struct ref_update *update, struct object_id *oid,
  *   the referent to transaction.
  * - If it is an update of head_ref, add a corresponding REF_LOG_ONLY
  *   update of HEAD.
+ * - If `update_packed` is set and the reference has no loose file, mark
+ *   the new value to be written to packed-refs rather than the
+ *   lockfile. The lock is still held until the transaction is done.
  */
 static int lock_ref_for_update(struct files_ref_store *refs,
 			       struct ref_update *update,
 			       struct ref_transaction *transaction,
 			       const char *head_ref,
 			       struct string_list *affected_refnames,
+			       int update_packed,
 			       struct strbuf *err)
 {
 	struct strbuf referent = STRBUF_INIT;
@@ -2546,6 +3594,21 @@ static int lock_ref_for_update(struct files_ref_store *refs,
 			 * The reference already has the desired
 			 * value, so we don't need to write it.
 			 */
+		} else if (update_packed &&
+			   can_update_packed(update, lock)) {
+			if (!(update->flags & REF_SKIP_OID_VERIFICATION) &&
+			    check_ref_object(update->refname, &update->new_oid,
+					     err)) {
+				char *write_err = strbuf_detach(err, NULL);
+
+				strbuf_addf(err,
+					    "cannot update ref '%s': %s",
+					    update->refname, write_err);
+				free(write_err);
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+			update->flags |= REF_NEEDS_PACKED_COMMIT;
 		} else if (write_ref_to_lockfile(
 				   lock, &update->new_oid,
 				   update->flags & REF_SKIP_OID_VERIFICATION,
@@ -2643,6 +3706,7 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 	int head_type;
 	struct files_transaction_backend_data *backend_data;
 	struct ref_transaction *packed_transaction = NULL;
+	int update_packed;
 
 	assert(err);
 
@@ -2716,20 +3780,24 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 	 * Note that lock_ref_for_update() might append more updates
 	 * to the transaction.
 	 */
+	update_packed = transaction->nr >= PACKED_UPDATES_MIN;
 	for (i = 0; i < transaction->nr; i++) {
 		struct ref_update *update = transaction->updates[i];
 
 		ret = lock_ref_for_update(refs, update, transaction,
-					  head_ref, &affected_refnames, err);
+					  head_ref, &affected_refnames,
+					  update_packed, err);
 		if (ret)
 			goto cleanup;
 
-		if (update->flags & REF_DELETING &&
-		    !(update->flags & REF_LOG_ONLY) &&
-		    !(update->flags & REF_IS_PRUNING)) {
+		if ((update->flags & REF_DELETING &&
+		     !(update->flags & REF_LOG_ONLY) &&
+		     !(update->flags & REF_IS_PRUNING)) ||
+		    update->flags & REF_NEEDS_PACKED_COMMIT) {
 			/*
 			 * This reference has to be deleted from
-			 * packed-refs if it exists there.
+			 * packed-refs if it exists there, or gets its
+			 * new value written there.
 			 */
 			if (!packed_transaction) {
 				packed_transaction = ref_store_transaction_begin(
@@ -2743,11 +3811,21 @@ static int files_transaction_prepare(struct ref_store *ref_store,
 					packed_transaction;
 			}
 
-			ref_transaction_add_update(
-					packed_transaction, update->refname,
-					REF_HAVE_NEW | REF_NO_DEREF,
-					&update->new_oid, NULL,
-					NULL);
+			if (update->flags & REF_NEEDS_PACKED_COMMIT) {
+				struct ref_lock *lock = update->backend_data;
+
+				ref_transaction_add_update(
+						packed_transaction, update->refname,
+						REF_HAVE_NEW | REF_HAVE_OLD | REF_NO_DEREF,
+						&update->new_oid, &lock->old_oid,
+						NULL);
+			} else {
+				ref_transaction_add_update(
+						packed_transaction, update->refname,
+						REF_HAVE_NEW | REF_NO_DEREF,
+						&update->new_oid, NULL,
+						NULL);
+			}
 		}
 	}
 
@@ -2831,6 +3909,7 @@ static int files_transaction_finish(struct ref_store *ref_store,
 		struct ref_lock *lock = update->backend_data;
 
 		if (update->flags & REF_NEEDS_COMMIT ||
+		    update->flags & REF_NEEDS_PACKED_COMMIT ||
 		    update->flags & REF_LOG_ONLY) {
 			if (files_log_ref_write(refs,
 						lock->ref_name,
@@ -2876,6 +3955,7 @@ static int files_transaction_finish(struct ref_store *ref_store,
 		    !(update->flags & REF_IS_PRUNING)) {
 			strbuf_reset(&sb);
 			files_reflog_path(refs, &sb, update->refname);
+			unlink_reflog_index(refs, update->refname);
 			if (!unlink_or_warn(sb.buf))
 				try_remove_empty_parents(refs, update->refname,
 							 REMOVE_EMPTY_PARENTS_REFLOG);
@@ -2885,8 +3965,9 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	/*
 	 * Perform deletes now that updates are safely completed.
 	 *
-	 * First delete any packed versions of the references, while
-	 * retaining the packed-refs lock:
+	 * First delete any packed versions of the references, and write
+	 * the new values that go to packed-refs, while retaining the
+	 * packed-refs lock and the locks of the loose references:
 	 */
 	if (packed_transaction) {
 		ret = ref_transaction_commit(packed_transaction, err);
@@ -2926,18 +4007,21 @@ static int files_transaction_finish(struct ref_store *ref_store,
 	for (i = 0; i < transaction->nr; i++) {
 		struct ref_update *update = transaction->updates[i];
 
-		if (update->flags & REF_DELETED_RMDIR) {
+		if (update->flags & REF_DELETED_RMDIR ||
+		    update->flags & REF_NEEDS_PACKED_COMMIT) {
 			/*
-			 * The reference was deleted. Delete any
-			 * empty parent directories. (Note that this
-			 * can only work because we have already
-			 * removed the lockfile.)
+			 * The reference was deleted, or only lives in
+			 * packed-refs. Delete any empty parent
+			 * directories. (Note that this can only work
+			 * because we have already removed the
+			 * lockfile.)
 			 */
 			try_remove_empty_parents(refs, update->refname,
 						 REMOVE_EMPTY_PARENTS_REF);
 		}
 	}
 
+	files_bump_generation(refs);
 	strbuf_release(&sb);
 	return ret;
 }
@@ -3045,6 +4129,7 @@ static int files_initial_transaction_commit(struct ref_store *ref_store,
 	}
 
 	packed_refs_unlock(refs->packed_ref_store);
+	files_bump_generation(refs);
 cleanup:
 	if (packed_transaction)
 		ref_transaction_free(packed_transaction);
@@ -3057,6 +4142,8 @@ struct expire_reflog_cb {
 	reflog_expiry_should_prune_fn *should_prune_fn;
 	void *policy_cb;
 	FILE *newlog;
+	struct strbuf line;
+	struct reflog_index_builder *index;
 	struct object_id last_kept_oid;
 	unsigned int rewrite:1,
 		     dry_run:1;
@@ -3078,8 +4165,12 @@ static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
 	if (cb->dry_run)
 		return 0; /* --dry-run */
 
-	fprintf(cb->newlog, "%s %s %s %"PRItime" %+05d\t%s", oid_to_hex(ooid),
-		oid_to_hex(noid), email, timestamp, tz, message);
+	strbuf_reset(&cb->line);
+	strbuf_addf(&cb->line, "%s %s %s %"PRItime" %+05d\t%s", oid_to_hex(ooid),
+		    oid_to_hex(noid), email, timestamp, tz, message);
+	fwrite(cb->line.buf, 1, cb->line.len, cb->newlog);
+	if (cb->index)
+		reflog_index_add(cb->index, timestamp, cb->line.buf, cb->line.len);
 	oidcpy(&cb->last_kept_oid, noid);
 
 	return 0;
@@ -3097,10 +4188,11 @@ static int files_reflog_expire(struct ref_store *ref_store,
 		files_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
 	struct lock_file reflog_lock = LOCK_INIT;
 	struct expire_reflog_cb cb;
+	struct reflog_index_builder index = { 0 };
 	struct ref_lock *lock;
 	struct strbuf log_file_sb = STRBUF_INIT;
 	char *log_file;
-	int status = 0;
+	int status = 0, use_index = 0;
 	struct strbuf err = STRBUF_INIT;
 	const struct object_id *oid;
 
@@ -3109,6 +4201,7 @@ static int files_reflog_expire(struct ref_store *ref_store,
 	cb.dry_run = !!(expire_flags & EXPIRE_REFLOGS_DRY_RUN);
 	cb.policy_cb = policy_cb_data;
 	cb.should_prune_fn = should_prune_fn;
+	strbuf_init(&cb.line, 0);
 
 	/*
 	 * The reflog file is locked by holding the lock on the
@@ -3163,6 +4256,9 @@ static int files_reflog_expire(struct ref_store *ref_store,
 			      get_lock_file_path(&reflog_lock), strerror(errno));
 			goto failure;
 		}
+		if (!repo_config_get_bool(refs->base.repo, "core.reflogindex",
+					  &use_index) && use_index)
+			cb.index = &index;
 	}
 
 	(*prepare_fn)(refname, oid, cb.policy_cb);
@@ -3205,27 +4301,48 @@ static int files_reflog_expire(struct ref_store *ref_store,
 		} else if (commit_lock_file(&reflog_lock)) {
 			status |= error("unable to write reflog '%s' (%s)",
 					log_file, strerror(errno));
-		} else if (update && commit_ref(lock)) {
-			status |= error("couldn't set %s", lock->ref_name);
+		} else {
+			if (cb.index)
+				status |= write_reflog_index(refs, refname,
+							     log_file, cb.index);
+			else
+				unlink_reflog_index(refs, refname);
+			if (update && commit_ref(lock))
+				status |= error("couldn't set %s", lock->ref_name);
+			else if (update)
+				files_bump_generation(refs);
 		}
 	}
+	strbuf_release(&cb.line);
+	free(index.chunks);
 	free(log_file);
 	unlock_ref(lock);
 	return status;
 
  failure:
 	rollback_lock_file(&reflog_lock);
+	strbuf_release(&cb.line);
+	free(index.chunks);
 	free(log_file);
 	unlock_ref(lock);
 	return -1;
 }
 
-static int files_init_db(struct ref_store *ref_store, struct strbuf *err UNUSED)
+static int files_init_db(struct ref_store *ref_store,
+			 int flags,
+			 struct strbuf *err UNUSED)
 {
 	struct files_ref_store *refs =
 		files_downcast(ref_store, REF_STORE_WRITE, "init_db");
 	struct strbuf sb = STRBUF_INIT;
 
+	/*
+	 * The shared references of a linked worktree live in the main
+	 * repository, which has been set up already.
+	 */
+	if (flags & REFS_INIT_DB_IS_WORKTREE)
+		return 0;
+
 	/*
 	 * Create .git/refs/{heads,tags}
 	 */
@@ -3241,7 +4358,6 @@ static int files_init_db(struct ref_store *ref_store, struct strbuf *err UNUSED)
 }
 
 struct ref_storage_be refs_be_files = {
-	.next = NULL,
 	.name = "files",
 	.init = files_ref_store_create,
 	.init_db = files_init_db,
@@ -3262,8 +4378,11 @@ struct ref_storage_be refs_be_files = {
 	.reflog_iterator_begin = files_reflog_iterator_begin,
 	.for_each_reflog_ent = files_for_each_reflog_ent,
 	.for_each_reflog_ent_reverse = files_for_each_reflog_ent_reverse,
+	.for_each_reflog_ent_reverse_seek = files_for_each_reflog_ent_reverse_seek,
 	.reflog_exists = files_reflog_exists,
 	.create_reflog = files_create_reflog,
 	.delete_reflog = files_delete_reflog,
-	.reflog_expire = files_reflog_expire
+	.reflog_expire = files_reflog_expire,
+
+	.read_generation = files_read_generation,
 };
@@ -10,6 +10,7 @@
 #include "../iterator.h"
 #include "../lockfile.h"
 #include "../chdir-notify.h"
+#include "../csum-file.h"
 #include "../statinfo.h"
 #include "../wrapper.h"
 #include "../write-or-die.h"
@@ -65,6 +66,10 @@ struct packed_ref_store;
  * `packed_ref_store`. Its freshness is checked whenever
  * `get_snapshot()` is called; if the existing snapshot is obsolete, a
  * new snapshot is taken.
+ *
+ * A snapshot of `packed-refs` owns a nested snapshot of the
+ * `packed-refs.delta` file, whose records take precedence over its
+ * own; see `delta` below.
  */
 struct snapshot {
 	/*
@@ -73,6 +78,9 @@ struct snapshot {
 	 */
 	struct packed_ref_store *refs;
 
+	/* Is this a snapshot of the `packed-refs.delta` file? */
+	int is_delta;
+
 	/* Is the `packed-refs` file currently mmapped? */
 	int mmapped;
 
@@ -114,6 +122,31 @@ struct snapshot {
 	 * replaced since we read it.
 	 */
 	struct stat_validity validity;
+
+	/*
+	 * The snapshot of the `packed-refs.delta` file that was taken
+	 * along with this one (never NULL, though it may be empty), or
+	 * NULL if this is itself a snapshot of the delta.
+	 *
+	 * The delta has the same format as `packed-refs` and is always
+	 * sorted and fully peeled. A record in it overrides the record
+	 * of the same name in `packed-refs`; a record with the null
+	 * object ID (a "tombstone") means that the reference has been
+	 * deleted.
+	 */
+	struct snapshot *delta;
+
+	/*
+	 * The contents of the `packed-refs.idx` file, if there is one
+	 * that matches the `packed-refs` file; otherwise NULL. See
+	 * `load_index()` for its format.
+	 */
+	const unsigned char *index;
+	size_t index_size;
+	int index_mmapped;
+
+	/* The number of sampled records in `index`: */
+	uint32_t index_nr;
 };
 
 /*
@@ -139,6 +172,19 @@ struct packed_ref_store {
 	/* The path of the "packed-refs" file: */
 	char *path;
 
+	/* The path of the "packed-refs.delta" file: */
+	char *delta_path;
+
+	/* The path of the "packed-refs.idx" file: */
+	char *index_path;
+
+	/*
+	 * If set, the next write folds `packed-refs.delta` into a new
+	 * `packed-refs` file rather than writing a new delta. This is
+	 * reset when the lock is released.
+	 */
+	int fold_delta;
+
 	/*
 	 * A snapshot of the values read from the `packed-refs` file,
 	 * if it might still be current; otherwise, NULL.
@@ -157,6 +203,12 @@ struct packed_ref_store {
 	 * `packed_ref_store`) must not be freed.
 	 */
 	struct tempfile *tempfile;
+
+	/*
+	 * Temporary file used when writing the "packed-refs.idx" file
+	 * that goes with `tempfile`, if any.
+	 */
+	struct tempfile *index_tempfile;
 };
 
 /*
@@ -167,6 +219,15 @@ static void acquire_snapshot(struct snapshot *snapshot)
 	snapshot->referrers++;
 }
 
+/*
+ * Return the path of the file from which `snapshot` was read.
+ */
+static const char *snapshot_path(struct snapshot *snapshot)
+{
+	return snapshot->is_delta ?
+		snapshot->refs->delta_path : snapshot->refs->path;
+}
+
 /*
  * If the buffer in `snapshot` is active, then either munmap the
  * memory and close the file, or free the memory. Then set the buffer
@@ -177,7 +238,7 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 	if (snapshot->mmapped) {
 		if (munmap(snapshot->buf, snapshot->eof - snapshot->buf))
 			die_errno("error ummapping packed-refs file %s",
-				  snapshot->refs->path);
+				  snapshot_path(snapshot));
 		snapshot->mmapped = 0;
 	} else {
 		free(snapshot->buf);
@@ -185,6 +246,18 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 	snapshot->buf = snapshot->start = snapshot->eof = NULL;
 }
 
+static void clear_snapshot_index(struct snapshot *snapshot)
+{
+	if (snapshot->index_mmapped)
+		munmap((void *)snapshot->index, snapshot->index_size);
+	else
+		free((void *)snapshot->index);
+	snapshot->index = NULL;
+	snapshot->index_size = 0;
+	snapshot->index_mmapped = 0;
+	snapshot->index_nr = 0;
+}
+
 /*
  * Decrease the reference count of `*snapshot`. If it goes to zero,
  * free `*snapshot` and return true; otherwise return false.
@@ -192,7 +265,10 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 static int release_snapshot(struct snapshot *snapshot)
 {
 	if (!--snapshot->referrers) {
+		if (snapshot->delta)
+			release_snapshot(snapshot->delta);
 		stat_validity_clear(&snapshot->validity);
+		clear_snapshot_index(snapshot);
 		clear_snapshot_buffer(snapshot);
 		free(snapshot);
 		return 1;
@@ -215,6 +291,14 @@ struct ref_store *packed_ref_store_create(struct repository *repo,
 	strbuf_addf(&sb, "%s/packed-refs", gitdir);
 	refs->path = strbuf_detach(&sb, NULL);
 	chdir_notify_reparent("packed-refs", &refs->path);
+
+	strbuf_addf(&sb, "%s/packed-refs.delta", gitdir);
+	refs->delta_path = strbuf_detach(&sb, NULL);
+	chdir_notify_reparent("packed-refs.delta", &refs->delta_path);
+
+	strbuf_addf(&sb, "%s/packed-refs.idx", gitdir);
+	refs->index_path = strbuf_detach(&sb, NULL);
+	chdir_notify_reparent("packed-refs.idx", &refs->index_path);
 	return ref_store;
 }
 
@@ -323,6 +407,32 @@ static int cmp_record_to_refname(const char *rec, const char *refname,
 	}
 }
 
+/*
+ * Compare the refnames of the snapshot records at `rec1` and `rec2`,
+ * which may come from different snapshots.
+ */
+static int cmp_records(const char *rec1, const char *rec2)
+{
+	struct snapshot_record e1 = { .start = rec1 };
+	struct snapshot_record e2 = { .start = rec2 };
+
+	return cmp_packed_ref_records(&e1, &e2);
+}
+
+/*
+ * Return true if the snapshot record at `rec` is a tombstone, i.e.,
+ * a record of the `packed-refs.delta` file with the null object ID.
+ */
+static int is_tombstone(const char *rec)
+{
+	size_t i;
+
+	for (i = 0; i < the_hash_algo->hexsz; i++)
+		if (rec[i] != '0')
+			return 0;
+	return 1;
+}
+
 /*
  * `snapshot->buf` is not known to be sorted. Check whether it is, and
  * if not, sort it into new memory and munmap/free the old storage.
@@ -356,7 +466,7 @@ static void sort_snapshot(struct snapshot *snapshot)
 			/* The safety check should prevent this. */
 			BUG("unterminated line found in packed-refs");
 		if (eol - pos < the_hash_algo->hexsz + 2)
-			die_invalid_line(snapshot->refs->path,
+			die_invalid_line(snapshot_path(snapshot),
 					 pos, eof - pos);
 		eol++;
 		if (eol < eof && *eol == '^') {
@@ -468,7 +578,7 @@ static void verify_buffer_safe(struct snapshot *snapshot)
 
 	last_line = find_start_of_record(start, eof - 1);
 	if (*(eof - 1) != '\n' || eof - last_line < the_hash_algo->hexsz + 2)
-		die_invalid_line(snapshot->refs->path,
+		die_invalid_line(snapshot_path(snapshot),
 				 last_line, eof - last_line);
 }
 
@@ -476,18 +586,17 @@ static void verify_buffer_safe(struct snapshot *snapshot)
 
 /*
  * Depending on `mmap_strategy`, either mmap or read the contents of
- * the `packed-refs` file into the snapshot. Return 1 if the file
- * existed and was read, or 0 if the file was absent or empty. Die on
- * errors.
+ * the `packed-refs` file into the snapshot and store its metadata in
+ * `st`. Return 1 if the file existed and was read, or 0 if the file
+ * was absent or empty. Die on errors.
  */
-static int load_contents(struct snapshot *snapshot)
+static int load_contents(struct snapshot *snapshot, struct stat *st)
 {
 	int fd;
-	struct stat st;
 	size_t size;
 	ssize_t bytes_read;
 
-	fd = open(snapshot->refs->path, O_RDONLY);
+	fd = open(snapshot_path(snapshot), O_RDONLY);
 	if (fd < 0) {
 		if (errno == ENOENT) {
 			/*
@@ -499,15 +608,15 @@ static int load_contents(struct snapshot *snapshot)
 			 */
 			return 0;
 		} else {
-			die_errno("couldn't read %s", snapshot->refs->path);
+			die_errno("couldn't read %s", snapshot_path(snapshot));
 		}
 	}
 
 	stat_validity_update(&snapshot->validity, fd);
 
-	if (fstat(fd, &st) < 0)
-		die_errno("couldn't stat %s", snapshot->refs->path);
-	size = xsize_t(st.st_size);
+	if (fstat(fd, st) < 0)
+		die_errno("couldn't stat %s", snapshot_path(snapshot));
+	size = xsize_t(st->st_size);
 
 	if (!size) {
 		close(fd);
@@ -516,7 +625,7 @@ static int load_contents(struct snapshot *snapshot)
 		snapshot->buf = xmalloc(size);
 		bytes_read = read_in_full(fd, snapshot->buf, size);
 		if (bytes_read < 0 || bytes_read != size)
-			die_errno("couldn't read %s", snapshot->refs->path);
+			die_errno("couldn't read %s", snapshot_path(snapshot));
 		snapshot->mmapped = 0;
 	} else {
 		snapshot->buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
@@ -530,6 +639,208 @@ static int load_contents(struct snapshot *snapshot)
 	return 1;
 }
 
+/*
+ * The `packed-refs.idx` file samples every PACKED_REFS_INDEX_INTERVAL-th
+ * record of a sorted `packed-refs` file, so that a lookup only has to
+ * scan forward over a handful of records rather than binary-search
+ * the whole file. All values are in network byte order:
+ *
+ *   - The signature "PRIX" and the version, 4 bytes each.
+ *
+ *   - The size of the `packed-refs` file (8 bytes), and its mtime
+ *     seconds, mtime nanoseconds and inode number as recorded in a
+ *     `struct stat_data` (4 bytes each). The index is used only if
+ *     these match the `packed-refs` file that is being read.
+ *
+ *   - The number of sampled records N (4 bytes).
+ *
+ *   - A fanout table of 256 entries of 4 bytes each. Entry `b` is the
+ *     number of sampled records whose refname starts with a byte
+ *     less than or equal to `b`.
+ *
+ *   - N offsets of 8 bytes each, of the sampled records relative to
+ *     the first record (i.e., not counting the header line).
+ *
+ *   - A trailing checksum of the above.
+ */
+#define PACKED_REFS_INDEX_SIGNATURE 0x50524958 /* "PRIX" */
+#define PACKED_REFS_INDEX_VERSION 1
+#define PACKED_REFS_INDEX_HEADER_SIZE 32
+#define PACKED_REFS_INDEX_FANOUT_SIZE (256 * 4)
+#define PACKED_REFS_INDEX_INTERVAL 16
+
+static const unsigned char *index_fanout(struct snapshot *snapshot)
+{
+	return snapshot->index + PACKED_REFS_INDEX_HEADER_SIZE;
+}
+
+static const unsigned char *index_offsets(struct snapshot *snapshot)
+{
+	return index_fanout(snapshot) + PACKED_REFS_INDEX_FANOUT_SIZE;
+}
+
+/*
+ * Load the `packed-refs.idx` file into `snapshot` if it belongs to
+ * the `packed-refs` file whose metadata is `st`. A missing, stale or
+ * malformed index is silently ignored.
+ */
+static void load_index(struct snapshot *snapshot, struct stat *st)
+{
+	struct stat_data sd;
+	struct stat index_st;
+	const unsigned char *index, *fanout;
+	size_t size;
+	uint32_t nr, i, prev = 0;
+	int fd;
+
+	fd = open(snapshot->refs->index_path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &index_st) < 0) {
+		close(fd);
+		return;
+	}
+	size = xsize_t(index_st.st_size);
+	if (size < PACKED_REFS_INDEX_HEADER_SIZE +
+		   PACKED_REFS_INDEX_FANOUT_SIZE + the_hash_algo->rawsz) {
+		close(fd);
+		return;
+	}
+	index = xmmap_gently(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (index == MAP_FAILED)
+		return;
+
+	snapshot->index = index;
+	snapshot->index_size = size;
+	snapshot->index_mmapped = 1;
+
+	fill_stat_data(&sd, st);
+	nr = get_be32(index + 28);
+	if (get_be32(index) != PACKED_REFS_INDEX_SIGNATURE ||
+	    get_be32(index + 4) != PACKED_REFS_INDEX_VERSION ||
+	    get_be64(index + 8) != (uint64_t)st->st_size ||
+	    get_be32(index + 16) != sd.sd_mtime.sec ||
+	    get_be32(index + 20) != sd.sd_mtime.nsec ||
+	    get_be32(index + 24) != sd.sd_ino ||
+	    size != PACKED_REFS_INDEX_HEADER_SIZE +
+		    PACKED_REFS_INDEX_FANOUT_SIZE +
+		    st_mult(nr, 8) + the_hash_algo->rawsz)
+		goto stale;
+
+	fanout = index_fanout(snapshot);
+	for (i = 0; i < 256; i++) {
+		uint32_t n = get_be32(fanout + 4 * i);
+
+		if (n < prev)
+			goto stale;
+		prev = n;
+	}
+	if (prev != nr)
+		goto stale;
+
+	snapshot->index_nr = nr;
+
+	if (mmap_strategy != MMAP_OK) {
+		/* Don't keep the file mmapped; see `read_snapshot()`. */
+		void *copy = xmemdupz(index, size);
+
+		clear_snapshot_index(snapshot);
+		snapshot->index = copy;
+		snapshot->index_size = size;
+		snapshot->index_nr = nr;
+	}
+	return;
+
+stale:
+	clear_snapshot_index(snapshot);
+}
+
+/*
+ * Return the `i`th record sampled by `snapshot->index`, or NULL if
+ * the offset stored for it does not point at the start of a record
+ * (which can only happen if the index is corrupt).
+ */
+static const char *index_record(struct snapshot *snapshot, uint32_t i)
+{
+	uint64_t offset = get_be64(index_offsets(snapshot) + st_mult(i, 8));
+	const char *rec;
+
+	if (offset >= (uint64_t)(snapshot->eof - snapshot->start))
+		return NULL;
+	rec = snapshot->start + offset;
+	if (rec != snapshot->start && (rec[-1] != '\n' || *rec == '^'))
+		return NULL;
+	return rec;
+}
+
+/*
+ * Find the location of `refname` like `find_reference_location_1()`
+ * does, but using `snapshot->index`. Return 0 and store the location
+ * in `*out` on success, or -1 if the index turns out to be corrupt.
+ */
+static int find_reference_location_indexed(struct snapshot *snapshot,
+					   const char *refname, int mustexist,
+					   int start, const char **out)
+{
+	const unsigned char *fanout = index_fanout(snapshot);
+	unsigned char first = *refname;
+	uint32_t lo, hi;
+	const char *rec, *end;
+
+	/*
+	 * The sampled records that compare before `refname` are all
+	 * in [0, lo), and the ones that compare after are all in
+	 * [hi, N). Only the ones that start with the same byte as
+	 * `refname` need to be compared. This does not hold for an
+	 * empty `refname`, though, which might compare after every
+	 * record.
+	 */
+	if (first) {
+		lo = get_be32(fanout + 4 * (first - 1));
+		hi = get_be32(fanout + 4 * first);
+	} else {
+		lo = 0;
+		hi = snapshot->index_nr;
+	}
+
+	/* Find the first sampled record that doesn't compare before: */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		rec = index_record(snapshot, mid);
+		if (!rec)
+			return -1;
+		if (cmp_record_to_refname(rec, refname, start) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/*
+	 * Now the record we are looking for is between the sampled
+	 * record before that one and that one; scan forward for it.
+	 */
+	if (!lo)
+		rec = snapshot->start;
+	else if (!(rec = index_record(snapshot, lo - 1)))
+		return -1;
+	if (lo == snapshot->index_nr)
+		end = snapshot->eof;
+	else if (!(end = index_record(snapshot, lo)) || end < rec)
+		return -1;
+
+	while (rec < end && cmp_record_to_refname(rec, refname, start) < 0)
+		rec = find_end_of_record(rec, end);
+
+	if (rec != snapshot->eof &&
+	    !cmp_record_to_refname(rec, refname, start))
+		*out = rec;
+	else
+		*out = mustexist ? NULL : rec;
+	return 0;
+}
+
 static const char *find_reference_location_1(struct snapshot *snapshot,
 					     const char *refname, int mustexist,
 					     int start)
@@ -556,6 +867,11 @@ static const char *find_reference_location_1(struct snapshot *snapshot,
 	 */
 	const char *hi = snapshot->eof;
 
+	if (snapshot->index &&
+	    !find_reference_location_indexed(snapshot, refname, mustexist,
+					     start, &lo))
+		return lo;
+
 	while (lo != hi) {
 		const char *mid, *rec;
 		int cmp;
@@ -614,8 +930,9 @@ static const char *find_reference_location_end(struct snapshot *snapshot,
 }
 
 /*
- * Create a newly-allocated `snapshot` of the `packed-refs` file in
- * its current state and return it. The return value will already have
+ * Create a newly-allocated `snapshot` of the `packed-refs` file (or,
+ * if `is_delta` is set, of the `packed-refs.delta` file) in its
+ * current state and return it. The return value will already have
  * its reference count incremented.
  *
  * A comment line of the form "# pack-refs with: " may contain zero or
@@ -646,16 +963,19 @@ static const char *find_reference_location_end(struct snapshot *snapshot,
  *
  *      The references in this file are known to be sorted by refname.
  */
-static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+static struct snapshot *read_snapshot(struct packed_ref_store *refs,
+				      int is_delta)
 {
 	struct snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
+	struct stat st;
 	int sorted = 0;
 
 	snapshot->refs = refs;
+	snapshot->is_delta = is_delta;
 	acquire_snapshot(snapshot);
 	snapshot->peeled = PEELED_NONE;
 
-	if (!load_contents(snapshot))
+	if (!load_contents(snapshot, &st))
 		return snapshot;
 
 	/* If the file has a header line, process it: */
@@ -666,14 +986,14 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		eol = memchr(snapshot->buf, '\n',
 			     snapshot->eof - snapshot->buf);
 		if (!eol)
-			die_unterminated_line(refs->path,
+			die_unterminated_line(snapshot_path(snapshot),
 					      snapshot->buf,
 					      snapshot->eof - snapshot->buf);
 
 		tmp = xmemdupz(snapshot->buf, eol - snapshot->buf);
 
 		if (!skip_prefix(tmp, "# pack-refs with:", (const char **)&p))
-			die_invalid_line(refs->path,
+			die_invalid_line(snapshot_path(snapshot),
 					 snapshot->buf,
 					 snapshot->eof - snapshot->buf);
 
@@ -706,6 +1026,8 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 		 * safety again:
 		 */
 		verify_buffer_safe(snapshot);
+	} else if (!is_delta) {
+		load_index(snapshot, &st);
 	}
 
 	if (mmap_strategy != MMAP_OK && snapshot->mmapped) {
@@ -725,14 +1047,46 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 	return snapshot;
 }
 
+/*
+ * Create a newly-allocated `snapshot` of the `packed-refs` file and
+ * of the `packed-refs.delta` file on top of it, and return it. The
+ * return value will already have its reference count incremented.
+ */
+static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+{
+	while (1) {
+		struct snapshot *snapshot = read_snapshot(refs, 0);
+
+		snapshot->delta = read_snapshot(refs, 1);
+
+		/*
+		 * Folding the delta writes a new `packed-refs` file
+		 * before it deletes the delta, so a delta that is read
+		 * after `packed-refs` is either the one that goes with
+		 * it or one that has already been folded into it. The
+		 * latter is harmless. But if `packed-refs` has been
+		 * replaced in the meantime, the two might not go
+		 * together; try again.
+		 */
+		if (is_lock_file_locked(&refs->lock) ||
+		    stat_validity_check(&snapshot->validity, refs->path))
+			return snapshot;
+
+		release_snapshot(snapshot);
+	}
+}
+
 /*
  * Check that `refs->snapshot` (if present) still reflects the
- * contents of the `packed-refs` file. If not, clear the snapshot.
+ * contents of the `packed-refs` and `packed-refs.delta` files. If
+ * not, clear the snapshot.
  */
 static void validate_snapshot(struct packed_ref_store *refs)
 {
 	if (refs->snapshot &&
-	    !stat_validity_check(&refs->snapshot->validity, refs->path))
+	    (!stat_validity_check(&refs->snapshot->validity, refs->path) ||
+	     !stat_validity_check(&refs->snapshot->delta->validity,
+				  refs->delta_path)))
 		clear_snapshot(refs);
 }
 
@@ -756,6 +1110,30 @@ static struct snapshot *get_snapshot(struct packed_ref_store *refs)
 	return refs->snapshot;
 }
 
+/*
+ * Look up `refname` in `snapshot->delta` and, failing that, in
+ * `snapshot`. Return 0 and store its value in `oid` if it exists, or
+ * -1 if it is missing from both or has a tombstone in the delta.
+ */
+static int lookup_packed_value(struct snapshot *snapshot, const char *refname,
+			       struct object_id *oid)
+{
+	const char *rec;
+
+	rec = find_reference_location(snapshot->delta, refname, 1);
+	if (rec)
+		snapshot = snapshot->delta;
+	else
+		rec = find_reference_location(snapshot, refname, 1);
+
+	if (!rec)
+		return -1;
+	if (get_oid_hex(rec, oid))
+		die_invalid_line(snapshot_path(snapshot), rec,
+				 snapshot->eof - rec);
+	return is_null_oid(oid) ? -1 : 0;
+}
+
 static int packed_read_raw_ref(struct ref_store *ref_store, const char *refname,
 			       struct object_id *oid, struct strbuf *referent UNUSED,
 			       unsigned int *type, int *failure_errno)
@@ -763,21 +1141,15 @@ static int packed_read_raw_ref(struct ref_store *ref_store, const char *refname,
 	struct packed_ref_store *refs =
 		packed_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
 	struct snapshot *snapshot = get_snapshot(refs);
-	const char *rec;
 
 	*type = 0;
 
-	rec = find_reference_location(snapshot, refname, 1);
-
-	if (!rec) {
+	if (lookup_packed_value(snapshot, refname, oid)) {
 		/* refname is not a packed reference. */
 		*failure_errno = ENOENT;
 		return -1;
 	}
 
-	if (get_oid_hex(rec, oid))
-		die_invalid_line(refs->path, rec, snapshot->eof - rec);
-
 	*type = REF_ISPACKED;
 	return 0;
 }
@@ -791,7 +1163,8 @@ static int packed_read_raw_ref(struct ref_store *ref_store, const char *refname,
 #define REF_KNOWS_PEELED 0x40
 
 /*
- * An iterator over a snapshot of a `packed-refs` file.
+ * An iterator over a snapshot of a `packed-refs` file, merged with
+ * the snapshot of the `packed-refs.delta` file on top of it.
  */
 struct packed_ref_iterator {
 	struct ref_iterator base;
@@ -804,6 +1177,9 @@ struct packed_ref_iterator {
 	/* The end of the part of the buffer that will be iterated over: */
 	const char *eof;
 
+	/* Likewise for the buffer of `snapshot->delta`: */
+	const char *delta_pos, *delta_eof;
+
 	struct jump_list_entry {
 		const char *start;
 		const char *end;
@@ -820,55 +1196,28 @@ struct packed_ref_iterator {
 };
 
 /*
- * Move the iterator to the next record in the snapshot, without
- * respect for whether the record is actually required by the current
- * iteration. Adjust the fields in `iter` and return `ITER_OK` or
- * `ITER_DONE`. This function does not free the iterator in the case
- * of `ITER_DONE`.
+ * Parse the record at `*pos` in `snapshot`, whose buffer ends at
+ * `eof`, into `iter`, and advance `*pos` past it.
  */
-static int next_record(struct packed_ref_iterator *iter)
+static int parse_record(struct packed_ref_iterator *iter,
+			struct snapshot *snapshot,
+			const char **pos, const char *eof)
 {
 	const char *p, *eol;
 
-	strbuf_reset(&iter->refname_buf);
-
-	/*
-	 * If iter->pos is contained within a skipped region, jump past
-	 * it.
-	 *
-	 * Note that each skipped region is considered at most once,
-	 * since they are ordered based on their starting position.
-	 */
-	while (iter->jump_cur < iter->jump_nr) {
-		struct jump_list_entry *curr = &iter->jump[iter->jump_cur];
-		if (iter->pos < curr->start)
-			break; /* not to the next jump yet */
-
-		iter->jump_cur++;
-		if (iter->pos < curr->end) {
-			iter->pos = curr->end;
-			trace2_counter_add(TRACE2_COUNTER_ID_PACKED_REFS_JUMPS, 1);
-			/* jumps are coalesced, so only one jump is necessary */
-			break;
-		}
-	}
-
-	if (iter->pos == iter->eof)
-		return ITER_DONE;
-
 	iter->base.flags = REF_ISPACKED;
-	p = iter->pos;
+	p = *pos;
 
-	if (iter->eof - p < the_hash_algo->hexsz + 2 ||
+	if (eof - p < the_hash_algo->hexsz + 2 ||
 	    parse_oid_hex(p, &iter->oid, &p) ||
 	    !isspace(*p++))
-		die_invalid_line(iter->snapshot->refs->path,
-				 iter->pos, iter->eof - iter->pos);
+		die_invalid_line(snapshot_path(snapshot),
+				 *pos, eof - *pos);
 
-	eol = memchr(p, '\n', iter->eof - p);
+	eol = memchr(p, '\n', eof - p);
 	if (!eol)
-		die_unterminated_line(iter->snapshot->refs->path,
-				      iter->pos, iter->eof - iter->pos);
+		die_unterminated_line(snapshot_path(snapshot),
+				      *pos, eof - *pos);
 
 	strbuf_add(&iter->refname_buf, p, eol - p);
 	iter->base.refname = iter->refname_buf.buf;
@@ -880,21 +1229,21 @@ static int next_record(struct packed_ref_iterator *iter)
 		oidclr(&iter->oid);
 		iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
 	}
-	if (iter->snapshot->peeled == PEELED_FULLY ||
-	    (iter->snapshot->peeled == PEELED_TAGS &&
+	if (snapshot->peeled == PEELED_FULLY ||
+	    (snapshot->peeled == PEELED_TAGS &&
 	     starts_with(iter->base.refname, "refs/tags/")))
 		iter->base.flags |= REF_KNOWS_PEELED;
 
-	iter->pos = eol + 1;
+	*pos = eol + 1;
 
-	if (iter->pos < iter->eof && *iter->pos == '^') {
-		p = iter->pos + 1;
-		if (iter->eof - p < the_hash_algo->hexsz + 1 ||
+	if (*pos < eof && **pos == '^') {
+		p = *pos + 1;
+		if (eof - p < the_hash_algo->hexsz + 1 ||
 		    parse_oid_hex(p, &iter->peeled, &p) ||
 		    *p++ != '\n')
-			die_invalid_line(iter->snapshot->refs->path,
-					 iter->pos, iter->eof - iter->pos);
-		iter->pos = p;
+			die_invalid_line(snapshot_path(snapshot),
+					 *pos, eof - *pos);
+		*pos = p;
 
 		/*
 		 * Regardless of what the file header said, we
@@ -914,6 +1263,68 @@ static int next_record(struct packed_ref_iterator *iter)
 	return ITER_OK;
 }
 
+/*
+ * Move the iterator to the next record in the snapshot, without
+ * respect for whether the record is actually required by the current
+ * iteration. Adjust the fields in `iter` and return `ITER_OK` or
+ * `ITER_DONE`. This function does not free the iterator in the case
+ * of `ITER_DONE`.
+ */
+static int next_record(struct packed_ref_iterator *iter)
+{
+	strbuf_reset(&iter->refname_buf);
+
+	while (1) {
+		int cmp;
+
+		/*
+		 * If iter->pos is contained within a skipped region, jump
+		 * past it.
+		 *
+		 * Note that each skipped region is considered at most once,
+		 * since they are ordered based on their starting position.
+		 */
+		while (iter->jump_cur < iter->jump_nr) {
+			struct jump_list_entry *curr = &iter->jump[iter->jump_cur];
+			if (iter->pos < curr->start)
+				break; /* not to the next jump yet */
+
+			iter->jump_cur++;
+			if (iter->pos < curr->end) {
+				iter->pos = curr->end;
+				trace2_counter_add(TRACE2_COUNTER_ID_PACKED_REFS_JUMPS, 1);
+				/* jumps are coalesced, so only one jump is necessary */
+				break;
+			}
+		}
+
+		if (iter->delta_pos == iter->delta_eof) {
+			if (iter->pos == iter->eof)
+				return ITER_DONE;
+			cmp = -1;
+		} else if (iter->pos == iter->eof) {
+			cmp = +1;
+		} else {
+			cmp = cmp_records(iter->pos, iter->delta_pos);
+		}
+
+		if (cmp < 0)
+			return parse_record(iter, iter->snapshot,
+					    &iter->pos, iter->eof);
+
+		/* The delta's record overrides the one in `packed-refs`: */
+		if (!cmp)
+			iter->pos = find_end_of_record(iter->pos, iter->eof);
+
+		if (!is_tombstone(iter->delta_pos))
+			return parse_record(iter, iter->snapshot->delta,
+					    &iter->delta_pos, iter->delta_eof);
+
+		iter->delta_pos = find_end_of_record(iter->delta_pos,
+						     iter->delta_eof);
+	}
+}
+
 static int packed_ref_iterator_advance(struct ref_iterator *ref_iterator)
 {
 	struct packed_ref_iterator *iter =
@@ -1086,7 +1497,7 @@ static struct ref_iterator *packed_ref_iterator_begin(
 {
 	struct packed_ref_store *refs;
 	struct snapshot *snapshot;
-	const char *start;
+	const char *start, *delta_start;
 	struct packed_ref_iterator *iter;
 	struct ref_iterator *ref_iterator;
 	unsigned int required_flags = REF_STORE_READ;
@@ -1102,12 +1513,15 @@ static struct ref_iterator *packed_ref_iterator_begin(
 	 */
 	snapshot = get_snapshot(refs);
 
-	if (prefix && *prefix)
+	if (prefix && *prefix) {
 		start = find_reference_location(snapshot, prefix, 0);
-	else
+		delta_start = find_reference_location(snapshot->delta, prefix, 0);
+	} else {
 		start = snapshot->start;
+		delta_start = snapshot->delta->start;
+	}
 
-	if (start == snapshot->eof)
+	if (start == snapshot->eof && delta_start == snapshot->delta->eof)
 		return empty_ref_iterator_begin();
 
 	CALLOC_ARRAY(iter, 1);
@@ -1122,6 +1536,8 @@ static struct ref_iterator *packed_ref_iterator_begin(
 
 	iter->pos = start;
 	iter->eof = snapshot->eof;
+	iter->delta_pos = delta_start;
+	iter->delta_eof = snapshot->delta->eof;
 	strbuf_init(&iter->refname_buf, 0);
 
 	iter->base.oid = &iter->oid;
@@ -1222,6 +1638,19 @@ void packed_refs_unlock(struct ref_store *ref_store)
 	if (!is_lock_file_locked(&refs->lock))
 		BUG("packed_refs_unlock() called when not locked");
 	rollback_lock_file(&refs->lock);
+	refs->fold_delta = 0;
+}
+
+void packed_refs_fold_delta(struct ref_store *ref_store)
+{
+	struct packed_ref_store *refs = packed_downcast(
+			ref_store,
+			REF_STORE_READ | REF_STORE_WRITE,
+			"packed_refs_fold_delta");
+
+	if (!is_lock_file_locked(&refs->lock))
+		BUG("packed_refs_fold_delta() called when not locked");
+	refs->fold_delta = 1;
 }
 
 int packed_refs_is_locked(struct ref_store *ref_store)
@@ -1246,18 +1675,124 @@ static const char PACKED_REFS_HEADER[] =
 	"# pack-refs with: peeled fully-peeled sorted \n";
 
 static int packed_init_db(struct ref_store *ref_store UNUSED,
+			  int flags UNUSED,
 			  struct strbuf *err UNUSED)
 {
 	/* Nothing to do. */
 	return 0;
 }
 
+/*
+ * The records sampled for the `packed-refs.idx` file while writing a
+ * new `packed-refs` file.
+ */
+struct index_builder {
+	/* The file offset of the first record: */
+	long base;
+
+	/* The number of records written so far: */
+	size_t records;
+
+	uint64_t *offsets;
+	size_t nr, alloc;
+
+	/* The number of samples by the first byte of their refname: */
+	uint32_t counts[256];
+};
+
+/*
+ * Note that the record for `refname` is about to be written to `out`.
+ */
+static int index_add_record(struct index_builder *index, FILE *out,
+			    const char *refname)
+{
+	long offset;
+
+	if (index->records++ % PACKED_REFS_INDEX_INTERVAL)
+		return 0;
+
+	offset = ftell(out);
+	if (offset < 0)
+		return -1;
+	ALLOC_GROW(index->offsets, index->nr + 1, index->alloc);
+	index->offsets[index->nr++] = offset - index->base;
+	index->counts[(unsigned char)*refname]++;
+	return 0;
+}
+
+/*
+ * Write the `packed-refs.idx` tempfile for the complete `packed-refs`
+ * tempfile, whose records were sampled in `index`. On error, write an
+ * error message to `err` and return a nonzero value.
+ */
+static int write_index(struct packed_ref_store *refs,
+		       struct index_builder *index,
+		       struct strbuf *err)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct hashfile *f;
+	struct stat st;
+	struct stat_data sd;
+	uint32_t total = 0;
+	size_t i;
+
+	/*
+	 * Renaming the tempfile into place keeps its size, mtime and
+	 * inode number, which tie the index to it:
+	 */
+	if (stat(get_tempfile_path(refs->tempfile), &st) < 0) {
+		strbuf_addf(err, "unable to stat %s: %s",
+			    get_tempfile_path(refs->tempfile), strerror(errno));
+		return -1;
+	}
+	fill_stat_data(&sd, &st);
+
+	strbuf_addf(&sb, "%s.new", refs->index_path);
+	refs->index_tempfile = create_tempfile(sb.buf);
+	if (!refs->index_tempfile) {
+		strbuf_addf(err, "unable to create file %s: %s",
+			    sb.buf, strerror(errno));
+		strbuf_release(&sb);
+		return -1;
+	}
+	strbuf_release(&sb);
+
+	f = hashfd(get_tempfile_fd(refs->index_tempfile),
+		   get_tempfile_path(refs->index_tempfile));
+	hashwrite_be32(f, PACKED_REFS_INDEX_SIGNATURE);
+	hashwrite_be32(f, PACKED_REFS_INDEX_VERSION);
+	hashwrite_be64(f, st.st_size);
+	hashwrite_be32(f, sd.sd_mtime.sec);
+	hashwrite_be32(f, sd.sd_mtime.nsec);
+	hashwrite_be32(f, sd.sd_ino);
+	hashwrite_be32(f, index->nr);
+	for (i = 0; i < 256; i++) {
+		total += index->counts[i];
+		hashwrite_be32(f, total);
+	}
+	for (i = 0; i < index->nr; i++)
+		hashwrite_be64(f, index->offsets[i]);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_REFERENCE,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+
+	if (close_tempfile_gently(refs->index_tempfile)) {
+		strbuf_addf(err, "error closing file %s: %s",
+			    get_tempfile_path(refs->index_tempfile),
+			    strerror(errno));
+		delete_tempfile(&refs->index_tempfile);
+		return -1;
+	}
+	return 0;
+}
+
 /*
  * Write the packed refs from the current snapshot to the packed-refs
  * tempfile, incorporating any changes from `updates`. `updates` must
  * be a sorted string list whose keys are the refnames and whose util
- * values are `struct ref_update *`. On error, rollback the tempfile,
- * write an error message to `err`, and return a nonzero value.
+ * values are `struct ref_update *`. If "core.packedRefsIndex" is
+ * set, also write the `packed-refs.idx` tempfile to go with it. On
+ * error, rollback the tempfiles, write an error message to `err`, and
+ * return a nonzero value.
  *
  * The packfile must be locked before calling this function and will
  * remain locked when it is done.
@@ -1268,9 +1803,10 @@ static int write_with_updates(struct packed_ref_store *refs,
 {
 	struct ref_iterator *iter = NULL;
 	size_t i;
-	int ok;
+	int ok, want_index = 0;
 	FILE *out;
 	struct strbuf sb = STRBUF_INIT;
+	struct index_builder index = { 0 };
 	char *packed_refs_path;
 
 	if (!is_lock_file_locked(&refs->lock))
@@ -1303,6 +1839,10 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
 		goto write_error;
 
+	repo_config_get_bool(refs->base.repo, "core.packedrefsindex",
+			     &want_index);
+	index.base = strlen(PACKED_REFS_HEADER);
+
 	/*
 	 * We iterate in parallel through the current list of refs and
 	 * the list of updates, processing an entry from at least one
@@ -1394,7 +1934,9 @@ static int write_with_updates(struct packed_ref_store *refs,
 			struct object_id peeled;
 			int peel_error = ref_iterator_peel(iter, &peeled);
 
-			if (write_packed_entry(out, iter->refname,
+			if ((want_index &&
+			     index_add_record(&index, out, iter->refname)) ||
+			    write_packed_entry(out, iter->refname,
 					       iter->oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
@@ -1415,7 +1957,9 @@ static int write_with_updates(struct packed_ref_store *refs,
 			int peel_error = peel_object(&update->new_oid,
 						     &peeled);
 
-			if (write_packed_entry(out, update->refname,
+			if ((want_index &&
+			     index_add_record(&index, out, update->refname)) ||
+			    write_packed_entry(out, update->refname,
 					       &update->new_oid,
 					       peel_error ? NULL : &peeled))
 				goto write_error;
@@ -1438,9 +1982,17 @@ static int write_with_updates(struct packed_ref_store *refs,
 			    strerror(errno));
 		strbuf_release(&sb);
 		delete_tempfile(&refs->tempfile);
+		free(index.offsets);
+		return -1;
+	}
+
+	if (want_index && write_index(refs, &index, err)) {
+		delete_tempfile(&refs->tempfile);
+		free(index.offsets);
 		return -1;
 	}
 
+	free(index.offsets);
 	return 0;
 
 write_error:
@@ -1451,10 +2003,204 @@ static int write_with_updates(struct packed_ref_store *refs,
 	if (iter)
 		ref_iterator_abort(iter);
 
+	delete_tempfile(&refs->tempfile);
+	free(index.offsets);
+	return -1;
+}
+
+/*
+ * Copy the snapshot records from `*pos` up to `end` verbatim to `out`
+ * and advance `*pos` to `end`. Clear `*empty` if there were any.
+ */
+static int copy_records(FILE *out, const char **pos, const char *end,
+			int *empty)
+{
+	if (*pos == end)
+		return 0;
+	*empty = 0;
+	if (fwrite(*pos, end - *pos, 1, out) != 1)
+		return -1;
+	*pos = end;
+	return 0;
+}
+
+/*
+ * Write the records of `packed-refs.delta` from the current snapshot
+ * to the delta tempfile, incorporating the changes from `updates`,
+ * but leave `packed-refs` alone. The old values are checked against
+ * the merged view of both files. `updates` must be as for
+ * `write_with_updates()`. Set `*empty` if the new delta has no
+ * records at all. On error, rollback the tempfile, write an error
+ * message to `err`, and return a nonzero value.
+ *
+ * The packfile must be locked before calling this function and will
+ * remain locked when it is done.
+ */
+static int write_delta_with_updates(struct packed_ref_store *refs,
+				    struct string_list *updates,
+				    int *empty, struct strbuf *err)
+{
+	struct snapshot *snapshot = get_snapshot(refs);
+	struct snapshot *delta = snapshot->delta;
+	const char *pos = delta->start;
+	struct strbuf sb = STRBUF_INIT;
+	size_t i;
+	FILE *out;
+
+	if (!is_lock_file_locked(&refs->lock))
+		BUG("write_delta_with_updates() called while unlocked");
+
+	*empty = 1;
+
+	strbuf_addf(&sb, "%s.new", refs->delta_path);
+	refs->tempfile = create_tempfile(sb.buf);
+	if (!refs->tempfile) {
+		strbuf_addf(err, "unable to create file %s: %s",
+			    sb.buf, strerror(errno));
+		strbuf_release(&sb);
+		return -1;
+	}
+	strbuf_release(&sb);
+
+	out = fdopen_tempfile(refs->tempfile, "w");
+	if (!out) {
+		strbuf_addf(err, "unable to fdopen packed-refs tempfile: %s",
+			    strerror(errno));
+		goto error;
+	}
+
+	if (fprintf(out, "%s", PACKED_REFS_HEADER) < 0)
+		goto write_error;
+
+	for (i = 0; i < updates->nr; i++) {
+		struct ref_update *update = updates->items[i].util;
+		const char *rec = find_reference_location(delta, update->refname, 0);
+		const char *old_rec = NULL;
+		struct object_id old_oid;
+		int exists;
+
+		/* Pass the old delta records before this one through: */
+		if (copy_records(out, &pos, rec, empty))
+			goto write_error;
+		if (pos != delta->eof &&
+		    !cmp_record_to_refname(pos, update->refname, 1)) {
+			old_rec = pos;
+			pos = find_end_of_record(pos, delta->eof);
+		}
+
+		exists = !lookup_packed_value(snapshot, update->refname, &old_oid);
+
+		if ((update->flags & REF_HAVE_OLD)) {
+			if (is_null_oid(&update->old_oid)) {
+				if (exists) {
+					strbuf_addf(err, "cannot update ref '%s': "
+						    "reference already exists",
+						    update->refname);
+					goto error;
+				}
+			} else if (!exists) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "reference is missing but expected %s",
+					    update->refname,
+					    oid_to_hex(&update->old_oid));
+				goto error;
+			} else if (!oideq(&update->old_oid, &old_oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "is at %s but expected %s",
+					    update->refname,
+					    oid_to_hex(&old_oid),
+					    oid_to_hex(&update->old_oid));
+				goto error;
+			}
+		}
+
+		if (!(update->flags & REF_HAVE_NEW)) {
+			/* Keep the old delta record, if any: */
+			if (old_rec && copy_records(out, &old_rec, pos, empty))
+				goto write_error;
+		} else if (is_null_oid(&update->new_oid)) {
+			/*
+			 * Deleting a reference that is in `packed-refs`
+			 * takes a tombstone; otherwise dropping its delta
+			 * record (if any) is enough.
+			 */
+			if (find_reference_location(snapshot, update->refname, 1)) {
+				*empty = 0;
+				if (write_packed_entry(out, update->refname,
+						       null_oid(), NULL))
+					goto write_error;
+			}
+		} else {
+			struct object_id peeled;
+			int peel_error = peel_object(&update->new_oid,
+						     &peeled);
+
+			*empty = 0;
+			if (write_packed_entry(out, update->refname,
+					       &update->new_oid,
+					       peel_error ? NULL : &peeled))
+				goto write_error;
+		}
+	}
+
+	if (copy_records(out, &pos, delta->eof, empty))
+		goto write_error;
+
+	if (fflush(out) ||
+	    fsync_component(FSYNC_COMPONENT_REFERENCE, get_tempfile_fd(refs->tempfile)) ||
+	    close_tempfile_gently(refs->tempfile)) {
+		strbuf_addf(err, "error closing file %s: %s",
+			    get_tempfile_path(refs->tempfile),
+			    strerror(errno));
+		delete_tempfile(&refs->tempfile);
+		return -1;
+	}
+
+	return 0;
+
+write_error:
+	strbuf_addf(err, "error writing to %s: %s",
+		    get_tempfile_path(refs->tempfile), strerror(errno));
+
+error:
 	delete_tempfile(&refs->tempfile);
 	return -1;
 }
 
+/*
+ * Writing the delta instead of a whole new `packed-refs` file only
+ * pays off while it is small compared to `packed-refs`; once it would
+ * grow beyond this fraction of it, fold it in instead.
+ */
+#define PACKED_REFS_DELTA_RATIO 8
+
+/*
+ * Return true if the `updates` should be written to the
+ * `packed-refs.delta` file rather than to a new `packed-refs` file.
+ */
+static int want_delta(struct packed_ref_store *refs,
+		      struct string_list *updates)
+{
+	struct snapshot *snapshot = get_snapshot(refs);
+	size_t size, i;
+	int enabled;
+
+	if (refs->fold_delta ||
+	    repo_config_get_bool(refs->base.repo, "core.packedrefsdelta",
+				 &enabled) ||
+	    !enabled)
+		return 0;
+
+	/* A rough estimate of the size of the new delta: */
+	size = snapshot->delta->eof - snapshot->delta->start;
+	for (i = 0; i < updates->nr; i++)
+		size += strlen(updates->items[i].string) +
+			2 * the_hash_algo->hexsz + 4;
+
+	return size * PACKED_REFS_DELTA_RATIO <
+		(size_t)(snapshot->eof - snapshot->start);
+}
+
 int is_packed_transaction_needed(struct ref_store *ref_store,
 				 struct ref_transaction *transaction)
 {
@@ -1554,6 +2300,13 @@ struct packed_transaction_backend_data {
 	/* True iff the transaction owns the packed-refs lock. */
 	int own_lock;
 
+	/*
+	 * True iff the tempfile holds a new `packed-refs.delta` file
+	 * rather than a new `packed-refs` file, and whether that delta
+	 * has no records.
+	 */
+	int write_delta, delta_empty;
+
 	struct string_list updates;
 };
 
@@ -1567,6 +2320,8 @@ static void packed_transaction_cleanup(struct packed_ref_store *refs,
 
 		if (is_tempfile_active(refs->tempfile))
 			delete_tempfile(&refs->tempfile);
+		if (is_tempfile_active(refs->index_tempfile))
+			delete_tempfile(&refs->index_tempfile);
 
 		if (data->own_lock && is_lock_file_locked(&refs->lock)) {
 			packed_refs_unlock(&refs->base);
@@ -1629,7 +2384,11 @@ static int packed_transaction_prepare(struct ref_store *ref_store,
 		data->own_lock = 1;
 	}
 
-	if (write_with_updates(refs, &data->updates, err))
+	data->write_delta = want_delta(refs, &data->updates);
+	if (data->write_delta ?
+	    write_delta_with_updates(refs, &data->updates,
+				     &data->delta_empty, err) :
+	    write_with_updates(refs, &data->updates, err))
 		goto failure;
 
 	transaction->state = REF_TRANSACTION_PREPARED;
@@ -1661,16 +2420,45 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 			ref_store,
 			REF_STORE_READ | REF_STORE_WRITE | REF_STORE_ODB,
 			"ref_transaction_finish");
+	struct packed_transaction_backend_data *data = transaction->backend_data;
 	int ret = TRANSACTION_GENERIC_ERROR;
-	char *packed_refs_path;
+	char *packed_refs_path = NULL;
 
 	clear_snapshot(refs);
 
-	packed_refs_path = get_locked_file_path(&refs->lock);
-	if (rename_tempfile(&refs->tempfile, packed_refs_path)) {
-		strbuf_addf(err, "error replacing %s: %s",
-			    refs->path, strerror(errno));
-		goto cleanup;
+	if (data->write_delta) {
+		if (data->delta_empty) {
+			delete_tempfile(&refs->tempfile);
+			unlink_or_warn(refs->delta_path);
+		} else if (rename_tempfile(&refs->tempfile, refs->delta_path)) {
+			strbuf_addf(err, "error replacing %s: %s",
+				    refs->delta_path, strerror(errno));
+			goto cleanup;
+		}
+	} else {
+		packed_refs_path = get_locked_file_path(&refs->lock);
+		if (rename_tempfile(&refs->tempfile, packed_refs_path)) {
+			strbuf_addf(err, "error replacing %s: %s",
+				    refs->path, strerror(errno));
+			goto cleanup;
+		}
+
+		/* The new `packed-refs` file has the delta folded in: */
+		unlink_or_warn(refs->delta_path);
+
+		/*
+		 * An old index would be ignored anyway, as it doesn't
+		 * match the new `packed-refs` file, so failing to
+		 * replace it is not an error:
+		 */
+		if (is_tempfile_active(refs->index_tempfile)) {
+			if (rename_tempfile(&refs->index_tempfile,
+					    refs->index_path))
+				warning_errno("unable to replace %s",
+					      refs->index_path);
+		} else {
+			unlink_or_warn(refs->index_path);
+		}
 	}
 
 	ret = 0;
@@ -1705,7 +2493,6 @@ static struct ref_iterator *packed_reflog_iterator_begin(struct ref_store *ref_s
 }
 
 struct ref_storage_be refs_be_packed = {
-	.next = NULL,
 	.name = "packed",
 	.init = packed_ref_store_create,
 	.init_db = packed_init_db,
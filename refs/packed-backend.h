@@ -27,6 +27,13 @@ int packed_refs_lock(struct ref_store *ref_store, int flags, struct strbuf *err)
 void packed_refs_unlock(struct ref_store *ref_store);
 int packed_refs_is_locked(struct ref_store *ref_store);
 
+/*
+ * Make the next transaction against the locked `ref_store` fold the
+ * `packed-refs.delta` file into a new `packed-refs` file, even if
+ * "core.packedRefsDelta" would have it write a new delta instead.
+ */
+void packed_refs_fold_delta(struct ref_store *ref_store);
+
 /*
  * Return true if `transaction` really needs to be carried out against
  * the specified packed_ref_store, or false if it can be skipped
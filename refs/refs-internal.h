@@ -529,7 +529,9 @@ typedef struct ref_store *ref_store_init_fn(struct repository *repo,
 					    const char *gitdir,
 					    unsigned int flags);
 
-typedef int ref_init_db_fn(struct ref_store *refs, struct strbuf *err);
+typedef int ref_init_db_fn(struct ref_store *refs,
+			   int flags,
+			   struct strbuf *err);
 
 typedef int ref_transaction_prepare_fn(struct ref_store *refs,
 				       struct ref_transaction *transaction,
@@ -589,6 +591,21 @@ typedef int for_each_reflog_ent_reverse_fn(struct ref_store *ref_store,
 					   const char *refname,
 					   each_reflog_ent_fn fn,
 					   void *cb_data);
+
+/*
+ * Like for_each_reflog_ent_reverse_fn, but for a walk that stops at the
+ * youngest entry at or before `at_time`, or at the `cnt`th youngest
+ * entry if `cnt` is positive, and compares that entry to the one after
+ * it. The backend may skip entries that are younger than both of
+ * these, and stores the number of entries skipped in `skipped` before
+ * calling `fn` for the first time. This method is optional.
+ */
+typedef int for_each_reflog_ent_reverse_seek_fn(struct ref_store *ref_store,
+						const char *refname,
+						timestamp_t at_time, int cnt,
+						int *skipped,
+						each_reflog_ent_fn fn,
+						void *cb_data);
 typedef int reflog_exists_fn(struct ref_store *ref_store, const char *refname);
 typedef int create_reflog_fn(struct ref_store *ref_store, const char *refname,
 			     struct strbuf *err);
@@ -662,8 +679,14 @@ typedef int read_raw_ref_fn(struct ref_store *ref_store, const char *refname,
 typedef int read_symbolic_ref_fn(struct ref_store *ref_store, const char *refname,
 				 struct strbuf *referent);
 
+/*
+ * Store a string in `out` that changes whenever a reference in the ref
+ * store is updated. Return 0 on success, or -1 if the generation cannot
+ * be determined. This method is optional.
+ */
+typedef int read_generation_fn(struct ref_store *ref_store, struct strbuf *out);
+
 struct ref_storage_be {
-	struct ref_storage_be *next;
 	const char *name;
 	ref_store_init_fn *init;
 	ref_init_db_fn *init_db;
@@ -685,13 +708,17 @@ struct ref_storage_be {
 	reflog_iterator_begin_fn *reflog_iterator_begin;
 	for_each_reflog_ent_fn *for_each_reflog_ent;
 	for_each_reflog_ent_reverse_fn *for_each_reflog_ent_reverse;
+	for_each_reflog_ent_reverse_seek_fn *for_each_reflog_ent_reverse_seek;
 	reflog_exists_fn *reflog_exists;
 	create_reflog_fn *create_reflog;
 	delete_reflog_fn *delete_reflog;
 	reflog_expire_fn *reflog_expire;
+
+	read_generation_fn *read_generation;
 };
 
 extern struct ref_storage_be refs_be_files;
+extern struct ref_storage_be refs_be_reftable;
 extern struct ref_storage_be refs_be_packed;
 
 /*
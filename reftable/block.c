@@ -276,36 +276,53 @@ void block_reader_start(struct block_reader *br, struct block_iter *it)
 	it->next_off = br->header_off + 4;
 }
 
-struct restart_find_args {
+struct restart_needle_less_args {
 	int error;
-	struct strbuf key;
-	struct block_reader *r;
+	struct strbuf needle;
+	struct block_reader *reader;
 };
 
-static int restart_key_less(size_t idx, void *args)
+static int restart_needle_less(size_t idx, void *_args)
 {
-	struct restart_find_args *a = args;
-	uint32_t off = block_reader_restart_offset(a->r, idx);
+	struct restart_needle_less_args *args = _args;
+	uint32_t off = block_reader_restart_offset(args->reader, idx);
 	struct string_view in = {
-		.buf = a->r->block.data + off,
-		.len = a->r->block_len - off,
+		.buf = args->reader->block.data + off,
+		.len = args->reader->block_len - off,
 	};
+	uint64_t prefix_len, suffix_len;
+	size_t len;
+	int n, result;
+
+	/*
+	 * Keys at restart points are not prefix-compressed, so we can compare
+	 * the needle against the key in place instead of decoding it.
+	 */
+	n = get_var_int(&prefix_len, &in);
+	if (n < 0 || prefix_len) {
+		args->error = 1;
+		return -1;
+	}
+	string_view_consume(&in, n);
+
+	n = get_var_int(&suffix_len, &in);
+	if (n <= 0) {
+		args->error = 1;
+		return -1;
+	}
+	string_view_consume(&in, n);
 
-	/* the restart key is verbatim in the block, so this could avoid the
-	   alloc for decoding the key */
-	struct strbuf rkey = STRBUF_INIT;
-	struct strbuf last_key = STRBUF_INIT;
-	uint8_t unused_extra;
-	int n = reftable_decode_key(&rkey, &unused_extra, last_key, in);
-	int result;
-	if (n < 0) {
-		a->error = 1;
+	suffix_len >>= 3;
+	if (suffix_len > in.len) {
+		args->error = 1;
 		return -1;
 	}
 
-	result = strbuf_cmp(&a->key, &rkey);
-	strbuf_release(&rkey);
-	return result;
+	len = args->needle.len < suffix_len ? args->needle.len : suffix_len;
+	result = memcmp(args->needle.buf, in.buf, len);
+	if (result)
+		return result < 0;
+	return args->needle.len < suffix_len;
 }
 
 void block_iter_copy_from(struct block_iter *dest, struct block_iter *src)
@@ -382,9 +399,9 @@ void block_iter_close(struct block_iter *it)
 int block_reader_seek(struct block_reader *br, struct block_iter *it,
 		      struct strbuf *want)
 {
-	struct restart_find_args args = {
-		.key = *want,
-		.r = br,
+	struct restart_needle_less_args args = {
+		.needle = *want,
+		.reader = br,
 	};
 	struct reftable_record rec = reftable_new_record(block_reader_type(br));
 	struct strbuf key = STRBUF_INIT;
@@ -393,7 +410,7 @@ int block_reader_seek(struct block_reader *br, struct block_iter *it,
 		.last_key = STRBUF_INIT,
 	};
 
-	int i = binsearch(br->restart_count, &restart_key_less, &args);
+	int i = binsearch(br->restart_count, &restart_needle_less, &args);
 	if (args.error) {
 		err = REFTABLE_FORMAT_ERROR;
 		goto done;
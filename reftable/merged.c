@@ -21,10 +21,13 @@ license that can be found in the LICENSE file or at
 static int merged_iter_init(struct merged_iter *mi)
 {
 	int i = 0;
+
+	merged_iter_pqueue_init(&mi->pq, mi->stack_len);
 	for (i = 0; i < mi->stack_len; i++) {
 		struct reftable_record rec = reftable_new_record(mi->typ);
 		int err = iterator_next(&mi->stack[i], &rec);
 		if (err < 0) {
+			reftable_record_release(&rec);
 			return err;
 		}
 
@@ -32,13 +35,10 @@ static int merged_iter_init(struct merged_iter *mi)
 			reftable_iterator_destroy(&mi->stack[i]);
 			reftable_record_release(&rec);
 		} else {
-			struct pq_entry e = {
-				.rec = rec,
-				.index = i,
-			};
-			merged_iter_pqueue_add(&mi->pq, &e);
+			merged_iter_pqueue_set(&mi->pq, i, &rec);
 		}
 	}
+	merged_iter_pqueue_build(&mi->pq);
 
 	return 0;
 }
@@ -52,48 +52,54 @@ static void merged_iter_close(void *p)
 		reftable_iterator_destroy(&mi->stack[i]);
 	}
 	reftable_free(mi->stack);
+	strbuf_release(&mi->key);
 }
 
-static int merged_iter_advance_nonnull_subiter(struct merged_iter *mi,
-					       size_t idx)
+/* Replace the top entry of the queue with the next one from its table. */
+static int merged_iter_advance_top(struct merged_iter *mi)
 {
-	struct pq_entry e = {
-		.rec = reftable_new_record(mi->typ),
-		.index = idx,
-	};
-	int err = iterator_next(&mi->stack[idx], &e.rec);
-	if (err < 0)
+	size_t idx = merged_iter_pqueue_top(&mi->pq)->index;
+	struct reftable_record rec;
+	int err;
+
+	if (iterator_is_null(&mi->stack[idx])) {
+		merged_iter_pqueue_replace_top(&mi->pq, NULL);
+		return 0;
+	}
+
+	rec = reftable_new_record(mi->typ);
+	err = iterator_next(&mi->stack[idx], &rec);
+	if (err < 0) {
+		reftable_record_release(&rec);
 		return err;
+	}
 
 	if (err > 0) {
 		reftable_iterator_destroy(&mi->stack[idx]);
-		reftable_record_release(&e.rec);
+		reftable_record_release(&rec);
+		merged_iter_pqueue_replace_top(&mi->pq, NULL);
 		return 0;
 	}
 
-	merged_iter_pqueue_add(&mi->pq, &e);
+	merged_iter_pqueue_replace_top(&mi->pq, &rec);
 	return 0;
 }
 
-static int merged_iter_advance_subiter(struct merged_iter *mi, size_t idx)
-{
-	if (iterator_is_null(&mi->stack[idx]))
-		return 0;
-	return merged_iter_advance_nonnull_subiter(mi, idx);
-}
-
 static int merged_iter_next_entry(struct merged_iter *mi,
 				  struct reftable_record *rec)
 {
-	struct strbuf entry_key = STRBUF_INIT;
-	struct pq_entry entry = { 0 };
+	struct pq_entry *top = NULL;
 	int err = 0;
 
-	if (merged_iter_pqueue_is_empty(mi->pq))
+	if (merged_iter_pqueue_is_empty(&mi->pq))
 		return 1;
 
-	entry = merged_iter_pqueue_remove(&mi->pq);
-	err = merged_iter_advance_subiter(mi, entry.index);
+	top = merged_iter_pqueue_top(&mi->pq);
+	reftable_record_copy_from(rec, &top->rec, hash_size(mi->hash_id));
+	strbuf_reset(&mi->key);
+	strbuf_addbuf(&mi->key, &top->key);
+
+	err = merged_iter_advance_top(mi);
 	if (err < 0)
 		return err;
 
@@ -105,32 +111,16 @@ static int merged_iter_next_entry(struct merged_iter *mi,
 	  such a deployment, the loop below must be changed to collect all
 	  entries for the same key, and return new the newest one.
 	*/
-	reftable_record_key(&entry.rec, &entry_key);
-	while (!merged_iter_pqueue_is_empty(mi->pq)) {
-		struct pq_entry top = merged_iter_pqueue_top(mi->pq);
-		struct strbuf k = STRBUF_INIT;
-		int err = 0, cmp = 0;
-
-		reftable_record_key(&top.rec, &k);
-
-		cmp = strbuf_cmp(&k, &entry_key);
-		strbuf_release(&k);
-
-		if (cmp > 0) {
+	while (!merged_iter_pqueue_is_empty(&mi->pq)) {
+		top = merged_iter_pqueue_top(&mi->pq);
+		if (strbuf_cmp(&top->key, &mi->key) > 0)
 			break;
-		}
 
-		merged_iter_pqueue_remove(&mi->pq);
-		err = merged_iter_advance_subiter(mi, top.index);
-		if (err < 0) {
+		err = merged_iter_advance_top(mi);
+		if (err < 0)
 			return err;
-		}
-		reftable_record_release(&top.rec);
 	}
 
-	reftable_record_copy_from(rec, &entry.rec, hash_size(mi->hash_id));
-	reftable_record_release(&entry.rec);
-	strbuf_release(&entry_key);
 	return 0;
 }
 
@@ -150,7 +140,7 @@ static int merged_iter_next(struct merged_iter *mi, struct reftable_record *rec)
 static int merged_iter_next_void(void *p, struct reftable_record *rec)
 {
 	struct merged_iter *mi = p;
-	if (merged_iter_pqueue_is_empty(mi->pq))
+	if (merged_iter_pqueue_is_empty(&mi->pq))
 		return 1;
 
 	return merged_iter_next(mi, rec);
@@ -248,6 +238,7 @@ static int merged_table_seek_record(struct reftable_merged_table *mt,
 		.typ = reftable_record_type(rec),
 		.hash_id = mt->hash_id,
 		.suppress_deletions = mt->suppress_deletions,
+		.key = STRBUF_INIT,
 	};
 	int n = 0;
 	int err = 0;
@@ -31,6 +31,8 @@ struct merged_iter {
 	uint8_t typ;
 	int suppress_deletions;
 	struct merged_iter_pqueue pq;
+	/* key of the entry returned last */
+	struct strbuf key;
 };
 
 void merged_table_release(struct reftable_merged_table *mt);
@@ -14,93 +14,152 @@ license that can be found in the LICENSE file or at
 
 int pq_less(struct pq_entry *a, struct pq_entry *b)
 {
-	struct strbuf ak = STRBUF_INIT;
-	struct strbuf bk = STRBUF_INIT;
-	int cmp = 0;
-	reftable_record_key(&a->rec, &ak);
-	reftable_record_key(&b->rec, &bk);
+	int cmp;
 
-	cmp = strbuf_cmp(&ak, &bk);
+	/* Exhausted sources lose against everything. */
+	if (!a->key.len)
+		return 0;
+	if (!b->key.len)
+		return 1;
 
-	strbuf_release(&ak);
-	strbuf_release(&bk);
+	if (a->prefix != b->prefix)
+		return a->prefix < b->prefix;
 
+	cmp = strbuf_cmp(&a->key, &b->key);
 	if (cmp == 0)
 		return a->index > b->index;
 
 	return cmp < 0;
 }
 
-struct pq_entry merged_iter_pqueue_top(struct merged_iter_pqueue pq)
+static uint64_t key_prefix(struct strbuf *key)
 {
-	return pq.heap[0];
+	uint64_t prefix = 0;
+	size_t i;
+
+	/* Zero padding keeps the order of keys shorter than the prefix. */
+	for (i = 0; i < sizeof(prefix); i++) {
+		prefix <<= 8;
+		if (i < key->len)
+			prefix |= (unsigned char)key->buf[i];
+	}
+	return prefix;
 }
 
-int merged_iter_pqueue_is_empty(struct merged_iter_pqueue pq)
+void merged_iter_pqueue_init(struct merged_iter_pqueue *pq, size_t len)
 {
-	return pq.len == 0;
+	size_t i;
+
+	pq->leaves = reftable_calloc(sizeof(*pq->leaves) * len);
+	pq->nodes = reftable_calloc(sizeof(*pq->nodes) * len);
+	pq->len = len;
+	pq->runner_up = len;
+	for (i = 0; i < len; i++) {
+		pq->leaves[i].index = i;
+		strbuf_init(&pq->leaves[i].key, 0);
+	}
 }
 
-struct pq_entry merged_iter_pqueue_remove(struct merged_iter_pqueue *pq)
+void merged_iter_pqueue_set(struct merged_iter_pqueue *pq, size_t index,
+			    struct reftable_record *rec)
 {
-	int i = 0;
-	struct pq_entry e = pq->heap[0];
-	pq->heap[0] = pq->heap[pq->len - 1];
-	pq->len--;
-
-	i = 0;
-	while (i < pq->len) {
-		int min = i;
-		int j = 2 * i + 1;
-		int k = 2 * i + 2;
-		if (j < pq->len && pq_less(&pq->heap[j], &pq->heap[i])) {
-			min = j;
-		}
-		if (k < pq->len && pq_less(&pq->heap[k], &pq->heap[min])) {
-			min = k;
-		}
-
-		if (min == i) {
-			break;
-		}
-
-		SWAP(pq->heap[i], pq->heap[min]);
-		i = min;
+	struct pq_entry *e = &pq->leaves[index];
+
+	if (e->key.len)
+		reftable_record_release(&e->rec);
+	if (!rec) {
+		strbuf_reset(&e->key);
+		return;
 	}
 
-	return e;
+	e->rec = *rec;
+	reftable_record_key(&e->rec, &e->key);
+	e->prefix = key_prefix(&e->key);
 }
 
-void merged_iter_pqueue_add(struct merged_iter_pqueue *pq, const struct pq_entry *e)
+void merged_iter_pqueue_build(struct merged_iter_pqueue *pq)
 {
-	int i = 0;
+	size_t *winners;
+	size_t p;
+
+	if (pq->len < 2)
+		return;
 
-	if (pq->len == pq->cap) {
-		pq->cap = 2 * pq->cap + 1;
-		pq->heap = reftable_realloc(pq->heap,
-					    pq->cap * sizeof(struct pq_entry));
+	winners = reftable_calloc(sizeof(*winners) * pq->len);
+	for (p = pq->len - 1; p > 0; p--) {
+		size_t a = 2 * p, b = 2 * p + 1;
+
+		a = a >= pq->len ? a - pq->len : winners[a];
+		b = b >= pq->len ? b - pq->len : winners[b];
+		if (pq_less(&pq->leaves[b], &pq->leaves[a]))
+			SWAP(a, b);
+
+		winners[p] = a;
+		pq->nodes[p] = b;
 	}
+	pq->nodes[0] = winners[1];
+	pq->runner_up = pq->len;
+	reftable_free(winners);
+}
 
-	pq->heap[pq->len++] = *e;
-	i = pq->len - 1;
-	while (i > 0) {
-		int j = (i - 1) / 2;
-		if (pq_less(&pq->heap[j], &pq->heap[i])) {
-			break;
-		}
+int merged_iter_pqueue_is_empty(struct merged_iter_pqueue *pq)
+{
+	return !pq->len || !pq->leaves[pq->nodes[0]].key.len;
+}
 
-		SWAP(pq->heap[j], pq->heap[i]);
+struct pq_entry *merged_iter_pqueue_top(struct merged_iter_pqueue *pq)
+{
+	return &pq->leaves[pq->nodes[0]];
+}
 
-		i = j;
+void merged_iter_pqueue_replace_top(struct merged_iter_pqueue *pq,
+				    struct reftable_record *rec)
+{
+	size_t winner = pq->nodes[0];
+	size_t cand = winner;
+	size_t p;
+
+	merged_iter_pqueue_set(pq, winner, rec);
+
+	/*
+	 * The runner-up is the best of the sources that lost against the
+	 * winner on its path. If the new entry still beats it, it beats all
+	 * of them, and every match on the path keeps its outcome.
+	 */
+	if (pq->runner_up < pq->len &&
+	    pq_less(&pq->leaves[winner], &pq->leaves[pq->runner_up]))
+		return;
+
+	for (p = (pq->len + winner) / 2; p > 0; p /= 2) {
+		if (pq_less(&pq->leaves[pq->nodes[p]], &pq->leaves[cand]))
+			SWAP(pq->nodes[p], cand);
+	}
+	pq->nodes[0] = cand;
+
+	/*
+	 * Only look for the runner-up when a source wins twice in a row,
+	 * which is when it is likely to hold a longer run of keys.
+	 */
+	pq->runner_up = pq->len;
+	if (cand != winner)
+		return;
+	for (p = (pq->len + winner) / 2; p > 0; p /= 2) {
+		size_t loser = pq->nodes[p];
+		if (pq->runner_up == pq->len ||
+		    pq_less(&pq->leaves[loser], &pq->leaves[pq->runner_up]))
+			pq->runner_up = loser;
 	}
 }
 
 void merged_iter_pqueue_release(struct merged_iter_pqueue *pq)
 {
-	int i = 0;
+	size_t i;
+
 	for (i = 0; i < pq->len; i++) {
-		reftable_record_release(&pq->heap[i].rec);
+		merged_iter_pqueue_set(pq, i, NULL);
+		strbuf_release(&pq->leaves[i].key);
 	}
-	FREE_AND_NULL(pq->heap);
-	pq->len = pq->cap = 0;
+	FREE_AND_NULL(pq->leaves);
+	FREE_AND_NULL(pq->nodes);
+	pq->len = pq->runner_up = 0;
 }
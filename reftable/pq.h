@@ -14,19 +14,47 @@ license that can be found in the LICENSE file or at
 struct pq_entry {
 	int index;
 	struct reftable_record rec;
+
+	/* The key of `rec`, empty if the source is exhausted. */
+	struct strbuf key;
+	/* The first eight bytes of `key` as a big-endian number. */
+	uint64_t prefix;
 };
 
+/*
+ * A tournament tree of losers that merges the sorted record streams of a
+ * fixed number of sources.
+ *
+ * Leaf `i` holds the current entry of source `i`. Each inner node holds the
+ * source that lost the match played there, and node 0 holds the overall
+ * winner. Replacing the winner's entry only replays the matches on the path
+ * from its leaf to the root, with one comparison per level.
+ */
 struct merged_iter_pqueue {
-	struct pq_entry *heap;
+	struct pq_entry *leaves;
+	size_t *nodes;
 	size_t len;
-	size_t cap;
+
+	/*
+	 * The source that wins once the winner's current entry is gone, or
+	 * `len` if that is not known. As long as the winner's next entries
+	 * sort before it, they win without replaying any matches.
+	 */
+	size_t runner_up;
 };
 
-struct pq_entry merged_iter_pqueue_top(struct merged_iter_pqueue pq);
-int merged_iter_pqueue_is_empty(struct merged_iter_pqueue pq);
-void merged_iter_pqueue_check(struct merged_iter_pqueue pq);
-struct pq_entry merged_iter_pqueue_remove(struct merged_iter_pqueue *pq);
-void merged_iter_pqueue_add(struct merged_iter_pqueue *pq, const struct pq_entry *e);
+void merged_iter_pqueue_init(struct merged_iter_pqueue *pq, size_t len);
+/* Hand the record of source `index` to the queue before it is built. */
+void merged_iter_pqueue_set(struct merged_iter_pqueue *pq, size_t index,
+			    struct reftable_record *rec);
+void merged_iter_pqueue_build(struct merged_iter_pqueue *pq);
+int merged_iter_pqueue_is_empty(struct merged_iter_pqueue *pq);
+struct pq_entry *merged_iter_pqueue_top(struct merged_iter_pqueue *pq);
+/* Replace the top record with the next one of its source, or NULL if the
+ * source is exhausted. */
+void merged_iter_pqueue_replace_top(struct merged_iter_pqueue *pq,
+				    struct reftable_record *rec);
+void merged_iter_pqueue_check(struct merged_iter_pqueue *pq);
 void merged_iter_pqueue_release(struct merged_iter_pqueue *pq);
 int pq_less(struct pq_entry *a, struct pq_entry *b);
 
@@ -15,56 +15,93 @@ license that can be found in the LICENSE file or at
 #include "reftable-tests.h"
 #include "test_framework.h"
 
-void merged_iter_pqueue_check(struct merged_iter_pqueue pq)
+void merged_iter_pqueue_check(struct merged_iter_pqueue *pq)
 {
+	struct pq_entry *top = merged_iter_pqueue_top(pq);
 	int i;
-	for (i = 1; i < pq.len; i++) {
-		int parent = (i - 1) / 2;
+	for (i = 0; i < pq->len; i++)
+		EXPECT(!pq_less(&pq->leaves[i], top));
+}
 
-		EXPECT(pq_less(&pq.heap[parent], &pq.heap[i]));
-	}
+static struct reftable_record ref_record(const char *name)
+{
+	struct reftable_record rec = {
+		.type = BLOCK_TYPE_REF,
+		.u.ref = {
+			.refname = xstrdup(name),
+		},
+	};
+	return rec;
 }
 
 static void test_pq(void)
 {
 	char *names[54] = { NULL };
 	int N = ARRAY_SIZE(names) - 1;
-
+	/* Uneven run lengths, so that some sources win many times in a row. */
+	int runs[] = { 1, 2, 7, 1, 3 };
+	int S = ARRAY_SIZE(runs);
+	int *source_of = reftable_calloc(sizeof(*source_of) * N);
+	int *pos = reftable_calloc(sizeof(*pos) * S);
 	struct merged_iter_pqueue pq = { NULL };
 	char *last = NULL;
+	int last_index = 0, count = 0;
+	int i, s;
 
-	int i = 0;
 	for (i = 0; i < N; i++) {
 		char name[100];
 		snprintf(name, sizeof(name), "%02d", i);
 		names[i] = xstrdup(name);
 	}
 
-	i = 1;
-	do {
-		struct pq_entry e = { .rec = { .type = BLOCK_TYPE_REF,
-					       .u.ref = {
-						       .refname = names[i],
-					       } } };
-		merged_iter_pqueue_add(&pq, &e);
-		merged_iter_pqueue_check(pq);
-		i = (i * 7) % N;
-	} while (i != 1);
+	/*
+	 * Every source starts with the first name, to check that the newest
+	 * source wins ties. The other names are dealt out in runs.
+	 */
+	for (i = 1, s = 0; i < N; s = (s + 1) % S) {
+		int j;
+		for (j = 0; j < runs[s] && i < N; j++)
+			source_of[i++] = s;
+	}
+
+	merged_iter_pqueue_init(&pq, S);
+	for (s = 0; s < S; s++) {
+		struct reftable_record rec = ref_record(names[0]);
+		merged_iter_pqueue_set(&pq, s, &rec);
+	}
+	merged_iter_pqueue_build(&pq);
 
-	while (!merged_iter_pqueue_is_empty(pq)) {
-		struct pq_entry e = merged_iter_pqueue_remove(&pq);
-		struct reftable_record *rec = &e.rec;
-		merged_iter_pqueue_check(pq);
+	while (!merged_iter_pqueue_is_empty(&pq)) {
+		struct pq_entry *e = merged_iter_pqueue_top(&pq);
+		struct reftable_record *rec = &e->rec;
+		int src = e->index;
 
+		merged_iter_pqueue_check(&pq);
 		EXPECT(reftable_record_type(rec) == BLOCK_TYPE_REF);
 		if (last) {
-			EXPECT(strcmp(last, rec->u.ref.refname) < 0);
+			int cmp = strcmp(last, rec->u.ref.refname);
+			EXPECT(cmp < 0 || (cmp == 0 && src < last_index));
+		}
+		reftable_free(last);
+		last = xstrdup(rec->u.ref.refname);
+		last_index = src;
+		count++;
+
+		do {
+			i = ++pos[src];
+		} while (i < N && source_of[i] != src);
+		if (i < N) {
+			struct reftable_record next = ref_record(names[i]);
+			merged_iter_pqueue_replace_top(&pq, &next);
+		} else {
+			merged_iter_pqueue_replace_top(&pq, NULL);
 		}
-		// this is names[i], so don't dealloc.
-		last = rec->u.ref.refname;
-		rec->u.ref.refname = NULL;
-		reftable_record_release(rec);
 	}
+	EXPECT(count == N - 1 + S);
+
+	reftable_free(last);
+	reftable_free(source_of);
+	reftable_free(pos);
 	for (i = 0; i < N; i++) {
 		reftable_free(names[i]);
 	}
@@ -278,6 +278,101 @@ static int32_t extract_block_size(uint8_t *data, uint8_t *typ, uint64_t off,
 	return result;
 }
 
+struct reader_cached_block {
+	uint64_t off;
+	uint64_t last_used;
+	/* one for the cache, plus one for each block_reader handed out */
+	int refcount;
+	struct block_reader br;
+};
+
+static void cached_block_unref(struct reader_cached_block *cb)
+{
+	if (--cb->refcount)
+		return;
+	reftable_block_done(&cb->br.block);
+	reftable_free(cb);
+}
+
+static void cached_block_return_block(void *arg, struct reftable_block *block)
+{
+	cached_block_unref(arg);
+}
+
+static struct reftable_block_source_vtable cached_block_vtable = {
+	.return_block = &cached_block_return_block,
+};
+
+/*
+ * Hand out a copy of the cached block reader. Its block is returned to the
+ * cache entry instead of the underlying source, so the decoded data stays
+ * alive until both the cache and all readers are done with it.
+ */
+static void cached_block_share(struct reader_cached_block *cb,
+			       struct block_reader *br)
+{
+	*br = cb->br;
+	br->block.source.ops = &cached_block_vtable;
+	br->block.source.arg = cb;
+	cb->refcount++;
+}
+
+static struct reader_cached_block *reader_cache_lookup(struct reftable_reader *r,
+						       uint64_t off)
+{
+	int i;
+
+	for (i = 0; i < READER_BLOCK_CACHE_SIZE; i++) {
+		struct reader_cached_block *cb = r->block_cache[i];
+		if (cb && cb->off == off) {
+			cb->last_used = ++r->block_cache_clock;
+			return cb;
+		}
+	}
+	return NULL;
+}
+
+/* Move the freshly decoded `br` into the cache, and share it back. */
+static void reader_cache_insert(struct reftable_reader *r, uint64_t off,
+				struct block_reader *br)
+{
+	struct reader_cached_block *cb = NULL;
+	int i, slot = 0;
+
+	for (i = 0; i < READER_BLOCK_CACHE_SIZE; i++) {
+		if (!r->block_cache[i]) {
+			slot = i;
+			break;
+		}
+		if (r->block_cache[i]->last_used <
+		    r->block_cache[slot]->last_used)
+			slot = i;
+	}
+	if (r->block_cache[slot])
+		cached_block_unref(r->block_cache[slot]);
+
+	cb = reftable_calloc(sizeof(*cb));
+	cb->off = off;
+	cb->last_used = ++r->block_cache_clock;
+	cb->refcount = 1;
+	cb->br = *br;
+	r->block_cache[slot] = cb;
+
+	cached_block_share(cb, br);
+}
+
+static void reader_cache_clear(struct reftable_reader *r)
+{
+	int i;
+
+	for (i = 0; i < READER_BLOCK_CACHE_SIZE; i++) {
+		if (!r->block_cache[i])
+			continue;
+		cached_block_unref(r->block_cache[i]);
+		r->block_cache[i] = NULL;
+	}
+}
+
 int reader_init_block_reader(struct reftable_reader *r, struct block_reader *br,
 			     uint64_t next_off, uint8_t want_typ)
 {
@@ -288,10 +383,20 @@ int reader_init_block_reader(struct reftable_reader *r, struct block_reader *br,
 	int err = 0;
 	uint32_t header_off = next_off ? 0 : header_size(r->version);
 	int32_t block_size = 0;
+	struct reader_cached_block *cb = NULL;
 
 	if (next_off >= r->size)
 		return 1;
 
+	cb = reader_cache_lookup(r, next_off);
+	if (cb) {
+		if (want_typ != BLOCK_TYPE_ANY &&
+		    block_reader_type(&cb->br) != want_typ)
+			return 1;
+		cached_block_share(cb, br);
+		return 0;
+	}
+
 	err = reader_get_block(r, &block, next_off, guess_block_size);
 	if (err < 0)
 		goto done;
@@ -317,6 +422,8 @@ int reader_init_block_reader(struct reftable_reader *r, struct block_reader *br,
 
 	err = block_reader_init(br, &block, header_off, r->block_size,
 				hash_size(r->hash_id));
+	if (!err)
+		reader_cache_insert(r, next_off, br);
 done:
 	reftable_block_done(&block);
 
@@ -630,6 +737,7 @@ int reftable_reader_seek_log(struct reftable_reader *r,
 
 void reader_close(struct reftable_reader *r)
 {
+	reader_cache_clear(r);
 	block_source_close(&r->source);
 	FREE_AND_NULL(r->name);
 }
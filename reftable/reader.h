@@ -28,6 +28,12 @@ struct reftable_reader_offsets {
 	uint64_t index_offset;
 };
 
+/* A decoded block, shared between the block cache and its block_readers. */
+struct reader_cached_block;
+
+/* Number of decoded blocks each reader keeps around. */
+#define READER_BLOCK_CACHE_SIZE 16
+
 /* The state for reading a reftable file. */
 struct reftable_reader {
 	/* for convience, associate a name with the instance. */
@@ -50,6 +56,10 @@ struct reftable_reader {
 	struct reftable_reader_offsets ref_offsets;
 	struct reftable_reader_offsets obj_offsets;
 	struct reftable_reader_offsets log_offsets;
+
+	/* Recently decoded blocks; the least recently used one is evicted. */
+	struct reader_cached_block *block_cache[READER_BLOCK_CACHE_SIZE];
+	uint64_t block_cache_clock;
 };
 
 int init_reader(struct reftable_reader *r, struct reftable_block_source *source,
@@ -520,6 +520,52 @@ static void test_table_read_write_seek_index(void)
 	test_table_read_write_seek(1, GIT_SHA1_FORMAT_ID);
 }
 
+static void test_table_read_cached_blocks(void)
+{
+	char **names;
+	struct strbuf buf = STRBUF_INIT;
+	int N = 50;
+	struct reftable_reader rd = { NULL };
+	struct reftable_block_source source = { NULL };
+	struct reftable_iterator it1 = { NULL }, it2 = { NULL };
+	struct reftable_ref_record ref = { NULL };
+	int err, i;
+
+	write_table(&names, &buf, N, 256, GIT_SHA1_FORMAT_ID);
+	block_source_from_strbuf(&source, &buf);
+	err = init_reader(&rd, &source, "file.ref");
+	EXPECT_ERR(err);
+
+	/* Both iterators share the same cached first block. */
+	err = reftable_reader_seek_ref(&rd, &it1, "");
+	EXPECT_ERR(err);
+	err = reftable_reader_seek_ref(&rd, &it2, "");
+	EXPECT_ERR(err);
+
+	/* Evict it from the cache while the iterators still use it. */
+	for (i = N - 1; i > 0; i--) {
+		struct reftable_iterator it = { NULL };
+		err = reftable_reader_seek_ref(&rd, &it, names[i]);
+		EXPECT_ERR(err);
+		reftable_iterator_destroy(&it);
+	}
+
+	for (i = 0; i < N; i++) {
+		err = reftable_iterator_next_ref(&it1, &ref);
+		EXPECT_ERR(err);
+		EXPECT(0 == strcmp(names[i], ref.refname));
+		if (i == N / 2)
+			reftable_iterator_destroy(&it2);
+	}
+	EXPECT(reftable_iterator_next_ref(&it1, &ref) > 0);
+
+	reftable_ref_record_release(&ref);
+	reftable_iterator_destroy(&it1);
+	reader_close(&rd);
+	strbuf_release(&buf);
+	free_names(names);
+}
+
 static void test_table_refs_for(int indexed)
 {
 	int N = 50;
@@ -840,6 +886,7 @@ int readwrite_test_main(int argc, const char *argv[])
 	RUN_TEST(test_table_read_write_sequential);
 	RUN_TEST(test_table_read_write_seek_linear);
 	RUN_TEST(test_table_read_write_seek_index);
+	RUN_TEST(test_table_read_cached_blocks);
 	RUN_TEST(test_table_refs_for_no_index);
 	RUN_TEST(test_table_refs_for_obj_index);
 	RUN_TEST(test_write_empty_key);
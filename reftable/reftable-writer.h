@@ -46,6 +46,12 @@ struct reftable_write_options {
 	 *   is a single line, and add '\n' if missing.
 	 */
 	unsigned exact_log_message : 1;
+
+	/* how long to keep retrying to lock the stack's tables.list while
+	 * another process holds the lock, in milliseconds. 0 means to fail
+	 * right away, and a negative value means to retry indefinitely.
+	 */
+	long lock_timeout_ms;
 };
 
 /* reftable_block_stats holds statistics for a single block type */
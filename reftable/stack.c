@@ -443,6 +443,36 @@ static void format_name(struct strbuf *dest, uint64_t min, uint64_t max)
 	strbuf_addstr(dest, buf);
 }
 
+/*
+ * Create the lock file `lock_file_name` for the stack. While another
+ * process holds it, retry with exponential backoff for up to
+ * `lock_timeout_ms` of the stack's configuration. Returns the file
+ * descriptor, or REFTABLE_LOCK_ERROR or REFTABLE_IO_ERROR.
+ */
+static int stack_lock(struct reftable_stack *st, const char *lock_file_name)
+{
+	long remaining_ms = st->config.lock_timeout_ms;
+	long backoff_ms = 1;
+
+	while (1) {
+		int fd = open(lock_file_name, O_EXCL | O_CREAT | O_WRONLY, 0666);
+		if (fd >= 0)
+			return fd;
+		if (errno != EEXIST)
+			return REFTABLE_IO_ERROR;
+		if (!remaining_ms)
+			return REFTABLE_LOCK_ERROR;
+
+		if (remaining_ms > 0 && backoff_ms > remaining_ms)
+			backoff_ms = remaining_ms;
+		sleep_millisec(backoff_ms);
+		if (remaining_ms > 0)
+			remaining_ms -= backoff_ms;
+		if (backoff_ms < 64)
+			backoff_ms *= 2;
+	}
+}
+
 struct reftable_addition {
 	int lock_file_fd;
 	struct strbuf lock_file_name;
@@ -468,14 +498,11 @@ static int reftable_stack_init_addition(struct reftable_addition *add,
 	strbuf_addstr(&add->lock_file_name, st->list_file);
 	strbuf_addstr(&add->lock_file_name, ".lock");
 
-	add->lock_file_fd = open(add->lock_file_name.buf,
-				 O_EXCL | O_CREAT | O_WRONLY, 0666);
+	add->lock_file_fd = stack_lock(st, add->lock_file_name.buf);
 	if (add->lock_file_fd < 0) {
-		if (errno == EEXIST) {
-			err = REFTABLE_LOCK_ERROR;
-		} else {
-			err = REFTABLE_IO_ERROR;
-		}
+		err = add->lock_file_fd;
+		/* The lock is someone else's, so don't remove it. */
+		strbuf_release(&add->lock_file_name);
 		goto done;
 	}
 	if (st->config.default_permissions) {
@@ -878,7 +905,39 @@ static int stack_write_compact(struct reftable_stack *st,
 	return err;
 }
 
-/* <  0: error. 0 == OK, > 0 attempt failed; could retry. */
+int stack_compacted_table_list(struct strbuf *out, char **names,
+			       char **compacted, const char *new_table)
+{
+	int pos = 0;
+	int len = 0;
+	int i = 0;
+
+	for (pos = 0; names[pos]; pos++) {
+		if (!strcmp(names[pos], compacted[0]))
+			break;
+	}
+	for (len = 0; compacted[len]; len++) {
+		if (!names[pos + len] || strcmp(names[pos + len], compacted[len]))
+			return 1;
+	}
+
+	for (i = 0; i < pos; i++)
+		strbuf_addf(out, "%s\n", names[i]);
+	if (new_table)
+		strbuf_addf(out, "%s\n", new_table);
+	for (i = pos + len; names[i]; i++)
+		strbuf_addf(out, "%s\n", names[i]);
+	return 0;
+}
+
+/*
+ * Compact the tables in [first, last]. The stack is locked only while
+ * the tables to compact are being locked and while the result is being
+ * swapped in, so other processes can keep adding tables to the stack
+ * (or compact other tables) in the meantime.
+ *
+ * <  0: error. 0 == OK, > 0 attempt failed; could retry.
+ */
 static int stack_compact_range(struct reftable_stack *st, int first, int last,
 			       struct reftable_log_expiry_config *expiry)
 {
@@ -896,6 +955,9 @@ static int stack_compact_range(struct reftable_stack *st, int first, int last,
 		reftable_calloc(sizeof(char *) * (compact_count + 1));
 	char **subtable_locks =
 		reftable_calloc(sizeof(char *) * (compact_count + 1));
+	char **compacted_names =
+		reftable_calloc(sizeof(char *) * (compact_count + 1));
+	char **names = NULL;
 	int i = 0;
 	int j = 0;
 	int is_empty_table = 0;
@@ -956,6 +1018,7 @@ static int stack_compact_range(struct reftable_stack *st, int first, int last,
 
 		subtable_locks[j] = subtab_lock.buf;
 		delete_on_success[j] = subtab_file_name.buf;
+		compacted_names[j] = (char *)reader_name(st->readers[i]);
 		j++;
 
 		if (err != 0)
@@ -978,14 +1041,13 @@ static int stack_compact_range(struct reftable_stack *st, int first, int last,
 	if (err < 0)
 		goto done;
 
-	lock_file_fd =
-		open(lock_file_name.buf, O_EXCL | O_CREAT | O_WRONLY, 0666);
+	/*
+	 * The merge is done; wait for any process that is adding a table
+	 * to be finished with it, rather than throwing the work away.
+	 */
+	lock_file_fd = stack_lock(st, lock_file_name.buf);
 	if (lock_file_fd < 0) {
-		if (errno == EEXIST) {
-			err = 1;
-		} else {
-			err = REFTABLE_IO_ERROR;
-		}
+		err = lock_file_fd == REFTABLE_LOCK_ERROR ? 1 : lock_file_fd;
 		goto done;
 	}
 	have_lock = 1;
@@ -1002,6 +1064,22 @@ static int stack_compact_range(struct reftable_stack *st, int first, int last,
 
 	stack_filename(&new_table_path, st, new_table_name.buf);
 
+	/*
+	 * Tables may have been added to the stack while it was unlocked,
+	 * and tables outside of our range compacted, so splice the new
+	 * table into the current tables.list rather than into the one we
+	 * started out with. The tables we compacted are locked, so no
+	 * other process can have removed them.
+	 */
+	err = read_lines(st->list_file, &names);
+	if (err < 0)
+		goto done;
+	err = stack_compacted_table_list(&ref_list_contents, names,
+					 compacted_names,
+					 is_empty_table ? NULL : new_table_name.buf);
+	if (err)
+		goto done;
+
 	if (!is_empty_table) {
 		/* retry? */
 		err = rename(temp_tab_file_name.buf, new_table_path.buf);
@@ -1011,19 +1089,6 @@ static int stack_compact_range(struct reftable_stack *st, int first, int last,
 		}
 	}
 
-	for (i = 0; i < first; i++) {
-		strbuf_addstr(&ref_list_contents, st->readers[i]->name);
-		strbuf_addstr(&ref_list_contents, "\n");
-	}
-	if (!is_empty_table) {
-		strbuf_addbuf(&ref_list_contents, &new_table_name);
-		strbuf_addstr(&ref_list_contents, "\n");
-	}
-	for (i = last + 1; i < st->merged->stack_len; i++) {
-		strbuf_addstr(&ref_list_contents, st->readers[i]->name);
-		strbuf_addstr(&ref_list_contents, "\n");
-	}
-
 	err = write(lock_file_fd, ref_list_contents.buf, ref_list_contents.len);
 	if (err < 0) {
 		err = REFTABLE_IO_ERROR;
@@ -1061,6 +1126,11 @@ static int stack_compact_range(struct reftable_stack *st, int first, int last,
 
 done:
 	free_names(delete_on_success);
+	free_names(names);
+	reftable_free(compacted_names);
+	/* Left behind if we failed to swap it in: */
+	if (temp_tab_file_name.len > 0)
+		unlink(temp_tab_file_name.buf);
 
 	listp = subtable_locks;
 	while (*listp) {
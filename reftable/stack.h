@@ -28,6 +28,15 @@ struct reftable_stack {
 
 int read_lines(const char *filename, char ***lines);
 
+/*
+ * Write the tables.list that results from replacing the tables named
+ * `compacted` by `new_table` (or by nothing if NULL) in the current
+ * tables.list `names` to `out`. Returns 1 if the compacted tables are
+ * not in `names` as a contiguous run anymore.
+ */
+int stack_compacted_table_list(struct strbuf *out, char **names,
+			       char **compacted, const char *new_table);
+
 struct segment {
 	int start, end;
 	int log;
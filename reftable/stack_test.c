@@ -889,6 +889,69 @@ static void test_reftable_stack_compaction_concurrent(void)
 	clear_dir(dir);
 }
 
+static void test_reftable_stack_compacted_table_list(void)
+{
+	char *names[] = { "a", "b", "c", "d", NULL };
+	char *middle[] = { "b", "c", NULL };
+	char *gap[] = { "b", "d", NULL };
+	char *gone[] = { "x", NULL };
+	struct strbuf out = STRBUF_INIT;
+
+	EXPECT(!stack_compacted_table_list(&out, names, middle, "n"));
+	EXPECT(!strcmp(out.buf, "a\nn\nd\n"));
+
+	strbuf_reset(&out);
+	EXPECT(!stack_compacted_table_list(&out, names, middle, NULL));
+	EXPECT(!strcmp(out.buf, "a\nd\n"));
+
+	strbuf_reset(&out);
+	EXPECT(!stack_compacted_table_list(&out, names, names, "n"));
+	EXPECT(!strcmp(out.buf, "n\n"));
+
+	EXPECT(stack_compacted_table_list(&out, names, gap, "n") == 1);
+	EXPECT(stack_compacted_table_list(&out, names, gone, "n") == 1);
+
+	strbuf_release(&out);
+}
+
+static void test_reftable_stack_lock_timeout(void)
+{
+	char *dir = get_tmp_dir(__LINE__);
+	struct reftable_write_options cfg = { 0 };
+	struct reftable_stack *st = NULL;
+	struct strbuf lock = STRBUF_INIT;
+	struct reftable_ref_record ref = {
+		.refname = "HEAD",
+		.update_index = 1,
+		.value_type = REFTABLE_REF_SYMREF,
+		.value.symref = "master",
+	};
+	int err, fd;
+
+	err = reftable_new_stack(&st, dir, cfg);
+	EXPECT_ERR(err);
+
+	strbuf_addf(&lock, "%s/tables.list.lock", dir);
+	fd = open(lock.buf, O_EXCL | O_CREAT | O_WRONLY, 0666);
+	EXPECT(fd >= 0);
+	close(fd);
+
+	err = reftable_stack_add(st, &write_test_ref, &ref);
+	EXPECT(err == REFTABLE_LOCK_ERROR);
+
+	st->config.lock_timeout_ms = 10;
+	err = reftable_stack_add(st, &write_test_ref, &ref);
+	EXPECT(err == REFTABLE_LOCK_ERROR);
+
+	unlink(lock.buf);
+	err = reftable_stack_add(st, &write_test_ref, &ref);
+	EXPECT_ERR(err);
+
+	strbuf_release(&lock);
+	reftable_stack_destroy(st);
+	clear_dir(dir);
+}
+
 static void unclean_stack_close(struct reftable_stack *st)
 {
 	/* break abstraction boundary to simulate unclean shutdown. */
@@ -962,8 +1025,10 @@ int stack_test_main(int argc, const char *argv[])
 	RUN_TEST(test_reftable_stack_auto_compaction);
 	RUN_TEST(test_reftable_stack_compaction_concurrent);
 	RUN_TEST(test_reftable_stack_compaction_concurrent_clean);
+	RUN_TEST(test_reftable_stack_compacted_table_list);
 	RUN_TEST(test_reftable_stack_hash_id);
 	RUN_TEST(test_reftable_stack_lock_failure);
+	RUN_TEST(test_reftable_stack_lock_timeout);
 	RUN_TEST(test_reftable_stack_log_normalize);
 	RUN_TEST(test_reftable_stack_tombstone);
 	RUN_TEST(test_reftable_stack_transaction_api);
@@ -1315,6 +1315,13 @@ static void parse_get(const char *arg)
 	fflush(stdout);
 }
 
+static void parse_get_stream(const char *url)
+{
+	if (http_get_stream(url, stdout, NULL))
+		die(_("failed to download file at URL '%s'"), url);
+	fflush(stdout);
+}
+
 static int push_dav(int nr_spec, const char **specs)
 {
 	struct child_process child = CHILD_PROCESS_INIT;
@@ -1597,10 +1604,16 @@ int cmd_main(int argc, const char **argv)
 			parse_get(arg);
 			fflush(stdout);
 
+		} else if (skip_prefix(buf.buf, "get-stream ", &arg)) {
+			/* The end of the file is the end of our output. */
+			parse_get_stream(arg);
+			break;
+
 		} else if (!strcmp(buf.buf, "capabilities")) {
 			printf("stateless-connect\n");
 			printf("fetch\n");
 			printf("get\n");
+			printf("get-stream\n");
 			printf("option\n");
 			printf("push\n");
 			printf("check-connectivity\n");
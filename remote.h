@@ -119,6 +119,14 @@ struct remote {
  */
 struct remote *remote_get(const char *name);
 
+/*
+ * Like remote_get(), but does not look at HEAD to find out the current
+ * branch. This is for callers that run before the reference database
+ * has been set up, like "git clone". Later calls to remote_get() will not
+ * know about the current branch either.
+ */
+struct remote *remote_get_early(const char *name);
+
 struct remote *pushremote_get(const char *name);
 int remote_is_configured(struct remote *remote, int in_repo);
 
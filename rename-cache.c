@@ -0,0 +1,99 @@
+#include "git-compat-util.h"
+#include "rename-cache.h"
+#include "chunk-format.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "path.h"
+#include "repository.h"
+#include "strbuf.h"
+
+#define RENAME_CACHE_HEADER_SIZE (16)
+#define RENAME_CACHE_SCORE_SIZE (16)
+
+static char *rename_cache_filename(struct repository *r,
+				   const struct object_id *key)
+{
+	return repo_git_path(r, "rename-cache/%s", oid_to_hex(key));
+}
+
+int read_rename_cache(struct repository *r, const struct object_id *key,
+		      struct rename_cache_score **scores, size_t *nr)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const unsigned char *data;
+	char *path = rename_cache_filename(r, key);
+	size_t i;
+	int ret = -1;
+
+	if (strbuf_read_file(&buf, path, 0) < 0)
+		goto cleanup;
+	data = (const unsigned char *)buf.buf;
+
+	if (buf.len < RENAME_CACHE_HEADER_SIZE + r->hash_algo->rawsz ||
+	    get_be32(data) != RENAME_CACHE_SIGNATURE ||
+	    get_be32(data + 4) != RENAME_CACHE_VERSION ||
+	    get_be32(data + 8) != oid_version(r->hash_algo))
+		goto invalid;
+	*nr = get_be32(data + 12);
+	if (buf.len != st_add3(RENAME_CACHE_HEADER_SIZE,
+			       st_mult(*nr, RENAME_CACHE_SCORE_SIZE),
+			       r->hash_algo->rawsz) ||
+	    !hashfile_checksum_valid(data, buf.len))
+		goto invalid;
+
+	data += RENAME_CACHE_HEADER_SIZE;
+	ALLOC_ARRAY(*scores, *nr);
+	for (i = 0; i < *nr; i++) {
+		(*scores)[i].dst = get_be32(data);
+		(*scores)[i].src = get_be32(data + 4);
+		(*scores)[i].score = get_be32(data + 8);
+		(*scores)[i].name_score = get_be32(data + 12);
+		data += RENAME_CACHE_SCORE_SIZE;
+	}
+	ret = 0;
+	goto cleanup;
+
+invalid:
+	warning(_("ignoring invalid rename cache '%s'"), path);
+cleanup:
+	strbuf_release(&buf);
+	free(path);
+	return ret;
+}
+
+void write_rename_cache(struct repository *r, const struct object_id *key,
+			const struct rename_cache_score *scores, size_t nr)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	char *path = rename_cache_filename(r, key);
+	size_t i;
+
+	if (nr > UINT32_MAX ||
+	    safe_create_leading_directories(path) < 0 ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0)
+		goto cleanup;
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	hashwrite_be32(f, RENAME_CACHE_SIGNATURE);
+	hashwrite_be32(f, RENAME_CACHE_VERSION);
+	hashwrite_be32(f, oid_version(r->hash_algo));
+	hashwrite_be32(f, nr);
+	for (i = 0; i < nr; i++) {
+		hashwrite_be32(f, scores[i].dst);
+		hashwrite_be32(f, scores[i].src);
+		hashwrite_be32(f, scores[i].score);
+		hashwrite_be32(f, scores[i].name_score);
+	}
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+
+	if (adjust_shared_perm(get_lock_file_path(&lk)) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		rollback_lock_file(&lk);
+
+cleanup:
+	free(path);
+}
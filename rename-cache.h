@@ -0,0 +1,54 @@
+#ifndef RENAME_CACHE_H
+#define RENAME_CACHE_H
+
+#include "hash-ll.h"
+
+struct repository;
+
+#define RENAME_CACHE_SIGNATURE 0x524e4d43 /* "RNMC" */
+#define RENAME_CACHE_VERSION 1
+
+/*
+ * With diff.renameCache, the scores computed by the exhaustive part of
+ * rename detection are kept in "$GIT_DIR/rename-cache/<key>", so that
+ * asking again for the renames between the same files, e.g. with "git
+ * log -M" or a restarted rebase, reuses them. The key is a hash of all
+ * that determines the scores: the paths, modes and object names of the
+ * candidate sources and destinations, and the options; see
+ * diffcore-rename.c.
+ *
+ * Each file consists of:
+ *
+ *   - a 16-byte header: the signature, the version, the hash id and the
+ *     number of scores
+ *
+ *   - for each score, in the order of the score matrix, the index of its
+ *     destination and of its source among the candidates, and the score
+ *     and name score, as 32-bit numbers
+ *
+ *   - a trailing checksum of the preceding contents
+ *
+ * All numbers are in network byte order. The files may be removed at any
+ * time.
+ */
+struct rename_cache_score {
+	uint32_t dst, src;
+	int score, name_score;
+};
+
+/*
+ * Read the scores cached under "key" into "scores", which the caller
+ * frees, and their number into "nr". Return 0 on success, and -1 if
+ * there are none, or the file is invalid.
+ */
+int read_rename_cache(struct repository *r, const struct object_id *key,
+		      struct rename_cache_score **scores, size_t *nr);
+
+/*
+ * Cache the "nr" scores under "key". Failing to do so is not an error:
+ * the scores are merely computed again the next time.
+ */
+void write_rename_cache(struct repository *r, const struct object_id *key,
+			const struct rename_cache_score *scores, size_t nr);
+
+#endif
@@ -12,6 +12,10 @@ struct submodule_cache;
 struct promisor_remote_config;
 struct remote_state;
 
+#define REF_STORAGE_FORMAT_UNKNOWN  0
+#define REF_STORAGE_FORMAT_FILES    1
+#define REF_STORAGE_FORMAT_REFTABLE 2
+
 enum untracked_cache_setting {
 	UNTRACKED_CACHE_KEEP,
 	UNTRACKED_CACHE_REMOVE,
@@ -21,6 +25,7 @@ enum untracked_cache_setting {
 enum fetch_negotiation_setting {
 	FETCH_NEGOTIATION_CONSECUTIVE,
 	FETCH_NEGOTIATION_SKIPPING,
+	FETCH_NEGOTIATION_GENERATION,
 	FETCH_NEGOTIATION_NOOP,
 };
 
@@ -35,6 +40,9 @@ struct repo_settings {
 	int command_requires_full_index;
 	int sparse_index;
 	int pack_read_reverse_index;
+	int pack_cache_reverse_index;
+	int core_loose_object_index;
+	int core_tree_cache;
 	int pack_use_bitmap_boundary_traversal;
 
 	/*
@@ -160,6 +168,9 @@ struct repository {
 	/* Repository's current hash algorithm, as serialized on disk. */
 	const struct git_hash_algo *hash_algo;
 
+	/* Repository's reference storage format, as serialized on disk. */
+	unsigned int ref_storage_format;
+
 	/* A unique-id for tracing purposes. */
 	int trace2_repo_id;
 
@@ -199,6 +210,7 @@ void repo_set_gitdir(struct repository *repo, const char *root,
 		     const struct set_gitdir_args *extra_args);
 void repo_set_worktree(struct repository *repo, const char *path);
 void repo_set_hash_algo(struct repository *repo, int algo);
+void repo_set_ref_storage_format(struct repository *repo, unsigned int format);
 void initialize_the_repository(void);
 RESULT_MUST_BE_USED
 int repo_init(struct repository *r, const char *gitdir, const char *worktree);
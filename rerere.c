@@ -19,6 +19,7 @@
 #include "object-store-ll.h"
 #include "hash-lookup.h"
 #include "strmap.h"
+#include "statinfo.h"
 
 #define RESOLVED 0
 #define PUNTED 1
@@ -54,6 +55,31 @@ static void free_rerere_dirs(void)
 	strmap_clear(&rerere_dirs, 0);
 }
 
+/*
+ * $GIT_DIR/rr-cache/index remembers the object name each preimage
+ * would have as a blob, so that a conflict that is exactly the same
+ * as one seen before can be told apart from the ones that are merely
+ * similar without reading and merging the recorded images.  The stat
+ * data of the preimage is recorded next to it; an entry whose stat
+ * data no longer matches the file is stale and ignored.
+ */
+struct preimage_hash {
+	struct stat_data sd;
+	struct object_id oid;
+};
+
+static struct strmap preimage_hashes = STRMAP_INIT;
+static int preimage_hashes_loaded, preimage_hashes_dirty;
+
+static GIT_PATH_FUNC(git_path_rr_cache_index, "rr-cache/index")
+
+static void free_preimage_hashes(void)
+{
+	strmap_clear(&preimage_hashes, 1);
+	preimage_hashes_loaded = 0;
+	preimage_hashes_dirty = 0;
+}
+
 static void free_rerere_id(struct string_list_item *item)
 {
 	free(item->util);
@@ -159,6 +185,186 @@ static struct rerere_dir *find_rerere_dir(const char *hex)
 	return rr_dir;
 }
 
+static const char *preimage_hash_key(const struct rerere_id *id,
+				     struct strbuf *key)
+{
+	strbuf_reset(key);
+	strbuf_addf(key, "%s/preimage", rerere_id_hex(id));
+	if (0 < id->variant)
+		strbuf_addf(key, ".%d", id->variant);
+	return key->buf;
+}
+
+static int parse_stat_data(const char *p, struct stat_data *sd,
+			   const char **end)
+{
+	unsigned int *field[] = {
+		&sd->sd_ctime.sec, &sd->sd_ctime.nsec,
+		&sd->sd_mtime.sec, &sd->sd_mtime.nsec,
+		&sd->sd_dev, &sd->sd_ino, &sd->sd_uid, &sd->sd_gid,
+		&sd->sd_size,
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(field); i++) {
+		char *ep;
+
+		if (*p++ != ' ' || !isdigit(*p))
+			return -1;
+		errno = 0;
+		*field[i] = strtoul(p, &ep, 10);
+		if (errno)
+			return -1;
+		p = ep;
+	}
+	*end = p;
+	return 0;
+}
+
+/*
+ * Each line of the index is the object name, the stat data and the
+ * name of the preimage relative to rr-cache.
+ */
+static void load_preimage_hashes(void)
+{
+	struct strbuf line = STRBUF_INIT;
+	FILE *in;
+
+	if (preimage_hashes_loaded)
+		return;
+	preimage_hashes_loaded = 1;
+
+	in = fopen(git_path_rr_cache_index(), "r");
+	if (!in)
+		return;
+	while (strbuf_getline_lf(&line, in) != EOF) {
+		struct preimage_hash *ph = xcalloc(1, sizeof(*ph));
+		const char *p;
+
+		if (parse_oid_hex(line.buf, &ph->oid, &p) ||
+		    parse_stat_data(p, &ph->sd, &p) ||
+		    *p++ != ' ' || !*p) {
+			/* drop what we cannot parse when writing it out */
+			free(ph);
+			preimage_hashes_dirty = 1;
+			continue;
+		}
+		free(strmap_put(&preimage_hashes, p, ph));
+	}
+	strbuf_release(&line);
+	fclose(in);
+}
+
+static void write_preimage_hashes(void)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct string_list keys = STRING_LIST_INIT_NODUP;
+	struct strbuf buf = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct strmap_entry *ent;
+	int i;
+
+	if (!preimage_hashes_dirty)
+		return;
+	preimage_hashes_dirty = 0;
+
+	/* Somebody else is updating it; theirs is as good as ours. */
+	if (hold_lock_file_for_update(&lock, git_path_rr_cache_index(), 0) < 0)
+		return;
+
+	if (!strmap_get_size(&preimage_hashes)) {
+		unlink_or_warn(git_path_rr_cache_index());
+		rollback_lock_file(&lock);
+		return;
+	}
+
+	strmap_for_each_entry(&preimage_hashes, &iter, ent)
+		string_list_append(&keys, ent->key)->util = ent->value;
+	string_list_sort(&keys);
+
+	for (i = 0; i < keys.nr; i++) {
+		struct preimage_hash *ph = keys.items[i].util;
+		const struct stat_data *sd = &ph->sd;
+
+		strbuf_addf(&buf, "%s %u %u %u %u %u %u %u %u %u %s\n",
+			    oid_to_hex(&ph->oid),
+			    sd->sd_ctime.sec, sd->sd_ctime.nsec,
+			    sd->sd_mtime.sec, sd->sd_mtime.nsec,
+			    sd->sd_dev, sd->sd_ino, sd->sd_uid, sd->sd_gid,
+			    sd->sd_size, keys.items[i].string);
+	}
+	if (write_in_full(get_lock_file_fd(&lock), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lock))
+		error_errno(_("unable to write '%s'"), git_path_rr_cache_index());
+	rollback_lock_file(&lock);
+	strbuf_release(&buf);
+	string_list_clear(&keys, 0);
+}
+
+/* The preimage of "id" is about to change or go away. */
+static void forget_preimage_hash(const struct rerere_id *id)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct preimage_hash *ph;
+
+	load_preimage_hashes();
+	ph = strmap_get(&preimage_hashes, preimage_hash_key(id, &key));
+	if (ph) {
+		strmap_remove(&preimage_hashes, key.buf, 1);
+		preimage_hashes_dirty = 1;
+	}
+	strbuf_release(&key);
+}
+
+/*
+ * Find the object name the preimage of "id" would have as a blob,
+ * from the index if it is still valid there, or by hashing the file.
+ */
+static int get_preimage_hash(const struct rerere_id *id, struct object_id *oid)
+{
+	const char *path = rerere_path(id, "preimage");
+	struct strbuf key = STRBUF_INIT;
+	struct preimage_hash *ph;
+	mmfile_t image = { NULL, 0 };
+	struct stat st;
+	int ret = -1;
+
+	load_preimage_hashes();
+	preimage_hash_key(id, &key);
+	ph = strmap_get(&preimage_hashes, key.buf);
+
+	if (lstat(path, &st) || !S_ISREG(st.st_mode))
+		goto out;
+	if (ph && !match_stat_data(&ph->sd, &st)) {
+		oidcpy(oid, &ph->oid);
+		ret = 0;
+		goto out;
+	}
+	if (read_mmfile(&image, path))
+		goto out;
+	hash_object_file(the_hash_algo, image.ptr, image.size, OBJ_BLOB, oid);
+	ret = 0;
+
+	/*
+	 * A file modified within the current second may still change
+	 * without its stat data telling; hash it again next time.
+	 */
+	if (st.st_mtime < time(NULL)) {
+		if (!ph) {
+			ph = xcalloc(1, sizeof(*ph));
+			strmap_put(&preimage_hashes, key.buf, ph);
+		}
+		fill_stat_data(&ph->sd, &st);
+		oidcpy(&ph->oid, oid);
+		preimage_hashes_dirty = 1;
+	}
+
+out:
+	strbuf_release(&key);
+	free(image.ptr);
+	return ret;
+}
+
 static int has_rerere_resolution(const struct rerere_id *id)
 {
 	const int both = RR_HAS_POSTIMAGE|RR_HAS_PREIMAGE;
@@ -641,30 +847,30 @@ static int try_merge(struct index_state *istate,
  * Find the conflict identified by "id"; the change between its
  * "preimage" (i.e. a previous contents with conflict markers) and its
  * "postimage" (i.e. the corresponding contents with conflicts
- * resolved) may apply cleanly to the contents stored in "path", i.e.
- * the conflict this time around.
+ * resolved) may apply cleanly to "cur", the normalized contents
+ * stored in "path", i.e. the conflict this time around.  When "cur"
+ * is known to be the same as the preimage, the postimage is the
+ * result without merging.
  *
  * Returns 0 for successful replay of recorded resolution, or non-zero
  * for failure.
  */
-static int merge(struct index_state *istate, const struct rerere_id *id, const char *path)
+static int merge(struct index_state *istate, const struct rerere_id *id,
+		 const char *path, mmfile_t *cur, int same_as_preimage)
 {
 	FILE *f;
 	int ret;
-	mmfile_t cur = {NULL, 0};
 	mmbuffer_t result = {NULL, 0};
 
-	/*
-	 * Normalize the conflicts in path and write it out to
-	 * "thisimage" temporary file.
-	 */
-	if ((handle_file(istate, path, NULL, rerere_path(id, "thisimage")) < 0) ||
-	    read_mmfile(&cur, rerere_path(id, "thisimage"))) {
-		ret = 1;
-		goto out;
-	}
+	if (same_as_preimage) {
+		mmfile_t other = {NULL, 0};
 
-	ret = try_merge(istate, id, path, &cur, &result);
+		ret = read_mmfile(&other, rerere_path(id, "postimage"));
+		result.ptr = other.ptr;
+		result.size = other.size;
+	} else {
+		ret = try_merge(istate, id, path, cur, &result);
+	}
 	if (ret)
 		goto out;
 
@@ -686,12 +892,33 @@ static int merge(struct index_state *istate, const struct rerere_id *id, const c
 		return error_errno(_("writing '%s' failed"), path);
 
 out:
-	free(cur.ptr);
 	free(result.ptr);
 
 	return ret;
 }
 
+/*
+ * Return the variant of "id" with a resolution whose preimage is
+ * exactly "cur", or -1 if there is none.
+ */
+static int find_identical_variant(const struct rerere_id *id,
+				  const mmfile_t *cur)
+{
+	const int both = RR_HAS_PREIMAGE | RR_HAS_POSTIMAGE;
+	struct rerere_dir *rr_dir = id->collection;
+	struct rerere_id vid = *id;
+	struct object_id cur_oid, oid;
+
+	hash_object_file(the_hash_algo, cur->ptr, cur->size, OBJ_BLOB, &cur_oid);
+	for (vid.variant = 0; vid.variant < rr_dir->status_nr; vid.variant++) {
+		if ((rr_dir->status[vid.variant] & both) != both)
+			continue;
+		if (!get_preimage_hash(&vid, &oid) && oideq(&oid, &cur_oid))
+			return vid.variant;
+	}
+	return -1;
+}
+
 static void update_paths(struct repository *r, struct string_list *update)
 {
 	struct lock_file index_lock = LOCK_INIT;
@@ -714,6 +941,7 @@ static void update_paths(struct repository *r, struct string_list *update)
 
 static void remove_variant(struct rerere_id *id)
 {
+	forget_preimage_hash(id);
 	unlink_or_warn(rerere_path(id, "postimage"));
 	unlink_or_warn(rerere_path(id, "preimage"));
 	id->collection->status[id->variant] = 0;
@@ -733,7 +961,8 @@ static void do_rerere_one_path(struct index_state *istate,
 	const char *path = rr_item->string;
 	struct rerere_id *id = rr_item->util;
 	struct rerere_dir *rr_dir = id->collection;
-	int variant;
+	mmfile_t cur = {NULL, 0};
+	int variant, identical;
 
 	variant = id->variant;
 
@@ -754,16 +983,36 @@ static void do_rerere_one_path(struct index_state *istate,
 		 */
 	}
 
-	/* Does any existing resolution apply cleanly? */
+	for (variant = 0; variant < rr_dir->status_nr; variant++)
+		if ((rr_dir->status[variant] & RR_HAS_PREIMAGE) &&
+		    (rr_dir->status[variant] & RR_HAS_POSTIMAGE))
+			break;
+	if (variant == rr_dir->status_nr)
+		goto new_variant;
+
+	/*
+	 * Normalize the conflicts in path and write it out to
+	 * "thisimage" temporary file.
+	 */
+	if ((handle_file(istate, path, NULL, rerere_path(id, "thisimage")) < 0) ||
+	    read_mmfile(&cur, rerere_path(id, "thisimage")))
+		goto new_variant;
+
+	/*
+	 * Does any existing resolution apply cleanly?  One recorded for
+	 * exactly this conflict does, and is the one to use.
+	 */
+	identical = find_identical_variant(id, &cur);
 	for (variant = 0; variant < rr_dir->status_nr; variant++) {
 		const int both = RR_HAS_PREIMAGE | RR_HAS_POSTIMAGE;
 		struct rerere_id vid = *id;
 
-		if ((rr_dir->status[variant] & both) != both)
+		if ((rr_dir->status[variant] & both) != both ||
+		    (0 <= identical && variant != identical))
 			continue;
 
 		vid.variant = variant;
-		if (merge(istate, &vid, path))
+		if (merge(istate, &vid, path, &cur, variant == identical))
 			continue; /* failed to replay */
 
 		/*
@@ -781,13 +1030,18 @@ static void do_rerere_one_path(struct index_state *istate,
 				   path);
 		free_rerere_id(rr_item);
 		rr_item->util = NULL;
+		free(cur.ptr);
 		return;
 	}
 
+new_variant:
+	free(cur.ptr);
+
 	/* None of the existing one applies; we need a new variant */
 	assign_variant(id);
 
 	variant = id->variant;
+	forget_preimage_hash(id);
 	handle_file(istate, path, NULL, rerere_path(id, "preimage"));
 	if (id->collection->status[variant] & RR_HAS_POSTIMAGE) {
 		const char *path = rerere_path(id, "postimage");
@@ -846,6 +1100,7 @@ static int do_plain_rerere(struct repository *r,
 	if (update.nr)
 		update_paths(r, &update);
 
+	write_preimage_hashes();
 	return write_rr(rr, fd);
 }
 
@@ -909,6 +1164,7 @@ int repo_rerere(struct repository *r, int flags)
 		return 0;
 	status = do_plain_rerere(r, &merge_rr, fd);
 	free_rerere_dirs();
+	free_preimage_hashes();
 	return status;
 }
 
@@ -1076,6 +1332,7 @@ static int rerere_forget_one_path(struct index_state *istate,
 	 * conflict in the working tree, run us again to record
 	 * the postimage.
 	 */
+	forget_preimage_hash(id);
 	handle_cache(istate, path, hash, rerere_path(id, "preimage"));
 	fprintf_ln(stderr, _("Updated preimage for '%s'"), path);
 
@@ -1121,6 +1378,7 @@ int rerere_forget(struct repository *r, struct pathspec *pathspec)
 			continue;
 		rerere_forget_one_path(r->index, it->string, &merge_rr);
 	}
+	write_preimage_hashes();
 	return write_rr(&merge_rr, fd);
 }
 
@@ -1226,6 +1484,7 @@ void rerere_gc(struct repository *r, struct string_list *rr)
 	for (i = 0; i < to_remove.nr; i++)
 		rmdir(git_path("rr-cache/%s", to_remove.items[i].string));
 	string_list_clear(&to_remove, 0);
+	write_preimage_hashes();
 	rollback_lock_file(&write_lock);
 }
 
@@ -1251,5 +1510,6 @@ void rerere_clear(struct repository *r, struct string_list *merge_rr)
 		}
 	}
 	unlink_or_warn(git_path_merge_rr(r));
+	write_preimage_hashes();
 	rollback_lock_file(&write_lock);
 }
@@ -38,6 +38,7 @@
 #include "trace2.h"
 #include "commit-reach.h"
 #include "commit-graph.h"
+#include "commit-queue.h"
 #include "prio-queue.h"
 #include "hashmap.h"
 #include "utf8.h"
@@ -667,25 +668,61 @@ static void trace2_bloom_filter_statistics_atexit(void)
 
 static int forbid_bloom_filters(struct pathspec *spec)
 {
-	if (spec->has_wildcard)
-		return 1;
-	if (spec->nr > 1)
-		return 1;
-	if (spec->magic & ~PATHSPEC_LITERAL)
-		return 1;
-	if (spec->nr && (spec->items[0].magic & ~PATHSPEC_LITERAL))
+	unsigned int allowed_magic = PATHSPEC_FROMTOP | PATHSPEC_LITERAL |
+				     PATHSPEC_GLOB;
+	int i;
+
+	if (spec->magic & ~allowed_magic)
 		return 1;
+	for (i = 0; i < spec->nr; i++)
+		if (spec->items[i].magic & ~allowed_magic)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Turn a pathspec item into the keys of the path that any change it
+ * matches must have added to a commit's Bloom filter. For a wildcard
+ * pattern, that is the longest leading directory without wildcards in
+ * it, e.g. "src" for "src/main*.c"; as the filters contain the
+ * leading directories of each changed path, too, this still rules out
+ * most commits. Returns -1 if the item matches changes anywhere.
+ */
+static int convert_pathspec_to_bloom_keyvec(struct bloom_keyvec **out,
+					    const struct pathspec_item *pi,
+					    const struct bloom_filter_settings *settings)
+{
+	size_t len = pi->nowildcard_len;
+
+	if (len < pi->len)
+		while (len > 0 && pi->match[len - 1] != '/')
+			len--;
+
+	/* remove single trailing slash from path, if needed */
+	if (len > 0 && pi->match[len - 1] == '/')
+		len--;
+
+	if (!len)
+		return -1;
 
+	*out = bloom_keyvec_new(pi->match, len, settings);
 	return 0;
 }
 
+static void release_revisions_bloom_keyvecs(struct rev_info *revs)
+{
+	int nr;
+
+	for (nr = 0; nr < revs->bloom_keyvecs_nr; nr++)
+		bloom_keyvec_free(revs->bloom_keyvecs[nr]);
+	FREE_AND_NULL(revs->bloom_keyvecs);
+	revs->bloom_keyvecs_nr = 0;
+}
+
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
 {
-	struct pathspec_item *pi;
-	char *path_alloc = NULL;
-	const char *path, *p;
-	size_t len;
-	int path_component_nr = 1;
+	int nr;
 
 	if (!revs->commits)
 		return;
@@ -702,63 +739,30 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->pruning.pathspec.nr)
 		return;
 
-	pi = &revs->pruning.pathspec.items[0];
-
-	/* remove single trailing slash from path, if needed */
-	if (pi->len > 0 && pi->match[pi->len - 1] == '/') {
-		path_alloc = xmemdupz(pi->match, pi->len - 1);
-		path = path_alloc;
-	} else
-		path = pi->match;
-
-	len = strlen(path);
-	if (!len) {
-		revs->bloom_filter_settings = NULL;
-		free(path_alloc);
-		return;
-	}
-
-	p = path;
-	while (*p) {
-		/*
-		 * At this point, the path is normalized to use Unix-style
-		 * path separators. This is required due to how the
-		 * changed-path Bloom filters store the paths.
-		 */
-		if (*p == '/')
-			path_component_nr++;
-		p++;
-	}
-
-	revs->bloom_keys_nr = path_component_nr;
-	ALLOC_ARRAY(revs->bloom_keys, revs->bloom_keys_nr);
-
-	fill_bloom_key(path, len, &revs->bloom_keys[0],
-		       revs->bloom_filter_settings);
-	path_component_nr = 1;
-
-	p = path + len - 1;
-	while (p > path) {
-		if (*p == '/')
-			fill_bloom_key(path, p - path,
-				       &revs->bloom_keys[path_component_nr++],
-				       revs->bloom_filter_settings);
-		p--;
+	CALLOC_ARRAY(revs->bloom_keyvecs, revs->pruning.pathspec.nr);
+	for (nr = 0; nr < revs->pruning.pathspec.nr; nr++) {
+		if (convert_pathspec_to_bloom_keyvec(&revs->bloom_keyvecs[nr],
+						     &revs->pruning.pathspec.items[nr],
+						     revs->bloom_filter_settings) < 0) {
+			revs->bloom_keyvecs_nr = nr;
+			release_revisions_bloom_keyvecs(revs);
+			revs->bloom_filter_settings = NULL;
+			return;
+		}
 	}
+	revs->bloom_keyvecs_nr = nr;
 
 	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
 		atexit(trace2_bloom_filter_statistics_atexit);
 		bloom_filter_atexit_registered = 1;
 	}
-
-	free(path_alloc);
 }
 
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 						 struct commit *commit)
 {
 	struct bloom_filter *filter;
-	int result = 1, j;
+	int result, nr;
 
 	if (!revs->repo->objects->commit_graph)
 		return -1;
@@ -773,11 +777,11 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 		return -1;
 	}
 
-	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
-		result = bloom_filter_contains(filter,
-					       &revs->bloom_keys[j],
-					       revs->bloom_filter_settings);
-	}
+	/* The commit may be interesting if it touches any of the paths. */
+	for (nr = 0, result = 0; !result && nr < revs->bloom_keyvecs_nr; nr++)
+		result = bloom_filter_contains_vec(filter,
+						   revs->bloom_keyvecs[nr],
+						   revs->bloom_filter_settings);
 
 	if (result)
 		count_bloom_filter_maybe++;
@@ -817,7 +821,7 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keys_nr && !nth_parent) {
+	if (revs->bloom_keyvecs_nr && !nth_parent) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 
 		if (bloom_ret == 0)
@@ -1214,6 +1218,8 @@ static void cherry_pick_list(struct commit_list *list, struct rev_info *revs)
 	int left_first;
 	struct patch_ids ids;
 	unsigned cherry_flag;
+	struct commit **others;
+	size_t others_nr = 0;
 
 	/* First count the commits on the left and on the right */
 	for (p = list; p; p = p->next) {
@@ -1251,6 +1257,19 @@ static void cherry_pick_list(struct commit_list *list, struct rev_info *revs)
 		add_commit_patch_id(commit, &ids);
 	}
 
+	/* Compute ahead what looking up the other side needs */
+	ALLOC_ARRAY(others, left_first ? right_count : left_count);
+	for (p = list; p; p = p->next) {
+		struct commit *commit = p->item;
+		unsigned flags = commit->object.flags;
+
+		if (!(flags & BOUNDARY) &&
+		    left_first != !!(flags & SYMMETRIC_LEFT))
+			others[others_nr++] = commit;
+	}
+	prepare_patch_id_lookups(&ids, others, others_nr);
+	free(others);
+
 	/* either cherry_mark or cherry_pick are true */
 	cherry_flag = revs->cherry_mark ? PATCHSAME : SHOWN;
 
@@ -3119,6 +3138,7 @@ void release_revisions(struct rev_info *revs)
 	clear_decoration(&revs->treesame, free);
 	line_log_free(revs);
 	oidset_clear(&revs->missing_commits);
+	release_revisions_bloom_keyvecs(revs);
 }
 
 static void add_child(struct rev_info *revs, struct commit *parent, struct commit *child)
@@ -3508,13 +3528,28 @@ static int mark_uninteresting(const struct object_id *oid,
 define_commit_slab(indegree_slab, int);
 define_commit_slab(author_date_slab, timestamp_t);
 
+static inline timestamp_t topo_walk_key(const struct commit *c,
+					void *unused UNUSED)
+{
+	return commit_graph_generation(c);
+}
+
+define_commit_queue(topo_walk_queue, topo_walk_key);
+
 struct topo_walk_info {
 	timestamp_t min_generation;
-	struct prio_queue explore_queue;
-	struct prio_queue indegree_queue;
+	struct topo_walk_queue explore_queue;
+	struct topo_walk_queue indegree_queue;
 	struct prio_queue topo_queue;
 	struct indegree_slab indegree;
 	struct author_date_slab author_date;
+
+	/*
+	 * The starting commits not yet considered, in graph order; see
+	 * next_topo_tip().
+	 */
+	struct commit **tips;
+	size_t tips_nr, tips_alloc, next_tip;
 };
 
 static int topo_walk_atexit_registered;
@@ -3537,20 +3572,20 @@ static void trace2_topo_walk_statistics_atexit(void)
 	jw_release(&jw);
 }
 
-static inline void test_flag_and_insert(struct prio_queue *q, struct commit *c, int flag)
+static inline void test_flag_and_insert(struct topo_walk_queue *q, struct commit *c, int flag)
 {
 	if (c->object.flags & flag)
 		return;
 
 	c->object.flags |= flag;
-	prio_queue_put(q, c);
+	topo_walk_queue_put(q, c);
 }
 
 static void explore_walk_step(struct rev_info *revs)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit_list *p;
-	struct commit *c = prio_queue_get(&info->explore_queue);
+	struct commit *c = topo_walk_queue_get(&info->explore_queue);
 
 	if (!c)
 		return;
@@ -3581,7 +3616,7 @@ static void explore_to_depth(struct rev_info *revs,
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
-	while ((c = prio_queue_peek(&info->explore_queue)) &&
+	while ((c = topo_walk_queue_peek(&info->explore_queue)) &&
 	       commit_graph_generation(c) >= gen_cutoff)
 		explore_walk_step(revs);
 }
@@ -3590,7 +3625,7 @@ static void indegree_walk_step(struct rev_info *revs)
 {
 	struct commit_list *p;
 	struct topo_walk_info *info = revs->topo_walk_info;
-	struct commit *c = prio_queue_get(&info->indegree_queue);
+	struct commit *c = topo_walk_queue_get(&info->indegree_queue);
 
 	if (!c)
 		return;
@@ -3626,7 +3661,7 @@ static void compute_indegrees_to_depth(struct rev_info *revs,
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
-	while ((c = prio_queue_peek(&info->indegree_queue)) &&
+	while ((c = topo_walk_queue_peek(&info->indegree_queue)) &&
 	       commit_graph_generation(c) >= gen_cutoff)
 		indegree_walk_step(revs);
 }
@@ -3635,11 +3670,12 @@ static void release_revisions_topo_walk_info(struct topo_walk_info *info)
 {
 	if (!info)
 		return;
-	clear_prio_queue(&info->explore_queue);
-	clear_prio_queue(&info->indegree_queue);
+	clear_topo_walk_queue(&info->explore_queue);
+	clear_topo_walk_queue(&info->indegree_queue);
 	clear_prio_queue(&info->topo_queue);
 	clear_indegree_slab(&info->indegree);
 	clear_author_date_slab(&info->author_date);
+	free(info->tips);
 	free(info);
 }
 
@@ -3679,9 +3715,6 @@ static void init_topo_walk(struct rev_info *revs)
 		break;
 	}
 
-	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
-	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
-
 	info->min_generation = GENERATION_NUMBER_INFINITY;
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
@@ -3701,22 +3734,33 @@ static void init_topo_walk(struct rev_info *revs)
 
 		if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
 			record_author_date(&info->author_date, c);
-	}
-	compute_indegrees_to_depth(revs, info->min_generation);
-
-	for (list = revs->commits; list; list = list->next) {
-		struct commit *c = list->item;
 
-		if (*(indegree_slab_at(&info->indegree, c)) == 1)
-			prio_queue_put(&info->topo_queue, c);
+		if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER) {
+			ALLOC_GROW(info->tips, info->tips_nr + 1, info->tips_alloc);
+			info->tips[info->tips_nr++] = c;
+		}
 	}
 
 	/*
-	 * This is unfortunate; the initial tips need to be shown
-	 * in the order given from the revision traversal machinery.
+	 * In graph order, the initial tips are shown in the order given
+	 * from the revision traversal machinery, each after everything
+	 * that became ready while showing the ones before it; so there is
+	 * no need to know which of them have children until then, see
+	 * next_topo_tip(). In the other orders, the tips that have no
+	 * children compete with everything else from the start.
 	 */
-	if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER)
-		prio_queue_reverse(&info->topo_queue);
+	if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER) {
+		info->min_generation = GENERATION_NUMBER_INFINITY;
+	} else {
+		compute_indegrees_to_depth(revs, info->min_generation);
+
+		for (list = revs->commits; list; list = list->next) {
+			struct commit *c = list->item;
+
+			if (*(indegree_slab_at(&info->indegree, c)) == 1)
+				prio_queue_put(&info->topo_queue, c);
+		}
+	}
 
 	if (trace2_is_enabled() && !topo_walk_atexit_registered) {
 		atexit(trace2_topo_walk_statistics_atexit);
@@ -3724,6 +3768,34 @@ static void init_topo_walk(struct rev_info *revs)
 	}
 }
 
+/*
+ * Return the next starting commit that has no children, once the
+ * indegrees are known down to its generation. A starting commit that
+ * has children is shown after them instead, when expand_topo_walk()
+ * finds it ready.
+ */
+static struct commit *next_topo_tip(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+
+	while (info->next_tip < info->tips_nr) {
+		struct commit *c = info->tips[info->next_tip++];
+		timestamp_t generation = commit_graph_generation(c);
+
+		/*
+		 * Without generation numbers, the first call walks it all
+		 * and the following ones have nothing left to do.
+		 */
+		if (generation < info->min_generation)
+			info->min_generation = generation;
+		compute_indegrees_to_depth(revs, info->min_generation);
+
+		if (*(indegree_slab_at(&info->indegree, c)) == 1)
+			return c;
+	}
+	return NULL;
+}
+
 static struct commit *next_topo_commit(struct rev_info *revs)
 {
 	struct commit *c;
@@ -3731,6 +3803,8 @@ static struct commit *next_topo_commit(struct rev_info *revs)
 
 	/* pop next off of topo_queue */
 	c = prio_queue_get(&info->topo_queue);
+	if (!c)
+		c = next_topo_tip(revs);
 
 	if (c)
 		*(indegree_slab_at(&info->indegree, c)) = 0;
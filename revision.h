@@ -62,7 +62,7 @@ struct repository;
 struct rev_info;
 struct string_list;
 struct saved_parents;
-struct bloom_key;
+struct bloom_keyvec;
 struct bloom_filter_settings;
 struct option;
 struct parse_opt_ctx_t;
@@ -115,6 +115,7 @@ struct ref_exclusions {
 	.hidden_refs = STRVEC_INIT, \
 }
 
+struct oidmap;
 struct oidset;
 struct topo_walk_info;
 
@@ -346,6 +347,8 @@ struct rev_info {
 
 	/* line level range that we are chasing */
 	struct decoration line_log_data;
+	/* parent blobs kept for the next commits, see line-log.c */
+	struct oidmap *line_log_blobs;
 
 	/* copies of the parent lists, for --full-diff display */
 	struct saved_parents *saved_parents_slab;
@@ -359,9 +362,12 @@ struct rev_info {
 	struct topo_walk_info *topo_walk_info;
 
 	/* Commit graph bloom filter fields */
-	/* The bloom filter key(s) for the pathspec */
-	struct bloom_key *bloom_keys;
-	int bloom_keys_nr;
+	/*
+	 * The bloom filter keys for the pathspec, one vector of keys
+	 * for each of its items.
+	 */
+	struct bloom_keyvec **bloom_keyvecs;
+	int bloom_keyvecs_nr;
 
 	/*
 	 * The bloom filter settings used to generate the key.
@@ -15,7 +15,12 @@
 #include "dir.h"
 #include "packfile.h"
 #include "help.h"
+#include "path.h"
+#include "read-cache-ll.h"
+#include "repository.h"
 #include "setup.h"
+#include "thread-utils.h"
+#include "trace.h"
 #include "trace2.h"
 
 static void setup_enlistment_directory(int argc, const char **argv,
@@ -116,6 +121,208 @@ static int have_fsmonitor_support(void)
 	       fsm_settings__get_reason(the_repository) == FSMONITOR_REASON_OK;
 }
 
+/*
+ * What the host and the worktree of an enlistment look like, as far as
+ * the settings picked by `scalar diagnose-perf` are concerned. It is
+ * recorded in the `scalar.perf.*` config of the enlistment.
+ */
+struct perf_profile {
+	int cpus;
+	int files;
+	unsigned long stat_ns;
+	int fsmonitor;
+	int dir_mtime;
+};
+
+/* an lstat() this slow means a network filesystem (or a very busy disk) */
+#define PERF_SLOW_STAT_NS 50000
+/* the number of index entries whose lstat() is timed */
+#define PERF_STAT_SAMPLES 2000
+/* below this many files, a parallel checkout is not worth its overhead */
+#define PERF_PARALLEL_CHECKOUT_FILES 2000
+
+static unsigned long time_lstat(struct index_state *istate)
+{
+	unsigned int i, nr = 0;
+	unsigned int step = istate->cache_nr / PERF_STAT_SAMPLES + 1;
+	uint64_t start = getnanotime();
+	struct stat st;
+
+	for (i = 0; i < istate->cache_nr; i += step) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_skip_worktree(ce) || S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+		lstat(ce->name, &st);
+		nr++;
+	}
+	return nr ? (getnanotime() - start) / nr : 0;
+}
+
+/*
+ * The untracked cache relies on the mtime of a directory changing when
+ * a file is created in it. Like `git update-index --test-untracked-cache`
+ * but without waiting for the clock to tick: set the mtime of a scratch
+ * directory back by an hour, create a file in it and see whether the
+ * mtime moved.
+ */
+static int probe_dir_mtime(void)
+{
+	char *dir = xstrdup(git_path("scalar-probe-XXXXXX"));
+	char *file;
+	struct utimbuf times;
+	struct stat st;
+	int fd, ret = 0;
+
+	if (!mkdtemp(dir)) {
+		free(dir);
+		return 0;
+	}
+	file = xstrfmt("%s/probe", dir);
+
+	times.actime = times.modtime = time(NULL) - 3600;
+	if (!utime(dir, &times) &&
+	    (fd = open(file, O_CREAT | O_EXCL | O_WRONLY, 0666)) >= 0) {
+		close(fd);
+		ret = !stat(dir, &st) && st.st_mtime > times.modtime;
+		unlink(file);
+	}
+	rmdir(dir);
+
+	free(file);
+	free(dir);
+	return ret;
+}
+
+static void measure_perf_profile(struct perf_profile *profile)
+{
+	struct index_state *istate = the_repository->index;
+
+	profile->cpus = online_cpus();
+	profile->fsmonitor = have_fsmonitor_support();
+	profile->dir_mtime = probe_dir_mtime();
+
+	if (repo_read_index(the_repository) < 0) {
+		profile->files = 0;
+		profile->stat_ns = 0;
+	} else {
+		profile->files = istate->cache_nr;
+		profile->stat_ns = time_lstat(istate);
+	}
+}
+
+static int read_perf_profile(struct perf_profile *profile)
+{
+	if (git_config_get_int("scalar.perf.cpus", &profile->cpus) ||
+	    git_config_get_int("scalar.perf.files", &profile->files) ||
+	    git_config_get_ulong("scalar.perf.statnanos", &profile->stat_ns) ||
+	    git_config_get_bool("scalar.perf.fsmonitor", &profile->fsmonitor) ||
+	    git_config_get_bool("scalar.perf.dirmtime", &profile->dir_mtime))
+		return -1;
+	return 0;
+}
+
+/*
+ * Whether the host or the worktree changed enough for the settings of
+ * the old profile to be off. The file count has to double or halve, and
+ * lstat() has to cross into or out of network filesystem territory, so
+ * that the noise of the timings does not flip the settings back and
+ * forth.
+ */
+static int perf_profile_changed(const struct perf_profile *old,
+				const struct perf_profile *new)
+{
+	return old->cpus != new->cpus ||
+	       new->files > 2 * (uint64_t)old->files ||
+	       old->files > 2 * (uint64_t)new->files ||
+	       (old->stat_ns >= PERF_SLOW_STAT_NS) !=
+			(new->stat_ns >= PERF_SLOW_STAT_NS) ||
+	       old->fsmonitor != new->fsmonitor ||
+	       old->dir_mtime != new->dir_mtime;
+}
+
+/*
+ * Pick the settings that match the profile and record the profile,
+ * optionally reporting every setting on stdout.
+ */
+static int apply_perf_profile(const struct perf_profile *profile, int report)
+{
+	int slow = profile->stat_ns >= PERF_SLOW_STAT_NS;
+	int workers = 1, untracked_cache = profile->dir_mtime;
+	struct scalar_config config[] = {
+		{ "core.preloadIndex", NULL, 1 },
+		{ "core.untrackedCache", NULL, 1 },
+		{ "checkout.workers", NULL, 1 },
+		{ "scalar.perf.cpus", NULL, 1 },
+		{ "scalar.perf.files", NULL, 1 },
+		{ "scalar.perf.statNanos", NULL, 1 },
+		{ "scalar.perf.fsmonitor", NULL, 1 },
+		{ "scalar.perf.dirMtime", NULL, 1 },
+		{ NULL, NULL },
+	};
+	char *values[ARRAY_SIZE(config)] = { NULL };
+	int i, res = 0;
+
+	/*
+	 * With a network filesystem, more workers than cores keep more
+	 * requests in flight; with a local one, they only compete.
+	 */
+	if (profile->files >= PERF_PARALLEL_CHECKOUT_FILES)
+		workers = slow ? 4 * profile->cpus : profile->cpus;
+#ifdef WIN32
+	/* see set_recommended_config() */
+	untracked_cache = 0;
+#endif
+
+	values[0] = xstrdup(profile->cpus > 1 || slow ? "true" : "false");
+	values[1] = xstrdup(untracked_cache ? "true" : "false");
+	values[2] = xstrfmt("%d", workers);
+	values[3] = xstrfmt("%d", profile->cpus);
+	values[4] = xstrfmt("%d", profile->files);
+	values[5] = xstrfmt("%lu", profile->stat_ns);
+	values[6] = xstrdup(profile->fsmonitor ? "true" : "false");
+	values[7] = xstrdup(profile->dir_mtime ? "true" : "false");
+
+	for (i = 0; config[i].key; i++) {
+		config[i].value = values[i];
+		if (set_scalar_config(config + i, 1)) {
+			res = error(_("could not configure %s=%s"),
+				    config[i].key, config[i].value);
+			break;
+		}
+		if (report)
+			printf("%s=%s\n", config[i].key, config[i].value);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(values); i++)
+		free(values[i]);
+	return res;
+}
+
+/*
+ * Keep the settings of a recorded profile across a reconfigure, and
+ * measure again if the host or the worktree may have changed a lot.
+ */
+static int reapply_perf_profile(void)
+{
+	struct perf_profile recorded, current;
+
+	if (read_perf_profile(&recorded))
+		return 0;
+
+	/* `reconfigure --all` sets up the repository without a worktree */
+	if (!the_repository->worktree)
+		return apply_perf_profile(&recorded, 0);
+
+	measure_perf_profile(&current);
+	if (perf_profile_changed(&recorded, &current)) {
+		trace2_data_string("scalar", the_repository, "perf-profile",
+				   "changed");
+		return apply_perf_profile(&current, 0);
+	}
+	return apply_perf_profile(&recorded, 0);
+}
+
 static int set_recommended_config(int reconfigure)
 {
 	struct scalar_config config[] = {
@@ -203,6 +410,9 @@ static int set_recommended_config(int reconfigure)
 		free(value);
 	}
 
+	if (reconfigure && reapply_perf_profile())
+		return error(_("could not apply the performance profile"));
+
 	return 0;
 }
 
@@ -573,6 +783,26 @@ static int cmd_diagnose(int argc, const char **argv)
 	return res;
 }
 
+static int cmd_diagnose_perf(int argc, const char **argv)
+{
+	struct option options[] = {
+		OPT_END(),
+	};
+	const char * const usage[] = {
+		N_("scalar diagnose-perf [<enlistment>]"),
+		NULL
+	};
+	struct perf_profile profile;
+
+	argc = parse_options(argc, argv, NULL, options,
+			     usage, 0);
+
+	setup_enlistment_directory(argc, argv, usage, options, NULL);
+
+	measure_perf_profile(&profile);
+	return apply_perf_profile(&profile, 1);
+}
+
 static int cmd_list(int argc, const char **argv UNUSED)
 {
 	if (argc != 1)
@@ -938,6 +1168,7 @@ static struct {
 	{ "help", cmd_help },
 	{ "version", cmd_version },
 	{ "diagnose", cmd_diagnose },
+	{ "diagnose-perf", cmd_diagnose_perf },
 	{ NULL, NULL},
 };
 
@@ -589,20 +589,15 @@ static void update_abort_safety_file(void)
 		write_file(git_path_abort_safety_file(), "%s", "");
 }
 
-static int fast_forward_to(struct repository *r,
-			   const struct object_id *to,
-			   const struct object_id *from,
-			   int unborn,
-			   struct replay_opts *opts)
+static int fast_forward_head(const struct object_id *to,
+			     const struct object_id *from,
+			     int unborn,
+			     struct replay_opts *opts)
 {
 	struct ref_transaction *transaction;
 	struct strbuf sb = STRBUF_INIT;
 	struct strbuf err = STRBUF_INIT;
 
-	repo_read_index(r);
-	if (checkout_fast_forward(r, from, to, 1))
-		return -1; /* the callee should have complained already */
-
 	strbuf_addf(&sb, "%s: fast-forward", action_name(opts));
 
 	transaction = ref_transaction_begin(&err);
@@ -622,6 +617,21 @@ static int fast_forward_to(struct repository *r,
 	strbuf_release(&sb);
 	strbuf_release(&err);
 	ref_transaction_free(transaction);
+	return 0;
+}
+
+static int fast_forward_to(struct repository *r,
+			   const struct object_id *to,
+			   const struct object_id *from,
+			   int unborn,
+			   struct replay_opts *opts)
+{
+	repo_read_index(r);
+	if (checkout_fast_forward(r, from, to, 1))
+		return -1; /* the callee should have complained already */
+
+	if (fast_forward_head(to, from, unborn, opts))
+		return -1;
 	update_abort_safety_file();
 	return 0;
 }
@@ -727,12 +737,9 @@ static int do_recursive_merge(struct repository *r,
 					    &result);
 		show_output = !is_rebase_i(opts) || !result.clean;
 		/*
-		 * TODO: merge_switch_to_result will update index/working tree;
-		 * we only really want to do that if !result.clean || this is
-		 * the final patch to be picked.  But determining this is the
-		 * final patch would take some work, and "head_tree" would need
-		 * to be replace with the tree the index matched before we
-		 * started doing any picks.
+		 * merge_switch_to_result will update index/working tree;
+		 * pick_commits_in_memory() avoids this for the runs of
+		 * picks of a rebase that apply cleanly.
 		 */
 		merge_switch_to_result(&o, head_tree, &result, 1, show_output);
 		clean = result.clean;
@@ -2416,7 +2423,8 @@ static int do_pick_commit(struct repository *r,
 		refs_delete_ref(get_main_ref_store(r), "", "CHERRY_PICK_HEAD",
 				NULL, 0);
 		unlink(git_path_merge_msg(r));
-		unlink(git_path_auto_merge(r));
+		refs_delete_ref(get_main_ref_store(r), "", "AUTO_MERGE",
+				NULL, REF_NO_DEREF);
 		fprintf(stderr,
 			_("dropping %s %s -- patch contents already upstream\n"),
 			oid_to_hex(&commit->object.oid), msg.subject);
@@ -2826,7 +2834,8 @@ void sequencer_post_commit_cleanup(struct repository *r, int verbose)
 		need_cleanup = 1;
 	}
 
-	unlink(git_path_auto_merge(r));
+	refs_delete_ref(get_main_ref_store(r), "", "AUTO_MERGE",
+			NULL, REF_NO_DEREF);
 
 	if (!need_cleanup)
 		return;
@@ -3417,6 +3426,24 @@ int sequencer_skip(struct repository *r, struct replay_opts *opts)
 	return -1;
 }
 
+/* Append the commands from "from" up to "to" to the "done" file. */
+static int append_to_done(struct todo_list *todo_list, int from, int to)
+{
+	const char *done = rebase_path_done();
+	int fd = open(done, O_CREAT | O_WRONLY | O_APPEND, 0666);
+	int ret = 0;
+
+	if (fd < 0)
+		return 0;
+	if (write_in_full(fd, get_item_line(todo_list, from),
+			  get_item_line_offset(todo_list, to) -
+			  get_item_line_offset(todo_list, from)) < 0)
+		ret = error_errno(_("could not write to '%s'"), done);
+	if (close(fd) < 0)
+		ret = error_errno(_("failed to finalize '%s'"), done);
+	return ret;
+}
+
 static int save_todo(struct todo_list *todo_list, struct replay_opts *opts,
 		     int reschedule)
 {
@@ -3441,21 +3468,8 @@ static int save_todo(struct todo_list *todo_list, struct replay_opts *opts,
 	if (commit_lock_file(&todo_lock) < 0)
 		return error(_("failed to finalize '%s'"), todo_path);
 
-	if (is_rebase_i(opts) && !reschedule && next > 0) {
-		const char *done = rebase_path_done();
-		int fd = open(done, O_CREAT | O_WRONLY | O_APPEND, 0666);
-		int ret = 0;
-
-		if (fd < 0)
-			return 0;
-		if (write_in_full(fd, get_item_line(todo_list, next - 1),
-				  get_item_line_length(todo_list, next - 1))
-		    < 0)
-			ret = error_errno(_("could not write to '%s'"), done);
-		if (close(fd) < 0)
-			ret = error_errno(_("failed to finalize '%s'"), done);
-		return ret;
-	}
+	if (is_rebase_i(opts) && !reschedule && next > 0)
+		return append_to_done(todo_list, next - 1, next);
 	return 0;
 }
 
@@ -4729,11 +4743,248 @@ static int pick_one_commit(struct repository *r,
 	return res;
 }
 
+/*
+ * A run of picks that apply cleanly is done in memory, the way "git
+ * replay" does it: each commit is merged and written without touching
+ * the index and the working tree, which are updated once, from the HEAD
+ * the run started at to its last commit, before HEAD is moved through
+ * the new commits.  Anything out of the ordinary, from a conflict to a
+ * pick that becomes empty, ends the run before that pick, which is then
+ * done as usual.
+ */
+struct in_memory_pick {
+	struct commit *result;
+	struct strbuf subject;
+	unsigned fast_forward : 1;
+};
+
+static int can_pick_in_memory(struct replay_opts *opts)
+{
+	return is_rebase_i(opts) &&
+		(!opts->strategy || !strcmp(opts->strategy, "ort")) &&
+		!opts->no_commit && !opts->signoff && !opts->record_origin &&
+		!opts->committer_date_is_author_date && !opts->ignore_date &&
+		!hook_exists("prepare-commit-msg") &&
+		!hook_exists("post-commit");
+}
+
+/*
+ * The attributes that drive a content merge are read from the working
+ * tree and the index, which a run does not update.
+ */
+static int changes_gitattributes(struct repository *r,
+				 struct commit *parent, struct commit *commit)
+{
+	const char *patterns[] = {
+		GITATTRIBUTES_FILE, "*/" GITATTRIBUTES_FILE, NULL
+	};
+	struct diff_options diffopt;
+	int ret;
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.flags.quick = 1;
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	parse_pathspec(&diffopt.pathspec, 0, 0, NULL, patterns);
+	diff_setup_done(&diffopt);
+	diff_tree_oid(get_commit_tree_oid(parent),
+		      get_commit_tree_oid(commit), "", &diffopt);
+	ret = diffopt.flags.has_changes;
+	diff_flush(&diffopt);
+	return ret;
+}
+
+/* Write the commit "item" becomes when it is picked onto "head". */
+static struct commit *pick_in_memory(struct repository *r,
+				     struct merge_options *o,
+				     struct merge_result *result,
+				     struct commit *head,
+				     struct todo_item *item,
+				     struct replay_opts *opts,
+				     struct strbuf *subject)
+{
+	struct commit *commit = item->commit, *parent;
+	struct commit_message msg = { NULL, NULL, NULL, NULL };
+	struct commit_list *parents = NULL;
+	struct strbuf msgbuf = STRBUF_INIT;
+	struct object_id oid;
+	char *author = NULL;
+	const char *p;
+	struct commit *ret = NULL;
+
+	parent = commit->parents->item;
+	if (get_message(commit, &msg))
+		return NULL;
+
+	o->ancestor = msg.parent_label;
+	o->branch2 = msg.label;
+	merge_incore_nonrecursive(o, repo_get_commit_tree(r, parent),
+				  repo_get_commit_tree(r, head),
+				  repo_get_commit_tree(r, commit), result);
+	o->ancestor = NULL;
+	if (result->clean <= 0 ||
+	    oideq(&result->tree->object.oid, get_commit_tree_oid(head)))
+		goto out;
+
+	if (find_commit_subject(msg.message, &p))
+		strbuf_addstr(&msgbuf, p);
+	if (opts->default_msg_cleanup != COMMIT_MSG_CLEANUP_NONE)
+		strbuf_stripspace(&msgbuf,
+		  opts->default_msg_cleanup == COMMIT_MSG_CLEANUP_ALL ?
+		  comment_line_char : '\0');
+	author = get_author(msg.message);
+	if (!author)
+		goto out;
+
+	reset_ident_date();
+	commit_list_insert(head, &parents);
+	if (commit_tree_extended(msgbuf.buf, msgbuf.len,
+				 &result->tree->object.oid, parents, &oid,
+				 author, NULL, opts->gpg_sign, NULL))
+		goto out;
+	ret = lookup_commit(r, &oid);
+	if (repo_parse_commit(r, ret)) {
+		ret = NULL;
+		goto out;
+	}
+	strbuf_add(subject, msgbuf.buf, strchrnul(msgbuf.buf, '\n') - msgbuf.buf);
+
+out:
+	free_message(commit, &msg);
+	strbuf_release(&msgbuf);
+	free(author);
+	return ret;
+}
+
+/*
+ * Do the picks from the current one on in memory. Returns the number of
+ * picks done, the last of which is now the current one, or 0 if the
+ * current pick has to be done as usual, in which case "*in_memory" is
+ * cleared if the following ones should not be tried in memory again.
+ */
+static int pick_commits_in_memory(struct repository *r,
+				  struct todo_list *todo_list,
+				  struct replay_opts *opts,
+				  int *in_memory)
+{
+	struct merge_options o;
+	struct merge_result result = { 0 };
+	struct in_memory_pick *picks = NULL;
+	size_t nr = 0, alloc = 0, i;
+	struct object_id orig_head;
+	struct commit *head, *prev;
+	int start = todo_list->current, ret = 0;
+
+	if (repo_get_oid(r, "HEAD", &orig_head) ||
+	    (opts->have_squash_onto &&
+	     oideq(&orig_head, &opts->squash_onto)) ||
+	    !(head = lookup_commit_reference(r, &orig_head)) ||
+	    index_differs_from(r, "HEAD", NULL, 0) ||
+	    has_unstaged_changes(r, 1))
+		return 0;
+
+	init_merge_options(&o, r);
+	o.branch1 = "HEAD";
+	o.show_rename_progress = 0;
+	for (i = 0; i < opts->xopts.nr; i++)
+		parse_merge_opt(&o, opts->xopts.v[i]);
+
+	for (i = start; i < todo_list->nr; i++) {
+		struct todo_item *item = todo_list->items + i;
+		struct commit *commit = item->commit, *next;
+		struct strbuf subject = STRBUF_INIT;
+		int fast_forward = 0;
+
+		if (item->command != TODO_PICK ||
+		    !commit->parents || commit->parents->next ||
+		    repo_parse_commit(r, commit->parents->item) ||
+		    changes_gitattributes(r, commit->parents->item, commit))
+			break;
+
+		if (opts->allow_ff &&
+		    oideq(&commit->parents->item->object.oid,
+			  &head->object.oid)) {
+			next = commit;
+			fast_forward = 1;
+		} else if (!(next = pick_in_memory(r, &o, &result, head, item,
+						   opts, &subject))) {
+			strbuf_release(&subject);
+			break;
+		}
+
+		ALLOC_GROW(picks, nr + 1, alloc);
+		picks[nr].result = next;
+		picks[nr].subject = subject;
+		picks[nr].fast_forward = fast_forward;
+		nr++;
+		head = next;
+
+		if (i > start) {
+			todo_list->done_nr++;
+			if (!opts->quiet)
+				fprintf(stderr, _("Rebasing (%d/%d)%s"),
+					todo_list->done_nr,
+					todo_list->total_nr,
+					opts->verbose ? "\n" : "\r");
+		}
+	}
+	merge_finalize(&o, &result);
+	clear_merge_options(&o);
+
+	if (!nr)
+		goto out;
+
+	repo_read_index(r);
+	if (checkout_fast_forward(r, &orig_head, &head->object.oid, 1)) {
+		/* Leave it to the usual picks to complain, one at a time. */
+		todo_list->done_nr -= nr - 1;
+		*in_memory = 0;
+		goto out;
+	}
+
+	prev = lookup_commit(r, &orig_head);
+	for (i = 0; i < nr; i++) {
+		struct commit *commit = todo_list->items[start + i].commit;
+		struct strbuf err = STRBUF_INIT;
+
+		todo_list->current = start + i;
+		if (picks[i].fast_forward) {
+			if (fast_forward_head(&picks[i].result->object.oid,
+					      &prev->object.oid, 0, opts))
+				ret = -1;
+		} else if (update_head_with_reflog(prev,
+						   &picks[i].result->object.oid,
+						   reflog_message(opts, "pick", NULL),
+						   &picks[i].subject, &err)) {
+			ret = error("%s", err.buf);
+		}
+		strbuf_release(&err);
+		if (ret)
+			goto out;
+		record_in_rewritten(&commit->object.oid,
+				    peek_command(todo_list, 1));
+		prev = picks[i].result;
+	}
+	update_abort_safety_file();
+	/* The loop in pick_commits() saved the first one. */
+	if (append_to_done(todo_list, start + 1, start + nr))
+		ret = -1;
+	else
+		ret = nr;
+
+out:
+	for (i = 0; i < nr; i++)
+		strbuf_release(&picks[i].subject);
+	free(picks);
+	return ret;
+}
+
 static int pick_commits(struct repository *r,
 			struct todo_list *todo_list,
 			struct replay_opts *opts)
 {
 	int res = 0, reschedule = 0;
+	int in_memory = can_pick_in_memory(opts);
 
 	opts->reflog_message = sequencer_reflog_action(opts);
 	if (opts->allow_ff)
@@ -4774,7 +5025,8 @@ static int pick_commits(struct repository *r,
 			}
 			unlink(rebase_path_author_script());
 			unlink(git_path_merge_head(r));
-			unlink(git_path_auto_merge(r));
+			refs_delete_ref(get_main_ref_store(r), "", "AUTO_MERGE",
+					NULL, REF_NO_DEREF);
 			delete_ref(NULL, "REBASE_HEAD", NULL, REF_NO_DEREF);
 
 			if (item->command == TODO_BREAK) {
@@ -4783,7 +5035,13 @@ static int pick_commits(struct repository *r,
 				return stopped_at_head(r);
 			}
 		}
-		if (item->command <= TODO_SQUASH) {
+		if (item->command == TODO_PICK && in_memory &&
+		    (res = pick_commits_in_memory(r, todo_list, opts,
+						  &in_memory))) {
+			if (res < 0)
+				return -1;
+			res = 0;
+		} else if (item->command <= TODO_SQUASH) {
 			res = pick_one_commit(r, todo_list, opts, &check_todo,
 					      &reschedule);
 			if (!res && item->command == TODO_EDIT)
@@ -5130,7 +5388,8 @@ static int commit_staged_changes(struct repository *r,
 		return error(_("could not commit staged changes."));
 	unlink(rebase_path_amend());
 	unlink(git_path_merge_head(r));
-	unlink(git_path_auto_merge(r));
+	refs_delete_ref(get_main_ref_store(r), "", "AUTO_MERGE",
+			NULL, REF_NO_DEREF);
 	if (final_fixup) {
 		unlink(rebase_path_fixup_msg());
 		unlink(rebase_path_squash_msg());
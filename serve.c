@@ -147,34 +147,32 @@ static struct protocol_capability capabilities[] = {
 
 void protocol_v2_advertise_capabilities(void)
 {
-	struct strbuf capability = STRBUF_INIT;
+	struct packet_writer writer;
 	struct strbuf value = STRBUF_INIT;
 	int i;
 
+	packet_writer_init(&writer, 1);
+	writer.buffered = 1;
+
 	/* serve by default supports v2 */
-	packet_write_fmt(1, "version 2\n");
+	packet_writer_write(&writer, "version 2\n");
 
 	for (i = 0; i < ARRAY_SIZE(capabilities); i++) {
 		struct protocol_capability *c = &capabilities[i];
 
 		if (c->advertise(the_repository, &value)) {
-			strbuf_addstr(&capability, c->name);
-
-			if (value.len) {
-				strbuf_addch(&capability, '=');
-				strbuf_addbuf(&capability, &value);
-			}
-
-			strbuf_addch(&capability, '\n');
-			packet_write(1, capability.buf, capability.len);
+			if (value.len)
+				packet_writer_write(&writer, "%s=%s\n",
+						    c->name, value.buf);
+			else
+				packet_writer_write(&writer, "%s\n", c->name);
 		}
 
-		strbuf_reset(&capability);
 		strbuf_reset(&value);
 	}
 
-	packet_flush(1);
-	strbuf_release(&capability);
+	packet_writer_flush(&writer);
+	packet_writer_release(&writer);
 	strbuf_release(&value);
 }
 
@@ -1,6 +1,18 @@
 #include "git-compat-util.h"
 #include "./sha256.h"
 
+/*
+ * Use the SHA extensions of x86 CPUs when the CPU we run on has them.
+ * The compiler only has to know the instructions; they are enabled
+ * per function, so the rest of Git is still built for the baseline.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(GIT_GNUC_PREREQ(4, 9) || defined(__clang__))
+#define SHA256_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 #undef RND
 #undef BLKSIZE
 
@@ -148,6 +160,121 @@ static void blk_SHA256_Transform(blk_SHA256_CTX *ctx, const unsigned char *buf)
 		ctx->state[i] += S[i];
 }
 
+#ifdef SHA256_SHANI
+static const uint32_t sha256_k[64] = {
+	0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul,
+	0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+	0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul,
+	0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+	0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul,
+	0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+	0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul,
+	0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+	0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul,
+	0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+	0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul,
+	0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+	0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul,
+	0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+	0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul,
+	0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+/*
+ * Two rounds are done by each sha256rnds2 instruction, which wants the
+ * state split into ABEF and CDGH. Each step below does four rounds with
+ * the message words in "m0", and then computes the words for the
+ * fourth step from now into "m0".
+ */
+#define SHANI_STEP(m0, m1, m2, m3, i) do { \
+	__m128i msg = _mm_add_epi32(m0, \
+		_mm_loadu_si128((const __m128i *)&sha256_k[4 * (i)])); \
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg); \
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, \
+				     _mm_shuffle_epi32(msg, 0x0e)); \
+	m0 = _mm_sha256msg2_epu32( \
+		_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), \
+			      _mm_alignr_epi8(m3, m2, 4)), \
+		m3); \
+} while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void blk_SHA256_Transform_shani(uint32_t *state,
+				       const unsigned char *buf, size_t nr)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i abef, cdgh, tmp;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]),
+				0xb1); /* CDAB */
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]),
+				 0x1b); /* EFGH */
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+	for (; nr; nr--, buf += 64) {
+		__m128i abef_save = abef, cdgh_save = cdgh;
+		__m128i m0, m1, m2, m3;
+		int i;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buf), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 48)), bswap);
+
+		for (i = 0; i < 16; i += 4) {
+			SHANI_STEP(m0, m1, m2, m3, i);
+			SHANI_STEP(m1, m2, m3, m0, i + 1);
+			SHANI_STEP(m2, m3, m0, m1, i + 2);
+			SHANI_STEP(m3, m0, m1, m2, i + 3);
+		}
+
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(abef, 0x1b); /* FEBA */
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1); /* DCHG */
+	_mm_storeu_si128((__m128i *)&state[0],
+			 _mm_blend_epi16(tmp, cdgh, 0xf0)); /* DCBA */
+	_mm_storeu_si128((__m128i *)&state[4],
+			 _mm_alignr_epi8(cdgh, tmp, 8)); /* HGFE */
+}
+
+#undef SHANI_STEP
+
+static int have_shani(void)
+{
+	static int have = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (have >= 0)
+		return have;
+
+	have = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+	    (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+	    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+	    (ebx & bit_SHA))
+		have = 1;
+	return have;
+}
+#endif
+
+static void blk_SHA256_Blocks(blk_SHA256_CTX *ctx, const unsigned char *buf,
+			      size_t nr)
+{
+#ifdef SHA256_SHANI
+	if (have_shani()) {
+		blk_SHA256_Transform_shani(ctx->state, buf, nr);
+		return;
+	}
+#endif
+	for (; nr; nr--, buf += 64)
+		blk_SHA256_Transform(ctx, buf);
+}
+
 void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
 {
 	unsigned int len_buf = ctx->size & 63;
@@ -165,12 +292,12 @@ void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
 		data = ((const char *)data + left);
 		if (len_buf)
 			return;
-		blk_SHA256_Transform(ctx, ctx->buf);
+		blk_SHA256_Blocks(ctx, ctx->buf, 1);
 	}
-	while (len >= 64) {
-		blk_SHA256_Transform(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		blk_SHA256_Blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~(size_t)63));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->buf, data, len);
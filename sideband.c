@@ -257,24 +257,34 @@ int demultiplex_sideband(const char *me, int status,
 void send_sideband(int fd, int band, const char *data, ssize_t sz, int packet_max)
 {
 	const char *p = data;
+	char *buf = NULL;
+
+	/*
+	 * Each packet goes out with its header in a single write(), which
+	 * saves a syscall and keeps the header from being sent on its own.
+	 */
+	if (sz)
+		buf = xmalloc(packet_max < sz + 5 ? packet_max : sz + 5);
 
 	while (sz) {
 		unsigned n;
-		char hdr[5];
+		int hdr_len;
 
 		n = sz;
 		if (packet_max - 5 < n)
 			n = packet_max - 5;
 		if (0 <= band) {
-			xsnprintf(hdr, sizeof(hdr), "%04x", n + 5);
-			hdr[4] = band;
-			write_or_die(fd, hdr, 5);
+			set_packet_header(buf, n + 5);
+			buf[4] = band;
+			hdr_len = 5;
 		} else {
-			xsnprintf(hdr, sizeof(hdr), "%04x", n + 4);
-			write_or_die(fd, hdr, 4);
+			set_packet_header(buf, n + 4);
+			hdr_len = 4;
 		}
-		write_or_die(fd, p, n);
+		memcpy(buf + hdr_len, p, n);
+		write_or_die(fd, buf, hdr_len + n);
 		p += n;
 		sz -= n;
 	}
+	free(buf);
 }
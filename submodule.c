@@ -31,6 +31,7 @@
 #include "read-cache-ll.h"
 #include "setup.h"
 #include "shallow.h"
+#include "tempfile.h"
 #include "trace2.h"
 
 static int config_update_recurse_submodules = RECURSE_SUBMODULES_OFF;
@@ -1878,14 +1879,15 @@ int fetch_submodules(struct repository *r,
 	return spf.result;
 }
 
-unsigned is_submodule_modified(const char *path, int ignore_untracked)
+/*
+ * Returns 1 if the submodule at "path" is checked out, 0 if it is not,
+ * and dies if its git directory is not a repository.
+ */
+static int submodule_is_checked_out(const char *path)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
 	struct strbuf buf = STRBUF_INIT;
-	FILE *fp;
-	unsigned dirty_submodule = 0;
 	const char *git_dir;
-	int ignore_cp_exit_code = 0;
+	int ret = 1;
 
 	strbuf_addf(&buf, "%s/.git", path);
 	git_dir = read_gitfile(buf.buf);
@@ -1894,52 +1896,83 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 	if (!is_git_directory(git_dir)) {
 		if (is_directory(git_dir))
 			die(_("'%s' not recognized as a git repository"), git_dir);
-		strbuf_release(&buf);
-		/* The submodule is not checked out, so it is not modified */
-		return 0;
+		ret = 0;
 	}
-	strbuf_reset(&buf);
+	strbuf_release(&buf);
+	return ret;
+}
 
-	strvec_pushl(&cp.args, "status", "--porcelain=2", NULL);
+static void prepare_submodule_status(struct child_process *cp,
+				     const char *path, int ignore_untracked)
+{
+	strvec_pushl(&cp->args, "status", "--porcelain=2", NULL);
 	if (ignore_untracked)
-		strvec_push(&cp.args, "-uno");
+		strvec_push(&cp->args, "-uno");
 
-	prepare_submodule_repo_env(&cp.env);
-	cp.git_cmd = 1;
-	cp.no_stdin = 1;
+	prepare_submodule_repo_env(&cp->env);
+	cp->git_cmd = 1;
+	cp->no_stdin = 1;
+	cp->dir = path;
+}
+
+/*
+ * Add what a line of "git status --porcelain=2" says about a submodule
+ * to "dirty_submodule". Returns 1 once nothing that the remaining lines
+ * could say would change the result.
+ */
+static int parse_submodule_status_line(const struct strbuf *buf,
+				       unsigned *dirty_submodule,
+				       int ignore_untracked)
+{
+	/* regular untracked files */
+	if (buf->buf[0] == '?')
+		*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+	if (buf->buf[0] == 'u' ||
+	    buf->buf[0] == '1' ||
+	    buf->buf[0] == '2') {
+		/* T = line type, XY = status, SSSS = submodule state */
+		if (buf->len < strlen("T XY SSSS"))
+			BUG("invalid status --porcelain=2 line %s",
+			    buf->buf);
+
+		if (buf->buf[5] == 'S' && buf->buf[8] == 'U')
+			/* nested untracked file */
+			*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+		if (buf->buf[0] == 'u' ||
+		    buf->buf[0] == '2' ||
+		    memcmp(buf->buf + 5, "S..U", 4))
+			/* other change */
+			*dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
+	}
+
+	return (*dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
+	       ((*dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
+		ignore_untracked);
+}
+
+unsigned is_submodule_modified(const char *path, int ignore_untracked)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	FILE *fp;
+	unsigned dirty_submodule = 0;
+	int ignore_cp_exit_code = 0;
+
+	if (!submodule_is_checked_out(path))
+		/* The submodule is not checked out, so it is not modified */
+		return 0;
+
+	prepare_submodule_status(&cp, path, ignore_untracked);
 	cp.out = -1;
-	cp.dir = path;
 	if (start_command(&cp))
 		die(_("Could not run 'git status --porcelain=2' in submodule %s"), path);
 
 	fp = xfdopen(cp.out, "r");
 	while (strbuf_getwholeline(&buf, fp, '\n') != EOF) {
-		/* regular untracked files */
-		if (buf.buf[0] == '?')
-			dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-		if (buf.buf[0] == 'u' ||
-		    buf.buf[0] == '1' ||
-		    buf.buf[0] == '2') {
-			/* T = line type, XY = status, SSSS = submodule state */
-			if (buf.len < strlen("T XY SSSS"))
-				BUG("invalid status --porcelain=2 line %s",
-				    buf.buf);
-
-			if (buf.buf[5] == 'S' && buf.buf[8] == 'U')
-				/* nested untracked file */
-				dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-			if (buf.buf[0] == 'u' ||
-			    buf.buf[0] == '2' ||
-			    memcmp(buf.buf + 5, "S..U", 4))
-				/* other change */
-				dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
-		}
-
-		if ((dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
-		    ((dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
-		     ignore_untracked)) {
+		if (parse_submodule_status_line(&buf, &dirty_submodule,
+						ignore_untracked)) {
 			/*
 			 * We're not interested in any further information from
 			 * the child any more, neither output nor its exit code.
@@ -1957,6 +1990,126 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 	return dirty_submodule;
 }
 
+struct submodule_parallel_status {
+	struct string_list *submodules;
+	size_t index;
+	int result;
+};
+
+struct submodule_status_task {
+	const char *path;
+	struct submodule_status_util *util;
+	struct tempfile *out;
+};
+
+static int get_next_submodule_status(struct child_process *cp,
+				     struct strbuf *err UNUSED,
+				     void *data, void **task_cb)
+{
+	struct submodule_parallel_status *sps = data;
+
+	while (sps->index < sps->submodules->nr) {
+		struct string_list_item *item =
+			&sps->submodules->items[sps->index++];
+		struct submodule_status_util *util = item->util;
+		struct submodule_status_task *task;
+
+		util->dirty_submodule = 0;
+		if (!submodule_is_checked_out(item->string))
+			continue;
+
+		/*
+		 * The output of the children is not ours to read when they
+		 * run in parallel, so it goes to a file each.
+		 */
+		CALLOC_ARRAY(task, 1);
+		task->path = item->string;
+		task->util = util;
+		task->out = mks_tempfile_t("git-submodule-status-XXXXXX");
+		if (!task->out)
+			die_errno(_("unable to create temporary file"));
+
+		child_process_init(cp);
+		prepare_submodule_status(cp, item->string,
+					 util->ignore_untracked);
+		cp->out = xdup(get_tempfile_fd(task->out));
+		*task_cb = task;
+		return 1;
+	}
+	return 0;
+}
+
+static void submodule_status_task_release(struct submodule_status_task *task)
+{
+	delete_tempfile(&task->out);
+	free(task);
+}
+
+static int submodule_status_start_failure(struct strbuf *err UNUSED,
+					  void *data, void *task_cb)
+{
+	struct submodule_parallel_status *sps = data;
+	struct submodule_status_task *task = task_cb;
+
+	error(_("Could not run 'git status --porcelain=2' in submodule %s"),
+	      task->path);
+	sps->result = 1;
+	submodule_status_task_release(task);
+	return 0;
+}
+
+static int submodule_status_finish(int retvalue, struct strbuf *err UNUSED,
+				   void *data, void *task_cb)
+{
+	struct submodule_parallel_status *sps = data;
+	struct submodule_status_task *task = task_cb;
+	struct strbuf buf = STRBUF_INIT;
+	int complete = 0;
+	FILE *fp;
+
+	fp = xfopen(get_tempfile_path(task->out), "r");
+	while (!complete && strbuf_getwholeline(&buf, fp, '\n') != EOF)
+		complete = parse_submodule_status_line(&buf,
+						       &task->util->dirty_submodule,
+						       task->util->ignore_untracked);
+	fclose(fp);
+	strbuf_release(&buf);
+
+	/* like is_submodule_modified(), which stops reading there */
+	if (retvalue && !complete) {
+		error(_("'git status --porcelain=2' failed in submodule %s"),
+		      task->path);
+		sps->result = 1;
+	}
+
+	submodule_status_task_release(task);
+	return 0;
+}
+
+int get_submodules_status(struct string_list *submodules,
+			  int max_parallel_jobs)
+{
+	struct submodule_parallel_status sps = {
+		.submodules = submodules,
+	};
+	const struct run_process_parallel_opts opts = {
+		.tr2_category = "submodule",
+		.tr2_label = "parallel/status",
+
+		.processes = max_parallel_jobs,
+		/* let the children write to stderr directly */
+		.ungroup = 1,
+
+		.get_next_task = get_next_submodule_status,
+		.start_failure = submodule_status_start_failure,
+		.task_finished = submodule_status_finish,
+		.data = &sps,
+	};
+
+	run_processes_parallel(&opts);
+	return sps.result;
+}
+
 int submodule_uses_gitfile(const char *path)
 {
 	struct child_process cp = CHILD_PROCESS_INIT;
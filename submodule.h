@@ -95,6 +95,22 @@ int fetch_submodules(struct repository *r,
 		     int default_option,
 		     int quiet, int max_parallel_jobs);
 unsigned is_submodule_modified(const char *path, int ignore_untracked);
+
+struct submodule_status_util {
+	/* input: like the argument of is_submodule_modified() */
+	int ignore_untracked;
+	/* output: like the return value of is_submodule_modified() */
+	unsigned dirty_submodule;
+};
+
+/*
+ * Like is_submodule_modified() for each item of "submodules", whose
+ * string is the path of a submodule and whose util points to a "struct
+ * submodule_status_util", but running up to "max_parallel_jobs" of
+ * them at a time. Returns non-zero if any of them failed.
+ */
+int get_submodules_status(struct string_list *submodules,
+			  int max_parallel_jobs);
 int submodule_uses_gitfile(const char *path);
 
 #define SUBMODULE_REMOVAL_DIE_ON_ERROR (1<<0)
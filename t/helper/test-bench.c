@@ -0,0 +1,459 @@
+#include "test-tool.h"
+#include "delta.h"
+#include "ewah/ewok.h"
+#include "hash-ll.h"
+#include "hashmap.h"
+#include "json-writer.h"
+#include "mem-pool.h"
+#include "oamap.h"
+#include "oidmap.h"
+#include "oidset.h"
+#include "parse-options.h"
+#include "prio-queue.h"
+#include "strbuf.h"
+#include "strmap.h"
+#include "trace.h"
+#include "xdiff-interface.h"
+
+/*
+ * Microbenchmarks of core data structures.  Each suite builds its
+ * input once, with "--size" items, and then times "--runs" runs of
+ * its workload after "--warmup" runs that are not timed.
+ */
+
+static const char * const bench_usage[] = {
+	"test-tool bench [--size=<n>] [--runs=<n>] [--warmup=<n>] [--json] <suite>...",
+	"test-tool bench --list",
+	NULL
+};
+
+struct bench_data {
+	size_t size;
+	struct object_id *oids;
+	char **strs;
+	unsigned int *ints;
+	struct strbuf a, b;
+	struct bitmap *bitmap_a, *bitmap_b;
+};
+
+/* A small LCG, so that the input is the same on every platform. */
+static unsigned int bench_rand(unsigned int *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 1;
+}
+
+static void setup_ints(struct bench_data *d)
+{
+	unsigned int state = 1;
+	size_t i;
+
+	ALLOC_ARRAY(d->ints, d->size);
+	for (i = 0; i < d->size; i++)
+		d->ints[i] = bench_rand(&state);
+}
+
+static void setup_oids(struct bench_data *d)
+{
+	const struct git_hash_algo *algo = &hash_algos[GIT_HASH_SHA1];
+	size_t i;
+
+	CALLOC_ARRAY(d->oids, d->size);
+	for (i = 0; i < d->size; i++) {
+		git_hash_ctx ctx;
+
+		algo->init_fn(&ctx);
+		algo->update_fn(&ctx, &i, sizeof(i));
+		algo->final_oid_fn(&d->oids[i], &ctx);
+	}
+}
+
+static void setup_strs(struct bench_data *d)
+{
+	size_t i;
+
+	ALLOC_ARRAY(d->strs, d->size);
+	for (i = 0; i < d->size; i++)
+		d->strs[i] = xstrfmt("refs/heads/topic/%"PRIuMAX, (uintmax_t)i);
+}
+
+/*
+ * Two texts of "--size" lines, in which every tenth line of the second
+ * one differs from the first one.
+ */
+static void setup_texts(struct bench_data *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->size; i++) {
+		strbuf_addf(&d->a, "line %"PRIuMAX" of the text\n", (uintmax_t)i);
+		if (i % 10)
+			strbuf_addf(&d->b, "line %"PRIuMAX" of the text\n",
+				    (uintmax_t)i);
+		else
+			strbuf_addf(&d->b, "line %"PRIuMAX" was changed\n",
+				    (uintmax_t)i);
+	}
+}
+
+/* A dense bitmap and a sparse one of "--size" bits. */
+static void setup_bitmaps(struct bench_data *d)
+{
+	unsigned int state = 1;
+	size_t i;
+
+	d->bitmap_a = bitmap_new();
+	d->bitmap_b = bitmap_new();
+	for (i = 0; i < d->size; i++) {
+		if (bench_rand(&state) % 4)
+			bitmap_set(d->bitmap_a, i);
+		if (!(bench_rand(&state) % 64))
+			bitmap_set(d->bitmap_b, i);
+	}
+}
+
+struct int_entry {
+	struct hashmap_entry ent;
+	unsigned int key;
+};
+
+static int int_entry_cmp(const void *cmp_data UNUSED,
+			 const struct hashmap_entry *eptr,
+			 const struct hashmap_entry *entry_or_key,
+			 const void *keydata UNUSED)
+{
+	const struct int_entry *a, *b;
+
+	a = container_of(eptr, const struct int_entry, ent);
+	b = container_of(entry_or_key, const struct int_entry, ent);
+	return a->key != b->key;
+}
+
+static void run_hashmap(struct bench_data *d)
+{
+	struct hashmap map = HASHMAP_INIT(int_entry_cmp, NULL);
+	struct int_entry *entries;
+	size_t i;
+
+	ALLOC_ARRAY(entries, d->size);
+	for (i = 0; i < d->size; i++) {
+		entries[i].key = d->ints[i];
+		hashmap_entry_init(&entries[i].ent, memhash(&d->ints[i],
+							    sizeof(unsigned int)));
+		hashmap_put(&map, &entries[i].ent);
+	}
+	for (i = 0; i < d->size; i++) {
+		struct int_entry key;
+
+		key.key = d->ints[i];
+		hashmap_entry_init(&key.ent, memhash(&key.key, sizeof(key.key)));
+		if (!hashmap_get(&map, &key.ent, NULL))
+			BUG("hashmap lost an entry");
+	}
+	hashmap_clear(&map);
+	free(entries);
+}
+
+static int int_key_cmp(const void *cmp_data UNUSED,
+		       const void *entry, const void *key)
+{
+	const struct int_entry *e = entry;
+
+	return e->key != *(const unsigned int *)key;
+}
+
+static void run_oamap(struct bench_data *d)
+{
+	struct oamap map = OAMAP_INIT(int_key_cmp, NULL);
+	struct int_entry *entries;
+	size_t i;
+
+	ALLOC_ARRAY(entries, d->size);
+	for (i = 0; i < d->size; i++) {
+		entries[i].key = d->ints[i];
+		oamap_add(&map, memhash(&d->ints[i], sizeof(unsigned int)),
+			  &entries[i]);
+	}
+	for (i = 0; i < d->size; i++) {
+		unsigned int key = d->ints[i];
+
+		if (!oamap_get(&map, memhash(&key, sizeof(key)), &key))
+			BUG("oamap lost an entry");
+	}
+	oamap_clear(&map);
+	free(entries);
+}
+
+static void run_strmap(struct bench_data *d)
+{
+	struct strmap map = STRMAP_INIT;
+	size_t i;
+
+	for (i = 0; i < d->size; i++)
+		strmap_put(&map, d->strs[i], d->strs[i]);
+	for (i = 0; i < d->size; i++)
+		if (!strmap_get(&map, d->strs[i]))
+			BUG("strmap lost an entry");
+	strmap_clear(&map, 0);
+}
+
+static void run_oidmap(struct bench_data *d)
+{
+	struct oidmap map = OIDMAP_INIT;
+	struct oidmap_entry *entries;
+	size_t i;
+
+	CALLOC_ARRAY(entries, d->size);
+	oidmap_init(&map, 0);
+	for (i = 0; i < d->size; i++) {
+		oidcpy(&entries[i].oid, &d->oids[i]);
+		oidmap_put(&map, &entries[i]);
+	}
+	for (i = 0; i < d->size; i++)
+		if (!oidmap_get(&map, &d->oids[i]))
+			BUG("oidmap lost an entry");
+	oidmap_free(&map, 0);
+	free(entries);
+}
+
+static void run_oidset(struct bench_data *d)
+{
+	struct oidset set = OIDSET_INIT;
+	size_t i;
+
+	for (i = 0; i < d->size; i++)
+		oidset_insert(&set, &d->oids[i]);
+	for (i = 0; i < d->size; i++)
+		if (!oidset_contains(&set, &d->oids[i]))
+			BUG("oidset lost an entry");
+	oidset_clear(&set);
+}
+
+static int int_cmp(const void *a_, const void *b_, void *data UNUSED)
+{
+	unsigned int a = *(const unsigned int *)a_;
+	unsigned int b = *(const unsigned int *)b_;
+	return a < b ? -1 : a > b;
+}
+
+static void run_prio_queue(struct bench_data *d)
+{
+	struct prio_queue queue = { int_cmp };
+	size_t i;
+
+	for (i = 0; i < d->size; i++)
+		prio_queue_put(&queue, &d->ints[i]);
+	while (prio_queue_get(&queue))
+		; /* nothing */
+	clear_prio_queue(&queue);
+}
+
+static void run_mem_pool(struct bench_data *d)
+{
+	struct mem_pool pool;
+	size_t i;
+
+	mem_pool_init(&pool, 0);
+	for (i = 0; i < d->size; i++)
+		mem_pool_alloc(&pool, 16 + d->ints[i] % 64);
+	mem_pool_discard(&pool, 0);
+}
+
+static void run_ewah(struct bench_data *d)
+{
+	struct ewah_bitmap *ewah = bitmap_to_ewah(d->bitmap_b);
+	struct bitmap *result = bitmap_dup(d->bitmap_a);
+
+	bitmap_or_ewah(result, ewah);
+	bitmap_and_not(result, d->bitmap_b);
+	if (bitmap_popcount(result) > d->size)
+		BUG("ewah set too many bits");
+	bitmap_free(result);
+	ewah_free(ewah);
+}
+
+static int count_line(void *data, char *line UNUSED, unsigned long len UNUSED)
+{
+	size_t *nr = data;
+	(*nr)++;
+	return 0;
+}
+
+static void run_xdiff(struct bench_data *d)
+{
+	mmfile_t a = { d->a.buf, d->a.len };
+	mmfile_t b = { d->b.buf, d->b.len };
+	xpparam_t xpp = { 0 };
+	xdemitconf_t xecfg = { 0 };
+	size_t nr = 0;
+
+	xecfg.ctxlen = 3;
+	if (xdi_diff_outf(&a, &b, NULL, count_line, &nr, &xpp, &xecfg) < 0)
+		BUG("xdiff failed");
+}
+
+static void run_delta(struct bench_data *d)
+{
+	unsigned long delta_size;
+	void *delta;
+
+	delta = diff_delta(d->a.buf, d->a.len, d->b.buf, d->b.len,
+			   &delta_size, 0);
+	if (!delta)
+		BUG("diff_delta failed");
+	free(delta);
+}
+
+static struct bench_suite {
+	const char *name;
+	void (*setup)(struct bench_data *);
+	void (*run)(struct bench_data *);
+} suites[] = {
+	{ "hashmap", setup_ints, run_hashmap },
+	{ "oamap", setup_ints, run_oamap },
+	{ "strmap", setup_strs, run_strmap },
+	{ "oidmap", setup_oids, run_oidmap },
+	{ "oidset", setup_oids, run_oidset },
+	{ "prio-queue", setup_ints, run_prio_queue },
+	{ "mem-pool", setup_ints, run_mem_pool },
+	{ "ewah", setup_bitmaps, run_ewah },
+	{ "xdiff", setup_texts, run_xdiff },
+	{ "delta", setup_texts, run_delta },
+};
+
+static void release_bench_data(struct bench_data *d)
+{
+	size_t i;
+
+	if (d->strs)
+		for (i = 0; i < d->size; i++)
+			free(d->strs[i]);
+	free(d->strs);
+	free(d->oids);
+	free(d->ints);
+	strbuf_release(&d->a);
+	strbuf_release(&d->b);
+	if (d->bitmap_a)
+		bitmap_free(d->bitmap_a);
+	if (d->bitmap_b)
+		bitmap_free(d->bitmap_b);
+}
+
+static int cmp_u64(const void *a_, const void *b_)
+{
+	uint64_t a = *(const uint64_t *)a_;
+	uint64_t b = *(const uint64_t *)b_;
+	return a < b ? -1 : a > b;
+}
+
+/* The nearest-rank percentile of sorted samples. */
+static uint64_t percentile(const uint64_t *ns, int nr, int p)
+{
+	int rank = (p * nr + 99) / 100;
+	return ns[rank ? rank - 1 : 0];
+}
+
+static void report(struct json_writer *jw, const struct bench_suite *suite,
+		   size_t size, uint64_t *ns, int runs)
+{
+	uint64_t total = 0;
+	int i;
+
+	QSORT(ns, runs, cmp_u64);
+	for (i = 0; i < runs; i++)
+		total += ns[i];
+
+	if (!jw) {
+		printf("%-12s size:%"PRIuMAX" runs:%d"
+		       " min:%.3f p50:%.3f p90:%.3f p99:%.3f max:%.3f mean:%.3f ms\n",
+		       suite->name, (uintmax_t)size, runs,
+		       ns[0] / 1e6, percentile(ns, runs, 50) / 1e6,
+		       percentile(ns, runs, 90) / 1e6,
+		       percentile(ns, runs, 99) / 1e6,
+		       ns[runs - 1] / 1e6, total / 1e6 / runs);
+		return;
+	}
+
+	jw_array_inline_begin_object(jw);
+	jw_object_string(jw, "suite", suite->name);
+	jw_object_intmax(jw, "size", size);
+	jw_object_intmax(jw, "runs", runs);
+	jw_object_intmax(jw, "min_ns", ns[0]);
+	jw_object_intmax(jw, "p50_ns", percentile(ns, runs, 50));
+	jw_object_intmax(jw, "p90_ns", percentile(ns, runs, 90));
+	jw_object_intmax(jw, "p99_ns", percentile(ns, runs, 99));
+	jw_object_intmax(jw, "max_ns", ns[runs - 1]);
+	jw_object_intmax(jw, "mean_ns", total / runs);
+	jw_end(jw);
+}
+
+static void run_suite(struct json_writer *jw, const struct bench_suite *suite,
+		      size_t size, int warmup, int runs)
+{
+	struct bench_data d = { .size = size, .a = STRBUF_INIT, .b = STRBUF_INIT };
+	uint64_t *ns;
+	int i;
+
+	suite->setup(&d);
+	for (i = 0; i < warmup; i++)
+		suite->run(&d);
+
+	ALLOC_ARRAY(ns, runs);
+	for (i = 0; i < runs; i++) {
+		uint64_t start = getnanotime();
+		suite->run(&d);
+		ns[i] = getnanotime() - start;
+	}
+
+	report(jw, suite, size, ns, runs);
+	free(ns);
+	release_bench_data(&d);
+}
+
+int cmd__bench(int argc, const char **argv)
+{
+	unsigned long size = 100000;
+	int runs = 10, warmup = 2, json = 0, list = 0;
+	struct json_writer jw = JSON_WRITER_INIT;
+	struct option options[] = {
+		OPT_MAGNITUDE(0, "size", &size, "number of items of each suite"),
+		OPT_INTEGER(0, "runs", &runs, "number of timed runs"),
+		OPT_INTEGER(0, "warmup", &warmup, "number of runs before timing"),
+		OPT_BOOL(0, "json", &json, "write the results as JSON"),
+		OPT_BOOL(0, "list", &list, "list the suites"),
+		OPT_END()
+	};
+	size_t i;
+	int j;
+
+	argc = parse_options(argc, argv, NULL, options, bench_usage, 0);
+	if (list) {
+		for (i = 0; i < ARRAY_SIZE(suites); i++)
+			printf("%s\n", suites[i].name);
+		return 0;
+	}
+	if (!argc || runs < 1 || warmup < 0 || !size)
+		usage_with_options(bench_usage, options);
+
+	for (j = 0; j < argc; j++) {
+		for (i = 0; i < ARRAY_SIZE(suites); i++)
+			if (!strcmp(argv[j], suites[i].name))
+				break;
+		if (i == ARRAY_SIZE(suites))
+			die("unknown suite '%s'", argv[j]);
+	}
+
+	if (json)
+		jw_array_begin(&jw, 1);
+	for (j = 0; j < argc; j++)
+		for (i = 0; i < ARRAY_SIZE(suites); i++)
+			if (!strcmp(argv[j], suites[i].name))
+				run_suite(json ? &jw : NULL, &suites[i],
+					  size, warmup, runs);
+	if (json) {
+		jw_end(&jw);
+		printf("%s\n", jw.json.buf);
+		jw_release(&jw);
+	}
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include "read-cache-ll.h"
 #include "repository.h"
 #include "setup.h"
+#include "strbuf.h"
 #include "trace.h"
 
 static int single;
@@ -15,6 +16,7 @@ static int dump;
 static int perf;
 static int analyze;
 static int analyze_step;
+static int lookup;
 
 /*
  * Dump the contents of the "dir" and "name" hash tables to stdout.
@@ -58,6 +60,35 @@ static void dump_run(void)
 	discard_index(&the_index);
 }
 
+/*
+ * Look up the paths read from stdin as files and as directories, and
+ * adjust the case of their leading directories, like a command running
+ * with core.ignoreCase does. With "single", the name hash is built in
+ * full first instead of being filled by the lookups.
+ */
+static void lookup_run(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	repo_read_index(the_repository);
+	if (single)
+		test_lazy_init_name_hash(&the_index, 0);
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		const struct cache_entry *ce;
+
+		ce = index_file_exists(&the_index, buf.buf, buf.len, 1);
+		printf("file %s %s\n", buf.buf, ce ? ce->name : "-");
+		printf("dir %s %d\n", buf.buf,
+		       index_dir_exists(&the_index, buf.buf, buf.len));
+		adjust_dirname_case(&the_index, buf.buf);
+		printf("case %s\n", buf.buf);
+	}
+
+	strbuf_release(&buf);
+	discard_index(&the_index);
+}
+
 /*
  * Run the single or multi threaded version "count" times and
  * report on the time taken.
@@ -195,6 +226,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		"test-tool lazy-init-name-hash -a a [--step s] [-c c]",
 		"test-tool lazy-init-name-hash (-s | -m) [-c c]",
 		"test-tool lazy-init-name-hash -s -m [-c c]",
+		"test-tool lazy-init-name-hash -l [-s]",
 		NULL
 	};
 	struct option options[] = {
@@ -205,6 +237,7 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 		OPT_BOOL('p', "perf", &perf, "compare single vs multi"),
 		OPT_INTEGER('a', "analyze", &analyze, "analyze different multi sizes"),
 		OPT_INTEGER(0, "step", &analyze_step, "analyze step factor"),
+		OPT_BOOL('l', "lookup", &lookup, "look up the paths on stdin"),
 		OPT_END(),
 	};
 	const char *prefix;
@@ -219,6 +252,13 @@ int cmd__lazy_init_name_hash(int argc, const char **argv)
 	 */
 	ignore_case = 1;
 
+	if (lookup) {
+		if (dump || perf || analyze > 0 || multi)
+			die("cannot combine lookup with dump, perf, analyze or multi");
+		lookup_run();
+		return 0;
+	}
+
 	if (dump) {
 		if (perf || analyze > 0)
 			die("cannot combine dump, perf, or analyze");
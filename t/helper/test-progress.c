@@ -8,6 +8,8 @@
  *                               if the " <title>" is omitted.
  *   "progress <items>" - Call display_progress() with the given item count
  *                        as parameter.
+ *   "add <items>" - Call progress_add() with the given item count as
+ *                   parameter.
  *   "throughput <bytes> <millis> - Call display_throughput() with the given
  *                                  byte count as parameter.  The 'millis'
  *                                  specify the time elapsed since the
@@ -70,6 +72,11 @@ int cmd__progress(int argc, const char **argv)
 			if (*end != '\0')
 				die("invalid input: '%s'\n", line.buf);
 			display_progress(progress, item_count);
+		} else if (skip_prefix(line.buf, "add ", (const char **) &end)) {
+			uint64_t item_count = strtoull(end, &end, 10);
+			if (*end != '\0')
+				die("invalid input: '%s'\n", line.buf);
+			progress_add(progress, item_count);
 		} else if (skip_prefix(line.buf, "throughput ",
 				       (const char **) &end)) {
 			uint64_t byte_count, test_ms;
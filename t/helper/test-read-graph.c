@@ -38,6 +38,12 @@ int cmd__read_graph(int argc UNUSED, const char **argv UNUSED)
 		printf(" generation_data");
 	if (graph->chunk_generation_data_overflow)
 		printf(" generation_data_overflow");
+	if (graph->chunk_first_parent_generation)
+		printf(" first_parent_generation");
+	if (graph->chunk_reachability)
+		printf(" reachability");
+	if (graph->chunk_rename_indexes)
+		printf(" renames");
 	if (graph->chunk_extra_edges)
 		printf(" extra_edges");
 	if (graph->chunk_bloom_indexes)
@@ -54,6 +60,8 @@ int cmd__read_graph(int argc UNUSED, const char **argv UNUSED)
 		       graph->bloom_filter_settings->num_hashes);
 	if (graph->read_generation_data)
 		printf(" read_generation_data");
+	if (graph->read_first_parent_generation)
+		printf(" read_first_parent_generation");
 	if (graph->topo_levels)
 		printf(" topo_levels");
 	printf("\n");
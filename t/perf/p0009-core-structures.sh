@@ -0,0 +1,17 @@
+#!/bin/sh
+
+test_description='Tests the performance of core data structures
+
+The timed runs of "test-tool bench" make up for the overhead of
+starting it, which would otherwise hide small regressions.'
+
+. ./perf-lib.sh
+
+for suite in $(test-tool bench --list)
+do
+	test_perf "bench $suite" "
+		test-tool bench --runs=10 --warmup=1 $suite
+	"
+done
+
+test_done
@@ -0,0 +1,35 @@
+#!/bin/sh
+
+test_description="Tests performance of starting up small commands"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+count=200
+
+test_expect_success 'setup a large config' '
+	for i in $(test_seq 300)
+	do
+		echo "[remote \"r$i\"]" &&
+		echo "	url = https://example.com/r$i.git" &&
+		echo "	fetch = +refs/heads/*:refs/remotes/r$i/*" || return 1
+	done >>"$(git rev-parse --git-path config)" &&
+	test-tool chmtime -3600 "$(git rev-parse --git-path config)"
+'
+
+test_perf "rev-parse HEAD $count times" "
+	for i in \$(test_seq $count)
+	do
+		git rev-parse HEAD >/dev/null || return 1
+	done
+"
+
+test_perf "cat-file -t HEAD $count times" "
+	for i in \$(test_seq $count)
+	do
+		git cat-file -t HEAD >/dev/null || return 1
+	done
+"
+
+test_done
@@ -9,4 +9,8 @@ test_perf 'cat-file --batch-check' '
 	git cat-file --batch-all-objects --batch-check
 '
 
+test_perf 'cat-file --batch-check="%(objectname)"' '
+	git cat-file --batch-all-objects --batch-check="%(objectname)"
+'
+
 test_done
@@ -54,4 +54,19 @@ test_perf 'log --color-moved-ws=allow-indentation-change' '
 		--no-merges --patch -n1000 $rev_b
 '
 
+test_expect_success 'setup moved blocks of common lines' '
+	for i in $(test_seq 5000)
+	do
+		printf "{\n\tfoo(%d);\n}\n\n" $i || return 1
+	done >blocks.old &&
+	awk "BEGIN { RS = \"\"; ORS = \"\\n\\n\" }
+	     { b[NR] = \$0 } END { for (i = NR; i > 0; i--) print b[i] }" \
+		blocks.old | sed -e "s/^./ &/" >blocks.new
+'
+
+test_perf 'diff --color-moved-ws=ignore-all-space with common lines' '
+	test_expect_code 1 git diff --no-index --color-moved=zebra \
+		--color-moved-ws=ignore-all-space blocks.old blocks.new
+'
+
 test_done
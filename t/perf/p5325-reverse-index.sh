@@ -0,0 +1,24 @@
+#!/bin/sh
+
+test_description='Tests reverse index performance'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'repack' '
+	git repack -ad &&
+	git rev-parse HEAD >tip
+'
+
+# Asking for the on-disk size of a single object makes the cost of
+# loading or building the reverse index dominate.
+test_perf 'build reverse index in memory' '
+	git -c pack.readReverseIndex=false cat-file \
+		--batch-check="%(objectsize:disk)" <tip
+'
+
+test_perf 'load reverse index from disk' '
+	git cat-file --batch-check="%(objectsize:disk)" <tip
+'
+
+test_done
@@ -0,0 +1,178 @@
+#!/bin/sh
+
+test_description='server performance under concurrent requests
+
+Each workload is run by several clients at once, each of which sends
+the same request to the server a number of times. Besides the time
+that all of them take, the throughput in requests per second and the
+99th percentile of the latency of a request in microseconds are
+reported.
+
+These can be tuned in the environment:
+
+  GIT_PERF_5552_CLIENTS    concurrent clients (default 8)
+  GIT_PERF_5552_REQUESTS   requests of each client (default 10)
+  GIT_PERF_5552_REFS       refs in the repository (default 10000)
+  GIT_PERF_5552_PUSH_REFS  refs updated by a push (default 1000)
+'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+clients=${GIT_PERF_5552_CLIENTS:-8}
+requests=${GIT_PERF_5552_REQUESTS:-10}
+nr_refs=${GIT_PERF_5552_REFS:-10000}
+nr_push_refs=${GIT_PERF_5552_PUSH_REFS:-1000}
+
+# run_clients <name> <command>...
+#
+# Run <command> $requests times in each of $clients background jobs.
+# Each run reads its request from "<name>-<client>.<n>" if there is
+# such a file, or from "<name>.req" otherwise. The latencies in
+# seconds are collected in "<name>.lat/" and the total time in
+# "<name>.elapsed".
+run_clients () {
+	name=$1 &&
+	shift &&
+	rm -rf "$name.lat" &&
+	mkdir "$name.lat" &&
+	start=$(test-tool date getnanos) &&
+	pids= &&
+	for c in $(test_seq $clients)
+	do
+		(
+			for r in $(test_seq $requests)
+			do
+				req="$name-$c.$((r % 2))" &&
+				if ! test -f "$req"
+				then
+					req="$name.req"
+				fi &&
+				t=$(test-tool date getnanos) &&
+				"$@" <"$req" >/dev/null &&
+				test-tool date getnanos $t >>"$name.lat/$c" ||
+				exit 1
+			done
+		) &
+		pids="$pids $!"
+	done &&
+	for pid in $pids
+	do
+		wait $pid || return 1
+	done &&
+	test-tool date getnanos $start >"$name.elapsed"
+}
+
+throughput () {
+	cat "$1".lat/* | wc -l >count &&
+	awk -v n=$(cat count) "{ printf \"%d\\n\", n / \$1 }" "$1.elapsed"
+}
+
+p99_latency_us () {
+	cat "$1".lat/* |
+	sort -n |
+	awk '{ v[NR] = $1 }
+	     END { i = int((99 * NR + 99) / 100); printf "%d\n", v[i] * 1000000 }'
+}
+
+test_expect_success 'setup refs and config' '
+	git config uploadpack.allowFilter true &&
+	git config uploadpack.allowAnySHA1InWant true &&
+	git config receive.denyCurrentBranch ignore &&
+	head=$(git rev-parse HEAD) &&
+	test_seq $nr_refs |
+	sed "s,.*,create refs/heads/bench/& $head," |
+	git update-ref --stdin &&
+	git pack-refs --all
+'
+
+test_expect_success 'setup requests' '
+	format=$(git rev-parse --show-object-format) &&
+	have=$(git rev-list --first-parent --max-count=100 HEAD | tail -n 1) &&
+	zero=$(test_oid zero) &&
+
+	test-tool pkt-line pack >ls-refs.req <<-EOF &&
+	command=ls-refs
+	object-format=$format
+	0001
+	peel
+	symrefs
+	ref-prefix HEAD
+	ref-prefix refs/heads/bench/1
+	0000
+	EOF
+
+	test-tool pkt-line pack >fetch.req <<-EOF &&
+	command=fetch
+	object-format=$format
+	0001
+	no-progress
+	want $head
+	have $have
+	done
+	0000
+	EOF
+
+	test-tool pkt-line pack >filter.req <<-EOF &&
+	command=fetch
+	object-format=$format
+	0001
+	no-progress
+	filter blob:none
+	want $head
+	done
+	0000
+	EOF
+
+	# Every client pushes to refs of its own. The odd requests create
+	# them and the even ones delete them, which needs no pack.
+	git pack-objects --stdout </dev/null >empty.pack &&
+	for c in $(test_seq $clients)
+	do
+		test_seq $nr_push_refs |
+		sed "s,.*,$zero $head refs/heads/push/$c/&," >cmds &&
+		{
+			test-tool pkt-line pack <cmds &&
+			test-tool pkt-line pack 0000 &&
+			cat empty.pack
+		} >push-$c.1 &&
+		test_seq $nr_push_refs |
+		sed "s,.*,$head $zero refs/heads/push/$c/&," >cmds &&
+		{
+			test-tool pkt-line pack <cmds &&
+			test-tool pkt-line pack 0000
+		} >push-$c.0 || return 1
+	done
+'
+
+test_perf 'ls-refs with prefixes' '
+	run_clients ls-refs test-tool serve-v2 --stateless-rpc
+'
+
+test_size 'ls-refs throughput' 'throughput ls-refs >&3'
+test_size 'ls-refs p99 latency' 'p99_latency_us ls-refs >&3'
+
+test_perf 'incremental fetch' '
+	run_clients fetch test-tool serve-v2 --stateless-rpc
+'
+
+test_size 'incremental fetch throughput' 'throughput fetch >&3'
+test_size 'incremental fetch p99 latency' 'p99_latency_us fetch >&3'
+
+test_perf 'partial clone without blobs' '
+	run_clients filter test-tool serve-v2 --stateless-rpc
+'
+
+test_size 'partial clone throughput' 'throughput filter >&3'
+test_size 'partial clone p99 latency' 'p99_latency_us filter >&3'
+
+test_perf 'push of many refs' \
+	--setup 'git for-each-ref --format="delete %(refname)" refs/heads/push/ |
+		 git update-ref --stdin' '
+	run_clients push git receive-pack --stateless-rpc .
+'
+
+test_size 'push throughput' 'throughput push >&3'
+test_size 'push p99 latency' 'p99_latency_us push >&3'
+
+test_done
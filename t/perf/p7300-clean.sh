@@ -28,8 +28,38 @@ test_perf 'clean many untracked sub dirs, ignore nested git' '
 	git clean -n -q -f -f -d 100000_sub_dirs/
 '
 
+test_perf 'clean many untracked sub dirs, ignore nested git, in threads' '
+	git -c clean.threads=0 clean -n -q -f -f -d 100000_sub_dirs/
+'
+
 test_perf 'ls-files -o' '
 	git ls-files -o
 '
 
+test_expect_success 'setup untracked directories to remove' '
+	for i in $(test_seq 1 200)
+	do
+		mkdir -p clean_test_dir/dir$i &&
+		for j in $(test_seq 1 50)
+		do
+			>clean_test_dir/dir$i/file$j || return $?
+		done
+	done &&
+	cp -r clean_test_dir clean_test_dir_orig
+'
+
+test_perf 'remove many untracked files' --setup '
+	rm -rf clean_test_dir &&
+	cp -r clean_test_dir_orig clean_test_dir
+' '
+	git clean -q -f -d clean_test_dir/
+'
+
+test_perf 'remove many untracked files in threads' --setup '
+	rm -rf clean_test_dir &&
+	cp -r clean_test_dir_orig clean_test_dir
+' '
+	git -c clean.threads=0 clean -q -f -d clean_test_dir/
+'
+
 test_done
@@ -308,6 +308,46 @@ EOF
 	test_must_be_empty err
 '
 
+test_expect_success 'last matching pattern wins across pattern kinds' '
+	cat >.gitattributes <<-\EOF &&
+	*.c foo=ext
+	Makefile foo=name
+	src/*.c foo=src
+	*.h foo=ext
+	m*.c foo=wild
+	src/lib/util.c foo=full
+	x.tar.gz foo=name
+	*.gz foo=ext
+	/docs/ foo=dir
+	EOF
+	cat >expect <<-\EOF &&
+	a.c: foo: ext
+	Makefile: foo: name
+	src/a.c: foo: src
+	src/main.c: foo: wild
+	src/lib/a.c: foo: ext
+	src/lib/util.c: foo: full
+	src/lib/Makefile: foo: name
+	a.h: foo: ext
+	x.tar.gz: foo: ext
+	y.tar: foo: unspecified
+	.c: foo: ext
+	c: foo: unspecified
+	docs: foo: unspecified
+	docs/: foo: dir
+	src/docs/: foo: unspecified
+	EOF
+	sed -e "s/:.*//" expect >paths &&
+	git check-attr --stdin foo <paths >actual &&
+	test_cmp expect actual &&
+	git -c core.ignorecase=true check-attr foo -- A.C SRC/lib/UTIL.C >actual &&
+	cat >expect <<-\EOF &&
+	A.C: foo: ext
+	SRC/lib/UTIL.C: foo: full
+	EOF
+	test_cmp expect actual
+'
+
 test_expect_success 'using --git-dir and --work-tree' '
 	mkdir unreal real &&
 	git init real &&
@@ -911,6 +911,120 @@ test_expect_success 'info/exclude trumps core.excludesfile' '
 	test_cmp expect actual
 '
 
+test_expect_success 'long ignore files keep the precedence of patterns' '
+	git init long &&
+	mkdir long/sub long/out &&
+	cat >long/.gitignore <<-\EOF &&
+	*.o
+	build
+	!keep.o
+	/out/
+	docs/*.html
+	*.tmp
+	!docs/index.html
+	x.tar.gz
+	*.gz
+	!Build
+	core
+	sub/deep/*.txt
+	f1
+	f2
+	f3
+	f4
+	EOF
+	cat >long/sub/.gitignore <<-\EOF &&
+	/lib/*.c
+	gen/out
+	*.c
+	!main.c
+	/lib/keep.c
+	g1
+	g2
+	g3
+	g4
+	g5
+	g6
+	g7
+	g8
+	g9
+	g10
+	g11
+	EOF
+	cat >paths <<-\EOF &&
+	a.o
+	keep.o
+	src/keep.o
+	build
+	src/build
+	out
+	out/
+	src/out/
+	docs/a.html
+	docs/index.html
+	src/docs/a.html
+	a.tmp
+	x.tar.gz
+	y.tar.gz
+	tar
+	.gz
+	core
+	Build
+	sub/deep/a.txt
+	sub/deep/more/a.txt
+	sub/lib/a.c
+	sub/lib/main.c
+	sub/lib/keep.c
+	sub/main.c
+	sub/x/lib/a.c
+	sub/gen/out
+	sub/x/gen/out
+	sub/g5
+	f4
+	EOF
+	q_to_tab >expect <<-\EOF &&
+	.gitignore:1:*.oQa.o
+	.gitignore:3:!keep.oQkeep.o
+	.gitignore:3:!keep.oQsrc/keep.o
+	.gitignore:2:buildQbuild
+	.gitignore:2:buildQsrc/build
+	.gitignore:4:/out/Qout
+	.gitignore:4:/out/Qout/
+	::Qsrc/out/
+	.gitignore:5:docs/*.htmlQdocs/a.html
+	.gitignore:7:!docs/index.htmlQdocs/index.html
+	::Qsrc/docs/a.html
+	.gitignore:6:*.tmpQa.tmp
+	.gitignore:9:*.gzQx.tar.gz
+	.gitignore:9:*.gzQy.tar.gz
+	::Qtar
+	.gitignore:9:*.gzQ.gz
+	.gitignore:11:coreQcore
+	.gitignore:10:!BuildQBuild
+	.gitignore:12:sub/deep/*.txtQsub/deep/a.txt
+	::Qsub/deep/more/a.txt
+	sub/.gitignore:3:*.cQsub/lib/a.c
+	sub/.gitignore:4:!main.cQsub/lib/main.c
+	sub/.gitignore:5:/lib/keep.cQsub/lib/keep.c
+	sub/.gitignore:4:!main.cQsub/main.c
+	sub/.gitignore:3:*.cQsub/x/lib/a.c
+	sub/.gitignore:2:gen/outQsub/gen/out
+	::Qsub/x/gen/out
+	sub/.gitignore:10:g5Qsub/g5
+	.gitignore:16:f4Qf4
+	EOF
+	git -C long check-ignore -v -n --no-index --stdin <paths >actual &&
+	test_cmp expect actual &&
+
+	git -C long -c core.ignorecase=true check-ignore -v -n --no-index \
+		A.O SUB/LIB/MAIN.C sub/lib/MAIN.C >actual &&
+	q_to_tab >expect <<-\EOF &&
+	.gitignore:1:*.oQA.O
+	::QSUB/LIB/MAIN.C
+	sub/.gitignore:4:!main.cQsub/lib/MAIN.C
+	EOF
+	test_cmp expect actual
+'
+
 test_expect_success SYMLINKS 'set up ignore file for symlink tests' '
 	echo "*" >ignore &&
 	rm -f .gitignore .git/info/exclude
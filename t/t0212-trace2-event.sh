@@ -323,6 +323,27 @@ test_expect_success 'discard traces when there are too many files' '
 	head -n2 trace_target_dir/git-trace2-discard | tail -n1 | grep \"event\":\"too_many_files\"
 '
 
+test_expect_success 'object layer emits timer and counter events' '
+	test_when_finished "rm -rf objects.repo trace.event" &&
+	git init objects.repo &&
+	test_seq 1000 >objects.repo/file &&
+	git -C objects.repo add file &&
+	git -C objects.repo commit -m one &&
+	test_seq 1001 >objects.repo/file &&
+	git -C objects.repo commit -a -m two &&
+	git -C objects.repo repack -adf &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C objects.repo log -p >/dev/null &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C objects.repo diff-index HEAD &&
+	grep "\"event\":\"timer\".*\"category\":\"pack\",\"name\":\"unpack-entry\"" trace.event &&
+	grep "\"event\":\"timer\".*\"category\":\"object\",\"name\":\"inflate\"" trace.event &&
+	grep "\"event\":\"timer\".*\"category\":\"index\",\"name\":\"read\"" trace.event &&
+	grep "\"event\":\"counter\".*\"category\":\"delta-base-cache\",\"name\":\"miss\"" trace.event &&
+	grep "\"event\":\"counter\".*\"category\":\"pack\",\"name\":\"mmap\",\"count\":1}" trace.event
+'
+
 # In the following "...redact..." tests, skip testing the GIT_TRACE2_REDACT=0
 # case because we would need to exactly model the full JSON event stream like
 # we did in the basic tests above and I do not think it is worth it.
@@ -0,0 +1,54 @@
+#!/bin/sh
+
+test_description='test trace2 facility (flame target)'
+
+. ./test-lib.sh
+
+# Turn off any inherited trace2 settings for this test.
+sane_unset GIT_TRACE2 GIT_TRACE2_PERF GIT_TRACE2_EVENT GIT_TRACE2_FLAME
+sane_unset GIT_TRACE2_CONFIG_PARAMS
+
+# Every line is "<frame>;<frame>;... <microseconds>".
+check_collapsed () {
+	! grep -v "^[^ ;][^ ]* [0-9][0-9]*$" "$1"
+}
+
+test_expect_success 'regions are written as collapsed stacks' '
+	test_when_finished "rm -f trace.flame" &&
+	test_commit one &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" git status >/dev/null &&
+	check_collapsed trace.flame &&
+	grep "^status;main " trace.flame &&
+	grep "^status;main;index:do_read_index " trace.flame &&
+	grep "^status;main;status:untracked;dir:read_directory " trace.flame
+'
+
+test_expect_success 'each process appends its own summary' '
+	test_when_finished "rm -f trace.flame" &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" git status >/dev/null &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" git status >/dev/null &&
+	check_collapsed trace.flame &&
+	grep -c "^status;main " trace.flame >actual &&
+	echo 2 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success PTHREADS 'threads with the same name share a stack' '
+	test_when_finished "rm -f trace.flame" &&
+	GIT_TRACE2_FLAME="$(pwd)/trace.flame" \
+		test-tool trace2 101timer 2 10 3 &&
+	check_collapsed trace.flame &&
+	grep "^trace2;ut_101 " trace.flame >threads &&
+	test_line_count = 1 threads &&
+	# three threads sleep for 20ms each
+	test $(sed -e "s/.* //" threads) -ge 60000
+'
+
+test_expect_success 'the target can be set in the global config' '
+	test_when_finished "rm -f trace.flame" &&
+	test_config_global trace2.flameTarget "$(pwd)/trace.flame" &&
+	git status >/dev/null &&
+	grep "^status;main " trace.flame
+'
+
+test_done
@@ -56,6 +56,28 @@ test_expect_success 'progress display with total' '
 	test_cmp expect out
 '
 
+test_expect_success 'progress_add() redraws only when the timer fires' '
+	cat >expect <<-\EOF &&
+	Working hard:   1% (10/1000)<CR>
+	Working hard:  51% (511/1000)<CR>
+	Working hard:  61% (611/1000), done.
+	EOF
+
+	cat >in <<-\EOF &&
+	start 1000
+	progress 10
+	add 500
+	update
+	add 1
+	add 100
+	stop
+	EOF
+	test-tool progress <in 2>stderr &&
+
+	show_cr <stderr >out &&
+	test_cmp expect out
+'
+
 test_expect_success 'progress display breaks long lines #1' '
 	sed -e "s/Z$//" >expect <<\EOF &&
 Working hard.......2.........3.........4.........5.........6:   0% (100/100000)<CR>
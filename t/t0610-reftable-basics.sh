@@ -0,0 +1,214 @@
+#!/bin/sh
+
+test_description='reftable basics'
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+INVALID_OID=$(test_oid 001)
+
+test_expect_success 'init: creates basic reftable structures' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	test_path_is_dir repo/.git/reftable &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo rev-parse --show-ref-format >actual &&
+	test_cmp expect actual &&
+	echo reftable >expect &&
+	git -C repo config extensions.refstorage >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: ref format via environment' '
+	test_when_finished "rm -rf repo" &&
+	GIT_DEFAULT_REF_FORMAT=reftable git init repo &&
+	echo reftable >expect &&
+	git -C repo rev-parse --show-ref-format >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init: unknown ref format is rejected' '
+	test_when_finished "rm -rf repo" &&
+	test_must_fail git init --ref-format=garbage repo 2>err &&
+	test_grep "unknown ref storage format ${SQ}garbage${SQ}" err &&
+	test_must_fail env GIT_DEFAULT_REF_FORMAT=garbage git init repo 2>err &&
+	test_grep "unknown ref storage format ${SQ}garbage${SQ}" err
+'
+
+test_expect_success 'init: reinit with a different format is rejected' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	git init --ref-format=reftable repo &&
+	test_must_fail git init --ref-format=files repo 2>err &&
+	test_grep "different reference storage format" err
+'
+
+test_expect_success 'invalid extensions.refstorage is rejected' '
+	test_when_finished "rm -rf repo" &&
+	git init --ref-format=reftable repo &&
+	git -C repo config extensions.refstorage garbage &&
+	test_must_fail git -C repo rev-parse --show-ref-format 2>err &&
+	test_grep "invalid value for ${SQ}extensions.refstorage${SQ}" err
+'
+
+test_expect_success 'setup' '
+	git init --ref-format=reftable repo &&
+	test_commit -C repo file &&
+	test_commit -C repo second
+'
+
+test_expect_success 'ref transaction: update, delete and verify' '
+	git -C repo update-ref refs/heads/topic HEAD~ &&
+	git -C repo rev-parse HEAD~ >expect &&
+	git -C repo rev-parse topic >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo update-ref refs/heads/topic HEAD $INVALID_OID 2>err &&
+	test_grep "cannot lock ref ${SQ}refs/heads/topic${SQ}" err &&
+	git -C repo update-ref -d refs/heads/topic &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/topic
+'
+
+test_expect_success 'ref transaction: D/F conflicts are rejected' '
+	test_must_fail git -C repo update-ref refs/heads/main/sub HEAD 2>err &&
+	test_grep "${SQ}refs/heads/main${SQ} exists; cannot create" err
+'
+
+test_expect_success 'ref transaction: multiple updates are atomic' '
+	cat >input <<-EOF &&
+	start
+	create refs/heads/one HEAD
+	create refs/heads/two HEAD
+	prepare
+	commit
+	EOF
+	git -C repo update-ref --stdin <input &&
+	git -C repo show-ref --verify refs/heads/one refs/heads/two &&
+	cat >input <<-EOF &&
+	start
+	create refs/heads/three HEAD
+	update refs/heads/one HEAD $INVALID_OID
+	prepare
+	EOF
+	test_must_fail git -C repo update-ref --stdin <input &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/three
+'
+
+test_expect_success 'ref transaction: waits for a locked stack' '
+	test_when_finished "rm -f repo/.git/reftable/tables.list.lock" &&
+	>repo/.git/reftable/tables.list.lock &&
+	test_must_fail git -C repo -c reftable.lockTimeout=0 \
+		update-ref refs/heads/locked HEAD 2>err &&
+	test_grep "cannot lock references" err &&
+	test_path_is_file repo/.git/reftable/tables.list.lock &&
+	{
+		( sleep 1 && rm -f repo/.git/reftable/tables.list.lock ) &
+	} &&
+	git -C repo -c reftable.lockTimeout=-1 \
+		update-ref refs/heads/locked HEAD &&
+	wait &&
+	git -C repo rev-parse --verify refs/heads/locked
+'
+
+test_expect_success 'symbolic refs' '
+	git -C repo symbolic-ref refs/heads/sym refs/heads/main &&
+	echo refs/heads/main >expect &&
+	git -C repo symbolic-ref refs/heads/sym >actual &&
+	test_cmp expect actual &&
+	git -C repo symbolic-ref -d refs/heads/sym &&
+	test_must_fail git -C repo symbolic-ref refs/heads/sym
+'
+
+test_expect_success 'peeled tags are reported' '
+	git -C repo tag -a -m annotated annotated HEAD &&
+	git -C repo rev-parse HEAD >expect &&
+	git -C repo show-ref -d annotated >out &&
+	grep "refs/tags/annotated^{}" out >actual.raw &&
+	cut -d" " -f1 actual.raw >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reflogs are written' '
+	git -C repo reflog show main >actual &&
+	test_line_count = 2 actual &&
+	git -C repo reflog exists refs/heads/main &&
+	test_must_fail git -C repo reflog exists refs/heads/nonexistent
+'
+
+test_expect_success 'branch rename and copy carry the reflog along' '
+	git -C repo branch renamed &&
+	git -C repo branch -m renamed moved &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/renamed &&
+	git -C repo reflog show moved >actual &&
+	test_grep "renamed refs/heads/renamed to refs/heads/moved" actual &&
+	git -C repo branch -c moved copied &&
+	git -C repo rev-parse moved copied &&
+	git -C repo reflog show copied >actual &&
+	test_grep "copied refs/heads/moved to refs/heads/copied" actual
+'
+
+test_expect_success 'reflog expire drops old entries' '
+	test_commit -C repo third &&
+	git -C repo reflog expire --expire=now refs/heads/main &&
+	git -C repo reflog show main >actual &&
+	test_must_be_empty actual &&
+	git -C repo rev-parse --verify main
+'
+
+test_expect_success 'pack-refs compacts the stack' '
+	test_line_count -gt 1 repo/.git/reftable/tables.list &&
+	git -C repo pack-refs &&
+	test_line_count = 1 repo/.git/reftable/tables.list &&
+	git -C repo show-ref --verify refs/heads/one
+'
+
+test_expect_success 'clone: honors --ref-format' '
+	test_when_finished "rm -rf clone" &&
+	git clone --ref-format=reftable repo clone &&
+	echo reftable >expect &&
+	git -C clone rev-parse --show-ref-format >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse main >expect &&
+	git -C clone rev-parse origin/main >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/main >expect &&
+	git -C clone symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone: reftable into files' '
+	test_when_finished "rm -rf clone" &&
+	git clone --ref-format=files repo clone &&
+	echo files >expect &&
+	git -C clone rev-parse --show-ref-format >actual &&
+	test_cmp expect actual &&
+	git -C clone show-ref --verify refs/remotes/origin/one
+'
+
+test_expect_success 'worktree: refs are per-worktree where needed' '
+	test_when_finished "rm -rf repo/wt && git -C repo worktree prune" &&
+	git -C repo worktree add -b wt-branch wt &&
+	test_path_is_dir repo/.git/worktrees/wt/reftable &&
+	echo refs/heads/wt-branch >expect &&
+	git -C repo/wt symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/main >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo/wt update-ref refs/bisect/wt HEAD &&
+	test_must_fail git -C repo rev-parse --verify refs/bisect/wt &&
+	git -C repo/wt update-ref refs/heads/shared HEAD &&
+	git -C repo rev-parse --verify refs/heads/shared
+'
+
+test_expect_success 'worktree: pseudorefs of the main worktree are visible' '
+	test_when_finished "rm -rf repo/wt && git -C repo worktree prune" &&
+	git -C repo worktree add wt &&
+	git -C repo update-ref refs/bisect/main HEAD &&
+	git -C repo rev-parse HEAD >expect &&
+	git -C repo/wt rev-parse main-worktree/refs/bisect/main >actual &&
+	test_cmp expect actual
+'
+
+test_done
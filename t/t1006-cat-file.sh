@@ -1201,4 +1201,56 @@ test_expect_success 'batch-command flush without --buffer' '
 	grep "^fatal:.*flush is only for --buffer mode.*" err
 '
 
+test_expect_success 'setup input for --batch-threads' '
+	git rev-list --objects --all >objects &&
+	{
+		cut -d" " -f1 objects &&
+		echo deadbeef &&
+		echo HEAD:does-not-exist &&
+		git rev-list --all | sed "s/$/:/" &&
+		cut -d" " -f1 objects
+	} >threads-in
+'
+
+for opts in "--batch" "--batch-check" "--batch --buffer"
+do
+	test_expect_success "--batch-threads output matches ($opts)" '
+		git cat-file $opts <threads-in >expect &&
+		git cat-file --batch-threads=4 $opts <threads-in >actual &&
+		test_cmp expect actual &&
+		git cat-file --batch-threads=0 $opts <threads-in >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success '--batch-threads output matches with custom format' '
+	format="%(objectname) %(objectsize:disk) %(deltabase) %(rest)" &&
+	sed "s/$/ rest of line/" threads-in >threads-in-rest &&
+	git cat-file --batch="$format" <threads-in-rest >expect &&
+	git cat-file --batch="$format" --batch-threads=4 \
+		<threads-in-rest >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-threads with -Z' '
+	tr "\n" "\0" <threads-in >threads-in-nul &&
+	git cat-file --batch -Z <threads-in-nul >expect &&
+	git cat-file --batch --batch-threads=3 -Z <threads-in-nul >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-threads incompatible options' '
+	test_must_fail git cat-file --batch-threads=2 -p HEAD 2>err &&
+	test_grep "requires a batch mode" err &&
+	test_must_fail git cat-file --batch-command --batch-threads=2 \
+		</dev/null 2>err &&
+	test_grep "cannot be used together" err &&
+	test_must_fail git cat-file --batch --batch-all-objects \
+		--batch-threads=2 2>err &&
+	test_grep "cannot be used together" err &&
+	test_must_fail git cat-file --batch --batch-threads=-1 \
+		</dev/null 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 test_done
@@ -31,6 +31,20 @@ test_expect_success 'enter "large" codepath, with small core.bigFileThreshold' '
 	git -C repo -c core.bigfilethreshold=4 fsck
 '
 
+test_expect_success 'hash-object -w --stdin streams large input from a pipe' '
+	test_when_finished "rm -rf repo" &&
+
+	git init --bare repo &&
+	cat huge | git -C repo hash-object -w --stdin >actual &&
+	git hash-object huge >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing repo/objects/$(test_oid_to_path $(cat actual)) &&
+	test_path_is_missing repo/objects/tmp_stdin_* &&
+	ls repo/objects/pack/pack-*.pack &&
+	git -C repo cat-file blob $(cat actual) >blob &&
+	test_cmp huge blob
+'
+
 # add a large file with different settings
 while read expect config
 do
@@ -1516,6 +1516,10 @@ test_expect_success 'sparse-index is not expanded: stash' '
 		ensure_not_expanded stash pop
 	) &&
 
+	echo >>sparse-index/deep/a &&
+	ensure_not_expanded stash push -- deep/a &&
+	ensure_not_expanded stash pop &&
+
 	ensure_not_expanded stash create &&
 	oid=$(git -C sparse-index stash create) &&
 	ensure_not_expanded stash store -m "test" $oid &&
@@ -1940,6 +1944,43 @@ test_expect_success 'mv directory from out-of-cone to in-cone' '
 	grep -e "H deep/0/1" actual
 '
 
+test_expect_success 'sparse index is not expanded: mv' '
+	init_repos &&
+
+	ensure_not_expanded mv deep/a deep/moved-a &&
+	ensure_not_expanded mv a deep/moved-root-a &&
+	ensure_not_expanded mv deep/deeper1 deep/moved-deeper1 &&
+	ensure_not_expanded mv -k deep/deeper2 folder1 &&
+
+	# moving a sparse directory moves the files in it
+	git -C sparse-index reset --hard &&
+	ensure_expanded mv --sparse folder1 deep
+'
+
+test_expect_success 'apply and am' '
+	init_repos &&
+
+	git -C full-checkout format-patch --stdout -1 update-deep >deep.patch &&
+	run_on_all git reset --hard base &&
+	test_all_match git apply --index ../deep.patch &&
+	test_all_match git status --porcelain=v2 &&
+
+	run_on_all git reset --hard base &&
+	test_all_match git am ../deep.patch &&
+	test_all_match git log -1 --format=%s &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'sparse index is not expanded: apply and am' '
+	init_repos &&
+
+	git -C sparse-index format-patch --stdout -1 update-deep >deep.patch &&
+	git -C sparse-index reset --hard base &&
+	ensure_not_expanded apply --index ../deep.patch &&
+	git -C sparse-index reset --hard base &&
+	ensure_not_expanded am ../deep.patch
+'
+
 test_expect_success 'rm pathspec inside sparse definition' '
 	init_repos &&
 
@@ -2222,6 +2263,28 @@ test_expect_success 'sparse-index is not expanded: diff-tree' '
 	ensure_not_expanded diff-tree HEAD update-folder1 -- folder1/a
 '
 
+test_expect_success 'diff-index' '
+	init_repos &&
+
+	test_all_match git diff-index HEAD &&
+	test_all_match git diff-index --cached update-deep &&
+	test_all_match git diff-index --cached update-folder1 &&
+	test_all_match git diff-index --cached update-folder1 -- folder1/a &&
+
+	run_on_all ../edit-contents deep/a &&
+	test_all_match git diff-index HEAD &&
+	test_all_match git diff-index -p HEAD -- deep/a
+'
+
+test_expect_success 'sparse-index is not expanded: diff-index' '
+	init_repos &&
+
+	ensure_not_expanded diff-index HEAD &&
+	ensure_not_expanded diff-index --cached update-deep &&
+	ensure_not_expanded diff-index --cached update-folder1 &&
+	ensure_not_expanded diff-index --cached HEAD -- deep/a
+'
+
 test_expect_success 'worktree' '
 	init_repos &&
 
@@ -397,4 +397,24 @@ test_expect_success 'iteration shows correct origins' '
 	test_cmp expect actual
 '
 
+test_expect_success 'iteration of an unchanged config file keeps origins' '
+	cat >.git/config <<-\EOF &&
+	[core]
+		repositoryformatversion = 0
+	[foo]
+		bar = one
+	[include]
+		path = included
+	[foo]
+		bar = two
+	EOF
+	printf "[foo]\n\tbar = from-include\n" >.git/included &&
+	test-tool config iterate >expect &&
+	test-tool chmtime -3600 .git/config .git/included &&
+	test-tool config iterate >actual &&
+	test_cmp expect actual &&
+	test-tool config iterate >actual &&
+	test_cmp expect actual
+'
+
 test_done
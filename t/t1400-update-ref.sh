@@ -1648,4 +1648,64 @@ test_expect_success REFFILES 'directory not created deleting packed ref' '
 	test_path_is_missing .git/refs/heads/d1
 '
 
+test_expect_success REFFILES 'large transactions write new values to packed-refs' '
+	test_when_finished "rm -f input" &&
+	git update-ref refs/heads/bulk-loose $A &&
+	{
+		echo "update refs/heads/bulk-loose $B" &&
+		for i in $(test_seq 1000)
+		do
+			echo "create refs/heads/bulk/$i $A" || return 1
+		done
+	} >input &&
+	git update-ref --stdin <input &&
+	test_path_is_missing .git/refs/heads/bulk &&
+	grep "^$A refs/heads/bulk/1000\$" .git/packed-refs &&
+	test_path_is_file .git/refs/heads/bulk-loose &&
+	test $B = $(git rev-parse refs/heads/bulk-loose) &&
+	test $A = $(git rev-parse refs/heads/bulk/7) &&
+	git reflog exists refs/heads/bulk/7 &&
+
+	for i in $(test_seq 1000)
+	do
+		echo "update refs/heads/bulk/$i $B $A" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	test_path_is_missing .git/refs/heads/bulk &&
+	test $B = $(git rev-parse refs/heads/bulk/7) &&
+	git reflog show refs/heads/bulk/7 >reflog &&
+	test_line_count = 2 reflog
+'
+
+test_expect_success REFFILES 'large transactions check values written to packed-refs' '
+	test_when_finished "rm -f input" &&
+	{
+		for i in $(test_seq 999)
+		do
+			echo "update refs/heads/bulk/$i $A $B" || return 1
+		done &&
+		echo "update refs/heads/bulk/1000 $A $A"
+	} >input &&
+	test_must_fail git update-ref --stdin <input 2>err &&
+	test_grep "is at $B but expected $A" err &&
+	test $B = $(git rev-parse refs/heads/bulk/7) &&
+	test_path_is_missing .git/packed-refs.lock &&
+
+	for i in $(test_seq 1000)
+	do
+		echo "update refs/heads/bulk/$i $(test_oid 001)" || return 1
+	done >input &&
+	test_must_fail git update-ref --stdin <input 2>err &&
+	test_grep "nonexistent object" err &&
+	test $B = $(git rev-parse refs/heads/bulk/1000) &&
+
+	for i in $(test_seq 1000)
+	do
+		echo "delete refs/heads/bulk/$i" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	test_must_fail git rev-parse --verify refs/heads/bulk/7 &&
+	test_must_fail git reflog exists refs/heads/bulk/7
+'
+
 test_done
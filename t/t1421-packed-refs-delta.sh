@@ -0,0 +1,120 @@
+#!/bin/sh
+
+test_description='updating packed refs through packed-refs.delta'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+if ! test_have_prereq REFFILES
+then
+	skip_all='skipping packed-refs tests; not using the files backend'
+	test_done
+fi
+
+# Add an identifying mark to the packed-refs file header line, which
+# goes away if the file is ever rewritten.
+mark_packed_refs () {
+	sed -e "s/^\(#.*\)/\1 t1421 /" .git/packed-refs >.git/packed-refs.new &&
+	mv .git/packed-refs.new .git/packed-refs
+}
+
+check_packed_refs_marked () {
+	grep -q "^#.* t1421 " .git/packed-refs
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated one &&
+	for i in $(test_seq 100)
+	do
+		echo "create refs/heads/branch-$i HEAD" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	git pack-refs --all &&
+	git config core.packedRefsDelta true &&
+	git for-each-ref >refs.before &&
+	mark_packed_refs
+'
+
+test_expect_success 'deleting a packed ref writes a tombstone' '
+	git branch -D branch-1 &&
+	check_packed_refs_marked &&
+	test_path_is_file .git/packed-refs.delta &&
+	grep "^$ZERO_OID refs/heads/branch-1\$" .git/packed-refs.delta &&
+	test_must_fail git rev-parse --verify refs/heads/branch-1 &&
+	test_must_fail git show-ref --verify refs/heads/branch-1 &&
+	grep -v "refs/heads/branch-1\$" refs.before >expect &&
+	git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'updates in the delta are visible to iteration' '
+	git update-ref -d refs/heads/branch-3 &&
+	git update-ref refs/heads/branch-4 HEAD^ &&
+	check_packed_refs_marked &&
+	git for-each-ref --format="%(objectname) %(refname)" \
+		refs/heads/branch-4 refs/heads/branch-3 >actual &&
+	echo "$(git rev-parse HEAD^) refs/heads/branch-4" >expect &&
+	test_cmp expect actual &&
+	git for-each-ref refs/heads/ >heads &&
+	test_line_count = 99 heads &&
+	git show-ref -d annotated >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'checks of old values see the delta' '
+	test_must_fail git update-ref -d refs/heads/branch-4 HEAD 2>err &&
+	test_grep "is at $(git rev-parse HEAD^) but expected" err &&
+	test_must_fail git update-ref refs/heads/branch-1 HEAD HEAD 2>err &&
+	test_grep "unable to resolve reference" err &&
+	git update-ref -d refs/heads/branch-4 HEAD^ &&
+	check_packed_refs_marked &&
+	test_must_fail git rev-parse --verify refs/heads/branch-4
+'
+
+test_expect_success 'pack-refs folds the delta into packed-refs' '
+	git for-each-ref >expect &&
+	git pack-refs --all &&
+	test_path_is_missing .git/packed-refs.delta &&
+	! check_packed_refs_marked &&
+	! grep " refs/heads/branch-1\$" .git/packed-refs &&
+	git for-each-ref >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a delta that grows too large is folded' '
+	mark_packed_refs &&
+	for i in $(test_seq 5 100)
+	do
+		echo "delete refs/heads/branch-$i" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	test_path_is_missing .git/packed-refs.delta &&
+	! check_packed_refs_marked &&
+	git for-each-ref refs/heads/ >heads &&
+	test_line_count = 2 heads
+'
+
+test_expect_success 'the delta is honored without the config' '
+	for i in $(test_seq 100)
+	do
+		echo "create refs/tags/tag-$i HEAD" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	git pack-refs --all &&
+	mark_packed_refs &&
+	git tag -d tag-1 &&
+	check_packed_refs_marked &&
+	git -c core.packedRefsDelta=false for-each-ref "refs/tags/tag-*" >tags &&
+	test_line_count = 99 tags &&
+	git -c core.packedRefsDelta=false tag -d tag-2 &&
+	test_path_is_missing .git/packed-refs.delta &&
+	git for-each-ref "refs/tags/tag-*" >tags &&
+	test_line_count = 98 tags
+'
+
+test_done
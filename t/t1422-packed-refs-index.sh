@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='looking up packed refs through packed-refs.idx'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+if ! test_have_prereq REFFILES
+then
+	skip_all='skipping packed-refs tests; not using the files backend'
+	test_done
+fi
+
+# Run the same queries with and without the index, which must agree.
+check_queries () {
+	for args in "for-each-ref" \
+		    "for-each-ref refs/heads/" \
+		    "for-each-ref refs/pull/12/" \
+		    "for-each-ref refs/pull/1" \
+		    "for-each-ref refs/tags/ refs/heads/b" \
+		    "for-each-ref --exclude=refs/pull/ --exclude=refs/heads/a" \
+		    "for-each-ref refs/nothing/" \
+		    "show-ref --verify refs/heads/a-7 refs/pull/30/head" \
+		    "show-ref --verify refs/heads/a-70" \
+		    "rev-parse --verify refs/tags/v1^{commit}" \
+		    "rev-parse --verify refs/pull/99/merge" \
+		    "show-ref --exists refs/heads/zzz"
+	do
+		test_might_fail git $args >actual 2>&1 &&
+		mv .git/packed-refs.idx idx.save &&
+		test_might_fail git $args >expect 2>&1 &&
+		mv idx.save .git/packed-refs.idx &&
+		test_cmp expect actual || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	git tag -a -m v1 v1 &&
+	{
+		for i in $(test_seq 100)
+		do
+			echo "create refs/heads/a-$i HEAD" &&
+			echo "create refs/heads/b-$i HEAD" &&
+			echo "create refs/pull/$i/head HEAD" &&
+			echo "create refs/pull/$i/merge HEAD" || return 1
+		done
+	} >input &&
+	git update-ref --stdin <input &&
+	git config core.packedRefsIndex true &&
+	git pack-refs --all
+'
+
+test_expect_success 'pack-refs writes the index' '
+	test_path_is_file .git/packed-refs.idx
+'
+
+test_expect_success 'lookups with the index agree with the ones without' '
+	check_queries
+'
+
+test_expect_success 'rewriting packed-refs rewrites the index' '
+	git update-ref -d refs/pull/30/head &&
+	git branch -D a-7 &&
+	test_path_is_file .git/packed-refs.idx &&
+	check_queries
+'
+
+test_expect_success 'a stale index is ignored' '
+	cp .git/packed-refs.idx idx.old &&
+	git update-ref -d refs/heads/b-50 &&
+	mv idx.old .git/packed-refs.idx &&
+	test_must_fail git rev-parse --verify refs/heads/b-50 &&
+	git for-each-ref refs/heads/b-50 >actual &&
+	test_line_count = 0 actual &&
+	git for-each-ref "refs/heads/b-5*" >actual &&
+	test_line_count = 10 actual
+'
+
+test_expect_success 'a truncated index is ignored' '
+	git pack-refs --all &&
+	test_copy_bytes 100 <.git/packed-refs.idx >idx.short &&
+	mv idx.short .git/packed-refs.idx &&
+	git show-ref --verify refs/heads/a-1 &&
+	git for-each-ref refs/pull/3/ >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'the index is removed without the config' '
+	git pack-refs --all &&
+	test_path_is_file .git/packed-refs.idx &&
+	git -c core.packedRefsIndex=false pack-refs --all &&
+	test_path_is_missing .git/packed-refs.idx
+'
+
+test_done
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+test_description='reading loose refs on multiple threads'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+if ! test_have_prereq REFFILES
+then
+	skip_all='skipping loose ref tests; not using the files backend'
+	test_done
+fi
+
+# Run the same command reading loose refs serially and on threads.
+check_threads () {
+	git -c core.looseRefsThreads=1 "$@" >expect 2>&1 &&
+	git -c core.looseRefsThreads=4 "$@" >actual 2>&1 &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	git tag -a -m annotated annotated &&
+	{
+		for i in $(test_seq 400)
+		do
+			echo "create refs/heads/branch-$i HEAD" &&
+			echo "create refs/pull/$i/head HEAD" || return 1
+		done
+	} >input &&
+	git update-ref --stdin <input &&
+	git symbolic-ref refs/heads/sym refs/heads/branch-1 &&
+	git symbolic-ref refs/pull/1/sym refs/heads/nonexistent &&
+	echo garbage >.git/refs/heads/broken &&
+	echo $ZERO_OID >.git/refs/pull/2/null &&
+	echo "$(git rev-parse HEAD)" >.git/refs/heads/bad..name
+'
+
+test_expect_success 'iterating over all refs' '
+	check_threads for-each-ref &&
+	test_grep "refs/pull/400/head" expect &&
+	test_grep "ignoring broken ref refs/heads/broken" expect &&
+	test_grep "ignoring broken ref refs/pull/2/null" expect &&
+	test_grep "ignoring ref with broken name refs/heads/bad..name" expect
+'
+
+test_expect_success 'iterating over a prefix' '
+	check_threads for-each-ref refs/pull/1 &&
+	check_threads for-each-ref refs/heads/ &&
+	check_threads show-ref --verify refs/pull/12/head
+'
+
+test_expect_success SYMLINKS 'symlinked refs are resolved' '
+	ln -s branch-1 .git/refs/heads/link &&
+	ln -s refs/heads/branch-2 .git/refs/heads/symlink &&
+	check_threads for-each-ref --format="%(refname) %(symref)" refs/heads/
+'
+
+test_expect_success 'pack-refs packs the same refs' '
+	git for-each-ref >refs.before &&
+	git -c core.looseRefsThreads=4 pack-refs --all &&
+	git for-each-ref >refs.after &&
+	test_cmp refs.before refs.after &&
+	test_path_is_missing .git/refs/pull/3/head
+'
+
+test_done
@@ -0,0 +1,154 @@
+#!/bin/sh
+
+test_description='looking up reflog entries through a reflog index'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+if ! test_have_prereq REFFILES
+then
+	skip_all='skipping reflog index tests; not using the files backend'
+	test_done
+fi
+
+log=.git/logs/refs/heads/main
+index=.git/logs/refs/heads/.main.idx
+
+# The timestamp of the i-th entry written by the setup below; every
+# seventh entry goes back in time.
+entry_time () {
+	if test $(($1 % 7)) = 0
+	then
+		echo $((1000000000 + 100 * $1 - 5000))
+	else
+		echo $((1000000000 + 100 * $1))
+	fi
+}
+
+# Look up entries by position and by time with and without the index,
+# which must agree.
+check_lookups () {
+	for spec in 0 1 2 3 63 64 65 66 100 200 297 298 299 300 301 302 400 \
+		    "@$(($(entry_time 1) - 1)) +0000" \
+		    "@$(entry_time 1) +0000" \
+		    "@$(entry_time 50) +0000" \
+		    "@$(($(entry_time 50) + 50)) +0000" \
+		    "@$(entry_time 63) +0000" \
+		    "@$(($(entry_time 64) + 1)) +0000" \
+		    "@$(entry_time 70) +0000" \
+		    "@$(($(entry_time 71) - 1)) +0000" \
+		    "@$(entry_time 250) +0000" \
+		    "@$(entry_time 299) +0000" \
+		    "@1112912000 +0000" \
+		    "@2000000000 +0000"
+	do
+		test_might_fail git rev-parse --verify "main@{$spec}" \
+			>actual 2>&1 &&
+		mv $index index.save &&
+		test_might_fail git rev-parse --verify "main@{$spec}" \
+			>expect 2>&1 &&
+		mv index.save $index &&
+		test_cmp expect actual || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	for i in $(test_seq 300)
+	do
+		echo $i >blob-$i &&
+		echo blob-$i >>blobs || return 1
+	done &&
+	git hash-object -w $(cat blobs) >oids &&
+	echo $ZERO_OID >old &&
+	head -n 299 oids >>old &&
+	{
+		head -n 299 oids &&
+		git rev-parse main
+	} >new &&
+	test_seq 300 >nr &&
+	paste -d " " old new nr |
+	while read old new i
+	do
+		printf "%s %s %s %s +0000\tentry %s\n" $old $new \
+			"C O Mitter <committer@example.com>" $(entry_time $i) $i ||
+		return 1
+	done >$log &&
+	git config core.reflogIndex true &&
+	git reflog expire --expire=never --expire-unreachable=never main
+'
+
+test_expect_success 'reflog expire writes the index' '
+	test_path_is_file $index &&
+	test_line_count = 300 $log
+'
+
+test_expect_success 'the index is not taken for a reflog' '
+	git fsck 2>err &&
+	test_must_be_empty err
+'
+
+test_expect_success 'lookups with the index agree with the ones without' '
+	check_lookups
+'
+
+test_expect_success 'lookups skip the entries they do not need' '
+	GIT_TRACE_REFS="$(pwd)/trace" git rev-parse "main@{299}" &&
+	test_grep "for_each_reflog_reverse_seek: refs/heads/main: 1 (skipped 297)" trace &&
+	rm trace &&
+	# The youngest entry that old is the 98th, which went back in time.
+	GIT_TRACE_REFS="$(pwd)/trace" \
+		git rev-parse "main@{@$(entry_time 50) +0000}" &&
+	test_grep "(skipped 201)" trace
+'
+
+test_expect_success 'entries appended after the index are found' '
+	test_commit one &&
+	test_commit two &&
+	test_commit three &&
+	test_line_count = 303 $log &&
+	check_lookups &&
+	GIT_TRACE_REFS="$(pwd)/trace" git rev-parse "main@{150}" &&
+	test_grep "(skipped 148)" trace
+'
+
+test_expect_success 'an index for a rewritten reflog is ignored' '
+	cp $log log.new &&
+	mv log.new $log &&
+	rm -f trace &&
+	GIT_TRACE_REFS="$(pwd)/trace" git rev-parse "main@{150}" &&
+	test_grep "(skipped 0)" trace &&
+	check_lookups
+'
+
+test_expect_success 'small reflogs do not get an index' '
+	git branch side &&
+	git reflog expire --expire=never --expire-unreachable=never side &&
+	test_path_is_file .git/logs/refs/heads/side &&
+	test_path_is_missing .git/logs/refs/heads/.side.idx
+'
+
+test_expect_success 'the index is removed with the reflog' '
+	git reflog expire --expire=never --expire-unreachable=never main &&
+	test_path_is_file $index &&
+	git branch -m main renamed &&
+	test_path_is_missing $index &&
+	test_path_is_missing .git/logs/refs/heads/.renamed.idx &&
+	git branch -m renamed main &&
+	git reflog expire --expire=never --expire-unreachable=never main &&
+	test_path_is_file $index &&
+	git reflog delete main@{0} &&
+	test_path_is_file $index &&
+	check_lookups
+'
+
+test_expect_success 'the index is removed without the config' '
+	git -c core.reflogIndex=false reflog expire \
+		--expire=never --expire-unreachable=never main &&
+	test_path_is_missing $index
+'
+
+test_done
@@ -1060,4 +1060,49 @@ test_expect_success 'fsck reports problems in current worktree index without fil
 	test_cmp expect actual
 '
 
+test_expect_success 'setup repository with a large pack' '
+	git init many &&
+	(
+		cd many &&
+		for i in $(test_seq 1000)
+		do
+			echo "blob $i" >file$i || return 1
+		done &&
+		git add . &&
+		git commit -q -m many &&
+		echo unreachable | git hash-object -w --stdin >../unreachable &&
+		git repack -adb
+	)
+'
+
+test_expect_success 'fsck --use-bitmap-index takes reachability from bitmaps' '
+	git -C many fsck --unreachable --no-reflogs >expect &&
+	test_grep "unreachable blob $(cat unreachable)" expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C many fsck --unreachable --no-reflogs --use-bitmap-index \
+		>actual &&
+	test_cmp expect actual &&
+	grep -E "\"commit_bitmap_(hits|loads)\",\"value\":\"[1-9]" trace
+'
+
+test_expect_success 'fsck reports on the objects of a pack in order with threads' '
+	git -C many fsck --threads=4 &&
+	pack=$(ls many/.git/objects/pack/pack-*.pack) &&
+	for blob in file10 file500
+	do
+		oid=$(git -C many rev-parse HEAD:$blob) &&
+		offset=$(git show-index <${pack%.pack}.idx |
+			 sed -n "s/^\([0-9]*\) $oid .*/\1/p") &&
+		printf "\377\377\377\377" |
+		dd of="$pack" bs=1 conv=notrunc seek=$((offset + 4)) || return 1
+	done &&
+	test_must_fail git -C many fsck --threads=1 2>err &&
+	test_grep "$(git -C many rev-parse HEAD:file500)" err &&
+	# zlib complains from whichever thread inflates the object
+	grep -v "inflate:" err >expect &&
+	test_must_fail git -C many fsck --threads=4 2>err &&
+	grep -v "inflate:" err >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -175,4 +175,40 @@ test_expect_success 'switch back when temporarily detached and checked out elsew
 	git -C wt2 switch --ignore-other-worktrees shared
 '
 
+test_expect_success 'switch -q only checks the paths that differ' '
+	git init quiet &&
+	(
+		cd quiet &&
+		for i in $(test_seq 1 40)
+		do
+			echo $i >file$i || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		git checkout -b changed &&
+		echo changed >file1 &&
+		git commit -a -m changed &&
+		git checkout main &&
+
+		# stat-dirty but unchanged
+		test-tool chmtime =-60 file1 &&
+		git switch -q changed &&
+		test_cmp_rev HEAD changed &&
+		echo changed >expect &&
+		test_cmp expect file1 &&
+
+		echo local >file1 &&
+		test_must_fail git switch -q main 2>err &&
+		test_grep "file1" err &&
+		git checkout file1 &&
+
+		echo local >file2 &&
+		git switch -q main &&
+		test_cmp_rev HEAD main &&
+		echo " M file2" >expect &&
+		git status --porcelain -uno >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -106,12 +106,14 @@ test_expect_success 'setup repo for checkout with various types of changes' '
 	)
 '
 
-for mode in sequential parallel sequential-fallback
+for mode in sequential parallel sequential-fallback threads
 do
+	threads=false
 	case $mode in
 	sequential)          workers=1 threshold=0 expected_workers=0 ;;
 	parallel)            workers=2 threshold=0 expected_workers=2 ;;
 	sequential-fallback) workers=2 threshold=100 expected_workers=0 ;;
+	threads)             workers=2 threshold=0 expected_workers=0 threads=true ;;
 	esac
 
 	test_expect_success "$mode checkout" '
@@ -128,23 +130,27 @@ do
 		git -C $repo submodule foreach "git update-index --refresh" &&
 
 		set_checkout_config $workers $threshold &&
+		test_config_global checkout.workerThreads $threads &&
 		test_checkout_workers $expected_workers \
 			git -C $repo checkout --recurse-submodules B2 &&
 		verify_checkout $repo
 	'
 done
 
-for mode in parallel sequential-fallback
+for mode in parallel sequential-fallback threads
 do
+	threads=false
 	case $mode in
 	parallel)            workers=2 threshold=0 expected_workers=2 ;;
 	sequential-fallback) workers=2 threshold=100 expected_workers=0 ;;
+	threads)             workers=2 threshold=0 expected_workers=0 threads=true ;;
 	esac
 
 	test_expect_success "$mode checkout on clone" '
 		test_config_global protocol.file.allow always &&
 		repo=various_${mode}_clone &&
 		set_checkout_config $workers $threshold &&
+		test_config_global checkout.workerThreads $threads &&
 		test_checkout_workers $expected_workers \
 			git clone --recurse-submodules --branch B2 various $repo &&
 		verify_checkout $repo
@@ -163,7 +169,36 @@ test_expect_success 'compare the working trees' '
 	git diff --no-index various_sequential various_parallel &&
 	git diff --no-index various_sequential various_parallel_clone &&
 	git diff --no-index various_sequential various_sequential-fallback &&
-	git diff --no-index various_sequential various_sequential-fallback_clone
+	git diff --no-index various_sequential various_sequential-fallback_clone &&
+	git diff --no-index various_sequential various_threads &&
+	git diff --no-index various_sequential various_threads_clone
+'
+
+test_expect_success 'threads stream large blobs' '
+	set_checkout_config 2 0 &&
+	test_config_global checkout.workerThreads true &&
+	git init threads &&
+	(
+		cd threads &&
+		echo "ident.t ident" >.gitattributes &&
+		for i in $(test_seq 1 8)
+		do
+			test_seq $i 1000 >file$i.t || return 1
+		done &&
+		printf "\$Id\$\n" >ident.t &&
+		git add . &&
+		git commit -m files &&
+		rm file*.t ident.t &&
+		test_checkout_workers 0 \
+			git -c core.bigFileThreshold=1k checkout . &&
+		for i in $(test_seq 1 8)
+		do
+			test_seq $i 1000 >../expect &&
+			test_cmp ../expect file$i.t || return 1
+		done &&
+		grep "Id: [0-9a-f]" ident.t
+	) &&
+	verify_checkout threads
 '
 
 # Currently, each submodule is checked out in a separated child process, but
@@ -188,4 +188,65 @@ test_expect_success 'parallel-checkout and delayed checkout' '
 	test_cmp delayed/Z original
 '
 
+test_expect_success 'parallel-checkout and parallel external filter' '
+	set_checkout_config 2 0 &&
+	(
+		cd filter &&
+		echo "* filter=rot13" >.gitattributes &&
+		echo ".gitattributes -filter" >>.gitattributes &&
+		git add --renormalize . &&
+		git commit -m "filter all" &&
+
+		rm A B C &&
+		test_checkout_workers 0 git checkout A B C &&
+		test_cmp original A &&
+		test_cmp original B &&
+		test_cmp original C &&
+
+		git config filter.rot13.parallel true &&
+		rm A B C &&
+		test_checkout_workers 2 git checkout A B C &&
+		test_cmp original A &&
+		test_cmp original B &&
+		test_cmp original C
+	)
+'
+
+test_expect_success 'parallel-checkout and parallel filter process' '
+	test_config_global filter.parallel.process \
+		"test-tool rot13-filter --always-delay --log=\"$(pwd)/parallel.log\" clean smudge delay" &&
+	test_config_global filter.parallel.required true &&
+	test_config_global filter.parallel.parallel true &&
+
+	git init parallel &&
+	(
+		cd parallel &&
+		echo "*.p filter=parallel" >.gitattributes &&
+		cp ../original W.p &&
+		cp ../original X.p &&
+		cp ../original Y.p &&
+		cp ../original Z.p &&
+		git add -A &&
+		git commit -m parallel &&
+		git cat-file -p :W.p >W.p.internal &&
+		test_cmp W.p.internal ../rot13 &&
+		rm *
+	) &&
+
+	rm parallel.log &&
+	set_checkout_config 2 0 &&
+	test_checkout_workers 2 git -C parallel checkout -f &&
+
+	# Each worker ran its own filter process, which delayed the
+	# entries and then handed them to the worker when asked for them.
+	test $(grep -c "^START" parallel.log) -eq 2 &&
+	test $(grep -c "^IN: smudge .* \[DELAYED\]" parallel.log) -eq 4 &&
+	test $(grep -c "^IN: list_available_blobs" parallel.log) -ge 2 &&
+	verify_checkout parallel &&
+	test_cmp parallel/W.p original &&
+	test_cmp parallel/X.p original &&
+	test_cmp parallel/Y.p original &&
+	test_cmp parallel/Z.p original
+'
+
 test_done
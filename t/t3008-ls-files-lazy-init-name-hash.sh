@@ -5,15 +5,13 @@ test_description='Test the lazy init name hash with various folder structures'
 TEST_PASSES_SANITIZE_LEAK=true
 . ./test-lib.sh
 
-if test 1 -eq $(test-tool online-cpus)
-then
-	skip_all='skipping lazy-init tests, single cpu'
-	test_done
-fi
+test_lazy_prereq MULTI_CPU '
+	test $(test-tool online-cpus) -gt 1
+'
 
 LAZY_THREAD_COST=2000
 
-test_expect_success 'no buffer overflow in lazy_init_name_hash' '
+test_expect_success MULTI_CPU 'no buffer overflow in lazy_init_name_hash' '
 	(
 	    test_seq $LAZY_THREAD_COST | sed "s/^/a_/" &&
 	    echo b/b/b &&
@@ -25,4 +23,53 @@ test_expect_success 'no buffer overflow in lazy_init_name_hash' '
 	test-tool lazy-init-name-hash -m
 '
 
+test_expect_success 'lookups fill the name hash on demand' '
+	rm -f .git/index &&
+	(
+	    test_seq 100 | sed "s|^|Dir/File|" &&
+	    test_seq 100 | sed "s|^|dir/sub/file|" &&
+	    test_seq 100 | sed "s|^|other/|" &&
+	    echo DIR/Sub/Deep/x &&
+	    echo a/b/c &&
+	    echo A/B &&
+	    echo Top &&
+	    echo top2
+	) |
+	sed "s/^/100644 $EMPTY_BLOB	/" |
+	git update-index --index-info &&
+	cat >paths <<-\EOF &&
+	dir/file1
+	DIR/FILE100
+	dir/SUB/file50
+	Dir/Sub
+	dir/sub/deep
+	dir/sub/deep/X
+	DIR/Sub/Deep/nothing
+	a/b
+	A/b
+	a/B/C
+	TOP
+	Top2
+	other
+	OTHER/42
+	missing/file
+	EOF
+	test-tool lazy-init-name-hash -l -s <paths >expect &&
+	test-tool lazy-init-name-hash -l <paths >actual &&
+	test_cmp expect actual &&
+	test_grep "file OTHER/42 other/42" actual &&
+	test_grep "case DIR/Sub/Deep/nothing" actual &&
+
+	# enough lookups to fall back to building the name hash in full
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		cat paths || return 1
+	done >many-paths &&
+	test-tool lazy-init-name-hash -l -s <many-paths >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		test-tool lazy-init-name-hash -l <many-paths >actual &&
+	test_cmp expect actual &&
+	grep "name-hash/partial-visited" trace
+'
+
 test_done
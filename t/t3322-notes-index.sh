@@ -0,0 +1,105 @@
+#!/bin/sh
+
+test_description='notes index'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+# log_notes <file>: the notes of all commits, looked up without an index
+# (into <file>.expect) and with one (into <file>.actual)
+log_notes () {
+	git -c notes.index=false log --format="%H %N" main >"$1.expect" &&
+	git -c notes.index=true log --format="%H %N" main >"$1.actual"
+}
+
+test_expect_success 'setup' '
+	test_commit_bulk --id=file 300 &&
+	for c in $(git rev-list -5 main)
+	do
+		git notes add -m "note for $c" $c || return 1
+	done
+'
+
+test_expect_success 'index is built and used' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.build" log_notes out &&
+	test_region notes-index build trace.build &&
+	test_cmp out.expect out.actual &&
+	test_path_is_dir .git/notes-index &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace.reuse" log_notes out &&
+	test_region ! notes-index build trace.reuse &&
+	test_region ! notes-index update trace.reuse &&
+	test_cmp out.expect out.actual
+'
+
+test_expect_success 'index is not used unless enabled' '
+	rm -rf .git/notes-index &&
+	git log --format="%H %N" main >out &&
+	test_path_is_missing .git/notes-index
+'
+
+test_expect_success 'index follows added, changed and removed notes' '
+	git -c notes.index=true log -1 main >/dev/null &&
+	git notes add -f -m changed main~1 &&
+	git notes remove main~2 &&
+	git notes add -m added main~10 &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.update" log_notes out &&
+	test_region notes-index update trace.update &&
+	test_region ! notes-index build trace.update &&
+	test_cmp out.expect out.actual &&
+	grep "$(git rev-parse main~1) changed" out.actual &&
+	! grep "$(git rev-parse main~2) note" out.actual
+'
+
+test_expect_success 'index follows a change of fanout' '
+	{
+		cat <<-EOF &&
+		commit refs/notes/commits
+		committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+		data <<EOM
+		many notes
+		EOM
+		from refs/notes/commits^0
+		EOF
+		git rev-list main~20 |
+		while read c
+		do
+			echo "N inline $c" &&
+			echo "data <<EOM" &&
+			echo "bulk note for $c" &&
+			echo "EOM" || return 1
+		done
+	} | git fast-import &&
+	git ls-tree refs/notes/commits >top &&
+	! grep -v "^040000 tree" top &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.fanout" log_notes out &&
+	test_region notes-index update trace.fanout &&
+	test_cmp out.expect out.actual &&
+	grep "bulk note" out.actual
+'
+
+test_expect_success 'commands that modify notes do not use the index' '
+	git config notes.index true &&
+	test_when_finished "git config --unset notes.index" &&
+	git notes list >list &&
+	test_line_count -gt 256 list &&
+	git notes copy main~1 main~2 &&
+	git log -1 --format=%N main~2 >actual &&
+	echo changed >expect &&
+	echo >>expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index is rebuilt when it is corrupt' '
+	for f in .git/notes-index/*
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.corrupt" log_notes out &&
+	test_region notes-index build trace.corrupt &&
+	test_cmp out.expect out.actual
+'
+
+test_done
@@ -2203,6 +2203,36 @@ test_expect_success 'bad labels and refs rejected when parsing todo list' '
 	test_path_is_missing execed
 '
 
+test_expect_success 'picks see the attributes of the picks before them' '
+	test_when_finished "rm -rf attr" &&
+	git init attr &&
+	(
+		cd attr &&
+		test_seq 1 20 >file &&
+		git add file &&
+		git commit -m base &&
+		git branch topic &&
+
+		git switch -c upstream &&
+		sed -e "s/^1\$/one/" file >tmp &&
+		mv tmp file &&
+		git commit -am upstream &&
+
+		git switch topic &&
+		echo "file -merge" >.gitattributes &&
+		git add .gitattributes &&
+		git commit -m attributes &&
+		sed -e "s/^20\$/twenty/" file >tmp &&
+		mv tmp file &&
+		git commit -am topic &&
+
+		test_must_fail git rebase upstream 2>err &&
+		test_grep "could not apply .* topic" err &&
+		test_cmp_rev upstream HEAD^ &&
+		git rebase --abort
+	)
+'
+
 # This must be the last test in this file
 test_expect_success '$EDITOR and friends are unchanged' '
 	test_editor_unchanged
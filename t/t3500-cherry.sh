@@ -78,4 +78,36 @@ test_expect_success 'cherry ignores whitespace' '
 	test_cmp expect actual
 '
 
+test_expect_success 'cherry with patch ID cache and threads' '
+	git cherry upstream-with-space feature-without-space >expect &&
+	git -c patchId.threads=2 \
+		cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual &&
+
+	test_when_finished "rm -f .git/patch-id-cache" &&
+	git -c patchId.cache=true \
+		cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .git/patch-id-cache &&
+	git -c patchId.cache=true -c patchId.threads=2 \
+		cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual &&
+	git -c patchId.cache=true \
+		log --format=%m%H --cherry-mark --right-only \
+		upstream-with-space...feature-without-space >actual &&
+	sed -e "s/^- /=/" -e "s/^+ />/" expect >expect.log &&
+	sort expect.log >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+test_expect_success 'corrupt patch ID cache is ignored' '
+	test_when_finished "rm -f .git/patch-id-cache" &&
+	git cherry upstream-with-space feature-without-space >expect &&
+	echo garbage >.git/patch-id-cache &&
+	git -c patchId.cache=true \
+		cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual
+'
+
 test_done
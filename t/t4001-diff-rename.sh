@@ -286,4 +286,73 @@ test_expect_success 'basename similarity vs best similarity' '
 	test_cmp expected actual
 '
 
+test_expect_success 'diff.renameThreads does not change inexact renames' '
+	mkdir threads &&
+	for i in $(test_seq 1 20)
+	do
+		test_seq $i $(($i + 20)) >threads/file$i || return 1
+	done &&
+	git add threads &&
+	git commit -m "files to rename" &&
+
+	for i in $(test_seq 1 20)
+	do
+		{ test_seq $i $(($i + 18)) && echo changed; } >threads/moved$i &&
+		rm threads/file$i || return 1
+	done &&
+	cp threads/moved1 threads/copy &&
+	git add -A threads &&
+	git commit -m "rename with changes" &&
+
+	git -c diff.renameThreads=1 diff-tree -r -C -C --name-status \
+		HEAD^ HEAD >expect &&
+	test_grep "^R0" expect &&
+	git -c diff.renameThreads=4 diff-tree -r -C -C --name-status \
+		HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff.approximateRenames goes beyond diff.renameLimit' '
+	git diff-tree -r -M -l0 --name-status HEAD^ HEAD >expect &&
+	git diff-tree -r -M -l2 --name-status HEAD^ HEAD >limited &&
+	! grep "^R" limited &&
+	git -c diff.approximateRenames=true \
+		diff-tree -r -M -l2 --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff.renameCache keeps the scores of inexact renames' '
+	mkdir cached &&
+	for i in $(test_seq 1 40)
+	do
+		test_seq 1000 $((1000 + $i)) >cached/file$i || return 1
+	done &&
+	git add cached &&
+	git commit -m "files to rename and cache" &&
+	for i in $(test_seq 1 40)
+	do
+		{ cat cached/file$i && echo new; } >cached/moved$i &&
+		rm cached/file$i || return 1
+	done &&
+	git add -A cached &&
+	git commit -m "rename cached" &&
+
+	git diff-tree -r -M --name-status HEAD^ HEAD >expect &&
+	test_path_is_missing .git/rename-cache &&
+	git -c diff.renameCache=true diff-tree -r -M --name-status \
+		HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	ls .git/rename-cache >cache-files &&
+	test_line_count = 1 cache-files &&
+	git -c diff.renameCache=true diff-tree -r -M --name-status \
+		HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+
+	echo garbage >.git/rename-cache/$(cat cache-files) &&
+	git -c diff.renameCache=true diff-tree -r -M --name-status \
+		HEAD^ HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "ignoring invalid rename cache" err
+'
+
 test_done
@@ -543,4 +543,29 @@ test_expect_success FUNNYNAMES '--combined-all-paths and --cc and funny names' '
 	test_cmp expect actual
 '
 
+test_expect_success 'combined diff in threads matches the one without' '
+	git switch --orphan big-base &&
+	test_seq 1 20000 >big &&
+	git add big &&
+	git commit -m big-base &&
+	for i in 1 2 3
+	do
+		git checkout -b big-side$i big-base &&
+		sed -e "$((i * 7))~$((i + 50))s/$/ side$i/" big >big.tmp &&
+		mv big.tmp big &&
+		git commit -a -m big-side$i || return 1
+	done &&
+	git checkout big-side1 &&
+	git merge --no-commit -s ours big-side2 big-side3 &&
+	sed -e "13~41s/$/ merged/" big >big.tmp &&
+	mv big.tmp big &&
+	git commit -a -m big-merge &&
+	for opt in -c --cc
+	do
+		git -c diff.combinedThreads=1 show $opt >expect &&
+		git -c diff.combinedThreads=3 show $opt >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
@@ -0,0 +1,49 @@
+#!/bin/sh
+
+test_description='diff.maxCost limits the work of the myers algorithm'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 600)
+	do
+		echo $(($i * 7 % 61)) >>pre &&
+		echo $(($i * 11 % 61)) >>post || return 1
+	done
+'
+
+test_expect_success 'diff without diff.maxCost is minimal' '
+	test_expect_code 1 git diff --no-index --minimal pre post >expect &&
+	test_expect_code 1 git -c diff.maxCost=0 diff --no-index --minimal \
+		pre post >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff within diff.maxCost does not change' '
+	test_expect_code 1 git -c diff.maxCost=1g diff --no-index --minimal \
+		pre post >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff beyond diff.maxCost still applies' '
+	test_expect_code 1 git -c diff.maxCost=10 diff --no-index --minimal \
+		pre post >patch &&
+	! test_cmp expect patch &&
+	cp pre file &&
+	sed -e "s|a/pre|a/file|" -e "s|b/post|b/file|" patch |
+	git apply --unidiff-zero - &&
+	test_cmp post file
+'
+
+test_expect_success 'diff beyond diff.maxCost is traced' '
+	test_expect_code 1 env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c diff.maxCost=10 diff --no-index pre post >/dev/null &&
+	grep "\"key\":\"max-cost-exceeded\",\"value\":\"pre\"" trace &&
+
+	rm trace &&
+	test_expect_code 1 env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git diff --no-index pre post >/dev/null &&
+	! grep max-cost-exceeded trace
+'
+
+test_done
@@ -671,4 +671,42 @@ test_expect_success 'test simple stage 1 handling' '
 	)
 '
 
+test_expect_success 'identical conflict reuses its resolution without merging' '
+	test_create_repo identical &&
+	(
+		cd identical &&
+		git config rerere.enabled true &&
+
+		test_seq 1 5 >file &&
+		git add file &&
+		git commit -m base &&
+		git checkout -b side &&
+		test_seq 1 5 | sed -e "s/3/three/" >file &&
+		git commit -a -m side &&
+		git checkout main &&
+		test_seq 1 5 | sed -e "s/3/drei/" >file &&
+		git commit -a -m main &&
+
+		test_must_fail git merge side &&
+		test_seq 1 5 | sed -e "s/3/tres/" >file &&
+		git rerere &&
+		test_seq 1 5 | sed -e "s/3/tres/" >expect &&
+		git reset --hard &&
+
+		# hashes of preimages are only kept once they are old enough
+		test-tool chmtime -60 .git/rr-cache/*/preimage &&
+		test_must_fail git merge side &&
+		test_cmp expect file &&
+		grep "/preimage\$" .git/rr-cache/index &&
+		git reset --hard &&
+
+		# a merge driver that always fails is not asked
+		test_must_fail git -c rerere.enabled=false merge side &&
+		git config merge.fail.driver false &&
+		echo "file merge=fail" >.git/info/attributes &&
+		git rerere &&
+		test_cmp expect file
+	)
+'
+
 test_done
@@ -209,6 +209,20 @@ test_expect_success 'git config log.follow is overridden by --no-follow' '
 	test_cmp expect actual
 '
 
+test_expect_success 'log.threads does not change the output' '
+	git -c log.threads=1 log -p --stat >expect &&
+	git -c log.threads=4 log -p --stat >actual &&
+	test_cmp expect actual &&
+	git -c log.threads=1 log -p -2 --skip=1 >expect &&
+	git -c log.threads=4 log -p -2 --skip=1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'log.threads must not be negative' '
+	test_must_fail git -c log.threads=-1 log -1 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 # Note that these commits are intentionally listed out of order.
 last_three="$(git rev-parse :/fourth :/sixth :/fifth)"
 cat > expect << EOF
@@ -223,4 +223,25 @@ test_expect_success 'log -S --pickaxe-regex looks into binary files' '
 	test_cmp log full-log
 '
 
+test_expect_success 'log -S counts matches on the lines both sides share' '
+	git init GS-lines &&
+	test_write_lines "needle at the start" middle "needle needle" >GS-lines/file &&
+	git -C GS-lines add file &&
+	git -C GS-lines commit -m first &&
+	test_write_lines "needle at the start" changed "needle needle" >GS-lines/file &&
+	git -C GS-lines commit -a -m same-count &&
+	test_write_lines "needle at the start" "changed needle" "needle needle" \
+		>GS-lines/file &&
+	git -C GS-lines commit -a -m one-more &&
+	test_write_lines "needle at the start" "changed need" le "needle needle" \
+		>GS-lines/file &&
+	git -C GS-lines commit -a -m split &&
+
+	git -C GS-lines log --format=%s -Sneedle >log &&
+	test_write_lines split one-more first >expect &&
+	test_cmp expect log &&
+	git -C GS-lines log --format=%s -i -SNEEDLE >log &&
+	test_cmp expect log
+'
+
 test_done
@@ -122,8 +122,14 @@ test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
 	test_bloom_filters_not_used "--walk-reflogs -- A"
 '
 
-test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
-	test_bloom_filters_not_used "-- file4 A/file1"
+test_expect_success 'git log -- multiple path specs uses Bloom filters' '
+	test_bloom_filters_used "-- file4 A/file1" &&
+	test_bloom_filters_used "-- A/B/file2 A/B/C/file3 path_does_not_exist" &&
+	test_bloom_filters_used "-- A/B A/B/C"
+'
+
+test_expect_success 'git log -- multiple path specs including "." does not use Bloom filters' '
+	test_bloom_filters_not_used "-- file4 ."
 '
 
 test_expect_success 'git log -- "." pathspec at root does not use Bloom filters' '
@@ -135,9 +141,34 @@ test_expect_success 'git log with wildcard that resolves to a single path uses B
 	test_bloom_filters_used "-- *renamed"
 '
 
-test_expect_success 'git log with wildcard that resolves to a multiple paths does not uses Bloom filters' '
-	test_bloom_filters_not_used "-- *" &&
-	test_bloom_filters_not_used "-- file*"
+test_expect_success 'git log with wildcard that resolves to multiple paths uses Bloom filters' '
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- file*"
+'
+
+# Pass the wildcards on to git, instead of having the shell expand them.
+test_expect_success 'git log with wildcard below a directory uses Bloom filters' '
+	(
+		set -f &&
+		test_bloom_filters_used "-- A/B/*" &&
+		test_bloom_filters_used "-- A/B/file*" &&
+		test_bloom_filters_used "-- A/B/?/file3" &&
+		test_bloom_filters_used "-- :(glob)A/**/file3" &&
+		test_bloom_filters_used "-- A/*/file3 file4"
+	)
+'
+
+test_expect_success 'git log with wildcard at the top level does not use Bloom filters' '
+	(
+		set -f &&
+		test_bloom_filters_not_used "-- file*" &&
+		test_bloom_filters_not_used "-- A/file1 */file3"
+	)
+'
+
+test_expect_success 'git log with unsupported pathspec magic does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(icase)a/file1" &&
+	test_bloom_filters_not_used "-- A :(exclude)A/B"
 '
 
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
@@ -405,6 +436,80 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+test_expect_success 'Bloom filters computed in threads match single thread' '
+	git init threads &&
+	test_when_finished "rm -fr threads" &&
+	(
+		cd threads &&
+		mkdir -p A/B A/C &&
+		for i in $(test_seq 1 8)
+		do
+			echo $i >A/B/file$i &&
+			echo $i >A/C/file$i &&
+			git add A &&
+			git commit -m "$i" || return 1
+		done &&
+		git rm -r A/C &&
+		echo file >A/C &&
+		git add A/C &&
+		git commit -m "dir to file" &&
+		test_chmod +x A/B/file1 &&
+		git commit -m "mode change" &&
+
+		graph=.git/objects/info/commit-graph &&
+		git -c commitGraph.threads=1 commit-graph write --reachable \
+			--changed-paths &&
+		mv $graph graph.single &&
+		git -c commitGraph.threads=4 commit-graph write --reachable \
+			--changed-paths &&
+		test_cmp_bin graph.single $graph
+	)
+'
+
+test_expect_success 'blocked Bloom filters (changedPathsVersion=2)' '
+	git init blocked &&
+	test_when_finished "rm -fr blocked" &&
+	(
+		cd blocked &&
+		mkdir dir &&
+		for i in $(test_seq 1 100)
+		do
+			echo $i >dir/file$i || return 1
+		done &&
+		git add dir &&
+		git commit -m "large" &&
+		for i in $(test_seq 1 10)
+		do
+			test_commit small$i dir/file$i || return 1
+		done &&
+
+		test_config commitGraph.changedPathsVersion 2 &&
+		git commit-graph write --reachable --changed-paths &&
+		test-tool read-graph >graph &&
+		grep "^options: bloom(2,10,7)" graph &&
+
+		for path in dir dir/file1 dir/file5 dir/file50 dir/file100 nope
+		do
+			git -c core.commitGraph=false log \
+				--pretty="format:%s" -- $path >expect &&
+			rm -f trace.perf &&
+			GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+				git log --pretty="format:%s" -- $path >actual &&
+			grep -q "statistics:{\"filter_not_present\":0" trace.perf &&
+			test_cmp expect actual || return 1
+		done &&
+
+		# Switching back recomputes the filters with the old layout.
+		test_config commitGraph.changedPathsVersion 1 &&
+		rm -f trace.event &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git commit-graph write --reachable --changed-paths &&
+		test_filter_computed 11 trace.event &&
+		test-tool read-graph >graph &&
+		grep "^options: bloom(1,10,7)" graph
+	)
+'
+
 corrupt_graph () {
 	graph=.git/objects/info/commit-graph &&
 	test_when_finished "rm -rf $graph" &&
@@ -105,6 +105,19 @@ test_expect_success 'Content merge and a few conflicts' '
 	test_cmp expect actual
 '
 
+test_expect_success 'content merges in threads give the same result' '
+	for side in side2 side4
+	do
+		test_expect_code 1 git -c merge.threads=1 \
+			merge-tree --write-tree side1 $side >expect &&
+		test_expect_code 1 env GIT_TRACE2_PERF="$(pwd)/trace" \
+			git -c merge.threads=4 \
+			merge-tree --write-tree side1 $side >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	grep "content merges" trace
+'
+
 test_expect_success 'Auto resolve conflicts by "ours" strategy option' '
 	git checkout side1^0 &&
 
@@ -945,4 +958,83 @@ test_expect_success 'check the input format when --stdin is passed' '
 	test_cmp expect actual
 '
 
+test_expect_success '--stdin reuses renames when merging a series' '
+	test_when_finished "rm -rf series" &&
+	git init series &&
+	(
+		cd series &&
+		test_seq 1 100 >numbers &&
+		git add numbers &&
+		git commit -m base &&
+		git branch topic &&
+
+		git switch -c upstream &&
+		git mv numbers values &&
+		test_seq 2 100 >values &&
+		git commit -am upstream &&
+
+		git switch topic &&
+		for i in 1 2 3
+		do
+			test_seq 1 $((100 + $i)) >numbers &&
+			git commit -am topic$i || return 1
+		done &&
+
+		# replay topic onto upstream, one merge per commit
+		onto=upstream &&
+		prev=upstream &&
+		>expect &&
+		>input &&
+		for c in topic~2 topic~1 topic
+		do
+			git merge-tree --write-tree -z --merge-base=$c^ \
+				$onto $c >out &&
+			printf "1\0" >>expect &&
+			cat out >>expect &&
+			printf "\0" >>expect &&
+			tree=$(tr "\000" "\n" <out | head -n 1) &&
+			onto=$(git commit-tree -p $onto -m $c $tree) &&
+			echo "$c^ -- $prev $c" >>input &&
+			prev=$onto || return 1
+		done &&
+
+		GIT_TRACE2_PERF="$(pwd)/trace.output" \
+			git merge-tree --stdin <input >actual &&
+		test_cmp expect actual &&
+		grep region_enter.*diffcore_rename trace.output >calls &&
+		test_line_count = 1 calls
+	)
+'
+
+test_expect_success 'merge results are written to a packfile' '
+	test_when_finished "rm -rf packed" &&
+	git init packed &&
+	(
+		cd packed &&
+		mkdir -p dir/sub &&
+		test_seq 1 10 >dir/sub/file &&
+		git add dir &&
+		git commit -m base &&
+		git branch side &&
+		git switch -c main &&
+		test_seq 0 10 >dir/sub/file &&
+		git commit -am main &&
+		git switch side &&
+		test_seq 1 11 >dir/sub/file &&
+		git commit -am side &&
+		git repack -ad &&
+
+		tree=$(git merge-tree --write-tree main side) &&
+		git count-objects -v >count &&
+		grep "^count: 0$" count &&
+		grep "^packs: 2$" count &&
+		git ls-tree -r $tree >actual &&
+		grep "dir/sub/file" actual &&
+		test_seq 0 11 >expect &&
+		git cat-file -p $tree:dir/sub/file >actual &&
+		test_cmp expect actual &&
+		git fsck --no-dangling
+	)
+'
+
 test_done
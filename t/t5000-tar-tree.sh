@@ -439,6 +439,82 @@ test_expect_success 'allow pathspecs that resolve to the current directory' '
 	test_cmp expect actual
 '
 
+archive_cache () {
+	grep "\"category\":\"archive\",\"key\":\"cache\",\"value\":\"$1\"" trace
+}
+
+test_expect_success 'archive.cache serves the same archive again' '
+	git init cached &&
+	test_commit -C cached one &&
+	git -C cached config archive.cache true &&
+	git -C cached -c archive.cache=false archive HEAD >expect.tar &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C cached archive HEAD >miss.tar &&
+	archive_cache miss &&
+	test_cmp_bin expect.tar miss.tar &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C cached archive HEAD >hit.tar &&
+	archive_cache hit &&
+	test_cmp_bin expect.tar hit.tar &&
+	ls cached/.git/archive-cache >entries &&
+	test_line_count = 1 entries &&
+
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C cached archive --remote=. HEAD >remote.tar &&
+	archive_cache hit &&
+	test_cmp_bin expect.tar remote.tar
+'
+
+test_expect_success 'archive.cache tells archives apart' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C cached archive --prefix=p/ HEAD >/dev/null &&
+	archive_cache miss &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C cached archive --format=zip HEAD >/dev/null &&
+	archive_cache miss &&
+	echo "* export-ignore" >cached/.git/info/attributes &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C cached archive HEAD >ignored.tar &&
+	archive_cache miss &&
+	! test_cmp_bin expect.tar ignored.tar &&
+	rm cached/.git/info/attributes
+'
+
+test_expect_success 'archive.cache does not keep substituted archives' '
+	rm -rf cached/.git/archive-cache &&
+	echo "one.t export-subst" >cached/.git/info/attributes &&
+	git -C cached archive HEAD >/dev/null &&
+	test_dir_is_empty cached/.git/archive-cache &&
+	rm cached/.git/info/attributes
+'
+
+test_expect_success 'archive-cache task evicts archives' '
+	rm -rf cached/.git/archive-cache &&
+	git -C cached archive HEAD >/dev/null &&
+	git -C cached archive --format=zip HEAD >/dev/null &&
+	ls cached/.git/archive-cache >entries &&
+	test_line_count = 2 entries &&
+	git -C cached maintenance run --task=archive-cache &&
+	ls cached/.git/archive-cache >entries &&
+	test_line_count = 2 entries &&
+
+	# Keep the archive that was used last.
+	test-tool chmtime =-60 cached/.git/archive-cache/*.tar &&
+	size=$(test_file_size cached/.git/archive-cache/*.zip) &&
+	git -C cached -c archive.cacheMaxSize=$size \
+		maintenance run --task=archive-cache &&
+	ls cached/.git/archive-cache >entries &&
+	grep "\.zip$" entries &&
+	test_line_count = 1 entries &&
+
+	git -C cached -c archive.cacheExpiry=now \
+		maintenance run --task=archive-cache &&
+	test_dir_is_empty cached/.git/archive-cache
+'
+
 # Pull the size and date of each entry in a tarfile using the system tar.
 #
 # We'll pull out only the year from the date; that avoids any question of
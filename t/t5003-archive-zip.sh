@@ -201,6 +201,16 @@ test_expect_success 'git archive --format=zip on large files' '
 
 check_zip large-compressed
 
+test_expect_success 'git archive --format=zip does not depend on zip.threads' '
+	git -c zip.threads=1 archive --format=zip HEAD >threads-1.zip &&
+	test_cmp_bin d.zip threads-1.zip &&
+	git -c zip.threads=4 archive --format=zip HEAD >threads-4.zip &&
+	test_cmp_bin d.zip threads-4.zip &&
+	git -c zip.threads=4 -c core.bigfilethreshold=1 \
+		archive --format=zip HEAD >threads-large.zip &&
+	test_cmp_bin large-compressed.zip threads-large.zip
+'
+
 test_expect_success 'git archive --format=zip --add-file' '
 	echo untracked >untracked &&
 	git archive --format=zip --add-file=untracked HEAD >with_untracked.zip
@@ -156,6 +156,25 @@ test_expect_success 'pack without delta' '
 	check_deltas stderr = 0
 '
 
+test_expect_success PTHREADS 'pack written with threads is the same' '
+	packname_threads=$(git pack-objects --window=0 --threads=4 \
+			test-threads <obj-list) &&
+	test "$packname_threads" = "$packname_1" &&
+	cmp test-1-$packname_1.pack test-threads-$packname_threads.pack &&
+	packname_threads=$(git pack-objects --threads=4 \
+			test-threads <obj-list) &&
+	git verify-pack test-threads-$packname_threads.pack
+'
+
+test_expect_success 'pack with a total window memory limit' '
+	packname_total=$(git pack-objects --threads=2 --window-memory-total=1k \
+			test-total <obj-list) &&
+	git verify-pack test-total-$packname_total.pack &&
+	packname_total=$(git -c pack.windowMemoryTotal=1k pack-objects \
+			test-total <obj-list) &&
+	git verify-pack test-total-$packname_total.pack
+'
+
 test_expect_success 'pack-objects with bogus arguments' '
 	test_must_fail git pack-objects --window=0 test-1 blah blah <obj-list
 '
@@ -589,6 +608,30 @@ test_expect_success 'prefetch objects' '
 	test_line_count = 1 donelines
 '
 
+test_expect_success PTHREADS 'objects checked in threads give the same pack' '
+	git init many &&
+	(
+		cd many &&
+		for i in $(test_seq 1 30)
+		do
+			for j in $(test_seq 1 40)
+			do
+				mkdir -p d$j &&
+				test_seq $j $((i + j)) >d$j/file || return 1
+			done &&
+			git add . &&
+			git commit -q -m "commit $i" || return 1
+		done &&
+		git repack -adq &&
+		git rev-list --objects --all >objs &&
+		test_line_count -gt 2048 objs &&
+		git pack-objects --threads=1 --all --stdout </dev/null >one.pack &&
+		git pack-objects --threads=4 --all --stdout </dev/null >four.pack &&
+		test_cmp one.pack four.pack &&
+		git index-pack four.pack
+	)
+'
+
 test_expect_success 'negative window clamps to 0' '
 	git pack-objects --progress --window=-1 neg-window <obj-list 2>stderr &&
 	check_deltas stderr = 0
@@ -68,6 +68,12 @@ test_expect_success 'index-pack results should match pack-objects ones' '
 	cmp "test-2-${pack2}.idx" "2.idx"
 '
 
+test_expect_success 'index-pack with threads matches single-threaded one' '
+	git index-pack --threads=4 --strict --index-version=2 \
+		-o threads.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" threads.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -506,6 +506,27 @@ test_expect_success 'boundary-based traversal is used when requested' '
 	done
 '
 
+test_expect_success 'boundary-based traversal walks to the merge bases' '
+	git checkout -b merge-base-left second &&
+	test_commit boundary-left &&
+	git checkout -b merge-base-right second &&
+	test_commit boundary-right &&
+	git merge -m merge merge-base-left &&
+	test_commit boundary-right-2 &&
+	git checkout merge-base-left &&
+	test_commit boundary-left-2 &&
+	git checkout - &&
+	git commit-graph write --reachable &&
+	test_when_finished "rm -f .git/objects/info/commit-graph" &&
+
+	git rev-list --count merge-base-left..merge-base-right >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+	git -c pack.useBitmapBoundaryTraversal=true rev-list \
+		--use-bitmap-index --count merge-base-left..merge-base-right >actual &&
+	test_cmp expect actual &&
+	grep "\"region_enter\".*\"label\":\"boundary-merge-bases\"" trace
+'
+
 test_bitmap_cases "pack.writeBitmapLookupTable"
 
 test_expect_success 'verify writing bitmap lookup table when enabled' '
@@ -527,4 +548,158 @@ test_expect_success 'truncated bitmap fails gracefully (lookup table)' '
 	test_grep corrupted.bitmap.index stderr
 '
 
+test_expect_success 'name-hash version 2 in the bitmap hash cache' '
+	git repack -adb &&
+	test-tool bitmap dump-hashes >v1 &&
+	git repack -adb --name-hash-version=2 &&
+	test-tool bitmap dump-hashes >v2 &&
+	test_line_count = $(wc -l <v1) v2 &&
+	! test_cmp v1 v2 &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --count --all >expect &&
+	git rev-list --use-bitmap-index --count --all >actual &&
+	test_cmp expect actual &&
+
+	# A version 1 repack must not copy version 2 hashes from the
+	# old bitmap, and the other way around.
+	git repack -adb &&
+	test-tool bitmap dump-hashes >again &&
+	test_cmp v1 again
+'
+
+test_expect_success 'readers without name-hash version 2 ignore its cache' '
+	git repack -adb --name-hash-version=2 &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	chmod +w $bitmap &&
+	flags=$(test_copy_bytes 8 <$bitmap | tail -c 1 | od -An -tu1) &&
+	test $((flags & 8)) = 8 &&
+	printf "\\$(printf %o $((flags & ~8)))" |
+		dd of=$bitmap bs=1 seek=7 conv=notrunc &&
+	test-tool bitmap dump-hashes >hashes &&
+	test_must_be_empty hashes &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'bitmaps built in threads are the same' '
+	git repack -adb &&
+	git -c pack.threads=1 repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	cp $bitmap serial.bitmap &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c pack.threads=4 repack -adb &&
+	grep "\"building_bitmaps_threads\",\"value\":\"4\"" trace &&
+	test_cmp_bin serial.bitmap $bitmap &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'cached tree bitmaps give the same bitmaps' '
+	git init tree-cache &&
+	for i in 1 2 3
+	do
+		mkdir -p tree-cache/sub/$i &&
+		echo $i >tree-cache/sub/$i/file &&
+		echo $i >tree-cache/top &&
+		git -C tree-cache add . &&
+		git -C tree-cache commit -m "tree cache $i" || return 1
+	done &&
+	git -C tree-cache -c pack.bitmapTreeCacheSize=0 repack -adb &&
+	bitmap=$(ls tree-cache/.git/objects/pack/*.bitmap) &&
+	mv $bitmap uncached.bitmap &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C tree-cache repack -adb &&
+	grep "\"building_bitmaps_cached_trees\",\"value\":\"[1-9]" trace &&
+	test_cmp_bin uncached.bitmap $bitmap
+'
+
+test_expect_success 'cached tree bitmaps in fill-in walks' '
+	for i in 4 5
+	do
+		mkdir -p tree-cache/sub/$i &&
+		echo $i >tree-cache/sub/$i/file &&
+		git -C tree-cache add . &&
+		git -C tree-cache commit -m "tree cache $i" || return 1
+	done &&
+	git -C tree-cache rev-list --objects HEAD~3..HEAD >out &&
+	cut -d" " -f1 out | sort >expect &&
+	for size in 0 1k 64m
+	do
+		git -C tree-cache -c pack.bitmapTreeCacheSize=$size \
+			rev-list --objects --use-bitmap-index HEAD~3..HEAD >out &&
+		cut -d" " -f1 out | sort >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'pseudo-merge bitmaps of tags' '
+	git init pseudo-merge &&
+	(
+		cd pseudo-merge &&
+		for i in $(test_seq 1 20)
+		do
+			test_commit --no-tag $i &&
+			git tag -m $i v$i || return 1
+		done &&
+		git config bitmapPseudoMerge.tags.pattern "refs/tags/v*" &&
+		git config bitmapPseudoMerge.tags.threshold now &&
+		git config bitmapPseudoMerge.tags.maxMerges 3 &&
+		git config pack.writeBitmapLookupTable true &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=10 \
+			git repack -adb --name-hash-version=2 &&
+		grep "\"building_bitmaps_pseudo_merges\",\"value\":\"3\"" trace &&
+		git rev-list --test-bitmap HEAD &&
+
+		git rev-list --objects --tags >out &&
+		cut -d" " -f1 out | sort >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=10 \
+			git rev-list --objects --use-bitmap-index --tags >out &&
+		cut -d" " -f1 out | sort >actual &&
+		test_cmp expect actual &&
+		grep "\"pseudo_merges_satisfied\",\"value\":\"3\"" trace &&
+
+		git rev-list --count --tags ^v10 >expect &&
+		git rev-list --count --use-bitmap-index --tags ^v10 >actual &&
+		test_cmp expect actual &&
+		test-tool bitmap dump-hashes >hashes &&
+		test_line_count = $(git rev-list --objects --all | wc -l) hashes
+	)
+'
+
+bitmap_stat () {
+	sed -n "s/.*\"commit_bitmap_$1\",\"value\":\"\([0-9]*\)\".*/\1/p" "$2"
+}
+
+test_expect_success 'pack.bitmapMaxXorDepth limits xor chains' '
+	git init xor-depth &&
+	(
+		cd xor-depth &&
+		for i in $(test_seq 1 100)
+		do
+			mkdir -p d$((i % 7)) &&
+			echo $i >>d$((i % 7))/f$((i % 13)) &&
+			git add . &&
+			git commit -q -m $i || return 1
+		done &&
+		git config pack.writeBitmapLookupTable true &&
+		git rev-list --count HEAD~1 HEAD~10 HEAD~20 >expect &&
+
+		git repack -adb &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git rev-list --use-bitmap-index --count HEAD~1 HEAD~10 HEAD~20 >actual &&
+		test_cmp expect actual &&
+		test $(bitmap_stat loads trace) -gt 0 &&
+		test $(bitmap_stat xors trace) -gt 3 &&
+
+		for depth in 0 1
+		do
+			rm -f trace &&
+			git -c pack.bitmapMaxXorDepth=$depth repack -adb &&
+			git rev-list --test-bitmap HEAD &&
+			GIT_TRACE2_EVENT="$(pwd)/trace" \
+				git rev-list --use-bitmap-index --count HEAD~1 HEAD~10 HEAD~20 >actual &&
+			test_cmp expect actual &&
+			test $(bitmap_stat xors trace) -le $((3 * depth)) || return 1
+		done
+	)
+'
+
 test_done
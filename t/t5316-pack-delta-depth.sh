@@ -49,7 +49,7 @@ TEST_PASSES_SANITIZE_LEAK=true
 # repeatedly-modified file to generate the delta chain).
 
 test_expect_success 'create series of packs' '
-	test-tool genrandom foo 4096 >content &&
+	test-tool genrandom foo 65536 >content &&
 	prev= &&
 	for i in $(test_seq 1 10)
 	do
@@ -118,4 +118,19 @@ test_expect_success 'negative depth disables deltas' '
 	test_cmp expect actual
 '
 
+test_expect_success 'objects deep in a delta chain read back intact' '
+	pack=$(git pack-objects --all --window=0 </dev/null pack) &&
+	git init deep &&
+	mv pack-$pack.pack pack-$pack.idx deep/.git/objects/pack/ &&
+	for i in $(test_seq 1 10)
+	do
+		cat content >expect &&
+		echo $i >>expect &&
+		blob=$(git rev-parse HEAD~$((10 - $i)):file) &&
+		git -C deep -c core.deltaBaseCacheLimit=0 \
+			cat-file blob $blob >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
@@ -629,6 +629,17 @@ test_expect_success 'detect mixed generation numbers (zero to non-zero)' '
 		"both zero and non-zero generations"
 '
 
+test_expect_success 'verify reports the same errors with any number of threads' '
+	corrupt_graph_and_verify $GRAPH_BYTE_COMMIT_DATE "\01" \
+		"commit date" &&
+	cp commit-graph-pre-write-test full/$objdir/info/commit-graph &&
+	test_must_fail git -C full -c commitGraph.threads=1 \
+		commit-graph verify 2>err-1 &&
+	test_must_fail git -C full -c commitGraph.threads=4 \
+		commit-graph verify 2>err-4 &&
+	test_cmp err-1 err-4
+'
+
 test_expect_success 'git fsck (checks commit-graph when config set to true)' '
 	git -C full fsck &&
 	corrupt_graph_and_verify $GRAPH_BYTE_FOOTER "\00" \
@@ -822,6 +833,120 @@ test_expect_success 'overflow during generation version upgrade' '
 	)
 '
 
+test_expect_success 'write and verify first-parent generations' '
+	git init first-parent &&
+	test_when_finished "rm -rf first-parent" &&
+	(
+		cd first-parent &&
+		test_commit A &&
+		test_commit B &&
+		git checkout -b side A &&
+		test_commit C &&
+		git checkout - &&
+		test_merge M side &&
+
+		git -c commitGraph.firstParentGeneration=true \
+			commit-graph write --reachable &&
+		test-tool read-graph >out &&
+		grep "^chunks:.* first_parent_generation" out &&
+		grep "^options:.* read_first_parent_generation" out &&
+		git commit-graph verify &&
+
+		# A layer on top of one without them does not get them.
+		test_commit D &&
+		git commit-graph write --reachable --split=no-merge &&
+		test_commit E &&
+		git -c commitGraph.firstParentGeneration=true \
+			commit-graph write --reachable --split=no-merge &&
+		test_line_count = 3 .git/objects/info/commit-graphs/commit-graph-chain &&
+		git commit-graph verify &&
+
+		# Merging the layers writes them for all commits again.
+		git -c commitGraph.firstParentGeneration=true \
+			commit-graph write --reachable --split=replace &&
+		git commit-graph verify
+	)
+'
+
+test_expect_success 'write and verify reachability labels' '
+	git init reachability &&
+	test_when_finished "rm -rf reachability" &&
+	(
+		cd reachability &&
+		test_commit A &&
+		test_commit B &&
+		git checkout -b side A &&
+		test_commit C &&
+		git checkout - &&
+		test_merge M side &&
+
+		git -c commitGraph.reachabilityIndex=true \
+			commit-graph write --reachable &&
+		test-tool read-graph >out &&
+		grep "^chunks:.* reachability" out &&
+		git commit-graph verify &&
+		git merge-base --is-ancestor C M &&
+		test_must_fail git merge-base --is-ancestor C B &&
+		test_must_fail git merge-base --is-ancestor M C &&
+
+		# An incremental layer does not get them.
+		test_commit D &&
+		git -c commitGraph.reachabilityIndex=true \
+			commit-graph write --reachable --split=no-merge &&
+		git commit-graph verify &&
+		git merge-base --is-ancestor C D &&
+		test_must_fail git merge-base --is-ancestor D M &&
+
+		git -c commitGraph.reachabilityIndex=true \
+			commit-graph write --reachable --split=replace &&
+		git commit-graph verify &&
+		git merge-base --is-ancestor C D
+	)
+'
+
+test_expect_success 'write and verify renames' '
+	git init renames &&
+	test_when_finished "rm -rf renames" &&
+	(
+		cd renames &&
+		test_seq 1 20 >a &&
+		git add a &&
+		git commit -m one &&
+		git mv a b &&
+		git commit -m rename &&
+		test_seq 0 20 >b &&
+		git commit -am change &&
+		git -c core.commitGraph=false blame b >expect &&
+
+		git -c commitGraph.renames=true \
+			commit-graph write --reachable &&
+		test-tool read-graph >out &&
+		grep "^chunks:.* renames" out &&
+		git commit-graph verify &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git blame b >actual &&
+		test_cmp expect actual &&
+		! grep "\"exact renames\"" trace &&
+
+		# Layers are written on top of one another.
+		git mv b c &&
+		git commit -m "rename again" &&
+		git -c core.commitGraph=false blame c >expect &&
+		git -c commitGraph.renames=true \
+			commit-graph write --reachable --split=no-merge &&
+		git commit-graph verify &&
+		rm trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git blame c >actual &&
+		test_cmp expect actual &&
+		! grep "\"exact renames\"" trace &&
+
+		git -c commitGraph.renames=true \
+			commit-graph write --reachable --split=replace &&
+		git commit-graph verify &&
+		git blame c >actual &&
+		test_cmp expect actual
+	)
+'
+
 corrupt_chunk () {
 	graph=full/.git/objects/info/commit-graph &&
 	test_when_finished "rm -rf $graph" &&
@@ -583,6 +583,33 @@ test_expect_success 'multi-pack-index and pack-bitmap' '
 	git rev-list --test-bitmap HEAD
 '
 
+test_expect_success 'cat-file --unordered uses the midx reverse index' '
+	git init midx-unordered &&
+	(
+		cd midx-unordered &&
+		test_commit one &&
+		git repack -d &&
+		test_commit two &&
+		git repack -d &&
+		git multi-pack-index write --bitmap &&
+
+		# an object in a pack outside of the midx, and a loose one
+		test_commit three &&
+		git repack -d &&
+		test_commit four &&
+
+		git -c core.multiPackIndex=false cat-file --batch-all-objects \
+			--batch-check --unordered >expect.unsorted &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+			git -c core.multiPackIndex=true cat-file --batch-all-objects \
+			--batch-check --unordered >actual.unsorted &&
+		grep "\"key\":\"source\",\"value\":\"midx\"" trace.txt &&
+		sort <expect.unsorted >expect &&
+		sort <actual.unsorted >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success 'multi-pack-index and alternates' '
 	git init --bare alt.git &&
 	echo $(pwd)/alt.git/objects >.git/objects/info/alternates &&
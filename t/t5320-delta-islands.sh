@@ -142,4 +142,37 @@ test_expect_success 'unmatched island core is not fatal' '
 	git -c "pack.islandcore=one" repack -adfi
 '
 
+test_expect_success 'island marks are propagated in threads' '
+	git init many-islands &&
+	test_seq 1 500 >many-islands/base &&
+	for i in $(test_seq 1 600)
+	do
+		cat <<-EOF &&
+		commit refs/heads/island$i
+		committer C O Mitter <committer@example.com> $i +0000
+		data <<EOM
+		$i
+		EOM
+		M 100644 inline dir/file
+		data <<EOD
+		$(cat many-islands/base)
+		$i
+		EOD
+
+		EOF
+		: || return 1
+	done >input &&
+	git -C many-islands fast-import <input &&
+	(
+		cd many-islands &&
+		git repack -adf &&
+		git verify-pack -v .git/objects/pack/pack-*.pack >verify &&
+		grep "chain length" verify &&
+
+		git -c "pack.island=refs/heads/(.*)" repack -adfi --threads=4 &&
+		git verify-pack -v .git/objects/pack/pack-*.pack >verify &&
+		! grep "chain length" verify
+	)
+'
+
 test_done
@@ -255,6 +255,41 @@ test_expect_success 'test merge stragety constants' '
 	)
 '
 
+test_expect_success 'merge limit defers merges to a later write' '
+	git clone --no-hardlinks . merge-limit &&
+	(
+		cd merge-limit &&
+		git config core.commitGraph true &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test_commit 18 &&
+		git commit-graph write --reachable --split --size-multiple=10 \
+			--merge-limit=1 &&
+		test_line_count = 3 $graphdir/commit-graph-chain &&
+		git commit-graph write --reachable --split --size-multiple=10 &&
+		test_line_count = 1 $graphdir/commit-graph-chain
+	)
+'
+
+test_expect_success 'maintenance merges what fetch did not' '
+	git clone --no-hardlinks . merge-limit-upstream &&
+	git clone --no-hardlinks merge-limit-upstream fetch-merge-limit &&
+	(
+		cd fetch-merge-limit &&
+		git config core.commitGraph true &&
+		git config fetch.writeCommitGraph true &&
+		git config fetch.commitGraphMergeLimit 1 &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test_commit -C ../merge-limit-upstream 19 &&
+		git fetch origin &&
+		test_line_count = 3 $graphdir/commit-graph-chain &&
+		test_commit -C ../merge-limit-upstream 20 &&
+		git fetch origin &&
+		test_line_count = 4 $graphdir/commit-graph-chain &&
+		git maintenance run --auto --task=commit-graph &&
+		test_line_count = 3 $graphdir/commit-graph-chain
+	)
+'
+
 test_expect_success 'remove commit-graph-chain file after flattening' '
 	git clone . flatten &&
 	(
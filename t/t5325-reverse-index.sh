@@ -132,6 +132,36 @@ test_expect_success 'revindex in-memory vs on-disk' '
 	)
 '
 
+test_expect_success 'pack.cacheReverseIndex writes missing .rev on read' '
+	git init repo &&
+	test_when_finished "rm -fr repo" &&
+	(
+		cd repo &&
+
+		test_commit commit &&
+
+		git rev-list --objects --no-object-names --all >objects &&
+
+		git -c pack.writeReverseIndex=false repack -ad &&
+		test_path_is_missing $packdir/pack-*.rev &&
+		git cat-file --batch-check="%(objectsize:disk) %(objectname)" \
+			<objects >in-core &&
+		test_path_is_missing $packdir/pack-*.rev &&
+
+		git -c pack.cacheReverseIndex=true cat-file \
+			--batch-check="%(objectsize:disk) %(objectname)" \
+			<objects >cached &&
+		test_cmp in-core cached &&
+		test_path_is_file $packdir/pack-*.rev &&
+		git fsck &&
+
+		GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 git cat-file \
+			--batch-check="%(objectsize:disk) %(objectname)" \
+			<objects >on-disk &&
+		test_cmp in-core on-disk
+	)
+'
+
 test_expect_success 'fsck succeeds on good rev-index' '
 	test_when_finished rm -fr repo &&
 	git init repo &&
@@ -410,6 +410,29 @@ test_expect_success 'preferred pack change with existing MIDX bitmap' '
 	)
 '
 
+test_expect_success 'bitmaps of an unchanged preferred pack are copied' '
+	git init unchanged-preferred-pack &&
+	(
+		cd unchanged-preferred-pack &&
+
+		test_commit_bulk 100 &&
+		big="$(git pack-objects --all --revs $objdir/pack/pack </dev/null)" &&
+		git prune-packed &&
+		git multi-pack-index write --bitmap \
+			--preferred-pack="pack-$big.pack" &&
+
+		test_commit new &&
+		git pack-objects --all --unpacked $objdir/pack/pack0 </dev/null &&
+		GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+			git multi-pack-index write --bitmap \
+			--preferred-pack="pack-$big.pack" &&
+
+		nr=$(git show-index <$objdir/pack/pack-$big.idx | wc -l) &&
+		grep "\"building_bitmaps_identical\",\"value\":\"$((nr))\"" trace2.txt &&
+		git rev-list --test-bitmap HEAD
+	)
+'
+
 test_expect_success 'tagged commits are selected for bitmapping' '
 	rm -fr repo &&
 	git init repo &&
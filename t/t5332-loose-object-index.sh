@@ -0,0 +1,92 @@
+#!/bin/sh
+
+test_description='core.looseObjectIndex'
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+index=.git/objects/info/loose-index
+
+# Pretend that the fan-out directories were last modified a while ago,
+# so that the index does not consider them racily clean.
+age_loose_dirs () {
+	for d in .git/objects/??
+	do
+		test-tool chmtime =-60 "$d" || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	test_commit three &&
+	age_loose_dirs &&
+	git cat-file --batch-all-objects --batch-check >expect &&
+	test_path_is_missing $index
+'
+
+test_expect_success 'index is written on first use' '
+	git -c core.looseObjectIndex=true cat-file \
+		--batch-all-objects --batch-check >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $index
+'
+
+test_expect_success 'index is used for unchanged directories' '
+	test_when_finished "git checkout -f && git cat-file --batch-all-objects --batch-check >expect" &&
+	blob=$(git rev-parse HEAD:three.t) &&
+	file=.git/objects/$(test_oid_to_path $blob) &&
+	dir=${file%/*} &&
+	test-tool chmtime --get $dir >mtime &&
+	mv $file blob.save &&
+	test-tool chmtime =$(cat mtime) $dir &&
+
+	git -c core.looseObjectIndex=true cat-file \
+		--batch-all-objects --batch-check="%(objectname)" >actual &&
+	grep $blob actual &&
+
+	mv blob.save $file &&
+	test-tool chmtime =$(cat mtime) $dir
+'
+
+test_expect_success 'new objects are picked up' '
+	blob=$(echo new | git hash-object -w --stdin) &&
+	git cat-file --batch-all-objects --batch-check >expect &&
+	git -c core.looseObjectIndex=true cat-file \
+		--batch-all-objects --batch-check >actual &&
+	test_cmp expect actual &&
+	grep $blob actual
+'
+
+test_expect_success 'removed objects are dropped' '
+	rm -f .git/objects/$(test_oid_to_path $blob) &&
+	age_loose_dirs &&
+	git cat-file --batch-all-objects --batch-check >expect &&
+	git -c core.looseObjectIndex=true cat-file \
+		--batch-all-objects --batch-check >actual &&
+	test_cmp expect actual &&
+	! grep $blob actual
+'
+
+test_expect_success 'abbreviated names are resolved with the index' '
+	git -c core.looseObjectIndex=true rev-parse --short HEAD >short &&
+	git -c core.looseObjectIndex=true rev-parse $(cat short) >actual &&
+	git rev-parse HEAD >head &&
+	test_cmp head actual
+'
+
+test_expect_success 'corrupt index is ignored' '
+	chmod u+w $index &&
+	printf "xxxx" | dd of=$index bs=1 count=4 conv=notrunc &&
+	git -c core.looseObjectIndex=true cat-file \
+		--batch-all-objects --batch-check >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "ignoring invalid loose object index" err &&
+
+	git -c core.looseObjectIndex=true cat-file \
+		--batch-all-objects --batch-check >actual 2>err &&
+	test_cmp expect actual &&
+	test_must_be_empty err
+'
+
+test_done
@@ -0,0 +1,96 @@
+#!/bin/sh
+
+test_description='pack-objects --path-walk'
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+list_pack_objects () {
+	git show-index <"${1%.pack}.idx" | awk "{print \$2}" | sort
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		for d in a b c a/b
+		do
+			mkdir -p $d &&
+			test_seq 1 $((20 * i)) | sed "s|^|$d |" >$d/index.js || return 1
+		done &&
+		git add . &&
+		git commit -m "commit $i" &&
+		git tag -a -m "tag $i" v$i || return 1
+	done &&
+	git branch base HEAD~2 &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect-all
+'
+
+test_expect_success 'pack all objects by path' '
+	pack=$(git pack-objects --all --path-walk --no-reuse-delta pack) &&
+	list_pack_objects pack-$pack.pack >actual &&
+	test_cmp expect-all actual &&
+	git verify-pack -v pack-$pack.pack >verify &&
+	grep "chain length" verify
+'
+
+test_expect_success 'pack by path with threads' '
+	pack=$(git pack-objects --all --path-walk --no-reuse-delta \
+		--threads=4 pack-threads) &&
+	list_pack_objects pack-threads-$pack.pack >actual &&
+	test_cmp expect-all actual &&
+	git verify-pack pack-threads-$pack.pack
+'
+
+test_expect_success 'delta chains respect --depth' '
+	pack=$(git pack-objects --all --path-walk --no-reuse-delta \
+		--depth=1 pack-depth) &&
+	git verify-pack -v pack-depth-$pack.pack >verify &&
+	! grep "chain length = [2-9]" verify
+'
+
+test_expect_success 'pack a range by path' '
+	git rev-list --objects main ^base | cut -d" " -f1 | sort >expect &&
+	printf "main\n^base\n" >input &&
+	git pack-objects --revs --path-walk --stdout <input >range.pack &&
+	git index-pack range.pack &&
+	list_pack_objects range.pack >actual &&
+	comm -2 -3 expect actual >missing &&
+	test_must_be_empty missing
+'
+
+test_expect_success 'thin pack by path' '
+	git pack-objects --revs --path-walk --thin --stdout <input >thin.pack &&
+	git init thin &&
+	git -C thin fetch .. refs/heads/base:refs/heads/base &&
+	git -C thin index-pack --stdin --fix-thin <thin.pack &&
+	git -C thin cat-file --batch-check="%(objectname)" <expect >out &&
+	! grep missing out
+'
+
+test_expect_success 'pack indexed objects by path' '
+	echo uncommitted >a/new.js &&
+	git add a/new.js &&
+	blob=$(git rev-parse :a/new.js) &&
+	pack=$(git pack-objects --all --indexed-objects --path-walk pack-index) &&
+	list_pack_objects pack-index-$pack.pack >actual &&
+	grep $blob actual
+'
+
+test_expect_success '--path-walk is ignored with --filter' '
+	echo main | git pack-objects --revs --path-walk --filter=blob:none \
+		--stdout >filtered.pack 2>err &&
+	test_grep "cannot use --filter with --path-walk" err &&
+	git index-pack filtered.pack
+'
+
+test_expect_success 'repack --path-walk' '
+	git repack -adf --path-walk &&
+	git fsck &&
+	git rev-list --objects --all --indexed-objects | cut -d" " -f1 | sort >expect &&
+	list_pack_objects .git/objects/pack/pack-*.pack >actual &&
+	test_cmp expect actual
+'
+
+test_done
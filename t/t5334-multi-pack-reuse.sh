@@ -0,0 +1,126 @@
+#!/bin/sh
+
+test_description='pack-objects multi-pack verbatim reuse'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP=0
+export GIT_TEST_MULTI_PACK_INDEX GIT_TEST_MULTI_PACK_INDEX_WRITE_BITMAP
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+# Pack all objects with the given arguments, print the number of
+# objects that were reused verbatim, and check that the resulting pack
+# is complete.
+pack_reused () {
+	rm -f got.pack got.idx &&
+	git pack-objects --all --stdout --progress "$@" \
+		</dev/null >got.pack 2>err &&
+	git index-pack got.pack >/dev/null &&
+	git show-index <got.idx | cut -d" " -f2 | sort >got &&
+	test_cmp expect got &&
+	sed -n "s/.*pack-reused \([0-9]*\).*/\1/p" err
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3
+	do
+		for j in 1 2 3 4 5
+		do
+			test_seq 1 $((i * 100 + j)) >file$j || return 1
+		done &&
+		git add . &&
+		git commit -m "commit $i" &&
+		git repack -d || return 1
+	done &&
+	test_stdout_line_count = 3 ls $packdir/pack-*.pack &&
+	git multi-pack-index write --bitmap &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect
+'
+
+test_expect_success 'only the preferred pack is reused by default' '
+	preferred=$(test-tool read-midx --preferred-pack $objdir) &&
+	git show-index <$packdir/$preferred >objects &&
+	echo $(wc -l <objects) >want &&
+	pack_reused >actual &&
+	test_cmp want actual &&
+
+	pack_reused --delta-base-offset >actual &&
+	test_cmp want actual
+'
+
+test_expect_success 'all packs are reused with pack.allowPackReuse=multi' '
+	test_config pack.allowPackReuse multi &&
+	echo $(wc -l <expect) >want &&
+	pack_reused --delta-base-offset >actual &&
+	test_cmp want actual
+'
+
+test_expect_success 'multi-pack reuse converts deltas to REF_DELTA' '
+	test_config pack.allowPackReuse multi &&
+	echo $(wc -l <expect) >want &&
+	pack_reused >actual &&
+	test_cmp want actual
+'
+
+test_expect_success 'multi-pack reuse with duplicate objects' '
+	test_config pack.allowPackReuse multi &&
+
+	# A pack of everything that duplicates the objects of all other
+	# packs, which is not preferred.
+	git pack-objects --all $packdir/pack </dev/null &&
+	test_commit more &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+
+	pack_reused --delta-base-offset >actual &&
+	test "$(cat actual)" -gt 0 &&
+	pack_reused >actual &&
+	test "$(cat actual)" -gt 0
+'
+
+test_expect_success 'clone with multi-pack reuse' '
+	test_config pack.allowPackReuse multi &&
+	git clone --no-local --bare . clone.git &&
+	git -C clone.git fsck &&
+	git -C clone.git rev-list --objects --all | cut -d" " -f1 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack.useSendfile does not change the output' '
+	test_config pack.allowPackReuse multi &&
+	git -c pack.useSendfile=false pack-objects --all --stdout \
+		--delta-base-offset </dev/null >copied.pack &&
+	git -c pack.useSendfile=true pack-objects --all --stdout \
+		--delta-base-offset </dev/null >sent.pack &&
+	git -c pack.useSendfile=true pack-objects --all --stdout \
+		--delta-base-offset </dev/null | cat >piped.pack &&
+	test_cmp copied.pack sent.pack &&
+	test_cmp copied.pack piped.pack &&
+	git index-pack sent.pack >/dev/null
+'
+
+test_expect_success 'reused objects are sent before the delta search' '
+	test_config pack.allowPackReuse multi &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git pack-objects --all --stdout --delta-base-offset \
+		</dev/null >early.pack &&
+	git -c pack.useSendfile=false pack-objects --all --stdout \
+		--delta-base-offset </dev/null >copied.pack &&
+	test_cmp copied.pack early.pack &&
+	grep -E "\"region_enter\".*\"(write-reused|prepare-pack)\"" trace2.txt |
+		sed -n "s/.*\"label\":\"\([a-z-]*\)\".*/\1/p" >actual &&
+	test_write_lines write-reused prepare-pack >expect.regions &&
+	test_cmp expect.regions actual
+'
+
+test_expect_success 'invalid pack.allowPackReuse' '
+	test_config pack.allowPackReuse bogus &&
+	test_must_fail git pack-objects --all --stdout </dev/null 2>err &&
+	test_grep "invalid pack.allowPackReuse value" err
+'
+
+test_done
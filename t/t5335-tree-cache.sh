@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='commit-graph write --tree-cache and core.treeCache'
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+cache=.git/objects/info/tree-cache
+
+test_expect_success 'setup' '
+	test_commit one &&
+	mkdir -p dir/sub &&
+	test_commit two dir/sub/two.t &&
+	test_commit three dir/three.t &&
+	git rm -r dir/sub &&
+	test_commit four &&
+	git repack -ad &&
+	git log --raw -r --format=%H >expect.log &&
+	git rev-list --objects --all >expect.objects
+'
+
+test_expect_success 'write tree cache' '
+	git commit-graph write --reachable --tree-cache &&
+	test_path_is_file $cache
+'
+
+test_expect_success 'tree cache is used and gives the same results' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git log --raw -r --format=%H >actual &&
+	test_cmp expect.log actual &&
+	grep "\"key\":\"trees\",\"value\":\"8\"" trace.txt &&
+	git rev-list --objects --all >actual &&
+	test_cmp expect.objects actual
+'
+
+test_expect_success 'core.treeCache=false ignores the cache' '
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -c core.treeCache=false log --raw -r --format=%H >actual &&
+	test_cmp expect.log actual &&
+	! grep "\"category\":\"tree-cache\"" trace.txt
+'
+
+test_expect_success 'later writes keep the cache up to date' '
+	mkdir new &&
+	test_commit five new/five.t &&
+	git commit-graph write --reachable &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git log --raw -r --format=%H >actual &&
+	git -c core.treeCache=false log --raw -r --format=%H >expect &&
+	test_cmp expect actual &&
+	grep "\"key\":\"trees\",\"value\":\"10\"" trace.txt
+'
+
+test_expect_success 'split writes keep the existing trees' '
+	test_commit six &&
+	git commit-graph write --reachable --split=no-merge &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git rev-list --objects --all >actual &&
+	git -c core.treeCache=false rev-list --objects --all >expect &&
+	test_cmp expect actual &&
+	grep "\"key\":\"trees\",\"value\":\"11\"" trace.txt
+'
+
+test_expect_success 'truncated cache is ignored' '
+	test_when_finished "mv cache.save $cache" &&
+	mv $cache cache.save &&
+	size=$(wc -c <cache.save) &&
+	test_copy_bytes $(($size - 10)) <cache.save >$cache &&
+	git log --raw -r --format=%H >actual 2>err &&
+	git -c core.treeCache=false log --raw -r --format=%H >expect &&
+	test_cmp expect actual &&
+	test_grep "ignoring invalid tree cache" err
+'
+
+test_expect_success '--no-tree-cache removes the cache' '
+	git commit-graph write --reachable --no-tree-cache &&
+	test_path_is_missing $cache
+'
+
+test_done
@@ -140,4 +140,53 @@ test_expect_success 'pre-receive hook that forgets to read its input' '
 	git push ./victim.git "+refs/heads/*:refs/heads/*"
 '
 
+test_expect_success 'update hooks may run in parallel' '
+	git clone --bare ./. parallel.git &&
+	test_hook --setup -C parallel.git update <<-\EOF &&
+	echo "$1" >>$GIT_DIR/update.refs
+	echo checking $1
+	case "$1" in
+	refs/heads/reject-*)
+		exit 1
+	esac
+	EOF
+	git -C parallel.git config receive.updateHookJobs 4 &&
+	for i in $(test_seq 8)
+	do
+		git branch accept-$i main &&
+		git branch reject-$i main || return 1
+	done &&
+	test_must_fail git push ./parallel.git "refs/heads/accept-*:refs/heads/accept-*" \
+		"refs/heads/reject-*:refs/heads/reject-*" 2>err &&
+	test_line_count = 16 parallel.git/update.refs &&
+	grep "remote: checking refs/heads/accept-1" err &&
+	grep "hook declined to update refs/heads/reject-1" err &&
+	git -C parallel.git for-each-ref --format="%(refname)" \
+		"refs/heads/accept-*" "refs/heads/reject-*" >actual &&
+	test_line_count = 8 actual &&
+	! grep reject actual
+'
+
+test_expect_success 'parallel update hooks skip refs refused by checks' '
+	rm -f parallel.git/update.refs &&
+	commit2=$(echo more | git commit-tree $tree1 -p $commit1) &&
+	git -C parallel.git config receive.denyDeletes true &&
+	test_must_fail git push ./parallel.git :accept-1 :accept-2 \
+		$commit2:refs/heads/accept-3 &&
+	echo refs/heads/accept-3 >expect &&
+	test_cmp expect parallel.git/update.refs &&
+	git -C parallel.git rev-parse --verify accept-1 &&
+	git -C parallel.git config --unset receive.denyDeletes
+'
+
+test_expect_success 'a declined parallel update hook fails an atomic push' '
+	rm -f parallel.git/update.refs &&
+	test_must_fail git push --atomic ./parallel.git \
+		$commit2:refs/heads/accept-1 $commit2:refs/heads/reject-1 &&
+	test_line_count = 2 parallel.git/update.refs &&
+	git -C parallel.git rev-parse accept-1 >actual &&
+	git rev-parse main >expect &&
+	test_cmp expect actual
+'
+
 test_done
@@ -898,6 +898,29 @@ test_expect_success 'shallow since with commit graph and already-seen commit' '
 	)
 '
 
+test_expect_success 'shallow since finds the same boundary with commit graph' '
+	test_create_repo shallow-since-graph-boundary &&
+	(
+	cd shallow-since-graph-boundary &&
+	GIT_COMMITTER_DATE="100000000 +0700" git commit --allow-empty -m one &&
+	git checkout -b side &&
+	GIT_COMMITTER_DATE="150000000 +0700" git commit --allow-empty -m side &&
+	git checkout - &&
+	GIT_COMMITTER_DATE="200000000 +0700" git commit --allow-empty -m two &&
+	GIT_COMMITTER_DATE="250000000 +0700" git merge --no-ff -m merge side &&
+	GIT_COMMITTER_DATE="300000000 +0700" git commit --allow-empty -m three &&
+	git clone --shallow-since "140000000 +0700" "file://$(pwd)/." \
+		../shallow-no-graph &&
+	git commit-graph write --reachable &&
+	git clone --shallow-since "140000000 +0700" "file://$(pwd)/." \
+		../shallow-graph
+	) &&
+	sort shallow-no-graph/.git/shallow >expect &&
+	sort shallow-graph/.git/shallow >actual &&
+	test_cmp expect actual &&
+	test_line_count = 2 actual
+'
+
 test_expect_success 'shallow clone exclude tag two' '
 	test_create_repo shallow-exclude &&
 	(
@@ -0,0 +1,167 @@
+#!/bin/sh
+
+test_description='test generation fetch negotiator'
+. ./test-lib.sh
+
+have_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -ne 0
+		then
+			echo "No have $(git -C client rev-parse $1) ($1)"
+			return 1
+		fi
+		shift
+	done
+}
+
+have_not_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -eq 0
+		then
+			return 1
+		fi
+		shift
+	done
+}
+
+# trace_fetch <client_dir> <server_dir> [args]
+#
+# Trace the packet output of fetch, but make sure we disable the variable
+# in the child upload-pack, so we don't combine the results in the same file.
+trace_fetch () {
+	client=$1; shift
+	server=$1; shift
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git -C "$client" fetch \
+	  --upload-pack 'unset GIT_TRACE_PACKET; git-upload-pack' \
+	  "$server" "$@"
+}
+
+test_expect_success 'steps double and roots are sent' '
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	for i in $(test_seq 11)
+	do
+		test_commit -C client c$i || return 1
+	done &&
+
+	# We send "c11" (step 1) "c10" (step 2) "c8" (step 4) "c4". The step
+	# of 8 would go past the root "c1", which is sent instead.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent c11 c10 c8 c4 c1 &&
+	have_not_sent c9 c7 c6 c5 c3 c2
+'
+
+test_expect_success 'only first parents are followed' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	test_commit -C client c1 &&
+	test_commit -C client c2 &&
+	git -C client checkout -b side &&
+	test_commit -C client s1 &&
+	test_commit -C client s2 &&
+	git -C client checkout - &&
+	test_commit -C client c3 &&
+	git -C client merge --no-ff -m merge side &&
+	git -C client tag merge &&
+	git -C client branch -D side &&
+	git -C client tag -d s1 s2 &&
+
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent merge c3 c1 &&
+	have_not_sent c2 s1 s2
+'
+
+test_expect_success 'advertised commits are sent' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server c1 &&
+	git clone server client &&
+	for i in $(test_seq 2 9)
+	do
+		test_commit -C client c$i || return 1
+	done &&
+	test_commit -C server to_fetch &&
+
+	# "c1" ends the chain of the client, but is sent by itself, because
+	# the server advertises its tag.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client origin &&
+	have_sent c9 c8 c6 c2 c1 &&
+	grep "fetch< ACK $(git -C client rev-parse c1)" trace
+'
+
+test_expect_success 'the history before an acknowledged have is searched again' '
+	rm -rf server client client.orig trace &&
+	git init client &&
+	tree=$(git -C client mktree </dev/null) &&
+	# Make "b1" the newest, so that its chain goes first.
+	for i in 8 7 6 5 4 3 2 1
+	do
+		test_tick &&
+		commit=$(git -C client commit-tree -m "b$i.c0" $tree) &&
+		for j in $(test_seq 40)
+		do
+			test_tick &&
+			commit=$(git -C client commit-tree -p $commit \
+				 -m "b$i.c$j" $tree) || return 1
+		done &&
+		git -C client branch b$i $commit || return 1
+	done &&
+
+	# The server has "b1~20", but does not advertise it.
+	git -C client branch old b1~20 &&
+	git init server &&
+	git -C server fetch --no-tags "$(pwd)/client" old:refs/heads/old &&
+	git -C client branch -D old &&
+	git -C server checkout old &&
+	test_commit -C server to_fetch &&
+	# An unrelated want keeps the server from giving up early.
+	git -C server checkout --orphan unrelated &&
+	test_commit -C server unrelated &&
+	cp -R client client.orig &&
+
+	# The chain of "b1" sends "b1", "b1~1", "b1~3", "b1~7", "b1~15" and
+	# "b1~31", of which the server has "b1~31". Searching again after
+	# "b1~15" sends "b1~16", "b1~17", "b1~19" and "b1~23", which the
+	# server has, too.
+	test_config -C client fetch.negotiationalgorithm generation &&
+	(
+		GIT_TEST_PROTOCOL_VERSION=0 &&
+		export GIT_TEST_PROTOCOL_VERSION &&
+		trace_fetch client "$(pwd)/server" to_fetch unrelated
+	) &&
+	have_sent b1 b1~1 b1~3 b1~7 b1~15 b1~31 b1~16 b1~17 b1~19 b1~23 &&
+	have_not_sent b1~2 b1~8 b1~14 b1~18 b1~24 b1~30 &&
+	grep "fetch< ACK $(git -C client rev-parse b1~31) common" trace &&
+	grep "fetch< ACK $(git -C client rev-parse b1~23) common" trace
+'
+
+test_expect_success 'commits may come from the commit-graph' '
+	mv trace trace.without-graph &&
+	rm -rf client &&
+	mv client.orig client &&
+	git -C client commit-graph write --reachable &&
+	test_config -C client fetch.negotiationalgorithm generation &&
+	(
+		GIT_TEST_PROTOCOL_VERSION=0 &&
+		export GIT_TEST_PROTOCOL_VERSION &&
+		trace_fetch client "$(pwd)/server" to_fetch unrelated
+	) &&
+	grep "fetch> have" trace.without-graph >expect &&
+	grep "fetch> have" trace >actual &&
+	test_cmp expect actual
+'
+
+test_done
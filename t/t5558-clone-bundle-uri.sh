@@ -284,6 +284,19 @@ test_expect_success 'clone HTTP bundle' '
 	test_config -C clone-http log.excludedecoration refs/bundle/
 '
 
+test_expect_success 'an HTTP bundle is unbundled as it downloads' '
+	test_when_finished rm -f trace*.txt &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace-clone.txt" \
+		git clone --bundle-uri="$HTTPD_URL/B.bundle" \
+		"$HTTPD_URL/smart/fetch.git" clone-http-stream &&
+	grep "\"key\":\"unbundled-from-download\",\"value\":\"$HTTPD_URL/B.bundle\"" \
+		trace-clone.txt &&
+	git -C clone-http-stream rev-parse refs/bundles/topic >actual &&
+	git -C clone-from rev-parse topic >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success 'clone bundle list (HTTP, no heuristic)' '
 	test_when_finished rm -f trace*.txt &&
 
@@ -412,6 +425,31 @@ test_expect_success 'clone bundle list (http, creationToken)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'clone bundle list (http, creationToken, parallel)' '
+	test_when_finished rm -f trace*.txt &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace-clone.txt" git \
+		-c fetch.bundleParallel=3 \
+		clone --bundle-uri="$HTTPD_URL/bundle-list" \
+		"$HTTPD_URL/smart/fetch.git" clone-list-http-parallel &&
+
+	git -C clone-from for-each-ref --format="%(objectname)" >oids &&
+	git -C clone-list-http-parallel cat-file --batch-check <oids &&
+
+	# The bundles below "bundle-4" download at the same time, but
+	# start in the same order.
+	cat >expect <<-EOF &&
+	$HTTPD_URL/bundle-list
+	$HTTPD_URL/bundle-4.bundle
+	$HTTPD_URL/bundle-3.bundle
+	$HTTPD_URL/bundle-2.bundle
+	$HTTPD_URL/bundle-1.bundle
+	EOF
+
+	test_remote_https_urls <trace-clone.txt >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'clone incomplete bundle list (http, creationToken)' '
 	test_when_finished rm -f trace*.txt &&
 
@@ -207,4 +207,38 @@ test_expect_success FAKENC 'hostname interpolation works after LF-stripping' '
 	test_cmp expect actual
 '
 
+stop_git_daemon
+mkdir pool
+start_git_daemon --export-all --upload-pack-pool="$PWD/pool" \
+	--upload-pack-pool-idle-timeout=5
+
+test_expect_success 'upload-pack pool is started by the first fetch' '
+	rm -rf pooled &&
+	git clone "$GIT_DAEMON_URL/repo.git" pooled &&
+	for i in $(test_seq 50)
+	do
+		if test -n "$(ls pool)"
+		then
+			break
+		fi &&
+		sleep 0.1 || return 1
+	done &&
+	test -S pool/* &&
+	test_cmp file pooled/file
+'
+
+test_expect_success 'fetch is served by the upload-pack pool' '
+	echo content >>file &&
+	git commit -a -m three &&
+	git push public &&
+	git -C pooled pull &&
+	test_cmp file pooled/file &&
+	test -S pool/*
+'
+
+test_expect_success 'errors of pooled upload-pack reach the client' '
+	test_must_fail git -C pooled fetch origin $(test_oid deadbeef) 2>err &&
+	test_grep "not our ref" err
+'
+
 test_done
@@ -0,0 +1,117 @@
+#!/bin/sh
+
+test_description='checking the connectivity of fetched packs in-process'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+# Fetch "main" of the server into a fresh copy of "client", leaving the
+# trace2 events in "trace".
+fetch () {
+	rm -rf fetcher trace &&
+	cp -R client fetcher &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C fetcher -c fetch.unpackLimit=1 \
+		fetch --no-tags "$@" origin main
+}
+
+connectivity () {
+	grep "\"category\":\"connectivity\",\"key\":\"$1\",\"value\":\"$2" trace
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	git clone --no-local server client &&
+	mkdir server/dir &&
+	for i in $(test_seq 20)
+	do
+		echo $i >server/dir/file$i &&
+		git -C server add dir &&
+		git -C server commit -q -m "commit $i" || return 1
+	done
+'
+
+test_expect_success 'the new pack is checked in-process' '
+	fetch &&
+	git -C server rev-parse main >expect &&
+	git -C fetcher rev-parse origin/main >actual &&
+	test_cmp expect actual &&
+	connectivity pack-objects 80 &&
+	connectivity outside 1
+'
+
+test_expect_success 'the new pack may be checked by threads' '
+	test_config -C client transfer.connectivityThreads 4 &&
+	fetch &&
+	connectivity pack-objects 80 &&
+	test_config -C client transfer.connectivityThreads 1 &&
+	fetch &&
+	connectivity pack-objects 80
+'
+
+test_expect_success 'objects covered by bitmaps are not walked' '
+	git -C client repack -adb &&
+	fetch &&
+	connectivity bitmapped 1 &&
+	connectivity outside 0
+'
+
+test_expect_success 'missing objects outside of the pack are found' '
+	test_commit -C server base &&
+	git -C server rm base.t &&
+	test_commit -C server tip &&
+
+	# The client has the parent of the new commit, but not all of its
+	# tree, and makes the server think that it has all of it.
+	git -C client -c fetch.unpackLimit=1000 fetch --no-tags \
+		origin base:refs/tmp &&
+	git -C client update-ref -d refs/tmp &&
+	blob=$(git -C server rev-parse base:base.t) &&
+	rm client/.git/objects/$(test_oid_to_path $blob) &&
+
+	! fetch --negotiation-tip=$(git -C server rev-parse base) 2>err &&
+	test_grep "did not send all necessary objects" err &&
+	connectivity outside 2
+'
+
+test_expect_success 'a clone checks the boundary recorded by index-pack' '
+	rm -rf reference clone trace &&
+	git clone --no-local --single-branch --no-tags server reference &&
+	test_commit -C server after-reference &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git clone --no-local --reference reference server clone &&
+	connectivity boundary &&
+	! grep "\"label\":\"walk-pack\"" trace &&
+	git -C clone fsck &&
+	ls clone/.git/objects/pack >packs &&
+	! grep "\.boundary$" packs
+'
+
+test_expect_success 'setup partial clone' '
+	git -C server config uploadpack.allowFilter true &&
+	git -C server config uploadpack.allowAnySHA1InWant true &&
+	rm -rf partial &&
+	git clone --no-local --filter=blob:none server partial &&
+
+	# A commit of the partial clone that the server learns about.
+	test_commit -C partial local &&
+	git -C partial push ../server HEAD:refs/heads/local &&
+	test_commit -C server new
+'
+
+test_expect_success 'a partial clone checks the boundary recorded by index-pack' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C partial -c fetch.unpackLimit=1 fetch origin &&
+	git -C server rev-parse main local >expect &&
+	git -C partial rev-parse origin/main origin/local >actual &&
+	test_cmp expect actual &&
+	connectivity boundary &&
+	ls partial/.git/objects/pack >packs &&
+	! grep "\.boundary$" packs
+'
+
+test_done
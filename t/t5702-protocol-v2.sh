@@ -1095,6 +1095,42 @@ test_expect_success 'packfile URIs with fetch instead of clone' '
 		fetch "$HTTPD_URL/smart/http_parent"
 '
 
+test_expect_success 'packfile URIs are downloaded alongside the main pack' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
+	rm -rf "$P" http_child trace &&
+
+	git init "$P" &&
+	git -C "$P" config "uploadpack.allowsidebandall" "true" &&
+
+	for b in one two three
+	do
+		echo $b-blob >"$P/$b-blob" &&
+		git -C "$P" add $b-blob &&
+		configure_exclusion "$P" $b-blob >h || return 1
+	done &&
+	git -C "$P" commit -m x &&
+
+	GIT_TRACE="$(pwd)/trace" GIT_TEST_SIDEBAND_ALL=1 \
+	git -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		-c http.maxRequests=2 \
+		clone "$HTTPD_URL/smart/http_parent" http_child &&
+	git -C http_child fsck &&
+
+	# Two downloads start before the main pack is indexed, and the third
+	# one waits for the first of them.
+	grep -E "run_command: git (http-fetch|index-pack)" trace >commands &&
+	sed -n 1,2p commands >first &&
+	test_line_count = 2 first &&
+	! grep index-pack first &&
+	sed -n 3p commands >third &&
+	grep index-pack third &&
+	grep http-fetch commands >downloads &&
+	test_line_count = 3 downloads &&
+	ls http_child/.git/objects/pack/*.pack >packs &&
+	test_line_count = 4 packs
+'
+
 test_expect_success 'fetching with valid packfile URI but invalid hash fails' '
 	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
 	rm -rf "$P" http_child log &&
@@ -0,0 +1,144 @@
+#!/bin/sh
+
+test_description='caching ls-refs responses with lsrefs.cache'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+# Send an ls-refs request with the given arguments, and unpack the
+# response into "actual" and the response made without the cache into
+# "expect". Leave a trace of the reference store in "trace".
+ls_refs () {
+	{
+		echo "command=ls-refs" &&
+		echo "object-format=$(test_oid algo)" &&
+		echo 0001 &&
+		for arg in "$@"
+		do
+			echo "$arg" || return 1
+		done &&
+		echo 0000
+	} | test-tool pkt-line pack >in &&
+	rm -f trace &&
+	GIT_TRACE_REFS="$(pwd)/trace" \
+		test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	GIT_CONFIG_COUNT=1 \
+	GIT_CONFIG_KEY_0=lsrefs.cache \
+	GIT_CONFIG_VALUE_0=false \
+		test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >expect
+}
+
+served_from_cache () {
+	test_path_is_file trace &&
+	! grep ref_iterator_begin trace
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	git branch dev &&
+	test_commit two &&
+	git symbolic-ref refs/heads/release refs/heads/main &&
+	git tag -a -m annotated annotated &&
+	git config lsrefs.cache true
+'
+
+test_expect_success 'a response is cached' '
+	ls_refs peel symrefs &&
+	! served_from_cache &&
+	test_cmp expect actual &&
+	ls .git/ls-refs-cache >files &&
+	test_line_count = 1 files &&
+	ls_refs peel symrefs &&
+	served_from_cache &&
+	test_cmp expect actual
+'
+
+test_expect_success 'requests with other arguments are cached separately' '
+	ls_refs "ref-prefix refs/heads/" symrefs &&
+	! served_from_cache &&
+	test_cmp expect actual &&
+	ls_refs "ref-prefix refs/heads/" symrefs &&
+	served_from_cache &&
+	test_cmp expect actual &&
+	ls_refs "ref-prefix refs/tags/" peel &&
+	! served_from_cache &&
+	test_cmp expect actual &&
+	ls .git/ls-refs-cache >files &&
+	test_line_count = 3 files
+'
+
+test_expect_success 'hidden refs are part of the key' '
+	ls_refs peel symrefs &&
+	served_from_cache &&
+	git -c transfer.hideRefs=refs/tags/ for-each-ref >/dev/null &&
+	test_config uploadpack.hideRefs refs/tags/ &&
+	ls_refs peel symrefs &&
+	! served_from_cache &&
+	test_cmp expect actual &&
+	! grep refs/tags/ actual
+'
+
+for cmd in \
+	"git update-ref refs/heads/dev HEAD" \
+	"git update-ref -d refs/heads/dev" \
+	"git symbolic-ref refs/heads/release refs/tags/one" \
+	"git branch -c main copied" \
+	"git branch -m copied renamed" \
+	"git tag -d annotated" \
+	"git checkout -b topic"
+do
+	test_expect_success "updates are noticed: $cmd" '
+		ls_refs peel symrefs &&
+		served_from_cache &&
+		$cmd &&
+		ls_refs peel symrefs &&
+		! served_from_cache &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'packing refs keeps the response correct' '
+	git pack-refs --all &&
+	ls_refs peel symrefs &&
+	test_cmp expect actual
+'
+
+test_expect_success REFFILES 'an interrupted update disables the cache' '
+	ls_refs symrefs &&
+	ls_refs symrefs &&
+	served_from_cache &&
+	>.git/refs-generation.lock &&
+	ls_refs symrefs &&
+	! served_from_cache &&
+	git update-ref refs/heads/locked HEAD &&
+	ls_refs symrefs &&
+	! served_from_cache &&
+	test_cmp expect actual &&
+	rm .git/refs-generation.lock &&
+	git update-ref refs/heads/unlocked HEAD &&
+	ls_refs symrefs &&
+	test_cmp expect actual &&
+	ls_refs symrefs &&
+	served_from_cache &&
+	test_cmp expect actual
+'
+
+test_expect_success 'an invalid cache file is ignored' '
+	ls_refs symrefs &&
+	ls_refs symrefs &&
+	served_from_cache &&
+	for f in .git/ls-refs-cache/*
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	ls_refs symrefs 2>err &&
+	test_grep "ignoring invalid ls-refs cache" err &&
+	test_cmp expect actual
+'
+
+test_done
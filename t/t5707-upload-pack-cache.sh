@@ -0,0 +1,144 @@
+#!/bin/sh
+
+test_description='sharing packs between fetches with uploadpack.packCache'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+# Clone the server into "client" with the given options, leaving the
+# trace2 events of upload-pack in "trace".
+clone () {
+	rm -rf client trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git clone --no-local "$@" server client &&
+	git -C client fsck
+}
+
+pack_cache () {
+	grep "\"key\":\"pack-cache\",\"value\":\"$1\"" trace
+}
+
+cache_entries () {
+	ls server/.git/upload-pack-cache >entries &&
+	test_line_count = "$1" entries
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	git -C server branch dev &&
+	test_commit -C server two &&
+	git -C server tag -a -m annotated annotated &&
+	git -C server config uploadpack.packCache true
+'
+
+test_expect_success 'a fetch writes an entry' '
+	clone &&
+	pack_cache write &&
+	cache_entries 1
+'
+
+test_expect_success 'the same fetch is served from the entry' '
+	clone &&
+	pack_cache hit &&
+	! pack_cache write &&
+	git -C server rev-parse main annotated >expect &&
+	git -C client rev-parse origin/main annotated >actual &&
+	test_cmp expect actual &&
+	cache_entries 1
+'
+
+test_expect_success 'progress does not matter for the key' '
+	clone --progress 2>err &&
+	pack_cache hit
+'
+
+test_expect_success 'other wants get an entry of their own' '
+	clone --single-branch --branch dev --no-tags &&
+	pack_cache write &&
+	cache_entries 2 &&
+	clone --single-branch --branch dev --no-tags &&
+	pack_cache hit
+'
+
+test_expect_success 'a fetch follows an entry being written' '
+	clone &&
+	entry=$(ls -t server/.git/upload-pack-cache | head -n 1) &&
+	mv server/.git/upload-pack-cache/$entry \
+	   server/.git/upload-pack-cache/$entry.lock &&
+	{
+		( sleep 1 &&
+		  mv server/.git/upload-pack-cache/$entry.lock \
+		     server/.git/upload-pack-cache/$entry ) &
+	} &&
+	clone &&
+	wait &&
+	pack_cache follow &&
+	test_path_is_file server/.git/upload-pack-cache/$entry
+'
+
+test_expect_success 'a fetch does without an abandoned entry' '
+	clone &&
+	entry=$(ls -t server/.git/upload-pack-cache | head -n 1) &&
+	test_copy_bytes 16 <server/.git/upload-pack-cache/$entry \
+		>server/.git/upload-pack-cache/$entry.lock &&
+	rm server/.git/upload-pack-cache/$entry &&
+	{
+		( sleep 1 && rm server/.git/upload-pack-cache/$entry.lock ) &
+	} &&
+	clone &&
+	wait &&
+	pack_cache follow &&
+	! pack_cache write &&
+	test_path_is_missing server/.git/upload-pack-cache/$entry
+'
+
+test_expect_success 'an invalid entry is replaced' '
+	clone &&
+	entry=$(ls -t server/.git/upload-pack-cache | head -n 1) &&
+	echo garbage >server/.git/upload-pack-cache/$entry &&
+	clone 2>err &&
+	test_grep "ignoring invalid pack cache" err &&
+	pack_cache write &&
+	clone &&
+	pack_cache hit
+'
+
+test_expect_success 'new references change the key with include-tag' '
+	clone --single-branch --branch dev &&
+	clone --single-branch --branch dev &&
+	pack_cache hit &&
+	git -C server tag lightweight one &&
+	clone --single-branch --branch dev &&
+	pack_cache write &&
+	git -C client rev-parse --verify lightweight
+'
+
+test_expect_success 'old entries are evicted' '
+	test-tool chmtime =-100000 server/.git/upload-pack-cache/* &&
+	git -C server config uploadpack.packCacheExpire 1.hour.ago &&
+	test_commit -C server three &&
+	clone &&
+	pack_cache write &&
+	cache_entries 1
+'
+
+test_expect_success 'entries are evicted by size' '
+	git -C server config uploadpack.packCacheMaxSize 1 &&
+	clone --single-branch --branch dev &&
+	pack_cache write &&
+	cache_entries 0 &&
+	git -C server config --unset uploadpack.packCacheMaxSize
+'
+
+test_expect_success 'the cache is not used without the config' '
+	git -C server config uploadpack.packCache false &&
+	clone &&
+	! pack_cache write &&
+	! pack_cache hit
+'
+
+test_done
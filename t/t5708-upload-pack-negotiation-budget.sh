@@ -0,0 +1,81 @@
+#!/bin/sh
+
+test_description='bounding the negotiation of upload-pack'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+# Fetch from the server into a fresh copy of "client", leaving the
+# trace2 events in "trace".
+fetch () {
+	rm -rf fetcher trace &&
+	cp -R client fetcher &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -C fetcher "$@" fetch --no-tags origin main &&
+	git -C fetcher fsck &&
+	git -C server rev-parse main >expect &&
+	git -C fetcher rev-parse origin/main >actual &&
+	test_cmp expect actual
+}
+
+exhausted () {
+	grep "\"key\":\"negotiation-exhausted\"" trace
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	git clone --no-local server client &&
+	test_commit -C server three &&
+	test_commit -C server four &&
+	tree=$(git -C client rev-parse HEAD^{tree}) &&
+	parent=$(git -C client rev-parse HEAD) &&
+	for i in $(test_seq 50)
+	do
+		parent=$(echo $i | git -C client commit-tree -p $parent $tree) &&
+		echo "create refs/heads/local-$i $parent" || return 1
+	done >input &&
+	git -C client update-ref --stdin <input
+'
+
+test_expect_success 'negotiation is not bounded by default' '
+	fetch &&
+	! exhausted
+'
+
+for version in 0 2
+do
+	test_expect_success "protocol v$version: negotiation stops after its haves" '
+		git -C server config uploadpack.negotiationMaxHaves 5 &&
+		fetch -c protocol.version=$version &&
+		exhausted &&
+		git -C server config --unset uploadpack.negotiationMaxHaves
+	'
+
+	test_expect_success "protocol v$version: haves within the budget are used" '
+		git -C server config uploadpack.negotiationMaxHaves 1000 &&
+		fetch -c protocol.version=$version &&
+		! exhausted &&
+		git -C server config --unset uploadpack.negotiationMaxHaves
+	'
+
+	test_expect_success "protocol v$version: negotiation time can be bounded" '
+		git -C server config uploadpack.negotiationMaxTime 1 &&
+		fetch -c protocol.version=$version &&
+		git -C server config --unset uploadpack.negotiationMaxTime
+	'
+done
+
+test_expect_success 'haves may come from the commit-graph' '
+	git -C server commit-graph write --reachable &&
+	git -C server config uploadpack.negotiationMaxHaves 1000 &&
+	GIT_TEST_COMMIT_GRAPH_PARANOIA=true fetch &&
+	fetch &&
+	! exhausted
+'
+
+test_done
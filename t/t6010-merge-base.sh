@@ -305,4 +305,45 @@ test_expect_success 'merge-base --octopus --all for complex tree' '
 	test_cmp expected actual
 '
 
+test_expect_success 'merge-base --first-parent --is-ancestor' '
+	git init first-parent &&
+	test_when_finished "rm -rf first-parent" &&
+	(
+		cd first-parent &&
+		test_commit A &&
+		test_commit B &&
+		git checkout -b side A &&
+		test_commit C &&
+		git checkout - &&
+		test_merge M side &&
+		test_commit D &&
+
+		for graph in none plain first-parent
+		do
+			rm -rf .git/objects/info/commit-graph &&
+			case "$graph" in
+			plain)
+				git commit-graph write --reachable ;;
+			first-parent)
+				git -c commitGraph.firstParentGeneration=true \
+					commit-graph write --reachable ;;
+			esac &&
+
+			git merge-base --first-parent --is-ancestor A D &&
+			git merge-base --first-parent --is-ancestor B D &&
+			git merge-base --first-parent --is-ancestor M D &&
+			git merge-base --first-parent --is-ancestor D D &&
+			test_must_fail git merge-base --first-parent --is-ancestor C D &&
+			test_must_fail git merge-base --first-parent --is-ancestor D A &&
+			test_must_fail git merge-base --first-parent --is-ancestor B C &&
+			git merge-base --is-ancestor C D || return 1
+		done
+	)
+'
+
+test_expect_success 'merge-base --first-parent requires --is-ancestor' '
+	test_must_fail git merge-base --first-parent HEAD HEAD 2>err &&
+	test_grep "requires" err
+'
+
 test_done
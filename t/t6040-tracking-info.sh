@@ -79,6 +79,40 @@ test_expect_success 'branch -vv' '
 	test_cmp expect actual
 '
 
+cat >expect <<\EOF
+b1 [ahead 1, behind 1] <> 1 1
+b2 [ahead 1, behind 1] <> 1 1
+b3 [behind 1] < 0 1
+b4 [ahead 2] > 2 0
+b5 [gone]  1 0
+b6  = 0 0
+main  = 0 0
+EOF
+
+test_expect_success 'for-each-ref upstream:track and ahead-behind in one walk' '
+	(
+		cd test &&
+		git for-each-ref --no-sort \
+			--format="%(refname:short) %(upstream:track) %(upstream:trackshort) %(ahead-behind:origin/main)" \
+			refs/heads >actual &&
+		sort actual
+	) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'for-each-ref upstream:track with different upstreams' '
+	test_when_finished "git branch -D follower2" &&
+	git branch follower2 main &&
+	git branch -u follower follower2 &&
+	cat >expect <<-\EOF &&
+	follower [ahead 1]
+	follower2 [behind 1]
+	EOF
+	git for-each-ref --format="%(refname:short) %(upstream:track)" \
+		refs/heads/follower refs/heads/follower2 >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'checkout (diverged from upstream)' '
 	(
 		cd test && git checkout b1
@@ -73,7 +73,55 @@ test_expect_success 'tree:1 filter' '
 	git rev-list --objects --filter=tree:1 HEAD >expect &&
 	git rev-list --use-bitmap-index \
 		     --objects --filter=tree:1 HEAD >actual &&
-	test_cmp expect actual
+	test_bitmap_traversal expect actual
+'
+
+# The non-bitmap tree:<depth> filter shows an object again when it finds
+# it at a lower depth than before, so compare only the sets of objects.
+test_same_objects () {
+	cut -d" " -f1 "$1" | sort -u >"$1.objects" &&
+	sort "$2" >"$2.objects" &&
+	test_cmp "$1.objects" "$2.objects"
+}
+
+test_expect_success 'tree:<depth> filter with nested trees' '
+	git init nested &&
+	(
+		cd nested &&
+		mkdir -p a/b/c &&
+		echo top >top &&
+		echo c >a/b/c/file &&
+		git add . &&
+		git commit -m base &&
+		git repack -adb &&
+		# the same blob and tree appear at more than one depth
+		cp -R a/b/c x &&
+		cp a/b/c/file a/file &&
+		git add . &&
+		git commit -m more &&
+
+		for depth in 1 2 3 4 5
+		do
+			git rev-list --objects --filter=tree:$depth HEAD >expect &&
+			git rev-list --use-bitmap-index \
+				     --objects --filter=tree:$depth HEAD >actual &&
+			test_same_objects expect actual &&
+
+			git rev-list --objects --filter=tree:$depth \
+				     HEAD^..HEAD HEAD:a/b >expect &&
+			git rev-list --use-bitmap-index \
+				     --objects --filter=tree:$depth \
+				     HEAD^..HEAD HEAD:a/b >actual &&
+			test_same_objects expect actual &&
+
+			git rev-list --objects --filter-provided-objects \
+				     --filter=tree:$depth HEAD HEAD:a >expect &&
+			git rev-list --use-bitmap-index \
+				     --objects --filter-provided-objects \
+				     --filter=tree:$depth HEAD HEAD:a >actual &&
+			test_same_objects expect actual || return 1
+		done
+	)
 '
 
 test_expect_success 'object:type filter' '
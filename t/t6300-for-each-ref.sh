@@ -1356,6 +1356,19 @@ test_expect_success '--no-sort without subsequent --sort prints expected refs' '
 	test_cmp expected actual
 '
 
+test_expect_success 'sorting by refname with patterns out of order' '
+	git for-each-ref --format="%(refname)" \
+		--sort=objecttype --sort=refname \
+		"refs/tags/multi-ref2-*" refs/heads/ "refs/tags/multi-ref1-*" >expected &&
+	git for-each-ref --format="%(refname)" \
+		"refs/tags/multi-ref2-*" refs/heads/ "refs/tags/multi-ref1-*" >actual &&
+	test_cmp expected actual &&
+	git for-each-ref --format="%(refname)" --count=3 \
+		"refs/tags/multi-ref2-*" refs/heads/ "refs/tags/multi-ref1-*" >actual &&
+	head -n 3 expected >expected.3 &&
+	test_cmp expected.3 actual
+'
+
 test_expect_success 'do not dereference NULL upon %(HEAD) on unborn branch' '
 	test_when_finished "git checkout main" &&
 	git for-each-ref --format="%(HEAD) %(refname:short)" refs/heads/ >actual &&
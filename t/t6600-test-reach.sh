@@ -58,6 +58,13 @@ test_expect_success 'setup' '
 	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
 	mv .git/objects/info/commit-graph commit-graph-no-gdat &&
 	chmod u+w commit-graph-no-gdat &&
+	git -c commitGraph.reachabilityIndex=true commit-graph write --reachable &&
+	mv .git/objects/info/commit-graph commit-graph-reach &&
+	chmod u+w commit-graph-reach &&
+	git show-ref -s commit-5-5 |
+	git -c commitGraph.reachabilityIndex=true commit-graph write --stdin-commits &&
+	mv .git/objects/info/commit-graph commit-graph-half-reach &&
+	chmod u+w commit-graph-half-reach &&
 	git config core.commitGraph true
 '
 
@@ -73,6 +80,12 @@ run_all_modes () {
 	test_cmp expect actual &&
 	cp commit-graph-no-gdat .git/objects/info/commit-graph &&
 	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-reach .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
+	test_cmp expect actual &&
+	cp commit-graph-half-reach .git/objects/info/commit-graph &&
+	"$@" <input >actual &&
 	test_cmp expect actual
 }
 
@@ -367,6 +380,16 @@ test_expect_success 'rev-list: first-parent range topo-order' '
 	run_all_modes git rev-list --first-parent --topo-order commit-3-8..commit-6-6
 '
 
+test_expect_success 'rev-list: topo-order with a tip reachable from another' '
+	git rev-parse \
+		commit-3-3 commit-3-2 commit-3-1 \
+		commit-2-5 commit-1-5 commit-2-4 commit-1-4 \
+		commit-2-3 commit-1-3 commit-2-2 commit-1-2 \
+		commit-2-1 commit-1-1 \
+	>expect &&
+	run_all_modes git rev-list --topo-order commit-1-2 commit-3-3 commit-2-5
+'
+
 test_expect_success 'rev-list: ancestry-path topo-order' '
 	git rev-parse \
 		commit-6-6 commit-5-6 commit-4-6 commit-3-6 \
@@ -991,4 +991,36 @@ test_expect_success 'empty repo (no index) and core.untrackedCache' '
 	git -C emptyrepo -c core.untrackedCache=true write-tree
 '
 
+test_expect_success 'untracked cache read ahead in threads' '
+	git init threads &&
+	(
+		cd threads &&
+		git config core.untrackedCache true &&
+		for i in $(test_seq 1 120)
+		do
+			mkdir d$i &&
+			echo $i >d$i/tracked || return 1
+		done &&
+		git add . &&
+		git commit -q -m dirs &&
+		echo untracked >d7/new &&
+		git status --porcelain >expect &&
+		avoid_racy &&
+		echo untracked >d42/new &&
+		rm -r d99 &&
+		mkdir d121 &&
+		echo untracked >d121/new &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace.threads" \
+			git -c core.untrackedCacheThreads=2 status --porcelain >actual &&
+		grep "untracked-prefetch/threads" ../trace.threads &&
+		git -c core.untrackedCacheThreads=1 status --porcelain >expect &&
+		test_cmp expect actual &&
+		test-tool dump-untracked-cache >../dump.threads &&
+		git -c core.untrackedCacheThreads=2 status --porcelain >actual &&
+		test_cmp expect actual &&
+		test-tool dump-untracked-cache >../dump.actual &&
+		test_cmp ../dump.threads ../dump.actual
+	)
+'
+
 test_done
@@ -794,4 +794,34 @@ test_expect_success 'traverse into directories that may have ignored entries' '
 	)
 '
 
+test_expect_success 'clean.threads reports the removed items in order' '
+	test_create_repo clean-threads &&
+	(
+		cd clean-threads &&
+		mkdir -p a/nested b/sub c &&
+		(cd a/nested && git init -q) &&
+		for f in b/sub/1 b/sub/2 c/x top1 top2 top3
+		do
+			echo $f >$f || return 1
+		done &&
+		git clean -n -d >../expect-dry &&
+		git -c clean.threads=4 clean -n -d >../actual-dry &&
+		test_cmp ../expect-dry ../actual-dry &&
+
+		git -c clean.threads=4 clean -f -d >../actual &&
+		cat >../expect <<-\EOF &&
+		Skipping repository a/nested
+		Removing b/
+		Removing c/
+		Removing top1
+		Removing top2
+		Removing top3
+		EOF
+		test_cmp ../expect ../actual &&
+		test_path_is_dir a/nested/.git &&
+		test_path_is_missing b &&
+		test_path_is_missing top1
+	)
+'
+
 test_done
@@ -412,4 +412,22 @@ test_expect_success 'status with added file in nested submodule (short)' '
 	EOF
 '
 
+test_expect_success 'status with submodule.diffJobs matches serial status' '
+	git -C super status --porcelain=2 >expect &&
+	git -C super -c submodule.diffJobs=3 status --porcelain=2 >actual &&
+	test_cmp expect actual &&
+	git -C super diff --submodule=short >expect &&
+	git -C super -c submodule.diffJobs=0 diff --submodule=short >actual &&
+	test_cmp expect actual &&
+	git -C super diff --name-status --ignore-submodules=none >expect &&
+	git -C super -c submodule.diffJobs=3 diff --name-status \
+		--ignore-submodules=none >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'submodule.diffJobs rejects negative values' '
+	test_must_fail git -C super -c submodule.diffJobs=-1 status 2>err &&
+	test_grep "negative values not allowed for submodule.diffJobs" err
+'
+
 test_done
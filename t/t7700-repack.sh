@@ -830,4 +830,43 @@ test_expect_success '-n overrides repack.updateServerInfo=true' '
 	test_server_info_missing
 '
 
+compressed_objects () {
+	GIT_PROGRESS_DELAY=0 git -C delta-record pack-objects --all --progress \
+		--stdout "$@" </dev/null 2>&1 >/dev/null |
+	tr "\r" "\n" |
+	sed -n "s|^Compressing objects: 100% (\([0-9]*\)/.*, done.*|\1|p"
+}
+
+test_expect_success 'pack.writeDeltaRecord writes a .deltas file' '
+	git init delta-record &&
+	for i in 1 2 3
+	do
+		test_seq 1 $((100 * i)) >delta-record/file &&
+		git -C delta-record add file &&
+		git -C delta-record commit -m "commit $i" || return 1
+	done &&
+	git -C delta-record -c pack.writeDeltaRecord=true repack -adf &&
+	pack=$(ls delta-record/.git/objects/pack/pack-*.pack) &&
+	test_path_is_file "${pack%.pack}.deltas" &&
+	git -C delta-record repack -adf &&
+	test_path_is_missing delta-record/.git/objects/pack/pack-*.deltas
+'
+
+test_expect_success 'objects recorded in a .deltas file are not searched again' '
+	git -C delta-record -c pack.writeDeltaRecord=true repack -adf &&
+	compressed_objects >actual &&
+	test_must_be_empty actual &&
+
+	test_seq 1 400 >delta-record/file &&
+	git -C delta-record commit -am "commit 4" &&
+	compressed_objects >new &&
+	compressed_objects --no-reuse-delta >all &&
+	test "$(cat new)" -lt "$(cat all)" &&
+
+	git -C delta-record -c pack.writeDeltaRecord=true repack -ad &&
+	git -C delta-record fsck &&
+	compressed_objects >actual &&
+	test_must_be_empty actual
+'
+
 test_done
@@ -445,4 +445,38 @@ test_expect_success '--geometric -l disables writing bitmaps with non-local pack
 	test_path_is_file member/.git/objects/pack/multi-pack-index-*.bitmap
 '
 
+test_expect_success '--geometric --jobs rolls up tiers in parallel' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+
+		test_commit_bulk --start=1 10 && # 30 objects
+		test_commit_bulk --start=11 1 && # 3 objects
+		test_commit_bulk --start=12 1 && # 3 objects
+		test_commit_bulk --start=13 1 && # 3 objects
+
+		git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+		big=$(ls -S $packdir/pack-*.pack | head -n 1) &&
+
+		# The three small packs are rolled up into a pack of six
+		# objects and a pack of three objects, which form a
+		# progression with the big pack.
+		git repack --geometric 2 --jobs=2 -d &&
+		test_path_is_file $big &&
+		test_stdout_line_count = 3 ls $packdir/pack-*.pack &&
+		for idx in $packdir/pack-*.idx
+		do
+			packed_objects $idx || return 1
+		done | sort -u >actual &&
+		test_cmp expect actual &&
+		git fsck &&
+
+		ls $packdir/pack-*.pack | sort >before &&
+		git repack --geometric 2 --jobs=2 -d &&
+		ls $packdir/pack-*.pack | sort >after &&
+		test_cmp before after
+	)
+'
+
 test_done
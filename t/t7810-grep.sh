@@ -1121,6 +1121,16 @@ do
 	"
 done
 
+test_expect_success 'grep --threads over several trees' '
+	set HEAD HEAD^{tree} HEAD HEAD^{tree} &&
+	git grep --threads=1 -n -C1 -e vvv -e a "$@" >expect &&
+	git grep --threads=2 -n -C1 -e vvv -e a "$@" >actual &&
+	test_cmp expect actual &&
+	git grep --threads=1 -l -e foo "$@" -- "*.c" file >expect &&
+	git grep --threads=2 -l -e foo "$@" -- "*.c" file >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success !PTHREADS,!FAIL_PREREQS \
 	'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
@@ -1919,4 +1929,19 @@ test_expect_success 'grep does not report i-t-a and assume unchanged with -L' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep does not require the optional parts of regexes' '
+	test_when_finished "rm -f optional" &&
+	printf "%s\n" ac bar xz "qqa{2}" "foo|bar" "a.b" "a+b" >optional &&
+	for args in "-E ab*c:ac" "-G ab*c:ac" "-E (foo)?bar:bar foo|bar" \
+		    "-G a\{0\}c:ac" "-E xy?z:xz" "-G xy\?z:xz" \
+		    "-G a{2}:qqa{2}" "-E foo\|bar:foo|bar" \
+		    "-G foo\|bar:bar foo|bar" "-E q+a:qqa{2}" \
+		    "-E a[.]b:a.b" "-G a+b:a+b" "-F a.b:a.b"
+	do
+		echo ${args#*:} | tr " " "\n" >expect &&
+		git grep --no-index -h ${args%%:*} optional >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
@@ -0,0 +1,101 @@
+#!/bin/sh
+
+test_description='git grep with the trigram index of the grep-index task'
+
+. ./test-lib.sh
+
+index_data () {
+	grep "\"key\":\"index/$1\",\"value\":\"$2\"" trace
+}
+
+test_expect_success 'setup' '
+	echo "Hello world" >hello &&
+	echo "goodbye moon" >bye &&
+	printf "one\ntwo\nthree\n" >numbers &&
+	printf "binary\0Hello world" >bin &&
+	mkdir dir &&
+	echo "Hello again" >dir/again &&
+	git add . &&
+	git commit -m first &&
+	echo "Hello sky" >sky &&
+	git add sky &&
+	git commit -m second
+'
+
+test_expect_success 'grep-index task writes the index' '
+	git maintenance run --task=grep-index &&
+	test_path_is_file .git/objects/info/grep-index
+'
+
+test_expect_success 'grep narrows down the blobs to read' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" git grep -e world HEAD >actual &&
+	index_data blobs 5 &&
+	index_data candidates 1 &&
+	git -c grep.trigramIndex=false grep -e world HEAD >expect &&
+	test_cmp expect actual &&
+	git grep -a -e world HEAD >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'grep with the index matches grep without it' '
+	for args in "-e Hello" "-i -e HELLO" "-e hello -e two" "-F -e o.w" \
+		    "-w -e again" "-c -e Hello" "-l -e moon" "-e nothing" \
+		    "-i -e SKY" "-e ello -- dir"
+	do
+		test_might_fail git grep $args HEAD HEAD^ >actual &&
+		test_might_fail git -c grep.trigramIndex=false \
+			grep $args HEAD HEAD^ >expect &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'the index is not used when it cannot tell' '
+	for args in "-v -e Hello" "-L -e Hello" "-e He.lo" "-e Hi" \
+		    "-i -e sky" "-e Hello --and -e world"
+	do
+		rm -f trace &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" test_might_fail \
+			git grep $args HEAD >actual &&
+		! grep "index/blobs" trace &&
+		test_might_fail git -c grep.trigramIndex=false \
+			grep $args HEAD >expect &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'blobs added after the index are grepped' '
+	echo "Hello new world" >new &&
+	git add new &&
+	git commit -m third &&
+	git grep -e world HEAD >actual &&
+	test_grep "HEAD:new:Hello new world" actual
+'
+
+test_expect_success 'grep-index task adds new blobs' '
+	git maintenance run --task=grep-index &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git grep -e world HEAD >actual &&
+	index_data blobs 6 &&
+	index_data candidates 2 &&
+	test_line_count = 3 actual
+'
+
+test_expect_success 'grep-index task drops blobs that are gone' '
+	git reset --hard HEAD^ &&
+	git reflog expire --expire=now --all &&
+	git gc --prune=now &&
+	git maintenance run --task=grep-index &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git grep -e world HEAD >actual &&
+	index_data blobs 5
+'
+
+test_expect_success 'grep --cached uses the index' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git grep --cached -e moon >actual &&
+	index_data candidates 1 &&
+	echo "bye:goodbye moon" >expect &&
+	test_cmp expect actual
+'
+
+test_done
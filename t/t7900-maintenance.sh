@@ -346,6 +346,36 @@ run_incremental_repack_and_verify () {
 	test_subcommand git multi-pack-index write --no-progress <trace-B
 }
 
+test_expect_success 'maintenance.loose-objects.batchSize' '
+	rm -rf loose-batch &&
+	git init loose-batch &&
+	for i in 1 2 3
+	do
+		echo $i | git -C loose-batch hash-object -w --stdin || return 1
+	done &&
+	test_config -C loose-batch maintenance.loose-objects.batchSize 2 &&
+	git -C loose-batch maintenance run --task=loose-objects &&
+	idx=$(ls loose-batch/.git/objects/pack/loose-*.idx) &&
+	git show-index <$idx >packed &&
+	test_line_count = 2 packed &&
+
+	# The next run packs the rest.
+	git -C loose-batch maintenance run --task=loose-objects &&
+	ls loose-batch/.git/objects/pack/loose-*.idx >idx &&
+	test_line_count = 2 idx
+'
+
+test_expect_success 'batch size and merge limit bound the work of tasks' '
+	test_config maintenance.incremental-repack.batchSize 1 &&
+	test_config maintenance.commit-graph.mergeLimit 1000 &&
+	GIT_TRACE2_EVENT="$(pwd)/bounded.txt" git maintenance run \
+		--task=incremental-repack --task=commit-graph &&
+	test_subcommand git multi-pack-index repack \
+		--no-progress --batch-size=1 <bounded.txt &&
+	test_subcommand git commit-graph write --split --reachable \
+		--merge-limit=1000 --no-progress <bounded.txt
+'
+
 test_expect_success 'maintenance.incremental-repack.auto' '
 	rm -rf incremental-repack-true &&
 	git init incremental-repack-true &&
@@ -376,6 +406,70 @@ test_expect_success 'pack-refs task' '
 	test_subcommand git pack-refs --all --prune <pack-refs.txt
 '
 
+test_expect_success 'split-index task' '
+	test_when_finished "rm -rf split" &&
+	git init split &&
+	(
+		cd split &&
+		git config splitIndex.maxPercentChange 100 &&
+		test_commit one &&
+		git update-index --split-index &&
+		test_commit two &&
+		test-tool dump-split-index .git/index >before &&
+		grep "^100644 .* 0	two.t$" before &&
+
+		git -c maintenance.split-index.auto=2 maintenance run \
+			--task=split-index --auto &&
+		test-tool dump-split-index .git/index >after &&
+		test_cmp before after &&
+
+		git maintenance run --task=split-index &&
+		test-tool dump-split-index .git/index >after &&
+		! grep "two.t$" after &&
+		! test "$(grep ^base before)" = "$(grep ^base after)" &&
+		git ls-files >actual &&
+		test_write_lines one.t two.t >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'split-index task does nothing without split index' '
+	test_when_finished "rm -rf unsplit" &&
+	git init unsplit &&
+	(
+		cd unsplit &&
+		test_commit one &&
+		git maintenance run --task=split-index &&
+		test_path_is_missing .git/sharedindex.* &&
+		test-tool dump-split-index .git/index >actual &&
+		test_grep "^not a split index" actual
+	)
+'
+
+test_expect_success 'tasks after the time budget are deferred' '
+	rm -rf budget &&
+	git init budget &&
+	test_commit -C budget one &&
+	git -C budget remote add self . &&
+	git -C budget config remote.self.uploadpack \
+		"sleep 2 && git-upload-pack" &&
+
+	GIT_TRACE2_EVENT="$(pwd)/budget-1.txt" \
+		git -C budget maintenance run --no-quiet --time-budget=1 \
+		--task=pack-refs --task=prefetch 2>err &&
+	test_grep "deferring task .pack-refs." err &&
+	test_subcommand ! git pack-refs --all --prune <budget-1.txt &&
+	echo pack-refs >expect &&
+	test_cmp expect budget/.git/objects/maintenance-deferred &&
+
+	# The deferred task runs first, although --auto does not select it.
+	GIT_TRACE2_EVENT="$(pwd)/budget-2.txt" \
+		git -C budget maintenance run --auto --time-budget=1 \
+		--task=pack-refs --task=prefetch &&
+	test_subcommand git pack-refs --all --prune <budget-2.txt &&
+	test_path_is_missing budget/.git/objects/maintenance-deferred
+'
+
 test_expect_success '--auto and --schedule incompatible' '
 	test_must_fail git maintenance run --auto --schedule=daily 2>err &&
 	test_grep "at most one" err
@@ -141,4 +141,28 @@ test_expect_success 'blame with uncommitted edits in partial clone does not cras
 	git -C client blame file.txt
 '
 
+test_expect_success 'blame --batch blames each path read from stdin' '
+	for path in file hello.c file
+	do
+		git blame -p HEAD -- $path &&
+		echo || return 1
+	done >expect &&
+	printf "%s\n" file hello.c file | git blame -p --batch HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blame --batch reports missing paths and goes on' '
+	echo >expect &&
+	git blame -p HEAD -- file >>expect &&
+	echo >>expect &&
+	printf "%s\n" no-such-path file | git blame -p --batch HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "no such path no-such-path" err
+'
+
+test_expect_success 'blame --batch cannot be used with -L' '
+	test_must_fail git blame --batch -L1,2 HEAD </dev/null 2>err &&
+	test_grep "cannot be used together" err
+'
+
 test_done
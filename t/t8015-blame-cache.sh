@@ -0,0 +1,81 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+
+. ./test-lib.sh
+
+change () {
+	sed -e "$((3 * $2))s/\$/ changed $2/" "$1" >"$1.new" &&
+	mv "$1.new" "$1" &&
+	test_tick &&
+	git commit -q -a -m "change $2"
+}
+
+test_expect_success 'setup' '
+	test_seq 1 20 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m initial &&
+	change file 1 &&
+	change file 2 &&
+	git mv file renamed &&
+	test_tick &&
+	git commit -m rename &&
+	change renamed 3 &&
+	change renamed 4 &&
+	change renamed 5
+'
+
+test_expect_success 'blame.cache records the blame of a file' '
+	git -c blame.cache=true blame HEAD~2 -- renamed >/dev/null &&
+	test_path_is_dir .git/blame-cache
+'
+
+test_expect_success 'blame of a descendant reuses the cached blame' '
+	git blame -p HEAD -- renamed >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c blame.cache=true blame -p HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache/hits\",\"value\":\"1\"" trace
+'
+
+test_expect_success 'blame of the same commit is read from the cache' '
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c blame.cache=true blame -p HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache/hits\",\"value\":\"1\"" trace
+'
+
+test_expect_success 'blame of a range uses the cache' '
+	git blame -L 5,12 HEAD -- renamed >expect &&
+	git -c blame.cache=true blame -L 5,12 HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blame of working tree changes uses the cache' '
+	test_when_finished "git checkout renamed" &&
+	echo new >>renamed &&
+	git blame renamed >expect &&
+	git -c blame.cache=true blame renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cache is not used with -M' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c blame.cache=true blame -M HEAD -- renamed >/dev/null &&
+	! grep cache/hits trace
+'
+
+test_expect_success 'a corrupt cache is ignored' '
+	git blame -p HEAD -- renamed >expect &&
+	for f in .git/blame-cache/*/*
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	git -c blame.cache=true blame -p HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -173,6 +173,27 @@ test_expect_success 'scalar reconfigure' '
 	test true = "$(git -C one/src config core.preloadIndex)"
 '
 
+test_expect_success 'scalar diagnose-perf' '
+	git init perf/src &&
+	test_commit -C perf/src one &&
+	scalar register perf &&
+	scalar diagnose-perf perf >out &&
+	grep "^checkout.workers=1$" out &&
+	grep "^scalar.perf.files=1$" out &&
+	test 1 = "$(git -C perf/src config scalar.perf.files)" &&
+
+	git -C perf/src config core.untrackedCache >expect &&
+	scalar reconfigure perf &&
+	git -C perf/src config core.untrackedCache >actual &&
+	test_cmp expect actual &&
+
+	git -C perf/src config scalar.perf.files 100000 &&
+	scalar reconfigure -a &&
+	test 100000 = "$(git -C perf/src config scalar.perf.files)" &&
+	scalar reconfigure perf &&
+	test 1 = "$(git -C perf/src config scalar.perf.files)"
+'
+
 test_expect_success '`reconfigure -a` removes stale config entries' '
 	git init stale/src &&
 	scalar register stale &&
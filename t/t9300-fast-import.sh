@@ -3528,4 +3528,69 @@ test_expect_success 'Y: rewrite submodules' '
 	)
 '
 
+
+###
+### series Z (blobs stored by threads)
+###
+
+z_blob () {
+	cat <<-EOF
+	blob
+	mark :$2
+	data $(wc -c <"$1")
+	EOF
+	cat "$1"
+}
+
+test_expect_success 'Z: setup' '
+	test_seq 1000 >Z-file &&
+	for i in $(test_seq 12)
+	do
+		sed -e "s/^$i\$/$i changed/" Z-file >Z-file.new &&
+		mv Z-file.new Z-file &&
+		z_blob Z-file $i >>Z-input &&
+		cat >>Z-input <<-EOF || return 1
+		commit refs/heads/Z
+		committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+		data <<COMMIT
+		Z $i
+		COMMIT
+		M 100644 :$i file$(($i % 3))
+
+		EOF
+	done &&
+	echo "cat-blob :12" >>Z-input
+'
+
+test_expect_success 'Z: threads and a delta window import the same objects' '
+	git init Z-serial &&
+	git -C Z-serial fast-import --export-marks=../Z-marks.expect \
+		<Z-input >Z-out.expect &&
+	git init Z-threads &&
+	git -C Z-threads fast-import --threads=4 --window=4 \
+		--export-marks=../Z-marks.actual <Z-input >Z-out.actual &&
+	test_cmp Z-marks.expect Z-marks.actual &&
+	test_cmp Z-out.expect Z-out.actual &&
+	git -C Z-serial rev-parse Z >expect &&
+	git -C Z-threads rev-parse Z >actual &&
+	test_cmp expect actual &&
+	git -C Z-threads fsck --strict
+'
+
+test_expect_success 'Z: a zero delta window stores blobs whole' '
+	git init Z-whole &&
+	git -C Z-whole -c fastimport.unpackLimit=0 \
+		-c fastimport.threads=2 -c fastimport.window=0 \
+		fast-import <Z-input >/dev/null &&
+	git verify-pack -v Z-whole/.git/objects/pack/*.idx >out &&
+	grep " blob " out | awk "NF > 5" >deltas &&
+	test_must_be_empty deltas &&
+	git init Z-delta &&
+	git -C Z-delta -c fastimport.unpackLimit=0 -c fastimport.window=4 \
+		fast-import <Z-input >/dev/null &&
+	git verify-pack -v Z-delta/.git/objects/pack/*.idx >out &&
+	grep " blob " out | awk "NF > 5" >deltas &&
+	test_file_not_empty deltas
+'
+
 test_done
@@ -78,4 +78,71 @@ test_expect_success 'relative marks are not affected by subdir' '
 	test_path_is_file deep-relative/.git/info/fast-import/exported-marks
 '
 
+test_expect_success 'binary marks can be exported and imported' '
+	git init binary &&
+	git -C binary fast-import --marks-format=binary \
+		--export-marks=../binary-marks <dump &&
+	git -C binary fast-import --export-marks=../text-marks <dump &&
+	git -C binary fast-import --import-marks=../binary-marks \
+		--marks-format=text --export-marks=../converted-marks </dev/null &&
+	test_cmp text-marks converted-marks
+'
+
+test_expect_success 'binary marks are looked up as they are used' '
+	cat >input <<-EOF &&
+	commit refs/heads/binary
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+	data <<COMMIT
+	uses a mark
+	COMMIT
+	M 100644 :1 file
+
+	EOF
+	git -C binary fast-import --import-marks=../binary-marks <input &&
+	git -C binary rev-parse binary:file >actual &&
+	git -C binary rev-parse HEAD:one.t >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'binary marks are appended to the file they came from' '
+	cp binary-marks appended-marks &&
+	rec=$(($(test_oid rawsz) + 8)) &&
+	size=$(test_file_size appended-marks) &&
+	cat >input <<-EOF &&
+	blob
+	mark :1024
+	data 5
+	blob
+
+	checkpoint
+
+	EOF
+	git -C binary fast-import --import-marks=../appended-marks \
+		--export-marks=../appended-marks <input &&
+	test_file_size appended-marks >actual &&
+	echo $(($size + $rec)) >expect &&
+	test_cmp expect actual &&
+	git -C binary fast-import --import-marks=../appended-marks \
+		--marks-format=text --export-marks=../text-marks </dev/null &&
+	grep "^:1024 $(echo blob | git hash-object --stdin)\$" text-marks
+'
+
+test_expect_success 'binary marks are written anew when the log grows large' '
+	for i in $(test_seq 1025 1030)
+	do
+		echo blob &&
+		echo "mark :$i" &&
+		echo "data 5" &&
+		echo "blob" || return 1
+	done >input &&
+	git -C binary fast-import --import-marks=../appended-marks \
+		--export-marks=../appended-marks <input &&
+	git -C binary fast-import --import-marks=../appended-marks \
+		--marks-format=text --export-marks=../text-marks </dev/null &&
+	rawsz=$(test_oid rawsz) &&
+	echo $((20 + $(wc -l <text-marks) * ($rawsz + 8) + $rawsz)) >expect &&
+	test_file_size appended-marks >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,89 @@
+#include "test-lib.h"
+#include "ewah/ewok.h"
+
+static uint64_t next_random(uint64_t *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/*
+ * A bitmap of "nr" words that mixes runs of zeroes, runs of ones and
+ * literal words, so that its compressed form has all of them.
+ */
+static struct bitmap *random_bitmap(size_t nr, uint64_t *state)
+{
+	struct bitmap *b = bitmap_word_alloc(nr);
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		switch (next_random(state) % 4) {
+		case 0:
+			b->words[i] = 0;
+			break;
+		case 1:
+			b->words[i] = ~(eword_t)0;
+			break;
+		default:
+			b->words[i] = next_random(state);
+			break;
+		}
+	}
+	return b;
+}
+
+static void check_words(struct bitmap *b, size_t max)
+{
+	struct ewah_bitmap *ewah = bitmap_to_ewah(b);
+	struct ewah_iterator it;
+	const eword_t *literals;
+	eword_t fill, word;
+	size_t nr, i = 0, j;
+
+	ewah_iterator_init(&it, ewah);
+	while ((nr = ewah_iterator_next_words(&literals, &fill, max, &it))) {
+		if (!check_uint(nr, <=, max) ||
+		    !check_uint(i + nr, <=, b->word_alloc))
+			break;
+		for (j = 0; j < nr; j++)
+			check_uint(literals ? literals[j] : fill, ==,
+				   b->words[i + j]);
+		if (!literals)
+			check(fill == 0 || fill == ~(eword_t)0);
+		i += nr;
+
+		/* the word-by-word iterator picks up where we stopped */
+		if (i < b->word_alloc && ewah_iterator_next(&word, &it))
+			check_uint(word, ==, b->words[i++]);
+	}
+
+	/* trailing zero words may be left out */
+	for (; i < b->word_alloc; i++)
+		check_uint(b->words[i], ==, 0);
+
+	ewah_free(ewah);
+}
+
+static void t_next_words(void)
+{
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	size_t nr, max;
+
+	for (nr = 1; nr <= 100; nr++) {
+		struct bitmap *b = random_bitmap(nr, &state);
+
+		for (max = 1; max <= 5; max++)
+			check_words(b, max);
+		check_words(b, SIZE_MAX);
+		bitmap_free(b);
+	}
+}
+
+int cmd_main(int argc, const char **argv)
+{
+	TEST(t_next_words(), "ewah_iterator_next_words yields all words");
+	return test_done();
+}
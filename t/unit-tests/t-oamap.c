@@ -0,0 +1,156 @@
+#include "test-lib.h"
+#include "oamap.h"
+
+struct test_entry {
+	int key;
+	int value;
+};
+
+static int test_entry_cmp(const void *cmp_data UNUSED,
+			  const void *entry, const void *key)
+{
+	const struct test_entry *e = entry;
+
+	return e->key != *(const int *)key;
+}
+
+/*
+ * The hash functions are poor on purpose, so that the entries collide
+ * and have to be probed for.
+ */
+static unsigned int hash_mod(int key)
+{
+	return key % 7;
+}
+
+static unsigned int hash_const(int key UNUSED)
+{
+	return 0xffffffffu;
+}
+
+#define NR_ENTRIES 1000
+
+static struct test_entry *alloc_entries(void)
+{
+	struct test_entry *entries;
+	int i;
+
+	ALLOC_ARRAY(entries, NR_ENTRIES);
+	for (i = 0; i < NR_ENTRIES; i++) {
+		entries[i].key = i;
+		entries[i].value = 2 * i;
+	}
+	return entries;
+}
+
+static void t_empty(void)
+{
+	struct oamap map = OAMAP_INIT(test_entry_cmp, NULL);
+	struct oamap_iter iter;
+	int key = 1;
+
+	check(!oamap_get(&map, 1, &key));
+	check(!oamap_remove(&map, 1, &key));
+	oamap_iter_init(&map, &iter);
+	check(!oamap_iter_next(&iter));
+	check_uint(oamap_get_size(&map), ==, 0);
+	oamap_clear(&map);
+}
+
+static void t_add_get_remove(unsigned int (*hash)(int), size_t initial_size)
+{
+	struct test_entry *entries = alloc_entries();
+	struct oamap map;
+	int i;
+
+	oamap_init(&map, test_entry_cmp, NULL, initial_size);
+	for (i = 0; i < NR_ENTRIES; i++)
+		oamap_add(&map, hash(i), &entries[i]);
+	check_uint(oamap_get_size(&map), ==, NR_ENTRIES);
+
+	for (i = 0; i < NR_ENTRIES; i++) {
+		struct test_entry *e = oamap_get(&map, hash(i), &i);
+
+		if (!check(e == &entries[i]))
+			test_msg("lookup of %d failed", i);
+	}
+
+	/* a key that is not there, with a hash that is */
+	i = NR_ENTRIES;
+	check(!oamap_get(&map, hash(i), &i));
+
+	/* remove every other entry, shifting back the ones after them */
+	for (i = 0; i < NR_ENTRIES; i += 2)
+		check(oamap_remove(&map, hash(i), &i) == &entries[i]);
+	check_uint(oamap_get_size(&map), ==, NR_ENTRIES / 2);
+
+	for (i = 0; i < NR_ENTRIES; i++) {
+		struct test_entry *e = oamap_get(&map, hash(i), &i);
+
+		if (!check(e == (i % 2 ? &entries[i] : NULL)))
+			test_msg("lookup of %d after removal failed", i);
+	}
+
+	oamap_clear(&map);
+	free(entries);
+}
+
+static void t_remove_entry(void)
+{
+	struct test_entry a = { .key = 1, .value = 1 };
+	struct test_entry b = { .key = 1, .value = 2 };
+	struct oamap map;
+	int key = 1;
+
+	oamap_init(&map, test_entry_cmp, NULL, 0);
+	oamap_add(&map, 5, &a);
+	oamap_add(&map, 5, &b);
+
+	check(oamap_remove_entry(&map, 5, &b) == &b);
+	check(!oamap_remove_entry(&map, 5, &b));
+	check(oamap_get(&map, 5, &key) == &a);
+	check_uint(oamap_get_size(&map), ==, 1);
+
+	oamap_clear(&map);
+}
+
+static void t_iterate(void)
+{
+	struct test_entry *entries = alloc_entries();
+	struct test_entry *e;
+	struct oamap_iter iter;
+	struct oamap map;
+	int *seen;
+	int i, nr = 0;
+
+	CALLOC_ARRAY(seen, NR_ENTRIES);
+	oamap_init(&map, test_entry_cmp, NULL, 0);
+	for (i = 0; i < NR_ENTRIES; i++)
+		oamap_add(&map, hash_mod(i), &entries[i]);
+
+	oamap_for_each_entry(&map, &iter, e) {
+		check_int(e->value, ==, 2 * e->key);
+		seen[e->key]++;
+		nr++;
+	}
+	check_int(nr, ==, NR_ENTRIES);
+	for (i = 0; i < NR_ENTRIES; i++)
+		if (!check_int(seen[i], ==, 1))
+			test_msg("entry %d", i);
+
+	oamap_clear(&map);
+	free(seen);
+	free(entries);
+}
+
+int cmd_main(int argc, const char **argv)
+{
+	TEST(t_empty(), "empty map has no entries");
+	TEST(t_add_get_remove(hash_mod, 0), "colliding hashes");
+	TEST(t_add_get_remove(hash_mod, NR_ENTRIES), "colliding hashes, presized");
+	TEST(t_add_get_remove(hash_const, 0), "identical hashes wrap around");
+	TEST(t_remove_entry(), "remove a specific entry among equal ones");
+	TEST(t_iterate(), "iteration visits every entry once");
+
+	return test_done();
+}
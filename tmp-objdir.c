@@ -212,6 +212,14 @@ static int migrate_one(struct strbuf *src, struct strbuf *dst)
 	if (stat(src->buf, &st) < 0)
 		return -1;
 	if (S_ISDIR(st.st_mode)) {
+		/*
+		 * A directory that the destination does not have yet, like
+		 * a loose object directory of a fresh fanout, can be moved
+		 * over as a whole instead of object by object.
+		 */
+		if (lstat(dst->buf, &st) < 0 && errno == ENOENT &&
+		    !rename(src->buf, dst->buf))
+			return adjust_shared_perm(dst->buf);
 		if (!mkdir(dst->buf, 0777)) {
 			if (adjust_shared_perm(dst->buf))
 				return -1;
@@ -37,6 +37,7 @@ static struct tr2_tgt *tr2_tgt_builtins[] =
 	&tr2_tgt_normal,
 	&tr2_tgt_perf,
 	&tr2_tgt_event,
+	&tr2_tgt_flame,
 	NULL
 };
 /* clang-format on */
@@ -510,6 +510,11 @@ enum trace2_timer_id {
 	TRACE2_TIMER_ID_TEST1 = 0, /* emits summary event only */
 	TRACE2_TIMER_ID_TEST2,     /* emits summary and thread events */
 
+	/* time spent in the object layer */
+	TRACE2_TIMER_ID_UNPACK_ENTRY,
+	TRACE2_TIMER_ID_INFLATE,
+	TRACE2_TIMER_ID_READ_INDEX,
+
 	/* Add additional timer definitions before here. */
 	TRACE2_NUMBER_OF_TIMERS
 };
@@ -558,6 +563,17 @@ enum trace2_counter_id {
 	TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY,
 	TRACE2_COUNTER_ID_FSYNC_HARDWARE_FLUSH,
 
+	/* counts hits and misses of the delta base cache */
+	TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT,
+	TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS,
+
+	/* counts pack windows mapped and the bytes mapped by them */
+	TRACE2_COUNTER_ID_PACK_MMAP,
+	TRACE2_COUNTER_ID_PACK_MMAP_BYTES,
+
+	TRACE2_COUNTER_ID_LOOSE_OBJECT_LOOKUP, /* counts loose object lookups */
+	TRACE2_COUNTER_ID_LOOKUP_OBJECT_PROBES, /* counts hash collisions */
+
 	/* Add additional counter definitions before here. */
 	TRACE2_NUMBER_OF_COUNTERS
 };
@@ -42,6 +42,36 @@ static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTER
 		.name = "hardware-flush",
 		.want_per_thread_events = 0,
 	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT] = {
+		.category = "delta-base-cache",
+		.name = "hit",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS] = {
+		.category = "delta-base-cache",
+		.name = "miss",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_PACK_MMAP] = {
+		.category = "pack",
+		.name = "mmap",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_PACK_MMAP_BYTES] = {
+		.category = "pack",
+		.name = "mmap-bytes",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_LOOSE_OBJECT_LOOKUP] = {
+		.category = "loose-object",
+		.name = "lookup",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_LOOKUP_OBJECT_PROBES] = {
+		.category = "object",
+		.name = "lookup-probes",
+		.want_per_thread_events = 0,
+	},
 
 	/* Add additional metadata before here. */
 };
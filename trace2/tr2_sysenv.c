@@ -52,6 +52,9 @@ static struct tr2_sysenv_entry tr2_sysenv_settings[] = {
 	[TR2_SYSENV_PERF_BRIEF]    = { "GIT_TRACE2_PERF_BRIEF",
 				       "trace2.perfbrief" },
 
+	[TR2_SYSENV_FLAME]         = { "GIT_TRACE2_FLAME",
+				       "trace2.flametarget" },
+
 	[TR2_SYSENV_MAX_FILES]     = { "GIT_TRACE2_MAX_FILES",
 				       "trace2.maxfiles" },
 };
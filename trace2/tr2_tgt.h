@@ -154,6 +154,7 @@ struct tr2_tgt {
 /* clang-format on */
 
 extern struct tr2_tgt tr2_tgt_event;
+extern struct tr2_tgt tr2_tgt_flame;
 extern struct tr2_tgt tr2_tgt_normal;
 extern struct tr2_tgt tr2_tgt_perf;
 
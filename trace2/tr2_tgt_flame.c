@@ -0,0 +1,299 @@
+#include "git-compat-util.h"
+#include "thread-utils.h"
+#include "trace2/tr2_dst.h"
+#include "trace2/tr2_sysenv.h"
+#include "trace2/tr2_tgt.h"
+#include "trace2/tr2_tls.h"
+
+static struct tr2_dst tr2dst_flame = {
+	.sysenv_var = TR2_SYSENV_FLAME,
+};
+
+/*
+ * The flame target does not write anything until the process exits.
+ * Until then it aggregates the regions of all threads into one tree,
+ * in which the children of a node are the regions that were entered
+ * while it was open.  A region entered several times at the same place
+ * has a single node, which adds up the time spent in all of them.
+ *
+ * The children of the root of the tree are the threads, by name, and
+ * their time is the time that they ran for.
+ */
+struct flame_node {
+	struct flame_node *parent;
+	struct flame_node *children;
+	struct flame_node *next_sibling;
+	char *frame;
+	uint64_t us_total;
+};
+
+static struct flame_node flame_root; /* access under tr2tls_lock() */
+static char *flame_command_name;
+
+/*
+ * The innermost open region of each thread, or the node of the thread
+ * itself when there is none.
+ */
+static pthread_key_t flame_key;
+static struct flame_node *flame_main_current;
+static int flame_initialized;
+
+static int fn_init(void)
+{
+	int want = tr2_dst_trace_want(&tr2dst_flame);
+
+	if (!want)
+		return want;
+
+	pthread_key_create(&flame_key, NULL);
+	flame_initialized = 1;
+	return want;
+}
+
+static void free_flame_children(struct flame_node *node)
+{
+	struct flame_node *child = node->children;
+
+	while (child) {
+		struct flame_node *next = child->next_sibling;
+
+		free_flame_children(child);
+		free(child->frame);
+		free(child);
+		child = next;
+	}
+	node->children = NULL;
+}
+
+static void fn_term(void)
+{
+	if (flame_initialized) {
+		free_flame_children(&flame_root);
+		FREE_AND_NULL(flame_command_name);
+		flame_main_current = NULL;
+		pthread_key_delete(flame_key);
+		flame_initialized = 0;
+	}
+	tr2_dst_trace_disable(&tr2dst_flame);
+}
+
+/*
+ * Frames of the collapsed stack format are separated by semicolons and
+ * the stack is separated from its value by a space.
+ */
+static void append_frame(struct strbuf *buf, const char *s)
+{
+	for (; *s; s++)
+		strbuf_addch(buf, (*s == ';' || isspace(*s)) ? '_' : *s);
+}
+
+static struct flame_node *get_child(struct flame_node *parent,
+				    const char *frame)
+{
+	struct flame_node **pp = &parent->children;
+
+	for (; *pp; pp = &(*pp)->next_sibling)
+		if (!strcmp((*pp)->frame, frame))
+			return *pp;
+
+	CALLOC_ARRAY(*pp, 1);
+	(*pp)->parent = parent;
+	(*pp)->frame = xstrdup(frame);
+	return *pp;
+}
+
+static struct flame_node *get_current(void)
+{
+	struct tr2tls_thread_ctx *ctx;
+	struct flame_node *current;
+	const char *name;
+
+	if (!HAVE_THREADS || tr2tls_is_main_thread()) {
+		if (!flame_main_current)
+			flame_main_current = get_child(&flame_root, "main");
+		return flame_main_current;
+	}
+
+	current = pthread_getspecific(flame_key);
+	if (current)
+		return current;
+
+	/*
+	 * Drop the "th<id>:" prefix of the thread name, so that all of
+	 * the threads started by the same thread-proc share a node.
+	 */
+	ctx = tr2tls_get_self();
+	name = strchr(ctx->thread_name, ':');
+	name = name ? name + 1 : ctx->thread_name;
+	current = get_child(&flame_root, name);
+	pthread_setspecific(flame_key, current);
+	return current;
+}
+
+static void set_current(struct flame_node *current)
+{
+	if (!HAVE_THREADS || tr2tls_is_main_thread())
+		flame_main_current = current;
+	else
+		pthread_setspecific(flame_key, current);
+}
+
+static struct flame_node *thread_node(struct flame_node *node)
+{
+	while (node->parent != &flame_root)
+		node = node->parent;
+	return node;
+}
+
+static void fn_command_name_fl(const char *file UNUSED, int line UNUSED,
+			       const char *name,
+			       const char *hierarchy UNUSED)
+{
+	tr2tls_lock();
+	free(flame_command_name);
+	flame_command_name = xstrdup(name);
+	tr2tls_unlock();
+}
+
+static void fn_thread_exit_fl(const char *file UNUSED, int line UNUSED,
+			      uint64_t us_elapsed_absolute UNUSED,
+			      uint64_t us_elapsed_thread)
+{
+	struct flame_node *node;
+
+	tr2tls_lock();
+	node = thread_node(get_current());
+	node->us_total += us_elapsed_thread;
+	tr2tls_unlock();
+
+	pthread_setspecific(flame_key, NULL);
+}
+
+static void fn_region_enter_printf_va_fl(const char *file UNUSED,
+					 int line UNUSED,
+					 uint64_t us_elapsed_absolute UNUSED,
+					 const char *category,
+					 const char *label,
+					 const struct repository *repo UNUSED,
+					 const char *fmt UNUSED,
+					 va_list ap UNUSED)
+{
+	struct strbuf frame = STRBUF_INIT;
+
+	if (category && *category) {
+		strbuf_addstr(&frame, category);
+		strbuf_addch(&frame, ':');
+	}
+	strbuf_addstr(&frame, label ? label : "");
+
+	tr2tls_lock();
+	set_current(get_child(get_current(), frame.buf));
+	tr2tls_unlock();
+
+	strbuf_release(&frame);
+}
+
+static void fn_region_leave_printf_va_fl(
+	const char *file UNUSED, int line UNUSED,
+	uint64_t us_elapsed_absolute UNUSED,
+	uint64_t us_elapsed_region, const char *category UNUSED,
+	const char *label UNUSED, const struct repository *repo UNUSED,
+	const char *fmt UNUSED, va_list ap UNUSED)
+{
+	struct flame_node *current;
+
+	tr2tls_lock();
+	current = get_current();
+	/* ignore a leave without an enter */
+	if (current->parent != &flame_root) {
+		current->us_total += us_elapsed_region;
+		set_current(current->parent);
+	}
+	tr2tls_unlock();
+}
+
+/*
+ * Write a line of "<frame>;<frame>;... <self>" for each node that
+ * spent time by itself, i.e. outside of its children.  Regions that
+ * were never left have no time, so the self time is clamped at zero.
+ */
+static void write_flame_node(struct strbuf *out, struct strbuf *stack,
+			     const struct flame_node *node)
+{
+	const struct flame_node *child;
+	size_t len = stack->len;
+	uint64_t us_children = 0;
+
+	strbuf_addch(stack, ';');
+	append_frame(stack, node->frame);
+
+	for (child = node->children; child; child = child->next_sibling)
+		us_children += child->us_total;
+	if (node->us_total > us_children) {
+		strbuf_addbuf(out, stack);
+		strbuf_addf(out, " %"PRIu64"\n", node->us_total - us_children);
+	}
+
+	for (child = node->children; child; child = child->next_sibling)
+		write_flame_node(out, stack, child);
+
+	strbuf_setlen(stack, len);
+}
+
+static void fn_atexit(uint64_t us_elapsed_absolute, int code UNUSED)
+{
+	struct strbuf out = STRBUF_INIT;
+	struct strbuf stack = STRBUF_INIT;
+	const struct flame_node *node;
+	struct flame_node *main_node;
+
+	tr2tls_lock();
+	main_node = get_child(&flame_root, "main");
+	main_node->us_total += us_elapsed_absolute;
+
+	append_frame(&stack, flame_command_name ? flame_command_name : "git");
+	for (node = flame_root.children; node; node = node->next_sibling)
+		write_flame_node(&out, &stack, node);
+	tr2tls_unlock();
+
+	if (out.len)
+		tr2_dst_write_line(&tr2dst_flame, &out);
+
+	strbuf_release(&out);
+	strbuf_release(&stack);
+}
+
+struct tr2_tgt tr2_tgt_flame = {
+	.pdst = &tr2dst_flame,
+
+	.pfn_init = fn_init,
+	.pfn_term = fn_term,
+
+	.pfn_version_fl = NULL,
+	.pfn_start_fl = NULL,
+	.pfn_exit_fl = NULL,
+	.pfn_signal = NULL,
+	.pfn_atexit = fn_atexit,
+	.pfn_error_va_fl = NULL,
+	.pfn_command_path_fl = NULL,
+	.pfn_command_ancestry_fl = NULL,
+	.pfn_command_name_fl = fn_command_name_fl,
+	.pfn_command_mode_fl = NULL,
+	.pfn_alias_fl = NULL,
+	.pfn_child_start_fl = NULL,
+	.pfn_child_exit_fl = NULL,
+	.pfn_child_ready_fl = NULL,
+	.pfn_thread_start_fl = NULL,
+	.pfn_thread_exit_fl = fn_thread_exit_fl,
+	.pfn_exec_fl = NULL,
+	.pfn_exec_result_fl = NULL,
+	.pfn_param_fl = NULL,
+	.pfn_repo_fl = NULL,
+	.pfn_region_enter_printf_va_fl = fn_region_enter_printf_va_fl,
+	.pfn_region_leave_printf_va_fl = fn_region_leave_printf_va_fl,
+	.pfn_data_fl = NULL,
+	.pfn_data_json_fl = NULL,
+	.pfn_printf_va_fl = NULL,
+	.pfn_timer = NULL,
+	.pfn_counter = NULL,
+};
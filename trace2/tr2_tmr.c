@@ -31,6 +31,21 @@ static struct tr2_timer_metadata tr2_timer_metadata[TRACE2_NUMBER_OF_TIMERS] = {
 		.name = "test2",
 		.want_per_thread_events = 1,
 	},
+	[TRACE2_TIMER_ID_UNPACK_ENTRY] = {
+		.category = "pack",
+		.name = "unpack-entry",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_TIMER_ID_INFLATE] = {
+		.category = "object",
+		.name = "inflate",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_TIMER_ID_READ_INDEX] = {
+		.category = "index",
+		.name = "read",
+		.want_per_thread_events = 0,
+	},
 
 	/* Add additional metadata before here. */
 };
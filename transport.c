@@ -1566,11 +1566,24 @@ void transport_unlock_pack(struct transport *transport, unsigned int flags)
 	int in_signal_handler = !!(flags & TRANSPORT_UNLOCK_PACK_IN_SIGNAL_HANDLER);
 	int i;
 
-	for (i = 0; i < transport->pack_lockfiles.nr; i++)
-		if (in_signal_handler)
-			unlink(transport->pack_lockfiles.items[i].string);
-		else
-			unlink_or_warn(transport->pack_lockfiles.items[i].string);
+	for (i = 0; i < transport->pack_lockfiles.nr; i++) {
+		const char *lockfile = transport->pack_lockfiles.items[i].string;
+		size_t len;
+
+		if (in_signal_handler) {
+			unlink(lockfile);
+			continue;
+		}
+		unlink_or_warn(lockfile);
+
+		/* index-pack --record-boundary leaves this next to it */
+		if (strip_suffix(lockfile, ".keep", &len)) {
+			char *boundary = xstrfmt("%.*s.boundary", (int)len,
+						 lockfile);
+			unlink_or_warn(boundary);
+			free(boundary);
+		}
+	}
 	if (!in_signal_handler)
 		string_list_clear(&transport->pack_lockfiles, 0);
 }
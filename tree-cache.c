@@ -0,0 +1,421 @@
+#include "git-compat-util.h"
+#include "tree-cache.h"
+#include "chunk-format.h"
+#include "commit.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "gettext.h"
+#include "hash-lookup.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "oidset.h"
+#include "path.h"
+#include "progress.h"
+#include "replace-object.h"
+#include "repository.h"
+#include "trace2.h"
+#include "tree-walk.h"
+
+#define TREE_CACHE_HEADER_SIZE (16)
+#define TREE_CACHE_FANOUT_SIZE (256 * 4)
+
+struct tree_cache {
+	void *map;
+	size_t map_size;
+
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *oids;
+	const unsigned char *offsets;
+	const unsigned char *data;
+	uint64_t data_size;
+};
+
+static char *tree_cache_filename(struct object_directory *odb)
+{
+	return xstrfmt("%s/info/tree-cache", odb->path);
+}
+
+static struct tree_cache *load_tree_cache(const char *path)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	struct tree_cache *tc;
+	const unsigned char *data;
+	struct stat st;
+	uint64_t prev = 0;
+	size_t size, min_size;
+	uint32_t i;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < TREE_CACHE_HEADER_SIZE + TREE_CACHE_FANOUT_SIZE + rawsz) {
+		close(fd);
+		return NULL;
+	}
+
+	CALLOC_ARRAY(tc, 1);
+	tc->map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	tc->map_size = size;
+	close(fd);
+
+	data = tc->map;
+	if (get_be32(data) != TREE_CACHE_SIGNATURE ||
+	    get_be32(data + 4) != TREE_CACHE_VERSION ||
+	    get_be32(data + 8) != oid_version(the_hash_algo))
+		goto invalid;
+	tc->nr = get_be32(data + 12);
+
+	tc->fanout = data + TREE_CACHE_HEADER_SIZE;
+	if (get_be32(tc->fanout + 255 * 4) != tc->nr)
+		goto invalid;
+	tc->oids = tc->fanout + TREE_CACHE_FANOUT_SIZE;
+
+	min_size = st_add3(TREE_CACHE_HEADER_SIZE + TREE_CACHE_FANOUT_SIZE,
+			   st_mult(tc->nr, rawsz + 8), rawsz);
+	if (size < min_size)
+		goto invalid;
+	tc->offsets = tc->oids + st_mult(tc->nr, rawsz);
+	tc->data = tc->offsets + st_mult(tc->nr, 8);
+
+	for (i = 0; i < tc->nr; i++) {
+		uint64_t end = get_be64(tc->offsets + st_mult(i, 8));
+		if (end < prev)
+			goto invalid;
+		prev = end;
+	}
+	tc->data_size = prev;
+	if (size - min_size != tc->data_size)
+		goto invalid;
+
+	return tc;
+
+invalid:
+	warning(_("ignoring invalid tree cache '%s'"), path);
+	tree_cache_free(tc);
+	return NULL;
+}
+
+struct tree_cache *odb_tree_cache(struct object_directory *odb)
+{
+	char *path;
+
+	if (odb->tree_cache || odb->tree_cache_checked)
+		return odb->tree_cache;
+	odb->tree_cache_checked = 1;
+
+	prepare_repo_settings(the_repository);
+	if (!the_repository->settings.core_tree_cache ||
+	    odb != the_repository->objects->odb)
+		return NULL;
+
+	path = tree_cache_filename(odb);
+	odb->tree_cache = load_tree_cache(path);
+	free(path);
+	if (odb->tree_cache)
+		trace2_data_intmax("tree-cache", the_repository, "trees",
+				   odb->tree_cache->nr);
+
+	return odb->tree_cache;
+}
+
+static int tree_cache_pos(const struct tree_cache *tc,
+			  const struct object_id *oid, uint32_t *pos)
+{
+	return bsearch_hash(oid->hash, (const uint32_t *)tc->fanout, tc->oids,
+			    the_hash_algo->rawsz, pos);
+}
+
+static const unsigned char *tree_cache_contents(const struct tree_cache *tc,
+						uint32_t pos, size_t *size)
+{
+	uint64_t start = pos ? get_be64(tc->offsets + st_mult(pos - 1, 8)) : 0;
+	uint64_t end = get_be64(tc->offsets + st_mult(pos, 8));
+
+	*size = xsize_t(end - start);
+	return tc->data + start;
+}
+
+void *tree_cache_read(struct repository *r, const struct object_id *oid,
+		      unsigned long *size)
+{
+	struct tree_cache *tc;
+	const unsigned char *contents;
+	size_t len;
+	uint32_t pos;
+
+	if (r != the_repository)
+		return NULL;
+
+	obj_read_lock();
+	tc = odb_tree_cache(r->objects->odb);
+	obj_read_unlock();
+	if (!tc)
+		return NULL;
+
+	oid = lookup_replace_object(r, oid);
+	if (!tree_cache_pos(tc, oid, &pos))
+		return NULL;
+
+	/*
+	 * The cache may outlive the objects it was written for; do not
+	 * make a tree that has gone missing (or was never there, in a
+	 * corrupt repository) appear to be present.
+	 */
+	if (!repo_has_object_file_with_flags(r, oid,
+					     OBJECT_INFO_QUICK |
+					     OBJECT_INFO_SKIP_FETCH_OBJECT))
+		return NULL;
+
+	contents = tree_cache_contents(tc, pos, &len);
+	*size = cast_size_t_to_ulong(len);
+	return xmemdupz(contents, len);
+}
+
+int tree_cache_exists(struct object_directory *odb)
+{
+	char *path = tree_cache_filename(odb);
+	int ret = file_exists(path);
+
+	free(path);
+	return ret;
+}
+
+void remove_tree_cache(struct object_directory *odb)
+{
+	char *path = tree_cache_filename(odb);
+
+	tree_cache_free(odb->tree_cache);
+	odb->tree_cache = NULL;
+	odb->tree_cache_checked = 0;
+	unlink_or_warn(path);
+	free(path);
+}
+
+void tree_cache_free(struct tree_cache *tc)
+{
+	if (!tc)
+		return;
+	if (tc->map)
+		munmap(tc->map, tc->map_size);
+	free(tc);
+}
+
+struct tree_cache_entry {
+	struct object_id oid;
+	unsigned long size;
+	const unsigned char *cached;
+};
+
+struct tree_cache_writer {
+	struct repository *r;
+	struct oidset seen;
+	struct tree_cache_entry *entries;
+	size_t nr, alloc;
+	struct progress *progress;
+};
+
+static void add_entry(struct tree_cache_writer *w, const struct object_id *oid,
+		      unsigned long size, const unsigned char *cached)
+{
+	ALLOC_GROW(w->entries, w->nr + 1, w->alloc);
+	oidcpy(&w->entries[w->nr].oid, oid);
+	w->entries[w->nr].size = size;
+	w->entries[w->nr].cached = cached;
+	w->nr++;
+	display_progress(w->progress, w->nr);
+}
+
+static int add_trees(struct tree_cache_writer *w, const struct object_id *root)
+{
+	struct object_id *stack = NULL;
+	size_t stack_nr = 0, stack_alloc = 0;
+	int ret = 0;
+
+	if (oidset_insert(&w->seen, root))
+		return 0;
+	ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+	oidcpy(&stack[stack_nr++], root);
+
+	while (stack_nr) {
+		struct object_id oid;
+		struct tree_desc desc;
+		struct name_entry entry;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		oidcpy(&oid, &stack[--stack_nr]);
+		buf = repo_read_object_file(w->r, &oid, &type, &size);
+		if (!buf || type != OBJ_TREE) {
+			free(buf);
+			ret = error(_("could not read tree %s"), oid_to_hex(&oid));
+			break;
+		}
+		if (init_tree_desc_gently(&desc, buf, size, 0)) {
+			free(buf);
+			ret = error(_("could not parse tree %s"), oid_to_hex(&oid));
+			break;
+		}
+		while (tree_entry_gently(&desc, &entry)) {
+			if (!S_ISDIR(entry.mode) ||
+			    oidset_insert(&w->seen, &entry.oid))
+				continue;
+			ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+			oidcpy(&stack[stack_nr++], &entry.oid);
+		}
+		free(buf);
+
+		add_entry(w, &oid, size, NULL);
+	}
+
+	free(stack);
+	return ret;
+}
+
+static int tree_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct tree_cache_entry *a = va, *b = vb;
+	return oidcmp(&a->oid, &b->oid);
+}
+
+static int write_entries(struct tree_cache_writer *w, struct hashfile *f)
+{
+	uint32_t fanout[256] = { 0 };
+	uint64_t end = 0;
+	size_t i;
+
+	for (i = 0; i < w->nr; i++)
+		fanout[w->entries[i].oid.hash[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	hashwrite_be32(f, TREE_CACHE_SIGNATURE);
+	hashwrite_be32(f, TREE_CACHE_VERSION);
+	hashwrite_be32(f, oid_version(the_hash_algo));
+	hashwrite_be32(f, w->nr);
+	for (i = 0; i < 256; i++)
+		hashwrite_be32(f, fanout[i]);
+	for (i = 0; i < w->nr; i++)
+		hashwrite(f, w->entries[i].oid.hash, the_hash_algo->rawsz);
+	for (i = 0; i < w->nr; i++) {
+		end += w->entries[i].size;
+		hashwrite_be64(f, end);
+	}
+
+	for (i = 0; i < w->nr; i++) {
+		struct tree_cache_entry *e = &w->entries[i];
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		if (e->cached) {
+			hashwrite(f, e->cached, e->size);
+			continue;
+		}
+
+		buf = repo_read_object_file(w->r, &e->oid, &type, &size);
+		if (!buf || type != OBJ_TREE || size != e->size) {
+			free(buf);
+			return error(_("could not read tree %s"),
+				     oid_to_hex(&e->oid));
+		}
+		hashwrite(f, buf, size);
+		free(buf);
+	}
+
+	return 0;
+}
+
+int write_tree_cache(struct repository *r, struct object_directory *odb,
+		     struct commit **commits, size_t nr,
+		     int keep_existing, int report_progress)
+{
+	struct tree_cache_writer w = { .r = r, .seen = OIDSET_INIT };
+	struct tree_cache *old = NULL;
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	char *path;
+	size_t i;
+	int ret = 0;
+
+	trace2_region_enter("tree-cache", "write", r);
+
+	path = tree_cache_filename(odb);
+	if (keep_existing)
+		old = load_tree_cache(path);
+
+	if (report_progress)
+		w.progress = start_delayed_progress(_("Collecting trees for the tree cache"), 0);
+
+	if (old) {
+		for (i = 0; i < old->nr; i++) {
+			struct object_id oid;
+			const unsigned char *contents;
+			size_t len;
+
+			oidread(&oid, old->oids + st_mult(i, r->hash_algo->rawsz));
+			if (!repo_has_object_file_with_flags(r, &oid,
+							     OBJECT_INFO_SKIP_FETCH_OBJECT))
+				continue;
+			contents = tree_cache_contents(old, i, &len);
+			oidset_insert(&w.seen, &oid);
+			add_entry(&w, &oid, cast_size_t_to_ulong(len), contents);
+		}
+	}
+
+	for (i = 0; i < nr && !ret; i++) {
+		struct object_id *tree = get_commit_tree_oid(commits[i]);
+
+		if (tree)
+			ret = add_trees(&w, tree);
+	}
+	stop_progress(&w.progress);
+	if (ret)
+		goto cleanup;
+
+	QSORT(w.entries, w.nr, tree_cache_entry_cmp);
+
+	if (safe_create_leading_directories(path) < 0) {
+		ret = error_errno(_("unable to create leading directories of %s"),
+				  path);
+		goto cleanup;
+	}
+	hold_lock_file_for_update(&lk, path, LOCK_DIE_ON_ERROR);
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	ret = write_entries(&w, f);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_COMMIT_GRAPH,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	if (ret) {
+		rollback_lock_file(&lk);
+		goto cleanup;
+	}
+
+	/* Let go of any mapping of the file we are about to replace. */
+	tree_cache_free(old);
+	old = NULL;
+	tree_cache_free(odb->tree_cache);
+	odb->tree_cache = NULL;
+	odb->tree_cache_checked = 0;
+
+	if (adjust_shared_perm(get_lock_file_path(&lk)) < 0 ||
+	    commit_lock_file(&lk) < 0) {
+		rollback_lock_file(&lk);
+		ret = error_errno(_("unable to write tree cache '%s'"), path);
+	}
+
+cleanup:
+	tree_cache_free(old);
+	oidset_clear(&w.seen);
+	free(w.entries);
+	free(path);
+	trace2_region_leave("tree-cache", "write", r);
+	return ret;
+}
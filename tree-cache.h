@@ -0,0 +1,71 @@
+#ifndef TREE_CACHE_H
+#define TREE_CACHE_H
+
+#include "object-store-ll.h"
+
+struct commit;
+
+#define TREE_CACHE_SIGNATURE 0x54524543 /* "TREC" */
+#define TREE_CACHE_VERSION 1
+
+/*
+ * The tree cache ("$GIT_OBJECT_DIRECTORY/info/tree-cache") keeps the
+ * contents of the trees reachable from the commits of the commit-graph
+ * uncompressed, so that walking them, e.g. for "git log --raw" or
+ * "git rev-list --objects", does not have to inflate them and resolve
+ * their deltas again and again. It is written by "git commit-graph write
+ * --tree-cache".
+ *
+ * The file consists of:
+ *
+ *   - a 16-byte header: the signature, the version, the hash id and the
+ *     number of trees
+ *
+ *   - a 256-entry fan-out table of 32-bit counts, like in a pack index
+ *
+ *   - the raw object names of the trees, sorted
+ *
+ *   - for each tree, the 64-bit offset of the end of its contents,
+ *     relative to the start of the contents section
+ *
+ *   - the contents of the trees, concatenated in the same order
+ *
+ *   - a trailing checksum of the preceding contents
+ *
+ * All numbers are in network byte order.
+ */
+struct tree_cache;
+
+/*
+ * Return the tree cache of "odb", loading it on first use, or NULL if
+ * there is none or it is not enabled (see core.treeCache).
+ */
+struct tree_cache *odb_tree_cache(struct object_directory *odb);
+
+/*
+ * Return a copy of the contents of tree "oid" if it is in the tree cache
+ * of the repository and still present in its object store, in which
+ * case its size is stored in "size". Return NULL otherwise; the caller
+ * then reads the object as usual.
+ */
+void *tree_cache_read(struct repository *r, const struct object_id *oid,
+		      unsigned long *size);
+
+/*
+ * Write the tree cache of "odb" for the trees reachable from the "nr"
+ * commits. With "keep_existing", the trees of the current cache are
+ * kept, too. Return 0 on success, and -1 on failure.
+ */
+int write_tree_cache(struct repository *r, struct object_directory *odb,
+		     struct commit **commits, size_t nr,
+		     int keep_existing, int report_progress);
+
+/* Return 1 if "odb" has a tree cache file, whether it is used or not. */
+int tree_cache_exists(struct object_directory *odb);
+
+/* Remove the tree cache file of "odb", if any. */
+void remove_tree_cache(struct object_directory *odb);
+
+void tree_cache_free(struct tree_cache *tc);
+
+#endif
@@ -10,6 +10,7 @@
 #include "pathspec.h"
 #include "json-writer.h"
 #include "environment.h"
+#include "tree-cache.h"
 
 static const char *get_mode(const char *str, unsigned int *modep)
 {
@@ -98,7 +99,10 @@ void *fill_tree_descriptor(struct repository *r,
 	void *buf = NULL;
 
 	if (oid) {
-		buf = read_object_with_reference(r, oid, OBJ_TREE, &size, NULL);
+		buf = tree_cache_read(r, oid, &size);
+		if (!buf)
+			buf = read_object_with_reference(r, oid, OBJ_TREE,
+							 &size, NULL);
 		if (!buf)
 			die("unable to read tree %s", oid_to_hex(oid));
 	}
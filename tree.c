@@ -11,6 +11,7 @@
 #include "tree-walk.h"
 #include "repository.h"
 #include "environment.h"
+#include "tree-cache.h"
 
 const char *tree_type = "tree";
 
@@ -194,6 +195,9 @@ int parse_tree_gently(struct tree *item, int quiet_on_missing)
 
 	if (item->object.parsed)
 		return 0;
+	buffer = tree_cache_read(the_repository, &item->object.oid, &size);
+	if (buffer)
+		return parse_tree_buffer(item, buffer, size);
 	buffer = repo_read_object_file(the_repository, &item->object.oid,
 				       &type, &size);
 	if (!buffer)
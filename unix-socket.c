@@ -135,3 +135,92 @@ int unix_stream_listen(const char *path,
 	errno = saved_errno;
 	return -1;
 }
+
+int unix_stream_send_fds(int fd, const void *buf, size_t len,
+			 const int *fds, int nr)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * UNIX_STREAM_MAX_FDS)];
+	} control;
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t n;
+
+	if (!len || nr < 1 || nr > UNIX_STREAM_MAX_FDS)
+		BUG("cannot pass %d descriptors with %"PRIuMAX" bytes",
+		    nr, (uintmax_t)len);
+
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nr);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nr);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nr);
+
+	do {
+		n = sendmsg(fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+
+	/* The descriptors went with the first byte; write the rest as usual. */
+	if (write_in_full(fd, (const char *)buf + n, len - n) < 0)
+		return -1;
+	return 0;
+}
+
+ssize_t unix_stream_recv_fds(int fd, void *buf, size_t len,
+			     int *fds, int *nr)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * UNIX_STREAM_MAX_FDS)];
+	} control;
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int got = 0;
+	ssize_t n;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do {
+		n = recvmsg(fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		int *data = (int *)CMSG_DATA(cmsg);
+		size_t i, count;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < count; i++) {
+			int received;
+
+			memcpy(&received, data + i, sizeof(int));
+			if (got < *nr)
+				fds[got++] = received;
+			else
+				close(received);
+		}
+	}
+	*nr = got;
+	return n;
+}
@@ -12,4 +12,23 @@ int unix_stream_connect(const char *path, int disallow_chdir);
 int unix_stream_listen(const char *path,
 		       const struct unix_stream_listen_opts *opts);
 
+#define UNIX_STREAM_MAX_FDS 4
+
+/*
+ * Write "len" bytes from "buf" to the socket "fd", passing the "nr"
+ * file descriptors in "fds" (at most UNIX_STREAM_MAX_FDS) along with
+ * them. Returns 0 on success and -1 with errno set on error.
+ */
+int unix_stream_send_fds(int fd, const void *buf, size_t len,
+			 const int *fds, int nr);
+
+/*
+ * Read up to "len" bytes into "buf" from the socket "fd", and up to
+ * "*nr" file descriptors that were passed along with them into "fds".
+ * "*nr" is set to the number of descriptors received. Returns the
+ * number of bytes read, or -1 with errno set on error.
+ */
+ssize_t unix_stream_recv_fds(int fd, void *buf, size_t len,
+			     int *fds, int *nr);
+
 #endif /* UNIX_SOCKET_H */
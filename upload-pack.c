@@ -34,6 +34,12 @@
 #include "shallow.h"
 #include "write-or-die.h"
 #include "json-writer.h"
+#include "trace.h"
+#include "lockfile.h"
+#include "chunk-format.h"
+#include "dir.h"
+#include "object-file.h"
+#include "path.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -59,6 +65,10 @@ enum allow_uor {
 	ALLOW_ANY_SHA1 = 0x07
 };
 
+/* Defaults for uploadpack.packCacheMaxSize and uploadpack.packCacheExpire. */
+#define PACK_CACHE_DEFAULT_MAX_SIZE (1024UL * 1024 * 1024)
+#define PACK_CACHE_DEFAULT_EXPIRE "1.day.ago"
+
 /*
  * Please annotate, and if possible group together, fields used only
  * for protocol v0 or only for protocol v2.
@@ -82,6 +92,16 @@ struct upload_pack_data {
 	int shallow_nr;
 	timestamp_t oldest_have;
 
+	/* Budget of negotiation, and what was spent of it. */
+	unsigned long negotiation_max_haves;
+	unsigned long negotiation_max_time;			/* in ms */
+	unsigned long negotiation_haves;
+	uint64_t negotiation_ns;
+
+	/* Count of haves marked, and its value when ok_to_give_up() failed. */
+	unsigned int haves_marked;
+	unsigned int give_up_marked;
+
 	unsigned int timeout;					/* v0 only */
 	enum {
 		NO_MULTI_ACK = 0,
@@ -102,6 +122,9 @@ struct upload_pack_data {
 
 	const char *pack_objects_hook;
 
+	unsigned long pack_cache_max_size;
+	timestamp_t pack_cache_expire;
+
 	unsigned stateless_rpc : 1;				/* v0 only */
 	unsigned no_done : 1;					/* v0 only */
 	unsigned daemon_mode : 1;				/* v0 only */
@@ -111,6 +134,8 @@ struct upload_pack_data {
 	unsigned use_ofs_delta : 1;
 	unsigned no_progress : 1;
 	unsigned use_include_tag : 1;
+	unsigned use_pack_cache : 1;
+	unsigned negotiation_exhausted : 1;
 	unsigned wait_for_done : 1;
 	unsigned allow_filter : 1;
 	unsigned allow_filter_fallback : 1;
@@ -156,10 +181,13 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 
 	data->keepalive = 5;
 	data->advertise_sid = 0;
+	data->pack_cache_max_size = PACK_CACHE_DEFAULT_MAX_SIZE;
+	parse_expiry_date(PACK_CACHE_DEFAULT_EXPIRE, &data->pack_cache_expire);
 }
 
 static void upload_pack_data_clear(struct upload_pack_data *data)
 {
+	packet_writer_release(&data->writer);
 	string_list_clear(&data->symref, 1);
 	string_list_clear(&data->wanted_refs, 1);
 	strvec_clear(&data->hidden_refs);
@@ -215,12 +243,17 @@ struct output_state {
 	 */
 	char buffer[(LARGE_PACKET_DATA_MAX - 1) + 1];
 	int used;
+	/* The pack cache entry that the pack data is copied to, if any. */
+	struct lock_file *pack_cache;
 	unsigned packfile_uris_started : 1;
 	unsigned packfile_started : 1;
 };
 
-static int relay_pack_data(int pack_objects_out, struct output_state *os,
-			   int use_sideband, int write_packfile_line)
+/*
+ * Send what has accumulated in the buffer of `os` to the client.
+ */
+static void relay_output(struct output_state *os, int use_sideband,
+			 int write_packfile_line)
 {
 	/*
 	 * We keep the last byte to ourselves
@@ -232,15 +265,6 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	 * pack data is not good enough to signal
 	 * breakage to downstream.
 	 */
-	ssize_t readsz;
-
-	readsz = xread(pack_objects_out, os->buffer + os->used,
-		       sizeof(os->buffer) - os->used);
-	if (readsz < 0) {
-		return readsz;
-	}
-	os->used += readsz;
-
 	while (!os->packfile_started) {
 		char *p;
 		if (os->used >= 4 && !memcmp(os->buffer, "PACK", 4)) {
@@ -268,7 +292,7 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 			/*
 			 * Incomplete line.
 			 */
-			return readsz;
+			return;
 		}
 	}
 
@@ -280,10 +304,396 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 		send_client_data(1, os->buffer, os->used, use_sideband);
 		os->used = 0;
 	}
+}
 
+static int relay_pack_data(int pack_objects_out, struct output_state *os,
+			   int use_sideband, int write_packfile_line)
+{
+	ssize_t readsz;
+
+	readsz = xread(pack_objects_out, os->buffer + os->used,
+		       sizeof(os->buffer) - os->used);
+	if (readsz < 0) {
+		return readsz;
+	}
+	if (os->pack_cache && readsz &&
+	    write_in_full(get_lock_file_fd(os->pack_cache),
+			  os->buffer + os->used, readsz) < 0) {
+		rollback_lock_file(os->pack_cache);
+		os->pack_cache = NULL;
+	}
+	os->used += readsz;
+
+	relay_output(os, use_sideband, write_packfile_line);
 	return readsz;
 }
 
+/*
+ * With uploadpack.packCache, the output of pack-objects for each
+ * distinct request is kept in "$GIT_DIR/upload-pack-cache/<key>", so
+ * that clients asking for the same objects, like the many clones of a
+ * busy repository, share a single run of pack-objects. The key is a
+ * hash of everything that the output depends on: the options given to
+ * pack-objects besides --progress, and the sorted shallow commits,
+ * wants and haves. With --include-tag, it also covers the generation
+ * of the references (see refs_read_generation()), as they decide which
+ * tags go into the pack.
+ *
+ * Each file consists of a 16-byte header, namely the signature, the
+ * version, the hash id and a zero word, all in network byte order,
+ * followed by the output of pack-objects. There is no checksum of its
+ * own, as the pack data ends with one that the client verifies.
+ *
+ * An entry is written through its lockfile while the pack data is sent
+ * to the first client asking for it. Others asking for the same
+ * objects in the meantime follow the lockfile as it grows, until it is
+ * committed. If it is abandoned instead, e.g. because pack-objects
+ * failed or the first client hung up, they get the same error as if
+ * their own pack-objects had failed, unless nothing was sent to them
+ * yet. Using an entry refreshes its mtime, and after writing a new one
+ * entries are evicted by age and then, least recently used first, by
+ * the total size of the cache.
+ */
+#define PACK_CACHE_SIGNATURE 0x55505043 /* "UPPC" */
+#define PACK_CACHE_VERSION 1
+#define PACK_CACHE_HEADER_SIZE 16
+/* How often to look for more data in an entry that is being written. */
+#define PACK_CACHE_POLL_MS 50
+/* Give up on an entry being written that did not change for this long. */
+#define PACK_CACHE_STALE_SECONDS 600
+
+static int collect_shallow(const struct commit_graft *graft, void *cb_data)
+{
+	struct oid_array *oids = cb_data;
+	if (graft->nr_parent == -1)
+		oid_array_append(oids, &graft->oid);
+	return 0;
+}
+
+static void add_sorted_oids(struct strbuf *buf, const char *name,
+			    struct oid_array *oids)
+{
+	size_t i;
+
+	oid_array_sort(oids);
+	strbuf_addf(buf, "%s %"PRIuMAX"\n", name, (uintmax_t)oids->nr);
+	for (i = 0; i < oids->nr; i++)
+		strbuf_addf(buf, "%s\n", oid_to_hex(&oids->oid[i]));
+	oid_array_clear(oids);
+}
+
+static void add_object_array_oids(struct oid_array *oids,
+				  const struct object_array *objects)
+{
+	unsigned int i;
+
+	for (i = 0; i < objects->nr; i++)
+		oid_array_append(oids, &objects->objects[i].item->oid);
+}
+
+/*
+ * Compute the cache key of the pack that pack-objects with `args`
+ * makes for this request. Return -1 if it cannot be cached.
+ */
+static int pack_cache_key(struct upload_pack_data *pack_data,
+			  const struct strvec *args, struct object_id *key)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct oid_array oids = OID_ARRAY_INIT;
+	git_hash_ctx ctx;
+	size_t i;
+
+	for (i = 0; i < args->nr; i++)
+		if (strcmp(args->v[i], "--progress"))
+			strbuf_add(&buf, args->v[i], strlen(args->v[i]) + 1);
+	/* An empty line cannot be an argument and ends them. */
+	strbuf_addch(&buf, '\n');
+	if (pack_data->use_include_tag) {
+		struct strbuf generation = STRBUF_INIT;
+
+		if (refs_read_generation(get_main_ref_store(the_repository),
+					 &generation) < 0) {
+			strbuf_release(&generation);
+			strbuf_release(&buf);
+			return -1;
+		}
+		strbuf_addf(&buf, "generation %"PRIuMAX"\n",
+			    (uintmax_t)generation.len);
+		strbuf_addbuf(&buf, &generation);
+		strbuf_release(&generation);
+	}
+
+	if (pack_data->shallow_nr)
+		for_each_commit_graft(collect_shallow, &oids);
+	add_sorted_oids(&buf, "shallow", &oids);
+	add_object_array_oids(&oids, &pack_data->want_obj);
+	add_sorted_oids(&buf, "want", &oids);
+	add_object_array_oids(&oids, &pack_data->have_obj);
+	add_object_array_oids(&oids, &pack_data->extra_edge_obj);
+	add_sorted_oids(&buf, "have", &oids);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, buf.buf, buf.len);
+	the_hash_algo->final_oid_fn(key, &ctx);
+	strbuf_release(&buf);
+	return 0;
+}
+
+struct pack_cache_reader {
+	struct upload_pack_data *pack_data;
+	char *path;
+	char *lock_path;
+	int fd;
+	struct stat st;
+	/* The entry is read through its lockfile while being written. */
+	unsigned in_progress : 1;
+	/* Some of the entry was sent to the client. */
+	unsigned sent : 1;
+};
+
+static int same_file(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+/*
+ * Read up to `len` bytes of the entry. If it is being written, wait
+ * for more data until it is committed or abandoned. Return the number
+ * of bytes read, 0 at the end of a committed entry, and -1 if it was
+ * abandoned or cannot be read.
+ */
+static ssize_t read_pack_cache(struct pack_cache_reader *rd,
+			       void *buf, size_t len)
+{
+	struct upload_pack_data *pack_data = rd->pack_data;
+	time_t last_keepalive = time(NULL);
+
+	for (;;) {
+		ssize_t readsz = xread(rd->fd, buf, len);
+		struct stat st;
+		time_t now;
+
+		if (readsz)
+			return readsz < 0 ? -1 : readsz;
+		if (!rd->in_progress)
+			return 0;
+
+		/*
+		 * Check the lockfile first: by the time it is gone, the entry
+		 * has been committed if it ever will be.
+		 */
+		now = time(NULL);
+		if (lstat(rd->lock_path, &st) || !same_file(&st, &rd->st)) {
+			if (lstat(rd->path, &st) || !same_file(&st, &rd->st))
+				return -1;
+			/* Read what was written before it was committed. */
+			rd->in_progress = 0;
+			continue;
+		}
+		if (st.st_mtime + PACK_CACHE_STALE_SECONDS < now)
+			return -1;
+
+		reset_timeout(pack_data->timeout);
+		if (pack_data->use_sideband && pack_data->keepalive >= 0 &&
+		    now - last_keepalive >= pack_data->keepalive) {
+			static const char keepalive[] = "0005\1";
+			write_or_die(1, keepalive, 5);
+			last_keepalive = now;
+		}
+		sleep_millisec(PACK_CACHE_POLL_MS);
+	}
+}
+
+/*
+ * Open the entry for reading, or its lockfile if `in_progress` is set,
+ * and check its header. Return -1 if there is none or it is invalid.
+ */
+static int open_pack_cache(struct pack_cache_reader *rd, int in_progress)
+{
+	unsigned char header[PACK_CACHE_HEADER_SIZE];
+	const char *path = in_progress ? rd->lock_path : rd->path;
+	size_t got = 0;
+
+	rd->fd = open(path, O_RDONLY);
+	if (rd->fd < 0)
+		return -1;
+	if (fstat(rd->fd, &rd->st) < 0)
+		goto fail;
+	rd->in_progress = in_progress;
+
+	while (got < sizeof(header)) {
+		ssize_t readsz = read_pack_cache(rd, header + got,
+						 sizeof(header) - got);
+		if (readsz <= 0)
+			break;
+		got += readsz;
+	}
+	if (got < sizeof(header) && rd->in_progress)
+		goto fail; /* abandoned early */
+	if (got < sizeof(header) ||
+	    get_be32(header) != PACK_CACHE_SIGNATURE ||
+	    get_be32(header + 4) != PACK_CACHE_VERSION ||
+	    get_be32(header + 8) != oid_version(the_hash_algo) ||
+	    get_be32(header + 12)) {
+		warning(_("ignoring invalid pack cache '%s'"), path);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	close(rd->fd);
+	rd->fd = -1;
+	return -1;
+}
+
+/*
+ * Relay the pack data of the entry to the client. Return 0 once all of
+ * it was relayed, and -1 if the entry was abandoned.
+ */
+static int relay_pack_cache(struct pack_cache_reader *rd,
+			    struct output_state *os, int use_sideband)
+{
+	for (;;) {
+		ssize_t readsz = read_pack_cache(rd, os->buffer + os->used,
+						 sizeof(os->buffer) - os->used);
+		if (readsz < 0)
+			return readsz;
+		os->used += readsz;
+		rd->sent = 1;
+		relay_output(os, use_sideband, 0);
+		if (!readsz)
+			return 0;
+	}
+}
+
+enum pack_cache_lookup {
+	PACK_CACHE_NONE,
+	PACK_CACHE_READ,
+	PACK_CACHE_WRITE,
+};
+
+/*
+ * Find the entry for `key` and set up `rd` to read it, whether it is
+ * committed or still being written. If there is none, take the lock in
+ * `lk` to write it.
+ */
+static enum pack_cache_lookup lookup_pack_cache(struct pack_cache_reader *rd,
+						struct lock_file *lk,
+						const struct object_id *key)
+{
+	unsigned char header[PACK_CACHE_HEADER_SIZE];
+	int tries;
+
+	rd->path = repo_git_path(the_repository, "upload-pack-cache/%s",
+				 oid_to_hex(key));
+	rd->lock_path = xstrfmt("%s%s", rd->path, LOCK_SUFFIX);
+	if (safe_create_leading_directories(rd->path) < 0)
+		return PACK_CACHE_NONE;
+
+	/*
+	 * The entry may come and go between these steps, but we give up
+	 * after a few rounds and simply do without the cache.
+	 */
+	for (tries = 0; tries < 3; tries++) {
+		if (!open_pack_cache(rd, 0)) {
+			utime(rd->path, NULL);
+			return PACK_CACHE_READ;
+		}
+		if (hold_lock_file_for_update(lk, rd->path, 0) >= 0)
+			break;
+		if (errno != EEXIST)
+			return PACK_CACHE_NONE;
+		if (!open_pack_cache(rd, 1))
+			return PACK_CACHE_READ;
+	}
+	if (!is_lock_file_locked(lk))
+		return PACK_CACHE_NONE;
+
+	put_be32(header, PACK_CACHE_SIGNATURE);
+	put_be32(header + 4, PACK_CACHE_VERSION);
+	put_be32(header + 8, oid_version(the_hash_algo));
+	put_be32(header + 12, 0);
+	if (adjust_shared_perm(get_lock_file_path(lk)) < 0 ||
+	    write_in_full(get_lock_file_fd(lk), header, sizeof(header)) < 0) {
+		rollback_lock_file(lk);
+		return PACK_CACHE_NONE;
+	}
+	return PACK_CACHE_WRITE;
+}
+
+struct pack_cache_entry {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static int pack_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_cache_entry *a = va, *b = vb;
+
+	/* most recently used first */
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Remove the entries last used before uploadpack.packCacheExpire, and
+ * then the least recently used ones until the rest fit in
+ * uploadpack.packCacheMaxSize. Leftover lockfiles are removed once they
+ * expire, too.
+ */
+static void prune_pack_cache(struct upload_pack_data *pack_data)
+{
+	struct pack_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	struct strbuf path = STRBUF_INIT;
+	uintmax_t total = 0;
+	struct dirent *de;
+	size_t baselen;
+	DIR *dir;
+
+	strbuf_repo_git_path(&path, the_repository, "upload-pack-cache/");
+	dir = opendir(path.buf);
+	if (!dir)
+		goto cleanup;
+	baselen = path.len;
+
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		struct stat st;
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (st.st_mtime <= pack_data->pack_cache_expire) {
+			unlink_or_warn(path.buf);
+			continue;
+		}
+		if (ends_with(de->d_name, LOCK_SUFFIX))
+			continue;
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = xstrdup(path.buf);
+		entries[nr].size = st.st_size;
+		entries[nr].mtime = st.st_mtime;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entries, nr, pack_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		total += entries[i].size;
+		if (pack_data->pack_cache_max_size &&
+		    total > pack_data->pack_cache_max_size)
+			unlink_or_warn(entries[i].path);
+		free(entries[i].path);
+	}
+	free(entries);
+
+cleanup:
+	strbuf_release(&path);
+}
+
 static void create_pack_file(struct upload_pack_data *pack_data,
 			     const struct string_list *uri_protocols)
 {
@@ -292,6 +702,9 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	char progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
+	struct pack_cache_reader cache_reader = { .pack_data = pack_data };
+	struct lock_file cache_lock = LOCK_INIT;
+	struct object_id cache_key;
 	ssize_t sz;
 	int i;
 	FILE *pipe_fd;
@@ -333,6 +746,36 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 					 uri_protocols->items[i].string);
 	}
 
+	if (pack_data->use_pack_cache && !pack_data->pack_objects_hook &&
+	    !uri_protocols &&
+	    !pack_cache_key(pack_data, &pack_objects.args, &cache_key)) {
+		switch (lookup_pack_cache(&cache_reader, &cache_lock,
+					  &cache_key)) {
+		case PACK_CACHE_READ:
+			trace2_data_string("upload-pack", the_repository,
+					   "pack-cache", cache_reader.in_progress ?
+					   "follow" : "hit");
+			sz = relay_pack_cache(&cache_reader, output_state,
+					      pack_data->use_sideband);
+			close(cache_reader.fd);
+			if (!sz) {
+				child_process_clear(&pack_objects);
+				goto done;
+			}
+			if (cache_reader.sent)
+				goto fail;
+			/* Abandoned before sending anything; pack ourselves. */
+			break;
+		case PACK_CACHE_WRITE:
+			trace2_data_string("upload-pack", the_repository,
+					   "pack-cache", "write");
+			output_state->pack_cache = &cache_lock;
+			break;
+		case PACK_CACHE_NONE:
+			break;
+		}
+	}
+
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
@@ -456,6 +899,13 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		goto fail;
 	}
 
+	if (output_state->pack_cache) {
+		if (commit_lock_file(output_state->pack_cache) < 0)
+			rollback_lock_file(output_state->pack_cache);
+		prune_pack_cache(pack_data);
+	}
+
+ done:
 	/* flush the data */
 	if (output_state->used > 0) {
 		send_client_data(1, output_state->buffer, output_state->used,
@@ -463,24 +913,48 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		fprintf(stderr, "flushed.\n");
 	}
 	free(output_state);
+	free(cache_reader.path);
+	free(cache_reader.lock_path);
 	if (pack_data->use_sideband)
 		packet_flush(1);
 	return;
 
  fail:
+	if (output_state->pack_cache)
+		rollback_lock_file(output_state->pack_cache);
 	free(output_state);
+	free(cache_reader.path);
+	free(cache_reader.lock_path);
 	send_client_data(3, abort_msg, sizeof(abort_msg),
 			 pack_data->use_sideband);
 	die("git upload-pack: %s", abort_msg);
 }
 
-static int do_got_oid(struct upload_pack_data *data, const struct object_id *oid)
+/*
+ * Look up a have that we know to exist. Commits in the commit-graph are
+ * taken from there, and other objects are parsed without checking
+ * their hash, as clients with many references send lots of haves.
+ */
+static struct object *lookup_have(const struct object_id *oid)
 {
-	int we_knew_they_have = 0;
-	struct object *o = parse_object(the_repository, oid);
+	struct commit *commit = lookup_commit_in_graph(the_repository, oid);
+	struct object *o;
 
+	if (commit)
+		return &commit->object;
+	o = parse_object_with_flags(the_repository, oid,
+				    PARSE_OBJECT_SKIP_HASH_CHECK);
 	if (!o)
 		die("oops (%s)", oid_to_hex(oid));
+	return o;
+}
+
+static int do_got_oid(struct upload_pack_data *data, const struct object_id *oid)
+{
+	int we_knew_they_have = 0;
+	struct object *o = lookup_have(oid);
+
+	data->haves_marked++;
 	if (o->type == OBJ_COMMIT) {
 		struct commit_list *parents;
 		struct commit *commit = (struct commit *)o;
@@ -502,17 +976,46 @@ static int do_got_oid(struct upload_pack_data *data, const struct object_id *oid
 	return 0;
 }
 
+static int have_object(const struct object_id *oid)
+{
+	return lookup_commit_in_graph(the_repository, oid) ||
+	       repo_has_object_file_with_flags(the_repository, oid,
+					       OBJECT_INFO_QUICK |
+					       OBJECT_INFO_SKIP_FETCH_OBJECT);
+}
+
 static int got_oid(struct upload_pack_data *data,
 		   const char *hex, struct object_id *oid)
 {
 	if (get_oid_hex(hex, oid))
 		die("git upload-pack: expected SHA1 object, got '%s'", hex);
-	if (!repo_has_object_file_with_flags(the_repository, oid,
-					     OBJECT_INFO_QUICK | OBJECT_INFO_SKIP_FETCH_OBJECT))
+	if (!have_object(oid))
 		return -1;
 	return do_got_oid(data, oid);
 }
 
+/*
+ * Whether negotiation used up its budget of haves or time, given by
+ * uploadpack.negotiationMaxHaves and uploadpack.negotiationMaxTime.
+ * After that, further haves are ignored and we are ready to send a
+ * pack based on the common commits found so far.
+ */
+static int negotiation_exhausted(struct upload_pack_data *data)
+{
+	if (data->negotiation_exhausted)
+		return 1;
+	if ((data->negotiation_max_haves &&
+	     data->negotiation_haves >= data->negotiation_max_haves) ||
+	    (data->negotiation_max_time &&
+	     data->negotiation_ns / 1000000 >= data->negotiation_max_time)) {
+		data->negotiation_exhausted = 1;
+		trace2_data_intmax("upload-pack", the_repository,
+				   "negotiation-exhausted",
+				   data->negotiation_haves);
+	}
+	return data->negotiation_exhausted;
+}
+
 static int ok_to_give_up(struct upload_pack_data *data)
 {
 	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
@@ -520,9 +1023,19 @@ static int ok_to_give_up(struct upload_pack_data *data)
 	if (!data->have_obj.nr)
 		return 0;
 
-	return can_all_from_reach_with_flag(&data->want_obj, THEY_HAVE,
-					    COMMON_KNOWN, data->oldest_have,
-					    min_generation);
+	/*
+	 * The answer only changes as haves are marked, so do not walk
+	 * again for each of the haves that we do not have. As there is a
+	 * have in have_obj, haves_marked is not zero at the first call.
+	 */
+	if (data->give_up_marked == data->haves_marked)
+		return 0;
+	if (can_all_from_reach_with_flag(&data->want_obj, THEY_HAVE,
+					 COMMON_KNOWN, data->oldest_have,
+					 min_generation))
+		return 1;
+	data->give_up_marked = data->haves_marked;
+	return 0;
 }
 
 static int get_common_commits(struct upload_pack_data *data,
@@ -543,9 +1056,9 @@ static int get_common_commits(struct upload_pack_data *data,
 
 		if (packet_reader_read(reader) != PACKET_READ_NORMAL) {
 			if (data->multi_ack == MULTI_ACK_DETAILED
-			    && got_common
-			    && !got_other
-			    && ok_to_give_up(data)) {
+			    && ((got_common && !got_other && ok_to_give_up(data)) ||
+				(negotiation_exhausted(data) &&
+				 data->have_obj.nr))) {
 				sent_ready = 1;
 				packet_write_fmt(1, "ACK %s ready\n", last_hex);
 			}
@@ -563,6 +1076,12 @@ static int get_common_commits(struct upload_pack_data *data,
 			continue;
 		}
 		if (skip_prefix(reader->line, "have ", &arg)) {
+			uint64_t start;
+
+			if (negotiation_exhausted(data))
+				continue;
+			data->negotiation_haves++;
+			start = getnanotime();
 			switch (got_oid(data, arg, &oid)) {
 			case -1: /* they have what we do not */
 				got_other = 1;
@@ -587,6 +1106,7 @@ static int get_common_commits(struct upload_pack_data *data,
 					packet_write_fmt(1, "ACK %s\n", last_hex);
 				break;
 			}
+			data->negotiation_ns += getnanotime() - start;
 			continue;
 		}
 		if (!strcmp(reader->line, "done")) {
@@ -861,10 +1381,24 @@ static void send_unshallow(struct upload_pack_data *data)
 	}
 }
 
+/*
+ * The walks that find the new shallow boundary take parents and commit
+ * dates from the commit-graph without parsing any commit objects. But
+ * the commit-graph does not know about the shallow commits of the
+ * client that an earlier request in this process registered as grafts,
+ * so they must do without it once there are any.
+ */
+static void prepare_shallow_walk(void)
+{
+	if (the_repository->parsed_objects->grafts_nr)
+		disable_commit_graph(the_repository);
+}
+
 static int check_ref(const char *refname_full, const struct object_id *oid,
 		     int flag, void *cb_data);
 static void deepen(struct upload_pack_data *data, int depth)
 {
+	prepare_shallow_walk();
 	if (depth == INFINITE_DEPTH && !is_repository_shallow(the_repository)) {
 		int i;
 
@@ -908,7 +1442,7 @@ static void deepen_by_rev_list(struct upload_pack_data *data,
 {
 	struct commit_list *result;
 
-	disable_commit_graph(the_repository);
+	prepare_shallow_walk();
 	result = get_shallow_commits_by_rev_list(ac, av, SHALLOW, NOT_SHALLOW);
 	send_shallow(data, result);
 	free_commit_list(result);
@@ -1368,6 +1902,20 @@ static int upload_pack_config(const char *var, const char *value,
 		data->allow_ref_in_want = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowsidebandall", var)) {
 		data->allow_sideband_all = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.negotiationmaxhaves", var)) {
+		data->negotiation_max_haves = git_config_ulong(var, value,
+							       ctx->kvi);
+	} else if (!strcmp("uploadpack.negotiationmaxtime", var)) {
+		data->negotiation_max_time = git_config_ulong(var, value,
+							      ctx->kvi);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		data->use_pack_cache = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxsize", var)) {
+		data->pack_cache_max_size = git_config_ulong(var, value,
+							     ctx->kvi);
+	} else if (!strcmp("uploadpack.packcacheexpire", var)) {
+		if (git_config_expiry_date(&data->pack_cache_expire, var, value))
+			return -1;
 	} else if (!strcmp("core.precomposeunicode", var)) {
 		precomposed_unicode = git_config_bool(var, value);
 	} else if (!strcmp("transfer.advertisesid", var)) {
@@ -1675,16 +2223,16 @@ static int process_haves(struct upload_pack_data *data, struct oid_array *common
 	int i;
 
 	/* Process haves */
-	for (i = 0; i < data->haves.nr; i++) {
+	for (i = 0; i < data->haves.nr && !negotiation_exhausted(data); i++) {
 		const struct object_id *oid = &data->haves.oid[i];
+		uint64_t start = getnanotime();
 
-		if (!repo_has_object_file_with_flags(the_repository, oid,
-						     OBJECT_INFO_QUICK | OBJECT_INFO_SKIP_FETCH_OBJECT))
-			continue;
-
-		oid_array_append(common, oid);
-
-		do_got_oid(data, oid);
+		data->negotiation_haves++;
+		if (have_object(oid)) {
+			oid_array_append(common, oid);
+			do_got_oid(data, oid);
+		}
+		data->negotiation_ns += getnanotime() - start;
 	}
 
 	return 0;
@@ -1705,7 +2253,8 @@ static int send_acks(struct upload_pack_data *data, struct oid_array *acks)
 				    oid_to_hex(&acks->oid[i]));
 	}
 
-	if (!data->wait_for_done && ok_to_give_up(data)) {
+	if (!data->wait_for_done &&
+	    (negotiation_exhausted(data) || ok_to_give_up(data))) {
 		/* Send Ready */
 		packet_writer_write(&data->writer, "ready\n");
 		return 1;
@@ -1767,7 +2316,7 @@ static void send_shallow_info(struct upload_pack_data *data)
 	    is_repository_shallow(the_repository))
 		deepen(data, INFINITE_DEPTH);
 
-	packet_delim(1);
+	packet_writer_delim(&data->writer);
 }
 
 enum fetch_state {
@@ -1786,6 +2335,11 @@ int upload_pack_v2(struct repository *r UNUSED, struct packet_reader *request)
 
 	upload_pack_data_init(&data);
 	data.use_sideband = LARGE_PACKET_MAX;
+	/*
+	 * The sections before the packfile go out together, in one write
+	 * for each flush-pkt or in one with the start of the pack.
+	 */
+	data.writer.buffered = 1;
 	get_upload_pack_config(&data);
 
 	while (state != FETCH_DONE) {
@@ -1826,9 +2380,11 @@ int upload_pack_v2(struct repository *r UNUSED, struct packet_reader *request)
 			send_shallow_info(&data);
 
 			if (data.uri_protocols.nr) {
+				packet_writer_send(&data.writer);
 				create_pack_file(&data, &data.uri_protocols);
 			} else {
 				packet_writer_write(&data.writer, "packfile\n");
+				packet_writer_send(&data.writer);
 				create_pack_file(&data, NULL);
 			}
 			state = FETCH_DONE;
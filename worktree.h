@@ -33,6 +33,13 @@ struct worktree **get_worktrees(void);
  */
 int submodule_uses_worktrees(const char *path);
 
+/*
+ * Construct a struct worktree corresponding to the linked worktree
+ * "id", or NULL if it does not exist. The caller frees it with
+ * free_worktree().
+ */
+struct worktree *get_linked_worktree(const char *id);
+
 /*
  * Return git dir of the worktree. Note that the path may be relative.
  * If wt is NULL, git dir of current worktree is returned.
@@ -138,6 +145,7 @@ void repair_worktree_at_path(const char *, worktree_repair_fn, void *cb_data);
  * Free up the memory for worktree(s)
  */
 void free_worktrees(struct worktree **);
+void free_worktree(struct worktree *);
 
 /*
  * Check if a per-worktree symref points to a ref in the main worktree
@@ -88,6 +88,15 @@ typedef struct s_xpparam {
 	/* See Documentation/diff-options.txt. */
 	char **anchors;
 	size_t anchors_nr;
+
+	/*
+	 * If positive, how many diagonals the Myers algorithm may visit in
+	 * total while looking for the best splits; once they are spent,
+	 * the rest of the diff is computed with a cheap cut-off that takes
+	 * linear time, and *max_cost_exceeded is set, unless it is NULL.
+	 */
+	long max_cost;
+	int *max_cost_exceeded;
 } xpparam_t;
 
 typedef struct s_xdemitcb {
@@ -27,6 +27,7 @@
 #define XDL_LINE_MAX (long)((1UL << (CHAR_BIT * sizeof(long) - 1)) - 1)
 #define XDL_SNAKE_CNT 20
 #define XDL_K_HEUR 4
+#define XDL_OUT_OF_COST_MAX 16
 
 typedef struct s_xdpsplit {
 	long i1, i2;
@@ -52,6 +53,7 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 	long fmin = fmid, fmax = fmid;
 	long bmin = bmid, bmax = bmid;
 	long ec, d, i1, i2, prev1, best, dd, v, k;
+	int out_of_cost;
 
 	/*
 	 * Set initial diagonal values for both forward and backward path.
@@ -136,7 +138,16 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 			}
 		}
 
-		if (need_min)
+		/*
+		 * Once the cost given by the caller has been spent, each split
+		 * may only cost a small constant, so that the rest of the diff
+		 * takes linear time, at the expense of its quality.
+		 */
+		if (xenv->limit_cost && xenv->cost_left > 0)
+			xenv->cost_left -= (fmax - fmin) / 2 + (bmax - bmin) / 2 + 2;
+		out_of_cost = xenv->limit_cost && xenv->cost_left <= 0;
+
+		if (need_min && !out_of_cost)
 			continue;
 
 		/*
@@ -204,7 +215,7 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 		 * collect the furthest reaching path using the (i1 + i2)
 		 * measure.
 		 */
-		if (ec >= xenv->mxcost) {
+		if (ec >= (out_of_cost ? XDL_OUT_OF_COST_MAX : xenv->mxcost)) {
 			long fbest, fbest1, bbest, bbest1;
 
 			fbest = fbest1 = -1;
@@ -352,6 +363,8 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		xenv.mxcost = XDL_MAX_COST_MIN;
 	xenv.snake_cnt = XDL_SNAKE_CNT;
 	xenv.heur_min = XDL_HEUR_MIN_COST;
+	xenv.limit_cost = xpp->max_cost > 0;
+	xenv.cost_left = xpp->max_cost;
 
 	dd1.nrec = xe->xdf1.nreff;
 	dd1.ha = xe->xdf1.ha;
@@ -365,6 +378,8 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	res = xdl_recs_cmp(&dd1, 0, dd1.nrec, &dd2, 0, dd2.nrec,
 			   kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0,
 			   &xenv);
+	if (xenv.limit_cost && xenv.cost_left <= 0 && xpp->max_cost_exceeded)
+		*xpp->max_cost_exceeded = 1;
 	xdl_free(kvd);
  out:
 	if (res < 0)
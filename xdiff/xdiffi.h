@@ -35,6 +35,9 @@ typedef struct s_xdalgoenv {
 	long mxcost;
 	long snake_cnt;
 	long heur_min;
+	/* diagonals left to visit, when limited by xpparam_t.max_cost */
+	int limit_cost;
+	long cost_left;
 } xdalgoenv_t;
 
 typedef struct s_xdchange {
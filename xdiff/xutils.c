@@ -294,20 +294,46 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 	return ha;
 }
 
-unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
+/*
+ * Without whitespace flags, the bytes of a record are hashed eight at a
+ * time, after memchr() has found where it ends. The words are read in
+ * the byte order of the machine, so the hash differs between machines,
+ * but it is never stored anywhere.
+ */
+#define XDL_HASH_MUL UINT64_C(0x9e3779b97f4a7c15)
+
+static unsigned long xdl_hash_record_verbatim(char const **data,
+		char const *top) {
 	char const *ptr = *data;
+	char const *eol = memchr(ptr, '\n', top - ptr);
+	size_t len = (eol ? eol : top) - ptr;
+	uint64_t ha = len, w;
 
-	if (flags & XDF_WHITESPACE_FLAGS)
-		return xdl_hash_record_with_whitespace(data, top, flags);
+	*data = eol ? eol + 1 : top;
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+	for (; len >= sizeof(w); ptr += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, ptr, sizeof(w));
+		ha = (ha ^ w) * XDL_HASH_MUL;
+		ha ^= ha >> 32;
+	}
+	if (len) {
+		w = 0;
+		memcpy(&w, ptr, len);
+		ha = (ha ^ w) * XDL_HASH_MUL;
 	}
-	*data = ptr < top ? ptr + 1: ptr;
 
-	return ha;
+	/* XDL_HASHLONG() uses the low bits; mix the high ones into them. */
+	ha ^= ha >> 29;
+	ha *= XDL_HASH_MUL;
+	ha ^= ha >> 32;
+
+	return (unsigned long) ha;
+}
+
+unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
+	if (flags & XDF_WHITESPACE_FLAGS)
+		return xdl_hash_record_with_whitespace(data, top, flags);
+	return xdl_hash_record_verbatim(data, top);
 }
 
 unsigned int xdl_hashbits(unsigned int size) {